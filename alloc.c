@@ -30,12 +30,21 @@ struct alloc_state {
 	int count; /* total number of nodes allocated */
 	int nr;    /* number of nodes left in current allocation */
 	void *p;   /* first free node in current allocation */
+	int merged; /* how many of "count" came from arenas */
 
 	/* bookkeeping of allocations */
 	void **slabs;
 	int slab_nr, slab_alloc;
 };
 
+struct alloc_arena {
+	struct alloc_state blob_state;
+	struct alloc_state tree_state;
+	struct alloc_state commit_state;
+	struct alloc_state tag_state;
+	struct alloc_state object_state;
+};
+
 void *allocate_alloc_state(void)
 {
 	return xcalloc(1, sizeof(struct alloc_state));
@@ -71,34 +80,62 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 	return ret;
 }
 
-void *alloc_blob_node(struct repository *r)
+static void *init_blob_node(struct blob *b)
 {
-	struct blob *b = alloc_node(r->parsed_objects->blob_state, sizeof(struct blob));
 	b->object.type = OBJ_BLOB;
 	return b;
 }
 
-void *alloc_tree_node(struct repository *r)
+static void *init_tree_node(struct tree *t)
 {
-	struct tree *t = alloc_node(r->parsed_objects->tree_state, sizeof(struct tree));
 	t->object.type = OBJ_TREE;
 	return t;
 }
 
-void *alloc_tag_node(struct repository *r)
+static void *init_tag_node(struct tag *t)
 {
-	struct tag *t = alloc_node(r->parsed_objects->tag_state, sizeof(struct tag));
 	t->object.type = OBJ_TAG;
 	return t;
 }
 
-void *alloc_object_node(struct repository *r)
+static void *init_object_node(struct object *obj)
 {
-	struct object *obj = alloc_node(r->parsed_objects->object_state, sizeof(union any_object));
 	obj->type = OBJ_NONE;
 	return obj;
 }
 
+static void *init_commit_node(struct commit *c)
+{
+	c->object.type = OBJ_COMMIT;
+	c->graph_pos = COMMIT_NOT_FROM_GRAPH;
+	c->generation = GENERATION_NUMBER_INFINITY;
+	return c;
+}
+
+void *alloc_blob_node(struct repository *r)
+{
+	return init_blob_node(alloc_node(r->parsed_objects->blob_state,
+					 sizeof(struct blob)));
+}
+
+void *alloc_tree_node(struct repository *r)
+{
+	return init_tree_node(alloc_node(r->parsed_objects->tree_state,
+					 sizeof(struct tree)));
+}
+
+void *alloc_tag_node(struct repository *r)
+{
+	return init_tag_node(alloc_node(r->parsed_objects->tag_state,
+					sizeof(struct tag)));
+}
+
+void *alloc_object_node(struct repository *r)
+{
+	return init_object_node(alloc_node(r->parsed_objects->object_state,
+					   sizeof(union any_object)));
+}
+
 unsigned int alloc_commit_index(struct repository *r)
 {
 	return r->parsed_objects->commit_count++;
@@ -106,23 +143,97 @@ unsigned int alloc_commit_index(struct repository *r)
 
 void *alloc_commit_node(struct repository *r)
 {
-	struct commit *c = alloc_node(r->parsed_objects->commit_state, sizeof(struct commit));
-	c->object.type = OBJ_COMMIT;
+	struct commit *c = init_commit_node(alloc_node(r->parsed_objects->commit_state,
+						       sizeof(struct commit)));
 	c->index = alloc_commit_index(r);
-	c->graph_pos = COMMIT_NOT_FROM_GRAPH;
-	c->generation = GENERATION_NUMBER_INFINITY;
 	return c;
 }
 
-static void report(const char *name, unsigned int count, size_t size)
+struct alloc_arena *alloc_arena_new(void)
+{
+	return xcalloc(1, sizeof(struct alloc_arena));
+}
+
+void *alloc_arena_blob_node(struct alloc_arena *a)
+{
+	return init_blob_node(alloc_node(&a->blob_state, sizeof(struct blob)));
+}
+
+void *alloc_arena_tree_node(struct alloc_arena *a)
+{
+	return init_tree_node(alloc_node(&a->tree_state, sizeof(struct tree)));
+}
+
+void *alloc_arena_tag_node(struct alloc_arena *a)
+{
+	return init_tag_node(alloc_node(&a->tag_state, sizeof(struct tag)));
+}
+
+void *alloc_arena_object_node(struct alloc_arena *a)
+{
+	return init_object_node(alloc_node(&a->object_state,
+					   sizeof(union any_object)));
+}
+
+void *alloc_arena_commit_node(struct alloc_arena *a)
+{
+	return init_commit_node(alloc_node(&a->commit_state,
+					   sizeof(struct commit)));
+}
+
+/*
+ * Hand the slabs of "src" over to "dst", which frees them in
+ * clear_alloc_state().  What is left of the last slab of "src" is
+ * not reused.
+ */
+static void merge_alloc_state(struct alloc_state *dst, struct alloc_state *src)
+{
+	ALLOC_GROW(dst->slabs, dst->slab_nr + src->slab_nr, dst->slab_alloc);
+	COPY_ARRAY(dst->slabs + dst->slab_nr, src->slabs, src->slab_nr);
+	dst->slab_nr += src->slab_nr;
+	dst->count += src->count;
+	dst->merged += src->count;
+
+	free(src->slabs);
+	memset(src, 0, sizeof(*src));
+}
+
+void alloc_arena_merge(struct repository *r, struct alloc_arena *a)
+{
+	struct alloc_state *s = &a->commit_state;
+	int i, j;
+
+	/* commits allocated in the arena get their index only now */
+	for (i = 0; i < s->slab_nr; i++) {
+		struct commit *c = s->slabs[i];
+		int nr = i == s->slab_nr - 1 ? BLOCKING - s->nr : BLOCKING;
+
+		for (j = 0; j < nr; j++)
+			c[j].index = alloc_commit_index(r);
+	}
+
+	merge_alloc_state(r->parsed_objects->blob_state, &a->blob_state);
+	merge_alloc_state(r->parsed_objects->tree_state, &a->tree_state);
+	merge_alloc_state(r->parsed_objects->commit_state, &a->commit_state);
+	merge_alloc_state(r->parsed_objects->tag_state, &a->tag_state);
+	merge_alloc_state(r->parsed_objects->object_state, &a->object_state);
+	free(a);
+}
+
+static void report(const char *name, unsigned int count, size_t size,
+		   unsigned int merged)
 {
-	fprintf(stderr, "%10s: %8u (%"PRIuMAX" kB)\n",
+	fprintf(stderr, "%10s: %8u (%"PRIuMAX" kB)",
 			name, count, (uintmax_t) size);
+	if (merged)
+		fprintf(stderr, ", %u from arenas", merged);
+	fputc('\n', stderr);
 }
 
 #define REPORT(name, type)	\
     report(#name, r->parsed_objects->name##_state->count, \
-		  r->parsed_objects->name##_state->count * sizeof(type) >> 10)
+		  r->parsed_objects->name##_state->count * sizeof(type) >> 10, \
+		  r->parsed_objects->name##_state->merged)
 
 void alloc_report(struct repository *r)
 {
@@ -13,6 +13,27 @@ void *alloc_object_node(struct repository *r);
 void alloc_report(struct repository *r);
 unsigned int alloc_commit_index(struct repository *r);
 
+/*
+ * An arena lets a thread allocate object nodes without touching the
+ * repository's parsed_object_pool, and so without any lock.  Each
+ * thread uses an arena of its own.  Once the thread is done, with
+ * the lock held, alloc_arena_merge() hands the nodes over to the
+ * pool, which then owns (and eventually frees) them, and frees the
+ * arena.
+ *
+ * Putting the objects in the object hash is still up to the caller.
+ * Commits from an arena do not have their "index" until they are
+ * merged, so they cannot be used with commit slabs before that.
+ */
+struct alloc_arena;
+struct alloc_arena *alloc_arena_new(void);
+void *alloc_arena_blob_node(struct alloc_arena *a);
+void *alloc_arena_tree_node(struct alloc_arena *a);
+void *alloc_arena_commit_node(struct alloc_arena *a);
+void *alloc_arena_tag_node(struct alloc_arena *a);
+void *alloc_arena_object_node(struct alloc_arena *a);
+void alloc_arena_merge(struct repository *r, struct alloc_arena *a);
+
 void *allocate_alloc_state(void);
 void clear_alloc_state(struct alloc_state *s);
 
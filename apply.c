@@ -21,11 +21,15 @@
 #include "quote.h"
 #include "rerere.h"
 #include "apply.h"
+#include "thread-utils.h"
+
+static int apply_default_threads;
 
 static void git_apply_config(void)
 {
 	git_config_get_string_const("apply.whitespace", &apply_default_whitespace);
 	git_config_get_string_const("apply.ignorewhitespace", &apply_default_ignorewhitespace);
+	git_config_get_int("apply.threads", &apply_default_threads);
 	git_config(git_default_config, NULL);
 }
 
@@ -94,6 +98,7 @@ int init_apply_state(struct apply_state *state,
 	strbuf_init(&state->root, 0);
 
 	git_apply_config();
+	state->nr_threads = apply_default_threads;
 	if (apply_default_whitespace && parse_whitespace_option(state, apply_default_whitespace))
 		return -1;
 	if (apply_default_ignorewhitespace && parse_ignorewhitespace_option(state, apply_default_ignorewhitespace))
@@ -218,6 +223,7 @@ struct patch {
 	unsigned int conflicted_threeway:1;
 	unsigned int direct_to_threeway:1;
 	unsigned int crlf_in_old:1;
+	unsigned int applied_ahead:1; /* see apply_patches_ahead() */
 	struct fragment *fragments;
 	char *result;
 	size_t resultsize;
@@ -3065,11 +3071,13 @@ static int apply_one_fragment(struct apply_state *state,
 		 * Warn if it was necessary to reduce the number
 		 * of context lines.
 		 */
-		if ((leading != frag->leading ||
-		     trailing != frag->trailing) && state->apply_verbosity > verbosity_silent)
-			fprintf_ln(stderr, _("Context reduced to (%ld/%ld)"
-					     " to apply fragment at %d"),
-				   leading, trailing, applied_pos+1);
+		if (leading != frag->leading || trailing != frag->trailing) {
+			state->reduced_context++;
+			if (state->apply_verbosity > verbosity_silent)
+				fprintf_ln(stderr, _("Context reduced to (%ld/%ld)"
+						     " to apply fragment at %d"),
+					   leading, trailing, applied_pos+1);
+		}
 		update_image(state, img, applied_pos, &preimage, &postimage);
 	} else {
 		if (state->apply_verbosity > verbosity_normal)
@@ -3625,19 +3633,21 @@ static int apply_data(struct apply_state *state, struct patch *patch,
 {
 	struct image image;
 
-	if (load_preimage(state, &image, patch, st, ce) < 0)
-		return -1;
-
-	if (patch->direct_to_threeway ||
-	    apply_fragments(state, &image, patch) < 0) {
-		/* Note: with --reject, apply_fragments() returns 0 */
-		if (!state->threeway || try_threeway(state, &image, patch, st, ce) < 0)
+	if (!patch->applied_ahead) {
+		if (load_preimage(state, &image, patch, st, ce) < 0)
 			return -1;
+
+		if (patch->direct_to_threeway ||
+		    apply_fragments(state, &image, patch) < 0) {
+			/* Note: with --reject, apply_fragments() returns 0 */
+			if (!state->threeway || try_threeway(state, &image, patch, st, ce) < 0)
+				return -1;
+		}
+		patch->result = image.buf;
+		patch->resultsize = image.len;
+		free(image.line_allocated);
 	}
-	patch->result = image.buf;
-	patch->resultsize = image.len;
 	add_to_fn_table(state, patch);
-	free(image.line_allocated);
 
 	if (0 < patch->is_delete && patch->resultsize)
 		return error(_("removal patch leaves file contents"));
@@ -3979,12 +3989,206 @@ static int check_patch(struct apply_state *state, struct patch *patch)
 	return 0;
 }
 
+#ifndef NO_PTHREADS
+
+/*
+ * A patch that changes a single regular file in place, a file that no
+ * other patch reads or writes, can be applied on its own. Give every
+ * thread at least APPLY_AHEAD_COST of them.
+ */
+#define APPLY_AHEAD_COST 16
+
+struct apply_ahead {
+	struct patch *patch;
+	const struct cache_entry *ce; /* the preimage in the index, or */
+	struct strbuf buf; /* the preimage read from the working tree */
+};
+
+struct apply_ahead_thread {
+	pthread_t pthread;
+	const struct apply_state *state;
+	struct apply_ahead *ahead;
+	int first, step, nr;
+};
+
+/*
+ * Apply the fragments of one patch, and keep the result only if
+ * nothing happened that check_patch() would have had to tell about: no
+ * fragment failed or needed a shorter context, and no whitespace was
+ * complained about or fixed. The other patches are applied again, in
+ * order.
+ */
+static void apply_one_ahead(const struct apply_state *state,
+			    struct apply_ahead *a)
+{
+	struct apply_state quiet = *state;
+	struct patch *patch = a->patch;
+	struct fragment *frag;
+	struct image image;
+	size_t len;
+	char *buf;
+	int nth = 0;
+
+	if (a->ce && read_file_or_gitlink(a->ce, &a->buf))
+		return;
+	buf = strbuf_detach(&a->buf, &len);
+	prepare_image(&image, buf, len, 1);
+
+	quiet.apply_verbosity = verbosity_silent;
+	for (frag = patch->fragments; frag; frag = frag->next)
+		if (apply_one_fragment(&quiet, &image, frag,
+				       patch->inaccurate_eof, patch->ws_rule,
+				       ++nth))
+			break;
+	if (frag ||
+	    quiet.whitespace_error != state->whitespace_error ||
+	    quiet.applied_after_fixing_ws != state->applied_after_fixing_ws ||
+	    quiet.reduced_context != state->reduced_context ||
+	    quiet.apply != state->apply) {
+		clear_image(&image);
+		return;
+	}
+	patch->result = image.buf;
+	patch->resultsize = image.len;
+	patch->applied_ahead = 1;
+	free(image.line_allocated);
+}
+
+static void *apply_ahead_thread(void *data)
+{
+	struct apply_ahead_thread *t = data;
+	int i;
+
+	for (i = t->first; i < t->nr; i += t->step)
+		apply_one_ahead(t->state, &t->ahead[i]);
+	return NULL;
+}
+
+/*
+ * If "patch" can be applied ahead, find its preimage where
+ * load_preimage() would, and return 1.
+ */
+static int prepare_ahead(struct apply_state *state, struct apply_ahead *a,
+			 struct patch *patch)
+{
+	const char *name = patch->old_name;
+	struct stat st;
+
+	if (patch->is_binary || !patch->fragments ||
+	    !name || !patch->new_name || strcmp(name, patch->new_name) ||
+	    patch->is_rename || patch->is_copy ||
+	    patch->is_new > 0 || patch->is_delete > 0)
+		return 0;
+
+	memset(a, 0, sizeof(*a));
+	a->patch = patch;
+	strbuf_init(&a->buf, 0);
+	if (state->cached || state->check_index) {
+		int pos = cache_name_pos(name, strlen(name));
+
+		if (pos < 0 || !S_ISREG(active_cache[pos]->ce_mode))
+			return 0;
+		a->ce = active_cache[pos];
+		return 1;
+	}
+	if (lstat(name, &st) || !S_ISREG(st.st_mode) ||
+	    has_symlink_leading_path(name, strlen(name)))
+		return 0;
+	if (read_old_data(&st, patch, name, &a->buf)) {
+		strbuf_release(&a->buf);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Apply with threads the patches that do not depend on the others, for
+ * check_patch() to take their results instead of applying them itself.
+ * The preimages in the working tree are read beforehand, as converting
+ * them with convert_to_git() is not thread-safe.
+ */
+static void apply_patches_ahead(struct apply_state *state, struct patch *list)
+{
+	struct string_list names = STRING_LIST_INIT_NODUP;
+	struct apply_ahead *ahead;
+	struct apply_ahead_thread *threads;
+	struct patch *patch;
+	int i, nr = 0, nr_patches = 0, nr_threads = state->nr_threads;
+
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	if (nr_threads < 2 || state->apply_with_reject ||
+	    state->apply_verbosity > verbosity_normal)
+		return;
+
+	for (patch = list; patch; patch = patch->next) {
+		if (patch->old_name)
+			string_list_append(&names, patch->old_name);
+		if (patch->new_name &&
+		    (!patch->old_name || strcmp(patch->old_name, patch->new_name)))
+			string_list_append(&names, patch->new_name);
+		nr_patches++;
+	}
+	if (nr_patches < 2 * APPLY_AHEAD_COST) {
+		string_list_clear(&names, 0);
+		return;
+	}
+	/* mark the paths more than one patch touches */
+	string_list_sort(&names);
+	for (i = 0; i + 1 < names.nr; i++)
+		if (!strcmp(names.items[i].string, names.items[i + 1].string))
+			names.items[i].util = names.items[i + 1].util = &names;
+
+	ALLOC_ARRAY(ahead, nr_patches);
+	for (patch = list; patch; patch = patch->next)
+		if (patch->old_name &&
+		    !string_list_lookup(&names, patch->old_name)->util)
+			nr += prepare_ahead(state, &ahead[nr], patch);
+	string_list_clear(&names, 0);
+
+	if (nr_threads > nr / APPLY_AHEAD_COST)
+		nr_threads = nr / APPLY_AHEAD_COST;
+	if (nr_threads >= 2) {
+		threads = xcalloc(nr_threads, sizeof(*threads));
+		enable_obj_read_lock();
+		for (i = 0; i < nr_threads; i++) {
+			struct apply_ahead_thread *t = &threads[i];
+
+			t->state = state;
+			t->ahead = ahead;
+			t->first = i;
+			t->step = nr_threads;
+			t->nr = nr;
+			if (pthread_create(&t->pthread, NULL,
+					   apply_ahead_thread, t))
+				die(_("unable to create threaded apply"));
+		}
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i].pthread, NULL))
+				die(_("unable to join threaded apply"));
+		disable_obj_read_lock();
+		free(threads);
+	}
+	for (i = 0; i < nr; i++)
+		strbuf_release(&ahead[i].buf);
+	free(ahead);
+}
+
+#else
+
+static void apply_patches_ahead(struct apply_state *state, struct patch *list)
+{
+}
+
+#endif
+
 static int check_patch_list(struct apply_state *state, struct patch *patch)
 {
 	int err = 0;
 
 	prepare_symlink_changes(state, patch);
 	prepare_fn_table(state, patch);
+	apply_patches_ahead(state, patch);
 	while (patch) {
 		int res;
 		if (state->apply_verbosity > verbosity_normal)
@@ -4093,12 +4297,12 @@ static int build_fake_ancestor(struct apply_state *state, struct patch *list)
 			return error(_("sha1 information is lacking or useless "
 				       "(%s)."), name);
 
-		ce = make_cache_entry(patch->old_mode, oid.hash, name, 0, 0);
+		ce = make_cache_entry(&result, patch->old_mode, oid.hash, name, 0, 0);
 		if (!ce)
 			return error(_("make_cache_entry failed for path '%s'"),
 				     name);
 		if (add_index_entry(&result, ce, ADD_CACHE_OK_TO_ADD)) {
-			free(ce);
+			discard_cache_entry(ce);
 			return error(_("could not add %s to temporary index"),
 				     name);
 		}
@@ -4266,9 +4470,8 @@ static int add_index_file(struct apply_state *state,
 	struct stat st;
 	struct cache_entry *ce;
 	int namelen = strlen(path);
-	unsigned ce_size = cache_entry_size(namelen);
 
-	ce = xcalloc(1, ce_size);
+	ce = make_empty_cache_entry(&the_index, namelen);
 	memcpy(ce->name, path, namelen);
 	ce->ce_mode = create_ce_mode(mode);
 	ce->ce_flags = create_ce_flags(0);
@@ -4281,13 +4484,13 @@ static int add_index_file(struct apply_state *state,
 
 		if (!skip_prefix(buf, "Subproject commit ", &s) ||
 		    get_oid_hex(s, &ce->oid)) {
-			free(ce);
+			discard_cache_entry(ce);
 		       return error(_("corrupt patch for submodule %s"), path);
 		}
 	} else {
 		if (!state->cached) {
 			if (lstat(path, &st) < 0) {
-				free(ce);
+				discard_cache_entry(ce);
 				return error_errno(_("unable to stat newly "
 						     "created file '%s'"),
 						   path);
@@ -4295,13 +4498,13 @@ static int add_index_file(struct apply_state *state,
 			fill_stat_cache_info(ce, &st);
 		}
 		if (write_object_file(buf, size, blob_type, &ce->oid) < 0) {
-			free(ce);
+			discard_cache_entry(ce);
 			return error(_("unable to create backing store "
 				       "for newly created file %s"), path);
 		}
 	}
 	if (add_cache_entry(ce, ADD_CACHE_OK_TO_ADD) < 0) {
-		free(ce);
+		discard_cache_entry(ce);
 		return error(_("unable to add cache entry for %s"), path);
 	}
 
@@ -4425,27 +4628,26 @@ static int add_conflicted_stages_file(struct apply_state *state,
 				       struct patch *patch)
 {
 	int stage, namelen;
-	unsigned ce_size, mode;
+	unsigned mode;
 	struct cache_entry *ce;
 
 	if (!state->update_index)
 		return 0;
 	namelen = strlen(patch->new_name);
-	ce_size = cache_entry_size(namelen);
 	mode = patch->new_mode ? patch->new_mode : (S_IFREG | 0644);
 
 	remove_file_from_cache(patch->new_name);
 	for (stage = 1; stage < 4; stage++) {
 		if (is_null_oid(&patch->threeway_stage[stage - 1]))
 			continue;
-		ce = xcalloc(1, ce_size);
+		ce = make_empty_cache_entry(&the_index, namelen);
 		memcpy(ce->name, patch->new_name, namelen);
 		ce->ce_mode = create_ce_mode(mode);
 		ce->ce_flags = create_ce_flags(stage);
 		ce->ce_namelen = namelen;
 		oidcpy(&ce->oid, &patch->threeway_stage[stage - 1]);
 		if (add_cache_entry(ce, ADD_CACHE_OK_TO_ADD) < 0) {
-			free(ce);
+			discard_cache_entry(ce);
 			return error(_("unable to add cache entry for %s"),
 				     patch->new_name);
 		}
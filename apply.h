@@ -71,6 +71,7 @@ struct apply_state {
 	int p_value;
 	int p_value_known;
 	unsigned int p_context;
+	int nr_threads; /* see apply.threads */
 
 	/* Exclude and include path parameters */
 	struct string_list limit_by_name;
@@ -109,6 +110,9 @@ struct apply_state {
 	int whitespace_error;
 	int squelch_whitespace_errors;
 	int applied_after_fixing_ws;
+
+	/* Fragments that only applied with fewer lines of context */
+	int reduced_context;
 };
 
 extern int apply_parse_options(int argc, const char **argv,
@@ -20,6 +20,14 @@ static int tar_umask = 002;
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args);
 
+static void write_block_to_stdout(const void *buf)
+{
+	write_or_die(1, buf, BLOCKSIZE);
+}
+
+/* All output goes through this, in BLOCKSIZE pieces. */
+static void (*write_block)(const void *) = write_block_to_stdout;
+
 /*
  * This is the max value that a ustar size header can specify, as it is fixed
  * at 11 octal digits. POSIX specifies that we switch to extended headers at
@@ -42,7 +50,7 @@ static int write_tar_filter_archive(const struct archiver *ar,
 static void write_if_needed(void)
 {
 	if (offset == BLOCKSIZE) {
-		write_or_die(1, block, BLOCKSIZE);
+		write_block(block);
 		offset = 0;
 	}
 }
@@ -66,7 +74,7 @@ static void do_write_blocked(const void *data, unsigned long size)
 		write_if_needed();
 	}
 	while (size >= BLOCKSIZE) {
-		write_or_die(1, buf, BLOCKSIZE);
+		write_block(buf);
 		size -= BLOCKSIZE;
 		buf += BLOCKSIZE;
 	}
@@ -101,10 +109,10 @@ static void write_trailer(void)
 {
 	int tail = BLOCKSIZE - offset;
 	memset(block + offset, 0, tail);
-	write_or_die(1, block, BLOCKSIZE);
+	write_block(block);
 	if (tail < 2 * RECORDSIZE) {
 		memset(block, 0, offset);
-		write_or_die(1, block, BLOCKSIZE);
+		write_block(block);
 	}
 }
 
@@ -433,6 +441,158 @@ static int write_tar_archive(const struct archiver *ar,
 	return err;
 }
 
+/*
+ * The built-in gzip, used when the command of a tar filter is
+ * internal_gzip_command, compresses the tar stream in chunks of
+ * TGZ_CHUNK_SIZE bytes with the threads of an archive pool, the way
+ * pigz does: each chunk is a deflate stream of its own, primed with
+ * the last TGZ_DICT_SIZE bytes before it and ended with a sync flush
+ * instead of a final block, except for the last chunk, so that the
+ * chunks written one after the other make up a single deflate stream.
+ * The output depends on the chunk size, not on the number of threads.
+ */
+static const char internal_gzip_command[] = "git archive gzip";
+
+#define TGZ_CHUNK_SIZE (128 * 1024)
+#define TGZ_DICT_SIZE (32 * 1024)
+
+struct tgz_chunk {
+	struct strbuf in; /* the dictionary, then the data */
+	size_t dict_len;
+	int level;
+	int last;
+	uLong crc;
+	struct strbuf out;
+};
+
+static struct archive_pool *tgz_pool;
+static struct tgz_chunk *tgz_chunk;
+static int tgz_level;
+static uLong tgz_crc;
+static uintmax_t tgz_size;
+
+static void deflate_tgz_chunk(void *data)
+{
+	struct tgz_chunk *c = data;
+	unsigned char *in = (unsigned char *)c->in.buf + c->dict_len;
+	unsigned long len = c->in.len - c->dict_len;
+	int flush = c->last ? Z_FINISH : Z_SYNC_FLUSH;
+	git_zstream stream;
+	int result;
+
+	c->crc = crc32(crc32(0, NULL, 0), in, len);
+
+	git_deflate_init_raw(&stream, c->level);
+	if (c->dict_len &&
+	    deflateSetDictionary(&stream.z, (unsigned char *)c->in.buf,
+				 c->dict_len) != Z_OK)
+		die("unable to set deflate dictionary");
+	strbuf_grow(&c->out, git_deflate_bound(&stream, len) + 16);
+	stream.next_in = in;
+	stream.avail_in = len;
+	for (;;) {
+		stream.next_out = (unsigned char *)c->out.buf + c->out.len;
+		stream.avail_out = c->out.alloc - c->out.len - 1;
+		result = git_deflate(&stream, flush);
+		strbuf_setlen(&c->out, (char *)stream.next_out - c->out.buf);
+		if (result == Z_STREAM_END ||
+		    (result == Z_OK && !stream.avail_in && stream.avail_out))
+			break;
+		if (result != Z_OK && result != Z_BUF_ERROR)
+			die("deflate error (%d)", result);
+		strbuf_grow(&c->out, 4096);
+	}
+	/* all but the last stream are left unfinished on purpose */
+	git_deflate_abort(&stream);
+}
+
+static struct tgz_chunk *new_tgz_chunk(const struct tgz_chunk *prev)
+{
+	struct tgz_chunk *c = xcalloc(1, sizeof(*c));
+
+	strbuf_init(&c->in, TGZ_CHUNK_SIZE + TGZ_DICT_SIZE);
+	strbuf_init(&c->out, 0);
+	c->level = tgz_level;
+	if (prev) {
+		size_t len = prev->in.len - prev->dict_len;
+		if (len > TGZ_DICT_SIZE)
+			len = TGZ_DICT_SIZE;
+		strbuf_add(&c->in, prev->in.buf + prev->in.len - len, len);
+		c->dict_len = len;
+	}
+	return c;
+}
+
+static void write_tgz_chunks(int flush)
+{
+	struct tgz_chunk *c;
+
+	while ((c = get_archive_job(tgz_pool, flush))) {
+		write_or_die(1, c->out.buf, c->out.len);
+		tgz_crc = crc32_combine(tgz_crc, c->crc,
+					c->in.len - c->dict_len);
+		strbuf_release(&c->in);
+		strbuf_release(&c->out);
+		free(c);
+	}
+}
+
+static void queue_tgz_chunk(int last)
+{
+	struct tgz_chunk *c = tgz_chunk;
+
+	c->last = last;
+	tgz_chunk = last ? NULL : new_tgz_chunk(c);
+	add_archive_job(tgz_pool, c, c->in.alloc);
+	write_tgz_chunks(last);
+}
+
+static void tgz_write_block(const void *data)
+{
+	strbuf_add(&tgz_chunk->in, data, BLOCKSIZE);
+	tgz_size += BLOCKSIZE;
+	if (tgz_chunk->in.len - tgz_chunk->dict_len >= TGZ_CHUNK_SIZE)
+		queue_tgz_chunk(0);
+}
+
+static void copy_le32(unsigned char *dest, uint32_t n)
+{
+	dest[0] = 0xff & n;
+	dest[1] = 0xff & (n >> 010);
+	dest[2] = 0xff & (n >> 020);
+	dest[3] = 0xff & (n >> 030);
+}
+
+static int write_tar_gzip_archive(const struct archiver *ar,
+				  struct archiver_args *args)
+{
+	/* magic, deflate, no flags, no mtime, no extra flags, Unix */
+	static const unsigned char header[10] = {
+		0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+	};
+	unsigned char trailer[8];
+	int r;
+
+	tgz_level = args->compression_level;
+	tgz_crc = crc32(0, NULL, 0);
+	tgz_size = 0;
+	tgz_pool = start_archive_pool(args->nr_threads, deflate_tgz_chunk);
+	tgz_chunk = new_tgz_chunk(NULL);
+	write_or_die(1, header, sizeof(header));
+
+	write_block = tgz_write_block;
+	r = write_tar_archive(ar, args);
+	write_block = write_block_to_stdout;
+
+	queue_tgz_chunk(1);
+	finish_archive_pool(tgz_pool);
+
+	copy_le32(trailer, tgz_crc);
+	copy_le32(trailer + 4, (uint32_t)tgz_size);
+	write_or_die(1, trailer, sizeof(trailer));
+	return r;
+}
+
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args)
 {
@@ -444,6 +604,9 @@ static int write_tar_filter_archive(const struct archiver *ar,
 	if (!ar->data)
 		BUG("tar-filter archiver called with no filter defined");
 
+	if (!strcmp(ar->data, internal_gzip_command))
+		return write_tar_gzip_archive(ar, args);
+
 	strbuf_addstr(&cmd, ar->data);
 	if (args->compression_level >= 0)
 		strbuf_addf(&cmd, " -%d", args->compression_level);
@@ -9,6 +9,8 @@
 #include "object-store.h"
 #include "userdiff.h"
 #include "xdiff-interface.h"
+#include "packfile.h"
+#include "pack-revindex.h"
 
 static int zip_date;
 static int zip_time;
@@ -21,6 +23,8 @@ static uint64_t zip_dir_entries;
 
 static unsigned int max_creator_version;
 
+static int zip_reuse_deflated;
+
 #define ZIP_STREAM	(1 <<  3)
 #define ZIP_UTF8	(1 << 11)
 
@@ -264,51 +268,163 @@ static int has_only_ascii(const char *s)
 	}
 }
 
-static int entry_is_binary(const char *path, const void *buffer, size_t size)
+/* Whether the attributes say; -1 if that depends on the contents. */
+static int path_is_binary(const char *path)
 {
 	struct userdiff_driver *driver = userdiff_find_by_path(path);
 	if (!driver)
 		driver = userdiff_find_by_name("default");
-	if (driver->binary != -1)
-		return driver->binary;
+	return driver->binary;
+}
+
+static int entry_is_binary(const char *path, const void *buffer, size_t size)
+{
+	int is_binary = path_is_binary(path);
+	if (is_binary != -1)
+		return is_binary;
 	return buffer_is_binary(buffer, size);
 }
 
 #define STREAM_BUFFER_SIZE (1024 * 16)
 
-static int write_zip_entry(struct archiver_args *args,
-			   const struct object_id *oid,
-			   const char *path, size_t pathlen,
-			   unsigned int mode)
-{
-	struct zip_local_header header;
-	uintmax_t offset = zip_offset;
-	struct zip_extra_mtime extra;
-	struct zip64_extra extra64;
-	size_t header_extra_size = ZIP_EXTRA_MTIME_SIZE;
-	int need_zip64_extra = 0;
+/*
+ * An entry read from the object store, to be compressed, possibly by
+ * a thread of zip_pool, and then written out.  Entries too big to be
+ * held in memory are streamed instead, by the main thread when their
+ * turn comes.
+ */
+struct zip_entry {
+	struct object_id oid;
+	char *path;
+	size_t pathlen;
+	unsigned long flags;
 	unsigned long attr2;
+	unsigned long size;
 	unsigned long compressed_size;
 	unsigned long crc;
 	int method;
-	unsigned char *out;
-	void *deflated = NULL;
+	int is_binary;
+	int compression_level;
+	unsigned int creator_version;
 	void *buffer;
-	struct git_istream *stream = NULL;
-	unsigned long flags = 0;
-	unsigned long size;
-	int is_binary = -1;
+	void *deflated;
+	unsigned char *packed;
+	unsigned long packed_len;
+	unsigned char *out;
+	struct git_istream *stream;
+};
+
+static struct archive_pool *zip_pool;
+
+/*
+ * With zip.reuseDeflated, a blob that a pack stores whole is not
+ * deflated again: its zlib stream is copied out of the pack, and
+ * check_packed_entry() inflates it to compute the CRC and to make sure
+ * it is sound, which is much cheaper than deflating, before its raw
+ * deflate data goes into the archive as is, without the two bytes of
+ * zlib header and the four of checksum around it.
+ */
+static int can_reuse_deflated(struct archiver_args *args, const char *path,
+			      const struct object_id *oid, unsigned int mode)
+{
+	struct stream_filter *filter;
+	int ret;
+
+	if (!zip_reuse_deflated || !S_ISREG(mode) || args->convert ||
+	    args->compression_level != Z_DEFAULT_COMPRESSION)
+		return 0;
+	filter = get_stream_filter(path + args->baselen, oid);
+	if (!filter)
+		return 0;
+	ret = is_null_stream_filter(filter);
+	free_stream_filter(filter);
+	return ret;
+}
+
+static int read_packed_entry(const struct object_id *oid, struct zip_entry *e)
+{
+	struct pack_entry pe;
+	struct pack_window *w_curs = NULL;
+	unsigned long size, len;
+	off_t curpos, end;
+	uint32_t pos;
+
+	if (!find_pack_entry(the_repository, oid, &pe))
+		return 0;
+	curpos = pe.offset;
+	if (unpack_object_header(pe.p, &w_curs, &curpos, &size) != OBJ_BLOB ||
+	    size != e->size ||
+	    offset_to_pack_pos(pe.p, pe.offset, &pos) < 0) {
+		unuse_pack(&w_curs);
+		return 0;
+	}
+	end = pack_pos_to_offset(pe.p, pos + 1);
+	if (end - curpos < 6 || end - curpos - 6 >= size) {
+		unuse_pack(&w_curs);
+		return 0;
+	}
+
+	e->packed_len = end - curpos;
+	e->packed = xmalloc(e->packed_len);
+	for (len = 0; len < e->packed_len; ) {
+		unsigned long avail;
+		unsigned char *in = use_pack(pe.p, &w_curs, curpos + len,
+					     &avail);
+		if (avail > e->packed_len - len)
+			avail = e->packed_len - len;
+		memcpy(e->packed + len, in, avail);
+		len += avail;
+	}
+	unuse_pack(&w_curs);
+	return 1;
+}
+
+/* Runs in the threads of zip_pool, like compress_zip_entry(). */
+static int check_packed_entry(struct zip_entry *e)
+{
+	unsigned char buf[STREAM_BUFFER_SIZE];
+	git_zstream stream;
+	int status;
+
+	/* deflate, and no preset dictionary */
+	if ((e->packed[0] & 0x0f) != 8 || (e->packed[1] & 0x20))
+		return -1;
+
+	memset(&stream, 0, sizeof(stream));
+	git_inflate_init(&stream);
+	stream.next_in = e->packed;
+	stream.avail_in = e->packed_len;
+	do {
+		stream.next_out = buf;
+		stream.avail_out = sizeof(buf);
+		status = git_inflate(&stream, Z_FINISH);
+		e->crc = crc32(e->crc, buf, stream.next_out - buf);
+		if (e->is_binary == -1)
+			e->is_binary = buffer_is_binary((const char *)buf,
+							stream.next_out - buf);
+	} while (status == Z_OK || status == Z_BUF_ERROR);
+	git_inflate_end(&stream);
+
+	if (status != Z_STREAM_END || stream.total_out != e->size ||
+	    stream.total_in != e->packed_len)
+		return -1;
+	return 0;
+}
+
+static int prepare_zip_entry(struct archiver_args *args,
+			     const struct object_id *oid,
+			     const char *path, size_t pathlen,
+			     unsigned int mode, struct zip_entry *e)
+{
 	const char *path_without_prefix = path + args->baselen;
-	unsigned int creator_version = 0;
-	unsigned int version_needed = 10;
-	size_t zip_dir_extra_size = ZIP_EXTRA_MTIME_SIZE;
-	size_t zip64_dir_extra_payload_size = 0;
 
-	crc = crc32(0, NULL, 0);
+	e->crc = crc32(0, NULL, 0);
+	e->is_binary = -1;
+	e->compression_level = args->compression_level;
 
 	if (!has_only_ascii(path)) {
 		if (is_utf8(path))
-			flags |= ZIP_UTF8;
+			e->flags |= ZIP_UTF8;
 		else
 			warning("Path is not valid UTF-8: %s", path);
 	}
@@ -319,62 +435,117 @@ static int write_zip_entry(struct archiver_args *args,
 	}
 
 	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
-		method = 0;
-		attr2 = 16;
-		out = NULL;
-		size = 0;
-		compressed_size = 0;
-		buffer = NULL;
+		e->method = 0;
+		e->attr2 = 16;
 	} else if (S_ISREG(mode) || S_ISLNK(mode)) {
 		enum object_type type = oid_object_info(the_repository, oid,
-							&size);
+							&e->size);
 
-		method = 0;
-		attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
+		e->method = 0;
+		e->attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
 			(mode & 0111) ? ((mode) << 16) : 0;
 		if (S_ISLNK(mode) || (mode & 0111))
-			creator_version = 0x0317;
-		if (S_ISREG(mode) && args->compression_level != 0 && size > 0)
-			method = 8;
+			e->creator_version = 0x0317;
+		if (S_ISREG(mode) && args->compression_level != 0 && e->size > 0)
+			e->method = 8;
 
 		if (S_ISREG(mode) && type == OBJ_BLOB && !args->convert &&
-		    size > big_file_threshold) {
-			stream = open_istream(oid, &type, &size, NULL);
-			if (!stream)
+		    e->size > big_file_threshold) {
+			e->stream = open_istream(oid, &type, &e->size, NULL);
+			if (!e->stream)
 				return error("cannot stream blob %s",
 					     oid_to_hex(oid));
-			flags |= ZIP_STREAM;
-			out = buffer = NULL;
+			e->flags |= ZIP_STREAM;
+		} else if (e->method == 8 &&
+			   can_reuse_deflated(args, path, oid, mode) &&
+			   read_packed_entry(oid, e)) {
+			e->is_binary = path_is_binary(path_without_prefix);
 		} else {
-			buffer = object_file_to_archive(args, path, oid, mode,
-							&type, &size);
-			if (!buffer)
+			e->buffer = object_file_to_archive(args, path, oid, mode,
+							   &type, &e->size);
+			if (!e->buffer)
 				return error("cannot read %s",
 					     oid_to_hex(oid));
-			crc = crc32(crc, buffer, size);
-			is_binary = entry_is_binary(path_without_prefix,
-						    buffer, size);
-			out = buffer;
+			e->is_binary = entry_is_binary(path_without_prefix,
+						       e->buffer, e->size);
+			e->out = e->buffer;
 		}
-		compressed_size = (method == 0) ? size : 0;
+		e->compressed_size = (e->method == 0) ? e->size : 0;
 	} else {
 		return error("unsupported file mode: 0%o (SHA1: %s)", mode,
 				oid_to_hex(oid));
 	}
 
-	if (creator_version > max_creator_version)
-		max_creator_version = creator_version;
-
-	if (buffer && method == 8) {
-		out = deflated = zlib_deflate_raw(buffer, size,
-						  args->compression_level,
-						  &compressed_size);
-		if (!out || compressed_size >= size) {
-			out = buffer;
-			method = 0;
-			compressed_size = size;
+	if (e->creator_version > max_creator_version)
+		max_creator_version = e->creator_version;
+
+	oidcpy(&e->oid, oid);
+	e->path = xmemdupz(path, pathlen);
+	e->pathlen = pathlen;
+	return 0;
+}
+
+/* Runs in the threads of zip_pool; it must not touch the object store. */
+static void compress_zip_entry(void *data)
+{
+	struct zip_entry *e = data;
+
+	if (e->packed) {
+		if (!check_packed_entry(e)) {
+			e->out = e->packed + 2;
+			e->compressed_size = e->packed_len - 6;
 		}
+		return;
+	}
+	if (!e->buffer)
+		return;
+	e->crc = crc32(e->crc, e->buffer, e->size);
+	if (e->method == 8) {
+		e->out = e->deflated = zlib_deflate_raw(e->buffer, e->size,
+							e->compression_level,
+							&e->compressed_size);
+		if (!e->out || e->compressed_size >= e->size) {
+			e->out = e->buffer;
+			e->method = 0;
+			e->compressed_size = e->size;
+		}
+	}
+}
+
+static int emit_zip_entry(struct archiver_args *args, struct zip_entry *e)
+{
+	struct zip_local_header header;
+	uintmax_t offset = zip_offset;
+	struct zip_extra_mtime extra;
+	struct zip64_extra extra64;
+	size_t header_extra_size = ZIP_EXTRA_MTIME_SIZE;
+	int need_zip64_extra = 0;
+	unsigned long size;
+	unsigned long compressed_size;
+	unsigned long crc;
+	int is_binary;
+	const char *path_without_prefix = e->path + args->baselen;
+	unsigned int version_needed = 10;
+	size_t zip_dir_extra_size = ZIP_EXTRA_MTIME_SIZE;
+	size_t zip64_dir_extra_payload_size = 0;
+
+	if (e->packed && !e->out) {
+		/* the copy from the pack did not check out */
+		enum object_type type;
+
+		FREE_AND_NULL(e->packed);
+		e->crc = crc32(0, NULL, 0);
+		e->buffer = read_object_file(&e->oid, &type, &e->size);
+		if (!e->buffer)
+			return error("cannot read %s", oid_to_hex(&e->oid));
+		e->is_binary = entry_is_binary(path_without_prefix,
+					       e->buffer, e->size);
+		compress_zip_entry(e);
 	}
+	size = e->size;
+	compressed_size = e->compressed_size;
+	crc = e->crc;
+	is_binary = e->is_binary;
 
 	copy_le16(extra.magic, 0x5455);
 	copy_le16(extra.extra_size, ZIP_EXTRA_MTIME_PAYLOAD_SIZE);
@@ -383,7 +554,7 @@ static int write_zip_entry(struct archiver_args *args,
 
 	if (size > 0xffffffff || compressed_size > 0xffffffff)
 		need_zip64_extra = 1;
-	if (stream && size > 0x7fffffff)
+	if (e->stream && size > 0x7fffffff)
 		need_zip64_extra = 1;
 
 	if (need_zip64_extra)
@@ -391,8 +562,8 @@ static int write_zip_entry(struct archiver_args *args,
 
 	copy_le32(header.magic, 0x04034b50);
 	copy_le16(header.version, version_needed);
-	copy_le16(header.flags, flags);
-	copy_le16(header.compression_method, method);
+	copy_le16(header.flags, e->flags);
+	copy_le16(header.compression_method, e->method);
 	copy_le16(header.mtime, zip_time);
 	copy_le16(header.mdate, zip_date);
 	if (need_zip64_extra) {
@@ -401,12 +572,12 @@ static int write_zip_entry(struct archiver_args *args,
 	} else {
 		set_zip_header_data_desc(&header, size, compressed_size, crc);
 	}
-	copy_le16(header.filename_length, pathlen);
+	copy_le16(header.filename_length, e->pathlen);
 	copy_le16(header.extra_length, header_extra_size);
 	write_or_die(1, &header, ZIP_LOCAL_HEADER_SIZE);
 	zip_offset += ZIP_LOCAL_HEADER_SIZE;
-	write_or_die(1, path, pathlen);
-	zip_offset += pathlen;
+	write_or_die(1, e->path, e->pathlen);
+	zip_offset += e->pathlen;
 	write_or_die(1, &extra, ZIP_EXTRA_MTIME_SIZE);
 	zip_offset += ZIP_EXTRA_MTIME_SIZE;
 	if (need_zip64_extra) {
@@ -418,12 +589,12 @@ static int write_zip_entry(struct archiver_args *args,
 		zip_offset += ZIP64_EXTRA_SIZE;
 	}
 
-	if (stream && method == 0) {
+	if (e->stream && e->method == 0) {
 		unsigned char buf[STREAM_BUFFER_SIZE];
 		ssize_t readlen;
 
 		for (;;) {
-			readlen = read_istream(stream, buf, sizeof(buf));
+			readlen = read_istream(e->stream, buf, sizeof(buf));
 			if (readlen <= 0)
 				break;
 			crc = crc32(crc, buf, readlen);
@@ -432,7 +603,8 @@ static int write_zip_entry(struct archiver_args *args,
 							    buf, readlen);
 			write_or_die(1, buf, readlen);
 		}
-		close_istream(stream);
+		close_istream(e->stream);
+		e->stream = NULL;
 		if (readlen)
 			return readlen;
 
@@ -440,7 +612,7 @@ static int write_zip_entry(struct archiver_args *args,
 		zip_offset += compressed_size;
 
 		write_zip_data_desc(size, compressed_size, crc);
-	} else if (stream && method == 8) {
+	} else if (e->stream && e->method == 8) {
 		unsigned char buf[STREAM_BUFFER_SIZE];
 		ssize_t readlen;
 		git_zstream zstream;
@@ -455,7 +627,7 @@ static int write_zip_entry(struct archiver_args *args,
 		zstream.avail_out = sizeof(compressed);
 
 		for (;;) {
-			readlen = read_istream(stream, buf, sizeof(buf));
+			readlen = read_istream(e->stream, buf, sizeof(buf));
 			if (readlen <= 0)
 				break;
 			crc = crc32(crc, buf, readlen);
@@ -478,7 +650,8 @@ static int write_zip_entry(struct archiver_args *args,
 			}
 
 		}
-		close_istream(stream);
+		close_istream(e->stream);
+		e->stream = NULL;
 		if (readlen)
 			return readlen;
 
@@ -496,13 +669,10 @@ static int write_zip_entry(struct archiver_args *args,
 
 		write_zip_data_desc(size, compressed_size, crc);
 	} else if (compressed_size > 0) {
-		write_or_die(1, out, compressed_size);
+		write_or_die(1, e->out, compressed_size);
 		zip_offset += compressed_size;
 	}
 
-	free(deflated);
-	free(buffer);
-
 	if (compressed_size > 0xffffffff || size > 0xffffffff ||
 	    offset > 0xffffffff) {
 		if (compressed_size >= 0xffffffff)
@@ -515,23 +685,23 @@ static int write_zip_entry(struct archiver_args *args,
 	}
 
 	strbuf_add_le(&zip_dir, 4, 0x02014b50);	/* magic */
-	strbuf_add_le(&zip_dir, 2, creator_version);
+	strbuf_add_le(&zip_dir, 2, e->creator_version);
 	strbuf_add_le(&zip_dir, 2, version_needed);
-	strbuf_add_le(&zip_dir, 2, flags);
-	strbuf_add_le(&zip_dir, 2, method);
+	strbuf_add_le(&zip_dir, 2, e->flags);
+	strbuf_add_le(&zip_dir, 2, e->method);
 	strbuf_add_le(&zip_dir, 2, zip_time);
 	strbuf_add_le(&zip_dir, 2, zip_date);
 	strbuf_add_le(&zip_dir, 4, crc);
 	strbuf_add_le(&zip_dir, 4, clamp32(compressed_size));
 	strbuf_add_le(&zip_dir, 4, clamp32(size));
-	strbuf_add_le(&zip_dir, 2, pathlen);
+	strbuf_add_le(&zip_dir, 2, e->pathlen);
 	strbuf_add_le(&zip_dir, 2, zip_dir_extra_size);
 	strbuf_add_le(&zip_dir, 2, 0);		/* comment length */
 	strbuf_add_le(&zip_dir, 2, 0);		/* disk */
 	strbuf_add_le(&zip_dir, 2, !is_binary);
-	strbuf_add_le(&zip_dir, 4, attr2);
+	strbuf_add_le(&zip_dir, 4, e->attr2);
 	strbuf_add_le(&zip_dir, 4, clamp32(offset));
-	strbuf_add(&zip_dir, path, pathlen);
+	strbuf_add(&zip_dir, e->path, e->pathlen);
 	strbuf_add(&zip_dir, &extra, ZIP_EXTRA_MTIME_SIZE);
 	if (zip64_dir_extra_payload_size) {
 		strbuf_add_le(&zip_dir, 2, 0x0001);	/* magic */
@@ -548,6 +718,59 @@ static int write_zip_entry(struct archiver_args *args,
 	return 0;
 }
 
+static void free_zip_entry(struct zip_entry *e)
+{
+	if (e->stream)
+		close_istream(e->stream);
+	free(e->deflated);
+	free(e->buffer);
+	free(e->packed);
+	free(e->path);
+	free(e);
+}
+
+/*
+ * Write out the entries zip_pool is done with, in order, or with
+ * "flush" all of them; after an error "err", just drop them.
+ */
+static int write_zip_entries(struct archiver_args *args, int flush, int err)
+{
+	struct zip_entry *e;
+
+	while ((e = get_archive_job(zip_pool, flush))) {
+		if (!err)
+			err = emit_zip_entry(args, e);
+		free_zip_entry(e);
+	}
+	return err;
+}
+
+static int write_zip_entry(struct archiver_args *args,
+			   const struct object_id *oid,
+			   const char *path, size_t pathlen,
+			   unsigned int mode)
+{
+	struct zip_entry *e = xcalloc(1, sizeof(*e));
+	int err;
+
+	err = prepare_zip_entry(args, oid, path, pathlen, mode, e);
+	if (err) {
+		free_zip_entry(e);
+		return err;
+	}
+
+	if (e->stream) {
+		err = write_zip_entries(args, 1, 0);
+		if (!err)
+			err = emit_zip_entry(args, e);
+		free_zip_entry(e);
+		return err;
+	}
+
+	add_archive_job(zip_pool, e, e->buffer ? e->size : e->packed_len);
+	return write_zip_entries(args, 0, 0);
+}
+
 static void write_zip64_trailer(void)
 {
 	struct zip64_dir_trailer trailer64;
@@ -615,6 +838,10 @@ static void dos_time(timestamp_t *timestamp, int *dos_date, int *dos_time)
 
 static int archive_zip_config(const char *var, const char *value, void *data)
 {
+	if (!strcmp(var, "zip.reusedeflated")) {
+		zip_reuse_deflated = git_config_bool(var, value);
+		return 0;
+	}
 	return userdiff_config(var, value);
 }
 
@@ -629,7 +856,10 @@ static int write_zip_archive(const struct archiver *ar,
 
 	strbuf_init(&zip_dir, 0);
 
+	zip_pool = start_archive_pool(args->nr_threads, compress_zip_entry);
 	err = write_archive_entries(args, write_zip_entry);
+	err = write_zip_entries(args, 1, err);
+	finish_archive_pool(zip_pool);
 	if (!err)
 		write_zip_trailer(args->commit_sha1);
 
@@ -9,6 +9,11 @@
 #include "parse-options.h"
 #include "unpack-trees.h"
 #include "dir.h"
+#include "thread-utils.h"
+#include "tempfile.h"
+#include "version.h"
+#include "packfile.h"
+#include "sha1-array.h"
 
 static char const * const archive_usage[] = {
 	N_("git archive [<options>] <tree-ish> [<path>...]"),
@@ -22,6 +27,8 @@ static const struct archiver **archivers;
 static int nr_archivers;
 static int alloc_archivers;
 static int remote_allow_unreachable;
+static int archive_cache;
+static unsigned long archive_cache_limit = 1024 * 1024 * 1024;
 
 void register_archiver(struct archiver *ar)
 {
@@ -149,6 +156,8 @@ static int write_archive_entry(const struct object_id *oid, const char *base,
 		if (check_attr_export_ignore(check))
 			return 0;
 		args->convert = check_attr_export_subst(check);
+		if (args->convert && args->commit)
+			args->export_subst = 1;
 	}
 
 	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
@@ -236,6 +245,26 @@ static int queue_or_write_archive_entry(const struct object_id *oid,
 				   stage, context);
 }
 
+/*
+ * The index read from the tree for its attributes lists the blobs to
+ * archive in the order they are written; read them ahead.
+ */
+static void readahead_archive_blobs(struct archiver_args *args)
+{
+	struct oid_array blobs = OID_ARRAY_INIT;
+	int i;
+
+	for (i = 0; i < the_index.cache_nr; i++) {
+		const struct cache_entry *ce = the_index.cache[i];
+
+		if (S_ISREG(ce->ce_mode) &&
+		    ce_path_match(ce, &args->pathspec, NULL))
+			oid_array_append(&blobs, &ce->oid);
+	}
+	readahead_packed_objects(the_repository, &blobs);
+	oid_array_clear(&blobs);
+}
+
 int write_archive_entries(struct archiver_args *args,
 		write_archive_entry_fn_t write_entry)
 {
@@ -275,6 +304,7 @@ int write_archive_entries(struct archiver_args *args,
 		if (unpack_trees(1, &t, &opts))
 			return -1;
 		git_attr_set_direction(GIT_ATTR_INDEX, &the_index);
+		readahead_archive_blobs(args);
 	}
 
 	err = read_tree_recursive(args->tree, "", 0, 0, &args->pathspec,
@@ -290,6 +320,168 @@ int write_archive_entries(struct archiver_args *args,
 	return err;
 }
 
+/*
+ * The jobs of a pool sit in a ring of "nr" slots, from "first", the
+ * oldest one the archiver has not taken back yet, to "end"; the
+ * threads have started on those before "next". Without threads, or
+ * with just one, the ring has a single slot and add_archive_job()
+ * does the work right away.
+ */
+#define ARCHIVE_AHEAD_PER_THREAD 16
+#define ARCHIVE_AHEAD_BYTES (64 * 1024 * 1024)
+
+struct archive_slot {
+	void *job;
+	size_t bytes;
+	unsigned done:1;
+};
+
+struct archive_pool {
+	void (*work)(void *job);
+	struct archive_slot *slots;
+	unsigned int nr, first, next, end;
+	size_t bytes;
+	int nr_threads;
+#ifndef NO_PTHREADS
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int stop;
+#endif
+};
+
+#ifndef NO_PTHREADS
+static void *archive_thread(void *data)
+{
+	struct archive_pool *pool = data;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		struct archive_slot *slot;
+
+		while (!pool->stop && pool->next == pool->end)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (pool->next == pool->end)
+			break;
+		slot = &pool->slots[pool->next++ % pool->nr];
+		pthread_mutex_unlock(&pool->mutex);
+
+		pool->work(slot->job);
+
+		pthread_mutex_lock(&pool->mutex);
+		slot->done = 1;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+#endif
+
+struct archive_pool *start_archive_pool(int nr_threads,
+					void (*work)(void *job))
+{
+	struct archive_pool *pool = xcalloc(1, sizeof(*pool));
+
+	if (!nr_threads)
+		nr_threads = online_cpus();
+#ifdef NO_PTHREADS
+	nr_threads = 1;
+#endif
+	pool->work = work;
+	pool->nr_threads = nr_threads > 1 ? nr_threads : 0;
+	pool->nr = nr_threads > 1 ? ARCHIVE_AHEAD_PER_THREAD * nr_threads : 1;
+	pool->slots = xcalloc(pool->nr, sizeof(*pool->slots));
+#ifndef NO_PTHREADS
+	if (pool->nr_threads) {
+		int i;
+
+		pthread_mutex_init(&pool->mutex, NULL);
+		pthread_cond_init(&pool->cond, NULL);
+		ALLOC_ARRAY(pool->threads, nr_threads);
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&pool->threads[i], NULL,
+					   archive_thread, pool))
+				die(_("unable to create thread"));
+	}
+#endif
+	return pool;
+}
+
+void add_archive_job(struct archive_pool *pool, void *job, size_t bytes)
+{
+	struct archive_slot *slot = &pool->slots[pool->end % pool->nr];
+
+	if (pool->end - pool->first >= pool->nr)
+		BUG("archive job added to a full pool");
+	slot->job = job;
+	slot->bytes = bytes;
+	slot->done = 0;
+
+	if (!pool->nr_threads) {
+		pool->work(job);
+		slot->done = 1;
+		pool->end++;
+		return;
+	}
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&pool->mutex);
+	pool->end++;
+	pool->bytes += bytes;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+#endif
+}
+
+void *get_archive_job(struct archive_pool *pool, int flush)
+{
+	struct archive_slot *slot = &pool->slots[pool->first % pool->nr];
+
+	if (pool->first == pool->end)
+		return NULL;
+	if (!pool->nr_threads) {
+		pool->first++;
+		return slot->job;
+	}
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&pool->mutex);
+	if (!slot->done && !flush &&
+	    pool->end - pool->first < pool->nr &&
+	    pool->bytes <= ARCHIVE_AHEAD_BYTES) {
+		pthread_mutex_unlock(&pool->mutex);
+		return NULL;
+	}
+	while (!slot->done)
+		pthread_cond_wait(&pool->cond, &pool->mutex);
+	pool->first++;
+	pool->bytes -= slot->bytes;
+	pthread_mutex_unlock(&pool->mutex);
+#endif
+	return slot->job;
+}
+
+void finish_archive_pool(struct archive_pool *pool)
+{
+	if (pool->first != pool->end)
+		BUG("archive pool finished with jobs left in it");
+#ifndef NO_PTHREADS
+	if (pool->nr_threads) {
+		int i;
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->stop = 1;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+		for (i = 0; i < pool->nr_threads; i++)
+			pthread_join(pool->threads[i], NULL);
+		pthread_mutex_destroy(&pool->mutex);
+		pthread_cond_destroy(&pool->cond);
+		free(pool->threads);
+	}
+#endif
+	free(pool->slots);
+	free(pool);
+}
+
 static const struct archiver *lookup_archiver(const char *name)
 {
 	int i;
@@ -505,10 +697,186 @@ static int parse_archive_args(int argc, const char **argv,
 	args->base = base;
 	args->baselen = strlen(base);
 	args->worktree_attributes = worktree_attributes;
+	args->export_subst = 0;
 
 	return argc;
 }
 
+/*
+ * With archive.cache, archives are kept in $GIT_DIR/archive-cache, named
+ * after the hash of everything that goes into them: the tree and the
+ * commit, the format and its options, the pathspec, the configuration
+ * of the archivers and of the conversion of the files, and the
+ * attribute files outside the tree. Asking for the same archive again
+ * then just copies the file. The least recently used archives go when
+ * the cache holds more than archive.cacheLimit bytes.
+ *
+ * Archives with export-subst files are not kept, since what replaces
+ * their placeholders depends on much more (the mailmap, the date
+ * formats, the current time...).
+ */
+static int add_filter_config(const char *var, const char *value, void *data)
+{
+	struct strbuf *key = data;
+
+	if (starts_with(var, "filter."))
+		strbuf_addf(key, "%s %s\n", var, value ? value : "");
+	return 0;
+}
+
+static void archive_cache_key(const struct archiver *ar,
+			      struct archiver_args *args,
+			      struct strbuf *path)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct strbuf var = STRBUF_INIT;
+	const char *value;
+	git_hash_ctx ctx;
+	struct object_id oid;
+	int i;
+
+	strbuf_addf(&key, "version %s\n", git_version_string);
+	strbuf_addf(&key, "format %s\n", ar->name);
+	strbuf_addf(&key, "tree %s\n", oid_to_hex(&args->tree->object.oid));
+	if (args->commit_sha1)
+		strbuf_addf(&key, "commit %s\n", sha1_to_hex(args->commit_sha1));
+	strbuf_addf(&key, "time %"PRItime"\n", args->time);
+	strbuf_addf(&key, "level %d\n", args->compression_level);
+	strbuf_addf(&key, "prefix %s\n", args->base);
+	for (i = 0; i < args->pathspec.nr; i++)
+		strbuf_addf(&key, "pathspec %s\n",
+			    args->pathspec.items[i].original);
+
+	strbuf_addf(&var, "tar.%s.command", ar->name);
+	if (!git_config_get_value(var.buf, &value) && value)
+		strbuf_addf(&key, "command %s\n", value);
+	if (!git_config_get_value("tar.umask", &value) && value)
+		strbuf_addf(&key, "umask %s\n", value);
+	if (!git_config_get_value("zip.reusedeflated", &value) && value)
+		strbuf_addf(&key, "reusedeflated %s\n", value);
+	strbuf_addf(&key, "autocrlf %d\neol %d\nbigfilethreshold %lu\n",
+		    auto_crlf, core_eol, big_file_threshold);
+	git_config(add_filter_config, &key);
+	add_outside_attr_files(&key);
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, key.buf, key.len);
+	the_hash_algo->final_fn(oid.hash, &ctx);
+	strbuf_addf(path, "%s/%s", git_path("archive-cache"), oid_to_hex(&oid));
+
+	strbuf_release(&var);
+	strbuf_release(&key);
+}
+
+struct archive_cache_entry {
+	char *path;
+	off_t size;
+	time_t mtime;
+};
+
+static int compare_archive_cache_entries(const void *a_, const void *b_)
+{
+	const struct archive_cache_entry *a = a_, *b = b_;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+static void prune_archive_cache(void)
+{
+	struct archive_cache_entry *entries = NULL;
+	int nr = 0, alloc = 0, i;
+	uintmax_t total = 0;
+	struct dirent *de;
+	DIR *dir = opendir(git_path("archive-cache"));
+
+	if (!dir)
+		return;
+	while ((de = readdir(dir))) {
+		struct stat st;
+		char *path;
+
+		if (de->d_name[0] == '.' || starts_with(de->d_name, "tmp_"))
+			continue;
+		path = git_pathdup("archive-cache/%s", de->d_name);
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = path;
+		entries[nr].size = st.st_size;
+		entries[nr].mtime = st.st_mtime;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(entries, nr, compare_archive_cache_entries);
+	for (i = 0; i < nr; i++) {
+		if (total > archive_cache_limit &&
+		    !unlink(entries[i].path))
+			total -= entries[i].size;
+		free(entries[i].path);
+	}
+	free(entries);
+}
+
+static int write_cached_archive(const struct archiver *ar,
+				struct archiver_args *args)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf template = STRBUF_INIT;
+	struct tempfile *tmp;
+	struct stat st;
+	int fd, saved_stdout, err;
+
+	archive_cache_key(ar, args, &path);
+
+	fd = open(path.buf, O_RDONLY);
+	if (fd >= 0) {
+		/* keep it from being pruned as the least recently used */
+		utime(path.buf, NULL);
+		err = copy_fd(fd, 1);
+		close(fd);
+		strbuf_release(&path);
+		return err ? error_errno(_("unable to copy cached archive")) : 0;
+	}
+
+	if (safe_create_leading_directories(path.buf)) {
+		strbuf_release(&path);
+		return ar->write_archive(ar, args);
+	}
+	strbuf_addf(&template, "%s/tmp_XXXXXX", git_path("archive-cache"));
+	tmp = mks_tempfile_m(template.buf, 0444);
+	strbuf_release(&template);
+	if (!tmp) {
+		strbuf_release(&path);
+		return ar->write_archive(ar, args);
+	}
+
+	saved_stdout = dup(1);
+	if (saved_stdout < 0 || dup2(get_tempfile_fd(tmp), 1) < 0)
+		die_errno(_("unable to redirect descriptor"));
+	err = ar->write_archive(ar, args);
+	if (dup2(saved_stdout, 1) < 0)
+		die_errno(_("unable to redirect descriptor"));
+	close(saved_stdout);
+
+	fd = get_tempfile_fd(tmp);
+	if (!err && (lseek(fd, 0, SEEK_SET) < 0 || copy_fd(fd, 1)))
+		err = error_errno(_("unable to copy archive"));
+	if (err || args->export_subst || fstat(fd, &st) ||
+	    (uintmax_t)st.st_size > archive_cache_limit ||
+	    rename_tempfile(&tmp, path.buf))
+		delete_tempfile(&tmp);
+	prune_archive_cache();
+
+	strbuf_release(&path);
+	return err;
+}
+
 int write_archive(int argc, const char **argv, const char *prefix,
 		  const char *name_hint, int remote)
 {
@@ -516,6 +884,13 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	struct archiver_args args;
 
 	git_config_get_bool("uploadarchive.allowunreachable", &remote_allow_unreachable);
+	if (git_config_get_int("archive.threads", &args.nr_threads))
+		args.nr_threads = 0;
+	else if (args.nr_threads < 0)
+		die(_("invalid number of threads specified (%d) for %s"),
+		    args.nr_threads, "archive.threads");
+	git_config_get_bool("archive.cache", &archive_cache);
+	git_config_get_ulong("archive.cachelimit", &archive_cache_limit);
 	git_config(git_default_config, NULL);
 
 	init_tar_archiver();
@@ -534,6 +909,14 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	parse_treeish_arg(argv, &args, prefix, remote);
 	parse_pathspec_arg(argv + 1, &args);
 
+	/*
+	 * Archives of the worktree attributes or with -v are not cached,
+	 * and neither are those of a tree, whose entries are stamped with
+	 * the current time.
+	 */
+	if (archive_cache && !args.verbose && !args.worktree_attributes &&
+	    args.commit)
+		return write_cached_archive(ar, &args);
 	return ar->write_archive(ar, &args);
 }
 
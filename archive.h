@@ -14,7 +14,9 @@ struct archiver_args {
 	unsigned int verbose : 1;
 	unsigned int worktree_attributes : 1;
 	unsigned int convert : 1;
+	unsigned int export_subst : 1;
 	int compression_level;
+	int nr_threads;
 };
 
 #define ARCHIVER_WANT_COMPRESSION_LEVELS 1
@@ -38,6 +40,26 @@ typedef int (*write_archive_entry_fn_t)(struct archiver_args *args,
 extern int write_archive_entries(struct archiver_args *args, write_archive_entry_fn_t write_entry);
 extern int write_archive(int argc, const char **argv, const char *prefix, const char *name_hint, int remote);
 
+/*
+ * A pool of threads for the archivers to do the work on their entries
+ * or blocks with, "work" being called on each job added. The jobs come
+ * back from get_archive_job() in the order they were added, so that
+ * the archiver can write them out in that order. It returns NULL when
+ * the oldest job is not done yet and there is room for more jobs, or
+ * when there are no jobs at all; with "flush", it waits for that job
+ * instead, to empty the pool. "bytes" is how much memory the job
+ * holds, which also limits how far ahead the archiver may get.
+ *
+ * A "nr_threads" of 0 means as many threads as there are CPUs; with 1,
+ * add_archive_job() does the work itself.
+ */
+struct archive_pool;
+struct archive_pool *start_archive_pool(int nr_threads,
+					void (*work)(void *job));
+void add_archive_job(struct archive_pool *pool, void *job, size_t bytes);
+void *get_archive_job(struct archive_pool *pool, int flush);
+void finish_archive_pool(struct archive_pool *pool);
+
 const char *archive_format_from_filename(const char *filename);
 extern void *object_file_to_archive(const struct archiver_args *args,
 				    const char *path, const struct object_id *oid,
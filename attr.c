@@ -452,6 +452,50 @@ static struct match_attr *parse_attr_line(const char *line, const char *src,
  * .gitignore file and info/excludes file as a fallback.
  */
 
+/* The indices of the rules of a frame that share a "key". */
+struct attr_rule_list {
+	struct hashmap_entry ent; /* must be the first member! */
+	const char *key; /* points into the pattern of a rule */
+	int keylen;
+	int nr, alloc;
+	int *rule;
+};
+
+/*
+ * The rules of an attr_stack frame sorted out by the part of a path
+ * that decides whether they can match it, so that fill() only tries
+ * the rules that can:
+ *
+ *  - "basenames" has the rules whose pattern is a literal basename,
+ *    keyed by it;
+ *  - "suffixes" has the "*<literal>" rules, keyed by the literal, all
+ *    of whose lengths are in "suffix_len";
+ *  - "dirs" has the rules with a slash in their literal prefix, keyed
+ *    by the leading directory of that prefix;
+ *  - "others" are the rules that are tried on every path.
+ *
+ * The rules that can match a path under the leading directory "dir"
+ * (below the frame, or none if "dirlen" is negative) are those of
+ * "others" and of "dirs", merged in "dir_rules", which the siblings
+ * and cousins of a path reuse.  All the lists keep the rules in the
+ * order of the file.
+ */
+struct attr_matcher {
+	int compiled;
+	int icase; /* ignore_case when it was compiled */
+	struct hashmap basenames, suffixes, dirs;
+	int *suffix_len, nr_suffix_len, alloc_suffix_len;
+	int *others, nr_others, alloc_others;
+
+	int dir_valid;
+	char *dir;
+	int dirlen;
+	int *dir_rules, nr_dir_rules, alloc_dir_rules;
+
+	/* the rules that can match the path at hand */
+	int *rule, nr_rule, alloc_rule;
+};
+
 struct attr_stack {
 	struct attr_stack *prev;
 	char *origin;
@@ -459,12 +503,80 @@ struct attr_stack {
 	unsigned num_matches;
 	unsigned alloc;
 	struct match_attr **attrs;
+	struct attr_matcher matcher;
 };
 
+static int attr_rule_list_cmp(const void *unused_cmp_data,
+			      const void *entry,
+			      const void *entry_or_key,
+			      const void *unused_keydata)
+{
+	const struct attr_rule_list *a = entry;
+	const struct attr_rule_list *b = entry_or_key;
+	return (a->keylen != b->keylen) || fspathncmp(a->key, b->key, a->keylen);
+}
+
+static struct attr_rule_list *find_rules(struct hashmap *map,
+					 const char *key, int keylen)
+{
+	struct attr_rule_list k;
+
+	if (!hashmap_get_size(map))
+		return NULL;
+	hashmap_entry_init(&k, ignore_case ? memihash(key, keylen) :
+					     memhash(key, keylen));
+	k.key = key;
+	k.keylen = keylen;
+	return hashmap_get(map, &k, NULL);
+}
+
+static void add_rule(struct hashmap *map, const char *key, int keylen, int i)
+{
+	struct attr_rule_list *list = find_rules(map, key, keylen);
+
+	if (!list) {
+		list = xcalloc(1, sizeof(*list));
+		hashmap_entry_init(list, ignore_case ? memihash(key, keylen) :
+						       memhash(key, keylen));
+		list->key = key;
+		list->keylen = keylen;
+		hashmap_add(map, list);
+	}
+	ALLOC_GROW(list->rule, list->nr + 1, list->alloc);
+	list->rule[list->nr++] = i;
+}
+
+static void free_rule_lists(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct attr_rule_list *list;
+
+	hashmap_iter_init(map, &iter);
+	while ((list = hashmap_iter_next(&iter)))
+		free(list->rule);
+	hashmap_free(map, 1);
+}
+
+static void attr_matcher_clear(struct attr_matcher *m)
+{
+	if (m->compiled) {
+		free_rule_lists(&m->basenames);
+		free_rule_lists(&m->suffixes);
+		free_rule_lists(&m->dirs);
+	}
+	free(m->suffix_len);
+	free(m->others);
+	free(m->dir);
+	free(m->dir_rules);
+	free(m->rule);
+	memset(m, 0, sizeof(*m));
+}
+
 static void attr_stack_free(struct attr_stack *e)
 {
 	int i;
 	free(e->origin);
+	attr_matcher_clear(&e->matcher);
 	for (i = 0; i < e->num_matches; i++) {
 		struct match_attr *a = e->attrs[i];
 		int j;
@@ -1037,16 +1149,195 @@ static int fill_one(const char *what, struct all_attrs_item *all_attrs,
 	return rem;
 }
 
+static void compile_matcher(struct attr_stack *stack)
+{
+	struct attr_matcher *m = &stack->matcher;
+	int i, j;
+
+	attr_matcher_clear(m);
+	m->compiled = 1;
+	m->icase = ignore_case;
+	hashmap_init(&m->basenames, attr_rule_list_cmp, NULL, 0);
+	hashmap_init(&m->suffixes, attr_rule_list_cmp, NULL, 0);
+	hashmap_init(&m->dirs, attr_rule_list_cmp, NULL, 0);
+
+	for (i = 0; i < stack->num_matches; i++) {
+		const struct match_attr *a = stack->attrs[i];
+		const struct pattern *pat = &a->u.pat;
+
+		if (a->is_macro)
+			continue;
+		if (pat->flags & EXC_FLAG_NODIR) {
+			if (pat->nowildcardlen == pat->patternlen) {
+				add_rule(&m->basenames, pat->pattern,
+					 pat->patternlen, i);
+				continue;
+			}
+			if (pat->flags & EXC_FLAG_ENDSWITH) {
+				int len = pat->patternlen - 1;
+
+				add_rule(&m->suffixes, pat->pattern + 1, len, i);
+				for (j = 0; j < m->nr_suffix_len; j++)
+					if (m->suffix_len[j] == len)
+						break;
+				if (j == m->nr_suffix_len) {
+					ALLOC_GROW(m->suffix_len, m->nr_suffix_len + 1,
+						   m->alloc_suffix_len);
+					m->suffix_len[m->nr_suffix_len++] = len;
+				}
+				continue;
+			}
+		} else {
+			const char *literal = pat->pattern;
+			int len = pat->nowildcardlen;
+			const char *slash;
+
+			/* see match_pathname() */
+			if (*literal == '/') {
+				literal++;
+				len--;
+			}
+			slash = len > 0 ? memchr(literal, '/', len) : NULL;
+			if (slash && slash != literal) {
+				add_rule(&m->dirs, literal, slash - literal, i);
+				continue;
+			}
+		}
+		ALLOC_GROW(m->others, m->nr_others + 1, m->alloc_others);
+		m->others[m->nr_others++] = i;
+	}
+}
+
+/*
+ * Merge the sorted "list" into the sorted "nr" rules of "*rule", which
+ * are grown as needed.
+ */
+static void merge_rules(int **rule, int *nr, int *alloc,
+			const int *list, int list_nr)
+{
+	int i = *nr - 1, j = list_nr - 1, k = *nr + list_nr - 1;
+
+	ALLOC_GROW(*rule, *nr + list_nr, *alloc);
+	while (j >= 0) {
+		if (i >= 0 && (*rule)[i] > list[j])
+			(*rule)[k--] = (*rule)[i--];
+		else
+			(*rule)[k--] = list[j--];
+	}
+	*nr += list_nr;
+}
+
+static void prepare_dir_rules(struct attr_matcher *m,
+			      const char *dir, int dirlen)
+{
+	const struct attr_rule_list *list;
+
+	if (m->dir_valid && m->dirlen == dirlen &&
+	    (dirlen < 0 || !memcmp(m->dir, dir, dirlen)))
+		return;
+
+	free(m->dir);
+	m->dir = dirlen < 0 ? NULL : xmemdupz(dir, dirlen);
+	m->dirlen = dirlen;
+	m->dir_valid = 1;
+
+	ALLOC_GROW(m->dir_rules, m->nr_others, m->alloc_dir_rules);
+	COPY_ARRAY(m->dir_rules, m->others, m->nr_others);
+	m->nr_dir_rules = m->nr_others;
+
+	list = dirlen < 0 ? NULL : find_rules(&m->dirs, dir, dirlen);
+	if (list)
+		merge_rules(&m->dir_rules, &m->nr_dir_rules, &m->alloc_dir_rules,
+			    list->rule, list->nr);
+}
+
+static int cmp_rule(const void *a_, const void *b_)
+{
+	const int *a = a_, *b = b_;
+	return *a < *b ? -1 : *a > *b;
+}
+
+/*
+ * Find the rules of the frame that can match "path", in the order of
+ * the file, and return how many there are.
+ */
+static int candidate_rules(struct attr_stack *stack,
+			   const char *path, int pathlen, int basename_offset,
+			   const int **rule)
+{
+	struct attr_matcher *m = &stack->matcher;
+	int isdir = (pathlen && path[pathlen - 1] == '/');
+	const char *basename = path + basename_offset;
+	int basenamelen = pathlen - basename_offset - isdir;
+	int baselen = stack->originlen;
+	const char *name, *slash = NULL;
+	const struct attr_rule_list *list;
+	int namelen, i;
+
+	if (!m->compiled || m->icase != ignore_case)
+		compile_matcher(stack);
+
+	/* the leading directory of the path below the frame, if any */
+	name = path + (baselen ? baselen + 1 : 0);
+	namelen = pathlen - isdir - (baselen ? baselen + 1 : 0);
+	if (namelen > 0)
+		slash = memchr(name, '/', namelen);
+	prepare_dir_rules(m, name, slash ? slash - name : -1);
+
+	m->nr_rule = 0;
+	list = find_rules(&m->basenames, basename, basenamelen);
+	if (list)
+		merge_rules(&m->rule, &m->nr_rule, &m->alloc_rule,
+			    list->rule, list->nr);
+	for (i = 0; i < m->nr_suffix_len; i++) {
+		int len = m->suffix_len[i];
+
+		if (len > basenamelen)
+			continue;
+		list = find_rules(&m->suffixes, basename + basenamelen - len, len);
+		if (list) {
+			ALLOC_GROW(m->rule, m->nr_rule + list->nr, m->alloc_rule);
+			COPY_ARRAY(m->rule + m->nr_rule, list->rule, list->nr);
+			m->nr_rule += list->nr;
+		}
+	}
+	if (!m->nr_rule) {
+		*rule = m->dir_rules;
+		return m->nr_dir_rules;
+	}
+	QSORT(m->rule, m->nr_rule, cmp_rule);
+	merge_rules(&m->rule, &m->nr_rule, &m->alloc_rule,
+		    m->dir_rules, m->nr_dir_rules);
+	*rule = m->rule;
+	return m->nr_rule;
+}
+
+static int scan_all_rules(void)
+{
+	static int scan_all = -1;
+
+	if (scan_all < 0)
+		scan_all = git_env_bool("GIT_TEST_ATTR_SCAN_ALL", 0);
+	return scan_all;
+}
+
 static int fill(const char *path, int pathlen, int basename_offset,
-		const struct attr_stack *stack,
+		struct attr_stack *stack,
 		struct all_attrs_item *all_attrs, int rem)
 {
 	for (; rem > 0 && stack; stack = stack->prev) {
-		int i;
+		int i, nr;
+		const int *rule = NULL;
 		const char *base = stack->origin ? stack->origin : "";
 
-		for (i = stack->num_matches - 1; 0 < rem && 0 <= i; i--) {
-			const struct match_attr *a = stack->attrs[i];
+		if (scan_all_rules())
+			nr = stack->num_matches;
+		else
+			nr = candidate_rules(stack, path, pathlen,
+					     basename_offset, &rule);
+
+		for (i = nr - 1; 0 < rem && 0 <= i; i--) {
+			const struct match_attr *a = stack->attrs[rule ? rule[i] : i];
 			if (a->is_macro)
 				continue;
 			if (path_matches(path, pathlen, basename_offset,
@@ -1171,6 +1462,28 @@ void git_all_attrs(const char *path, struct attr_check *check)
 	}
 }
 
+static void add_attr_file(struct strbuf *sb, const char *path)
+{
+	struct strbuf contents = STRBUF_INIT;
+
+	if (strbuf_read_file(&contents, path, 0) < 0)
+		strbuf_addstr(sb, "none\n");
+	else
+		strbuf_addf(sb, "%"PRIuMAX"\n%s", (uintmax_t)contents.len,
+			    contents.buf);
+	strbuf_release(&contents);
+}
+
+void add_outside_attr_files(struct strbuf *sb)
+{
+	if (git_attr_system())
+		add_attr_file(sb, git_etc_gitattributes());
+	if (get_home_gitattributes())
+		add_attr_file(sb, get_home_gitattributes());
+	if (startup_info->have_repository)
+		add_attr_file(sb, git_path_info_attributes());
+}
+
 void attr_start(void)
 {
 #ifndef NO_PTHREADS
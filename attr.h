@@ -78,4 +78,12 @@ void git_attr_set_direction(enum git_attr_direction new_direction,
 
 extern void attr_start(void);
 
+/*
+ * Append the contents of the attribute files that do not come from a
+ * tree, i.e. the system-wide one, core.attributesFile and
+ * $GIT_DIR/info/attributes, to "sb", for callers that need to tell
+ * whether they changed.
+ */
+extern void add_outside_attr_files(struct strbuf *sb);
+
 #endif /* ATTR_H */
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "diff.h"
 #include "revision.h"
 #include "refs.h"
@@ -13,6 +14,7 @@
 #include "sha1-array.h"
 #include "argv-array.h"
 #include "commit-slab.h"
+#include "ewah/ewok.h"
 
 static struct oid_array good_revs;
 static struct oid_array skipped_revs;
@@ -99,6 +101,151 @@ static int count_interesting_parents(struct commit *commit)
 	return count;
 }
 
+/* The number of 64-bit words of the reachability sets built at once */
+#define REACH_WORDS 4
+
+/* The position of "commit" on the list whose weights start at "weights" */
+static int list_pos(struct commit *commit, int *weights)
+{
+	int **slot = commit_weight_peek(&commit_weight, commit);
+
+	return slot && *slot ? *slot - weights : -1;
+}
+
+/*
+ * Give each merge on the list the weight count_distance() would give
+ * it, for all of them at once. Going through the list parents first,
+ * the set of the counted commits a commit reaches is the union of those
+ * of its parents, plus itself. The sets are built for a slice of the
+ * counted commits at a time, with a few words per commit, and a merge
+ * adds the size of its sets from each slice.
+ *
+ * That takes a number of passes over the list proportional to its
+ * size, but a pass is a sequential walk through arrays rather than
+ * one commit graph walk per merge, each followed by clearing the list.
+ *
+ * Return -1 if some parent is neither on the list nor uninteresting.
+ */
+static int count_merge_distances(struct commit_list *list, int *weights)
+{
+	struct commit **commits;
+	int *order, *topo_of, *col_of, *parent_nr, *parents, *dist;
+	int *stack;
+	char *state;
+	uint64_t *reach;
+	int n, nr_cols = 0, nr_order = 0, nr_edges = 0, i, ret = -1;
+	struct commit_list *p;
+
+	for (n = 0, p = list; p; p = p->next)
+		n++;
+	commits = xcalloc(n, sizeof(*commits));
+	for (p = list; p; p = p->next)
+		commits[list_pos(p->item, weights)] = p->item;
+
+	/* order the list parents first, with an iterative depth-first walk */
+	order = xcalloc(n, sizeof(*order));
+	state = xcalloc(n, 1);
+	stack = xcalloc(n, sizeof(*stack));
+	for (i = 0; i < n; i++) {
+		int sp = 0;
+
+		if (state[i])
+			continue;
+		stack[sp++] = i;
+		state[i] = 1;
+		while (sp) {
+			int pos = stack[sp - 1], parent;
+			struct commit_list *q;
+
+			for (q = commits[pos]->parents; q; q = q->next) {
+				if (q->item->object.flags & UNINTERESTING)
+					continue;
+				parent = list_pos(q->item, weights);
+				if (parent < 0)
+					goto out;
+				if (!state[parent])
+					break;
+			}
+			if (q) {
+				parent = list_pos(q->item, weights);
+				state[parent] = 1;
+				stack[sp++] = parent;
+				continue;
+			}
+			order[nr_order++] = pos;
+			sp--;
+		}
+	}
+
+	/* the parents of each commit, by their rank in that order */
+	topo_of = xcalloc(n, sizeof(*topo_of));
+	for (i = 0; i < n; i++)
+		topo_of[order[i]] = i;
+	parent_nr = xcalloc(n + 1, sizeof(*parent_nr));
+	col_of = xcalloc(n, sizeof(*col_of));
+	for (i = 0; i < n; i++) {
+		struct commit *commit = commits[order[i]];
+		struct commit_list *q;
+
+		parent_nr[i] = nr_edges;
+		for (q = commit->parents; q; q = q->next)
+			if (!(q->item->object.flags & UNINTERESTING))
+				nr_edges++;
+		col_of[i] = (commit->object.flags & TREESAME) ? -1 : nr_cols++;
+	}
+	parent_nr[n] = nr_edges;
+	parents = xcalloc(nr_edges ? nr_edges : 1, sizeof(*parents));
+	for (i = 0; i < n; i++) {
+		struct commit_list *q;
+		int k = parent_nr[i];
+
+		for (q = commits[order[i]]->parents; q; q = q->next)
+			if (!(q->item->object.flags & UNINTERESTING))
+				parents[k++] = topo_of[list_pos(q->item, weights)];
+	}
+
+	dist = xcalloc(n, sizeof(*dist));
+	reach = xcalloc(st_mult(n, REACH_WORDS), sizeof(*reach));
+	for (; nr_cols > 0; nr_cols -= 64 * REACH_WORDS) {
+		for (i = 0; i < n; i++) {
+			uint64_t *r = reach + i * REACH_WORDS;
+			int k, w;
+
+			memset(r, 0, REACH_WORDS * sizeof(*r));
+			for (k = parent_nr[i]; k < parent_nr[i + 1]; k++) {
+				const uint64_t *pr = reach + parents[k] * REACH_WORDS;
+				for (w = 0; w < REACH_WORDS; w++)
+					r[w] |= pr[w];
+			}
+			if (0 <= col_of[i] && col_of[i] < 64 * REACH_WORDS)
+				r[col_of[i] / 64] |= (uint64_t)1 << (col_of[i] % 64);
+			if (parent_nr[i + 1] - parent_nr[i] > 1)
+				for (w = 0; w < REACH_WORDS; w++)
+					dist[i] += ewah_bit_popcount64(r[w]);
+			/* the next slice */
+			col_of[i] -= 64 * REACH_WORDS;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		if (parent_nr[i + 1] - parent_nr[i] > 1)
+			weights[order[i]] = dist[i];
+	ret = 0;
+
+	free(topo_of);
+	free(parent_nr);
+	free(col_of);
+	free(parents);
+	free(dist);
+	free(reach);
+out:
+	free(commits);
+	free(order);
+	free(state);
+	free(stack);
+	return ret;
+}
+
 static inline int halfway(struct commit_list *p, int nr)
 {
 	/*
@@ -308,13 +455,21 @@ static struct commit_list *do_find_bisection(struct commit_list *list,
 	 * So we will first count distance of merges the usual
 	 * way, and then fill the blanks using cheaper algorithm.
 	 */
+	if (count_merge_distances(list, weights) < 0) {
+		for (p = list; p; p = p->next) {
+			if (p->item->object.flags & UNINTERESTING)
+				continue;
+			if (weight(p) != -2)
+				continue;
+			weight_set(p, count_distance(p));
+			clear_distance(list);
+		}
+	}
 	for (p = list; p; p = p->next) {
 		if (p->item->object.flags & UNINTERESTING)
 			continue;
-		if (weight(p) != -2)
+		if (count_interesting_parents(p->item) < 2)
 			continue;
-		weight_set(p, count_distance(p));
-		clear_distance(list);
 
 		/* Does it happen to be at exactly half-way? */
 		if (!find_all && halfway(p, nr))
@@ -0,0 +1,356 @@
+#include "cache.h"
+#include "config.h"
+#include "lockfile.h"
+#include "tree-walk.h"
+#include "blame.h"
+#include "blame-cache.h"
+
+/*
+ * Each blame is a file in $GIT_DIR/blame-cache, named after the hash
+ * of the hex name of the commit, a NUL and the path, with the first two
+ * hex digits as a directory like loose objects. It has a header:
+ *
+ *   4-byte signature "BLMC"
+ *   1-byte version (1)
+ *   1-byte hash version (1 for SHA-1)
+ *   2 bytes of padding
+ *   the object name of the commit
+ *   the object name of the blob at the path in the commit
+ *   4-byte xdiff flags the blame was run with
+ *   4-byte blame flags (BLAME_CACHE_*) it was run with
+ *   4-byte number of lines of the blob
+ *   4-byte number of origins
+ *   4-byte number of entries
+ *   4-byte length of the path, and the path
+ *
+ * followed by the origins, each of which is:
+ *
+ *   the object name of the commit
+ *   the object name of the previous commit, or the null object name
+ *   4-byte length of the path, and the path
+ *   4-byte length of the previous path, and the previous path
+ *
+ * and the entries, each of which is its lno, num_lines, s_lno and the
+ * index of its origin, 4 bytes each. All numbers are in network byte
+ * order.
+ */
+#define BLAME_CACHE_SIGNATURE 0x424c4d43 /* "BLMC" */
+#define BLAME_CACHE_VERSION 1
+#define BLAME_CACHE_OID_VERSION 1
+
+#define BLAME_CACHE_FIRST_PARENT (1u << 0)
+#define BLAME_CACHE_NO_WHOLE_FILE_RENAME (1u << 1)
+
+static int use_cache = -1;
+
+int blame_cache_enabled(void)
+{
+	if (use_cache < 0 &&
+	    git_config_get_bool("blame.cache", &use_cache))
+		use_cache = 0;
+	return use_cache;
+}
+
+static uint32_t blame_cache_flags(const struct blame_scoreboard *sb)
+{
+	uint32_t flags = 0;
+
+	if (sb->revs->first_parent_only)
+		flags |= BLAME_CACHE_FIRST_PARENT;
+	if (sb->no_whole_file_rename)
+		flags |= BLAME_CACHE_NO_WHOLE_FILE_RENAME;
+	return flags;
+}
+
+static char *blame_cache_filename(const struct object_id *commit,
+				  const char *path)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	const char *hex;
+
+	hex = oid_to_hex(commit);
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, hex, strlen(hex) + 1);
+	the_hash_algo->update_fn(&ctx, path, strlen(path));
+	the_hash_algo->final_fn(hash, &ctx);
+	hex = sha1_to_hex(hash);
+	return git_pathdup("blame-cache/%.2s/%s", hex, hex + 2);
+}
+
+struct reader {
+	const unsigned char *p, *end;
+	int bad;
+};
+
+static const unsigned char *read_bytes(struct reader *r, size_t len)
+{
+	const unsigned char *p = r->p;
+
+	if (r->bad || (size_t)(r->end - r->p) < len) {
+		r->bad = 1;
+		return NULL;
+	}
+	r->p += len;
+	return p;
+}
+
+static uint32_t read_be32(struct reader *r)
+{
+	const unsigned char *p = read_bytes(r, 4);
+	return p ? get_be32(p) : 0;
+}
+
+static void read_oid(struct reader *r, struct object_id *oid)
+{
+	const unsigned char *p = read_bytes(r, GIT_SHA1_RAWSZ);
+
+	if (p)
+		hashcpy(oid->hash, p);
+	else
+		oidclr(oid);
+}
+
+static char *read_path(struct reader *r)
+{
+	uint32_t len = read_be32(r);
+	const unsigned char *p = read_bytes(r, len);
+
+	return p ? xmemdupz(p, len) : NULL;
+}
+
+static int parse_blame_cache(struct blame_cache *bc, struct reader *r,
+			     const struct blame_scoreboard *sb,
+			     const struct object_id *commit,
+			     const char *path,
+			     const struct object_id *blob)
+{
+	const unsigned char *hdr = read_bytes(r, 8);
+	struct object_id oid;
+	char *p;
+	int i, lno, match;
+
+	if (!hdr || get_be32(hdr) != BLAME_CACHE_SIGNATURE ||
+	    hdr[4] != BLAME_CACHE_VERSION ||
+	    hdr[5] != BLAME_CACHE_OID_VERSION)
+		return -1;
+	read_oid(r, &oid);
+	if (oidcmp(&oid, commit))
+		return -1;
+	read_oid(r, &oid);
+	if (oidcmp(&oid, blob))
+		return -1;
+	if (read_be32(r) != (uint32_t)sb->xdl_opts ||
+	    read_be32(r) != blame_cache_flags(sb))
+		return -1;
+	bc->num_lines = read_be32(r);
+	bc->nr_origins = read_be32(r);
+	bc->nr_entries = read_be32(r);
+	p = read_path(r);
+	match = p && !strcmp(p, path);
+	free(p);
+	if (!match || bc->num_lines < 0 || bc->nr_origins < 0 ||
+	    bc->nr_entries < 0 ||
+	    /* each origin and each entry takes at least 16 bytes */
+	    (r->end - r->p) / 16 < (size_t)bc->nr_origins + bc->nr_entries)
+		return -1;
+
+	bc->origins = xcalloc(bc->nr_origins, sizeof(*bc->origins));
+	for (i = 0; i < bc->nr_origins; i++) {
+		struct blame_cache_origin *o = &bc->origins[i];
+
+		read_oid(r, &o->commit);
+		read_oid(r, &o->previous);
+		o->path = read_path(r);
+		o->previous_path = read_path(r);
+		if (r->bad)
+			return -1;
+		if (is_null_oid(&o->previous))
+			FREE_AND_NULL(o->previous_path);
+	}
+
+	ALLOC_ARRAY(bc->entries, bc->nr_entries);
+	for (i = lno = 0; i < bc->nr_entries; i++) {
+		struct blame_cache_entry *e = &bc->entries[i];
+
+		e->lno = read_be32(r);
+		e->num_lines = read_be32(r);
+		e->s_lno = read_be32(r);
+		e->origin = read_be32(r);
+		if (r->bad || e->lno != lno || e->num_lines <= 0 ||
+		    e->num_lines > bc->num_lines - lno || e->s_lno < 0 ||
+		    e->origin < 0 || e->origin >= bc->nr_origins)
+			return -1;
+		lno += e->num_lines;
+	}
+	if (lno != bc->num_lines || r->p != r->end)
+		return -1;
+	return 0;
+}
+
+int blame_cache_read(struct blame_cache *bc,
+		     const struct blame_scoreboard *sb,
+		     const struct object_id *commit,
+		     const char *path,
+		     const struct object_id *blob)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct reader r;
+	char *filename;
+	int ret;
+
+	memset(bc, 0, sizeof(*bc));
+	filename = blame_cache_filename(commit, path);
+	ret = strbuf_read_file(&buf, filename, 0);
+	free(filename);
+	if (ret < 0) {
+		strbuf_release(&buf);
+		return -1;
+	}
+
+	r.p = (const unsigned char *)buf.buf;
+	r.end = r.p + buf.len;
+	r.bad = 0;
+	ret = parse_blame_cache(bc, &r, sb, commit, path, blob);
+	strbuf_release(&buf);
+	if (ret)
+		blame_cache_release(bc);
+	return ret;
+}
+
+void blame_cache_release(struct blame_cache *bc)
+{
+	int i;
+
+	for (i = 0; i < bc->nr_origins; i++) {
+		free(bc->origins[i].path);
+		free(bc->origins[i].previous_path);
+	}
+	free(bc->origins);
+	free(bc->entries);
+	memset(bc, 0, sizeof(*bc));
+}
+
+static int origin_cmp(const void *a_, const void *b_)
+{
+	const struct blame_origin *a = *(const struct blame_origin **)a_;
+	const struct blame_origin *b = *(const struct blame_origin **)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+static int entry_cmp(const void *a_, const void *b_)
+{
+	const struct blame_entry *a = *(const struct blame_entry **)a_;
+	const struct blame_entry *b = *(const struct blame_entry **)b_;
+
+	return a->lno - b->lno;
+}
+
+static void add_be32(struct strbuf *buf, uint32_t v)
+{
+	unsigned char p[4];
+
+	put_be32(p, v);
+	strbuf_add(buf, p, sizeof(p));
+}
+
+static void add_path(struct strbuf *buf, const char *path)
+{
+	size_t len = strlen(path);
+
+	add_be32(buf, len);
+	strbuf_add(buf, path, len);
+}
+
+void blame_cache_write(const struct blame_scoreboard *sb)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_origin **origins;
+	struct blame_entry *e, **entries;
+	struct object_id blob;
+	unsigned mode;
+	char *filename;
+	int i, nr, nr_origins, lno;
+
+	if (is_null_oid(&sb->final->object.oid))
+		return; /* the working tree is not a commit */
+	if (get_tree_entry(&sb->final->object.oid, sb->path, &blob, &mode))
+		return;
+
+	for (nr = 0, e = sb->ent; e; e = e->next)
+		nr++;
+	ALLOC_ARRAY(entries, nr);
+	ALLOC_ARRAY(origins, nr);
+	for (i = 0, e = sb->ent; e; e = e->next, i++) {
+		entries[i] = e;
+		origins[i] = e->suspect;
+	}
+	QSORT(entries, nr, entry_cmp);
+	QSORT(origins, nr, origin_cmp);
+	for (i = nr_origins = 0; i < nr; i++)
+		if (!nr_origins || origins[nr_origins - 1] != origins[i])
+			origins[nr_origins++] = origins[i];
+
+	/* only the blame of all the lines can be resumed from */
+	for (i = lno = 0; i < nr; i++) {
+		if (entries[i]->lno != lno)
+			goto out;
+		lno += entries[i]->num_lines;
+	}
+	if (!lno || lno != sb->num_lines)
+		goto out;
+
+	strbuf_add(&buf, "BLMC", 4);
+	strbuf_addch(&buf, BLAME_CACHE_VERSION);
+	strbuf_addch(&buf, BLAME_CACHE_OID_VERSION);
+	strbuf_addch(&buf, 0);
+	strbuf_addch(&buf, 0);
+	strbuf_add(&buf, sb->final->object.oid.hash, GIT_SHA1_RAWSZ);
+	strbuf_add(&buf, blob.hash, GIT_SHA1_RAWSZ);
+	add_be32(&buf, sb->xdl_opts);
+	add_be32(&buf, blame_cache_flags(sb));
+	add_be32(&buf, sb->num_lines);
+	add_be32(&buf, nr_origins);
+	add_be32(&buf, nr);
+	add_path(&buf, sb->path);
+	for (i = 0; i < nr_origins; i++) {
+		struct blame_origin *o = origins[i];
+
+		strbuf_add(&buf, o->commit->object.oid.hash, GIT_SHA1_RAWSZ);
+		strbuf_add(&buf, o->previous ?
+			   o->previous->commit->object.oid.hash :
+			   null_oid.hash, GIT_SHA1_RAWSZ);
+		add_path(&buf, o->path);
+		add_path(&buf, o->previous ? o->previous->path : "");
+	}
+	for (i = 0; i < nr; i++) {
+		struct blame_origin **o;
+
+		o = bsearch(&entries[i]->suspect, origins, nr_origins,
+			    sizeof(*origins), origin_cmp);
+		add_be32(&buf, entries[i]->lno);
+		add_be32(&buf, entries[i]->num_lines);
+		add_be32(&buf, entries[i]->s_lno);
+		add_be32(&buf, o - origins);
+	}
+
+	/*
+	 * The cache only saves work; if we cannot write it, the next
+	 * blame will just dig through history again.
+	 */
+	filename = blame_cache_filename(&sb->final->object.oid, sb->path);
+	if (safe_create_leading_directories(filename) == SCLD_OK &&
+	    hold_lock_file_for_update(&lock, filename, 0) >= 0) {
+		if (write_in_full(get_lock_file_fd(&lock), buf.buf, buf.len) < 0)
+			rollback_lock_file(&lock);
+		else
+			commit_lock_file(&lock);
+	}
+	free(filename);
+out:
+	strbuf_release(&buf);
+	free(entries);
+	free(origins);
+}
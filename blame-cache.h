@@ -0,0 +1,59 @@
+#ifndef BLAME_CACHE_H
+#define BLAME_CACHE_H
+
+struct blame_scoreboard;
+
+/*
+ * The blame cache keeps in $GIT_DIR/blame-cache the result of blaming a
+ * whole file up to a commit, so that a later blame reaching the same
+ * path in that commit can take the lines from it instead of digging
+ * through the rest of history again. It is only used when blame.cache
+ * is true, and for blames whose result only depends on the commit and
+ * the path: see the callers in builtin/blame.c and blame.c.
+ */
+
+struct blame_cache_origin {
+	struct object_id commit;
+	char *path;
+	/* the origin blamed before it, if previous_path is not NULL */
+	struct object_id previous;
+	char *previous_path;
+};
+
+struct blame_cache_entry {
+	/* lines lno to lno + num_lines - 1 of the file came from */
+	int lno, num_lines;
+	/* the lines starting at s_lno of origins[origin] */
+	int s_lno, origin;
+};
+
+struct blame_cache {
+	int num_lines;
+	struct blame_cache_origin *origins;
+	int nr_origins;
+	/* sorted by lno, each starting where the previous one ends */
+	struct blame_cache_entry *entries;
+	int nr_entries;
+};
+
+extern int blame_cache_enabled(void);
+
+/*
+ * Read the blame of "path" up to "commit", where the path has the
+ * contents "blob", with the options of "sb" into "bc". Return 0 on
+ * success, and -1 if there is no such blame in the cache.
+ */
+extern int blame_cache_read(struct blame_cache *bc,
+			    const struct blame_scoreboard *sb,
+			    const struct object_id *commit,
+			    const char *path,
+			    const struct object_id *blob);
+extern void blame_cache_release(struct blame_cache *bc);
+
+/*
+ * Save the blame found in "sb", if it is the blame of the whole file
+ * in a commit.
+ */
+extern void blame_cache_write(const struct blame_scoreboard *sb);
+
+#endif
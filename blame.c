@@ -7,8 +7,11 @@
 #include "diffcore.h"
 #include "tag.h"
 #include "blame.h"
+#include "blame-cache.h"
 #include "alloc.h"
 #include "commit-slab.h"
+#include "config.h"
+#include "thread-utils.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -176,7 +179,7 @@ static struct commit *fake_working_tree_commit(struct diff_options *opt,
 	struct strbuf buf = STRBUF_INIT;
 	const char *ident;
 	time_t now;
-	int size, len;
+	int len;
 	struct cache_entry *ce;
 	unsigned mode;
 	struct strbuf msg = STRBUF_INIT;
@@ -274,8 +277,7 @@ static struct commit *fake_working_tree_commit(struct diff_options *opt,
 			/* Let's not bother reading from HEAD tree */
 			mode = S_IFREG | 0644;
 	}
-	size = cache_entry_size(len);
-	ce = xcalloc(1, size);
+	ce = make_empty_cache_entry(&the_index, len);
 	oidcpy(&ce->oid, &origin->blob_oid);
 	memcpy(ce->name, path, len);
 	ce->ce_flags = create_ce_flags(0);
@@ -303,6 +305,36 @@ static int diff_hunks(mmfile_t *file_a, mmfile_t *file_b,
 	return xdi_diff(file_a, file_b, &xpp, &xecfg, &ecb);
 }
 
+/*
+ * Prepare file_a to be diffed by diff_hunks_prepared() against the many
+ * blame entries we look for in it.
+ */
+static xdprepared_t *prepare_hunks(mmfile_t *file_a, int xdl_opts)
+{
+	xpparam_t xpp = {0};
+	xdprepared_t *prep;
+
+	xpp.flags = xdl_opts;
+	prep = xdi_prepare_file(file_a, &xpp);
+	if (!prep)
+		die("unable to prepare diff");
+	return prep;
+}
+
+static int diff_hunks_prepared(xdprepared_t *prep, mmfile_t *file_b,
+			       xdl_emit_hunk_consume_func_t hunk_func,
+			       void *cb_data, int xdl_opts)
+{
+	xpparam_t xpp = {0};
+	xdemitconf_t xecfg = {0};
+	xdemitcb_t ecb = {NULL};
+
+	xpp.flags = xdl_opts;
+	xecfg.hunk_func = hunk_func;
+	ecb.priv = cb_data;
+	return xdi_diff_prepared(prep, file_b, &xpp, &xecfg, &ecb);
+}
+
 /*
  * Given an origin, prepare mmfile_t structure to be used by the
  * diff machinery
@@ -951,18 +983,34 @@ static int blame_chunk_cb(long start_a, long count_a,
 	return 0;
 }
 
+/*
+ * The hunks of the diff between a parent and the target, when they were
+ * computed before pass_blame_to_parent() needs them.
+ */
+struct parent_diff {
+	struct parent_hunk {
+		long start_a, count_a;
+		long start_b, count_b;
+	} *hunks;
+	int nr, alloc;
+	int ret;
+};
+
 /*
  * We are looking at the origin 'target' and aiming to pass blame
  * for the lines it is suspected to its parent.  Run diff to find
- * which lines came from parent and pass blame for them.
+ * which lines came from parent and pass blame for them, or use the
+ * hunks in "pd" if they were already found.
  */
 static void pass_blame_to_parent(struct blame_scoreboard *sb,
 				 struct blame_origin *target,
-				 struct blame_origin *parent)
+				 struct blame_origin *parent,
+				 struct parent_diff *pd)
 {
 	mmfile_t file_p, file_o;
 	struct blame_chunk_cb_data d;
 	struct blame_entry *newdest = NULL;
+	int i, ret;
 
 	if (!target->suspects)
 		return; /* nothing remains for this target */
@@ -975,7 +1023,14 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 	fill_origin_blob(&sb->revs->diffopt, target, &file_o, &sb->num_read_blob);
 	sb->num_get_patch++;
 
-	if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
+	if (!pd)
+		ret = diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts);
+	else if (!(ret = pd->ret))
+		for (i = 0; i < pd->nr; i++)
+			blame_chunk_cb(pd->hunks[i].start_a, pd->hunks[i].count_a,
+				       pd->hunks[i].start_b, pd->hunks[i].count_b,
+				       &d);
+	if (ret)
 		die("unable to generate diff (%s -> %s)",
 		    oid_to_hex(&parent->commit->object.oid),
 		    oid_to_hex(&target->commit->object.oid));
@@ -1098,14 +1153,14 @@ static int handle_split_cb(long start_a, long count_a,
 
 /*
  * Find the lines from parent that are the same as ent so that
- * we can pass blames to it.  file_p has the blob contents for
- * the parent.
+ * we can pass blames to it.  prep has the blob contents for
+ * the parent, prepared by prepare_hunks().
  */
 static void find_copy_in_blob(struct blame_scoreboard *sb,
 			      struct blame_entry *ent,
 			      struct blame_origin *parent,
 			      struct blame_entry *split,
-			      mmfile_t *file_p)
+			      xdprepared_t *prep)
 {
 	const char *cp;
 	mmfile_t file_o;
@@ -1125,7 +1180,7 @@ static void find_copy_in_blob(struct blame_scoreboard *sb,
 	 * file_p partially may match that image.
 	 */
 	memset(split, 0, sizeof(struct blame_entry [3]));
-	if (diff_hunks(file_p, &file_o, handle_split_cb, &d, sb->xdl_opts))
+	if (diff_hunks_prepared(prep, &file_o, handle_split_cb, &d, sb->xdl_opts))
 		die("unable to generate diff (%s)",
 		    oid_to_hex(&parent->commit->object.oid));
 	/* remainder, if any, all match the preimage */
@@ -1174,6 +1229,7 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
 	mmfile_t file_p;
+	xdprepared_t *prep;
 
 	if (!unblamed)
 		return; /* nothing remains for this target */
@@ -1181,6 +1237,7 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 	fill_origin_blob(&sb->revs->diffopt, parent, &file_p, &sb->num_read_blob);
 	if (!file_p.ptr)
 		return;
+	prep = prepare_hunks(&file_p, sb->xdl_opts);
 
 	/* At each iteration, unblamed has a NULL-terminated list of
 	 * entries that have not yet been tested for blame.  leftover
@@ -1192,7 +1249,7 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 		struct blame_entry *next;
 		for (e = unblamed; e; e = next) {
 			next = e->next;
-			find_copy_in_blob(sb, e, parent, split, &file_p);
+			find_copy_in_blob(sb, e, parent, split, prep);
 			if (split[1].suspect &&
 			    sb->move_score < blame_entry_score(sb, &split[1])) {
 				split_blame(blamed, &unblamedtail, split, e);
@@ -1206,6 +1263,7 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 		toosmall = filter_small(sb, toosmall, &unblamed, sb->move_score);
 	} while (unblamed);
 	target->suspects = reverse_blame(leftover, NULL);
+	xdl_free_prepared(prep);
 }
 
 struct blame_list {
@@ -1294,6 +1352,7 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 			struct diff_filepair *p = diff_queued_diff.queue[i];
 			struct blame_origin *norigin;
 			mmfile_t file_p;
+			xdprepared_t *prep;
 			struct blame_entry potential[3];
 
 			if (!DIFF_FILE_VALID(p->one))
@@ -1311,13 +1370,15 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 			if (!file_p.ptr)
 				continue;
 
+			prep = prepare_hunks(&file_p, sb->xdl_opts);
 			for (j = 0; j < num_ents; j++) {
 				find_copy_in_blob(sb, blame_list[j].ent,
-						  norigin, potential, &file_p);
+						  norigin, potential, prep);
 				copy_split_if_better(sb, blame_list[j].split,
 						     potential);
 				decref_split(potential);
 			}
+			xdl_free_prepared(prep);
 			blame_origin_decref(norigin);
 		}
 
@@ -1416,6 +1477,150 @@ static void distribute_blame(struct blame_scoreboard *sb, struct blame_entry *bl
 
 #define MAXSG 16
 
+#ifndef NO_PTHREADS
+
+/*
+ * Diffing the target against its parents in threads only pays off for
+ * large files: give every thread at least THREAD_COST bytes of the
+ * target to diff, and use at most MAX_PARALLEL of them.
+ */
+#define MAX_PARALLEL (16)
+#define THREAD_COST (64 * 1024)
+
+struct parent_diff_thread {
+	pthread_t pthread;
+	struct parent_diff *diffs;
+	mmfile_t *files, file_o;
+	int xdl_opts;
+	int first, step, nr;
+};
+
+static int collect_hunk_cb(long start_a, long count_a,
+			   long start_b, long count_b, void *data)
+{
+	struct parent_diff *pd = data;
+	struct parent_hunk *h;
+
+	ALLOC_GROW(pd->hunks, pd->nr + 1, pd->alloc);
+	h = &pd->hunks[pd->nr++];
+	h->start_a = start_a;
+	h->count_a = count_a;
+	h->start_b = start_b;
+	h->count_b = count_b;
+	return 0;
+}
+
+static void *parent_diff_thread(void *data)
+{
+	struct parent_diff_thread *t = data;
+	int i;
+
+	for (i = t->first; i < t->nr; i += t->step) {
+		if (!t->files[i].ptr)
+			continue;
+		t->diffs[i].ret = diff_hunks(&t->files[i], &t->file_o,
+					     collect_hunk_cb, &t->diffs[i],
+					     t->xdl_opts);
+	}
+	return NULL;
+}
+
+static int parent_diff_threads(unsigned long size, int num_parents)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_BLAME_THREADS", 0);
+
+	if (!nr_threads) {
+		nr_threads = (uint64_t)size * num_parents / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	if (nr_threads > num_parents)
+		nr_threads = num_parents;
+	return nr_threads;
+}
+
+/*
+ * The diff between the target and each of its parents depends on their
+ * contents alone, not on which lines are still to be blamed, so when
+ * there are several parents we can find all the hunks at once, in
+ * threads, and then let pass_blame_to_parent() pass blame for them one
+ * parent after the other as usual. Reading the blobs is not thread-safe
+ * and is done first.
+ */
+static struct parent_diff *diff_parents_threaded(struct blame_scoreboard *sb,
+						 struct blame_origin *target,
+						 struct blame_origin **sg_origin,
+						 int num_sg)
+{
+	struct parent_diff_thread *threads;
+	struct parent_diff *diffs;
+	mmfile_t file_o, *files;
+	int i, num_parents, nr_threads;
+
+	for (num_parents = i = 0; i < num_sg; i++)
+		if (sg_origin[i])
+			num_parents++;
+	if (num_parents < 2)
+		return NULL;
+	fill_origin_blob(&sb->revs->diffopt, target, &file_o, &sb->num_read_blob);
+	nr_threads = parent_diff_threads(file_o.size, num_parents);
+	if (nr_threads < 2)
+		return NULL;
+
+	files = xcalloc(num_sg, sizeof(*files));
+	for (i = 0; i < num_sg; i++)
+		if (sg_origin[i])
+			fill_origin_blob(&sb->revs->diffopt, sg_origin[i],
+					 &files[i], &sb->num_read_blob);
+
+	diffs = xcalloc(num_sg, sizeof(*diffs));
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		struct parent_diff_thread *t = &threads[i];
+
+		t->diffs = diffs;
+		t->files = files;
+		t->file_o = file_o;
+		t->xdl_opts = sb->xdl_opts;
+		t->first = i;
+		t->step = nr_threads;
+		t->nr = num_sg;
+		if (pthread_create(&t->pthread, NULL, parent_diff_thread, t))
+			die("unable to create threaded blame");
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die("unable to join threaded blame");
+	free(threads);
+	free(files);
+	return diffs;
+}
+
+#else
+
+static struct parent_diff *diff_parents_threaded(struct blame_scoreboard *sb,
+						 struct blame_origin *target,
+						 struct blame_origin **sg_origin,
+						 int num_sg)
+{
+	return NULL;
+}
+
+#endif
+
+static void free_parent_diffs(struct parent_diff *diffs, int num_sg)
+{
+	int i;
+
+	if (!diffs)
+		return;
+	for (i = 0; i < num_sg; i++)
+		free(diffs[i].hunks);
+	free(diffs);
+}
+
 static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin, int opt)
 {
 	struct rev_info *revs = sb->revs;
@@ -1426,6 +1631,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	struct blame_origin *porigin, **sg_origin = sg_buf;
 	struct blame_entry *toosmall = NULL;
 	struct blame_entry *blames, **blametail = &blames;
+	struct parent_diff *diffs = NULL;
 
 	num_sg = num_scapegoats(revs, commit, sb->reverse);
 	if (!num_sg)
@@ -1475,6 +1681,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	}
 
 	sb->num_commits++;
+	diffs = diff_parents_threaded(sb, origin, sg_origin, num_sg);
 	for (i = 0, sg = first_scapegoat(revs, commit, sb->reverse);
 	     i < num_sg && sg;
 	     sg = sg->next, i++) {
@@ -1485,7 +1692,8 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 			blame_origin_incref(porigin);
 			origin->previous = porigin;
 		}
-		pass_blame_to_parent(sb, origin, porigin);
+		pass_blame_to_parent(sb, origin, porigin,
+				     diffs ? &diffs[i] : NULL);
 		if (!origin->suspects)
 			goto finish;
 	}
@@ -1559,12 +1767,113 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	drop_origin_blob(origin);
 	if (sg_buf != sg_origin)
 		free(sg_origin);
+	free_parent_diffs(diffs, num_sg);
 }
 
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
  * to its parents. */
+/*
+ * Find the first entry of the cached blame that covers line lno.
+ */
+static int find_cached_entry(struct blame_cache *bc, int lno)
+{
+	int lo = 0, hi = bc->nr_entries;
+
+	while (lo + 1 < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (bc->entries[mi].lno <= lno)
+			lo = mi;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+/*
+ * If the blame of the whole file of origin up to its commit is in the
+ * blame cache, blame the lines origin is suspected for from it instead
+ * of digging further, and return 1. Who is to blame for the lines of a
+ * file in a commit does not depend on where they ended up later, so
+ * each suspect can be split like the cached blame of the lines it
+ * covers.
+ */
+static int resume_from_cache(struct blame_scoreboard *sb,
+			     struct blame_origin *origin)
+{
+	struct blame_cache bc;
+	struct blame_origin **origins;
+	struct blame_entry *e, *next;
+	int i;
+
+	if (!sb->use_cache || is_null_oid(&origin->commit->object.oid) ||
+	    blame_cache_read(&bc, sb, &origin->commit->object.oid,
+			     origin->path, &origin->blob_oid))
+		return 0;
+	for (e = origin->suspects; e; e = e->next)
+		if (e->s_lno + e->num_lines > bc.num_lines)
+			goto fail;
+
+	origins = xcalloc(bc.nr_origins, sizeof(*origins));
+	for (i = 0; i < bc.nr_origins; i++) {
+		struct blame_cache_origin *co = &bc.origins[i];
+		struct commit *commit = lookup_commit(&co->commit);
+		struct blame_origin *o;
+
+		if (!commit || parse_commit(commit)) {
+			while (i--)
+				blame_origin_decref(origins[i]);
+			free(origins);
+			goto fail;
+		}
+		/* treat root commit as boundary, as we would have */
+		if (!commit->parents && !sb->show_root)
+			commit->object.flags |= UNINTERESTING;
+		o = origins[i] = get_origin(commit, co->path);
+		if (co->previous_path && !o->previous) {
+			commit = lookup_commit(&co->previous);
+			if (commit)
+				o->previous = get_origin(commit, co->previous_path);
+		}
+	}
+
+	for (e = origin->suspects; e; e = next) {
+		int lno = e->s_lno, end = e->s_lno + e->num_lines;
+
+		next = e->next;
+		for (i = find_cached_entry(&bc, lno); lno < end; i++) {
+			struct blame_cache_entry *ce = &bc.entries[i];
+			struct blame_entry *n = xcalloc(1, sizeof(*n));
+
+			n->lno = e->lno + lno - e->s_lno;
+			n->num_lines = (end < ce->lno + ce->num_lines ?
+					end : ce->lno + ce->num_lines) - lno;
+			n->s_lno = ce->s_lno + lno - ce->lno;
+			n->suspect = blame_origin_incref(origins[ce->origin]);
+			n->suspect->guilty = 1;
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(n, sb->found_guilty_entry_data);
+			n->next = sb->ent;
+			sb->ent = n;
+			lno += n->num_lines;
+		}
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	origin->suspects = NULL;
+
+	for (i = 0; i < bc.nr_origins; i++)
+		blame_origin_decref(origins[i]);
+	free(origins);
+	blame_cache_release(&bc);
+	return 1;
+
+fail:
+	blame_cache_release(&bc);
+	return 0;
+}
+
 void assign_blame(struct blame_scoreboard *sb, int opt)
 {
 	struct rev_info *revs = sb->revs;
@@ -1590,6 +1899,10 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		 * so hold onto it in the meantime.
 		 */
 		blame_origin_incref(suspect);
+		if (resume_from_cache(sb, suspect)) {
+			blame_origin_decref(suspect);
+			continue;
+		}
 		parse_commit(commit);
 		if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
@@ -141,6 +141,8 @@ struct blame_scoreboard {
 	int xdl_opts;
 	int no_whole_file_rename;
 	int debug;
+	/* resume from blames in the blame cache */
+	int use_cache;
 
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
@@ -0,0 +1,236 @@
+#include "cache.h"
+#include "bloom.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "commit.h"
+#include "revision.h"
+#include "commit-slab.h"
+#include "commit-graph.h"
+#include "string-list.h"
+
+define_commit_slab(bloom_filter_slab, struct bloom_filter);
+
+static struct bloom_filter_slab bloom_filters;
+
+static uint32_t rotate_left(uint32_t value, int32_t count)
+{
+	uint32_t mask = 8 * sizeof(uint32_t) - 1;
+	count &= mask;
+	return ((value << count) | (value >> ((-count) & mask)));
+}
+
+static inline unsigned char get_bitmask(uint32_t pos)
+{
+	return ((unsigned char)1) << (pos & (BITS_PER_WORD - 1));
+}
+
+/*
+ * Calculate the murmur3 32-bit hash value for the given data
+ * using the given seed.
+ * Produces a uniformly distributed hash value.
+ * Not considered to be cryptographically secure.
+ * Implemented as described in https://en.wikipedia.org/wiki/MurmurHash#Algorithm
+ */
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t r1 = 15;
+	const uint32_t r2 = 13;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	size_t i, len4 = len / sizeof(uint32_t);
+	uint32_t k1 = 0;
+	const unsigned char *tail;
+
+	for (i = 0; i < len4; i++) {
+		uint32_t byte1 = (uint32_t)bytes[4*i];
+		uint32_t byte2 = ((uint32_t)bytes[4*i + 1]) << 8;
+		uint32_t byte3 = ((uint32_t)bytes[4*i + 2]) << 16;
+		uint32_t byte4 = ((uint32_t)bytes[4*i + 3]) << 24;
+		uint32_t k = byte1 | byte2 | byte3 | byte4;
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+
+		seed ^= k;
+		seed = rotate_left(seed, r2) * m + n;
+	}
+
+	tail = (bytes + len4 * sizeof(uint32_t));
+
+	switch (len & (sizeof(uint32_t) - 1)) {
+	case 3:
+		k1 ^= ((uint32_t)tail[2]) << 16;
+		/*-fallthrough*/
+	case 2:
+		k1 ^= ((uint32_t)tail[1]) << 8;
+		/*-fallthrough*/
+	case 1:
+		k1 ^= ((uint32_t)tail[0]) << 0;
+		k1 *= c1;
+		k1 = rotate_left(k1, r1);
+		k1 *= c2;
+		seed ^= k1;
+		break;
+	}
+
+	seed ^= (uint32_t)len;
+	seed ^= (seed >> 16);
+	seed *= 0x85ebca6b;
+	seed ^= (seed >> 13);
+	seed *= 0xc2b2ae35;
+	seed ^= (seed >> 16);
+
+	return seed;
+}
+
+void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	uint32_t i;
+	const uint32_t seed0 = 0x293ae76f;
+	const uint32_t seed1 = 0x7e646e2c;
+	const uint32_t hash0 = murmur3_seeded(seed0, data, len);
+	const uint32_t hash1 = murmur3_seeded(seed1, data, len);
+
+	ALLOC_ARRAY(key->hashes, settings->num_hashes);
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	FREE_AND_NULL(key->hashes);
+}
+
+void add_key_to_filter(const struct bloom_key *key, struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	uint32_t i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		filter->data[block_pos] |= get_bitmask(hash_mod);
+	}
+}
+
+void init_bloom_filters(void)
+{
+	init_bloom_filter_slab(&bloom_filters);
+}
+
+/*
+ * Add "path" and each of its leading directories to "paths", so that
+ * "git log dir/subdir" can use the filter as well as "git log dir/file".
+ * Directories are added without their trailing slash.
+ */
+static void add_path_and_leading_dirs(struct string_list *paths, const char *path)
+{
+	const char *slash;
+
+	string_list_insert(paths, path);
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+		char *dir = xmemdupz(path, slash - path);
+		string_list_insert(paths, dir);
+		free(dir);
+	}
+}
+
+struct bloom_filter *get_bloom_filter(struct commit *c,
+				      int compute_if_not_present)
+{
+	struct bloom_filter *filter;
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct diff_options diffopt;
+	int i;
+
+	if (!bloom_filters.slab_size)
+		return NULL;
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+
+	if (!filter->data) {
+		load_commit_graph_info(c);
+		if (c->graph_pos != COMMIT_NOT_FROM_GRAPH &&
+		    load_bloom_filter_from_graph(c, filter))
+			return filter;
+	}
+
+	if (filter->data || !compute_if_not_present)
+		return filter->data ? filter : NULL;
+
+	diff_setup(&diffopt);
+	diffopt.flags.recursive = 1;
+	diff_setup_done(&diffopt);
+
+	if (c->parents && parse_commit(c->parents->item))
+		return NULL;
+
+	if (c->parents)
+		diff_tree_oid(get_commit_tree_oid(c->parents->item),
+			      get_commit_tree_oid(c), "", &diffopt);
+	else
+		diff_tree_oid(NULL, get_commit_tree_oid(c), "", &diffopt);
+
+	if (diff_queued_diff.nr <= BLOOM_FILTER_MAX_CHANGED_PATHS) {
+		struct string_list paths = STRING_LIST_INIT_DUP;
+		struct string_list_item *item;
+
+		for (i = 0; i < diff_queued_diff.nr; i++)
+			add_path_and_leading_dirs(&paths,
+						  diff_queued_diff.queue[i]->two->path);
+
+		filter->len = (paths.nr * settings.bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+		if (!filter->len)
+			filter->len = 1;
+		filter->data = xcalloc(filter->len, sizeof(unsigned char));
+
+		for_each_string_list_item(item, &paths) {
+			struct bloom_key key;
+
+			fill_bloom_key(item->string, strlen(item->string), &key, &settings);
+			add_key_to_filter(&key, filter, &settings);
+			clear_bloom_key(&key);
+		}
+
+		string_list_clear(&paths, 0);
+	} else {
+		/* Too many changes: say "maybe" for every path. */
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xff;
+	}
+
+	for (i = 0; i < diff_queued_diff.nr; i++)
+		diff_free_filepair(diff_queued_diff.queue[i]);
+	free(diff_queued_diff.queue);
+	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+
+	return filter;
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	uint32_t i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	if (!mod)
+		return -1;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		if (!(filter->data[block_pos] & get_bitmask(hash_mod)))
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,88 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+struct commit;
+struct commit_graph;
+
+/*
+ * Parameters of the changed-path Bloom filters stored in the commit-graph
+ * (see Documentation/technical/commit-graph-format.txt).
+ */
+struct bloom_filter_settings {
+	/*
+	 * The version of the hashing technique being used. Only the
+	 * murmur3 double-hashing scheme (version 1) is known.
+	 */
+	uint32_t hash_version;
+
+	/* The number of times a path is hashed into the filter, i.e. "k". */
+	uint32_t num_hashes;
+
+	/* The number of filter bits used per changed path. */
+	uint32_t bits_per_entry;
+};
+
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10 }
+#define BITS_PER_WORD 8
+#define BLOOMDATA_CHUNK_HEADER_SIZE (3 * sizeof(uint32_t))
+
+/*
+ * Commits touching more than this many paths get a filter with every bit
+ * set, which never rules a path out.
+ */
+#define BLOOM_FILTER_MAX_CHANGED_PATHS 512
+
+/*
+ * A Bloom filter has a length of "len" bytes. A filter of length zero
+ * is never conclusive.
+ */
+struct bloom_filter {
+	unsigned char *data;
+	size_t len;
+};
+
+/*
+ * The "num_hashes" seeded hash values of a single path, computed once
+ * and then tested against the filter of every commit in a walk.
+ */
+struct bloom_key {
+	uint32_t *hashes;
+};
+
+/*
+ * Return a 32-bit MurmurHash3 of the first "len" bytes of "data" using
+ * the given "seed".
+ */
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len);
+
+void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+		    const struct bloom_filter_settings *settings);
+void clear_bloom_key(struct bloom_key *key);
+
+void add_key_to_filter(const struct bloom_key *key, struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings);
+
+/*
+ * Initialize the slab holding the filters of individual commits. Must be
+ * called before get_bloom_filter().
+ */
+void init_bloom_filters(void);
+
+/*
+ * Return the changed-path filter of "c" with respect to its first parent.
+ * The filter is read from the commit-graph when "c" has one there;
+ * otherwise it is computed from a tree diff if "compute_if_not_present"
+ * is set, and NULL is returned if not.
+ */
+struct bloom_filter *get_bloom_filter(struct commit *c,
+				      int compute_if_not_present);
+
+/*
+ * Return 0 if "key" is definitely not in "filter", 1 if it may be, and -1
+ * if the filter cannot tell.
+ */
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings);
+
+#endif
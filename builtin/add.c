@@ -19,6 +19,10 @@
 #include "bulk-checkin.h"
 #include "argv-array.h"
 #include "submodule.h"
+#include "object-store.h"
+#include "blob.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 static const char * const builtin_add_usage[] = {
 	N_("git add [<options>] [--] <pathspec>..."),
@@ -359,9 +363,174 @@ static void check_embedded_repo(const char *path)
 	strbuf_release(&name);
 }
 
+/*
+ * The new files are added in batches: the blobs of a batch are read,
+ * hashed and compressed by several threads, and then written out and
+ * added to the index in order by the main thread. Files that are to be
+ * converted, which takes the attributes, and those above
+ * core.bigFileThreshold, which are streamed, are added as usual.
+ */
+struct new_blob {
+	const char *path;
+	struct stat st;
+	struct object_id oid;
+	void *deflated;		/* NULL if it is to be added as usual */
+	unsigned long size;
+	unsigned prepare : 1;
+};
+
+/*
+ * Compress at most PREPARE_LIMIT bytes of files and BATCH_CHUNK files
+ * at a time, with threads which get at least THREAD_COST files each.
+ */
+#define MAX_PARALLEL (16)
+#define THREAD_COST (64)
+#define PREPARE_LIMIT (256 * 1024 * 1024)
+#define BATCH_CHUNK (4096)
+
+static int prepare_threads(int nr)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_ADD_THREADS", 0);
+
+	if (!nr_threads) {
+		nr_threads = nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	return nr_threads < 1 ? 1 : nr_threads;
+}
+
+struct prepare_thread {
+#ifndef NO_PTHREADS
+	pthread_t pthread;
+#endif
+	struct new_blob *blobs;
+	int first, step, nr;
+};
+
+static void prepare_blob(struct new_blob *b)
+{
+	size_t size = xsize_t(b->st.st_size);
+	struct stat_data sd;
+	struct stat st;
+	void *buf;
+	int fd;
+
+	fd = open(b->path, O_RDONLY);
+	if (fd < 0)
+		return;
+	buf = xmalloc(size + 1);
+	/* leave a file that changes under us to add_file_to_index() */
+	fill_stat_data(&sd, &b->st);
+	if (read_in_full(fd, buf, size) == size &&
+	    !fstat(fd, &st) && !match_stat_data(&sd, &st))
+		b->deflated = deflate_loose_object(buf, size, blob_type,
+						   &b->oid, &b->size);
+	free(buf);
+	close(fd);
+}
+
+static void *prepare_thread(void *data)
+{
+	struct prepare_thread *t = data;
+	int i;
+
+	for (i = t->first; i < t->nr; i += t->step)
+		if (t->blobs[i].prepare)
+			prepare_blob(&t->blobs[i]);
+	return NULL;
+}
+
+static int want_prepared_blob(struct new_blob *b)
+{
+	if (lstat(b->path, &b->st) || !S_ISREG(b->st.st_mode) ||
+	    b->st.st_size > big_file_threshold)
+		return 0;
+	if (index_file_exists(&the_index, b->path, strlen(b->path),
+			      ignore_case))
+		return 0;
+	return !would_convert_to_git(&the_index, b->path);
+}
+
+/*
+ * Fill "blobs" with the files at the start of "entries", prepare those
+ * that can be, and return how many were considered.
+ */
+static int prepare_new_blobs(struct dir_entry **entries, int nr,
+			     struct new_blob *blobs, int flags)
+{
+	struct prepare_thread *threads;
+	unsigned long total = 0;
+	int i, nr_threads, nr_prepare = 0;
+
+	if (nr > BATCH_CHUNK)
+		nr = BATCH_CHUNK;
+	for (i = 0; i < nr; i++) {
+		struct new_blob *b = &blobs[i];
+
+		memset(b, 0, sizeof(*b));
+		b->path = entries[i]->name;
+		if ((flags & (ADD_CACHE_PRETEND | ADD_CACHE_INTENT)) ||
+		    !want_prepared_blob(b))
+			continue;
+		if (total && b->st.st_size > PREPARE_LIMIT - total)
+			break;
+		total += b->st.st_size;
+		b->prepare = 1;
+		nr_prepare++;
+	}
+	nr = i;
+	if (!nr_prepare)
+		return nr;
+
+	nr_threads = prepare_threads(nr_prepare);
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].blobs = blobs;
+		threads[i].first = i;
+		threads[i].step = nr_threads;
+		threads[i].nr = nr;
+	}
+#ifndef NO_PTHREADS
+	if (nr_threads > 1) {
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i].pthread, NULL,
+					   prepare_thread, &threads[i]))
+				die("unable to create threaded add");
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i].pthread, NULL))
+				die("unable to join threaded add");
+	} else
+#endif
+		prepare_thread(&threads[0]);
+	free(threads);
+	return nr;
+}
+
+static int add_new_blob(struct new_blob *b, int flags)
+{
+	int ret;
+
+	if (!b->deflated)
+		return add_file_to_index(&the_index, b->path, flags);
+	if (write_deflated_loose_object(&b->oid, b->deflated, b->size))
+		ret = error("unable to index file %s", b->path);
+	else
+		ret = add_blob_to_index(&the_index, b->path, &b->st,
+					&b->oid, flags);
+	FREE_AND_NULL(b->deflated);
+	return ret;
+}
+
 static int add_files(struct dir_struct *dir, int flags)
 {
-	int i, exit_status = 0;
+	int i, j, nr, exit_status = 0;
+	struct new_blob *blobs;
+	intmax_t nr_prepared = 0;
 
 	if (dir->ignored_nr) {
 		fprintf(stderr, _(ignore_error));
@@ -371,14 +540,25 @@ static int add_files(struct dir_struct *dir, int flags)
 		exit_status = 1;
 	}
 
-	for (i = 0; i < dir->nr; i++) {
-		check_embedded_repo(dir->entries[i]->name);
-		if (add_file_to_index(&the_index, dir->entries[i]->name, flags)) {
-			if (!ignore_add_errors)
-				die(_("adding files failed"));
-			exit_status = 1;
+	blobs = xcalloc(dir->nr < BATCH_CHUNK ? dir->nr : BATCH_CHUNK,
+			sizeof(*blobs));
+	for (i = 0; i < dir->nr; i += nr) {
+		nr = prepare_new_blobs(dir->entries + i, dir->nr - i,
+				       blobs, flags);
+		for (j = 0; j < nr; j++) {
+			check_embedded_repo(blobs[j].path);
+			if (blobs[j].deflated)
+				nr_prepared++;
+			if (add_new_blob(&blobs[j], flags)) {
+				if (!ignore_add_errors)
+					die(_("adding files failed"));
+				exit_status = 1;
+			}
 		}
 	}
+	free(blobs);
+	if (nr_prepared)
+		trace2_data_intmax("add", "prepared_blobs", nr_prepared);
 	return exit_status;
 }
 
@@ -394,6 +574,7 @@ int cmd_add(int argc, const char **argv, const char *prefix)
 	struct lock_file lock_file = LOCK_INIT;
 
 	git_config(add_config, NULL);
+	command_requires_full_index = 0;
 
 	argc = parse_options(argc, argv, prefix, builtin_add_options,
 			  builtin_add_usage, PARSE_OPT_KEEP_ARGV0);
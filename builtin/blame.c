@@ -26,6 +26,7 @@
 #include "progress.h"
 #include "object-store.h"
 #include "blame.h"
+#include "blame-cache.h"
 #include "string-list.h"
 
 static char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
@@ -671,6 +672,33 @@ static const char *add_prefix(const char *prefix, const char *path)
 	return prefix_path(prefix, prefix ? strlen(prefix) : 0, path);
 }
 
+/*
+ * The blame cache keeps the blame of whole files as the walk of all of
+ * history finds it, so there must be no commits to stop at, and no
+ * move or copy detection or textconv, whose results depend on more than
+ * the commit and the path.
+ */
+static int can_use_blame_cache(struct rev_info *revs, const char *path,
+			       int opt, const char *revs_file)
+{
+	struct userdiff_driver *driver;
+	int i;
+
+	if (!blame_cache_enabled() || reverse || revs_file ||
+	    (opt & (PICKAXE_BLAME_MOVE | PICKAXE_BLAME_COPY)) ||
+	    revs->max_age != -1)
+		return 0;
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return 0;
+	if (revs->diffopt.flags.allow_textconv) {
+		driver = userdiff_find_by_path(path);
+		if (driver && driver->textconv)
+			return 0;
+	}
+	return 1;
+}
+
 static int git_blame_config(const char *var, const char *value, void *cb)
 {
 	if (!strcmp(var, "blame.showroot")) {
@@ -985,6 +1013,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	setup_revisions(argc, argv, &revs, NULL);
 
 	init_scoreboard(&sb);
+	sb.use_cache = can_use_blame_cache(&revs, path, opt, revs_file);
 	sb.revs = &revs;
 	sb.contents_from = contents_from;
 	sb.reverse = reverse;
@@ -1055,6 +1084,9 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	stop_progress(&pi.progress);
 
+	if (sb.use_cache)
+		blame_cache_write(&sb);
+
 	if (!incremental)
 		setup_pager();
 	else
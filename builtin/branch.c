@@ -10,6 +10,7 @@
 #include "color.h"
 #include "refs.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "builtin.h"
 #include "remote.h"
 #include "parse-options.h"
@@ -412,6 +413,7 @@ static void print_ref_list(struct ref_filter *filter, struct ref_sorting *sortin
 		die(_("unable to parse format string"));
 
 	ref_array_sort(sorting, &array);
+	ref_array_populate(&array, array.nr);
 
 	for (i = 0; i < array.nr; i++) {
 		struct strbuf out = STRBUF_INIT;
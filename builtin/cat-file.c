@@ -14,13 +14,23 @@
 #include "sha1-array.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "replace-object.h"
+#include "thread-utils.h"
+
+enum batch_order {
+	BATCH_ORDER_NONE = 0,	/* answer each line as soon as it is read */
+	BATCH_ORDER_INPUT,
+	BATCH_ORDER_PACK
+};
 
 struct batch_options {
 	int enabled;
 	int follow_symlinks;
 	int print_contents;
+	int command;	/* --batch-command */
 	int buffer_output;
 	int all_objects;
+	enum batch_order order;
 	int cmdmode; /* may be 'w' or 'c' for --filters or --textconv */
 	const char *format;
 };
@@ -211,6 +221,14 @@ struct expand_data {
 	 * optimized out.
 	 */
 	unsigned skip_object_info : 1;
+
+	/*
+	 * The contents of the object, if they were read ahead of time
+	 * (see --batch-order).
+	 */
+	void *contents;
+	unsigned long contents_size;
+	enum object_type contents_type;
 };
 
 static int is_atom(const char *atom, const char *s, int slen)
@@ -287,7 +305,13 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 
 	assert(data->info.typep);
 
-	if (data->type == OBJ_BLOB) {
+	if (data->contents) {
+		if (data->contents_type != data->type)
+			die("object %s changed type!?", oid_to_hex(oid));
+		if (data->info.sizep && data->contents_size != data->size)
+			die("object %s changed size!?", oid_to_hex(oid));
+		batch_write(opt, data->contents, data->contents_size);
+	} else if (data->type == OBJ_BLOB) {
 		if (opt->buffer_output)
 			fflush(stdout);
 		if (opt->cmdmode) {
@@ -362,59 +386,348 @@ static void batch_object_write(const char *obj_name, struct batch_options *opt,
 	}
 }
 
-static void batch_one_object(const char *obj_name, struct batch_options *opt,
-			     struct expand_data *data)
+/*
+ * Find the object "obj_name" names. If there is none to show, put what to
+ * print instead in "msg" and return -1.
+ */
+static int get_batch_oid(const char *obj_name, struct batch_options *opt,
+			 struct object_id *oid, struct strbuf *msg)
 {
 	struct object_context ctx;
 	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
 	enum follow_symlinks_result result;
 
-	result = get_oid_with_context(obj_name, flags, &data->oid, &ctx);
+	result = get_oid_with_context(obj_name, flags, oid, &ctx);
 	if (result != FOUND) {
 		switch (result) {
 		case MISSING_OBJECT:
-			printf("%s missing\n", obj_name);
+			strbuf_addf(msg, "%s missing\n", obj_name);
 			break;
 		case DANGLING_SYMLINK:
-			printf("dangling %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(msg, "dangling %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		case SYMLINK_LOOP:
-			printf("loop %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(msg, "loop %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		case NOT_DIR:
-			printf("notdir %"PRIuMAX"\n%s\n",
-			       (uintmax_t)strlen(obj_name), obj_name);
+			strbuf_addf(msg, "notdir %"PRIuMAX"\n%s\n",
+				    (uintmax_t)strlen(obj_name), obj_name);
 			break;
 		default:
 			BUG("unknown get_sha1_with_context result %d\n",
 			       result);
 			break;
 		}
-		fflush(stdout);
-		return;
+		return -1;
 	}
 
 	if (ctx.mode == 0) {
-		printf("symlink %"PRIuMAX"\n%s\n",
-		       (uintmax_t)ctx.symlink_path.len,
-		       ctx.symlink_path.buf);
+		strbuf_addf(msg, "symlink %"PRIuMAX"\n%s\n",
+			    (uintmax_t)ctx.symlink_path.len,
+			    ctx.symlink_path.buf);
+		return -1;
+	}
+	return 0;
+}
+
+static void batch_one_object(const char *obj_name, struct batch_options *opt,
+			     struct expand_data *data)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (get_batch_oid(obj_name, opt, &data->oid, &msg)) {
+		fputs(msg.buf, stdout);
 		fflush(stdout);
+		strbuf_release(&msg);
 		return;
 	}
 
 	batch_object_write(obj_name, opt, data);
 }
 
+/*
+ * With --batch-order, the objects are looked up in the order of the
+ * packs they are in and of their offsets there, which keeps the pack
+ * windows and the delta base cache warm, however the input is sorted.
+ * Their contents can be read ahead of time by several threads, and are
+ * kept until it is their turn to be shown.
+ */
+struct batch_entry {
+	char *name;		/* NULL with --batch-all-objects */
+	const char *rest;	/* points into "name" */
+	struct object_id oid;
+	char *msg;		/* what to print if there is no object */
+	struct packed_git *pack;
+	off_t offset;
+	int nr;			/* position in the input */
+	void *contents;
+	unsigned long size;
+	enum object_type type;
+	unsigned prefetch : 1;
+};
+
+struct batch_entries {
+	struct batch_entry *entry;
+	int nr, alloc;
+};
+
+/*
+ * Read ahead the contents of at most PREFETCH_LIMIT bytes of objects,
+ * with threads which get at least THREAD_COST objects each. Batches of
+ * the input are at most BATCH_CHUNK lines when the output is in input
+ * order, as their contents are all kept until the batch is shown.
+ */
+#define MAX_PARALLEL (16)
+#define THREAD_COST (16)
+#define PREFETCH_LIMIT (256 * 1024 * 1024)
+#define BATCH_CHUNK (4096)
+
+static void add_batch_entry(struct batch_entries *entries,
+			    const struct object_id *oid, char *name,
+			    const char *rest, char *msg)
+{
+	struct batch_entry *e;
+	struct pack_entry pe;
+
+	ALLOC_GROW(entries->entry, entries->nr + 1, entries->alloc);
+	e = &entries->entry[entries->nr];
+	memset(e, 0, sizeof(*e));
+	e->name = name;
+	e->rest = rest;
+	e->msg = msg;
+	e->nr = entries->nr++;
+	if (msg)
+		return;
+	oidcpy(&e->oid, oid);
+	if (find_pack_entry(the_repository,
+			    lookup_replace_object(the_repository, oid), &pe)) {
+		e->pack = pe.p;
+		e->offset = pe.offset;
+	}
+}
+
+/*
+ * Objects that are not in a pack come first, in input order, then those
+ * in a pack, by pack and offset.
+ */
+static int batch_entry_cmp(const void *a_, const void *b_)
+{
+	const struct batch_entry *a = *(const struct batch_entry **)a_;
+	const struct batch_entry *b = *(const struct batch_entry **)b_;
+
+	if (!a->pack != !b->pack)
+		return a->pack ? 1 : -1;
+	if (a->pack != b->pack) {
+		int cmp = strcmp(a->pack->pack_name, b->pack->pack_name);
+		if (cmp)
+			return cmp;
+	}
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return a->nr - b->nr;
+}
+
+static int batch_prefetch_threads(int nr)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_CAT_FILE_THREADS", 0);
+
+	/* a lazy fetch from a thread would run a whole transport */
+	if (repository_format_partial_clone)
+		return 1;
+	if (!nr_threads) {
+		nr_threads = nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	return nr_threads < 1 ? 1 : nr_threads;
+}
+
+struct prefetch_thread {
+#ifndef NO_PTHREADS
+	pthread_t pthread;
+#endif
+	struct batch_entry **sorted;
+	int first, step, nr;
+};
+
+static void *prefetch_thread(void *data)
+{
+	struct prefetch_thread *t = data;
+	int i;
+
+	for (i = t->first; i < t->nr; i += t->step) {
+		struct batch_entry *e = t->sorted[i];
+
+		/*
+		 * If we cannot read it after all, print_object_or_die()
+		 * will complain about it as usual.
+		 */
+		if (e->prefetch)
+			e->contents = read_object_file(&e->oid, &e->type,
+						       &e->size);
+	}
+	return NULL;
+}
+
+/*
+ * Read ahead the contents of the objects at the start of "sorted", and
+ * return how many of them were considered. Blobs above
+ * core.bigFileThreshold are left to be streamed.
+ */
+static int batch_prefetch(struct batch_entry **sorted, int nr)
+{
+	struct prefetch_thread *threads;
+	unsigned long total = 0;
+	int i, nr_threads, nr_prefetch = 0;
+
+	for (i = 0; i < nr; i++) {
+		struct batch_entry *e = sorted[i];
+		unsigned long size;
+		enum object_type type;
+
+		if (e->msg)
+			continue;
+		type = oid_object_info(the_repository, &e->oid, &size);
+		if (type < 0 || (type == OBJ_BLOB && size > big_file_threshold))
+			continue;
+		if (size > PREFETCH_LIMIT - total)
+			break;
+		total += size;
+		e->prefetch = 1;
+		nr_prefetch++;
+	}
+	nr = i;
+
+	nr_threads = batch_prefetch_threads(nr_prefetch);
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].sorted = sorted;
+		threads[i].first = i;
+		threads[i].step = nr_threads;
+		threads[i].nr = nr;
+	}
+#ifndef NO_PTHREADS
+	if (nr_threads > 1) {
+		enable_obj_read_lock();
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i].pthread, NULL,
+					   prefetch_thread, &threads[i]))
+				die("unable to create threaded prefetch");
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i].pthread, NULL))
+				die("unable to join threaded prefetch");
+		disable_obj_read_lock();
+	} else
+#endif
+		prefetch_thread(&threads[0]);
+	free(threads);
+	return nr;
+}
+
+static void batch_entry_write(struct batch_options *opt,
+			      struct expand_data *data, struct batch_entry *e)
+{
+	if (e->msg) {
+		fputs(e->msg, stdout);
+		fflush(stdout);
+		return;
+	}
+
+	oidcpy(&data->oid, &e->oid);
+	data->rest = e->rest;
+	data->contents = e->contents;
+	data->contents_size = e->size;
+	data->contents_type = e->type;
+	batch_object_write(e->name, opt, data);
+	data->contents = NULL;
+	FREE_AND_NULL(e->contents);
+}
+
+static void batch_entries_write(struct batch_options *opt,
+				struct expand_data *data,
+				struct batch_entries *entries)
+{
+	struct batch_entry **sorted;
+	/* there is nothing to read ahead for --batch-check */
+	int prefetch = opt->print_contents && !opt->cmdmode;
+	int i, n;
+
+	ALLOC_ARRAY(sorted, entries->nr);
+	for (i = 0; i < entries->nr; i++)
+		sorted[i] = &entries->entry[i];
+	QSORT(sorted, entries->nr, batch_entry_cmp);
+
+	if (opt->order == BATCH_ORDER_PACK) {
+		/*
+		 * Reading ahead in the order we show the objects in only
+		 * helps if several threads do it.
+		 */
+		if (batch_prefetch_threads(entries->nr) < 2)
+			prefetch = 0;
+		for (i = 0; i < entries->nr; i += n) {
+			int j;
+
+			n = prefetch ? batch_prefetch(sorted + i, entries->nr - i) : 0;
+			if (!n)
+				n = 1;
+			for (j = i; j < i + n; j++)
+				batch_entry_write(opt, data, sorted[j]);
+		}
+	} else {
+		if (prefetch)
+			batch_prefetch(sorted, entries->nr);
+		for (i = 0; i < entries->nr; i++)
+			batch_entry_write(opt, data, &entries->entry[i]);
+	}
+
+	for (i = 0; i < entries->nr; i++) {
+		free(entries->entry[i].name);
+		free(entries->entry[i].msg);
+	}
+	entries->nr = 0;
+	free(sorted);
+}
+
+static void batch_queue_object(struct batch_options *opt,
+			       struct expand_data *data,
+			       struct batch_entries *entries,
+			       char *name, const char *rest)
+{
+	struct strbuf msg = STRBUF_INIT;
+	struct object_id oid;
+
+	if (get_batch_oid(name, opt, &oid, &msg))
+		add_batch_entry(entries, NULL, name, rest, strbuf_detach(&msg, NULL));
+	else
+		add_batch_entry(entries, &oid, name, rest, NULL);
+	if (opt->order == BATCH_ORDER_INPUT && entries->nr >= BATCH_CHUNK)
+		batch_entries_write(opt, data, entries);
+}
+
 struct object_cb_data {
 	struct batch_options *opt;
 	struct expand_data *expand;
+	struct batch_entries *entries;
 };
 
 static int batch_object_cb(const struct object_id *oid, void *vdata)
 {
 	struct object_cb_data *data = vdata;
+
+	if (data->entries) {
+		add_batch_entry(data->entries, oid, NULL, NULL, NULL);
+		if (data->opt->order == BATCH_ORDER_INPUT &&
+		    data->entries->nr >= BATCH_CHUNK)
+			batch_entries_write(data->opt, data->expand,
+					    data->entries);
+		return 0;
+	}
 	oidcpy(&data->expand->oid, oid);
 	batch_object_write(NULL, data->opt, data->expand);
 	return 0;
@@ -437,10 +750,94 @@ static int batch_packed_object(const struct object_id *oid,
 	return 0;
 }
 
+/*
+ * Split at first whitespace, tying off the beginning of the string and
+ * saving the remainder (or NULL) in data->rest.
+ */
+static void split_rest(char *line, struct expand_data *data)
+{
+	char *p = strpbrk(line, " \t");
+
+	if (p) {
+		while (*p && strchr(" \t", *p))
+			*p++ = '\0';
+	}
+	data->rest = p;
+}
+
+/*
+ * The commands of --batch-command. "contents" and "info" show an object
+ * like --batch and --batch-check do, and "flush" writes out what the
+ * previous commands printed with --buffer.
+ */
+enum batch_command_type {
+	BATCH_CMD_CONTENTS,
+	BATCH_CMD_INFO,
+	BATCH_CMD_FLUSH
+};
+
+static const struct {
+	const char *name;
+	enum batch_command_type type;
+	int takes_args;
+} batch_commands[] = {
+	{ "contents", BATCH_CMD_CONTENTS, 1 },
+	{ "info", BATCH_CMD_INFO, 1 },
+	{ "flush", BATCH_CMD_FLUSH, 0 },
+};
+
+static void batch_command(struct batch_options *opt, struct expand_data *data,
+			  char *line)
+{
+	const char *args = NULL;
+	int i;
+
+	if (!*line)
+		die("empty command in input");
+	if (isspace(*line))
+		die("whitespace before command: '%s'", line);
+
+	for (i = 0; i < ARRAY_SIZE(batch_commands); i++) {
+		if (skip_prefix(line, batch_commands[i].name, &args) &&
+		    (!*args || *args == ' '))
+			break;
+	}
+	if (i == ARRAY_SIZE(batch_commands))
+		die("unknown command: '%s'", line);
+
+	if (!batch_commands[i].takes_args) {
+		if (*args)
+			die("%s takes no arguments", batch_commands[i].name);
+	} else {
+		if (!*args || !args[1])
+			die("%s requires arguments", batch_commands[i].name);
+		args++;
+	}
+
+	switch (batch_commands[i].type) {
+	case BATCH_CMD_FLUSH:
+		if (!opt->buffer_output)
+			die("flush is only for --buffer mode");
+		fflush(stdout);
+		return;
+	case BATCH_CMD_CONTENTS:
+		opt->print_contents = 1;
+		break;
+	case BATCH_CMD_INFO:
+		opt->print_contents = 0;
+		break;
+	}
+
+	if (data->split_on_whitespace)
+		split_rest((char *)args, data);
+	batch_one_object(args, opt, data);
+}
+
 static int batch_objects(struct batch_options *opt)
 {
 	struct strbuf buf = STRBUF_INIT;
 	struct expand_data data;
+	struct batch_entries entries = { NULL };
 	int save_warning;
 	int retval = 0;
 
@@ -469,9 +866,12 @@ static int batch_objects(struct batch_options *opt)
 	 * If we are printing out the object, then always fill in the type,
 	 * since we will want to decide whether or not to stream.
 	 */
-	if (opt->print_contents)
+	if (opt->print_contents || opt->command)
 		data.info.typep = &data.type;
 
+	/* objects are looked up in no particular order of the packs */
+	set_pack_access(PACK_ACCESS_RANDOM);
+
 	if (opt->all_objects) {
 		struct oid_array sa = OID_ARRAY_INIT;
 		struct object_cb_data cb;
@@ -483,9 +883,13 @@ static int batch_objects(struct batch_options *opt)
 
 		cb.opt = opt;
 		cb.expand = &data;
+		cb.entries = opt->order ? &entries : NULL;
 		oid_array_for_each_unique(&sa, batch_object_cb, &cb);
+		if (opt->order)
+			batch_entries_write(opt, &data, &entries);
 
 		oid_array_clear(&sa);
+		free(entries.entry);
 		return 0;
 	}
 
@@ -500,21 +904,24 @@ static int batch_objects(struct batch_options *opt)
 	warn_on_object_refname_ambiguity = 0;
 
 	while (strbuf_getline(&buf, stdin) != EOF) {
-		if (data.split_on_whitespace) {
-			/*
-			 * Split at first whitespace, tying off the beginning
-			 * of the string and saving the remainder (or NULL) in
-			 * data.rest.
-			 */
-			char *p = strpbrk(buf.buf, " \t");
-			if (p) {
-				while (*p && strchr(" \t", *p))
-					*p++ = '\0';
-			}
-			data.rest = p;
+		/* the entries of --batch-order keep their own copy */
+		char *name = opt->order ? xmemdupz(buf.buf, buf.len) : buf.buf;
+
+		if (opt->command) {
+			batch_command(opt, &data, name);
+			continue;
 		}
+		if (data.split_on_whitespace)
+			split_rest(name, &data);
 
-		batch_one_object(buf.buf, opt, &data);
+		if (opt->order)
+			batch_queue_object(opt, &data, &entries, name, data.rest);
+		else
+			batch_one_object(name, opt, &data);
+	}
+	if (opt->order) {
+		batch_entries_write(opt, &data, &entries);
+		free(entries.entry);
 	}
 
 	strbuf_release(&buf);
@@ -524,7 +931,7 @@ static int batch_objects(struct batch_options *opt)
 
 static const char * const cat_file_usage[] = {
 	N_("git cat-file (-t [--allow-unknown-type] | -s [--allow-unknown-type] | -e | -p | <type> | --textconv | --filters) [--path=<path>] <object>"),
-	N_("git cat-file (--batch | --batch-check) [--follow-symlinks] [--textconv | --filters]"),
+	N_("git cat-file (--batch | --batch-check | --batch-command) [--follow-symlinks] [--textconv | --filters] [--batch-order=<order>]"),
 	NULL
 };
 
@@ -548,6 +955,7 @@ static int batch_option_callback(const struct option *opt,
 
 	bo->enabled = 1;
 	bo->print_contents = !strcmp(opt->long_name, "batch");
+	bo->command = !strcmp(opt->long_name, "batch-command");
 	bo->format = arg;
 
 	return 0;
@@ -558,6 +966,7 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 	int opt = 0;
 	const char *exp_type = NULL, *obj_name = NULL;
 	struct batch_options batch = {0};
+	const char *batch_order = NULL;
 	int unknown_type = 0;
 
 	const struct option options[] = {
@@ -582,10 +991,15 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		{ OPTION_CALLBACK, 0, "batch-check", &batch, "format",
 			N_("show info about objects fed from the standard input"),
 			PARSE_OPT_OPTARG, batch_option_callback },
+		{ OPTION_CALLBACK, 0, "batch-command", &batch, "format",
+			N_("read commands from the standard input"),
+			PARSE_OPT_OPTARG, batch_option_callback },
 		OPT_BOOL(0, "follow-symlinks", &batch.follow_symlinks,
 			 N_("follow in-tree symlinks (used with --batch or --batch-check)")),
 		OPT_BOOL(0, "batch-all-objects", &batch.all_objects,
 			 N_("show all objects with --batch or --batch-check")),
+		OPT_STRING(0, "batch-order", &batch_order, N_("order"),
+			   N_("read objects by pack and offset, show them in input or pack order")),
 		OPT_END()
 	};
 
@@ -617,10 +1031,24 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			    "--textconv nor with --filters");
 	}
 
-	if ((batch.follow_symlinks || batch.all_objects) && !batch.enabled) {
+	if ((batch.follow_symlinks || batch.all_objects || batch_order) &&
+	    !batch.enabled) {
 		usage_with_options(cat_file_usage, options);
 	}
 
+	if (batch_order) {
+		if (!strcmp(batch_order, "input"))
+			batch.order = BATCH_ORDER_INPUT;
+		else if (!strcmp(batch_order, "pack"))
+			batch.order = BATCH_ORDER_PACK;
+		else
+			die("unknown --batch-order value: %s", batch_order);
+	}
+
+	if (batch.command && (batch.all_objects || batch.order))
+		die("--batch-command cannot be combined with "
+		    "--batch-all-objects nor with --batch-order");
+
 	if (force_path && opt != 'c' && opt != 'w') {
 		error("--path=<path> needs --textconv or --filters");
 		usage_with_options(cat_file_usage, options);
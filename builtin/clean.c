@@ -17,6 +17,7 @@
 #include "color.h"
 #include "pathspec.h"
 #include "help.h"
+#include "thread-utils.h"
 
 static int force = -1; /* unset */
 static int interactive;
@@ -144,14 +145,97 @@ static int exclude_cb(const struct option *opt, const char *arg, int unset)
 	return 0;
 }
 
+/*
+ * Unlinking a file does not depend on unlinking any other, so a long
+ * list of them is shared among threads, giving every thread at least
+ * THREAD_COST files and using at most MAX_PARALLEL threads.
+ */
+#define THREAD_COST (256)
+#define MAX_PARALLEL (16)
+
+struct unlink_file {
+	char *path;
+	/* 0 once it is gone, or why it is not */
+	int err;
+};
+
+#ifndef NO_PTHREADS
+
+struct unlink_thread {
+	pthread_t pthread;
+	struct unlink_file *files;
+	int first, step, nr;
+};
+
+static void *unlink_thread(void *data)
+{
+	struct unlink_thread *t = data;
+	int i;
+
+	for (i = t->first; i < t->nr; i += t->step)
+		t->files[i].err = unlink(t->files[i].path) ? errno : 0;
+	return NULL;
+}
+
+static int unlink_threads(int nr)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_CLEAN_THREADS", 0);
+
+	if (!nr_threads) {
+		nr_threads = nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	return nr_threads;
+}
+
+#endif
+
+static void unlink_files(struct unlink_file *files, int nr)
+{
+	int i;
+#ifndef NO_PTHREADS
+	int nr_threads = unlink_threads(nr);
+
+	if (nr_threads > 1) {
+		struct unlink_thread *threads;
+
+		threads = xcalloc(nr_threads, sizeof(*threads));
+		for (i = 0; i < nr_threads; i++) {
+			struct unlink_thread *t = &threads[i];
+
+			t->files = files;
+			t->first = i;
+			t->step = nr_threads;
+			t->nr = nr;
+			if (pthread_create(&t->pthread, NULL, unlink_thread, t))
+				die("unable to create threaded unlink");
+		}
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i].pthread, NULL))
+				die("unable to join threaded unlink");
+		free(threads);
+		return;
+	}
+#endif
+	for (i = 0; i < nr; i++)
+		files[i].err = unlink(files[i].path) ? errno : 0;
+}
+
 static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 		int dry_run, int quiet, int *dir_gone)
 {
 	DIR *dir;
 	struct strbuf quoted = STRBUF_INIT;
 	struct dirent *e;
-	int res = 0, ret = 0, gone = 1, original_len = path->len, len;
+	int res = 0, ret = 0, gone = 1, original_len = path->len, len, i;
 	struct string_list dels = STRING_LIST_INIT_DUP;
+	struct unlink_file *files = NULL;
+	int files_nr = 0, files_alloc = 0;
 
 	*dir_gone = 1;
 
@@ -203,18 +287,13 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 				*dir_gone = 0;
 			continue;
 		} else {
-			res = dry_run ? 0 : unlink(path->buf);
-			if (!res) {
-				quote_path_relative(path->buf, prefix, &quoted);
-				string_list_append(&dels, quoted.buf);
-			} else {
-				int saved_errno = errno;
-				quote_path_relative(path->buf, prefix, &quoted);
-				errno = saved_errno;
-				warning_errno(_(msg_warn_remove_failed), quoted.buf);
-				*dir_gone = 0;
-				ret = 1;
-			}
+			/* unlinked all together below, in their place in dels */
+			quote_path_relative(path->buf, prefix, &quoted);
+			string_list_append(&dels, quoted.buf)->util =
+				(void *)(intptr_t)(files_nr + 1);
+			ALLOC_GROW(files, files_nr + 1, files_alloc);
+			files[files_nr].path = xstrdup(path->buf);
+			files[files_nr++].err = 0;
 			continue;
 		}
 
@@ -225,6 +304,19 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 	}
 	closedir(dir);
 
+	if (!dry_run)
+		unlink_files(files, files_nr);
+	for (i = 0; i < dels.nr; i++) {
+		intptr_t file = (intptr_t)dels.items[i].util;
+
+		if (!file || !files[file - 1].err)
+			continue;
+		errno = files[file - 1].err;
+		warning_errno(_(msg_warn_remove_failed), dels.items[i].string);
+		*dir_gone = 0;
+		ret = 1;
+	}
+
 	strbuf_setlen(path, original_len);
 
 	if (*dir_gone) {
@@ -242,11 +334,19 @@ static int remove_dirs(struct strbuf *path, const char *prefix, int force_flag,
 	}
 
 	if (!*dir_gone && !quiet) {
-		int i;
-		for (i = 0; i < dels.nr; i++)
+		for (i = 0; i < dels.nr; i++) {
+			intptr_t file = (intptr_t)dels.items[i].util;
+
+			/* the files we failed to remove were warned about */
+			if (file && files[file - 1].err)
+				continue;
 			printf(dry_run ?  _(msg_would_remove) : _(msg_remove), dels.items[i].string);
+		}
 	}
 out:
+	for (i = 0; i < files_nr; i++)
+		free(files[i].path);
+	free(files);
 	strbuf_release(&quoted);
 	string_list_clear(&dels, 0);
 	return ret;
@@ -900,6 +1000,8 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 	struct string_list exclude_list = STRING_LIST_INIT_NODUP;
 	struct exclude_list *el;
 	struct string_list_item *item;
+	struct unlink_file *files;
+	int files_nr = 0;
 	const char *qname;
 	struct option options[] = {
 		OPT__QUIET(&quiet, N_("do not print names of files removed")),
@@ -952,12 +1054,25 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 	if (read_cache() < 0)
 		die(_("index file corrupt"));
 
+	/*
+	 * Without -d, untracked directories are not looked into, and the
+	 * empty ones are not removed either; that is what the untracked
+	 * cache keeps for "git status", which can then be used here too.
+	 */
+	if (!remove_directories && !ignored && !ignored_only &&
+	    !exclude_list.nr) {
+		dir.flags |= DIR_HIDE_EMPTY_DIRECTORIES;
+		dir.untracked = the_index.untracked;
+	}
+
 	if (!ignored)
 		setup_standard_excludes(&dir);
 
-	el = add_exclude_list(&dir, EXC_CMDL, "--exclude option");
-	for (i = 0; i < exclude_list.nr; i++)
-		add_exclude(exclude_list.items[i].string, "", 0, el, -(i+1));
+	if (exclude_list.nr) {
+		el = add_exclude_list(&dir, EXC_CMDL, "--exclude option");
+		for (i = 0; i < exclude_list.nr; i++)
+			add_exclude(exclude_list.items[i].string, "", 0, el, -(i+1));
+	}
 
 	parse_pathspec(&pathspec, 0,
 		       PATHSPEC_PREFER_CWD,
@@ -969,7 +1084,6 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < dir.nr; i++) {
 		struct dir_entry *ent = dir.entries[i];
 		int matches = 0;
-		struct stat st;
 		const char *rel;
 
 		if (!cache_name_is_other(ent->name, ent->len))
@@ -981,11 +1095,9 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 		if (pathspec.nr && !matches)
 			continue;
 
-		if (lstat(ent->name, &st))
-			die_errno("Cannot lstat '%s'", ent->name);
-
-		if (S_ISDIR(st.st_mode) && !remove_directories &&
-		    matches != MATCHED_EXACTLY)
+		/* only directories are listed with a trailing slash */
+		if (ent->len && ent->name[ent->len - 1] == '/' &&
+		    !remove_directories && matches != MATCHED_EXACTLY)
 			continue;
 
 		rel = relative_path(ent->name, prefix, &buf);
@@ -1001,9 +1113,42 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 	if (interactive && del_list.nr > 0)
 		interactive_main_loop();
 
+	/* remove the files all together first, reporting them in order */
+	ALLOC_ARRAY(files, del_list.nr);
 	for_each_string_list_item(item, &del_list) {
+		const char *rel = item->string;
+
+		if (rel[0] && rel[strlen(rel) - 1] == '/')
+			continue;
+		if (prefix)
+			strbuf_addstr(&abs_path, prefix);
+		strbuf_addstr(&abs_path, rel);
+		files[files_nr].path = strbuf_detach(&abs_path, NULL);
+		files[files_nr].err = 0;
+		item->util = &files[files_nr++];
+	}
+	if (!dry_run)
+		unlink_files(files, files_nr);
+
+	for_each_string_list_item(item, &del_list) {
+		struct unlink_file *file = item->util;
 		struct stat st;
 
+		if (file) {
+			/* it was not there to begin with */
+			if (file->err == ENOENT)
+				continue;
+			qname = quote_path_relative(item->string, NULL, &buf);
+			if (file->err) {
+				errno = file->err;
+				warning_errno(_(msg_warn_remove_failed), qname);
+				errors++;
+			} else if (!quiet) {
+				printf(dry_run ? _(msg_would_remove) : _(msg_remove), qname);
+			}
+			continue;
+		}
+
 		if (prefix)
 			strbuf_addstr(&abs_path, prefix);
 
@@ -1040,6 +1185,9 @@ int cmd_clean(int argc, const char **argv, const char *prefix)
 		strbuf_reset(&abs_path);
 	}
 
+	for (i = 0; i < files_nr; i++)
+		free(files[i].path);
+	free(files);
 	strbuf_release(&abs_path);
 	strbuf_release(&buf);
 	string_list_clear(&del_list, 0);
@@ -0,0 +1,566 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "command-server.h"
+#include "pkt-line.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "string-list.h"
+#include "tempfile.h"
+#include "unix-socket.h"
+
+static const char * const builtin_command_server_usage[] = {
+	N_("git command-server start"),
+	N_("git command-server run [--debug]"),
+	N_("git command-server stop"),
+	N_("git command-server status"),
+	NULL
+};
+
+static const char *socket_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = absolute_pathdup(git_path("command-server.ipc"));
+	return path;
+}
+
+#ifndef NO_UNIX_SOCKETS
+
+/*
+ * Environment variables that a git process only looks at when it
+ * starts or first reads its configuration; we read ours long before
+ * the client came, so it has to agree with us about them.
+ */
+static const char *startup_env[] = {
+	"HOME",
+	"XDG_CONFIG_HOME",
+	"GIT_CONFIG_NOSYSTEM",
+	"GIT_NAMESPACE",
+	"GIT_TRACE2",
+	"GIT_TRACE2_BRIEF",
+	"GIT_TRACE2_EVENT",
+	"GIT_TRACE2_PERF",
+	"LANG",
+	"LANGUAGE",
+	"LC_ALL",
+	"LC_MESSAGES",
+	NULL
+};
+
+static int listen_fd = -1;
+static struct tempfile *socket_file;
+
+struct watched_file {
+	char *path;
+	struct stat_validity validity;
+};
+
+static struct watched_file index_file;
+static struct watched_file config_files[4];
+static int config_files_nr;
+
+static void watch_file(struct watched_file *f, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	free(f->path);
+	f->path = xstrdup(path);
+	stat_validity_update(&f->validity, fd);
+	if (fd >= 0)
+		close(fd);
+}
+
+static int file_changed(struct watched_file *f)
+{
+	return !stat_validity_check(&f->validity, f->path);
+}
+
+/* Watch the files do_git_config_sequence() reads. */
+static void watch_config_files(void)
+{
+	char *xdg_config = xdg_config_home("config");
+	char *user_config = expand_user_path("~/.gitconfig", 0);
+	char *repo_config = absolute_pathdup(git_path("config"));
+
+	if (git_config_system())
+		watch_file(&config_files[config_files_nr++], git_etc_gitconfig());
+	if (xdg_config)
+		watch_file(&config_files[config_files_nr++], xdg_config);
+	if (user_config)
+		watch_file(&config_files[config_files_nr++], user_config);
+	watch_file(&config_files[config_files_nr++], repo_config);
+
+	free(xdg_config);
+	free(user_config);
+	free(repo_config);
+}
+
+static int config_changed(void)
+{
+	int i;
+
+	for (i = 0; i < config_files_nr; i++)
+		if (file_changed(&config_files[i]))
+			return 1;
+	return 0;
+}
+
+/*
+ * Look at the file before reading it, so that a change made while we
+ * read it is noticed the next time.
+ */
+static void load_index(void)
+{
+	watch_file(&index_file, get_index_file());
+	discard_cache();
+	read_cache();
+}
+
+static void stop_listening(void)
+{
+	if (listen_fd < 0)
+		return;
+	close(listen_fd);
+	listen_fd = -1;
+	delete_tempfile(&socket_file);
+}
+
+static const char *client_getenv(struct string_list *env, const char *name)
+{
+	struct string_list_item *item;
+	const char *value;
+
+	for_each_string_list_item(item, env)
+		if (skip_prefix(item->string, name, &value) && *value == '=')
+			return value + 1;
+	return NULL;
+}
+
+static int agrees_on_env(struct string_list *env)
+{
+	int i;
+
+	for (i = 0; local_repo_env[i]; i++)
+		if (client_getenv(env, local_repo_env[i]))
+			return 0;
+	for (i = 0; startup_env[i]; i++) {
+		const char *ours = getenv(startup_env[i]);
+		const char *theirs = client_getenv(env, startup_env[i]);
+
+		if (ours ? !theirs || strcmp(ours, theirs) : !!theirs)
+			return 0;
+	}
+	return 1;
+}
+
+static int is_local_repo_env(const char *name)
+{
+	int i;
+
+	for (i = 0; local_repo_env[i]; i++)
+		if (!strcmp(name, local_repo_env[i]))
+			return 1;
+	return 0;
+}
+
+/*
+ * Take over the environment of the client, except for the variables
+ * that describe our repository.
+ */
+static void apply_client_env(struct string_list *env)
+{
+	extern char **environ;
+	struct string_list ours = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+	char **e;
+
+	for (e = environ; *e; e++) {
+		const char *eq = strchr(*e, '=');
+
+		if (eq)
+			string_list_append(&ours, xmemdupz(*e, eq - *e));
+	}
+	for_each_string_list_item(item, &ours)
+		if (!is_local_repo_env(item->string))
+			unsetenv(item->string);
+	ours.strdup_strings = 1;
+	string_list_clear(&ours, 0);
+
+	for_each_string_list_item(item, env) {
+		char *eq = strchr(item->string, '=');
+
+		if (!eq)
+			continue;
+		*eq = '\0';
+		setenv(item->string, eq + 1, 1);
+	}
+}
+
+/*
+ * Find the prefix of the client in our working tree.  Return -1 if it
+ * is not in the working tree, or in a repository of its own there.
+ */
+static int get_client_prefix(const char *cwd, char **prefix)
+{
+	const char *work_tree = get_git_work_tree();
+	struct strbuf dir = STRBUF_INIT;
+	const char *rest;
+	int ret = 0;
+
+	*prefix = NULL;
+	if (!skip_prefix(cwd, work_tree, &rest) || (*rest && *rest != '/'))
+		return -1;
+	if (!*rest)
+		return 0;
+	rest++;
+	if (!strcmp(rest, ".git") || starts_with(rest, ".git/"))
+		return -1;
+
+	strbuf_addstr(&dir, cwd);
+	while (dir.len > strlen(work_tree)) {
+		size_t len = dir.len;
+
+		strbuf_addstr(&dir, "/.git");
+		if (!access(dir.buf, F_OK)) {
+			ret = -1;
+			break;
+		}
+		strbuf_setlen(&dir, len);
+		strbuf_setlen(&dir, strrchr(dir.buf, '/') - dir.buf);
+	}
+	strbuf_release(&dir);
+
+	if (!ret)
+		*prefix = xstrfmt("%s/", rest);
+	return ret;
+}
+
+/*
+ * Wait for the command to finish.  "alive" is closed when it exits; if
+ * the client hangs up before that, nobody wants the result any more.
+ */
+static int wait_for_command(pid_t pid, int alive, int client)
+{
+	struct pollfd pfd[2];
+	int status;
+
+	pfd[0].fd = alive;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = client;
+	pfd[1].events = POLLIN;
+	while (poll(pfd, 2, -1) < 0)
+		if (errno != EINTR)
+			die_errno("poll failed");
+	if (!pfd[0].revents && pfd[1].revents)
+		kill(pid, SIGTERM);
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			die_errno("waitpid failed");
+	return status;
+}
+
+/*
+ * Run the command a client asked for, in a process of our own (the
+ * client receives its exit status from us).  This runs in a child of
+ * the server, which is free to go on to the next client.
+ */
+static int serve_run_request(int client)
+{
+	struct strbuf cwd = STRBUF_INIT;
+	struct string_list env = STRING_LIST_INIT_DUP;
+	struct argv_array args = ARGV_ARRAY_INIT;
+	char *prefix = NULL;
+	int fds[3], alive[2];
+	const char *arg;
+	char *line;
+	pid_t pid;
+	int i, status;
+
+	close(listen_fd);
+
+	if (unix_stream_recv_fds(client, fds, ARRAY_SIZE(fds)) < 0)
+		return error_errno("unable to receive descriptors from client");
+	for (;;) {
+		if (packet_read_line_gently(client, NULL, &line) < 0)
+			return error("command-server client hung up");
+		if (!line)
+			break;
+		if (skip_prefix(line, "cwd=", &arg))
+			strbuf_addstr(&cwd, arg);
+		else if (skip_prefix(line, "env=", &arg))
+			string_list_append(&env, arg);
+		else if (skip_prefix(line, "arg=", &arg))
+			argv_array_push(&args, arg);
+		else
+			return error("command-server client sent bogus line: %s",
+				     line);
+	}
+
+	if (!args.argc || !is_servable_builtin(args.argv[0]) ||
+	    !agrees_on_env(&env) || get_client_prefix(cwd.buf, &prefix)) {
+		packet_write_fmt_gently(client, "fallback");
+		return 0;
+	}
+	if (packet_write_fmt_gently(client, "ok") || pipe(alive) < 0)
+		return -1;
+	fcntl(alive[1], F_SETFD, FD_CLOEXEC);
+
+	pid = fork();
+	if (pid < 0)
+		die_errno("fork failed");
+	if (!pid) {
+		close(alive[0]);
+		close(client);
+		for (i = 0; i < ARRAY_SIZE(fds); i++) {
+			if (dup2(fds[i], i) < 0)
+				die_errno("dup2 failed");
+			close(fds[i]);
+		}
+		sigchain_pop(SIGPIPE);
+
+		apply_client_env(&env);
+		setenv(GIT_PREFIX_ENVIRONMENT, prefix ? prefix : "", 1);
+		startup_info->prefix = prefix;
+		startup_info->served = 1;
+		exit(run_served_builtin(args.argc, args.argv));
+	}
+	close(alive[1]);
+	for (i = 0; i < ARRAY_SIZE(fds); i++)
+		close(fds[i]);
+
+	status = wait_for_command(pid, alive[0], client);
+	if (WIFSIGNALED(status))
+		packet_write_fmt_gently(client, "signal %d", WTERMSIG(status));
+	else
+		packet_write_fmt_gently(client, "exit %d", WEXITSTATUS(status));
+	return 0;
+}
+
+/* Return 0 to keep serving, 1 when it is time to stop. */
+static int serve_one_client(int client)
+{
+	char *line;
+	pid_t pid;
+
+	if (packet_read_line_gently(client, NULL, &line) < 0 || !line) {
+		warning("command-server client hung up");
+		return 0;
+	}
+
+	if (!strcmp(line, "run")) {
+		/*
+		 * Globals set from the old configuration cannot be taken
+		 * back; let the client run its command itself, and let
+		 * the next server start afresh.
+		 */
+		if (config_changed()) {
+			stop_listening();
+			packet_write_fmt_gently(client, "fallback");
+			return 1;
+		}
+		if (file_changed(&index_file))
+			load_index();
+
+		pid = fork();
+		if (pid < 0) {
+			warning_errno("fork failed");
+			packet_write_fmt_gently(client, "fallback");
+		} else if (!pid) {
+			exit(!!serve_run_request(client));
+		}
+		return 0;
+	}
+
+	if (!strcmp(line, "status")) {
+		packet_write_fmt_gently(client, "%s", get_git_work_tree());
+		return 0;
+	}
+
+	if (!strcmp(line, "stop")) {
+		stop_listening();
+		packet_write_fmt_gently(client, "ok");
+		return 1;
+	}
+
+	warning("command-server client sent unknown request: %s", line);
+	return 0;
+}
+
+static void serve(void)
+{
+	struct pollfd pfd;
+	int stop = 0;
+
+	pfd.fd = listen_fd;
+	pfd.events = POLLIN;
+
+	while (!stop) {
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno != EINTR)
+				die_errno("poll failed");
+			continue;
+		}
+
+		/* Reap the children that served earlier clients. */
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			; /* nothing */
+
+		if (pfd.revents & POLLIN) {
+			int client = accept(listen_fd, NULL, NULL);
+
+			if (client < 0) {
+				warning_errno("accept failed");
+				continue;
+			}
+			stop = serve_one_client(client);
+			close(client);
+		}
+	}
+}
+
+static int run_server(int debug)
+{
+	const char *path = socket_path();
+	int devnull;
+
+	/* Read everything the client would, and no more. */
+	watch_config_files();
+	git_config_clear();
+	git_config(git_default_config, NULL);
+	load_index();
+
+	listen_fd = unix_stream_listen(path);
+	if (listen_fd < 0)
+		die_errno(_("unable to bind to '%s'"), path);
+	socket_file = register_tempfile(path);
+
+	/*
+	 * Commands we run write to the descriptors of their client, which
+	 * they receive on 0, 1 and 2; keep those taken (and stdout and
+	 * stderr usable) until then.
+	 */
+	printf("ok\n");
+	fflush(stdout);
+	devnull = xopen("/dev/null", O_RDWR);
+	dup2(devnull, 1);
+	if (!debug)
+		dup2(devnull, 2);
+	close(devnull);
+
+	/* Do not die when a client hangs up before reading its answer. */
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	serve();
+
+	stop_listening();
+	return 0;
+}
+
+static int spawn_server(void)
+{
+	struct child_process server = CHILD_PROCESS_INIT;
+	char buf[128];
+	int r;
+
+	argv_array_pushl(&server.args, "command-server", "run", NULL);
+	server.git_cmd = 1;
+	server.no_stdin = 1;
+	server.out = -1;
+
+	if (start_command(&server))
+		return error(_("unable to start command server"));
+	r = read_in_full(server.out, buf, sizeof(buf));
+	close(server.out);
+	if (r < 0)
+		return error_errno(_("unable to read result code from command server"));
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		return error(_("command server did not start: %.*s"), r, buf);
+	return 0;
+}
+
+#else
+
+static int run_server(int debug)
+{
+	die(_("command-server is not supported on this platform"));
+}
+
+static int spawn_server(void)
+{
+	return error(_("command-server is not supported on this platform"));
+}
+
+#endif
+
+static int is_server_running(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+	int ret = !command_server_send_command(socket_path(), "status", &answer);
+
+	strbuf_release(&answer);
+	return ret;
+}
+
+int cmd_command_server(int argc, const char **argv, const char *prefix)
+{
+	const char *subcmd;
+	int debug = 0;
+	struct option options[] = {
+		OPT_BOOL(0, "debug", &debug,
+			 N_("print debugging messages to stderr")),
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_command_server_usage, options);
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_command_server_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_command_server_usage, options);
+	subcmd = argv[0];
+
+	if (!strcmp(subcmd, "run")) {
+		if (is_server_running())
+			die(_("command-server is already running in '%s'"),
+			    get_git_work_tree());
+		return run_server(debug);
+	}
+
+	if (!strcmp(subcmd, "start")) {
+		if (is_server_running())
+			die(_("command-server is already running in '%s'"),
+			    get_git_work_tree());
+		return !!spawn_server();
+	}
+
+	if (!strcmp(subcmd, "stop")) {
+		struct strbuf answer = STRBUF_INIT;
+
+		if (command_server_send_command(socket_path(), "stop", &answer))
+			die(_("command-server is not running"));
+		strbuf_release(&answer);
+		return 0;
+	}
+
+	if (!strcmp(subcmd, "status")) {
+		struct strbuf answer = STRBUF_INIT;
+
+		if (command_server_send_command(socket_path(), "status", &answer)) {
+			printf(_("command-server is not running in '%s'\n"),
+			       get_git_work_tree());
+			return 1;
+		}
+		printf(_("command-server is serving '%s' on '%s'\n"),
+		       answer.buf, socket_path());
+		strbuf_release(&answer);
+		return 0;
+	}
+
+	usage_with_options(builtin_command_server_usage, options);
+}
@@ -8,7 +8,7 @@
 static char const * const builtin_commit_graph_usage[] = {
 	N_("git commit-graph [--object-dir <objdir>]"),
 	N_("git commit-graph read [--object-dir <objdir>]"),
-	N_("git commit-graph write [--object-dir <objdir>] [--append] [--stdin-packs|--stdin-commits]"),
+	N_("git commit-graph write [--object-dir <objdir>] [--append|--split] [--size-multiple=<n>] [--changed-paths] [--stdin-packs|--stdin-commits]"),
 	NULL
 };
 
@@ -18,7 +18,7 @@ static const char * const builtin_commit_graph_read_usage[] = {
 };
 
 static const char * const builtin_commit_graph_write_usage[] = {
-	N_("git commit-graph write [--object-dir <objdir>] [--append] [--stdin-packs|--stdin-commits]"),
+	N_("git commit-graph write [--object-dir <objdir>] [--append|--split] [--size-multiple=<n>] [--changed-paths] [--stdin-packs|--stdin-commits]"),
 	NULL
 };
 
@@ -27,6 +27,9 @@ static struct opts_commit_graph {
 	int stdin_packs;
 	int stdin_commits;
 	int append;
+	int changed_paths;
+	int split;
+	int size_multiple;
 } opts;
 
 static int graph_read(int argc, const char **argv)
@@ -50,6 +53,8 @@ static int graph_read(int argc, const char **argv)
 
 	graph_name = get_commit_graph_filename(opts.obj_dir);
 	graph = load_commit_graph_one(graph_name);
+	if (!graph)
+		graph = load_commit_graph_chain(opts.obj_dir);
 
 	if (!graph)
 		die("graph file %s does not exist", graph_name);
@@ -70,8 +75,18 @@ static int graph_read(int argc, const char **argv)
 		printf(" oid_lookup");
 	if (graph->chunk_commit_data)
 		printf(" commit_metadata");
+	if (graph->chunk_generation_data)
+		printf(" generation_data");
+	if (graph->chunk_generation_data_overflow)
+		printf(" generation_data_overflow");
 	if (graph->chunk_large_edges)
 		printf(" large_edges");
+	if (graph->chunk_bloom_indexes)
+		printf(" bloom_indexes");
+	if (graph->chunk_bloom_data)
+		printf(" bloom_data");
+	if (graph->chunk_base_graphs)
+		printf(" base_graphs");
 	printf("\n");
 
 	return 0;
@@ -86,6 +101,7 @@ static int graph_write(int argc, const char **argv)
 	const char **lines = NULL;
 	int lines_nr = 0;
 	int lines_alloc = 0;
+	unsigned int flags = 0;
 
 	static struct option builtin_commit_graph_write_options[] = {
 		OPT_STRING(0, "object-dir", &opts.obj_dir,
@@ -97,6 +113,12 @@ static int graph_write(int argc, const char **argv)
 			N_("start walk at commits listed by stdin")),
 		OPT_BOOL(0, "append", &opts.append,
 			N_("include all commits already in the commit-graph file")),
+		OPT_BOOL(0, "changed-paths", &opts.changed_paths,
+			N_("enable computation for changed paths")),
+		OPT_BOOL(0, "split", &opts.split,
+			N_("write the new commits into a layer of a commit-graph chain")),
+		OPT_INTEGER(0, "size-multiple", &opts.size_multiple,
+			N_("maximal size ratio between two layers of a commit-graph chain")),
 		OPT_END(),
 	};
 
@@ -108,6 +130,14 @@ static int graph_write(int argc, const char **argv)
 		die(_("cannot use both --stdin-commits and --stdin-packs"));
 	if (!opts.obj_dir)
 		opts.obj_dir = get_object_directory();
+	if (opts.append)
+		flags |= COMMIT_GRAPH_APPEND;
+	if (opts.changed_paths)
+		flags |= COMMIT_GRAPH_CHANGED_PATHS;
+	if (opts.split)
+		flags |= COMMIT_GRAPH_SPLIT;
+	if (opts.size_multiple < 0)
+		die(_("--size-multiple must not be negative"));
 
 	if (opts.stdin_packs || opts.stdin_commits) {
 		struct strbuf buf = STRBUF_INIT;
@@ -135,7 +165,8 @@ static int graph_write(int argc, const char **argv)
 			   packs_nr,
 			   commit_hex,
 			   commits_nr,
-			   opts.append);
+			   flags,
+			   opts.size_multiple);
 
 	return 0;
 }
@@ -153,6 +184,9 @@ int cmd_commit_graph(int argc, const char **argv, const char *prefix)
 		usage_with_options(builtin_commit_graph_usage,
 				   builtin_commit_graph_options);
 
+	/* the graph records the history as it is, not as replaced */
+	check_replace_refs = 0;
+
 	git_config(git_default_config, NULL);
 	argc = parse_options(argc, argv, prefix,
 			     builtin_commit_graph_options,
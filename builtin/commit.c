@@ -15,6 +15,7 @@
 #include "diff.h"
 #include "diffcore.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "revision.h"
 #include "wt-status.h"
 #include "run-command.h"
@@ -31,6 +32,7 @@
 #include "gpg-interface.h"
 #include "column.h"
 #include "sequencer.h"
+#include "sparse-index.h"
 #include "mailmap.h"
 #include "help.h"
 
@@ -334,7 +336,7 @@ static const char *prepare_index(int argc, const char **argv, const char *prefix
 		       PATHSPEC_PREFER_FULL,
 		       prefix, argv);
 
-	if (read_cache_preload(&pathspec) < 0)
+	if (read_cache_preload(&pathspec, PRELOAD_REFRESH) < 0)
 		die(_("index file corrupt"));
 
 	if (interactive) {
@@ -447,6 +449,10 @@ static const char *prepare_index(int argc, const char **argv, const char *prefix
 			die(_("cannot do a partial commit during a cherry-pick."));
 	}
 
+	/* partial commits work on individual paths of the full index */
+	command_requires_full_index = 1;
+	ensure_full_index(&the_index);
+
 	if (list_paths(&partial, !current_head ? NULL : "HEAD", prefix, &pathspec))
 		exit(1);
 
@@ -932,7 +938,7 @@ static int prepare_to_commit(const char *index_file, const char *prefix,
 		return 0;
 	}
 
-	if (!no_verify && find_hook("pre-commit")) {
+	if (!no_verify && hook_exists("pre-commit")) {
 		/*
 		 * Re-read the index as pre-commit hook could have updated it,
 		 * and write it out as a tree.  We must do this before we invoke
@@ -1355,7 +1361,8 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 		       PATHSPEC_PREFER_FULL,
 		       prefix, argv);
 
-	read_cache_preload(&s.pathspec);
+	command_requires_full_index = 0;
+	read_cache_preload(&s.pathspec, PRELOAD_REFRESH);
 	refresh_index(&the_index, REFRESH_QUIET|REFRESH_UNMERGED, &s.pathspec, NULL, NULL);
 
 	if (use_optional_locks())
@@ -1379,6 +1386,15 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 			s.rename_score = parse_rename_score(&rename_score_arg);
 	}
 
+	if (wt_status_can_stream(&s)) {
+		if (s.relative_paths)
+			s.prefix = prefix;
+		wt_status_stream(&s);
+		if (0 <= fd)
+			update_index_if_able(&the_index, &index_lock);
+		return 0;
+	}
+
 	wt_status_collect(&s);
 
 	if (0 <= fd)
@@ -1444,7 +1460,6 @@ int run_commit_hook(int editor_is_used, const char *index_file, const char *name
 
 int cmd_commit(int argc, const char **argv, const char *prefix)
 {
-	const char *argv_gc_auto[] = {"gc", "--auto", NULL};
 	static struct wt_status s;
 	static struct option builtin_commit_options[] = {
 		OPT__QUIET(&quiet, N_("suppress summary after successful commit")),
@@ -1519,6 +1534,7 @@ int cmd_commit(int argc, const char **argv, const char *prefix)
 	s.commit_template = 1;
 	status_format = STATUS_FORMAT_NONE; /* Ignore status.short */
 	s.colopts = 0;
+	command_requires_full_index = 0;
 
 	if (get_oid("HEAD", &oid))
 		current_head = NULL;
@@ -1652,7 +1668,7 @@ int cmd_commit(int argc, const char **argv, const char *prefix)
 		     "not exceeded, and then \"git reset HEAD\" to recover."));
 
 	rerere(0);
-	run_command_v_opt(argv_gc_auto, RUN_GIT_CMD);
+	run_auto_maintenance(quiet);
 	run_commit_hook(use_editor, get_index_file(), "post-commit", NULL);
 	if (amend && !no_post_rewrite) {
 		commit_post_rewrite(current_head, &oid);
@@ -17,10 +17,12 @@
 #include "revision.h"
 #include "list-objects.h"
 #include "commit-slab.h"
+#include "prio-queue.h"
 
 #define MAX_TAGS	(FLAG_BITS - 1)
 
 define_commit_slab(commit_names, struct commit_name *);
+define_commit_slab(commit_queued, char);
 
 static const char * const describe_usage[] = {
 	N_("git describe [<options>] [<commit-ish>...]"),
@@ -231,33 +233,92 @@ static int compare_pt(const void *a_, const void *b_)
 	return 0;
 }
 
+/*
+ * The commits left to visit, by date. "pending" counts those that lack
+ * some of the flags in "mask": once there is none, every commit the
+ * walk has yet to visit is reachable from all the tags in "mask".
+ */
+struct describe_queue {
+	struct prio_queue queue;
+	struct commit_queued queued;
+	unsigned mask;
+	unsigned long pending;
+};
+
+static int lacks_mask(struct describe_queue *q, struct commit *c)
+{
+	return (c->object.flags & q->mask) != q->mask;
+}
+
+static void set_mask(struct describe_queue *q, unsigned mask)
+{
+	int i;
+
+	q->mask = mask;
+	q->pending = 0;
+	for (i = 0; i < q->queue.nr; i++)
+		if (lacks_mask(q, q->queue.array[i].data))
+			q->pending++;
+}
+
+static void put_commit(struct describe_queue *q, struct commit *c)
+{
+	prio_queue_put(&q->queue, c);
+	*commit_queued_at(&q->queued, c) = 1;
+	if (lacks_mask(q, c))
+		q->pending++;
+}
+
+static struct commit *get_commit(struct describe_queue *q)
+{
+	struct commit *c = prio_queue_get(&q->queue);
+
+	if (c) {
+		*commit_queued_at(&q->queued, c) = 0;
+		if (lacks_mask(q, c))
+			q->pending--;
+	}
+	return c;
+}
+
+/* Queue the parent "p" of a commit with "flags", or pass them on to it */
+static void visit_parent(struct describe_queue *q, struct commit *p,
+			 unsigned flags)
+{
+	char *queued;
+	int was_pending;
+
+	parse_commit(p);
+	if (!(p->object.flags & SEEN)) {
+		p->object.flags |= flags;
+		put_commit(q, p);
+		return;
+	}
+	queued = commit_queued_peek(&q->queued, p);
+	was_pending = queued && *queued && lacks_mask(q, p);
+	p->object.flags |= flags;
+	if (was_pending && !lacks_mask(q, p))
+		q->pending--;
+}
+
 static unsigned long finish_depth_computation(
-	struct commit_list **list,
+	struct describe_queue *q,
 	struct possible_tag *best)
 {
 	unsigned long seen_commits = 0;
-	while (*list) {
-		struct commit *c = pop_commit(list);
+	struct commit *c;
+
+	set_mask(q, best->flag_within);
+	while ((c = get_commit(q))) {
 		struct commit_list *parents = c->parents;
 		seen_commits++;
 		if (c->object.flags & best->flag_within) {
-			struct commit_list *a = *list;
-			while (a) {
-				struct commit *i = a->item;
-				if (!(i->object.flags & best->flag_within))
-					break;
-				a = a->next;
-			}
-			if (!a)
+			if (!q->pending)
 				break;
 		} else
 			best->depth++;
 		while (parents) {
-			struct commit *p = parents->item;
-			parse_commit(p);
-			if (!(p->object.flags & SEEN))
-				commit_list_insert_by_date(p, list);
-			p->object.flags |= c->object.flags;
+			visit_parent(q, parents->item, c->object.flags);
 			parents = parents->next;
 		}
 	}
@@ -295,8 +356,8 @@ static void append_suffix(int depth, const struct object_id *oid, struct strbuf
 
 static void describe_commit(struct object_id *oid, struct strbuf *dst)
 {
-	struct commit *cmit, *gave_up_on = NULL;
-	struct commit_list *list;
+	struct commit *cmit, *c, *gave_up_on = NULL;
+	struct describe_queue queue = { { compare_commits_by_commit_date } };
 	struct commit_name *n;
 	struct possible_tag all_matches[MAX_TAGS];
 	unsigned int match_cnt = 0, annotated_cnt = 0, cur_match;
@@ -338,11 +399,10 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 		have_util = 1;
 	}
 
-	list = NULL;
+	init_commit_queued(&queue.queued);
 	cmit->object.flags = SEEN;
-	commit_list_insert(cmit, &list);
-	while (list) {
-		struct commit *c = pop_commit(&list);
+	put_commit(&queue, cmit);
+	while ((c = get_commit(&queue))) {
 		struct commit_list *parents = c->parents;
 		struct commit_name **slot;
 
@@ -361,6 +421,7 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 				c->object.flags |= t->flag_within;
 				if (n->prio == 2)
 					annotated_cnt++;
+				set_mask(&queue, queue.mask | t->flag_within);
 			}
 			else {
 				gave_up_on = c;
@@ -372,23 +433,30 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 			if (!(c->object.flags & t->flag_within))
 				t->depth++;
 		}
-		if (annotated_cnt && !list) {
+		if (annotated_cnt && !queue.queue.nr) {
 			if (debug)
 				fprintf(stderr, _("finished search at %s\n"),
 					oid_to_hex(&c->object.oid));
 			break;
 		}
 		while (parents) {
-			struct commit *p = parents->item;
-			parse_commit(p);
-			if (!(p->object.flags & SEEN))
-				commit_list_insert_by_date(p, &list);
-			p->object.flags |= c->object.flags;
+			visit_parent(&queue, parents->item, c->object.flags);
 			parents = parents->next;
 
 			if (first_parent)
 				break;
 		}
+		/*
+		 * When all the commits left are reachable from every tag
+		 * found, the depths of these tags are final, and tags found
+		 * further down would be deeper than all of them.
+		 */
+		if (match_cnt && !queue.pending) {
+			if (debug)
+				fprintf(stderr, _("finished search at %s\n"),
+					oid_to_hex(&c->object.oid));
+			break;
+		}
 	}
 
 	if (!match_cnt) {
@@ -412,11 +480,12 @@ static void describe_commit(struct object_id *oid, struct strbuf *dst)
 	QSORT(all_matches, match_cnt, compare_pt);
 
 	if (gave_up_on) {
-		commit_list_insert_by_date(gave_up_on, &list);
+		put_commit(&queue, gave_up_on);
 		seen_commits--;
 	}
-	seen_commits += finish_depth_computation(&list, &all_matches[0]);
-	free_commit_list(list);
+	seen_commits += finish_depth_computation(&queue, &all_matches[0]);
+	clear_prio_queue(&queue.queue);
+	clear_commit_queued(&queue.queued);
 
 	if (debug) {
 		static int label_width = -1;
@@ -628,7 +697,7 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 			struct argv_array args = ARGV_ARRAY_INIT;
 			int fd, result;
 
-			read_cache_preload(NULL);
+			read_cache_preload(NULL, PRELOAD_REFRESH);
 			refresh_index(&the_index, REFRESH_QUIET|REFRESH_UNMERGED,
 				      NULL, NULL, NULL);
 			fd = hold_locked_index(&index_lock, 0);
@@ -65,7 +65,7 @@ int cmd_diff_files(int argc, const char **argv, const char *prefix)
 	    (rev.diffopt.output_format & DIFF_FORMAT_PATCH))
 		rev.combine_merges = rev.dense_combined_merges = 1;
 
-	if (read_cache_preload(&rev.diffopt.pathspec) < 0) {
+	if (read_cache_preload(&rev.diffopt.pathspec, 0) < 0) {
 		perror("read_cache_preload");
 		return -1;
 	}
@@ -47,7 +47,7 @@ int cmd_diff_index(int argc, const char **argv, const char *prefix)
 		usage(diff_cache_usage);
 	if (!cached) {
 		setup_work_tree();
-		if (read_cache_preload(&rev.diffopt.pathspec) < 0) {
+		if (read_cache_preload(&rev.diffopt.pathspec, 0) < 0) {
 			perror("read_cache_preload");
 			return -1;
 		}
@@ -24,6 +24,7 @@
 #include "remote.h"
 #include "blob.h"
 #include "commit-slab.h"
+#include "streaming.h"
 
 static const char *fast_export_usage[] = {
 	N_("git fast-export [rev-list-opts]"),
@@ -216,6 +217,48 @@ static char *anonymize_blob(unsigned long *size)
 	return strbuf_detach(&out, NULL);
 }
 
+/*
+ * Copy a blob larger than core.bigFileThreshold to the output a chunk
+ * at a time, checking its object name as we go, instead of reading it
+ * into memory whole.
+ */
+static void stream_blob(const struct object_id *oid, unsigned long size)
+{
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long total = 0;
+	char hdr[64];
+	int hdrlen;
+	git_hash_ctx c;
+	struct object_id real_oid;
+
+	st = open_istream(oid, &type, &size, NULL);
+	if (!st)
+		die("Could not read blob %s", oid_to_hex(oid));
+
+	hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %lu",
+			   type_name(type), size) + 1;
+	the_hash_algo->init_fn(&c);
+	the_hash_algo->update_fn(&c, hdr, hdrlen);
+	for (;;) {
+		char buf[1024 * 16];
+		ssize_t readlen = read_istream(st, buf, sizeof(buf));
+
+		if (readlen < 0)
+			die("Could not read blob %s", oid_to_hex(oid));
+		if (!readlen)
+			break;
+		the_hash_algo->update_fn(&c, buf, readlen);
+		if (fwrite(buf, readlen, 1, stdout) != 1)
+			die_errno ("Could not write blob '%s'", oid_to_hex(oid));
+		total += readlen;
+	}
+	close_istream(st);
+	the_hash_algo->final_fn(real_oid.hash, &c);
+	if (total != size || oidcmp(oid, &real_oid))
+		die("sha1 mismatch in blob %s", oid_to_hex(oid));
+}
+
 static void export_blob(const struct object_id *oid)
 {
 	unsigned long size;
@@ -238,6 +281,11 @@ static void export_blob(const struct object_id *oid)
 		buf = anonymize_blob(&size);
 		object = (struct object *)lookup_blob(oid);
 		eaten = 0;
+	} else if (oid_object_info(the_repository, oid, &size) == OBJ_BLOB &&
+		   size > big_file_threshold) {
+		buf = NULL;
+		object = (struct object *)lookup_blob(oid);
+		eaten = 1;
 	} else {
 		buf = read_object_file(oid, &type, &size);
 		if (!buf)
@@ -253,7 +301,9 @@ static void export_blob(const struct object_id *oid)
 	mark_next_object(object);
 
 	printf("blob\nmark :%"PRIu32"\ndata %lu\n", last_idnum, size);
-	if (size && fwrite(buf, size, 1, stdout) != 1)
+	if (!buf)
+		stream_blob(oid, size);
+	else if (size && fwrite(buf, size, 1, stdout) != 1)
 		die_errno ("Could not write blob '%s'", oid_to_hex(oid));
 	printf("\n");
 
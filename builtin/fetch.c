@@ -8,6 +8,7 @@
 #include "refspec.h"
 #include "object-store.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "builtin.h"
 #include "string-list.h"
 #include "remote.h"
@@ -21,6 +22,7 @@
 #include "argv-array.h"
 #include "utf8.h"
 #include "packfile.h"
+#include "oidset.h"
 #include "list-objects-filter-options.h"
 
 static const char * const builtin_fetch_usage[] = {
@@ -46,9 +48,14 @@ static int prune_tags = -1; /* unspecified */
 #define PRUNE_TAGS_BY_DEFAULT 0 /* do we prune tags by default? */
 
 static int all, append, dry_run, force, keep, multiple, update_head_ok, verbosity, deepen_relative;
+static int atomic_fetch, truncate_fetch_head_later;
+static int write_fetch_head = 1;
+static int prefetch;
 static int progress = -1;
 static int tags = TAGS_DEFAULT, unshallow, update_shallow, deepen;
-static int max_children = 1;
+static int max_jobs = -1, submodule_fetch_jobs_config = -1;
+static int fetch_parallel_config = 1;
+static int enable_auto_maintenance = 1;
 static enum transport_family family;
 static const char *depth;
 static const char *deepen_since;
@@ -77,6 +84,13 @@ static int git_fetch_config(const char *k, const char *v, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(k, "fetch.parallel")) {
+		fetch_parallel_config = git_config_int(k, v);
+		if (fetch_parallel_config < 0)
+			die(_("fetch.parallel cannot be negative"));
+		return 0;
+	}
+
 	if (!strcmp(k, "submodule.recurse")) {
 		int r = git_config_bool(k, v) ?
 			RECURSE_SUBMODULES_ON : RECURSE_SUBMODULES_OFF;
@@ -84,7 +98,7 @@ static int git_fetch_config(const char *k, const char *v, void *cb)
 	}
 
 	if (!strcmp(k, "submodule.fetchjobs")) {
-		max_children = parse_submodule_fetchjobs(k, v);
+		submodule_fetch_jobs_config = parse_submodule_fetchjobs(k, v);
 		return 0;
 	} else if (!strcmp(k, "fetch.recursesubmodules")) {
 		recurse_submodules = parse_fetch_recurse_submodules_arg(k, v);
@@ -120,8 +134,8 @@ static struct option builtin_fetch_options[] = {
 		    N_("fetch all tags and associated objects"), TAGS_SET),
 	OPT_SET_INT('n', NULL, &tags,
 		    N_("do not fetch all tags (--no-tags)"), TAGS_UNSET),
-	OPT_INTEGER('j', "jobs", &max_children,
-		    N_("number of submodules fetched in parallel")),
+	OPT_INTEGER('j', "jobs", &max_jobs,
+		    N_("number of submodules and remotes fetched in parallel")),
 	OPT_BOOL('p', "prune", &prune,
 		 N_("prune remote-tracking branches no longer on remote")),
 	OPT_BOOL('P', "prune-tags", &prune_tags,
@@ -131,6 +145,14 @@ static struct option builtin_fetch_options[] = {
 		    PARSE_OPT_OPTARG, option_fetch_parse_recurse_submodules },
 	OPT_BOOL(0, "dry-run", &dry_run,
 		 N_("dry run")),
+	OPT_BOOL(0, "atomic", &atomic_fetch,
+		 N_("use an atomic transaction to update the local refs")),
+	OPT_BOOL(0, "write-fetch-head", &write_fetch_head,
+		 N_("write fetched references to the FETCH_HEAD file")),
+	OPT_BOOL(0, "auto-maintenance", &enable_auto_maintenance,
+		 N_("run 'maintenance --auto' after fetching")),
+	OPT_BOOL(0, "prefetch", &prefetch,
+		 N_("modify the refspec to place all refs within refs/prefetch/")),
 	OPT_BOOL('k', "keep", &keep, N_("keep downloaded pack")),
 	OPT_BOOL('u', "update-head-ok", &update_head_ok,
 		    N_("allow updating of HEAD ref")),
@@ -231,61 +253,102 @@ static int add_existing(const char *refname, const struct object_id *oid,
 	return 0;
 }
 
-static int will_fetch(struct ref **head, const unsigned char *sha1)
+/*
+ * Collect the existing refs that live in the same directories as the
+ * peer refs of `ref_map`, without reading the rest of the ref store.
+ */
+static void add_existing_peers(const struct ref *ref_map,
+			       struct string_list *existing_refs)
 {
-	struct ref *rm = *head;
-	while (rm) {
-		if (!hashcmp(rm->old_oid.hash, sha1))
-			return 1;
-		rm = rm->next;
+	struct argv_array dirs = ARGV_ARRAY_INIT;
+	const struct ref *rm;
+
+	for (rm = ref_map; rm; rm = rm->next) {
+		const char *slash;
+
+		if (!rm->peer_ref)
+			continue;
+		slash = strrchr(rm->peer_ref->name, '/');
+		if (slash)
+			argv_array_pushf(&dirs, "%.*s",
+					 (int)(slash - rm->peer_ref->name + 1),
+					 rm->peer_ref->name);
+		else
+			argv_array_push(&dirs, "");
 	}
+	if (dirs.argc)
+		refs_for_each_fullref_in_prefixes(get_main_ref_store(the_repository),
+						  "", dirs.argv,
+						  add_existing, existing_refs);
+	argv_array_clear(&dirs);
+}
+
+struct local_tips {
+	struct string_list *tags;
+	struct oidset *tips;
+};
+
+static int add_local_tip(const char *refname, const struct object_id *oid,
+			 int flag, void *cbdata)
+{
+	struct local_tips *data = cbdata;
+
+	oidset_insert(data->tips, oid);
+	if (starts_with(refname, "refs/tags/"))
+		add_existing(refname, oid, flag, data->tags);
 	return 0;
 }
 
+struct tag_candidate {
+	struct object_id oid;
+	struct object_id peeled;
+	unsigned has_peeled : 1;
+};
+
 static void find_non_local_tags(const struct ref *refs,
 				struct ref **head,
 				struct ref ***tail)
 {
 	struct string_list existing_refs = STRING_LIST_INIT_DUP;
 	struct string_list remote_refs = STRING_LIST_INIT_NODUP;
+	struct oidset tips = OIDSET_INIT;
+	struct oidset fetching = OIDSET_INIT;
+	struct local_tips data = { &existing_refs, &tips };
+	struct object_id *lookup = NULL;
+	unsigned char *found;
+	size_t nr_lookup = 0, alloc_lookup = 0, i;
 	const struct ref *ref;
 	struct string_list_item *item = NULL;
 
-	for_each_ref(add_existing, &existing_refs);
+	/*
+	 * Every tip we have is an object we have, so walking the refs once
+	 * answers most of the existence questions below without looking
+	 * into the object store at all.
+	 */
+	for_each_ref(add_local_tip, &data);
+	for (ref = *head; ref; ref = ref->next)
+		oidset_insert(&fetching, &ref->old_oid);
+
 	for (ref = refs; ref; ref = ref->next) {
+		struct tag_candidate *tag;
+
 		if (!starts_with(ref->name, "refs/tags/"))
 			continue;
 
 		/*
 		 * The peeled ref always follows the matching base
-		 * ref, so if we see a peeled ref that we don't want
-		 * to fetch then we can mark the ref entry in the list
-		 * as one to ignore by setting util to NULL.
+		 * ref, so remember it with the entry for that ref.
 		 */
 		if (ends_with(ref->name, "^{}")) {
-			if (item &&
-			    !has_object_file_with_flags(&ref->old_oid,
-							OBJECT_INFO_QUICK) &&
-			    !will_fetch(head, ref->old_oid.hash) &&
-			    !has_sha1_file_with_flags(item->util,
-						      OBJECT_INFO_QUICK) &&
-			    !will_fetch(head, item->util))
-				item->util = NULL;
+			if (item) {
+				tag = item->util;
+				oidcpy(&tag->peeled, &ref->old_oid);
+				tag->has_peeled = 1;
+			}
 			item = NULL;
 			continue;
 		}
 
-		/*
-		 * If item is non-NULL here, then we previously saw a
-		 * ref not followed by a peeled reference, so we need
-		 * to check if it is a lightweight tag that we want to
-		 * fetch.
-		 */
-		if (item &&
-		    !has_sha1_file_with_flags(item->util, OBJECT_INFO_QUICK) &&
-		    !will_fetch(head, item->util))
-			item->util = NULL;
-
 		item = NULL;
 
 		/* skip duplicates and refs that we already have */
@@ -294,36 +357,63 @@ static void find_non_local_tags(const struct ref *refs,
 			continue;
 
 		item = string_list_insert(&remote_refs, ref->name);
-		item->util = (void *)&ref->old_oid;
+		tag = xcalloc(1, sizeof(*tag));
+		oidcpy(&tag->oid, &ref->old_oid);
+		item->util = tag;
 	}
 	string_list_clear(&existing_refs, 1);
 
 	/*
-	 * We may have a final lightweight tag that needs to be
-	 * checked to see if it needs fetching.
+	 * Check whether we have the objects that are neither tips of ours
+	 * nor about to be fetched all at once, rather than one by one.
 	 */
-	if (item &&
-	    !has_sha1_file_with_flags(item->util, OBJECT_INFO_QUICK) &&
-	    !will_fetch(head, item->util))
-		item->util = NULL;
+	for_each_string_list_item(item, &remote_refs) {
+		struct tag_candidate *tag = item->util;
+		const struct object_id *oids[2] = { &tag->oid, &tag->peeled };
+		int n = tag->has_peeled ? 2 : 1, j;
+
+		for (j = 0; j < n; j++) {
+			if (oidset_contains(&tips, oids[j]) ||
+			    oidset_contains(&fetching, oids[j]))
+				continue;
+			ALLOC_GROW(lookup, nr_lookup + 1, alloc_lookup);
+			oidcpy(&lookup[nr_lookup++], oids[j]);
+		}
+	}
+	found = xcalloc(nr_lookup ? nr_lookup : 1, 1);
+	has_object_files_quick(the_repository, lookup, nr_lookup, found);
+	for (i = 0; i < nr_lookup; i++)
+		if (found[i])
+			oidset_insert(&tips, &lookup[i]);
+	free(found);
+	free(lookup);
 
 	/*
-	 * For all the tags in the remote_refs string list,
-	 * add them to the list of refs to be fetched
+	 * For all the tags in the remote_refs string list, add them to
+	 * the list of refs to be fetched, unless neither the tag nor
+	 * what it points at is something we have or are going to get.
 	 */
 	for_each_string_list_item(item, &remote_refs) {
-		/* Unless we have already decided to ignore this item... */
-		if (item->util)
-		{
-			struct ref *rm = alloc_ref(item->string);
-			rm->peer_ref = alloc_ref(item->string);
-			oidcpy(&rm->old_oid, item->util);
-			**tail = rm;
-			*tail = &rm->next;
-		}
+		struct tag_candidate *tag = item->util;
+		struct ref *rm;
+
+		if (!oidset_contains(&tips, &tag->oid) &&
+		    !oidset_contains(&fetching, &tag->oid) &&
+		    (!tag->has_peeled ||
+		     (!oidset_contains(&tips, &tag->peeled) &&
+		      !oidset_contains(&fetching, &tag->peeled))))
+			continue;
+
+		rm = alloc_ref(item->string);
+		rm->peer_ref = alloc_ref(item->string);
+		oidcpy(&rm->old_oid, &tag->oid);
+		**tail = rm;
+		*tail = &rm->next;
 	}
 
-	string_list_clear(&remote_refs, 0);
+	string_list_clear(&remote_refs, 1);
+	oidset_clear(&tips);
+	oidset_clear(&fetching);
 }
 
 static struct ref *get_ref_map(struct remote *remote,
@@ -433,7 +523,7 @@ static struct ref *get_ref_map(struct remote *remote,
 
 	ref_map = ref_remove_duplicates(ref_map);
 
-	for_each_ref(add_existing, &existing_refs);
+	add_existing_peers(ref_map, &existing_refs);
 	for (rm = ref_map; rm; rm = rm->next) {
 		if (rm->peer_ref) {
 			struct string_list_item *peer_item =
@@ -453,15 +543,26 @@ static struct ref *get_ref_map(struct remote *remote,
 #define STORE_REF_ERROR_OTHER 1
 #define STORE_REF_ERROR_DF_CONFLICT 2
 
+static int commit_error(int ret)
+{
+	return ret == TRANSACTION_NAME_CONFLICT ? STORE_REF_ERROR_DF_CONFLICT
+						: STORE_REF_ERROR_OTHER;
+}
+
+/*
+ * Update the ref in a transaction of its own, or with --atomic, queue
+ * the update in "transaction" for the caller to commit with the others.
+ */
 static int s_update_ref(const char *action,
 			struct ref *ref,
+			struct ref_transaction *transaction,
 			int check_old)
 {
 	char *msg;
 	char *rla = getenv("GIT_REFLOG_ACTION");
-	struct ref_transaction *transaction;
+	struct ref_transaction *our_transaction = NULL;
 	struct strbuf err = STRBUF_INIT;
-	int ret, df_conflict = 0;
+	int ret = 0;
 
 	if (dry_run)
 		return 0;
@@ -469,31 +570,35 @@ static int s_update_ref(const char *action,
 		rla = default_rla.buf;
 	msg = xstrfmt("%s: %s", rla, action);
 
-	transaction = ref_transaction_begin(&err);
-	if (!transaction ||
-	    ref_transaction_update(transaction, ref->name,
+	if (!transaction) {
+		transaction = our_transaction = ref_transaction_begin(&err);
+		if (!transaction) {
+			ret = STORE_REF_ERROR_OTHER;
+			goto out;
+		}
+	}
+
+	if (ref_transaction_update(transaction, ref->name,
 				   &ref->new_oid,
 				   check_old ? &ref->old_oid : NULL,
-				   0, msg, &err))
-		goto fail;
+				   0, msg, &err)) {
+		ret = STORE_REF_ERROR_OTHER;
+		goto out;
+	}
 
-	ret = ref_transaction_commit(transaction, &err);
-	if (ret) {
-		df_conflict = (ret == TRANSACTION_NAME_CONFLICT);
-		goto fail;
+	if (our_transaction) {
+		ret = ref_transaction_commit(our_transaction, &err);
+		if (ret)
+			ret = commit_error(ret);
 	}
 
-	ref_transaction_free(transaction);
-	strbuf_release(&err);
-	free(msg);
-	return 0;
-fail:
-	ref_transaction_free(transaction);
-	error("%s", err.buf);
+out:
+	ref_transaction_free(our_transaction);
+	if (ret)
+		error("%s", err.buf);
 	strbuf_release(&err);
 	free(msg);
-	return df_conflict ? STORE_REF_ERROR_DF_CONFLICT
-			   : STORE_REF_ERROR_OTHER;
+	return ret;
 }
 
 static int refcol_width = 10;
@@ -627,6 +732,7 @@ static void format_display(struct strbuf *display, char code,
 }
 
 static int update_local_ref(struct ref *ref,
+			    struct ref_transaction *transaction,
 			    const char *remote,
 			    const struct ref *remote_ref,
 			    struct strbuf *display,
@@ -665,7 +771,7 @@ static int update_local_ref(struct ref *ref,
 	if (!is_null_oid(&ref->old_oid) &&
 	    starts_with(ref->name, "refs/tags/")) {
 		int r;
-		r = s_update_ref("updating tag", ref, 0);
+		r = s_update_ref("updating tag", ref, transaction, 0);
 		format_display(display, r ? '!' : 't', _("[tag update]"),
 			       r ? _("unable to update local ref") : NULL,
 			       remote, pretty_ref, summary_width);
@@ -698,7 +804,7 @@ static int update_local_ref(struct ref *ref,
 		if ((recurse_submodules != RECURSE_SUBMODULES_OFF) &&
 		    (recurse_submodules != RECURSE_SUBMODULES_ON))
 			check_for_new_submodule_commits(&ref->new_oid);
-		r = s_update_ref(msg, ref, 0);
+		r = s_update_ref(msg, ref, transaction, 0);
 		format_display(display, r ? '!' : '*', what,
 			       r ? _("unable to update local ref") : NULL,
 			       remote, pretty_ref, summary_width);
@@ -714,7 +820,7 @@ static int update_local_ref(struct ref *ref,
 		if ((recurse_submodules != RECURSE_SUBMODULES_OFF) &&
 		    (recurse_submodules != RECURSE_SUBMODULES_ON))
 			check_for_new_submodule_commits(&ref->new_oid);
-		r = s_update_ref("fast-forward", ref, 1);
+		r = s_update_ref("fast-forward", ref, transaction, 1);
 		format_display(display, r ? '!' : ' ', quickref.buf,
 			       r ? _("unable to update local ref") : NULL,
 			       remote, pretty_ref, summary_width);
@@ -729,7 +835,7 @@ static int update_local_ref(struct ref *ref,
 		if ((recurse_submodules != RECURSE_SUBMODULES_OFF) &&
 		    (recurse_submodules != RECURSE_SUBMODULES_ON))
 			check_for_new_submodule_commits(&ref->new_oid);
-		r = s_update_ref("forced-update", ref, 1);
+		r = s_update_ref("forced-update", ref, transaction, 1);
 		format_display(display, r ? '!' : '+', quickref.buf,
 			       r ? _("unable to update local ref") : _("forced update"),
 			       remote, pretty_ref, summary_width);
@@ -757,21 +863,31 @@ static int iterate_ref_map(void *cb_data, struct object_id *oid)
 }
 
 static int store_updated_refs(const char *raw_url, const char *remote_name,
-			      int connectivity_checked, struct ref *ref_map)
+			      int connectivity_checked, struct ref *ref_map,
+			      const char *pack_lockfile)
 {
-	FILE *fp;
+	int fd;
 	struct commit *commit;
 	int url_len, i, rc = 0;
 	struct strbuf note = STRBUF_INIT;
+	struct strbuf fetch_head = STRBUF_INIT;
 	const char *what, *kind;
 	struct ref *rm;
 	char *url;
-	const char *filename = dry_run ? "/dev/null" : git_path_fetch_head(the_repository);
+	const char *filename = (dry_run || !write_fetch_head)
+		? "/dev/null" : git_path_fetch_head(the_repository);
 	int want_status;
 	int summary_width = transport_summary_width(ref_map);
+	struct ref_transaction *transaction = NULL;
+	struct strbuf err = STRBUF_INIT;
 
-	fp = fopen(filename, "a");
-	if (!fp)
+	/*
+	 * Our lines go to FETCH_HEAD in a single write at the end, so that
+	 * they are not mixed with those of other fetches appending to it
+	 * at the same time.
+	 */
+	fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd < 0)
 		return error_errno(_("cannot open %s"), filename);
 
 	if (raw_url)
@@ -780,13 +896,28 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 		url = xstrdup("foreign");
 
 	if (!connectivity_checked) {
+		struct check_connected_options opt = CHECK_CONNECTED_INIT;
+
+		opt.pack_lockfile = pack_lockfile;
 		rm = ref_map;
-		if (check_connected(iterate_ref_map, &rm, NULL)) {
+		if (check_connected(iterate_ref_map, &rm, &opt)) {
 			rc = error(_("%s did not send all necessary objects\n"), url);
 			goto abort;
 		}
 	}
 
+	/*
+	 * With --atomic, all the refs are updated in a single transaction
+	 * committed at the end, or not at all if any of them fails.
+	 */
+	if (atomic_fetch) {
+		transaction = ref_transaction_begin(&err);
+		if (!transaction) {
+			rc = error("%s", err.buf);
+			goto abort;
+		}
+	}
+
 	prepare_format_display(ref_map);
 
 	/*
@@ -863,16 +994,16 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 				merge_status_marker = "not-for-merge";
 				/* fall-through */
 			case FETCH_HEAD_MERGE:
-				fprintf(fp, "%s\t%s\t%s",
-					oid_to_hex(&rm->old_oid),
-					merge_status_marker,
-					note.buf);
+				strbuf_addf(&fetch_head, "%s\t%s\t%s",
+					    oid_to_hex(&rm->old_oid),
+					    merge_status_marker,
+					    note.buf);
 				for (i = 0; i < url_len; ++i)
 					if ('\n' == url[i])
-						fputs("\\n", fp);
+						strbuf_addstr(&fetch_head, "\\n");
 					else
-						fputc(url[i], fp);
-				fputc('\n', fp);
+						strbuf_addch(&fetch_head, url[i]);
+				strbuf_addch(&fetch_head, '\n');
 				break;
 			default:
 				/* do not write anything to FETCH_HEAD */
@@ -881,8 +1012,8 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 
 			strbuf_reset(&note);
 			if (ref) {
-				rc |= update_local_ref(ref, what, rm, &note,
-						       summary_width);
+				rc |= update_local_ref(ref, transaction, what,
+						       rm, &note, summary_width);
 				free(ref);
 			} else
 				format_display(&note, '*',
@@ -901,15 +1032,39 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 		}
 	}
 
+	if (transaction && !dry_run) {
+		if (rc)
+			error(_("no local refs were updated, as --atomic was given"));
+		else if ((rc = ref_transaction_commit(transaction, &err))) {
+			error("%s", err.buf);
+			rc = commit_error(rc);
+		}
+	}
+
 	if (rc & STORE_REF_ERROR_DF_CONFLICT)
 		error(_("some local refs could not be updated; try running\n"
 		      " 'git remote prune %s' to remove any old, conflicting "
 		      "branches"), remote_name);
 
+	/* FETCH_HEAD must not name what an atomic fetch did not store */
+	if (transaction && rc)
+		goto abort;
+
+	if (truncate_fetch_head_later) {
+		if (ftruncate(fd, 0) < 0)
+			rc |= error_errno(_("cannot truncate %s"), filename);
+		truncate_fetch_head_later = 0;
+	}
+	if (write_in_full(fd, fetch_head.buf, fetch_head.len) < 0)
+		rc |= error_errno(_("cannot write %s"), filename);
+
  abort:
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	strbuf_release(&fetch_head);
 	strbuf_release(&note);
 	free(url);
-	fclose(fp);
+	close(fd);
 	return rc;
 }
 
@@ -961,7 +1116,7 @@ static int consume_refs(struct transport *transport, struct ref *ref_map)
 	int ret = store_updated_refs(transport->url,
 				     transport->remote->name,
 				     connectivity_checked,
-				     ref_map);
+				     ref_map, transport->pack_lockfile);
 	transport_unlock_pack(transport);
 	return ret;
 }
@@ -1116,6 +1271,38 @@ static void backfill_tags(struct transport *transport, struct ref *ref_map)
 	}
 }
 
+/*
+ * Point the destinations of "rs" into refs/prefetch/, and drop the
+ * refspecs that would write elsewhere: those without a destination,
+ * and those of tags.
+ */
+static void filter_prefetch_refspec(struct refspec *rs)
+{
+	int i, j;
+
+	for (i = j = 0; i < rs->nr; i++) {
+		struct refspec_item *item = &rs->items[i];
+		const char *sub;
+		char *dst;
+
+		if (!item->dst ||
+		    (item->src && starts_with(item->src, "refs/tags/"))) {
+			refspec_item_clear(item);
+			continue;
+		}
+
+		if (!skip_prefix(item->dst, "refs/", &sub))
+			sub = item->dst;
+		dst = xstrfmt("refs/prefetch/%s", sub);
+		free(item->dst);
+		item->dst = dst;
+		item->force = 1;
+
+		rs->items[j++] = *item;
+	}
+	rs->nr = j;
+}
+
 static int do_fetch(struct transport *transport,
 		    struct refspec *rs)
 {
@@ -1132,12 +1319,27 @@ static int do_fetch(struct transport *transport,
 		if (transport->remote->fetch_tags == -1)
 			tags = TAGS_UNSET;
 	}
+	if (prefetch) {
+		tags = TAGS_UNSET;
+		autotags = 0;
+		if (rs->nr)
+			filter_prefetch_refspec(rs);
+		else if (transport->remote)
+			filter_prefetch_refspec(&transport->remote->fetch);
+	}
 
-	/* if not appending, truncate FETCH_HEAD */
-	if (!append && !dry_run) {
-		retcode = truncate_fetch_head();
-		if (retcode)
-			goto cleanup;
+	/*
+	 * If not appending, truncate FETCH_HEAD, or with --atomic, only
+	 * once the refs have been updated.
+	 */
+	if (!append && !dry_run && write_fetch_head) {
+		if (atomic_fetch)
+			truncate_fetch_head_later = 1;
+		else {
+			retcode = truncate_fetch_head();
+			if (retcode)
+				goto cleanup;
+		}
 	}
 
 	if (rs->nr)
@@ -1265,6 +1467,10 @@ static void add_options_to_argv(struct argv_array *argv)
 {
 	if (dry_run)
 		argv_array_push(argv, "--dry-run");
+	if (!write_fetch_head)
+		argv_array_push(argv, "--no-write-fetch-head");
+	if (prefetch)
+		argv_array_push(argv, "--prefetch");
 	if (prune != -1)
 		argv_array_push(argv, prune ? "--prune" : "--no-prune");
 	if (prune_tags != -1)
@@ -1292,20 +1498,94 @@ static void add_options_to_argv(struct argv_array *argv)
 
 }
 
-static int fetch_multiple(struct string_list *list)
+struct parallel_fetch_state {
+	const char **argv;
+	struct string_list *remotes;
+	int next, result;
+};
+
+static int fetch_next_remote(struct child_process *cp, struct strbuf *out,
+			     void *cb, void **task_cb)
+{
+	struct parallel_fetch_state *state = cb;
+	const char *remote;
+
+	if (state->next >= state->remotes->nr)
+		return 0;
+
+	remote = state->remotes->items[state->next++].string;
+	*task_cb = (void *)remote;
+
+	argv_array_pushv(&cp->args, state->argv);
+	argv_array_push(&cp->args, remote);
+	cp->git_cmd = 1;
+
+	if (verbosity >= 0)
+		printf(_("Fetching %s\n"), remote);
+
+	return 1;
+}
+
+static int fetch_failed_to_start(struct strbuf *out, void *cb, void *task_cb)
+{
+	struct parallel_fetch_state *state = cb;
+	const char *remote = task_cb;
+
+	error(_("Could not fetch %s"), remote);
+	state->result = 1;
+
+	return 0;
+}
+
+static int fetch_finished(int result, struct strbuf *out,
+			  void *cb, void *task_cb)
+{
+	struct parallel_fetch_state *state = cb;
+	const char *remote = task_cb;
+
+	if (result) {
+		strbuf_addf(out, _("could not fetch '%s' (exit code: %d)\n"),
+			    remote, result);
+		state->result = 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Fetch from each remote in a "git fetch" of its own, up to
+ * "max_children" of them at a time. The maintenance these would run is
+ * left to us, to be done once.
+ */
+static int fetch_multiple(struct string_list *list, int max_children)
 {
 	int i, result = 0;
 	struct argv_array argv = ARGV_ARRAY_INIT;
 
-	if (!append && !dry_run) {
+	if (!append && !dry_run && write_fetch_head) {
 		int errcode = truncate_fetch_head();
 		if (errcode)
 			return errcode;
 	}
 
-	argv_array_pushl(&argv, "fetch", "--append", NULL);
+	argv_array_pushl(&argv, "fetch", "--append", "--no-auto-maintenance",
+			 NULL);
 	add_options_to_argv(&argv);
 
+	if (max_children != 1 && list->nr != 1) {
+		struct parallel_fetch_state state = { argv.argv, list, 0, 0 };
+
+		result = run_processes_parallel(max_children,
+						&fetch_next_remote,
+						&fetch_failed_to_start,
+						&fetch_finished,
+						&state);
+		if (!result)
+			result = state.result;
+		argv_array_clear(&argv);
+		return result;
+	}
+
 	for (i = 0; i < list->nr; i++) {
 		const char *name = list->items[i].string;
 		argv_array_push(&argv, name);
@@ -1448,7 +1728,6 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	struct remote *remote = NULL;
 	int result = 0;
 	int prune_tags_ok = 1;
-	struct argv_array argv_gc_auto = ARGV_ARRAY_INIT;
 
 	packet_trace_identity("fetch");
 
@@ -1459,7 +1738,8 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	for (i = 1; i < argc; i++)
 		strbuf_addf(&default_rla, " %s", argv[i]);
 
-	fetch_config_from_gitmodules(&max_children, &recurse_submodules);
+	fetch_config_from_gitmodules(&submodule_fetch_jobs_config,
+				     &recurse_submodules);
 	git_config(git_fetch_config, NULL);
 
 	argc = parse_options(argc, argv, prefix,
@@ -1528,11 +1808,18 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 		if (filter_options.choice)
 			die(_("--filter can only be used with the remote configured in core.partialClone"));
 		/* TODO should this also die if we have a previous partial-clone? */
-		result = fetch_multiple(&list);
+		result = fetch_multiple(&list, max_jobs < 0 ?
+					fetch_parallel_config : max_jobs);
 	}
 
 	if (!result && (recurse_submodules != RECURSE_SUBMODULES_OFF)) {
 		struct argv_array options = ARGV_ARRAY_INIT;
+		int max_children = max_jobs;
+
+		if (max_children < 0)
+			max_children = submodule_fetch_jobs_config;
+		if (max_children < 0)
+			max_children = fetch_parallel_config;
 
 		add_options_to_argv(&options);
 		result = fetch_populated_submodules(the_repository,
@@ -1549,11 +1836,8 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 
 	close_all_packs(the_repository->objects);
 
-	argv_array_pushl(&argv_gc_auto, "gc", "--auto", NULL);
-	if (verbosity < 0)
-		argv_array_push(&argv_gc_auto, "--quiet");
-	run_command_v_opt(argv_gc_auto.argv, RUN_GIT_CMD);
-	argv_array_clear(&argv_gc_auto);
+	if (enable_auto_maintenance)
+		run_auto_maintenance(verbosity < 0);
 
 	return result;
 }
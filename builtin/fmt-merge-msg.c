@@ -4,6 +4,7 @@
 #include "refs.h"
 #include "object-store.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "diff.h"
 #include "revision.h"
 #include "tag.h"
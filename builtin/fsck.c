@@ -18,6 +18,7 @@
 #include "decorate.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -43,6 +44,7 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int nr_threads;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -95,6 +97,14 @@ static int fsck_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (strcmp(var, "fsck.threads") == 0) {
+		nr_threads = git_config_int(var, value);
+		if (nr_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    nr_threads, var);
+		return 0;
+	}
+
 	if (skip_prefix(var, "fsck.", &var)) {
 		fsck_set_msg_type(&fsck_obj_options, var, value);
 		return 0;
@@ -507,19 +517,22 @@ static void get_default_heads(void)
 	}
 }
 
-static int fsck_loose(const struct object_id *oid, const char *path, void *data)
+/*
+ * Check a loose object, once read_loose_object() has returned "ret"
+ * for it.
+ */
+static void fsck_loose_read(const struct object_id *oid, const char *path,
+			    int ret, enum object_type type, unsigned long size,
+			    void *contents)
 {
 	struct object *obj;
-	enum object_type type;
-	unsigned long size;
-	void *contents;
 	int eaten;
 
-	if (read_loose_object(path, oid, &type, &size, &contents) < 0) {
+	if (ret < 0) {
 		errors_found |= ERROR_OBJECT;
 		error("%s: object corrupt or missing: %s",
 		      oid_to_hex(oid), path);
-		return 0; /* keep checking other objects */
+		return; /* keep checking other objects */
 	}
 
 	if (!contents && type != OBJ_BLOB)
@@ -532,7 +545,7 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 		      oid_to_hex(oid), path);
 		if (!eaten)
 			free(contents);
-		return 0; /* keep checking other objects */
+		return; /* keep checking other objects */
 	}
 
 	obj->flags &= ~(REACHABLE | SEEN);
@@ -542,6 +555,17 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 
 	if (!eaten)
 		free(contents);
+}
+
+static int fsck_loose(const struct object_id *oid, const char *path, void *data)
+{
+	enum object_type type;
+	unsigned long size;
+	void *contents;
+	int ret;
+
+	ret = read_loose_object(path, oid, &type, &size, &contents);
+	fsck_loose_read(oid, path, ret, type, size, contents);
 	return 0; /* keep checking other objects, even if we saw an error */
 }
 
@@ -558,6 +582,199 @@ static int fsck_subdir(unsigned int nr, const char *path, void *progress)
 	return 0;
 }
 
+#ifndef NO_PTHREADS
+/*
+ * With threads, the 256 subdirectories of the object directory are
+ * listed, and their objects read and hashed, by worker threads, at most
+ * LOOSE_AHEAD_PER_THREAD subdirectories each ahead of the main thread.
+ * The main thread parses and checks the objects in the order they were
+ * listed, printing what the workers had to report about each just
+ * before, so that the output is that of a single thread.
+ */
+#define LOOSE_AHEAD_PER_THREAD 2
+
+struct loose_file {
+	struct object_id oid;
+	char *path;
+	const char *basename; /* for cruft; NULL for an object */
+	enum object_type type;
+	unsigned long size;
+	void *contents;
+	int ret;
+	char *reports;
+};
+
+struct loose_subdir {
+	struct loose_file *files;
+	int nr, alloc;
+	char *reports;
+	unsigned done:1,
+		 listed:1;
+};
+
+struct loose_state {
+	const char *objdir;
+	struct loose_subdir subdirs[256];
+	unsigned int next, consumed, ahead;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static struct loose_file *add_loose_file(struct loose_subdir *sub,
+					 const char *path)
+{
+	struct loose_file *file;
+
+	ALLOC_GROW(sub->files, sub->nr + 1, sub->alloc);
+	file = &sub->files[sub->nr++];
+	memset(file, 0, sizeof(*file));
+	file->path = xstrdup(path);
+	return file;
+}
+
+static int list_loose(const struct object_id *oid, const char *path, void *data)
+{
+	oidcpy(&add_loose_file(data, path)->oid, oid);
+	return 0;
+}
+
+static int list_cruft(const char *basename, const char *path, void *data)
+{
+	struct loose_file *file = add_loose_file(data, path);
+
+	file->basename = file->path + strlen(path) - strlen(basename);
+	return 0;
+}
+
+static int list_subdir(unsigned int nr, const char *path, void *data)
+{
+	struct loose_subdir *sub = data;
+
+	sub->listed = 1;
+	return 0;
+}
+
+static void read_loose_subdir(struct loose_state *ls, unsigned int nr)
+{
+	struct loose_subdir *sub = &ls->subdirs[nr];
+	struct strbuf path = STRBUF_INIT, reports = STRBUF_INIT;
+	int i;
+
+	strbuf_addstr(&path, ls->objdir);
+	capture_reports(&reports);
+	for_each_file_in_obj_subdir(nr, &path, list_loose, list_cruft,
+				    list_subdir, sub);
+	sub->reports = strbuf_detach(&reports, NULL);
+
+	for (i = 0; i < sub->nr; i++) {
+		struct loose_file *file = &sub->files[i];
+
+		if (file->basename)
+			continue;
+		file->ret = read_loose_object(file->path, &file->oid,
+					      &file->type, &file->size,
+					      &file->contents);
+		file->reports = strbuf_detach(&reports, NULL);
+	}
+	capture_reports(NULL);
+	strbuf_release(&path);
+}
+
+static void *loose_thread(void *data)
+{
+	struct loose_state *ls = data;
+
+	pthread_mutex_lock(&ls->mutex);
+	for (;;) {
+		unsigned int nr;
+
+		while (ls->next < 256 && ls->next >= ls->consumed + ls->ahead)
+			pthread_cond_wait(&ls->cond, &ls->mutex);
+		if (ls->next >= 256)
+			break;
+		nr = ls->next++;
+		pthread_mutex_unlock(&ls->mutex);
+
+		read_loose_subdir(ls, nr);
+
+		pthread_mutex_lock(&ls->mutex);
+		ls->subdirs[nr].done = 1;
+		pthread_cond_broadcast(&ls->cond);
+	}
+	pthread_mutex_unlock(&ls->mutex);
+	return NULL;
+}
+
+static void fsck_loose_subdir(struct loose_subdir *sub, unsigned int nr,
+			      const char *objdir, struct progress *progress)
+{
+	int i;
+
+	fputs(sub->reports, stderr);
+	for (i = 0; i < sub->nr; i++) {
+		struct loose_file *file = &sub->files[i];
+
+		if (file->basename) {
+			fsck_cruft(file->basename, file->path, NULL);
+		} else {
+			fputs(file->reports, stderr);
+			fsck_loose_read(&file->oid, file->path, file->ret,
+					file->type, file->size, file->contents);
+			free(file->reports);
+		}
+		free(file->path);
+	}
+	if (sub->listed)
+		fsck_subdir(nr, objdir, progress);
+	free(sub->files);
+	free(sub->reports);
+}
+
+static void fsck_object_dir_threaded(const char *path,
+				     struct progress *progress)
+{
+	struct loose_state *ls = xcalloc(1, sizeof(*ls));
+	pthread_t *threads;
+	unsigned int i;
+
+	ls->objdir = path;
+	ls->ahead = LOOSE_AHEAD_PER_THREAD * nr_threads;
+	pthread_mutex_init(&ls->mutex, NULL);
+	pthread_cond_init(&ls->cond, NULL);
+
+	begin_report_capture();
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, loose_thread, ls))
+			die(_("unable to create thread"));
+
+	for (i = 0; i < 256; i++) {
+		struct loose_subdir *sub = &ls->subdirs[i];
+
+		pthread_mutex_lock(&ls->mutex);
+		while (!sub->done)
+			pthread_cond_wait(&ls->cond, &ls->mutex);
+		pthread_mutex_unlock(&ls->mutex);
+
+		fsck_loose_subdir(sub, i, path, progress);
+
+		pthread_mutex_lock(&ls->mutex);
+		ls->consumed = i + 1;
+		pthread_cond_broadcast(&ls->cond);
+		pthread_mutex_unlock(&ls->mutex);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	end_report_capture();
+
+	pthread_mutex_destroy(&ls->mutex);
+	pthread_cond_destroy(&ls->cond);
+	free(threads);
+	free(ls);
+}
+#endif
+
 static void fsck_object_dir(const char *path)
 {
 	struct progress *progress = NULL;
@@ -568,8 +785,13 @@ static void fsck_object_dir(const char *path)
 	if (show_progress)
 		progress = start_progress(_("Checking object directories"), 256);
 
-	for_each_loose_file_in_objdir(path, fsck_loose, fsck_cruft, fsck_subdir,
-				      progress);
+#ifndef NO_PTHREADS
+	if (nr_threads > 1)
+		fsck_object_dir_threaded(path, progress);
+	else
+#endif
+		for_each_loose_file_in_objdir(path, fsck_loose, fsck_cruft,
+					      fsck_subdir, progress);
 	display_progress(progress, 256);
 	stop_progress(&progress);
 }
@@ -714,6 +936,8 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 			xcalloc(1, sizeof(struct decoration));
 
 	git_config(fsck_config, NULL);
+	if (!nr_threads)
+		nr_threads = online_cpus();
 
 	fsck_head_link();
 	if (connectivity_only) {
@@ -748,7 +972,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 			     p = p->next) {
 				/* verify gives error messages itself */
 				if (verify_pack(p, fsck_obj_buffer,
-						progress, count))
+						progress, count, nr_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
@@ -0,0 +1,297 @@
+#include "builtin.h"
+#include "config.h"
+#include "parse-options.h"
+#include "fsmonitor-ipc.h"
+#include "fsmonitor--daemon.h"
+#include "sigchain.h"
+#include "tempfile.h"
+#include "unix-socket.h"
+
+static const char * const builtin_fsmonitor__daemon_usage[] = {
+	N_("git fsmonitor--daemon start"),
+	N_("git fsmonitor--daemon run [--debug]"),
+	N_("git fsmonitor--daemon stop"),
+	N_("git fsmonitor--daemon status"),
+	NULL
+};
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+#include "compat/fsmonitor/fsm-listen.h"
+
+/*
+ * The clock of a client and ours are not guaranteed to agree to the
+ * nanosecond; err on the side of reporting a change twice.
+ */
+#define CLOCK_SLACK_NS (1000000000ULL)
+
+static int listen_fd = -1;
+static struct tempfile *socket_file;
+
+/*
+ * Stop accepting clients, so that a command started right after "stop"
+ * returns does not find us still listening.
+ */
+static void stop_listening(void)
+{
+	if (listen_fd < 0)
+		return;
+	close(listen_fd);
+	listen_fd = -1;
+	delete_tempfile(&socket_file);
+}
+
+struct changed_path {
+	struct hashmap_entry ent;
+	uint64_t time;
+	char path[FLEX_ARRAY];
+};
+
+static int changed_path_cmp(const void *unused_cmp_data,
+			    const void *entry, const void *entry_or_key,
+			    const void *keydata)
+{
+	const struct changed_path *a = entry;
+	const struct changed_path *b = entry_or_key;
+
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+void fsmonitor_publish(struct fsmonitor_daemon_state *state, const char *path)
+{
+	struct changed_path key, *e;
+	unsigned int hash = strhash(path);
+
+	hashmap_entry_init(&key, hash);
+	e = hashmap_get(&state->changed_paths, &key, path);
+	if (!e) {
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(e, hash);
+		hashmap_add(&state->changed_paths, e);
+	}
+	e->time = getnanotime();
+}
+
+void fsmonitor_force_resync(struct fsmonitor_daemon_state *state)
+{
+	hashmap_free(&state->changed_paths, 1);
+	hashmap_init(&state->changed_paths, changed_path_cmp, NULL, 0);
+	state->start_time = getnanotime();
+}
+
+static void answer_query(struct fsmonitor_daemon_state *state,
+			 uint64_t since, struct strbuf *answer)
+{
+	struct hashmap_iter iter;
+	struct changed_path *e;
+
+	if (since < state->start_time) {
+		strbuf_addch(answer, '/');
+		return;
+	}
+
+	since = since > CLOCK_SLACK_NS ? since - CLOCK_SLACK_NS : 0;
+	hashmap_iter_init(&state->changed_paths, &iter);
+	while ((e = hashmap_iter_next(&iter))) {
+		if (e->time < since)
+			continue;
+		strbuf_addstr(answer, e->path);
+		strbuf_addch(answer, '\0');
+	}
+}
+
+/* Return 0 to keep serving, 1 when asked to stop. */
+static int serve_one_client(struct fsmonitor_daemon_state *state, int fd)
+{
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf answer = STRBUF_INIT;
+	const char *arg;
+	int stop = 0;
+
+	if (strbuf_read(&request, fd, 0) < 0) {
+		warning_errno("unable to read fsmonitor request");
+		goto out;
+	}
+
+	/* Make sure that the answer covers every change made so far. */
+	fsm_listen__drain(state);
+
+	if (skip_prefix(request.buf, "query ", &arg)) {
+		char *end;
+		uint64_t since = strtoumax(arg, &end, 10);
+
+		if (*end)
+			warning("invalid fsmonitor query: %s", request.buf);
+		else
+			answer_query(state, since, &answer);
+	} else if (!strcmp(request.buf, "status")) {
+		strbuf_addstr(&answer, get_git_work_tree());
+	} else if (!strcmp(request.buf, "stop")) {
+		stop_listening();
+		strbuf_addstr(&answer, "ok");
+		stop = 1;
+	} else {
+		warning("fsmonitor client sent unknown request: %s", request.buf);
+	}
+
+	if (write_in_full(fd, answer.buf, answer.len) < 0)
+		warning_errno("unable to answer fsmonitor client");
+
+out:
+	strbuf_release(&request);
+	strbuf_release(&answer);
+	return stop;
+}
+
+static void serve(struct fsmonitor_daemon_state *state)
+{
+	struct pollfd pfd[2];
+
+	pfd[0].fd = listen_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = fsm_listen__fd(state);
+	pfd[1].events = POLLIN;
+
+	while (!state->shutdown) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno != EINTR)
+				die_errno("poll failed");
+			continue;
+		}
+
+		if (pfd[1].revents & POLLIN)
+			fsm_listen__drain(state);
+
+		if (pfd[0].revents & POLLIN) {
+			int client = accept(listen_fd, NULL, NULL);
+
+			if (client < 0) {
+				warning_errno("accept failed");
+				continue;
+			}
+			if (serve_one_client(state, client))
+				state->shutdown = 1;
+			close(client);
+		}
+	}
+}
+
+static int fsmonitor_run_daemon(int debug)
+{
+	struct fsmonitor_daemon_state state;
+	const char *socket_path = fsmonitor_ipc__get_path();
+
+	memset(&state, 0, sizeof(state));
+	hashmap_init(&state.changed_paths, changed_path_cmp, NULL, 0);
+
+	listen_fd = unix_stream_listen(socket_path);
+	if (listen_fd < 0)
+		die_errno(_("unable to bind to '%s'"), socket_path);
+	socket_file = register_tempfile(socket_path);
+
+	/*
+	 * Anything that changes while we set up the watches is reported
+	 * by them or not at all; only promise to know about changes from
+	 * this point on.
+	 */
+	state.start_time = getnanotime();
+	if (fsm_listen__ctor(&state))
+		die(_("unable to watch '%s'"), get_git_work_tree());
+
+	printf("ok\n");
+	fclose(stdout);
+	if (!debug) {
+		if (!freopen("/dev/null", "w", stderr))
+			die_errno("unable to point stderr to /dev/null");
+	}
+
+	/* Do not die when a client hangs up before reading its answer. */
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	serve(&state);
+
+	stop_listening();
+	fsm_listen__dtor(&state);
+	hashmap_free(&state.changed_paths, 1);
+	return 0;
+}
+
+#else
+
+static int fsmonitor_run_daemon(int debug)
+{
+	die(_("fsmonitor--daemon is not supported on this platform"));
+}
+
+#endif
+
+static int is_daemon_running(void)
+{
+	struct strbuf answer = STRBUF_INIT;
+	int ret = !fsmonitor_ipc__send_command("status", &answer);
+
+	strbuf_release(&answer);
+	return ret;
+}
+
+int cmd_fsmonitor__daemon(int argc, const char **argv, const char *prefix)
+{
+	const char *subcmd;
+	int debug = 0;
+	struct option options[] = {
+		OPT_BOOL(0, "debug", &debug,
+			 N_("print debugging messages to stderr")),
+		OPT_END()
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_fsmonitor__daemon_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_fsmonitor__daemon_usage, options);
+	subcmd = argv[0];
+
+	if (!fsmonitor_ipc__is_supported())
+		die(_("fsmonitor--daemon is not supported on this platform"));
+
+	if (!strcmp(subcmd, "run")) {
+		if (is_daemon_running())
+			die(_("fsmonitor--daemon is already running in '%s'"),
+			    get_git_work_tree());
+		return fsmonitor_run_daemon(debug);
+	}
+
+	if (!strcmp(subcmd, "start")) {
+		if (is_daemon_running())
+			die(_("fsmonitor--daemon is already running in '%s'"),
+			    get_git_work_tree());
+		return !!fsmonitor_ipc__spawn_daemon();
+	}
+
+	if (!strcmp(subcmd, "stop")) {
+		struct strbuf answer = STRBUF_INIT;
+
+		if (fsmonitor_ipc__send_command("stop", &answer))
+			die(_("fsmonitor--daemon is not running"));
+		strbuf_release(&answer);
+		return 0;
+	}
+
+	if (!strcmp(subcmd, "status")) {
+		struct strbuf answer = STRBUF_INIT;
+
+		if (fsmonitor_ipc__send_command("status", &answer)) {
+			printf(_("fsmonitor--daemon is not watching '%s'\n"),
+			       get_git_work_tree());
+			return 1;
+		}
+		printf(_("fsmonitor--daemon is watching '%s'\n"), answer.buf);
+		strbuf_release(&answer);
+		return 0;
+	}
+
+	usage_with_options(builtin_fsmonitor__daemon_usage, options);
+}
@@ -26,6 +26,12 @@
 #include "pack-objects.h"
 #include "blob.h"
 #include "tree.h"
+#include "refs.h"
+#include "remote.h"
+#include "revision.h"
+#include "trace2.h"
+#include "exec-cmd.h"
+#include "split-index.h"
 
 #define FAILED_RUN "failed to run %s"
 
@@ -40,6 +46,8 @@ static int aggressive_depth = 50;
 static int aggressive_window = 250;
 static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
+static int gc_auto_geometric_factor;
+static int cruft_packs;
 static int detach_auto = 1;
 static timestamp_t gc_log_expire_time;
 static const char *gc_log_expire = "1.day.ago";
@@ -129,7 +137,9 @@ static void gc_config(void)
 	git_config_get_int("gc.aggressivedepth", &aggressive_depth);
 	git_config_get_int("gc.auto", &gc_auto_threshold);
 	git_config_get_int("gc.autopacklimit", &gc_auto_pack_limit);
+	git_config_get_int("gc.autogeometricfactor", &gc_auto_geometric_factor);
 	git_config_get_bool("gc.autodetach", &detach_auto);
+	git_config_get_bool("gc.cruftpacks", &cruft_packs);
 	git_config_get_expiry("gc.pruneexpire", &prune_expire);
 	git_config_get_expiry("gc.worktreepruneexpire", &prune_worktrees_expire);
 	git_config_get_expiry("gc.logexpiry", &gc_log_expire);
@@ -302,7 +312,11 @@ static void add_repack_all_option(struct string_list *keep_pack)
 {
 	if (prune_expire && !strcmp(prune_expire, "now"))
 		argv_array_push(&repack, "-a");
-	else {
+	else if (cruft_packs) {
+		argv_array_push(&repack, "--cruft");
+		if (prune_expire)
+			argv_array_pushf(&repack, "--cruft-expiration=%s", prune_expire);
+	} else {
 		argv_array_push(&repack, "-A");
 		if (prune_expire)
 			argv_array_pushf(&repack, "--unpack-unreachable=%s", prune_expire);
@@ -317,6 +331,12 @@ static void add_repack_incremental_option(void)
        argv_array_push(&repack, "--no-write-bitmap-index");
 }
 
+static void add_repack_geometric_option(void)
+{
+	argv_array_pushf(&repack, "--geometric=%d", gc_auto_geometric_factor);
+	argv_array_push(&repack, "--no-write-bitmap-index");
+}
+
 static int need_to_gc(void)
 {
 	/*
@@ -331,8 +351,15 @@ static int need_to_gc(void)
 	 * packs, we run "repack -d -l".  If there are too many packs,
 	 * we run "repack -A -d -l".  Otherwise we tell the caller
 	 * there is no need.
+	 *
+	 * With gc.autoGeometricFactor, we run "repack -d -l --geometric"
+	 * in both cases instead, which packs the loose objects together
+	 * with as few of the small packs as needed.
 	 */
-	if (too_many_packs()) {
+	if (gc_auto_geometric_factor > 1 &&
+	    (too_many_packs() || too_many_loose_objects()))
+		add_repack_geometric_option();
+	else if (too_many_packs()) {
 		struct string_list keep_pack = STRING_LIST_INIT_NODUP;
 
 		if (big_pack_threshold) {
@@ -509,6 +536,8 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 			   PARSE_OPT_NOCOMPLETE),
 		OPT_BOOL(0, "keep-largest-pack", &keep_base_pack,
 			 N_("repack all other packs except the largest pack")),
+		OPT_BOOL(0, "cruft", &cruft_packs,
+			 N_("pack unreachable objects into a cruft pack")),
 		OPT_END()
 	};
 
@@ -650,3 +679,1118 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 
 	return 0;
 }
+
+static const char * const builtin_maintenance_run_usage[] = {
+	N_("git maintenance run [--auto] [--[no-]quiet] [--task=<task>] [--schedule]"),
+	NULL
+};
+
+enum schedule_priority {
+	SCHEDULE_NONE = 0,
+	SCHEDULE_WEEKLY = 1,
+	SCHEDULE_DAILY = 2,
+	SCHEDULE_HOURLY = 3,
+};
+
+static enum schedule_priority parse_schedule(const char *value)
+{
+	if (!value)
+		return SCHEDULE_NONE;
+	if (!strcasecmp(value, "hourly"))
+		return SCHEDULE_HOURLY;
+	if (!strcasecmp(value, "daily"))
+		return SCHEDULE_DAILY;
+	if (!strcasecmp(value, "weekly"))
+		return SCHEDULE_WEEKLY;
+	return SCHEDULE_NONE;
+}
+
+static int maintenance_opt_schedule(const struct option *opt, const char *arg,
+				    int unset)
+{
+	enum schedule_priority *priority = opt->value;
+
+	if (unset)
+		die(_("--no-schedule is not allowed"));
+
+	*priority = parse_schedule(arg);
+
+	if (!*priority)
+		die(_("unrecognized --schedule argument '%s'"), arg);
+
+	return 0;
+}
+
+struct maintenance_run_opts {
+	int auto_flag;
+	int quiet;
+	enum schedule_priority schedule;
+};
+
+struct cg_auto_data {
+	int num_not_in_graph;
+	int limit;
+};
+
+static int dfs_on_ref(const char *refname,
+		      const struct object_id *oid, int flags,
+		      void *cb_data)
+{
+	struct cg_auto_data *data = (struct cg_auto_data *)cb_data;
+	int result = 0;
+	struct object_id peeled;
+	struct commit_list *stack = NULL;
+	struct commit *commit;
+
+	if (!peel_ref(refname, &peeled))
+		oid = &peeled;
+	if (oid_object_info(the_repository, oid, NULL) != OBJ_COMMIT)
+		return 0;
+
+	commit = lookup_commit(oid);
+	if (!commit || commit->object.flags & SEEN)
+		return 0;
+	commit->object.flags |= SEEN;
+	if (parse_commit(commit) || commit->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		return 0;
+
+	data->num_not_in_graph++;
+	if (data->num_not_in_graph >= data->limit)
+		return 1;
+
+	commit_list_append(commit, &stack);
+
+	while (!result && stack) {
+		struct commit_list *parent;
+
+		commit = pop_commit(&stack);
+
+		for (parent = commit->parents; parent; parent = parent->next) {
+			if (parent->item->object.flags & SEEN)
+				continue;
+			parent->item->object.flags |= SEEN;
+			if (parse_commit(parent->item) ||
+			    parent->item->graph_pos != COMMIT_NOT_FROM_GRAPH)
+				continue;
+
+			data->num_not_in_graph++;
+			if (data->num_not_in_graph >= data->limit) {
+				result = 1;
+				break;
+			}
+
+			commit_list_append(parent->item, &stack);
+		}
+	}
+
+	free_commit_list(stack);
+	return result;
+}
+
+static int should_write_commit_graph(void)
+{
+	int result;
+	struct cg_auto_data data;
+
+	data.num_not_in_graph = 0;
+	data.limit = 100;
+	git_config_get_int("maintenance.commit-graph.auto",
+			   &data.limit);
+
+	if (!data.limit)
+		return 0;
+	if (data.limit < 0)
+		return 1;
+
+	result = for_each_ref(dfs_on_ref, &data);
+
+	clear_commit_marks_all(SEEN);
+
+	return result;
+}
+
+static int write_ref_tip(const char *refname, const struct object_id *oid,
+			 int flags, void *cb_data)
+{
+	fprintf(cb_data, "%s\n", oid_to_hex(oid));
+	return 0;
+}
+
+static int maintenance_task_commit_graph(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+	FILE *in;
+
+	close_all_packs(the_repository->objects);
+
+	/* the same commits as "git rev-list --all" */
+	child.git_cmd = 1;
+	child.in = -1;
+	argv_array_pushl(&child.args, "commit-graph", "write",
+			 "--split", "--stdin-commits", NULL);
+
+	if (start_command(&child))
+		return error(_("failed to start 'git commit-graph' process"));
+	in = xfdopen(child.in, "w");
+	for_each_ref(write_ref_tip, in);
+	fclose(in);
+	if (finish_command(&child))
+		return error(_("failed to write commit-graph"));
+	return 0;
+}
+
+static int fetch_remote(const char *remote, struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "fetch", remote, "--prefetch", "--prune",
+			 "--no-tags", "--no-write-fetch-head",
+			 "--recurse-submodules=no", NULL);
+
+	if (opts->quiet)
+		argv_array_push(&child.args, "--quiet");
+
+	return !!run_command(&child);
+}
+
+static int append_remote(struct remote *remote, void *cbdata)
+{
+	struct string_list *remotes = (struct string_list *)cbdata;
+
+	/* the remotes left out of "git fetch --all" */
+	if (!remote->skip_default_update)
+		string_list_append(remotes, remote->name);
+	return 0;
+}
+
+static int maintenance_task_prefetch(struct maintenance_run_opts *opts)
+{
+	int result = 0;
+	struct string_list_item *item;
+	struct string_list remotes = STRING_LIST_INIT_DUP;
+
+	if (for_each_remote(append_remote, &remotes)) {
+		error(_("failed to fill remotes"));
+		result = 1;
+		goto cleanup;
+	}
+
+	for_each_string_list_item(item, &remotes)
+		result |= fetch_remote(item->string, opts);
+
+cleanup:
+	string_list_clear(&remotes, 0);
+	return result;
+}
+
+static int maintenance_task_gc(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_push(&child.args, "gc");
+
+	if (opts->auto_flag)
+		argv_array_push(&child.args, "--auto");
+	if (opts->quiet)
+		argv_array_push(&child.args, "--quiet");
+	else
+		argv_array_push(&child.args, "--no-quiet");
+
+	close_all_packs(the_repository->objects);
+	return run_command(&child);
+}
+
+static int prune_packed(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_push(&child.args, "prune-packed");
+
+	if (opts->quiet)
+		argv_array_push(&child.args, "--quiet");
+
+	return !!run_command(&child);
+}
+
+struct write_loose_object_data {
+	FILE *in;
+	int count;
+	int batch_size;
+};
+
+static int loose_object_auto_limit = 100;
+
+static int loose_object_count(const struct object_id *oid,
+			      const char *path,
+			      void *data)
+{
+	int *count = (int*)data;
+	if (++*count >= loose_object_auto_limit)
+		return 1;
+	return 0;
+}
+
+static int loose_object_auto_condition(void)
+{
+	int count = 0;
+
+	git_config_get_int("maintenance.loose-objects.auto",
+			   &loose_object_auto_limit);
+
+	if (!loose_object_auto_limit)
+		return 0;
+	if (loose_object_auto_limit < 0)
+		return 1;
+
+	return for_each_loose_file_in_objdir(get_object_directory(),
+					     loose_object_count,
+					     NULL, NULL, &count);
+}
+
+static int bail_on_loose(const struct object_id *oid,
+			 const char *path,
+			 void *data)
+{
+	return 1;
+}
+
+static int write_loose_object_to_stdin(const struct object_id *oid,
+				       const char *path,
+				       void *data)
+{
+	struct write_loose_object_data *d = (struct write_loose_object_data *)data;
+
+	fprintf(d->in, "%s\n", oid_to_hex(oid));
+
+	return ++(d->count) > d->batch_size;
+}
+
+/*
+ * Pack the loose objects, but do not delete them: the next run of the
+ * task does that with "git prune-packed", once no process can still be
+ * looking for them where they were.
+ */
+static int pack_loose(struct maintenance_run_opts *opts)
+{
+	int result = 0;
+	struct write_loose_object_data data;
+	struct child_process pack_proc = CHILD_PROCESS_INIT;
+
+	/*
+	 * Do not start pack-objects process
+	 * if there are no loose objects.
+	 */
+	if (!for_each_loose_file_in_objdir(get_object_directory(),
+					   bail_on_loose,
+					   NULL, NULL, NULL))
+		return 0;
+
+	pack_proc.git_cmd = 1;
+
+	argv_array_push(&pack_proc.args, "pack-objects");
+	if (opts->quiet)
+		argv_array_push(&pack_proc.args, "--quiet");
+	argv_array_pushf(&pack_proc.args, "%s/pack/loose", get_object_directory());
+
+	pack_proc.in = -1;
+	pack_proc.no_stdout = 1;
+
+	if (start_command(&pack_proc)) {
+		error(_("failed to start 'git pack-objects' process"));
+		return 1;
+	}
+
+	data.in = xfdopen(pack_proc.in, "w");
+	data.count = 0;
+	data.batch_size = 50000;
+
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      write_loose_object_to_stdin,
+				      NULL,
+				      NULL,
+				      &data);
+
+	fclose(data.in);
+
+	if (finish_command(&pack_proc)) {
+		error(_("failed to finish 'git pack-objects' process"));
+		result = 1;
+	}
+
+	return result;
+}
+
+static int maintenance_task_loose_objects(struct maintenance_run_opts *opts)
+{
+	return prune_packed(opts) || pack_loose(opts);
+}
+
+static int incremental_repack_auto_condition(void)
+{
+	struct packed_git *p;
+	int count = 0;
+	int incremental_repack_auto_limit = 10;
+
+	git_config_get_int("maintenance.incremental-repack.auto",
+			   &incremental_repack_auto_limit);
+
+	if (!incremental_repack_auto_limit)
+		return 0;
+	if (incremental_repack_auto_limit < 0)
+		return 1;
+
+	for (p = get_packed_git(the_repository);
+	     count < incremental_repack_auto_limit && p;
+	     p = p->next) {
+		if (p->pack_local && !p->pack_keep)
+			count++;
+	}
+
+	return count >= incremental_repack_auto_limit;
+}
+
+/*
+ * Roll up the smallest packs with "git repack --geometric" (see
+ * there), so that the work done is about proportional to what was
+ * added since the last run; then refresh the multi-pack-index, if the
+ * repository uses one, to cover the packs left.
+ */
+static int maintenance_task_incremental_repack(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+	int use_midx = 0;
+
+	close_all_packs(the_repository->objects);
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "repack", "--geometric=2", "-d", "-l",
+			 "--no-write-bitmap-index", NULL);
+	if (opts->quiet)
+		argv_array_push(&child.args, "-q");
+
+	if (run_command(&child))
+		return error(_("failed to run 'git repack'"));
+
+	git_config_get_bool("core.multipackindex", &use_midx);
+	if (use_midx) {
+		struct child_process midx = CHILD_PROCESS_INIT;
+
+		midx.git_cmd = 1;
+		argv_array_pushl(&midx.args, "multi-pack-index", "write", NULL);
+		if (run_command(&midx))
+			return error(_("failed to write multi-pack-index"));
+	}
+	return 0;
+}
+
+static int maintenance_task_pack_refs(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "pack-refs", "--all", "--prune", NULL);
+	return run_command(&child);
+}
+
+static int split_index_auto_condition(void)
+{
+	int ret;
+
+	if (is_bare_repository() || read_index(&the_index) < 0)
+		return 0;
+	ret = the_index.split_index &&
+	      too_many_not_shared_entries(&the_index);
+	discard_index(&the_index);
+	return ret;
+}
+
+static int maintenance_task_split_index(struct maintenance_run_opts *opts)
+{
+	struct lock_file lk = LOCK_INIT;
+
+	if (is_bare_repository())
+		return 0;
+	/* a foreground command is writing the index; try again next time */
+	if (hold_locked_index(&lk, 0) < 0)
+		return 0;
+	discard_index(&the_index);
+	if (read_index(&the_index) < 0 || !the_index.split_index) {
+		rollback_lock_file(&lk);
+		return 0;
+	}
+	the_index.cache_changed |= SPLIT_INDEX_ORDERED;
+	if (write_locked_index(&the_index, &lk, COMMIT_LOCK))
+		return error(_("unable to write new index file"));
+	return 0;
+}
+
+/*
+ * "git gc --auto" checks for itself whether there is anything to do,
+ * and runs in the background if it should.
+ */
+static int gc_auto_condition(void)
+{
+	return 1;
+}
+
+typedef int maintenance_task_fn(struct maintenance_run_opts *opts);
+
+/*
+ * An auto condition function returns 1 if the task should run
+ * and 0 if the task should NOT run.
+ */
+typedef int maintenance_auto_fn(void);
+
+struct maintenance_task {
+	const char *name;
+	maintenance_task_fn *fn;
+	maintenance_auto_fn *auto_condition;
+	unsigned enabled:1;
+
+	enum schedule_priority schedule;
+
+	/* -1 if not selected. */
+	int selected_order;
+};
+
+enum maintenance_task_label {
+	TASK_PREFETCH,
+	TASK_LOOSE_OBJECTS,
+	TASK_INCREMENTAL_REPACK,
+	TASK_GC,
+	TASK_COMMIT_GRAPH,
+	TASK_PACK_REFS,
+	TASK_SPLIT_INDEX,
+
+	/* Leave as final value */
+	TASK__COUNT
+};
+
+static struct maintenance_task tasks[] = {
+	[TASK_PREFETCH] = {
+		"prefetch",
+		maintenance_task_prefetch,
+	},
+	[TASK_LOOSE_OBJECTS] = {
+		"loose-objects",
+		maintenance_task_loose_objects,
+		loose_object_auto_condition,
+	},
+	[TASK_INCREMENTAL_REPACK] = {
+		"incremental-repack",
+		maintenance_task_incremental_repack,
+		incremental_repack_auto_condition,
+	},
+	[TASK_GC] = {
+		"gc",
+		maintenance_task_gc,
+		gc_auto_condition,
+		1,
+	},
+	[TASK_COMMIT_GRAPH] = {
+		"commit-graph",
+		maintenance_task_commit_graph,
+		should_write_commit_graph,
+	},
+	[TASK_PACK_REFS] = {
+		"pack-refs",
+		maintenance_task_pack_refs,
+	},
+	[TASK_SPLIT_INDEX] = {
+		"split-index",
+		maintenance_task_split_index,
+		split_index_auto_condition,
+	},
+};
+
+static int compare_tasks_by_selection(const void *a_, const void *b_)
+{
+	const struct maintenance_task *a = a_;
+	const struct maintenance_task *b = b_;
+
+	return a->selected_order - b->selected_order;
+}
+
+static int maintenance_run_tasks(struct maintenance_run_opts *opts)
+{
+	int i, found_selected = 0;
+	int result = 0;
+	struct lock_file lk;
+	struct repository *r = the_repository;
+	char *lock_path = xstrfmt("%s/maintenance", r->objects->objectdir);
+
+	if (hold_lock_file_for_update(&lk, lock_path, LOCK_NO_DEREF) < 0) {
+		/*
+		 * Another maintenance command is running.
+		 *
+		 * If --auto was provided, then it is likely due to a
+		 * recursive process stack. Do not report an error in
+		 * that case.
+		 */
+		if (!opts->auto_flag && !opts->quiet)
+			warning(_("lock file '%s' exists, skipping maintenance"),
+				lock_path);
+		free(lock_path);
+		return 0;
+	}
+	free(lock_path);
+
+	for (i = 0; !found_selected && i < TASK__COUNT; i++)
+		found_selected = tasks[i].selected_order >= 0;
+
+	if (found_selected)
+		QSORT(tasks, TASK__COUNT, compare_tasks_by_selection);
+
+	for (i = 0; i < TASK__COUNT; i++) {
+		if (found_selected && tasks[i].selected_order < 0)
+			continue;
+
+		if (!found_selected && !tasks[i].enabled)
+			continue;
+
+		if (opts->auto_flag &&
+		    (!tasks[i].auto_condition ||
+		     !tasks[i].auto_condition()))
+			continue;
+
+		if (opts->schedule && tasks[i].schedule < opts->schedule)
+			continue;
+
+		trace2_region_enter("maintenance", tasks[i].name);
+		if (tasks[i].fn(opts)) {
+			error(_("task '%s' failed"), tasks[i].name);
+			result = 1;
+		}
+		trace2_region_leave("maintenance", tasks[i].name);
+	}
+
+	rollback_lock_file(&lk);
+	return result;
+}
+
+static void initialize_maintenance_strategy(void)
+{
+	const char *config_str;
+
+	if (git_config_get_string_const("maintenance.strategy", &config_str))
+		return;
+
+	if (!strcasecmp(config_str, "incremental")) {
+		tasks[TASK_GC].schedule = SCHEDULE_NONE;
+		tasks[TASK_COMMIT_GRAPH].enabled = 1;
+		tasks[TASK_COMMIT_GRAPH].schedule = SCHEDULE_HOURLY;
+		tasks[TASK_PREFETCH].enabled = 1;
+		tasks[TASK_PREFETCH].schedule = SCHEDULE_HOURLY;
+		tasks[TASK_INCREMENTAL_REPACK].enabled = 1;
+		tasks[TASK_INCREMENTAL_REPACK].schedule = SCHEDULE_DAILY;
+		tasks[TASK_LOOSE_OBJECTS].enabled = 1;
+		tasks[TASK_LOOSE_OBJECTS].schedule = SCHEDULE_DAILY;
+		tasks[TASK_PACK_REFS].enabled = 1;
+		tasks[TASK_PACK_REFS].schedule = SCHEDULE_WEEKLY;
+		tasks[TASK_SPLIT_INDEX].enabled = 1;
+		tasks[TASK_SPLIT_INDEX].schedule = SCHEDULE_HOURLY;
+	}
+}
+
+static void initialize_task_config(int schedule)
+{
+	int i;
+	struct strbuf config_name = STRBUF_INIT;
+
+	if (schedule)
+		initialize_maintenance_strategy();
+
+	for (i = 0; i < TASK__COUNT; i++) {
+		int config_value;
+		const char *config_str;
+
+		strbuf_reset(&config_name);
+		strbuf_addf(&config_name, "maintenance.%s.enabled",
+			    tasks[i].name);
+
+		if (!git_config_get_bool(config_name.buf, &config_value))
+			tasks[i].enabled = config_value;
+
+		strbuf_reset(&config_name);
+		strbuf_addf(&config_name, "maintenance.%s.schedule",
+			    tasks[i].name);
+
+		if (!git_config_get_string_const(config_name.buf, &config_str))
+			tasks[i].schedule = parse_schedule(config_str);
+	}
+
+	strbuf_release(&config_name);
+}
+
+static int task_option_parse(const struct option *opt,
+			     const char *arg, int unset)
+{
+	int i, num_selected = 0;
+	struct maintenance_task *task = NULL;
+
+	for (i = 0; i < TASK__COUNT; i++) {
+		if (tasks[i].selected_order >= 0)
+			num_selected++;
+		if (!strcasecmp(tasks[i].name, arg)) {
+			task = &tasks[i];
+		}
+	}
+
+	if (!task) {
+		error(_("'%s' is not a valid task"), arg);
+		return 1;
+	}
+
+	if (task->selected_order >= 0) {
+		error(_("task '%s' cannot be selected multiple times"), arg);
+		return 1;
+	}
+
+	task->selected_order = num_selected + 1;
+
+	return 0;
+}
+
+static int maintenance_run(int argc, const char **argv, const char *prefix)
+{
+	int i;
+	struct maintenance_run_opts opts;
+	struct option builtin_maintenance_run_options[] = {
+		OPT_BOOL(0, "auto", &opts.auto_flag,
+			 N_("run tasks based on the state of the repository")),
+		OPT_CALLBACK(0, "schedule", &opts.schedule, N_("frequency"),
+			     N_("run tasks based on frequency"),
+			     maintenance_opt_schedule),
+		OPT_BOOL(0, "quiet", &opts.quiet,
+			 N_("do not report progress or other information over stderr")),
+		{ OPTION_CALLBACK, 0, "task", NULL, N_("task"),
+			N_("run a specific task"),
+			PARSE_OPT_NONEG, task_option_parse },
+		OPT_END()
+	};
+	memset(&opts, 0, sizeof(opts));
+
+	opts.quiet = !isatty(2);
+	git_config(git_default_config, NULL);
+
+	for (i = 0; i < TASK__COUNT; i++)
+		tasks[i].selected_order = -1;
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_maintenance_run_options,
+			     builtin_maintenance_run_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (opts.auto_flag && opts.schedule)
+		die(_("use at most one of --auto and --schedule=<frequency>"));
+
+	if (opts.auto_flag) {
+		int auto_maintenance;
+
+		if (!git_config_get_bool("maintenance.auto", &auto_maintenance) &&
+		    !auto_maintenance)
+			return 0;
+	}
+
+	initialize_task_config(opts.schedule);
+
+	if (argc != 0)
+		usage_with_options(builtin_maintenance_run_usage,
+				   builtin_maintenance_run_options);
+	return maintenance_run_tasks(&opts);
+}
+
+static char *get_maintpath(void)
+{
+	struct repository *r = the_repository;
+
+	return absolute_pathdup(r->worktree ? r->worktree : r->gitdir);
+}
+
+static int maintenance_register(void)
+{
+	char *maintpath = get_maintpath();
+	const char *config_value;
+	struct child_process config_set = CHILD_PROCESS_INIT;
+	struct child_process config_get = CHILD_PROCESS_INIT;
+	struct strbuf registered = STRBUF_INIT;
+	struct string_list repos = STRING_LIST_INIT_DUP;
+	int found = 0, rc = 0;
+
+	/* Disable foreground maintenance */
+	git_config_set("maintenance.auto", "false");
+
+	/* Set maintenance strategy, if unset */
+	if (git_config_get_string_const("maintenance.strategy", &config_value))
+		git_config_set("maintenance.strategy", "incremental");
+
+	config_get.git_cmd = 1;
+	argv_array_pushl(&config_get.args, "config", "--global", "--get-all",
+			 "maintenance.repo", NULL);
+	if (!capture_command(&config_get, &registered, 0)) {
+		struct string_list_item *item;
+
+		string_list_split(&repos, registered.buf, '\n', -1);
+		for_each_string_list_item(item, &repos)
+			if (!strcmp(item->string, maintpath))
+				found = 1;
+	}
+
+	if (!found) {
+		config_set.git_cmd = 1;
+		argv_array_pushl(&config_set.args, "config", "--add", "--global",
+				 "maintenance.repo", maintpath, NULL);
+		rc = run_command(&config_set);
+	}
+
+	string_list_clear(&repos, 0);
+	strbuf_release(&registered);
+	free(maintpath);
+	return rc;
+}
+
+static int maintenance_unregister(void)
+{
+	char *maintpath = get_maintpath();
+	struct child_process config_unset = CHILD_PROCESS_INIT;
+	struct strbuf pattern = STRBUF_INIT;
+	const char *p;
+	int rc;
+
+	/* "git config --unset" takes a regex of the value */
+	strbuf_addch(&pattern, '^');
+	for (p = maintpath; *p; p++) {
+		if (strchr("\\^$.|?*+()[]{}", *p))
+			strbuf_addch(&pattern, '\\');
+		strbuf_addch(&pattern, *p);
+	}
+	strbuf_addch(&pattern, '$');
+
+	config_unset.git_cmd = 1;
+	argv_array_pushl(&config_unset.args, "config", "--global", "--unset",
+			 "maintenance.repo", pattern.buf, NULL);
+
+	rc = run_command(&config_unset);
+	strbuf_release(&pattern);
+	free(maintpath);
+	return rc;
+}
+
+/*
+ * The schedulers run "git for-each-repo" over the registered
+ * repositories, with the git we are now.
+ */
+static void add_scheduled_command(struct strbuf *out, const char *frequency)
+{
+	const char *exec_path = git_exec_path();
+
+	strbuf_addf(out, "\"%s/git\" --exec-path=\"%s\" for-each-repo "
+		    "--config=maintenance.repo maintenance run --schedule=%s",
+		    exec_path, exec_path, frequency);
+}
+
+#define BEGIN_LINE "# BEGIN GIT MAINTENANCE SCHEDULE"
+#define END_LINE "# END GIT MAINTENANCE SCHEDULE"
+
+static const char *get_crontab_cmd(void)
+{
+	const char *cmd = getenv("GIT_TEST_CRONTAB");
+
+	return cmd ? cmd : "crontab";
+}
+
+/*
+ * Replace the region of the crontab between BEGIN_LINE and END_LINE
+ * with the schedule, or just drop it if "run_maintenance" is 0.
+ */
+static int crontab_update_schedule(int run_maintenance)
+{
+	const char *cmd = get_crontab_cmd();
+	struct child_process crontab_list = CHILD_PROCESS_INIT;
+	struct child_process crontab_edit = CHILD_PROCESS_INIT;
+	struct strbuf old_crontab = STRBUF_INIT;
+	struct strbuf new_crontab = STRBUF_INIT;
+	struct string_list lines = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct tempfile *tmpfile;
+	int in_old_region = 0, result = 0;
+
+	/* no crontab yet is the same as an empty one */
+	argv_array_pushl(&crontab_list.args, cmd, "-l", NULL);
+	if (capture_command(&crontab_list, &old_crontab, 0))
+		strbuf_reset(&old_crontab);
+
+	string_list_split(&lines, old_crontab.buf, '\n', -1);
+	for_each_string_list_item(item, &lines) {
+		if (!strcmp(item->string, BEGIN_LINE))
+			in_old_region = 1;
+		else if (!strcmp(item->string, END_LINE))
+			in_old_region = 0;
+		else if (!in_old_region)
+			strbuf_addf(&new_crontab, "%s\n", item->string);
+	}
+	/* drop the blank lines that set our region apart */
+	strbuf_rtrim(&new_crontab);
+	if (new_crontab.len)
+		strbuf_addch(&new_crontab, '\n');
+
+	if (run_maintenance) {
+		static const struct {
+			const char *when, *frequency;
+		} schedule[] = {
+			{ "0 1-23 * * *", "hourly" },
+			{ "0 0 * * 1-6", "daily" },
+			{ "0 0 * * 0", "weekly" },
+		};
+		int i;
+
+		if (new_crontab.len)
+			strbuf_addch(&new_crontab, '\n');
+		strbuf_addf(&new_crontab, "%s\n", BEGIN_LINE);
+		strbuf_addstr(&new_crontab,
+			      "# The following schedule was created by Git\n"
+			      "# Any edits made in this region might be\n"
+			      "# replaced in the future by a Git command.\n\n");
+		for (i = 0; i < ARRAY_SIZE(schedule); i++) {
+			strbuf_addf(&new_crontab, "%s ", schedule[i].when);
+			add_scheduled_command(&new_crontab, schedule[i].frequency);
+			strbuf_addch(&new_crontab, '\n');
+		}
+		strbuf_addf(&new_crontab, "\n%s\n", END_LINE);
+	}
+
+	tmpfile = mks_tempfile_t("git-maintenance-crontab-XXXXXX");
+	if (!tmpfile ||
+	    write_in_full(tmpfile->fd, new_crontab.buf, new_crontab.len) < 0 ||
+	    close_tempfile_gently(tmpfile)) {
+		result = error_errno(_("failed to create crontab temporary file"));
+		goto out;
+	}
+
+	argv_array_pushl(&crontab_edit.args, cmd, get_tempfile_path(tmpfile), NULL);
+	if (run_command(&crontab_edit))
+		result = error(_("'crontab' died"));
+
+out:
+	delete_tempfile(&tmpfile);
+	string_list_clear(&lines, 0);
+	strbuf_release(&old_crontab);
+	strbuf_release(&new_crontab);
+	return result;
+}
+
+static const char *get_systemctl_cmd(void)
+{
+	const char *cmd = getenv("GIT_TEST_SYSTEMCTL");
+
+	return cmd ? cmd : "systemctl";
+}
+
+static int systemctl(const char *action, int quiet)
+{
+	static const char *frequencies[] = { "hourly", "daily", "weekly" };
+	struct child_process child = CHILD_PROCESS_INIT;
+	int i;
+
+	argv_array_pushl(&child.args, get_systemctl_cmd(), "--user", action,
+			 NULL);
+	if (strcmp(action, "list-timers")) {
+		argv_array_push(&child.args, "--now");
+		for (i = 0; i < ARRAY_SIZE(frequencies); i++)
+			argv_array_pushf(&child.args, "git-maintenance@%s.timer",
+					 frequencies[i]);
+	}
+	child.no_stdin = 1;
+	child.no_stdout = quiet;
+	child.no_stderr = quiet;
+	return run_command(&child);
+}
+
+static int is_systemd_timer_available(void)
+{
+	return !systemctl("list-timers", 1);
+}
+
+static char *systemd_unit_path(const char *name)
+{
+	const char *config_home = getenv("XDG_CONFIG_HOME");
+
+	if (config_home && *config_home)
+		return xstrfmt("%s/systemd/user/%s", config_home, name);
+	return expand_user_path(xstrfmt("~/.config/systemd/user/%s", name), 0);
+}
+
+static int write_systemd_unit(const char *name, const char *contents)
+{
+	char *path = systemd_unit_path(name);
+	int result = 0;
+
+	if (!path)
+		return error(_("could not find the systemd user unit directory"));
+	if (safe_create_leading_directories(path))
+		result = error_errno(_("could not create leading directories of '%s'"), path);
+	else
+		write_file_buf(path, contents, strlen(contents));
+	free(path);
+	return result;
+}
+
+/*
+ * One timer per frequency, git-maintenance@hourly.timer and so on,
+ * out of the same template units.
+ */
+static int systemd_timer_update_schedule(int run_maintenance)
+{
+	static const char *units[] = {
+		"git-maintenance@.timer", "git-maintenance@.service"
+	};
+	struct strbuf service = STRBUF_INIT;
+	int i, result = 0;
+
+	if (!run_maintenance) {
+		systemctl("disable", 1);
+		for (i = 0; i < ARRAY_SIZE(units); i++) {
+			char *path = systemd_unit_path(units[i]);
+
+			if (path)
+				unlink_or_warn(path);
+			free(path);
+		}
+		return 0;
+	}
+
+	strbuf_addstr(&service,
+		      "[Unit]\n"
+		      "Description=Optimize Git repositories data\n"
+		      "\n"
+		      "[Service]\n"
+		      "Type=oneshot\n"
+		      "ExecStart=");
+	add_scheduled_command(&service, "%i");
+	strbuf_addstr(&service,
+		      "\n"
+		      "Nice=19\n");
+
+	if (write_systemd_unit("git-maintenance@.timer",
+			       "[Unit]\n"
+			       "Description=Optimize Git repositories data\n"
+			       "\n"
+			       "[Timer]\n"
+			       "OnCalendar=%i\n"
+			       "Persistent=true\n"
+			       "\n"
+			       "[Install]\n"
+			       "WantedBy=timers.target\n") ||
+	    write_systemd_unit("git-maintenance@.service", service.buf))
+		result = -1;
+	else if (systemctl("enable", 0))
+		result = error(_("failed to enable the maintenance timers"));
+
+	strbuf_release(&service);
+	return result;
+}
+
+enum scheduler {
+	SCHEDULER_INVALID = -1,
+	SCHEDULER_AUTO,
+	SCHEDULER_CRON,
+	SCHEDULER_SYSTEMD,
+};
+
+static enum scheduler parse_scheduler(const char *value)
+{
+	if (!value)
+		return SCHEDULER_INVALID;
+	if (!strcasecmp(value, "auto"))
+		return SCHEDULER_AUTO;
+	if (!strcasecmp(value, "cron") || !strcasecmp(value, "crontab"))
+		return SCHEDULER_CRON;
+	if (!strcasecmp(value, "systemd") || !strcasecmp(value, "systemd-timer"))
+		return SCHEDULER_SYSTEMD;
+	return SCHEDULER_INVALID;
+}
+
+static int maintenance_opt_scheduler(const struct option *opt, const char *arg,
+				     int unset)
+{
+	enum scheduler *scheduler = opt->value;
+
+	if (unset)
+		die(_("--no-scheduler is not allowed"));
+
+	*scheduler = parse_scheduler(arg);
+	if (*scheduler == SCHEDULER_INVALID)
+		die(_("unrecognized --scheduler argument '%s'"), arg);
+	return 0;
+}
+
+static const char * const builtin_maintenance_start_usage[] = {
+	N_("git maintenance start [--scheduler=<scheduler>]"),
+	NULL
+};
+
+static int maintenance_start(int argc, const char **argv, const char *prefix)
+{
+	enum scheduler scheduler = SCHEDULER_AUTO;
+	struct option options[] = {
+		{ OPTION_CALLBACK, 0, "scheduler", &scheduler, N_("scheduler"),
+			N_("scheduler to trigger git maintenance run"),
+			PARSE_OPT_NONEG, maintenance_opt_scheduler },
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_maintenance_start_usage, 0);
+	if (argc)
+		usage_with_options(builtin_maintenance_start_usage, options);
+
+	if (scheduler == SCHEDULER_AUTO)
+		scheduler = is_systemd_timer_available()
+			? SCHEDULER_SYSTEMD : SCHEDULER_CRON;
+
+	if (maintenance_register())
+		warning(_("failed to add repo to global config"));
+
+	/* only one scheduler should run the tasks */
+	if (scheduler == SCHEDULER_SYSTEMD) {
+		crontab_update_schedule(0);
+		return systemd_timer_update_schedule(1);
+	}
+	if (is_systemd_timer_available())
+		systemd_timer_update_schedule(0);
+	return crontab_update_schedule(1);
+}
+
+static int maintenance_stop(void)
+{
+	int result = crontab_update_schedule(0);
+
+	if (is_systemd_timer_available())
+		result |= systemd_timer_update_schedule(0);
+	return result;
+}
+
+static const char builtin_maintenance_usage[] =	N_("git maintenance <subcommand> [<options>]");
+
+int cmd_maintenance(int argc, const char **argv, const char *prefix)
+{
+	if (argc < 2 ||
+	    (argc == 2 && !strcmp(argv[1], "-h")))
+		usage(builtin_maintenance_usage);
+
+	if (!strcmp(argv[1], "run"))
+		return maintenance_run(argc - 1, argv + 1, prefix);
+	if (!strcmp(argv[1], "start"))
+		return maintenance_start(argc - 1, argv + 1, prefix);
+	if (!strcmp(argv[1], "stop"))
+		return maintenance_stop();
+	if (!strcmp(argv[1], "register"))
+		return maintenance_register();
+	if (!strcmp(argv[1], "unregister"))
+		return maintenance_unregister();
+
+	die(_("invalid subcommand: %s"), argv[1]);
+}
@@ -23,6 +23,8 @@
 #include "submodule.h"
 #include "submodule-config.h"
 #include "object-store.h"
+#include "trigram-index.h"
+#include "packfile.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -201,8 +203,9 @@ static void start_threads(struct grep_opt *opt)
 	int i;
 
 	pthread_mutex_init(&grep_mutex, NULL);
-	pthread_mutex_init(&grep_read_mutex, NULL);
+	enable_obj_read_lock();
 	pthread_mutex_init(&grep_attr_mutex, NULL);
+	pthread_mutex_init(&grep_trigram_mutex, NULL);
 	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
@@ -255,8 +258,9 @@ static int wait_all(void)
 	free(threads);
 
 	pthread_mutex_destroy(&grep_mutex);
-	pthread_mutex_destroy(&grep_read_mutex);
+	disable_obj_read_lock();
 	pthread_mutex_destroy(&grep_attr_mutex);
+	pthread_mutex_destroy(&grep_trigram_mutex);
 	pthread_cond_destroy(&cond_add);
 	pthread_cond_destroy(&cond_write);
 	pthread_cond_destroy(&cond_result);
@@ -302,16 +306,6 @@ static int grep_cmd_config(const char *var, const char *value, void *cb)
 	return st;
 }
 
-static void *lock_and_read_oid_file(const struct object_id *oid, enum object_type *type, unsigned long *size)
-{
-	void *data;
-
-	grep_read_lock();
-	data = read_object_file(oid, type, size);
-	grep_read_unlock();
-	return data;
-}
-
 static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 		     const char *filename, int tree_name_len,
 		     const char *path)
@@ -536,6 +530,43 @@ static int grep_cache(struct grep_opt *opt, struct repository *repo,
 	return hit;
 }
 
+/*
+ * Read ahead the blobs of "tree" that grep_tree() is about to grep, so
+ * that the later ones are read from disk while the earlier ones are
+ * grepped. "name" is grep_tree()'s, holding the submodule prefix.
+ */
+static void readahead_tree_blobs(const struct pathspec *pathspec,
+				 struct tree_desc *tree, struct strbuf *base,
+				 int tn_len, struct strbuf *name)
+{
+	struct oid_array blobs = OID_ARRAY_INIT;
+	enum interesting match = entry_not_interesting;
+	struct tree_desc desc = *tree;
+	struct name_entry entry;
+	size_t name_base_len = name->len;
+
+	while (tree_entry(&desc, &entry)) {
+		if (!S_ISREG(entry.mode))
+			continue;
+		if (match != all_entries_interesting) {
+			strbuf_addstr(name, base->buf + tn_len);
+			match = tree_entry_interesting(&entry, name,
+						       0, pathspec);
+			strbuf_setlen(name, name_base_len);
+
+			if (match == all_entries_not_interesting)
+				break;
+			if (match == entry_not_interesting)
+				continue;
+		}
+		oid_array_append(&blobs, entry.oid);
+	}
+	grep_read_lock();
+	readahead_packed_objects(the_repository, &blobs);
+	grep_read_unlock();
+	oid_array_clear(&blobs);
+}
+
 static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 		     struct tree_desc *tree, struct strbuf *base, int tn_len,
 		     int check_attr, struct repository *repo)
@@ -551,6 +582,7 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 		name_base_len = name.len;
 	}
 
+	readahead_tree_blobs(pathspec, tree, base, tn_len, &name);
 	while (tree_entry(tree, &entry)) {
 		int te_len = tree_entry_len(&entry);
 
@@ -577,7 +609,7 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 			void *data;
 			unsigned long size;
 
-			data = lock_and_read_oid_file(entry.oid, &type, &size);
+			data = read_object_file(entry.oid, &type, &size);
 			if (!data)
 				die(_("unable to read tree (%s)"),
 				    oid_to_hex(entry.oid));
@@ -1043,6 +1075,14 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	num_threads = 0;
 #endif
 
+	/*
+	 * The trigram index can only tell that a blob has no matching
+	 * line, which says nothing about what -v or -L show.
+	 */
+	if (use_index && !opt.invert && !opt.unmatch_name_only &&
+	    trigram_index_enabled())
+		opt.use_trigram_index = 1;
+
 	if (!num_threads)
 		/*
 		 * The compiled patterns on the main path are only
@@ -1113,6 +1153,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 
 	if (num_threads)
 		hit |= wait_all();
+	if (opt.use_trigram_index)
+		trigram_index_flush();
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
 	clear_pathspec(&pathspec);
@@ -14,9 +14,12 @@
 #include "thread-utils.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "dir.h"
+#include "trace2.h"
+#include "sha1-array.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--report-links] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -39,11 +42,21 @@ struct base_data {
 	unsigned long size;
 	int ref_first, ref_last;
 	int ofs_first, ofs_last;
+	/*
+	 * The (delta) object was resolved by another thread, which handed
+	 * its descendants over to us: without its base we cannot compute
+	 * its data again, so it is not pruned from the base cache.
+	 */
+	unsigned handed_over:1;
 };
 
 struct thread_local {
 #ifndef NO_PTHREADS
 	pthread_t thread;
+	/* statistics, for GIT_TRACE_PERFORMANCE */
+	uint64_t busy_ns;
+	int nr_deltas;
+	int nr_handed_over;
 #endif
 	struct base_data *base_cache;
 	size_t base_cache_used;
@@ -64,6 +77,36 @@ struct ref_delta_entry {
 	int obj_no;
 };
 
+/*
+ * Non-delta objects up to HASH_BATCH_MAX_SIZE bytes are not hashed while
+ * they are inflated, but kept until HASH_BATCH_NR of them can be hashed
+ * together with the_hash_algo->many_fn().
+ */
+#define HASH_BATCH_NR 32
+#define HASH_BATCH_MAX_SIZE 16384
+
+struct hash_batch_entry {
+	struct object_entry *obj;
+	void *data;
+	char hdr[32];
+};
+
+struct hash_batch {
+	struct hash_batch_entry entry[HASH_BATCH_NR];
+	int nr;
+};
+
+/* What the first pass finds in a run of consecutive objects */
+struct parse_result {
+	struct ofs_delta_entry *ofs_deltas;
+	int nr_ofs_deltas, ofs_deltas_alloc;
+	struct ref_delta_entry *ref_deltas;
+	int nr_ref_deltas, ref_deltas_alloc;
+	/* large blobs, to be checked once the pass is over */
+	int nr_delays;
+	struct hash_batch hash_batch;
+};
+
 static struct object_entry *objects;
 static struct object_stat *obj_stat;
 static struct ofs_delta_entry *ofs_deltas;
@@ -74,6 +117,7 @@ static int nr_ofs_deltas;
 static int nr_ref_deltas;
 static int ref_deltas_alloc;
 static int nr_resolved_deltas;
+static int nr_parsed_objects;
 static int nr_threads;
 
 static int from_stdin;
@@ -84,17 +128,32 @@ static int verbose;
 static int show_resolving_progress;
 static int show_stat;
 static int check_self_contained_and_connected;
+static int report_links;
+static struct oid_array links = OID_ARRAY_INIT;
 
 static struct progress *progress;
 
-/* We always read in 4kB chunks. */
-static unsigned char input_buffer[4096];
-static unsigned int input_offset, input_len;
-static off_t consumed_bytes;
+/*
+ * The pack is read through an input_stream: "buffer" holds "len" bytes
+ * from "offset" on, the first of which is at "consumed" in the pack.
+ * The main stream reads the whole pack from input_fd, hashing it and
+ * copying it to output_fd as it goes; a stream with a "range_end" reads
+ * a part of the pack from "range_fd", without doing either.
+ */
+struct input_stream {
+	/* We always read in 4kB chunks. */
+	unsigned char buffer[4096];
+	unsigned int offset, len;
+	off_t consumed;
+	uint32_t crc32;
+	int range_fd;
+	off_t range_end;
+};
+
+static struct input_stream input;
 static off_t max_input_size;
 static unsigned deepest_delta;
 static git_hash_ctx input_ctx;
-static uint32_t input_crc32;
 static int input_fd, output_fd;
 static const char *curr_pack;
 
@@ -104,6 +163,17 @@ static struct thread_local *thread_data;
 static int nr_dispatched;
 static int threads_active;
 
+/*
+ * Delta subtrees that a thread handed over to the threads waiting for
+ * work, and the number of those threads. Both are protected by
+ * work_mutex.
+ */
+static struct base_data **handed_over;
+static int nr_handed_over, handed_over_alloc;
+static int nr_waiting;
+static int no_more_work;
+static pthread_cond_t work_cond;
+
 static pthread_mutex_t read_mutex;
 #define read_lock()		lock_mutex(&read_mutex)
 #define read_unlock()		unlock_mutex(&read_mutex)
@@ -147,6 +217,7 @@ static void init_thread(void)
 	init_recursive_mutex(&read_mutex);
 	pthread_mutex_init(&counter_mutex, NULL);
 	pthread_mutex_init(&work_mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
 	pthread_mutex_init(&type_cas_mutex, NULL);
 	if (show_stat)
 		pthread_mutex_init(&deepest_delta_mutex, NULL);
@@ -170,6 +241,7 @@ static void cleanup_thread(void)
 	pthread_mutex_destroy(&read_mutex);
 	pthread_mutex_destroy(&counter_mutex);
 	pthread_mutex_destroy(&work_mutex);
+	pthread_cond_destroy(&work_cond);
 	pthread_mutex_destroy(&type_cas_mutex);
 	if (show_stat)
 		pthread_mutex_destroy(&deepest_delta_mutex);
@@ -248,61 +320,93 @@ static unsigned check_objects(void)
 	return foreign_nr;
 }
 
+/* Collect the objects that the pack points to, but does not have */
+static void collect_links(void)
+{
+	unsigned i, max;
+
+	max = get_max_object_index();
+	for (i = 0; i < max; i++) {
+		struct object *obj = get_indexed_object(i);
+
+		if (obj && (obj->flags & FLAG_LINK) &&
+		    !(obj->flags & FLAG_CHECKED))
+			oid_array_append(&links, &obj->oid);
+	}
+}
+
 
 /* Discard current buffer used content. */
-static void flush(void)
-{
-	if (input_offset) {
-		if (output_fd >= 0)
-			write_or_die(output_fd, input_buffer, input_offset);
-		the_hash_algo->update_fn(&input_ctx, input_buffer, input_offset);
-		memmove(input_buffer, input_buffer + input_offset, input_len);
-		input_offset = 0;
+static void flush(struct input_stream *in)
+{
+	if (in->offset) {
+		if (!in->range_end) {
+			if (output_fd >= 0)
+				write_or_die(output_fd, in->buffer, in->offset);
+			the_hash_algo->update_fn(&input_ctx, in->buffer, in->offset);
+		}
+		memmove(in->buffer, in->buffer + in->offset, in->len);
+		in->offset = 0;
 	}
 }
 
+static ssize_t read_input(struct input_stream *in)
+{
+	size_t room = sizeof(in->buffer) - in->len;
+	off_t pos;
+
+	if (!in->range_end)
+		return xread(input_fd, in->buffer + in->len, room);
+
+	pos = in->consumed + in->len;
+	if (in->range_end - pos < room)
+		room = in->range_end - pos;
+	if (!room)
+		return 0;
+	return xpread(in->range_fd, in->buffer + in->len, room, pos);
+}
+
 /*
  * Make sure at least "min" bytes are available in the buffer, and
  * return the pointer to the buffer.
  */
-static void *fill(int min)
+static void *fill(struct input_stream *in, int min)
 {
-	if (min <= input_len)
-		return input_buffer + input_offset;
-	if (min > sizeof(input_buffer))
+	if (min <= in->len)
+		return in->buffer + in->offset;
+	if (min > sizeof(in->buffer))
 		die(Q_("cannot fill %d byte",
 		       "cannot fill %d bytes",
 		       min),
 		    min);
-	flush();
+	flush(in);
 	do {
-		ssize_t ret = xread(input_fd, input_buffer + input_len,
-				sizeof(input_buffer) - input_len);
+		ssize_t ret = read_input(in);
 		if (ret <= 0) {
 			if (!ret)
 				die(_("early EOF"));
 			die_errno(_("read error on input"));
 		}
-		input_len += ret;
+		in->len += ret;
 		if (from_stdin)
-			display_throughput(progress, consumed_bytes + input_len);
-	} while (input_len < min);
-	return input_buffer;
+			display_throughput(progress, in->consumed + in->len);
+	} while (in->len < min);
+	return in->buffer;
 }
 
-static void use(int bytes)
+static void use(struct input_stream *in, int bytes)
 {
-	if (bytes > input_len)
+	if (bytes > in->len)
 		die(_("used more bytes than were available"));
-	input_crc32 = crc32(input_crc32, input_buffer + input_offset, bytes);
-	input_len -= bytes;
-	input_offset += bytes;
+	in->crc32 = crc32(in->crc32, in->buffer + in->offset, bytes);
+	in->len -= bytes;
+	in->offset += bytes;
 
 	/* make sure off_t is sufficiently large not to wrap */
-	if (signed_add_overflows(consumed_bytes, bytes))
+	if (signed_add_overflows(in->consumed, bytes))
 		die(_("pack too large for current definition of off_t"));
-	consumed_bytes += bytes;
-	if (max_input_size && consumed_bytes > max_input_size)
+	in->consumed += bytes;
+	if (max_input_size && in->consumed > max_input_size)
 		die(_("pack exceeds maximum allowed size"));
 }
 
@@ -334,7 +438,7 @@ static const char *open_pack_file(const char *pack_name)
 
 static void parse_pack_header(void)
 {
-	struct pack_header *hdr = fill(sizeof(struct pack_header));
+	struct pack_header *hdr = fill(&input, sizeof(struct pack_header));
 
 	/* Header consistency check */
 	if (hdr->hdr_signature != htonl(PACK_SIGNATURE))
@@ -344,7 +448,7 @@ static void parse_pack_header(void)
 			ntohl(hdr->hdr_version));
 
 	nr_objects = ntohl(hdr->hdr_entries);
-	use(sizeof(struct pack_header));
+	use(&input, sizeof(struct pack_header));
 }
 
 static NORETURN void bad_object(off_t offset, const char *format,
@@ -404,7 +508,7 @@ static void prune_base_data(struct base_data *retain)
 	for (b = data->base_cache;
 	     data->base_cache_used > delta_base_cache_limit && b;
 	     b = b->child) {
-		if (b->data && b != retain)
+		if (b->data && b != retain && !b->handed_over)
 			free_base_data(b);
 	}
 }
@@ -438,10 +542,13 @@ static int is_delta_type(enum object_type type)
 	return (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA);
 }
 
-static void *unpack_entry_data(off_t offset, unsigned long size,
+static void *unpack_entry_data(struct input_stream *in,
+			       off_t offset, unsigned long size,
 			       enum object_type type, struct object_id *oid)
 {
-	static char fixed_buf[8192];
+	/* large blobs are inflated bit by bit, only to be hashed */
+	const size_t chunk_size = 8192;
+	int streaming = type == OBJ_BLOB && size > big_file_threshold;
 	int status;
 	git_zstream stream;
 	void *buf;
@@ -449,33 +556,34 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
+	if (is_delta_type(type))
+		oid = NULL;
+	if (oid) {
 		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %lu", type_name(type), size) + 1;
 		the_hash_algo->init_fn(&c);
 		the_hash_algo->update_fn(&c, hdr, hdrlen);
-	} else
-		oid = NULL;
-	if (type == OBJ_BLOB && size > big_file_threshold)
-		buf = fixed_buf;
+	}
+	if (streaming)
+		buf = xmalloc(chunk_size);
 	else
 		buf = xmallocz(size);
 
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
-	stream.avail_out = buf == fixed_buf ? sizeof(fixed_buf) : size;
+	stream.avail_out = streaming ? chunk_size : size;
 
 	do {
 		unsigned char *last_out = stream.next_out;
-		stream.next_in = fill(1);
-		stream.avail_in = input_len;
+		stream.next_in = fill(in, 1);
+		stream.avail_in = in->len;
 		status = git_inflate(&stream, 0);
-		use(input_len - stream.avail_in);
+		use(in, in->len - stream.avail_in);
 		if (oid)
 			the_hash_algo->update_fn(&c, last_out, stream.next_out - last_out);
-		if (buf == fixed_buf) {
+		if (streaming) {
 			stream.next_out = buf;
-			stream.avail_out = sizeof(fixed_buf);
+			stream.avail_out = chunk_size;
 		}
 	} while (status == Z_OK);
 	if (stream.total_out != size || status != Z_STREAM_END)
@@ -483,10 +591,20 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	git_inflate_end(&stream);
 	if (oid)
 		the_hash_algo->final_fn(oid->hash, &c);
-	return buf == fixed_buf ? NULL : buf;
+	if (streaming)
+		FREE_AND_NULL(buf);
+	return buf;
+}
+
+static int hash_in_batch(struct object_entry *obj)
+{
+	if (obj->type == OBJ_BLOB && obj->size > big_file_threshold)
+		return 0; /* streamed, so there is no buffer to hash later */
+	return !is_delta_type(obj->type) && obj->size <= HASH_BATCH_MAX_SIZE;
 }
 
-static void *unpack_raw_entry(struct object_entry *obj,
+static void *unpack_raw_entry(struct input_stream *in,
+			      struct object_entry *obj,
 			      off_t *ofs_offset,
 			      struct object_id *ref_oid,
 			      struct object_id *oid)
@@ -497,19 +615,19 @@ static void *unpack_raw_entry(struct object_entry *obj,
 	unsigned shift;
 	void *data;
 
-	obj->idx.offset = consumed_bytes;
-	input_crc32 = crc32(0, NULL, 0);
+	obj->idx.offset = in->consumed;
+	in->crc32 = crc32(0, NULL, 0);
 
-	p = fill(1);
+	p = fill(in, 1);
 	c = *p;
-	use(1);
+	use(in, 1);
 	obj->type = (c >> 4) & 7;
 	size = (c & 15);
 	shift = 4;
 	while (c & 0x80) {
-		p = fill(1);
+		p = fill(in, 1);
 		c = *p;
-		use(1);
+		use(in, 1);
 		size += (c & 0x7f) << shift;
 		shift += 7;
 	}
@@ -517,21 +635,21 @@ static void *unpack_raw_entry(struct object_entry *obj,
 
 	switch (obj->type) {
 	case OBJ_REF_DELTA:
-		hashcpy(ref_oid->hash, fill(the_hash_algo->rawsz));
-		use(the_hash_algo->rawsz);
+		hashcpy(ref_oid->hash, fill(in, the_hash_algo->rawsz));
+		use(in, the_hash_algo->rawsz);
 		break;
 	case OBJ_OFS_DELTA:
-		p = fill(1);
+		p = fill(in, 1);
 		c = *p;
-		use(1);
+		use(in, 1);
 		base_offset = c & 127;
 		while (c & 128) {
 			base_offset += 1;
 			if (!base_offset || MSB(base_offset, 7))
 				bad_object(obj->idx.offset, _("offset value overflow for delta base object"));
-			p = fill(1);
+			p = fill(in, 1);
 			c = *p;
-			use(1);
+			use(in, 1);
 			base_offset = (base_offset << 7) + (c & 127);
 		}
 		*ofs_offset = obj->idx.offset - base_offset;
@@ -546,10 +664,11 @@ static void *unpack_raw_entry(struct object_entry *obj,
 	default:
 		bad_object(obj->idx.offset, _("unknown object type %d"), obj->type);
 	}
-	obj->hdr_size = consumed_bytes - obj->idx.offset;
+	obj->hdr_size = in->consumed - obj->idx.offset;
 
-	data = unpack_entry_data(obj->idx.offset, obj->size, obj->type, oid);
-	obj->idx.crc32 = input_crc32;
+	data = unpack_entry_data(in, obj->idx.offset, obj->size, obj->type,
+				 hash_in_batch(obj) ? NULL : oid);
+	obj->idx.crc32 = in->crc32;
 	return data;
 }
 
@@ -829,7 +948,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 		free(has_data);
 	}
 
-	if (strict || do_fsck_object) {
+	if (strict || do_fsck_object || report_links) {
 		read_lock();
 		if (type == OBJ_BLOB) {
 			struct blob *blob = lookup_blob(oid);
@@ -858,7 +977,8 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 			if (do_fsck_object &&
 			    fsck_object(obj, buf, size, &fsck_options))
 				die(_("fsck error in packed object"));
-			if (strict && fsck_walk(obj, NULL, &fsck_options))
+			if ((strict || report_links) &&
+			    fsck_walk(obj, NULL, &fsck_options))
 				die(_("Not all child objects of %s are reachable"), oid_to_hex(&obj->oid));
 
 			if (obj->type == OBJ_TREE) {
@@ -970,6 +1090,10 @@ static void resolve_delta(struct object_entry *delta_obj,
 	counter_lock();
 	nr_resolved_deltas++;
 	counter_unlock();
+	progress_add(progress, 1);
+#ifndef NO_PTHREADS
+	get_thread_data()->nr_deltas++;
+#endif
 }
 
 /*
@@ -1046,12 +1170,60 @@ static struct base_data *find_unresolved_deltas_1(struct base_data *base,
 	return NULL;
 }
 
+#ifndef NO_PTHREADS
+static int has_delta_children(struct base_data *base)
+{
+	int first, last;
+
+	find_ref_delta_children(&base->obj->idx.oid, &first, &last,
+				OBJ_REF_DELTA);
+	if (first <= last)
+		return 1;
+	find_ofs_delta_children(base->obj->idx.offset, &first, &last,
+				OBJ_OFS_DELTA);
+	return first <= last;
+}
+
+/*
+ * When other threads ran out of base objects to start from, give them
+ * the deltas based on "base", a delta that was just resolved, instead
+ * of resolving them ourselves. This keeps all threads busy until the
+ * end even when a few bases have most deltas depending on them.
+ */
+static int hand_over_delta_children(struct base_data *base)
+{
+	int ret = 0;
+
+	/* racy, but handing over a little late is fine */
+	if (!threads_active || !nr_waiting || !has_delta_children(base))
+		return 0;
+
+	work_lock();
+	if (nr_waiting > nr_handed_over) {
+		base->handed_over = 1;
+		ALLOC_GROW(handed_over, nr_handed_over + 1, handed_over_alloc);
+		handed_over[nr_handed_over++] = base;
+		pthread_cond_signal(&work_cond);
+		ret = 1;
+	}
+	work_unlock();
+	if (ret)
+		get_thread_data()->nr_handed_over++;
+	return ret;
+}
+#else
+#define hand_over_delta_children(base) 0
+#endif
+
 static void find_unresolved_deltas(struct base_data *base)
 {
 	struct base_data *new_base, *prev_base = NULL;
 	for (;;) {
 		new_base = find_unresolved_deltas_1(base, prev_base);
 
+		if (new_base && hand_over_delta_children(new_base))
+			continue;
+
 		if (new_base) {
 			prev_base = base;
 			base = new_base;
@@ -1092,27 +1264,61 @@ static void resolve_base(struct object_entry *obj)
 }
 
 #ifndef NO_PTHREADS
-static void *threaded_second_pass(void *data)
+/*
+ * Return the next subtree of deltas to resolve, starting from a base
+ * object, or from the resolved delta that another thread handed over;
+ * or NULL when all threads are out of work.
+ */
+static struct base_data *get_work(void)
 {
-	set_thread_data(data);
-	for (;;) {
-		int i;
-		counter_lock();
-		display_progress(progress, nr_resolved_deltas);
-		counter_unlock();
-		work_lock();
+	struct base_data *base = NULL;
+
+	work_lock();
+	while (!no_more_work) {
 		while (nr_dispatched < nr_objects &&
 		       is_delta_type(objects[nr_dispatched].type))
 			nr_dispatched++;
-		if (nr_dispatched >= nr_objects) {
-			work_unlock();
+		if (nr_dispatched < nr_objects) {
+			base = alloc_base_data();
+			base->obj = &objects[nr_dispatched++];
 			break;
 		}
-		i = nr_dispatched++;
-		work_unlock();
+		if (nr_handed_over) {
+			base = handed_over[--nr_handed_over];
+			break;
+		}
+		if (nr_waiting == nr_threads - 1) {
+			/* nobody is left to hand anything over */
+			no_more_work = 1;
+			pthread_cond_broadcast(&work_cond);
+			break;
+		}
+		nr_waiting++;
+		pthread_cond_wait(&work_cond, &work_mutex);
+		nr_waiting--;
+	}
+	work_unlock();
+	return base;
+}
+
+static void *threaded_second_pass(void *_data)
+{
+	struct thread_local *data = _data;
+	struct base_data *base;
 
-		resolve_base(&objects[i]);
+	trace2_thread_start("second_pass");
+	set_thread_data(data);
+	for (;;) {
+		uint64_t start;
+
+		base = get_work();
+		if (!base)
+			break;
+		start = getnanotime();
+		find_unresolved_deltas(base);
+		data->busy_ns += getnanotime() - start;
 	}
+	trace2_thread_exit();
 	return NULL;
 }
 #endif
@@ -1123,57 +1329,245 @@ static void *threaded_second_pass(void *data)
  * - calculate SHA1 of all non-delta objects;
  * - remember base (SHA1 or offset) for all deltas.
  */
-static void parse_pack_objects(unsigned char *hash)
+static void flush_hash_batch(struct hash_batch *batch)
 {
-	int i, nr_delays = 0;
-	struct ofs_delta_entry *ofs_delta = ofs_deltas;
-	struct object_id ref_delta_oid;
-	struct stat st;
+	struct git_hash_msg msgs[HASH_BATCH_NR];
+	int i;
 
-	if (verbose)
-		progress = start_progress(
-				from_stdin ? _("Receiving objects") : _("Indexing objects"),
-				nr_objects);
-	for (i = 0; i < nr_objects; i++) {
+	for (i = 0; i < batch->nr; i++) {
+		struct hash_batch_entry *e = &batch->entry[i];
+
+		msgs[i].hdr = e->hdr;
+		msgs[i].hdrlen = xsnprintf(e->hdr, sizeof(e->hdr), "%s %lu",
+					   type_name(e->obj->type),
+					   e->obj->size) + 1;
+		msgs[i].buf = e->data;
+		msgs[i].len = e->obj->size;
+		msgs[i].hash = e->obj->idx.oid.hash;
+	}
+	the_hash_algo->many_fn(msgs, batch->nr);
+
+	for (i = 0; i < batch->nr; i++) {
+		struct hash_batch_entry *e = &batch->entry[i];
+
+		sha1_object(e->data, NULL, e->obj->size, e->obj->type,
+			    &e->obj->idx.oid);
+		free(e->data);
+	}
+	batch->nr = 0;
+}
+
+/* Parse the "nr" objects from "first" on, which start where "in" is. */
+static void parse_objects(struct input_stream *in, int first, int nr,
+			  struct parse_result *res)
+{
+	int i;
+
+	for (i = first; i < first + nr; i++) {
 		struct object_entry *obj = &objects[i];
-		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
+		struct hash_batch *batch = &res->hash_batch;
+		struct object_id ref_delta_oid;
+		off_t ofs_offset = 0;
+		void *data = unpack_raw_entry(in, obj, &ofs_offset,
 					      &ref_delta_oid,
 					      &obj->idx.oid);
 		obj->real_type = obj->type;
 		if (obj->type == OBJ_OFS_DELTA) {
-			nr_ofs_deltas++;
-			ofs_delta->obj_no = i;
-			ofs_delta++;
+			ALLOC_GROW(res->ofs_deltas, res->nr_ofs_deltas + 1,
+				   res->ofs_deltas_alloc);
+			res->ofs_deltas[res->nr_ofs_deltas].offset = ofs_offset;
+			res->ofs_deltas[res->nr_ofs_deltas].obj_no = i;
+			res->nr_ofs_deltas++;
 		} else if (obj->type == OBJ_REF_DELTA) {
-			ALLOC_GROW(ref_deltas, nr_ref_deltas + 1, ref_deltas_alloc);
-			oidcpy(&ref_deltas[nr_ref_deltas].oid, &ref_delta_oid);
-			ref_deltas[nr_ref_deltas].obj_no = i;
-			nr_ref_deltas++;
+			ALLOC_GROW(res->ref_deltas, res->nr_ref_deltas + 1,
+				   res->ref_deltas_alloc);
+			oidcpy(&res->ref_deltas[res->nr_ref_deltas].oid,
+			       &ref_delta_oid);
+			res->ref_deltas[res->nr_ref_deltas].obj_no = i;
+			res->nr_ref_deltas++;
 		} else if (!data) {
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
-			nr_delays++;
+			res->nr_delays++;
+		} else if (hash_in_batch(obj)) {
+			batch->entry[batch->nr].obj = obj;
+			batch->entry[batch->nr].data = data;
+			data = NULL;
+			if (++batch->nr == HASH_BATCH_NR)
+				flush_hash_batch(batch);
 		} else
 			sha1_object(data, NULL, obj->size, obj->type,
 				    &obj->idx.oid);
 		free(data);
-		display_progress(progress, i+1);
+
+		counter_lock();
+		nr_parsed_objects++;
+		counter_unlock();
+		if (in == &input)
+			display_progress(progress, nr_parsed_objects);
+	}
+	flush_hash_batch(&res->hash_batch);
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * When verifying a pack, its .idx tells where the objects are, so they
+ * can be parsed in ranges, by several threads, each reading the pack
+ * with its own file descriptor and inflating on its own.  The main
+ * thread meanwhile reads the whole pack through "input", for its hash.
+ */
+struct verify_range {
+	off_t start, end;
+	int first, nr;
+	struct parse_result res;
+};
+
+static struct verify_range *verify_ranges;
+static int nr_verify_ranges;
+/* the next range to parse, protected by work_mutex */
+static int next_verify_range;
+
+static void *threaded_first_pass(void *data)
+{
+	struct thread_local *thread = data;
+	struct input_stream *in = xmalloc(sizeof(*in));
+
+	set_thread_data(thread);
+	for (;;) {
+		struct verify_range *r;
+
+		work_lock();
+		if (next_verify_range == nr_verify_ranges) {
+			work_unlock();
+			break;
+		}
+		r = &verify_ranges[next_verify_range++];
+		work_unlock();
+
+		in->offset = in->len = 0;
+		in->consumed = r->start;
+		in->range_fd = thread->pack_fd;
+		in->range_end = r->end;
+		parse_objects(in, r->first, r->nr, &r->res);
+		/* where the last range ends is up to the pack */
+		if (r != &verify_ranges[nr_verify_ranges - 1] &&
+		    in->consumed != r->end)
+			die(_("the index of %s does not match the pack at offset %"PRIuMAX),
+			    curr_pack, (uintmax_t)r->end);
+		r->end = in->consumed;
+	}
+	free(in);
+	return NULL;
+}
+
+/* Let the main stream go over the pack up to "end", hashing it. */
+static void hash_input_until(off_t end)
+{
+	while (input.consumed < end) {
+		unsigned int n;
+
+		fill(&input, 1);
+		n = input.len;
+		if (end - input.consumed < n)
+			n = end - input.consumed;
+		/* like use(), without the CRC that nobody needs here */
+		input.offset += n;
+		input.len -= n;
+		input.consumed += n;
+
+		counter_lock();
+		display_progress(progress, nr_parsed_objects);
+		counter_unlock();
+	}
+}
+
+static void parse_verify_ranges(struct parse_result *res)
+{
+	struct verify_range *last = &verify_ranges[nr_verify_ranges - 1];
+	uint64_t start = getnanotime();
+	int i;
+
+	init_thread();
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"),
+			    strerror(ret));
 	}
-	objects[i].idx.offset = consumed_bytes;
+	hash_input_until(last->start);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	cleanup_thread();
+	hash_input_until(last->end);
+	display_progress(progress, nr_parsed_objects);
+	trace_performance_since(start, "parsing %d ranges of the pack on %d threads",
+				nr_verify_ranges, nr_threads);
+
+	/* gather what the ranges found, in the order of the pack */
+	for (i = 0; i < nr_verify_ranges; i++) {
+		struct parse_result *r = &verify_ranges[i].res;
+
+		COPY_ARRAY(res->ofs_deltas + res->nr_ofs_deltas,
+			   r->ofs_deltas, r->nr_ofs_deltas);
+		res->nr_ofs_deltas += r->nr_ofs_deltas;
+		ALLOC_GROW(res->ref_deltas,
+			   res->nr_ref_deltas + r->nr_ref_deltas,
+			   res->ref_deltas_alloc);
+		COPY_ARRAY(res->ref_deltas + res->nr_ref_deltas,
+			   r->ref_deltas, r->nr_ref_deltas);
+		res->nr_ref_deltas += r->nr_ref_deltas;
+		res->nr_delays += r->nr_delays;
+		free(r->ofs_deltas);
+		free(r->ref_deltas);
+	}
+	FREE_AND_NULL(verify_ranges);
+	nr_verify_ranges = 0;
+}
+
+#endif
+
+static void parse_pack_objects(unsigned char *hash)
+{
+	int i;
+	struct parse_result res;
+	struct stat st;
+
+	memset(&res, 0, sizeof(res));
+	res.ofs_deltas = ofs_deltas;
+	res.ofs_deltas_alloc = nr_objects;
+
+	if (verbose)
+		progress = start_progress(
+				from_stdin ? _("Receiving objects") : _("Indexing objects"),
+				nr_objects);
+#ifndef NO_PTHREADS
+	if (nr_verify_ranges)
+		parse_verify_ranges(&res);
+	else
+#endif
+		parse_objects(&input, 0, nr_objects, &res);
+	objects[nr_objects].idx.offset = input.consumed;
 	stop_progress(&progress);
 
+	nr_ofs_deltas = res.nr_ofs_deltas;
+	ref_deltas = res.ref_deltas;
+	nr_ref_deltas = res.nr_ref_deltas;
+	ref_deltas_alloc = res.ref_deltas_alloc;
+
 	/* Check pack integrity */
-	flush();
+	flush(&input);
 	the_hash_algo->final_fn(hash, &input_ctx);
-	if (hashcmp(fill(the_hash_algo->rawsz), hash))
+	if (hashcmp(fill(&input, the_hash_algo->rawsz), hash))
 		die(_("pack is corrupted (SHA1 mismatch)"));
-	use(the_hash_algo->rawsz);
+	use(&input, the_hash_algo->rawsz);
 
 	/* If input_fd is a file, we should have reached its end now. */
 	if (fstat(input_fd, &st))
 		die_errno(_("cannot fstat packfile"));
 	if (S_ISREG(st.st_mode) &&
-			lseek(input_fd, 0, SEEK_CUR) - input_len != st.st_size)
+			lseek(input_fd, 0, SEEK_CUR) - input.len != st.st_size)
 		die(_("pack has junk at the end"));
 
 	for (i = 0; i < nr_objects; i++) {
@@ -1183,9 +1577,9 @@ static void parse_pack_objects(unsigned char *hash)
 		obj->real_type = obj->type;
 		sha1_object(NULL, obj, obj->size, obj->type,
 			    &obj->idx.oid);
-		nr_delays--;
+		res.nr_delays--;
 	}
-	if (nr_delays)
+	if (res.nr_delays)
 		die(_("confusion beyond insanity in parse_pack_objects()"));
 }
 
@@ -1215,6 +1609,8 @@ static void resolve_deltas(void)
 #ifndef NO_PTHREADS
 	nr_dispatched = 0;
 	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
+		uint64_t start = getnanotime(), elapsed;
+
 		init_thread();
 		for (i = 0; i < nr_threads; i++) {
 			int ret = pthread_create(&thread_data[i].thread, NULL,
@@ -1225,6 +1621,17 @@ static void resolve_deltas(void)
 		}
 		for (i = 0; i < nr_threads; i++)
 			pthread_join(thread_data[i].thread, NULL);
+		elapsed = getnanotime() - start;
+		for (i = 0; i < nr_threads; i++) {
+			struct thread_local *data = &thread_data[i];
+
+			trace_performance(data->busy_ns,
+					  "delta resolution thread %d: %d%% busy, "
+					  "%d deltas, %d subtrees handed over",
+					  i, elapsed ? (int)(data->busy_ns * 100 / elapsed) : 100,
+					  data->nr_deltas, data->nr_handed_over);
+		}
+		FREE_AND_NULL(handed_over);
 		cleanup_thread();
 		return;
 	}
@@ -1251,7 +1658,7 @@ static void conclude_pack(int fix_thin_pack, const char *curr_pack, unsigned cha
 	if (nr_ref_deltas + nr_ofs_deltas == nr_resolved_deltas) {
 		stop_progress(&progress);
 		/* Flush remaining pack final hash. */
-		flush();
+		flush(&input);
 		return;
 	}
 
@@ -1278,7 +1685,7 @@ static void conclude_pack(int fix_thin_pack, const char *curr_pack, unsigned cha
 		hashcpy(read_hash, pack_hash);
 		fixup_pack_header_footer(output_fd, pack_hash,
 					 curr_pack, nr_objects,
-					 read_hash, consumed_bytes-the_hash_algo->rawsz);
+					 read_hash, input.consumed-the_hash_algo->rawsz);
 		if (hashcmp(read_hash, tail_hash) != 0)
 			die(_("Unexpected tail checksum for %s "
 			      "(disk corruption?)"), curr_pack);
@@ -1442,13 +1849,15 @@ static void write_special_file(const char *suffix, const char *msg,
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_index_name, const char *curr_rev_index_name,
 		  const char *keep_msg, const char *promisor_msg,
 		  unsigned char *hash)
 {
 	const char *report = "pack";
 	struct strbuf pack_name = STRBUF_INIT;
 	struct strbuf index_name = STRBUF_INIT;
-	int err;
+	struct strbuf rev_index_name = STRBUF_INIT;
+	int err, i;
 
 	if (!from_stdin) {
 		close(input_fd);
@@ -1474,6 +1883,16 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	if (!curr_rev_index_name)
+		; /* no reverse index */
+	else if (final_rev_index_name != curr_rev_index_name) {
+		if (!final_rev_index_name)
+			final_rev_index_name = odb_pack_name(&rev_index_name, hash, "rev");
+		if (finalize_object_file(curr_rev_index_name, final_rev_index_name))
+			die(_("cannot store reverse index file"));
+	} else
+		chmod(final_rev_index_name, 0444);
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name)
 			final_index_name = odb_pack_name(&index_name, hash, "idx");
@@ -1491,10 +1910,20 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 
 	if (!from_stdin) {
 		printf("%s\n", sha1_to_hex(hash));
+		if (report_links) {
+			for (i = 0; i < links.nr; i++)
+				printf("%s\n", oid_to_hex(&links.oid[i]));
+			putchar('\n');
+		}
 	} else {
 		struct strbuf buf = STRBUF_INIT;
 
 		strbuf_addf(&buf, "%s\t%s\n", report, sha1_to_hex(hash));
+		if (report_links) {
+			for (i = 0; i < links.nr; i++)
+				strbuf_addf(&buf, "%s\n", oid_to_hex(&links.oid[i]));
+			strbuf_addch(&buf, '\n');
+		}
 		write_or_die(1, buf.buf, buf.len);
 		strbuf_release(&buf);
 
@@ -1502,15 +1931,16 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 		 * Let's just mimic git-unpack-objects here and write
 		 * the last part of the input buffer to stdout.
 		 */
-		while (input_len) {
-			err = xwrite(1, input_buffer + input_offset, input_len);
+		while (input.len) {
+			err = xwrite(1, input.buffer + input.offset, input.len);
 			if (err <= 0)
 				break;
-			input_len -= err;
-			input_offset += err;
+			input.len -= err;
+			input.offset += err;
 		}
 	}
 
+	strbuf_release(&rev_index_name);
 	strbuf_release(&index_name);
 	strbuf_release(&pack_name);
 }
@@ -1525,6 +1955,13 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1612,6 +2049,86 @@ static void read_idx_option(struct pack_idx_option *opts, const char *pack_name)
 	free(p);
 }
 
+#ifndef NO_PTHREADS
+static int compare_offsets(const void *a_, const void *b_)
+{
+	const off_t *a = a_, *b = b_;
+
+	return *a < *b ? -1 : *a > *b ? 1 : 0;
+}
+
+/*
+ * Split the objects of the pack being verified into ranges for
+ * threaded_first_pass(), going by the offsets in the .idx.  These are
+ * only trusted if the .idx is intact; if it is not, the pack is parsed
+ * in one go, to find out how the .idx does not match it.
+ */
+static void plan_verify_ranges(const char *index_name)
+{
+	struct packed_git *p = add_packed_git(index_name, strlen(index_name), 1);
+	const unsigned char *index_base;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	off_t *offsets = NULL, end, size;
+	int i, want;
+
+	if (!p)
+		return;
+	if (open_pack_index(p) || p->num_objects != nr_objects || !nr_objects)
+		goto out;
+	index_base = p->index_data;
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, index_base,
+				 p->index_size - the_hash_algo->rawsz);
+	the_hash_algo->final_fn(hash, &ctx);
+	if (hashcmp(hash, index_base + p->index_size - the_hash_algo->rawsz))
+		goto out;
+
+	ALLOC_ARRAY(offsets, nr_objects);
+	for (i = 0; i < nr_objects; i++)
+		offsets[i] = nth_packed_object_offset(p, i);
+	QSORT(offsets, nr_objects, compare_offsets);
+	end = p->pack_size - the_hash_algo->rawsz;
+	if (offsets[0] != input.consumed || offsets[nr_objects - 1] >= end)
+		goto out;
+	for (i = 1; i < nr_objects; i++)
+		if (offsets[i] == offsets[i - 1])
+			goto out;
+
+	/* a few ranges per thread, of about the same size */
+	want = nr_threads * 4;
+	if (want > nr_objects)
+		want = nr_objects;
+	size = end - offsets[0];
+	verify_ranges = xcalloc(want, sizeof(*verify_ranges));
+	for (i = 0; i < nr_objects; i++) {
+		if (nr_verify_ranges &&
+		    (nr_verify_ranges == want ||
+		     offsets[i] - offsets[0] < size / want * nr_verify_ranges))
+			continue;
+		verify_ranges[nr_verify_ranges].start = offsets[i];
+		verify_ranges[nr_verify_ranges].first = i;
+		nr_verify_ranges++;
+	}
+	for (i = 0; i < nr_verify_ranges; i++) {
+		struct verify_range *r = &verify_ranges[i];
+
+		if (i + 1 < nr_verify_ranges) {
+			r->nr = r[1].first - r->first;
+			r->end = r[1].start;
+		} else {
+			r->nr = nr_objects - r->first;
+			r->end = end;
+		}
+	}
+
+out:
+	free(offsets);
+	close_pack_index(p);
+	free(p);
+}
+#endif
+
 static void show_pack_info(int stat_only)
 {
 	int i, baseobjects = nr_objects - nr_ref_deltas - nr_ofs_deltas;
@@ -1659,11 +2176,13 @@ static void show_pack_info(int stat_only)
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_index;
+	const char *curr_index, *curr_rev_index = NULL;
+	const char *rev_index_name = NULL;
 	const char *index_name = NULL, *pack_name = NULL;
 	const char *keep_msg = NULL;
 	const char *promisor_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT;
+	struct strbuf rev_index_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
 	unsigned char pack_hash[GIT_MAX_RAWSZ];
@@ -1683,6 +2202,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	fsck_options.walk = mark_link;
 
 	reset_pack_idx_option(&opts);
+	if (git_env_bool("GIT_TEST_WRITE_REV_INDEX", 0))
+		opts.flags |= WRITE_REV;
 	git_config(git_index_pack_config, &opts);
 	if (prefix && chdir(prefix))
 		die(_("Cannot come back to cwd"));
@@ -1704,6 +2225,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				check_self_contained_and_connected = 1;
 			} else if (!strcmp(arg, "--fsck-objects")) {
 				do_fsck_object = 1;
+			} else if (!strcmp(arg, "--report-links")) {
+				report_links = 1;
 			} else if (!strcmp(arg, "--verify")) {
 				verify = 1;
 			} else if (!strcmp(arg, "--verify-stat")) {
@@ -1732,7 +2255,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				struct pack_header *hdr;
 				char *c;
 
-				hdr = (struct pack_header *)input_buffer;
+				hdr = (struct pack_header *)input.buffer;
 				hdr->hdr_signature = htonl(PACK_SIGNATURE);
 				hdr->hdr_version = htonl(strtoul(arg + 14, &c, 10));
 				if (*c != ',')
@@ -1740,7 +2263,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				hdr->hdr_entries = htonl(strtoul(c + 1, &c, 10));
 				if (*c)
 					die(_("bad %s"), arg);
-				input_len = sizeof(*hdr);
+				input.len = sizeof(*hdr);
 			} else if (!strcmp(arg, "-v")) {
 				verbose = 1;
 			} else if (!strcmp(arg, "--show-resolving-progress")) {
@@ -1787,6 +2310,23 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		read_idx_option(&opts, index_name);
 		opts.flags |= WRITE_IDX_VERIFY | WRITE_IDX_STRICT;
 	}
+	if (index_name) {
+		size_t len;
+
+		/* the .rev goes next to the .idx, if it looks like one */
+		if (strip_suffix(index_name, ".idx", &len)) {
+			strbuf_add(&rev_index_name_buf, index_name, len);
+			strbuf_addstr(&rev_index_name_buf, ".rev");
+			rev_index_name = rev_index_name_buf.buf;
+		} else
+			opts.flags &= ~WRITE_REV;
+	}
+	if (verify) {
+		/* check the .rev there is, whether we would write one or not */
+		opts.flags &= ~WRITE_REV;
+		if (rev_index_name && file_exists(rev_index_name))
+			opts.flags |= WRITE_REV_VERIFY;
+	}
 	if (strict)
 		opts.flags |= WRITE_IDX_STRICT;
 
@@ -1805,6 +2345,11 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	if (show_stat)
 		obj_stat = xcalloc(st_add(nr_objects, 1), sizeof(struct object_stat));
 	ofs_deltas = xcalloc(nr_objects, sizeof(struct ofs_delta_entry));
+#ifndef NO_PTHREADS
+	if (verify && !from_stdin &&
+	    (nr_threads > 1 || getenv("GIT_FORCE_THREADS")))
+		plan_verify_ranges(index_name);
+#endif
 	parse_pack_objects(pack_hash);
 	if (report_end_of_input)
 		write_in_full(2, "\0", 1);
@@ -1812,6 +2357,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	conclude_pack(fix_thin_pack, curr_pack, pack_hash);
 	free(ofs_deltas);
 	free(ref_deltas);
+	if (report_links)
+		collect_links();
 	if (strict)
 		foreign_nr = check_objects();
 
@@ -1822,11 +2369,16 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_hash);
+	if (opts.flags & (WRITE_REV | WRITE_REV_VERIFY))
+		curr_rev_index = write_rev_file(rev_index_name, idx_objects,
+						nr_objects, pack_hash,
+						opts.flags);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_index_name, curr_rev_index,
 		      keep_msg, promisor_msg,
 		      pack_hash);
 	else
@@ -1837,10 +2389,13 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 
 	free(objects);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_index_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_index_name == NULL)
+		free((void *) curr_rev_index);
 
 	/*
 	 * Let the caller know this pack is not self contained
@@ -23,6 +23,7 @@
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
 static const char *init_db_template_dir;
+static const char *init_ref_storage;
 
 static void copy_templates_1(struct strbuf *path, struct strbuf *template_path,
 			     DIR *dir)
@@ -171,6 +172,12 @@ static int needs_work_tree_config(const char *git_dir, const char *work_tree)
 	return 1;
 }
 
+static int ref_storage_is_files(void)
+{
+	return !repository_format_ref_storage ||
+		!strcmp(repository_format_ref_storage, "files");
+}
+
 static int create_default_files(const char *template_path,
 				const char *original_git_dir)
 {
@@ -223,6 +230,14 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	/*
+	 * Look for HEAD before setting up the refs db, which may
+	 * write one.
+	 */
+	path = git_path_buf(&buf, "HEAD");
+	reinit = (!access(path, R_OK)
+		  || readlink(path, junk, sizeof(junk)-1) != -1);
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -230,9 +245,6 @@ static int create_default_files(const char *template_path,
 	 * Create the default symlink from ".git/HEAD" to the "master"
 	 * branch, if it does not exist yet.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
@@ -240,8 +252,11 @@ static int create_default_files(const char *template_path,
 
 	/* This forces creation of new config file */
 	xsnprintf(repo_version_string, sizeof(repo_version_string),
-		  "%d", GIT_REPO_VERSION);
+		  "%d", ref_storage_is_files() ? GIT_REPO_VERSION : 1);
 	git_config_set("core.repositoryformatversion", repo_version_string);
+	if (!ref_storage_is_files())
+		git_config_set("extensions.refstorage",
+			       repository_format_ref_storage);
 
 	/* Check filemode trustability */
 	path = git_path_buf(&buf, "config");
@@ -371,6 +386,18 @@ int init_db(const char *git_dir, const char *real_git_dir,
 	 */
 	check_repository_format();
 
+	if (init_ref_storage) {
+		const char *current = repository_format_ref_storage ?
+			repository_format_ref_storage : "files";
+
+		if (!ref_storage_backend_exists(init_ref_storage))
+			die(_("unknown ref storage format '%s'"), init_ref_storage);
+		if (strcmp(current, init_ref_storage) &&
+		    !access(git_path("HEAD"), F_OK))
+			die(_("attempt to reinitialize repository with different ref storage format"));
+		repository_format_ref_storage = xstrdup(init_ref_storage);
+	}
+
 	reinit = create_default_files(template_dir, original_git_dir);
 
 	create_object_directory();
@@ -455,7 +482,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-storage=<format>] [<directory>]"),
 	NULL
 };
 
@@ -484,6 +511,8 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-storage", &init_ref_storage, N_("format"),
+			   N_("how to store refs (files or reftable)")),
 		OPT_END()
 	};
 
@@ -10,6 +10,7 @@
 #include "object-store.h"
 #include "color.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "diff.h"
 #include "revision.h"
 #include "log-tree.h"
@@ -358,9 +359,92 @@ static void finish_early_output(struct rev_info *rev)
 	show_early_header(rev, "done", n);
 }
 
+/*
+ * When the diffs look at the contents of the blobs, with -S and -G or
+ * to show patches and stats, most of the time goes to reading them, and
+ * with --show-signature to waiting for gpg. So we take the commits from
+ * the walk in batches, let log_tree_prefetch() diff them and read what
+ * their diffs need in threads, or verify their signatures several at a
+ * time, and then show them in order. A batch starts small, so that
+ * the first commits do not wait for long, and grows to LOG_BATCH
+ * commits. This is not done when what the walk gives us next, or how
+ * we diff a commit, depends on the commits we showed already.
+ */
+#define LOG_BATCH 256
+
+struct log_batch {
+	struct commit *commits[LOG_BATCH];
+	int nr, pos, size;
+	unsigned prefetch;
+};
+
+static int use_diff_prefetch(struct rev_info *rev)
+{
+	struct diff_options *opt = &rev->diffopt;
+
+	if (!rev->diff || opt->flags.quick)
+		return 0;
+	/*
+	 * With --full-diff on a pruned walk, get_saved_parents() gives
+	 * the parents to diff against, and the walk frees them once it
+	 * runs out of commits, which a batch sees before it shows them.
+	 */
+	if (rev->full_diff && rev->prune)
+		return 0;
+	return (opt->pickaxe_opts & (DIFF_PICKAXE_KIND_S | DIFF_PICKAXE_KIND_G)) ||
+		(opt->output_format & (DIFF_FORMAT_PATCH | DIFF_FORMAT_DIFFSTAT |
+				       DIFF_FORMAT_NUMSTAT | DIFF_FORMAT_SHORTSTAT |
+				       DIFF_FORMAT_DIRSTAT)) ||
+		opt->detect_rename;
+}
+
+/*
+ * What log_tree_prefetch() should do for the batches, or 0 not to take
+ * the commits in batches at all.
+ */
+static unsigned use_log_batch(struct rev_info *rev)
+{
+	unsigned flags = 0;
+
+	if (rev->diffopt.flags.follow_renames || rev->reflog_info ||
+	    rev->graph || rev->line_level_traverse || rev->track_linear)
+		return 0;
+	if (use_diff_prefetch(rev))
+		flags |= LOG_PREFETCH_DIFFS;
+	if (rev->show_signature)
+		flags |= LOG_PREFETCH_SIGNATURES;
+	return flags;
+}
+
+static struct commit *next_commit(struct rev_info *rev,
+				  struct log_batch *batch)
+{
+	if (!batch)
+		return get_revision(rev);
+	if (batch->pos == batch->nr) {
+		struct commit *commit;
+
+		log_tree_prefetch_clear();
+		batch->nr = batch->pos = 0;
+		batch->size = batch->size ? 2 * batch->size : 16;
+		if (batch->size > LOG_BATCH)
+			batch->size = LOG_BATCH;
+		while (batch->nr < batch->size &&
+		       (commit = get_revision(rev)) != NULL)
+			batch->commits[batch->nr++] = commit;
+		if (!batch->nr)
+			return NULL;
+		log_tree_prefetch(rev, batch->commits, batch->nr,
+				  batch->prefetch);
+	}
+	return batch->commits[batch->pos++];
+}
+
 static int cmd_log_walk(struct rev_info *rev)
 {
 	struct commit *commit;
+	struct log_batch *batch = NULL;
+	unsigned prefetch;
 	int saved_nrl = 0;
 	int saved_dcctc = 0, close_file = rev->diffopt.close_file;
 
@@ -379,7 +463,12 @@ static int cmd_log_walk(struct rev_info *rev)
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
 	rev->diffopt.close_file = 0;
-	while ((commit = get_revision(rev)) != NULL) {
+	prefetch = use_log_batch(rev);
+	if (prefetch) {
+		batch = xcalloc(1, sizeof(*batch));
+		batch->prefetch = prefetch;
+	}
+	while ((commit = next_commit(rev, batch)) != NULL) {
 		if (!log_tree_commit(rev, commit) && rev->max_count >= 0)
 			/*
 			 * We decremented max_count in get_revision,
@@ -400,6 +489,10 @@ static int cmd_log_walk(struct rev_info *rev)
 		if (rev->diffopt.degraded_cc_to_c)
 			saved_dcctc = 1;
 	}
+	if (batch) {
+		log_tree_prefetch_clear();
+		free(batch);
+	}
 	rev->diffopt.degraded_cc_to_c = saved_dcctc;
 	rev->diffopt.needed_rename_limit = saved_nrl;
 	if (close_file)
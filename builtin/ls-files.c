@@ -45,6 +45,8 @@ static int error_unmatch;
 static char *ps_matched;
 static const char *with_tree;
 static int exc_given;
+/* --exclude-standard was given but is not set up yet */
+static int exclude_standard_pending;
 static int exclude_args;
 
 static const char *tag_cached = "";
@@ -480,12 +482,26 @@ static int option_parse_exclude(const struct option *opt,
 	return 0;
 }
 
+/*
+ * The standard exclusions are set up once the index is read, so that
+ * the untracked cache in it can be used, unless other exclude options
+ * given after them need them to be in place first.
+ */
+static void setup_pending_exclude_standard(struct dir_struct *dir)
+{
+	if (!exclude_standard_pending)
+		return;
+	exclude_standard_pending = 0;
+	setup_standard_excludes(dir);
+}
+
 static int option_parse_exclude_from(const struct option *opt,
 				     const char *arg, int unset)
 {
 	struct dir_struct *dir = opt->value;
 
 	exc_given = 1;
+	setup_pending_exclude_standard(dir);
 	add_excludes_from_file(dir, arg);
 
 	return 0;
@@ -497,7 +513,21 @@ static int option_parse_exclude_standard(const struct option *opt,
 	struct dir_struct *dir = opt->value;
 
 	exc_given = 1;
-	setup_standard_excludes(dir);
+	if (dir->exclude_per_dir || dir->unmanaged_exclude_files)
+		setup_standard_excludes(dir);
+	else
+		exclude_standard_pending = 1;
+
+	return 0;
+}
+
+static int option_parse_exclude_per_directory(const struct option *opt,
+					      const char *arg, int unset)
+{
+	struct dir_struct *dir = opt->value;
+
+	setup_pending_exclude_standard(dir);
+	dir->exclude_per_dir = arg;
 
 	return 0;
 }
@@ -551,8 +581,9 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 		{ OPTION_CALLBACK, 'X', "exclude-from", &dir, N_("file"),
 			N_("exclude patterns are read from <file>"),
 			0, option_parse_exclude_from },
-		OPT_STRING(0, "exclude-per-directory", &dir.exclude_per_dir, N_("file"),
-			N_("read additional per-directory exclude patterns in <file>")),
+		{ OPTION_CALLBACK, 0, "exclude-per-directory", &dir, N_("file"),
+			N_("read additional per-directory exclude patterns in <file>"),
+			0, option_parse_exclude_per_directory },
 		{ OPTION_CALLBACK, 0, "exclude-standard", &dir, NULL,
 			N_("add the standard git exclusions"),
 			PARSE_OPT_NOARG, option_parse_exclude_standard },
@@ -579,14 +610,13 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 		prefix_len = strlen(prefix);
 	git_config(git_default_config, NULL);
 
-	if (repo_read_index(the_repository) < 0)
-		die("index file corrupt");
-
 	argc = parse_options(argc, argv, prefix, builtin_ls_files_options,
 			ls_files_usage, 0);
-	el = add_exclude_list(&dir, EXC_CMDL, "--exclude option");
-	for (i = 0; i < exclude_list.nr; i++) {
-		add_exclude(exclude_list.items[i].string, "", 0, el, --exclude_args);
+	if (exclude_list.nr) {
+		el = add_exclude_list(&dir, EXC_CMDL, "--exclude option");
+		for (i = 0; i < exclude_list.nr; i++)
+			add_exclude(exclude_list.items[i].string, "", 0, el,
+				    --exclude_args);
 	}
 	if (show_tag || show_valid_bit || show_fsmonitor_bit) {
 		tag_cached = "H ";
@@ -606,7 +636,7 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 		 * you also show the stage information.
 		 */
 		show_stage = 1;
-	if (dir.exclude_per_dir)
+	if (dir.exclude_per_dir || exclude_standard_pending)
 		exc_given = 1;
 
 	if (require_work_tree && !is_inside_work_tree())
@@ -625,6 +655,20 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 		       PATHSPEC_PREFER_CWD,
 		       prefix, argv);
 
+	/*
+	 * Only the entries the pathspec matches are needed, unless we
+	 * look at the working tree or at what is in the extensions.
+	 */
+	if (show_others || show_killed || show_resolve_undo || with_tree ||
+	    show_fsmonitor_bit || recurse_submodules) {
+		if (repo_read_index(the_repository) < 0)
+			die("index file corrupt");
+	} else if (read_index_from_pathspec(the_repository->index,
+					    the_repository->index_file,
+					    the_repository->gitdir,
+					    &pathspec) < 0)
+		die("index file corrupt");
+
 	/*
 	 * Find common prefix for all pathspec's
 	 * This is used as a performance optimization which unfortunately cannot
@@ -641,6 +685,13 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 
 	prune_index(the_repository->index, max_prefix, max_prefix_len);
 
+	if (exclude_standard_pending) {
+		/* fill_directory() checks whether it fits what we ask */
+		if (show_others && !show_killed)
+			dir.untracked = the_repository->index->untracked;
+		setup_pending_exclude_standard(&dir);
+	}
+
 	/* Treat unmatching pathspec elements as errors */
 	if (pathspec.nr && error_unmatch)
 		ps_matched = xcalloc(pathspec.nr, 1);
@@ -2,6 +2,7 @@
 #include "cache.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "refs.h"
 #include "diff.h"
 #include "revision.h"
@@ -5,8 +5,13 @@
 #include "blob.h"
 #include "exec-cmd.h"
 #include "merge-blobs.h"
+#include "commit.h"
+#include "merge-ort.h"
+#include "quote.h"
 
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+static const char merge_tree_usage[] =
+"git merge-tree <base-tree> <branch1> <branch2>\n"
+"   or: git merge-tree --write-tree [--no-messages] <branch1> <branch2>";
 
 struct merge_list {
 	struct merge_list *next;
@@ -26,7 +31,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -221,7 +226,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -338,7 +343,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -360,18 +365,86 @@ static void *get_tree_descriptor(struct tree_desc *desc, const char *rev)
 	return buf;
 }
 
+static struct commit *get_commit(const char *rev)
+{
+	struct commit *commit = get_merge_parent(rev);
+
+	if (!commit)
+		die(_("could not parse as commit: %s"), rev);
+	return commit;
+}
+
+/*
+ * Print the merged tree, the stages of the conflicted paths, and the
+ * conflict messages; exit with 1 if the merge is not clean.
+ */
+static int write_tree(const char *branch1, const char *branch2,
+		      int show_messages)
+{
+	struct merge_options o;
+	struct merge_result result;
+	const char *last = NULL;
+	int i, j, clean;
+
+	init_merge_options(&o);
+	o.branch1 = branch1;
+	o.branch2 = branch2;
+
+	if (merge_incore_recursive(&o, NULL, get_commit(branch1),
+				   get_commit(branch2), &result) < 0)
+		die(_("merge of %s and %s failed"), branch1, branch2);
+
+	printf("%s\n", oid_to_hex(&result.tree->object.oid));
+	for (i = 0; i < result.nr_conflicts; i++) {
+		struct merge_conflict *c = &result.conflicts[i];
+
+		if (last && !strcmp(last, c->path))
+			continue;
+		last = c->path;
+		for (j = 0; j < 3; j++) {
+			if (!c->stages[j].mode)
+				continue;
+			printf("%06o %s %d\t", c->stages[j].mode,
+			       oid_to_hex(&c->stages[j].oid), j + 1);
+			write_name_quoted(c->path, stdout, '\n');
+		}
+	}
+	if (show_messages && result.nr_conflicts) {
+		putchar('\n');
+		for (i = 0; i < result.nr_conflicts; i++)
+			printf("%s\n", result.conflicts[i].message);
+	}
+
+	clean = result.clean;
+	merge_result_release(&result);
+	return clean ? 0 : 1;
+}
+
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 {
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
 
+	if (argc > 1 && !strcmp(argv[1], "--write-tree")) {
+		int show_messages = 1;
+
+		if (argc > 2 && !strcmp(argv[2], "--no-messages")) {
+			show_messages = 0;
+			argc--;
+			argv++;
+		}
+		if (argc != 4)
+			usage(merge_tree_usage);
+		return write_tree(argv[2], argv[3], show_messages);
+	}
+
 	if (argc != 4)
 		usage(merge_tree_usage);
 
 	buf1 = get_tree_descriptor(t+0, argv[1]);
 	buf2 = get_tree_descriptor(t+1, argv[2]);
 	buf3 = get_tree_descriptor(t+2, argv[3]);
-	merge_trees(t, "");
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
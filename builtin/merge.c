@@ -16,6 +16,7 @@
 #include "refs.h"
 #include "refspec.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "diffcore.h"
 #include "revision.h"
 #include "unpack-trees.h"
@@ -407,15 +408,14 @@ static void finish(struct commit *head_commit,
 		if (verbosity >= 0 && !merge_msg.len)
 			printf(_("No merge message -- not updating HEAD\n"));
 		else {
-			const char *argv_gc_auto[] = { "gc", "--auto", NULL };
 			update_ref(reflog_message.buf, "HEAD", new_head, head,
 				   0, UPDATE_REFS_DIE_ON_ERR);
 			/*
-			 * We ignore errors in 'gc --auto', since the
+			 * We ignore errors in 'maintenance run --auto', since the
 			 * user should see them.
 			 */
 			close_all_packs(the_repository->objects);
-			run_command_v_opt(argv_gc_auto, RUN_GIT_CMD);
+			run_auto_maintenance(verbosity < 0);
 		}
 	}
 	if (new_head && show_diffstat) {
@@ -1321,6 +1321,16 @@ int cmd_merge(int argc, const char **argv, const char *prefix)
 			builtin_merge_options);
 
 	if (verify_signatures) {
+		struct commit **commits;
+		int nr = 0;
+
+		ALLOC_ARRAY(commits, commit_list_count(remoteheads));
+		for (p = remoteheads; p; p = p->next)
+			commits[nr++] = p->item;
+		if (nr > 1)
+			prefetch_commit_signatures(commits, nr);
+		free(commits);
+
 		for (p = remoteheads; p; p = p->next) {
 			struct commit *commit = p->item;
 			char hex[GIT_MAX_HEXSZ + 1];
@@ -1348,6 +1358,7 @@ int cmd_merge(int argc, const char **argv, const char *prefix)
 
 			signature_check_clear(&signature_check);
 		}
+		clear_prefetched_commit_signatures();
 	}
 
 	strbuf_addstr(&buf, "merge");
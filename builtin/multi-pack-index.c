@@ -0,0 +1,104 @@
+#include "builtin.h"
+#include "cache.h"
+#include "config.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static char const * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index [--object-dir=<dir>] (write|verify|read)"),
+	N_("git multi-pack-index [--object-dir=<dir>] [--preferred-pack=<pack>] [--bitmap] write"),
+	NULL
+};
+
+static struct opts_multi_pack_index {
+	const char *object_dir;
+	const char *preferred_pack;
+	int bitmap;
+} opts;
+
+static int midx_read(void)
+{
+	uint32_t i;
+	struct multi_pack_index *m = load_multi_pack_index(opts.object_dir, 1);
+
+	if (!m)
+		die(_("multi-pack-index file for %s does not exist"),
+		    opts.object_dir);
+
+	printf("header: %08x %d %d %d %d\n",
+	       m->signature,
+	       m->version,
+	       m->data[5],
+	       m->num_chunks,
+	       m->data[7]);
+
+	printf("chunks:");
+
+	if (m->chunk_pack_names)
+		printf(" pack-names");
+	if (m->chunk_oid_fanout)
+		printf(" oid-fanout");
+	if (m->chunk_oid_lookup)
+		printf(" oid-lookup");
+	if (m->chunk_object_offsets)
+		printf(" object-offsets");
+	if (m->chunk_large_offsets)
+		printf(" large-offsets");
+	if (m->chunk_revindex)
+		printf(" revindex");
+
+	printf("\nnum_objects: %d\n", m->num_objects);
+
+	printf("packs:\n");
+	for (i = 0; i < m->num_packs; i++)
+		printf("%s\n", m->pack_names[i]);
+
+	printf("object-dir: %s\n", m->object_dir);
+
+	close_midx(m);
+	free(m);
+	return 0;
+}
+
+int cmd_multi_pack_index(int argc, const char **argv,
+			 const char *prefix)
+{
+	static struct option builtin_multi_pack_index_options[] = {
+		OPT_FILENAME(0, "object-dir", &opts.object_dir,
+		  N_("object directory containing set of packfile and pack-index pairs")),
+		OPT_STRING(0, "preferred-pack", &opts.preferred_pack, N_("pack"),
+		  N_("pack to take objects found in several packs from")),
+		OPT_BOOL(0, "bitmap", &opts.bitmap,
+		  N_("write a reachability bitmap for the multi-pack-index")),
+		OPT_END(),
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_multi_pack_index_options,
+			     builtin_multi_pack_index_usage, 0);
+
+	if (!opts.object_dir)
+		opts.object_dir = get_object_directory();
+
+	if (argc == 0)
+		usage_with_options(builtin_multi_pack_index_usage,
+				   builtin_multi_pack_index_options);
+
+	if (argc > 1)
+		die(_("too many arguments"));
+
+	if (strcmp(argv[0], "write") && (opts.preferred_pack || opts.bitmap))
+		die(_("--preferred-pack and --bitmap only work with 'write'"));
+
+	if (!strcmp(argv[0], "write"))
+		return write_midx_file(opts.object_dir, opts.preferred_pack,
+				       opts.bitmap ? MIDX_WRITE_BITMAP : 0);
+	if (!strcmp(argv[0], "verify"))
+		return verify_midx_file(opts.object_dir);
+	if (!strcmp(argv[0], "read"))
+		return midx_read();
+
+	die(_("unrecognized verb: %s"), argv[0]);
+}
@@ -26,6 +26,7 @@
 static const char * const git_notes_usage[] = {
 	N_("git notes [--ref <notes-ref>] [list [<object>]]"),
 	N_("git notes [--ref <notes-ref>] add [-f] [--allow-empty] [-m <msg> | -F <file> | (-c | -C) <object>] [<object>]"),
+	N_("git notes [--ref <notes-ref>] add [-f] [--allow-empty] --stdin"),
 	N_("git notes [--ref <notes-ref>] copy [-f] <from-object> <to-object>"),
 	N_("git notes [--ref <notes-ref>] append [--allow-empty] [-m <msg> | -F <file> | (-c | -C) <object>] [<object>]"),
 	N_("git notes [--ref <notes-ref>] edit [--allow-empty] [<object>]"),
@@ -46,6 +47,7 @@ static const char * const git_notes_list_usage[] = {
 
 static const char * const git_notes_add_usage[] = {
 	N_("git notes add [<options>] [<object>]"),
+	N_("git notes add [-f] [--allow-empty] --stdin"),
 	NULL
 };
 
@@ -391,9 +393,61 @@ static int list(int argc, const char **argv, const char *prefix)
 
 static int append_edit(int argc, const char **argv, const char *prefix);
 
+/*
+ * Read "<object> SP <note-object>" lines and attach the notes to their
+ * objects, all in a single notes commit.
+ */
+static int notes_add_from_stdin(int force, int allow_empty)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct notes_tree *t;
+	int ret = 0;
+
+	t = init_notes_check("add", NOTES_INIT_WRITABLE);
+
+	while (strbuf_getline_lf(&buf, stdin) != EOF) {
+		struct object_id object, new_note;
+		struct strbuf **split;
+		unsigned long size;
+
+		split = strbuf_split(&buf, ' ');
+		if (!split[0] || !split[1] || split[2])
+			die(_("malformed input line: '%s'."), buf.buf);
+		strbuf_rtrim(split[0]);
+		if (get_oid(split[0]->buf, &object))
+			die(_("failed to resolve '%s' as a valid ref."), split[0]->buf);
+		if (get_oid(split[1]->buf, &new_note))
+			die(_("failed to resolve '%s' as a valid ref."), split[1]->buf);
+
+		if (oid_object_info(the_repository, &new_note, &size) != OBJ_BLOB) {
+			error(_("cannot read note data from non-blob object '%s'."),
+			      split[1]->buf);
+			ret = 1;
+		} else if (!force && get_note(t, &object)) {
+			error(_("Cannot add notes. "
+				"Found existing notes for object %s. "
+				"Use '-f' to overwrite existing notes"),
+			      oid_to_hex(&object));
+			ret = 1;
+		} else if (size || allow_empty) {
+			if (add_note(t, &object, &new_note,
+				     combine_notes_overwrite))
+				BUG("combine_notes_overwrite failed");
+		} else
+			remove_note(t, object.hash);
+
+		strbuf_list_free(split);
+	}
+
+	commit_notes(t, "Notes added by 'git notes add'");
+	free_notes(t);
+	strbuf_release(&buf);
+	return ret;
+}
+
 static int add(int argc, const char **argv, const char *prefix)
 {
-	int force = 0, allow_empty = 0;
+	int force = 0, allow_empty = 0, from_stdin = 0;
 	const char *object_ref;
 	struct notes_tree *t;
 	struct object_id object, new_note;
@@ -415,12 +469,23 @@ static int add(int argc, const char **argv, const char *prefix)
 		OPT_BOOL(0, "allow-empty", &allow_empty,
 			N_("allow storing empty note")),
 		OPT__FORCE(&force, N_("replace existing notes"), PARSE_OPT_NOCOMPLETE),
+		OPT_BOOL(0, "stdin", &from_stdin,
+			N_("read objects and their note objects from stdin")),
 		OPT_END()
 	};
 
 	argc = parse_options(argc, argv, prefix, options, git_notes_add_usage,
 			     PARSE_OPT_KEEP_ARGV0);
 
+	if (from_stdin) {
+		if (1 < argc || d.given) {
+			free_note_data(&d);
+			error(_("--stdin cannot be used with an object or a note"));
+			usage_with_options(git_notes_add_usage, options);
+		}
+		return notes_add_from_stdin(force, allow_empty);
+	}
+
 	if (2 < argc) {
 		error(_("too many parameters"));
 		usage_with_options(git_notes_add_usage, options);
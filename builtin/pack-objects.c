@@ -31,6 +31,10 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "dir.h"
+#include "delta-islands.h"
+#include "oidmap.h"
+#include "pack-mtimes.h"
+#include "trace2.h"
 
 #define IN_PACK(obj) oe_in_pack(&to_pack, obj)
 #define SIZE(obj) oe_size(&to_pack, obj)
@@ -64,6 +68,8 @@ static int non_empty;
 static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static timestamp_t unpack_unreachable_expiration;
+static int cruft;
+static timestamp_t cruft_expiration;
 static int pack_loose_unreachable;
 static int local;
 static int have_non_local_packs;
@@ -84,12 +90,13 @@ static struct progress *progress_state;
 
 static struct packed_git *reuse_packfile;
 static uint32_t reuse_packfile_objects;
-static off_t reuse_packfile_offset;
+static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
+static int use_delta_islands;
 static int write_bitmap_index;
-static uint16_t write_bitmap_options;
+static uint16_t write_bitmap_options = BITMAP_OPT_LOOKUP_TABLE | BITMAP_OPT_HASH_CACHE;
 
 static int exclude_promisor_objects;
 
@@ -99,8 +106,30 @@ static unsigned long cache_max_small_delta_size = 1000;
 
 static unsigned long window_memory_limit = 0;
 
+/*
+ * With a memory limit, what is left of it for the delta search once
+ * the object list is accounted for: the delta cache takes from it, and
+ * the windows of the search threads share the rest.
+ */
+static unsigned long memory_limit;
+static unsigned long search_memory;
+
 static struct list_objects_filter_options filter_options;
 
+/*
+ * Packs that the client can download from a URI ("uploadpack.packfileURI")
+ * instead of receiving their objects in our pack.
+ */
+struct packfile_uri {
+	struct packed_git *pack;
+	const char *uri;
+	unsigned used : 1;
+};
+static struct packfile_uri *packfile_uris;
+static int packfile_uris_nr, packfile_uris_alloc;
+static struct string_list packfile_uri_config = STRING_LIST_INIT_DUP;
+static struct string_list uri_protocols = STRING_LIST_INIT_NODUP;
+
 enum missing_action {
 	MA_ERROR = 0,      /* fail if any missing objects are encountered */
 	MA_ALLOW_ANY,      /* silently allow ALL missing objects */
@@ -157,27 +186,13 @@ static void *get_delta(struct object_entry *entry)
 
 static unsigned long do_compress(void **pptr, unsigned long size)
 {
-	git_zstream stream;
-	void *in, *out;
-	unsigned long maxsize;
-
-	git_deflate_init(&stream, pack_compression_level);
-	maxsize = git_deflate_bound(&stream, size);
-
-	in = *pptr;
-	out = xmalloc(maxsize);
-	*pptr = out;
-
-	stream.next_in = in;
-	stream.avail_in = size;
-	stream.next_out = out;
-	stream.avail_out = maxsize;
-	while (git_deflate(&stream, Z_FINISH) == Z_OK)
-		; /* nothing */
-	git_deflate_end(&stream);
+	unsigned long result_size;
+	void *in = *pptr;
 
+	*pptr = git_deflate_buffer(in, size, pack_compression_level,
+				   &result_size);
 	free(in);
-	return stream.total_out;
+	return result_size;
 }
 
 static unsigned long write_large_blob_data(struct git_istream *st, struct hashfile *f,
@@ -385,7 +400,7 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 {
 	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
 	enum object_type type = oe_type(entry);
 	off_t datalen;
@@ -402,10 +417,15 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 					      type, entry_size);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die(_("write_reuse_object: could not locate %s, expected at "
+		      "offset %"PRIuMAX" in pack %s"),
+		    oid_to_hex(&entry->idx.oid), (uintmax_t)offset,
+		    p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error("bad packed object CRC for %s",
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -753,63 +773,215 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
-static off_t write_reused_pack(struct hashfile *f)
+/*
+ * Record, for the objects copied from the reused pack, how much earlier
+ * they end up in the new pack than in the old one because of the objects
+ * left out, so that the offsets of their OFS_DELTA bases can be fixed.
+ * A chunk is added whenever the difference changes.
+ */
+static struct reused_chunk {
+	/* offset of the first object of the chunk in the reused pack */
+	off_t original;
+	/* by how much the objects of the chunk move back */
+	off_t difference;
+} *reused_chunks;
+static int reused_chunks_nr;
+static int reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t offset)
+{
+	if (reused_chunks_nr &&
+	    reused_chunks[reused_chunks_nr - 1].difference == offset)
+		return;
+
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1, reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = offset;
+	reused_chunks_nr++;
+}
+
+/* How much the object at "where" in the reused pack moved back */
+static off_t find_reused_offset(off_t where)
 {
-	unsigned char buffer[8192];
-	off_t to_write, total;
-	int fd;
+	int lo = 0, hi = reused_chunks_nr;
 
-	if (!is_pack_valid(reuse_packfile))
-		die("packfile is invalid: %s", reuse_packfile->pack_name);
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
 
-	fd = git_open(reuse_packfile->pack_name);
-	if (fd < 0)
-		die_errno("unable to open packfile for reuse: %s",
-			  reuse_packfile->pack_name);
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
 
-	if (lseek(fd, sizeof(struct pack_header), SEEK_SET) == -1)
-		die_errno("unable to seek in reused packfile");
+	/*
+	 * The first chunk starts at the first object, so "lo" is at least
+	 * 1 for any offset of an object.
+	 */
+	assert(lo);
+	return reused_chunks[lo - 1].difference;
+}
 
-	if (reuse_packfile_offset < 0)
-		reuse_packfile_offset = reuse_packfile->pack_size - the_hash_algo->rawsz;
+static void write_reused_pack_one(size_t pos, struct hashfile *dest,
+				  struct pack_window **w_curs)
+{
+	off_t offset, next, cur;
+	enum object_type type;
+	unsigned long size;
 
-	total = to_write = reuse_packfile_offset - sizeof(struct pack_header);
+	offset = pack_pos_to_offset(reuse_packfile, pos);
+	next = pack_pos_to_offset(reuse_packfile, pos + 1);
 
-	while (to_write) {
-		int read_pack = xread(fd, buffer, sizeof(buffer));
+	record_reused_object(offset, offset - hashfile_total(dest));
 
-		if (read_pack <= 0)
-			die_errno("unable to read from reused packfile");
+	cur = offset;
+	type = unpack_object_header(reuse_packfile, w_curs, &cur, &size);
+	assert(type >= 0);
 
-		if (read_pack > to_write)
-			read_pack = to_write;
+	if (type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		off_t fixup;
+		unsigned char header[MAX_PACK_OBJECT_HEADER];
+		unsigned len;
 
-		hashwrite(f, buffer, read_pack);
-		to_write -= read_pack;
+		base_offset = get_delta_base(reuse_packfile, w_curs, &cur,
+					     type, offset);
+		assert(base_offset != 0);
 
 		/*
-		 * We don't know the actual number of objects written,
-		 * only how many bytes written, how many bytes total, and
-		 * how many objects total. So we can fake it by pretending all
-		 * objects we are writing are the same size. This gives us a
-		 * smooth progress meter, and at the end it matches the true
-		 * answer.
+		 * If objects were left out between the base and the delta,
+		 * the delta has to point less far back.
 		 */
-		written = reuse_packfile_objects *
-				(((double)(total - to_write)) / total);
+		fixup = find_reused_offset(offset) -
+			find_reused_offset(base_offset);
+		if (fixup) {
+			unsigned char ofs_header[10];
+			unsigned i, ofs_len;
+			off_t ofs = offset - base_offset - fixup;
+
+			len = encode_in_pack_object_header(header, sizeof(header),
+							   OBJ_OFS_DELTA, size);
+
+			i = sizeof(ofs_header) - 1;
+			ofs_header[i] = ofs & 127;
+			while (ofs >>= 7)
+				ofs_header[--i] = 128 | (--ofs & 127);
+
+			ofs_len = sizeof(ofs_header) - i;
+
+			hashwrite(dest, header, len);
+			hashwrite(dest, ofs_header + sizeof(ofs_header) - ofs_len, ofs_len);
+			copy_pack_data(dest, reuse_packfile, w_curs, cur, next - cur);
+			return;
+		}
+	}
+
+	copy_pack_data(dest, reuse_packfile, w_curs, offset, next - offset);
+}
+
+/* Copy the leading words of objects that are reused whole in one go */
+static size_t write_reused_pack_verbatim(struct hashfile *out,
+					 struct pack_window **w_curs)
+{
+	size_t pos = 0;
+
+	while (pos < reuse_packfile_bitmap->word_alloc &&
+	       reuse_packfile_bitmap->words[pos] == (eword_t)~0)
+		pos++;
+
+	if (pos) {
+		off_t to_write;
+
+		written = (pos * BITS_IN_EWORD);
+		to_write = pack_pos_to_offset(reuse_packfile, written) -
+			sizeof(struct pack_header);
+
+		/* We're recording one chunk, not one object. */
+		record_reused_object(sizeof(struct pack_header), 0);
+		copy_pack_data(out, reuse_packfile, w_curs,
+			       sizeof(struct pack_header), to_write);
+
 		display_progress(progress_state, written);
 	}
+	return pos;
+}
 
-	close(fd);
-	written = reuse_packfile_objects;
-	display_progress(progress_state, written);
-	return reuse_packfile_offset - sizeof(struct pack_header);
+static void write_reused_pack(struct hashfile *f)
+{
+	size_t i = 0;
+	uint32_t offset;
+	struct pack_window *w_curs = NULL;
+
+	if (!is_pack_valid(reuse_packfile))
+		die("packfile is invalid: %s", reuse_packfile->pack_name);
+
+	i = write_reused_pack_verbatim(f, &w_curs);
+
+	for (; i < reuse_packfile_bitmap->word_alloc; ++i) {
+		eword_t word = reuse_packfile_bitmap->words[i];
+		size_t pos = (i * BITS_IN_EWORD);
+
+		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			write_reused_pack_one(pos + offset, f, &w_curs);
+			display_progress(progress_state, ++written);
+		}
+	}
+
+	unuse_pack(&w_curs);
 }
 
 static const char no_split_warning[] = N_(
 "disabling bitmap writing, packs are split due to pack.packSizeLimit"
 );
 
+static int idx_entry_oid_cmp(const void *a_, const void *b_)
+{
+	const struct pack_idx_entry *a = *(const struct pack_idx_entry **)a_;
+	const struct pack_idx_entry *b = *(const struct pack_idx_entry **)b_;
+
+	return oidcmp(&a->oid, &b->oid);
+}
+
+/*
+ * Write the .mtimes file of the cruft pack "oid" just written, next to
+ * where finish_tmp_packfile() is about to put it: the .idx is what
+ * makes the pack visible, so the .mtimes must be there first.
+ */
+static void write_cruft_mtimes(struct strbuf *name_buffer,
+			       const struct object_id *oid)
+{
+	struct pack_idx_entry **sorted;
+	uint32_t *mtimes, i;
+	const char *tmp_name;
+	size_t baselen = name_buffer->len;
+
+	ALLOC_ARRAY(sorted, nr_written);
+	COPY_ARRAY(sorted, written_list, nr_written);
+	QSORT(sorted, nr_written, idx_entry_oid_cmp);
+	ALLOC_ARRAY(mtimes, nr_written);
+	for (i = 0; i < nr_written; i++)
+		mtimes[i] = oe_cruft_mtime(&to_pack,
+					   (struct object_entry *)sorted[i]);
+
+	tmp_name = write_mtimes_file(NULL, mtimes, nr_written, oid->hash);
+	if (adjust_shared_perm(tmp_name))
+		die_errno("unable to make temporary mtimes file readable");
+	strbuf_addf(name_buffer, "%s.mtimes", oid_to_hex(oid));
+	if (rename(tmp_name, name_buffer->buf))
+		die_errno("unable to rename temporary mtimes file");
+	strbuf_setlen(name_buffer, baselen);
+
+	free((void *)tmp_name);
+	free(mtimes);
+	free(sorted);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -836,11 +1008,9 @@ static void write_pack_file(void)
 		offset = write_pack_header(f, nr_remaining);
 
 		if (reuse_packfile) {
-			off_t packfile_size;
 			assert(pack_to_stdout);
-
-			packfile_size = write_reused_pack(f);
-			offset += packfile_size;
+			write_reused_pack(f);
+			offset = hashfile_total(f);
 		}
 
 		nr_written = 0;
@@ -901,6 +1071,9 @@ static void write_pack_file(void)
 					&to_pack, written_list, nr_written);
 			}
 
+			if (cruft)
+				write_cruft_mtimes(&tmpname, &oid);
+
 			finish_tmp_packfile(&tmpname, pack_tmp_name,
 					    written_list, nr_written,
 					    &pack_idx_opts, oid.hash);
@@ -981,6 +1154,15 @@ static int have_duplicate_entry(const struct object_id *oid,
 	return 1;
 }
 
+static void mark_packfile_uri_used(struct packed_git *p)
+{
+	int i;
+
+	for (i = 0; i < packfile_uris_nr; i++)
+		if (packfile_uris[i].pack == p)
+			packfile_uris[i].used = 1;
+}
+
 static int want_found_object(int exclude, struct packed_git *p)
 {
 	if (exclude)
@@ -1009,10 +1191,12 @@ static int want_found_object(int exclude, struct packed_git *p)
 
 	if (local && !p->pack_local)
 		return 0;
-	if (p->pack_local &&
-	    ((ignore_packed_keep_on_disk && p->pack_keep) ||
-	     (ignore_packed_keep_in_core && p->pack_keep_in_core)))
+	if (p->pack_local && ignore_packed_keep_on_disk && p->pack_keep)
+		return 0;
+	if (p->pack_local && ignore_packed_keep_in_core && p->pack_keep_in_core) {
+		mark_packfile_uri_used(p);
 		return 0;
+	}
 
 	/* we don't know yet; keep looking for more packs */
 	return -1;
@@ -1494,17 +1678,18 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
 		}
 
-		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL))) {
+		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL)) &&
+		    in_same_island(&entry->idx.oid, &base_entry->idx.oid)) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1820,6 +2005,11 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
+	if (use_delta_islands) {
+		int island_cmp = island_delta_cmp(&a->idx.oid, &b->idx.oid);
+		if (island_cmp)
+			return island_cmp;
+	}
 	if (a_size > b_size)
 		return -1;
 	if (a_size < b_size)
@@ -1875,6 +2065,29 @@ static pthread_mutex_t progress_mutex;
 
 #endif
 
+/*
+ * How much memory the window of a search thread may hold.  Under a
+ * memory limit, the threads share what the delta cache does not hold
+ * at the moment, so they can keep larger windows until it fills up.
+ */
+static unsigned long window_limit(void)
+{
+	unsigned long limit = window_memory_limit, share;
+
+	if (!search_memory)
+		return limit;
+	cache_lock();
+	share = search_memory > delta_cache_size ?
+		search_memory - delta_cache_size : 0;
+	cache_unlock();
+	share /= delta_search_threads;
+	if (!share)
+		share = 1;
+	if (!limit || share < limit)
+		limit = share;
+	return limit;
+}
+
 /*
  * Return the size of the object without doing any delta
  * reconstruction (so non-deltas are true object sizes, but deltas
@@ -1948,6 +2161,10 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (src->depth >= max_depth)
 		return 0;
 
+	/* Do not form deltas that cross an island boundary. */
+	if (use_delta_islands && !in_same_island(&trg_entry->idx.oid, &src_entry->idx.oid))
+		return 0;
+
 	/* Now some size filtering heuristics. */
 	trg_size = SIZE(trg_entry);
 	if (!DELTA(trg_entry)) {
@@ -2096,7 +2313,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 {
 	uint32_t i, idx = 0, count = 0;
 	struct unpacked *array;
-	unsigned long mem_usage = 0;
+	unsigned long mem_usage = 0, limit;
 
 	array = xcalloc(window, sizeof(struct unpacked));
 
@@ -2112,18 +2329,17 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		}
 		entry = *list++;
 		(*list_size)--;
-		if (!entry->preferred_base) {
+		if (!entry->preferred_base)
 			(*processed)++;
-			display_progress(progress_state, *processed);
-		}
 		progress_unlock();
+		if (!entry->preferred_base)
+			progress_add(progress_state, 1);
 
 		mem_usage -= free_unpacked(n);
 		n->entry = entry;
 
-		while (window_memory_limit &&
-		       mem_usage > window_memory_limit &&
-		       count > 1) {
+		limit = window_limit();
+		while (limit && mem_usage > limit && count > 1) {
 			uint32_t tail = (idx + window - count) % window;
 			mem_usage -= free_unpacked(array + tail);
 			count--;
@@ -2245,12 +2461,12 @@ static void try_to_free_from_threads(size_t size)
 static try_to_free_t old_try_to_free_routine;
 
 /*
- * The main thread waits on the condition that (at least) one of the workers
- * has stopped working (which is indicated in the .working member of
- * struct thread_params).
- * When a work thread has completed its work, it sets .working to 0 and
- * signals the main thread and waits on the condition that .data_ready
- * becomes 1.
+ * Each thread searches for deltas in a segment of the object list. A
+ * thread that is done with its segment steals the second half of the
+ * largest segment that another thread has not processed yet, and exits
+ * when no segment is left that is worth splitting. The segment being
+ * searched only shrinks from its end, under progress_mutex, so the
+ * owner of a segment never notices that half of it was stolen.
  */
 
 struct thread_params {
@@ -2260,14 +2476,15 @@ struct thread_params {
 	unsigned remaining;
 	int window;
 	int depth;
-	int working;
-	int data_ready;
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
 	unsigned *processed;
+
+	/* statistics, for GIT_TRACE_PERFORMANCE */
+	uint64_t busy_ns;
+	unsigned nr_objects;
+	int nr_steals;
 };
 
-static pthread_cond_t progress_cond;
+static struct thread_params *search_threads;
 
 /*
  * Mutex and conditional variable can't be statically-initialized on Windows.
@@ -2277,53 +2494,101 @@ static void init_threaded_search(void)
 	init_recursive_mutex(&read_mutex);
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
-	pthread_cond_init(&progress_cond, NULL);
 	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
 }
 
 static void cleanup_threaded_search(void)
 {
 	set_try_to_free_routine(old_try_to_free_routine);
-	pthread_cond_destroy(&progress_cond);
 	pthread_mutex_destroy(&read_mutex);
 	pthread_mutex_destroy(&cache_mutex);
 	pthread_mutex_destroy(&progress_mutex);
 }
 
+static int same_path_group(struct object_entry **pos)
+{
+	return pos[0]->hash && pos[0]->hash == pos[-1]->hash;
+}
+
+/*
+ * Find where to split the "size" objects at the end of "list" so that
+ * the second part gets about half of them. Objects of the same path
+ * are most likely to delta against each other; prefer the path
+ * boundary closest to the middle, as long as each part keeps at least
+ * a quarter of the objects. Return the number of objects that go into
+ * the second part.
+ */
+static unsigned split_segment(struct object_entry **list, unsigned size)
+{
+	struct object_entry **end = list + size;
+	unsigned half = size / 2, d;
+
+	for (d = 0; d <= size / 4; d++) {
+		if (!same_path_group(end - half + d))
+			return half - d;
+		if (d && !same_path_group(end - half - d))
+			return half + d;
+	}
+
+	/*
+	 * It is possible for some "paths" to have so many objects that
+	 * no hash boundary might be found. Let's just steal the exact
+	 * half in that case.
+	 */
+	return half;
+}
+
+/*
+ * Give "me" the second half of the largest segment left, if any is
+ * worth splitting. Must be called with progress_mutex held.
+ */
+static int steal_work(struct thread_params *me)
+{
+	struct thread_params *victim = NULL;
+	unsigned sub_size;
+	int i;
+
+	for (i = 0; i < delta_search_threads; i++) {
+		struct thread_params *p = &search_threads[i];
+
+		if (p->remaining > 2*p->window &&
+		    (!victim || victim->remaining < p->remaining))
+			victim = p;
+	}
+	if (!victim)
+		return 0;
+
+	sub_size = split_segment(victim->list + victim->list_size -
+				 victim->remaining, victim->remaining);
+	me->list = victim->list + victim->list_size - sub_size;
+	me->list_size = sub_size;
+	me->remaining = sub_size;
+	me->nr_objects += sub_size;
+	me->nr_steals++;
+	victim->list_size -= sub_size;
+	victim->remaining -= sub_size;
+	victim->nr_objects -= sub_size;
+	return 1;
+}
+
 static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
+	int more;
 
-	progress_lock();
-	while (me->remaining) {
-		progress_unlock();
+	trace2_thread_start("find_deltas");
+	do {
+		uint64_t start = getnanotime();
 
 		find_deltas(me->list, &me->remaining,
 			    me->window, me->depth, me->processed);
+		me->busy_ns += getnanotime() - start;
 
 		progress_lock();
-		me->working = 0;
-		pthread_cond_signal(&progress_cond);
+		more = steal_work(me);
 		progress_unlock();
-
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
-		pthread_mutex_lock(&me->mutex);
-		while (!me->data_ready)
-			pthread_cond_wait(&me->cond, &me->mutex);
-		me->data_ready = 0;
-		pthread_mutex_unlock(&me->mutex);
-
-		progress_lock();
-	}
-	progress_unlock();
-	/* leave ->working 1 so that this doesn't get more work assigned */
+	} while (more);
+	trace2_thread_exit();
 	return NULL;
 }
 
@@ -2331,7 +2596,8 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
 	struct thread_params *p;
-	int i, ret, active_threads = 0;
+	uint64_t start, elapsed;
+	int i, ret;
 
 	init_threaded_search();
 
@@ -2343,7 +2609,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	if (progress > pack_to_stdout)
 		fprintf(stderr, "Delta compression using up to %d threads.\n",
 				delta_search_threads);
-	p = xcalloc(delta_search_threads, sizeof(*p));
+	p = search_threads = xcalloc(delta_search_threads, sizeof(*p));
 
 	/* Partition the work amongst work threads. */
 	for (i = 0; i < delta_search_threads; i++) {
@@ -2356,8 +2622,6 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		p[i].window = window;
 		p[i].depth = depth;
 		p[i].processed = processed;
-		p[i].working = 1;
-		p[i].data_ready = 0;
 
 		/* try to split chunks on "path" boundaries */
 		while (sub_size && sub_size < list_size &&
@@ -2368,92 +2632,37 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		p[i].list = list;
 		p[i].list_size = sub_size;
 		p[i].remaining = sub_size;
+		p[i].nr_objects = sub_size;
 
 		list += sub_size;
 		list_size -= sub_size;
 	}
 
-	/* Start work threads. */
+	/*
+	 * Start work threads. Those without a segment of their own start
+	 * by stealing one; the threads find each other's segments in
+	 * search_threads, so the partition must be complete by now.
+	 */
+	start = getnanotime();
 	for (i = 0; i < delta_search_threads; i++) {
-		if (!p[i].list_size)
-			continue;
-		pthread_mutex_init(&p[i].mutex, NULL);
-		pthread_cond_init(&p[i].cond, NULL);
 		ret = pthread_create(&p[i].thread, NULL,
 				     threaded_find_deltas, &p[i]);
 		if (ret)
 			die("unable to create thread: %s", strerror(ret));
-		active_threads++;
 	}
+	for (i = 0; i < delta_search_threads; i++)
+		pthread_join(p[i].thread, NULL);
+	elapsed = getnanotime() - start;
 
-	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
-	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		unsigned sub_size = 0;
-
-		progress_lock();
-		for (;;) {
-			for (i = 0; !target && i < delta_search_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			pthread_cond_wait(&progress_cond, &progress_mutex);
-		}
-
-		for (i = 0; i < delta_search_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
-			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
-		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1;
-		progress_unlock();
-
-		pthread_mutex_lock(&target->mutex);
-		target->data_ready = 1;
-		pthread_cond_signal(&target->cond);
-		pthread_mutex_unlock(&target->mutex);
-
-		if (!sub_size) {
-			pthread_join(target->thread, NULL);
-			pthread_cond_destroy(&target->cond);
-			pthread_mutex_destroy(&target->mutex);
-			active_threads--;
-		}
+	for (i = 0; i < delta_search_threads; i++) {
+		trace_performance(p[i].busy_ns,
+				  "delta search thread %d: %d%% busy, "
+				  "%u objects, %d segments stolen",
+				  i, elapsed ? (int)(p[i].busy_ns * 100 / elapsed) : 100,
+				  p[i].nr_objects, p[i].nr_steals);
 	}
 	cleanup_threaded_search();
-	free(p);
+	FREE_AND_NULL(search_threads);
 }
 
 #else
@@ -2500,6 +2709,56 @@ static int add_ref_tag(const char *path, const struct object_id *oid, int flag,
 	return 0;
 }
 
+/*
+ * Fit the delta search of the "n" objects of "list" into memory_limit.
+ * The object list itself has to be there, and is taken out first.  Of
+ * the rest, the delta base cache gets an eighth at most, and the delta
+ * cache a quarter; the windows of the threads get what is left, and
+ * what the delta cache does not use (see window_limit()).  There are
+ * only as many threads as can hold a full window of objects of the
+ * average size.
+ */
+static void fit_memory_limit(struct object_entry **list, unsigned n,
+			     int window)
+{
+	uint64_t fixed, rest, avg, full_window;
+	int threads;
+	unsigned i;
+
+	fixed = st_mult(to_pack.nr_alloc, sizeof(struct object_entry)) +
+		st_mult(n, sizeof(*list));
+	if (fixed >= memory_limit)
+		warning(_("memory limit of %lu is too low for %"PRIu32" objects"),
+			memory_limit, to_pack.nr_objects);
+	rest = fixed < memory_limit ? memory_limit - fixed : 0;
+
+	if (delta_base_cache_limit > rest / 8)
+		delta_base_cache_limit = rest / 8;
+	if (!max_delta_cache_size || max_delta_cache_size > rest / 4)
+		max_delta_cache_size = rest / 4 ? rest / 4 : 1;
+	search_memory = rest - delta_base_cache_limit;
+	if (!search_memory)
+		search_memory = 1;
+
+	for (i = avg = 0; i < n; i++)
+		avg += SIZE(list[i]);
+	avg /= n;
+	full_window = (window + 1) * avg;
+	threads = full_window ?
+		(search_memory - max_delta_cache_size) / full_window : 0;
+	if (threads < 1)
+		threads = 1;
+	if (threads < delta_search_threads)
+		delta_search_threads = threads;
+
+	trace2_data_intmax("pack-objects", "memory-limit/threads",
+			   delta_search_threads);
+	trace2_data_intmax("pack-objects", "memory-limit/delta-cache",
+			   max_delta_cache_size);
+	trace2_data_intmax("pack-objects", "memory-limit/search",
+			   search_memory);
+}
+
 static void prepare_pack(int window, int depth)
 {
 	struct object_entry **delta_list;
@@ -2564,6 +2823,8 @@ static void prepare_pack(int window, int depth)
 			progress_state = start_progress(_("Compressing objects"),
 							nr_deltas);
 		QSORT(delta_list, n, type_size_sort);
+		if (memory_limit)
+			fit_memory_limit(delta_list, n, window);
 		ll_find_deltas(delta_list, n, window+1, depth, &nr_done);
 		stop_progress(&progress_state);
 		if (nr_done != nr_deltas)
@@ -2582,6 +2843,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		window_memory_limit = git_config_ulong(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.memorylimit")) {
+		memory_limit = git_config_ulong(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.depth")) {
 		depth = git_config_int(k, v);
 		return 0;
@@ -2600,6 +2865,18 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "uploadpack.packfileuri")) {
+		if (!v)
+			return config_error_nonbool(k);
+		string_list_append(&packfile_uri_config, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -2624,6 +2901,15 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
+	if (!strcmp(k, "pack.island"))
+		return island_config_callback(k, v, cb);
 	return git_default_config(k, v, cb);
 }
 
@@ -2669,6 +2955,9 @@ static void show_commit(struct commit *commit, void *data)
 
 	if (write_bitmap_index)
 		index_commit_for_bitmap(commit);
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj, const char *name, void *data)
@@ -2676,6 +2965,21 @@ static void show_object(struct object *obj, const char *name, void *data)
 	add_preferred_base_object(name);
 	add_object_entry(&obj->oid, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
+
+	if (use_delta_islands) {
+		const char *p;
+		unsigned depth;
+		struct object_entry *ent;
+
+		/* the empty string is a root tree, which is depth 0 */
+		depth = *name ? 1 : 0;
+		for (p = strchr(name, '/'); p; p = strchr(p + 1, '/'))
+			depth++;
+
+		ent = packlist_find(&to_pack, obj->oid.hash, NULL);
+		if (ent && depth > oe_tree_depth(&to_pack, ent))
+			oe_set_tree_depth(&to_pack, ent, depth);
+	}
 }
 
 static void show_object__ma_allow_any(struct object *obj, const char *name, void *data)
@@ -2776,44 +3080,128 @@ static int ofscmp(const void *a_, const void *b_)
 		return oidcmp(&a->object->oid, &b->object->oid);
 }
 
+static void add_pack_to_in_pack(struct packed_git *p, struct in_pack *in_pack)
+{
+	struct object_id oid;
+	struct object *o;
+	uint32_t i;
+
+	if (open_pack_index(p))
+		die("cannot open pack index");
+
+	ALLOC_GROW(in_pack->array,
+		   in_pack->nr + p->num_objects,
+		   in_pack->alloc);
+
+	for (i = 0; i < p->num_objects; i++) {
+		nth_packed_object_oid(&oid, p, i);
+		o = lookup_unknown_object(oid.hash);
+		if (!(o->flags & OBJECT_ADDED))
+			mark_in_pack_object(o, p, in_pack);
+		o->flags |= OBJECT_ADDED;
+	}
+}
+
+static void add_in_pack_objects(struct in_pack *in_pack)
+{
+	uint32_t i;
+
+	if (in_pack->nr) {
+		QSORT(in_pack->array, in_pack->nr, ofscmp);
+		for (i = 0; i < in_pack->nr; i++) {
+			struct object *o = in_pack->array[i].object;
+			add_object_entry(&o->oid, o->type, "", 0);
+		}
+	}
+	free(in_pack->array);
+}
+
 static void add_objects_in_unpacked_packs(struct rev_info *revs)
 {
 	struct packed_git *p;
 	struct in_pack in_pack;
-	uint32_t i;
 
 	memset(&in_pack, 0, sizeof(in_pack));
 
 	for (p = get_packed_git(the_repository); p; p = p->next) {
-		struct object_id oid;
-		struct object *o;
-
 		if (!p->pack_local || p->pack_keep || p->pack_keep_in_core)
 			continue;
-		if (open_pack_index(p))
-			die("cannot open pack index");
+		add_pack_to_in_pack(p, &in_pack);
+	}
+	add_in_pack_objects(&in_pack);
+}
 
-		ALLOC_GROW(in_pack.array,
-			   in_pack.nr + p->num_objects,
-			   in_pack.alloc);
+/*
+ * Read the names of local packs from the standard input, one per line,
+ * into "include", or into "exclude" for those named with a leading '^'.
+ * The objects of the excluded packs are left out like those of
+ * --keep-pack.
+ */
+static void read_packs_list(struct string_list *include,
+			    struct string_list *exclude)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list_item *item;
+	struct packed_git *p;
 
-		for (i = 0; i < p->num_objects; i++) {
-			nth_packed_object_oid(&oid, p, i);
-			o = lookup_unknown_object(oid.hash);
-			if (!(o->flags & OBJECT_ADDED))
-				mark_in_pack_object(o, p, &in_pack);
-			o->flags |= OBJECT_ADDED;
-		}
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		if (!buf.len)
+			continue;
+		if (*buf.buf == '^')
+			string_list_append(exclude, buf.buf + 1);
+		else
+			string_list_append(include, buf.buf);
 	}
+	string_list_sort(include);
+	string_list_sort(exclude);
 
-	if (in_pack.nr) {
-		QSORT(in_pack.array, in_pack.nr, ofscmp);
-		for (i = 0; i < in_pack.nr; i++) {
-			struct object *o = in_pack.array[i].object;
-			add_object_entry(&o->oid, o->type, "", 0);
-		}
+	for (p = get_packed_git(the_repository); p; p = p->next) {
+		const char *name = basename(p->pack_name);
+
+		if (!p->pack_local)
+			continue;
+		item = string_list_lookup(include, name);
+		if (!item)
+			item = string_list_lookup(exclude, name);
+		if (item)
+			item->util = p;
 	}
-	free(in_pack.array);
+
+	for_each_string_list_item(item, include)
+		if (!item->util)
+			die(_("could not find pack '%s'"), item->string);
+	for_each_string_list_item(item, exclude) {
+		p = item->util;
+		if (!p)
+			die(_("could not find pack '%s'"), item->string);
+		p->pack_keep_in_core = 1;
+		ignore_packed_keep_in_core = 1;
+	}
+	strbuf_release(&buf);
+}
+
+/*
+ * Pack all the objects of the packs listed on the standard input (see
+ * read_packs_list()).  There is no traversal: the objects go out in
+ * the order they were in, without the names that help to find deltas,
+ * but the deltas that are already there are kept.
+ */
+static void read_packs_list_from_stdin(void)
+{
+	struct string_list include = STRING_LIST_INIT_DUP;
+	struct string_list exclude = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	struct in_pack in_pack;
+
+	read_packs_list(&include, &exclude);
+
+	memset(&in_pack, 0, sizeof(in_pack));
+	for_each_string_list_item(item, &include)
+		add_pack_to_in_pack(item->util, &in_pack);
+	add_in_pack_objects(&in_pack);
+
+	string_list_clear(&include, 0);
+	string_list_clear(&exclude, 0);
 }
 
 static int add_loose_object(const struct object_id *oid, const char *path,
@@ -2867,6 +3255,191 @@ static int has_sha1_pack_kept_or_nonlocal(const struct object_id *oid)
 	return 0;
 }
 
+/*
+ * With --cruft, the objects to pack are those of the packs listed on
+ * the standard input and the loose ones, less those of the packs
+ * excluded with '^' (usually, the pack of everything reachable that
+ * was just written) and of kept packs.  Each goes into the .mtimes
+ * file with the time it was last written, or the latest of them if
+ * there are copies.  With --cruft-expiration, objects not written
+ * since are left out, unless a more recent one needs them.
+ */
+struct cruft_object {
+	struct oidmap_entry entry;
+	uint32_t mtime;
+	unsigned keep:1;
+};
+
+static struct oidmap cruft_objects;
+static struct cruft_object **cruft_list;
+static size_t cruft_nr, cruft_alloc;
+
+static void add_cruft_candidate(const struct object_id *oid, time_t mtime)
+{
+	struct cruft_object *c;
+
+	c = oidmap_get(&cruft_objects, oid);
+	if (c) {
+		if (c->mtime < mtime)
+			c->mtime = mtime;
+		return;
+	}
+	if (has_sha1_pack_kept_or_nonlocal(oid))
+		return;
+
+	c = xcalloc(1, sizeof(*c));
+	oidcpy(&c->entry.oid, oid);
+	c->mtime = mtime;
+	oidmap_put(&cruft_objects, c);
+	ALLOC_GROW(cruft_list, cruft_nr + 1, cruft_alloc);
+	cruft_list[cruft_nr++] = c;
+}
+
+static void add_cruft_pack(struct packed_git *p)
+{
+	struct object_id oid;
+	uint32_t pos;
+
+	if (open_pack_index(p))
+		die(_("cannot open pack index"));
+
+	/* in pack order, as add_in_pack_objects() would */
+	for (pos = 0; pos < p->num_objects; pos++) {
+		uint32_t nr = pack_pos_to_index(p, pos);
+
+		nth_packed_object_oid(&oid, p, nr);
+		add_cruft_candidate(&oid, packed_object_mtime(p, nr));
+	}
+}
+
+static int add_cruft_loose_object(const struct object_id *oid,
+				  const char *path, void *data)
+{
+	struct stat st;
+
+	if (lstat(path, &st) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		return error_errno(_("unable to stat %s"), path);
+	}
+	add_cruft_candidate(oid, st.st_mtime);
+	return 0;
+}
+
+static void keep_cruft_object(const struct object_id *oid,
+			      struct cruft_object ***stack,
+			      size_t *nr, size_t *alloc)
+{
+	struct cruft_object *c = oidmap_get(&cruft_objects, oid);
+
+	if (!c || c->keep)
+		return;
+	c->keep = 1;
+	ALLOC_GROW(*stack, *nr + 1, *alloc);
+	(*stack)[(*nr)++] = c;
+}
+
+/*
+ * Keep the recent cruft objects, and those they refer to.  Anything
+ * they refer to that is not cruft is reachable, and so are all of its
+ * links, so the walk stays among the cruft objects.
+ */
+static void keep_recent_cruft(void)
+{
+	struct cruft_object **stack = NULL;
+	size_t nr = 0, alloc = 0, i;
+
+	for (i = 0; i < cruft_nr; i++)
+		if (cruft_list[i]->mtime > cruft_expiration)
+			keep_cruft_object(&cruft_list[i]->entry.oid,
+					  &stack, &nr, &alloc);
+
+	while (nr) {
+		const struct object_id *oid = &stack[--nr]->entry.oid;
+
+		switch (oid_object_info(the_repository, oid, NULL)) {
+		case OBJ_COMMIT: {
+			struct commit *commit = lookup_commit(oid);
+			struct commit_list *parents;
+
+			if (!commit || parse_commit(commit))
+				break;
+			keep_cruft_object(get_commit_tree_oid(commit),
+					  &stack, &nr, &alloc);
+			for (parents = commit->parents; parents; parents = parents->next)
+				keep_cruft_object(&parents->item->object.oid,
+						  &stack, &nr, &alloc);
+			break;
+		}
+		case OBJ_TREE: {
+			struct tree *tree = lookup_tree(oid);
+			struct tree_desc desc;
+			struct name_entry entry;
+
+			if (!tree || parse_tree(tree))
+				break;
+			init_tree_desc(&desc, tree->buffer, tree->size);
+			while (tree_entry(&desc, &entry))
+				if (!S_ISGITLINK(entry.mode))
+					keep_cruft_object(entry.oid,
+							  &stack, &nr, &alloc);
+			free_tree_buffer(tree);
+			break;
+		}
+		case OBJ_TAG: {
+			struct tag *tag = lookup_tag(oid);
+
+			if (!tag || parse_tag(tag) || !tag->tagged)
+				break;
+			keep_cruft_object(&tag->tagged->oid,
+					  &stack, &nr, &alloc);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	free(stack);
+}
+
+static void read_cruft_objects(void)
+{
+	struct string_list discard = STRING_LIST_INIT_DUP;
+	struct string_list fresh = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	size_t i;
+
+	read_packs_list(&discard, &fresh);
+
+	oidmap_init(&cruft_objects, 0);
+	for_each_string_list_item(item, &discard)
+		add_cruft_pack(item->util);
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      add_cruft_loose_object,
+				      NULL, NULL, NULL);
+
+	if (cruft_expiration)
+		keep_recent_cruft();
+
+	for (i = 0; i < cruft_nr; i++) {
+		struct cruft_object *c = cruft_list[i];
+		struct object_entry *entry;
+
+		if (cruft_expiration && !c->keep)
+			continue;
+		if (!add_object_entry(&c->entry.oid, OBJ_NONE, "", 0))
+			continue;
+		entry = packlist_find(&to_pack, c->entry.oid.hash, NULL);
+		oe_set_cruft_mtime(&to_pack, entry, c->mtime);
+	}
+
+	oidmap_free(&cruft_objects, 1);
+	FREE_AND_NULL(cruft_list);
+	cruft_nr = cruft_alloc = 0;
+	string_list_clear(&discard, 0);
+	string_list_clear(&fresh, 0);
+}
+
 /*
  * Store a list of sha1s that are should not be discarded
  * because they are either written too recently, or are
@@ -2930,7 +3503,7 @@ static int pack_options_allow_reuse(void)
 static int get_object_list_from_bitmap(struct rev_info *revs)
 {
 	struct bitmap_index *bitmap_git;
-	if (!(bitmap_git = prepare_bitmap_walk(revs)))
+	if (!(bitmap_git = prepare_bitmap_walk(revs, &filter_options)))
 		return -1;
 
 	if (pack_options_allow_reuse() &&
@@ -2938,9 +3511,11 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 			bitmap_git,
 			&reuse_packfile,
 			&reuse_packfile_objects,
-			&reuse_packfile_offset)) {
+			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
+		trace2_data_intmax("pack-objects", "reused-verbatim",
+				   reuse_packfile_objects);
 		display_progress(progress_state, nr_result);
 	}
 
@@ -2969,6 +3544,7 @@ static void get_object_list(int ac, const char **av)
 
 	init_revisions(&revs, NULL);
 	save_commit_buffer = 0;
+	revs.compact_blobs = core_compact_object_walk;
 	setup_revisions(ac, av, &revs, NULL);
 
 	/* make sure shallows are read */
@@ -3003,6 +3579,9 @@ static void get_object_list(int ac, const char **av)
 	if (use_bitmap_index && !get_object_list_from_bitmap(&revs))
 		return;
 
+	if (use_delta_islands)
+		load_delta_islands(progress);
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(&revs, show_edge);
@@ -3013,6 +3592,9 @@ static void get_object_list(int ac, const char **av)
 				      show_commit, fn_show_object, NULL,
 				      NULL);
 
+	if (use_delta_islands)
+		resolve_tree_islands(progress, &to_pack);
+
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
 		if (add_unseen_recent_objects_to_traversal(&revs,
@@ -3060,6 +3642,76 @@ static void add_extra_kept_packs(const struct string_list *names)
 	}
 }
 
+/*
+ * Leave out the objects of the packs configured with a URI that uses one
+ * of the protocols given with --uri-protocol, like those of --keep-pack.
+ */
+static void add_packfile_uris(void)
+{
+	struct string_list_item *item;
+
+	if (!uri_protocols.nr)
+		return;
+
+	for_each_string_list_item(item, &packfile_uri_config) {
+		struct object_id hash;
+		const char *uri, *colon;
+		struct packed_git *p;
+		int i;
+
+		if (parse_oid_hex(item->string, &hash, &uri) || *uri++ != ' ')
+			die(_("invalid value for uploadpack.packfileURI: '%s'"),
+			    item->string);
+		colon = strchr(uri, ':');
+		for (i = 0; colon && i < uri_protocols.nr; i++)
+			if (!strncmp(uri, uri_protocols.items[i].string,
+				     colon - uri) &&
+			    !uri_protocols.items[i].string[colon - uri])
+				break;
+		if (!colon || i == uri_protocols.nr)
+			continue;
+
+		for (p = get_packed_git(the_repository); p; p = p->next)
+			if (p->pack_local && !hashcmp(p->sha1, hash.hash))
+				break;
+		if (!p) {
+			warning(_("ignoring URI of unknown pack %s"),
+				oid_to_hex(&hash));
+			continue;
+		}
+
+		ALLOC_GROW(packfile_uris, packfile_uris_nr + 1,
+			   packfile_uris_alloc);
+		packfile_uris[packfile_uris_nr].pack = p;
+		packfile_uris[packfile_uris_nr].uri = uri;
+		packfile_uris[packfile_uris_nr].used = 0;
+		packfile_uris_nr++;
+
+		p->pack_keep_in_core = 1;
+		ignore_packed_keep_in_core = 1;
+	}
+}
+
+/*
+ * Tell our reader which of the packs with a URI it has to download,
+ * before the pack data itself.
+ */
+static void write_packfile_uris(void)
+{
+	struct strbuf out = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < packfile_uris_nr; i++) {
+		if (!packfile_uris[i].used)
+			continue;
+		strbuf_addf(&out, "%s %s\n",
+			    sha1_to_hex(packfile_uris[i].pack->sha1),
+			    packfile_uris[i].uri);
+	}
+	write_or_die(1, out.buf, out.len);
+	strbuf_release(&out);
+}
+
 static int option_parse_index_version(const struct option *opt,
 				      const char *arg, int unset)
 {
@@ -3093,6 +3745,7 @@ static int option_parse_unpack_unreachable(const struct option *opt,
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
+	int stdin_packs = 0;
 	int thin = 0;
 	int shallow = 0;
 	int all_progress_implied = 0;
@@ -3123,6 +3776,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			    N_("limit pack window by objects")),
 		OPT_MAGNITUDE(0, "window-memory", &window_memory_limit,
 			      N_("limit pack window by memory in addition to object limit")),
+		OPT_MAGNITUDE(0, "memory-limit", &memory_limit,
+			      N_("fit the delta search into this much memory")),
 		OPT_INTEGER(0, "depth", &depth,
 			    N_("maximum length of delta chain allowed in the resulting pack")),
 		OPT_BOOL(0, "reuse-delta", &reuse_delta,
@@ -3137,6 +3792,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not create an empty pack output")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
 			 N_("read revision arguments from standard input")),
+		OPT_BOOL(0, "stdin-packs", &stdin_packs,
+			 N_("read packs from stdin")),
+		OPT_BOOL(0, "cruft", &cruft,
+			 N_("pack the objects of the packs from stdin and loose objects into a cruft pack")),
+		OPT_EXPIRY_DATE(0, "cruft-expiration", &cruft_expiration,
+				N_("leave out cruft objects older than <time>")),
 		OPT_SET_INT_F(0, "unpacked", &rev_list_unpacked,
 			      N_("limit the objects to those that are not yet packed"),
 			      1, PARSE_OPT_NONEG),
@@ -3176,12 +3837,17 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 		{ OPTION_CALLBACK, 0, "missing", NULL, N_("action"),
 		  N_("handling for missing objects"), PARSE_OPT_NONEG,
 		  option_parse_missing_action },
 		OPT_BOOL(0, "exclude-promisor-objects", &exclude_promisor_objects,
 			 N_("do not pack objects in promisor packfiles")),
+		OPT_STRING_LIST(0, "uri-protocol", &uri_protocols,
+				N_("protocol"),
+				N_("leave out packs that can be downloaded with this protocol")),
 		OPT_END(),
 	};
 
@@ -3191,6 +3857,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	check_replace_refs = 0;
 
 	reset_pack_idx_option(&pack_idx_opts);
+	if (git_env_bool("GIT_TEST_WRITE_REV_INDEX", 0))
+		pack_idx_opts.flags |= WRITE_REV;
 	git_config(git_pack_config, NULL);
 
 	progress = isatty(2);
@@ -3236,6 +3904,20 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--indexed-objects");
 	}
+	if (stdin_packs && (use_internal_rev_list || unpack_unreachable ||
+			    keep_unreachable || pack_loose_unreachable))
+		die(_("cannot use internal rev list with --stdin-packs"));
+	if (cruft) {
+		if (stdin_packs)
+			die(_("--cruft and --stdin-packs are incompatible"));
+		if (use_internal_rev_list || rev_list_unpacked ||
+		    unpack_unreachable || keep_unreachable ||
+		    pack_loose_unreachable)
+			die(_("cannot use internal rev list with --cruft"));
+		if (pack_to_stdout)
+			die(_("--cruft cannot be used with --stdout"));
+	} else if (cruft_expiration)
+		die(_("--cruft-expiration requires --cruft"));
 	if (rev_list_unpacked) {
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--unpacked");
@@ -3280,9 +3962,16 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!rev_list_all || !rev_list_reflog || !rev_list_index)
 		unpack_unreachable_expiration = 0;
 
-	if (filter_options.choice) {
-		if (!pack_to_stdout)
-			die("cannot use --filter without --stdout.");
+	if (filter_options.choice && !pack_to_stdout)
+		die("cannot use --filter without --stdout.");
+
+	/*
+	 * Island marks are propagated from commits to their parents and
+	 * trees during the walk, which needs the commits in topological
+	 * order and cannot be done from a bitmap.
+	 */
+	if (use_delta_islands) {
+		argv_array_push(&rp, "--topo-order");
 		use_bitmap_index = 0;
 	}
 
@@ -3312,6 +4001,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		progress = 2;
 
 	add_extra_kept_packs(&keep_pack_list);
+	if (uri_protocols.nr && !pack_to_stdout)
+		die(_("--uri-protocol requires --stdout"));
+	add_packfile_uris();
 	if (ignore_packed_keep_on_disk) {
 		struct packed_git *p;
 		for (p = get_packed_git(the_repository); p; p = p->next)
@@ -3339,7 +4031,14 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress(_("Enumerating objects"), 0);
-	if (!use_internal_rev_list)
+	if (cruft)
+		read_cruft_objects();
+	else if (stdin_packs) {
+		read_packs_list_from_stdin();
+		/* with --stdin-packs, --unpacked means all loose objects */
+		if (rev_list_unpacked)
+			add_unreachable_loose_objects();
+	} else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		get_object_list(rp.argc, rp.argv);
@@ -3352,9 +4051,17 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (non_empty && !nr_result)
 		return 0;
-	if (nr_result)
+	if (packfile_uris_nr)
+		write_packfile_uris();
+	if (nr_result) {
+		trace2_region_enter("pack-objects", "prepare_pack");
 		prepare_pack(window, depth);
+		trace2_region_leave("pack-objects", "prepare_pack");
+	}
+	trace2_region_enter("pack-objects", "write_pack_file");
 	write_pack_file();
+	trace2_region_leave("pack-objects", "write_pack_file");
+	trace2_data_intmax("pack-objects", "written", written);
 	if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
 			" reused %"PRIu32" (delta %"PRIu32")\n",
@@ -9,6 +9,7 @@
 #include "run-command.h"
 #include "exec-cmd.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "object.h"
 #include "remote.h"
 #include "connect.h"
@@ -27,6 +28,7 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "protocol.h"
+#include "pack-bitmap.h"
 
 static const char * const receive_pack_usage[] = {
 	N_("git receive-pack <git-dir>"),
@@ -94,6 +96,9 @@ static enum {
 static int keepalive_in_sec = 5;
 
 static struct tmp_objdir *tmp_objdir;
+static const char *pack_lockfile;
+static struct oid_array pack_links = OID_ARRAY_INIT;
+static int have_pack_links;
 
 static enum deny_action parse_deny_action(const char *var, const char *value)
 {
@@ -312,7 +317,8 @@ struct command {
 	struct command *next;
 	const char *error_string;
 	unsigned int skip_update:1,
-		     did_not_exist:1;
+		     did_not_exist:1,
+		     ignore_old_oid:1;
 	int index;
 	struct object_id old_oid;
 	struct object_id new_oid;
@@ -622,7 +628,7 @@ static int check_cert_push_options(const struct string_list *push_options)
 	return retval;
 }
 
-static void prepare_push_cert_sha1(struct child_process *proc)
+static void prepare_push_cert_sha1(struct argv_array *env)
 {
 	static int already_done;
 
@@ -646,146 +652,88 @@ static void prepare_push_cert_sha1(struct child_process *proc)
 		nonce_status = check_nonce(push_cert.buf, bogs);
 	}
 	if (!is_null_oid(&push_cert_oid)) {
-		argv_array_pushf(&proc->env_array, "GIT_PUSH_CERT=%s",
+		argv_array_pushf(env, "GIT_PUSH_CERT=%s",
 				 oid_to_hex(&push_cert_oid));
-		argv_array_pushf(&proc->env_array, "GIT_PUSH_CERT_SIGNER=%s",
+		argv_array_pushf(env, "GIT_PUSH_CERT_SIGNER=%s",
 				 sigcheck.signer ? sigcheck.signer : "");
-		argv_array_pushf(&proc->env_array, "GIT_PUSH_CERT_KEY=%s",
+		argv_array_pushf(env, "GIT_PUSH_CERT_KEY=%s",
 				 sigcheck.key ? sigcheck.key : "");
-		argv_array_pushf(&proc->env_array, "GIT_PUSH_CERT_STATUS=%c",
+		argv_array_pushf(env, "GIT_PUSH_CERT_STATUS=%c",
 				 sigcheck.result);
 		if (push_cert_nonce) {
-			argv_array_pushf(&proc->env_array,
+			argv_array_pushf(env,
 					 "GIT_PUSH_CERT_NONCE=%s",
 					 push_cert_nonce);
-			argv_array_pushf(&proc->env_array,
+			argv_array_pushf(env,
 					 "GIT_PUSH_CERT_NONCE_STATUS=%s",
 					 nonce_status);
 			if (nonce_status == NONCE_SLOP)
-				argv_array_pushf(&proc->env_array,
+				argv_array_pushf(env,
 						 "GIT_PUSH_CERT_NONCE_SLOP=%ld",
 						 nonce_stamp_slop);
 		}
 	}
 }
 
-struct receive_hook_feed_state {
-	struct command *cmd;
-	int skip_broken;
-	struct strbuf buf;
-	const struct string_list *push_options;
-};
-
-typedef int (*feed_fn)(void *, const char **, size_t *);
-static int run_and_feed_hook(const char *hook_name, feed_fn feed,
-			     struct receive_hook_feed_state *feed_state)
+static int run_receive_hook(struct command *commands,
+			    const char *hook_name,
+			    int skip_broken,
+			    const struct string_list *push_options)
 {
-	struct child_process proc = CHILD_PROCESS_INIT;
+	struct run_hooks_opt opt = RUN_HOOKS_OPT_INIT;
+	struct strbuf input = STRBUF_INIT;
+	struct command *cmd;
 	struct async muxer;
-	const char *argv[2];
 	int code;
 
-	argv[0] = find_hook(hook_name);
-	if (!argv[0])
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (skip_broken && (cmd->error_string || cmd->did_not_exist))
+			continue;
+		strbuf_addf(&input, "%s %s %s\n",
+			    oid_to_hex(&cmd->old_oid), oid_to_hex(&cmd->new_oid),
+			    cmd->ref_name);
+	}
+	if (!input.len || !hook_exists(hook_name)) {
+		strbuf_release(&input);
 		return 0;
+	}
+	opt.input = input.buf;
+	opt.input_len = input.len;
 
-	argv[1] = NULL;
-
-	proc.argv = argv;
-	proc.in = -1;
-	proc.stdout_to_stderr = 1;
-	if (feed_state->push_options) {
+	if (push_options) {
 		int i;
-		for (i = 0; i < feed_state->push_options->nr; i++)
-			argv_array_pushf(&proc.env_array,
+		for (i = 0; i < push_options->nr; i++)
+			argv_array_pushf(&opt.env,
 				"GIT_PUSH_OPTION_%d=%s", i,
-				feed_state->push_options->items[i].string);
-		argv_array_pushf(&proc.env_array, "GIT_PUSH_OPTION_COUNT=%d",
-				 feed_state->push_options->nr);
+				push_options->items[i].string);
+		argv_array_pushf(&opt.env, "GIT_PUSH_OPTION_COUNT=%d",
+				 push_options->nr);
 	} else
-		argv_array_pushf(&proc.env_array, "GIT_PUSH_OPTION_COUNT");
+		argv_array_pushf(&opt.env, "GIT_PUSH_OPTION_COUNT");
 
 	if (tmp_objdir)
-		argv_array_pushv(&proc.env_array, tmp_objdir_env(tmp_objdir));
+		argv_array_pushv(&opt.env, tmp_objdir_env(tmp_objdir));
+
+	prepare_push_cert_sha1(&opt.env);
 
 	if (use_sideband) {
 		memset(&muxer, 0, sizeof(muxer));
 		muxer.proc = copy_to_sideband;
 		muxer.in = -1;
 		code = start_async(&muxer);
-		if (code)
+		if (code) {
+			argv_array_clear(&opt.env);
+			strbuf_release(&input);
 			return code;
-		proc.err = muxer.in;
-	}
-
-	prepare_push_cert_sha1(&proc);
-
-	code = start_command(&proc);
-	if (code) {
-		if (use_sideband)
-			finish_async(&muxer);
-		return code;
+		}
+		opt.err = muxer.in;
 	}
 
-	sigchain_push(SIGPIPE, SIG_IGN);
-
-	while (1) {
-		const char *buf;
-		size_t n;
-		if (feed(feed_state, &buf, &n))
-			break;
-		if (write_in_full(proc.in, buf, n) < 0)
-			break;
-	}
-	close(proc.in);
+	code = run_hooks(hook_name, &opt);
 	if (use_sideband)
 		finish_async(&muxer);
-
-	sigchain_pop(SIGPIPE);
-
-	return finish_command(&proc);
-}
-
-static int feed_receive_hook(void *state_, const char **bufp, size_t *sizep)
-{
-	struct receive_hook_feed_state *state = state_;
-	struct command *cmd = state->cmd;
-
-	while (cmd &&
-	       state->skip_broken && (cmd->error_string || cmd->did_not_exist))
-		cmd = cmd->next;
-	if (!cmd)
-		return -1; /* EOF */
-	strbuf_reset(&state->buf);
-	strbuf_addf(&state->buf, "%s %s %s\n",
-		    oid_to_hex(&cmd->old_oid), oid_to_hex(&cmd->new_oid),
-		    cmd->ref_name);
-	state->cmd = cmd->next;
-	if (bufp) {
-		*bufp = state->buf.buf;
-		*sizep = state->buf.len;
-	}
-	return 0;
-}
-
-static int run_receive_hook(struct command *commands,
-			    const char *hook_name,
-			    int skip_broken,
-			    const struct string_list *push_options)
-{
-	struct receive_hook_feed_state state;
-	int status;
-
-	strbuf_init(&state.buf, 0);
-	state.cmd = commands;
-	state.skip_broken = skip_broken;
-	if (feed_receive_hook(&state, NULL, NULL))
-		return 0;
-	state.cmd = commands;
-	state.push_options = push_options;
-	status = run_and_feed_hook(hook_name, feed_receive_hook, &state);
-	strbuf_release(&state.buf);
-	return status;
+	strbuf_release(&input);
+	return code;
 }
 
 static int run_update_hook(struct command *cmd)
@@ -1008,7 +956,7 @@ static const char *update_worktree(unsigned char *sha1)
 
 	argv_array_pushf(&env, "GIT_DIR=%s", absolute_path(get_git_dir()));
 
-	if (!find_hook(push_to_checkout_hook))
+	if (!hook_exists(push_to_checkout_hook))
 		retval = push_to_deploy(sha1, &env, work_tree);
 	else
 		retval = push_to_checkout(sha1, &env, work_tree);
@@ -1017,6 +965,28 @@ static const char *update_worktree(unsigned char *sha1)
 	return retval;
 }
 
+/*
+ * Queue the update of the ref of "cmd" in the current transaction, once
+ * update() has checked that it is allowed.
+ */
+static int queue_ref_update(struct command *cmd, struct strbuf *err)
+{
+	struct strbuf namespaced_name = STRBUF_INIT;
+	int ret;
+
+	strbuf_addf(&namespaced_name, "%s%s", get_git_namespace(), cmd->ref_name);
+	if (is_null_oid(&cmd->new_oid))
+		ret = ref_transaction_delete(transaction, namespaced_name.buf,
+					     cmd->ignore_old_oid ? NULL : &cmd->old_oid,
+					     0, "push", err);
+	else
+		ret = ref_transaction_update(transaction, namespaced_name.buf,
+					     &cmd->new_oid, &cmd->old_oid,
+					     0, "push", err);
+	strbuf_release(&namespaced_name);
+	return ret;
+}
+
 static const char *update(struct command *cmd, struct shallow_info *si)
 {
 	const char *name = cmd->ref_name;
@@ -1120,7 +1090,7 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 	if (is_null_oid(new_oid)) {
 		struct strbuf err = STRBUF_INIT;
 		if (!parse_object(old_oid)) {
-			old_oid = NULL;
+			cmd->ignore_old_oid = 1;
 			if (ref_exists(name)) {
 				rp_warning("Allowing deletion of corrupt ref.");
 			} else {
@@ -1128,10 +1098,7 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 				cmd->did_not_exist = 1;
 			}
 		}
-		if (ref_transaction_delete(transaction,
-					   namespaced_name,
-					   old_oid,
-					   0, "push", &err)) {
+		if (queue_ref_update(cmd, &err)) {
 			rp_error("%s", err.buf);
 			strbuf_release(&err);
 			return "failed to delete";
@@ -1145,11 +1112,7 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 		    update_shallow_ref(cmd, si))
 			return "shallow error";
 
-		if (ref_transaction_update(transaction,
-					   namespaced_name,
-					   new_oid, old_oid,
-					   0, "push",
-					   &err)) {
+		if (queue_ref_update(cmd, &err)) {
 			rp_error("%s", err.buf);
 			strbuf_release(&err);
 
@@ -1163,33 +1126,35 @@ static const char *update(struct command *cmd, struct shallow_info *si)
 
 static void run_update_post_hook(struct command *commands)
 {
+	struct run_hooks_opt opt = RUN_HOOKS_OPT_INIT;
 	struct command *cmd;
-	struct child_process proc = CHILD_PROCESS_INIT;
-	const char *hook;
+	struct async muxer;
 
-	hook = find_hook("post-update");
-	if (!hook)
+	if (!hook_exists("post-update"))
 		return;
 
 	for (cmd = commands; cmd; cmd = cmd->next) {
 		if (cmd->error_string || cmd->did_not_exist)
 			continue;
-		if (!proc.args.argc)
-			argv_array_push(&proc.args, hook);
-		argv_array_push(&proc.args, cmd->ref_name);
+		argv_array_push(&opt.args, cmd->ref_name);
 	}
-	if (!proc.args.argc)
+	if (!opt.args.argc)
 		return;
 
-	proc.no_stdin = 1;
-	proc.stdout_to_stderr = 1;
-	proc.err = use_sideband ? -1 : 0;
-
-	if (!start_command(&proc)) {
-		if (use_sideband)
-			copy_to_sideband(proc.err, -1, NULL);
-		finish_command(&proc);
+	if (use_sideband) {
+		memset(&muxer, 0, sizeof(muxer));
+		muxer.proc = copy_to_sideband;
+		muxer.in = -1;
+		if (start_async(&muxer)) {
+			argv_array_clear(&opt.args);
+			return;
+		}
+		opt.err = muxer.in;
 	}
+
+	run_hooks("post-update", &opt);
+	if (use_sideband)
+		finish_async(&muxer);
 }
 
 static void check_aliased_update(struct command *cmd, struct string_list *list)
@@ -1369,15 +1334,35 @@ static void warn_if_skipped_connectivity_check(struct command *commands,
 		BUG("connectivity check skipped???");
 }
 
-static void execute_commands_non_atomic(struct command *commands,
-					struct shallow_info *si)
+/*
+ * The updates of a non-atomic push are committed in batches of this
+ * many refs, so that pushing many refs does not take a transaction
+ * (and, for deletions, a rewrite of packed-refs) for every ref.
+ */
+#define UPDATE_BATCH_SIZE 1000
+
+/*
+ * Commit the current transaction, which holds the updates of the "nr"
+ * commands in "batch". If that fails, we cannot tell which of them made
+ * it fail, so commit them one by one instead, as if they had never been
+ * batched, and report errors for the ones that fail.
+ */
+static void commit_batch(struct command **batch, int nr)
 {
-	struct command *cmd;
 	struct strbuf err = STRBUF_INIT;
+	int i;
 
-	for (cmd = commands; cmd; cmd = cmd->next) {
-		if (!should_process_cmd(cmd))
-			continue;
+	if (!nr || !ref_transaction_commit(transaction, &err)) {
+		ref_transaction_free(transaction);
+		transaction = NULL;
+		strbuf_release(&err);
+		return;
+	}
+	ref_transaction_free(transaction);
+	strbuf_reset(&err);
+
+	for (i = 0; i < nr; i++) {
+		struct command *cmd = batch[i];
 
 		transaction = ref_transaction_begin(&err);
 		if (!transaction) {
@@ -1386,17 +1371,54 @@ static void execute_commands_non_atomic(struct command *commands,
 			cmd->error_string = "transaction failed to start";
 			continue;
 		}
-
-		cmd->error_string = update(cmd, si);
-
-		if (!cmd->error_string
-		    && ref_transaction_commit(transaction, &err)) {
+		if (queue_ref_update(cmd, &err) ||
+		    ref_transaction_commit(transaction, &err)) {
 			rp_error("%s", err.buf);
 			strbuf_reset(&err);
 			cmd->error_string = "failed to update ref";
 		}
 		ref_transaction_free(transaction);
 	}
+	transaction = NULL;
+	strbuf_release(&err);
+}
+
+static void execute_commands_non_atomic(struct command *commands,
+					struct shallow_info *si)
+{
+	struct command *cmd;
+	struct command **batch = NULL;
+	int batch_nr = 0, batch_alloc = 0;
+	struct strbuf err = STRBUF_INIT;
+
+	for (cmd = commands; cmd; cmd = cmd->next) {
+		if (!should_process_cmd(cmd))
+			continue;
+
+		if (!transaction) {
+			transaction = ref_transaction_begin(&err);
+			if (!transaction) {
+				rp_error("%s", err.buf);
+				strbuf_reset(&err);
+				cmd->error_string = "transaction failed to start";
+				continue;
+			}
+		}
+
+		cmd->error_string = update(cmd, si);
+		if (cmd->error_string)
+			continue;
+
+		ALLOC_GROW(batch, batch_nr + 1, batch_alloc);
+		batch[batch_nr++] = cmd;
+		if (batch_nr == UPDATE_BATCH_SIZE) {
+			commit_batch(batch, batch_nr);
+			batch_nr = 0;
+		}
+	}
+	if (transaction)
+		commit_batch(batch, batch_nr);
+	free(batch);
 	strbuf_release(&err);
 }
 
@@ -1473,6 +1495,9 @@ static void execute_commands(struct command *commands,
 	opt.err_fd = err_fd;
 	opt.progress = err_fd && !quiet;
 	opt.env = tmp_objdir_env(tmp_objdir);
+	opt.pack_lockfile = pack_lockfile;
+	if (have_pack_links)
+		opt.pack_links = &pack_links;
 	if (check_connected(iterate_receive_command_list, &data, &opt))
 		set_connectivity_errors(commands, si);
 
@@ -1666,7 +1691,45 @@ static const char *parse_pack_header(struct pack_header *hdr)
 	}
 }
 
-static const char *pack_lockfile;
+/*
+ * The connectivity check can use what index-pack tells about the links
+ * of the pack, but only with reachability bitmaps.
+ */
+static int want_pack_links(void)
+{
+	struct bitmap_index *bitmap_git;
+
+	if (repository_format_partial_clone ||
+	    is_repository_shallow(the_repository))
+		return 0;
+	bitmap_git = prepare_bitmap_git();
+	if (!bitmap_git)
+		return 0;
+	free_bitmap_index(bitmap_git);
+	return 1;
+}
+
+/* Read the links that "index-pack --report-links" lists, and close "fd". */
+static void read_pack_links(int fd)
+{
+	FILE *fp = xfdopen(fd, "r");
+	struct strbuf line = STRBUF_INIT;
+	struct object_id oid;
+
+	while (strbuf_getline(&line, fp) != EOF) {
+		if (!line.len) {
+			have_pack_links = 1;
+			break;
+		}
+		if (get_oid_hex(line.buf, &oid) || line.buf[GIT_SHA1_HEXSZ])
+			break;
+		oid_array_append(&pack_links, &oid);
+	}
+	if (!have_pack_links)
+		oid_array_clear(&pack_links);
+	strbuf_release(&line);
+	fclose(fp);
+}
 
 static void push_header_arg(struct argv_array *args, struct pack_header *hdr)
 {
@@ -1733,6 +1796,7 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 			return "unpack-objects abnormal exit";
 	} else {
 		char hostname[HOST_NAME_MAX + 1];
+		int report_links = want_pack_links();
 
 		argv_array_pushl(&child.args, "index-pack", "--stdin", NULL);
 		push_header_arg(&child.args, &hdr);
@@ -1753,6 +1817,8 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 				fsck_msg_types.buf);
 		if (!reject_thin)
 			argv_array_push(&child.args, "--fix-thin");
+		if (report_links)
+			argv_array_push(&child.args, "--report-links");
 		if (max_input_size)
 			argv_array_pushf(&child.args, "--max-input-size=%"PRIuMAX,
 				(uintmax_t)max_input_size);
@@ -1763,7 +1829,10 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 		if (status)
 			return "index-pack fork failed";
 		pack_lockfile = index_pack_lockfile(child.out);
-		close(child.out);
+		if (report_links)
+			read_pack_links(child.out);
+		else
+			close(child.out);
 		status = finish_command(&child);
 		if (status)
 			return "index-pack abnormal exit";
@@ -2012,7 +2081,7 @@ int cmd_receive_pack(int argc, const char **argv, const char *prefix)
 		string_list_clear(&push_options, 0);
 		if (auto_gc) {
 			const char *argv_gc_auto[] = {
-				"gc", "--auto", "--quiet", NULL,
+				"maintenance", "run", "--auto", "--quiet", NULL,
 			};
 			struct child_process proc = CHILD_PROCESS_INIT;
 
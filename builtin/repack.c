@@ -8,6 +8,9 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
+#include "packfile.h"
+#include "object-store.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
@@ -122,7 +125,8 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list,
 
 static void remove_redundant_pack(const char *dir_name, const char *base_name)
 {
-	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap"};
+	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".rev",
+			      ".mtimes"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -138,6 +142,158 @@ static void remove_redundant_pack(const char *dir_name, const char *base_name)
 	strbuf_release(&buf);
 }
 
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	/* the packs before this one are rolled up, the others are kept */
+	uint32_t split;
+};
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	const struct packed_git *a = *(const struct packed_git **)va;
+	const struct packed_git *b = *(const struct packed_git **)vb;
+
+	if (a->num_objects < b->num_objects)
+		return -1;
+	return a->num_objects > b->num_objects;
+}
+
+/*
+ * Collect the packs that --geometric may roll up, i.e. the local ones
+ * that are not kept, smallest (by number of objects) first.
+ */
+static void init_pack_geometry(struct pack_geometry *geometry,
+			       const struct string_list *keep_pack_list)
+{
+	struct packed_git *p;
+
+	memset(geometry, 0, sizeof(*geometry));
+	for (p = get_packed_git(the_repository); p; p = p->next) {
+		const char *name = basename(p->pack_name);
+		int i;
+
+		if (!p->pack_local || p->pack_keep || p->pack_promisor)
+			continue;
+		for (i = 0; i < keep_pack_list->nr; i++)
+			if (!fspathcmp(name, keep_pack_list->items[i].string))
+				break;
+		if (i < keep_pack_list->nr)
+			continue;
+		if (open_pack_index(p))
+			die(_("cannot open index for %s"), p->pack_name);
+
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+/*
+ * Find the fewest of the smallest packs to roll up into one so that
+ * each of the remaining packs has at least "factor" times as many
+ * objects as the one before it (the rolled-up one included).
+ */
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint32_t i, split;
+	uint64_t total = 0;
+
+	if (geometry->pack_nr <= 1) {
+		geometry->split = 0;
+		return;
+	}
+
+	/* the packs above the last pair that is out of progression stay */
+	for (i = geometry->pack_nr - 1; i > 0; i--) {
+		uint64_t ours = geometry->pack[i]->num_objects;
+		uint64_t prev = geometry->pack[i - 1]->num_objects;
+
+		if (ours < factor * prev)
+			break;
+	}
+	split = i ? i + 1 : 0;
+
+	/*
+	 * Rolling up may make the new pack too large for the ones above
+	 * it; roll those up too.
+	 */
+	for (i = 0; i < split; i++)
+		total += geometry->pack[i]->num_objects;
+	while (split && split < geometry->pack_nr &&
+	       geometry->pack[split]->num_objects < factor * total)
+		total += geometry->pack[split++]->num_objects;
+
+	geometry->split = split;
+}
+
+/*
+ * Pack what is left of the packs about to be removed, and the loose
+ * objects, into a cruft pack (see "git pack-objects --cruft"), instead
+ * of turning the unreachable objects loose.  The objects of the new
+ * packs "names" are left out; the name of the cruft pack is added to
+ * them.
+ */
+static int write_cruft_pack(const char *cruft_expiration,
+			    const struct string_list *keep_pack_list,
+			    int local, int quiet,
+			    struct string_list *names,
+			    const struct string_list *existing_packs)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct string_list_item *item;
+	struct strbuf line = STRBUF_INIT;
+	FILE *in, *out;
+	int i, ret;
+
+	argv_array_push(&cmd.args, "pack-objects");
+	argv_array_push(&cmd.args, "--cruft");
+	if (cruft_expiration)
+		argv_array_pushf(&cmd.args, "--cruft-expiration=%s",
+				 cruft_expiration);
+	if (!pack_kept_objects)
+		argv_array_push(&cmd.args, "--honor-pack-keep");
+	for (i = 0; i < keep_pack_list->nr; i++)
+		argv_array_pushf(&cmd.args, "--keep-pack=%s",
+				 keep_pack_list->items[i].string);
+	argv_array_push(&cmd.args, "--non-empty");
+	if (local)
+		argv_array_push(&cmd.args,  "--local");
+	if (quiet)
+		argv_array_push(&cmd.args,  "--quiet");
+	if (delta_base_offset)
+		argv_array_push(&cmd.args,  "--delta-base-offset");
+	argv_array_push(&cmd.args, packtmp);
+
+	cmd.git_cmd = 1;
+	cmd.in = -1;
+	cmd.out = -1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+
+	/* the new packs are not in place yet */
+	in = xfdopen(cmd.in, "w");
+	for_each_string_list_item(item, names)
+		fprintf(in, "^%s-%s.pack\n", basename(packtmp), item->string);
+	for_each_string_list_item(item, existing_packs)
+		fprintf(in, "%s.pack\n", item->string);
+	fclose(in);
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline_lf(&line, out) != EOF) {
+		if (line.len != 40)
+			die("repack: Expecting 40 character sha1 lines only from pack-objects.");
+		string_list_append(names, line.buf);
+	}
+	fclose(out);
+	strbuf_release(&line);
+
+	return finish_command(&cmd);
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
 
@@ -148,6 +304,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		unsigned optional:1;
 	} exts[] = {
 		{".pack"},
+		{".rev", 1},
+		{".mtimes", 1},
 		{".idx"},
 		{".bitmap", 1},
 	};
@@ -174,6 +332,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int no_update_server_info = 0;
 	int quiet = 0;
 	int local = 0;
+	int use_delta_islands = 0;
+	int geometric_factor = 0;
+	struct pack_geometry geometry = { 0 };
+	int cruft = 0;
+	const char *cruft_expiration = NULL;
 
 	struct option builtin_repack_options[] = {
 		OPT_BIT('a', NULL, &pack_everything,
@@ -194,10 +357,16 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("pass --local to git-pack-objects")),
 		OPT_BOOL('b', "write-bitmap-index", &write_bitmaps,
 				N_("write bitmap index")),
+		OPT_BOOL('i', "delta-islands", &use_delta_islands,
+				N_("pass --delta-islands to git-pack-objects")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_BOOL('k', "keep-unreachable", &keep_unreachable,
 				N_("with -a, repack unreachable objects")),
+		OPT_BOOL(0, "cruft", &cruft,
+				N_("same as -a, and pack unreachable objects into a cruft pack")),
+		OPT_STRING(0, "cruft-expiration", &cruft_expiration, N_("approxidate"),
+				N_("with --cruft, expire objects older than this")),
 		OPT_STRING(0, "window", &window, N_("n"),
 				N_("size of the window used for delta compression")),
 		OPT_STRING(0, "window-memory", &window_memory, N_("bytes"),
@@ -212,6 +381,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("repack objects in packs marked with .keep")),
 		OPT_STRING_LIST(0, "keep-pack", &keep_pack_list, N_("name"),
 				N_("do not repack this pack")),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+			    N_("find a geometric progression with factor <n>")),
 		OPT_END()
 	};
 
@@ -227,9 +398,24 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (cruft) {
+		if (keep_unreachable || unpack_unreachable ||
+		    (pack_everything & LOOSEN_UNREACHABLE))
+			die(_("--cruft is incompatible with -A and -k"));
+		if (geometric_factor)
+			die(_("--geometric is incompatible with --cruft"));
+		pack_everything |= ALL_INTO_ONE;
+	} else if (cruft_expiration)
+		die(_("--cruft-expiration requires --cruft"));
+
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps;
 
+	if (geometric_factor && pack_everything)
+		die(_("--geometric is incompatible with -A and -a"));
+	if (geometric_factor < 0 || geometric_factor == 1)
+		die(_("--geometric needs a factor of at least 2"));
+
 	if (write_bitmaps && !(pack_everything & ALL_INTO_ONE))
 		die(_(incremental_bitmap_conflict_error));
 
@@ -246,11 +432,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--keep-pack=%s",
 				 keep_pack_list.items[i].string);
 	argv_array_push(&cmd.args, "--non-empty");
-	argv_array_push(&cmd.args, "--all");
-	argv_array_push(&cmd.args, "--reflog");
-	argv_array_push(&cmd.args, "--indexed-objects");
-	if (repository_format_partial_clone)
-		argv_array_push(&cmd.args, "--exclude-promisor-objects");
+	if (!geometric_factor) {
+		argv_array_push(&cmd.args, "--all");
+		argv_array_push(&cmd.args, "--reflog");
+		argv_array_push(&cmd.args, "--indexed-objects");
+		if (repository_format_partial_clone)
+			argv_array_push(&cmd.args, "--exclude-promisor-objects");
+	}
 	if (window)
 		argv_array_pushf(&cmd.args, "--window=%s", window);
 	if (window_memory)
@@ -267,8 +455,24 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--no-reuse-object");
 	if (write_bitmaps)
 		argv_array_push(&cmd.args, "--write-bitmap-index");
-
-	if (pack_everything & ALL_INTO_ONE) {
+	if (use_delta_islands)
+		argv_array_push(&cmd.args, "--delta-islands");
+
+	if (geometric_factor) {
+		init_pack_geometry(&geometry, &keep_pack_list);
+		split_pack_geometry(&geometry, geometric_factor);
+		for (i = 0; i < geometry.split; i++) {
+			size_t len;
+			const char *name = basename(geometry.pack[i]->pack_name);
+
+			if (!strip_suffix(name, ".pack", &len))
+				BUG("pack_name does not end in .pack");
+			string_list_append_nodup(&existing_packs,
+						 xmemdupz(name, len));
+		}
+		argv_array_push(&cmd.args, "--stdin-packs");
+		argv_array_push(&cmd.args, "--unpacked");
+	} else if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs, &keep_pack_list);
 
 		if (existing_packs.nr && delete_redundant) {
@@ -303,12 +507,24 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 
 	cmd.git_cmd = 1;
 	cmd.out = -1;
-	cmd.no_stdin = 1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
 
 	ret = start_command(&cmd);
 	if (ret)
 		return ret;
 
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+
+		for (i = 0; i < geometry.pack_nr; i++)
+			fprintf(in, "%s%s\n", i < geometry.split ? "" : "^",
+				basename(geometry.pack[i]->pack_name));
+		fclose(in);
+	}
+
 	out = xfdopen(cmd.out, "r");
 	while (strbuf_getline_lf(&line, out) != EOF) {
 		if (line.len != 40)
@@ -320,6 +536,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (ret)
 		return ret;
 
+	if (cruft) {
+		ret = write_cruft_pack(cruft_expiration, &keep_pack_list,
+				       local, quiet, &names, &existing_packs);
+		if (ret)
+			return ret;
+	}
+
 	if (!names.nr && !quiet)
 		printf("Nothing new to pack.\n");
 
@@ -431,6 +654,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 
 	if (delete_redundant) {
 		int opts = 0;
+		int stale_midx = 0;
+		struct multi_pack_index *m;
+
+		m = load_multi_pack_index(get_object_directory(), 1);
 		string_list_sort(&names);
 		for_each_string_list_item(item, &existing_packs) {
 			char *sha1;
@@ -438,11 +665,33 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 			if (len < 40)
 				continue;
 			sha1 = item->string + len - 40;
-			if (!string_list_has_string(&names, sha1))
+			if (!string_list_has_string(&names, sha1)) {
+				if (m && !stale_midx) {
+					char *idx_name = xstrfmt("%s.idx", item->string);
+					stale_midx = midx_locate_pack(m, idx_name, NULL);
+					free(idx_name);
+				}
 				remove_redundant_pack(packdir, item->string);
+			}
+		}
+		if (m) {
+			close_midx(m);
+			free(m);
 		}
+		/*
+		 * A multi-pack-index that names a pack we just removed would
+		 * only send lookups to a missing file; drop it.
+		 */
+		if (stale_midx)
+			clear_midx_file(get_object_directory());
 		if (!quiet && isatty(2))
 			opts |= PRUNE_PACKED_VERBOSE;
+		/*
+		 * --geometric and --cruft looked at the packs before the
+		 * new ones were there
+		 */
+		if (geometric_factor || cruft)
+			reprepare_packed_git(the_repository);
 		prune_packed_objects(opts);
 	}
 
@@ -453,6 +702,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
 	strbuf_release(&line);
+	free(geometry.pack);
 
 	return 0;
 }
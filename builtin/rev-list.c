@@ -15,7 +15,7 @@
 #include "bisect.h"
 #include "progress.h"
 #include "reflog-walk.h"
-#include "oidset.h"
+#include "compact-oidset.h"
 #include "packfile.h"
 #include "object-store.h"
 
@@ -62,10 +62,10 @@ static struct progress *progress;
 static unsigned progress_counter;
 
 static struct list_objects_filter_options filter_options;
-static struct oidset omitted_objects;
+static struct compact_oidset omitted_objects;
 static int arg_print_omitted; /* print objects omitted by filter */
 
-static struct oidset missing_objects;
+static struct compact_oidset missing_objects;
 enum missing_action {
 	MA_ERROR = 0,    /* fail if any missing objects are encountered */
 	MA_ALLOW_ANY,    /* silently allow ALL missing objects */
@@ -74,8 +74,6 @@ enum missing_action {
 };
 static enum missing_action arg_missing_action;
 
-#define DEFAULT_OIDSET_SIZE     (16*1024)
-
 static void finish_commit(struct commit *commit, void *data);
 static void show_commit(struct commit *commit, void *data)
 {
@@ -216,7 +214,7 @@ static inline void finish_object__ma(struct object *obj)
 		return;
 
 	case MA_PRINT:
-		oidset_insert(&missing_objects, &obj->oid);
+		compact_oidset_insert(&missing_objects, &obj->oid);
 		return;
 
 	case MA_ALLOW_PROMISOR:
@@ -252,6 +250,11 @@ static void show_object(struct object *obj, const char *name, void *cb_data)
 	display_progress(progress, ++progress_counter);
 	if (info->flags & REV_LIST_QUIET)
 		return;
+	if (info->revs->count) {
+		/* objects are counted along with the commits */
+		info->revs->count_right++;
+		return;
+	}
 	show_object_with_name(stdout, obj, name);
 }
 
@@ -327,6 +330,57 @@ static int show_object_fast(
 	return 1;
 }
 
+/*
+ * Count the two sides of "rev-list --left-right --count A...B" from the
+ * bitmaps; the merge bases and any other negative commits among the
+ * pending objects are subtracted from both.
+ */
+static int count_left_right_with_bitmap(struct rev_info *revs,
+					uint32_t *left, uint32_t *right)
+{
+	struct commit *ours = NULL, *theirs = NULL;
+	struct object_list *haves = NULL;
+	struct bitmap_index *bitmap_git;
+	unsigned int i;
+	int ret = -1;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *object = revs->pending.objects[i].item;
+		struct commit *commit =
+			lookup_commit_reference_gently(&object->oid, 1);
+
+		if (!commit)
+			goto cleanup;
+		if (object->flags & UNINTERESTING)
+			object_list_insert(&commit->object, &haves);
+		else if (ours && (object->flags & SYMMETRIC_LEFT))
+			goto cleanup;
+		else if (object->flags & SYMMETRIC_LEFT)
+			ours = commit;
+		else if (theirs)
+			goto cleanup;
+		else
+			theirs = commit;
+	}
+	if (!ours || !theirs)
+		goto cleanup;
+
+	bitmap_git = prepare_bitmap_git();
+	if (bitmap_git) {
+		ret = bitmap_ahead_behind(bitmap_git, ours, theirs, haves,
+					  left, right);
+		free_bitmap_index(bitmap_git);
+	}
+
+cleanup:
+	while (haves) {
+		struct object_list *next = haves->next;
+		free(haves);
+		haves = next;
+	}
+	return ret;
+}
+
 static inline int parse_missing_action_value(const char *value)
 {
 	if (!strcmp(value, "error")) {
@@ -373,6 +427,7 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	init_revisions(&revs, prefix);
 	revs.abbrev = DEFAULT_ABBREV;
 	revs.commit_format = CMIT_FMT_UNSPECIFIED;
+	revs.compact_blobs = core_compact_object_walk;
 
 	/*
 	 * Scan the argument list before invoking setup_revisions(), so that we
@@ -500,9 +555,6 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (revs.show_notes)
 		die(_("rev-list does not support display of notes"));
 
-	if (filter_options.choice && use_bitmap_index)
-		die(_("cannot combine --use-bitmap-index with object filtering"));
-
 	save_commit_buffer = (revs.verbose_header ||
 			      revs.grep_filter.pattern_list ||
 			      revs.grep_filter.header_list);
@@ -512,23 +564,41 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (show_progress)
 		progress = start_delayed_progress(show_progress, 0);
 
-	if (use_bitmap_index && !revs.prune) {
-		if (revs.count && !revs.left_right && !revs.cherry_mark) {
-			uint32_t commit_count;
+	/* the objects omitted by a filter are not known to a bitmap walk */
+	if (use_bitmap_index && !revs.prune && !arg_print_omitted) {
+		int count_objects = revs.tag_objects || revs.tree_objects ||
+				    revs.blob_objects;
+
+		if (revs.count && !revs.left_right && !revs.cherry_mark &&
+		    (revs.max_count < 0 || !count_objects)) {
+			uint32_t commit_count, tree_count = 0, blob_count = 0;
+			uint32_t tag_count = 0;
 			int max_count = revs.max_count;
 			struct bitmap_index *bitmap_git;
-			if ((bitmap_git = prepare_bitmap_walk(&revs))) {
-				count_bitmap_commit_list(bitmap_git, &commit_count, NULL, NULL, NULL);
+			if ((bitmap_git = prepare_bitmap_walk(&revs, &filter_options))) {
+				count_bitmap_commit_list(bitmap_git, &commit_count,
+							 revs.tree_objects ? &tree_count : NULL,
+							 revs.blob_objects ? &blob_count : NULL,
+							 revs.tag_objects ? &tag_count : NULL);
 				if (max_count >= 0 && max_count < commit_count)
 					commit_count = max_count;
-				printf("%d\n", commit_count);
+				printf("%d\n", commit_count + tree_count +
+				       blob_count + tag_count);
 				free_bitmap_index(bitmap_git);
 				return 0;
 			}
+		} else if (revs.count && revs.left_right && !revs.cherry_mark &&
+			   !revs.first_parent_only && revs.max_count < 0 &&
+			   !count_objects) {
+			uint32_t left, right;
+			if (!count_left_right_with_bitmap(&revs, &left, &right)) {
+				printf("%d\t%d\n", left, right);
+				return 0;
+			}
 		} else if (revs.max_count < 0 &&
 			   revs.tag_objects && revs.tree_objects && revs.blob_objects) {
 			struct bitmap_index *bitmap_git;
-			if ((bitmap_git = prepare_bitmap_walk(&revs))) {
+			if ((bitmap_git = prepare_bitmap_walk(&revs, &filter_options))) {
 				traverse_bitmap_commit_list(bitmap_git, &show_object_fast);
 				free_bitmap_index(bitmap_git);
 				return 0;
@@ -550,30 +620,25 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			return show_bisect_vars(&info, reaches, all);
 	}
 
-	if (arg_print_omitted)
-		oidset_init(&omitted_objects, DEFAULT_OIDSET_SIZE);
-	if (arg_missing_action == MA_PRINT)
-		oidset_init(&missing_objects, DEFAULT_OIDSET_SIZE);
-
 	traverse_commit_list_filtered(
 		&filter_options, &revs, show_commit, show_object, &info,
 		(arg_print_omitted ? &omitted_objects : NULL));
 
 	if (arg_print_omitted) {
-		struct oidset_iter iter;
+		struct compact_oidset_iter iter;
 		struct object_id *oid;
-		oidset_iter_init(&omitted_objects, &iter);
-		while ((oid = oidset_iter_next(&iter)))
+		compact_oidset_iter_init(&omitted_objects, &iter);
+		while ((oid = compact_oidset_iter_next(&iter)))
 			printf("~%s\n", oid_to_hex(oid));
-		oidset_clear(&omitted_objects);
+		compact_oidset_clear(&omitted_objects);
 	}
 	if (arg_missing_action == MA_PRINT) {
-		struct oidset_iter iter;
+		struct compact_oidset_iter iter;
 		struct object_id *oid;
-		oidset_iter_init(&missing_objects, &iter);
-		while ((oid = oidset_iter_next(&iter)))
+		compact_oidset_iter_init(&missing_objects, &iter);
+		while ((oid = compact_oidset_iter_next(&iter)))
 			printf("?%s\n", oid_to_hex(oid));
-		oidset_clear(&missing_objects);
+		compact_oidset_clear(&missing_objects);
 	}
 
 	stop_progress(&progress);
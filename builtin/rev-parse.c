@@ -6,6 +6,7 @@
 #include "cache.h"
 #include "config.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "refs.h"
 #include "quote.h"
 #include "builtin.h"
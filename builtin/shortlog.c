@@ -9,6 +9,8 @@
 #include "mailmap.h"
 #include "shortlog.h"
 #include "parse-options.h"
+#include "object-store.h"
+#include "thread-utils.h"
 
 static char const * const shortlog_usage[] = {
 	N_("git shortlog [<options>] [<revision-range>] [[--] <path>...]"),
@@ -97,15 +99,49 @@ static void insert_one_record(struct shortlog *log,
 	}
 }
 
-static int parse_stdin_author(struct shortlog *log,
-			       struct strbuf *out, const char *in)
+struct shortlog_ident {
+	struct hashmap_entry ent;
+	char *author;
+	size_t len;
+	char raw[FLEX_ARRAY];
+};
+
+static int shortlog_ident_cmp(const void *unused_cmp_data,
+			      const void *entry,
+			      const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct shortlog_ident *a = entry;
+	const struct shortlog_ident *b = entry_or_key;
+	return a->len != b->len ||
+		memcmp(a->raw, keydata ? keydata : b->raw, a->len);
+}
+
+/*
+ * Return the author an ident line is shown as, after the mailmap, or
+ * NULL if it cannot be split. Most commits are by someone who has
+ * written others, so each distinct name and email is looked up in the
+ * mailmap and formatted only once.
+ */
+static const char *intern_ident(struct shortlog *log,
+				const char *in, size_t len)
 {
 	const char *mailbuf, *namebuf;
 	size_t namelen, maillen;
 	struct ident_split ident;
+	struct shortlog_ident key, *e;
+	struct strbuf out = STRBUF_INIT;
 
-	if (split_ident_line(&ident, in, strlen(in)))
-		return -1;
+	if (split_ident_line(&ident, in, len))
+		return NULL;
+
+	/* the date does not matter */
+	len = ident.mail_end - ident.name_begin;
+	hashmap_entry_init(&key, memhash(ident.name_begin, len));
+	key.len = len;
+	e = hashmap_get(&log->idents, &key, ident.name_begin);
+	if (e)
+		return e->author;
 
 	namebuf = ident.name_begin;
 	mailbuf = ident.mail_begin;
@@ -113,17 +149,32 @@ static int parse_stdin_author(struct shortlog *log,
 	maillen = ident.mail_end - ident.mail_begin;
 
 	map_user(&log->mailmap, &mailbuf, &maillen, &namebuf, &namelen);
-	strbuf_add(out, namebuf, namelen);
+	strbuf_add(&out, namebuf, namelen);
 	if (log->email)
-		strbuf_addf(out, " <%.*s>", (int)maillen, mailbuf);
+		strbuf_addf(&out, " <%.*s>", (int)maillen, mailbuf);
+
+	FLEX_ALLOC_MEM(e, raw, ident.name_begin, len);
+	hashmap_entry_init(e, key.ent.hash);
+	e->len = len;
+	e->author = strbuf_detach(&out, NULL);
+	hashmap_add(&log->idents, e);
+	return e->author;
+}
 
-	return 0;
+static void clear_idents(struct shortlog *log)
+{
+	struct hashmap_iter iter;
+	struct shortlog_ident *e;
+
+	hashmap_iter_init(&log->idents, &iter);
+	while ((e = hashmap_iter_next(&iter)))
+		free(e->author);
+	hashmap_free(&log->idents, 1);
 }
 
 static void read_from_stdin(struct shortlog *log)
 {
 	struct strbuf author = STRBUF_INIT;
-	struct strbuf mapped_author = STRBUF_INIT;
 	struct strbuf oneline = STRBUF_INIT;
 	static const char *author_match[2] = { "Author: ", "author " };
 	static const char *committer_match[2] = { "Commit: ", "committer " };
@@ -131,7 +182,7 @@ static void read_from_stdin(struct shortlog *log)
 
 	match = log->committer ? committer_match : author_match;
 	while (strbuf_getline_lf(&author, stdin) != EOF) {
-		const char *v;
+		const char *v, *mapped_author;
 		if (!skip_prefix(author.buf, match[0], &v) &&
 		    !skip_prefix(author.buf, match[1], &v))
 			continue;
@@ -142,23 +193,59 @@ static void read_from_stdin(struct shortlog *log)
 		       !oneline.len)
 			; /* discard blanks */
 
-		strbuf_reset(&mapped_author);
-		if (parse_stdin_author(log, &mapped_author, v) < 0)
+		mapped_author = intern_ident(log, v, author.buf + author.len - v);
+		if (!mapped_author)
 			continue;
 
-		insert_one_record(log, mapped_author.buf, oneline.buf);
+		insert_one_record(log, mapped_author, oneline.buf);
 	}
 	strbuf_release(&author);
-	strbuf_release(&mapped_author);
 	strbuf_release(&oneline);
 }
 
+/*
+ * The author of "commit" as "%aN" (or "%cN", with " <%aE>" for --email)
+ * would show it, from the ident interned for it, or NULL if the commit
+ * has to be formatted after all: its headers are out of the ordinary,
+ * or its message would be re-encoded.
+ */
+static const char *commit_ident(struct shortlog *log, struct commit *commit)
+{
+	const char *buffer, *ret = NULL;
+	const struct commit_header_offsets *o;
+	const char *output_encoding = get_log_output_encoding();
+	enum commit_header which = log->committer ?
+		COMMIT_HEADER_COMMITTER : COMMIT_HEADER_AUTHOR;
+
+	buffer = get_commit_buffer(commit, NULL);
+	o = commit_header_offsets(commit, buffer);
+	if (!o || !o->off[which])
+		goto out;
+	if (output_encoding && *output_encoding) {
+		char *encoding = NULL;
+		int same;
+
+		if (o->off[COMMIT_HEADER_ENCODING])
+			encoding = xmemdupz(buffer + o->off[COMMIT_HEADER_ENCODING],
+					    o->len[COMMIT_HEADER_ENCODING]);
+		same = same_encoding(encoding ? encoding : "UTF-8",
+				     output_encoding);
+		free(encoding);
+		if (!same)
+			goto out;
+	}
+	ret = intern_ident(log, buffer + o->off[which], o->len[which]);
+out:
+	unuse_commit_buffer(commit, buffer);
+	return ret;
+}
+
 void shortlog_add_commit(struct shortlog *log, struct commit *commit)
 {
 	struct strbuf author = STRBUF_INIT;
 	struct strbuf oneline = STRBUF_INIT;
 	struct pretty_print_context ctx = {0};
-	const char *fmt;
+	const char *fmt, *interned;
 
 	ctx.fmt = CMIT_FMT_USERFORMAT;
 	ctx.abbrev = log->abbrev;
@@ -170,7 +257,9 @@ void shortlog_add_commit(struct shortlog *log, struct commit *commit)
 		(log->email ? "%cN <%cE>" : "%cN") :
 		(log->email ? "%aN <%aE>" : "%aN");
 
-	format_commit_message(commit, fmt, &author, &ctx);
+	interned = commit_ident(log, commit);
+	if (!interned)
+		format_commit_message(commit, fmt, &author, &ctx);
 	if (!log->summary) {
 		if (log->user_format)
 			pretty_print_commit(&ctx, commit, &oneline);
@@ -178,20 +267,153 @@ void shortlog_add_commit(struct shortlog *log, struct commit *commit)
 			format_commit_message(commit, "%s", &oneline, &ctx);
 	}
 
-	insert_one_record(log, author.buf, oneline.len ? oneline.buf : "<none>");
+	insert_one_record(log, interned ? interned : author.buf,
+			  oneline.len ? oneline.buf : "<none>");
 
 	strbuf_release(&author);
 	strbuf_release(&oneline);
 }
 
+/*
+ * With a commit-graph the walk itself hardly reads any commits, and
+ * reading them one by one for their idents is most of the work. Take
+ * them from the walk BATCH at a time and read the ones whose contents
+ * are not kept already in threads, giving every thread at least
+ * THREAD_COST of them and using at most MAX_PARALLEL threads.
+ */
+#define BATCH (1024)
+#define THREAD_COST (64)
+#define MAX_PARALLEL (16)
+
+struct read_commit {
+	struct commit *commit;
+	void *buffer;
+	unsigned long size;
+};
+
+#ifndef NO_PTHREADS
+
+struct read_thread {
+	pthread_t pthread;
+	struct read_commit *commits;
+	int first, step, nr;
+};
+
+static void *read_thread(void *data)
+{
+	struct read_thread *t = data;
+	int i;
+
+	for (i = t->first; i < t->nr; i += t->step) {
+		struct read_commit *r = &t->commits[i];
+		enum object_type type;
+
+		/* if it cannot be read, the main thread will say so */
+		r->buffer = read_object_file(&r->commit->object.oid, &type,
+					     &r->size);
+		if (r->buffer && type != OBJ_COMMIT)
+			FREE_AND_NULL(r->buffer);
+	}
+	return NULL;
+}
+
+static int read_threads(int nr)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_SHORTLOG_THREADS", 0);
+
+	/* a lazy fetch from a thread would run a whole transport */
+	if (repository_format_partial_clone)
+		return 1;
+	if (!nr_threads) {
+		nr_threads = nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	return nr_threads;
+}
+
+static void read_commits(struct read_commit *commits, int nr)
+{
+	struct read_thread *threads;
+	int i, nr_threads = read_threads(nr);
+
+	if (nr_threads < 2)
+		return;
+
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	enable_obj_read_lock();
+	for (i = 0; i < nr_threads; i++) {
+		struct read_thread *t = &threads[i];
+
+		t->commits = commits;
+		t->first = i;
+		t->step = nr_threads;
+		t->nr = nr;
+		if (pthread_create(&t->pthread, NULL, read_thread, t))
+			die("unable to create threaded shortlog reader");
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die("unable to join threaded shortlog reader");
+	disable_obj_read_lock();
+	free(threads);
+
+	for (i = 0; i < nr; i++)
+		if (commits[i].buffer)
+			set_commit_buffer(commits[i].commit, commits[i].buffer,
+					  commits[i].size);
+}
+
+#else
+
+static void read_commits(struct read_commit *commits, int nr)
+{
+}
+
+#endif
+
+static void add_commits(struct shortlog *log, struct read_commit *commits,
+			int nr)
+{
+	int i;
+
+	read_commits(commits, nr);
+	for (i = 0; i < nr; i++) {
+		shortlog_add_commit(log, commits[i].commit);
+		/* we will not look at it again */
+		if (commits[i].buffer)
+			free_commit_buffer(commits[i].commit);
+	}
+}
+
 static void get_from_rev(struct rev_info *rev, struct shortlog *log)
 {
+	struct read_commit commits[BATCH];
 	struct commit *commit;
+	int nr = 0;
 
 	if (prepare_revision_walk(rev))
 		die(_("revision walk setup failed"));
-	while ((commit = get_revision(rev)) != NULL)
-		shortlog_add_commit(log, commit);
+	while ((commit = get_revision(rev)) != NULL) {
+		if (get_cached_commit_buffer(commit, NULL)) {
+			/* keep the order of the commits */
+			add_commits(log, commits, nr);
+			nr = 0;
+			shortlog_add_commit(log, commit);
+			continue;
+		}
+		commits[nr].commit = commit;
+		commits[nr].buffer = NULL;
+		if (++nr == BATCH) {
+			add_commits(log, commits, nr);
+			nr = 0;
+		}
+	}
+	add_commits(log, commits, nr);
 }
 
 static int parse_uint(char const **arg, int comma, int defval)
@@ -246,6 +468,7 @@ void shortlog_init(struct shortlog *log)
 	memset(log, 0, sizeof(*log));
 
 	read_mailmap(&log->mailmap, &log->common_repo_prefix);
+	hashmap_init(&log->idents, shortlog_ident_cmp, NULL, 0);
 
 	log->list.strdup_strings = 1;
 	log->wrap = DEFAULT_WRAPLEN;
@@ -373,4 +596,5 @@ void shortlog_output(struct shortlog *log)
 	log->list.strdup_strings = 1;
 	string_list_clear(&log->list, 1);
 	clear_mailmap(&log->mailmap);
+	clear_idents(log);
 }
@@ -60,6 +60,7 @@ static int list_tags(struct ref_filter *filter, struct ref_sorting *sorting,
 	filter->with_commit_tag_algo = 1;
 	filter_refs(&array, filter, FILTER_REFS_TAGS);
 	ref_array_sort(sorting, &array);
+	ref_array_populate(&array, array.nr);
 
 	for (i = 0; i < array.nr; i++)
 		show_ref_array_item(array.items[i], format);
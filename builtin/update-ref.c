@@ -309,7 +309,8 @@ static const char *parse_cmd_verify(struct ref_transaction *transaction,
 	return next;
 }
 
-static const char *parse_cmd_option(struct strbuf *input, const char *next)
+static const char *parse_cmd_option(struct ref_transaction *transaction,
+				    struct strbuf *input, const char *next)
 {
 	const char *rest;
 	if (skip_prefix(next, "no-deref", &rest) && *rest == line_termination)
@@ -319,36 +320,220 @@ static const char *parse_cmd_option(struct strbuf *input, const char *next)
 	return rest;
 }
 
-static void update_refs_stdin(struct ref_transaction *transaction)
+/*
+ * The state of the transaction of an "update-ref --stdin" session.
+ * Commands are queued into an implicitly begun transaction that is
+ * committed at the end of the input, unless "start" asks for explicit
+ * control: then only "commit" makes the updates, and reaching the end
+ * of the input aborts what has not been committed yet.
+ */
+enum update_refs_state {
+	/* Implicit transaction, committed at the end of the input */
+	UPDATE_REFS_OPEN,
+	/* Explicitly started transaction, queueing updates */
+	UPDATE_REFS_STARTED,
+	/* Transaction with all refs locked, waiting for commit or abort */
+	UPDATE_REFS_PREPARED,
+	/* Transaction committed or aborted, waiting for the next start */
+	UPDATE_REFS_CLOSED
+};
+
+static void report_ok(const char *command)
+{
+	/* The caller may be waiting for this before sending more. */
+	printf("%s: ok\n", command);
+	fflush(stdout);
+}
+
+static const char *parse_cmd_start(struct ref_transaction *transaction,
+				   struct strbuf *input, const char *next)
+{
+	if (*next != line_termination)
+		die("start: extra input: %s", next);
+	report_ok("start");
+	return next;
+}
+
+static const char *parse_cmd_prepare(struct ref_transaction *transaction,
+				     struct strbuf *input, const char *next)
+{
+	struct strbuf err = STRBUF_INIT;
+
+	if (*next != line_termination)
+		die("prepare: extra input: %s", next);
+	if (ref_transaction_prepare(transaction, &err))
+		die("%s", err.buf);
+	report_ok("prepare");
+	strbuf_release(&err);
+	return next;
+}
+
+static const char *parse_cmd_abort(struct ref_transaction *transaction,
+				   struct strbuf *input, const char *next)
+{
+	struct strbuf err = STRBUF_INIT;
+
+	if (*next != line_termination)
+		die("abort: extra input: %s", next);
+	if (ref_transaction_abort(transaction, &err))
+		die("%s", err.buf);
+	report_ok("abort");
+	strbuf_release(&err);
+	return next;
+}
+
+static const char *parse_cmd_commit(struct ref_transaction *transaction,
+				    struct strbuf *input, const char *next)
+{
+	struct strbuf err = STRBUF_INIT;
+
+	if (*next != line_termination)
+		die("commit: extra input: %s", next);
+	if (ref_transaction_commit(transaction, &err))
+		die("%s", err.buf);
+	ref_transaction_free(transaction);
+	report_ok("commit");
+	strbuf_release(&err);
+	return next;
+}
+
+static const struct parse_cmd {
+	const char *prefix;
+	const char *(*fn)(struct ref_transaction *, struct strbuf *, const char *);
+	/* number of arguments, each terminated by NUL with -z */
+	unsigned args;
+	/* the states in which the command is allowed */
+	unsigned states;
+	/* the state after the command, or -1 to leave it alone */
+	int new_state;
+} commands[] = {
+#define IN(state) (1u << (state))
+#define QUEUEING (IN(UPDATE_REFS_OPEN) | IN(UPDATE_REFS_STARTED))
+	{ "update ", parse_cmd_update, 3, QUEUEING, -1 },
+	{ "create ", parse_cmd_create, 2, QUEUEING, -1 },
+	{ "delete ", parse_cmd_delete, 2, QUEUEING, -1 },
+	{ "verify ", parse_cmd_verify, 2, QUEUEING, -1 },
+	{ "option ", parse_cmd_option, 1, QUEUEING, -1 },
+	{ "start", parse_cmd_start, 0,
+	  IN(UPDATE_REFS_OPEN) | IN(UPDATE_REFS_CLOSED), UPDATE_REFS_STARTED },
+	{ "prepare", parse_cmd_prepare, 0, QUEUEING, UPDATE_REFS_PREPARED },
+	{ "abort", parse_cmd_abort, 0,
+	  QUEUEING | IN(UPDATE_REFS_PREPARED), UPDATE_REFS_CLOSED },
+	{ "commit", parse_cmd_commit, 0,
+	  QUEUEING | IN(UPDATE_REFS_PREPARED), UPDATE_REFS_CLOSED },
+#undef QUEUEING
+#undef IN
+};
+
+static const char *state_name(enum update_refs_state state)
 {
-	struct strbuf input = STRBUF_INIT;
+	switch (state) {
+	case UPDATE_REFS_OPEN:
+	case UPDATE_REFS_STARTED:
+		return "open";
+	case UPDATE_REFS_PREPARED:
+		return "prepared";
+	case UPDATE_REFS_CLOSED:
+		return "closed";
+	}
+	BUG("unknown update-ref state %d", state);
+}
+
+/*
+ * Read one command, and with -z the NUL-terminated arguments that
+ * follow it, into input. Return 0 at the end of the input.
+ */
+static int read_command(struct strbuf *input, const struct parse_cmd **cmd)
+{
+	struct strbuf arg = STRBUF_INIT;
 	const char *next;
+	size_t i;
 
-	if (strbuf_read(&input, 0, 1000) < 0)
-		die_errno("could not read from stdin");
-	next = input.buf;
-	/* Read each line dispatch its command */
-	while (next < input.buf + input.len) {
-		if (*next == line_termination)
-			die("empty command in input");
-		else if (isspace(*next))
-			die("whitespace before command: %s", next);
-		else if (skip_prefix(next, "update ", &next))
-			next = parse_cmd_update(transaction, &input, next);
-		else if (skip_prefix(next, "create ", &next))
-			next = parse_cmd_create(transaction, &input, next);
-		else if (skip_prefix(next, "delete ", &next))
-			next = parse_cmd_delete(transaction, &input, next);
-		else if (skip_prefix(next, "verify ", &next))
-			next = parse_cmd_verify(transaction, &input, next);
-		else if (skip_prefix(next, "option ", &next))
-			next = parse_cmd_option(&input, next);
-		else
-			die("unknown command: %s", next);
-
-		next++;
+	strbuf_reset(input);
+	if (strbuf_getwholeline(input, stdin, line_termination))
+		return 0;
+	next = input->buf;
+	if (*next == line_termination)
+		die("empty command in input");
+	else if (isspace(*next))
+		die("whitespace before command: %s", next);
+
+	for (i = 0; i < ARRAY_SIZE(commands); i++) {
+		const char *rest;
+
+		if (!skip_prefix(next, commands[i].prefix, &rest))
+			continue;
+		/* commands without arguments must be followed by the end */
+		if (!commands[i].args && *rest && *rest != line_termination)
+			continue;
+		*cmd = &commands[i];
+		break;
 	}
+	if (i == ARRAY_SIZE(commands))
+		die("unknown command: %s", next);
+
+	if (!line_termination)
+		for (i = 1; i < (*cmd)->args; i++) {
+			if (strbuf_getwholeline(&arg, stdin, line_termination))
+				break;
+			strbuf_addbuf(input, &arg);
+		}
+	strbuf_release(&arg);
+	return 1;
+}
+
+static void update_refs_stdin(void)
+{
+	struct strbuf input = STRBUF_INIT, err = STRBUF_INIT;
+	enum update_refs_state state = UPDATE_REFS_OPEN;
+	struct ref_transaction *transaction;
+	const struct parse_cmd *cmd;
 
+	transaction = ref_transaction_begin(&err);
+	if (!transaction)
+		die("%s", err.buf);
+
+	/*
+	 * Read and dispatch one command at a time, so that a caller can
+	 * wait for the outcome of one transaction before starting the next.
+	 */
+	while (read_command(&input, &cmd)) {
+		const char *next = input.buf + strlen(cmd->prefix);
+
+		if (!(cmd->states & (1u << state)))
+			die("%.*s: not allowed in %s transaction",
+			    (int)strcspn(cmd->prefix, " "), cmd->prefix,
+			    state_name(state));
+
+		if (state == UPDATE_REFS_CLOSED) {
+			transaction = ref_transaction_begin(&err);
+			if (!transaction)
+				die("%s", err.buf);
+		}
+
+		cmd->fn(transaction, &input, next);
+		if (cmd->new_state >= 0)
+			state = cmd->new_state;
+	}
+
+	switch (state) {
+	case UPDATE_REFS_OPEN:
+		/* Without "start", commit what was queued as before. */
+		if (ref_transaction_commit(transaction, &err))
+			die("%s", err.buf);
+		ref_transaction_free(transaction);
+		break;
+	case UPDATE_REFS_STARTED:
+	case UPDATE_REFS_PREPARED:
+		/* An explicit transaction that was not committed is lost. */
+		if (ref_transaction_abort(transaction, &err))
+			die("%s", err.buf);
+		break;
+	case UPDATE_REFS_CLOSED:
+		break;
+	}
+
+	strbuf_release(&err);
 	strbuf_release(&input);
 }
 
@@ -379,21 +564,11 @@ int cmd_update_ref(int argc, const char **argv, const char *prefix)
 	create_reflog_flag = create_reflog ? REF_FORCE_CREATE_REFLOG : 0;
 
 	if (read_stdin) {
-		struct strbuf err = STRBUF_INIT;
-		struct ref_transaction *transaction;
-
-		transaction = ref_transaction_begin(&err);
-		if (!transaction)
-			die("%s", err.buf);
 		if (delete || no_deref || argc > 0)
 			usage_with_options(git_update_ref_usage, options);
 		if (end_null)
 			line_termination = '\0';
-		update_refs_stdin(transaction);
-		if (ref_transaction_commit(transaction, &err))
-			die("%s", err.buf);
-		ref_transaction_free(transaction);
-		strbuf_release(&err);
+		update_refs_stdin();
 		return 0;
 	}
 
@@ -58,6 +58,29 @@ static int verify_commit(const char *name, unsigned flags)
 	return ret;
 }
 
+/*
+ * Verify the signatures of all the commits named on the command line
+ * at once, so that gpg runs for several of them at a time. Names that
+ * are not commits are left for verify_commit() to complain about.
+ */
+static void prefetch_signatures(const char **names, int nr)
+{
+	struct commit **commits;
+	int i, commits_nr = 0;
+
+	ALLOC_ARRAY(commits, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_id oid;
+
+		if (get_oid(names[i], &oid) ||
+		    oid_object_info(the_repository, &oid, NULL) != OBJ_COMMIT)
+			continue;
+		commits[commits_nr++] = lookup_commit(&oid);
+	}
+	prefetch_commit_signatures(commits, commits_nr);
+	free(commits);
+}
+
 static int git_verify_commit_config(const char *var, const char *value, void *cb)
 {
 	int status = git_gpg_config(var, value, cb);
@@ -89,6 +112,8 @@ int cmd_verify_commit(int argc, const char **argv, const char *prefix)
 	/* sometimes the program was terminated because this signal
 	 * was received in the process of writing the gpg input: */
 	signal(SIGPIPE, SIG_IGN);
+	if (argc - i > 1)
+		prefetch_signatures(argv + i, argc - i);
 	while (i < argc)
 		if (verify_commit(argv[i++], flags))
 			had_error = 1;
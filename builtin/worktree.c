@@ -12,6 +12,10 @@
 #include "refs.h"
 #include "utf8.h"
 #include "worktree.h"
+#include "lockfile.h"
+#include "cache-tree.h"
+#include "fsmonitor.h"
+#include "trace2.h"
 
 static const char * const worktree_usage[] = {
 	N_("git worktree add [<options>] <path> [<commit-ish>]"),
@@ -29,6 +33,7 @@ struct add_opts {
 	int detach;
 	int checkout;
 	int keep_locked;
+	int sparse;
 };
 
 static int show_only;
@@ -211,6 +216,87 @@ static const char *worktree_basename(const char *path, int *olen)
 	return name;
 }
 
+/*
+ * When the index of this worktree holds exactly the tree of "commit",
+ * give the new worktree at "path" a copy of it, together with copies of
+ * the files known to match their entries, so that the checkout there
+ * finds them up to date and only writes the rest. Returns the number of
+ * files copied, or -1 if the index cannot be used.
+ */
+static int seed_worktree(const char *path, const char *git_dir,
+			 struct commit *commit)
+{
+	struct index_state *istate = &the_index;
+	struct lock_file lock = LOCK_INIT;
+	struct strbuf dst = STRBUF_INIT;
+	int i, dst_len, copied = 0;
+
+	if (is_bare_repository() || read_index(istate) < 0 ||
+	    istate->split_index || istate->sparse_index ||
+	    !istate->cache_tree || !cache_tree_fully_valid(istate->cache_tree) ||
+	    oidcmp(&istate->cache_tree->oid, get_commit_tree_oid(commit)))
+		goto fail;
+	for (i = 0; i < istate->cache_nr; i++)
+		if (ce_stage(istate->cache[i]) ||
+		    ce_intent_to_add(istate->cache[i]))
+			goto fail;
+
+	/* these describe this worktree, not the new one */
+	remove_untracked_cache(istate);
+	remove_fsmonitor(istate);
+
+	strbuf_addf(&dst, "%s/", path);
+	dst_len = dst.len;
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct stat st;
+		int clean = S_ISREG(ce->ce_mode) && !ce_skip_worktree(ce) &&
+			!lstat(ce->name, &st) &&
+			!ie_match_stat(istate, ce, &st,
+				       CE_MATCH_IGNORE_VALID |
+				       CE_MATCH_RACY_IS_DIRTY |
+				       CE_MATCH_IGNORE_FSMONITOR);
+
+		/* the checkout decides these afresh */
+		ce->ce_flags &= ~(CE_VALID | CE_SKIP_WORKTREE);
+		strbuf_setlen(&dst, dst_len);
+		strbuf_addstr(&dst, ce->name);
+		if (clean &&
+		    safe_create_leading_directories(dst.buf) == SCLD_OK &&
+		    !copy_file(dst.buf, ce->name, ce->ce_mode) &&
+		    !lstat(dst.buf, &st)) {
+			fill_stat_cache_info(ce, &st);
+			copied++;
+		} else {
+			/* have the checkout write it */
+			memset(&ce->ce_stat_data, 0, sizeof(ce->ce_stat_data));
+		}
+	}
+	strbuf_release(&dst);
+
+	/*
+	 * The copies are known to match, and any racily clean ones are
+	 * caught by the checkout against the timestamp of the new index;
+	 * the one of ours would have them all looked at again here.
+	 */
+	istate->timestamp.sec = 0;
+	istate->timestamp.nsec = 0;
+	istate->cache_changed |= SOMETHING_CHANGED;
+	hold_lock_file_for_update(&lock, mkpath("%s/index", git_dir),
+				  LOCK_DIE_ON_ERROR);
+	if (write_locked_index(istate, &lock, COMMIT_LOCK)) {
+		error(_("could not write index of the new worktree"));
+		goto fail;
+	}
+	discard_index(istate);
+	trace2_data_intmax("worktree", "seeded_files", copied);
+	return copied;
+
+fail:
+	discard_index(istate);
+	return -1;
+}
+
 static int add_worktree(const char *path, const char *refname,
 			const struct add_opts *opts)
 {
@@ -311,7 +397,17 @@ static int add_worktree(const char *path, const char *refname,
 	if (ret)
 		goto done;
 
+	if (opts->sparse) {
+		strbuf_reset(&sb);
+		strbuf_addf(&sb, "%s/info/sparse-checkout", sb_repo.buf);
+		if (safe_create_leading_directories_const(sb.buf) ||
+		    copy_file(sb.buf, git_path("info/sparse-checkout"), 0666))
+			die_errno(_("could not copy sparse-checkout patterns to '%s'"),
+				  sb.buf);
+	}
+
 	if (opts->checkout) {
+		seed_worktree(path, sb_repo.buf, commit);
 		cp.argv = NULL;
 		argv_array_clear(&cp.args);
 		argv_array_pushl(&cp.args, "reset", "--hard", NULL);
@@ -437,6 +533,8 @@ static int add(int ac, const char **av, const char *prefix)
 		OPT_BOOL(0, "detach", &opts.detach, N_("detach HEAD at named commit")),
 		OPT_BOOL(0, "checkout", &opts.checkout, N_("populate the new working tree")),
 		OPT_BOOL(0, "lock", &opts.keep_locked, N_("keep the new working tree locked")),
+		OPT_BOOL(0, "sparse", &opts.sparse,
+			 N_("populate only the paths the sparse-checkout patterns of this worktree select")),
 		OPT_PASSTHRU(0, "track", &opt_track, NULL,
 			     N_("set up tracking mode (see git-branch(1))"),
 			     PARSE_OPT_NOARG | PARSE_OPT_OPTARG),
@@ -452,6 +550,14 @@ static int add(int ac, const char **av, const char *prefix)
 		die(_("-b, -B, and --detach are mutually exclusive"));
 	if (ac < 1 || ac > 2)
 		usage_with_options(worktree_usage, options);
+	if (opts.sparse && !core_apply_sparse_checkout)
+		die(_("--sparse needs core.sparseCheckout"));
+	if (opts.sparse && !file_exists(git_path("info/sparse-checkout")))
+		die(_("--sparse needs sparse-checkout patterns in this worktree"));
+	if (repository_format_ref_storage &&
+	    strcmp(repository_format_ref_storage, "files"))
+		die(_("linked worktrees are not supported with the %s ref storage"),
+		    repository_format_ref_storage);
 
 	path = prefix_filename(prefix, av[0]);
 	branch = ac < 2 ? "HEAD" : av[1];
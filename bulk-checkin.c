@@ -3,12 +3,16 @@
  */
 #include "cache.h"
 #include "bulk-checkin.h"
+#include "config.h"
 #include "repository.h"
 #include "csum-file.h"
 #include "pack.h"
 #include "strbuf.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "tmp-objdir.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 static struct bulk_checkin_state {
 	unsigned plugged:1;
@@ -23,6 +27,14 @@ static struct bulk_checkin_state {
 	uint32_t nr_written;
 } state;
 
+/*
+ * With core.fsyncMethod=batch, the loose objects written while the bulk
+ * checkin is plugged go to this temporary object directory without being
+ * flushed one by one. unplug_bulk_checkin() makes them durable with a
+ * single barrier, and only then moves them into the repository.
+ */
+static struct tmp_objdir *batch_objdir;
+
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	struct object_id oid;
@@ -79,6 +91,199 @@ static int already_written(struct bulk_checkin_state *state, struct object_id *o
 	return 0;
 }
 
+/*
+ * Append "len" bytes to the pack, unless that would make it exceed the
+ * pack size limit and it has objects already; return -1 in that case.
+ */
+static int write_to_pack(struct bulk_checkin_state *state,
+			 const void *buf, size_t len)
+{
+	if (state->nr_written &&
+	    pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + len)
+		return -1;
+
+	hashwrite(state->f, buf, len);
+	state->offset += len;
+	return 0;
+}
+
+/*
+ * Read "len" bytes of the contents from fd into "buf", and hash those
+ * that stream_to_pack() has not hashed in an earlier attempt.
+ */
+static void read_to_pack(git_hash_ctx *ctx, off_t *already_hashed_to,
+			 off_t *offset, int fd, unsigned char *buf,
+			 size_t len, const char *path)
+{
+	ssize_t read_result = read_in_full(fd, buf, len);
+
+	if (read_result < 0)
+		die_errno("failed to read from '%s'", path);
+	if (read_result != len)
+		die("failed to read %d bytes from '%s'", (int)len, path);
+	*offset += len;
+	if (*already_hashed_to < *offset) {
+		size_t hsize = *offset - *already_hashed_to;
+		if (len < hsize)
+			hsize = len;
+		if (hsize)
+			the_hash_algo->update_fn(ctx, buf + len - hsize, hsize);
+		*already_hashed_to = *offset;
+	}
+}
+
+/*
+ * Large blobs are compressed by several threads, PARALLEL_CHUNK bytes
+ * each, the way pigz does it: every chunk is deflated on its own as a
+ * raw stream primed with the DEFLATE_DICT bytes of contents before it,
+ * and ends with a sync flush, or is finished if it is the last one.
+ * Between a zlib header and the adler32 of the whole contents, their
+ * concatenation is a single zlib stream, which is what a pack entry
+ * holds. The contents are read a round of one chunk per thread at a
+ * time.
+ */
+#define PARALLEL_CHUNK (128 * 1024)
+#define DEFLATE_DICT (32 * 1024)
+#define MAX_PARALLEL (8)
+
+static int deflate_threads(void)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_BULK_CHECKIN_THREADS", 0);
+
+	if (!nr_threads) {
+		nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	return nr_threads;
+}
+
+struct deflate_chunk {
+#ifndef NO_PTHREADS
+	pthread_t pthread;
+#endif
+	const unsigned char *in;
+	size_t len, dict_len;
+	int last;
+	unsigned char *out;
+	size_t out_len;
+	uLong adler;
+};
+
+static void *deflate_chunk(void *data)
+{
+	struct deflate_chunk *c = data;
+	git_zstream s;
+	unsigned long bound;
+	int status;
+
+	git_deflate_init_raw(&s, pack_compression_level);
+	if (c->dict_len)
+		deflateSetDictionary(&s.z, c->in - c->dict_len, c->dict_len);
+	/* room for the empty block of the sync flush */
+	bound = git_deflate_bound(&s, c->len) + 16;
+	c->out = xmalloc(bound);
+	s.next_in = (unsigned char *)c->in;
+	s.avail_in = c->len;
+	s.next_out = c->out;
+	s.avail_out = bound;
+	status = git_deflate(&s, c->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (status != (c->last ? Z_STREAM_END : Z_OK) || s.avail_in)
+		die("unexpected deflate failure: %d", status);
+	c->out_len = s.total_out;
+	/* an unfinished stream is "freed prematurely" */
+	git_deflate_abort(&s);
+
+	c->adler = adler32(adler32(0L, Z_NULL, 0), c->in, c->len);
+	return NULL;
+}
+
+static int stream_to_pack_parallel(struct bulk_checkin_state *state,
+				   git_hash_ctx *ctx,
+				   off_t *already_hashed_to,
+				   int fd, size_t size, enum object_type type,
+				   const char *path, int nr_threads)
+{
+	unsigned char hdr[32];
+	unsigned hdrlen;
+	size_t round = nr_threads * PARALLEL_CHUNK;
+	unsigned char *buf = xmalloc(DEFLATE_DICT + round);
+	size_t dict_len = 0;
+	struct deflate_chunk *chunks = xcalloc(nr_threads, sizeof(*chunks));
+	uLong adler = adler32(0L, Z_NULL, 0);
+	off_t offset = 0;
+	intmax_t nr_chunks = 0;
+	int i, nr, ret;
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), type, size);
+	/* deflate with a 32kB window, and no preset dictionary */
+	hdr[hdrlen++] = 0x78;
+	hdr[hdrlen++] = 0x9c;
+	ret = write_to_pack(state, hdr, hdrlen);
+
+	while (!ret && size) {
+		unsigned char *in = buf + dict_len;
+		size_t len = size < round ? size : round, keep;
+
+		read_to_pack(ctx, already_hashed_to, &offset, fd, in, len,
+			     path);
+		size -= len;
+
+		for (nr = 0; nr * PARALLEL_CHUNK < len; nr++) {
+			struct deflate_chunk *c = &chunks[nr];
+
+			c->in = in + nr * PARALLEL_CHUNK;
+			c->len = len - nr * PARALLEL_CHUNK;
+			if (c->len > PARALLEL_CHUNK)
+				c->len = PARALLEL_CHUNK;
+			c->dict_len = c->in - buf;
+			if (c->dict_len > DEFLATE_DICT)
+				c->dict_len = DEFLATE_DICT;
+			c->last = !size && c->in + c->len == in + len;
+		}
+#ifndef NO_PTHREADS
+		if (nr > 1) {
+			for (i = 0; i < nr; i++)
+				if (pthread_create(&chunks[i].pthread, NULL,
+						   deflate_chunk, &chunks[i]))
+					die("unable to create threaded deflate");
+			for (i = 0; i < nr; i++)
+				if (pthread_join(chunks[i].pthread, NULL))
+					die("unable to join threaded deflate");
+		} else
+#endif
+			for (i = 0; i < nr; i++)
+				deflate_chunk(&chunks[i]);
+
+		for (i = 0; i < nr; i++) {
+			struct deflate_chunk *c = &chunks[i];
+
+			adler = adler32_combine(adler, c->adler, c->len);
+			if (!ret)
+				ret = write_to_pack(state, c->out, c->out_len);
+			FREE_AND_NULL(c->out);
+		}
+		nr_chunks += nr;
+
+		/* the end of this round primes the next one */
+		keep = dict_len + len;
+		if (keep > DEFLATE_DICT)
+			keep = DEFLATE_DICT;
+		memmove(buf, in + len - keep, keep);
+		dict_len = keep;
+	}
+	if (!ret) {
+		put_be32(hdr, adler);
+		ret = write_to_pack(state, hdr, 4);
+	}
+	trace2_data_intmax("bulk_checkin", "parallel_chunks", nr_chunks);
+
+	free(chunks);
+	free(buf);
+	return ret;
+}
+
 /*
  * Read the contents from fd for size bytes, streaming it to the
  * packfile in state while updating the hash in ctx. Signal a failure
@@ -105,6 +310,13 @@ static int stream_to_pack(struct bulk_checkin_state *state,
 	int status = Z_OK;
 	int write_object = (flags & HASH_WRITE_OBJECT);
 	off_t offset = 0;
+	int nr_threads;
+
+	if (write_object && size > PARALLEL_CHUNK &&
+	    (nr_threads = deflate_threads()) > 1)
+		return stream_to_pack_parallel(state, ctx, already_hashed_to,
+					       fd, size, type, path,
+					       nr_threads);
 
 	git_deflate_init(&s, pack_compression_level);
 
@@ -116,22 +328,9 @@ static int stream_to_pack(struct bulk_checkin_state *state,
 		unsigned char ibuf[16384];
 
 		if (size && !s.avail_in) {
-			ssize_t rsize = size < sizeof(ibuf) ? size : sizeof(ibuf);
-			ssize_t read_result = read_in_full(fd, ibuf, rsize);
-			if (read_result < 0)
-				die_errno("failed to read from '%s'", path);
-			if (read_result != rsize)
-				die("failed to read %d bytes from '%s'",
-				    (int)rsize, path);
-			offset += rsize;
-			if (*already_hashed_to < offset) {
-				size_t hsize = offset - *already_hashed_to;
-				if (rsize < hsize)
-					hsize = rsize;
-				if (hsize)
-					the_hash_algo->update_fn(ctx, ibuf, hsize);
-				*already_hashed_to = offset;
-			}
+			size_t rsize = size < sizeof(ibuf) ? size : sizeof(ibuf);
+			read_to_pack(ctx, already_hashed_to, &offset, fd,
+				     ibuf, rsize, path);
 			s.next_in = ibuf;
 			s.avail_in = rsize;
 			size -= rsize;
@@ -140,19 +339,10 @@ static int stream_to_pack(struct bulk_checkin_state *state,
 		status = git_deflate(&s, size ? 0 : Z_FINISH);
 
 		if (!s.avail_out || status == Z_STREAM_END) {
-			if (write_object) {
-				size_t written = s.next_out - obuf;
-
-				/* would we bust the size limit? */
-				if (state->nr_written &&
-				    pack_size_limit_cfg &&
-				    pack_size_limit_cfg < state->offset + written) {
-					git_deflate_abort(&s);
-					return -1;
-				}
-
-				hashwrite(state->f, obuf, written);
-				state->offset += written;
+			if (write_object &&
+			    write_to_pack(state, obuf, s.next_out - obuf)) {
+				git_deflate_abort(&s);
+				return -1;
 			}
 			s.next_out = obuf;
 			s.avail_out = sizeof(obuf);
@@ -268,6 +458,67 @@ int index_bulk_checkin(struct object_id *oid,
 	return status;
 }
 
+const char *bulk_checkin_objdir(void)
+{
+	if (!state.plugged || !fsync_object_files ||
+	    fsync_method != FSYNC_METHOD_BATCH)
+		return NULL;
+
+	if (!batch_objdir) {
+		batch_objdir = tmp_objdir_create();
+		if (!batch_objdir)
+			return NULL;
+		tmp_objdir_add_as_alternate(batch_objdir);
+	}
+	return tmp_objdir_path(batch_objdir);
+}
+
+void fsync_loose_object_bulk_checkin(int fd)
+{
+#ifdef HAVE_SYNCFS
+	/*
+	 * The syncfs() in finish_batch_objdir() writes the data out; only
+	 * start the writeback now, so that it overlaps with the next objects.
+	 */
+#ifdef HAVE_SYNC_FILE_RANGE
+	sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+#else
+	/*
+	 * A single fsync() does not write out the data of other files on
+	 * every platform, so flush each object; we still save the renames
+	 * into the repository until the whole batch is written.
+	 */
+	fsync_or_die(fd, "loose object file");
+#endif
+}
+
+static void finish_batch_objdir(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	int fd;
+
+	if (!batch_objdir)
+		return;
+
+	strbuf_addf(&path, "%s/bulk_fsync_XXXXXX",
+		    tmp_objdir_path(batch_objdir));
+	fd = xmkstemp(path.buf);
+#ifdef HAVE_SYNCFS
+	if (syncfs(fd) < 0)
+		die_errno("syncfs error on '%s'", path.buf);
+#else
+	fsync_or_die(fd, path.buf);
+#endif
+	close(fd);
+	unlink_or_warn(path.buf);
+	strbuf_release(&path);
+
+	if (tmp_objdir_migrate(batch_objdir))
+		die("unable to move the new objects into the repository");
+	batch_objdir = NULL;
+}
+
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
@@ -278,4 +529,5 @@ void unplug_bulk_checkin(void)
 	state.plugged = 0;
 	if (state.f)
 		finish_bulk_checkin(&state);
+	finish_batch_objdir();
 }
@@ -8,6 +8,19 @@ extern int index_bulk_checkin(struct object_id *oid,
 			      int fd, size_t size, enum object_type type,
 			      const char *path, unsigned flags);
 
+/*
+ * While the bulk checkin is plugged and core.fsyncMethod is "batch",
+ * return the directory new loose objects are written to, or NULL if they
+ * go to the object directory and are flushed one by one as usual.
+ */
+extern const char *bulk_checkin_objdir(void);
+
+/*
+ * Flush a loose object written to bulk_checkin_objdir(), before it is
+ * closed; the flush may be deferred until unplug_bulk_checkin().
+ */
+extern void fsync_loose_object_bulk_checkin(int fd);
+
 extern void plug_bulk_checkin(void);
 extern void unplug_bulk_checkin(void);
 
@@ -0,0 +1,384 @@
+#include "cache.h"
+#include "bundle-uri.h"
+#include "bundle.h"
+#include "config.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "refs.h"
+#include "repository.h"
+#include "run-command.h"
+
+enum bundle_list_mode {
+	BUNDLE_MODE_ALL = 0,
+	BUNDLE_MODE_ANY
+};
+
+struct remote_bundle_info {
+	char *id;
+	char *uri;
+
+	/* where the bundle is on disk, once downloaded */
+	char *file;
+	unsigned unlink_file : 1,
+		 unbundled : 1;
+};
+
+struct bundle_list {
+	enum bundle_list_mode mode;
+	const char *base_uri;
+	struct remote_bundle_info *bundles;
+	int nr, alloc;
+};
+
+static struct remote_bundle_info *bundle_list_lookup(struct bundle_list *list,
+						     const char *id,
+						     size_t id_len)
+{
+	struct remote_bundle_info *b;
+	int i;
+
+	for (i = 0; i < list->nr; i++) {
+		b = &list->bundles[i];
+		if (!strncmp(b->id, id, id_len) && !b->id[id_len])
+			return b;
+	}
+
+	ALLOC_GROW(list->bundles, list->nr + 1, list->alloc);
+	b = &list->bundles[list->nr++];
+	memset(b, 0, sizeof(*b));
+	b->id = xmemdupz(id, id_len);
+	return b;
+}
+
+static void clear_bundle_list(struct bundle_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++) {
+		struct remote_bundle_info *b = &list->bundles[i];
+
+		if (b->unlink_file)
+			unlink_or_warn(b->file);
+		free(b->id);
+		free(b->uri);
+		free(b->file);
+	}
+	FREE_AND_NULL(list->bundles);
+	list->nr = list->alloc = 0;
+}
+
+/*
+ * Resolve "uri" against the URI of the list it was found in, unless
+ * it is absolute.
+ */
+static char *resolve_bundle_uri(const char *base, const char *uri)
+{
+	const char *slash;
+
+	if (strstr(uri, "://") || is_absolute_path(uri))
+		return xstrdup(uri);
+
+	slash = strrchr(base, '/');
+	if (!slash)
+		return xstrdup(uri);
+	return xstrfmt("%.*s/%s", (int)(slash - base), base, uri);
+}
+
+static int bundle_list_config(const char *var, const char *value, void *data)
+{
+	struct bundle_list *list = data;
+	const char *subsection, *key;
+	int subsection_len;
+
+	if (parse_config_key(var, "bundle", &subsection, &subsection_len, &key))
+		return 0;
+
+	if (!subsection) {
+		if (!strcmp(key, "version")) {
+			if (!value || strcmp(value, "1"))
+				return error(_("unsupported bundle list version '%s'"),
+					     value);
+		} else if (!strcmp(key, "mode")) {
+			if (!value)
+				return config_error_nonbool(var);
+			if (!strcmp(value, "all"))
+				list->mode = BUNDLE_MODE_ALL;
+			else if (!strcmp(value, "any"))
+				list->mode = BUNDLE_MODE_ANY;
+			else
+				return error(_("unknown bundle list mode '%s'"),
+					     value);
+		}
+		return 0;
+	}
+
+	if (!strcmp(key, "uri")) {
+		struct remote_bundle_info *b;
+
+		if (!value)
+			return config_error_nonbool(var);
+		b = bundle_list_lookup(list, subsection, subsection_len);
+		free(b->uri);
+		b->uri = resolve_bundle_uri(list->base_uri, value);
+	}
+
+	/* ignore other keys, which may be understood by newer Git */
+	return 0;
+}
+
+static int download_with_remote_helper(const char *uri, const char *file)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	struct strbuf line = STRBUF_INIT;
+	const char *scheme_end = strstr(uri, "://");
+	FILE *child_in, *child_out;
+	int found_get = 0, ret = 0;
+
+	cp.git_cmd = 1;
+	argv_array_pushf(&cp.args, "remote-%.*s",
+			 (int)(scheme_end - uri), uri);
+	argv_array_push(&cp.args, uri);
+	cp.in = -1;
+	cp.out = -1;
+	if (start_command(&cp))
+		return error(_("unable to run the remote helper for '%s'"), uri);
+
+	child_in = xfdopen(cp.in, "w");
+	child_out = xfdopen(cp.out, "r");
+
+	fprintf(child_in, "capabilities\n");
+	fflush(child_in);
+	while (!strbuf_getline_lf(&line, child_out) && line.len)
+		if (!strcmp(line.buf, "get"))
+			found_get = 1;
+	if (!found_get) {
+		ret = error(_("remote helper for '%s' cannot download files"),
+			    uri);
+		goto cleanup;
+	}
+
+	fprintf(child_in, "get %s %s\n\n", uri, file);
+	fflush(child_in);
+	if (strbuf_getline_lf(&line, child_out) || line.len)
+		ret = error(_("unable to download '%s'"), uri);
+
+cleanup:
+	fclose(child_in);
+	fclose(child_out);
+	if (finish_command(&cp))
+		ret = -1;
+	strbuf_release(&line);
+	return ret;
+}
+
+/*
+ * Make the file at "uri" available on disk, as "b->file". Local files
+ * are used in place; anything else goes to a temporary file that is
+ * removed again with the list.
+ */
+static int download_bundle(struct remote_bundle_info *b)
+{
+	struct strbuf file = STRBUF_INIT;
+	const char *path = NULL;
+	int fd;
+
+	if (!skip_prefix(b->uri, "file://", &path) && !strstr(b->uri, "://"))
+		path = b->uri;
+	if (path) {
+		if (access(path, R_OK))
+			return error_errno(_("unable to read '%s'"), b->uri);
+		b->file = xstrdup(path);
+		return 0;
+	}
+
+	/*
+	 * We only want a unique name: the helper moves the download into
+	 * place, and would keep an existing file over it.
+	 */
+	fd = odb_mkstemp(&file, "pack/tmp_bundle_XXXXXX");
+	close(fd);
+	unlink(file.buf);
+	b->file = strbuf_detach(&file, NULL);
+	b->unlink_file = 1;
+	return download_with_remote_helper(b->uri, b->file);
+}
+
+static int has_all_prerequisites(const struct bundle_header *header)
+{
+	int i;
+
+	for (i = 0; i < header->prerequisites.nr; i++)
+		if (!has_object_file(&header->prerequisites.list[i].oid))
+			return 0;
+	return 1;
+}
+
+static void write_bundle_refs(const struct bundle_header *header)
+{
+	struct strbuf refname = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < header->references.nr; i++) {
+		const struct ref_list_entry *e = &header->references.list[i];
+		const char *branch;
+
+		if (!skip_prefix(e->name, "refs/heads/", &branch))
+			continue;
+
+		strbuf_reset(&refname);
+		strbuf_addf(&refname, "refs/bundles/%s", branch);
+		update_ref("fetched bundle", refname.buf, &e->oid, NULL, 0,
+			   UPDATE_REFS_MSG_ON_ERR);
+	}
+	strbuf_release(&refname);
+}
+
+/*
+ * Unbundle "b" if the objects it builds on are all there already.
+ * Returns 1 if it was unbundled, 0 if it has to wait for another bundle,
+ * and -1 on errors.
+ */
+static int try_unbundle(struct repository *r, struct remote_bundle_info *b)
+{
+	struct bundle_header header;
+	int fd, ret = 0;
+
+	memset(&header, 0, sizeof(header));
+	fd = read_bundle_header(b->file, &header);
+	if (fd < 0) {
+		ret = -1;
+		goto cleanup;
+	}
+	if (!has_all_prerequisites(&header)) {
+		close(fd);
+		goto cleanup;
+	}
+
+	/* unbundle() closes "fd" */
+	if (unbundle(&header, fd, 0)) {
+		ret = error(_("unable to unbundle '%s'"), b->uri);
+		goto cleanup;
+	}
+	reprepare_packed_git(r);
+	write_bundle_refs(&header);
+	b->unbundled = 1;
+	ret = 1;
+
+cleanup:
+	release_bundle_header(&header);
+	return ret;
+}
+
+static int unbundle_all(struct repository *r, struct bundle_list *list)
+{
+	int i, progress, nr_unbundled = 0;
+
+	for (i = 0; i < list->nr; i++) {
+		struct remote_bundle_info *b = &list->bundles[i];
+
+		if (!b->uri)
+			continue;
+		if (download_bundle(b) || !is_bundle(b->file, 0)) {
+			warning(_("ignoring bundle '%s'"), b->uri);
+			FREE_AND_NULL(b->uri);
+		}
+	}
+
+	/*
+	 * The list does not tell which bundle builds on which, so keep
+	 * unbundling those whose prerequisites we already have.
+	 */
+	do {
+		progress = 0;
+		for (i = 0; i < list->nr; i++) {
+			struct remote_bundle_info *b = &list->bundles[i];
+			int ret;
+
+			if (!b->uri || b->unbundled)
+				continue;
+			ret = try_unbundle(r, b);
+			if (ret < 0)
+				FREE_AND_NULL(b->uri);
+			else if (ret > 0) {
+				progress = 1;
+				nr_unbundled++;
+			}
+		}
+	} while (progress);
+
+	for (i = 0; i < list->nr; i++) {
+		struct remote_bundle_info *b = &list->bundles[i];
+
+		if (b->uri && !b->unbundled)
+			warning(_("bundle '%s' lacks prerequisites; ignoring it"),
+				b->uri);
+	}
+	return nr_unbundled ? 0 : -1;
+}
+
+static int unbundle_any(struct repository *r, struct bundle_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++) {
+		struct remote_bundle_info *b = &list->bundles[i];
+
+		if (!b->uri)
+			continue;
+		if (download_bundle(b) || !is_bundle(b->file, 0) ||
+		    try_unbundle(r, b) <= 0) {
+			warning(_("ignoring bundle '%s'"), b->uri);
+			continue;
+		}
+		return 0;
+	}
+	return -1;
+}
+
+int fetch_bundle_uri(struct repository *r, const char *uri)
+{
+	struct bundle_list list;
+	struct remote_bundle_info *b;
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+
+	memset(&list, 0, sizeof(list));
+	list.base_uri = uri;
+
+	b = bundle_list_lookup(&list, "", 0);
+	b->uri = xstrdup(uri);
+	if (download_bundle(b)) {
+		ret = -1;
+		goto cleanup;
+	}
+
+	if (is_bundle(b->file, 1)) {
+		/* a single bundle, rather than a list of them */
+		ret = try_unbundle(r, b);
+		if (!ret)
+			warning(_("bundle '%s' lacks prerequisites; ignoring it"),
+				uri);
+		ret = ret > 0 ? 0 : -1;
+		goto cleanup;
+	}
+
+	/* keep the list file itself out of the bundles it lists */
+	FREE_AND_NULL(b->uri);
+	if (strbuf_read_file(&buf, b->file, 0) < 0 ||
+	    git_config_from_mem(bundle_list_config, CONFIG_ORIGIN_FILE, uri,
+				buf.buf, buf.len, &list)) {
+		ret = error(_("'%s' is neither a bundle nor a bundle list"),
+			    uri);
+		goto cleanup;
+	}
+
+	if (list.mode == BUNDLE_MODE_ANY)
+		ret = unbundle_any(r, &list);
+	else
+		ret = unbundle_all(r, &list);
+
+cleanup:
+	clear_bundle_list(&list);
+	strbuf_release(&buf);
+	return ret;
+}
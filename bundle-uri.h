@@ -0,0 +1,36 @@
+#ifndef BUNDLE_URI_H
+#define BUNDLE_URI_H
+
+struct repository;
+
+/*
+ * Download and unbundle the bundles at the given URI into the object
+ * store of "r", before fetching the rest from the remote as usual.
+ *
+ * The URI is either that of a single bundle, or that of a bundle list:
+ * a file in config format, like
+ *
+ *	[bundle]
+ *		version = 1
+ *		mode = all
+ *	[bundle "base"]
+ *		uri = base.bundle
+ *	[bundle "incremental"]
+ *		uri = https://example.com/incremental.bundle
+ *
+ * where relative URIs are relative to the URI of the list. With mode
+ * "all", every bundle is unbundled, so that they can form incremental
+ * chains in any order; with mode "any", they are mirrors of each other
+ * and the first one that can be unbundled is used. The URIs can be
+ * local paths, "file://" URIs, or URIs that a remote helper with the
+ * "get" capability (like "git remote-https") can download.
+ *
+ * The branches of each bundle are stored as "refs/bundles/<branch>", so
+ * that the objects they bring are used as common history when fetching
+ * later.
+ *
+ * Returns 0 if at least one bundle was unbundled, and -1 otherwise.
+ */
+extern int fetch_bundle_uri(struct repository *r, const char *uri);
+
+#endif
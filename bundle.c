@@ -90,6 +90,22 @@ int read_bundle_header(const char *path, struct bundle_header *header)
 	return parse_bundle_header(fd, header, path);
 }
 
+static void release_ref_list(struct ref_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++)
+		free(list->list[i].name);
+	FREE_AND_NULL(list->list);
+	list->nr = list->alloc = 0;
+}
+
+void release_bundle_header(struct bundle_header *header)
+{
+	release_ref_list(&header->prerequisites);
+	release_ref_list(&header->references);
+}
+
 int is_bundle(const char *path, int quiet)
 {
 	struct bundle_header header;
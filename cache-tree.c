@@ -43,7 +43,7 @@ static int subtree_name_cmp(const char *one, int onelen,
 	return memcmp(one, two, onelen);
 }
 
-static int subtree_pos(struct cache_tree *it, const char *path, int pathlen)
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen)
 {
 	struct cache_tree_sub **down = it->down;
 	int lo, hi;
@@ -70,7 +70,7 @@ static struct cache_tree_sub *find_subtree(struct cache_tree *it,
 					   int create)
 {
 	struct cache_tree_sub *down;
-	int pos = subtree_pos(it, path, pathlen);
+	int pos = cache_tree_subtree_pos(it, path, pathlen);
 	if (0 <= pos)
 		return it->down[pos];
 	if (!create)
@@ -121,7 +121,7 @@ static int do_invalidate_path(struct cache_tree *it, const char *path)
 	it->entry_count = -1;
 	if (!*slash) {
 		int pos;
-		pos = subtree_pos(it, path, namelen);
+		pos = cache_tree_subtree_pos(it, path, namelen);
 		if (0 <= pos) {
 			cache_tree_free(&it->down[pos]->cache_tree);
 			free(it->down[pos]);
@@ -252,6 +252,23 @@ static int update_one(struct cache_tree *it,
 
 	*skip_count = 0;
 
+	/*
+	 * A sparse directory entry that names "base" itself stands for
+	 * the whole subtree; it is a leaf of the cache-tree pointing at
+	 * the tree recorded in the entry.
+	 */
+	if (entries > 0) {
+		const struct cache_entry *ce = cache[0];
+
+		if (S_ISSPARSEDIR(ce->ce_mode) &&
+		    ce_namelen(ce) == baselen &&
+		    !memcmp(ce->name, base, baselen)) {
+			it->entry_count = 1;
+			oidcpy(&it->oid, &ce->oid);
+			return 1;
+		}
+	}
+
 	if (0 <= it->entry_count && has_sha1_file(it->oid.hash))
 		return it->entry_count;
 
@@ -683,6 +700,32 @@ static void prime_cache_tree_rec(struct cache_tree *it, struct tree *tree)
 	it->entry_count = cnt;
 }
 
+void cache_tree_prime_path(struct cache_tree *root, const char *path,
+			   int entry_count, const struct object_id *oid)
+{
+	struct cache_tree *it = root;
+	int i;
+
+	while (*path) {
+		const char *slash = strchrnul(path, '/');
+		struct cache_tree_sub *sub = find_subtree(it, path,
+							  slash - path, 1);
+
+		if (!sub->cache_tree)
+			sub->cache_tree = cache_tree();
+		it = sub->cache_tree;
+		path = *slash ? slash + 1 : slash;
+	}
+	/* those of its subdirectories get primed after it, if at all */
+	for (i = 0; i < it->subtree_nr; i++) {
+		cache_tree_free(&it->down[i]->cache_tree);
+		free(it->down[i]);
+	}
+	it->subtree_nr = 0;
+	it->entry_count = entry_count;
+	oidcpy(&it->oid, oid);
+}
+
 void prime_cache_tree(struct index_state *istate, struct tree *tree)
 {
 	cache_tree_free(&istate->cache_tree);
@@ -27,6 +27,12 @@ void cache_tree_free(struct cache_tree **);
 void cache_tree_invalidate_path(struct index_state *, const char *);
 struct cache_tree_sub *cache_tree_sub(struct cache_tree *, const char *);
 
+/*
+ * Return the position of the subtree "path" (of length "pathlen") in
+ * it->down[], or a negative value if there is no such subtree.
+ */
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen);
+
 void cache_tree_write(struct strbuf *, struct cache_tree *root);
 struct cache_tree *cache_tree_read(const char *buffer, unsigned long size);
 
@@ -51,6 +57,15 @@ int write_index_as_tree(struct object_id *oid, struct index_state *index_state,
 int write_cache_as_tree(struct object_id *oid, int flags, const char *prefix);
 void prime_cache_tree(struct index_state *, struct tree *);
 
+/*
+ * Make the cache-tree of "path" (a directory, without the trailing
+ * slash) below "root" valid, as the tree "oid" of "entry_count" index
+ * entries, and forget its subtrees; the trees above it are left as
+ * they are.
+ */
+void cache_tree_prime_path(struct cache_tree *root, const char *path,
+			   int entry_count, const struct object_id *oid);
+
 extern int cache_tree_matches_traversal(struct cache_tree *, struct name_entry *ent, struct traverse_info *info);
 
 #endif
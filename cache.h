@@ -15,6 +15,7 @@
 #include "path.h"
 #include "sha1-array.h"
 #include "repository.h"
+#include "mem-pool.h"
 
 #include <zlib.h>
 typedef struct git_zstream {
@@ -41,13 +42,41 @@ int git_deflate_end_gently(git_zstream *);
 int git_deflate(git_zstream *, int flush);
 unsigned long git_deflate_bound(git_zstream *, unsigned long);
 
+/*
+ * Inflate the zlib stream at the start of the "inlen" bytes at "in"
+ * into "out", in one go.  "size" is the exact inflated size, as known
+ * from e.g. a pack entry header.  On success, store the number of
+ * input bytes the stream took in "consumed" and return 0.  Return -1
+ * when the stream is corrupt, inflates to anything but "size" bytes,
+ * or does not end within "inlen"; the caller should then fall back to
+ * git_inflate(), which also reports the error.
+ *
+ * With USE_LIBDEFLATE, this (and git_deflate_buffer() below) use
+ * libdeflate instead of zlib.
+ */
+int git_inflate_buffer(void *out, unsigned long size,
+		       const void *in, unsigned long inlen,
+		       unsigned long *consumed);
+
+/*
+ * Deflate "size" bytes at "in" at compression "level" into a newly
+ * allocated buffer, which is returned; its size is stored in
+ * "result_size".
+ */
+void *git_deflate_buffer(const void *in, unsigned long size, int level,
+			 unsigned long *result_size);
+
 /* The length in bytes and in hex digits of an object name (SHA-1 value). */
 #define GIT_SHA1_RAWSZ 20
 #define GIT_SHA1_HEXSZ (2 * GIT_SHA1_RAWSZ)
 
+/* The length in bytes and in hex digits of an object name (SHA-256 value). */
+#define GIT_SHA256_RAWSZ 32
+#define GIT_SHA256_HEXSZ (2 * GIT_SHA256_RAWSZ)
+
 /* The length in byte and in hex digits of the largest possible hash value. */
-#define GIT_MAX_RAWSZ GIT_SHA1_RAWSZ
-#define GIT_MAX_HEXSZ GIT_SHA1_HEXSZ
+#define GIT_MAX_RAWSZ GIT_SHA256_RAWSZ
+#define GIT_MAX_HEXSZ GIT_SHA256_HEXSZ
 
 struct object_id {
 	unsigned char hash[GIT_MAX_RAWSZ];
@@ -81,6 +110,12 @@ struct object_id {
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * A "sparse directory" entry of a sparse index records a whole tree
+ * outside of the sparse checkout; its name ends with a '/'.
+ */
+#define S_ISSPARSEDIR(m) ((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -129,7 +164,7 @@ struct cache_header {
 };
 
 #define INDEX_FORMAT_LB 2
-#define INDEX_FORMAT_UB 4
+#define INDEX_FORMAT_UB 5
 
 /*
  * The "cache_time" is just the low 32 bits of the
@@ -159,6 +194,7 @@ struct cache_entry {
 	unsigned int ce_namelen;
 	unsigned int index;	/* for link extension */
 	struct object_id oid;
+	unsigned int mem_pool_allocated;
 	char name[FLEX_ARRAY]; /* more */
 };
 
@@ -221,12 +257,14 @@ struct child_process;
 
 /*
  * Copy the sha1 and stat state of a cache entry from one to
- * another. But we never change the name, or the hash state!
+ * another. But we never change the name, or the hash state,
+ * or where the entry was allocated from!
  */
 static inline void copy_cache_entry(struct cache_entry *dst,
 				    const struct cache_entry *src)
 {
 	unsigned int state = dst->ce_flags & CE_HASHED;
+	int mem_pool_allocated = dst->mem_pool_allocated;
 
 	/* Don't copy hash chain and name */
 	memcpy(&dst->ce_stat_data, &src->ce_stat_data,
@@ -235,6 +273,9 @@ static inline void copy_cache_entry(struct cache_entry *dst,
 
 	/* Restore the hash state */
 	dst->ce_flags = (dst->ce_flags & ~CE_HASHED) | state;
+
+	/* Restore the mem_pool_allocated flag */
+	dst->mem_pool_allocated = mem_pool_allocated;
 }
 
 static inline unsigned create_ce_flags(unsigned stage)
@@ -321,13 +362,17 @@ struct index_state {
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
 		 initialized : 1,
-		 drop_cache_tree : 1;
+		 drop_cache_tree : 1,
+		 sparse_index : 1,
+		 partial : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	struct object_id oid;
 	struct untracked_cache *untracked;
 	uint64_t fsmonitor_last_update;
 	struct ewah_bitmap *fsmonitor_dirty;
+	/* the cache entries of the index are allocated from this pool */
+	struct mem_pool *ce_mem_pool;
 };
 
 extern struct index_state the_index;
@@ -348,7 +393,7 @@ extern void free_name_hash(struct index_state *istate);
 
 #define read_cache() read_index(&the_index)
 #define read_cache_from(path) read_index_from(&the_index, (path), (get_git_dir()))
-#define read_cache_preload(pathspec) read_index_preload(&the_index, (pathspec))
+#define read_cache_preload(pathspec, flags) read_index_preload(&the_index, (pathspec), (flags))
 #define is_cache_unborn() is_index_unborn(&the_index)
 #define read_cache_unmerged() read_index_unmerged(&the_index)
 #define discard_cache() discard_index(&the_index)
@@ -597,11 +642,28 @@ extern int daemonize(void);
 /* Initialize and use the cache information */
 struct lock_file;
 extern int read_index(struct index_state *);
-extern int read_index_preload(struct index_state *, const struct pathspec *pathspec);
+/*
+ * With PRELOAD_REFRESH, the caller is about to refresh the index, and
+ * the entries whose files look modified but have the same contents are
+ * refreshed while preloading already.
+ */
+#define PRELOAD_REFRESH 0x0001
+extern int read_index_preload(struct index_state *, const struct pathspec *pathspec,
+			      unsigned int flags);
 extern int do_read_index(struct index_state *istate, const char *path,
 			 int must_exist); /* for testting only! */
 extern int read_index_from(struct index_state *, const char *path,
 			   const char *gitdir);
+/*
+ * Like read_index_from(), but read only the entries "pathspec" may
+ * match, and verify the checksums of just the blocks they are in, if
+ * the index is in version 5.  Such an index is marked as partial, has
+ * none of the extensions and cannot be written out.  Other indexes are
+ * read as a whole.
+ */
+extern int read_index_from_pathspec(struct index_state *, const char *path,
+				    const char *gitdir,
+				    const struct pathspec *pathspec);
 extern int is_index_unborn(struct index_state *);
 extern int read_index_unmerged(struct index_state *);
 
@@ -698,7 +760,28 @@ extern int remove_file_from_index(struct index_state *, const char *path);
 extern int add_to_index(struct index_state *, const char *path, struct stat *, int flags);
 extern int add_file_to_index(struct index_state *, const char *path, int flags);
 
-extern struct cache_entry *make_cache_entry(unsigned int mode, const unsigned char *sha1, const char *path, int stage, unsigned int refresh_options);
+/*
+ * Like add_to_index(), for a regular file whose contents are already
+ * in the object store as the blob "oid", e.g. as they were hashed
+ * ahead of time by another thread.
+ */
+extern int add_blob_to_index(struct index_state *, const char *path,
+			     struct stat *, const struct object_id *oid,
+			     int flags);
+
+/*
+ * Cache entries that are added to an index are allocated from the
+ * memory pool of that index, and are freed all at once when the index
+ * is discarded. Entries that are only used temporarily ("transient")
+ * are allocated on the heap. Either kind is released with
+ * discard_cache_entry(), which does nothing for an entry of a pool.
+ */
+extern struct cache_entry *make_empty_cache_entry(struct index_state *istate, size_t name_len);
+extern struct cache_entry *make_cache_entry(struct index_state *istate, unsigned int mode, const unsigned char *sha1, const char *path, int stage, unsigned int refresh_options);
+extern struct cache_entry *make_empty_transient_cache_entry(size_t name_len);
+extern struct cache_entry *make_transient_cache_entry(unsigned int mode, const unsigned char *sha1, const char *path, int stage);
+extern void discard_cache_entry(struct cache_entry *ce);
+
 extern int chmod_index_entry(struct index_state *, struct cache_entry *ce, char flip);
 extern int ce_same_name(const struct cache_entry *a, const struct cache_entry *b);
 extern void set_object_name_for_intent_to_add_entry(struct cache_entry *ce);
@@ -751,7 +834,14 @@ extern void fill_stat_cache_info(struct cache_entry *ce, struct stat *st);
 #define REFRESH_IGNORE_SUBMODULES	0x0010	/* ignore submodules */
 #define REFRESH_IN_PORCELAIN	0x0020	/* user friendly output, not "needs update" */
 extern int refresh_index(struct index_state *, unsigned int flags, const struct pathspec *pathspec, char *seen, const char *header_msg);
-extern struct cache_entry *refresh_cache_entry(struct cache_entry *, unsigned int);
+extern struct cache_entry *refresh_cache_entry(struct index_state *, struct cache_entry *, unsigned int);
+
+/*
+ * The work tree file of the entry at "pos" was found to have the
+ * contents the entry records while its stat information "st" did not
+ * match: take "st" into the index as refresh_index() would.
+ */
+extern void refresh_index_entry_at(struct index_state *, int pos, struct stat *st);
 
 /*
  * Opportunistically update the index but do not complain if we can't.
@@ -787,6 +877,15 @@ extern int pack_compression_level;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+extern size_t tree_cache_limit;
+extern int core_compact_object_walk;
+
+enum delta_base_cache_policy {
+	DELTA_BASE_CACHE_LRU,
+	DELTA_BASE_CACHE_ARC
+};
+
+extern enum delta_base_cache_policy delta_base_cache_policy;
 extern unsigned long big_file_threshold;
 extern unsigned long pack_size_limit_cfg;
 
@@ -813,12 +912,24 @@ extern char *git_replace_ref_base;
 
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_bulk_stat;
+extern int core_loose_object_cache;
 extern int core_commit_graph;
+extern int core_multi_pack_index;
 extern int core_apply_sparse_checkout;
+extern int core_sparse_checkout_cone;
+
+/*
+ * Commands that know how to deal with the sparse directory entries of
+ * a sparse index clear this before reading the index; everybody else
+ * sees a fully expanded index.
+ */
+extern int command_requires_full_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
 extern const char *core_fsmonitor;
+extern int core_fsmonitor_use_daemon;
 
 /*
  * Include broken refs in all ref iterations, which will
@@ -892,6 +1003,13 @@ enum object_creation_mode {
 
 extern enum object_creation_mode object_creation_mode;
 
+enum fsync_method {
+	FSYNC_METHOD_FSYNC = 0,
+	FSYNC_METHOD_BATCH
+};
+
+extern enum fsync_method fsync_method;
+
 extern char *notes_ref_name;
 
 extern int grafts_replace_parents;
@@ -905,12 +1023,14 @@ extern int grafts_replace_parents;
 #define GIT_REPO_VERSION_READ 1
 extern int repository_format_precious_objects;
 extern char *repository_format_partial_clone;
+extern char *repository_format_ref_storage;
 extern const char *core_partial_clone_filter_default;
 
 struct repository_format {
 	int version;
 	int precious_objects;
 	char *partial_clone; /* value of extensions.partialclone */
+	char *ref_storage; /* value of extensions.refstorage */
 	int is_bare;
 	int hash_algo;
 	char *work_tree;
@@ -1704,6 +1824,12 @@ void overlay_tree_on_index(struct index_state *istate,
 struct startup_info {
 	int have_repository;
 	const char *prefix;
+	/*
+	 * Set in a command run by "git command-server", which finds the
+	 * repository already set up; setup_git_directory() then only
+	 * returns "prefix".
+	 */
+	int served;
 };
 extern struct startup_info *startup_info;
 
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "object-store.h"
 #include "commit.h"
 #include "blob.h"
@@ -12,6 +13,8 @@
 #include "userdiff.h"
 #include "sha1-array.h"
 #include "revision.h"
+#include "fetch-object.h"
+#include "thread-utils.h"
 
 static int compare_paths(const struct combine_diff_path *one,
 			  const struct diff_filespec *two)
@@ -335,58 +338,66 @@ static void append_lost(struct sline *sline, int n, const char *line, int len)
 }
 
 struct combine_diff_state {
-	unsigned int lno;
-	int ob, on, nb, nn;
 	unsigned long nmask;
 	int num_parent;
 	int n;
 	struct sline *sline;
-	struct sline *lost_bucket;
+	/* the parent, and the start of its line number "parent_lno" */
+	const char *parent, *parent_end;
+	const char *parent_pos;
+	long parent_lno;
 };
 
-static void consume_line(void *state_, char *line, unsigned long len)
+/*
+ * Take a hunk of the diff between parent N and the result straight
+ * from xdiff, rather than as text to parse: attach the lines it
+ * removes from the parent to the line of the result they come before,
+ * and mark the lines it adds as not coming from parent N.
+ */
+static int consume_hunk(long start_a, long count_a,
+			long start_b, long count_b, void *state_)
 {
 	struct combine_diff_state *state = state_;
-	if (5 < len && !memcmp("@@ -", line, 4)) {
-		if (parse_hunk_header(line, len,
-				      &state->ob, &state->on,
-				      &state->nb, &state->nn))
-			return;
-		state->lno = state->nb;
-		if (state->nn == 0) {
-			/* @@ -X,Y +N,0 @@ removed Y lines
-			 * that would have come *after* line N
-			 * in the result.  Our lost buckets hang
-			 * to the line after the removed lines,
-			 *
-			 * Note that this is correct even when N == 0,
-			 * in which case the hunk removes the first
-			 * line in the file.
-			 */
-			state->lost_bucket = &state->sline[state->nb];
-			if (!state->nb)
-				state->nb = 1;
-		} else {
-			state->lost_bucket = &state->sline[state->nb-1];
-		}
-		if (!state->sline[state->nb-1].p_lno)
-			state->sline[state->nb-1].p_lno =
-				xcalloc(state->num_parent,
-					sizeof(unsigned long));
-		state->sline[state->nb-1].p_lno[state->n] = state->ob;
-		return;
+	struct sline *lost_bucket;
+	/* the line numbers a "@@ -ob,on +nb,nn @@" header would show */
+	long ob = count_a ? start_a + 1 : start_a;
+	long nb = count_b ? start_b + 1 : start_b;
+	long i;
+
+	if (count_b == 0) {
+		/* @@ -X,Y +N,0 @@ removed Y lines
+		 * that would have come *after* line N
+		 * in the result.  Our lost buckets hang
+		 * to the line after the removed lines,
+		 *
+		 * Note that this is correct even when N == 0,
+		 * in which case the hunk removes the first
+		 * line in the file.
+		 */
+		lost_bucket = &state->sline[nb];
+		if (!nb)
+			nb = 1;
+	} else {
+		lost_bucket = &state->sline[nb-1];
 	}
-	if (!state->lost_bucket)
-		return; /* not in any hunk yet */
-	switch (line[0]) {
-	case '-':
-		append_lost(state->lost_bucket, state->n, line+1, len-1);
-		break;
-	case '+':
-		state->sline[state->lno-1].flag |= state->nmask;
-		state->lno++;
-		break;
+	if (!state->sline[nb-1].p_lno)
+		state->sline[nb-1].p_lno =
+			xcalloc(state->num_parent, sizeof(unsigned long));
+	state->sline[nb-1].p_lno[state->n] = ob;
+
+	/* the hunks come in order, so the parent is only scanned once */
+	for (; state->parent_lno < start_a + count_a; state->parent_lno++) {
+		const char *line = state->parent_pos;
+		const char *eol = memchr(line, '\n', state->parent_end - line);
+
+		state->parent_pos = eol ? eol + 1 : state->parent_end;
+		if (state->parent_lno >= start_a)
+			append_lost(lost_bucket, state->n, line,
+				    state->parent_pos - line);
 	}
+	for (i = nb - 1; i < nb - 1 + count_b; i++)
+		state->sline[i].flag |= state->nmask;
+	return 0;
 }
 
 static void combine_diff(const struct object_id *parent, unsigned int mode,
@@ -400,6 +411,7 @@ static void combine_diff(const struct object_id *parent, unsigned int mode,
 	unsigned long nmask = (1UL << n);
 	xpparam_t xpp;
 	xdemitconf_t xecfg;
+	xdemitcb_t ecb;
 	mmfile_t parent_file;
 	struct combine_diff_state state;
 	unsigned long sz;
@@ -412,15 +424,18 @@ static void combine_diff(const struct object_id *parent, unsigned int mode,
 	memset(&xpp, 0, sizeof(xpp));
 	xpp.flags = flags;
 	memset(&xecfg, 0, sizeof(xecfg));
+	xecfg.hunk_func = consume_hunk;
 	memset(&state, 0, sizeof(state));
 	state.nmask = nmask;
 	state.sline = sline;
-	state.lno = 1;
 	state.num_parent = num_parent;
 	state.n = n;
+	state.parent = state.parent_pos = parent_file.ptr;
+	state.parent_end = parent_file.ptr + sz;
+	memset(&ecb, 0, sizeof(ecb));
+	ecb.priv = &state;
 
-	if (xdi_diff_outf(&parent_file, result_file, consume_line, &state,
-			  &xpp, &xecfg))
+	if (xdi_diff(&parent_file, result_file, &xpp, &xecfg, &ecb))
 		die("unable to generate combined diff for %s",
 		    oid_to_hex(parent));
 	free(parent_file.ptr);
@@ -967,29 +982,42 @@ static void show_combined_header(struct combine_diff_path *elem,
 				 line_prefix, c_meta, c_reset);
 }
 
-static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
-			    int dense, int working_tree_file,
-			    struct rev_info *rev)
+/*
+ * What show_patch_diff() works out about a path before showing it.
+ */
+struct combined_patch {
+	struct combine_diff_path *elem;
+	struct userdiff_driver *userdiff, *textconv;
+	char *result;
+	unsigned long cnt;
+	struct sline *sline; /* survived lines */
+	int result_deleted, mode_differs, is_binary, show_hunks;
+};
+
+static void find_userdiff(struct combined_patch *patch, struct diff_options *opt)
 {
-	struct diff_options *opt = &rev->diffopt;
+	patch->userdiff = userdiff_find_by_path(patch->elem->path);
+	if (!patch->userdiff)
+		patch->userdiff = userdiff_find_by_name("default");
+	if (opt->flags.allow_textconv)
+		patch->textconv = userdiff_get_textconv(patch->userdiff);
+}
+
+/*
+ * Read the result and the parents of the path in "patch", and diff them.
+ * Return -1 if there is nothing to show for it.
+ */
+static int prepare_patch_diff(struct combined_patch *patch, int num_parent,
+			      int dense, int working_tree_file, long xdl_opts)
+{
+	struct combine_diff_path *elem = patch->elem;
+	struct userdiff_driver *textconv = patch->textconv;
 	unsigned long result_size, cnt, lno;
 	int result_deleted = 0;
 	char *result, *cp;
-	struct sline *sline; /* survived lines */
-	int mode_differs = 0;
-	int i, show_hunks;
+	struct sline *sline;
+	int i;
 	mmfile_t result_file;
-	struct userdiff_driver *userdiff;
-	struct userdiff_driver *textconv = NULL;
-	int is_binary;
-	const char *line_prefix = diff_line_prefix(opt);
-
-	context = opt->context;
-	userdiff = userdiff_find_by_path(elem->path);
-	if (!userdiff)
-		userdiff = userdiff_find_by_name("default");
-	if (opt->flags.allow_textconv)
-		textconv = userdiff_get_textconv(userdiff);
 
 	/* Read the result of merge first */
 	if (!working_tree_file)
@@ -1008,7 +1036,7 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 
 			if (strbuf_readlink(&buf, elem->path, st.st_size) < 0) {
 				error_errno("readlink(%s)", elem->path);
-				return;
+				return -1;
 			}
 			result_size = buf.len;
 			result = strbuf_detach(&buf, NULL);
@@ -1075,35 +1103,32 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 
 	for (i = 0; i < num_parent; i++) {
 		if (elem->parent[i].mode != elem->mode) {
-			mode_differs = 1;
+			patch->mode_differs = 1;
 			break;
 		}
 	}
 
+	patch->result = result;
+	patch->result_deleted = result_deleted;
 	if (textconv)
-		is_binary = 0;
-	else if (userdiff->binary != -1)
-		is_binary = userdiff->binary;
+		patch->is_binary = 0;
+	else if (patch->userdiff->binary != -1)
+		patch->is_binary = patch->userdiff->binary;
 	else {
-		is_binary = buffer_is_binary(result, result_size);
-		for (i = 0; !is_binary && i < num_parent; i++) {
+		patch->is_binary = buffer_is_binary(result, result_size);
+		for (i = 0; !patch->is_binary && i < num_parent; i++) {
 			char *buf;
 			unsigned long size;
 			buf = grab_blob(&elem->parent[i].oid,
 					elem->parent[i].mode,
 					&size, NULL, NULL);
 			if (buffer_is_binary(buf, size))
-				is_binary = 1;
+				patch->is_binary = 1;
 			free(buf);
 		}
 	}
-	if (is_binary) {
-		show_combined_header(elem, num_parent, dense, rev,
-				     line_prefix, mode_differs, 0);
-		printf("Binary files differ\n");
-		free(result);
-		return;
-	}
+	if (patch->is_binary)
+		return 0;
 
 	for (cnt = 0, cp = result; cp < result + result_size; cp++) {
 		if (*cp == '\n')
@@ -1149,20 +1174,41 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 				     elem->parent[i].mode,
 				     &result_file, sline,
 				     cnt, i, num_parent, result_deleted,
-				     textconv, elem->path, opt->xdl_opts);
+				     textconv, elem->path, xdl_opts);
 	}
 
-	show_hunks = make_hunks(sline, cnt, num_parent, dense);
+	patch->sline = sline;
+	patch->cnt = cnt;
+	patch->show_hunks = make_hunks(sline, cnt, num_parent, dense);
+	return 0;
+}
+
+static void show_prepared_patch(struct combined_patch *patch, int num_parent,
+				int dense, int working_tree_file,
+				struct rev_info *rev)
+{
+	struct diff_options *opt = &rev->diffopt;
+	const char *line_prefix = diff_line_prefix(opt);
+	struct sline *sline = patch->sline;
+	unsigned long lno;
 
-	if (show_hunks || mode_differs || working_tree_file) {
-		show_combined_header(elem, num_parent, dense, rev,
-				     line_prefix, mode_differs, 1);
-		dump_sline(sline, line_prefix, cnt, num_parent,
-			   opt->use_color, result_deleted);
+	if (patch->is_binary) {
+		show_combined_header(patch->elem, num_parent, dense, rev,
+				     line_prefix, patch->mode_differs, 0);
+		printf("Binary files differ\n");
+		free(patch->result);
+		return;
 	}
-	free(result);
 
-	for (lno = 0; lno < cnt; lno++) {
+	if (patch->show_hunks || patch->mode_differs || working_tree_file) {
+		show_combined_header(patch->elem, num_parent, dense, rev,
+				     line_prefix, patch->mode_differs, 1);
+		dump_sline(sline, line_prefix, patch->cnt, num_parent,
+			   opt->use_color, patch->result_deleted);
+	}
+	free(patch->result);
+
+	for (lno = 0; lno < patch->cnt; lno++) {
 		if (sline[lno].lost) {
 			struct lline *ll = sline[lno].lost;
 			while (ll) {
@@ -1176,6 +1222,147 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 	free(sline);
 }
 
+static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
+			    int dense, int working_tree_file,
+			    struct rev_info *rev)
+{
+	struct combined_patch patch;
+
+	memset(&patch, 0, sizeof(patch));
+	patch.elem = elem;
+	context = rev->diffopt.context;
+	find_userdiff(&patch, &rev->diffopt);
+	if (prepare_patch_diff(&patch, num_parent, dense, working_tree_file,
+			       rev->diffopt.xdl_opts))
+		return;
+	show_prepared_patch(&patch, num_parent, dense, working_tree_file, rev);
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Diffing a path against its parents does not depend on any other
+ * path, so with many paths to show, threads prepare a chunk of
+ * CHUNK_PER_THREAD paths each at a time, reading the blobs under the
+ * object read lock, and then the main thread shows them in order. A
+ * path with a textconv filter is left for the main thread to prepare,
+ * as it runs an external program and its cache.
+ */
+#define MAX_PARALLEL (16)
+#define THREAD_COST (4)
+#define CHUNK_PER_THREAD (16)
+
+struct prepare_thread {
+	pthread_t pthread;
+	struct combined_patch *patches;
+	int first, step, nr;
+	int num_parent, dense;
+	long xdl_opts;
+};
+
+static void *prepare_thread(void *data)
+{
+	struct prepare_thread *t = data;
+	int i;
+
+	for (i = t->first; i < t->nr; i += t->step)
+		if (!t->patches[i].textconv)
+			/* without a working tree file, this cannot fail */
+			prepare_patch_diff(&t->patches[i], t->num_parent,
+					   t->dense, 0, t->xdl_opts);
+	return NULL;
+}
+
+static int prepare_threads(int nr)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_COMBINE_DIFF_THREADS", 0);
+
+	/* a lazy fetch from a thread would run a whole transport */
+	if (repository_format_partial_clone)
+		return 1;
+	if (!nr_threads) {
+		nr_threads = nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	return nr_threads;
+}
+
+static void show_patch_diffs(struct combine_diff_path *paths, int num_paths,
+			     int num_parent, int dense, struct rev_info *rev)
+{
+	struct diff_options *opt = &rev->diffopt;
+	int nr_threads = prepare_threads(num_paths);
+	struct prepare_thread *threads;
+	struct combined_patch *patches;
+	struct combine_diff_path *p;
+	int i, nr, chunk;
+
+	if (nr_threads < 2) {
+		for (p = paths; p; p = p->next)
+			show_patch_diff(p, num_parent, dense, 0, rev);
+		return;
+	}
+
+	context = opt->context;
+	chunk = nr_threads * CHUNK_PER_THREAD;
+	patches = xcalloc(chunk, sizeof(*patches));
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (p = paths; p; ) {
+		memset(patches, 0, chunk * sizeof(*patches));
+		for (nr = 0; p && nr < chunk; p = p->next, nr++) {
+			patches[nr].elem = p;
+			find_userdiff(&patches[nr], opt);
+		}
+
+		enable_obj_read_lock();
+		for (i = 0; i < nr_threads; i++) {
+			struct prepare_thread *t = &threads[i];
+
+			t->patches = patches;
+			t->first = i;
+			t->step = nr_threads;
+			t->nr = nr;
+			t->num_parent = num_parent;
+			t->dense = dense;
+			t->xdl_opts = opt->xdl_opts;
+			if (pthread_create(&t->pthread, NULL, prepare_thread, t))
+				die("unable to create threaded combined diff");
+		}
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_join(threads[i].pthread, NULL))
+				die("unable to join threaded combined diff");
+		disable_obj_read_lock();
+
+		for (i = 0; i < nr; i++) {
+			if (patches[i].textconv)
+				prepare_patch_diff(&patches[i], num_parent,
+						   dense, 0, opt->xdl_opts);
+			show_prepared_patch(&patches[i], num_parent, dense,
+					    0, rev);
+		}
+	}
+	free(threads);
+	free(patches);
+}
+
+#else
+
+static void show_patch_diffs(struct combine_diff_path *paths, int num_paths,
+			     int num_parent, int dense, struct rev_info *rev)
+{
+	struct combine_diff_path *p;
+
+	for (p = paths; p; p = p->next)
+		show_patch_diff(p, num_parent, dense, 0, rev);
+}
+
+#endif
+
 static void show_raw_diff(struct combine_diff_path *p, int num_parent, struct rev_info *rev)
 {
 	struct diff_options *opt = &rev->diffopt;
@@ -1385,6 +1572,32 @@ static struct combine_diff_path *find_paths_multitree(
 }
 
 
+/*
+ * In a partial clone, fetch the blobs show_patch_diff() is about to
+ * read for "paths" in one go.
+ */
+static void prefetch_combined_paths(struct combine_diff_path *paths,
+				    int num_parent)
+{
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	struct combine_diff_path *p;
+	int i;
+
+	if (!repository_format_partial_clone)
+		return;
+
+	for (p = paths; p; p = p->next) {
+		if (!is_null_oid(&p->oid) && !S_ISGITLINK(p->mode))
+			oid_array_append(&to_fetch, &p->oid);
+		for (i = 0; i < num_parent; i++)
+			if (!is_null_oid(&p->parent[i].oid) &&
+			    !S_ISGITLINK(p->parent[i].mode))
+				oid_array_append(&to_fetch, &p->parent[i].oid);
+	}
+	prefetch_objects(&to_fetch, -1);
+	oid_array_clear(&to_fetch);
+}
+
 void diff_tree_combined(const struct object_id *oid,
 			const struct oid_array *parents,
 			int dense,
@@ -1511,12 +1724,12 @@ void diff_tree_combined(const struct object_id *oid,
 			handle_combined_callback(opt, paths, num_parent, num_paths);
 
 		if (opt->output_format & DIFF_FORMAT_PATCH) {
+			prefetch_combined_paths(paths, num_parent);
 			if (needsep)
 				printf("%s%c", diff_line_prefix(opt),
 				       opt->line_termination);
-			for (p = paths; p; p = p->next)
-				show_patch_diff(p, num_parent, dense,
-						0, rev);
+			show_patch_diffs(paths, num_paths, num_parent,
+					 dense, rev);
 		}
 	}
 
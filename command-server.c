@@ -0,0 +1,122 @@
+#include "cache.h"
+#include "command-server.h"
+#include "pkt-line.h"
+#include "sigchain.h"
+#include "trace2.h"
+#include "unix-socket.h"
+
+#ifndef NO_UNIX_SOCKETS
+
+static int send_run_request(int fd, int argc, const char **argv)
+{
+	extern char **environ;
+	struct strbuf cwd = STRBUF_INIT;
+	int fds[3] = { 0, 1, 2 };
+	char **e;
+	int i, ret = -1;
+
+	if (strbuf_getcwd(&cwd) ||
+	    packet_write_fmt_gently(fd, "run") ||
+	    unix_stream_send_fds(fd, fds, ARRAY_SIZE(fds)) ||
+	    packet_write_fmt_gently(fd, "cwd=%s", cwd.buf))
+		goto out;
+	for (e = environ; *e; e++)
+		if (packet_write_fmt_gently(fd, "env=%s", *e))
+			goto out;
+	for (i = 0; i < argc; i++)
+		if (packet_write_fmt_gently(fd, "arg=%s", argv[i]))
+			goto out;
+	ret = packet_flush_gently(fd);
+out:
+	strbuf_release(&cwd);
+	return ret;
+}
+
+int command_server_run(int argc, const char **argv)
+{
+	const char *path = getenv(COMMAND_SERVER_ENVIRONMENT);
+	const char *arg;
+	char *line;
+	int fd, i, ret = -1;
+
+	if (!path || !*path)
+		return -1;
+	/*
+	 * A pager started by the server would not be in the foreground
+	 * process group of the terminal.
+	 */
+	if (isatty(1))
+		return -1;
+	/* The server only knows its own repository. */
+	for (i = 0; local_repo_env[i]; i++)
+		if (getenv(local_repo_env[i]))
+			return -1;
+
+	fd = unix_stream_connect(path);
+	if (fd < 0)
+		return -1;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	if (send_run_request(fd, argc, argv) ||
+	    packet_read_line_gently(fd, NULL, &line) < 0 ||
+	    !line || strcmp(line, "ok"))
+		goto out;
+
+	/* From here on, the command may have had effects; no going back. */
+	trace2_data_string("command_server", "served", argv[0]);
+	if (packet_read_line_gently(fd, NULL, &line) < 0 || !line)
+		die(_("lost connection to the command server at '%s'"), path);
+	if (skip_prefix(line, "exit ", &arg)) {
+		ret = atoi(arg);
+	} else if (skip_prefix(line, "signal ", &arg)) {
+		int sig = atoi(arg);
+
+		close(fd);
+		signal(sig, SIG_DFL);
+		raise(sig);
+		exit(128 + sig);
+	} else {
+		die(_("command server sent unexpected line: %s"), line);
+	}
+out:
+	sigchain_pop(SIGPIPE);
+	close(fd);
+	return ret;
+}
+
+int command_server_send_command(const char *path, const char *command,
+				struct strbuf *answer)
+{
+	int fd = unix_stream_connect(path);
+	char *line;
+	int ret = 0;
+
+	if (fd < 0)
+		return -1;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	if (packet_write_fmt_gently(fd, "%s", command) ||
+	    packet_read_line_gently(fd, NULL, &line) < 0 || !line)
+		ret = error_errno(_("unable to talk to the command server"));
+	else
+		strbuf_addstr(answer, line);
+	sigchain_pop(SIGPIPE);
+
+	close(fd);
+	return ret;
+}
+
+#else
+
+int command_server_run(int argc, const char **argv)
+{
+	return -1;
+}
+
+int command_server_send_command(const char *path, const char *command,
+				struct strbuf *answer)
+{
+	return -1;
+}
+
+#endif
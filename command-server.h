@@ -0,0 +1,36 @@
+#ifndef COMMAND_SERVER_H
+#define COMMAND_SERVER_H
+
+/*
+ * Talk to "git command-server", which keeps a repository, its
+ * configuration and its index loaded, and runs read-only builtins on
+ * behalf of clients that point GIT_COMMAND_SERVER at its socket.
+ *
+ * A client sends a pkt-line with its request.  For "run", it then
+ * passes its standard input, output and error over the socket, and
+ * sends "cwd=<dir>", one "env=<name>=<value>" per environment variable
+ * and one "arg=<arg>" per argument, followed by a flush packet.  The
+ * server answers "fallback" if the client had better run the command
+ * itself, or "ok" followed, once the command is done, by "exit <code>"
+ * or "signal <number>".  "status" is answered with the working tree
+ * of the server, "stop" with "ok".
+ */
+
+#define COMMAND_SERVER_ENVIRONMENT "GIT_COMMAND_SERVER"
+
+/*
+ * Have the server named by $GIT_COMMAND_SERVER run the builtin in
+ * "argv".  Return its exit code, or -1 if there is no server to ask or
+ * it declined, in which case the caller should run the command itself.
+ */
+int command_server_run(int argc, const char **argv);
+
+/*
+ * Send "command" to the server listening on "path" and store its
+ * answer in "answer".  Return 0 on success and -1 if the server could
+ * not be reached.
+ */
+int command_server_send_command(const char *path, const char *command,
+				struct strbuf *answer);
+
+#endif /* COMMAND_SERVER_H */
@@ -11,12 +11,24 @@
 #include "sha1-lookup.h"
 #include "commit-graph.h"
 #include "object-store.h"
+#include "bloom.h"
+#include "commit-slab.h"
+#include "replace-object.h"
 
 #define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
 #define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
 #define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
+#define GRAPH_CHUNKID_GENERATION_DATA 0x47444154 /* "GDAT" */
+#define GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW 0x47444f56 /* "GDOV" */
+#define GRAPH_MAX_CHUNKS 9
+
+#define GRAPH_MAX_BASE_GRAPHS 0xff
+#define GRAPH_DEFAULT_SIZE_MULTIPLE 2
 
 #define GRAPH_DATA_WIDTH 36
 
@@ -35,6 +47,8 @@
 
 #define GRAPH_LAST_EDGE 0x80000000
 
+#define CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW 0x80000000
+
 #define GRAPH_FANOUT_SIZE (4 * 256)
 #define GRAPH_CHUNKLOOKUP_WIDTH 12
 #define GRAPH_MIN_SIZE (5 * GRAPH_CHUNKLOOKUP_WIDTH + GRAPH_FANOUT_SIZE + \
@@ -45,6 +59,16 @@ char *get_commit_graph_filename(const char *obj_dir)
 	return xstrfmt("%s/info/commit-graph", obj_dir);
 }
 
+char *get_commit_graph_chain_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/info/commit-graphs/commit-graph-chain", obj_dir);
+}
+
+char *get_split_graph_filename(const char *obj_dir, const char *oid_hex)
+{
+	return xstrfmt("%s/info/commit-graphs/graph-%s.graph", obj_dir, oid_hex);
+}
+
 static struct commit_graph *alloc_commit_graph(void)
 {
 	struct commit_graph *g = xcalloc(1, sizeof(*g));
@@ -107,6 +131,7 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 
 	graph->hash_len = GRAPH_OID_LEN;
 	graph->num_chunks = *(unsigned char*)(data + 6);
+	graph->num_base = *(unsigned char*)(data + 7);
 	graph->graph_fd = fd;
 	graph->data = graph_map;
 	graph->data_len = graph_size;
@@ -121,7 +146,7 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 
 		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
 
-		if (chunk_offset > graph_size - GIT_MAX_RAWSZ) {
+		if (chunk_offset > graph_size - the_hash_algo->rawsz) {
 			error("improper chunk offset %08x%08x", (uint32_t)(chunk_offset >> 32),
 			      (uint32_t)chunk_offset);
 			goto cleanup_fail;
@@ -155,6 +180,41 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 			else
 				graph->chunk_large_edges = data + chunk_offset;
 			break;
+
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			if (graph->chunk_bloom_indexes)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_indexes = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMDATA:
+			if (graph->chunk_bloom_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BASE:
+			if (graph->chunk_base_graphs)
+				chunk_repeated = 1;
+			else
+				graph->chunk_base_graphs = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_GENERATION_DATA:
+			if (graph->chunk_generation_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW:
+			if (graph->chunk_generation_data_overflow)
+				chunk_repeated = 1;
+			else
+				graph->chunk_generation_data_overflow = data + chunk_offset;
+			break;
 		}
 
 		if (chunk_repeated) {
@@ -172,6 +232,34 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 		last_chunk_offset = chunk_offset;
 	}
 
+	if (graph->num_base && !graph->chunk_base_graphs) {
+		error("commit-graph has %d base graphs but no base graph chunk",
+		      graph->num_base);
+		goto cleanup_fail;
+	}
+
+	hashcpy(graph->oid.hash, data + graph_size - graph->hash_len);
+
+	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data) {
+		const unsigned char *header = graph->chunk_bloom_data;
+
+		graph->bloom_filter_settings = xmalloc(sizeof(struct bloom_filter_settings));
+		graph->bloom_filter_settings->hash_version = get_be32(header);
+		graph->bloom_filter_settings->num_hashes = get_be32(header + 4);
+		graph->bloom_filter_settings->bits_per_entry = get_be32(header + 8);
+
+		/* Unknown hashing schemes cannot be read; pretend they are absent. */
+		if (graph->bloom_filter_settings->hash_version != 1 ||
+		    !graph->bloom_filter_settings->num_hashes) {
+			FREE_AND_NULL(graph->bloom_filter_settings);
+			graph->chunk_bloom_indexes = NULL;
+			graph->chunk_bloom_data = NULL;
+		}
+	} else {
+		graph->chunk_bloom_indexes = NULL;
+		graph->chunk_bloom_data = NULL;
+	}
+
 	return graph;
 
 cleanup_fail:
@@ -180,6 +268,132 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 	exit(1);
 }
 
+static void free_commit_graph(struct commit_graph *g)
+{
+	while (g) {
+		struct commit_graph *base = g->base_graph;
+
+		if (g->graph_fd >= 0) {
+			munmap((void *)g->data, g->data_len);
+			close(g->graph_fd);
+		}
+		free(g->bloom_filter_settings);
+		free(g);
+		g = base;
+	}
+}
+
+/*
+ * Put "g", the "n"th layer of a chain whose layers are named by "oids",
+ * on top of "chain". Returns 0 if "g" does not belong there.
+ */
+static int add_graph_to_chain(struct commit_graph *g,
+			      struct commit_graph *chain,
+			      struct object_id *oids,
+			      int n)
+{
+	int i;
+
+	if (oidcmp(&g->oid, &oids[n])) {
+		warning(_("commit-graph file %s has an unexpected checksum"),
+			oid_to_hex(&oids[n]));
+		return 0;
+	}
+
+	if (g->num_base != n) {
+		warning(_("commit-graph has incorrect number of base graphs"));
+		return 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (hashcmp(g->chunk_base_graphs + g->hash_len * i,
+			    oids[i].hash)) {
+			warning(_("commit-graph chain does not match"));
+			return 0;
+		}
+	}
+
+	if (chain) {
+		g->num_commits_in_base = chain->num_commits_in_base +
+					 chain->num_commits;
+		if ((uint64_t)g->num_commits_in_base + g->num_commits >=
+		    GRAPH_PARENT_MISSING) {
+			warning(_("commit-graph chain has too many commits"));
+			return 0;
+		}
+	}
+	g->base_graph = chain;
+
+	return 1;
+}
+
+struct commit_graph *load_commit_graph_chain(const char *obj_dir)
+{
+	struct commit_graph *graph_chain = NULL;
+	struct strbuf line = STRBUF_INIT;
+	struct object_id *oids = NULL;
+	int i, nr = 0, alloc = 0;
+	char *chain_name = get_commit_graph_chain_filename(obj_dir);
+	FILE *fp = fopen(chain_name, "r");
+
+	free(chain_name);
+	if (!fp)
+		return NULL;
+
+	while (strbuf_getline_lf(&line, fp) != EOF) {
+		ALLOC_GROW(oids, nr + 1, alloc);
+		if (get_oid_hex(line.buf, &oids[nr])) {
+			warning(_("invalid commit-graph chain: line '%s' not a hash"),
+				line.buf);
+			break;
+		}
+		nr++;
+	}
+	fclose(fp);
+	strbuf_release(&line);
+
+	for (i = 0; i < nr && i <= GRAPH_MAX_BASE_GRAPHS; i++) {
+		char *graph_name = get_split_graph_filename(obj_dir,
+							    oid_to_hex(&oids[i]));
+		struct commit_graph *g = load_commit_graph_one(graph_name);
+
+		free(graph_name);
+		if (!g || !add_graph_to_chain(g, graph_chain, oids, i)) {
+			free_commit_graph(g);
+			warning(_("unable to find all commit-graph files"));
+			break;
+		}
+		graph_chain = g;
+	}
+
+	free(oids);
+	return graph_chain;
+}
+
+static int get_generation_version(void)
+{
+	int version = 2;
+
+	git_config_get_int("commitgraph.generationversion", &version);
+	return version;
+}
+
+/*
+ * Corrected commit dates can only be compared with each other, so they
+ * are used only if every layer of the chain "g" has them.
+ */
+static void validate_generation_data(struct commit_graph *g)
+{
+	struct commit_graph *p;
+	int read_generation_data = get_generation_version() >= 2;
+
+	for (p = g; p; p = p->base_graph)
+		if (!p->chunk_generation_data)
+			read_generation_data = 0;
+	for (p = g; p; p = p->base_graph)
+		p->read_generation_data = read_generation_data;
+}
+
 /* global storage */
 static struct commit_graph *commit_graph = NULL;
 
@@ -192,10 +406,21 @@ static void prepare_commit_graph_one(const char *obj_dir)
 
 	graph_name = get_commit_graph_filename(obj_dir);
 	commit_graph = load_commit_graph_one(graph_name);
-
 	FREE_AND_NULL(graph_name);
+
+	if (!commit_graph)
+		commit_graph = load_commit_graph_chain(obj_dir);
+	validate_generation_data(commit_graph);
 }
 
+/*
+ * The graph records the history as it is. When replace refs give some
+ * commits other parents, the graph still describes every commit that
+ * is not itself replaced, but the generation numbers and changed-path
+ * filters of the commits after the replaced ones no longer hold.
+ */
+static int history_replaced;
+
 static int prepare_commit_graph_run_once = 0;
 static void prepare_commit_graph(void)
 {
@@ -205,6 +430,7 @@ static void prepare_commit_graph(void)
 	if (prepare_commit_graph_run_once)
 		return;
 	prepare_commit_graph_run_once = 1;
+	history_replaced = replace_refs_in_use(the_repository);
 
 	obj_dir = get_object_directory();
 	prepare_commit_graph_one(obj_dir);
@@ -217,31 +443,48 @@ static void prepare_commit_graph(void)
 
 static void close_commit_graph(void)
 {
-	if (!commit_graph)
-		return;
-
-	if (commit_graph->graph_fd >= 0) {
-		munmap((void *)commit_graph->data, commit_graph->data_len);
-		commit_graph->data = NULL;
-		close(commit_graph->graph_fd);
-	}
+	free_commit_graph(commit_graph);
+	commit_graph = NULL;
+}
 
-	FREE_AND_NULL(commit_graph);
+/*
+ * Find the layer of the chain "g" holding the commit at global position
+ * "pos", and turn "pos" into the position within that layer.
+ */
+static struct commit_graph *graph_for_pos(struct commit_graph *g, uint32_t *pos)
+{
+	while (g && *pos < g->num_commits_in_base)
+		g = g->base_graph;
+	if (!g || *pos >= g->num_commits_in_base + g->num_commits)
+		die(_("invalid commit position %u: commit-graph is corrupt"),
+		    *pos);
+	*pos -= g->num_commits_in_base;
+	return g;
 }
 
-static int bsearch_graph(struct commit_graph *g, struct object_id *oid, uint32_t *pos)
+static int bsearch_graph(struct commit_graph *g, const struct object_id *oid,
+			 uint32_t *pos)
 {
-	return bsearch_hash(oid->hash, g->chunk_oid_fanout,
-			    g->chunk_oid_lookup, g->hash_len, pos);
+	for (; g; g = g->base_graph) {
+		if (bsearch_hash(oid->hash, g->chunk_oid_fanout,
+				 g->chunk_oid_lookup, g->hash_len, pos)) {
+			*pos += g->num_commits_in_base;
+			return 1;
+		}
+	}
+	return 0;
 }
 
 static struct commit_list **insert_parent_or_die(struct commit_graph *g,
-						 uint64_t pos,
+						 uint32_t pos,
 						 struct commit_list **pptr)
 {
 	struct commit *c;
 	struct object_id oid;
-	hashcpy(oid.hash, g->chunk_oid_lookup + g->hash_len * pos);
+	uint32_t lex_pos = pos;
+	struct commit_graph *layer = graph_for_pos(g, &lex_pos);
+
+	hashcpy(oid.hash, layer->chunk_oid_lookup + layer->hash_len * lex_pos);
 	c = lookup_commit(&oid);
 	if (!c)
 		die("could not find commit %s", oid_to_hex(&oid));
@@ -249,31 +492,74 @@ static struct commit_list **insert_parent_or_die(struct commit_graph *g,
 	return &commit_list_insert(c, pptr)->next;
 }
 
+static timestamp_t graph_commit_date(struct commit_graph *g, uint32_t lex_pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data +
+					   GRAPH_DATA_WIDTH * lex_pos;
+	uint64_t date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	uint64_t date_low = get_be32(commit_data + g->hash_len + 12);
+
+	return (timestamp_t)((date_high << 32) | date_low);
+}
+
+static uint32_t graph_topo_level(struct commit_graph *g, uint32_t lex_pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data +
+					   GRAPH_DATA_WIDTH * lex_pos;
+
+	return get_be32(commit_data + g->hash_len + 8) >> 2;
+}
+
+/* The layer "g" must have a generation data chunk. */
+static timestamp_t graph_corrected_date(struct commit_graph *g, uint32_t lex_pos)
+{
+	timestamp_t offset = get_be32(g->chunk_generation_data + 4 * lex_pos);
+
+	if (offset & CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW) {
+		offset ^= CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW;
+		if (!g->chunk_generation_data_overflow)
+			die(_("commit-graph requires overflow generation data but has none"));
+		offset = get_be64(g->chunk_generation_data_overflow + 8 * offset);
+	}
+
+	return graph_commit_date(g, lex_pos) + offset;
+}
+
+static timestamp_t graph_generation(struct commit_graph *g, uint32_t lex_pos)
+{
+	if (g->read_generation_data)
+		return graph_corrected_date(g, lex_pos);
+	return graph_topo_level(g, lex_pos);
+}
+
 static void fill_commit_graph_info(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
-	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	uint32_t lex_pos = pos;
+
+	g = graph_for_pos(g, &lex_pos);
 	item->graph_pos = pos;
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->generation = history_replaced ? GENERATION_NUMBER_INFINITY :
+			   graph_generation(g, lex_pos);
 }
 
 static int fill_commit_in_graph(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
 	uint32_t edge_value;
 	uint32_t *parent_data_ptr;
-	uint64_t date_low, date_high;
 	struct commit_list **pptr;
-	const unsigned char *commit_data = g->chunk_commit_data + (g->hash_len + 16) * pos;
+	uint32_t lex_pos = pos;
+	struct commit_graph *layer = graph_for_pos(g, &lex_pos);
+	const unsigned char *commit_data = layer->chunk_commit_data +
+					   GRAPH_DATA_WIDTH * lex_pos;
 
 	item->object.parsed = 1;
 	item->graph_pos = pos;
 
 	item->maybe_tree = NULL;
 
-	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
-	date_low = get_be32(commit_data + g->hash_len + 12);
-	item->date = (timestamp_t)((date_high << 32) | date_low);
-
-	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	item->date = graph_commit_date(layer, lex_pos);
+	item->generation = history_replaced ? GENERATION_NUMBER_INFINITY :
+			   graph_generation(layer, lex_pos);
 
 	pptr = &item->parents;
 
@@ -290,7 +576,7 @@ static int fill_commit_in_graph(struct commit *item, struct commit_graph *g, uin
 		return 1;
 	}
 
-	parent_data_ptr = (uint32_t*)(g->chunk_large_edges +
+	parent_data_ptr = (uint32_t*)(layer->chunk_large_edges +
 			  4 * (uint64_t)(edge_value & GRAPH_EDGE_LAST_MASK));
 	do {
 		edge_value = get_be32(parent_data_ptr);
@@ -313,6 +599,12 @@ static int find_commit_in_graph(struct commit *item, struct commit_graph *g, uin
 	}
 }
 
+static int commit_is_replaced(struct commit *item)
+{
+	return lookup_replace_object(the_repository, &item->object.oid) !=
+		&item->object.oid;
+}
+
 int parse_commit_in_graph(struct commit *item)
 {
 	uint32_t pos;
@@ -321,6 +613,12 @@ int parse_commit_in_graph(struct commit *item)
 		return 0;
 	if (item->object.parsed)
 		return 1;
+	/* grafts and shallow boundaries override the parents in the graph */
+	if (lookup_commit_graft(the_repository, &item->object.oid))
+		return 0;
+	/* and a replaced commit is read from its replacement */
+	if (commit_is_replaced(item))
+		return 0;
 	prepare_commit_graph();
 	if (commit_graph && find_commit_in_graph(item, commit_graph, &pos))
 		return fill_commit_in_graph(item, commit_graph, pos);
@@ -333,15 +631,30 @@ void load_commit_graph_info(struct commit *item)
 	if (!core_commit_graph)
 		return;
 	prepare_commit_graph();
-	if (commit_graph && find_commit_in_graph(item, commit_graph, &pos))
+	if (commit_graph && !commit_is_replaced(item) &&
+	    find_commit_in_graph(item, commit_graph, &pos))
 		fill_commit_graph_info(item, commit_graph, pos);
 }
 
+int generation_numbers_enabled(void)
+{
+	if (!core_commit_graph)
+		return 0;
+	prepare_commit_graph();
+
+	/* A graph written before generation numbers has zero in their place. */
+	return commit_graph && commit_graph->num_commits && !history_replaced &&
+	       graph_topo_level(commit_graph, 0);
+}
+
 static struct tree *load_tree_for_commit(struct commit_graph *g, struct commit *c)
 {
 	struct object_id oid;
-	const unsigned char *commit_data = g->chunk_commit_data +
-					   GRAPH_DATA_WIDTH * (c->graph_pos);
+	uint32_t lex_pos = c->graph_pos;
+	const unsigned char *commit_data;
+
+	g = graph_for_pos(g, &lex_pos);
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_pos;
 
 	hashcpy(oid.hash, commit_data);
 	c->maybe_tree = lookup_tree(&oid);
@@ -359,6 +672,67 @@ struct tree *get_commit_tree_in_graph(const struct commit *c)
 	return load_tree_for_commit(commit_graph, (struct commit *)c);
 }
 
+struct bloom_filter_settings *get_bloom_filter_settings(void)
+{
+	struct commit_graph *g;
+
+	if (!core_commit_graph)
+		return NULL;
+	prepare_commit_graph();
+	if (history_replaced)
+		return NULL;
+	for (g = commit_graph; g; g = g->base_graph)
+		if (g->bloom_filter_settings)
+			return g->bloom_filter_settings;
+	return NULL;
+}
+
+int load_bloom_filter_from_graph(struct commit *c, struct bloom_filter *filter)
+{
+	uint32_t start_index, end_index;
+	uint32_t lex_pos = c->graph_pos;
+	struct commit_graph *g = commit_graph;
+
+	if (!g || c->graph_pos == COMMIT_NOT_FROM_GRAPH)
+		return 0;
+
+	g = graph_for_pos(g, &lex_pos);
+	if (!g->chunk_bloom_indexes)
+		return 0;
+
+	end_index = get_be32(g->chunk_bloom_indexes + 4 * lex_pos);
+	if (lex_pos > 0)
+		start_index = get_be32(g->chunk_bloom_indexes + 4 * (lex_pos - 1));
+	else
+		start_index = 0;
+
+	if (end_index < start_index ||
+	    g->chunk_bloom_data + BLOOMDATA_CHUNK_HEADER_SIZE + end_index >
+	    g->data + g->data_len) {
+		warning(_("ignoring out-of-range Bloom filter for commit %s"),
+			oid_to_hex(&c->object.oid));
+		return 0;
+	}
+
+	filter->len = end_index - start_index;
+	filter->data = (unsigned char *)(g->chunk_bloom_data +
+					 BLOOMDATA_CHUNK_HEADER_SIZE +
+					 start_index);
+	return 1;
+}
+
+/*
+ * The generation numbers of the commits being written: the topological
+ * level stored in the commit data chunk, and the corrected commit date
+ * stored in the generation data chunk.
+ */
+struct write_generation {
+	uint32_t topo_level;
+	timestamp_t corrected_date;
+};
+define_commit_slab(write_generation_slab, struct write_generation);
+static struct write_generation_slab write_generations;
+
 static void write_graph_chunk_fanout(struct hashfile *f,
 				     struct commit **commits,
 				     int nr_commits)
@@ -398,8 +772,30 @@ static const unsigned char *commit_to_sha1(size_t index, void *table)
 	return commits[index]->object.oid.hash;
 }
 
+/*
+ * Return the position that "c" gets in the chain being written: its
+ * position in "commits" past all the commits of the "base" layers, or its
+ * position in those layers. Returns -1 if "c" is in neither.
+ */
+static int graph_pos_for_write(struct commit *c,
+			       struct commit **commits, int nr_commits,
+			       struct commit_graph *base)
+{
+	uint32_t pos;
+	int lex_pos = sha1_pos(c->object.oid.hash, commits, nr_commits,
+			       commit_to_sha1);
+
+	if (lex_pos >= 0)
+		return lex_pos + (base ? base->num_commits_in_base +
+				  base->num_commits : 0);
+	if (bsearch_graph(base, &c->object.oid, &pos))
+		return pos;
+	return -1;
+}
+
 static void write_graph_chunk_data(struct hashfile *f, int hash_len,
-				   struct commit **commits, int nr_commits)
+				   struct commit **commits, int nr_commits,
+				   struct commit_graph *base)
 {
 	struct commit **list = commits;
 	struct commit **last = commits + nr_commits;
@@ -418,10 +814,9 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		if (!parent)
 			edge_value = GRAPH_PARENT_NONE;
 		else {
-			edge_value = sha1_pos(parent->item->object.oid.hash,
-					      commits,
-					      nr_commits,
-					      commit_to_sha1);
+			edge_value = graph_pos_for_write(parent->item,
+							 commits, nr_commits,
+							 base);
 
 			if (edge_value < 0)
 				edge_value = GRAPH_PARENT_MISSING;
@@ -437,10 +832,9 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		else if (parent->next)
 			edge_value = GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges;
 		else {
-			edge_value = sha1_pos(parent->item->object.oid.hash,
-					      commits,
-					      nr_commits,
-					      commit_to_sha1);
+			edge_value = graph_pos_for_write(parent->item,
+							 commits, nr_commits,
+							 base);
 			if (edge_value < 0)
 				edge_value = GRAPH_PARENT_MISSING;
 		}
@@ -459,7 +853,8 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 		else
 			packedDate[0] = 0;
 
-		packedDate[0] |= htonl((*list)->generation << 2);
+		packedDate[0] |= htonl(write_generation_slab_at(&write_generations,
+								*list)->topo_level << 2);
 
 		packedDate[1] = htonl((*list)->date);
 		hashwrite(f, packedDate, 8);
@@ -470,7 +865,8 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 
 static void write_graph_chunk_large_edges(struct hashfile *f,
 					  struct commit **commits,
-					  int nr_commits)
+					  int nr_commits,
+					  struct commit_graph *base)
 {
 	struct commit **list = commits;
 	struct commit **last = commits + nr_commits;
@@ -489,10 +885,9 @@ static void write_graph_chunk_large_edges(struct hashfile *f,
 
 		/* Since num_parents > 2, this initializer is safe. */
 		for (parent = (*list)->parents->next; parent; parent = parent->next) {
-			int edge_value = sha1_pos(parent->item->object.oid.hash,
-						  commits,
-						  nr_commits,
-						  commit_to_sha1);
+			int edge_value = graph_pos_for_write(parent->item,
+							     commits, nr_commits,
+							     base);
 
 			if (edge_value < 0)
 				edge_value = GRAPH_PARENT_MISSING;
@@ -506,6 +901,81 @@ static void write_graph_chunk_large_edges(struct hashfile *f,
 	}
 }
 
+static timestamp_t corrected_date_offset(struct commit *c)
+{
+	return write_generation_slab_at(&write_generations, c)->corrected_date -
+	       c->date;
+}
+
+static void write_graph_chunk_generation_data(struct hashfile *f,
+					      struct commit **commits,
+					      int nr_commits)
+{
+	int i;
+	uint32_t num_overflows = 0;
+
+	for (i = 0; i < nr_commits; i++) {
+		timestamp_t offset = corrected_date_offset(commits[i]);
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX)
+			offset = CORRECTED_COMMIT_DATE_OFFSET_OVERFLOW |
+				 num_overflows++;
+		hashwrite_be32(f, offset);
+	}
+}
+
+static void write_graph_chunk_generation_data_overflow(struct hashfile *f,
+						       struct commit **commits,
+						       int nr_commits)
+{
+	int i;
+
+	for (i = 0; i < nr_commits; i++) {
+		timestamp_t offset = corrected_date_offset(commits[i]);
+
+		if (offset > GENERATION_NUMBER_V2_OFFSET_MAX) {
+			hashwrite_be32(f, (uint64_t)offset >> 32);
+			hashwrite_be32(f, offset & 0xffffffff);
+		}
+	}
+}
+
+static void write_graph_chunk_bloom_indexes(struct hashfile *f,
+					    struct commit **commits,
+					    int nr_commits)
+{
+	struct commit **list = commits;
+	struct commit **last = commits + nr_commits;
+	uint32_t cur_pos = 0;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(*list, 0);
+		cur_pos += filter ? filter->len : 0;
+		hashwrite_be32(f, cur_pos);
+		list++;
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct hashfile *f,
+					 struct commit **commits,
+					 int nr_commits,
+					 const struct bloom_filter_settings *settings)
+{
+	struct commit **list = commits;
+	struct commit **last = commits + nr_commits;
+
+	hashwrite_be32(f, settings->hash_version);
+	hashwrite_be32(f, settings->num_hashes);
+	hashwrite_be32(f, settings->bits_per_entry);
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(*list, 0);
+		if (filter && filter->len)
+			hashwrite(f, filter->data, filter->len);
+		list++;
+	}
+}
+
 static int commit_compare(const void *_a, const void *_b)
 {
 	const struct object_id *a = (const struct object_id *)_a;
@@ -549,20 +1019,31 @@ static int add_packed_commits(const struct object_id *oid,
 	return 0;
 }
 
-static void add_missing_parents(struct packed_oid_list *oids, struct commit *commit)
+/*
+ * Add the parents of "commit" that are not yet in "oids". Parents that
+ * are in the commit-graph chain "skip" are left out, together with the
+ * history behind them.
+ */
+static void add_missing_parents(struct packed_oid_list *oids, struct commit *commit,
+				struct commit_graph *skip)
 {
 	struct commit_list *parent;
 	for (parent = commit->parents; parent; parent = parent->next) {
-		if (!(parent->item->object.flags & UNINTERESTING)) {
-			ALLOC_GROW(oids->list, oids->nr + 1, oids->alloc);
-			oidcpy(&oids->list[oids->nr], &(parent->item->object.oid));
-			oids->nr++;
-			parent->item->object.flags |= UNINTERESTING;
-		}
+		uint32_t pos;
+
+		if (parent->item->object.flags & UNINTERESTING)
+			continue;
+		if (skip && bsearch_graph(skip, &parent->item->object.oid, &pos))
+			continue;
+
+		parent->item->object.flags |= UNINTERESTING;
+		ALLOC_GROW(oids->list, oids->nr + 1, oids->alloc);
+		oidcpy(&oids->list[oids->nr], &(parent->item->object.oid));
+		oids->nr++;
 	}
 }
 
-static void close_reachable(struct packed_oid_list *oids)
+static void close_reachable(struct packed_oid_list *oids, struct commit_graph *skip)
 {
 	int i;
 	struct commit *commit;
@@ -582,7 +1063,7 @@ static void close_reachable(struct packed_oid_list *oids)
 		commit = lookup_commit(&oids->list[i]);
 
 		if (commit && !parse_commit(commit))
-			add_missing_parents(oids, commit);
+			add_missing_parents(oids, commit, skip);
 	}
 
 	for (i = 0; i < oids->nr; i++) {
@@ -593,43 +1074,210 @@ static void close_reachable(struct packed_oid_list *oids)
 	}
 }
 
-static void compute_generation_numbers(struct packed_commit_list* commits)
+/*
+ * Read the generation numbers of "c" from the layers "base" that the new
+ * layer goes on top of. Returns 0 if "c" is not in those layers.
+ */
+static int read_base_generation(struct commit *c, struct commit_graph *base,
+				struct write_generation *gen)
+{
+	uint32_t lex_pos;
+
+	if (!base || !bsearch_graph(base, &c->object.oid, &lex_pos))
+		return 0;
+
+	base = graph_for_pos(base, &lex_pos);
+	gen->topo_level = graph_topo_level(base, lex_pos);
+	gen->corrected_date = base->chunk_generation_data ?
+			      graph_corrected_date(base, lex_pos) : 0;
+	return 1;
+}
+
+/*
+ * Compute the topological level and the corrected commit date of every
+ * commit to be written. The corrected commit date of a commit is its
+ * commit date, or one more than the largest corrected commit date of its
+ * parents if that is later. Returns the number of commits whose corrected
+ * commit date is too far from their commit date to fit the generation
+ * data chunk.
+ */
+static uint32_t compute_generation_numbers(struct packed_commit_list *commits,
+					   struct commit_graph *base)
 {
 	int i;
+	uint32_t num_overflows = 0;
 	struct commit_list *list = NULL;
 
 	for (i = 0; i < commits->nr; i++) {
-		if (commits->list[i]->generation != GENERATION_NUMBER_INFINITY &&
-		    commits->list[i]->generation != GENERATION_NUMBER_ZERO)
+		if (write_generation_slab_at(&write_generations,
+					     commits->list[i])->topo_level)
 			continue;
 
 		commit_list_insert(commits->list[i], &list);
 		while (list) {
 			struct commit *current = list->item;
 			struct commit_list *parent;
+			struct write_generation *gen;
 			int all_parents_computed = 1;
-			uint32_t max_generation = 0;
+			uint32_t max_level = 0;
+			timestamp_t max_corrected_date = 0;
 
 			for (parent = current->parents; parent; parent = parent->next) {
-				if (parent->item->generation == GENERATION_NUMBER_INFINITY ||
-				    parent->item->generation == GENERATION_NUMBER_ZERO) {
-					all_parents_computed = 0;
-					commit_list_insert(parent->item, &list);
-					break;
-				} else if (parent->item->generation > max_generation) {
-					max_generation = parent->item->generation;
+				struct write_generation base_gen;
+
+				gen = &base_gen;
+				if (!read_base_generation(parent->item, base, gen)) {
+					gen = write_generation_slab_at(&write_generations,
+								       parent->item);
+					if (!gen->topo_level) {
+						all_parents_computed = 0;
+						parse_commit(parent->item);
+						commit_list_insert(parent->item, &list);
+						break;
+					}
 				}
+
+				if (gen->topo_level > max_level)
+					max_level = gen->topo_level;
+				if (gen->corrected_date > max_corrected_date)
+					max_corrected_date = gen->corrected_date;
 			}
 
 			if (all_parents_computed) {
-				current->generation = max_generation + 1;
-				pop_commit(&list);
+				gen = write_generation_slab_at(&write_generations,
+							       current);
+				gen->topo_level = max_level + 1;
+				if (gen->topo_level > GENERATION_NUMBER_V1_MAX)
+					gen->topo_level = GENERATION_NUMBER_V1_MAX;
+
+				if (current->date && current->date > max_corrected_date)
+					max_corrected_date = current->date - 1;
+				gen->corrected_date = max_corrected_date + 1;
 
-				if (current->generation > GENERATION_NUMBER_MAX)
-					current->generation = GENERATION_NUMBER_MAX;
+				pop_commit(&list);
 			}
 		}
 	}
+
+	for (i = 0; i < commits->nr; i++)
+		if (corrected_date_offset(commits->list[i]) >
+		    GENERATION_NUMBER_V2_OFFSET_MAX)
+			num_overflows++;
+
+	return num_overflows;
+}
+
+/*
+ * Compute (or load from the existing graph) the changed-path filter of
+ * every commit, returning the total size of the filters in bytes.
+ */
+static size_t compute_bloom_filters(struct packed_commit_list *commits)
+{
+	int i;
+	size_t total = 0;
+
+	init_bloom_filters();
+	for (i = 0; i < commits->nr; i++) {
+		struct bloom_filter *filter = get_bloom_filter(commits->list[i], 1);
+		if (filter)
+			total += filter->len;
+	}
+
+	if (total != (uint32_t)total)
+		die(_("the changed-path Bloom filters are too large to write"));
+	return total;
+}
+
+static void add_graph_commits(struct packed_oid_list *oids, struct commit_graph *g)
+{
+	uint32_t i;
+
+	ALLOC_GROW(oids->list, oids->nr + g->num_commits, oids->alloc);
+	for (i = 0; i < g->num_commits; i++)
+		hashcpy(oids->list[oids->nr++].hash,
+			g->chunk_oid_lookup + g->hash_len * i);
+}
+
+/*
+ * Decide which layers at the top of the loaded commit-graph chain the new
+ * layer replaces: a layer is merged while it is not "size_multiple" times
+ * larger than the commits collected so far. The commits of the merged
+ * layers are added to "oids", and the topmost layer that is kept is
+ * returned.
+ */
+static struct commit_graph *split_graph_merge_strategy(struct commit_graph *chain,
+						       struct packed_oid_list *oids,
+						       int size_multiple)
+{
+	struct commit_graph *g;
+	uint64_t num_new = 0;
+	uint32_t num_layers = 0, pos;
+	int i;
+
+	for (i = 0; i < oids->nr; i++) {
+		if (i > 0 && !oidcmp(&oids->list[i - 1], &oids->list[i]))
+			continue;
+		if (!bsearch_graph(chain, &oids->list[i], &pos))
+			num_new++;
+	}
+
+	for (g = chain; g; g = g->base_graph)
+		num_layers++;
+
+	g = chain;
+	while (g && (g->num_commits <= size_multiple * num_new ||
+		     num_layers > GRAPH_MAX_BASE_GRAPHS)) {
+		num_new += g->num_commits;
+		add_graph_commits(oids, g);
+		num_layers--;
+		g = g->base_graph;
+	}
+
+	return g;
+}
+
+/*
+ * Remove the layers in "<obj_dir>/info/commit-graphs" that are not one
+ * of the "nr_keep" layers named by "keep".
+ */
+static void expire_commit_graphs(const char *obj_dir,
+				 const struct object_id *keep, int nr_keep)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	size_t dirlen;
+	DIR *dir;
+
+	strbuf_addf(&path, "%s/info/commit-graphs", obj_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+
+	while ((de = readdir(dir)) != NULL) {
+		struct object_id oid;
+		const char *hex, *end;
+		int i, found = 0;
+
+		if (!skip_prefix(de->d_name, "graph-", &hex) ||
+		    parse_oid_hex(hex, &oid, &end) || strcmp(end, ".graph"))
+			continue;
+
+		for (i = 0; i < nr_keep && !found; i++)
+			found = !oidcmp(&oid, &keep[i]);
+		if (found)
+			continue;
+
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		unlink_or_warn(path.buf);
+	}
+
+	closedir(dir);
+	strbuf_release(&path);
 }
 
 void write_commit_graph(const char *obj_dir,
@@ -637,7 +1285,8 @@ void write_commit_graph(const char *obj_dir,
 			int nr_packs,
 			const char **commit_hex,
 			int nr_commits,
-			int append)
+			unsigned int flags,
+			int split_size_multiple)
 {
 	struct packed_oid_list oids;
 	struct packed_commit_list commits;
@@ -645,31 +1294,59 @@ void write_commit_graph(const char *obj_dir,
 	uint32_t i, count_distinct = 0;
 	char *graph_name;
 	struct lock_file lk = LOCK_INIT;
-	uint32_t chunk_ids[5];
-	uint64_t chunk_offsets[5];
+	uint32_t chunk_ids[GRAPH_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[GRAPH_MAX_CHUNKS + 1];
 	int num_chunks;
 	int num_extra_edges;
 	struct commit_list *parent;
+	int append = flags & COMMIT_GRAPH_APPEND;
+	int changed_paths = flags & COMMIT_GRAPH_CHANGED_PATHS;
+	int split = flags & COMMIT_GRAPH_SPLIT;
+	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	size_t total_bloom_filter_size = 0;
+	struct commit_graph *g, *chain = NULL, *base = NULL;
+	struct object_id *base_oids = NULL;
+	uint32_t num_base = 0;
+	struct strbuf tmp_name = STRBUF_INIT;
+	int write_generation_data = get_generation_version() >= 2;
+	uint32_t num_generation_data_overflows;
+
+	if (!split_size_multiple)
+		split_size_multiple = GRAPH_DEFAULT_SIZE_MULTIPLE;
+
+	init_write_generation_slab(&write_generations);
 
 	oids.nr = 0;
 	oids.alloc = approximate_object_count() / 4;
 
-	if (append) {
+	if (append || split) {
 		prepare_commit_graph_one(obj_dir);
 		if (commit_graph)
-			oids.alloc += commit_graph->num_commits;
+			oids.alloc += commit_graph->num_commits_in_base +
+				      commit_graph->num_commits;
 	}
 
 	if (oids.alloc < 1024)
 		oids.alloc = 1024;
 	ALLOC_ARRAY(oids.list, oids.alloc);
 
-	if (append && commit_graph) {
-		for (i = 0; i < commit_graph->num_commits; i++) {
-			const unsigned char *hash = commit_graph->chunk_oid_lookup +
-				commit_graph->hash_len * i;
-			hashcpy(oids.list[oids.nr++].hash, hash);
-		}
+	graph_name = get_commit_graph_filename(obj_dir);
+
+	/*
+	 * A new layer only has to hold the commits that are missing from
+	 * the chain, but a single commit-graph file takes precedence over
+	 * any chain and is merged into the first layer as a whole.
+	 */
+	if (split && commit_graph) {
+		if (file_exists(graph_name))
+			add_graph_commits(&oids, commit_graph);
+		else
+			chain = commit_graph;
+	}
+
+	if (append && !split) {
+		for (g = commit_graph; g; g = g->base_graph)
+			add_graph_commits(&oids, g);
 	}
 
 	if (pack_indexes) {
@@ -714,19 +1391,44 @@ void write_commit_graph(const char *obj_dir,
 	if (!pack_indexes && !commit_hex)
 		for_each_packed_object(add_packed_commits, &oids, 0);
 
-	close_reachable(&oids);
+	close_reachable(&oids, chain);
 
 	QSORT(oids.list, oids.nr, commit_compare);
 
-	count_distinct = 1;
-	for (i = 1; i < oids.nr; i++) {
-		if (oidcmp(&oids.list[i-1], &oids.list[i]))
-			count_distinct++;
+	if (chain) {
+		base = split_graph_merge_strategy(chain, &oids,
+						  split_size_multiple);
+		QSORT(oids.list, oids.nr, commit_compare);
+
+	}
+
+	if (split) {
+		for (g = base; g; g = g->base_graph)
+			num_base++;
+		/* one more slot for the new layer itself */
+		ALLOC_ARRAY(base_oids, num_base + 1);
+		i = num_base;
+		for (g = base; g; g = g->base_graph)
+			oidcpy(&base_oids[--i], &g->oid);
+	}
+
+	count_distinct = 0;
+	for (i = 0; i < oids.nr; i++) {
+		uint32_t pos;
+
+		if (i > 0 && !oidcmp(&oids.list[i-1], &oids.list[i]))
+			continue;
+		if (base && bsearch_graph(base, &oids.list[i], &pos))
+			continue;
+		count_distinct++;
 	}
 
 	if (count_distinct >= GRAPH_PARENT_MISSING)
 		die(_("the commit graph format cannot write %d commits"), count_distinct);
 
+	if (split && !count_distinct)
+		goto cleanup;
+
 	commits.nr = 0;
 	commits.alloc = count_distinct;
 	ALLOC_ARRAY(commits.list, commits.alloc);
@@ -734,8 +1436,12 @@ void write_commit_graph(const char *obj_dir,
 	num_extra_edges = 0;
 	for (i = 0; i < oids.nr; i++) {
 		int num_parents = 0;
+		uint32_t pos;
+
 		if (i > 0 && !oidcmp(&oids.list[i-1], &oids.list[i]))
 			continue;
+		if (base && bsearch_graph(base, &oids.list[i], &pos))
+			continue;
 
 		commits.list[commits.nr] = lookup_commit(&oids.list[i]);
 		parse_commit(commits.list[commits.nr]);
@@ -749,42 +1455,96 @@ void write_commit_graph(const char *obj_dir,
 
 		commits.nr++;
 	}
-	num_chunks = num_extra_edges ? 4 : 3;
-
-	if (commits.nr >= GRAPH_PARENT_MISSING)
+	if ((uint64_t)commits.nr +
+	    (base ? base->num_commits_in_base + base->num_commits : 0) >=
+	    GRAPH_PARENT_MISSING)
 		die(_("too many commits to write graph"));
 
-	compute_generation_numbers(&commits);
+	/*
+	 * Corrected commit dates build on those of the base layers, and
+	 * are only read if every layer has them.
+	 */
+	for (g = base; g; g = g->base_graph)
+		if (!g->chunk_generation_data)
+			write_generation_data = 0;
 
-	graph_name = get_commit_graph_filename(obj_dir);
-	if (safe_create_leading_directories(graph_name))
-		die_errno(_("unable to create leading directories of %s"),
-			  graph_name);
+	num_generation_data_overflows = compute_generation_numbers(&commits, base);
+
+	if (changed_paths)
+		total_bloom_filter_size = compute_bloom_filters(&commits);
+
+	if (split) {
+		int fd;
+
+		strbuf_addf(&tmp_name, "%s/info/commit-graphs/tmp_graph_XXXXXX",
+			    obj_dir);
+		if (safe_create_leading_directories(tmp_name.buf))
+			die_errno(_("unable to create leading directories of %s"),
+				  tmp_name.buf);
+		fd = xmkstemp_mode(tmp_name.buf, 0444);
+		f = hashfd(fd, tmp_name.buf);
+	} else {
+		if (safe_create_leading_directories(graph_name))
+			die_errno(_("unable to create leading directories of %s"),
+				  graph_name);
+
+		hold_lock_file_for_update(&lk, graph_name, LOCK_DIE_ON_ERROR);
+		f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	}
+
+	num_chunks = 0;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_offsets[num_chunks + 1] = GRAPH_FANOUT_SIZE;
+	num_chunks++;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_offsets[num_chunks + 1] = GRAPH_OID_LEN * commits.nr;
+	num_chunks++;
+	chunk_ids[num_chunks] = GRAPH_CHUNKID_DATA;
+	chunk_offsets[num_chunks + 1] = (GRAPH_OID_LEN + 16) * commits.nr;
+	num_chunks++;
+	if (write_generation_data) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_GENERATION_DATA;
+		chunk_offsets[num_chunks + 1] = sizeof(uint32_t) * commits.nr;
+		num_chunks++;
+	}
+	if (write_generation_data && num_generation_data_overflows) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_GENERATION_DATA_OVERFLOW;
+		chunk_offsets[num_chunks + 1] = sizeof(uint64_t) *
+						num_generation_data_overflows;
+		num_chunks++;
+	}
+	if (num_extra_edges) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_LARGEEDGES;
+		chunk_offsets[num_chunks + 1] = 4 * num_extra_edges;
+		num_chunks++;
+	}
+	if (changed_paths) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMINDEXES;
+		chunk_offsets[num_chunks + 1] = sizeof(uint32_t) * commits.nr;
+		num_chunks++;
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BLOOMDATA;
+		chunk_offsets[num_chunks + 1] = BLOOMDATA_CHUNK_HEADER_SIZE +
+						total_bloom_filter_size;
+		num_chunks++;
+	}
+	if (num_base) {
+		chunk_ids[num_chunks] = GRAPH_CHUNKID_BASE;
+		chunk_offsets[num_chunks + 1] = GRAPH_OID_LEN * num_base;
+		num_chunks++;
+	}
+	chunk_ids[num_chunks] = 0;
 
-	hold_lock_file_for_update(&lk, graph_name, LOCK_DIE_ON_ERROR);
-	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	/* Turn the chunk sizes into offsets, past the header and lookup table. */
+	chunk_offsets[0] = 8 + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	for (i = 1; i <= num_chunks; i++)
+		chunk_offsets[i] += chunk_offsets[i - 1];
 
 	hashwrite_be32(f, GRAPH_SIGNATURE);
 
 	hashwrite_u8(f, GRAPH_VERSION);
 	hashwrite_u8(f, GRAPH_OID_VERSION);
 	hashwrite_u8(f, num_chunks);
-	hashwrite_u8(f, 0); /* unused padding byte */
-
-	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
-	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
-	chunk_ids[2] = GRAPH_CHUNKID_DATA;
-	if (num_extra_edges)
-		chunk_ids[3] = GRAPH_CHUNKID_LARGEEDGES;
-	else
-		chunk_ids[3] = 0;
-	chunk_ids[4] = 0;
-
-	chunk_offsets[0] = 8 + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
-	chunk_offsets[1] = chunk_offsets[0] + GRAPH_FANOUT_SIZE;
-	chunk_offsets[2] = chunk_offsets[1] + GRAPH_OID_LEN * commits.nr;
-	chunk_offsets[3] = chunk_offsets[2] + (GRAPH_OID_LEN + 16) * commits.nr;
-	chunk_offsets[4] = chunk_offsets[3] + 4 * num_extra_edges;
+	hashwrite_u8(f, num_base);
 
 	for (i = 0; i <= num_chunks; i++) {
 		uint32_t chunk_write[3];
@@ -797,13 +1557,74 @@ void write_commit_graph(const char *obj_dir,
 
 	write_graph_chunk_fanout(f, commits.list, commits.nr);
 	write_graph_chunk_oids(f, GRAPH_OID_LEN, commits.list, commits.nr);
-	write_graph_chunk_data(f, GRAPH_OID_LEN, commits.list, commits.nr);
-	write_graph_chunk_large_edges(f, commits.list, commits.nr);
+	write_graph_chunk_data(f, GRAPH_OID_LEN, commits.list, commits.nr, base);
+	if (write_generation_data) {
+		write_graph_chunk_generation_data(f, commits.list, commits.nr);
+		if (num_generation_data_overflows)
+			write_graph_chunk_generation_data_overflow(f, commits.list,
+								   commits.nr);
+	}
+	write_graph_chunk_large_edges(f, commits.list, commits.nr, base);
+	if (changed_paths) {
+		write_graph_chunk_bloom_indexes(f, commits.list, commits.nr);
+		write_graph_chunk_bloom_data(f, commits.list, commits.nr,
+					     &bloom_settings);
+	}
+	for (i = 0; i < num_base; i++)
+		hashwrite(f, base_oids[i].hash, GRAPH_OID_LEN);
 
 	close_commit_graph();
-	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
-	commit_lock_file(&lk);
 
+	if (split) {
+		unsigned char file_hash[GIT_MAX_RAWSZ];
+		char *chain_name = get_commit_graph_chain_filename(obj_dir);
+		char *final_name;
+		FILE *fp;
+
+		finalize_hashfile(f, file_hash,
+				  CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
+		final_name = get_split_graph_filename(obj_dir,
+						      sha1_to_hex(file_hash));
+		if (rename(tmp_name.buf, final_name))
+			die_errno(_("failed to rename %s to %s"),
+				  tmp_name.buf, final_name);
+
+		hold_lock_file_for_update(&lk, chain_name, LOCK_DIE_ON_ERROR);
+		fp = fdopen_lock_file(&lk, "w");
+		for (i = 0; i < num_base; i++)
+			fprintf(fp, "%s\n", oid_to_hex(&base_oids[i]));
+		fprintf(fp, "%s\n", sha1_to_hex(file_hash));
+		if (commit_lock_file(&lk))
+			die_errno(_("unable to write %s"), chain_name);
+
+		/* The layers replaced by the new one are no longer needed. */
+		hashcpy(base_oids[num_base].hash, file_hash);
+		expire_commit_graphs(obj_dir, base_oids, num_base + 1);
+		unlink_or_warn(graph_name);
+
+		free(final_name);
+		free(chain_name);
+	} else {
+		char *chain_name = get_commit_graph_chain_filename(obj_dir);
+
+		finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+		commit_lock_file(&lk);
+
+		/* The new file covers everything a chain could have had. */
+		if (file_exists(chain_name)) {
+			unlink_or_warn(chain_name);
+			expire_commit_graphs(obj_dir, NULL, 0);
+		}
+		free(chain_name);
+	}
+
+	free(commits.list);
+cleanup:
+	close_commit_graph();
+	clear_write_generation_slab(&write_generations);
+	free(base_oids);
+	free(graph_name);
+	strbuf_release(&tmp_name);
 	free(oids.list);
 	oids.alloc = 0;
 	oids.nr = 0;
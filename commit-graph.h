@@ -3,7 +3,13 @@
 
 #include "git-compat-util.h"
 
+struct commit;
+struct bloom_filter;
+struct bloom_filter_settings;
+
 char *get_commit_graph_filename(const char *obj_dir);
+char *get_commit_graph_chain_filename(const char *obj_dir);
+char *get_split_graph_filename(const char *obj_dir, const char *oid_hex);
 
 /*
  * Given a commit struct, try to fill the commit struct info, including:
@@ -27,6 +33,12 @@ void load_commit_graph_info(struct commit *item);
 
 struct tree *get_commit_tree_in_graph(const struct commit *c);
 
+/*
+ * Return 1 if commits are read from a commit-graph that has generation
+ * numbers, i.e. if walks can rely on commit->generation to stop early.
+ */
+int generation_numbers_enabled(void);
+
 struct commit_graph {
 	int graph_fd;
 
@@ -35,22 +47,80 @@ struct commit_graph {
 
 	unsigned char hash_len;
 	unsigned char num_chunks;
+	unsigned char num_base;
 	uint32_t num_commits;
 	struct object_id oid;
 
+	/*
+	 * A graph loaded from a commit-graph-chain only stores the commits
+	 * that are not in its base layers. Positions of commits (including
+	 * parent edges) are global across the chain: the commits of this
+	 * layer follow the "num_commits_in_base" commits of "base_graph".
+	 */
+	uint32_t num_commits_in_base;
+	struct commit_graph *base_graph;
+
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_commit_data;
 	const unsigned char *chunk_large_edges;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	const unsigned char *chunk_base_graphs;
+	const unsigned char *chunk_generation_data;
+	const unsigned char *chunk_generation_data_overflow;
+
+	/*
+	 * Whether commit->generation is filled with corrected commit dates
+	 * from the generation data chunk rather than with the topological
+	 * levels of the commit data chunk. This is the same for all layers
+	 * of a chain.
+	 */
+	int read_generation_data;
+
+	struct bloom_filter_settings *bloom_filter_settings;
 };
 
 struct commit_graph *load_commit_graph_one(const char *graph_file);
 
+/*
+ * Load the layers listed in "<obj_dir>/info/commit-graphs/commit-graph-chain"
+ * and return the topmost one, or NULL if there is no chain. Loading stops
+ * at the first layer that is missing or does not match the layers below
+ * it, so a partially-written chain is still usable.
+ */
+struct commit_graph *load_commit_graph_chain(const char *obj_dir);
+
+/*
+ * Return the settings of the changed-path Bloom filters in the loaded
+ * commit-graph, or NULL if it has none.
+ */
+struct bloom_filter_settings *get_bloom_filter_settings(void);
+
+/*
+ * Point "filter" at the changed-path Bloom filter stored for "c" in the
+ * commit-graph. Returns 1 on success and 0 if there is no such filter.
+ */
+int load_bloom_filter_from_graph(struct commit *c, struct bloom_filter *filter);
+
+#define COMMIT_GRAPH_APPEND        (1 << 0)
+#define COMMIT_GRAPH_CHANGED_PATHS (1 << 1)
+#define COMMIT_GRAPH_SPLIT         (1 << 2)
+
+/*
+ * With COMMIT_GRAPH_SPLIT, only the commits that are not yet in the
+ * commit-graph chain are written, into a new layer on top of it. Layers
+ * are merged into the new one for as long as the layer below it has no
+ * more than "split_size_multiple" times the commits of the new layer, so
+ * that the chain stays logarithmic in the number of commits. A zero
+ * "split_size_multiple" selects the default of 2.
+ */
 void write_commit_graph(const char *obj_dir,
 			const char **pack_indexes,
 			int nr_packs,
 			const char **commit_hex,
 			int nr_commits,
-			int append);
+			unsigned int flags,
+			int split_size_multiple);
 
 #endif
@@ -0,0 +1,125 @@
+#ifndef COMMIT_REACH_H
+#define COMMIT_REACH_H
+
+#include "commit.h"
+#include "commit-slab.h"
+
+struct ref_filter;
+struct object_id;
+struct object_array;
+
+struct commit_list *get_merge_bases_many(struct commit *one,
+					 int n,
+					 struct commit **twos);
+struct commit_list *get_merge_bases(struct commit *one, struct commit *two);
+struct commit_list *get_octopus_merge_bases(struct commit_list *in);
+
+/* To be used only when object flags after this call no longer matter */
+struct commit_list *get_merge_bases_many_dirty(struct commit *one,
+					       int n,
+					       struct commit **twos);
+
+/*
+ * Is "commit" a descendant of one of the elements on the "with_commit"
+ * list? An empty list says yes.
+ */
+int is_descendant_of(struct commit *commit, struct commit_list *with_commit);
+
+/*
+ * Is "commit" an ancestor of (i.e. reachable from) the "reference", or
+ * of one of the "nr_reference" commits in "reference"?
+ */
+int in_merge_bases(struct commit *commit, struct commit *reference);
+int in_merge_bases_many(struct commit *commit, int nr_reference,
+			struct commit **reference);
+
+/*
+ * Takes a list of commits and returns a new list where those
+ * have been removed that can be reached from other commits in
+ * the list. It is useful for, e.g., reducing the commits
+ * randomly thrown at the git-merge command and removing
+ * redundant commits that the user shouldn't have given to it.
+ *
+ * This function destroys the STALE bit of the commit objects'
+ * flags.
+ */
+struct commit_list *reduce_heads(struct commit_list *heads);
+
+/*
+ * Like `reduce_heads()`, except it replaces the list. Use this
+ * instead of `foo = reduce_heads(foo);` to avoid memory leaks.
+ */
+void reduce_heads_replace(struct commit_list **heads);
+
+/*
+ * Is "new_oid" a commit that descends from the commit "old_oid"? Tags
+ * are peeled; anything else than a commit says no.
+ */
+int ref_newer(const struct object_id *new_oid, const struct object_id *old_oid);
+
+/*
+ * Count the commits reachable from "ours" but not from "theirs" into
+ * "num_ours" and the other way around into "num_theirs", from the
+ * reachability bitmaps when they can answer, and otherwise by walking
+ * "ours...theirs".
+ */
+void ahead_behind(struct commit *ours, struct commit *theirs,
+		  int *num_ours, int *num_theirs);
+
+/*
+ * Unknown has to be "0" here, because that's the default value for
+ * contains_cache slab entries that have not yet been assigned.
+ */
+enum contains_result {
+	CONTAINS_UNKNOWN = 0,
+	CONTAINS_NO,
+	CONTAINS_YES
+};
+
+define_commit_slab(contains_cache, enum contains_result);
+
+/*
+ * Does "commit" contain one of the commits in "list", i.e. is it one of
+ * their descendants? The answers for the commits walked over are kept
+ * in "cache" and reused by later calls when the filter asks for the
+ * "git tag --contains" algorithm.
+ */
+int commit_contains(struct ref_filter *filter, struct commit *commit,
+		    struct commit_list *list, struct contains_cache *cache);
+
+/*
+ * Set "result[i]" to whether "commits[i]" contains one of the commits
+ * in "list", for each of the "nr" commits. When the commits in "list"
+ * have generation numbers, or the filter asks for the "git tag
+ * --contains" algorithm, this is one walk shared by all the commits:
+ * each commit above the lowest generation of "list" is visited at
+ * most once, however many of "commits" reach it.
+ */
+void commits_contain(struct ref_filter *filter, struct commit **commits,
+		     int nr, struct commit_list *list, unsigned char *result);
+
+/*
+ * Determine if every commit in "from" can reach at least one commit that
+ * is marked with "with_flag". As we traverse, use "assign_flag" as a
+ * marker for commits that are already known to reach a "with_flag"
+ * commit, so that later calls need not walk from them again. Tags in
+ * "from" are peeled; other non-commits are marked and skipped.
+ *
+ * The walk does not continue past commits older than "min_commit_date"
+ * or with a generation number below "min_generation".
+ */
+int can_all_from_reach_with_flag(struct object_array *from,
+				 unsigned int with_flag,
+				 unsigned int assign_flag,
+				 timestamp_t min_commit_date,
+				 timestamp_t min_generation);
+
+/*
+ * Can every commit in "from" reach at least one of the commits in "to"?
+ * The walk is cut short by the generation numbers of the "to" commits,
+ * and by their commit dates as well if "cutoff_by_min_date" is set.
+ */
+int can_all_from_reach(struct commit_list *from, struct commit_list *to,
+		       int cutoff_by_min_date);
+
+#endif
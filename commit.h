@@ -8,10 +8,12 @@
 #include "gpg-interface.h"
 #include "string-list.h"
 #include "pretty.h"
+#include "commit-slab-decl.h"
 
 #define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
-#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
-#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_INFINITY ((1ULL << 63) - 1)
+#define GENERATION_NUMBER_V1_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_V2_OFFSET_MAX ((1ULL << 31) - 1)
 #define GENERATION_NUMBER_ZERO 0
 
 struct commit_list {
@@ -36,7 +38,12 @@ struct commit {
 	 */
 	struct tree *maybe_tree;
 	uint32_t graph_pos;
-	uint32_t generation;
+	/*
+	 * The topological level or, if every commit-graph layer stores
+	 * it, the corrected commit date of a commit loaded from the
+	 * commit-graph; GENERATION_NUMBER_INFINITY otherwise.
+	 */
+	timestamp_t generation;
 	unsigned int index;
 };
 
@@ -197,13 +204,6 @@ struct commit_graft *read_graft_line(struct strbuf *line);
 int register_commit_graft(struct repository *r, struct commit_graft *, int);
 struct commit_graft *lookup_commit_graft(struct repository *r, const struct object_id *oid);
 
-extern struct commit_list *get_merge_bases(struct commit *rev1, struct commit *rev2);
-extern struct commit_list *get_merge_bases_many(struct commit *one, int n, struct commit **twos);
-extern struct commit_list *get_octopus_merge_bases(struct commit_list *in);
-
-/* To be used only when object flags after this call no longer matter */
-extern struct commit_list *get_merge_bases_many_dirty(struct commit *one, int n, struct commit **twos);
-
 /* largest positive number a signed 32-bit integer can contain */
 #define INFINITE_DEPTH 0x7fffffff
 
@@ -251,32 +251,10 @@ extern int delayed_reachability_test(struct shallow_info *si, int c);
 extern void prune_shallow(int show_only);
 extern struct trace_key trace_shallow;
 
-int is_descendant_of(struct commit *, struct commit_list *);
-int in_merge_bases(struct commit *, struct commit *);
-int in_merge_bases_many(struct commit *, int, struct commit **);
-
 extern int interactive_add(int argc, const char **argv, const char *prefix, int patch);
 extern int run_add_interactive(const char *revision, const char *patch_mode,
 			       const struct pathspec *pathspec);
 
-/*
- * Takes a list of commits and returns a new list where those
- * have been removed that can be reached from other commits in
- * the list. It is useful for, e.g., reducing the commits
- * randomly thrown at the git-merge command and removing
- * redundant commits that the user shouldn't have given to it.
- *
- * This function destroys the STALE bit of the commit objects'
- * flags.
- */
-extern struct commit_list *reduce_heads(struct commit_list *heads);
-
-/*
- * Like `reduce_heads()`, except it replaces the list. Use this
- * instead of `foo = reduce_heads(foo);` to avoid memory leaks.
- */
-extern void reduce_heads_replace(struct commit_list **heads);
-
 struct commit_extra_header {
 	struct commit_extra_header *next;
 	char *key;
@@ -314,6 +292,45 @@ extern void free_commit_extra_headers(struct commit_extra_header *extra);
 extern const char *find_commit_header(const char *msg, const char *key,
 				      size_t *out_len);
 
+enum commit_header {
+	COMMIT_HEADER_AUTHOR,
+	COMMIT_HEADER_COMMITTER,
+	COMMIT_HEADER_ENCODING,
+	COMMIT_HEADER_NR
+};
+
+/*
+ * Where the headers of a commit are in its object contents. For each of
+ * them, "off" is the offset of its value, or 0 if the commit does not
+ * have it, and "len" is the length of the value up to the newline.
+ * "end" is the offset of the empty line after the headers, or of the
+ * end if there is none.
+ */
+struct commit_header_offsets {
+	size_t off[COMMIT_HEADER_NR];
+	size_t len[COMMIT_HEADER_NR];
+	size_t end;
+};
+
+/*
+ * Return the offsets of the headers in "buffer", which holds the contents
+ * of "commit" as they are in the object, not re-encoded. They are found
+ * the first time they are asked for and kept with the commit. Returns
+ * NULL if a header appears more than once; the caller then has to look
+ * for the one it wants itself.
+ */
+extern const struct commit_header_offsets *commit_header_offsets(const struct commit *commit,
+								 const char *buffer);
+
+/*
+ * find_commit_header() for one of the headers above, using the offsets
+ * kept with "commit".
+ */
+extern const char *find_commit_header_cached(const struct commit *commit,
+					     const char *buffer,
+					     enum commit_header key,
+					     size_t *out_len);
+
 /* Find the end of the log message, the right place for a new trailer. */
 extern int ignore_non_trailer(const char *buf, size_t len);
 
@@ -350,9 +367,31 @@ extern int remove_signature(struct strbuf *buf);
  */
 extern int check_commit_signature(const struct commit *commit, struct signature_check *sigc);
 
+/*
+ * Verify the signatures of "commits" all at once, several at a time,
+ * so that check_commit_signature() on them later need not wait for gpg.
+ * Until clear_prefetched_commit_signatures(), the results are kept by
+ * commit and prefetched_commit_signature() gives them, or NULL for a
+ * commit that was not prefetched. Its "signature" is NULL for an
+ * unsigned commit.
+ */
+void prefetch_commit_signatures(struct commit **commits, int nr);
+const struct signature_verification *prefetched_commit_signature(const struct commit *commit);
+void clear_prefetched_commit_signatures(void);
+
+/* record author-date for each commit object */
+define_shared_commit_slab(author_date_slab, timestamp_t);
+
+void record_author_date(struct author_date_slab *author_date,
+			struct commit *commit);
+
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
 int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
 
+/* "author_date" is the author_date_slab filled by record_author_date() */
+int compare_commits_by_author_date(const void *a_, const void *b_,
+				   void *author_date);
+
 LAST_ARG_MUST_BE_NULL
 extern int run_commit_hook(int editor_is_used, const char *index_file, const char *name, ...);
 
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "exec-cmd.h"
 #include "attr.h"
+#include "trace2.h"
 
 /*
  * Many parts of Git have subprograms communicate via pipe, expect the
@@ -42,5 +43,8 @@ int main(int argc, const char **argv)
 
 	restore_sigpipe_to_default();
 
-	return cmd_main(argc, argv);
+	trace2_initialize(argv);
+
+	/* returning from main() does not go through the exit() wrapper */
+	return trace2_cmd_exit_fl(__FILE__, __LINE__, cmd_main(argc, argv));
 }
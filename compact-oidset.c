@@ -0,0 +1,389 @@
+#include "cache.h"
+#include "config.h"
+#include "compact-oidset.h"
+
+/*
+ * A run holds "nr" oids in sorted order, in blocks of RUN_BLOCK.  The
+ * first oid of block "b" is kept whole, at "first + b * rawsz", so the
+ * blocks can be binary-searched.  All the oids of the block start with
+ * the same "prefix[b]" bytes; of the others, only the remaining bytes
+ * are stored, one after the other, from "data + offset[b]".
+ *
+ * The oids of a large run are close to each other, so the bytes left
+ * out make up for what the first oids cost.
+ *
+ * To narrow down the binary search, "fence[k]" is the first block that
+ * starts at or after any oid whose leading "fence_bits" bits are "k".
+ */
+#define RUN_BLOCK 64
+
+struct compact_oidset_run {
+	size_t nr;
+	unsigned char *first;
+	unsigned char *prefix;
+	size_t *offset;
+	unsigned char *data;
+	size_t data_nr, data_alloc;
+	size_t *fence;
+	int fence_bits;
+};
+
+static size_t staging_max(void)
+{
+	static size_t max;
+
+	if (!max) {
+		max = git_env_ulong("GIT_TEST_COMPACT_OIDSET_STAGING", 1 << 16);
+		if (!max)
+			max = 1;
+	}
+	return max;
+}
+
+static size_t nr_blocks(size_t nr)
+{
+	return DIV_ROUND_UP(nr, RUN_BLOCK);
+}
+
+static size_t fence_key(const struct compact_oidset_run *run,
+			const unsigned char *hash)
+{
+	uint32_t lead = get_be32(hash);
+
+	return run->fence_bits ? lead >> (32 - run->fence_bits) : 0;
+}
+
+static void run_get(const struct compact_oidset_run *run, size_t i,
+		    struct object_id *oid)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	size_t b = i / RUN_BLOCK, j = i % RUN_BLOCK;
+	const unsigned char *first = run->first + b * rawsz;
+	size_t p = run->prefix[b], width = rawsz - p;
+
+	if (!j) {
+		memcpy(oid->hash, first, rawsz);
+		return;
+	}
+	memcpy(oid->hash, first, p);
+	memcpy(oid->hash + p, run->data + run->offset[b] + (j - 1) * width,
+	       width);
+}
+
+static int run_contains(const struct compact_oidset_run *run,
+			const struct object_id *oid)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	size_t k = fence_key(run, oid->hash);
+	size_t lo = run->fence[k], hi = run->fence[k + 1];
+	size_t b, p, width;
+	const unsigned char *data;
+
+	/*
+	 * Find the last block that starts at or before "oid"; all blocks
+	 * before "lo" do, and none from "hi" on.
+	 */
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		int cmp = memcmp(run->first + mi * rawsz, oid->hash, rawsz);
+
+		if (!cmp)
+			return 1;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	if (!lo)
+		return 0;
+	b = lo - 1;
+	p = run->prefix[b];
+	if (memcmp(run->first + b * rawsz, oid->hash, p))
+		return 0;
+
+	width = rawsz - p;
+	data = run->data + run->offset[b];
+	lo = 0;
+	hi = (b + 1 < nr_blocks(run->nr) ? RUN_BLOCK : run->nr - b * RUN_BLOCK) - 1;
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		int cmp = memcmp(data + mi * width, oid->hash + p, width);
+
+		if (!cmp)
+			return 1;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+static void run_free(struct compact_oidset_run *run)
+{
+	free(run->first);
+	free(run->prefix);
+	free(run->offset);
+	free(run->data);
+	free(run->fence);
+}
+
+/* Builds a run out of oids given in sorted order. */
+struct run_writer {
+	struct compact_oidset_run *run;
+	struct object_id block[RUN_BLOCK];
+	int block_nr;
+};
+
+static void writer_init(struct run_writer *w, struct compact_oidset_run *run,
+			size_t max_nr)
+{
+	memset(run, 0, sizeof(*run));
+	ALLOC_ARRAY(run->first, st_mult(nr_blocks(max_nr), the_hash_algo->rawsz));
+	ALLOC_ARRAY(run->prefix, nr_blocks(max_nr));
+	ALLOC_ARRAY(run->offset, nr_blocks(max_nr));
+	w->run = run;
+	w->block_nr = 0;
+}
+
+static void writer_flush(struct run_writer *w)
+{
+	struct compact_oidset_run *run = w->run;
+	size_t rawsz = the_hash_algo->rawsz;
+	size_t b = run->nr / RUN_BLOCK, p = 0, width;
+	const struct object_id *last;
+	int i;
+
+	if (!w->block_nr)
+		return;
+	last = &w->block[w->block_nr - 1];
+	while (p < rawsz && w->block[0].hash[p] == last->hash[p])
+		p++;
+	memcpy(run->first + b * rawsz, w->block[0].hash, rawsz);
+	run->prefix[b] = p;
+	run->offset[b] = run->data_nr;
+
+	width = rawsz - p;
+	ALLOC_GROW(run->data, run->data_nr + (w->block_nr - 1) * width,
+		   run->data_alloc);
+	for (i = 1; i < w->block_nr; i++) {
+		memcpy(run->data + run->data_nr, w->block[i].hash + p, width);
+		run->data_nr += width;
+	}
+	run->nr += w->block_nr;
+	w->block_nr = 0;
+}
+
+static void writer_add(struct run_writer *w, const struct object_id *oid)
+{
+	oidcpy(&w->block[w->block_nr++], oid);
+	if (w->block_nr == RUN_BLOCK)
+		writer_flush(w);
+}
+
+static void writer_finish(struct run_writer *w)
+{
+	struct compact_oidset_run *run = w->run;
+
+	size_t rawsz = the_hash_algo->rawsz, blocks, b, k;
+
+	writer_flush(w);
+	/* give back what ALLOC_GROW() reserved ahead */
+	REALLOC_ARRAY(run->data, run->data_nr);
+	run->data_alloc = run->data_nr;
+
+	/* about one fence per block */
+	blocks = nr_blocks(run->nr);
+	run->fence_bits = 0;
+	while (run->fence_bits < 24 && ((size_t)2 << run->fence_bits) <= blocks)
+		run->fence_bits++;
+	ALLOC_ARRAY(run->fence, ((size_t)1 << run->fence_bits) + 1);
+	for (b = 0, k = 0; b < blocks; b++) {
+		size_t key = fence_key(run, run->first + b * rawsz);
+
+		while (k <= key)
+			run->fence[k++] = b;
+	}
+	while (k <= ((size_t)1 << run->fence_bits))
+		run->fence[k++] = blocks;
+}
+
+/* Add "oid" to a run being written, unless it was removed from the set. */
+static void write_oid(struct compact_oidset *set, struct run_writer *w,
+		      const struct object_id *oid)
+{
+	if (oidset_size(&set->removed) && oidset_remove(&set->removed, oid))
+		return;
+	writer_add(w, oid);
+}
+
+static void merge_last_runs(struct compact_oidset *set)
+{
+	struct compact_oidset_run *a = &set->runs[set->nr_runs - 2];
+	struct compact_oidset_run *b = &set->runs[set->nr_runs - 1];
+	struct compact_oidset_run merged;
+	struct run_writer *w = xmalloc(sizeof(*w));
+	struct object_id oa, ob;
+	size_t i = 0, j = 0;
+
+	writer_init(w, &merged, a->nr + b->nr);
+	if (a->nr)
+		run_get(a, 0, &oa);
+	if (b->nr)
+		run_get(b, 0, &ob);
+	/* the runs have no oid in common */
+	while (i < a->nr || j < b->nr) {
+		if (j == b->nr || (i < a->nr && oidcmp(&oa, &ob) < 0)) {
+			write_oid(set, w, &oa);
+			if (++i < a->nr)
+				run_get(a, i, &oa);
+		} else {
+			write_oid(set, w, &ob);
+			if (++j < b->nr)
+				run_get(b, j, &ob);
+		}
+	}
+	writer_finish(w);
+	free(w);
+
+	run_free(a);
+	run_free(b);
+	*a = merged;
+	set->nr_runs--;
+}
+
+static int cmp_oid(const void *a, const void *b)
+{
+	return oidcmp(a, b);
+}
+
+/*
+ * Move the staged oids to a new run, then merge runs for as long as
+ * the last one is at least half as large as the one before it, so that
+ * there are only logarithmically many.
+ */
+static void flush_staging(struct compact_oidset *set)
+{
+	struct oidset_iter iter;
+	struct object_id *oid, *sorted;
+	size_t nr = oidset_size(&set->staging), i = 0;
+	struct run_writer *w = xmalloc(sizeof(*w));
+
+	ALLOC_ARRAY(sorted, nr);
+	oidset_iter_init(&set->staging, &iter);
+	while ((oid = oidset_iter_next(&iter)))
+		oidcpy(&sorted[i++], oid);
+	QSORT(sorted, nr, cmp_oid);
+	oidset_clear(&set->staging);
+	oidset_init(&set->staging, staging_max());
+
+	ALLOC_GROW(set->runs, set->nr_runs + 1, set->alloc_runs);
+	writer_init(w, &set->runs[set->nr_runs++], nr);
+	for (i = 0; i < nr; i++)
+		writer_add(w, &sorted[i]);
+	writer_finish(w);
+	free(w);
+	free(sorted);
+
+	while (set->nr_runs > 1 &&
+	       set->runs[set->nr_runs - 2].nr <= 2 * set->runs[set->nr_runs - 1].nr)
+		merge_last_runs(set);
+}
+
+static int runs_contain(const struct compact_oidset *set,
+			const struct object_id *oid)
+{
+	int i;
+
+	for (i = 0; i < set->nr_runs; i++)
+		if (run_contains(&set->runs[i], oid))
+			return 1;
+	return 0;
+}
+
+int compact_oidset_contains(const struct compact_oidset *set,
+			    const struct object_id *oid)
+{
+	if (oidset_contains(&set->staging, oid))
+		return 1;
+	if (!runs_contain(set, oid))
+		return 0;
+	return !oidset_contains(&set->removed, oid);
+}
+
+int compact_oidset_insert(struct compact_oidset *set,
+			  const struct object_id *oid)
+{
+	if (oidset_contains(&set->staging, oid))
+		return 1;
+	if (runs_contain(set, oid)) {
+		/* it may be coming back after having been removed */
+		return !(oidset_size(&set->removed) &&
+			 oidset_remove(&set->removed, oid));
+	}
+	oidset_insert(&set->staging, oid);
+	if (oidset_size(&set->staging) >= staging_max())
+		flush_staging(set);
+	return 0;
+}
+
+int compact_oidset_remove(struct compact_oidset *set,
+			  const struct object_id *oid)
+{
+	if (oidset_remove(&set->staging, oid))
+		return 1;
+	if (!runs_contain(set, oid) || oidset_contains(&set->removed, oid))
+		return 0;
+	oidset_insert(&set->removed, oid);
+	return 1;
+}
+
+void compact_oidset_clear(struct compact_oidset *set)
+{
+	int i;
+
+	oidset_clear(&set->staging);
+	oidset_clear(&set->removed);
+	for (i = 0; i < set->nr_runs; i++)
+		run_free(&set->runs[i]);
+	FREE_AND_NULL(set->runs);
+	set->nr_runs = set->alloc_runs = 0;
+}
+
+void compact_oidset_iter_init(struct compact_oidset *set,
+			      struct compact_oidset_iter *iter)
+{
+	iter->set = set;
+	oidset_iter_init(&set->staging, &iter->staging);
+	iter->in_staging = 1;
+	iter->run = 0;
+	iter->pos = 0;
+}
+
+struct object_id *compact_oidset_iter_next(struct compact_oidset_iter *iter)
+{
+	struct compact_oidset *set = iter->set;
+
+	if (iter->in_staging) {
+		struct object_id *oid = oidset_iter_next(&iter->staging);
+
+		if (oid)
+			return oid;
+		iter->in_staging = 0;
+	}
+	while (iter->run < set->nr_runs) {
+		struct compact_oidset_run *run = &set->runs[iter->run];
+
+		if (iter->pos == run->nr) {
+			iter->run++;
+			iter->pos = 0;
+			continue;
+		}
+		run_get(run, iter->pos++, &iter->oid);
+		if (oidset_size(&set->removed) &&
+		    oidset_contains(&set->removed, &iter->oid))
+			continue;
+		return &iter->oid;
+	}
+	return NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef COMPACT_OIDSET_H
+#define COMPACT_OIDSET_H
+
+#include "oidset.h"
+
+/**
+ * A set of object ids for when there are millions of them, e.g. the
+ * objects a filter omits from a walk.
+ *
+ * Each oid in a "struct oidset" costs a hash table slot and an
+ * allocation of its own, several times the size of the oid itself.
+ * A compact_oidset instead keeps new oids in a small oidset, and
+ * whenever that fills up, moves them to a sorted "run".  Runs are
+ * merged as they pile up, so there are only a few, and each is stored
+ * in blocks of oids that leave out the leading bytes that all the oids
+ * of the block share.  Lookups binary-search the runs.
+ *
+ * The API is that of oidset, except that there is no oidset_init()
+ * (the set grows as needed) and that oids come out of an iteration in
+ * no particular order.
+ */
+
+struct compact_oidset_run;
+
+/**
+ * A single compact_oidset; should be zero-initialized (or use
+ * COMPACT_OIDSET_INIT).
+ */
+struct compact_oidset {
+	/* oids not yet in any run */
+	struct oidset staging;
+	/* oids still in a run, but removed from the set */
+	struct oidset removed;
+
+	/* sorted by size, the largest first */
+	struct compact_oidset_run *runs;
+	int nr_runs, alloc_runs;
+};
+
+#define COMPACT_OIDSET_INIT { OIDSET_INIT, OIDSET_INIT }
+
+/**
+ * Returns true iff `set` contains `oid`.
+ */
+int compact_oidset_contains(const struct compact_oidset *set,
+			    const struct object_id *oid);
+
+/**
+ * Insert the oid into the set.
+ *
+ * Returns 1 if the oid was already in the set, 0 otherwise.
+ */
+int compact_oidset_insert(struct compact_oidset *set,
+			  const struct object_id *oid);
+
+/**
+ * Remove the oid from the set.
+ *
+ * Returns 1 if the oid was present in the set, 0 otherwise.
+ */
+int compact_oidset_remove(struct compact_oidset *set,
+			  const struct object_id *oid);
+
+/**
+ * Remove all entries from the set, freeing any resources associated
+ * with it.
+ */
+void compact_oidset_clear(struct compact_oidset *set);
+
+struct compact_oidset_iter {
+	struct compact_oidset *set;
+	struct oidset_iter staging;
+	int in_staging;
+	int run;
+	size_t pos;
+	struct object_id oid;
+};
+
+void compact_oidset_iter_init(struct compact_oidset *set,
+			      struct compact_oidset_iter *iter);
+struct object_id *compact_oidset_iter_next(struct compact_oidset_iter *iter);
+
+static inline struct object_id *compact_oidset_iter_first(struct compact_oidset *set,
+							  struct compact_oidset_iter *iter)
+{
+	compact_oidset_iter_init(set, iter);
+	return compact_oidset_iter_next(iter);
+}
+
+#endif /* COMPACT_OIDSET_H */
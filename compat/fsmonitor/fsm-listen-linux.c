@@ -0,0 +1,224 @@
+#include "cache.h"
+#include "dir.h"
+#include "fsmonitor--daemon.h"
+#include "fsm-listen.h"
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+		    IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | \
+		    IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+struct fsm_listen_data {
+	int fd;
+
+	/*
+	 * The directory watched by each watch descriptor, relative to the
+	 * work tree and with a trailing slash (the work tree itself is
+	 * ""), or NULL if the descriptor is unused. Watch descriptors are
+	 * small integers, so they index this array directly.
+	 */
+	char **dirs;
+	int dirs_alloc;
+	int root_wd;
+};
+
+/*
+ * Watch "dir" (relative, with a trailing slash unless empty) and all
+ * directories below it, except the repository's own ".git". When the
+ * directory appeared after we started, whatever was created in it
+ * before the watch was in place is published as well.
+ */
+static void add_watches(struct fsmonitor_daemon_state *state,
+			struct strbuf *dir, int publish)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	size_t baselen = dir->len;
+	struct dirent *de;
+	DIR *d;
+	int wd;
+
+	wd = inotify_add_watch(data->fd, dir->len ? dir->buf : ".", WATCH_MASK);
+	if (wd < 0) {
+		/*
+		 * The directory may be gone already; running out of watches
+		 * means that we cannot tell what changes any more.
+		 */
+		if (errno == ENOSPC) {
+			warning(_("inotify watch limit reached"));
+			fsmonitor_force_resync(state);
+		}
+		return;
+	}
+	if (!baselen)
+		data->root_wd = wd;
+
+	if (wd >= data->dirs_alloc) {
+		int old_alloc = data->dirs_alloc;
+
+		ALLOC_GROW(data->dirs, wd + 1, data->dirs_alloc);
+		memset(data->dirs + old_alloc, 0,
+		       (data->dirs_alloc - old_alloc) * sizeof(*data->dirs));
+	}
+	free(data->dirs[wd]);
+	data->dirs[wd] = xstrdup(dir->buf);
+
+	d = opendir(dir->len ? dir->buf : ".");
+	if (!d)
+		return;
+
+	while ((de = readdir(d)) != NULL) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		if (!baselen && !strcmp(de->d_name, ".git"))
+			continue;
+
+		strbuf_setlen(dir, baselen);
+		strbuf_addstr(dir, de->d_name);
+		if (publish)
+			fsmonitor_publish(state, dir->buf);
+
+		if (lstat(dir->buf, &st) || !S_ISDIR(st.st_mode))
+			continue;
+		strbuf_addch(dir, '/');
+		add_watches(state, dir, publish);
+	}
+	strbuf_setlen(dir, baselen);
+	closedir(d);
+}
+
+/*
+ * A directory was moved away: the watches below it still report paths
+ * under its old name. Drop them; if it was moved within the work tree,
+ * IN_MOVED_TO adds them back under the new name.
+ */
+static void remove_watches(struct fsm_listen_data *data, const char *dir)
+{
+	size_t len = strlen(dir);
+	int wd;
+
+	for (wd = 0; wd < data->dirs_alloc; wd++) {
+		if (!data->dirs[wd] || strncmp(data->dirs[wd], dir, len) ||
+		    data->dirs[wd][len] != '/')
+			continue;
+		inotify_rm_watch(data->fd, wd);
+		FREE_AND_NULL(data->dirs[wd]);
+	}
+}
+
+static void handle_event(struct fsmonitor_daemon_state *state,
+			 const struct inotify_event *ev, struct strbuf *path)
+{
+	struct fsm_listen_data *data = state->listen_data;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		fsmonitor_force_resync(state);
+		return;
+	}
+
+	if (ev->wd < 0 || ev->wd >= data->dirs_alloc || !data->dirs[ev->wd])
+		return;
+
+	if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+		if (ev->wd == data->root_wd) {
+			state->shutdown = 1;
+			return;
+		}
+		if (ev->mask & IN_IGNORED)
+			FREE_AND_NULL(data->dirs[ev->wd]);
+		return;
+	}
+
+	if (!ev->len)
+		return;
+
+	strbuf_reset(path);
+	strbuf_addstr(path, data->dirs[ev->wd]);
+	strbuf_addstr(path, ev->name);
+	if (!strcmp(path->buf, ".git"))
+		return;
+
+	fsmonitor_publish(state, path->buf);
+
+	if (!(ev->mask & IN_ISDIR))
+		return;
+	if (ev->mask & IN_MOVED_FROM)
+		remove_watches(data, path->buf);
+	if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		strbuf_addch(path, '/');
+		add_watches(state, path, 1);
+	}
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = xcalloc(1, sizeof(*data));
+	struct strbuf dir = STRBUF_INIT;
+
+	data->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd < 0) {
+		free(data);
+		return error_errno(_("unable to initialize inotify"));
+	}
+	data->root_wd = -1;
+	state->listen_data = data;
+
+	add_watches(state, &dir, 0);
+	strbuf_release(&dir);
+
+	if (data->root_wd < 0) {
+		fsm_listen__dtor(state);
+		return error_errno(_("unable to watch the work tree"));
+	}
+	return 0;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	int wd;
+
+	if (!data)
+		return;
+	close(data->fd);
+	for (wd = 0; wd < data->dirs_alloc; wd++)
+		free(data->dirs[wd]);
+	free(data->dirs);
+	FREE_AND_NULL(state->listen_data);
+}
+
+int fsm_listen__fd(struct fsmonitor_daemon_state *state)
+{
+	return state->listen_data->fd;
+}
+
+void fsm_listen__drain(struct fsmonitor_daemon_state *state)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct strbuf path = STRBUF_INIT;
+
+	while (!state->shutdown) {
+		ssize_t len = read(fsm_listen__fd(state), buf, sizeof(buf));
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				error_errno(_("unable to read inotify events"));
+			break;
+		}
+		if (!len)
+			break;
+
+		for (p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+
+			handle_event(state, ev, &path);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	strbuf_release(&path);
+}
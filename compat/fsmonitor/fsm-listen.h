@@ -0,0 +1,33 @@
+#ifndef FSM_LISTEN_H
+#define FSM_LISTEN_H
+
+/*
+ * The platform-specific backend of "git fsmonitor--daemon". The daemon
+ * runs a single poll() loop over the listening socket and the file
+ * descriptor returned by fsm_listen__fd(); whenever the latter becomes
+ * readable, and before each client is answered, it calls
+ * fsm_listen__drain() to have all pending events published.
+ */
+
+struct fsmonitor_daemon_state;
+
+/*
+ * Start watching the work tree, which is the current directory, and
+ * store the backend-specific data in state->listen_data. Return 0 on
+ * success and -1 (after reporting the error) on failure.
+ */
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state);
+
+/* Stop watching the work tree and release state->listen_data. */
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state);
+
+/* The descriptor to poll for readability. */
+int fsm_listen__fd(struct fsmonitor_daemon_state *state);
+
+/*
+ * Publish every event that is pending, without blocking. Set
+ * state->shutdown when the work tree itself went away.
+ */
+void fsm_listen__drain(struct fsmonitor_daemon_state *state);
+
+#endif /* FSM_LISTEN_H */
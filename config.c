@@ -18,6 +18,7 @@
 #include "utf8.h"
 #include "dir.h"
 #include "color.h"
+#include "trace2.h"
 
 struct config_source {
 	struct config_source *prev;
@@ -71,6 +72,13 @@ static struct key_value_info *current_config_kvi;
  */
 static enum config_scope current_parsing_scope;
 
+/*
+ * While non-NULL, the files that the configuration of a repository is
+ * read from are recorded here, for the cache of that configuration
+ * (see core.configCache).
+ */
+static struct string_list *config_cache_files;
+
 static int core_compression_seen;
 static int pack_compression_seen;
 static int zlib_compression_seen;
@@ -116,6 +124,41 @@ static long config_buf_ftell(struct config_source *conf)
 	return conf->u.buf.pos;
 }
 
+#define CONFIG_CACHE_SIGNATURE 0x43464743 /* "CFGC" */
+#define CONFIG_CACHE_VERSION 2
+#define CONFIG_CACHE_STAT_WORDS 10
+
+/*
+ * The stat data of "path" as the cache records it; all zero if there
+ * is no such file, so that its creation is noticed too.
+ */
+static void config_cache_stat(const char *path, uint32_t *words)
+{
+	struct stat st;
+	struct stat_data sd;
+
+	memset(words, 0, sizeof(*words) * CONFIG_CACHE_STAT_WORDS);
+	if (stat(path, &st))
+		return;
+	fill_stat_data(&sd, &st);
+	words[0] = 1;
+	words[1] = sd.sd_ctime.sec;
+	words[2] = sd.sd_ctime.nsec;
+	words[3] = sd.sd_mtime.sec;
+	words[4] = sd.sd_mtime.nsec;
+	words[5] = sd.sd_dev;
+	words[6] = sd.sd_ino;
+	words[7] = sd.sd_uid;
+	words[8] = sd.sd_gid;
+	words[9] = sd.sd_size;
+}
+
+static void record_config_file(const char *path)
+{
+	if (config_cache_files)
+		string_list_append(config_cache_files, path);
+}
+
 #define MAX_INCLUDE_DEPTH 10
 static const char include_depth_advice[] =
 "exceeded maximum include depth (%d) while including\n"
@@ -154,6 +197,7 @@ static int handle_path_include(const char *path, struct config_include_data *inc
 		path = buf.buf;
 	}
 
+	record_config_file(path);
 	if (!access_or_die(path, R_OK, 0)) {
 		if (++inc->depth > MAX_INCLUDE_DEPTH)
 			die(include_depth_advice, MAX_INCLUDE_DEPTH, path,
@@ -1217,6 +1261,28 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.treecachelimit")) {
+		tree_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.compactobjectwalk")) {
+		core_compact_object_walk = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.deltabasecachepolicy")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "lru"))
+			delta_base_cache_policy = DELTA_BASE_CACHE_LRU;
+		else if (!strcmp(value, "arc"))
+			delta_base_cache_policy = DELTA_BASE_CACHE_ARC;
+		else
+			die(_("invalid policy for the delta base cache: %s"), value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.autocrlf")) {
 		if (value && !strcasecmp(value, "input")) {
 			auto_crlf = AUTO_CRLF_INPUT;
@@ -1294,11 +1360,33 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.fsyncmethod")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "fsync"))
+			fsync_method = FSYNC_METHOD_FSYNC;
+		else if (!strcmp(value, "batch"))
+			fsync_method = FSYNC_METHOD_BATCH;
+		else
+			die(_("invalid fsync method: %s"), value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.preloadindex")) {
 		core_preload_index = git_config_bool(var, value);
 		return 0;
 	}
 
+	if (!strcmp(var, "core.bulkstat")) {
+		core_bulk_stat = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.looseobjectcache")) {
+		core_loose_object_cache = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.createobject")) {
 		if (!strcmp(value, "rename"))
 			object_creation_mode = OBJECT_CREATION_USES_RENAMES;
@@ -1314,11 +1402,21 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.multipackindex")) {
+		core_multi_pack_index = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.sparsecheckout")) {
 		core_apply_sparse_checkout = git_config_bool(var, value);
 		return 0;
 	}
 
+	if (!strcmp(var, "core.sparsecheckoutcone")) {
+		core_sparse_checkout_cone = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.precomposeunicode")) {
 		precomposed_unicode = git_config_bool(var, value);
 		return 0;
@@ -1648,23 +1746,27 @@ int git_config_system(void)
 	return !git_env_bool("GIT_CONFIG_NOSYSTEM", 0);
 }
 
-static int do_git_config_sequence(const struct config_options *opts,
-				  config_fn_t fn, void *data)
+static void do_git_config_parameters(config_fn_t fn, void *data)
+{
+	current_parsing_scope = CONFIG_SCOPE_CMDLINE;
+	if (git_config_from_parameters(fn, data) < 0)
+		die(_("unable to parse command-line config"));
+	current_parsing_scope = CONFIG_SCOPE_UNKNOWN;
+}
+
+/* Read the system and the user configuration. */
+static int do_git_config_sequence_global(config_fn_t fn, void *data)
 {
 	int ret = 0;
 	char *xdg_config = xdg_config_home("config");
 	char *user_config = expand_user_path("~/.gitconfig", 0);
-	char *repo_config;
-
-	if (opts->commondir)
-		repo_config = mkpathdup("%s/config", opts->commondir);
-	else
-		repo_config = NULL;
 
 	current_parsing_scope = CONFIG_SCOPE_SYSTEM;
-	if (git_config_system() && !access_or_die(git_etc_gitconfig(), R_OK, 0))
-		ret += git_config_from_file(fn, git_etc_gitconfig(),
-					    data);
+	if (git_config_system()) {
+		if (!access_or_die(git_etc_gitconfig(), R_OK, 0))
+			ret += git_config_from_file(fn, git_etc_gitconfig(),
+						    data);
+	}
 
 	current_parsing_scope = CONFIG_SCOPE_GLOBAL;
 	if (xdg_config && !access_or_die(xdg_config, R_OK, ACCESS_EACCES_OK))
@@ -1673,21 +1775,44 @@ static int do_git_config_sequence(const struct config_options *opts,
 	if (user_config && !access_or_die(user_config, R_OK, ACCESS_EACCES_OK))
 		ret += git_config_from_file(fn, user_config, data);
 
+	free(xdg_config);
+	free(user_config);
+	return ret;
+}
+
+/* Read the configuration of the repository itself. */
+static int do_git_config_sequence_repo(const struct config_options *opts,
+				       config_fn_t fn, void *data)
+{
+	int ret = 0;
+	char *repo_config;
+
+	if (opts->commondir)
+		repo_config = mkpathdup("%s/config", opts->commondir);
+	else
+		repo_config = NULL;
+
 	current_parsing_scope = CONFIG_SCOPE_REPO;
+	if (repo_config)
+		record_config_file(repo_config);
 	if (repo_config && !access_or_die(repo_config, R_OK, 0))
 		ret += git_config_from_file(fn, repo_config, data);
 
-	current_parsing_scope = CONFIG_SCOPE_CMDLINE;
-	if (git_config_from_parameters(fn, data) < 0)
-		die(_("unable to parse command-line config"));
-
-	current_parsing_scope = CONFIG_SCOPE_UNKNOWN;
-	free(xdg_config);
-	free(user_config);
 	free(repo_config);
 	return ret;
 }
 
+static int do_git_config_sequence(const struct config_options *opts,
+				  config_fn_t fn, void *data)
+{
+	int ret = 0;
+
+	ret += do_git_config_sequence_global(fn, data);
+	ret += do_git_config_sequence_repo(opts, fn, data);
+	do_git_config_parameters(fn, data);
+	return ret;
+}
+
 int config_with_options(config_fn_t fn, void *data,
 			struct git_config_source *config_source,
 			const struct config_options *opts)
@@ -1769,9 +1894,18 @@ void read_early_config(config_fn_t cb, void *data)
 	strbuf_release(&gitdir);
 }
 
-static struct config_set_element *configset_find_element(struct config_set *cs, const char *key)
+static struct config_set_element *configset_find_normalized(struct config_set *cs,
+							   const char *key)
 {
 	struct config_set_element k;
+
+	hashmap_entry_init(&k, strhash(key));
+	k.key = (char *)key;
+	return hashmap_get(&cs->config_hash, &k, NULL);
+}
+
+static struct config_set_element *configset_find_element(struct config_set *cs, const char *key)
+{
 	struct config_set_element *found_entry;
 	char *normalized_key;
 	/*
@@ -1781,25 +1915,23 @@ static struct config_set_element *configset_find_element(struct config_set *cs,
 	if (git_config_parse_key(key, &normalized_key, NULL))
 		return NULL;
 
-	hashmap_entry_init(&k, strhash(normalized_key));
-	k.key = normalized_key;
-	found_entry = hashmap_get(&cs->config_hash, &k, NULL);
+	found_entry = configset_find_normalized(cs, normalized_key);
 	free(normalized_key);
 	return found_entry;
 }
 
-static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+static void configset_add(struct config_set *cs, const char *key,
+			  const char *value, struct key_value_info *kv_info)
 {
 	struct config_set_element *e;
 	struct string_list_item *si;
 	struct configset_list_item *l_item;
-	struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
 
-	e = configset_find_element(cs, key);
 	/*
 	 * Since the keys are being fed by git_config*() callback mechanism, they
 	 * are already normalized. So simply add them without any further munging.
 	 */
+	e = configset_find_normalized(cs, key);
 	if (!e) {
 		e = xmalloc(sizeof(*e));
 		hashmap_entry_init(e, strhash(key));
@@ -1813,6 +1945,12 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 	l_item = &cs->list.items[cs->list.nr++];
 	l_item->e = e;
 	l_item->value_index = e->value_list.nr - 1;
+	si->util = kv_info;
+}
+
+static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+{
+	struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
 
 	if (!cf)
 		BUG("configset_add_value has no source");
@@ -1827,7 +1965,7 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 		kv_info->origin_type = CONFIG_ORIGIN_CMDLINE;
 	}
 	kv_info->scope = current_parsing_scope;
-	si->util = kv_info;
+	configset_add(cs, key, value, kv_info);
 
 	return 0;
 }
@@ -1983,10 +2121,310 @@ int git_configset_get_pathname(struct config_set *cs, const char *key, const cha
 		return 1;
 }
 
+/*
+ * With core.configCache, the configuration that a repository reads from
+ * its own files is saved in "$GIT_DIR/config-cache", so that the next
+ * process can skip parsing them as long as none of them changed.  The
+ * cache is:
+ *
+ *   - a 4-byte signature, CONFIG_CACHE_SIGNATURE,
+ *   - a 4-byte version number, CONFIG_CACHE_VERSION,
+ *   - the NUL-terminated key from config_cache_key(),
+ *   - the 4-byte number of files, and for each of them its
+ *     NUL-terminated path and CONFIG_CACHE_STAT_WORDS 4-byte words of
+ *     stat data (see config_cache_stat()),
+ *   - the 4-byte number of values, and for each of them its 1-byte
+ *     scope, origin type and whether it has a value, the 4-byte
+ *     position of its file in the list above, its 4-byte line number,
+ *     and its NUL-terminated key and value (if any),
+ *   - the checksum of all of the above.
+ *
+ * All numbers are in network byte order.
+ *
+ * Anyone who can write to the repository can write the cache, so it
+ * must not be able to say more than the repository configuration
+ * could: only values of the repository scope are cached, and the system
+ * and user configuration, as well as values from the command line, are
+ * read anew every time.  For the same reason, the cache is only used
+ * when it is enabled outside of the repository.
+ */
+static char *config_cache_path(struct repository *repo)
+{
+	return mkpathdup("%s/config-cache", repo->gitdir);
+}
+
+/* What decides which files are read, other than their contents. */
+static void config_cache_key(struct repository *repo, struct strbuf *key)
+{
+	const char *home = getenv("HOME");
+
+	strbuf_addf(key, "%s\n%s\n%s",
+		    repo->gitdir, repo->commondir, home ? home : "");
+}
+
+static void config_cache_add_uint32(struct strbuf *buf, uint32_t v)
+{
+	v = htonl(v);
+	strbuf_add(buf, &v, sizeof(v));
+}
+
+static const char *config_cache_string(const char **p, const char *end)
+{
+	const char *s = *p;
+	const char *nul = memchr(s, '\0', end - s);
+
+	if (!nul)
+		return NULL;
+	*p = nul + 1;
+	return s;
+}
+
+static int config_cache_uint32(const char **p, const char *end, uint32_t *v)
+{
+	if (end - *p < 4)
+		return -1;
+	*v = get_be32(*p);
+	*p += 4;
+	return 0;
+}
+
+struct config_cache_value {
+	const char *key, *value;
+	uint32_t file, linenr;
+};
+
+/*
+ * Add the values of the cache between "p" and "end" to the configset of
+ * "repo", but only if all of the cache is sound and up to date.
+ */
+static int parse_config_cache(struct repository *repo, const char *p,
+			      const char *end)
+{
+	struct config_set *cs = repo->config;
+	struct strbuf key = STRBUF_INIT;
+	const char **names = NULL;
+	struct config_cache_value *values = NULL;
+	const char *s;
+	uint32_t v, nr_files, nr, i, j;
+	int ret = -1;
+
+	if (config_cache_uint32(&p, end, &v) || v != CONFIG_CACHE_SIGNATURE ||
+	    config_cache_uint32(&p, end, &v) || v != CONFIG_CACHE_VERSION)
+		goto out;
+
+	config_cache_key(repo, &key);
+	s = config_cache_string(&p, end);
+	if (!s || strcmp(s, key.buf))
+		goto out;
+
+	/* The configuration file of the repository is always among them. */
+	if (config_cache_uint32(&p, end, &nr_files) || !nr_files ||
+	    nr_files > (size_t)(end - p))
+		goto out;
+	ALLOC_ARRAY(names, nr_files);
+	for (i = 0; i < nr_files; i++) {
+		uint32_t words[CONFIG_CACHE_STAT_WORDS];
+
+		s = config_cache_string(&p, end);
+		if (!s)
+			goto out;
+		config_cache_stat(s, words);
+		for (j = 0; j < CONFIG_CACHE_STAT_WORDS; j++)
+			if (config_cache_uint32(&p, end, &v) || v != words[j])
+				goto out;
+		names[i] = s;
+	}
+
+	if (config_cache_uint32(&p, end, &nr) || nr > (size_t)(end - p))
+		goto out;
+	ALLOC_ARRAY(values, nr);
+	for (i = 0; i < nr; i++) {
+		struct config_cache_value *value = &values[i];
+		unsigned char scope, origin_type, has_value;
+
+		if (end - p < 3)
+			goto out;
+		scope = *p++;
+		origin_type = *p++;
+		has_value = *p++;
+		value->value = NULL;
+		if (scope != CONFIG_SCOPE_REPO ||
+		    origin_type != CONFIG_ORIGIN_FILE ||
+		    config_cache_uint32(&p, end, &value->file) ||
+		    value->file >= nr_files ||
+		    config_cache_uint32(&p, end, &value->linenr) ||
+		    !(value->key = config_cache_string(&p, end)) ||
+		    (has_value && !(value->value = config_cache_string(&p, end))))
+			goto out;
+	}
+	if (p != end)
+		goto out;
+
+	ALLOC_GROW(cs->list.items, cs->list.nr + nr, cs->list.alloc);
+	for (i = 0; i < nr; i++) {
+		struct key_value_info *kv_info = xmalloc(sizeof(*kv_info));
+
+		kv_info->filename = strintern(names[values[i].file]);
+		kv_info->linenr = (int)values[i].linenr;
+		kv_info->origin_type = CONFIG_ORIGIN_FILE;
+		kv_info->scope = CONFIG_SCOPE_REPO;
+		configset_add(cs, values[i].key, values[i].value, kv_info);
+	}
+	ret = 0;
+out:
+	free(values);
+	free(names);
+	strbuf_release(&key);
+	return ret;
+}
+
+/*
+ * Add the repository configuration of "repo" to its configset from the
+ * cache.  Return 1 if that worked, or 0 if the files have to be read.
+ */
+static int read_config_cache(struct repository *repo)
+{
+	char *path = config_cache_path(repo);
+	const unsigned rawsz = the_hash_algo->rawsz;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	struct stat st;
+	size_t len;
+	void *map;
+	int fd, ret = 0;
+
+	fd = git_open(path);
+	free(path);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) || st.st_size <= rawsz) {
+		close(fd);
+		return 0;
+	}
+	len = xsize_t(st.st_size);
+	map = xmmap_gently(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, map, len - rawsz);
+	the_hash_algo->final_fn(hash, &ctx);
+	if (!hashcmp(hash, (unsigned char *)map + len - rawsz) &&
+	    !parse_config_cache(repo, map, (char *)map + len - rawsz)) {
+		ret = 1;
+		trace2_data_intmax("config", "cache_hit", 1);
+	}
+	munmap(map, len);
+	return ret;
+}
+
+/*
+ * Write the cache of the repository configuration that was read from
+ * "files", starting at time "start".
+ */
+static void write_config_cache(struct repository *repo,
+			       struct string_list *files, time_t start)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct configset_list *list = &repo->config->list;
+	struct string_list_item *item;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx ctx;
+	char *path;
+	int i, j, nr = 0;
+
+	/*
+	 * A file that was modified since we started reading, or in the
+	 * same second, may not be what we read, or may be modified again
+	 * without its mtime telling; leave it to a later process.
+	 */
+	for_each_string_list_item(item, files) {
+		uint32_t *words = xcalloc(CONFIG_CACHE_STAT_WORDS, sizeof(*words));
+
+		item->util = words;
+		config_cache_stat(item->string, words);
+		if (words[0] && words[3] >= (uint32_t)start)
+			return;
+	}
+
+	config_cache_add_uint32(&buf, CONFIG_CACHE_SIGNATURE);
+	config_cache_add_uint32(&buf, CONFIG_CACHE_VERSION);
+	config_cache_key(repo, &buf);
+	strbuf_addch(&buf, '\0');
+
+	config_cache_add_uint32(&buf, files->nr);
+	for_each_string_list_item(item, files) {
+		uint32_t *words = item->util;
+
+		strbuf_add(&buf, item->string, strlen(item->string) + 1);
+		for (j = 0; j < CONFIG_CACHE_STAT_WORDS; j++)
+			config_cache_add_uint32(&buf, words[j]);
+	}
+
+	for (i = 0; i < list->nr; i++) {
+		struct string_list_item *value =
+			&list->items[i].e->value_list.items[list->items[i].value_index];
+		struct key_value_info *kv_info = value->util;
+
+		if (kv_info->scope == CONFIG_SCOPE_REPO)
+			nr++;
+	}
+	config_cache_add_uint32(&buf, nr);
+	for (i = 0, j = 0; i < list->nr; i++) {
+		struct config_set_element *e = list->items[i].e;
+		struct string_list_item *value =
+			&e->value_list.items[list->items[i].value_index];
+		struct key_value_info *kv_info = value->util;
+
+		if (kv_info->scope != CONFIG_SCOPE_REPO)
+			continue;
+		if (!kv_info->filename ||
+		    kv_info->origin_type != CONFIG_ORIGIN_FILE)
+			goto out;
+		/* Values come file by file; start where the last one was. */
+		for (nr = 0; nr < files->nr; nr++, j = (j + 1) % files->nr)
+			if (!strcmp(files->items[j].string, kv_info->filename))
+				break;
+		if (nr == files->nr)
+			goto out;
+		strbuf_addch(&buf, kv_info->scope);
+		strbuf_addch(&buf, kv_info->origin_type);
+		strbuf_addch(&buf, !!value->string);
+		config_cache_add_uint32(&buf, j);
+		config_cache_add_uint32(&buf, kv_info->linenr);
+		strbuf_add(&buf, e->key, strlen(e->key) + 1);
+		if (value->string)
+			strbuf_add(&buf, value->string, strlen(value->string) + 1);
+	}
+
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, buf.buf, buf.len);
+	the_hash_algo->final_fn(hash, &ctx);
+	strbuf_add(&buf, hash, the_hash_algo->rawsz);
+
+	/* The cache is only an optimization; never complain about it. */
+	path = config_cache_path(repo);
+	if (hold_lock_file_for_update(&lk, path, 0) >= 0) {
+		if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0 ||
+		    commit_lock_file(&lk))
+			rollback_lock_file(&lk);
+	}
+	free(path);
+out:
+	strbuf_release(&buf);
+}
+
 /* Functions use to read configuration from a repository */
 static void repo_read_config(struct repository *repo)
 {
 	struct config_options opts;
+	struct config_include_data inc = CONFIG_INCLUDE_INIT;
+	struct string_list files = STRING_LIST_INIT_DUP;
+	int use_cache = 0;
+	time_t start = 0;
+	int ret = 0;
 
 	opts.respect_includes = 1;
 	opts.commondir = repo->commondir;
@@ -1999,9 +2437,41 @@ static void repo_read_config(struct repository *repo)
 
 	git_configset_init(repo->config);
 
-	if (config_with_options(config_set_callback, repo->config, NULL, &opts) < 0)
+	inc.fn = config_set_callback;
+	inc.data = repo->config;
+	inc.opts = &opts;
+	ret += do_git_config_sequence_global(git_config_include, &inc);
+
+	/* Only the system and user configuration may enable the cache. */
+	if (repo->gitdir && repo->commondir &&
+	    !git_configset_get_bool(repo->config, "core.configcache",
+				    &use_cache) &&
+	    !use_cache) {
+		char *path = config_cache_path(repo);
+
+		unlink(path);
+		free(path);
+	}
+
+	if (use_cache && read_config_cache(repo)) {
+		do_git_config_parameters(git_config_include, &inc);
+		return;
+	}
+
+	if (use_cache) {
+		config_cache_files = &files;
+		start = time(NULL);
+	}
+	ret += do_git_config_sequence_repo(&opts, git_config_include, &inc);
+	config_cache_files = NULL;
+	if (use_cache && git_env_bool(GIT_OPTIONAL_LOCKS_ENVIRONMENT, 1))
+		write_config_cache(repo, &files, start);
+	string_list_clear(&files, 1);
+
+	do_git_config_parameters(git_config_include, &inc);
+	if (ret < 0)
 		/*
-		 * config_with_options() normally returns only
+		 * Reading the configuration normally returns only
 		 * zero, as most errors are fatal, and
 		 * non-fatal potential errors are guarded by "if"
 		 * statements that are entered only when no error is
@@ -2242,6 +2712,27 @@ int git_config_get_split_index(void)
 	return -1; /* default value */
 }
 
+int git_config_get_index_threads(int *dest)
+{
+	int is_bool, val;
+
+	val = git_env_ulong("GIT_TEST_INDEX_THREADS", 0);
+	if (val) {
+		*dest = val;
+		return 0;
+	}
+
+	if (!git_config_get_bool_or_int("index.threads", &is_bool, &val)) {
+		if (is_bool)
+			*dest = val ? 0 : 1;
+		else
+			*dest = val;
+		return 0;
+	}
+
+	return 1;
+}
+
 int git_config_get_max_percent_split_change(void)
 {
 	int val = -1;
@@ -2257,6 +2748,16 @@ int git_config_get_max_percent_split_change(void)
 	return -1; /* default value */
 }
 
+int git_config_get_split_index_defer_rewrite(void)
+{
+	int val;
+
+	if (!git_config_get_bool("splitindex.deferrewrite", &val))
+		return val;
+
+	return -1; /* default value */
+}
+
 int git_config_get_fsmonitor(void)
 {
 	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
@@ -2265,6 +2766,19 @@ int git_config_get_fsmonitor(void)
 	if (core_fsmonitor && !*core_fsmonitor)
 		core_fsmonitor = NULL;
 
+	/* "true" asks for the built-in daemon, "false" for no monitor */
+	core_fsmonitor_use_daemon = 0;
+	if (core_fsmonitor) {
+		switch (git_parse_maybe_bool(core_fsmonitor)) {
+		case 0:
+			core_fsmonitor = NULL;
+			break;
+		case 1:
+			core_fsmonitor_use_daemon = 1;
+			break;
+		}
+	}
+
 	if (core_fsmonitor)
 		return 1;
 
@@ -229,6 +229,13 @@ extern int git_config_get_pathname(const char *key, const char **dest);
 extern int git_config_get_untracked_cache(void);
 extern int git_config_get_split_index(void);
 extern int git_config_get_max_percent_split_change(void);
+extern int git_config_get_split_index_defer_rewrite(void);
+
+/*
+ * Read index.threads into "dest": 0 lets git pick the number of threads,
+ * 1 disables threading. Returns 1 if it is not configured.
+ */
+extern int git_config_get_index_threads(int *dest);
 extern int git_config_get_fsmonitor(void);
 
 /* This dies if the configured or default date is in the future */
@@ -4,6 +4,187 @@
 #include "connected.h"
 #include "transport.h"
 #include "packfile.h"
+#include "object-store.h"
+#include "sha1-array.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "revision.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+
+/*
+ * Find the pack whose ".keep" file is "lockfile". Where index-pack
+ * wrote it to a quarantine directory, that is in an alternate object
+ * directory; go by its name.
+ */
+static struct packed_git *find_new_pack(const char *lockfile)
+{
+	struct strbuf idx_file = STRBUF_INIT;
+	struct packed_git *p;
+	const char *name;
+	size_t base_len, name_len;
+
+	if (!strip_suffix(lockfile, ".keep", &base_len))
+		return NULL;
+	strbuf_add(&idx_file, lockfile, base_len);
+	name = find_last_dir_sep(idx_file.buf);
+	name = name ? name + 1 : idx_file.buf;
+	name_len = idx_file.buf + idx_file.len - name;
+
+	for (p = get_packed_git(the_repository); p; p = p->next) {
+		const char *p_name = find_last_dir_sep(p->pack_name);
+		size_t len;
+
+		p_name = p_name ? p_name + 1 : p->pack_name;
+		if (strip_suffix(p_name, ".pack", &len) &&
+		    len == name_len && !strncmp(p_name, name, len))
+			break;
+	}
+	if (!p) {
+		strbuf_addstr(&idx_file, ".idx");
+		p = add_packed_git(idx_file.buf, idx_file.len, 1);
+	}
+	strbuf_release(&idx_file);
+	return p;
+}
+
+static int in_new_pack_or_bitmap(const struct object_id *oid,
+				 struct packed_git *new_pack,
+				 struct bitmap_index *bitmap_git)
+{
+	return find_pack_entry_one(oid->hash, new_pack) ||
+	       bitmap_walk_contains(bitmap_git, oid);
+}
+
+/*
+ * Whether all that the object "oid" of the new pack points to is
+ * either in the new pack, or reachable from our refs.
+ */
+static int links_are_known(const struct object_id *oid,
+			   struct packed_git *new_pack,
+			   struct bitmap_index *bitmap_git)
+{
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	struct object *obj;
+	int eaten, ret = 1;
+
+	type = oid_object_info(the_repository, oid, NULL);
+	if (type == OBJ_BLOB)
+		return 1;
+	buf = read_object_file(oid, &type, &size);
+	if (!buf)
+		return 0;
+	obj = parse_object_buffer(oid, type, size, buf, &eaten);
+	if (!obj) {
+		ret = 0;
+	} else if (obj->type == OBJ_COMMIT) {
+		struct commit *commit = (struct commit *)obj;
+		struct commit_list *parent;
+
+		if (!in_new_pack_or_bitmap(get_commit_tree_oid(commit),
+					   new_pack, bitmap_git))
+			ret = 0;
+		for (parent = commit->parents; ret && parent; parent = parent->next)
+			if (!in_new_pack_or_bitmap(&parent->item->object.oid,
+						   new_pack, bitmap_git))
+				ret = 0;
+		if (eaten)
+			free_commit_buffer(commit);
+	} else if (obj->type == OBJ_TREE) {
+		struct tree *tree = (struct tree *)obj;
+		struct tree_desc desc;
+		struct name_entry entry;
+
+		/* "tree" may have been parsed already, and let go of its buffer */
+		init_tree_desc(&desc, buf, size);
+		while (ret && tree_entry_gently(&desc, &entry))
+			if (!S_ISGITLINK(entry.mode) &&
+			    !in_new_pack_or_bitmap(entry.oid, new_pack, bitmap_git))
+				ret = 0;
+		if (desc.size)
+			ret = 0; /* a broken tree */
+		if (eaten)
+			free_tree_buffer(tree);
+	} else if (obj->type == OBJ_TAG) {
+		struct tag *tag = (struct tag *)obj;
+
+		if (!tag->tagged ||
+		    !in_new_pack_or_bitmap(&tag->tagged->oid, new_pack, bitmap_git))
+			ret = 0;
+	}
+	if (!eaten)
+		free(buf);
+	return ret;
+}
+
+/*
+ * Try to tell that "tips" are connected without walking any history:
+ * that is so if each of them, and each object that an object of the
+ * new pack points to, is in the new pack or reachable from our refs,
+ * according to the reachability bitmaps of the repository. This needs
+ * one look at each object of the new pack, where the rev-list below
+ * has to walk the new history, and the old one down to where it meets
+ * the refs; or none, when "links" already lists what the new pack
+ * points to.
+ *
+ * Returns 0 if the tips are connected, and -1 if it cannot tell.
+ */
+static int check_connected_with_bitmap(struct oid_array *tips,
+				       struct packed_git *new_pack,
+				       const struct oid_array *links)
+{
+	const char *argv[] = { "rev-list", "--objects", "--all", NULL };
+	struct rev_info revs;
+	struct bitmap_index *bitmap_git;
+	struct object_id oid;
+	uint32_t i;
+	int ret = 0;
+
+	if (open_pack_index(new_pack))
+		return -1;
+
+	init_revisions(&revs, NULL);
+	revs.ignore_missing = 1;
+	setup_revisions(ARRAY_SIZE(argv) - 1, argv, &revs, NULL);
+	bitmap_git = prepare_bitmap_walk(&revs, NULL);
+	reset_revision_walk();
+	if (!bitmap_git)
+		return -1;
+
+	for (i = 0; !ret && i < tips->nr; i++)
+		if (!in_new_pack_or_bitmap(&tips->oid[i], new_pack, bitmap_git))
+			ret = -1;
+	if (links) {
+		for (i = 0; !ret && i < links->nr; i++)
+			if (!in_new_pack_or_bitmap(&links->oid[i], new_pack,
+						   bitmap_git))
+				ret = -1;
+	} else {
+		for (i = 0; !ret && i < new_pack->num_objects; i++) {
+			nth_packed_object_oid(&oid, new_pack, i);
+			if (!links_are_known(&oid, new_pack, bitmap_git))
+				ret = -1;
+		}
+	}
+
+	free_bitmap_index(bitmap_git);
+	return ret;
+}
+
+static int iterate_oid_array(void *cb_data, struct object_id *oid)
+{
+	struct oid_array *tips = cb_data;
+
+	if (!tips->nr)
+		return -1;
+	/* hand them out from the end; the order makes no difference */
+	oidcpy(oid, &tips->oid[--tips->nr]);
+	return 0;
+}
 
 /*
  * If we feed all the commits we want to verify to this command
@@ -14,6 +195,10 @@
  * these commits locally exists and is connected to our existing refs.
  * Note that this does _not_ validate the individual objects.
  *
+ * When the objects came in a pack that we know of, and there are
+ * reachability bitmaps, check_connected_with_bitmap() can often tell
+ * without it.
+ *
  * Returns 0 if everything is connected, non-zero otherwise.
  */
 int check_connected(oid_iterate_fn fn, void *cb_data,
@@ -26,7 +211,9 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	int err = 0;
 	struct packed_git *new_pack = NULL;
 	struct transport *transport;
-	size_t base_len;
+	const char *pack_lockfile;
+	int self_contained;
+	struct oid_array tips = OID_ARRAY_INIT;
 
 	if (!opt)
 		opt = &defaults;
@@ -38,15 +225,34 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		return err;
 	}
 
-	if (transport && transport->smart_options &&
-	    transport->smart_options->self_contained_and_connected &&
-	    transport->pack_lockfile &&
-	    strip_suffix(transport->pack_lockfile, ".keep", &base_len)) {
-		struct strbuf idx_file = STRBUF_INIT;
-		strbuf_add(&idx_file, transport->pack_lockfile, base_len);
-		strbuf_addstr(&idx_file, ".idx");
-		new_pack = add_packed_git(idx_file.buf, idx_file.len, 1);
-		strbuf_release(&idx_file);
+	pack_lockfile = opt->pack_lockfile;
+	if (!pack_lockfile && transport)
+		pack_lockfile = transport->pack_lockfile;
+	if (pack_lockfile)
+		new_pack = find_new_pack(pack_lockfile);
+	self_contained = transport && transport->smart_options &&
+		transport->smart_options->self_contained_and_connected &&
+		transport->pack_lockfile;
+
+	if (new_pack && !self_contained && !opt->shallow_file &&
+	    !opt->is_deepening_fetch && !repository_format_partial_clone &&
+	    !is_repository_shallow(the_repository)) {
+		do {
+			oid_array_append(&tips, &oid);
+		} while (!fn(cb_data, &oid));
+
+		if (!check_connected_with_bitmap(&tips, new_pack,
+						 opt->pack_links)) {
+			oid_array_clear(&tips);
+			if (opt->err_fd)
+				close(opt->err_fd);
+			return 0;
+		}
+
+		/* let rev-list have them after all */
+		fn = iterate_oid_array;
+		cb_data = &tips;
+		fn(cb_data, &oid);
 	}
 
 	if (opt->shallow_file) {
@@ -76,8 +282,10 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	else
 		rev_list.no_stderr = opt->quiet;
 
-	if (start_command(&rev_list))
+	if (start_command(&rev_list)) {
+		oid_array_clear(&tips);
 		return error(_("Could not run 'git rev-list'"));
+	}
 
 	sigchain_push(SIGPIPE, SIG_IGN);
 
@@ -91,7 +299,8 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		 * are sure the ref is good and not sending it to
 		 * rev-list for verification.
 		 */
-		if (new_pack && find_pack_entry_one(oid.hash, new_pack))
+		if (self_contained && new_pack &&
+		    find_pack_entry_one(oid.hash, new_pack))
 			continue;
 
 		memcpy(commit, oid_to_hex(&oid), GIT_SHA1_HEXSZ);
@@ -107,5 +316,6 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		err = error_errno(_("failed to close rev-list's stdin"));
 
 	sigchain_pop(SIGPIPE);
+	oid_array_clear(&tips);
 	return finish_command(&rev_list) || err;
 }
@@ -2,6 +2,7 @@
 #define CONNECTED_H
 
 struct transport;
+struct oid_array;
 
 /*
  * Take callback data, and return next object name in the buffer.
@@ -24,6 +25,19 @@ struct check_connected_options {
 	/* Transport whose objects we are checking, if available. */
 	struct transport *transport;
 
+	/*
+	 * The ".keep" file of the pack the objects came in, if available;
+	 * otherwise that of the transport is used.
+	 */
+	const char *pack_lockfile;
+
+	/*
+	 * The objects that objects of that pack point to, without the
+	 * pack having them, if known (see "index-pack --report-links");
+	 * the pack then need not be read again.
+	 */
+	const struct oid_array *pack_links;
+
 	/*
 	 * If non-zero, send error messages to this descriptor rather
 	 * than stderr. The descriptor is closed before check_connected
@@ -10,6 +10,13 @@
 #include "sub-process.h"
 #include "utf8.h"
 
+#if !defined(NO_CONVERT_AVX2) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define CONVERT_AVX2
+#include <immintrin.h>
+#endif
+
 /*
  * convert.c - convert a file when checking it out and checking it in.
  *
@@ -24,17 +31,6 @@
 #define CONVERT_STAT_BITS_TXT_CRLF  0x2
 #define CONVERT_STAT_BITS_BIN       0x4
 
-enum crlf_action {
-	CRLF_UNDEFINED,
-	CRLF_BINARY,
-	CRLF_TEXT,
-	CRLF_TEXT_INPUT,
-	CRLF_TEXT_CRLF,
-	CRLF_AUTO,
-	CRLF_AUTO_INPUT,
-	CRLF_AUTO_CRLF
-};
-
 struct text_stat {
 	/* NUL, CR, LF and CRLF counts */
 	unsigned nul, lonecr, lonelf, crlf;
@@ -43,13 +39,84 @@ struct text_stat {
 	unsigned printable, nonprintable;
 };
 
-static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
+#ifdef CONVERT_AVX2
+
+static int gather_stats_avx2_available(void)
 {
+	static int available = -1;
+
+	if (available < 0)
+		available = git_env_bool("GIT_TEST_CONVERT_AVX2", 1) &&
+			    __builtin_cpu_supports("avx2");
+	return available;
+}
+
+/*
+ * Add up the stats of "buf" 32 bytes at a time, as gather_stats() would,
+ * and return how many bytes were counted.  Each kind of byte makes a
+ * bit mask of the block; a CR that ends a block looks at the byte after
+ * it, and an LF that starts one at the byte before it.
+ */
+__attribute__((target("avx2")))
+static unsigned long gather_stats_avx2(const char *buf, unsigned long size,
+				       struct text_stat *stats)
+{
+	const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+	const __m256i nul = _mm256_setzero_si256(), del = _mm256_set1_epi8(127);
+	const __m256i ctl_max = _mm256_set1_epi8(31);
+	const __m256i bs = _mm256_set1_epi8('\b'), ht = _mm256_set1_epi8('\t');
+	const __m256i esc = _mm256_set1_epi8('\033'), ff = _mm256_set1_epi8('\014');
+	uint32_t prev_cr = 0;
 	unsigned long i;
 
+	for (i = 0; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		uint32_t m_cr = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr));
+		uint32_t m_lf = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+		uint32_t m_nul = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nul));
+		uint32_t m_del = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, del));
+		uint32_t m_ctl = _mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl_max), v));
+		/* the control characters that count as printable */
+		uint32_t m_ok = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, bs),
+					_mm256_cmpeq_epi8(v, ht)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, esc),
+					_mm256_cmpeq_epi8(v, ff))));
+		uint32_t next_lf = i + 32 < size && buf[i + 32] == '\n';
+		uint32_t lf_after = (m_lf >> 1) | (next_lf << 31);
+		uint32_t cr_before = (m_cr << 1) | prev_cr;
+		uint32_t m_non = (m_ctl & ~(m_cr | m_lf | m_ok)) | m_del;
+
+		stats->crlf += __builtin_popcount(m_cr & lf_after);
+		stats->lonecr += __builtin_popcount(m_cr & ~lf_after);
+		stats->lonelf += __builtin_popcount(m_lf & ~cr_before);
+		stats->nul += __builtin_popcount(m_nul);
+		stats->nonprintable += __builtin_popcount(m_non);
+		stats->printable += 32 - __builtin_popcount(m_cr | m_lf | m_non);
+		prev_cr = m_cr >> 31;
+	}
+	return i;
+}
+
+#endif
+
+static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
+{
+	unsigned long i = 0;
+
 	memset(stats, 0, sizeof(*stats));
 
-	for (i = 0; i < size; i++) {
+#ifdef CONVERT_AVX2
+	if (gather_stats_avx2_available()) {
+		i = gather_stats_avx2(buf, size, stats);
+		/* an LF right after the blocks was counted with its CR */
+		if (i && i < size && buf[i - 1] == '\r' && buf[i] == '\n')
+			i++;
+	}
+#endif
+
+	for (; i < size; i++) {
 		unsigned char c = buf[i];
 		if (c == '\r') {
 			if (i+1 < size && buf[i+1] == '\n') {
@@ -502,6 +569,32 @@ static int encode_to_worktree(const char *path, const char *src, size_t src_len,
 	return 1;
 }
 
+/*
+ * Copy "len" bytes of "src" to "dst", which may be "src" itself, without
+ * the CR of each CRLF, or of any CR if "any_cr" is set, and return where
+ * the copy ends.  The runs between CRs are found with memchr() and moved
+ * whole.
+ */
+static char *strip_crlf(char *dst, const char *src, size_t len, int any_cr)
+{
+	while (len) {
+		const char *cr = memchr(src, '\r', len);
+		size_t run = cr ? cr - src : len;
+
+		memmove(dst, src, run);
+		dst += run;
+		src += run;
+		len -= run;
+		if (!len)
+			break;
+		if (!any_cr && !(1 < len && src[1] == '\n'))
+			*dst++ = *src;
+		src++;
+		len--;
+	}
+	return dst;
+}
+
 static int crlf_to_git(const struct index_state *istate,
 		       const char *path, const char *src, size_t len,
 		       struct strbuf *buf,
@@ -568,25 +661,14 @@ static int crlf_to_git(const struct index_state *istate,
 	/* only grow if not in place */
 	if (strbuf_avail(buf) + buf->len < len)
 		strbuf_grow(buf, len - buf->len);
-	dst = buf->buf;
-	if (crlf_action == CRLF_AUTO || crlf_action == CRLF_AUTO_INPUT || crlf_action == CRLF_AUTO_CRLF) {
-		/*
-		 * If we guessed, we already know we rejected a file with
-		 * lone CR, and we can strip a CR without looking at what
-		 * follow it.
-		 */
-		do {
-			unsigned char c = *src++;
-			if (c != '\r')
-				*dst++ = c;
-		} while (--len);
-	} else {
-		do {
-			unsigned char c = *src++;
-			if (! (c == '\r' && (1 < len && *src == '\n')))
-				*dst++ = c;
-		} while (--len);
-	}
+	/*
+	 * If we guessed, we already know we rejected a file with lone
+	 * CR, and we can strip a CR without looking at what follow it.
+	 */
+	dst = strip_crlf(buf->buf, src, len,
+			 crlf_action == CRLF_AUTO ||
+			 crlf_action == CRLF_AUTO_INPUT ||
+			 crlf_action == CRLF_AUTO_CRLF);
 	strbuf_setlen(buf, dst - buf->buf);
 	return 1;
 }
@@ -750,6 +832,7 @@ static int apply_single_file_filter(const char *path, const char *src, size_t le
 #define CAP_CLEAN    (1u<<0)
 #define CAP_SMUDGE   (1u<<1)
 #define CAP_DELAY    (1u<<2)
+#define CAP_BATCH    (1u<<3)
 
 struct cmd2process {
 	struct subprocess_entry subprocess; /* must be the first member! */
@@ -766,6 +849,7 @@ static int start_multi_file_filter_fn(struct subprocess_entry *subprocess)
 		{ "clean",  CAP_CLEAN  },
 		{ "smudge", CAP_SMUDGE },
 		{ "delay",  CAP_DELAY  },
+		{ "batch",  CAP_BATCH  },
 		{ NULL, 0 }
 	};
 	struct cmd2process *entry = (struct cmd2process *)subprocess;
@@ -803,7 +887,7 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 				   struct delayed_checkout *dco)
 {
 	int err;
-	int can_delay = 0;
+	int can_delay = 0, batch = 0;
 	struct cmd2process *entry;
 	struct child_process *process;
 	struct strbuf nbuf = STRBUF_INIT;
@@ -864,6 +948,12 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 		err = packet_write_fmt_gently(process->in, "can-delay=1\n");
 		if (err)
 			goto done;
+		if (entry->supported_capabilities & CAP_BATCH) {
+			batch = 1;
+			err = packet_write_fmt_gently(process->in, "batch=1\n");
+			if (err)
+				goto done;
+		}
 	}
 
 	err = packet_flush_gently(process->in);
@@ -877,6 +967,16 @@ static int apply_multi_file_filter(const char *path, const char *src, size_t len
 	if (err)
 		goto done;
 
+	if (batch) {
+		/*
+		 * The filter takes the blob as delayed without answering,
+		 * so that we can go on with the next one at once.
+		 */
+		string_list_insert(&dco->filters, cmd);
+		string_list_insert(&dco->paths, path);
+		goto done;
+	}
+
 	err = subprocess_read_status(process->out, &filter_status);
 	if (err)
 		goto done;
@@ -1283,15 +1383,7 @@ static int git_path_check_ident(struct attr_check_item *check)
 	return !!ATTR_TRUE(value);
 }
 
-struct conv_attrs {
-	struct convert_driver *drv;
-	enum crlf_action attr_action; /* What attr says */
-	enum crlf_action crlf_action; /* When no attr is set, use core.autocrlf */
-	int ident;
-	const char *working_tree_encoding; /* Supported encoding or default encoding if NULL */
-};
-
-static void convert_attrs(struct conv_attrs *ca, const char *path)
+void convert_attrs(struct conv_attrs *ca, const char *path)
 {
 	static struct attr_check *check;
 
@@ -1437,16 +1529,15 @@ void convert_to_git_filter_fd(const struct index_state *istate,
 	ident_to_git(path, dst->buf, dst->len, dst, ca.ident);
 }
 
-static int convert_to_working_tree_internal(const char *path, const char *src,
-					    size_t len, struct strbuf *dst,
-					    int normalizing, struct delayed_checkout *dco)
+static int convert_to_working_tree_ca_internal(const struct conv_attrs *ca,
+					       const char *path, const char *src,
+					       size_t len, struct strbuf *dst,
+					       int normalizing,
+					       struct delayed_checkout *dco)
 {
 	int ret = 0, ret_filter = 0;
-	struct conv_attrs ca;
-
-	convert_attrs(&ca, path);
 
-	ret |= ident_to_worktree(path, src, len, dst, ca.ident);
+	ret |= ident_to_worktree(path, src, len, dst, ca->ident);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
@@ -1456,28 +1547,39 @@ static int convert_to_working_tree_internal(const char *path, const char *src,
 	 * is a smudge or process filter (even if the process filter doesn't
 	 * support smudge).  The filters might expect CRLFs.
 	 */
-	if ((ca.drv && (ca.drv->smudge || ca.drv->process)) || !normalizing) {
-		ret |= crlf_to_worktree(path, src, len, dst, ca.crlf_action);
+	if ((ca->drv && (ca->drv->smudge || ca->drv->process)) || !normalizing) {
+		ret |= crlf_to_worktree(path, src, len, dst, ca->crlf_action);
 		if (ret) {
 			src = dst->buf;
 			len = dst->len;
 		}
 	}
 
-	ret |= encode_to_worktree(path, src, len, dst, ca.working_tree_encoding);
+	ret |= encode_to_worktree(path, src, len, dst, ca->working_tree_encoding);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
 	}
 
 	ret_filter = apply_filter(
-		path, src, len, -1, dst, ca.drv, CAP_SMUDGE, dco);
-	if (!ret_filter && ca.drv && ca.drv->required)
-		die("%s: smudge filter %s failed", path, ca.drv->name);
+		path, src, len, -1, dst, ca->drv, CAP_SMUDGE, dco);
+	if (!ret_filter && ca->drv && ca->drv->required)
+		die("%s: smudge filter %s failed", path, ca->drv->name);
 
 	return ret | ret_filter;
 }
 
+static int convert_to_working_tree_internal(const char *path, const char *src,
+					    size_t len, struct strbuf *dst,
+					    int normalizing, struct delayed_checkout *dco)
+{
+	struct conv_attrs ca;
+
+	convert_attrs(&ca, path);
+	return convert_to_working_tree_ca_internal(&ca, path, src, len, dst,
+						   normalizing, dco);
+}
+
 int async_convert_to_working_tree(const char *path, const char *src,
 				  size_t len, struct strbuf *dst,
 				  void *dco)
@@ -1490,6 +1592,12 @@ int convert_to_working_tree(const char *path, const char *src, size_t len, struc
 	return convert_to_working_tree_internal(path, src, len, dst, 0, NULL);
 }
 
+int convert_to_working_tree_ca(const struct conv_attrs *ca, const char *path,
+			       const char *src, size_t len, struct strbuf *dst)
+{
+	return convert_to_working_tree_ca_internal(ca, path, src, len, dst, 0, NULL);
+}
+
 int renormalize_buffer(const struct index_state *istate, const char *path,
 		       const char *src, size_t len, struct strbuf *dst)
 {
@@ -1927,25 +2035,24 @@ static struct stream_filter *ident_filter(const struct object_id *oid)
  * Note that you would be crazy to set CRLF, smuge/clean or ident to a
  * large binary blob you would want us not to slurp into the memory!
  */
-struct stream_filter *get_stream_filter(const char *path, const struct object_id *oid)
+struct stream_filter *get_stream_filter_ca(const struct conv_attrs *ca,
+					   const struct object_id *oid)
 {
-	struct conv_attrs ca;
 	struct stream_filter *filter = NULL;
 
-	convert_attrs(&ca, path);
-	if (ca.drv && (ca.drv->process || ca.drv->smudge || ca.drv->clean))
+	if (ca->drv && (ca->drv->process || ca->drv->smudge || ca->drv->clean))
 		return NULL;
 
-	if (ca.working_tree_encoding)
+	if (ca->working_tree_encoding)
 		return NULL;
 
-	if (ca.crlf_action == CRLF_AUTO || ca.crlf_action == CRLF_AUTO_CRLF)
+	if (ca->crlf_action == CRLF_AUTO || ca->crlf_action == CRLF_AUTO_CRLF)
 		return NULL;
 
-	if (ca.ident)
+	if (ca->ident)
 		filter = ident_filter(oid);
 
-	if (output_eol(ca.crlf_action) == EOL_CRLF)
+	if (output_eol(ca->crlf_action) == EOL_CRLF)
 		filter = cascade_filter(filter, lf_to_crlf_filter());
 	else
 		filter = cascade_filter(filter, &null_filter_singleton);
@@ -1953,6 +2060,14 @@ struct stream_filter *get_stream_filter(const char *path, const struct object_id
 	return filter;
 }
 
+struct stream_filter *get_stream_filter(const char *path, const struct object_id *oid)
+{
+	struct conv_attrs ca;
+
+	convert_attrs(&ca, path);
+	return get_stream_filter_ca(&ca, oid);
+}
+
 void free_stream_filter(struct stream_filter *filter)
 {
 	filter->vtbl->free(filter);
@@ -55,6 +55,27 @@ struct delayed_checkout {
 	struct string_list paths;
 };
 
+enum crlf_action {
+	CRLF_UNDEFINED,
+	CRLF_BINARY,
+	CRLF_TEXT,
+	CRLF_TEXT_INPUT,
+	CRLF_TEXT_CRLF,
+	CRLF_AUTO,
+	CRLF_AUTO_INPUT,
+	CRLF_AUTO_CRLF
+};
+
+struct convert_driver;
+
+struct conv_attrs {
+	struct convert_driver *drv;
+	enum crlf_action attr_action; /* What attr says */
+	enum crlf_action crlf_action; /* When no attr is set, use core.autocrlf */
+	int ident;
+	const char *working_tree_encoding; /* Supported encoding or default encoding if NULL */
+};
+
 extern enum eol core_eol;
 extern char *check_roundtrip_encoding;
 extern const char *get_cached_convert_stats_ascii(const struct index_state *istate,
@@ -68,6 +89,15 @@ extern int convert_to_git(const struct index_state *istate,
 			  struct strbuf *dst, int conv_flags);
 extern int convert_to_working_tree(const char *path, const char *src,
 				   size_t len, struct strbuf *dst);
+/*
+ * Like convert_to_working_tree(), but with the attributes of "path"
+ * already looked up by convert_attrs(). This lets the attributes be
+ * computed in one process and the conversion be done in another.
+ */
+extern void convert_attrs(struct conv_attrs *ca, const char *path);
+extern int convert_to_working_tree_ca(const struct conv_attrs *ca,
+				      const char *path, const char *src,
+				      size_t len, struct strbuf *dst);
 extern int async_convert_to_working_tree(const char *path, const char *src,
 					 size_t len, struct strbuf *dst,
 					 void *dco);
@@ -96,6 +126,8 @@ extern int would_convert_to_git_filter_fd(const char *path);
 struct stream_filter; /* opaque */
 
 extern struct stream_filter *get_stream_filter(const char *path, const struct object_id *);
+extern struct stream_filter *get_stream_filter_ca(const struct conv_attrs *ca,
+						  const struct object_id *);
 extern void free_stream_filter(struct stream_filter *);
 extern int is_null_stream_filter(struct stream_filter *);
 
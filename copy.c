@@ -1,4 +1,8 @@
 #include "cache.h"
+#ifdef HAVE_FICLONE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 int copy_fd(int ifd, int ofd)
 {
@@ -15,6 +19,20 @@ int copy_fd(int ifd, int ofd)
 	return 0;
 }
 
+/*
+ * Have "ofd" share the blocks of "ifd" on a filesystem that can, so that
+ * the copy is made at once and takes no room until either is written to.
+ * Returns -1 if the contents have to be copied after all.
+ */
+static int clone_fd(int ifd, int ofd)
+{
+#if defined(HAVE_FICLONE) && defined(FICLONE)
+	if (!ioctl(ofd, FICLONE, ifd))
+		return 0;
+#endif
+	return -1;
+}
+
 static int copy_times(const char *dst, const char *src)
 {
 	struct stat st;
@@ -39,7 +57,7 @@ int copy_file(const char *dst, const char *src, int mode)
 		close(fdi);
 		return fdo;
 	}
-	status = copy_fd(fdi, fdo);
+	status = clone_fd(fdi, fdo) ? copy_fd(fdi, fdo) : 0;
 	switch (status) {
 	case COPY_READ_ERROR:
 		error_errno("copy-fd: read returned");
@@ -90,39 +90,70 @@ static timestamp_t check_expirations(void)
 	return next - now;
 }
 
-static int read_request(FILE *fh, struct credential *c,
+/*
+ * A client whose request is still being read. Clients send the whole
+ * request and then shut down their side of the socket, so each is
+ * read as its data arrives and served once we see EOF; one that is
+ * slow to write does not hold up the others.
+ */
+struct cache_client {
+	int fd;
+	struct strbuf request;
+};
+static struct cache_client *clients;
+static int clients_nr;
+static int clients_alloc;
+
+/* Cut the next line off "*buf", which is NUL-terminated. */
+static char *next_line(char **buf)
+{
+	char *line = *buf;
+	char *eol = strchrnul(line, '\n');
+
+	*buf = *eol ? eol + 1 : eol;
+	*eol = '\0';
+	return line;
+}
+
+static int read_request(char *buf, struct credential *c,
 			struct strbuf *action, int *timeout) {
-	static struct strbuf item = STRBUF_INIT;
 	const char *p;
+	char *line;
 
-	strbuf_getline_lf(&item, fh);
-	if (!skip_prefix(item.buf, "action=", &p))
-		return error("client sent bogus action line: %s", item.buf);
+	line = next_line(&buf);
+	if (!skip_prefix(line, "action=", &p))
+		return error("client sent bogus action line: %s", line);
 	strbuf_addstr(action, p);
 
-	strbuf_getline_lf(&item, fh);
-	if (!skip_prefix(item.buf, "timeout=", &p))
-		return error("client sent bogus timeout line: %s", item.buf);
+	line = next_line(&buf);
+	if (!skip_prefix(line, "timeout=", &p))
+		return error("client sent bogus timeout line: %s", line);
 	*timeout = atoi(p);
 
-	if (credential_read(c, fh) < 0)
-		return -1;
+	while (*buf) {
+		line = next_line(&buf);
+		if (!*line)
+			break;
+		if (credential_read_line(c, line) < 0)
+			return -1;
+	}
 	return 0;
 }
 
-static void serve_one_client(FILE *in, FILE *out)
+static void serve_one_client(char *request, int out)
 {
 	struct credential c = CREDENTIAL_INIT;
 	struct strbuf action = STRBUF_INIT;
+	struct strbuf response = STRBUF_INIT;
 	int timeout = -1;
 
-	if (read_request(in, &c, &action, &timeout) < 0)
+	if (read_request(request, &c, &action, &timeout) < 0)
 		/* ignore error */ ;
 	else if (!strcmp(action.buf, "get")) {
 		struct credential_cache_entry *e = lookup_credential(&c);
 		if (e) {
-			fprintf(out, "username=%s\n", e->item.username);
-			fprintf(out, "password=%s\n", e->item.password);
+			strbuf_addf(&response, "username=%s\n", e->item.username);
+			strbuf_addf(&response, "password=%s\n", e->item.password);
 		}
 	}
 	else if (!strcmp(action.buf, "exit")) {
@@ -151,49 +182,100 @@ static void serve_one_client(FILE *in, FILE *out)
 	else
 		warning("cache client sent unknown action: %s", action.buf);
 
+	if (response.len && write_in_full(out, response.buf, response.len) < 0)
+		warning_errno("unable to write to cache client");
+
 	credential_clear(&c);
 	strbuf_release(&action);
+	strbuf_release(&response);
+}
+
+static void accept_client(int fd)
+{
+	struct cache_client *client;
+	int client_fd;
+
+	client_fd = accept(fd, NULL, NULL);
+	if (client_fd < 0) {
+		warning_errno("accept failed");
+		return;
+	}
+
+	ALLOC_GROW(clients, clients_nr + 1, clients_alloc);
+	client = &clients[clients_nr++];
+	client->fd = client_fd;
+	strbuf_init(&client->request, 0);
+}
+
+/*
+ * Read what the client has sent; return 1 once it has all been read
+ * (or the client is gone) and it should be dropped.
+ */
+static int read_client(struct cache_client *client)
+{
+	ssize_t r;
+
+	strbuf_grow(&client->request, 1024);
+	r = xread(client->fd, client->request.buf + client->request.len,
+		  strbuf_avail(&client->request));
+	if (r > 0) {
+		strbuf_setlen(&client->request, client->request.len + r);
+		return 0;
+	}
+	if (r < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		warning_errno("read from cache client failed");
+		return 1;
+	}
+
+	serve_one_client(client->request.buf, client->fd);
+	return 1;
 }
 
 static int serve_cache_loop(int fd)
 {
-	struct pollfd pfd;
+	struct pollfd *pfd;
 	timestamp_t wakeup;
+	int i, nr;
 
 	wakeup = check_expirations();
-	if (!wakeup)
-		return 0;
+	if (!wakeup) {
+		if (!clients_nr)
+			return 0;
+		/* let the clients we have finish */
+		wakeup = 1;
+	}
+
+	ALLOC_ARRAY(pfd, clients_nr + 1);
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	for (i = 0; i < clients_nr; i++) {
+		pfd[i + 1].fd = clients[i].fd;
+		pfd[i + 1].events = POLLIN;
+	}
+	nr = clients_nr;
 
-	pfd.fd = fd;
-	pfd.events = POLLIN;
-	if (poll(&pfd, 1, 1000 * wakeup) < 0) {
+	if (poll(pfd, nr + 1, 1000 * wakeup) < 0) {
 		if (errno != EINTR)
 			die_errno("poll failed");
+		free(pfd);
 		return 1;
 	}
 
-	if (pfd.revents & POLLIN) {
-		int client, client2;
-		FILE *in, *out;
+	/* drop the clients that are done, from the end back */
+	for (i = nr - 1; i >= 0; i--) {
+		if (!pfd[i + 1].revents || !read_client(&clients[i]))
+			continue;
+		close(clients[i].fd);
+		strbuf_release(&clients[i].request);
+		clients[i] = clients[--clients_nr];
+	}
 
-		client = accept(fd, NULL, NULL);
-		if (client < 0) {
-			warning_errno("accept failed");
-			return 1;
-		}
-		client2 = dup(client);
-		if (client2 < 0) {
-			warning_errno("dup failed");
-			close(client);
-			return 1;
-		}
+	if (pfd[0].revents & POLLIN)
+		accept_client(fd);
 
-		in = xfdopen(client, "r");
-		out = xfdopen(client2, "w");
-		serve_one_client(in, out);
-		fclose(in);
-		fclose(out);
-	}
+	free(pfd);
 	return 1;
 }
 
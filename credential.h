@@ -27,6 +27,12 @@ void credential_approve(struct credential *);
 void credential_reject(struct credential *);
 
 int credential_read(struct credential *, FILE *);
+/*
+ * Parse a single "key=value" line of the helper protocol into the
+ * credential, as credential_read() does for each line it reads; the
+ * line is modified. Return -1 if it has no "=".
+ */
+int credential_read_line(struct credential *, char *line);
 void credential_write(const struct credential *, FILE *);
 void credential_from_url(struct credential *, const char *url);
 int credential_match(const struct credential *have,
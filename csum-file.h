@@ -40,6 +40,12 @@ extern void hashflush(struct hashfile *f);
 extern void crc32_begin(struct hashfile *);
 extern uint32_t crc32_end(struct hashfile *);
 
+/* The number of bytes written to "f" so far, flushed or not. */
+static inline off_t hashfile_total(struct hashfile *f)
+{
+	return f->total + f->offset;
+}
+
 static inline void hashwrite_u8(struct hashfile *f, uint8_t data)
 {
 	hashwrite(f, &data, sizeof(data));
@@ -2,8 +2,10 @@
 #include "config.h"
 #include "pkt-line.h"
 #include "run-command.h"
+#include "sigchain.h"
 #include "strbuf.h"
 #include "string-list.h"
+#include "unix-socket.h"
 
 #ifdef NO_INITGROUPS
 #define initgroups(x, y) (0) /* nothing */
@@ -22,6 +24,7 @@ static int informative_errors;
 static const char daemon_usage[] =
 "git daemon [--verbose] [--syslog] [--export-all]\n"
 "           [--timeout=<n>] [--init-timeout=<n>] [--max-connections=<n>]\n"
+"           [--prefork=<n>]\n"
 "           [--strict-paths] [--base-path=<path>] [--base-path-relaxed]\n"
 "           [--user-path | --user-path=<path>]\n"
 "           [--interpolated-path=<path>]\n"
@@ -871,12 +874,38 @@ static void kill_some_child(void)
 		}
 }
 
+/*
+ * With --prefork, this many serving processes are started ahead of
+ * time and wait for the daemon to pass them a connection, so that
+ * starting one is not in the way of a client.
+ */
+static int prefork;
+
+static struct argv_array worker_argv = ARGV_ARRAY_INIT;
+
+static struct idle_worker {
+	struct child_process cld;
+	int channel;
+} *idle_workers;
+static int idle_nr, idle_alloc;
+
 static void check_dead_children(void)
 {
 	int status;
 	pid_t pid;
+	int i;
 
 	struct child **cradle, *blanket;
+
+	/* Idle workers should not die, but do not leave zombies if they do. */
+	for (i = 0; i < idle_nr;)
+		if (waitpid(idle_workers[i].cld.pid, &status, WNOHANG) > 0) {
+			close(idle_workers[i].channel);
+			child_process_clear(&idle_workers[i].cld);
+			idle_workers[i] = idle_workers[--idle_nr];
+		} else
+			i++;
+
 	for (cradle = &firstborn; (blanket = *cradle);)
 		if ((pid = waitpid(blanket->cld.pid, &status, WNOHANG)) > 1) {
 			const char *dead = "";
@@ -893,6 +922,122 @@ static void check_dead_children(void)
 			cradle = &blanket->next;
 }
 
+#ifndef NO_UNIX_SOCKETS
+
+static void spawn_workers(void)
+{
+	while (idle_nr < prefork) {
+		struct idle_worker *w;
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+			logerror("unable to create socket pair: %s",
+				 strerror(errno));
+			return;
+		}
+		/* Only the worker at the other end may hold it open. */
+		fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+		ALLOC_GROW(idle_workers, idle_nr + 1, idle_alloc);
+		w = &idle_workers[idle_nr];
+		child_process_init(&w->cld);
+		w->cld.argv = worker_argv.argv;
+		w->cld.in = sv[1];
+		if (start_command(&w->cld)) {
+			logerror("unable to fork");
+			close(sv[0]);
+			return;
+		}
+		w->channel = sv[0];
+		idle_nr++;
+	}
+}
+
+/*
+ * Pass the connection "incoming", and the environment that "cld" would
+ * have been started with, to an idle worker.  Return 1 if one took it.
+ */
+static int hand_to_worker(struct child_process *cld, int incoming,
+			  struct sockaddr *addr, socklen_t addrlen)
+{
+	int handed = 0;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	while (!handed && idle_nr) {
+		struct idle_worker *w = &idle_workers[--idle_nr];
+		int i, ret;
+
+		ret = unix_stream_send_fds(w->channel, &incoming, 1);
+		for (i = 0; !ret && i < cld->env_array.argc; i++)
+			ret = packet_write_fmt_gently(w->channel, "%s",
+						      cld->env_array.argv[i]);
+		if (!ret)
+			ret = packet_flush_gently(w->channel);
+		close(w->channel);
+
+		if (ret) {
+			kill(w->cld.pid, SIGTERM);
+			waitpid(w->cld.pid, NULL, 0);
+			child_process_clear(&w->cld);
+			continue;
+		}
+		add_child(&w->cld, addr, addrlen);
+		handed = 1;
+	}
+	sigchain_pop(SIGPIPE);
+
+	if (handed) {
+		close(incoming);
+		child_process_clear(cld);
+	}
+	spawn_workers();
+	return handed;
+}
+
+/*
+ * Wait in a worker for the daemon to pass us a connection.  Return -1
+ * if the daemon went away instead.
+ */
+static int receive_connection(void)
+{
+	char *line;
+	int fd;
+
+	if (unix_stream_recv_fds(0, &fd, 1))
+		return -1;
+	while ((line = packet_read_line(0, NULL))) {
+		char *eq = strchr(line, '=');
+
+		if (eq) {
+			*eq = '\0';
+			setenv(line, eq + 1, 1);
+		}
+	}
+	if (dup2(fd, 0) < 0 || dup2(fd, 1) < 0)
+		die_errno("unable to take over the connection");
+	close(fd);
+	return 0;
+}
+
+#else
+
+static void spawn_workers(void)
+{
+}
+
+static int hand_to_worker(struct child_process *cld, int incoming,
+			  struct sockaddr *addr, socklen_t addrlen)
+{
+	return 0;
+}
+
+static int receive_connection(void)
+{
+	return -1;
+}
+
+#endif
+
 static struct argv_array cld_argv = ARGV_ARRAY_INIT;
 static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 {
@@ -927,6 +1072,9 @@ static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 #endif
 	}
 
+	if (hand_to_worker(&cld, incoming, addr, addrlen))
+		return;
+
 	cld.argv = cld_argv.argv;
 	cld.in = incoming;
 	cld.out = dup(incoming);
@@ -1157,6 +1305,8 @@ static int service_loop(struct socketlist *socklist)
 
 	signal(SIGCHLD, child_handler);
 
+	spawn_workers();
+
 	for (;;) {
 		int i;
 
@@ -1271,7 +1421,7 @@ int cmd_main(int argc, const char **argv)
 {
 	int listen_port = 0;
 	struct string_list listen_addr = STRING_LIST_INIT_NODUP;
-	int serve_mode = 0, inetd_mode = 0;
+	int serve_mode = 0, inetd_mode = 0, worker_mode = 0;
 	const char *pid_file = NULL, *user_name = NULL, *group_name = NULL;
 	int detach = 0;
 	struct credentials *cred = NULL;
@@ -1298,6 +1448,10 @@ int cmd_main(int argc, const char **argv)
 			serve_mode = 1;
 			continue;
 		}
+		if (!strcmp(arg, "--serve-worker")) {
+			serve_mode = worker_mode = 1;
+			continue;
+		}
 		if (!strcmp(arg, "--inetd")) {
 			inetd_mode = 1;
 			continue;
@@ -1345,6 +1499,12 @@ int cmd_main(int argc, const char **argv)
 				max_connections = 0;	        /* unlimited */
 			continue;
 		}
+		if (skip_prefix(arg, "--prefork=", &v)) {
+			prefork = atoi(v);
+			if (prefork < 0)
+				prefork = 0;
+			continue;
+		}
 		if (!strcmp(arg, "--strict-paths")) {
 			strict_paths = 1;
 			continue;
@@ -1441,6 +1601,13 @@ int cmd_main(int argc, const char **argv)
 	if (inetd_mode && (detach || group_name || user_name))
 		die("--detach, --user and --group are incompatible with --inetd");
 
+	if (inetd_mode && prefork)
+		die("--prefork is incompatible with --inetd");
+#ifdef NO_UNIX_SOCKETS
+	if (prefork)
+		die("--prefork not supported on this platform");
+#endif
+
 	if (inetd_mode && (listen_port || (listen_addr.nr > 0)))
 		die("--listen= and --port= are incompatible with --inetd");
 	else if (listen_port == 0)
@@ -1464,6 +1631,8 @@ int cmd_main(int argc, const char **argv)
 			die_errno("failed to redirect stderr to /dev/null");
 	}
 
+	if (worker_mode && receive_connection())
+		return 0;
 	if (inetd_mode || serve_mode)
 		return execute();
 
@@ -1481,5 +1650,10 @@ int cmd_main(int argc, const char **argv)
 	for (i = 1; i < argc; ++i)
 		argv_array_push(&cld_argv, argv[i]);
 
+	argv_array_push(&worker_argv, argv[0]);
+	argv_array_push(&worker_argv, "--serve-worker");
+	for (i = 1; i < argc; ++i)
+		argv_array_push(&worker_argv, argv[i]);
+
 	return serve(&listen_addr, listen_port, cred);
 }
@@ -0,0 +1,408 @@
+#include "cache.h"
+#include "config.h"
+#include "object.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "progress.h"
+#include "refs.h"
+#include "khash.h"
+#include "sha1-array.h"
+#include "string-list.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "delta-islands.h"
+
+static kh_sha1_t *island_marks;
+static unsigned island_counter;
+
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+static uint32_t island_bitmap_size;
+
+/*
+ * Allocate a new bitmap; if "old" is not NULL, the new bitmap will be a copy
+ * of "old". Otherwise, the new bitmap is empty.
+ */
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) + (island_bitmap_size * 4);
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b, old, size);
+
+	b->refcount = 1;
+	return b;
+}
+
+static void island_bitmap_or(struct island_bitmap *a, const struct island_bitmap *b)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; ++i)
+		a->bits[i] |= b->bits[i];
+}
+
+static int island_bitmap_is_subset(struct island_bitmap *self,
+				   struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+
+	for (i = 0; i < island_bitmap_size; ++i) {
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+#define ISLAND_BITMAP_BLOCK(x) (x / 32)
+#define ISLAND_BITMAP_MASK(x) (1 << (x % 32))
+
+static void island_bitmap_set(struct island_bitmap *self, uint32_t i)
+{
+	self->bits[ISLAND_BITMAP_BLOCK(i)] |= ISLAND_BITMAP_MASK(i);
+}
+
+static struct island_bitmap *get_island_marks(const struct object_id *oid)
+{
+	khiter_t pos = kh_get_sha1(island_marks, oid->hash);
+
+	if (pos >= kh_end(island_marks))
+		return NULL;
+	return kh_value(island_marks, pos);
+}
+
+int in_same_island(const struct object_id *trg_oid, const struct object_id *src_oid)
+{
+	struct island_bitmap *trg_marks, *src_marks;
+
+	if (!island_marks)
+		return 1;
+
+	/*
+	 * If we don't have a bitmap for the target, we can delta it
+	 * against anything -- it's not an important object
+	 */
+	trg_marks = get_island_marks(trg_oid);
+	if (!trg_marks)
+		return 1;
+
+	/*
+	 * if the source (our delta base) doesn't have a bitmap,
+	 * we don't want to base any deltas on it!
+	 */
+	src_marks = get_island_marks(src_oid);
+	if (!src_marks)
+		return 0;
+
+	return island_bitmap_is_subset(trg_marks, src_marks);
+}
+
+int island_delta_cmp(const struct object_id *a, const struct object_id *b)
+{
+	struct island_bitmap *a_marks, *b_marks;
+
+	if (!island_marks)
+		return 0;
+
+	a_marks = get_island_marks(a);
+	b_marks = get_island_marks(b);
+
+	/*
+	 * Objects reachable from more islands sort first, so that they
+	 * are in the window when the objects they can be a base for are
+	 * looked at.
+	 */
+	if (a_marks) {
+		if (!b_marks || !island_bitmap_is_subset(a_marks, b_marks))
+			return -1;
+	}
+	if (b_marks) {
+		if (!a_marks || !island_bitmap_is_subset(b_marks, a_marks))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Give "obj" all the islands in "marks". Objects share their bitmap
+ * with whatever they got their marks from until they need one of their
+ * own.
+ */
+static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b;
+	khiter_t pos;
+	int hash_ret;
+
+	pos = kh_put_sha1(island_marks, obj->oid.hash, &hash_ret);
+	if (hash_ret) {
+		/*
+		 * We don't have one yet; share the one from our parent.
+		 */
+		kh_value(island_marks, pos) = marks;
+		marks->refcount++;
+		return;
+	}
+
+	/*
+	 * We do have it. Make sure we split any copy-on-write before
+	 * updating.
+	 */
+	b = kh_value(island_marks, pos);
+	if (island_bitmap_is_subset(marks, b))
+		return;
+
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = kh_value(island_marks, pos) = island_bitmap_new(b);
+	}
+	island_bitmap_or(b, marks);
+}
+
+static void mark_remote_island_1(struct object *obj, struct island_bitmap *marks)
+{
+	set_island_marks(obj, marks);
+
+	while (obj && obj->type == OBJ_TAG) {
+		obj = ((struct tag *)obj)->tagged;
+		if (!obj)
+			break;
+		parse_object(&obj->oid);
+		set_island_marks(obj, marks);
+	}
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *root_marks;
+	struct commit_list *p;
+
+	if (!island_marks)
+		return;
+
+	root_marks = get_island_marks(&commit->object.oid);
+	if (!root_marks)
+		return;
+
+	parse_commit(commit);
+	set_island_marks(&get_commit_tree(commit)->object, root_marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, root_marks);
+}
+
+struct tree_islands_todo {
+	struct object_entry *entry;
+	unsigned int depth;
+};
+
+static int tree_depth_compare(const void *a, const void *b)
+{
+	const struct tree_islands_todo *todo_a = a;
+	const struct tree_islands_todo *todo_b = b;
+
+	return todo_a->depth - todo_b->depth;
+}
+
+void resolve_tree_islands(int progress, struct packing_data *to_pack)
+{
+	struct progress *progress_state = NULL;
+	struct tree_islands_todo *todo;
+	int nr = 0;
+	int i;
+
+	if (!island_marks)
+		return;
+
+	/*
+	 * We process only trees, as commits and tags have already been handled
+	 * (and passed their marks on to root trees as well). We must make
+	 * sure to process them shallowest first so that marks propagate
+	 * down the tree properly, even if a sub-tree is found in multiple
+	 * parent trees.
+	 */
+	ALLOC_ARRAY(todo, to_pack->nr_objects);
+	for (i = 0; i < to_pack->nr_objects; i++) {
+		if (oe_type(&to_pack->objects[i]) == OBJ_TREE) {
+			todo[nr].entry = &to_pack->objects[i];
+			todo[nr].depth = oe_tree_depth(to_pack, &to_pack->objects[i]);
+			nr++;
+		}
+	}
+	QSORT(todo, nr, tree_depth_compare);
+
+	if (progress)
+		progress_state = start_progress(_("Propagating island marks"), nr);
+
+	for (i = 0; i < nr; i++) {
+		struct object_entry *ent = todo[i].entry;
+		struct island_bitmap *root_marks;
+		struct tree *tree;
+		struct tree_desc desc;
+		struct name_entry entry;
+
+		root_marks = get_island_marks(&ent->idx.oid);
+		if (!root_marks)
+			continue;
+
+		tree = lookup_tree(&ent->idx.oid);
+		if (!tree || parse_tree(tree) < 0)
+			die(_("bad tree object %s"), oid_to_hex(&ent->idx.oid));
+
+		init_tree_desc(&desc, tree->buffer, tree->size);
+		while (tree_entry(&desc, &entry)) {
+			struct object *obj;
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+
+			obj = lookup_object(entry.oid->hash);
+			if (!obj)
+				continue;
+
+			set_island_marks(obj, root_marks);
+		}
+
+		free_tree_buffer(tree);
+
+		display_progress(progress_state, i+1);
+	}
+
+	stop_progress(&progress_state);
+	free(todo);
+}
+
+static regex_t *island_regexes;
+static unsigned int island_regexes_alloc, island_regexes_nr;
+
+int island_config_callback(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.island")) {
+		struct strbuf re = STRBUF_INIT;
+
+		if (!v)
+			return config_error_nonbool(k);
+
+		ALLOC_GROW(island_regexes, island_regexes_nr + 1, island_regexes_alloc);
+
+		if (*v != '^')
+			strbuf_addch(&re, '^');
+		strbuf_addstr(&re, v);
+
+		if (regcomp(&island_regexes[island_regexes_nr], re.buf, REG_EXTENDED))
+			die(_("failed to load island regex for '%s': %s"), k, re.buf);
+
+		strbuf_release(&re);
+		island_regexes_nr++;
+	}
+
+	return 0;
+}
+
+static struct string_list island_refs = STRING_LIST_INIT_DUP;
+
+static void add_ref_to_island(const char *island_name, const struct object_id *oid)
+{
+	struct string_list_item *item;
+
+	item = string_list_insert(&island_refs, island_name);
+	if (!item->util)
+		item->util = xcalloc(1, sizeof(struct oid_array));
+	oid_array_append(item->util, oid);
+}
+
+static int find_island_for_ref(const char *refname, const struct object_id *oid,
+			       int flags, void *data)
+{
+	/*
+	 * We should advertise 'ARRAY_SIZE(matches) - 2' as the max,
+	 * so we can diagnose below a config with more capture groups
+	 * than we support.
+	 */
+	regmatch_t matches[16];
+	int i, m;
+	struct strbuf island_name = STRBUF_INIT;
+
+	/* walk backwards to get last-one-wins ordering */
+	for (i = island_regexes_nr - 1; i >= 0; i--) {
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	}
+
+	if (i < 0)
+		return 0;
+
+	if (matches[ARRAY_SIZE(matches) - 1].rm_so != -1)
+		warning(_("island regex from config has "
+			  "too many capture groups (max=%d)"),
+			(int)ARRAY_SIZE(matches) - 2);
+
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+
+		if (island_name.len)
+			strbuf_addch(&island_name, '-');
+
+		strbuf_add(&island_name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	add_ref_to_island(island_name.buf, oid);
+	strbuf_release(&island_name);
+	return 0;
+}
+
+static void mark_island(struct oid_array *tips, struct island_bitmap *marks)
+{
+	int i;
+
+	for (i = 0; i < tips->nr; i++) {
+		struct object *obj = parse_object(&tips->oid[i]);
+
+		if (obj)
+			mark_remote_island_1(obj, marks);
+	}
+}
+
+void load_delta_islands(int progress)
+{
+	struct string_list_item *item;
+
+	island_marks = kh_init_sha1();
+
+	for_each_ref(find_island_for_ref, NULL);
+
+	island_bitmap_size = (island_refs.nr / 32) + 1;
+	for_each_string_list_item(item, &island_refs) {
+		struct island_bitmap *marks = island_bitmap_new(NULL);
+
+		island_bitmap_set(marks, island_counter++);
+		mark_island(item->util, marks);
+
+		/* set_island_marks() took its own references */
+		if (!--marks->refcount)
+			free(marks);
+
+		oid_array_clear(item->util);
+		free(item->util);
+		item->util = NULL;
+	}
+	string_list_clear(&island_refs, 0);
+
+	if (progress)
+		fprintf(stderr, _("Marked %d islands, done.\n"), island_counter);
+}
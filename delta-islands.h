@@ -0,0 +1,23 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+struct object_id;
+struct packing_data;
+struct commit;
+
+/*
+ * Delta islands partition the objects of a repository by the refs they
+ * are reachable from, as configured with "pack.island". While islands
+ * are in use, an object is only stored as a delta against a base that
+ * is reachable from every island the object itself is reachable from.
+ */
+
+extern int island_config_callback(const char *var, const char *value, void *cb);
+extern void load_delta_islands(int progress);
+extern void propagate_island_marks(struct commit *commit);
+extern void resolve_tree_islands(int progress, struct packing_data *to_pack);
+
+extern int in_same_island(const struct object_id *trg, const struct object_id *src);
+extern int island_delta_cmp(const struct object_id *a, const struct object_id *b);
+
+#endif /* DELTA_ISLANDS_H */
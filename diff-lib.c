@@ -2,6 +2,7 @@
  * Copyright (C) 2005 Junio C Hamano
  */
 #include "cache.h"
+#include "config.h"
 #include "quote.h"
 #include "commit.h"
 #include "diff.h"
@@ -13,6 +14,9 @@
 #include "submodule.h"
 #include "dir.h"
 #include "fsmonitor.h"
+#include "trace2.h"
+#include "string-list.h"
+#include "thread-utils.h"
 
 /*
  * diff-files
@@ -57,35 +61,111 @@ static int check_removed(const struct cache_entry *ce, struct stat *st)
 	return 0;
 }
 
+/*
+ * Whether match_stat_with_submodule() looks into the work tree of the
+ * submodule "ce", and whether it ignores the untracked files there;
+ * "changed" is cleared if the submodule is to be ignored altogether.
+ */
+static int want_submodule_status(struct diff_options *diffopt,
+				 const struct cache_entry *ce, int *changed,
+				 int *ignore_untracked)
+{
+	struct diff_flags orig_flags = diffopt->flags;
+	int want = 0;
+
+	if (!diffopt->flags.override_submodule_config)
+		set_diffopt_flags_from_submodule_config(diffopt, ce->name);
+	if (diffopt->flags.ignore_submodules)
+		*changed = 0;
+	else if (!diffopt->flags.ignore_dirty_submodules &&
+		 (!*changed || diffopt->flags.dirty_submodules))
+		want = 1;
+	*ignore_untracked = diffopt->flags.ignore_untracked_in_submodules;
+	diffopt->flags = orig_flags;
+	return want;
+}
+
 /*
  * Has a file changed or has a submodule new commits or a dirty work tree?
  *
  * Return 1 when changes are detected, 0 otherwise. If the DIRTY_SUBMODULES
  * option is set, the caller does not only want to know if a submodule is
  * modified at all but wants to know all the conditions that are met (new
- * commits, untracked content and/or modified content).
+ * commits, untracked content and/or modified content). The status of the
+ * submodules in "submodules", if any, has been found out already.
  */
 static int match_stat_with_submodule(struct diff_options *diffopt,
 				     const struct cache_entry *ce,
 				     struct stat *st, unsigned ce_option,
-				     unsigned *dirty_submodule)
+				     unsigned *dirty_submodule,
+				     struct string_list *submodules)
 {
 	int changed = ce_match_stat(ce, st, ce_option);
-	if (S_ISGITLINK(ce->ce_mode)) {
-		struct diff_flags orig_flags = diffopt->flags;
-		if (!diffopt->flags.override_submodule_config)
-			set_diffopt_flags_from_submodule_config(diffopt, ce->name);
-		if (diffopt->flags.ignore_submodules)
-			changed = 0;
-		else if (!diffopt->flags.ignore_dirty_submodules &&
-			 (!changed || diffopt->flags.dirty_submodules))
+	int ignore_untracked;
+
+	if (S_ISGITLINK(ce->ce_mode) &&
+	    want_submodule_status(diffopt, ce, &changed, &ignore_untracked)) {
+		struct string_list_item *item = NULL;
+
+		if (submodules)
+			item = string_list_lookup(submodules, ce->name);
+		if (item) {
+			struct submodule_status *status = item->util;
+			*dirty_submodule = status->dirty_submodule;
+		} else
 			*dirty_submodule = is_submodule_modified(ce->name,
-								 diffopt->flags.ignore_untracked_in_submodules);
-		diffopt->flags = orig_flags;
+								 ignore_untracked);
 	}
 	return changed;
 }
 
+/*
+ * With submodule.diffJobs, list the submodules whose work tree
+ * run_diff_files() is going to look into in "submodules", and find
+ * out their status in parallel ahead of time.
+ */
+static void get_submodules_status_ahead(struct rev_info *revs,
+					unsigned ce_option,
+					struct string_list *submodules)
+{
+	int i, max_jobs = 1;
+
+	if (!repo_config_get_int(the_repository, "submodule.diffjobs",
+				 &max_jobs) && max_jobs < 0)
+		die(_("negative values not allowed for submodule.diffJobs"));
+	if (!max_jobs)
+		max_jobs = online_cpus();
+	if (max_jobs < 2 || revs->diffopt.flags.quick)
+		return;
+
+	for (i = 0; i < active_nr; i++) {
+		struct cache_entry *ce = active_cache[i];
+		struct submodule_status *status;
+		struct stat st;
+		int changed, ignore_untracked;
+
+		if (!S_ISGITLINK(ce->ce_mode) || ce_stage(ce) ||
+		    ce_uptodate(ce) || ce_skip_worktree(ce) ||
+		    (ce->ce_flags & CE_VALID))
+			continue;
+		if (!ce_path_match(ce, &revs->prune_data, NULL))
+			continue;
+		if (check_removed(ce, &st))
+			continue;
+		changed = ce_match_stat(ce, &st, ce_option);
+		if (!want_submodule_status(&revs->diffopt, ce, &changed,
+					   &ignore_untracked))
+			continue;
+		status = xcalloc(1, sizeof(*status));
+		status->ignore_untracked = ignore_untracked;
+		string_list_append(submodules, ce->name)->util = status;
+	}
+	if (submodules->nr > 1)
+		get_submodules_status(submodules, max_jobs);
+	else
+		string_list_clear(submodules, 1);
+}
+
 int run_diff_files(struct rev_info *revs, unsigned int option)
 {
 	int entries, i;
@@ -93,11 +173,13 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 	unsigned ce_option = ((option & DIFF_RACY_IS_MODIFIED)
 			      ? CE_MATCH_RACY_IS_DIRTY : 0);
 	uint64_t start = getnanotime();
+	struct string_list submodules = STRING_LIST_INIT_NODUP;
 
 	diff_set_mnemonic_prefix(&revs->diffopt, "i/", "w/");
 
 	if (diff_unmerged_stage < 0)
 		diff_unmerged_stage = 2;
+	get_submodules_status_ahead(revs, ce_option, &submodules);
 	entries = active_nr;
 	for (i = 0; i < entries; i++) {
 		unsigned int oldmode, newmode;
@@ -211,21 +293,23 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 					perror(ce->name);
 					continue;
 				}
-				diff_addremove(&revs->diffopt, '-', ce->ce_mode,
-					       &ce->oid,
-					       !is_null_oid(&ce->oid),
-					       ce->name, 0);
+				revs->diffopt.add_remove(&revs->diffopt, '-',
+							 ce->ce_mode, &ce->oid,
+							 !is_null_oid(&ce->oid),
+							 ce->name, 0);
 				continue;
 			} else if (revs->diffopt.ita_invisible_in_index &&
 				   ce_intent_to_add(ce)) {
-				diff_addremove(&revs->diffopt, '+', ce->ce_mode,
-					       the_hash_algo->empty_tree, 0,
-					       ce->name, 0);
+				revs->diffopt.add_remove(&revs->diffopt, '+',
+							 ce->ce_mode,
+							 the_hash_algo->empty_tree,
+							 0, ce->name, 0);
 				continue;
 			}
 
 			changed = match_stat_with_submodule(&revs->diffopt, ce, &st,
-							    ce_option, &dirty_submodule);
+							    ce_option, &dirty_submodule,
+							    &submodules);
 			newmode = ce_mode_from_stat(ce, st.st_mode);
 		}
 
@@ -238,13 +322,14 @@ int run_diff_files(struct rev_info *revs, unsigned int option)
 		oldmode = ce->ce_mode;
 		old_oid = &ce->oid;
 		new_oid = changed ? &null_oid : &ce->oid;
-		diff_change(&revs->diffopt, oldmode, newmode,
-			    old_oid, new_oid,
-			    !is_null_oid(old_oid),
-			    !is_null_oid(new_oid),
-			    ce->name, 0, dirty_submodule);
+		revs->diffopt.change(&revs->diffopt, oldmode, newmode,
+				     old_oid, new_oid,
+				     !is_null_oid(old_oid),
+				     !is_null_oid(new_oid),
+				     ce->name, 0, dirty_submodule);
 
 	}
+	string_list_clear(&submodules, 1);
 	diffcore_std(&revs->diffopt);
 	diff_flush(&revs->diffopt);
 	trace_performance_since(start, "diff-files");
@@ -291,7 +376,8 @@ static int get_stat_data(const struct cache_entry *ce,
 			return -1;
 		}
 		changed = match_stat_with_submodule(diffopt, ce, &st,
-						    0, dirty_submodule);
+						    0, dirty_submodule,
+						    NULL);
 		if (changed) {
 			mode = ce_mode_from_stat(ce, st.st_mode);
 			oid = &null_oid;
@@ -303,6 +389,22 @@ static int get_stat_data(const struct cache_entry *ce,
 	return 0;
 }
 
+/*
+ * A sparse directory entry of the index stands for a whole tree;
+ * compare the trees and report the paths that differ inside it.
+ */
+static void diff_sparse_directory(struct rev_info *revs,
+				  const struct object_id *old_oid,
+				  const struct object_id *new_oid,
+				  const char *base)
+{
+	struct diff_flags orig_flags = revs->diffopt.flags;
+
+	revs->diffopt.flags.recursive = 1;
+	diff_tree_oid(old_oid, new_oid, base, &revs->diffopt);
+	revs->diffopt.flags = orig_flags;
+}
+
 static void show_new_file(struct rev_info *revs,
 			  const struct cache_entry *new_file,
 			  int cached, int match_missing)
@@ -311,6 +413,11 @@ static void show_new_file(struct rev_info *revs,
 	unsigned int mode;
 	unsigned dirty_submodule = 0;
 
+	if (S_ISSPARSEDIR(new_file->ce_mode)) {
+		diff_sparse_directory(revs, NULL, &new_file->oid, new_file->name);
+		return;
+	}
+
 	/*
 	 * New file in the index: it might actually be different in
 	 * the working tree.
@@ -332,6 +439,13 @@ static int show_modified(struct rev_info *revs,
 	const struct object_id *oid;
 	unsigned dirty_submodule = 0;
 
+	if (S_ISSPARSEDIR(new_entry->ce_mode)) {
+		if (oidcmp(&old_entry->oid, &new_entry->oid))
+			diff_sparse_directory(revs, &old_entry->oid,
+					      &new_entry->oid, new_entry->name);
+		return 0;
+	}
+
 	if (get_stat_data(new_entry, &oid, &mode, cached, match_missing,
 			  &dirty_submodule, &revs->diffopt) < 0) {
 		if (report_missing)
@@ -503,6 +617,17 @@ static int diff_cache(struct rev_info *revs,
 	opts.index_only = cached;
 	opts.diff_index_cached = (cached &&
 				  !revs->diffopt.flags.find_copies_harder);
+	/*
+	 * The cache-tree may tell that the whole index matches the tree,
+	 * in which case there is nothing to show (an i-t-a or unmerged
+	 * entry would have invalidated it).
+	 */
+	if (opts.diff_index_cached && the_index.cache_tree &&
+	    the_index.cache_tree->entry_count == the_index.cache_nr &&
+	    !oidcmp(&the_index.cache_tree->oid, &tree->object.oid)) {
+		trace2_data_intmax("diff", "cache_tree_matched", 1);
+		return 0;
+	}
 	opts.merge = 1;
 	opts.fn = oneway_diff;
 	opts.unpack_data = revs;
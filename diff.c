@@ -24,6 +24,9 @@
 #include "graph.h"
 #include "packfile.h"
 #include "help.h"
+#include "fetch-object.h"
+#include "oidmap.h"
+#include "thread-utils.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -1814,7 +1817,7 @@ static void diff_words_flush(struct emit_callback *ecbdata)
 	}
 }
 
-static void diff_filespec_load_driver(struct diff_filespec *one)
+void diff_filespec_load_driver(struct diff_filespec *one)
 {
 	/* Use already-loaded driver */
 	if (one->driver)
@@ -2874,23 +2877,8 @@ static unsigned char *deflate_it(char *data,
 				 unsigned long size,
 				 unsigned long *result_size)
 {
-	int bound;
-	unsigned char *deflated;
-	git_zstream stream;
-
-	git_deflate_init(&stream, zlib_compression_level);
-	bound = git_deflate_bound(&stream, size);
-	deflated = xmalloc(bound);
-	stream.next_out = deflated;
-	stream.avail_out = bound;
-
-	stream.next_in = (unsigned char *)data;
-	stream.avail_in = size;
-	while (git_deflate(&stream, Z_FINISH) == Z_OK)
-		; /* nothing */
-	git_deflate_end(&stream);
-	*result_size = stream.total_out;
-	return deflated;
+	return git_deflate_buffer(data, size, zlib_compression_level,
+				  result_size);
 }
 
 static void emit_binary_diff_body(struct diff_options *o,
@@ -3505,6 +3493,199 @@ static int reuse_worktree_file(const char *name, const struct object_id *oid, in
 	return 0;
 }
 
+/*
+ * The blobs diff_prefetch_blobs() read. diff_populate_filespec() lends
+ * their data to the filespecs without giving it away, so that a blob
+ * that is compared several times is only read once.
+ */
+struct prefetched_blob {
+	struct oidmap_entry entry;
+	void *data;
+	unsigned long size;
+};
+
+static struct oidmap prefetched_blobs;
+
+static const void *prefetched_blob(const struct object_id *oid,
+				   unsigned long *size)
+{
+	struct prefetched_blob *b = oidmap_get(&prefetched_blobs, oid);
+
+	if (!b || !b->data)
+		return NULL;
+	*size = b->size;
+	return b->data;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Give every thread at least THREAD_COST blobs to read, use at most
+ * MAX_PARALLEL of them, and keep at most PREFETCH_LIMIT bytes.
+ */
+#define MAX_PARALLEL (16)
+#define THREAD_COST (16)
+#define PREFETCH_LIMIT (256 * 1024 * 1024)
+
+struct prefetch_thread {
+	pthread_t pthread;
+	struct prefetched_blob **blobs;
+	int first, step, nr;
+	/* shared by all the threads */
+	pthread_mutex_t *mutex;
+	unsigned long *total;
+};
+
+static int may_prefetch_blob(struct prefetch_thread *t,
+			     const struct object_id *oid)
+{
+	unsigned long size;
+	int ret = 0;
+
+	/* diff_populate_filespec() does not read these */
+	if (oid_object_info(the_repository, oid, &size) != OBJ_BLOB ||
+	    size > big_file_threshold)
+		return 0;
+	pthread_mutex_lock(t->mutex);
+	if (size <= PREFETCH_LIMIT - *t->total) {
+		*t->total += size;
+		ret = 1;
+	}
+	pthread_mutex_unlock(t->mutex);
+	return ret;
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct prefetch_thread *t = data;
+	int i;
+
+	for (i = t->first; i < t->nr; i += t->step) {
+		struct prefetched_blob *b = t->blobs[i];
+		enum object_type type;
+
+		if (!may_prefetch_blob(t, &b->entry.oid))
+			continue;
+		/*
+		 * If we cannot read it after all, diff_populate_filespec()
+		 * will complain about it as usual.
+		 */
+		b->data = read_object_file(&b->entry.oid, &type, &b->size);
+		if (b->data && type != OBJ_BLOB)
+			FREE_AND_NULL(b->data);
+	}
+	return NULL;
+}
+
+static int prefetch_threads(int nr)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_DIFF_PREFETCH_THREADS", 0);
+
+	if (!nr_threads) {
+		nr_threads = nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	return nr_threads;
+}
+
+static void add_prefetched_blob(struct prefetched_blob ***blobs, int *nr,
+				int *alloc, const struct diff_filespec *s)
+{
+	struct prefetched_blob *b;
+
+	if (!DIFF_FILE_VALID(s) || !s->oid_valid ||
+	    !(S_ISREG(s->mode) || S_ISLNK(s->mode)) ||
+	    oidmap_get(&prefetched_blobs, &s->oid))
+		return;
+	b = xcalloc(1, sizeof(*b));
+	oidcpy(&b->entry.oid, &s->oid);
+	oidmap_put(&prefetched_blobs, b);
+	ALLOC_GROW(*blobs, *nr + 1, *alloc);
+	(*blobs)[(*nr)++] = b;
+}
+
+/*
+ * Reading a blob does not depend on reading any other, so the threads
+ * read their share of them under the object read lock, which they let
+ * go of while inflating.
+ */
+void diff_prefetch_blobs(struct diff_queue_struct **queues, int nr)
+{
+	struct prefetched_blob **blobs = NULL;
+	struct prefetch_thread *threads;
+	pthread_mutex_t mutex;
+	unsigned long total = 0;
+	int i, j, blobs_nr = 0, blobs_alloc = 0, nr_threads;
+
+	/* a lazy fetch from a thread would run a whole transport */
+	if (repository_format_partial_clone)
+		return;
+	for (i = 0; i < nr; i++) {
+		struct diff_queue_struct *q = queues[i];
+
+		for (j = 0; j < q->nr; j++) {
+			struct diff_filepair *p = q->queue[j];
+
+			if (diff_unmodified_pair(p))
+				continue;
+			add_prefetched_blob(&blobs, &blobs_nr, &blobs_alloc, p->one);
+			add_prefetched_blob(&blobs, &blobs_nr, &blobs_alloc, p->two);
+		}
+	}
+	nr_threads = prefetch_threads(blobs_nr);
+	if (nr_threads < 2) {
+		free(blobs);
+		return;
+	}
+
+	pthread_mutex_init(&mutex, NULL);
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	enable_obj_read_lock();
+	for (i = 0; i < nr_threads; i++) {
+		struct prefetch_thread *t = &threads[i];
+
+		t->blobs = blobs;
+		t->first = i;
+		t->step = nr_threads;
+		t->nr = blobs_nr;
+		t->mutex = &mutex;
+		t->total = &total;
+		if (pthread_create(&t->pthread, NULL, prefetch_thread, t))
+			die("unable to create threaded diff prefetch");
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die("unable to join threaded diff prefetch");
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&mutex);
+	free(threads);
+	free(blobs);
+}
+
+#else
+
+void diff_prefetch_blobs(struct diff_queue_struct **queues, int nr)
+{
+}
+
+#endif
+
+void diff_prefetch_clear(void)
+{
+	struct oidmap_iter iter;
+	struct prefetched_blob *b;
+
+	oidmap_iter_init(&prefetched_blobs, &iter);
+	while ((b = oidmap_iter_next(&iter)))
+		free(b->data);
+	oidmap_free(&prefetched_blobs, 1);
+}
+
 static int diff_populate_gitlink(struct diff_filespec *s, int size_only)
 {
 	struct strbuf buf = STRBUF_INIT;
@@ -3643,6 +3824,9 @@ int diff_populate_filespec(struct diff_filespec *s, unsigned int flags)
 				return 0;
 			}
 		}
+		s->data = (void *)prefetched_blob(&s->oid, &s->size);
+		if (s->data)
+			return 0;
 		s->data = read_object_file(&s->oid, &type, &s->size);
 		if (!s->data)
 			die("unable to read %s", oid_to_hex(&s->oid));
@@ -4942,6 +5126,39 @@ void diff_free_filepair(struct diff_filepair *p)
 	free(p);
 }
 
+struct diff_queue_struct *diff_queue_take(void)
+{
+	struct diff_queue_struct *q = xmalloc(sizeof(*q));
+
+	*q = diff_queued_diff;
+	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	return q;
+}
+
+void diff_queue_restore(struct diff_queue_struct *q,
+			struct diff_options *options)
+{
+	int i;
+
+	for (i = 0; i < q->nr; i++)
+		diff_q(&diff_queued_diff, q->queue[i]);
+	/* as diff_addremove() and diff_change() would have */
+	if (q->nr && !options->flags.diff_from_contents)
+		options->flags.has_changes = 1;
+	free(q->queue);
+	free(q);
+}
+
+void diff_queue_discard(struct diff_queue_struct *q)
+{
+	int i;
+
+	for (i = 0; i < q->nr; i++)
+		diff_free_filepair(q->queue[i]);
+	free(q->queue);
+	free(q);
+}
+
 const char *diff_aligned_abbrev(const struct object_id *oid, int len)
 {
 	int abblen;
@@ -5817,8 +6034,53 @@ void diffcore_fix_diff_index(struct diff_options *options)
 	QSORT(q->queue, q->nr, diffnamecmp);
 }
 
+void diff_add_filespec_to_fetch(struct oid_array *to_fetch,
+				const struct diff_filespec *filespec)
+{
+	if (DIFF_FILE_VALID(filespec) && filespec->oid_valid &&
+	    !S_ISGITLINK(filespec->mode))
+		oid_array_append(to_fetch, &filespec->oid);
+}
+
+/*
+ * In a partial clone, fetch the blobs of the whole queue at once before
+ * the diffcore transformations or the output need them, instead of
+ * fetching them one by one as they are read.
+ */
+static void diff_queued_diff_prefetch(void)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	int i;
+
+	for (i = 0; i < q->nr; i++) {
+		diff_add_filespec_to_fetch(&to_fetch, q->queue[i]->one);
+		diff_add_filespec_to_fetch(&to_fetch, q->queue[i]->two);
+	}
+	prefetch_objects(&to_fetch, -1);
+	oid_array_clear(&to_fetch);
+}
+
 void diffcore_std(struct diff_options *options)
 {
+	int output_formats_to_prefetch = DIFF_FORMAT_DIFFSTAT |
+		DIFF_FORMAT_NUMSTAT |
+		DIFF_FORMAT_PATCH |
+		DIFF_FORMAT_SHORTSTAT |
+		DIFF_FORMAT_DIRSTAT;
+
+	/*
+	 * Prefetch if the output or a transformation other than rename
+	 * detection needs the contents of the blobs; diffcore_rename()
+	 * prefetches what it needs by itself otherwise.
+	 */
+	if (repository_format_partial_clone &&
+	    ((options->output_format & output_formats_to_prefetch) ||
+	     options->break_opt != -1 ||
+	     (options->pickaxe_opts & DIFF_PICKAXE_KINDS_MASK) ||
+	     options->flags.diff_from_contents))
+		diff_queued_diff_prefetch();
+
 	/* NOTE please keep the following in sync with diff_tree_combined() */
 	if (options->skip_stat_unmatch)
 		diffcore_skip_stat_unmatch(options);
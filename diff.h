@@ -342,6 +342,19 @@ extern int git_config_rename(const char *var, const char *value);
 
 #define DIFF_PICKAXE_IGNORE_CASE	32
 
+/*
+ * A caller that runs the pickaxe over many diffs, like "git log -S", can
+ * queue their changes with diff_pickaxe_prefetch() first, and have
+ * diff_pickaxe_prefetch_run() find out in threads which of them the
+ * pickaxe matches. Until diff_pickaxe_prefetch_clear(), diffcore_pickaxe()
+ * then uses those answers instead of reading the blobs itself. "q" is a
+ * queue from diff_queue_take().
+ */
+extern void diff_pickaxe_prefetch(struct diff_queue_struct *q,
+				  struct diff_options *opt);
+extern void diff_pickaxe_prefetch_run(struct diff_options *opt);
+extern void diff_pickaxe_prefetch_clear(void);
+
 extern void diffcore_std(struct diff_options *);
 extern void diffcore_fix_diff_index(struct diff_options *);
 
@@ -377,6 +390,24 @@ extern int diff_queue_is_empty(void);
 extern void diff_flush(struct diff_options*);
 extern void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc);
 
+/*
+ * diff_queue_take() takes the filepairs queued so far, leaving the queue
+ * empty, for diff_queue_restore() to queue them again later, or for
+ * diff_queue_discard() to free them.
+ */
+extern struct diff_queue_struct *diff_queue_take(void);
+extern void diff_queue_restore(struct diff_queue_struct *q,
+			       struct diff_options *options);
+extern void diff_queue_discard(struct diff_queue_struct *q);
+
+/*
+ * Read in threads the blobs that showing the diffs of "queues", taken
+ * with diff_queue_take(), will compare. They are kept in memory for
+ * diff_populate_filespec() until diff_prefetch_clear().
+ */
+extern void diff_prefetch_blobs(struct diff_queue_struct **queues, int nr);
+extern void diff_prefetch_clear(void);
+
 /* diff-raw status letters */
 #define DIFF_STATUS_ADDED		'A'
 #define DIFF_STATUS_COPIED		'C'
@@ -162,6 +162,47 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	return hash;
 }
 
+unsigned int diffcore_count_spans(void *count, uint32_t **spans)
+{
+	struct spanhash_top *hash = count;
+	struct spanhash *s;
+	unsigned int nr = 0, i;
+
+	for (s = hash->data; s->cnt; s++)
+		nr++;
+	ALLOC_ARRAY(*spans, st_mult(2, nr));
+	for (i = 0; i < nr; i++) {
+		(*spans)[2 * i] = hash->data[i].hashval;
+		(*spans)[2 * i + 1] = hash->data[i].cnt;
+	}
+	return nr;
+}
+
+void *diffcore_count_from_spans(const uint32_t *spans, unsigned int nr)
+{
+	struct spanhash_top *hash;
+	unsigned int i;
+	int sz = INITIAL_HASH_SIZE;
+
+	while (INITIAL_FREE(sz) <= nr)
+		sz++;
+	hash = xcalloc(1, st_add(sizeof(*hash),
+				 st_mult(sizeof(struct spanhash), 1 << sz)));
+	hash->alloc_log2 = sz;
+	hash->free = INITIAL_FREE(sz) - nr;
+	for (i = 0; i < nr; i++) {
+		hash->data[i].hashval = spans[2 * i];
+		hash->data[i].cnt = spans[2 * i + 1];
+	}
+	return hash;
+}
+
+void diffcore_prepare_count(struct diff_filespec *one, void **count_p)
+{
+	if (!*count_p)
+		*count_p = hash_chars(one);
+}
+
 int diffcore_count_changes(struct diff_filespec *src,
 			   struct diff_filespec *dst,
 			   void **src_count_p,
@@ -3,12 +3,16 @@
  * Copyright (C) 2010 Google Inc.
  */
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "xdiff-interface.h"
 #include "kwset.h"
 #include "commit.h"
 #include "quote.h"
+#include "object-store.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 typedef int (*pickaxe_fn)(mmfile_t *one, mmfile_t *two,
 			  struct diff_options *o,
@@ -116,6 +120,60 @@ static int has_changes(mmfile_t *one, mmfile_t *two,
 	return one_contains != two_contains;
 }
 
+/*
+ * What the pickaxe said about the changes that diff_pickaxe_prefetch()
+ * queued, sorted by their blobs, with the null object name for a side
+ * that does not exist.
+ */
+struct prefetched_match {
+	struct object_id one, two;
+	int ret; /* -1 if the thread could not tell */
+};
+
+static struct prefetched_match *prefetched;
+static int prefetched_nr, prefetched_alloc, prefetched_ready;
+
+static int prefetched_cmp(const void *a_, const void *b_)
+{
+	const struct prefetched_match *a = a_, *b = b_;
+	int cmp = oidcmp(&a->one, &b->one);
+
+	return cmp ? cmp : oidcmp(&a->two, &b->two);
+}
+
+/*
+ * The threads read the blobs as they are in the object store, which is
+ * what fill_textconv() gives us without a textconv filter, except for
+ * submodules and files in the working tree.
+ */
+static int can_prefetch(const struct diff_filespec *s)
+{
+	return !DIFF_FILE_VALID(s) ||
+		(s->oid_valid && (S_ISREG(s->mode) || S_ISLNK(s->mode)));
+}
+
+static void prefetched_key(struct prefetched_match *m,
+			   const struct diff_filepair *p)
+{
+	oidcpy(&m->one, DIFF_FILE_VALID(p->one) ? &p->one->oid : &null_oid);
+	oidcpy(&m->two, DIFF_FILE_VALID(p->two) ? &p->two->oid : &null_oid);
+}
+
+static int prefetched_match(const struct diff_filepair *p)
+{
+	struct prefetched_match key, *m;
+
+	if (!prefetched_ready || !can_prefetch(p->one) || !can_prefetch(p->two))
+		return -1;
+	prefetched_key(&key, p);
+	m = bsearch(&key, prefetched, prefetched_nr, sizeof(*prefetched),
+		    prefetched_cmp);
+	if (!m || m->ret < 0)
+		return -1;
+	trace2_counter_add("pickaxe", "prefetch/hits", 1);
+	return m->ret;
+}
+
 static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 			 regex_t *regexp, kwset_t kws, pickaxe_fn fn)
 {
@@ -153,6 +211,12 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 	if (textconv_one == textconv_two && diff_unmodified_pair(p))
 		return 0;
 
+	if (!textconv_one && !textconv_two) {
+		ret = prefetched_match(p);
+		if (ret >= 0)
+			return ret;
+	}
+
 	mf1.size = fill_textconv(textconv_one, p->one, &mf1.ptr);
 	mf2.size = fill_textconv(textconv_two, p->two, &mf2.ptr);
 
@@ -219,19 +283,20 @@ static void regcomp_or_die(regex_t *regex, const char *needle, int cflags)
 	}
 }
 
-void diffcore_pickaxe(struct diff_options *o)
+static pickaxe_fn compile_pickaxe(struct diff_options *o, regex_t *regex,
+				  regex_t **regexp, kwset_t *kws)
 {
 	const char *needle = o->pickaxe;
 	int opts = o->pickaxe_opts;
-	regex_t regex, *regexp = NULL;
-	kwset_t kws = NULL;
 
+	*regexp = NULL;
+	*kws = NULL;
 	if (opts & (DIFF_PICKAXE_REGEX | DIFF_PICKAXE_KIND_G)) {
 		int cflags = REG_EXTENDED | REG_NEWLINE;
 		if (o->pickaxe_opts & DIFF_PICKAXE_IGNORE_CASE)
 			cflags |= REG_ICASE;
-		regcomp_or_die(&regex, needle, cflags);
-		regexp = &regex;
+		regcomp_or_die(regex, needle, cflags);
+		*regexp = regex;
 	} else if (opts & DIFF_PICKAXE_KIND_S) {
 		if (o->pickaxe_opts & DIFF_PICKAXE_IGNORE_CASE &&
 		    has_non_ascii(needle)) {
@@ -239,23 +304,214 @@ void diffcore_pickaxe(struct diff_options *o)
 			int cflags = REG_NEWLINE | REG_ICASE;
 
 			basic_regex_quote_buf(&sb, needle);
-			regcomp_or_die(&regex, sb.buf, cflags);
+			regcomp_or_die(regex, sb.buf, cflags);
 			strbuf_release(&sb);
-			regexp = &regex;
+			*regexp = regex;
 		} else {
-			kws = kwsalloc(o->pickaxe_opts & DIFF_PICKAXE_IGNORE_CASE
-				       ? tolower_trans_tbl : NULL);
-			kwsincr(kws, needle, strlen(needle));
-			kwsprep(kws);
+			*kws = kwsalloc(o->pickaxe_opts & DIFF_PICKAXE_IGNORE_CASE
+					? tolower_trans_tbl : NULL);
+			kwsincr(*kws, needle, strlen(needle));
+			kwsprep(*kws);
 		}
 	}
 
-	pickaxe(&diff_queued_diff, o, regexp, kws,
-		(opts & DIFF_PICKAXE_KIND_G) ? diff_grep : has_changes);
+	return (opts & DIFF_PICKAXE_KIND_G) ? diff_grep : has_changes;
+}
 
+static void free_pickaxe(regex_t *regexp, kwset_t kws)
+{
 	if (regexp)
 		regfree(regexp);
 	if (kws)
 		kwsfree(kws);
-	return;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Give every thread at least THREAD_COST changes to look at, and use at
+ * most MAX_PARALLEL of them.
+ */
+#define MAX_PARALLEL (16)
+#define THREAD_COST (16)
+
+struct pickaxe_thread {
+	pthread_t pthread;
+	struct diff_options *o;
+	/* each thread has its own, as regexec() may serialize its callers */
+	regex_t regex, *regexp;
+	kwset_t kws;
+	pickaxe_fn fn;
+	int first, step;
+};
+
+static int read_blob(const struct object_id *oid, mmfile_t *mf)
+{
+	enum object_type type;
+	unsigned long size;
+
+	mf->ptr = read_object_file(oid, &type, &size);
+	if (!mf->ptr)
+		return -1;
+	if (type != OBJ_BLOB) {
+		FREE_AND_NULL(mf->ptr);
+		return -1;
+	}
+	mf->size = size;
+	return 0;
+}
+
+static int match_blobs(struct pickaxe_thread *t,
+		       const struct object_id *one,
+		       const struct object_id *two)
+{
+	mmfile_t mf1 = { NULL }, mf2 = { NULL };
+	int ret = -1;
+
+	/*
+	 * If we cannot read a blob, leave it to pickaxe_match() to
+	 * complain about it as usual.
+	 */
+	if ((is_null_oid(one) || !read_blob(one, &mf1)) &&
+	    (is_null_oid(two) || !read_blob(two, &mf2)))
+		ret = t->fn(is_null_oid(one) ? NULL : &mf1,
+			    is_null_oid(two) ? NULL : &mf2,
+			    t->o, t->regexp, t->kws);
+	free(mf1.ptr);
+	free(mf2.ptr);
+	return ret;
+}
+
+static void *pickaxe_thread(void *data)
+{
+	struct pickaxe_thread *t = data;
+	int i;
+
+	for (i = t->first; i < prefetched_nr; i += t->step) {
+		struct prefetched_match *m = &prefetched[i];
+		m->ret = match_blobs(t, &m->one, &m->two);
+	}
+	return NULL;
+}
+
+static int pickaxe_threads(int nr)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_PICKAXE_THREADS", 0);
+
+	if (!nr_threads) {
+		nr_threads = nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+		if (nr_threads > MAX_PARALLEL)
+			nr_threads = MAX_PARALLEL;
+	}
+	if (nr_threads > nr)
+		nr_threads = nr;
+	return nr_threads;
+}
+
+static int may_prefetch(struct diff_options *o)
+{
+	/*
+	 * A lazy fetch of a missing object from a thread would run a
+	 * whole transport under the object read lock.
+	 */
+	return !o->objfind && o->pickaxe && o->pickaxe[0] &&
+		(o->pickaxe_opts & (DIFF_PICKAXE_KIND_S | DIFF_PICKAXE_KIND_G)) &&
+		!repository_format_partial_clone;
+}
+
+void diff_pickaxe_prefetch(struct diff_queue_struct *q,
+			   struct diff_options *opt)
+{
+	int i;
+
+	if (!may_prefetch(opt))
+		return;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		if ((!DIFF_FILE_VALID(p->one) && !DIFF_FILE_VALID(p->two)) ||
+		    diff_unmodified_pair(p) ||
+		    !can_prefetch(p->one) || !can_prefetch(p->two))
+			continue;
+		if (opt->flags.allow_textconv &&
+		    (get_textconv(p->one) || get_textconv(p->two)))
+			continue;
+		ALLOC_GROW(prefetched, prefetched_nr + 1, prefetched_alloc);
+		prefetched_key(&prefetched[prefetched_nr], p);
+		prefetched[prefetched_nr++].ret = -1;
+	}
+}
+
+/*
+ * Whether the pickaxe matches a change depends on the two blobs alone,
+ * so each thread can look at its share of the changes independently, and
+ * diffcore_pickaxe() gives the same answers with these as without them.
+ */
+void diff_pickaxe_prefetch_run(struct diff_options *o)
+{
+	struct pickaxe_thread *threads;
+	int i, nr, nr_threads;
+
+	QSORT(prefetched, prefetched_nr, prefetched_cmp);
+	for (i = nr = 0; i < prefetched_nr; i++)
+		if (!nr || prefetched_cmp(&prefetched[nr - 1], &prefetched[i]))
+			prefetched[nr++] = prefetched[i];
+	prefetched_nr = nr;
+	nr_threads = pickaxe_threads(nr);
+	if (nr_threads < 2)
+		return;
+
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	enable_obj_read_lock();
+	for (i = 0; i < nr_threads; i++) {
+		struct pickaxe_thread *t = &threads[i];
+
+		t->o = o;
+		t->fn = compile_pickaxe(o, &t->regex, &t->regexp, &t->kws);
+		t->first = i;
+		t->step = nr_threads;
+		if (pthread_create(&t->pthread, NULL, pickaxe_thread, t))
+			die("unable to create threaded pickaxe");
+	}
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(threads[i].pthread, NULL))
+			die("unable to join threaded pickaxe");
+		free_pickaxe(threads[i].regexp, threads[i].kws);
+	}
+	disable_obj_read_lock();
+	free(threads);
+	prefetched_ready = 1;
+}
+
+#else
+
+void diff_pickaxe_prefetch(struct diff_queue_struct *q,
+			   struct diff_options *opt)
+{
+}
+
+void diff_pickaxe_prefetch_run(struct diff_options *o)
+{
+}
+
+#endif
+
+void diff_pickaxe_prefetch_clear(void)
+{
+	FREE_AND_NULL(prefetched);
+	prefetched_nr = prefetched_alloc = 0;
+	prefetched_ready = 0;
+}
+
+void diffcore_pickaxe(struct diff_options *o)
+{
+	regex_t regex, *regexp;
+	kwset_t kws;
+	pickaxe_fn fn = compile_pickaxe(o, &regex, &regexp, &kws);
+
+	pickaxe(&diff_queued_diff, o, regexp, kws, fn);
+	free_pickaxe(regexp, kws);
 }
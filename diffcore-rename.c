@@ -2,11 +2,16 @@
  * Copyright (C) 2005 Junio C Hamano
  */
 #include "cache.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "object-store.h"
 #include "hashmap.h"
 #include "progress.h"
+#include "fetch-object.h"
+#include "trace2.h"
+#include "thread-utils.h"
+#include "similarity-cache.h"
 
 /* Table of rename/copy destinations */
 
@@ -146,7 +151,7 @@ static int estimate_similarity(struct diff_filespec *src,
 	 * call into this function in that case.
 	 */
 	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
-	int score;
+	int score, new_src, new_dst;
 
 	/* We deal only with regular files.  Symlink renames are handled
 	 * only when they are exact matches --- in other words, no edits
@@ -155,6 +160,11 @@ static int estimate_similarity(struct diff_filespec *src,
 	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
 		return 0;
 
+	if (!src->cnt_data)
+		similarity_cache_lookup(src);
+	if (!dst->cnt_data)
+		similarity_cache_lookup(dst);
+
 	/*
 	 * Need to check that source and destination sizes are
 	 * filled in before comparing them.
@@ -191,10 +201,16 @@ static int estimate_similarity(struct diff_filespec *src,
 	if (!dst->cnt_data && diff_populate_filespec(dst, 0))
 		return 0;
 
+	new_src = !src->cnt_data;
+	new_dst = !dst->cnt_data;
 	if (diffcore_count_changes(src, dst,
 				   &src->cnt_data, &dst->cnt_data,
 				   &src_copied, &literal_added))
 		return 0;
+	if (new_src)
+		similarity_cache_add(src);
+	if (new_dst)
+		similarity_cache_add(dst);
 
 	/* How similar are they?
 	 * what percentage of material in dst are from source?
@@ -356,6 +372,125 @@ static int find_exact_renames(struct diff_options *options)
 	return renames;
 }
 
+struct basename_entry {
+	struct hashmap_entry entry;
+	const char *basename;
+	int index; /* -1 if more than one path has this basename */
+};
+
+static const char *get_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+static int basename_entry_cmp(const void *unused_cmp_data,
+			      const void *entry,
+			      const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct basename_entry *a = entry;
+	const struct basename_entry *b = entry_or_key;
+
+	return strcmp(a->basename, keydata ? keydata : b->basename);
+}
+
+static void add_basename(struct hashmap *map, const char *path, int index)
+{
+	const char *base = get_basename(path);
+	struct basename_entry key, *e;
+
+	hashmap_entry_init(&key, strhash(base));
+	e = hashmap_get(map, &key, base);
+	if (e) {
+		e->index = -1;
+		return;
+	}
+	e = xmalloc(sizeof(*e));
+	hashmap_entry_init(e, strhash(base));
+	e->basename = base;
+	e->index = index;
+	hashmap_add(map, e);
+}
+
+/*
+ * Most files that are moved keep their basename. When the basename of a
+ * remaining destination is shared by only one remaining source and no
+ * other destination, compare just the two of them, and pair them if they
+ * are similar enough: this finds most renames without computing the
+ * similarity of every source with every destination. The pairs are held
+ * to a higher score than minimum_score, as the matrix would have chosen
+ * between all the candidates.
+ */
+static int find_basename_matches(struct diff_options *options,
+				 int minimum_score)
+{
+	int basename_score = minimum_score + (MAX_SCORE - minimum_score) / 2;
+	struct hashmap srcs, dsts;
+	struct hashmap_iter iter;
+	struct basename_entry *d;
+	int i, renames = 0;
+
+	hashmap_init(&srcs, basename_entry_cmp, NULL, rename_src_nr);
+	hashmap_init(&dsts, basename_entry_cmp, NULL, rename_dst_nr);
+	for (i = 0; i < rename_src_nr; i++)
+		if (!rename_src[i].p->one->rename_used)
+			add_basename(&srcs, rename_src[i].p->one->path, i);
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair)
+			add_basename(&dsts, rename_dst[i].two->path, i);
+
+	if (repository_format_partial_clone) {
+		struct oid_array to_fetch = OID_ARRAY_INIT;
+
+		hashmap_iter_init(&dsts, &iter);
+		while ((d = hashmap_iter_next(&iter))) {
+			struct basename_entry *s;
+
+			if (d->index < 0)
+				continue;
+			s = hashmap_get_from_hash(&srcs, strhash(d->basename),
+						  d->basename);
+			if (!s || s->index < 0)
+				continue;
+			diff_add_filespec_to_fetch(&to_fetch,
+						   rename_dst[d->index].two);
+			diff_add_filespec_to_fetch(&to_fetch,
+						   rename_src[s->index].p->one);
+		}
+		prefetch_objects(&to_fetch, -1);
+		oid_array_clear(&to_fetch);
+	}
+
+	hashmap_iter_init(&dsts, &iter);
+	while ((d = hashmap_iter_next(&iter))) {
+		struct diff_filespec *one, *two;
+		struct basename_entry *s;
+		int score;
+
+		if (d->index < 0)
+			continue;
+		s = hashmap_get_from_hash(&srcs, strhash(d->basename),
+					  d->basename);
+		if (!s || s->index < 0)
+			continue;
+
+		one = rename_src[s->index].p->one;
+		two = rename_dst[d->index].two;
+		score = estimate_similarity(one, two, basename_score);
+		diff_free_filespec_blob(one);
+		diff_free_filespec_blob(two);
+		if (score < basename_score)
+			continue;
+		record_rename_pair(d->index, s->index, score);
+		renames++;
+	}
+
+	hashmap_free(&srcs, 1);
+	hashmap_free(&dsts, 1);
+	return renames;
+}
+
 #define NUM_CANDIDATE_PER_DST 4
 static void record_if_better(struct diff_score m[], struct diff_score *o)
 {
@@ -387,6 +522,12 @@ static int too_many_rename_candidates(int num_create,
 
 	options->needed_rename_limit = 0;
 
+	/* Sources that are already renamed are out of the matrix */
+	if (options->detect_rename != DIFF_DETECT_COPY)
+		for (num_src = i = 0; i < rename_src_nr; i++)
+			if (!rename_src[i].p->one->rename_used)
+				num_src++;
+
 	/*
 	 * This basically does a test for the rename matrix not
 	 * growing larger than a "rename_limit" square matrix, ie:
@@ -441,6 +582,231 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+static int is_candidate_src(int src_index, int skip_unmodified, int copies)
+{
+	struct diff_filepair *p = rename_src[src_index].p;
+
+	if (skip_unmodified && diff_unmodified_pair(p))
+		return 0;
+	if (!copies && p->one->rename_used)
+		return 0; /* cannot be renamed twice */
+	return 1;
+}
+
+/*
+ * Record in m the best NUM_CANDIDATE_PER_DST sources for the destination
+ * dst_index. When "prepared", the counts of all the files are already
+ * computed, and the filespecs are not touched at all.
+ */
+static void fill_candidates(struct diff_score *m, int dst_index,
+			    int minimum_score, int skip_unmodified, int copies,
+			    int prepared)
+{
+	struct diff_filespec *two = rename_dst[dst_index].two;
+	int j;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		struct diff_score this_src;
+
+		if (!is_candidate_src(j, skip_unmodified, copies))
+			continue;
+
+		if (prepared && (!one->cnt_data || !two->cnt_data))
+			this_src.score = 0;
+		else
+			this_src.score = estimate_similarity(one, two,
+							     minimum_score);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = dst_index;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+		if (prepared)
+			continue;
+		/*
+		 * Once we run estimate_similarity,
+		 * We do not need the text anymore.
+		 */
+		diff_free_filespec_blob(one);
+		diff_free_filespec_blob(two);
+	}
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Filling the matrix in threads is only worth it for large ones: give
+ * every thread at least THREAD_COST pairs to compare, and use at most
+ * MAX_PARALLEL of them.
+ */
+#define MAX_PARALLEL (16)
+#define THREAD_COST (20000)
+
+struct similarity_thread {
+	pthread_t pthread;
+	struct diff_score *mx;
+	int *rows; /* indices in rename_dst */
+	int nr;
+	int minimum_score, skip_unmodified, copies;
+	/* shared by all the threads */
+	pthread_mutex_t *mutex;
+	struct progress *progress;
+	uint64_t *done;
+};
+
+static void *similarity_thread(void *data)
+{
+	struct similarity_thread *t = data;
+	int i;
+
+	for (i = 0; i < t->nr; i++) {
+		fill_candidates(&t->mx[i * NUM_CANDIDATE_PER_DST], t->rows[i],
+				t->minimum_score, t->skip_unmodified,
+				t->copies, 1);
+		if (!t->progress)
+			continue;
+		pthread_mutex_lock(t->mutex);
+		*t->done += rename_src_nr;
+		display_progress(t->progress, *t->done);
+		pthread_mutex_unlock(t->mutex);
+	}
+	return NULL;
+}
+
+/*
+ * Read the file and count its contents for diffcore_count_changes(),
+ * which only happens the first time the matrix compares it otherwise.
+ */
+static void prepare_similarity(struct diff_filespec *one)
+{
+	if (!S_ISREG(one->mode) || one->cnt_data ||
+	    similarity_cache_lookup(one))
+		return;
+	if (!diff_populate_filespec(one, 0)) {
+		diffcore_prepare_count(one, &one->cnt_data);
+		similarity_cache_add(one);
+	}
+	diff_free_filespec_blob(one);
+}
+
+static int similarity_threads(int num_create, int num_src)
+{
+	int nr_threads = git_env_ulong("GIT_TEST_RENAME_THREADS", 0);
+
+	if (nr_threads)
+		return nr_threads;
+	nr_threads = (uint64_t)num_create * num_src / THREAD_COST;
+	if (nr_threads > online_cpus())
+		nr_threads = online_cpus();
+	if (nr_threads > MAX_PARALLEL)
+		nr_threads = MAX_PARALLEL;
+	return nr_threads;
+}
+
+/*
+ * Every row of the matrix is computed independently from the others,
+ * and each thread fills its own range of rows, so the result is the
+ * same as with a single thread. Reading the objects and counting their
+ * contents is not thread-safe, and is done for all the files first.
+ */
+static int fill_matrix_threaded(struct diff_score *mx, int num_create,
+				int minimum_score, int skip_unmodified,
+				int copies, struct progress *progress)
+{
+	struct similarity_thread *threads;
+	pthread_mutex_t mutex;
+	uint64_t done = 0;
+	int *rows;
+	int i, nr_threads, num_src, row, offset;
+
+	for (num_src = i = 0; i < rename_src_nr; i++)
+		if (is_candidate_src(i, skip_unmodified, copies))
+			num_src++;
+	nr_threads = similarity_threads(num_create, num_src);
+	if (nr_threads > num_create)
+		nr_threads = num_create;
+	if (nr_threads < 2)
+		return 0;
+
+	ALLOC_ARRAY(rows, num_create);
+	for (row = i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+		rows[row++] = i;
+		prepare_similarity(rename_dst[i].two);
+	}
+	for (i = 0; i < rename_src_nr; i++)
+		if (is_candidate_src(i, skip_unmodified, copies))
+			prepare_similarity(rename_src[i].p->one);
+
+	pthread_mutex_init(&mutex, NULL);
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = offset = 0; i < nr_threads; i++) {
+		struct similarity_thread *t = &threads[i];
+		int end = (int)((uint64_t)num_create * (i + 1) / nr_threads);
+
+		t->mx = &mx[offset * NUM_CANDIDATE_PER_DST];
+		t->rows = rows + offset;
+		t->nr = end - offset;
+		t->minimum_score = minimum_score;
+		t->skip_unmodified = skip_unmodified;
+		t->copies = copies;
+		t->mutex = &mutex;
+		t->progress = progress;
+		t->done = &done;
+		offset = end;
+		if (pthread_create(&t->pthread, NULL, similarity_thread, t))
+			die(_("unable to create threaded rename detection"));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die(_("unable to join threaded rename detection"));
+	pthread_mutex_destroy(&mutex);
+	free(threads);
+	free(rows);
+	return 1;
+}
+
+#else
+
+static int fill_matrix_threaded(struct diff_score *mx, int num_create,
+				int minimum_score, int skip_unmodified,
+				int copies, struct progress *progress)
+{
+	return 0;
+}
+
+#endif
+
+/*
+ * Fill the candidates of the remaining destinations into mx, and return
+ * the number of destinations.
+ */
+static int fill_matrix(struct diff_score *mx, int num_create,
+		       int minimum_score, int skip_unmodified, int copies,
+		       struct progress *progress)
+{
+	int i, dst_cnt;
+
+	if (fill_matrix_threaded(mx, num_create, minimum_score,
+				 skip_unmodified, copies, progress))
+		return num_create;
+
+	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+
+		fill_candidates(&mx[dst_cnt * NUM_CANDIDATE_PER_DST], i,
+				minimum_score, skip_unmodified, copies, 0);
+		dst_cnt++;
+		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
+	}
+	return dst_cnt;
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -448,13 +814,15 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
+	int i, rename_count, skip_unmodified = 0;
 	int num_create, dst_cnt;
 	struct progress *progress = NULL;
 
 	if (!minimum_score)
 		minimum_score = DEFAULT_RENAME_SCORE;
 
+	trace2_region_enter("diff", "diffcore_rename");
+
 	for (i = 0; i < q->nr; i++) {
 		struct diff_filepair *p = q->queue[i];
 		if (!DIFF_FILE_VALID(p->one)) {
@@ -505,14 +873,25 @@ void diffcore_rename(struct diff_options *options)
 	 * with cheap tests in order to avoid doing deltas.
 	 */
 	rename_count = find_exact_renames(options);
+	trace2_data_intmax("diff", "rename/exact", rename_count);
 
 	/* Did we only want exact renames? */
 	if (minimum_score == MAX_SCORE)
 		goto cleanup;
 
+	/*
+	 * Unless we look for copies, pair up the sources and destinations
+	 * that have a unique basename before resorting to the matrix.
+	 */
+	if (detect_rename != DIFF_DETECT_COPY) {
+		int found = find_basename_matches(options, minimum_score);
+		trace2_data_intmax("diff", "rename/basename", found);
+		rename_count += found;
+	}
+
 	/*
 	 * Calculate how many renames are left (but all the source
-	 * files still remain as options for rename/copies!)
+	 * files still remain as options for copies!)
 	 */
 	num_create = (rename_dst_nr - rename_count);
 
@@ -531,6 +910,31 @@ void diffcore_rename(struct diff_options *options)
 		break;
 	}
 
+	if (repository_format_partial_clone) {
+		/*
+		 * Fetch the blobs inexact rename detection is about to
+		 * compare in one go.
+		 */
+		struct oid_array to_fetch = OID_ARRAY_INIT;
+
+		for (i = 0; i < rename_dst_nr; i++) {
+			if (rename_dst[i].pair)
+				continue; /* dealt with exact match already. */
+			diff_add_filespec_to_fetch(&to_fetch, rename_dst[i].two);
+		}
+		for (i = 0; i < rename_src_nr; i++) {
+			if (skip_unmodified &&
+			    diff_unmodified_pair(rename_src[i].p))
+				continue;
+			diff_add_filespec_to_fetch(&to_fetch, rename_src[i].p->one);
+		}
+		prefetch_objects(&to_fetch, -1);
+		oid_array_clear(&to_fetch);
+	}
+
+	trace2_region_enter("diff", "rename/inexact");
+	trace2_data_intmax("diff", "rename/pairs",
+			   (intmax_t)num_create * rename_src_nr);
 	if (options->show_rename_progress) {
 		progress = start_delayed_progress(
 				_("Performing inexact rename detection"),
@@ -538,41 +942,8 @@ void diffcore_rename(struct diff_options *options)
 	}
 
 	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
-	}
+	dst_cnt = fill_matrix(mx, num_create, minimum_score, skip_unmodified,
+			      detect_rename == DIFF_DETECT_COPY, progress);
 	stop_progress(&progress);
 
 	/* cost matrix sorted by most to least similar pair */
@@ -582,6 +953,8 @@ void diffcore_rename(struct diff_options *options)
 	if (detect_rename == DIFF_DETECT_COPY)
 		rename_count += find_renames(mx, dst_cnt, minimum_score, 1);
 	free(mx);
+	trace2_region_leave("diff", "rename/inexact");
+	trace2_data_intmax("diff", "rename/found", rename_count);
 
  cleanup:
 	/* At this point, we have found some renames and copies and they
@@ -671,5 +1044,7 @@ void diffcore_rename(struct diff_options *options)
 	rename_dst_nr = rename_dst_alloc = 0;
 	FREE_AND_NULL(rename_src);
 	rename_src_nr = rename_src_alloc = 0;
+	similarity_cache_flush();
+	trace2_region_leave("diff", "diffcore_rename");
 	return;
 }
@@ -23,6 +23,7 @@
 #define MINIMUM_BREAK_SIZE     400 /* do not break a file smaller than this */
 
 struct userdiff_driver;
+struct oid_array;
 
 struct diff_filespec {
 	struct object_id oid;
@@ -61,6 +62,7 @@ extern int diff_populate_filespec(struct diff_filespec *, unsigned int);
 extern void diff_free_filespec_data(struct diff_filespec *);
 extern void diff_free_filespec_blob(struct diff_filespec *);
 extern int diff_filespec_is_binary(struct diff_filespec *);
+extern void diff_filespec_load_driver(struct diff_filespec *);
 
 struct diff_filepair {
 	struct diff_filespec *one;
@@ -88,6 +90,13 @@ struct diff_filepair {
 
 extern void diff_free_filepair(struct diff_filepair *);
 
+/*
+ * Add the blob of "filespec" to "to_fetch", for prefetch_objects(),
+ * if it comes from the object store.
+ */
+extern void diff_add_filespec_to_fetch(struct oid_array *to_fetch,
+				       const struct diff_filespec *filespec);
+
 extern int diff_unmodified_pair(struct diff_filepair *);
 
 struct diff_queue_struct {
@@ -145,4 +154,20 @@ extern int diffcore_count_changes(struct diff_filespec *src,
 				  unsigned long *src_copied,
 				  unsigned long *literal_added);
 
+/*
+ * Compute into *count_p, unless it is already there, what
+ * diffcore_count_changes() needs to know about the contents of "one",
+ * which must be populated. diffcore_count_changes() does not touch the
+ * filespecs when both counts are prepared, so it can then run in threads.
+ */
+extern void diffcore_prepare_count(struct diff_filespec *one, void **count_p);
+
+/*
+ * Convert the counts of diffcore_count_changes() to and from "nr" pairs
+ * of a hash and a count, sorted by hash; this is how similarity-cache.c
+ * stores them. diffcore_count_spans() allocates *spans.
+ */
+extern unsigned int diffcore_count_spans(void *count, uint32_t **spans);
+extern void *diffcore_count_from_spans(const uint32_t *spans, unsigned int nr);
+
 #endif
@@ -21,6 +21,8 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -53,6 +55,46 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 	struct index_state *istate, const char *path, int len,
 	struct untracked_cache_dir *untracked,
 	int check_only, int stop_at_first_file, const struct pathspec *pathspec);
+
+/*
+ * Subdirectories of the top-level directory, waiting to be scanned by
+ * read_directory_threaded().
+ */
+struct dir_walk_queue {
+	struct dir_walk_item {
+		char *path;
+		int len;
+		struct untracked_cache_dir *untracked;
+	} *items;
+	int nr, alloc;
+	int next; /* the first item that nobody is scanning yet */
+};
+
+static void queue_subdir(struct dir_walk_queue *queue, struct strbuf *path,
+			 struct untracked_cache_dir *untracked)
+{
+	struct dir_walk_item *item;
+
+	ALLOC_GROW(queue->items, queue->nr + 1, queue->alloc);
+	item = &queue->items[queue->nr++];
+	item->path = xmemdupz(path->buf, path->len);
+	item->len = path->len;
+	item->untracked = untracked;
+}
+
+/*
+ * Serializes what a threaded scan does outside of its own dir_struct
+ * and untracked cache nodes: reading objects, and looking at the refs
+ * of nested repositories.
+ */
+#ifndef NO_PTHREADS
+static pthread_mutex_t scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define scan_lock() pthread_mutex_lock(&scan_mutex)
+#define scan_unlock() pthread_mutex_unlock(&scan_mutex)
+#else
+#define scan_lock()
+#define scan_unlock()
+#endif
 static int get_dtype(struct dirent *de, struct index_state *istate,
 		     const char *path, int len);
 
@@ -426,12 +468,111 @@ static int match_pathspec_item(const struct pathspec_item *item, int prefix,
  * pathspec did not match any names, which could indicate that the
  * user mistyped the nth pathspec.
  */
+static void do_match_pathspec_item(const struct pathspec *ps, int i,
+				   const char *name, int namelen,
+				   int prefix, char *seen,
+				   unsigned flags, int *retval)
+{
+	int how, exclude = flags & DO_MATCH_EXCLUDE;
+
+	if ((!exclude &&   ps->items[i].magic & PATHSPEC_EXCLUDE) ||
+	    ( exclude && !(ps->items[i].magic & PATHSPEC_EXCLUDE)))
+		return;
+
+	if (seen && seen[i] == MATCHED_EXACTLY)
+		return;
+	/*
+	 * Make exclude patterns optional and never report
+	 * "pathspec ':(exclude)foo' matches no files"
+	 */
+	if (seen && ps->items[i].magic & PATHSPEC_EXCLUDE)
+		seen[i] = MATCHED_FNMATCH;
+	how = match_pathspec_item(ps->items+i, prefix, name,
+				  namelen, flags);
+	if (ps->recursive &&
+	    (ps->magic & PATHSPEC_MAXDEPTH) &&
+	    ps->max_depth != -1 &&
+	    how && how != MATCHED_FNMATCH) {
+		int len = ps->items[i].len;
+		if (name[len] == '/')
+			len++;
+		if (within_depth(name+len, namelen-len, 0, ps->max_depth))
+			how = MATCHED_EXACTLY;
+		else
+			how = 0;
+	}
+	if (how) {
+		if (*retval < how)
+			*retval = how;
+		if (seen && seen[i] < how)
+			seen[i] = how;
+	}
+}
+
+/* Try the items of "keys" keyed by "len" bytes of "path" */
+static void do_match_pathspec_keys(const struct pathspec *ps,
+				   const struct pathspec_key *keys, int nr,
+				   const char *path, int len,
+				   const char *name, int namelen,
+				   int prefix, char *seen,
+				   unsigned flags, int *retval)
+{
+	int i, end;
+
+	for (i = pathspec_key_range(keys, nr, path, len, 1, &end); i < end; i++)
+		do_match_pathspec_item(ps, keys[i].item, name, namelen,
+				       prefix, seen, flags, retval);
+}
+
+/*
+ * Only the items that "name" or one of its leading directories is the
+ * key of (see pathspec_lookup in pathspec.h) can match it.
+ */
+static int do_match_pathspec_lookup(const struct pathspec *ps,
+				    const char *name, int namelen,
+				    int prefix, char *seen,
+				    unsigned flags)
+{
+	const struct pathspec_lookup *l = ps->lookup;
+	const char *path = name - prefix;
+	int i, pathlen = namelen + prefix, retval = 0;
+
+	for (i = 0; i < l->rest_nr; i++)
+		do_match_pathspec_item(ps, l->rest[i], name, namelen,
+				       prefix, seen, flags, &retval);
+	/* the indexed items have no exclude magic */
+	if (flags & DO_MATCH_EXCLUDE)
+		return retval;
+
+	do_match_pathspec_keys(ps, l->literal, l->literal_nr, path, pathlen,
+			       name, namelen, prefix, seen, flags, &retval);
+	if (pathlen)
+		do_match_pathspec_keys(ps, l->literal, l->literal_nr, path, 0,
+				       name, namelen, prefix, seen, flags, &retval);
+	do_match_pathspec_keys(ps, l->wildcard, l->wildcard_nr, path, 0,
+			       name, namelen, prefix, seen, flags, &retval);
+	for (i = 0; i < pathlen; i++) {
+		if (path[i] != '/')
+			continue;
+		do_match_pathspec_keys(ps, l->literal, l->literal_nr, path, i,
+				       name, namelen, prefix, seen, flags, &retval);
+		do_match_pathspec_keys(ps, l->wildcard, l->wildcard_nr, path, i,
+				       name, namelen, prefix, seen, flags, &retval);
+	}
+	/* an item that is all prefix matches everything */
+	if (prefix && prefix < pathlen &&
+	    path[prefix - 1] != '/' && path[prefix] != '/')
+		do_match_pathspec_keys(ps, l->literal, l->literal_nr, path, prefix,
+				       name, namelen, prefix, seen, flags, &retval);
+	return retval;
+}
+
 static int do_match_pathspec(const struct pathspec *ps,
 			     const char *name, int namelen,
 			     int prefix, char *seen,
 			     unsigned flags)
 {
-	int i, retval = 0, exclude = flags & DO_MATCH_EXCLUDE;
+	int i, retval = 0;
 
 	GUARD_PATHSPEC(ps,
 		       PATHSPEC_FROMTOP |
@@ -457,42 +598,13 @@ static int do_match_pathspec(const struct pathspec *ps,
 	name += prefix;
 	namelen -= prefix;
 
-	for (i = ps->nr - 1; i >= 0; i--) {
-		int how;
-
-		if ((!exclude &&   ps->items[i].magic & PATHSPEC_EXCLUDE) ||
-		    ( exclude && !(ps->items[i].magic & PATHSPEC_EXCLUDE)))
-			continue;
+	if (pathspec_use_lookup(ps) && !(flags & DO_MATCH_SUBMODULE))
+		return do_match_pathspec_lookup(ps, name, namelen,
+						prefix, seen, flags);
 
-		if (seen && seen[i] == MATCHED_EXACTLY)
-			continue;
-		/*
-		 * Make exclude patterns optional and never report
-		 * "pathspec ':(exclude)foo' matches no files"
-		 */
-		if (seen && ps->items[i].magic & PATHSPEC_EXCLUDE)
-			seen[i] = MATCHED_FNMATCH;
-		how = match_pathspec_item(ps->items+i, prefix, name,
-					  namelen, flags);
-		if (ps->recursive &&
-		    (ps->magic & PATHSPEC_MAXDEPTH) &&
-		    ps->max_depth != -1 &&
-		    how && how != MATCHED_FNMATCH) {
-			int len = ps->items[i].len;
-			if (name[len] == '/')
-				len++;
-			if (within_depth(name+len, namelen-len, 0, ps->max_depth))
-				how = MATCHED_EXACTLY;
-			else
-				how = 0;
-		}
-		if (how) {
-			if (retval < how)
-				retval = how;
-			if (seen && seen[i] < how)
-				seen[i] = how;
-		}
-	}
+	for (i = ps->nr - 1; i >= 0; i--)
+		do_match_pathspec_item(ps, i, name, namelen,
+				       prefix, seen, flags, &retval);
 	return retval;
 }
 
@@ -626,6 +738,343 @@ void parse_exclude_pattern(const char **pattern,
 	*patternlen = len;
 }
 
+struct cone_entry {
+	struct hashmap_entry ent;
+	size_t len;
+	char path[FLEX_ARRAY];
+};
+
+struct cone_key {
+	const char *path;
+	size_t len;
+};
+
+static int cone_entry_cmp(const void *unused_cmp_data,
+			  const void *entry, const void *entry_or_key,
+			  const void *keydata)
+{
+	const struct cone_entry *e1 = entry;
+	const struct cone_key *key = keydata;
+	struct cone_key k;
+
+	if (!key) {
+		const struct cone_entry *e2 = entry_or_key;
+		k.path = e2->path;
+		k.len = e2->len;
+		key = &k;
+	}
+	if (e1->len != key->len)
+		return 1;
+	return fspathncmp(e1->path, key->path, key->len);
+}
+
+static unsigned int cone_hash(const char *path, size_t len)
+{
+	return ignore_case ? memihash(path, len) : memhash(path, len);
+}
+
+static struct cone_entry *cone_hashmap_get(const struct hashmap *map,
+					   const char *path, size_t len)
+{
+	struct hashmap_entry key;
+	struct cone_key keydata;
+
+	if (!map->tablesize)
+		return NULL;
+	hashmap_entry_init(&key, cone_hash(path, len));
+	keydata.path = path;
+	keydata.len = len;
+	return hashmap_get(map, &key, &keydata);
+}
+
+static void clear_cone_hashmaps(struct exclude_list *el)
+{
+	hashmap_free(&el->recursive_hashmap, 1);
+	hashmap_free(&el->parent_hashmap, 1);
+}
+
+static void disable_cone_patterns(struct exclude_list *el)
+{
+	warning(_("disabling cone pattern matching"));
+	clear_cone_hashmaps(el);
+	el->use_cone_patterns = 0;
+}
+
+/*
+ * Remember the directory named by the cone pattern "x" in the
+ * hashmaps of its exclude_list (see the "Sparse checkout" section of
+ * git-read-tree(1) for what cone patterns look like). A positive
+ * pattern includes a directory recursively; the negative pattern
+ * excluding its subdirectories that follows turns it into a parent.
+ */
+static void add_exclude_to_hashmaps(struct exclude_list *el,
+				    const struct exclude *x)
+{
+	const char *p = x->pattern;
+	size_t i, len = x->patternlen;
+	struct cone_entry *e;
+	struct strbuf dir = STRBUF_INIT;
+
+	if (len == 2 && !strncmp(p, "/*", 2)) {
+		if (x->flags == (EXC_FLAG_NEGATIVE | EXC_FLAG_MUSTBEDIR))
+			el->full_cone = 0;
+		else if (!x->flags)
+			el->full_cone = 1;
+		else
+			goto not_cone;
+		return;
+	}
+
+	if (len < 2 || *p != '/' || strstr(p, "**"))
+		goto not_cone;
+
+	/*
+	 * Only literal directory names are allowed, except for a
+	 * trailing '*' on a negative pattern; glob characters can be
+	 * escaped with a backslash.
+	 */
+	for (i = 1; i < len; i++) {
+		if (p[i] == '\\' && i + 1 < len) {
+			strbuf_addch(&dir, p[++i]);
+			continue;
+		}
+		if (is_glob_special(p[i])) {
+			if (p[i] == '*' && i + 1 == len && p[i - 1] == '/')
+				break;
+			goto not_cone;
+		}
+		strbuf_addch(&dir, p[i]);
+	}
+
+	if (i < len) {
+		/* the parent must have been included recursively before */
+		if (!(x->flags & EXC_FLAG_NEGATIVE) || !dir.len)
+			goto not_cone;
+		strbuf_setlen(&dir, dir.len - 1);
+		e = cone_hashmap_get(&el->recursive_hashmap, dir.buf, dir.len);
+		if (!e) {
+			warning(_("unrecognized negative pattern: '%s'"), p);
+			goto disable;
+		}
+		hashmap_remove(&el->recursive_hashmap, e, NULL);
+		hashmap_add(&el->parent_hashmap, e);
+		strbuf_release(&dir);
+		return;
+	}
+
+	if (x->flags & EXC_FLAG_NEGATIVE) {
+		warning(_("unrecognized negative pattern: '%s'"), p);
+		goto disable;
+	}
+	if (cone_hashmap_get(&el->parent_hashmap, dir.buf, dir.len) ||
+	    cone_hashmap_get(&el->recursive_hashmap, dir.buf, dir.len)) {
+		warning(_("your sparse-checkout file may have issues: pattern '%s' is repeated"), p);
+		goto disable;
+	}
+	FLEX_ALLOC_MEM(e, path, dir.buf, dir.len);
+	e->len = dir.len;
+	hashmap_entry_init(e, cone_hash(e->path, e->len));
+	hashmap_add(&el->recursive_hashmap, e);
+	strbuf_release(&dir);
+	return;
+
+not_cone:
+	warning(_("unrecognized pattern: '%s'"), p);
+disable:
+	strbuf_release(&dir);
+	disable_cone_patterns(el);
+}
+
+/*
+ * Match "pathname" against the cone patterns of "el": a path below a
+ * recursively included directory is MATCHED_RECURSIVE, an entry at
+ * the top level or directly inside a parent directory is MATCHED.
+ * This takes one hash lookup per leading directory of the path, no
+ * matter how many patterns there are.
+ */
+static int path_matches_cone(const char *pathname, int pathlen,
+			     struct exclude_list *el)
+{
+	int len;
+
+	if (el->full_cone)
+		return MATCHED_RECURSIVE;
+
+	if (cone_hashmap_get(&el->recursive_hashmap, pathname, pathlen))
+		return MATCHED_RECURSIVE;
+
+	for (len = pathlen; len > 0 && pathname[len - 1] != '/'; len--)
+		; /* find the containing directory */
+	if (!len)
+		return MATCHED;
+	len--;
+	if (cone_hashmap_get(&el->parent_hashmap, pathname, len))
+		return MATCHED;
+
+	while (len > 0) {
+		if (cone_hashmap_get(&el->recursive_hashmap, pathname, len))
+			return MATCHED_RECURSIVE;
+		while (len > 0 && pathname[--len] != '/')
+			; /* go up one level */
+	}
+	return NOT_MATCHED;
+}
+
+/* lists with fewer patterns are matched one pattern after the other */
+#define EXCLUDE_LOOKUP_MIN 32
+
+struct exclude_bucket {
+	struct hashmap_entry ent;
+	const char *key;
+	size_t len;
+	/* positions in exclude_list.excludes, in increasing order */
+	int *pos, nr, alloc;
+};
+
+struct exclude_lookup {
+	struct hashmap basename;
+	struct hashmap extension;
+	struct hashmap leading_dir;
+	/* the base of the patterns in leading_dir */
+	const char *base;
+	int baselen;
+	/* the patterns that are in no bucket */
+	int *rest, rest_nr, rest_alloc;
+};
+
+static int exclude_bucket_cmp(const void *unused_cmp_data,
+			      const void *entry, const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct exclude_bucket *e1 = entry;
+	const struct cone_key *key = keydata;
+	struct cone_key k;
+
+	if (!key) {
+		const struct exclude_bucket *e2 = entry_or_key;
+		k.path = e2->key;
+		k.len = e2->len;
+		key = &k;
+	}
+	if (e1->len != key->len)
+		return 1;
+	return fspathncmp(e1->key, key->path, key->len);
+}
+
+static struct exclude_bucket *get_exclude_bucket(struct hashmap *map,
+						 const char *key, size_t len,
+						 int create)
+{
+	struct exclude_bucket *b;
+	struct hashmap_entry k;
+	struct cone_key keydata;
+
+	hashmap_entry_init(&k, cone_hash(key, len));
+	keydata.path = key;
+	keydata.len = len;
+	b = hashmap_get(map, &k, &keydata);
+	if (b || !create)
+		return b;
+	b = xcalloc(1, sizeof(*b));
+	hashmap_entry_init(b, k.hash);
+	b->key = key;
+	b->len = len;
+	hashmap_add(map, b);
+	return b;
+}
+
+/*
+ * File the pattern "x" at position "pos" of its list into the bucket
+ * of what a path needs to have for it to match:
+ *
+ *  - "name" without a slash and without wildcards matches the
+ *    basenames equal to it;
+ *
+ *  - "*name.ext" matches the basenames with the extension "ext";
+ *
+ *  - "dir/..." (or "/dir/...", or "/name") with a literal first
+ *    component matches the paths with that first component below
+ *    the directory of the exclude file.
+ *
+ * Everything else lands in "rest" and is tried for every path.
+ */
+static void add_exclude_to_lookup(struct exclude_lookup *l,
+				  const struct exclude *x, int pos)
+{
+	const char *p = x->pattern;
+	struct exclude_bucket *b = NULL;
+	int i;
+
+	if (x->flags & EXC_FLAG_NODIR) {
+		if (x->nowildcardlen == x->patternlen) {
+			b = get_exclude_bucket(&l->basename, p, x->patternlen, 1);
+		} else if (x->flags & EXC_FLAG_ENDSWITH) {
+			for (i = x->patternlen; i > 1 && p[i - 1] != '.'; i--)
+				; /* find the extension */
+			if (p[i - 1] == '.')
+				b = get_exclude_bucket(&l->extension, p + i,
+						       x->patternlen - i, 1);
+		}
+	} else if (x->baselen == l->baselen &&
+		   (!l->baselen || !strncmp(x->base, l->base, l->baselen))) {
+		int start = *p == '/';
+
+		for (i = start; i < x->patternlen && p[i] != '/'; i++)
+			; /* find the end of the first component */
+		if (i > start &&
+		    (i < x->nowildcardlen || x->nowildcardlen == x->patternlen))
+			b = get_exclude_bucket(&l->leading_dir, p + start,
+					       i - start, 1);
+	}
+
+	if (b) {
+		ALLOC_GROW(b->pos, b->nr + 1, b->alloc);
+		b->pos[b->nr++] = pos;
+	} else {
+		ALLOC_GROW(l->rest, l->rest_nr + 1, l->rest_alloc);
+		l->rest[l->rest_nr++] = pos;
+	}
+}
+
+static void prepare_exclude_lookup(struct exclude_list *el)
+{
+	struct exclude_lookup *l = xcalloc(1, sizeof(*l));
+	int i;
+
+	hashmap_init(&l->basename, exclude_bucket_cmp, NULL, 0);
+	hashmap_init(&l->extension, exclude_bucket_cmp, NULL, 0);
+	hashmap_init(&l->leading_dir, exclude_bucket_cmp, NULL, 0);
+	l->base = el->excludes[0]->base;
+	l->baselen = el->excludes[0]->baselen;
+	for (i = 0; i < el->nr; i++)
+		add_exclude_to_lookup(l, el->excludes[i], i);
+	el->lookup = l;
+}
+
+static void free_exclude_buckets(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct exclude_bucket *b;
+
+	hashmap_iter_init(map, &iter);
+	while ((b = hashmap_iter_next(&iter)))
+		free(b->pos);
+	hashmap_free(map, 1);
+}
+
+static void clear_exclude_lookup(struct exclude_list *el)
+{
+	struct exclude_lookup *l = el->lookup;
+
+	if (!l)
+		return;
+	free_exclude_buckets(&l->basename);
+	free_exclude_buckets(&l->extension);
+	free_exclude_buckets(&l->leading_dir);
+	free(l->rest);
+	FREE_AND_NULL(el->lookup);
+}
+
 void add_exclude(const char *string, const char *base,
 		 int baselen, struct exclude_list *el, int srcpos)
 {
@@ -650,6 +1099,14 @@ void add_exclude(const char *string, const char *base,
 	ALLOC_GROW(el->excludes, el->nr + 1, el->alloc);
 	el->excludes[el->nr++] = x;
 	x->el = el;
+
+	if (el->lookup)
+		add_exclude_to_lookup(el->lookup, x, el->nr - 1);
+	else if (el->nr == EXCLUDE_LOOKUP_MIN)
+		prepare_exclude_lookup(el);
+
+	if (el->use_cone_patterns)
+		add_exclude_to_hashmaps(el, x);
 }
 
 static int read_skip_worktree_file_from_index(const struct index_state *istate,
@@ -657,7 +1114,7 @@ static int read_skip_worktree_file_from_index(const struct index_state *istate,
 					      size_t *size_out, char **data_out,
 					      struct oid_stat *oid_stat)
 {
-	int pos, len;
+	int pos, len, ret;
 
 	len = strlen(path);
 	pos = index_name_pos(istate, path, len);
@@ -666,7 +1123,10 @@ static int read_skip_worktree_file_from_index(const struct index_state *istate,
 	if (!ce_skip_worktree(istate->cache[pos]))
 		return -1;
 
-	return do_read_blob(&istate->cache[pos]->oid, oid_stat, size_out, data_out);
+	scan_lock();
+	ret = do_read_blob(&istate->cache[pos]->oid, oid_stat, size_out, data_out);
+	scan_unlock();
+	return ret;
 }
 
 /*
@@ -681,6 +1141,8 @@ void clear_exclude_list(struct exclude_list *el)
 		free(el->excludes[i]);
 	free(el->excludes);
 	free(el->filebuf);
+	clear_cone_hashmaps(el);
+	clear_exclude_lookup(el);
 
 	memset(el, 0, sizeof(*el));
 }
@@ -877,6 +1339,11 @@ static int add_excludes_from_buffer(char *buf, size_t size,
 
 	el->filebuf = buf;
 
+	if (el->use_cone_patterns) {
+		hashmap_init(&el->recursive_hashmap, cone_entry_cmp, NULL, 0);
+		hashmap_init(&el->parent_hashmap, cone_entry_cmp, NULL, 0);
+	}
+
 	if (skip_utf8_bom(&buf, size))
 		size -= buf - el->filebuf;
 
@@ -1042,6 +1509,92 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+static int exclude_matches(const struct exclude *x,
+			   const char *pathname, int pathlen,
+			   const char *basename, int *dtype,
+			   struct index_state *istate)
+{
+	if (x->flags & EXC_FLAG_MUSTBEDIR) {
+		if (*dtype == DT_UNKNOWN)
+			*dtype = get_dtype(NULL, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (x->flags & EXC_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      x->pattern, x->nowildcardlen,
+				      x->patternlen, x->flags);
+
+	assert(x->baselen == 0 || x->base[x->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      x->base, x->baselen ? x->baselen - 1 : 0,
+			      x->pattern, x->nowildcardlen, x->patternlen,
+			      x->flags);
+}
+
+/*
+ * Like last_exclude_matching_from_list(), but only try the patterns
+ * in the buckets of "pathname" and those in no bucket, from the last
+ * to the first of the list.
+ */
+static struct exclude *last_exclude_matching_from_lookup(const char *pathname,
+							 int pathlen,
+							 const char *basename,
+							 int *dtype,
+							 struct exclude_list *el,
+							 struct index_state *istate)
+{
+	struct exclude_lookup *l = el->lookup;
+	int basenamelen = pathlen - (basename - pathname);
+	const struct exclude_bucket *b[3];
+	const int *list[4];
+	int nr[4], n = 0, i;
+
+	b[0] = get_exclude_bucket(&l->basename, basename, basenamelen, 0);
+	for (i = basenamelen; i > 0 && basename[i - 1] != '.'; i--)
+		; /* find the extension */
+	b[1] = i ? get_exclude_bucket(&l->extension, basename + i,
+				      basenamelen - i, 0) : NULL;
+	b[2] = NULL;
+	if (pathlen > l->baselen &&
+	    !fspathncmp(pathname, l->base, l->baselen)) {
+		const char *name = pathname + l->baselen;
+		const char *slash = memchr(name, '/', pathlen - l->baselen);
+		int len = slash ? slash - name : pathlen - l->baselen;
+
+		b[2] = get_exclude_bucket(&l->leading_dir, name, len, 0);
+	}
+
+	list[n] = l->rest;
+	nr[n++] = l->rest_nr;
+	for (i = 0; i < ARRAY_SIZE(b); i++) {
+		if (!b[i])
+			continue;
+		list[n] = b[i]->pos;
+		nr[n++] = b[i]->nr;
+	}
+
+	/* the last pattern that matches decides */
+	for (;;) {
+		int best = -1, pos = -1;
+
+		for (i = 0; i < n; i++) {
+			if (nr[i] && list[i][nr[i] - 1] > pos) {
+				pos = list[i][nr[i] - 1];
+				best = i;
+			}
+		}
+		if (best < 0)
+			return NULL;
+		nr[best]--;
+		if (exclude_matches(el->excludes[pos], pathname, pathlen,
+				    basename, dtype, istate))
+			return el->excludes[pos];
+	}
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -1055,55 +1608,37 @@ static struct exclude *last_exclude_matching_from_list(const char *pathname,
 						       struct exclude_list *el,
 						       struct index_state *istate)
 {
-	struct exclude *exc = NULL; /* undecided */
 	int i;
 
 	if (!el->nr)
 		return NULL;	/* undefined */
 
-	for (i = el->nr - 1; 0 <= i; i--) {
-		struct exclude *x = el->excludes[i];
-		const char *exclude = x->pattern;
-		int prefix = x->nowildcardlen;
-
-		if (x->flags & EXC_FLAG_MUSTBEDIR) {
-			if (*dtype == DT_UNKNOWN)
-				*dtype = get_dtype(NULL, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
+	if (el->lookup)
+		return last_exclude_matching_from_lookup(pathname, pathlen,
+							 basename, dtype,
+							 el, istate);
 
-		if (x->flags & EXC_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, x->patternlen,
-					   x->flags)) {
-				exc = x;
-				break;
-			}
-			continue;
-		}
-
-		assert(x->baselen == 0 || x->base[x->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   x->base, x->baselen ? x->baselen - 1 : 0,
-				   exclude, prefix, x->patternlen, x->flags)) {
-			exc = x;
-			break;
-		}
-	}
-	return exc;
+	for (i = el->nr - 1; 0 <= i; i--)
+		if (exclude_matches(el->excludes[i], pathname, pathlen,
+				    basename, dtype, istate))
+			return el->excludes[i];
+	return NULL;
 }
 
 /*
  * Scan the list and let the last match determine the fate.
- * Return 1 for exclude, 0 for include and -1 for undecided.
+ * Return 1 for exclude, 0 for include and -1 for undecided. With cone
+ * patterns, the result is never undecided and may be MATCHED_RECURSIVE.
  */
 int is_excluded_from_list(const char *pathname,
 			  int pathlen, const char *basename, int *dtype,
 			  struct exclude_list *el, struct index_state *istate)
 {
 	struct exclude *exclude;
+
+	if (el->use_cone_patterns)
+		return path_matches_cone(pathname, pathlen, el);
+
 	exclude = last_exclude_matching_from_list(pathname, pathlen, basename,
 						  dtype, el, istate);
 	if (exclude)
@@ -1111,17 +1646,35 @@ int is_excluded_from_list(const char *pathname,
 	return -1; /* undecided */
 }
 
+static void read_unread_excludes(struct dir_struct *dir,
+				 struct index_state *istate,
+				 struct exclude_list *el)
+{
+	el->unread = 0;
+	add_excludes(el->src, el->src,
+		     strlen(el->src) - strlen(dir->exclude_per_dir),
+		     el, istate, NULL);
+}
+
+/*
+ * Match against the lists of all groups, but only the first "dirs_nr"
+ * lists of EXC_DIRS, i.e. those of the directories above the one
+ * whose list is next.
+ */
 static struct exclude *last_exclude_matching_from_lists(struct dir_struct *dir,
 							struct index_state *istate,
 		const char *pathname, int pathlen, const char *basename,
-		int *dtype_p)
+		int *dtype_p, int dirs_nr)
 {
 	int i, j;
 	struct exclude_list_group *group;
 	struct exclude *exclude;
 	for (i = EXC_CMDL; i <= EXC_FILE; i++) {
 		group = &dir->exclude_list_group[i];
-		for (j = group->nr - 1; j >= 0; j--) {
+		j = i == EXC_DIRS ? dirs_nr : group->nr;
+		for (j--; j >= 0; j--) {
+			if (group->el[j].unread)
+				read_unread_excludes(dir, istate, &group->el[j]);
 			exclude = last_exclude_matching_from_list(
 				pathname, pathlen, basename, dtype_p,
 				&group->el[j], istate);
@@ -1132,6 +1685,87 @@ static struct exclude *last_exclude_matching_from_lists(struct dir_struct *dir,
 	return NULL;
 }
 
+static void pop_exclude_stack(struct dir_struct *dir)
+{
+	struct exclude_list_group *group = &dir->exclude_list_group[EXC_DIRS];
+	struct exclude_stack *stk = dir->exclude_stack;
+	struct exclude_list *el = &group->el[stk->exclude_ix];
+
+	dir->exclude_stack = stk->prev;
+	free((char *)el->src); /* see strbuf_detach() in prep_exclude() */
+	clear_exclude_list(el);
+	free(stk);
+	group->nr--;
+}
+
+/*
+ * Is the directory of "stk", whose path dir->basebuf starts with,
+ * excluded by the lists of the directories above it?
+ */
+static struct exclude *exclude_directory(struct dir_struct *dir,
+					 struct index_state *istate,
+					 struct exclude_stack *stk)
+{
+	int current = stk->prev ? stk->prev->baselen : 0;
+	struct exclude *exclude;
+	int dt = DT_DIR;
+
+	dir->basebuf.buf[stk->baselen - 1] = 0;
+	exclude = last_exclude_matching_from_lists(dir, istate,
+		dir->basebuf.buf, stk->baselen - 1,
+		dir->basebuf.buf + current, &dt, stk->exclude_ix);
+	dir->basebuf.buf[stk->baselen - 1] = '/';
+	if (exclude && exclude->flags & EXC_FLAG_NEGATIVE)
+		exclude = NULL;
+	return exclude;
+}
+
+static struct exclude_stack *check_unchecked(struct dir_struct *dir,
+					     struct index_state *istate,
+					     struct exclude_stack *stk)
+{
+	struct exclude_stack *excluded;
+
+	if (!stk)
+		return NULL;
+	excluded = check_unchecked(dir, istate, stk->prev);
+	if (excluded || !stk->unchecked)
+		return excluded;
+	stk->unchecked = 0;
+	dir->exclude = exclude_directory(dir, istate, stk);
+	return dir->exclude ? stk : NULL;
+}
+
+/*
+ * Find out, from the top-level directory down, whether those that prep_exclude()
+ * left unchecked are excluded. As if prep_exclude() had stopped there,
+ * drop what it pushed for the directories below an excluded one.
+ */
+static void check_unchecked_directories(struct dir_struct *dir,
+					struct index_state *istate)
+{
+	struct exclude_stack *excluded;
+
+	excluded = check_unchecked(dir, istate, dir->exclude_stack);
+	if (!excluded)
+		return;
+	while (dir->exclude_stack != excluded)
+		pop_exclude_stack(dir);
+}
+
+/* Leave nothing on the stack for matching paths to finish up */
+static void read_unread_directories(struct dir_struct *dir,
+				    struct index_state *istate)
+{
+	struct exclude_list_group *group = &dir->exclude_list_group[EXC_DIRS];
+	int i;
+
+	check_unchecked_directories(dir, istate);
+	for (i = 0; i < group->nr; i++)
+		if (group->el[i].unread)
+			read_unread_excludes(dir, istate, &group->el[i]);
+}
+
 /*
  * Loads the per-directory exclude list for the substring of base
  * which has a char length of baselen.
@@ -1157,13 +1791,8 @@ static void prep_exclude(struct dir_struct *dir,
 		if (stk->baselen <= baselen &&
 		    !strncmp(dir->basebuf.buf, base, stk->baselen))
 			break;
-		el = &group->el[dir->exclude_stack->exclude_ix];
-		dir->exclude_stack = stk->prev;
+		pop_exclude_stack(dir);
 		dir->exclude = NULL;
-		free((char *)el->src); /* see strbuf_detach() below */
-		clear_exclude_list(el);
-		free(stk);
-		group->nr--;
 	}
 
 	/* Skip traversing into sub directories if the parent is excluded */
@@ -1189,8 +1818,8 @@ static void prep_exclude(struct dir_struct *dir,
 	while (current < baselen) {
 		const char *cp;
 		struct oid_stat oid_stat;
+		int trusted;
 
-		stk = xcalloc(1, sizeof(*stk));
 		if (current < 0) {
 			cp = base;
 			current = 0;
@@ -1204,6 +1833,23 @@ static void prep_exclude(struct dir_struct *dir,
 						 base + current,
 						 cp - base - current);
 		}
+
+		/*
+		 * With fsmonitor, neither a directory the untracked cache
+		 * has valid data for nor its .gitignore has changed: leave
+		 * reading that file, and finding out whether the directory
+		 * is excluded, until a path in it needs to be matched,
+		 * which may well never happen.
+		 */
+		trusted = untracked && untracked->valid &&
+			dir->untracked->use_fsmonitor;
+		if (!trusted && cp != base) {
+			check_unchecked_directories(dir, istate);
+			if (dir->exclude)
+				return;
+		}
+
+		stk = xcalloc(1, sizeof(*stk));
 		stk->prev = dir->exclude_stack;
 		stk->baselen = cp - base;
 		stk->exclude_ix = group->nr;
@@ -1213,17 +1859,10 @@ static void prep_exclude(struct dir_struct *dir,
 		assert(stk->baselen == dir->basebuf.len);
 
 		/* Abort if the directory is excluded */
-		if (stk->baselen) {
-			int dt = DT_DIR;
-			dir->basebuf.buf[stk->baselen - 1] = 0;
-			dir->exclude = last_exclude_matching_from_lists(dir,
-									istate,
-				dir->basebuf.buf, stk->baselen - 1,
-				dir->basebuf.buf + current, &dt);
-			dir->basebuf.buf[stk->baselen - 1] = '/';
-			if (dir->exclude &&
-			    dir->exclude->flags & EXC_FLAG_NEGATIVE)
-				dir->exclude = NULL;
+		if (stk->baselen && trusted) {
+			stk->unchecked = 1;
+		} else if (stk->baselen) {
+			dir->exclude = exclude_directory(dir, istate, stk);
 			if (dir->exclude) {
 				dir->exclude_stack = stk;
 				return;
@@ -1259,24 +1898,20 @@ static void prep_exclude(struct dir_struct *dir,
 			strbuf_addbuf(&sb, &dir->basebuf);
 			strbuf_addstr(&sb, dir->exclude_per_dir);
 			el->src = strbuf_detach(&sb, NULL);
-			add_excludes(el->src, el->src, stk->baselen, el, istate,
-				     untracked ? &oid_stat : NULL);
+			if (trusted)
+				el->unread = 1;
+			else
+				add_excludes(el->src, el->src, stk->baselen,
+					     el, istate,
+					     untracked ? &oid_stat : NULL);
 		}
 		/*
-		 * NEEDSWORK: when untracked cache is enabled, prep_exclude()
-		 * will first be called in valid_cached_dir() then maybe many
-		 * times more in last_exclude_matching(). When the cache is
-		 * used, last_exclude_matching() will not be called and
-		 * reading .gitignore content will be a waste.
-		 *
-		 * So when it's called by valid_cached_dir() and we can get
-		 * .gitignore SHA-1 from the index (i.e. .gitignore is not
-		 * modified on work tree), we could delay reading the
-		 * .gitignore content until we absolutely need it in
-		 * last_exclude_matching(). Be careful about ignore rule
-		 * order, though, if you do that.
+		 * NEEDSWORK: without fsmonitor, the untracked cache cannot
+		 * tell whether .gitignore changed without reading it, so
+		 * its contents are read even when the cache is then used
+		 * and last_exclude_matching() is never called.
 		 */
-		if (untracked &&
+		if (untracked && !trusted &&
 		    oidcmp(&oid_stat.oid, &untracked->exclude_oid)) {
 			invalidate_gitignore(dir->untracked, untracked);
 			oidcpy(&untracked->exclude_oid, &oid_stat.oid);
@@ -1303,12 +1938,14 @@ struct exclude *last_exclude_matching(struct dir_struct *dir,
 	basename = (basename) ? basename+1 : pathname;
 
 	prep_exclude(dir, istate, pathname, basename-pathname);
+	check_unchecked_directories(dir, istate);
 
 	if (dir->exclude)
 		return dir->exclude;
 
 	return last_exclude_matching_from_lists(dir, istate, pathname, pathlen,
-			basename, dtype_p);
+			basename, dtype_p,
+			dir->exclude_list_group[EXC_DIRS].nr);
 }
 
 /*
@@ -1494,7 +2131,12 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 		}
 		if (!(dir->flags & DIR_NO_GITLINKS)) {
 			struct object_id oid;
-			if (resolve_gitlink_ref(dirname, "HEAD", &oid) == 0)
+			int is_gitlink;
+
+			scan_lock();
+			is_gitlink = !resolve_gitlink_ref(dirname, "HEAD", &oid);
+			scan_unlock();
+			if (is_gitlink)
 				return exclude ? path_excluded : path_untracked;
 		}
 		return path_recurse;
@@ -1969,12 +2611,16 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 			ud = lookup_untracked(dir->untracked, untracked,
 					      path.buf + baselen,
 					      path.len - baselen);
-			subdir_state =
-				read_directory_recursive(dir, istate, path.buf,
-							 path.len, ud,
-							 check_only, stop_at_first_file, pathspec);
-			if (subdir_state > dir_state)
-				dir_state = subdir_state;
+			if (dir->walk_queue && !check_only) {
+				queue_subdir(dir->walk_queue, &path, ud);
+			} else {
+				subdir_state =
+					read_directory_recursive(dir, istate, path.buf,
+								 path.len, ud,
+								 check_only, stop_at_first_file, pathspec);
+				if (subdir_state > dir_state)
+					dir_state = subdir_state;
+			}
 		}
 
 		if (check_only) {
@@ -2259,6 +2905,226 @@ static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *d
 	return root;
 }
 
+/* Mostly arbitrary: few work trees have more top-level directories. */
+#define MAX_UNTRACKED_THREADS (32)
+
+/*
+ * Read core.untrackedThreads: 0 or "true" picks the number of CPUs,
+ * 1 or "false" (the default) scans the work tree on a single thread.
+ */
+static int get_untracked_threads(void)
+{
+	static int threads = -1;
+	int is_bool, val;
+
+	if (threads >= 0)
+		return threads;
+
+	threads = git_env_ulong("GIT_TEST_UNTRACKED_THREADS", 0);
+	if (!threads) {
+		if (!git_config_get_bool_or_int("core.untrackedthreads",
+						&is_bool, &val))
+			threads = is_bool ? !val : val;
+		else
+			threads = 1;
+	}
+	if (threads <= 0)
+		threads = online_cpus();
+	if (threads > MAX_UNTRACKED_THREADS)
+		threads = MAX_UNTRACKED_THREADS;
+	return threads;
+}
+
+static void scan_queued_subdirs(struct dir_struct *dir,
+				struct index_state *istate,
+				struct dir_walk_queue *queue,
+				const struct pathspec *pathspec)
+{
+	while (queue->next < queue->nr) {
+		struct dir_walk_item *item = &queue->items[queue->next++];
+
+		read_directory_recursive(dir, istate, item->path, item->len,
+					 item->untracked, 0, 0, pathspec);
+	}
+}
+
+#ifndef NO_PTHREADS
+struct untracked_thread {
+	pthread_t pthread;
+	struct dir_struct dir;
+	struct untracked_cache uc;
+	struct index_state *istate;
+	struct dir_walk_queue *queue;
+	const struct pathspec *pathspec;
+};
+
+static pthread_mutex_t walk_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *untracked_thread_proc(void *_data)
+{
+	struct untracked_thread *p = _data;
+	struct dir_walk_queue *queue = p->queue;
+
+	for (;;) {
+		struct dir_walk_item *item = NULL;
+
+		pthread_mutex_lock(&walk_queue_mutex);
+		if (queue->next < queue->nr)
+			item = &queue->items[queue->next++];
+		pthread_mutex_unlock(&walk_queue_mutex);
+		if (!item)
+			break;
+		read_directory_recursive(&p->dir, p->istate, item->path,
+					 item->len, item->untracked, 0, 0,
+					 p->pathspec);
+	}
+	return NULL;
+}
+
+/*
+ * Give a thread its own view of "dir": result lists, a copy of the
+ * per-directory exclude lists that it can push to and pop from, and
+ * untracked cache statistics. The exclude lists read so far (those of
+ * the top-level directory and its parents) and the untracked cache
+ * nodes are shared; each thread only modifies the nodes of the
+ * subdirectories it scans.
+ */
+static void init_untracked_thread(struct untracked_thread *p,
+				  const struct dir_struct *dir)
+{
+	struct exclude_list_group *group;
+
+	p->dir = *dir;
+	p->dir.nr = p->dir.alloc = 0;
+	p->dir.entries = NULL;
+	p->dir.ignored_nr = p->dir.ignored_alloc = 0;
+	p->dir.ignored = NULL;
+
+	group = &p->dir.exclude_list_group[EXC_DIRS];
+	ALLOC_ARRAY(group->el, group->nr);
+	COPY_ARRAY(group->el, dir->exclude_list_group[EXC_DIRS].el, group->nr);
+	group->alloc = group->nr;
+
+	strbuf_init(&p->dir.basebuf, dir->basebuf.len);
+	strbuf_addbuf(&p->dir.basebuf, &dir->basebuf);
+
+	if (dir->untracked) {
+		p->uc = *dir->untracked;
+		p->uc.dir_created = 0;
+		p->uc.gitignore_invalidated = 0;
+		p->uc.dir_invalidated = 0;
+		p->uc.dir_opened = 0;
+		p->dir.untracked = &p->uc;
+	}
+}
+
+/* Hand the results of a thread back to "dir" and release the rest. */
+static void merge_untracked_thread(struct dir_struct *dir,
+				   struct untracked_thread *p)
+{
+	struct exclude_list_group *group = &p->dir.exclude_list_group[EXC_DIRS];
+
+	ALLOC_GROW(dir->entries, dir->nr + p->dir.nr, dir->alloc);
+	COPY_ARRAY(dir->entries + dir->nr, p->dir.entries, p->dir.nr);
+	dir->nr += p->dir.nr;
+	free(p->dir.entries);
+
+	ALLOC_GROW(dir->ignored, dir->ignored_nr + p->dir.ignored_nr,
+		   dir->ignored_alloc);
+	COPY_ARRAY(dir->ignored + dir->ignored_nr, p->dir.ignored,
+		   p->dir.ignored_nr);
+	dir->ignored_nr += p->dir.ignored_nr;
+	free(p->dir.ignored);
+
+	/* pop what the thread pushed on top of the shared exclude lists */
+	while (p->dir.exclude_stack != dir->exclude_stack) {
+		struct exclude_stack *stk = p->dir.exclude_stack;
+		struct exclude_list *el = &group->el[stk->exclude_ix];
+
+		p->dir.exclude_stack = stk->prev;
+		free((char *)el->src);
+		clear_exclude_list(el);
+		free(stk);
+	}
+	free(group->el);
+	strbuf_release(&p->dir.basebuf);
+
+	if (dir->untracked) {
+		dir->untracked->dir_created += p->uc.dir_created;
+		dir->untracked->gitignore_invalidated += p->uc.gitignore_invalidated;
+		dir->untracked->dir_invalidated += p->uc.dir_invalidated;
+		dir->untracked->dir_opened += p->uc.dir_opened;
+	}
+}
+#endif
+
+/*
+ * Scan the top-level directory on this thread, and the subdirectories
+ * it contains on up to "nr_threads" threads. Each subdirectory is
+ * scanned as a whole by the thread that picked it, with exclude lists
+ * pushed and popped on a stack of its own; read_directory() sorts the
+ * merged results.
+ */
+static void read_directory_threaded(struct dir_struct *dir,
+				    struct index_state *istate,
+				    const char *path, int len,
+				    struct untracked_cache_dir *untracked,
+				    const struct pathspec *pathspec,
+				    int nr_threads)
+{
+	struct dir_walk_queue queue = { NULL };
+	int i;
+
+	dir->walk_queue = &queue;
+	read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+	dir->walk_queue = NULL;
+
+#ifndef NO_PTHREADS
+	if (nr_threads > queue.nr)
+		nr_threads = queue.nr;
+	if (nr_threads > 1) {
+		struct untracked_thread *threads;
+
+		/*
+		 * Leave only the exclude lists of "path" and its parents
+		 * on the stack, which the threads then share.
+		 */
+		prep_exclude(dir, istate, path, len);
+
+		/* set up what the threads would otherwise race to set up */
+		read_unread_directories(dir, istate);
+		index_dir_exists(istate, "", 0);
+		if (dir->untracked)
+			refresh_fsmonitor(istate);
+
+		threads = xcalloc(nr_threads, sizeof(*threads));
+		for (i = 0; i < nr_threads; i++) {
+			struct untracked_thread *p = &threads[i];
+
+			init_untracked_thread(p, dir);
+			p->istate = istate;
+			p->queue = &queue;
+			p->pathspec = pathspec;
+			if (pthread_create(&p->pthread, NULL,
+					   untracked_thread_proc, p))
+				die("unable to create threaded directory scan");
+		}
+		for (i = 0; i < nr_threads; i++) {
+			if (pthread_join(threads[i].pthread, NULL))
+				die("unable to join threaded directory scan");
+			merge_untracked_thread(dir, &threads[i]);
+		}
+		free(threads);
+	}
+#endif
+	/* whatever is left, e.g. when there were too few subdirectories */
+	scan_queued_subdirs(dir, istate, &queue, pathspec);
+
+	for (i = 0; i < queue.nr; i++)
+		free(queue.items[i].path);
+	free(queue.items);
+}
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
@@ -2268,6 +3134,7 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 	if (has_symlink_leading_path(path, len))
 		return dir->nr;
 
+	trace2_region_enter("dir", "read_directory");
 	untracked = validate_untracked_cache(dir, len, pathspec);
 	if (!untracked)
 		/*
@@ -2275,11 +3142,37 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
-		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+	if (!len || treat_leading_path(dir, istate, path, len, pathspec)) {
+		int nr_threads = get_untracked_threads();
+
+		/* looking paths up may expand a sparse index */
+		if (nr_threads > 1 && !istate->sparse_index)
+			read_directory_threaded(dir, istate, path, len,
+						untracked, pathspec, nr_threads);
+		else
+			read_directory_recursive(dir, istate, path, len,
+						 untracked, 0, 0, pathspec);
+	}
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
+	/*
+	 * The untracked cache lists an untracked directory among the
+	 * untracked paths of its parent, and also has it checked again
+	 * for untracked contents, which adds it a second time.
+	 */
+	if (untracked) {
+		int i, j;
+
+		for (i = j = 0; j < dir->nr; j++) {
+			if (i && !cmp_dir_entry(&dir->entries[i - 1], &dir->entries[j]))
+				FREE_AND_NULL(dir->entries[j]);
+			else
+				dir->entries[i++] = dir->entries[j];
+		}
+		dir->nr = i;
+	}
+
 	/*
 	 * If DIR_SHOW_IGNORED_TOO is set, read_directory_recursive() will
 	 * also pick up untracked contents of untracked dirs; by default
@@ -2302,6 +3195,9 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		dir->nr = i;
 	}
 
+	trace2_region_leave("dir", "read_directory");
+	trace2_data_intmax("dir", "read_directory/untracked", dir->nr);
+	trace2_data_intmax("dir", "read_directory/ignored", dir->ignored_nr);
 	trace_performance_since(start, "read directory %.*s", len, path);
 	if (dir->untracked) {
 		static int force_untracked_cache = -1;
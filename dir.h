@@ -55,6 +55,43 @@ struct exclude_list {
 	const char *src;
 
 	struct exclude **excludes;
+
+	/*
+	 * With "cone" patterns (see core.sparseCheckoutCone), the list
+	 * only names directories, and is matched by looking up the
+	 * leading directories of a path in these hashmaps instead of
+	 * trying every pattern in turn:
+	 *
+	 *  - recursive_hashmap holds the directories whose contents are
+	 *    all included;
+	 *
+	 *  - parent_hashmap holds the directories whose files, but not
+	 *    their subdirectories, are included.
+	 *
+	 * "full_cone" is set when everything is included. Patterns that
+	 * do not fit cone mode disable it with a warning, falling back
+	 * to regular matching.
+	 */
+	unsigned use_cone_patterns : 1,
+		 full_cone : 1;
+
+	struct hashmap recursive_hashmap;
+	struct hashmap parent_hashmap;
+
+	/*
+	 * Long lists also sort their patterns into buckets by the
+	 * basename, extension or leading directory a matching path must
+	 * have, so that a path is only matched against the few patterns
+	 * that could match it (see add_exclude_to_lookup() in dir.c).
+	 */
+	struct exclude_lookup *lookup;
+
+	/*
+	 * Set for a per-directory file that the untracked cache and
+	 * fsmonitor vouch has not changed: its patterns are only read
+	 * when a path is matched against them.
+	 */
+	unsigned unread : 1;
 };
 
 /*
@@ -68,6 +105,8 @@ struct exclude_stack {
 	int baselen;
 	int exclude_ix; /* index of exclude_list within EXC_DIRS exclude_list_group */
 	struct untracked_cache_dir *ucd;
+	/* whether the directory is excluded is yet to be found out */
+	unsigned unchecked : 1;
 };
 
 struct exclude_list_group {
@@ -199,6 +238,13 @@ struct dir_struct {
 	struct oid_stat ss_info_exclude;
 	struct oid_stat ss_excludes_file;
 	unsigned unmanaged_exclude_files;
+
+	/*
+	 * When set, the top-level directory scan queues the
+	 * subdirectories it would recurse into here, so that
+	 * read_directory() can scan them on several threads.
+	 */
+	struct dir_walk_queue *walk_queue;
 };
 
 /*Count the number of slashes for string s*/
@@ -229,6 +275,19 @@ extern int read_directory(struct dir_struct *, struct index_state *istate,
 			  const char *path, int len,
 			  const struct pathspec *pathspec);
 
+/*
+ * The result of matching a path against an exclude_list: UNDECIDED
+ * when no pattern matches, MATCHED or NOT_MATCHED following the last
+ * pattern that matches. In cone mode a directory may also be
+ * MATCHED_RECURSIVE, meaning that everything below it is included.
+ */
+enum pattern_match_result {
+	UNDECIDED = -1,
+	NOT_MATCHED = 0,
+	MATCHED = 1,
+	MATCHED_RECURSIVE = 2
+};
+
 extern int is_excluded_from_list(const char *pathname, int pathlen,
 				 const char *basename, int *dtype,
 				 struct exclude_list *el,
@@ -31,6 +31,7 @@ int warn_on_object_refname_ambiguity = 1;
 int ref_paranoia = -1;
 int repository_format_precious_objects;
 char *repository_format_partial_clone;
+char *repository_format_ref_storage;
 const char *core_partial_clone_filter_default;
 const char *git_commit_encoding;
 const char *git_log_output_encoding;
@@ -45,6 +46,9 @@ int fsync_object_files;
 size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
 size_t delta_base_cache_limit = 96 * 1024 * 1024;
+size_t tree_cache_limit = 32 * 1024 * 1024;
+int core_compact_object_walk;
+enum delta_base_cache_policy delta_base_cache_policy = DELTA_BASE_CACHE_ARC;
 unsigned long big_file_threshold = 512 * 1024 * 1024;
 int pager_use_color = 1;
 const char *editor_program;
@@ -64,10 +68,14 @@ enum push_default_type push_default = PUSH_DEFAULT_UNSPECIFIED;
 #define OBJECT_CREATION_MODE OBJECT_CREATION_USES_HARDLINKS
 #endif
 enum object_creation_mode object_creation_mode = OBJECT_CREATION_MODE;
+enum fsync_method fsync_method = FSYNC_METHOD_FSYNC;
 char *notes_ref_name;
 int grafts_replace_parents = 1;
 int core_commit_graph;
+int core_multi_pack_index;
 int core_apply_sparse_checkout;
+int core_sparse_checkout_cone;
+int command_requires_full_index = 1;
 int merge_log_config = -1;
 int precomposed_unicode = -1; /* see probe_utf8_pathname_composition() */
 unsigned long pack_size_limit_cfg;
@@ -84,6 +92,7 @@ int protect_hfs = PROTECT_HFS_DEFAULT;
 #endif
 int protect_ntfs = PROTECT_NTFS_DEFAULT;
 const char *core_fsmonitor;
+int core_fsmonitor_use_daemon;
 
 /*
  * The character that begins a commented line in user-editable file
@@ -94,6 +103,10 @@ int auto_comment_line_char;
 
 /* Parallel index stat data preload? */
 int core_preload_index = 1;
+int core_bulk_stat;
+
+/* Look loose objects up in a cache for quick existence checks? */
+int core_loose_object_cache;
 
 /*
  * This is a hack for test programs like test-dump-untracked-cache to
@@ -18,6 +18,7 @@
  */
 #include "cache.h"
 #include "ewok.h"
+#include "ewok_rlw.h"
 
 #define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
 #define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
@@ -30,21 +31,37 @@ struct bitmap *bitmap_new(void)
 	return bitmap;
 }
 
+/* Make room for "nr" words in "self", the new ones all zeroes */
+static void bitmap_grow(struct bitmap *self, size_t nr)
+{
+	size_t old_size = self->word_alloc;
+
+	if (nr <= old_size)
+		return;
+	self->word_alloc = nr;
+	REALLOC_ARRAY(self->words, self->word_alloc);
+	memset(self->words + old_size, 0x0,
+		(self->word_alloc - old_size) * sizeof(eword_t));
+}
+
 void bitmap_set(struct bitmap *self, size_t pos)
 {
 	size_t block = EWAH_BLOCK(pos);
 
-	if (block >= self->word_alloc) {
-		size_t old_size = self->word_alloc;
-		self->word_alloc = block * 2;
-		REALLOC_ARRAY(self->words, self->word_alloc);
-		memset(self->words + old_size, 0x0,
-			(self->word_alloc - old_size) * sizeof(eword_t));
-	}
+	if (block >= self->word_alloc)
+		bitmap_grow(self, block * 2);
 
 	self->words[block] |= EWAH_MASK(pos);
 }
 
+void bitmap_unset(struct bitmap *self, size_t pos)
+{
+	size_t block = EWAH_BLOCK(pos);
+
+	if (block < self->word_alloc)
+		self->words[block] &= ~EWAH_MASK(pos);
+}
+
 int bitmap_get(struct bitmap *self, size_t pos)
 {
 	size_t block = EWAH_BLOCK(pos);
@@ -79,21 +96,61 @@ struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
 	return ewah;
 }
 
-struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
+/* The number of words "ewah" decompresses to */
+static size_t ewah_word_count(const struct ewah_bitmap *ewah)
 {
-	struct bitmap *bitmap = bitmap_new();
-	struct ewah_iterator it;
-	eword_t blowup;
-	size_t i = 0;
+	size_t pointer = 0, nr = 0;
 
-	ewah_iterator_init(&it, ewah);
+	while (pointer < ewah->buffer_size) {
+		const eword_t *rlw = &ewah->buffer[pointer];
+		size_t literals = rlw_get_literal_words(rlw);
 
-	while (ewah_iterator_next(&blowup, &it)) {
-		ALLOC_GROW(bitmap->words, i + 1, bitmap->word_alloc);
-		bitmap->words[i++] = blowup;
+		nr += rlw_get_running_len(rlw) + literals;
+		pointer += 1 + literals;
 	}
+	return nr;
+}
 
-	bitmap->word_alloc = i;
+/*
+ * OR "ewah" into the first words of "self", which must have room for
+ * all of them. The marker words are read directly rather than through
+ * an ewah_iterator, so that runs of zeroes are skipped and runs of ones
+ * filled in one go, and only literal words are combined one by one, in
+ * a loop the compiler can vectorize.
+ */
+static void or_ewah_words(struct bitmap *self, const struct ewah_bitmap *ewah)
+{
+	eword_t *words = self->words;
+	size_t pointer = 0, pos = 0;
+
+	while (pointer < ewah->buffer_size) {
+		const eword_t *rlw = &ewah->buffer[pointer];
+		size_t run = rlw_get_running_len(rlw);
+		size_t literals = rlw_get_literal_words(rlw);
+		const eword_t *in = rlw + 1;
+		size_t i;
+
+		if (pointer + 1 + literals > ewah->buffer_size)
+			literals = ewah->buffer_size - pointer - 1;
+
+		if (rlw_get_run_bit(rlw))
+			memset(words + pos, 0xff, run * sizeof(eword_t));
+		pos += run;
+
+		for (i = 0; i < literals; i++)
+			words[pos + i] |= in[i];
+		pos += literals;
+		pointer += 1 + literals;
+	}
+}
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
+{
+	struct bitmap *bitmap = xmalloc(sizeof(struct bitmap));
+
+	bitmap->word_alloc = ewah_word_count(ewah);
+	bitmap->words = xcalloc(bitmap->word_alloc, sizeof(eword_t));
+	or_ewah_words(bitmap, ewah);
 	return bitmap;
 }
 
@@ -110,23 +167,20 @@ void bitmap_and_not(struct bitmap *self, struct bitmap *other)
 
 void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
-	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
-	struct ewah_iterator it;
-	eword_t word;
-
-	if (self->word_alloc < other_final) {
-		self->word_alloc = other_final;
-		REALLOC_ARRAY(self->words, self->word_alloc);
-		memset(self->words + original_size, 0x0,
-			(self->word_alloc - original_size) * sizeof(eword_t));
-	}
+	size_t other_words = ewah_word_count(other);
+
+	bitmap_grow(self, other_final > other_words ? other_final : other_words);
+	or_ewah_words(self, other);
+}
 
-	ewah_iterator_init(&it, other);
+void bitmap_or(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i;
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	bitmap_grow(self, other->word_alloc);
+	for (i = 0; i < other->word_alloc; i++)
+		self->words[i] |= other->words[i];
 }
 
 size_t bitmap_popcount(struct bitmap *self)
@@ -139,6 +193,38 @@ size_t bitmap_popcount(struct bitmap *self)
 	return count;
 }
 
+size_t bitmap_and_ewah_popcount(struct bitmap *self, struct ewah_bitmap *mask)
+{
+	size_t pointer = 0, pos = 0, count = 0;
+
+	while (pointer < mask->buffer_size && pos < self->word_alloc) {
+		const eword_t *rlw = &mask->buffer[pointer];
+		size_t run = rlw_get_running_len(rlw);
+		size_t literals = rlw_get_literal_words(rlw);
+		const eword_t *in = rlw + 1;
+		size_t i;
+
+		if (pointer + 1 + literals > mask->buffer_size)
+			literals = mask->buffer_size - pointer - 1;
+
+		if (run > self->word_alloc - pos)
+			run = self->word_alloc - pos;
+		if (rlw_get_run_bit(rlw))
+			for (i = 0; i < run; i++)
+				count += ewah_bit_popcount64(self->words[pos + i]);
+		pos += run;
+
+		if (literals > self->word_alloc - pos)
+			literals = self->word_alloc - pos;
+		for (i = 0; i < literals; i++)
+			count += ewah_bit_popcount64(self->words[pos + i] & in[i]);
+		pos += literals;
+		pointer += 1 + literals;
+	}
+
+	return count;
+}
+
 int bitmap_equals(struct bitmap *self, struct bitmap *other)
 {
 	struct bitmap *big, *small;
@@ -364,6 +364,23 @@ int ewah_iterator_next(eword_t *next, struct ewah_iterator *it)
 	return 1;
 }
 
+size_t ewah_iterator_skip_zeroes(struct ewah_iterator *it)
+{
+	size_t skipped = 0;
+
+	while (it->pointer < it->buffer_size &&
+	       !it->b && it->compressed < it->rl) {
+		skipped += it->rl - it->compressed;
+		it->compressed = it->rl;
+
+		if (it->literals == it->lw &&
+		    ++it->pointer < it->buffer_size)
+			read_new_rlw(it);
+	}
+
+	return skipped;
+}
+
 void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
 {
 	it->buffer = parent->buffer;
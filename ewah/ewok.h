@@ -24,11 +24,15 @@ typedef uint64_t eword_t;
 #define BITS_IN_EWORD (sizeof(eword_t) * 8)
 
 /**
- * Do not use __builtin_popcountll. The GCC implementation
- * is notoriously slow on all platforms.
+ * Do not use __builtin_popcountll unless the target has a popcount
+ * instruction. The GCC implementation is notoriously slow on all
+ * platforms otherwise.
  *
  * See: http://gcc.gnu.org/bugzilla/show_bug.cgi?id=36041
  */
+#if defined(__GNUC__) && defined(__POPCNT__)
+#define ewah_bit_popcount64(x) ((uint32_t)__builtin_popcountll(x))
+#else
 static inline uint32_t ewah_bit_popcount64(uint64_t x)
 {
 	x = (x & 0x5555555555555555ULL) + ((x >>  1) & 0x5555555555555555ULL);
@@ -36,6 +40,7 @@ static inline uint32_t ewah_bit_popcount64(uint64_t x)
 	x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >>  4) & 0x0F0F0F0F0F0F0F0FULL);
 	return (x * 0x0101010101010101ULL) >> 56;
 }
+#endif
 
 /* __builtin_ctzll was not available until 3.4.0 */
 #if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3  && __GNUC_MINOR > 3))
@@ -148,6 +153,13 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
  */
 int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
 
+/**
+ * Skip the words of zeroes the iterator is at, if any, without
+ * yielding them one by one. Return how many were skipped, so that
+ * callers can keep track of their position in the bitmap.
+ */
+size_t ewah_iterator_skip_zeroes(struct ewah_iterator *it);
+
 void ewah_xor(
 	struct ewah_bitmap *ewah_i,
 	struct ewah_bitmap *ewah_j,
@@ -173,6 +185,7 @@ struct bitmap {
 
 struct bitmap *bitmap_new(void);
 void bitmap_set(struct bitmap *self, size_t pos);
+void bitmap_unset(struct bitmap *self, size_t pos);
 int bitmap_get(struct bitmap *self, size_t pos);
 void bitmap_reset(struct bitmap *self);
 void bitmap_free(struct bitmap *self);
@@ -188,4 +201,10 @@ void bitmap_or(struct bitmap *self, const struct bitmap *other);
 
 size_t bitmap_popcount(struct bitmap *self);
 
+/*
+ * The number of bits set in both "self" and "mask", without
+ * decompressing "mask": its runs of zeroes are skipped.
+ */
+size_t bitmap_and_ewah_popcount(struct bitmap *self, struct ewah_bitmap *mask);
+
 #endif
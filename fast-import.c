@@ -161,6 +161,7 @@ Format of STDIN stream:
 #include "blob.h"
 #include "tree.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "delta.h"
 #include "pack.h"
 #include "refs.h"
@@ -169,6 +170,7 @@ Format of STDIN stream:
 #include "dir.h"
 #include "run-command.h"
 #include "packfile.h"
+#include "thread-utils.h"
 #include "object-store.h"
 #include "mem-pool.h"
 
@@ -321,6 +323,14 @@ static unsigned int object_entry_alloc = 5000;
 static struct object_entry_pool *blocks;
 static struct object_entry *object_table[1 << 16];
 static struct mark_set *marks;
+
+/* Objects in packfiles we have finished, see forget_packed_objects() */
+static struct object_entry *free_objects;
+static unsigned int forgotten_pack_id;
+static struct object_entry spilled_mark;
+static struct tempfile *mark_spill;
+static struct strbuf mark_spill_buf = STRBUF_INIT;
+static uintmax_t mark_spill_start;
 static const char *export_marks_file;
 static const char *import_marks_file;
 static int import_marks_file_from_stream;
@@ -331,6 +341,24 @@ static int relative_marks_paths;
 /* Our last blob */
 static struct last_object last_blob = { STRBUF_INIT, 0, 0, 0 };
 
+/*
+ * What store_object() does to an object before it looks at what
+ * fast-import already has: the object name, and the deflated data or
+ * delta against "base", if any, that a blob thread has come up with.
+ */
+struct prepared_object {
+	struct object_id oid;
+	const char *base;
+	unsigned long base_len;
+	void *delta;
+	unsigned long deltalen;
+	void *out;
+	unsigned long outlen;
+};
+
+/* Threads hashing and deflating blobs, see queue_blob() */
+static int nr_blob_threads = 1;
+
 /* Tree management */
 static unsigned int tree_entry_alloc = 1000;
 static void *avail_tree_entry;
@@ -371,6 +399,7 @@ static volatile sig_atomic_t checkpoint_requested;
 static int cat_blob_fd = STDOUT_FILENO;
 
 static void parse_argv(void);
+static void store_queued_blobs(void);
 static void parse_get_mark(const char *p);
 static void parse_cat_blob(const char *p);
 static void parse_ls(const char *p, struct branch *b);
@@ -559,10 +588,14 @@ static struct object_entry *new_object(struct object_id *oid)
 {
 	struct object_entry *e;
 
-	if (blocks->next_free == blocks->end)
-		alloc_objects(object_entry_alloc);
-
-	e = blocks->next_free++;
+	if (free_objects) {
+		e = free_objects;
+		free_objects = e->next;
+	} else {
+		if (blocks->next_free == blocks->end)
+			alloc_objects(object_entry_alloc);
+		e = blocks->next_free++;
+	}
 	oidcpy(&e->idx.oid, oid);
 	return e;
 }
@@ -661,6 +694,82 @@ static void insert_mark(uintmax_t idnum, struct object_entry *oe)
 	s->data.marked[idnum] = oe;
 }
 
+static void flush_mark_spill(void)
+{
+	off_t pos = mark_spill_start * the_hash_algo->rawsz;
+	int fd;
+
+	if (!mark_spill_buf.len)
+		return;
+	if (!mark_spill)
+		mark_spill = xmks_tempfile(git_path("fast_import_marks_XXXXXX"));
+	fd = get_tempfile_fd(mark_spill);
+	if (lseek(fd, pos, SEEK_SET) != pos ||
+	    write_in_full(fd, mark_spill_buf.buf, mark_spill_buf.len) < 0)
+		die_errno("cannot write marks to %s",
+			  get_tempfile_path(mark_spill));
+	strbuf_reset(&mark_spill_buf);
+}
+
+/*
+ * Replace the mark "idnum", which must point to an object in a packfile
+ * we have finished, with the name of the object in the spill file.
+ */
+static void spill_mark(uintmax_t idnum, struct object_entry **marked)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+
+	if (mark_spill_buf.len &&
+	    (mark_spill_start + mark_spill_buf.len / rawsz != idnum ||
+	     mark_spill_buf.len >= 1024 * 1024))
+		flush_mark_spill();
+	if (!mark_spill_buf.len)
+		mark_spill_start = idnum;
+	strbuf_add(&mark_spill_buf, (*marked)->idx.oid.hash, rawsz);
+	*marked = &spilled_mark;
+}
+
+static void read_spilled_mark(uintmax_t idnum, struct object_id *oid)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+
+	oidclr(oid);
+	if (pread_in_full(get_tempfile_fd(mark_spill), oid->hash, rawsz,
+			  idnum * rawsz) != rawsz)
+		die_errno("cannot read mark :%" PRIuMAX " from %s",
+			  idnum, get_tempfile_path(mark_spill));
+}
+
+static struct object_entry *unspill_mark(uintmax_t idnum)
+{
+	struct object_id oid;
+	struct object_entry *e;
+	unsigned int k;
+
+	read_spilled_mark(idnum, &oid);
+	e = find_object(&oid);
+	if (e)
+		return e;
+	for (k = 0; k < pack_id; k++) {
+		off_t offset = find_pack_entry_one(oid.hash, all_packs[k]);
+		enum object_type type;
+
+		if (!offset)
+			continue;
+		type = oid_object_info(the_repository, &oid, NULL);
+		if (type < 0)
+			break;
+		e = insert_object(&oid);
+		e->type = type;
+		e->pack_id = k;
+		e->depth = 0;
+		e->idx.offset = offset;
+		return e;
+	}
+	die("mark :%" PRIuMAX " points to a missing object %s",
+	    idnum, oid_to_hex(&oid));
+}
+
 static struct object_entry *find_mark(uintmax_t idnum)
 {
 	uintmax_t orig_idnum = idnum;
@@ -677,6 +786,8 @@ static struct object_entry *find_mark(uintmax_t idnum)
 	}
 	if (!oe)
 		die("mark :%" PRIuMAX " not declared", orig_idnum);
+	if (oe == &spilled_mark)
+		oe = s->data.marked[idnum] = unspill_mark(orig_idnum);
 	return oe;
 }
 
@@ -1037,27 +1148,116 @@ static void cycle_packfile(void)
 	start_packfile();
 }
 
-static int store_object(
+static void spill_marks_helper(uintmax_t base, struct mark_set *m)
+{
+	uintmax_t k;
+	if (m->shift) {
+		for (k = 0; k < 1024; k++) {
+			if (m->data.sets[k])
+				spill_marks_helper(base + (k << m->shift),
+					m->data.sets[k]);
+		}
+	} else {
+		for (k = 0; k < 1024; k++) {
+			struct object_entry *e = m->data.marked[k];
+			if (e && e != &spilled_mark && e->pack_id < pack_id)
+				spill_mark(base + k, &m->data.marked[k]);
+		}
+	}
+}
+
+/*
+ * Once a packfile is kept, core git finds its objects through the pack
+ * index, and so can we: drop them from the object table and reuse their
+ * entries for new objects. Marks pointing to them are moved to a spill
+ * file and read back by find_mark() when used again. This is only done
+ * between commands, as the commands hold on to object entries while
+ * they run, and may finish a packfile while doing so.
+ */
+static void forget_packed_objects(void)
+{
+	unsigned int h;
+
+	if (forgotten_pack_id == pack_id)
+		return;
+
+	spill_marks_helper(0, marks);
+	flush_mark_spill();
+	for (h = 0; h < ARRAY_SIZE(object_table); h++) {
+		struct object_entry **p = &object_table[h];
+
+		while (*p) {
+			struct object_entry *e = *p;
+
+			if (e->pack_id < pack_id) {
+				*p = e->next;
+				e->next = free_objects;
+				free_objects = e;
+			} else
+				p = &e->next;
+		}
+	}
+	forgotten_pack_id = pack_id;
+}
+
+static void hash_object_data(enum object_type type, struct strbuf *dat,
+			     struct object_id *oid)
+{
+	unsigned char hdr[96];
+	unsigned long hdrlen;
+	git_hash_ctx c;
+
+	hdrlen = xsnprintf((char *)hdr, sizeof(hdr), "%s %lu",
+			   type_name(type), (unsigned long)dat->len) + 1;
+	the_hash_algo->init_fn(&c);
+	the_hash_algo->update_fn(&c, hdr, hdrlen);
+	the_hash_algo->update_fn(&c, dat->buf, dat->len);
+	the_hash_algo->final_fn(oid->hash, &c);
+}
+
+static void *deflate_object_data(const void *data, unsigned long len,
+				 unsigned long *outlen)
+{
+	git_zstream s;
+	void *out;
+
+	git_deflate_init(&s, pack_compression_level);
+	s.next_in = (void *)data;
+	s.avail_in = len;
+	s.avail_out = git_deflate_bound(&s, s.avail_in);
+	s.next_out = out = xmalloc(s.avail_out);
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	*outlen = s.total_out;
+	return out;
+}
+
+/*
+ * Store "dat", unless we have it already. "prep", if not NULL, is what
+ * a blob thread did for it; its delta and deflated data are taken over,
+ * and set to NULL, where they are what we would have come up with
+ * ourselves. Whatever is left in it is for the caller to free.
+ */
+static int store_prepared_object(
 	enum object_type type,
 	struct strbuf *dat,
 	struct last_object *last,
 	struct object_id *oidout,
-	uintmax_t mark)
+	uintmax_t mark,
+	struct prepared_object *prep)
 {
 	void *out, *delta;
 	struct object_entry *e;
 	unsigned char hdr[96];
 	struct object_id oid;
-	unsigned long hdrlen, deltalen;
-	git_hash_ctx c;
-	git_zstream s;
+	unsigned long hdrlen, deltalen, outlen;
+	int from_prep = 0;
 
-	hdrlen = xsnprintf((char *)hdr, sizeof(hdr), "%s %lu",
-			   type_name(type), (unsigned long)dat->len) + 1;
-	the_hash_algo->init_fn(&c);
-	the_hash_algo->update_fn(&c, hdr, hdrlen);
-	the_hash_algo->update_fn(&c, dat->buf, dat->len);
-	the_hash_algo->final_fn(oid.hash, &c);
+	if (prep)
+		oidcpy(&oid, &prep->oid);
+	else
+		hash_object_data(type, dat, &oid);
 	if (oidout)
 		oidcpy(oidout, &oid);
 
@@ -1080,29 +1280,32 @@ static int store_object(
 		&& dat->len > the_hash_algo->rawsz) {
 
 		delta_count_attempts_by_type[type]++;
-		delta = diff_delta(last->data.buf, last->data.len,
-			dat->buf, dat->len,
-			&deltalen, dat->len - the_hash_algo->rawsz);
+		if (prep && prep->base == last->data.buf &&
+		    prep->base_len == last->data.len) {
+			delta = prep->delta;
+			deltalen = prep->deltalen;
+			prep->delta = NULL;
+			from_prep = 1;
+		} else
+			delta = diff_delta(last->data.buf, last->data.len,
+				dat->buf, dat->len,
+				&deltalen, dat->len - the_hash_algo->rawsz);
 	} else
 		delta = NULL;
 
-	git_deflate_init(&s, pack_compression_level);
-	if (delta) {
-		s.next_in = delta;
-		s.avail_in = deltalen;
-	} else {
-		s.next_in = (void *)dat->buf;
-		s.avail_in = dat->len;
-	}
-	s.avail_out = git_deflate_bound(&s, s.avail_in);
-	s.next_out = out = xmalloc(s.avail_out);
-	while (git_deflate(&s, Z_FINISH) == Z_OK)
-		; /* nothing */
-	git_deflate_end(&s);
+	/* the thread deflated its delta if it has one, "dat" otherwise */
+	if (prep && prep->out && (from_prep || (!delta && !prep->delta))) {
+		out = prep->out;
+		outlen = prep->outlen;
+		prep->out = NULL;
+	} else if (delta)
+		out = deflate_object_data(delta, deltalen, &outlen);
+	else
+		out = deflate_object_data(dat->buf, dat->len, &outlen);
 
 	/* Determine if we should auto-checkpoint. */
-	if ((max_packsize && (pack_size + 60 + s.total_out) > max_packsize)
-		|| (pack_size + 60 + s.total_out) < pack_size) {
+	if ((max_packsize && (pack_size + 60 + outlen) > max_packsize)
+		|| (pack_size + 60 + outlen) < pack_size) {
 
 		/* This new object needs to *not* have the current pack_id. */
 		e->pack_id = pack_id + 1;
@@ -1111,15 +1314,8 @@ static int store_object(
 		/* We cannot carry a delta into the new pack. */
 		if (delta) {
 			FREE_AND_NULL(delta);
-
-			git_deflate_init(&s, pack_compression_level);
-			s.next_in = (void *)dat->buf;
-			s.avail_in = dat->len;
-			s.avail_out = git_deflate_bound(&s, s.avail_in);
-			s.next_out = out = xrealloc(out, s.avail_out);
-			while (git_deflate(&s, Z_FINISH) == Z_OK)
-				; /* nothing */
-			git_deflate_end(&s);
+			free(out);
+			out = deflate_object_data(dat->buf, dat->len, &outlen);
 		}
 	}
 
@@ -1156,8 +1352,8 @@ static int store_object(
 		pack_size += hdrlen;
 	}
 
-	hashwrite(pack_file, out, s.total_out);
-	pack_size += s.total_out;
+	hashwrite(pack_file, out, outlen);
+	pack_size += outlen;
 
 	e->idx.crc32 = crc32_end(pack_file);
 
@@ -1175,6 +1371,16 @@ static int store_object(
 	return 0;
 }
 
+static int store_object(
+	enum object_type type,
+	struct strbuf *dat,
+	struct last_object *last,
+	struct object_id *oidout,
+	uintmax_t mark)
+{
+	return store_prepared_object(type, dat, last, oidout, mark, NULL);
+}
+
 static void truncate_pack(struct hashfile_checkpoint *checkpoint)
 {
 	if (hashfile_truncate(pack_file, checkpoint))
@@ -1808,9 +2014,16 @@ static void dump_marks_helper(FILE *f,
 		}
 	} else {
 		for (k = 0; k < 1024; k++) {
-			if (m->data.marked[k])
-				fprintf(f, ":%" PRIuMAX " %s\n", base + k,
-					oid_to_hex(&m->data.marked[k]->idx.oid));
+			struct object_id oid;
+
+			if (!m->data.marked[k])
+				continue;
+			if (m->data.marked[k] == &spilled_mark)
+				read_spilled_mark(base + k, &oid);
+			else
+				oidcpy(&oid, &m->data.marked[k]->idx.oid);
+			fprintf(f, ":%" PRIuMAX " %s\n", base + k,
+				oid_to_hex(&oid));
 		}
 	}
 }
@@ -1934,10 +2147,12 @@ static int read_next_command(void)
 			cmd_tail = rc;
 		}
 		if (skip_prefix(command_buf.buf, "get-mark ", &p)) {
+			store_queued_blobs();
 			parse_get_mark(p);
 			continue;
 		}
 		if (skip_prefix(command_buf.buf, "cat-blob ", &p)) {
+			store_queued_blobs();
 			parse_cat_blob(p);
 			continue;
 		}
@@ -2082,6 +2297,21 @@ static char *parse_ident(const char *buf)
 	return strbuf_detach(&ident, NULL);
 }
 
+static void store_big_blob(
+	struct last_object *last,
+	struct object_id *oidout,
+	uintmax_t mark,
+	uintmax_t len)
+{
+	if (last) {
+		strbuf_release(&last->data);
+		last->offset = 0;
+		last->depth = 0;
+	}
+	stream_blob(len, oidout, mark);
+	skip_optional_lf();
+}
+
 static void parse_and_store_blob(
 	struct last_object *last,
 	struct object_id *oidout,
@@ -2092,21 +2322,221 @@ static void parse_and_store_blob(
 
 	if (parse_data(&buf, big_file_threshold, &len))
 		store_object(OBJ_BLOB, &buf, last, oidout, mark);
-	else {
-		if (last) {
-			strbuf_release(&last->data);
-			last->offset = 0;
-			last->depth = 0;
+	else
+		store_big_blob(last, oidout, mark, len);
+}
+
+/*
+ * With --threads, the data of "blob" commands is hashed, deltified
+ * against the blob before it and deflated by blob threads, while we go
+ * on reading the stream. The blobs are stored, in order, by
+ * store_queued_blobs(), which all commands but "blob" call first, so
+ * that marks and the pack come out as without threads. A blob thread
+ * can only guess that the previous blob will be the delta base, and
+ * store_object() does the work again when a duplicate, a pack size
+ * limit or the delta depth proves it wrong.
+ */
+#define BLOB_AHEAD_PER_THREAD 16
+#define BLOB_AHEAD_BYTES (64 * 1024 * 1024)
+
+struct queued_blob {
+	struct strbuf data;
+	uintmax_t mark;
+	struct prepared_object prep;
+	unsigned done:1;
+};
+
+static struct queued_blob **blob_queue;
+static unsigned int blob_queue_nr, blob_first, blob_next, blob_end;
+static size_t blob_queue_bytes;
+/* stored, but possibly still the delta base of the next blob */
+static struct queued_blob *stored_blob;
+
+static void prepare_blob(struct queued_blob *qb)
+{
+	struct prepared_object *prep = &qb->prep;
+
+	hash_object_data(OBJ_BLOB, &qb->data, &prep->oid);
+	if (prep->base_len && qb->data.len > the_hash_algo->rawsz)
+		prep->delta = diff_delta(prep->base, prep->base_len,
+					 qb->data.buf, qb->data.len,
+					 &prep->deltalen,
+					 qb->data.len - the_hash_algo->rawsz);
+	else
+		prep->base = NULL;
+	if (prep->delta)
+		prep->out = deflate_object_data(prep->delta, prep->deltalen,
+						&prep->outlen);
+	else
+		prep->out = deflate_object_data(qb->data.buf, qb->data.len,
+						&prep->outlen);
+}
+
+static void free_queued_blob(struct queued_blob *qb)
+{
+	if (!qb)
+		return;
+	strbuf_release(&qb->data);
+	free(qb->prep.delta);
+	free(qb->prep.out);
+	free(qb);
+}
+
+#ifndef NO_PTHREADS
+static pthread_t *blob_threads;
+static pthread_mutex_t blob_mutex;
+static pthread_cond_t blob_cond;
+static int blob_threads_stop;
+
+static void *blob_thread(void *data)
+{
+	pthread_mutex_lock(&blob_mutex);
+	for (;;) {
+		struct queued_blob *qb;
+
+		while (!blob_threads_stop && blob_next == blob_end)
+			pthread_cond_wait(&blob_cond, &blob_mutex);
+		if (blob_next == blob_end)
+			break;
+		qb = blob_queue[blob_next++ % blob_queue_nr];
+		pthread_mutex_unlock(&blob_mutex);
+
+		prepare_blob(qb);
+
+		pthread_mutex_lock(&blob_mutex);
+		qb->done = 1;
+		pthread_cond_broadcast(&blob_cond);
+	}
+	pthread_mutex_unlock(&blob_mutex);
+	return NULL;
+}
+
+static void start_blob_threads(void)
+{
+	int i;
+
+	blob_queue_nr = BLOB_AHEAD_PER_THREAD * nr_blob_threads;
+	ALLOC_ARRAY(blob_queue, blob_queue_nr);
+	pthread_mutex_init(&blob_mutex, NULL);
+	pthread_cond_init(&blob_cond, NULL);
+	ALLOC_ARRAY(blob_threads, nr_blob_threads);
+	for (i = 0; i < nr_blob_threads; i++)
+		if (pthread_create(&blob_threads[i], NULL, blob_thread, NULL))
+			die("unable to create thread");
+}
+
+static void stop_blob_threads(void)
+{
+	int i;
+
+	if (!blob_threads)
+		return;
+	pthread_mutex_lock(&blob_mutex);
+	blob_threads_stop = 1;
+	pthread_cond_broadcast(&blob_cond);
+	pthread_mutex_unlock(&blob_mutex);
+	for (i = 0; i < nr_blob_threads; i++)
+		pthread_join(blob_threads[i], NULL);
+	FREE_AND_NULL(blob_threads);
+	pthread_mutex_destroy(&blob_mutex);
+	pthread_cond_destroy(&blob_cond);
+	FREE_AND_NULL(blob_queue);
+}
+
+/*
+ * Store the queued blobs the threads are done with, in order; with
+ * "flush", or while the queue is full, wait for them.
+ */
+static void store_some_queued_blobs(int flush)
+{
+	while (blob_first != blob_end) {
+		struct queued_blob *qb = blob_queue[blob_first % blob_queue_nr];
+
+		pthread_mutex_lock(&blob_mutex);
+		if (!qb->done && !flush &&
+		    blob_end - blob_first < blob_queue_nr &&
+		    blob_queue_bytes <= BLOB_AHEAD_BYTES) {
+			pthread_mutex_unlock(&blob_mutex);
+			return;
 		}
-		stream_blob(len, oidout, mark);
-		skip_optional_lf();
+		while (!qb->done)
+			pthread_cond_wait(&blob_cond, &blob_mutex);
+		blob_first++;
+		blob_queue_bytes -= qb->data.len;
+		pthread_mutex_unlock(&blob_mutex);
+
+		store_prepared_object(OBJ_BLOB, &qb->data, &last_blob, NULL,
+				      qb->mark, &qb->prep);
+		/*
+		 * The next blob may still be deltified against this one
+		 * by a thread, whether it ended up in last_blob or not.
+		 */
+		free_queued_blob(stored_blob);
+		stored_blob = qb;
+	}
+	if (flush) {
+		free_queued_blob(stored_blob);
+		stored_blob = NULL;
 	}
 }
 
+static void queue_blob(uintmax_t mark)
+{
+	static struct strbuf buf = STRBUF_INIT;
+	struct queued_blob *qb;
+	uintmax_t len;
+
+	if (!parse_data(&buf, big_file_threshold, &len)) {
+		store_some_queued_blobs(1);
+		store_big_blob(&last_blob, NULL, mark, len);
+		return;
+	}
+
+	if (!blob_threads)
+		start_blob_threads();
+	qb = xcalloc(1, sizeof(*qb));
+	strbuf_init(&qb->data, 0);
+	strbuf_swap(&qb->data, &buf);
+	qb->mark = mark;
+	/* our guess at the delta base: the blob before this one */
+	if (blob_end != blob_first) {
+		struct queued_blob *prev =
+			blob_queue[(blob_end - 1) % blob_queue_nr];
+		qb->prep.base = prev->data.buf;
+		qb->prep.base_len = prev->data.len;
+	} else {
+		qb->prep.base = last_blob.data.buf;
+		qb->prep.base_len = last_blob.data.len;
+	}
+
+	pthread_mutex_lock(&blob_mutex);
+	blob_queue[blob_end++ % blob_queue_nr] = qb;
+	blob_queue_bytes += qb->data.len;
+	pthread_cond_broadcast(&blob_cond);
+	pthread_mutex_unlock(&blob_mutex);
+
+	store_some_queued_blobs(0);
+}
+#endif
+
+static void store_queued_blobs(void)
+{
+#ifndef NO_PTHREADS
+	if (blob_threads)
+		store_some_queued_blobs(1);
+#endif
+}
+
 static void parse_new_blob(void)
 {
 	read_next_command();
 	parse_mark();
+#ifndef NO_PTHREADS
+	if (nr_blob_threads > 1) {
+		queue_blob(next_mark);
+		return;
+	}
+#endif
 	parse_and_store_blob(&last_blob, NULL, next_mark);
 }
 
@@ -3152,6 +3582,7 @@ static void parse_ls(const char *p, struct branch *b)
 
 static void checkpoint(void)
 {
+	store_queued_blobs();
 	checkpoint_requested = 0;
 	if (object_count) {
 		cycle_packfile();
@@ -3233,6 +3664,19 @@ static void option_active_branches(const char *branches)
 	max_active_branches = ulong_arg("--active-branches", branches);
 }
 
+static void option_threads(const char *threads)
+{
+	nr_blob_threads = ulong_arg("--threads", threads);
+#ifdef NO_PTHREADS
+	if (nr_blob_threads != 1)
+		warning("no threads support, ignoring --threads");
+	nr_blob_threads = 1;
+#else
+	if (!nr_blob_threads)
+		nr_blob_threads = online_cpus();
+#endif
+}
+
 static void option_export_marks(const char *marks)
 {
 	export_marks_file = make_fast_import_path(marks);
@@ -3277,6 +3721,8 @@ static int parse_one_option(const char *option)
 		option_depth(option);
 	} else if (skip_prefix(option, "active-branches=", &option)) {
 		option_active_branches(option);
+	} else if (skip_prefix(option, "threads=", &option)) {
+		option_threads(option);
 	} else if (skip_prefix(option, "export-pack-edges=", &option)) {
 		option_export_pack_edges(option);
 	} else if (starts_with(option, "quiet")) {
@@ -3373,7 +3819,7 @@ static void git_pack_config(void)
 }
 
 static const char fast_import_usage[] =
-"git fast-import [--date-format=<f>] [--max-pack-size=<n>] [--big-file-threshold=<n>] [--depth=<n>] [--active-branches=<n>] [--export-marks=<marks.file>]";
+"git fast-import [--date-format=<f>] [--max-pack-size=<n>] [--big-file-threshold=<n>] [--depth=<n>] [--active-branches=<n>] [--threads=<n>] [--export-marks=<marks.file>]";
 
 static void parse_argv(void)
 {
@@ -3440,6 +3886,8 @@ int cmd_main(int argc, const char **argv)
 	set_checkpoint_signal();
 	while (read_next_command() != EOF) {
 		const char *v;
+		if (strcmp("blob", command_buf.buf))
+			store_queued_blobs();
 		if (!strcmp("blob", command_buf.buf))
 			parse_new_blob();
 		else if (skip_prefix(command_buf.buf, "ls ", &v))
@@ -3467,6 +3915,7 @@ int cmd_main(int argc, const char **argv)
 
 		if (checkpoint_requested)
 			checkpoint();
+		forget_packed_objects();
 	}
 
 	/* argv hasn't been parsed yet, do so */
@@ -3476,6 +3925,10 @@ int cmd_main(int argc, const char **argv)
 	if (require_explicit_termination && feof(stdin))
 		die("stream ends early");
 
+	store_queued_blobs();
+#ifndef NO_PTHREADS
+	stop_blob_threads();
+#endif
 	end_packfile();
 
 	dump_branches();
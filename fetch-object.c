@@ -1,11 +1,13 @@
 #include "cache.h"
+#include "object-store.h"
 #include "packfile.h"
 #include "pkt-line.h"
 #include "strbuf.h"
 #include "transport.h"
 #include "fetch-object.h"
 
-static void fetch_refs(const char *remote_name, struct ref *ref)
+static void fetch_refs(const char *remote_name, struct ref *ref,
+		       int show_progress)
 {
 	struct remote *remote;
 	struct transport *transport;
@@ -16,6 +18,7 @@ static void fetch_refs(const char *remote_name, struct ref *ref)
 	if (!remote->url[0])
 		die(_("Remote with no URL"));
 	transport = transport_get(remote, remote->url[0]);
+	transport_set_verbosity(transport, 0, show_progress);
 
 	transport_set_option(transport, TRANS_OPT_FROM_PROMISOR, "1");
 	transport_set_option(transport, TRANS_OPT_NO_DEPENDENTS, "1");
@@ -27,10 +30,12 @@ void fetch_object(const char *remote_name, const unsigned char *sha1)
 {
 	struct ref *ref = alloc_ref(sha1_to_hex(sha1));
 	hashcpy(ref->old_oid.hash, sha1);
-	fetch_refs(remote_name, ref);
+	fetch_refs(remote_name, ref, -1);
 }
 
-void fetch_objects(const char *remote_name, const struct oid_array *to_fetch)
+static void fetch_objects_progress(const char *remote_name,
+				   const struct oid_array *to_fetch,
+				   int show_progress)
 {
 	struct ref *ref = NULL;
 	int i;
@@ -41,5 +46,35 @@ void fetch_objects(const char *remote_name, const struct oid_array *to_fetch)
 		new_ref->next = ref;
 		ref = new_ref;
 	}
-	fetch_refs(remote_name, ref);
+	fetch_refs(remote_name, ref, show_progress);
+}
+
+void fetch_objects(const char *remote_name, const struct oid_array *to_fetch)
+{
+	fetch_objects_progress(remote_name, to_fetch, -1);
+}
+
+static int append_if_missing(const struct object_id *oid, void *data)
+{
+	if (!has_object_file(oid))
+		oid_array_append(data, oid);
+	return 0;
+}
+
+void prefetch_objects(struct oid_array *oids, int show_progress)
+{
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	int fetch_if_missing_store = fetch_if_missing;
+
+	if (!repository_format_partial_clone || !oids->nr)
+		return;
+
+	fetch_if_missing = 0;
+	oid_array_for_each_unique(oids, append_if_missing, &to_fetch);
+	fetch_if_missing = fetch_if_missing_store;
+
+	if (to_fetch.nr)
+		fetch_objects_progress(repository_format_partial_clone,
+				       &to_fetch, show_progress);
+	oid_array_clear(&to_fetch);
 }
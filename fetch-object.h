@@ -8,4 +8,15 @@ extern void fetch_object(const char *remote_name, const unsigned char *sha1);
 extern void fetch_objects(const char *remote_name,
 			  const struct oid_array *to_fetch);
 
+/*
+ * In a partial clone, fetch those of "oids" that are missing from the
+ * promisor remote, all in a single request, so that the callers that
+ * are about to read them do not fetch them one at a time. Does nothing
+ * in other repositories. "oids" may contain duplicates, and is sorted.
+ *
+ * "show_progress" is 1 to show the progress of the fetch, 0 not to,
+ * and -1 to show it only if stderr is a terminal.
+ */
+extern void prefetch_objects(struct oid_array *oids, int show_progress);
+
 #endif
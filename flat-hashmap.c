@@ -0,0 +1,374 @@
+/*
+ * Open-addressing hash map, probing seven slots at a time.
+ */
+#include "cache.h"
+#include "flat-hashmap.h"
+
+/*
+ * The table is an array of groups.  Each group holds GROUP_SLOTS
+ * pointers to entries and, in front of them, one control byte per
+ * slot, so that on 64-bit platforms a group fills one 64-byte cache
+ * line.  The control byte of a slot is CTRL_EMPTY, CTRL_DELETED, or 7
+ * bits of the (mixed) hash code of its entry with the high bit set;
+ * the eighth byte, which has no slot, is left out of all matches.  A
+ * new table is all zeroes, so it can come straight from xcalloc().
+ *
+ * An entry goes in the first group of its probe sequence that has a
+ * slot free, so a lookup can stop at the first group that has an empty
+ * slot.  The control bytes of a group are read into one 64-bit word,
+ * and matched all at once; only the entries whose byte matches are
+ * looked at.
+ */
+#define GROUP_SLOTS 7
+#define CTRL_EMPTY 0x00
+#define CTRL_DELETED 0x01
+#define CTRL_FULL 0x80
+
+struct flat_hashmap_group {
+	unsigned char ctrl[GROUP_SLOTS + 1];
+	struct hashmap_entry *slots[GROUP_SLOTS];
+};
+
+#define GROUP_ALIGN 64
+
+/* start and grow like hashmap.c does */
+#define FLAT_HASHMAP_INITIAL_SIZE 8
+#define FLAT_HASHMAP_RESIZE_BITS 2
+/* at most 6 in 7 slots are taken, by entries or deleted ones */
+#define FLAT_HASHMAP_MAX_LOAD(groups) ((groups) * 6)
+
+#define BYTES_1 0x0101010101010101ULL
+#define BYTES_80 0x8080808080808080ULL
+/* the high bits of the bytes that have a slot */
+#define SLOTS_80 (BYTES_80 >> (8 * (8 - GROUP_SLOTS)))
+
+/*
+ * Callers' hash codes can be poor in some bits (think of sequential
+ * ids), and both the tag and the group take some bits only.  Spread
+ * all of them over the upper half of a 64-bit product first, and take
+ * the tag from its top bits and the group from the bits below.
+ */
+static inline uint64_t mix_hash(unsigned int hash)
+{
+	return (uint64_t)hash * 0x9e3779b97f4a7c15ULL;
+}
+
+static inline unsigned char hash_tag(uint64_t hash)
+{
+	return CTRL_FULL | (hash >> 57);
+}
+
+static inline unsigned int hash_group(const struct flat_hashmap *map,
+				      uint64_t hash)
+{
+	return (hash >> 32) & (map->tablesize - 1);
+}
+
+static inline uint64_t load_ctrl(const struct flat_hashmap_group *g)
+{
+	const unsigned char *ctrl = g->ctrl;
+
+	/* byte i of the group is byte i of the word, whatever the CPU */
+	return (uint64_t)ctrl[0] |
+	       (uint64_t)ctrl[1] << 8 |
+	       (uint64_t)ctrl[2] << 16 |
+	       (uint64_t)ctrl[3] << 24 |
+	       (uint64_t)ctrl[4] << 32 |
+	       (uint64_t)ctrl[5] << 40 |
+	       (uint64_t)ctrl[6] << 48 |
+	       (uint64_t)ctrl[7] << 56;
+}
+
+/*
+ * The high bit of each byte of the result says whether that byte of
+ * the group is "tag".  A byte right above a match may come out as a
+ * match too; callers check the entry anyway.
+ */
+static inline uint64_t match_tag(uint64_t ctrl, unsigned char tag)
+{
+	uint64_t x = ctrl ^ (BYTES_1 * tag);
+	return (x - BYTES_1) & ~x & SLOTS_80;
+}
+
+/* Like match_tag(), so only good to tell whether there is one at all. */
+static inline uint64_t match_empty(uint64_t ctrl)
+{
+	return (ctrl - BYTES_1) & ~ctrl & SLOTS_80;
+}
+
+static inline uint64_t match_free(uint64_t ctrl)
+{
+	/* CTRL_EMPTY and CTRL_DELETED are the ones with the high bit clear */
+	return ~ctrl & SLOTS_80;
+}
+
+static inline unsigned int first_match(uint64_t match)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(match) / 8;
+#else
+	unsigned int i = 0;
+	while (!(match & 0x80)) {
+		match >>= 8;
+		i++;
+	}
+	return i;
+#endif
+}
+
+static inline int entry_equals(const struct flat_hashmap *map,
+			       const struct hashmap_entry *e1,
+			       const struct hashmap_entry *e2,
+			       const void *keydata)
+{
+	return (e1 == e2) ||
+	       (e1->hash == e2->hash &&
+		!map->cmpfn(map->cmpfn_data, e1, e2, keydata));
+}
+
+static void alloc_table(struct flat_hashmap *map, unsigned int size)
+{
+	map->tablesize = size;
+	map->alloc = xcalloc(1, st_add(st_mult(size, sizeof(*map->groups)),
+				       GROUP_ALIGN - 1));
+	map->groups = (struct flat_hashmap_group *)
+		(((uintptr_t)map->alloc + GROUP_ALIGN - 1) &
+		 ~(uintptr_t)(GROUP_ALIGN - 1));
+	map->deleted = 0;
+}
+
+/* Put "e" in the first free slot of its probe sequence. */
+static void insert_entry(struct flat_hashmap *map, struct hashmap_entry *e)
+{
+	uint64_t hash = mix_hash(e->hash);
+	unsigned int i = hash_group(map, hash), stride = 0;
+
+	for (;;) {
+		struct flat_hashmap_group *g = &map->groups[i];
+		uint64_t m = match_free(load_ctrl(g));
+
+		if (m) {
+			unsigned int pos = first_match(m);
+
+			if (g->ctrl[pos] == CTRL_DELETED)
+				map->deleted--;
+			g->ctrl[pos] = hash_tag(hash);
+			g->slots[pos] = e;
+			return;
+		}
+		i = (i + ++stride) & (map->tablesize - 1);
+	}
+}
+
+static void rehash(struct flat_hashmap *map, unsigned int newsize)
+{
+	unsigned int i, j, oldsize = map->tablesize;
+	struct flat_hashmap_group *oldgroups = map->groups;
+	void *oldalloc = map->alloc;
+
+	alloc_table(map, newsize);
+	for (i = 0; i < oldsize; i++)
+		for (j = 0; j < GROUP_SLOTS; j++)
+			if (oldgroups[i].slots[j])
+				insert_entry(map, oldgroups[i].slots[j]);
+	free(oldalloc);
+}
+
+/*
+ * Return the group and position of the first entry equal to "key" in
+ * the probe sequence of "key", or NULL if there is none.
+ */
+static struct flat_hashmap_group *find_slot(const struct flat_hashmap *map,
+					    const struct hashmap_entry *key,
+					    const void *keydata,
+					    unsigned int *pos)
+{
+	uint64_t hash = mix_hash(key->hash);
+	unsigned int i = hash_group(map, hash), stride = 0;
+	unsigned char tag = hash_tag(hash);
+
+	for (;;) {
+		struct flat_hashmap_group *g = &map->groups[i];
+		uint64_t ctrl = load_ctrl(g);
+		uint64_t m = match_tag(ctrl, tag);
+
+		while (m) {
+			struct hashmap_entry *e;
+
+			*pos = first_match(m);
+			e = g->slots[*pos];
+			if (e && entry_equals(map, e, key, keydata))
+				return g;
+			m &= m - 1;
+		}
+		if (match_empty(ctrl))
+			return NULL;
+		i = (i + ++stride) & (map->tablesize - 1);
+	}
+}
+
+/*
+ * Like find_slot(), but find the first entry equal to "entry" that
+ * comes after it in its probe sequence.
+ */
+static struct flat_hashmap_group *find_next_slot(const struct flat_hashmap *map,
+						 const struct hashmap_entry *entry,
+						 unsigned int *pos)
+{
+	uint64_t hash = mix_hash(entry->hash);
+	unsigned int i = hash_group(map, hash), stride = 0;
+	unsigned char tag = hash_tag(hash);
+	int seen = 0;
+
+	for (;;) {
+		struct flat_hashmap_group *g = &map->groups[i];
+		uint64_t ctrl = load_ctrl(g);
+		uint64_t m = match_tag(ctrl, tag);
+
+		while (m) {
+			struct hashmap_entry *e;
+
+			*pos = first_match(m);
+			e = g->slots[*pos];
+			m &= m - 1;
+			if (!e)
+				continue;
+			if (!seen)
+				seen = (e == entry);
+			else if (entry_equals(map, entry, e, NULL))
+				return g;
+		}
+		if (match_empty(ctrl))
+			return NULL;
+		i = (i + ++stride) & (map->tablesize - 1);
+	}
+}
+
+static int always_equal(const void *unused_cmp_data,
+			const void *unused1,
+			const void *unused2,
+			const void *unused_keydata)
+{
+	return 0;
+}
+
+void flat_hashmap_init(struct flat_hashmap *map, hashmap_cmp_fn equals_function,
+		       const void *cmpfn_data, size_t initial_size)
+{
+	unsigned int size = FLAT_HASHMAP_INITIAL_SIZE;
+
+	memset(map, 0, sizeof(*map));
+
+	map->cmpfn = equals_function ? equals_function : always_equal;
+	map->cmpfn_data = cmpfn_data;
+
+	/*
+	 * A group is 64 bytes, so do not overshoot by a factor of 4 here:
+	 * whoever gives a size usually knows it well.
+	 */
+	while (FLAT_HASHMAP_MAX_LOAD(size) < initial_size)
+		size <<= 1;
+	alloc_table(map, size);
+}
+
+void flat_hashmap_free(struct flat_hashmap *map, int free_entries)
+{
+	if (!map || !map->tablesize)
+		return;
+	if (free_entries) {
+		unsigned int i, j;
+
+		for (i = 0; i < map->tablesize; i++)
+			for (j = 0; j < GROUP_SLOTS; j++)
+				free(map->groups[i].slots[j]);
+	}
+	free(map->alloc);
+	memset(map, 0, sizeof(*map));
+}
+
+void *flat_hashmap_get(const struct flat_hashmap *map, const void *key,
+		       const void *keydata)
+{
+	unsigned int pos;
+	struct flat_hashmap_group *g = find_slot(map, key, keydata, &pos);
+
+	return g ? g->slots[pos] : NULL;
+}
+
+void *flat_hashmap_get_next(const struct flat_hashmap *map, const void *entry)
+{
+	unsigned int pos;
+	struct flat_hashmap_group *g = find_next_slot(map, entry, &pos);
+
+	return g ? g->slots[pos] : NULL;
+}
+
+void flat_hashmap_add(struct flat_hashmap *map, void *entry)
+{
+	if (map->private_size + map->deleted >= FLAT_HASHMAP_MAX_LOAD(map->tablesize)) {
+		/*
+		 * Grow when more than half of the allowed load are
+		 * entries; otherwise, only clear out the deleted slots.
+		 */
+		if (2 * map->private_size >= FLAT_HASHMAP_MAX_LOAD(map->tablesize))
+			rehash(map, map->tablesize << FLAT_HASHMAP_RESIZE_BITS);
+		else
+			rehash(map, map->tablesize);
+	}
+	insert_entry(map, entry);
+	map->private_size++;
+}
+
+void *flat_hashmap_remove(struct flat_hashmap *map, const void *key,
+			  const void *keydata)
+{
+	unsigned int pos;
+	struct flat_hashmap_group *g = find_slot(map, key, keydata, &pos);
+	struct hashmap_entry *old;
+
+	if (!g)
+		return NULL;
+	old = g->slots[pos];
+	g->slots[pos] = NULL;
+	g->ctrl[pos] = CTRL_DELETED;
+	map->deleted++;
+	map->private_size--;
+	return old;
+}
+
+void *flat_hashmap_put(struct flat_hashmap *map, void *entry)
+{
+	unsigned int pos;
+	struct flat_hashmap_group *g = find_slot(map, entry, NULL, &pos);
+	struct hashmap_entry *old;
+
+	if (!g) {
+		flat_hashmap_add(map, entry);
+		return NULL;
+	}
+	old = g->slots[pos];
+	g->slots[pos] = entry;
+	return old;
+}
+
+void flat_hashmap_iter_init(struct flat_hashmap *map,
+			    struct flat_hashmap_iter *iter)
+{
+	iter->map = map;
+	iter->pos = 0;
+}
+
+void *flat_hashmap_iter_next(struct flat_hashmap_iter *iter)
+{
+	unsigned int end = iter->map->tablesize * GROUP_SLOTS;
+
+	while (iter->pos < end) {
+		unsigned int pos = iter->pos++;
+		struct hashmap_entry *e =
+			iter->map->groups[pos / GROUP_SLOTS].slots[pos % GROUP_SLOTS];
+
+		if (e)
+			return e;
+	}
+	return NULL;
+}
@@ -0,0 +1,95 @@
+#ifndef FLAT_HASHMAP_H
+#define FLAT_HASHMAP_H
+
+#include "hashmap.h"
+
+/*
+ * An open-addressing variant of hashmap.h, for maps that are mostly
+ * looked up in.
+ *
+ * The entries are the same as those of hashmap.h: structs starting
+ * with a "struct hashmap_entry", set up with hashmap_entry_init() and
+ * compared with a hashmap_cmp_fn.  Instead of chaining them, the map
+ * keeps pointers to them in groups of seven slots, next to one byte per
+ * slot holding 7 bits of the entry's hash code; a group fits in one
+ * cache line.  Lookups check the bytes of a group at once, and look at
+ * an entry only when its byte matches.
+ *
+ * The functions behave like their hashmap.h counterparts, duplicate
+ * entries and flat_hashmap_get_next() included, except that entries
+ * with the same key may come out in any order.  Unlike hashmap.h, there
+ * are no buckets to lock separately, so several threads must not add
+ * to the same map at the same time.
+ */
+struct flat_hashmap_group;
+
+struct flat_hashmap {
+	/* the groups of slots, see flat-hashmap.c */
+	struct flat_hashmap_group *groups;
+	void *alloc;
+
+	/* Stores the comparison function specified in flat_hashmap_init(). */
+	hashmap_cmp_fn cmpfn;
+	const void *cmpfn_data;
+
+	/* total number of entries (0 means the map is empty) */
+	unsigned int private_size; /* use flat_hashmap_get_size() */
+	/* slots that held an entry that was removed since the last resize */
+	unsigned int deleted;
+	/*
+	 * tablesize is the number of groups, a power of 2.  A non-0 value
+	 * indicates that the map is initialized.
+	 */
+	unsigned int tablesize;
+};
+
+void flat_hashmap_init(struct flat_hashmap *map,
+		       hashmap_cmp_fn equals_function,
+		       const void *equals_function_data,
+		       size_t initial_size);
+void flat_hashmap_free(struct flat_hashmap *map, int free_entries);
+
+static inline unsigned int flat_hashmap_get_size(const struct flat_hashmap *map)
+{
+	return map->private_size;
+}
+
+void *flat_hashmap_get(const struct flat_hashmap *map, const void *key,
+		       const void *keydata);
+
+static inline void *flat_hashmap_get_from_hash(const struct flat_hashmap *map,
+					       unsigned int hash,
+					       const void *keydata)
+{
+	struct hashmap_entry key;
+	hashmap_entry_init(&key, hash);
+	return flat_hashmap_get(map, &key, keydata);
+}
+
+void *flat_hashmap_get_next(const struct flat_hashmap *map, const void *entry);
+void flat_hashmap_add(struct flat_hashmap *map, void *entry);
+void *flat_hashmap_put(struct flat_hashmap *map, void *entry);
+void *flat_hashmap_remove(struct flat_hashmap *map, const void *key,
+			  const void *keydata);
+
+/*
+ * Entries come out in the order of their slots.  Removing the entry
+ * last returned is fine; adding entries while iterating is not.
+ */
+struct flat_hashmap_iter {
+	struct flat_hashmap *map;
+	unsigned int pos;
+};
+
+void flat_hashmap_iter_init(struct flat_hashmap *map,
+			    struct flat_hashmap_iter *iter);
+void *flat_hashmap_iter_next(struct flat_hashmap_iter *iter);
+
+static inline void *flat_hashmap_iter_first(struct flat_hashmap *map,
+					    struct flat_hashmap_iter *iter)
+{
+	flat_hashmap_iter_init(map, iter);
+	return flat_hashmap_iter_next(iter);
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef FSMONITOR_DAEMON_H
+#define FSMONITOR_DAEMON_H
+
+#include "hashmap.h"
+
+struct fsm_listen_data;
+
+/*
+ * The state of "git fsmonitor--daemon run", shared between the command
+ * and the platform-specific backend listening to filesystem events
+ * (compat/fsmonitor/fsm-listen-*.c).
+ *
+ * Every change reported by the backend is stamped with the time at which
+ * the daemon learned about it. Because the events are always drained
+ * before a client is answered, a change made before a query is never
+ * stamped later than the answer; a client that remembers a time taken
+ * before sending its query will therefore see every later change on its
+ * next query.
+ */
+struct fsmonitor_daemon_state {
+	/*
+	 * Changes from before this time may have been missed: a client
+	 * asking about them gets the trivial response ("/").
+	 */
+	uint64_t start_time;
+
+	/* changed path (relative to the work tree) -> time of last change */
+	struct hashmap changed_paths;
+
+	struct fsm_listen_data *listen_data;
+
+	/* set by the backend when the work tree disappeared */
+	unsigned int shutdown : 1;
+};
+
+/*
+ * Record that "path", relative to the top of the work tree, changed.
+ * Paths of directories may be given too, and mean that everything below
+ * them may have changed.
+ */
+void fsmonitor_publish(struct fsmonitor_daemon_state *state, const char *path);
+
+/*
+ * Forget everything: some events were lost, so clients have to start
+ * from scratch.
+ */
+void fsmonitor_force_resync(struct fsmonitor_daemon_state *state);
+
+#endif /* FSMONITOR_DAEMON_H */
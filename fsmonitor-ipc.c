@@ -0,0 +1,112 @@
+#include "cache.h"
+#include "fsmonitor-ipc.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "unix-socket.h"
+
+#ifdef HAVE_FSMONITOR_DAEMON_BACKEND
+
+int fsmonitor_ipc__is_supported(void)
+{
+	return 1;
+}
+
+const char *fsmonitor_ipc__get_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = absolute_pathdup(git_path("fsmonitor--daemon.ipc"));
+	return path;
+}
+
+int fsmonitor_ipc__spawn_daemon(void)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	char buf[128];
+	int r;
+
+	argv_array_pushl(&daemon.args, "fsmonitor--daemon", "run", NULL);
+	daemon.git_cmd = 1;
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+
+	if (start_command(&daemon))
+		return error(_("unable to start fsmonitor daemon"));
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	close(daemon.out);
+	if (r < 0)
+		return error_errno(_("unable to read result code from fsmonitor daemon"));
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		return error(_("fsmonitor daemon did not start: %.*s"), r, buf);
+	return 0;
+}
+
+static int send_request(const char *request, struct strbuf *answer)
+{
+	int fd = unix_stream_connect(fsmonitor_ipc__get_path());
+	int ret = 0;
+
+	if (fd < 0)
+		return -1;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	if (write_in_full(fd, request, strlen(request)) < 0 ||
+	    shutdown(fd, SHUT_WR) < 0 ||
+	    strbuf_read(answer, fd, 0) < 0)
+		ret = error_errno(_("unable to talk to fsmonitor daemon"));
+	sigchain_pop(SIGPIPE);
+
+	close(fd);
+	return ret;
+}
+
+int fsmonitor_ipc__send_command(const char *command, struct strbuf *answer)
+{
+	return send_request(command, answer);
+}
+
+int fsmonitor_ipc__send_query(uint64_t since, struct strbuf *answer)
+{
+	struct strbuf request = STRBUF_INIT;
+	int ret;
+
+	strbuf_addf(&request, "query %"PRIuMAX, (uintmax_t)since);
+	ret = send_request(request.buf, answer);
+	if (ret < 0 && (errno == ENOENT || errno == ECONNREFUSED)) {
+		strbuf_reset(answer);
+		if (!fsmonitor_ipc__spawn_daemon())
+			ret = send_request(request.buf, answer);
+	}
+	strbuf_release(&request);
+	return ret;
+}
+
+#else
+
+int fsmonitor_ipc__is_supported(void)
+{
+	return 0;
+}
+
+const char *fsmonitor_ipc__get_path(void)
+{
+	return NULL;
+}
+
+int fsmonitor_ipc__spawn_daemon(void)
+{
+	return error(_("fsmonitor daemon is not supported on this platform"));
+}
+
+int fsmonitor_ipc__send_command(const char *command, struct strbuf *answer)
+{
+	return -1;
+}
+
+int fsmonitor_ipc__send_query(uint64_t since, struct strbuf *answer)
+{
+	return -1;
+}
+
+#endif
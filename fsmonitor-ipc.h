@@ -0,0 +1,49 @@
+#ifndef FSMONITOR_IPC_H
+#define FSMONITOR_IPC_H
+
+/*
+ * Talk to the built-in filesystem monitor, "git fsmonitor--daemon",
+ * which is used instead of a hook when core.fsmonitor is "true".
+ *
+ * The daemon serves one request per connection on a unix domain socket
+ * in the repository: the client writes its request and shuts down its
+ * side of the connection, then reads the response until EOF.
+ */
+
+/*
+ * Return 1 if this platform has a backend for the daemon, 0 otherwise.
+ */
+int fsmonitor_ipc__is_supported(void);
+
+/*
+ * Return the path of the socket the daemon of this repository listens
+ * on. The string is owned by this module.
+ */
+const char *fsmonitor_ipc__get_path(void);
+
+/*
+ * Start a daemon for the current working tree in the background and
+ * only return once it is watching the working tree and listening for
+ * requests. Return 0 on success, -1 on error.
+ */
+int fsmonitor_ipc__spawn_daemon(void);
+
+/*
+ * Send "command" to the daemon and store its response in "answer".
+ * Return 0 on success and -1 if the daemon could not be reached.
+ */
+int fsmonitor_ipc__send_command(const char *command, struct strbuf *answer);
+
+/*
+ * Ask the daemon for the paths that changed since "since" (in the same
+ * nanosecond clock that the fsmonitor index extension uses) and store
+ * them in "answer" in the hook format: NUL-terminated paths relative to
+ * the top of the working tree, or "/" if the daemon cannot tell and
+ * everything has to be considered changed.
+ *
+ * If no daemon is running, one is started and asked; this first answer
+ * is always "/". Return 0 on success, -1 on error.
+ */
+int fsmonitor_ipc__send_query(uint64_t since, struct strbuf *answer);
+
+#endif /* FSMONITOR_IPC_H */
@@ -3,6 +3,7 @@
 #include "dir.h"
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
+#include "fsmonitor-ipc.h"
 #include "run-command.h"
 #include "strbuf.h"
 
@@ -92,7 +93,8 @@ void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
 }
 
 /*
- * Call the query-fsmonitor hook passing the time of the last saved results.
+ * Call the query-fsmonitor hook passing the time of the last saved results,
+ * or ask the built-in daemon for the same.
  */
 static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *query_result)
 {
@@ -101,6 +103,9 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	if (!core_fsmonitor)
 		return -1;
 
+	if (core_fsmonitor_use_daemon)
+		return fsmonitor_ipc__send_query(last_update, query_result);
+
 	argv_array_push(&cp.args, core_fsmonitor);
 	argv_array_pushf(&cp.args, "%d", version);
 	argv_array_pushf(&cp.args, "%" PRIuMAX, (uintmax_t)last_update);
@@ -112,11 +117,33 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 
 static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
 {
-	int pos = index_name_pos(istate, name, strlen(name));
+	int len = strlen(name);
+	int pos = index_name_pos(istate, name, len);
 
 	if (pos >= 0) {
 		struct cache_entry *ce = istate->cache[pos];
 		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	} else {
+		/*
+		 * "name" may be a directory that was moved or removed as a
+		 * whole, in which case no event was reported for the
+		 * entries below it; invalidate them all.
+		 */
+		struct strbuf dir = STRBUF_INIT;
+
+		strbuf_add(&dir, name, len);
+		strbuf_addch(&dir, '/');
+		pos = index_name_pos(istate, dir.buf, dir.len);
+		if (pos < 0)
+			pos = -pos - 1;
+		for (; pos < istate->cache_nr; pos++) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (strncmp(ce->name, dir.buf, dir.len))
+				break;
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		}
+		strbuf_release(&dir);
 	}
 
 	/*
@@ -780,6 +780,17 @@ extern int git_atexit(void (*handler)(void));
 typedef void (*try_to_free_t)(size_t);
 extern try_to_free_t set_try_to_free_routine(try_to_free_t);
 
+/*
+ * Count the calls to xmalloc(), xcalloc(), xrealloc() and friends, and
+ * the bytes they ask for, into "counter" until it is set back to NULL.
+ * Meant for benchmarks, which should not count from several threads.
+ */
+struct alloc_counter {
+	uintmax_t nr;
+	uintmax_t bytes;
+};
+extern void set_alloc_counter(struct alloc_counter *counter);
+
 static inline size_t st_add(size_t a, size_t b)
 {
 	if (unsigned_add_overflows(a, b))
@@ -1239,4 +1250,11 @@ extern void unleak_memory(const void *ptr, size_t len);
 #define UNLEAK(var) do {} while (0)
 #endif
 
+/*
+ * Let trace2 record the exit of the process, whichever way the
+ * process exits; see trace2.h.
+ */
+extern int trace2_cmd_exit_fl(const char *file, int line, int code);
+#define exit(code) exit(trace2_cmd_exit_fl(__FILE__, __LINE__, (code)))
+
 #endif
@@ -497,6 +497,14 @@ then
 	test -z "$interactive_rebase" && interactive_rebase=implied
 fi
 
+# Only the sequencer, behind the interactive backend, picks in memory
+if test "$(git config --bool rebase.inMemory)" = true &&
+   test -z "$do_merge" &&
+   test -z "$(echo " $git_am_opt " | sed -e 's/ -q / /g' -e 's/^ *$//')"
+then
+	test -z "$interactive_rebase" && interactive_rebase=implied
+fi
+
 if test -n "$interactive_rebase"
 then
 	if test -z "$preserve_merges"
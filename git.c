@@ -4,6 +4,8 @@
 #include "help.h"
 #include "run-command.h"
 #include "alias.h"
+#include "command-server.h"
+#include "trace2.h"
 
 #define RUN_SETUP		(1<<0)
 #define RUN_SETUP_GENTLY	(1<<1)
@@ -16,6 +18,7 @@
 #define SUPPORT_SUPER_PREFIX	(1<<4)
 #define DELAY_PAGER_CONFIG	(1<<5)
 #define NO_PARSEOPT		(1<<6) /* parse-options is not used */
+#define SERVABLE		(1<<7) /* "git command-server" may run it */
 
 struct cmd_struct {
 	const char *cmd;
@@ -413,6 +416,7 @@ static int run_builtin(struct cmd_struct *p, int argc, const char **argv)
 		setup_work_tree();
 
 	trace_argv_printf(argv, "trace: built-in: git");
+	trace2_cmd_name(p->cmd);
 
 	status = p->fn(argc, argv, prefix);
 	if (status)
@@ -445,12 +449,14 @@ static struct cmd_struct commands[] = {
 	{ "blame", cmd_blame, RUN_SETUP },
 	{ "branch", cmd_branch, RUN_SETUP | DELAY_PAGER_CONFIG },
 	{ "bundle", cmd_bundle, RUN_SETUP_GENTLY | NO_PARSEOPT },
-	{ "cat-file", cmd_cat_file, RUN_SETUP },
+	{ "cat-file", cmd_cat_file, RUN_SETUP | SERVABLE },
 	{ "check-attr", cmd_check_attr, RUN_SETUP },
 	{ "check-ignore", cmd_check_ignore, RUN_SETUP | NEED_WORK_TREE },
 	{ "check-mailmap", cmd_check_mailmap, RUN_SETUP },
 	{ "check-ref-format", cmd_check_ref_format, NO_PARSEOPT  },
 	{ "checkout", cmd_checkout, RUN_SETUP | NEED_WORK_TREE },
+	{ "checkout--worker", cmd_checkout__worker,
+		RUN_SETUP | NEED_WORK_TREE | SUPPORT_SUPER_PREFIX },
 	{ "checkout-index", cmd_checkout_index,
 		RUN_SETUP | NEED_WORK_TREE},
 	{ "cherry", cmd_cherry, RUN_SETUP },
@@ -458,6 +464,7 @@ static struct cmd_struct commands[] = {
 	{ "clean", cmd_clean, RUN_SETUP | NEED_WORK_TREE },
 	{ "clone", cmd_clone },
 	{ "column", cmd_column, RUN_SETUP_GENTLY },
+	{ "command-server", cmd_command_server, RUN_SETUP | NEED_WORK_TREE },
 	{ "commit", cmd_commit, RUN_SETUP | NEED_WORK_TREE },
 	{ "commit-graph", cmd_commit_graph, RUN_SETUP },
 	{ "commit-tree", cmd_commit_tree, RUN_SETUP | NO_PARSEOPT },
@@ -465,19 +472,21 @@ static struct cmd_struct commands[] = {
 	{ "count-objects", cmd_count_objects, RUN_SETUP },
 	{ "credential", cmd_credential, RUN_SETUP_GENTLY | NO_PARSEOPT },
 	{ "describe", cmd_describe, RUN_SETUP },
-	{ "diff", cmd_diff, NO_PARSEOPT },
-	{ "diff-files", cmd_diff_files, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT },
-	{ "diff-index", cmd_diff_index, RUN_SETUP | NO_PARSEOPT },
-	{ "diff-tree", cmd_diff_tree, RUN_SETUP | NO_PARSEOPT },
+	{ "diff", cmd_diff, NO_PARSEOPT | SERVABLE },
+	{ "diff-files", cmd_diff_files, RUN_SETUP | NEED_WORK_TREE | NO_PARSEOPT | SERVABLE },
+	{ "diff-index", cmd_diff_index, RUN_SETUP | NO_PARSEOPT | SERVABLE },
+	{ "diff-tree", cmd_diff_tree, RUN_SETUP | NO_PARSEOPT | SERVABLE },
 	{ "difftool", cmd_difftool, RUN_SETUP | NEED_WORK_TREE },
 	{ "fast-export", cmd_fast_export, RUN_SETUP },
 	{ "fetch", cmd_fetch, RUN_SETUP },
 	{ "fetch-pack", cmd_fetch_pack, RUN_SETUP | NO_PARSEOPT },
 	{ "fmt-merge-msg", cmd_fmt_merge_msg, RUN_SETUP },
-	{ "for-each-ref", cmd_for_each_ref, RUN_SETUP },
+	{ "for-each-ref", cmd_for_each_ref, RUN_SETUP | SERVABLE },
+	{ "for-each-repo", cmd_for_each_repo, RUN_SETUP_GENTLY },
 	{ "format-patch", cmd_format_patch, RUN_SETUP },
 	{ "fsck", cmd_fsck, RUN_SETUP },
 	{ "fsck-objects", cmd_fsck, RUN_SETUP },
+	{ "fsmonitor--daemon", cmd_fsmonitor__daemon, RUN_SETUP | NEED_WORK_TREE },
 	{ "gc", cmd_gc, RUN_SETUP },
 	{ "get-tar-commit-id", cmd_get_tar_commit_id, NO_PARSEOPT },
 	{ "grep", cmd_grep, RUN_SETUP_GENTLY },
@@ -487,12 +496,13 @@ static struct cmd_struct commands[] = {
 	{ "init", cmd_init_db },
 	{ "init-db", cmd_init_db },
 	{ "interpret-trailers", cmd_interpret_trailers, RUN_SETUP_GENTLY },
-	{ "log", cmd_log, RUN_SETUP },
-	{ "ls-files", cmd_ls_files, RUN_SETUP },
+	{ "log", cmd_log, RUN_SETUP | SERVABLE },
+	{ "ls-files", cmd_ls_files, RUN_SETUP | SERVABLE },
 	{ "ls-remote", cmd_ls_remote, RUN_SETUP_GENTLY },
-	{ "ls-tree", cmd_ls_tree, RUN_SETUP },
+	{ "ls-tree", cmd_ls_tree, RUN_SETUP | SERVABLE },
 	{ "mailinfo", cmd_mailinfo, RUN_SETUP_GENTLY | NO_PARSEOPT },
 	{ "mailsplit", cmd_mailsplit, NO_PARSEOPT },
+	{ "maintenance", cmd_maintenance, RUN_SETUP | NO_PARSEOPT },
 	{ "merge", cmd_merge, RUN_SETUP | NEED_WORK_TREE },
 	{ "merge-base", cmd_merge_base, RUN_SETUP },
 	{ "merge-file", cmd_merge_file, RUN_SETUP_GENTLY },
@@ -505,6 +515,7 @@ static struct cmd_struct commands[] = {
 	{ "merge-tree", cmd_merge_tree, RUN_SETUP | NO_PARSEOPT },
 	{ "mktag", cmd_mktag, RUN_SETUP | NO_PARSEOPT },
 	{ "mktree", cmd_mktree, RUN_SETUP },
+	{ "multi-pack-index", cmd_multi_pack_index, RUN_SETUP_GENTLY },
 	{ "mv", cmd_mv, RUN_SETUP | NEED_WORK_TREE },
 	{ "name-rev", cmd_name_rev, RUN_SETUP },
 	{ "notes", cmd_notes, RUN_SETUP },
@@ -528,19 +539,19 @@ static struct cmd_struct commands[] = {
 	{ "replace", cmd_replace, RUN_SETUP },
 	{ "rerere", cmd_rerere, RUN_SETUP },
 	{ "reset", cmd_reset, RUN_SETUP },
-	{ "rev-list", cmd_rev_list, RUN_SETUP | NO_PARSEOPT },
-	{ "rev-parse", cmd_rev_parse, NO_PARSEOPT },
+	{ "rev-list", cmd_rev_list, RUN_SETUP | NO_PARSEOPT | SERVABLE },
+	{ "rev-parse", cmd_rev_parse, NO_PARSEOPT | SERVABLE },
 	{ "revert", cmd_revert, RUN_SETUP | NEED_WORK_TREE },
 	{ "rm", cmd_rm, RUN_SETUP },
 	{ "send-pack", cmd_send_pack, RUN_SETUP },
 	{ "serve", cmd_serve, RUN_SETUP },
 	{ "shortlog", cmd_shortlog, RUN_SETUP_GENTLY | USE_PAGER },
-	{ "show", cmd_show, RUN_SETUP },
+	{ "show", cmd_show, RUN_SETUP | SERVABLE },
 	{ "show-branch", cmd_show_branch, RUN_SETUP },
 	{ "show-index", cmd_show_index },
-	{ "show-ref", cmd_show_ref, RUN_SETUP },
+	{ "show-ref", cmd_show_ref, RUN_SETUP | SERVABLE },
 	{ "stage", cmd_add, RUN_SETUP | NEED_WORK_TREE },
-	{ "status", cmd_status, RUN_SETUP | NEED_WORK_TREE },
+	{ "status", cmd_status, RUN_SETUP | NEED_WORK_TREE | SERVABLE },
 	{ "stripspace", cmd_stripspace },
 	{ "submodule--helper", cmd_submodule__helper, RUN_SETUP | SUPPORT_SUPER_PREFIX | NO_PARSEOPT },
 	{ "symbolic-ref", cmd_symbolic_ref, RUN_SETUP },
@@ -579,6 +590,20 @@ int is_builtin(const char *s)
 	return !!get_builtin(s);
 }
 
+int is_servable_builtin(const char *s)
+{
+	struct cmd_struct *builtin = get_builtin(s);
+
+	return builtin && (builtin->option & SERVABLE);
+}
+
+int run_served_builtin(int argc, const char **argv)
+{
+	if (!argc || !is_servable_builtin(argv[0]))
+		return -1;
+	return run_builtin(get_builtin(argv[0]), argc, argv);
+}
+
 static void list_builtins(struct string_list *out, unsigned int exclude_option)
 {
 	int i;
@@ -705,6 +730,7 @@ int cmd_main(int argc, const char **argv)
 {
 	const char *cmd;
 	int done_help = 0;
+	int nr_args;
 
 	cmd = argv[0];
 	if (!cmd)
@@ -736,6 +762,7 @@ int cmd_main(int argc, const char **argv)
 	/* Look for flags.. */
 	argv++;
 	argc--;
+	nr_args = argc;
 	handle_options(&argv, &argc, NULL);
 	if (argc > 0) {
 		/* translate --help and --version into commands */
@@ -750,6 +777,17 @@ int cmd_main(int argc, const char **argv)
 	}
 	cmd = argv[0];
 
+	/*
+	 * Let a command server run read-only builtins, unless options
+	 * given to "git" itself would have to be passed on.
+	 */
+	if (argc == nr_args && is_servable_builtin(cmd) &&
+	    !(argc > 1 && !strcmp(argv[1], "--help"))) {
+		int status = command_server_run(argc, argv);
+		if (status >= 0)
+			exit(status);
+	}
+
 	/*
 	 * We use PATH to find git commands, but we prepend some higher
 	 * precedence paths: the "--exec-path" option, the GIT_EXEC_PATH
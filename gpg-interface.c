@@ -5,9 +5,11 @@
 #include "gpg-interface.h"
 #include "sigchain.h"
 #include "tempfile.h"
+#include "thread-utils.h"
 
 static char *configured_signing_key;
 static const char *gpg_program = "gpg";
+static int gpg_verify_jobs = -1;
 
 #define PGP_SIGNATURE "-----BEGIN PGP SIGNATURE-----"
 #define PGP_MESSAGE "-----BEGIN PGP MESSAGE-----"
@@ -64,29 +66,47 @@ static void parse_gpg_output(struct signature_check *sigc)
 	}
 }
 
+static int fill_signature_check(const char *payload, size_t plen,
+				int status, const struct strbuf *gpg_output,
+				const struct strbuf *gpg_status,
+				struct signature_check *sigc)
+{
+	sigc->result = 'N';
+
+	if (status && !gpg_output->len)
+		goto out;
+	sigc->payload = xmemdupz(payload, plen);
+	sigc->gpg_output = xstrdup(gpg_output->buf);
+	sigc->gpg_status = xstrdup(gpg_status->buf);
+	parse_gpg_output(sigc);
+
+ out:
+	return sigc->result != 'G' && sigc->result != 'U';
+}
+
 int check_signature(const char *payload, size_t plen, const char *signature,
 	size_t slen, struct signature_check *sigc)
 {
 	struct strbuf gpg_output = STRBUF_INIT;
 	struct strbuf gpg_status = STRBUF_INIT;
-	int status;
-
-	sigc->result = 'N';
+	int status, ret;
 
 	status = verify_signed_buffer(payload, plen, signature, slen,
 				      &gpg_output, &gpg_status);
-	if (status && !gpg_output.len)
-		goto out;
-	sigc->payload = xmemdupz(payload, plen);
-	sigc->gpg_output = strbuf_detach(&gpg_output, NULL);
-	sigc->gpg_status = strbuf_detach(&gpg_status, NULL);
-	parse_gpg_output(sigc);
+	ret = fill_signature_check(payload, plen, status, &gpg_output,
+				   &gpg_status, sigc);
 
- out:
 	strbuf_release(&gpg_status);
 	strbuf_release(&gpg_output);
 
-	return sigc->result != 'G' && sigc->result != 'U';
+	return ret;
+}
+
+int check_verified_signature(const struct signature_verification *v,
+			     struct signature_check *sigc)
+{
+	return fill_signature_check(v->payload, v->payload_size, v->ret,
+				    &v->gpg_output, &v->gpg_status, sigc);
 }
 
 void print_signature_buffer(const struct signature_check *sigc, unsigned flags)
@@ -138,6 +158,11 @@ int git_gpg_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "gpg.verifyjobs")) {
+		gpg_verify_jobs = git_config_int(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "gpg.program")) {
 		if (!value)
 			return config_error_nonbool(var);
@@ -238,3 +263,153 @@ int verify_signed_buffer(const char *payload, size_t payload_size,
 
 	return ret;
 }
+
+struct verify_job {
+	struct signature_verification *v;
+	struct child_process gpg;
+	struct tempfile *signature, *payload, *output;
+};
+
+static struct tempfile *write_verify_tempfile(const char *template,
+					      const char *buf, size_t len)
+{
+	struct tempfile *temp = mks_tempfile_t(template);
+
+	if (!temp) {
+		error_errno(_("could not create temporary file"));
+		return NULL;
+	}
+	if (write_in_full(temp->fd, buf, len) < 0 ||
+	    close_tempfile_gently(temp) < 0) {
+		error_errno(_("failed writing detached signature to '%s'"),
+			    temp->filename.buf);
+		delete_tempfile(&temp);
+	}
+	return temp;
+}
+
+static void finish_verify_job(struct verify_job *job)
+{
+	if (job->output)
+		delete_tempfile(&job->output);
+	if (job->payload)
+		delete_tempfile(&job->payload);
+	if (job->signature)
+		delete_tempfile(&job->signature);
+}
+
+/*
+ * Start gpg on the signature of "job", with the payload on its
+ * standard input and everything it says, the status lines included,
+ * going to a temporary file that finish_verify_job() sorts out.
+ */
+static int start_verify_job(struct verify_job *job)
+{
+	struct signature_verification *v = job->v;
+	struct child_process *gpg = &job->gpg;
+
+	job->signature = write_verify_tempfile(".git_vtag_tmpXXXXXX",
+					       v->signature, v->signature_size);
+	job->payload = write_verify_tempfile(".git_vpayload_tmpXXXXXX",
+					     v->payload, v->payload_size);
+	job->output = write_verify_tempfile(".git_vout_tmpXXXXXX", "", 0);
+	if (!job->signature || !job->payload || !job->output)
+		goto fail;
+
+	child_process_init(gpg);
+	argv_array_pushl(&gpg->args,
+			 gpg_program,
+			 "--status-fd=2",
+			 "--keyid-format=long",
+			 "--verify", job->signature->filename.buf, "-",
+			 NULL);
+	gpg->in = open(job->payload->filename.buf, O_RDONLY);
+	if (gpg->in < 0)
+		goto fail_errno;
+	gpg->err = open(job->output->filename.buf, O_WRONLY);
+	if (gpg->err < 0) {
+		close(gpg->in);
+		goto fail_errno;
+	}
+	gpg->no_stdout = 1;
+	if (start_command(gpg))
+		goto fail;
+	return 0;
+
+fail_errno:
+	error_errno(_("could not open temporary file"));
+fail:
+	finish_verify_job(job);
+	return -1;
+}
+
+static void collect_verify_job(struct verify_job *job)
+{
+	struct signature_verification *v = job->v;
+	struct strbuf out = STRBUF_INIT;
+	const char *line, *eol;
+
+	v->ret = finish_command(&job->gpg);
+	if (strbuf_read_file(&out, job->output->filename.buf, 0) < 0)
+		v->ret |= error_errno(_("could not read '%s'"),
+				      job->output->filename.buf);
+	finish_verify_job(job);
+
+	/* Tell the status lines apart from the diagnostic output. */
+	for (line = out.buf; *line; line = eol) {
+		eol = strchrnul(line, '\n');
+		if (*eol)
+			eol++;
+		if (starts_with(line, "[GNUPG:] "))
+			strbuf_add(&v->gpg_status, line, eol - line);
+		else
+			strbuf_add(&v->gpg_output, line, eol - line);
+	}
+	strbuf_release(&out);
+
+	v->ret |= !strstr(v->gpg_status.buf, "\n[GNUPG:] GOODSIG ");
+}
+
+void verify_signed_buffers(struct signature_verification **v, int nr)
+{
+	struct verify_job *jobs;
+	int max = gpg_verify_jobs > 0 ? gpg_verify_jobs : online_cpus();
+	int i, started = 0, done = 0;
+
+	if (max > nr)
+		max = nr;
+	if (max <= 1) {
+		for (i = 0; i < nr; i++)
+			v[i]->ret = verify_signed_buffer(v[i]->payload,
+							 v[i]->payload_size,
+							 v[i]->signature,
+							 v[i]->signature_size,
+							 &v[i]->gpg_output,
+							 &v[i]->gpg_status);
+		return;
+	}
+
+	/*
+	 * Keep "max" gpg running, collecting them in the order they were
+	 * started; they all take about as long, so the oldest one is the
+	 * first to be done anyway.
+	 */
+	jobs = xcalloc(max, sizeof(*jobs));
+	sigchain_push(SIGPIPE, SIG_IGN);
+	while (done < nr) {
+		struct verify_job *job;
+
+		while (started < nr && started - done < max) {
+			job = &jobs[started % max];
+			memset(job, 0, sizeof(*job));
+			job->v = v[started++];
+			if (start_verify_job(job))
+				job->v->ret = -1;
+		}
+		job = &jobs[done++ % max];
+		if (job->output)
+			collect_verify_job(job);
+	}
+	sigchain_pop(SIGPIPE);
+	free(jobs);
+}
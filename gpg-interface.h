@@ -51,12 +51,42 @@ int verify_signed_buffer(const char *payload, size_t payload_size,
 			 const char *signature, size_t signature_size,
 			 struct strbuf *gpg_output, struct strbuf *gpg_status);
 
+/*
+ * A signature for verify_signed_buffers() to check, and what
+ * verify_signed_buffer() would have said about it.
+ */
+struct signature_verification {
+	const char *payload;
+	size_t payload_size;
+	const char *signature;
+	size_t signature_size;
+
+	int ret;
+	struct strbuf gpg_output;
+	struct strbuf gpg_status;
+};
+
+#define SIGNATURE_VERIFICATION_INIT { NULL, 0, NULL, 0, 0, STRBUF_INIT, STRBUF_INIT }
+
+/*
+ * Like verify_signed_buffer() on each of the "nr" signatures, but with
+ * several "gpg" running at once, as many as "gpg.verifyJobs" says
+ * (the number of CPUs by default).
+ */
+void verify_signed_buffers(struct signature_verification **v, int nr);
+
 int git_gpg_config(const char *, const char *, void *);
 void set_signing_key(const char *);
 const char *get_signing_key(void);
 int check_signature(const char *payload, size_t plen,
 		    const char *signature, size_t slen,
 		    struct signature_check *sigc);
+/*
+ * Like check_signature(), for a signature verify_signed_buffers()
+ * checked already.
+ */
+int check_verified_signature(const struct signature_verification *v,
+			     struct signature_check *sigc);
 void print_signature_buffer(const struct signature_check *sigc,
 			    unsigned flags);
 
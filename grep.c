@@ -9,6 +9,8 @@
 #include "commit.h"
 #include "quote.h"
 #include "help.h"
+#include "trigram-index.h"
+#include "trace2.h"
 
 static int grep_source_load(struct grep_source *gs);
 static int grep_source_is_binary(struct grep_source *gs);
@@ -1507,13 +1509,28 @@ static inline void grep_attr_unlock(void)
 }
 
 /*
- * Same as git_attr_mutex, but protecting the thread-unsafe object db access.
+ * This lock protects access to the trigram index, which is not
+ * thread-safe either.
  */
-pthread_mutex_t grep_read_mutex;
+pthread_mutex_t grep_trigram_mutex;
+
+static inline void grep_trigram_lock(void)
+{
+	if (grep_use_locks)
+		pthread_mutex_lock(&grep_trigram_mutex);
+}
+
+static inline void grep_trigram_unlock(void)
+{
+	if (grep_use_locks)
+		pthread_mutex_unlock(&grep_trigram_mutex);
+}
 
 #else
 #define grep_attr_lock()
 #define grep_attr_unlock()
+#define grep_trigram_lock()
+#define grep_trigram_unlock()
 #endif
 
 static int match_funcname(struct grep_opt *opt, struct grep_source *gs, char *bol, char *eol)
@@ -1742,6 +1759,90 @@ static int is_empty_line(const char *bol, const char *eol)
 	return bol == eol;
 }
 
+static int pattern_may_match(struct grep_pat *p,
+			     const struct trigram_filter *filter)
+{
+	/*
+	 * Only a pattern we search with kws is a string that a matching
+	 * line contains as is, or folded to lowercase ASCII with -i.
+	 */
+	if (!p->fixed)
+		return 1;
+	return trigram_filter_may_contain(filter, p->pattern, p->patternlen);
+}
+
+static int expr_may_match(struct grep_expr *x,
+			  const struct trigram_filter *filter)
+{
+	switch (x->node) {
+	case GREP_NODE_ATOM:
+		return pattern_may_match(x->u.atom, filter);
+	case GREP_NODE_AND:
+		return expr_may_match(x->u.binary.left, filter) &&
+		       expr_may_match(x->u.binary.right, filter);
+	case GREP_NODE_OR:
+		return expr_may_match(x->u.binary.left, filter) ||
+		       expr_may_match(x->u.binary.right, filter);
+	default:
+		return 1;
+	}
+}
+
+static int trigrams_may_match(struct grep_opt *opt,
+			      const struct trigram_filter *filter)
+{
+	struct grep_pat *p;
+
+	if (opt->extended)
+		return !opt->pattern_expression ||
+		       expr_may_match(opt->pattern_expression, filter);
+
+	/* a line matches if any of the patterns does */
+	for (p = opt->pattern_list; p; p = p->next)
+		if (pattern_may_match(p, filter))
+			return 1;
+	return 0;
+}
+
+/*
+ * Return 1 if the trigram index tells us that no line of the blob "gs"
+ * can match, and set "indexed" if the index knows about it.
+ */
+static int grep_source_cannot_match(struct grep_opt *opt, struct grep_source *gs,
+				    int *indexed)
+{
+	const struct trigram_filter *filter;
+	int ret = 0;
+
+	if (!opt->use_trigram_index || gs->type != GREP_SOURCE_OID)
+		return 0;
+
+	grep_trigram_lock();
+	filter = trigram_index_lookup(gs->identifier);
+	if (filter) {
+		*indexed = 1;
+		if (!trigrams_may_match(opt, filter)) {
+			trace2_counter_add("grep", "trigram-index/skipped", 1);
+			ret = 1;
+		}
+	}
+	grep_trigram_unlock();
+	return ret;
+}
+
+static void grep_source_index_trigrams(struct grep_opt *opt, struct grep_source *gs)
+{
+	struct trigram_filter *filter;
+
+	if (!opt->use_trigram_index || gs->type != GREP_SOURCE_OID)
+		return;
+
+	filter = trigram_filter_compute(gs->identifier, gs->buf, gs->size);
+	grep_trigram_lock();
+	trigram_index_add(filter);
+	grep_trigram_unlock();
+}
+
 static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int collect_hits)
 {
 	char *bol;
@@ -1753,6 +1854,7 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 	unsigned count = 0;
 	int try_lookahead = 0;
 	int show_function = 0;
+	int indexed = 0;
 	struct userdiff_driver *textconv = NULL;
 	enum grep_context ctx = GREP_CONTEXT_HEAD;
 	xdemitconf_t xecfg;
@@ -1786,6 +1888,13 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 		grep_attr_unlock();
 	}
 
+	/*
+	 * The trigram index knows about the contents of the blob, not about
+	 * what textconv makes of it.
+	 */
+	if (!textconv && grep_source_cannot_match(opt, gs, &indexed))
+		return 0;
+
 	/*
 	 * We know the result of a textconv is text, so we only have to care
 	 * about binary handling if we are not using it.
@@ -1814,6 +1923,8 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 
 	if (fill_textconv_grep(textconv, gs) < 0)
 		return 0;
+	if (!textconv && !indexed)
+		grep_source_index_trigrams(opt, gs);
 
 	bol = gs->buf;
 	left = gs->size;
@@ -2082,9 +2193,7 @@ static int grep_source_load_oid(struct grep_source *gs)
 {
 	enum object_type type;
 
-	grep_read_lock();
 	gs->buf = read_object_file(gs->identifier, &type, &gs->size);
-	grep_read_unlock();
 
 	if (!gs->buf)
 		return error(_("'%s': unable to read %s"),
@@ -156,6 +156,7 @@ struct grep_opt {
 #define GREP_BINARY_TEXT	2
 	int binary;
 	int allow_textconv;
+	int use_trigram_index;
 	int extended;
 	int use_reflog_filter;
 	int pcre1;
@@ -231,23 +232,14 @@ extern int grep_threads_ok(const struct grep_opt *opt);
  */
 extern int grep_use_locks;
 extern pthread_mutex_t grep_attr_mutex;
-extern pthread_mutex_t grep_read_mutex;
-
-static inline void grep_read_lock(void)
-{
-	if (grep_use_locks)
-		pthread_mutex_lock(&grep_read_mutex);
-}
-
-static inline void grep_read_unlock(void)
-{
-	if (grep_use_locks)
-		pthread_mutex_unlock(&grep_read_mutex);
-}
-
-#else
-#define grep_read_lock()
-#define grep_read_unlock()
+extern pthread_mutex_t grep_trigram_mutex;
 #endif
 
+/*
+ * Reading objects takes care of its own locking when the threads are
+ * running; these protect the other uses of the object store.
+ */
+#define grep_read_lock() obj_read_lock()
+#define grep_read_unlock() obj_read_unlock()
+
 #endif
@@ -15,6 +15,8 @@
 #include "block-sha1/sha1.h"
 #endif
 
+#include "sha256/block/sha256.h"
+
 #ifndef platform_SHA_CTX
 /*
  * platform's underlying implementation of SHA-1; could be OpenSSL,
@@ -34,6 +36,11 @@
 #define git_SHA1_Update		platform_SHA1_Update
 #define git_SHA1_Final		platform_SHA1_Final
 
+#define git_SHA256_CTX		platform_SHA256_CTX
+#define git_SHA256_Init		platform_SHA256_Init
+#define git_SHA256_Update	platform_SHA256_Update
+#define git_SHA256_Final	platform_SHA256_Final
+
 #ifdef SHA1_MAX_BLOCK_SIZE
 #include "compat/sha1-chunked.h"
 #undef git_SHA1_Update
@@ -52,12 +59,15 @@
 #define GIT_HASH_UNKNOWN 0
 /* SHA-1 */
 #define GIT_HASH_SHA1 1
+/* SHA-256 */
+#define GIT_HASH_SHA256 2
 /* Number of algorithms supported (including unknown). */
-#define GIT_HASH_NALGOS (GIT_HASH_SHA1 + 1)
+#define GIT_HASH_NALGOS (GIT_HASH_SHA256 + 1)
 
 /* A suitably aligned type for stack allocations of hash contexts. */
 union git_hash_ctx {
 	git_SHA_CTX sha1;
+	git_SHA256_CTX sha256;
 };
 typedef union git_hash_ctx git_hash_ctx;
 
@@ -65,6 +75,21 @@ typedef void (*git_hash_init_fn)(git_hash_ctx *ctx);
 typedef void (*git_hash_update_fn)(git_hash_ctx *ctx, const void *in, size_t len);
 typedef void (*git_hash_final_fn)(unsigned char *hash, git_hash_ctx *ctx);
 
+/*
+ * One of the independent messages hashed together by a git_hash_many_fn:
+ * "hdrlen" bytes at "hdr" followed by "len" bytes at "buf", whose hash
+ * is stored to "hash".
+ */
+struct git_hash_msg {
+	const void *hdr;
+	size_t hdrlen;
+	const void *buf;
+	size_t len;
+	unsigned char *hash;
+};
+
+typedef void (*git_hash_many_fn)(struct git_hash_msg *msgs, size_t nr);
+
 struct git_hash_algo {
 	/*
 	 * The name of the algorithm, as appears in the config file and in
@@ -90,6 +115,12 @@ struct git_hash_algo {
 	/* The hash finalization function. */
 	git_hash_final_fn final_fn;
 
+	/*
+	 * Hash "nr" independent messages at once, which an implementation
+	 * may do several at a time, in the lanes of SIMD registers.
+	 */
+	git_hash_many_fn many_fn;
+
 	/* The OID of the empty tree. */
 	const struct object_id *empty_tree;
 
@@ -13,6 +13,7 @@
 #include "packfile.h"
 #include "object-store.h"
 #include "protocol.h"
+#include "upload-pack.h"
 
 static const char content_type[] = "Content-Type";
 static const char content_length[] = "Content-Length";
@@ -22,6 +23,10 @@ static unsigned long max_request_buffer = 10 * 1024 * 1024;
 
 static struct string_list *query_params;
 
+/* Set when serving requests ourselves; see http_server(). */
+static int in_process_upload_pack;
+static int headers_sent;
+
 struct rpc_service {
 	const char *name;
 	const char *config_name;
@@ -119,6 +124,7 @@ static void hdr_cache_forever(struct strbuf *hdr)
 static void end_headers(struct strbuf *hdr)
 {
 	strbuf_add(hdr, "\r\n", 2);
+	headers_sent = 1;
 	write_or_die(1, hdr->buf, hdr->len);
 	strbuf_release(hdr);
 }
@@ -321,7 +327,8 @@ static ssize_t read_request(int fd, unsigned char **out)
 	}
 }
 
-static void inflate_request(const char *prog_name, int out, int buffer_input)
+static void inflate_request(const char *prog_name, int in, int out,
+			    int buffer_input)
 {
 	git_zstream stream;
 	unsigned char *full_request = NULL;
@@ -339,10 +346,10 @@ static void inflate_request(const char *prog_name, int out, int buffer_input)
 			if (full_request)
 				n = 0; /* nothing left to read */
 			else
-				n = read_request(0, &full_request);
+				n = read_request(in, &full_request);
 			stream.next_in = full_request;
 		} else {
-			n = xread(0, in_buf, sizeof(in_buf));
+			n = xread(in, in_buf, sizeof(in_buf));
 			stream.next_in = in_buf;
 		}
 
@@ -376,10 +383,10 @@ static void inflate_request(const char *prog_name, int out, int buffer_input)
 	free(full_request);
 }
 
-static void copy_request(const char *prog_name, int out)
+static void copy_request(const char *prog_name, int in, int out)
 {
 	unsigned char *buf;
-	ssize_t n = read_request(0, &buf);
+	ssize_t n = read_request(in, &buf);
 	if (n < 0)
 		die_errno("error reading request body");
 	if (write_in_full(out, buf, n) < 0)
@@ -388,6 +395,64 @@ static void copy_request(const char *prog_name, int out)
 	free(buf);
 }
 
+struct request_feed {
+	const char *prog_name;
+	int gzipped;
+	int buffer_input;
+};
+
+static int feed_request(int in, int out, void *data)
+{
+	struct request_feed *feed = data;
+
+	if (feed->gzipped)
+		inflate_request(feed->prog_name, in, out, feed->buffer_input);
+	else
+		copy_request(feed->prog_name, in, out);
+	close(in);
+	return 0;
+}
+
+/*
+ * Run upload-pack in this process, which only ever serves one request,
+ * instead of starting it anew.
+ */
+static void run_upload_pack(const char **argv, int buffer_input,
+			    int gzipped_request)
+{
+	struct upload_pack_options opts = { 0 };
+	struct request_feed feed = { argv[0], gzipped_request, buffer_input };
+	struct async feeder = { NULL };
+	int i;
+
+	for (i = 1; argv[i]; i++)
+		if (!strcmp(argv[i], "--stateless-rpc"))
+			opts.stateless_rpc = 1;
+		else if (!strcmp(argv[i], "--advertise-refs"))
+			opts.advertise_refs = 1;
+
+	if (buffer_input || gzipped_request) {
+		feeder.proc = feed_request;
+		feeder.data = &feed;
+		feeder.in = dup(0);
+		feeder.out = -1;
+		if (feeder.in < 0 || start_async(&feeder))
+			exit(1);
+		if (dup2(feeder.out, 0) < 0)
+			die_errno("unable to read the request");
+		close(feeder.out);
+	}
+
+	packet_trace_identity("upload-pack");
+	check_replace_refs = 0;
+	upload_pack_any_version(&opts);
+
+	close(0);
+	close(1);
+	if ((buffer_input || gzipped_request) && finish_async(&feeder))
+		exit(1);
+}
+
 static void run_service(const char **argv, int buffer_input)
 {
 	const char *encoding = getenv("HTTP_CONTENT_ENCODING");
@@ -401,6 +466,11 @@ static void run_service(const char **argv, int buffer_input)
 	else if (encoding && !strcmp(encoding, "x-gzip"))
 		gzipped_request = 1;
 
+	if (in_process_upload_pack && !strcmp(argv[0], "upload-pack")) {
+		run_upload_pack(argv, buffer_input, gzipped_request);
+		return;
+	}
+
 	if (!user || !*user)
 		user = "anonymous";
 	if (!host || !*host)
@@ -421,9 +491,9 @@ static void run_service(const char **argv, int buffer_input)
 
 	close(1);
 	if (gzipped_request)
-		inflate_request(argv[0], cld.in, buffer_input);
+		inflate_request(argv[0], 0, cld.in, buffer_input);
 	else if (buffer_input)
-		copy_request(argv[0], cld.in);
+		copy_request(argv[0], 0, cld.in);
 	else
 		close(0);
 
@@ -590,9 +660,12 @@ static NORETURN void die_webcgi(const char *err, va_list params)
 
 		vreportf("fatal: ", err, params);
 
-		http_status(&hdr, 500, "Internal Server Error");
-		hdr_nocache(&hdr);
-		end_headers(&hdr);
+		/* Too late to tell the client if we already started talking. */
+		if (!headers_sent) {
+			http_status(&hdr, 500, "Internal Server Error");
+			hdr_nocache(&hdr);
+			end_headers(&hdr);
+		}
 	}
 	exit(0); /* we successfully reported a failure ;-) */
 }
@@ -659,7 +732,7 @@ static int bad_request(struct strbuf *hdr, const struct service_cmd *c)
 	return 0;
 }
 
-int cmd_main(int argc, const char **argv)
+static int serve_request(void)
 {
 	char *method = getenv("REQUEST_METHOD");
 	char *dir;
@@ -716,3 +789,643 @@ int cmd_main(int argc, const char **argv)
 	cmd->imp(&hdr, cmd_arg);
 	return 0;
 }
+
+#ifndef NO_POSIX_GOODIES
+
+/*
+ * With --port, we are our own HTTP server: every connection gets a
+ * process of its own, which reads requests one after the other and
+ * forks, without exec'ing anything, to serve each of them exactly like
+ * the CGI would, relaying what it writes back to the client.
+ */
+
+static const char http_server_usage[] =
+"git http-backend [--listen=<host_or_ipaddr>] --port=<n> [--timeout=<n>]";
+
+/* Seconds to wait for the next request on a connection. */
+static int idle_timeout = 60;
+
+#define MAX_REQUEST_HEAD (64 * 1024)
+
+struct http_conn {
+	int fd;
+	struct strbuf in;	/* read from the client, not consumed yet */
+	char *remote_addr;
+};
+
+struct http_request {
+	char *method;
+	char *target;
+	char *protocol;
+	int keep_alive;
+	int expect_continue;
+	struct argv_array env;
+
+	/* how to find the end of the body */
+	enum {
+		BODY_DATA,
+		BODY_CHUNK_SIZE,
+		BODY_CHUNK_END,
+		BODY_TRAILER,
+		BODY_DONE
+	} body_state;
+	int chunked;
+	uintmax_t remaining;
+};
+
+static void http_request_clear(struct http_request *req)
+{
+	free(req->method);
+	free(req->target);
+	free(req->protocol);
+	argv_array_clear(&req->env);
+}
+
+static ssize_t conn_read(struct http_conn *conn, int timeout)
+{
+	struct pollfd pfd;
+	ssize_t n;
+
+	pfd.fd = conn->fd;
+	pfd.events = POLLIN;
+	if (timeout && poll(&pfd, 1, timeout * 1000) <= 0)
+		return -1;
+
+	strbuf_grow(&conn->in, 65536);
+	n = xread(conn->fd, conn->in.buf + conn->in.len, 65536);
+	if (n > 0)
+		strbuf_setlen(&conn->in, conn->in.len + n);
+	return n;
+}
+
+/*
+ * Read the request line and the headers of the next request into
+ * "head".  Return -1 if the client went away, timed out or sent too
+ * much.
+ */
+static int read_request_head(struct http_conn *conn, struct strbuf *head)
+{
+	const char *end;
+
+	while (!(end = memmem(conn->in.buf, conn->in.len, "\r\n\r\n", 4))) {
+		if (conn->in.len > MAX_REQUEST_HEAD ||
+		    conn_read(conn, idle_timeout) <= 0)
+			return -1;
+	}
+	strbuf_add(head, conn->in.buf, end + 2 - conn->in.buf);
+	strbuf_remove(&conn->in, 0, end + 4 - conn->in.buf);
+	return 0;
+}
+
+/*
+ * Turn the request head into the environment that a web server would
+ * give the CGI.  Return -1 if it makes no sense.
+ */
+static int parse_request_head(struct http_conn *conn, char *head,
+			      struct http_request *req)
+{
+	char *line, *next, *query;
+	char *path;
+
+	next = strstr(head, "\r\n");
+	*next = '\0';
+	next += 2;
+	line = head;
+
+	req->target = strchr(line, ' ');
+	if (!req->target)
+		return -1;
+	req->method = xmemdupz(line, req->target - line);
+	line = req->target + 1;
+	req->protocol = strchr(line, ' ');
+	if (!req->protocol || !starts_with(req->protocol + 1, "HTTP/"))
+		return -1;
+	req->target = xmemdupz(line, req->protocol - line);
+	req->protocol = xstrdup(req->protocol + 1);
+	req->keep_alive = !strcmp(req->protocol, "HTTP/1.1");
+	if (req->target[0] != '/')
+		return -1;
+
+	query = strchr(req->target, '?');
+	if (query)
+		path = url_decode_mem(req->target, query++ - req->target);
+	else
+		path = url_decode(req->target);
+	argv_array_pushf(&req->env, "REQUEST_METHOD=%s", req->method);
+	argv_array_pushf(&req->env, "PATH_INFO=%s", path);
+	argv_array_pushf(&req->env, "QUERY_STRING=%s", query ? query : "");
+	argv_array_pushf(&req->env, "SERVER_PROTOCOL=%s", req->protocol);
+	argv_array_pushf(&req->env, "REMOTE_ADDR=%s", conn->remote_addr);
+	free(path);
+
+	req->body_state = BODY_DONE;
+	for (line = next; *line; line = next) {
+		char *value;
+
+		next = strstr(line, "\r\n");
+		*next = '\0';
+		next += 2;
+		value = strchr(line, ':');
+		if (!value)
+			return -1;
+		*value++ = '\0';
+		while (isspace(*value))
+			value++;
+
+		if (!strcasecmp(line, "Content-Type")) {
+			argv_array_pushf(&req->env, "CONTENT_TYPE=%s", value);
+		} else if (!strcasecmp(line, "Content-Encoding")) {
+			argv_array_pushf(&req->env, "HTTP_CONTENT_ENCODING=%s",
+					 value);
+		} else if (!strcasecmp(line, "Git-Protocol")) {
+			argv_array_pushf(&req->env, "GIT_PROTOCOL=%s", value);
+		} else if (!strcasecmp(line, "Content-Length")) {
+			if (!req->chunked) {
+				req->remaining = strtoumax(value, NULL, 10);
+				req->body_state = req->remaining ?
+					BODY_DATA : BODY_DONE;
+			}
+			argv_array_pushf(&req->env, "CONTENT_LENGTH=%s", value);
+		} else if (!strcasecmp(line, "Transfer-Encoding")) {
+			if (strcasecmp(value, "chunked"))
+				return -1;
+			req->chunked = 1;
+			req->body_state = BODY_CHUNK_SIZE;
+		} else if (!strcasecmp(line, "Connection")) {
+			if (!strcasecmp(value, "close"))
+				req->keep_alive = 0;
+			else if (!strcasecmp(value, "keep-alive"))
+				req->keep_alive = 1;
+		} else if (!strcasecmp(line, "Expect")) {
+			req->expect_continue = !strcasecmp(value, "100-continue");
+		}
+	}
+	return 0;
+}
+
+/*
+ * Move as much of the request body as we have from the connection to
+ * "out", taking off the chunked encoding.  Return -1 if the body is
+ * garbled.
+ */
+static int decode_body(struct http_conn *conn, struct http_request *req,
+		       struct strbuf *out)
+{
+	for (;;) {
+		struct strbuf *in = &conn->in;
+		const char *eol;
+		size_t n;
+
+		switch (req->body_state) {
+		case BODY_DATA:
+			n = in->len < req->remaining ? in->len : req->remaining;
+			if (!n)
+				return 0;
+			strbuf_add(out, in->buf, n);
+			strbuf_remove(in, 0, n);
+			req->remaining -= n;
+			if (!req->remaining)
+				req->body_state = req->chunked ?
+					BODY_CHUNK_END : BODY_DONE;
+			break;
+		case BODY_CHUNK_SIZE:
+			eol = memmem(in->buf, in->len, "\r\n", 2);
+			if (!eol)
+				return in->len > 1024 ? -1 : 0;
+			if (!isxdigit(*in->buf))
+				return -1;
+			req->remaining = strtoumax(in->buf, NULL, 16);
+			strbuf_remove(in, 0, eol + 2 - in->buf);
+			req->body_state = req->remaining ?
+				BODY_DATA : BODY_TRAILER;
+			break;
+		case BODY_CHUNK_END:
+			if (in->len < 2)
+				return 0;
+			if (memcmp(in->buf, "\r\n", 2))
+				return -1;
+			strbuf_remove(in, 0, 2);
+			req->body_state = BODY_CHUNK_SIZE;
+			break;
+		case BODY_TRAILER:
+			eol = memmem(in->buf, in->len, "\r\n", 2);
+			if (!eol)
+				return in->len > 1024 ? -1 : 0;
+			if (eol == in->buf)
+				req->body_state = BODY_DONE;
+			strbuf_remove(in, 0, eol + 2 - in->buf);
+			break;
+		case BODY_DONE:
+			return 0;
+		}
+	}
+}
+
+struct http_response {
+	struct strbuf head;	/* CGI headers, until we have them all */
+	int headers_done;
+	int status;
+	int chunked;
+	int no_body;
+	int keep_alive;
+	uintmax_t bytes;
+};
+
+/*
+ * Turn the CGI headers into a response head: the "Status" header into
+ * the status line, and delimit the body so that the connection can be
+ * kept open.
+ */
+static int send_response_head(struct http_conn *conn,
+			      struct http_request *req,
+			      struct http_response *res)
+{
+	struct strbuf out = STRBUF_INIT;
+	struct strbuf headers = STRBUF_INIT;
+	const char *status = "200 OK";
+	int has_length = 0, ret;
+	char *line, *next;
+
+	for (line = res->head.buf; *line; line = next) {
+		const char *value;
+		size_t len;
+
+		next = strchrnul(line, '\n');
+		if (*next)
+			*next++ = '\0';
+		len = strlen(line);
+		if (len && line[len - 1] == '\r')
+			line[len - 1] = '\0';
+		if (!*line)
+			break;
+		if (skip_prefix(line, "Status: ", &value)) {
+			status = value;
+			continue;
+		}
+		if (istarts_with(line, "Content-Length:"))
+			has_length = 1;
+		strbuf_addf(&headers, "%s\r\n", line);
+	}
+	res->status = atoi(status);
+
+	strbuf_addf(&out, "%s %s\r\n", req->protocol, status);
+	strbuf_addbuf(&out, &headers);
+	if (!has_length && !res->no_body) {
+		if (!strcmp(req->protocol, "HTTP/1.1"))
+			res->chunked = 1;
+		else
+			res->keep_alive = 0;
+	}
+	if (res->chunked)
+		strbuf_addstr(&out, "Transfer-Encoding: chunked\r\n");
+	if (!res->keep_alive)
+		strbuf_addstr(&out, "Connection: close\r\n");
+	strbuf_addstr(&out, "\r\n");
+
+	ret = write_in_full(conn->fd, out.buf, out.len) < 0 ? -1 : 0;
+	strbuf_release(&out);
+	strbuf_release(&headers);
+	return ret;
+}
+
+static int send_response_data(struct http_conn *conn,
+			      struct http_request *req,
+			      struct http_response *res,
+			      const char *buf, size_t len)
+{
+	if (!res->headers_done) {
+		char *end;
+
+		strbuf_add(&res->head, buf, len);
+		end = strstr(res->head.buf, "\r\n\r\n");
+		if (!end) {
+			end = strstr(res->head.buf, "\n\n");
+			if (!end)
+				return res->head.len > MAX_REQUEST_HEAD ? -1 : 0;
+			end += 2;
+		} else {
+			end += 4;
+		}
+		res->headers_done = 1;
+		len = res->head.buf + res->head.len - end;
+		buf = xmemdupz(end, len);
+		*end = '\0';
+		if (send_response_head(conn, req, res) ||
+		    send_response_data(conn, req, res, buf, len)) {
+			free((char *)buf);
+			return -1;
+		}
+		free((char *)buf);
+		return 0;
+	}
+
+	if (!len || res->no_body)
+		return 0;
+	res->bytes += len;
+	if (res->chunked) {
+		char size[32];
+
+		xsnprintf(size, sizeof(size), "%"PRIxMAX"\r\n", (uintmax_t)len);
+		if (write_in_full(conn->fd, size, strlen(size)) < 0 ||
+		    write_in_full(conn->fd, buf, len) < 0 ||
+		    write_in_full(conn->fd, "\r\n", 2) < 0)
+			return -1;
+		return 0;
+	}
+	return write_in_full(conn->fd, buf, len) < 0 ? -1 : 0;
+}
+
+static int finish_response(struct http_conn *conn, struct http_response *res)
+{
+	if (!res->headers_done)
+		return -1;
+	if (res->chunked && !res->no_body &&
+	    write_in_full(conn->fd, "0\r\n\r\n", 5) < 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Serve one request whose head we have read.  Return -1 if the
+ * connection cannot be used any further.
+ */
+static int serve_http_request(struct http_conn *conn, struct http_request *req)
+{
+	struct http_response res = { STRBUF_INIT };
+	struct strbuf body = STRBUF_INIT;
+	uint64_t start = getnanotime();
+	int to_child[2], from_child[2];
+	int in = -1, out, discard = 0, ret = 0;
+	char buf[65536];
+	pid_t pid;
+	int i;
+
+	res.keep_alive = req->keep_alive;
+	res.no_body = !strcmp(req->method, "HEAD");
+
+	if (req->expect_continue && req->body_state != BODY_DONE &&
+	    write_in_full(conn->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25) < 0)
+		return -1;
+
+	if (pipe(to_child) < 0 || pipe(from_child) < 0)
+		die_errno("unable to create pipe");
+	pid = fork();
+	if (pid < 0)
+		die_errno("unable to fork");
+	if (!pid) {
+		close(conn->fd);
+		close(to_child[1]);
+		close(from_child[0]);
+		dup2(to_child[0], 0);
+		dup2(from_child[1], 1);
+		close(to_child[0]);
+		close(from_child[1]);
+		for (i = 0; i < req->env.argc; i++)
+			putenv((char *)req->env.argv[i]);
+		in_process_upload_pack = 1;
+		exit(serve_request());
+	}
+	close(to_child[0]);
+	close(from_child[1]);
+	in = to_child[1];
+	out = from_child[0];
+	fcntl(in, F_SETFL, O_NONBLOCK);
+
+	while (out >= 0) {
+		struct pollfd pfd[2];
+		int nr = 0, in_idx = -1;
+		ssize_t n;
+
+		if (decode_body(conn, req, &body)) {
+			ret = -1;
+			break;
+		}
+		if (discard)
+			strbuf_reset(&body);
+		if (in >= 0 && !body.len && req->body_state == BODY_DONE) {
+			close(in);
+			in = -1;
+		}
+
+		pfd[nr].fd = out;
+		pfd[nr++].events = POLLIN;
+		if (in >= 0 && body.len) {
+			in_idx = nr;
+			pfd[nr].fd = in;
+			pfd[nr++].events = POLLOUT;
+		} else if (req->body_state != BODY_DONE) {
+			in_idx = nr;
+			pfd[nr].fd = conn->fd;
+			pfd[nr++].events = POLLIN;
+		}
+		if (poll(pfd, nr, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("poll failed");
+		}
+
+		if (in_idx >= 0 && pfd[in_idx].revents) {
+			if (pfd[in_idx].fd == conn->fd) {
+				if (conn_read(conn, 0) <= 0) {
+					ret = -1;
+					break;
+				}
+			} else {
+				n = xwrite(in, body.buf, body.len);
+				if (n > 0) {
+					strbuf_remove(&body, 0, n);
+				} else if (n < 0 && errno != EAGAIN) {
+					/* not interested in (the rest of) the body */
+					close(in);
+					in = -1;
+					discard = 1;
+					strbuf_reset(&body);
+				}
+			}
+		}
+
+		if (pfd[0].revents) {
+			n = xread(out, buf, sizeof(buf));
+			if (n <= 0) {
+				close(out);
+				out = -1;
+			} else if (send_response_data(conn, req, &res, buf, n)) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	if (in >= 0)
+		close(in);
+	if (out >= 0) {
+		close(out);
+		kill(pid, SIGTERM);
+	}
+	waitpid(pid, NULL, 0);
+
+	if (!ret && !res.headers_done) {
+		static const char failed[] =
+			"Status: 500 Internal Server Error\r\n"
+			"Content-Length: 0\r\n\r\n";
+
+		/* the child died without a word */
+		strbuf_reset(&res.head);
+		ret = send_response_data(conn, req, &res,
+					 failed, strlen(failed));
+	}
+	if (!ret)
+		ret = finish_response(conn, &res);
+	/* We cannot find the next request if we did not read all of this one. */
+	if (req->body_state != BODY_DONE || !res.keep_alive)
+		ret = -1;
+
+	fprintf(stderr, "[%"PRIuMAX"] %s \"%s %s %s\" %d %"PRIuMAX" %.3fms\n",
+		(uintmax_t)getpid(), conn->remote_addr,
+		req->method, req->target, req->protocol,
+		res.status, res.bytes, (getnanotime() - start) / 1000000.0);
+
+	strbuf_release(&res.head);
+	strbuf_release(&body);
+	return ret;
+}
+
+static void serve_connection(int fd, const char *remote_addr)
+{
+	struct http_conn conn = { fd, STRBUF_INIT };
+	struct strbuf head = STRBUF_INIT;
+
+	conn.remote_addr = xstrdup(remote_addr);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		struct http_request req = { NULL };
+		int ret;
+
+		argv_array_init(&req.env);
+		strbuf_reset(&head);
+		if (read_request_head(&conn, &head))
+			break;
+		if (parse_request_head(&conn, head.buf, &req)) {
+			static const char bad[] =
+				"HTTP/1.0 400 Bad Request\r\n"
+				"Connection: close\r\n\r\n";
+			write_in_full(fd, bad, strlen(bad));
+			http_request_clear(&req);
+			break;
+		}
+		ret = serve_http_request(&conn, &req);
+		http_request_clear(&req);
+		if (ret)
+			break;
+	}
+
+	close(fd);
+	strbuf_release(&head);
+	strbuf_release(&conn.in);
+	free(conn.remote_addr);
+}
+
+static int http_server(const char *listen_addr, const char *port)
+{
+	struct addrinfo hints, *ai, *ai0;
+	int sockfd = -1, gai, on = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	gai = getaddrinfo(listen_addr, port, &hints, &ai0);
+	if (gai)
+		die("getaddrinfo() for %s failed: %s",
+		    listen_addr ? listen_addr : "*", gai_strerror(gai));
+	for (ai = ai0; ai; ai = ai->ai_next) {
+		sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (sockfd < 0)
+			continue;
+		setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (!bind(sockfd, ai->ai_addr, ai->ai_addrlen) &&
+		    !listen(sockfd, 128))
+			break;
+		close(sockfd);
+		sockfd = -1;
+	}
+	freeaddrinfo(ai0);
+	if (sockfd < 0)
+		die_errno("unable to listen on port %s", port);
+
+	/* Connections are not waited for; let them be reaped. */
+	signal(SIGCHLD, SIG_IGN);
+
+	fprintf(stderr, "[%"PRIuMAX"] Listening on port %s\n",
+		(uintmax_t)getpid(), port);
+
+	for (;;) {
+		struct sockaddr_storage ss;
+		socklen_t sslen = sizeof(ss);
+		char addr[NI_MAXHOST];
+		pid_t pid;
+		int fd;
+
+		fd = accept(sockfd, (struct sockaddr *)&ss, &sslen);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			die_errno("accept failed");
+		}
+		if (getnameinfo((struct sockaddr *)&ss, sslen, addr,
+				sizeof(addr), NULL, 0, NI_NUMERICHOST))
+			xsnprintf(addr, sizeof(addr), "(unknown)");
+
+		pid = fork();
+		if (pid < 0) {
+			error_errno("unable to fork");
+		} else if (!pid) {
+			close(sockfd);
+			signal(SIGCHLD, SIG_DFL);
+			serve_connection(fd, addr);
+			exit(0);
+		}
+		close(fd);
+	}
+}
+
+int cmd_main(int argc, const char **argv)
+{
+	const char *listen_addr = NULL, *port = NULL;
+	int i;
+
+	if (argc == 1)
+		return serve_request();
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *v;
+
+		if (skip_prefix(arg, "--listen=", &v))
+			listen_addr = v;
+		else if (skip_prefix(arg, "--port=", &v))
+			port = v;
+		else if (skip_prefix(arg, "--timeout=", &v))
+			idle_timeout = atoi(v);
+		else
+			usage(http_server_usage);
+	}
+	if (!port)
+		usage(http_server_usage);
+
+	setvbuf(stderr, NULL, _IOLBF, 0);
+	return http_server(listen_addr, port);
+}
+
+#else
+
+int cmd_main(int argc, const char **argv)
+{
+	if (argc > 1)
+		die("serving HTTP by ourselves is not supported on this platform");
+	return serve_request();
+}
+
+#endif
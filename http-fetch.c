@@ -3,9 +3,60 @@
 #include "exec-cmd.h"
 #include "http.h"
 #include "walker.h"
+#include "run-command.h"
+#include "argv-array.h"
 
 static const char http_fetch_usage[] = "git http-fetch "
-"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url";
+"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url\n"
+"   or: git http-fetch --packfile=<hash> [--index-pack-arg=<arg>...] url";
+
+/*
+ * Download the pack at "url", which must have the checksum "hash", and
+ * index it into the repository.
+ */
+static void fetch_single_packfile(const struct object_id *hash,
+				  const char *url,
+				  const struct argv_array *index_pack_args)
+{
+	struct child_process ip = CHILD_PROCESS_INIT;
+	struct strbuf tmpfile = STRBUF_INIT;
+	struct strbuf out = STRBUF_INIT;
+	const char *p;
+	int fd, ret;
+
+	/* named after the pack, so that an interrupted download resumes */
+	strbuf_addf(&tmpfile, "%s/pack/tmp_uri_pack_%s",
+		    get_object_directory(), oid_to_hex(hash));
+	if (safe_create_leading_directories(tmpfile.buf))
+		die_errno(_("unable to create directory for '%s'"), tmpfile.buf);
+	if (http_get_file(url, tmpfile.buf, NULL) != HTTP_OK)
+		die(_("unable to download pack from '%s'"), url);
+
+	fd = xopen(tmpfile.buf, O_RDONLY);
+	ip.git_cmd = 1;
+	ip.in = fd;
+	ip.out = -1;
+	argv_array_pushl(&ip.args, "index-pack", "--stdin", NULL);
+	argv_array_pushv(&ip.args, index_pack_args->argv);
+	if (start_command(&ip))
+		die(_("unable to run index-pack"));
+	if (strbuf_read(&out, ip.out, 0) < 0)
+		die_errno(_("unable to read the output of index-pack"));
+	close(ip.out);
+	ret = finish_command(&ip);
+	unlink_or_warn(tmpfile.buf);
+	if (ret)
+		die(_("unable to index the pack from '%s'"), url);
+
+	if ((!skip_prefix(out.buf, "pack\t", &p) &&
+	     !skip_prefix(out.buf, "keep\t", &p)) ||
+	    strncmp(p, oid_to_hex(hash), GIT_SHA1_HEXSZ))
+		die(_("pack from '%s' is not the expected pack %s"),
+		    url, oid_to_hex(hash));
+
+	strbuf_release(&tmpfile);
+	strbuf_release(&out);
+}
 
 int cmd_main(int argc, const char **argv)
 {
@@ -19,9 +70,20 @@ int cmd_main(int argc, const char **argv)
 	int rc = 0;
 	int get_verbosely = 0;
 	int get_recover = 0;
+	int packfile = 0;
+	struct object_id packfile_hash;
+	struct argv_array index_pack_args = ARGV_ARRAY_INIT;
 
 	while (arg < argc && argv[arg][0] == '-') {
-		if (argv[arg][1] == 't') {
+		const char *p;
+
+		if (skip_prefix(argv[arg], "--packfile=", &p)) {
+			if (get_oid_hex(p, &packfile_hash) || p[GIT_SHA1_HEXSZ])
+				die(_("argument to --packfile must be a pack hash"));
+			packfile = 1;
+		} else if (skip_prefix(argv[arg], "--index-pack-arg=", &p)) {
+			argv_array_push(&index_pack_args, p);
+		} else if (argv[arg][1] == 't') {
 		} else if (argv[arg][1] == 'c') {
 		} else if (argv[arg][1] == 'a') {
 		} else if (argv[arg][1] == 'v') {
@@ -38,6 +100,23 @@ int cmd_main(int argc, const char **argv)
 		}
 		arg++;
 	}
+
+	if (packfile) {
+		if (argc != arg + 1 || commits_on_stdin)
+			usage(http_fetch_usage);
+
+		setup_git_directory();
+		git_config(git_default_config, NULL);
+
+		http_init(NULL, argv[arg], 0);
+		fetch_single_packfile(&packfile_hash, argv[arg],
+				      &index_pack_args);
+		http_cleanup();
+
+		argv_array_clear(&index_pack_args);
+		return 0;
+	}
+
 	if (argc != arg + 2 - commits_on_stdin)
 		usage(http_fetch_usage);
 	if (commits_on_stdin) {
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "tag.h"
 #include "blob.h"
 #include "http.h"
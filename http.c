@@ -41,6 +41,13 @@ static CURLM *curlm;
 #ifndef NO_CURL_EASY_DUPHANDLE
 static CURL *curl_default;
 #endif
+#if LIBCURL_VERSION_NUM >= 0x070a03
+/*
+ * Shared between all the handles, so that a fresh handle neither
+ * resolves the host again nor makes a full TLS handshake.
+ */
+static CURLSH *curlsh;
+#endif
 
 #define PREV_BUF_SIZE 4096
 
@@ -67,6 +74,16 @@ static struct {
 	{ "tlsv1.3", CURL_SSLVERSION_TLSv1_3 },
 #endif
 };
+#if LIBCURL_VERSION_NUM >= 0x072b00
+static const char *curl_http_version;
+static struct {
+	const char *name;
+	long http_version;
+} http_versions[] = {
+	{ "HTTP/1.1", CURL_HTTP_VERSION_1_1 },
+	{ "HTTP/2", CURL_HTTP_VERSION_2_0 },
+};
+#endif
 #if LIBCURL_VERSION_NUM >= 0x070903
 static const char *ssl_key;
 #endif
@@ -207,10 +224,52 @@ static void closedown_active_slot(struct active_request_slot *slot)
 	slot->in_use = 0;
 }
 
+/*
+ * Report how long the request just finished by "slot" took, and where
+ * the time went, to GIT_TRACE_PERFORMANCE and GIT_TRACE_CURL.
+ */
+static void trace_request_timing(struct active_request_slot *slot)
+{
+	struct strbuf buf = STRBUF_INIT;
+	double namelookup = 0, connect = 0, appconnect = 0;
+	double starttransfer = 0, total = 0;
+	long new_connections = 0;
+	char *url = NULL;
+
+	if (!trace_want(&trace_perf_key) && !trace_want(&trace_curl))
+		return;
+
+	curl_easy_getinfo(slot->curl, CURLINFO_EFFECTIVE_URL, &url);
+	curl_easy_getinfo(slot->curl, CURLINFO_NAMELOOKUP_TIME, &namelookup);
+	curl_easy_getinfo(slot->curl, CURLINFO_CONNECT_TIME, &connect);
+#if LIBCURL_VERSION_NUM >= 0x071300
+	curl_easy_getinfo(slot->curl, CURLINFO_APPCONNECT_TIME, &appconnect);
+#endif
+	curl_easy_getinfo(slot->curl, CURLINFO_STARTTRANSFER_TIME,
+			  &starttransfer);
+	curl_easy_getinfo(slot->curl, CURLINFO_TOTAL_TIME, &total);
+#if LIBCURL_VERSION_NUM >= 0x070c03
+	curl_easy_getinfo(slot->curl, CURLINFO_NUM_CONNECTS, &new_connections);
+#endif
+
+	url = transport_anonymize_url(url ? url : "");
+	strbuf_addf(&buf, "http request %s (HTTP %ld): namelookup %.6f s, "
+		    "connect %.6f s, appconnect %.6f s, starttransfer %.6f s, "
+		    "new connections %ld",
+		    url, slot->http_code, namelookup, connect,
+		    appconnect, starttransfer, new_connections);
+	free(url);
+	trace_performance((uint64_t)(total * 1000000000.0), "%s", buf.buf);
+	trace_printf_key(&trace_curl, "== Info: %s, total %.6f s\n",
+			 buf.buf, total);
+	strbuf_release(&buf);
+}
+
 static void finish_active_slot(struct active_request_slot *slot)
 {
 	closedown_active_slot(slot);
 	curl_easy_getinfo(slot->curl, CURLINFO_HTTP_CODE, &slot->http_code);
+	trace_request_timing(slot);
 
 	if (slot->finished != NULL)
 		(*slot->finished) = 1;
@@ -282,6 +341,10 @@ static int http_options(const char *var, const char *value, void *cb)
 		return git_config_string(&ssl_cipherlist, var, value);
 	if (!strcmp("http.sslversion", var))
 		return git_config_string(&ssl_version, var, value);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	if (!strcmp("http.version", var))
+		return git_config_string(&curl_http_version, var, value);
+#endif
 	if (!strcmp("http.sslcert", var))
 		return git_config_pathname(&ssl_cert, var, value);
 #if LIBCURL_VERSION_NUM >= 0x070903
@@ -822,6 +885,22 @@ static CURL *get_curl_handle(void)
 				ssl_version);
 	}
 
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	if (curl_http_version) {
+		int i;
+		for (i = 0; i < ARRAY_SIZE(http_versions); i++) {
+			if (!strcmp(curl_http_version, http_versions[i].name)) {
+				curl_easy_setopt(result, CURLOPT_HTTP_VERSION,
+						 http_versions[i].http_version);
+				break;
+			}
+		}
+		if (i == ARRAY_SIZE(http_versions))
+			warning("unsupported http version %s: using default",
+				curl_http_version);
+	}
+#endif
+
 	if (getenv("GIT_SSL_CIPHER_LIST"))
 		ssl_cipherlist = getenv("GIT_SSL_CIPHER_LIST");
 	if (ssl_cipherlist != NULL && *ssl_cipherlist)
@@ -1021,6 +1100,20 @@ void http_init(struct remote *remote, const char *url, int proactive_auth)
 	curlm = curl_multi_init();
 	if (!curlm)
 		die("curl_multi_init failed");
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/* let concurrent requests to a HTTP/2 server share a connection */
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x070a03
+	curlsh = curl_share_init();
+	if (!curlsh)
+		die("curl_share_init failed");
+	curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x071700
+	curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#endif
 #endif
 
 	if (getenv("GIT_SSL_NO_VERIFY"))
@@ -1090,6 +1183,10 @@ void http_cleanup(void)
 
 #ifdef USE_CURL_MULTI
 	curl_multi_cleanup(curlm);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x070a03
+	curl_share_cleanup(curlsh);
+	curlsh = NULL;
 #endif
 	curl_global_cleanup();
 
@@ -1168,6 +1265,9 @@ struct active_request_slot *get_active_slot(void)
 		slot->curl = get_curl_handle();
 #else
 		slot->curl = curl_easy_duphandle(curl_default);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x070a03
+		curl_easy_setopt(slot->curl, CURLOPT_SHARE, curlsh);
 #endif
 		curl_session_count++;
 	}
@@ -1916,8 +2016,8 @@ int http_get_strbuf(const char *url,
  * If a previous interrupted download is detected (i.e. a previous temporary
  * file is still around) the download is resumed.
  */
-static int http_get_file(const char *url, const char *filename,
-			 struct http_get_options *options)
+int http_get_file(const char *url, const char *filename,
+		  struct http_get_options *options)
 {
 	int ret;
 	struct strbuf tmpfile = STRBUF_INIT;
@@ -37,6 +37,12 @@
 #include "kwset.h"
 #include "compat/obstack.h"
 
+/* With SSE2, a single keyword is searched for 16 positions at a time. */
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define KWSET_PAIRS 1
+#endif
+
 #define NCHAR (UCHAR_MAX + 1)
 #define obstack_chunk_alloc xmalloc
 #define obstack_chunk_free free
@@ -79,6 +85,9 @@ struct kwset
   char *target;			/* Target string if there's only one. */
   int mind2;			/* Used in Boyer-Moore search for one string. */
   unsigned char const *trans;  /* Character translation table. */
+  int use_pairs;		/* Whether pairexec can search for target. */
+  unsigned char pairs[2][2];	/* Text bytes matching the first and the
+				   last bytes of target. */
 };
 
 /* Allocate and initialize a keyword set object, returning an opaque
@@ -110,6 +119,7 @@ kwsalloc (unsigned char const *trans)
   kwset->maxd = -1;
   kwset->target = NULL;
   kwset->trans = trans;
+  kwset->use_pairs = 0;
 
   return (kwset_t) kwset;
 }
@@ -371,6 +381,52 @@ treenext (struct tree const *tree, struct trie *next[])
   next[tree->label] = tree->trie;
 }
 
+/* Extract the only string of the keyword set from the trie. Return
+   nonzero if memory is not available. */
+static int
+extract_target (struct kwset *kwset)
+{
+  struct trie *curr;
+  int i;
+
+  kwset->target = obstack_alloc(&kwset->obstack, kwset->mind);
+  if (!kwset->target)
+    return -1;
+  for (i = kwset->mind - 1, curr = kwset->trie; i >= 0; --i)
+    {
+      kwset->target[i] = curr->links->label;
+      curr = curr->links->trie;
+    }
+  return 0;
+}
+
+#ifdef KWSET_PAIRS
+/* Store in BYTES the characters of the text that translate to the
+   character C of a keyword.  Return zero if there are none, or more
+   than two of them. */
+static int
+text_bytes (struct kwset const *kwset, unsigned char c, unsigned char *bytes)
+{
+  int i, n = 0;
+
+  if (!kwset->trans)
+    {
+      bytes[0] = bytes[1] = c;
+      return 1;
+    }
+  for (i = 0; i < NCHAR; ++i)
+    if (kwset->trans[i] == c)
+      {
+	if (n == 2)
+	  return 0;
+	bytes[n++] = i;
+      }
+  if (n == 1)
+    bytes[1] = bytes[0];
+  return n;
+}
+#endif
+
 /* Compute the shift for each trie node, as well as the delta
    table and next cache for the given keyword set. */
 const char *
@@ -396,14 +452,8 @@ kwsprep (kwset_t kws)
       char c;
 
       /* Looking for just one string.  Extract it from the trie. */
-      kwset->target = obstack_alloc(&kwset->obstack, kwset->mind);
-      if (!kwset->target)
+      if (extract_target(kwset))
 	return "memory exhausted";
-      for (i = kwset->mind - 1, curr = kwset->trie; i >= 0; --i)
-	{
-	  kwset->target[i] = curr->links->label;
-	  curr = curr->links->trie;
-	}
       /* Build the Boyer Moore delta.  Boy that's easy compared to CW. */
       for (i = 0; i < kwset->mind; ++i)
 	delta[U(kwset->target[i])] = kwset->mind - (i + 1);
@@ -485,6 +535,21 @@ kwsprep (kwset_t kws)
   else
     memcpy(kwset->delta, delta, NCHAR);
 
+#ifdef KWSET_PAIRS
+  /* A single string of at least two characters, each end of which
+     matches at most two characters of the text, can be searched for
+     with pairexec. */
+  if (kwset->words == 1 && kwset->mind >= 2)
+    {
+      if (!kwset->target && extract_target(kwset))
+	return "memory exhausted";
+      kwset->use_pairs
+	= (text_bytes(kwset, U(kwset->target[0]), kwset->pairs[0])
+	   && text_bytes(kwset, U(kwset->target[kwset->mind - 1]),
+			 kwset->pairs[1]));
+    }
+#endif
+
   return NULL;
 }
 
@@ -574,6 +639,76 @@ bmexec (kwset_t kws, char const *text, size_t size)
   return -1;
 }
 
+#ifdef KWSET_PAIRS
+/* Whether the text at TP, the first and last characters of which are
+   known to match, is the target. */
+static inline int
+pair_matches (struct kwset const *kwset, char const *tp)
+{
+  unsigned char const *trans = kwset->trans;
+  int i, len = kwset->mind;
+
+  if (!trans)
+    return !memcmp(tp + 1, kwset->target + 1, len - 2);
+  for (i = 1; i < len - 1; ++i)
+    if (trans[U(tp[i])] != U(kwset->target[i]))
+      return 0;
+  return 1;
+}
+
+/* Search for a single string by comparing the characters at 16
+   positions with its first character, and the characters LEN - 1
+   further with its last one, at once; only where both match do we
+   compare the rest. */
+static size_t
+pairexec (kwset_t kws, char const *text, size_t size)
+{
+  struct kwset const *kwset = (struct kwset const *) kws;
+  unsigned char const *f = kwset->pairs[0], *l = kwset->pairs[1];
+  size_t len = kwset->mind;
+  char const *tp, *ep;
+  __m128i f0, f1, l0, l1;
+
+  if (len > size)
+    return -1;
+
+  f0 = _mm_set1_epi8(f[0]);
+  f1 = _mm_set1_epi8(f[1]);
+  l0 = _mm_set1_epi8(l[0]);
+  l1 = _mm_set1_epi8(l[1]);
+
+  /* The last place a match can start. */
+  ep = text + size - len;
+  for (tp = text; ep - tp >= 15; tp += 16)
+    {
+      __m128i a = _mm_loadu_si128((__m128i const *) tp);
+      __m128i b = _mm_loadu_si128((__m128i const *) (tp + len - 1));
+      unsigned int mask;
+
+      a = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+      b = _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1));
+      mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+      while (mask)
+	{
+	  int i = __builtin_ctz(mask);
+
+	  if (pair_matches(kwset, tp + i))
+	    return tp + i - text;
+	  mask &= mask - 1;
+	}
+    }
+
+  /* Fewer than 16 places are left. */
+  for (; tp <= ep; ++tp)
+    if ((U(*tp) == f[0] || U(*tp) == f[1])
+	&& (U(tp[len - 1]) == l[0] || U(tp[len - 1]) == l[1])
+	&& pair_matches(kwset, tp))
+      return tp - text;
+
+  return -1;
+}
+#endif
+
 /* Hairy multiple string search. */
 static size_t
 cwexec (kwset_t kws, char const *text, size_t len, struct kwsmatch *kwsmatch)
@@ -742,6 +877,19 @@ kwsexec (kwset_t kws, char const *text, size_t size,
 	 struct kwsmatch *kwsmatch)
 {
   struct kwset const *kwset = (struct kwset *) kws;
+#ifdef KWSET_PAIRS
+  if (kwset->use_pairs)
+    {
+      size_t ret = pairexec (kws, text, size);
+      if (kwsmatch != NULL && ret != (size_t) -1)
+	{
+	  kwsmatch->index = 0;
+	  kwsmatch->offset[0] = ret;
+	  kwsmatch->size[0] = kwset->mind;
+	}
+      return ret;
+    }
+#endif
   if (kwset->words == 1 && kwset->trans == NULL)
     {
       size_t ret = bmexec (kws, text, size);
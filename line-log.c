@@ -15,6 +15,9 @@
 #include "userdiff.h"
 #include "line-log.h"
 #include "argv-array.h"
+#include "tree-walk.h"
+#include "commit-graph.h"
+#include "bloom.h"
 
 static void range_set_grow(struct range_set *rs, size_t extra)
 {
@@ -536,6 +539,49 @@ static void fill_line_ends(struct diff_filespec *spec, long *lines,
 	*line_ends = ends;
 }
 
+/*
+ * The line ends of the blobs dump_diff_hacky_one() looked at last. The
+ * preimage of a commit it shows is often the postimage of the next one,
+ * which then need not be scanned again.
+ */
+static struct line_ends_cache {
+	struct object_id oid;
+	long lines;
+	unsigned long *ends;
+	unsigned used;
+} line_ends_cache[2];
+static unsigned line_ends_clock;
+
+/*
+ * Like fill_line_ends(), but the table stays owned by the cache, and
+ * is valid until the line ends of two more blobs have been asked for.
+ */
+static unsigned long *cached_line_ends(struct diff_filespec *spec, long *lines)
+{
+	struct line_ends_cache *c = &line_ends_cache[0];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(line_ends_cache); i++) {
+		if (line_ends_cache[i].ends &&
+		    !oidcmp(&line_ends_cache[i].oid, &spec->oid)) {
+			c = &line_ends_cache[i];
+			if (diff_populate_filespec(spec, 0))
+				die("Cannot read blob %s", oid_to_hex(&spec->oid));
+			goto out;
+		}
+		if (line_ends_cache[i].used < c->used)
+			c = &line_ends_cache[i];
+	}
+
+	free(c->ends);
+	oidcpy(&c->oid, &spec->oid);
+	fill_line_ends(spec, &c->lines, &c->ends);
+ out:
+	c->used = ++line_ends_clock;
+	*lines = c->lines;
+	return c->ends;
+}
+
 struct nth_line_cb {
 	struct diff_filespec *spec;
 	long lines;
@@ -827,6 +873,76 @@ static void queue_diffs(struct line_log_data *range,
 	move_diff_queue(queue, &diff_queued_diff);
 }
 
+/*
+ * Return 1 if the changed-path filter of "commit" says that it leaves
+ * all the paths in "range" alone, 0 if it cannot tell.
+ */
+static int bloom_says_paths_unchanged(struct commit *commit,
+				      struct line_log_data *range)
+{
+	static struct bloom_filter_settings *settings;
+	static int initialized;
+	struct bloom_filter *filter;
+	struct line_log_data *r;
+
+	if (!initialized) {
+		settings = get_bloom_filter_settings();
+		if (settings)
+			init_bloom_filters();
+		initialized = 1;
+	}
+	if (!settings || commit->generation == GENERATION_NUMBER_INFINITY)
+		return 0;
+	filter = get_bloom_filter(commit, 0);
+	if (!filter)
+		return 0;
+
+	for (r = range; r; r = r->next) {
+		struct bloom_key key;
+		int contains;
+
+		if (!r->ranges.nr)
+			continue;
+		fill_bloom_key(r->path, strlen(r->path), &key, settings);
+		contains = bloom_filter_contains(filter, &key, settings);
+		clear_bloom_key(&key);
+		if (contains)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Return 1 if each of the paths "range" still tracks lines in is the
+ * same blob in "commit" as in "parent". Then no diff between them can
+ * touch the ranges, renames or not, and looking at the trees along the
+ * paths is all it takes to know that the ranges pass to "parent" as
+ * they are.
+ */
+static int range_paths_unchanged(struct commit *commit, struct commit *parent,
+				 int first_parent, struct line_log_data *range)
+{
+	struct line_log_data *r;
+
+	if (first_parent && bloom_says_paths_unchanged(commit, range))
+		return 1;
+
+	for (r = range; r; r = r->next) {
+		struct object_id oid, parent_oid;
+		unsigned mode, parent_mode;
+
+		if (!r->ranges.nr)
+			continue;
+		if (get_tree_entry(get_commit_tree_oid(commit), r->path,
+				   &oid, &mode) ||
+		    get_tree_entry(get_commit_tree_oid(parent), r->path,
+				   &parent_oid, &parent_mode) ||
+		    mode != parent_mode || oidcmp(&oid, &parent_oid))
+			return 0;
+	}
+	return 1;
+}
+
 static char *get_nth_line(long line, unsigned long *ends, void *data)
 {
 	if (line == 0)
@@ -891,8 +1007,8 @@ static void dump_diff_hacky_one(struct rev_info *rev, struct line_log_data *rang
 		return;
 
 	if (pair->one->oid_valid)
-		fill_line_ends(pair->one, &p_lines, &p_ends);
-	fill_line_ends(pair->two, &t_lines, &t_ends);
+		p_ends = cached_line_ends(pair->one, &p_lines);
+	t_ends = cached_line_ends(pair->two, &t_lines);
 
 	fprintf(opt->file, "%s%sdiff --git a/%s b/%s%s\n", prefix, c_meta, pair->one->path, pair->two->path, c_reset);
 	fprintf(opt->file, "%s%s--- %s%s%s\n", prefix, c_meta,
@@ -962,9 +1078,6 @@ static void dump_diff_hacky_one(struct rev_info *rev, struct line_log_data *rang
 			print_line(prefix, ' ', t_cur, t_ends, pair->two->data,
 				   c_context, c_reset, opt->file);
 	}
-
-	free(p_ends);
-	free(t_ends);
 }
 
 /*
@@ -1118,6 +1231,11 @@ static int process_ranges_ordinary_commit(struct rev_info *rev, struct commit *c
 	if (commit->parents)
 		parent = commit->parents->item;
 
+	if (parent && range_paths_unchanged(commit, parent, 1, range)) {
+		add_line_range(rev, parent, range);
+		return 0;
+	}
+
 	queue_diffs(range, &rev->diffopt, &queue, commit, parent);
 	changed = process_all_files(&parent_range, rev, &queue, range);
 	if (parent)
@@ -1147,13 +1265,25 @@ static int process_ranges_merge_commit(struct rev_info *rev, struct commit *comm
 	for (i = 0; i < nparents; i++) {
 		parents[i] = p->item;
 		p = p->next;
-		queue_diffs(range, &rev->diffopt, &diffqueues[i], commit, parents[i]);
+		DIFF_QUEUE_CLEAR(&diffqueues[i]);
 	}
 
 	for (i = 0; i < nparents; i++) {
 		int changed;
 		cand[i] = NULL;
-		changed = process_all_files(&cand[i], rev, &diffqueues[i], range);
+		/*
+		 * The diff against a parent is only needed when no
+		 * parent before it took all the blame.
+		 */
+		if (range_paths_unchanged(commit, parents[i], !i, range)) {
+			cand[i] = line_log_data_copy(range);
+			changed = 0;
+		} else {
+			queue_diffs(range, &rev->diffopt, &diffqueues[i],
+				    commit, parents[i]);
+			changed = process_all_files(&cand[i], rev,
+						    &diffqueues[i], range);
+		}
 		if (!changed) {
 			/*
 			 * This parent can take all the blame, so we
@@ -10,7 +10,7 @@
 #include "list-objects.h"
 #include "list-objects-filter.h"
 #include "list-objects-filter-options.h"
-#include "oidset.h"
+#include "compact-oidset.h"
 #include "object-store.h"
 
 /* Remember to update object flag allocation in object.h */
@@ -30,7 +30,7 @@
  * And to OPTIONALLY collect a list of the omitted OIDs.
  */
 struct filter_blobs_none_data {
-	struct oidset *omits;
+	struct compact_oidset *omits;
 };
 
 static enum list_objects_filter_result filter_blobs_none(
@@ -61,13 +61,13 @@ static enum list_objects_filter_result filter_blobs_none(
 		assert((obj->flags & SEEN) == 0);
 
 		if (filter_data->omits)
-			oidset_insert(filter_data->omits, &obj->oid);
+			compact_oidset_insert(filter_data->omits, &obj->oid);
 		return LOFR_MARK_SEEN; /* but not LOFR_DO_SHOW (hard omit) */
 	}
 }
 
 static void *filter_blobs_none__init(
-	struct oidset *omitted,
+	struct compact_oidset *omitted,
 	struct list_objects_filter_options *filter_options,
 	filter_object_fn *filter_fn,
 	filter_free_fn *filter_free_fn)
@@ -85,7 +85,7 @@ static void *filter_blobs_none__init(
  * And to OPTIONALLY collect a list of the omitted OIDs.
  */
 struct filter_blobs_limit_data {
-	struct oidset *omits;
+	struct compact_oidset *omits;
 	unsigned long max_bytes;
 };
 
@@ -133,18 +133,18 @@ static enum list_objects_filter_result filter_blobs_limit(
 			goto include_it;
 
 		if (filter_data->omits)
-			oidset_insert(filter_data->omits, &obj->oid);
+			compact_oidset_insert(filter_data->omits, &obj->oid);
 		return LOFR_MARK_SEEN; /* but not LOFR_DO_SHOW (hard omit) */
 	}
 
 include_it:
 	if (filter_data->omits)
-		oidset_remove(filter_data->omits, &obj->oid);
+		compact_oidset_remove(filter_data->omits, &obj->oid);
 	return LOFR_MARK_SEEN | LOFR_DO_SHOW;
 }
 
 static void *filter_blobs_limit__init(
-	struct oidset *omitted,
+	struct compact_oidset *omitted,
 	struct list_objects_filter_options *filter_options,
 	filter_object_fn *filter_fn,
 	filter_free_fn *filter_free_fn)
@@ -188,7 +188,7 @@ struct frame {
 };
 
 struct filter_sparse_data {
-	struct oidset *omits;
+	struct compact_oidset *omits;
 	struct exclude_list el;
 
 	size_t nr, alloc;
@@ -284,7 +284,7 @@ static enum list_objects_filter_result filter_sparse(
 			val = frame->defval;
 		if (val > 0) {
 			if (filter_data->omits)
-				oidset_remove(filter_data->omits, &obj->oid);
+				compact_oidset_remove(filter_data->omits, &obj->oid);
 			return LOFR_MARK_SEEN | LOFR_DO_SHOW;
 		}
 
@@ -299,7 +299,7 @@ static enum list_objects_filter_result filter_sparse(
 		 * again in the traversal, we will be asked again.
 		 */
 		if (filter_data->omits)
-			oidset_insert(filter_data->omits, &obj->oid);
+			compact_oidset_insert(filter_data->omits, &obj->oid);
 
 		/*
 		 * Remember that at least 1 blob in this tree was
@@ -320,7 +320,7 @@ static void filter_sparse_free(void *filter_data)
 }
 
 static void *filter_sparse_oid__init(
-	struct oidset *omitted,
+	struct compact_oidset *omitted,
 	struct list_objects_filter_options *filter_options,
 	filter_object_fn *filter_fn,
 	filter_free_fn *filter_free_fn)
@@ -341,7 +341,7 @@ static void *filter_sparse_oid__init(
 }
 
 static void *filter_sparse_path__init(
-	struct oidset *omitted,
+	struct compact_oidset *omitted,
 	struct list_objects_filter_options *filter_options,
 	filter_object_fn *filter_fn,
 	filter_free_fn *filter_free_fn)
@@ -362,7 +362,7 @@ static void *filter_sparse_path__init(
 }
 
 typedef void *(*filter_init_fn)(
-	struct oidset *omitted,
+	struct compact_oidset *omitted,
 	struct list_objects_filter_options *filter_options,
 	filter_object_fn *filter_fn,
 	filter_free_fn *filter_free_fn);
@@ -379,7 +379,7 @@ static filter_init_fn s_filters[] = {
 };
 
 void *list_objects_filter__init(
-	struct oidset *omitted,
+	struct compact_oidset *omitted,
 	struct list_objects_filter_options *filter_options,
 	filter_object_fn *filter_fn,
 	filter_free_fn *filter_free_fn)
@@ -69,7 +69,7 @@ typedef void (*filter_free_fn)(void *filter_data);
  * filter_data.
  */
 void *list_objects_filter__init(
-	struct oidset *omitted,
+	struct compact_oidset *omitted,
 	struct list_objects_filter_options *filter_options,
 	filter_object_fn *filter_fn,
 	filter_free_fn *filter_free_fn);
@@ -11,6 +11,18 @@
 #include "list-objects-filter-options.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "ewah/ewok.h"
+
+/*
+ * With revs->compact_blobs, the blobs seen so far that are in a pack
+ * are kept as bits in a bitmap per pack, by their position in its
+ * index.
+ */
+static struct compact_seen {
+	struct packed_git *pack;
+	struct bitmap *seen;
+} *compact_seen;
+static int compact_seen_nr, compact_seen_alloc;
 
 static void process_blob(struct rev_info *revs,
 			 struct blob *blob,
@@ -59,6 +71,93 @@ static void process_blob(struct rev_info *revs,
 	strbuf_setlen(path, pathlen);
 }
 
+/*
+ * Find the bitmap and position of the blob "oid" in compact_seen, or
+ * return NULL if it is not in any pack.
+ */
+static struct bitmap *compact_seen_bit(const struct object_id *oid,
+				       uint32_t *pos)
+{
+	struct list_head *p;
+
+	list_for_each(p, get_packed_git_mru(the_repository)) {
+		struct packed_git *pack = list_entry(p, struct packed_git, mru);
+		int i;
+
+		if (open_pack_index(pack) || !bsearch_pack(oid, pack, pos))
+			continue;
+		for (i = 0; i < compact_seen_nr; i++)
+			if (compact_seen[i].pack == pack)
+				return compact_seen[i].seen;
+		ALLOC_GROW(compact_seen, compact_seen_nr + 1, compact_seen_alloc);
+		compact_seen[compact_seen_nr].pack = pack;
+		compact_seen[compact_seen_nr].seen = bitmap_new();
+		return compact_seen[compact_seen_nr++].seen;
+	}
+	return NULL;
+}
+
+static void clear_compact_seen(void)
+{
+	int i;
+
+	for (i = 0; i < compact_seen_nr; i++)
+		bitmap_free(compact_seen[i].seen);
+	FREE_AND_NULL(compact_seen);
+	compact_seen_nr = compact_seen_alloc = 0;
+}
+
+/*
+ * Like process_blob(), but without creating a "struct blob" for the
+ * blobs that are in a pack.
+ */
+static void process_compact_blob(struct rev_info *revs,
+				 const struct object_id *oid,
+				 show_object_fn show,
+				 struct strbuf *path,
+				 const char *name,
+				 void *cb_data)
+{
+	struct object *obj;
+	struct bitmap *seen;
+	struct blob scratch;
+	uint32_t pos;
+	size_t pathlen;
+
+	if (!revs->blob_objects)
+		return;
+
+	/* given on the command line, or marked uninteresting */
+	obj = lookup_object(oid->hash);
+	if (obj && (obj->flags & (UNINTERESTING | SEEN)))
+		return;
+
+	seen = compact_seen_bit(oid, &pos);
+	if (!seen) {
+		process_blob(revs, lookup_blob(oid), show, path, name,
+			     cb_data, NULL, NULL);
+		return;
+	}
+	if (bitmap_get(seen, pos))
+		return;
+	bitmap_set(seen, pos);
+	if (obj) {
+		process_blob(revs, lookup_blob(oid), show, path, name,
+			     cb_data, NULL, NULL);
+		return;
+	}
+
+	memset(&scratch, 0, sizeof(scratch));
+	scratch.object.type = OBJ_BLOB;
+	scratch.object.flags = SEEN;
+	oidcpy(&scratch.object.oid, oid);
+
+	pathlen = path->len;
+	strbuf_addstr(path, name);
+	show(&scratch.object, path->buf, cb_data);
+	strbuf_setlen(path, pathlen);
+}
+
 /*
  * Processing a gitlink entry currently does nothing, since
  * we do not recurse into the subproject.
@@ -165,6 +264,10 @@ static void process_tree(struct rev_info *revs,
 			process_gitlink(revs, entry.oid->hash,
 					show, base, entry.path,
 					cb_data);
+		else if (revs->compact_blobs && !filter_fn)
+			process_compact_blob(revs, entry.oid,
+					     show, base, entry.path,
+					     cb_data);
 		else
 			process_blob(revs,
 				     lookup_blob(entry.oid),
@@ -319,6 +422,7 @@ static void do_traverse(struct rev_info *revs,
 				 show_object, show_data,
 				 filter_fn, filter_data);
 	strbuf_release(&csp);
+	clear_compact_seen();
 }
 
 void traverse_commit_list(struct rev_info *revs,
@@ -335,7 +439,7 @@ void traverse_commit_list_filtered(
 	show_commit_fn show_commit,
 	show_object_fn show_object,
 	void *show_data,
-	struct oidset *omitted)
+	struct compact_oidset *omitted)
 {
 	filter_object_fn filter_fn = NULL;
 	filter_free_fn filter_free_fn = NULL;
@@ -8,7 +8,7 @@ void traverse_commit_list(struct rev_info *, show_commit_fn, show_object_fn, voi
 typedef void (*show_edge_fn)(struct commit *);
 void mark_edges_uninteresting(struct rev_info *, show_edge_fn);
 
-struct oidset;
+struct compact_oidset;
 struct list_objects_filter_options;
 
 void traverse_commit_list_filtered(
@@ -17,6 +17,6 @@ void traverse_commit_list_filtered(
 	show_commit_fn show_commit,
 	show_object_fn show_object,
 	void *show_data,
-	struct oidset *omitted);
+	struct compact_oidset *omitted);
 
 #endif /* LIST_OBJECTS_H */
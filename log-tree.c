@@ -89,6 +89,11 @@ static int add_ref_decoration(const char *refname, const struct object_id *oid,
 			      filter->exclude_ref_pattern))
 		return 0;
 
+	/* the refs of the maintenance prefetch task, unless asked for */
+	if (starts_with(refname, "refs/prefetch/") &&
+	    !(filter && filter->include_ref_pattern->nr))
+		return 0;
+
 	if (starts_with(refname, git_replace_ref_base)) {
 		struct object_id original_oid;
 		if (!check_replace_refs)
@@ -446,14 +451,22 @@ static void show_signature(struct rev_info *opt, struct commit *commit)
 	struct strbuf payload = STRBUF_INIT;
 	struct strbuf signature = STRBUF_INIT;
 	struct strbuf gpg_output = STRBUF_INIT;
+	const struct signature_verification *v;
 	int status;
 
-	if (parse_signed_commit(commit, &payload, &signature) <= 0)
-		goto out;
-
-	status = verify_signed_buffer(payload.buf, payload.len,
-				      signature.buf, signature.len,
-				      &gpg_output, NULL);
+	v = prefetched_commit_signature(commit);
+	if (v) {
+		if (!v->signature)
+			return;
+		status = v->ret;
+		strbuf_addbuf(&gpg_output, &v->gpg_output);
+	} else {
+		if (parse_signed_commit(commit, &payload, &signature) <= 0)
+			goto out;
+		status = verify_signed_buffer(payload.buf, payload.len,
+					      signature.buf, signature.len,
+					      &gpg_output, NULL);
+	}
 	if (status && !gpg_output.len)
 		strbuf_addstr(&gpg_output, "No signature\n");
 
@@ -794,23 +807,158 @@ static int do_diff_combined(struct rev_info *opt, struct commit *commit)
  *
  * Return true if we printed any log info messages
  */
+/*
+ * The diffs log_tree_prefetch() found, in the order log_tree_diff() will
+ * want them, each with the commit and the parent (NULL for a root commit)
+ * it is between.
+ */
+struct prefetched_diff {
+	const struct commit *commit, *parent;
+	struct diff_queue_struct *q;
+};
+
+static struct prefetched_diff *prefetched_diffs;
+static int prefetched_nr, prefetched_alloc, prefetched_pos;
+
+static void prefetch_diff(struct rev_info *opt, struct commit *parent,
+			  struct commit *commit)
+{
+	struct diff_options diffopt;
+	struct prefetched_diff *d;
+
+	/*
+	 * The diff is only shown later, so it must not touch the state
+	 * of the options.
+	 */
+	memcpy(&diffopt, &opt->diffopt, sizeof(diffopt));
+	if (parent)
+		diff_tree_oid(get_commit_tree_oid(parent),
+			      get_commit_tree_oid(commit), "", &diffopt);
+	else
+		diff_root_tree_oid(get_commit_tree_oid(commit), "", &diffopt);
+
+	ALLOC_GROW(prefetched_diffs, prefetched_nr + 1, prefetched_alloc);
+	d = &prefetched_diffs[prefetched_nr++];
+	d->commit = commit;
+	d->parent = parent;
+	d->q = diff_queue_take();
+}
+
+/*
+ * With LOG_PREFETCH_SIGNATURES, verify the signatures of "commits" for
+ * --show-signature several at a time. With LOG_PREFETCH_DIFFS, diff
+ * each of them against the parents log_tree_diff() would diff it
+ * against, and prepare in threads what showing these diffs needs: the
+ * answers of the pickaxe with -S and -G, or the blobs otherwise. A
+ * merge shown with a combined diff is left alone.
+ */
+void log_tree_prefetch(struct rev_info *opt, struct commit **commits, int nr,
+		       unsigned flags)
+{
+	struct diff_queue_struct **queues;
+	int i;
+
+	if (flags & LOG_PREFETCH_SIGNATURES)
+		prefetch_commit_signatures(commits, nr);
+	if (!(flags & LOG_PREFETCH_DIFFS))
+		return;
+
+	for (i = 0; i < nr; i++) {
+		struct commit *commit = commits[i];
+		struct commit_list *parents;
+
+		if (parse_commit(commit))
+			continue;
+		parents = get_saved_parents(opt, commit);
+		if (!parents) {
+			if (opt->show_root_diff)
+				prefetch_diff(opt, NULL, commit);
+			continue;
+		}
+		if (parents->next &&
+		    (opt->ignore_merges || opt->combine_merges))
+			continue;
+		for (; parents; parents = parents->next) {
+			if (parse_commit(parents->item))
+				break;
+			prefetch_diff(opt, parents->item, commit);
+			if (opt->first_parent_only)
+				break;
+		}
+	}
+
+	if (opt->diffopt.pickaxe_opts &
+	    (DIFF_PICKAXE_KIND_S | DIFF_PICKAXE_KIND_G)) {
+		for (i = 0; i < prefetched_nr; i++)
+			diff_pickaxe_prefetch(prefetched_diffs[i].q,
+					      &opt->diffopt);
+		diff_pickaxe_prefetch_run(&opt->diffopt);
+		return;
+	}
+	ALLOC_ARRAY(queues, prefetched_nr);
+	for (i = 0; i < prefetched_nr; i++)
+		queues[i] = prefetched_diffs[i].q;
+	diff_prefetch_blobs(queues, prefetched_nr);
+	free(queues);
+}
+
+void log_tree_prefetch_clear(void)
+{
+	int i;
+
+	for (i = prefetched_pos; i < prefetched_nr; i++)
+		if (prefetched_diffs[i].q)
+			diff_queue_discard(prefetched_diffs[i].q);
+	FREE_AND_NULL(prefetched_diffs);
+	prefetched_nr = prefetched_alloc = prefetched_pos = 0;
+	diff_pickaxe_prefetch_clear();
+	diff_prefetch_clear();
+	clear_prefetched_commit_signatures();
+}
+
+/*
+ * Queue the diff between "parent" (NULL for a root commit) and "commit",
+ * as log_tree_prefetch() found it if it did.
+ */
+static void diff_commit_tree(struct rev_info *opt, struct commit *parent,
+			     struct commit *commit)
+{
+	int i;
+
+	for (i = prefetched_pos; i < prefetched_nr; i++) {
+		struct prefetched_diff *d = &prefetched_diffs[i];
+
+		if (d->commit != commit || d->parent != parent || !d->q)
+			continue;
+		diff_queue_restore(d->q, &opt->diffopt);
+		d->q = NULL;
+		if (i == prefetched_pos)
+			prefetched_pos++;
+		return;
+	}
+
+	if (parent)
+		diff_tree_oid(get_commit_tree_oid(parent),
+			      get_commit_tree_oid(commit), "", &opt->diffopt);
+	else
+		diff_root_tree_oid(get_commit_tree_oid(commit), "", &opt->diffopt);
+}
+
 static int log_tree_diff(struct rev_info *opt, struct commit *commit, struct log_info *log)
 {
 	int showed_log;
 	struct commit_list *parents;
-	struct object_id *oid;
 
 	if (!opt->diff && !opt->diffopt.flags.exit_with_status)
 		return 0;
 
 	parse_commit_or_die(commit);
-	oid = get_commit_tree_oid(commit);
 
 	/* Root commit? */
 	parents = get_saved_parents(opt, commit);
 	if (!parents) {
 		if (opt->show_root_diff) {
-			diff_root_tree_oid(oid, "", &opt->diffopt);
+			diff_commit_tree(opt, NULL, commit);
 			log_tree_diff_flush(opt);
 		}
 		return !opt->loginfo;
@@ -829,8 +977,7 @@ static int log_tree_diff(struct rev_info *opt, struct commit *commit, struct log
 			 * we merged _in_.
 			 */
 			parse_commit_or_die(parents->item);
-			diff_tree_oid(get_commit_tree_oid(parents->item),
-				      oid, "", &opt->diffopt);
+			diff_commit_tree(opt, parents->item, commit);
 			log_tree_diff_flush(opt);
 			return !opt->loginfo;
 		}
@@ -844,8 +991,7 @@ static int log_tree_diff(struct rev_info *opt, struct commit *commit, struct log
 		struct commit *parent = parents->item;
 
 		parse_commit_or_die(parent);
-		diff_tree_oid(get_commit_tree_oid(parent),
-			      oid, "", &opt->diffopt);
+		diff_commit_tree(opt, parent, commit);
 		log_tree_diff_flush(opt);
 
 		showed_log |= !opt->loginfo;
@@ -15,6 +15,10 @@ int parse_decorate_color_config(const char *var, const char *slot_name, const ch
 void init_log_tree_opt(struct rev_info *);
 int log_tree_diff_flush(struct rev_info *);
 int log_tree_commit(struct rev_info *, struct commit *);
+#define LOG_PREFETCH_DIFFS (1<<0)
+#define LOG_PREFETCH_SIGNATURES (1<<1)
+void log_tree_prefetch(struct rev_info *, struct commit **, int, unsigned);
+void log_tree_prefetch_clear(void);
 int log_tree_opt_parse(struct rev_info *, const char **, int);
 void show_log(struct rev_info *opt);
 void format_decorations_extended(struct strbuf *sb, const struct commit *commit,
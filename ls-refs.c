@@ -1,14 +1,18 @@
 #include "cache.h"
+#include "config.h"
 #include "repository.h"
 #include "refs.h"
 #include "remote.h"
 #include "argv-array.h"
+#include "lockfile.h"
 #include "ls-refs.h"
 #include "pkt-line.h"
+#include "trace2.h"
 
 /*
- * Check if one of the prefixes is a prefix of the ref.
- * If no prefixes were provided, all refs match.
+ * Check if one of the prefixes is a prefix of the ref. If no prefixes
+ * were provided, all refs match. The refs iterated over match by
+ * construction; this is for HEAD.
  */
 static int ref_match(const struct argv_array *prefixes, const char *refname)
 {
@@ -31,6 +35,7 @@ struct ls_refs_data {
 	unsigned peel;
 	unsigned symrefs;
 	struct argv_array prefixes;
+	struct packet_batch out;
 };
 
 static int send_ref(const char *refname, const struct object_id *oid,
@@ -40,9 +45,6 @@ static int send_ref(const char *refname, const struct object_id *oid,
 	const char *refname_nons = strip_namespace(refname);
 	struct strbuf refline = STRBUF_INIT;
 
-	if (!ref_match(&data->prefixes, refname))
-		return 0;
-
 	strbuf_addf(&refline, "%s %s", oid_to_hex(oid), refname_nons);
 	if (data->symrefs && flag & REF_ISSYMREF) {
 		struct object_id unused;
@@ -63,18 +65,151 @@ static int send_ref(const char *refname, const struct object_id *oid,
 	}
 
 	strbuf_addch(&refline, '\n');
-	packet_write(1, refline.buf, refline.len);
+	packet_batch_write(&data->out, refline.buf, refline.len);
 
 	strbuf_release(&refline);
 	return 0;
 }
 
+/*
+ * With uploadpack.lsRefsCache, the answer to a request for all refs
+ * with their symref targets and peeled values is kept in
+ * $GIT_DIR/ls-refs-cache, after the token in REFS_GENERATION_FILE it
+ * was made with, the namespace and LS_REFS_CACHE_VERSION. Every
+ * request is answered by filtering those lines for as long as the
+ * token does not change.
+ */
+#define LS_REFS_CACHE_FILE "ls-refs-cache"
+#define LS_REFS_CACHE_VERSION 2
+
+static int collect_ref(const char *refname, const struct object_id *oid,
+		       int flag, void *cb_data)
+{
+	struct strbuf *out = cb_data;
+	const char *refname_nons = strip_namespace(refname);
+	struct object_id peeled;
+
+	strbuf_addf(out, "%s %s", oid_to_hex(oid), refname_nons);
+	if (flag & REF_ISSYMREF) {
+		struct object_id unused;
+		const char *symref_target = resolve_ref_unsafe(refname, 0,
+							       &unused,
+							       &flag);
+
+		if (!symref_target)
+			die("'%s' is a symref but it is not?", refname);
+
+		strbuf_addf(out, " symref-target:%s", symref_target);
+	}
+	if (!peel_ref(refname, &peeled))
+		strbuf_addf(out, " peeled:%s", oid_to_hex(&peeled));
+	strbuf_addch(out, '\n');
+	return 0;
+}
+
+/*
+ * Fill "refs" with the cached refs, after checking or making the
+ * cache. Return -1 if there is no cache to use.
+ */
+static int read_ls_refs_cache(struct repository *r, struct strbuf *refs)
+{
+	char *token_path = xstrfmt("%s/%s", r->commondir, REFS_GENERATION_FILE);
+	char *cache_path = xstrfmt("%s/%s", r->commondir, LS_REFS_CACHE_FILE);
+	struct strbuf token = STRBUF_INIT;
+	struct strbuf cache = STRBUF_INIT;
+	struct lock_file lock = LOCK_INIT;
+	const char *namespace = get_git_namespace();
+	const char *p;
+	int fd, ret = -1;
+
+	if (strbuf_read_file(&token, token_path, 0) < 0) {
+		if (errno != ENOENT ||
+		    refs_update_generation(r->commondir, 1) ||
+		    strbuf_read_file(&token, token_path, 0) < 0)
+			goto out;
+	}
+	strbuf_addf(&token, "%s\n%d\n", namespace, LS_REFS_CACHE_VERSION);
+
+	if (strbuf_read_file(&cache, cache_path, 0) >= 0 &&
+	    skip_prefix(cache.buf, token.buf, &p)) {
+		strbuf_add(refs, p, cache.buf + cache.len - p);
+		trace2_data_intmax("ls-refs", "cache_hit", 1);
+		ret = 0;
+		goto out;
+	}
+
+	/* The token is read first, so that it changes if the refs do. */
+	head_ref_namespaced(collect_ref, refs);
+	refs_for_each_fullref_in_prefixes(get_main_ref_store(r), namespace,
+					  NULL, collect_ref, refs);
+	ret = 0;
+
+	fd = hold_lock_file_for_update(&lock, cache_path, 0);
+	if (fd < 0)
+		goto out;
+	if (write_in_full(fd, token.buf, token.len) < 0 ||
+	    write_in_full(fd, refs->buf, refs->len) < 0 ||
+	    commit_lock_file(&lock))
+		rollback_lock_file(&lock);
+
+out:
+	strbuf_release(&cache);
+	strbuf_release(&token);
+	free(cache_path);
+	free(token_path);
+	return ret;
+}
+
+/*
+ * Send the lines of "refs" that match the request, leaving out what
+ * the client did not ask for.
+ */
+static void send_cached_refs(struct ls_refs_data *data, struct strbuf *refs)
+{
+	struct strbuf refline = STRBUF_INIT;
+	const char *line = refs->buf, *end = refs->buf + refs->len;
+
+	while (line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		const char *name = (const char *)memchr(line, ' ', eol - line) + 1;
+		const char *attr = memchr(name, ' ', eol - name);
+
+		if (!attr)
+			attr = eol;
+		strbuf_reset(&refline);
+		strbuf_add(&refline, name, attr - name);
+		if (ref_match(&data->prefixes, refline.buf)) {
+			strbuf_reset(&refline);
+			strbuf_add(&refline, line, attr - line);
+			/* Each attribute is a space and a word. */
+			while (attr < eol) {
+				const char *next = memchr(attr + 1, ' ', eol - attr - 1);
+
+				if (!next)
+					next = eol;
+				if (starts_with(attr, " symref-target:") ?
+				    data->symrefs : data->peel)
+					strbuf_add(&refline, attr, next - attr);
+				attr = next;
+			}
+			strbuf_addch(&refline, '\n');
+			packet_batch_write(&data->out, refline.buf, refline.len);
+		}
+		line = eol + 1;
+	}
+	strbuf_release(&refline);
+}
+
 int ls_refs(struct repository *r, struct argv_array *keys,
 	    struct packet_reader *request)
 {
 	struct ls_refs_data data;
+	struct strbuf cached = STRBUF_INIT;
+	int use_cache = 0;
 
 	memset(&data, 0, sizeof(data));
+	data.out.fd = 1;
+	strbuf_init(&data.out.buf, 0);
 
 	while (packet_reader_read(request) != PACKET_READ_FLUSH) {
 		const char *arg = request->line;
@@ -88,9 +223,21 @@ int ls_refs(struct repository *r, struct argv_array *keys,
 			argv_array_push(&data.prefixes, out);
 	}
 
-	head_ref_namespaced(send_ref, &data);
-	for_each_namespaced_ref(send_ref, &data);
-	packet_flush(1);
+	repo_config_get_bool(r, "uploadpack.lsrefscache", &use_cache);
+	if (use_cache && !read_ls_refs_cache(r, &cached)) {
+		send_cached_refs(&data, &cached);
+	} else {
+		if (ref_match(&data.prefixes, "HEAD"))
+			head_ref_namespaced(send_ref, &data);
+		/* Only look at the refs we are asked for. */
+		refs_for_each_fullref_in_prefixes(get_main_ref_store(r),
+						  get_git_namespace(),
+						  data.prefixes.argv,
+						  send_ref, &data);
+	}
+	packet_batch_flush(&data.out);
+	packet_batch_release(&data.out);
+	strbuf_release(&cached);
 	argv_array_clear(&data.prefixes);
 	return 0;
 }
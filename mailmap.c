@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "string-list.h"
+#include "hashmap.h"
 #include "mailmap.h"
 #include "object-store.h"
 
@@ -254,9 +255,94 @@ int read_mailmap(struct string_list *map, char **repo_abbrev)
 	return err;
 }
 
+/*
+ * The emails of the map, hashed case-insensitively, so that each
+ * lookup is not a binary search. It is built by the first lookup in a
+ * map; only the map used last is indexed.
+ */
+struct mailmap_email {
+	struct hashmap_entry ent;
+	size_t len;
+	struct string_list_item *item;
+};
+
+static struct mailmap_index {
+	const struct string_list *map;
+	const struct string_list_item *items;
+	unsigned int nr;
+	struct hashmap emails;
+	struct mailmap_email *entries;
+} mailmap_index;
+
+static int mailmap_email_cmp(const void *unused_cmp_data,
+			     const void *entry,
+			     const void *entry_or_key,
+			     const void *keydata)
+{
+	const struct mailmap_email *a = entry;
+	const struct mailmap_email *b = entry_or_key;
+	return a->len != b->len ||
+		strncasecmp(a->item->string,
+			    keydata ? keydata : b->item->string, a->len);
+}
+
+static void clear_mailmap_index(void)
+{
+	if (!mailmap_index.map)
+		return;
+	hashmap_free(&mailmap_index.emails, 0);
+	FREE_AND_NULL(mailmap_index.entries);
+	mailmap_index.map = NULL;
+}
+
+static void prepare_mailmap_index(const struct string_list *map)
+{
+	unsigned int i;
+
+	if (mailmap_index.map == map && mailmap_index.items == map->items &&
+	    mailmap_index.nr == map->nr)
+		return;
+
+	clear_mailmap_index();
+	mailmap_index.map = map;
+	mailmap_index.items = map->items;
+	mailmap_index.nr = map->nr;
+	hashmap_init(&mailmap_index.emails, mailmap_email_cmp, NULL, map->nr);
+	ALLOC_ARRAY(mailmap_index.entries, map->nr);
+	for (i = 0; i < map->nr; i++) {
+		struct mailmap_email *e = &mailmap_index.entries[i];
+
+		e->item = &map->items[i];
+		e->len = strlen(e->item->string);
+		hashmap_entry_init(e, memihash(e->item->string, e->len));
+		hashmap_add(&mailmap_index.emails, e);
+	}
+}
+
+/*
+ * Look for the entry of the email string[0:len]; string[len] does not
+ * have to be NUL (but it could be).
+ */
+static struct string_list_item *lookup_email(struct string_list *map,
+					     const char *string, size_t len)
+{
+	struct mailmap_email key, *e;
+
+	if (!map->nr)
+		return NULL;
+	prepare_mailmap_index(map);
+
+	hashmap_entry_init(&key, memihash(string, len));
+	key.len = len;
+	e = hashmap_get(&mailmap_index.emails, &key, string);
+	return e ? e->item : NULL;
+}
+
 void clear_mailmap(struct string_list *map)
 {
 	debug_mm("mailmap: clearing %d entries...\n", map->nr);
+	if (mailmap_index.map == map)
+		clear_mailmap_index();
 	map->strdup_strings = 1;
 	string_list_clear_func(map, free_mailmap_entry);
 	debug_mm("mailmap: cleared\n");
@@ -324,7 +410,7 @@ int map_user(struct string_list *map,
 		 (int)*namelen, debug_str(*name),
 		 (int)*emaillen, debug_str(*email));
 
-	item = lookup_prefix(map, *email, *emaillen);
+	item = lookup_email(map, *email, *emaillen);
 	if (item != NULL) {
 		me = (struct mailmap_entry *)item->util;
 		if (me->namemap.nr) {
@@ -21,6 +21,18 @@ struct mem_pool {
 	size_t pool_alloc;
 };
 
+/*
+ * Initialize a new memory pool for "*mem_pool", unless it already has
+ * one. If "initial_size" is non-zero, a first block of that many bytes
+ * is allocated up front.
+ */
+void mem_pool_init(struct mem_pool **mem_pool, size_t initial_size);
+
+/*
+ * Discard a memory pool and free all the memory it is responsible for.
+ */
+void mem_pool_discard(struct mem_pool *mem_pool);
+
 /*
  * Alloc memory from the mem_pool.
  */
@@ -31,4 +43,10 @@ void *mem_pool_alloc(struct mem_pool *pool, size_t len);
  */
 void *mem_pool_calloc(struct mem_pool *pool, size_t count, size_t size);
 
+/*
+ * Move the memory associated with the "src" pool to the "dst" pool. The
+ * "src" pool is left empty, and can be discarded or used again.
+ */
+void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src);
+
 #endif
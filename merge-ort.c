@@ -0,0 +1,890 @@
+/*
+ * A three-way merge of trees that never touches the index or the working
+ * tree; see merge-ort.h.
+ *
+ * Only the paths that changed on either side are looked at: they are
+ * collected from the rename-detecting diffs between the merge base and
+ * each side, merged one by one, and the merged tree is the tree of the
+ * merge base with these paths replaced, so that the subtrees that did not
+ * change are reused as they are.
+ */
+#include "cache.h"
+#include "object-store.h"
+#include "repository.h"
+#include "blob.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "commit.h"
+#include "commit-reach.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "alloc.h"
+#include "xdiff-interface.h"
+#include "ll-merge.h"
+#include "hashmap.h"
+#include "string-list.h"
+#include "merge-ort.h"
+
+#define MERGE_BASE 0
+#define SIDE1 1
+#define SIDE2 2
+
+struct merge_entry {
+	struct hashmap_entry ent;
+	/* the merge base, side1 and side2 versions */
+	struct merge_stage stages[3];
+	/* the path of each version, or NULL if it was not renamed */
+	char *paths[3];
+	/* the merged version */
+	struct merge_stage result;
+	/* the side whose version is the result, 0 if it was merged */
+	int result_side;
+	/* the result was decided when looking at the renames */
+	unsigned resolved:1;
+	char path[FLEX_ARRAY];
+};
+
+struct merge_ctx {
+	struct merge_options *o;
+	struct merge_result *result;
+	struct hashmap entries;
+	/* the renames of each side, keyed by their source */
+	struct string_list renames[3];
+};
+
+static int merge_entry_cmp(const void *unused_cmp_data,
+			   const void *entry,
+			   const void *entry_or_key,
+			   const void *keydata)
+{
+	const struct merge_entry *a = entry;
+	const struct merge_entry *b = entry_or_key;
+
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static struct merge_entry *find_entry(struct merge_ctx *ctx, const char *path)
+{
+	struct hashmap_entry key;
+
+	hashmap_entry_init(&key, strhash(path));
+	return hashmap_get(&ctx->entries, &key, path);
+}
+
+static struct merge_entry *get_entry(struct merge_ctx *ctx, const char *path,
+				     int *created)
+{
+	struct merge_entry *e = find_entry(ctx, path);
+
+	*created = !e;
+	if (!e) {
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(e, strhash(path));
+		hashmap_add(&ctx->entries, e);
+	}
+	return e;
+}
+
+static const char *branch_name(struct merge_ctx *ctx, int side)
+{
+	return side == SIDE2 ? ctx->o->branch2 : ctx->o->branch1;
+}
+
+static void set_stage(struct merge_stage *stage, const struct diff_filespec *spec)
+{
+	if (DIFF_FILE_VALID(spec)) {
+		stage->mode = spec->mode;
+		oidcpy(&stage->oid, &spec->oid);
+	} else {
+		stage->mode = 0;
+		oidclr(&stage->oid);
+	}
+}
+
+static int stage_eq(const struct merge_stage *a, const struct merge_stage *b)
+{
+	if (!a->mode || !b->mode)
+		return a->mode == b->mode;
+	return a->mode == b->mode && !oidcmp(&a->oid, &b->oid);
+}
+
+__attribute__((format (printf, 4, 5)))
+static void add_conflict(struct merge_ctx *ctx, const char *path,
+			 const struct merge_stage *stages,
+			 const char *fmt, ...)
+{
+	struct merge_result *result = ctx->result;
+	struct merge_conflict *c;
+	struct strbuf sb = STRBUF_INIT;
+	va_list ap;
+
+	result->clean = 0;
+	if (ctx->o->call_depth)
+		return;
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&sb, fmt, ap);
+	va_end(ap);
+
+	ALLOC_GROW(result->conflicts, result->nr_conflicts + 1,
+		   result->alloc_conflicts);
+	c = &result->conflicts[result->nr_conflicts++];
+	c->path = xstrdup(path);
+	if (stages)
+		memcpy(c->stages, stages, sizeof(c->stages));
+	else
+		memset(c->stages, 0, sizeof(c->stages));
+	c->message = strbuf_detach(&sb, NULL);
+}
+
+/*
+ * Get the changes between the merge base and one side, detecting the
+ * renames as get_diffpairs() in merge-recursive.c does.
+ */
+static struct diff_queue_struct *get_changes(struct merge_options *o,
+					     struct tree *base,
+					     struct tree *side)
+{
+	struct diff_queue_struct *ret;
+	struct diff_options opts;
+
+	diff_setup(&opts);
+	opts.flags.recursive = 1;
+	opts.flags.rename_empty = 0;
+	opts.detect_rename = merge_detect_rename(o);
+	if (opts.detect_rename > DIFF_DETECT_RENAME)
+		opts.detect_rename = DIFF_DETECT_RENAME;
+	opts.rename_limit = o->merge_rename_limit >= 0 ? o->merge_rename_limit :
+			    o->diff_rename_limit >= 0 ? o->diff_rename_limit :
+			    1000;
+	opts.rename_score = o->rename_score;
+	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opts);
+	diff_tree_oid(&base->object.oid, &side->object.oid, "", &opts);
+	diffcore_std(&opts);
+	if (opts.needed_rename_limit > o->needed_rename_limit)
+		o->needed_rename_limit = opts.needed_rename_limit;
+
+	ret = xmalloc(sizeof(*ret));
+	*ret = diff_queued_diff;
+
+	diff_queued_diff.nr = 0;
+	diff_queued_diff.queue = NULL;
+	diff_flush(&opts);
+	return ret;
+}
+
+static void free_changes(struct diff_queue_struct *q)
+{
+	int i;
+
+	for (i = 0; i < q->nr; i++)
+		diff_free_filepair(q->queue[i]);
+	free(q->queue);
+	free(q);
+}
+
+static void record_change(struct merge_ctx *ctx, int side,
+			  struct diff_filepair *p)
+{
+	struct merge_entry *e;
+	int created;
+
+	if (p->status == DIFF_STATUS_RENAMED) {
+		string_list_append(&ctx->renames[side], p->one->path)->util = p;
+		return;
+	}
+
+	e = get_entry(ctx, p->two->path, &created);
+	if (created) {
+		set_stage(&e->stages[MERGE_BASE], p->one);
+		e->stages[SIDE1] = e->stages[SIDE2] = e->stages[MERGE_BASE];
+	}
+	set_stage(&e->stages[side], p->two);
+}
+
+static struct diff_filepair *find_rename(struct merge_ctx *ctx, int side,
+					 const char *src)
+{
+	struct string_list_item *item;
+
+	item = string_list_lookup(&ctx->renames[side], src);
+	return item ? item->util : NULL;
+}
+
+/*
+ * The source of a rename is gone on the side that renamed it, and the
+ * changes the other side made to it follow it to its new name.
+ */
+static void record_rename(struct merge_ctx *ctx, int side,
+			  struct diff_filepair *p)
+{
+	int other = side == SIDE1 ? SIDE2 : SIDE1;
+	const char *src = p->one->path, *dst = p->two->path;
+	struct diff_filepair *q = find_rename(ctx, other, src);
+	struct merge_entry *a, *b;
+	int created;
+
+	a = get_entry(ctx, src, &created);
+	if (created) {
+		set_stage(&a->stages[MERGE_BASE], p->one);
+		a->stages[SIDE1] = a->stages[SIDE2] = a->stages[MERGE_BASE];
+	}
+	a->stages[side].mode = 0;
+
+	if (q) {
+		struct merge_entry *c;
+		const char *other_dst = q->two->path;
+
+		/* both sides renamed it; the second one has nothing to do */
+		if (side == SIDE2)
+			return;
+		a->stages[other].mode = 0;
+
+		if (!strcmp(dst, other_dst)) {
+			b = get_entry(ctx, dst, &created);
+			set_stage(&b->stages[MERGE_BASE], p->one);
+			set_stage(&b->stages[side], p->two);
+			set_stage(&b->stages[other], q->two);
+			b->paths[MERGE_BASE] = xstrdup(src);
+			return;
+		}
+
+		/* renamed to different names: keep both */
+		b = get_entry(ctx, dst, &created);
+		set_stage(&b->stages[side], p->two);
+		c = get_entry(ctx, other_dst, &created);
+		set_stage(&c->stages[other], q->two);
+		add_conflict(ctx, a->path, a->stages,
+			     _("CONFLICT (rename/rename): "
+			       "Rename \"%s\"->\"%s\" in branch \"%s\" "
+			       "rename \"%s\"->\"%s\" in \"%s\""),
+			     src, dst, branch_name(ctx, side),
+			     src, other_dst, branch_name(ctx, other));
+		return;
+	}
+
+	b = get_entry(ctx, dst, &created);
+	if (!created && b->stages[other].mode) {
+		/*
+		 * The other side added a file with the same name: merge
+		 * them as two additions, and leave the other side's version
+		 * of the source where it is.
+		 */
+		b->stages[MERGE_BASE].mode = 0;
+		set_stage(&b->stages[side], p->two);
+		add_conflict(ctx, b->path, b->stages,
+			     _("CONFLICT (rename/add): Rename %s->%s in %s. "
+			       "%s added in %s"),
+			     src, dst, branch_name(ctx, side),
+			     dst, branch_name(ctx, other));
+		return;
+	}
+
+	set_stage(&b->stages[MERGE_BASE], p->one);
+	set_stage(&b->stages[side], p->two);
+	b->stages[other] = a->stages[other];
+	b->paths[MERGE_BASE] = xstrdup(src);
+	b->paths[other] = xstrdup(src);
+	a->stages[other].mode = 0;
+
+	if (!b->stages[other].mode) {
+		b->result = b->stages[side];
+		b->result_side = side;
+		b->resolved = 1;
+		add_conflict(ctx, b->path, b->stages,
+			     _("CONFLICT (rename/delete): %s deleted in %s "
+			       "and renamed to %s in %s. Version %s of %s "
+			       "left in tree."),
+			     src, branch_name(ctx, other),
+			     dst, branch_name(ctx, side),
+			     branch_name(ctx, side), dst);
+	}
+}
+
+static int merge_blobs_3way(struct merge_ctx *ctx, struct merge_entry *e,
+			    struct object_id *result_oid)
+{
+	struct merge_options *o = ctx->o;
+	struct ll_merge_options ll_opts = { 0 };
+	mmfile_t orig, src1, src2;
+	mmbuffer_t result_buf;
+	char *names[3];
+	int i, merge_status;
+
+	ll_opts.renormalize = o->renormalize;
+	ll_opts.xdl_opts = o->xdl_opts;
+	if (o->call_depth)
+		ll_opts.virtual_ancestor = 1;
+	else if (o->recursive_variant == MERGE_RECURSIVE_OURS)
+		ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+	else if (o->recursive_variant == MERGE_RECURSIVE_THEIRS)
+		ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+
+	for (i = 0; i < 3; i++) {
+		const char *label = i == MERGE_BASE ? o->ancestor :
+				    branch_name(ctx, i);
+
+		if (!label)
+			names[i] = NULL;
+		else if (e->paths[MERGE_BASE] || e->paths[SIDE1] ||
+			 e->paths[SIDE2])
+			names[i] = xstrfmt("%s:%s", label,
+					   e->paths[i] ? e->paths[i] : e->path);
+		else
+			names[i] = xstrdup(label);
+	}
+
+	if (e->stages[MERGE_BASE].mode)
+		read_mmblob(&orig, &e->stages[MERGE_BASE].oid);
+	else
+		read_mmblob(&orig, &null_oid);
+	read_mmblob(&src1, &e->stages[SIDE1].oid);
+	read_mmblob(&src2, &e->stages[SIDE2].oid);
+
+	merge_status = ll_merge(&result_buf, e->path, &orig, names[MERGE_BASE],
+				&src1, names[SIDE1], &src2, names[SIDE2],
+				&ll_opts);
+
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+	for (i = 0; i < 3; i++)
+		free(names[i]);
+
+	if (merge_status < 0 ||
+	    write_object_file(result_buf.ptr, result_buf.size, blob_type,
+			      result_oid)) {
+		free(result_buf.ptr);
+		return error(_("failed to merge %s"), e->path);
+	}
+	free(result_buf.ptr);
+	return merge_status;
+}
+
+static unsigned merge_modes(struct merge_ctx *ctx, struct merge_entry *e)
+{
+	unsigned base = e->stages[MERGE_BASE].mode;
+	unsigned mode1 = e->stages[SIDE1].mode, mode2 = e->stages[SIDE2].mode;
+
+	if (mode1 == mode2 || base == mode2)
+		return mode1;
+	if (base == mode1)
+		return mode2;
+	add_conflict(ctx, e->path, e->stages,
+		     _("CONFLICT (mode): %s had its mode changed "
+		       "differently in %s and %s"),
+		     e->path, ctx->o->branch1, ctx->o->branch2);
+	return mode1;
+}
+
+static int merge_one_entry(struct merge_ctx *ctx, struct merge_entry *e)
+{
+	struct merge_stage *base = &e->stages[MERGE_BASE];
+	struct merge_stage *s1 = &e->stages[SIDE1], *s2 = &e->stages[SIDE2];
+	int status;
+
+	if (e->resolved)
+		return 0;
+
+	e->result_side = SIDE1;
+	if (stage_eq(s1, s2) || stage_eq(base, s2)) {
+		e->result = *s1;
+		return 0;
+	}
+	if (stage_eq(base, s1)) {
+		e->result = *s2;
+		e->result_side = SIDE2;
+		return 0;
+	}
+
+	if (!s1->mode || !s2->mode) {
+		int modified = s1->mode ? SIDE1 : SIDE2;
+		int deleted = s1->mode ? SIDE2 : SIDE1;
+
+		e->result = e->stages[modified];
+		e->result_side = modified;
+		add_conflict(ctx, e->path, e->stages,
+			     _("CONFLICT (modify/delete): %s deleted in %s "
+			       "and modified in %s. Version %s of %s left "
+			       "in tree."),
+			     e->path, branch_name(ctx, deleted),
+			     branch_name(ctx, modified),
+			     branch_name(ctx, modified), e->path);
+		return 0;
+	}
+
+	e->result = *s1;
+	if ((s1->mode ^ s2->mode) & S_IFMT) {
+		add_conflict(ctx, e->path, e->stages,
+			     _("CONFLICT (distinct types): %s had a "
+			       "different type in %s and in %s; the "
+			       "version of %s was kept"),
+			     e->path, ctx->o->branch1, ctx->o->branch2,
+			     ctx->o->branch1);
+		return 0;
+	}
+	if (S_ISGITLINK(s1->mode)) {
+		add_conflict(ctx, e->path, e->stages,
+			     _("CONFLICT (submodule): Merge conflict in %s"),
+			     e->path);
+		return 0;
+	}
+	if (S_ISLNK(s1->mode)) {
+		add_conflict(ctx, e->path, e->stages,
+			     _("CONFLICT (content): Merge conflict in %s"),
+			     e->path);
+		return 0;
+	}
+
+	e->result_side = 0;
+	e->result.mode = merge_modes(ctx, e);
+	if (!oidcmp(&s1->oid, &s2->oid))
+		return 0;
+	if (base->mode && !oidcmp(&base->oid, &s1->oid)) {
+		oidcpy(&e->result.oid, &s2->oid);
+		return 0;
+	}
+	if (base->mode && !oidcmp(&base->oid, &s2->oid))
+		return 0;
+
+	status = merge_blobs_3way(ctx, e, &e->result.oid);
+	if (status < 0)
+		return -1;
+	if (status > 0)
+		add_conflict(ctx, e->path, e->stages,
+			     _("CONFLICT (%s): Merge conflict in %s"),
+			     base->mode ? "content" : "add/add", e->path);
+	return 0;
+}
+
+struct tree_entry_out {
+	char *name;
+	unsigned mode;
+	struct object_id oid;
+};
+
+struct edit_group {
+	struct merge_entry *file;
+	int sub_start, sub_nr;
+	unsigned base_mode;
+	struct object_id base_oid;
+};
+
+static int tree_entry_out_cmp(const void *a_, const void *b_)
+{
+	const struct tree_entry_out *a = a_, *b = b_;
+
+	return base_name_compare(a->name, strlen(a->name), a->mode,
+				 b->name, strlen(b->name), b->mode);
+}
+
+static void add_tree_entry(struct tree_entry_out **out, int *nr, int *alloc,
+			   char *name, unsigned mode,
+			   const struct object_id *oid)
+{
+	ALLOC_GROW(*out, *nr + 1, *alloc);
+	(*out)[*nr].name = name;
+	(*out)[*nr].mode = mode;
+	oidcpy(&(*out)[*nr].oid, oid);
+	(*nr)++;
+}
+
+/*
+ * Name the file that conflicts with a directory "<name>~<branch>", as
+ * merge-recursive.c does in the working tree.
+ */
+static char *df_conflict_name(struct string_list *names, const char *name,
+			      const char *branch)
+{
+	struct strbuf sb = STRBUF_INIT;
+	size_t base_len;
+	int suffix = 0;
+	char *p;
+
+	strbuf_addf(&sb, "%s~", name);
+	base_len = sb.len;
+	strbuf_addstr(&sb, branch);
+	for (p = sb.buf + base_len; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	base_len = sb.len;
+	while (string_list_has_string(names, sb.buf)) {
+		strbuf_setlen(&sb, base_len);
+		strbuf_addf(&sb, "_%d", suffix++);
+	}
+	return strbuf_detach(&sb, NULL);
+}
+
+/*
+ * Write the tree at <prefix> (which is empty or ends with a slash): the
+ * tree 'base' (NULL if there is none) with the merged versions of the
+ * paths of 'edits', which are sorted and all start with <prefix>.
+ * Return 1 if the tree has entries, 0 if it is empty, -1 on errors.
+ */
+static int write_merged_tree(struct merge_ctx *ctx,
+			     const struct object_id *base,
+			     struct strbuf *prefix,
+			     struct merge_entry **edits, int nr,
+			     struct object_id *result)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct tree_entry_out *out = NULL;
+	int out_nr = 0, out_alloc = 0;
+	struct strbuf buf = STRBUF_INIT;
+	void *tree_buf = NULL;
+	int i, ret = 0;
+
+	for (i = 0; i < nr; i++) {
+		const char *rest = edits[i]->path + prefix->len;
+		const char *slash = strchrnul(rest, '/');
+		struct string_list_item *item;
+		struct edit_group *g;
+		char *name = xmemdupz(rest, slash - rest);
+
+		item = string_list_insert(&names, name);
+		free(name);
+		g = item->util;
+		if (!g)
+			item->util = g = xcalloc(1, sizeof(*g));
+		if (!*slash)
+			g->file = edits[i];
+		else if (!g->sub_nr++)
+			g->sub_start = i;
+	}
+
+	if (base) {
+		enum object_type type;
+		unsigned long size;
+		struct tree_desc desc;
+		struct name_entry entry;
+
+		tree_buf = read_object_file(base, &type, &size);
+		if (!tree_buf || type != OBJ_TREE) {
+			ret = error(_("unable to read tree %s"), oid_to_hex(base));
+			goto out;
+		}
+		init_tree_desc(&desc, tree_buf, size);
+		while (tree_entry(&desc, &entry)) {
+			struct string_list_item *item;
+
+			item = string_list_lookup(&names, entry.path);
+			if (item) {
+				struct edit_group *g = item->util;
+				g->base_mode = entry.mode;
+				oidcpy(&g->base_oid, entry.oid);
+				continue;
+			}
+			add_tree_entry(&out, &out_nr, &out_alloc,
+				       xstrdup(entry.path), entry.mode,
+				       entry.oid);
+		}
+	}
+
+	for (i = 0; i < names.nr; i++) {
+		const char *name = names.items[i].string;
+		struct edit_group *g = names.items[i].util;
+		struct merge_stage file = { 0 };
+		struct object_id sub_oid;
+		int sub = 0;
+
+		if (g->file)
+			file = g->file->result;
+		else if (g->base_mode && !S_ISDIR(g->base_mode)) {
+			file.mode = g->base_mode;
+			oidcpy(&file.oid, &g->base_oid);
+		}
+
+		if (g->sub_nr) {
+			size_t len = prefix->len;
+
+			strbuf_addf(prefix, "%s/", name);
+			sub = write_merged_tree(ctx,
+						S_ISDIR(g->base_mode) ?
+						&g->base_oid : NULL,
+						prefix, edits + g->sub_start,
+						g->sub_nr, &sub_oid);
+			strbuf_setlen(prefix, len);
+			if (sub < 0) {
+				ret = -1;
+				goto out;
+			}
+		} else if (S_ISDIR(g->base_mode)) {
+			oidcpy(&sub_oid, &g->base_oid);
+			sub = 1;
+		}
+
+		if (sub)
+			add_tree_entry(&out, &out_nr, &out_alloc, xstrdup(name),
+				       S_IFDIR, &sub_oid);
+		if (!file.mode)
+			continue;
+		if (sub) {
+			int side = g->file && g->file->result_side == SIDE2 ?
+				   SIDE2 : SIDE1;
+			int other = side == SIDE1 ? SIDE2 : SIDE1;
+			char *new_name = df_conflict_name(&names, name,
+							  branch_name(ctx, side));
+
+			strbuf_addf(&buf, "%s%s", prefix->buf, name);
+			add_conflict(ctx, buf.buf,
+				     g->file ? g->file->stages : NULL,
+				     _("CONFLICT (directory/file): There is a "
+				       "directory with name %s%s in %s. Adding "
+				       "%s%s as %s%s"),
+				     prefix->buf, name, branch_name(ctx, other),
+				     prefix->buf, name, prefix->buf, new_name);
+			strbuf_reset(&buf);
+			add_tree_entry(&out, &out_nr, &out_alloc, new_name,
+				       file.mode, &file.oid);
+		} else
+			add_tree_entry(&out, &out_nr, &out_alloc, xstrdup(name),
+				       file.mode, &file.oid);
+	}
+
+	QSORT(out, out_nr, tree_entry_out_cmp);
+	for (i = 0; i < out_nr; i++) {
+		strbuf_addf(&buf, "%o %s%c", out[i].mode, out[i].name, '\0');
+		strbuf_add(&buf, out[i].oid.hash, the_hash_algo->rawsz);
+	}
+	if (write_object_file(buf.buf, buf.len, tree_type, result))
+		ret = error(_("unable to write tree"));
+	else
+		ret = out_nr > 0;
+
+out:
+	for (i = 0; i < out_nr; i++)
+		free(out[i].name);
+	free(out);
+	free(tree_buf);
+	strbuf_release(&buf);
+	for (i = 0; i < names.nr; i++)
+		free(names.items[i].util);
+	string_list_clear(&names, 0);
+	return ret;
+}
+
+static int merge_entry_path_cmp(const void *a_, const void *b_)
+{
+	const struct merge_entry *a = *(const struct merge_entry **)a_;
+	const struct merge_entry *b = *(const struct merge_entry **)b_;
+
+	return strcmp(a->path, b->path);
+}
+
+static int merge_conflict_cmp(const void *a_, const void *b_)
+{
+	const struct merge_conflict *a = a_, *b = b_;
+	int cmp = strcmp(a->path, b->path);
+
+	if (cmp)
+		return cmp;
+	return a < b ? -1 : a > b;
+}
+
+static int merge_changes(struct merge_ctx *ctx, struct tree *merge_base,
+			 struct diff_queue_struct *changes[3],
+			 struct object_id *result)
+{
+	struct merge_entry **edits = NULL, *e;
+	struct hashmap_iter iter;
+	struct strbuf prefix = STRBUF_INIT;
+	int side, i, nr = 0, ret = 0;
+
+	for (side = SIDE1; side <= SIDE2; side++)
+		for (i = 0; i < changes[side]->nr; i++)
+			record_change(ctx, side, changes[side]->queue[i]);
+	for (side = SIDE1; side <= SIDE2; side++)
+		string_list_sort(&ctx->renames[side]);
+	for (side = SIDE1; side <= SIDE2; side++)
+		for (i = 0; i < ctx->renames[side].nr; i++)
+			record_rename(ctx, side, ctx->renames[side].items[i].util);
+
+	ALLOC_ARRAY(edits, hashmap_get_size(&ctx->entries));
+	hashmap_iter_init(&ctx->entries, &iter);
+	while ((e = hashmap_iter_next(&iter)))
+		edits[nr++] = e;
+	QSORT(edits, nr, merge_entry_path_cmp);
+
+	for (i = 0; i < nr; i++)
+		if (merge_one_entry(ctx, edits[i]) < 0) {
+			ret = -1;
+			goto out;
+		}
+
+	/*
+	 * Only the paths whose merged version differs from the merge base
+	 * need to be written; that of a rename destination was at another
+	 * path.
+	 */
+	for (i = 0, side = 0; i < nr; i++)
+		if (edits[i]->paths[MERGE_BASE] ||
+		    !stage_eq(&edits[i]->result, &edits[i]->stages[MERGE_BASE]))
+			edits[side++] = edits[i];
+
+	if (write_merged_tree(ctx, &merge_base->object.oid, &prefix,
+			      edits, side, result) < 0)
+		ret = -1;
+
+out:
+	free(edits);
+	strbuf_release(&prefix);
+	return ret;
+}
+
+static void free_entries(struct hashmap *entries)
+{
+	struct hashmap_iter iter;
+	struct merge_entry *e;
+	int i;
+
+	hashmap_iter_init(entries, &iter);
+	while ((e = hashmap_iter_next(&iter)))
+		for (i = 0; i < 3; i++)
+			free(e->paths[i]);
+	hashmap_free(entries, 1);
+}
+
+int merge_incore_nonrecursive(struct merge_options *o,
+			      struct tree *merge_base,
+			      struct tree *side1,
+			      struct tree *side2,
+			      struct merge_result *result)
+{
+	struct merge_ctx ctx;
+	struct diff_queue_struct *changes[3] = { NULL };
+	struct object_id oid;
+	int side, ret = 0;
+
+	memset(result, 0, sizeof(*result));
+	result->clean = 1;
+
+	if (!oidcmp(&side1->object.oid, &side2->object.oid) ||
+	    !oidcmp(&merge_base->object.oid, &side2->object.oid)) {
+		result->tree = side1;
+		return 0;
+	}
+	if (!oidcmp(&merge_base->object.oid, &side1->object.oid)) {
+		result->tree = side2;
+		return 0;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.o = o;
+	ctx.result = result;
+	hashmap_init(&ctx.entries, merge_entry_cmp, NULL, 0);
+	for (side = SIDE1; side <= SIDE2; side++) {
+		string_list_init(&ctx.renames[side], 0);
+		changes[side] = get_changes(o, merge_base,
+					    side == SIDE1 ? side1 : side2);
+	}
+	ret = merge_changes(&ctx, merge_base, changes, &oid);
+
+	for (side = SIDE1; side <= SIDE2; side++) {
+		string_list_clear(&ctx.renames[side], 0);
+		free_changes(changes[side]);
+	}
+	free_entries(&ctx.entries);
+
+	if (ret < 0) {
+		merge_result_release(result);
+		return -1;
+	}
+	result->tree = lookup_tree(&oid);
+	QSORT(result->conflicts, result->nr_conflicts, merge_conflict_cmp);
+	return 0;
+}
+
+static struct commit *make_virtual_commit(struct tree *tree, const char *comment)
+{
+	struct commit *commit = alloc_commit_node(the_repository);
+
+	set_merge_remote_desc(commit, comment, (struct object *)commit);
+	commit->maybe_tree = tree;
+	commit->object.parsed = 1;
+	return commit;
+}
+
+static struct commit_list *reverse_commit_list(struct commit_list *list)
+{
+	struct commit_list *next = NULL, *current, *backup;
+	for (current = list; current; current = backup) {
+		backup = current->next;
+		current->next = next;
+		next = current;
+	}
+	return next;
+}
+
+int merge_incore_recursive(struct merge_options *o,
+			   struct commit_list *merge_bases,
+			   struct commit *side1,
+			   struct commit *side2,
+			   struct merge_result *result)
+{
+	struct commit *base;
+	const char *saved_ancestor = o->ancestor;
+	char *ancestor_name = NULL;
+	int ret;
+
+	if (!merge_bases) {
+		merge_bases = get_merge_bases(side1, side2);
+		merge_bases = reverse_commit_list(merge_bases);
+	}
+
+	base = pop_commit(&merge_bases);
+	if (!base)
+		base = make_virtual_commit(lookup_tree(the_hash_algo->empty_tree),
+					   "ancestor");
+	else if (!merge_bases && !o->ancestor)
+		o->ancestor = ancestor_name =
+			xstrdup(find_unique_abbrev(&base->object.oid,
+						   DEFAULT_ABBREV));
+	else if (merge_bases && !o->ancestor)
+		o->ancestor = "merged common ancestors";
+
+	while (merge_bases) {
+		struct commit *next = pop_commit(&merge_bases);
+		const char *saved_b1 = o->branch1, *saved_b2 = o->branch2;
+		struct merge_result virtual_result;
+		struct commit *virtual;
+
+		o->call_depth++;
+		o->branch1 = "Temporary merge branch 1";
+		o->branch2 = "Temporary merge branch 2";
+		ret = merge_incore_recursive(o, NULL, base, next,
+					     &virtual_result);
+		o->branch1 = saved_b1;
+		o->branch2 = saved_b2;
+		o->call_depth--;
+		if (ret < 0) {
+			free_commit_list(merge_bases);
+			return ret;
+		}
+
+		virtual = make_virtual_commit(virtual_result.tree, "merged tree");
+		commit_list_insert(base, &virtual->parents);
+		commit_list_insert(next, &virtual->parents->next);
+		merge_result_release(&virtual_result);
+		base = virtual;
+	}
+
+	ret = merge_incore_nonrecursive(o, get_commit_tree(base),
+					get_commit_tree(side1),
+					get_commit_tree(side2), result);
+	o->ancestor = saved_ancestor;
+	free(ancestor_name);
+	return ret;
+}
+
+void merge_result_release(struct merge_result *result)
+{
+	int i;
+
+	for (i = 0; i < result->nr_conflicts; i++) {
+		free(result->conflicts[i].path);
+		free(result->conflicts[i].message);
+	}
+	FREE_AND_NULL(result->conflicts);
+	result->nr_conflicts = result->alloc_conflicts = 0;
+}
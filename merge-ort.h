@@ -0,0 +1,69 @@
+#ifndef MERGE_ORT_H
+#define MERGE_ORT_H
+
+#include "merge-recursive.h"
+
+/*
+ * A three-way merge computed from the trees alone: unlike merge_trees(),
+ * it neither reads nor writes the index or the working tree, and the only
+ * side effect is that the merged blobs and trees are written to the object
+ * database. It is meant for callers that need the result of a merge without
+ * a checkout, e.g. to check whether two branches of a bare repository merge
+ * cleanly.
+ *
+ * Renames are detected as merge_trees() does (merge.renames and
+ * merge.renameLimit), but directory renames are not.
+ */
+
+struct merge_stage {
+	unsigned mode;		/* 0 if the path does not exist */
+	struct object_id oid;
+};
+
+struct merge_conflict {
+	char *path;
+	/* the versions of the path in the merge base, branch1 and branch2 */
+	struct merge_stage stages[3];
+	/* "CONFLICT (<type>): ...", as merge_trees() shows it */
+	char *message;
+};
+
+struct merge_result {
+	/* 1 if the merge is clean, 0 if there are conflicts */
+	int clean;
+	/*
+	 * The merged tree; files with conflicting changes hold conflict
+	 * markers, as in the working tree after a conflicted merge.
+	 */
+	struct tree *tree;
+	/* sorted by path; a path may have more than one conflict */
+	struct merge_conflict *conflicts;
+	int nr_conflicts, alloc_conflicts;
+};
+
+/*
+ * Merge the trees side1 and side2, whose common ancestor is merge_base, and
+ * fill result. o->branch1, o->branch2 and o->ancestor label the conflict
+ * markers and messages. Return -1 on errors, 0 otherwise.
+ */
+int merge_incore_nonrecursive(struct merge_options *o,
+			      struct tree *merge_base,
+			      struct tree *side1,
+			      struct tree *side2,
+			      struct merge_result *result);
+
+/*
+ * Like merge_incore_nonrecursive(), but merge the commits side1 and side2,
+ * whose merge bases are merge_bases (computed if NULL; the list is
+ * consumed). Several merge bases are first merged into a virtual one, as
+ * merge_recursive() does.
+ */
+int merge_incore_recursive(struct merge_options *o,
+			   struct commit_list *merge_bases,
+			   struct commit *side1,
+			   struct commit *side2,
+			   struct merge_result *result);
+
+void merge_result_release(struct merge_result *result);
+
+#endif
@@ -10,6 +10,7 @@
 #include "cache-tree.h"
 #include "object-store.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "blob.h"
 #include "builtin.h"
 #include "tree-walk.h"
@@ -26,6 +27,7 @@
 #include "dir.h"
 #include "submodule.h"
 #include "revision.h"
+#include "trace2.h"
 
 struct path_hashmap_entry {
 	struct hashmap_entry e;
@@ -319,7 +321,7 @@ static int add_cacheinfo(struct merge_options *o,
 	struct cache_entry *ce;
 	int ret;
 
-	ce = make_cache_entry(mode, oid ? oid->hash : null_sha1, path, stage, 0);
+	ce = make_cache_entry(&the_index, mode, oid ? oid->hash : null_sha1, path, stage, 0);
 	if (!ce)
 		return err(o, _("add_cacheinfo failed for path '%s'; merge aborting."), path);
 
@@ -327,7 +329,7 @@ static int add_cacheinfo(struct merge_options *o,
 	if (refresh) {
 		struct cache_entry *nce;
 
-		nce = refresh_cache_entry(ce, CE_MATCH_REFRESH | CE_MATCH_IGNORE_MISSING);
+		nce = refresh_cache_entry(&the_index, ce, CE_MATCH_REFRESH | CE_MATCH_IGNORE_MISSING);
 		if (!nce)
 			return err(o, _("add_cacheinfo failed to refresh for path '%s'; merge aborting."), path);
 		if (nce != ce)
@@ -1801,50 +1803,331 @@ static int handle_rename_rename_2to1(struct merge_options *o,
 	return ret;
 }
 
+struct cached_rename {
+	struct hashmap_entry ent;
+	unsigned src_mode, dst_mode;
+	struct object_id src_oid, dst_oid;
+	unsigned short score;
+	char *dst;
+	char src[FLEX_ARRAY];
+};
+
+static int cached_rename_cmp(const void *unused_cmp_data,
+			     const void *entry,
+			     const void *entry_or_key,
+			     const void *keydata)
+{
+	const struct cached_rename *a = entry;
+	const struct cached_rename *b = entry_or_key;
+
+	return strcmp(a->src, keydata ? keydata : b->src);
+}
+
+struct queued_path {
+	struct hashmap_entry ent;
+	int nr;
+	const char *path;
+};
+
+static int queued_path_cmp(const void *unused_cmp_data,
+			   const void *entry,
+			   const void *entry_or_key,
+			   const void *keydata)
+{
+	const struct queued_path *a = entry;
+	const struct queued_path *b = entry_or_key;
+
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+void rename_cache_clear(struct rename_cache *cache)
+{
+	struct hashmap_iter iter;
+	struct cached_rename *r;
+
+	if (!cache->renames.tablesize)
+		return;
+	hashmap_iter_init(&cache->renames, &iter);
+	while ((r = hashmap_iter_next(&iter)))
+		free(r->dst);
+	hashmap_free(&cache->renames, 1);
+}
+
+static int is_cached_side(const struct cached_rename *r,
+			  const struct diff_filespec *src,
+			  const struct diff_filespec *dst)
+{
+	return r->src_mode == src->mode && !oidcmp(&r->src_oid, &src->oid) &&
+	       r->dst_mode == dst->mode && !oidcmp(&r->dst_oid, &dst->oid);
+}
+
 /*
- * Get the diff_filepairs changed between o_tree and tree.
+ * Pair the deletions and additions of the queue that the last merge found
+ * to be a rename, if neither of them changed since; diffcore_rename()
+ * then only looks for renames among those that remain.
  */
-static struct diff_queue_struct *get_diffpairs(struct merge_options *o,
-					       struct tree *o_tree,
-					       struct tree *tree)
+static void reuse_cached_renames(struct rename_cache *cache,
+				 struct diff_queue_struct *q)
 {
-	struct diff_queue_struct *ret;
-	struct diff_options opts;
+	struct hashmap added;
+	struct queued_path *entries;
+	int i, j, reused = 0;
+
+	if (!cache->renames.tablesize || !hashmap_get_size(&cache->renames))
+		return;
+
+	hashmap_init(&added, queued_path_cmp, NULL, q->nr);
+	ALLOC_ARRAY(entries, q->nr);
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
 
-	diff_setup(&opts);
-	opts.flags.recursive = 1;
-	opts.flags.rename_empty = 0;
-	opts.detect_rename = merge_detect_rename(o);
+		if (DIFF_FILE_VALID(p->one) || !DIFF_FILE_VALID(p->two))
+			continue;
+		entries[i].nr = i;
+		entries[i].path = p->two->path;
+		hashmap_entry_init(&entries[i], strhash(p->two->path));
+		hashmap_add(&added, &entries[i]);
+	}
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i], *dp;
+		struct cached_rename *r;
+		struct queued_path *dst;
+		struct hashmap_entry key;
+
+		if (!p || !DIFF_FILE_VALID(p->one) || DIFF_FILE_VALID(p->two))
+			continue;
+		hashmap_entry_init(&key, strhash(p->one->path));
+		r = hashmap_get(&cache->renames, &key, p->one->path);
+		if (!r)
+			continue;
+		hashmap_entry_init(&key, strhash(r->dst));
+		dst = hashmap_get(&added, &key, r->dst);
+		if (!dst || !is_cached_side(r, p->one, q->queue[dst->nr]->two))
+			continue;
+
+		p->one->rename_used++;
+		p->one->count++;
+		q->queue[dst->nr]->two->count++;
+		dp = diff_queue(NULL, p->one, q->queue[dst->nr]->two);
+		dp->renamed_pair = 1;
+		dp->score = r->score;
+
+		diff_free_filepair(q->queue[dst->nr]);
+		q->queue[dst->nr] = dp;
+		diff_free_filepair(p);
+		q->queue[i] = NULL;
+		hashmap_remove(&added, dst, NULL);
+		reused++;
+	}
+
+	for (i = j = 0; i < q->nr; i++)
+		if (q->queue[i])
+			q->queue[j++] = q->queue[i];
+	q->nr = j;
+
+	hashmap_free(&added, 0);
+	free(entries);
+	trace2_counter_add("merge", "renames/reused", reused);
+}
+
+static void update_rename_cache(struct rename_cache *cache,
+				struct diff_queue_struct *q)
+{
+	int i;
+
+	rename_cache_clear(cache);
+	hashmap_init(&cache->renames, cached_rename_cmp, NULL, 0);
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		struct cached_rename *r;
+
+		if (p->status != DIFF_STATUS_RENAMED)
+			continue;
+		FLEX_ALLOC_STR(r, src, p->one->path);
+		r->src_mode = p->one->mode;
+		oidcpy(&r->src_oid, &p->one->oid);
+		r->dst = xstrdup(p->two->path);
+		r->dst_mode = p->two->mode;
+		oidcpy(&r->dst_oid, &p->two->oid);
+		r->score = p->score;
+		hashmap_entry_init(r, strhash(r->src));
+		hashmap_add(&cache->renames, r);
+	}
+}
+
+static void setup_rename_options(struct merge_options *o,
+				 struct diff_options *opts)
+{
+	diff_setup(opts);
+	opts->flags.recursive = 1;
+	opts->flags.rename_empty = 0;
+	opts->detect_rename = merge_detect_rename(o);
 	/*
 	 * We do not have logic to handle the detection of copies.  In
 	 * fact, it may not even make sense to add such logic: would we
 	 * really want a change to a base file to be propagated through
 	 * multiple other files by a merge?
 	 */
-	if (opts.detect_rename > DIFF_DETECT_RENAME)
-		opts.detect_rename = DIFF_DETECT_RENAME;
-	opts.rename_limit = o->merge_rename_limit >= 0 ? o->merge_rename_limit :
-			    o->diff_rename_limit >= 0 ? o->diff_rename_limit :
-			    1000;
-	opts.rename_score = o->rename_score;
-	opts.show_rename_progress = o->show_rename_progress;
-	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
-	diff_setup_done(&opts);
+	if (opts->detect_rename > DIFF_DETECT_RENAME)
+		opts->detect_rename = DIFF_DETECT_RENAME;
+	opts->rename_limit = o->merge_rename_limit >= 0 ? o->merge_rename_limit :
+			     o->diff_rename_limit >= 0 ? o->diff_rename_limit :
+			     1000;
+	opts->rename_score = o->rename_score;
+	opts->show_rename_progress = o->show_rename_progress;
+	opts->output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(opts);
+}
+
+/*
+ * Get the diff_filepairs changed between o_tree and tree, without
+ * detecting renames yet.
+ */
+static struct diff_queue_struct *get_diffpairs(struct merge_options *o,
+					       struct tree *o_tree,
+					       struct tree *tree)
+{
+	struct diff_queue_struct *ret;
+	struct diff_options opts;
+
+	setup_rename_options(o, &opts);
 	diff_tree_oid(&o_tree->object.oid, &tree->object.oid, "", &opts);
-	diffcore_std(&opts);
-	if (opts.needed_rename_limit > o->needed_rename_limit)
-		o->needed_rename_limit = opts.needed_rename_limit;
 
 	ret = xmalloc(sizeof(*ret));
 	*ret = diff_queued_diff;
-
-	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
-	diff_queued_diff.nr = 0;
-	diff_queued_diff.queue = NULL;
+	DIFF_QUEUE_CLEAR(&diff_queued_diff);
 	diff_flush(&opts);
 	return ret;
 }
 
+/*
+ * Turn the deletions and additions of the pairs into renames; the
+ * renames are reused from and saved to 'cache', if it is not NULL.
+ */
+static void detect_renames(struct merge_options *o,
+			   struct diff_queue_struct *pairs,
+			   struct rename_cache *cache)
+{
+	struct diff_options opts;
+
+	setup_rename_options(o, &opts);
+	diff_queued_diff = *pairs;
+	if (cache)
+		reuse_cached_renames(cache, &diff_queued_diff);
+	diffcore_std(&opts);
+	if (opts.needed_rename_limit > o->needed_rename_limit)
+		o->needed_rename_limit = opts.needed_rename_limit;
+	if (cache)
+		update_rename_cache(cache, &diff_queued_diff);
+
+	*pairs = diff_queued_diff;
+	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	diff_flush(&opts);
+}
+
+/* What one side of the merge did to the paths of the merge base */
+struct side_changes {
+	struct string_list changed;	/* modified or deleted paths */
+	struct string_list added_names;	/* basenames of new paths */
+	struct string_list added_dirs;	/* top directories of new paths */
+};
+
+static void collect_side_changes(struct diff_queue_struct *pairs,
+				 struct side_changes *sc)
+{
+	int i;
+
+	string_list_init(&sc->changed, 1);
+	string_list_init(&sc->added_names, 1);
+	string_list_init(&sc->added_dirs, 1);
+	for (i = 0; i < pairs->nr; i++) {
+		struct diff_filepair *p = pairs->queue[i];
+		const char *slash;
+
+		if (DIFF_FILE_VALID(p->one)) {
+			string_list_append(&sc->changed, p->one->path);
+			continue;
+		}
+		slash = strrchr(p->two->path, '/');
+		string_list_append(&sc->added_names,
+				   slash ? slash + 1 : p->two->path);
+		slash = strchr(p->two->path, '/');
+		if (slash)
+			string_list_append_nodup(&sc->added_dirs,
+				xmemdupz(p->two->path, slash - p->two->path));
+	}
+	string_list_sort(&sc->changed);
+	string_list_sort(&sc->added_names);
+	string_list_sort(&sc->added_dirs);
+	string_list_remove_duplicates(&sc->added_dirs, 0);
+}
+
+static void clear_side_changes(struct side_changes *sc)
+{
+	string_list_clear(&sc->changed, 0);
+	string_list_clear(&sc->added_names, 0);
+	string_list_clear(&sc->added_dirs, 0);
+}
+
+static int have_common_string(struct string_list *a, struct string_list *b)
+{
+	int i = 0, j = 0;
+
+	while (i < a->nr && j < b->nr) {
+		int cmp = strcmp(a->items[i].string, b->items[j].string);
+		if (!cmp)
+			return 1;
+		if (cmp < 0)
+			i++;
+		else
+			j++;
+	}
+	return 0;
+}
+
+/*
+ * A file that one side renamed only matters to the merge if the other
+ * side changed it, so that its changes have to follow the rename, or if
+ * the other side added files to the directory it was in, which may
+ * have to follow a directory rename. Otherwise, the deletion and the
+ * addition give the same result as the rename, and we drop the deletion
+ * from the rename sources, which can save most of the cost of rename
+ * detection when one side moved many files that the other did not touch.
+ */
+static void drop_irrelevant_sources(struct diff_queue_struct *pairs,
+				    struct side_changes *other)
+{
+	int i, j, dropped = 0;
+
+	for (i = j = 0; i < pairs->nr; i++) {
+		struct diff_filepair *p = pairs->queue[i];
+		const char *path = p->one->path, *slash;
+
+		if (!DIFF_FILE_VALID(p->one) || DIFF_FILE_VALID(p->two) ||
+		    string_list_has_string(&other->changed, path)) {
+			pairs->queue[j++] = p;
+			continue;
+		}
+		slash = strchr(path, '/');
+		if (slash) {
+			char *dir = xmemdupz(path, slash - path);
+			int in_added_dir =
+				string_list_has_string(&other->added_dirs, dir);
+
+			free(dir);
+			if (in_added_dir) {
+				pairs->queue[j++] = p;
+				continue;
+			}
+		}
+		diff_free_filepair(p);
+		dropped++;
+	}
+	pairs->nr = j;
+	trace2_counter_add("merge", "renames/irrelevant-sources", dropped);
+}
+
 static int tree_has_path(struct tree *tree, const char *path)
 {
 	struct object_id hashy;
@@ -2856,6 +3139,7 @@ static int detect_and_process_renames(struct merge_options *o,
 				      struct rename_info *ri)
 {
 	struct diff_queue_struct *head_pairs, *merge_pairs;
+	struct side_changes head_changes, merge_changes;
 	struct hashmap *dir_re_head, *dir_re_merge;
 	int clean = 1;
 
@@ -2868,6 +3152,25 @@ static int detect_and_process_renames(struct merge_options *o,
 	head_pairs = get_diffpairs(o, common, head);
 	merge_pairs = get_diffpairs(o, common, merge);
 
+	/*
+	 * When both sides added the same path, possibly once directory
+	 * renames are applied, which keep the basenames, a rename may be
+	 * part of a rename/add or rename/rename(2to1) conflict, and all the
+	 * sources are needed to tell them from add/add conflicts.
+	 */
+	collect_side_changes(head_pairs, &head_changes);
+	collect_side_changes(merge_pairs, &merge_changes);
+	if (!have_common_string(&head_changes.added_names,
+				&merge_changes.added_names)) {
+		drop_irrelevant_sources(head_pairs, &merge_changes);
+		drop_irrelevant_sources(merge_pairs, &head_changes);
+	}
+	clear_side_changes(&head_changes);
+	clear_side_changes(&merge_changes);
+
+	detect_renames(o, head_pairs, o->call_depth ? NULL : o->rename_cache);
+	detect_renames(o, merge_pairs, NULL);
+
 	dir_re_head = get_directory_renames(head_pairs, head);
 	dir_re_merge = get_directory_renames(merge_pairs, merge);
 
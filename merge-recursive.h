@@ -4,6 +4,18 @@
 #include "unpack-trees.h"
 #include "string-list.h"
 
+/*
+ * The renames between the merge base and branch1 that a merge found, so
+ * that the next merge onto the same branch (like the next pick of a
+ * rebase) reuses those whose source and destination did not change,
+ * instead of detecting them again. Initialize with memset() to zero.
+ */
+struct rename_cache {
+	struct hashmap renames;
+};
+
+void rename_cache_clear(struct rename_cache *cache);
+
 struct merge_options {
 	const char *ancestor;
 	const char *branch1;
@@ -31,6 +43,7 @@ struct merge_options {
 	struct string_list df_conflict_file_set;
 	struct unpack_trees_options unpack_opts;
 	struct index_state orig_index;
+	struct rename_cache *rename_cache; /* or NULL */
 };
 
 /*
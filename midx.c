@@ -0,0 +1,1289 @@
+#include "cache.h"
+#include "config.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "lockfile.h"
+#include "packfile.h"
+#include "object-store.h"
+#include "sha1-lookup.h"
+#include "commit.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "pack-bitmap.h"
+#include "midx.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+#define MIDX_CHUNKID_REVINDEX 0x52494458 /* "RIDX" */
+
+#define MIDX_VERSION 1
+#define MIDX_HASH_VERSION 1
+#define MIDX_HASH_LEN GIT_SHA1_RAWSZ
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_CHUNK_OFFSET_WIDTH 8
+#define MIDX_CHUNK_LARGE_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+#define MIDX_CHUNK_REVINDEX_WIDTH 4
+#define MIDX_MAX_CHUNKS 6
+#define MIDX_CHUNK_ALIGNMENT 4
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_HASH_LEN)
+
+char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct multi_pack_index *m = NULL;
+	int fd;
+	struct stat st;
+	size_t midx_size;
+	void *midx_map = NULL;
+	uint32_t hash_version;
+	char *midx_name = get_midx_filename(object_dir);
+	uint32_t i;
+	const char *cur_pack_name;
+
+	fd = git_open(midx_name);
+
+	if (fd < 0)
+		goto cleanup_fail;
+	if (fstat(fd, &st)) {
+		error_errno(_("failed to read %s"), midx_name);
+		goto cleanup_fail;
+	}
+
+	midx_size = xsize_t(st.st_size);
+
+	if (midx_size < MIDX_MIN_SIZE) {
+		error(_("multi-pack-index file %s is too small"), midx_name);
+		goto cleanup_fail;
+	}
+
+	FREE_AND_NULL(midx_name);
+
+	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	FLEX_ALLOC_STR(m, object_dir, object_dir);
+	m->fd = fd;
+	m->data = midx_map;
+	m->data_len = midx_size;
+	m->local = local;
+
+	m->signature = get_be32(m->data);
+	if (m->signature != MIDX_SIGNATURE)
+		die(_("multi-pack-index signature 0x%08x does not match signature 0x%08x"),
+		    m->signature, MIDX_SIGNATURE);
+
+	m->version = m->data[4];
+	if (m->version != MIDX_VERSION)
+		die(_("multi-pack-index version %d not recognized"),
+		    m->version);
+
+	hash_version = m->data[5];
+	if (hash_version != MIDX_HASH_VERSION)
+		die(_("hash version %u does not match"), hash_version);
+	m->hash_len = MIDX_HASH_LEN;
+
+	m->num_chunks = m->data[6];
+	m->num_packs = get_be32(m->data + 8);
+
+	if (MIDX_HEADER_SIZE + (m->num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH > midx_size)
+		die(_("multi-pack-index chunk lookup table is truncated"));
+
+	for (i = 0; i < m->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(m->data + MIDX_HEADER_SIZE +
+					     MIDX_CHUNKLOOKUP_WIDTH * i);
+		uint64_t chunk_offset = get_be64(m->data + MIDX_HEADER_SIZE + 4 +
+						 MIDX_CHUNKLOOKUP_WIDTH * i);
+
+		if (chunk_offset >= m->data_len)
+			die(_("invalid chunk offset (too large)"));
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = m->data + chunk_offset;
+			break;
+
+		case MIDX_CHUNKID_OIDFANOUT:
+			m->chunk_oid_fanout = (uint32_t *)(m->data + chunk_offset);
+			break;
+
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = m->data + chunk_offset;
+			break;
+
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = m->data + chunk_offset;
+			break;
+
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = m->data + chunk_offset;
+			break;
+
+		case MIDX_CHUNKID_REVINDEX:
+			m->chunk_revindex = m->data + chunk_offset;
+			break;
+
+		case 0:
+			die(_("terminating multi-pack-index chunk id appears earlier than expected"));
+			break;
+
+		default:
+			/*
+			 * Do nothing on unrecognized chunks, allowing future
+			 * extensions to add optional chunks.
+			 */
+			break;
+		}
+	}
+
+	if (!m->chunk_pack_names)
+		die(_("multi-pack-index missing required pack-name chunk"));
+	if (!m->chunk_oid_fanout)
+		die(_("multi-pack-index missing required OID fanout chunk"));
+	if (!m->chunk_oid_lookup)
+		die(_("multi-pack-index missing required OID lookup chunk"));
+	if (!m->chunk_object_offsets)
+		die(_("multi-pack-index missing required object offsets chunk"));
+
+	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
+
+	if (m->chunk_revindex &&
+	    m->chunk_revindex + (size_t)m->num_objects * MIDX_CHUNK_REVINDEX_WIDTH >
+	    m->data + m->data_len - m->hash_len)
+		die(_("multi-pack-index reverse index chunk is truncated"));
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+
+	cur_pack_name = (const char *)m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		m->pack_names[i] = cur_pack_name;
+
+		cur_pack_name += strlen(cur_pack_name) + 1;
+
+		if (i && strcmp(m->pack_names[i], m->pack_names[i - 1]) <= 0)
+			die(_("multi-pack-index pack names out of order: '%s' before '%s'"),
+			    m->pack_names[i - 1],
+			    m->pack_names[i]);
+	}
+
+	return m;
+
+cleanup_fail:
+	free(m);
+	free(midx_name);
+	if (midx_map)
+		munmap(midx_map, midx_size);
+	if (0 <= fd)
+		close(fd);
+	return NULL;
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	uint32_t i;
+
+	if (!m)
+		return;
+
+	munmap((unsigned char *)m->data, m->data_len);
+	close(m->fd);
+	m->fd = -1;
+
+	/*
+	 * The packs themselves are owned by the repository's list of
+	 * packed_git structs; only drop our references to them.
+	 */
+	for (i = 0; i < m->num_packs; i++)
+		if (m->packs[i])
+			m->packs[i]->multi_pack_index = 0;
+
+	FREE_AND_NULL(m->packs);
+	FREE_AND_NULL(m->pack_names);
+	FREE_AND_NULL(m->pack_pos);
+}
+
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - m->hash_len;
+}
+
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap", m->object_dir,
+		       sha1_to_hex(get_midx_checksum(m)));
+}
+
+struct multi_pack_index *find_multi_pack_index(struct repository *r,
+					       const char *object_dir)
+{
+	struct multi_pack_index *m;
+
+	for (m = r->objects->multi_pack_index; m; m = m->next)
+		if (!strcmp(object_dir, m->object_dir))
+			return m;
+	return NULL;
+}
+
+int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local)
+{
+	struct multi_pack_index *m;
+
+	if (!core_multi_pack_index)
+		return 0;
+
+	if (find_multi_pack_index(r, object_dir))
+		return 1;
+
+	m = load_multi_pack_index(object_dir, local);
+	if (!m)
+		return 0;
+
+	m->next = r->objects->multi_pack_index;
+	r->objects->multi_pack_index = m;
+	return 1;
+}
+
+int midx_locate_pack(struct multi_pack_index *m, const char *idx_name,
+		     uint32_t *pack_int_id)
+{
+	uint32_t first = 0, last = m->num_packs;
+
+	while (first < last) {
+		uint32_t mid = first + (last - first) / 2;
+		int cmp = strcmp(idx_name, m->pack_names[mid]);
+
+		if (!cmp) {
+			if (pack_int_id)
+				*pack_int_id = mid;
+			return 1;
+		}
+		if (cmp > 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	return 0;
+}
+
+int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m,
+		 uint32_t *result)
+{
+	return bsearch_hash(oid->hash, m->chunk_oid_fanout, m->chunk_oid_lookup,
+			    MIDX_HASH_LEN, result);
+}
+
+struct object_id *nth_midxed_object_oid(struct object_id *oid,
+					struct multi_pack_index *m,
+					uint32_t n)
+{
+	if (n >= m->num_objects)
+		return NULL;
+
+	hashcpy(oid->hash, m->chunk_oid_lookup + m->hash_len * n);
+	return oid;
+}
+
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+{
+	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
+}
+
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+{
+	const unsigned char *offset_data;
+	uint32_t offset32;
+
+	offset_data = m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH;
+	offset32 = get_be32(offset_data + sizeof(uint32_t));
+
+	if (m->chunk_large_offsets && offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		if (sizeof(off_t) < sizeof(uint64_t))
+			die(_("multi-pack-index stores a 64-bit offset, but off_t is too small"));
+
+		offset32 ^= MIDX_LARGE_OFFSET_NEEDED;
+		return get_be64(m->chunk_large_offsets +
+				MIDX_CHUNK_LARGE_OFFSET_WIDTH * offset32);
+	}
+
+	return offset32;
+}
+
+uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos)
+{
+	if (!m->chunk_revindex)
+		BUG("multi-pack-index has no reverse index");
+	if (pos >= m->num_objects)
+		BUG("pack position %"PRIu32" out of range", pos);
+	return get_be32(m->chunk_revindex + pos * MIDX_CHUNK_REVINDEX_WIDTH);
+}
+
+uint32_t midx_to_pack_pos(struct multi_pack_index *m, uint32_t at)
+{
+	if (!m->pack_pos) {
+		uint32_t i;
+
+		ALLOC_ARRAY(m->pack_pos, m->num_objects);
+		for (i = 0; i < m->num_objects; i++) {
+			uint32_t nr = pack_pos_to_midx(m, i);
+
+			if (nr >= m->num_objects)
+				die(_("multi-pack-index reverse index refers to "
+				      "object %"PRIu32" (%"PRIu32" total objects)"),
+				    nr, m->num_objects);
+			m->pack_pos[nr] = i;
+		}
+	}
+	return m->pack_pos[at];
+}
+
+int fill_midx_entry(const struct object_id *oid, struct pack_entry *e,
+		    struct multi_pack_index *m)
+{
+	uint32_t pos, pack_int_id;
+	struct packed_git *p;
+
+	if (!bsearch_midx(oid, m, &pos))
+		return 0;
+
+	pack_int_id = nth_midxed_pack_int_id(m, pos);
+	if (pack_int_id >= m->num_packs)
+		die(_("bad pack-int-id: %u (%u total packs)"),
+		    pack_int_id, m->num_packs);
+
+	p = m->packs[pack_int_id];
+	if (!p)
+		return 0;
+
+	if (p->num_bad_objects) {
+		uint32_t i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (!hashcmp(oid->hash,
+				     p->bad_object_sha1 + the_hash_algo->rawsz * i))
+				return 0;
+	}
+
+	/*
+	 * We are about to tell the caller where they can locate the
+	 * requested object.  We better make sure the packfile is
+	 * still here and can be accessed before supplying that
+	 * answer, as it may have been deleted since the midx was
+	 * loaded!
+	 */
+	if (!is_pack_valid(p))
+		return 0;
+
+	e->offset = nth_midxed_offset(m, pos);
+	e->p = p;
+	return 1;
+}
+
+struct pack_list {
+	struct packed_git **list;
+	char **names;
+	uint32_t nr;
+	uint32_t alloc;
+};
+
+static void add_pack_to_midx(const char *full_path, size_t full_path_len,
+			     const char *file_name, void *data)
+{
+	struct pack_list *packs = (struct pack_list *)data;
+	struct packed_git *p;
+
+	if (!ends_with(file_name, ".idx"))
+		return;
+
+	p = add_packed_git(full_path, full_path_len, 0);
+	if (!p) {
+		warning(_("failed to add packfile '%s'"), full_path);
+		return;
+	}
+
+	if (open_pack_index(p)) {
+		warning(_("failed to open pack-index '%s'"), full_path);
+		close_pack(p);
+		free(p);
+		return;
+	}
+
+	ALLOC_GROW(packs->list, packs->nr + 1, packs->alloc);
+	ALLOC_GROW(packs->names, packs->nr + 1, packs->alloc);
+
+	packs->list[packs->nr] = p;
+	packs->names[packs->nr] = xstrdup(file_name);
+	packs->nr++;
+}
+
+struct pack_pair {
+	uint32_t pack_int_id;
+	char *pack_name;
+};
+
+static int pack_pair_compare(const void *_a, const void *_b)
+{
+	struct pack_pair *a = (struct pack_pair *)_a;
+	struct pack_pair *b = (struct pack_pair *)_b;
+	return strcmp(a->pack_name, b->pack_name);
+}
+
+static void sort_packs_by_name(struct pack_list *packs)
+{
+	uint32_t i;
+	struct pack_pair *pairs;
+	struct packed_git **list_copy;
+
+	ALLOC_ARRAY(pairs, packs->nr);
+	for (i = 0; i < packs->nr; i++) {
+		pairs[i].pack_int_id = i;
+		pairs[i].pack_name = packs->names[i];
+	}
+
+	QSORT(pairs, packs->nr, pack_pair_compare);
+
+	/*
+	 * The position of a pack in the sorted list is its pack-int-id,
+	 * so the objects must be collected only after this reordering.
+	 */
+	ALLOC_ARRAY(list_copy, packs->nr);
+	COPY_ARRAY(list_copy, packs->list, packs->nr);
+	for (i = 0; i < packs->nr; i++) {
+		packs->names[i] = pairs[i].pack_name;
+		packs->list[i] = list_copy[pairs[i].pack_int_id];
+	}
+
+	free(list_copy);
+	free(pairs);
+}
+
+struct pack_midx_entry {
+	struct object_id oid;
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	uint64_t offset;
+	unsigned preferred : 1;
+};
+
+static int midx_oid_compare(const void *_a, const void *_b)
+{
+	const struct pack_midx_entry *a = (const struct pack_midx_entry *)_a;
+	const struct pack_midx_entry *b = (const struct pack_midx_entry *)_b;
+	int cmp = oidcmp(&a->oid, &b->oid);
+
+	if (cmp)
+		return cmp;
+
+	/* Prefer the copy in the preferred pack... */
+	if (a->preferred > b->preferred)
+		return -1;
+	if (a->preferred < b->preferred)
+		return 1;
+
+	/* ...and then the one in the most recent pack. */
+	if (a->pack_mtime > b->pack_mtime)
+		return -1;
+	else if (a->pack_mtime < b->pack_mtime)
+		return 1;
+
+	if (a->pack_int_id < b->pack_int_id)
+		return -1;
+	return a->pack_int_id > b->pack_int_id;
+}
+
+/*
+ * Collect the objects of every pack, sorted by object id and with a
+ * single entry for each object.
+ */
+static struct pack_midx_entry *get_sorted_entries(struct pack_list *packs,
+						  int preferred_pack,
+						  uint32_t *nr_objects)
+{
+	uint32_t i, j, total = 0, nr = 0;
+	struct pack_midx_entry *entries;
+
+	for (i = 0; i < packs->nr; i++)
+		total = st_add(total, packs->list[i]->num_objects);
+
+	ALLOC_ARRAY(entries, total);
+
+	for (i = 0; i < packs->nr; i++) {
+		struct packed_git *p = packs->list[i];
+
+		for (j = 0; j < p->num_objects; j++) {
+			struct pack_midx_entry *e = &entries[nr++];
+
+			if (!nth_packed_object_oid(&e->oid, p, j))
+				die(_("unable to get object %u of %s"), j,
+				    p->pack_name);
+			e->pack_int_id = i;
+			e->pack_mtime = p->mtime;
+			e->offset = nth_packed_object_offset(p, j);
+			e->preferred = (i == preferred_pack);
+		}
+	}
+
+	QSORT(entries, nr, midx_oid_compare);
+
+	for (i = 0, j = 0; i < nr; i++) {
+		if (j && !oidcmp(&entries[j - 1].oid, &entries[i].oid))
+			continue;
+		if (i != j)
+			entries[j] = entries[i];
+		j++;
+	}
+
+	*nr_objects = j;
+	return entries;
+}
+
+static size_t write_midx_pack_names(struct hashfile *f,
+				    char **pack_names,
+				    uint32_t num_packs)
+{
+	unsigned char padding[MIDX_CHUNK_ALIGNMENT];
+	uint32_t i;
+	size_t written = 0;
+
+	for (i = 0; i < num_packs; i++) {
+		size_t writelen = strlen(pack_names[i]) + 1;
+
+		if (i && strcmp(pack_names[i], pack_names[i - 1]) <= 0)
+			BUG("incorrect pack-file order: %s before %s",
+			    pack_names[i - 1],
+			    pack_names[i]);
+
+		hashwrite(f, pack_names[i], writelen);
+		written += writelen;
+	}
+
+	/* add padding to be aligned */
+	i = MIDX_CHUNK_ALIGNMENT - (written % MIDX_CHUNK_ALIGNMENT);
+	if (i < MIDX_CHUNK_ALIGNMENT) {
+		memset(padding, 0, sizeof(padding));
+		hashwrite(f, padding, i);
+		written += i;
+	}
+
+	return written;
+}
+
+static size_t write_midx_oid_fanout(struct hashfile *f,
+				    struct pack_midx_entry *objects,
+				    uint32_t nr_objects)
+{
+	struct pack_midx_entry *list = objects;
+	struct pack_midx_entry *last = objects + nr_objects;
+	uint32_t count = 0;
+	uint32_t i;
+
+	/*
+	 * Write the first-level table (the list is sorted,
+	 * but we use a 256-entry lookup to be able to avoid
+	 * having to do eight extra binary search iterations).
+	 */
+	for (i = 0; i < 256; i++) {
+		struct pack_midx_entry *next = list;
+
+		while (next < last && next->oid.hash[0] == i) {
+			count++;
+			next++;
+		}
+
+		hashwrite_be32(f, count);
+		list = next;
+	}
+
+	return MIDX_FANOUT_SIZE;
+}
+
+static size_t write_midx_oid_lookup(struct hashfile *f, unsigned char hash_len,
+				    struct pack_midx_entry *objects,
+				    uint32_t nr_objects)
+{
+	struct pack_midx_entry *list = objects;
+	uint32_t i;
+	size_t written = 0;
+
+	for (i = 0; i < nr_objects; i++) {
+		struct pack_midx_entry *obj = list++;
+
+		if (i < nr_objects - 1) {
+			struct pack_midx_entry *next = list;
+			if (oidcmp(&obj->oid, &next->oid) >= 0)
+				BUG("OIDs not in order: %s >= %s",
+				    oid_to_hex(&obj->oid),
+				    oid_to_hex(&next->oid));
+		}
+
+		hashwrite(f, obj->oid.hash, (int)hash_len);
+		written += hash_len;
+	}
+
+	return written;
+}
+
+static size_t write_midx_object_offsets(struct hashfile *f, int large_offset_needed,
+					struct pack_midx_entry *objects, uint32_t nr_objects)
+{
+	struct pack_midx_entry *list = objects;
+	uint32_t i, nr_large_offset = 0;
+	size_t written = 0;
+
+	for (i = 0; i < nr_objects; i++) {
+		struct pack_midx_entry *obj = list++;
+
+		hashwrite_be32(f, obj->pack_int_id);
+
+		if (large_offset_needed && obj->offset >> 31)
+			hashwrite_be32(f, MIDX_LARGE_OFFSET_NEEDED | nr_large_offset++);
+		else if (!large_offset_needed && obj->offset >> 32)
+			BUG("object %s requires a large offset (%"PRIx64") but the MIDX is not writing large offsets!",
+			    oid_to_hex(&obj->oid),
+			    obj->offset);
+		else
+			hashwrite_be32(f, (uint32_t)obj->offset);
+
+		written += MIDX_CHUNK_OFFSET_WIDTH;
+	}
+
+	return written;
+}
+
+static size_t write_midx_large_offsets(struct hashfile *f, uint32_t nr_large_offset,
+				       struct pack_midx_entry *objects, uint32_t nr_objects)
+{
+	struct pack_midx_entry *list = objects, *end = objects + nr_objects;
+	size_t written = 0;
+
+	while (nr_large_offset) {
+		struct pack_midx_entry *obj;
+		uint64_t offset;
+
+		if (list >= end)
+			BUG("too many large-offset objects");
+
+		obj = list++;
+		offset = obj->offset;
+
+		if (!(offset >> 31))
+			continue;
+
+		hashwrite_be32(f, offset >> 32);
+		hashwrite_be32(f, offset & 0xffffffffUL);
+		written += 2 * sizeof(uint32_t);
+
+		nr_large_offset--;
+	}
+
+	return written;
+}
+
+struct midx_pack_order_data {
+	uint32_t nr;
+	uint32_t pack;
+	uint64_t offset;
+};
+
+static int midx_pack_order_cmp(const void *va, const void *vb)
+{
+	const struct midx_pack_order_data *a = va, *b = vb;
+
+	if (a->pack < b->pack)
+		return -1;
+	if (a->pack > b->pack)
+		return 1;
+	if (a->offset < b->offset)
+		return -1;
+	if (a->offset > b->offset)
+		return 1;
+	return 0;
+}
+
+/*
+ * Return the positions of "entries" in pack order (see midx.h): the
+ * objects of "preferred_pack" first, then those of every other pack.
+ */
+static uint32_t *midx_pack_order(struct pack_midx_entry *entries,
+				 uint32_t nr_entries, int preferred_pack)
+{
+	struct midx_pack_order_data *data;
+	uint32_t *pack_order;
+	uint32_t i;
+
+	ALLOC_ARRAY(data, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		data[i].nr = i;
+		data[i].pack = entries[i].pack_int_id == preferred_pack ?
+			0 : entries[i].pack_int_id + 1;
+		data[i].offset = entries[i].offset;
+	}
+
+	QSORT(data, nr_entries, midx_pack_order_cmp);
+
+	ALLOC_ARRAY(pack_order, nr_entries);
+	for (i = 0; i < nr_entries; i++)
+		pack_order[i] = data[i].nr;
+
+	free(data);
+	return pack_order;
+}
+
+static size_t write_midx_revindex(struct hashfile *f, uint32_t *pack_order,
+				  uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, pack_order[i]);
+
+	return (size_t)nr_objects * MIDX_CHUNK_REVINDEX_WIDTH;
+}
+
+struct bitmap_commits_data {
+	struct packing_data *to_pack;
+	struct commit **commits;
+	uint32_t nr, alloc;
+};
+
+static void bitmap_show_commit(struct commit *c, void *data_)
+{
+	struct bitmap_commits_data *data = data_;
+
+	if (!packlist_find(data->to_pack, c->object.oid.hash, NULL))
+		die(_("cannot write a multi-pack-index bitmap: "
+		      "commit %s is not in any pack"),
+		    oid_to_hex(&c->object.oid));
+	ALLOC_GROW(data->commits, data->nr + 1, data->alloc);
+	data->commits[data->nr++] = c;
+}
+
+/* Remember the name of each object for the hash cache */
+static void bitmap_show_object(struct object *obj, const char *name,
+			       void *data_)
+{
+	struct bitmap_commits_data *data = data_;
+	struct object_entry *entry;
+
+	entry = packlist_find(data->to_pack, obj->oid.hash, NULL);
+	if (entry && !entry->hash)
+		entry->hash = pack_name_hash(name);
+}
+
+/*
+ * Collect every commit reachable from the refs. They must all be in
+ * the multi-pack-index (that is, in "to_pack"), and so must everything
+ * they reach, as a bitmap can only describe a set of objects with
+ * full closure. With "names", walk the trees too and give the objects
+ * the name hash of the path they were first seen at.
+ */
+static struct commit **find_bitmap_commits(struct packing_data *to_pack,
+					   uint32_t *nr_commits, int names)
+{
+	const char *argv[] = { NULL, "--all", NULL };
+	struct bitmap_commits_data data = { to_pack, NULL, 0, 0 };
+	struct rev_info revs;
+
+	init_revisions(&revs, NULL);
+	setup_revisions(ARRAY_SIZE(argv) - 1, argv, &revs, NULL);
+	if (names) {
+		revs.tag_objects = 1;
+		revs.tree_objects = 1;
+		revs.blob_objects = 1;
+	}
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+
+	traverse_commit_list(&revs, bitmap_show_commit, bitmap_show_object,
+			     &data);
+	reset_revision_walk();
+
+	*nr_commits = data.nr;
+	return data.commits;
+}
+
+static void write_midx_bitmap(const char *object_dir,
+			      unsigned char *midx_hash,
+			      struct pack_midx_entry *entries,
+			      uint32_t nr_entries,
+			      uint32_t *pack_order)
+{
+	struct packing_data to_pack;
+	struct pack_idx_entry **index, **index_in_pack_order;
+	struct commit **commits;
+	uint32_t i, nr_commits;
+	char *bitmap_name;
+	uint16_t options = BITMAP_OPT_LOOKUP_TABLE | BITMAP_OPT_HASH_CACHE;
+	int lookup_table, hash_cache;
+
+	if (!git_config_get_bool("pack.writebitmaplookuptable", &lookup_table) &&
+	    !lookup_table)
+		options &= ~BITMAP_OPT_LOOKUP_TABLE;
+	if (!git_config_get_bool("pack.writebitmaphashcache", &hash_cache) &&
+	    !hash_cache)
+		options &= ~BITMAP_OPT_HASH_CACHE;
+
+	memset(&to_pack, 0, sizeof(to_pack));
+	prepare_packing_data(&to_pack);
+	for (i = 0; i < nr_entries; i++) {
+		uint32_t index_pos;
+
+		packlist_find(&to_pack, entries[i].oid.hash, &index_pos);
+		packlist_alloc(&to_pack, entries[i].oid.hash, index_pos);
+	}
+
+	ALLOC_ARRAY(index, nr_entries);
+	ALLOC_ARRAY(index_in_pack_order, nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		index[i] = &to_pack.objects[i].idx;
+		index_in_pack_order[i] = &to_pack.objects[pack_order[i]].idx;
+	}
+
+	save_commit_buffer = 0;
+	commits = find_bitmap_commits(&to_pack, &nr_commits,
+				      options & BITMAP_OPT_HASH_CACHE);
+
+	bitmap_name = xstrfmt("%s/pack/multi-pack-index-%s.bitmap",
+			      object_dir, sha1_to_hex(midx_hash));
+
+	bitmap_writer_show_progress(0);
+	bitmap_writer_set_checksum(midx_hash);
+	bitmap_writer_build_type_index(&to_pack, index_in_pack_order, nr_entries);
+	bitmap_writer_reuse_bitmaps(&to_pack);
+	bitmap_writer_select_commits(commits, nr_commits, -1);
+	bitmap_writer_build(&to_pack);
+	bitmap_writer_finish(index, nr_entries, bitmap_name, options);
+
+	free(bitmap_name);
+	free(commits);
+	free(index);
+	free(index_in_pack_order);
+}
+
+static int is_pack_named(const char *name, const char *idx_name)
+{
+	size_t len;
+
+	if (!strip_suffix(idx_name, ".idx", &len) || strncmp(name, idx_name, len))
+		return 0;
+	return !strcmp(name + len, ".idx") || !strcmp(name + len, ".pack");
+}
+
+struct clear_midx_bitmaps_data {
+	const char *keep;
+};
+
+static void clear_midx_bitmap(const char *full_path, size_t full_path_len,
+			      const char *file_name, void *data)
+{
+	struct clear_midx_bitmaps_data *d = data;
+
+	if (!starts_with(file_name, "multi-pack-index-") ||
+	    !ends_with(file_name, ".bitmap"))
+		return;
+	if (d->keep && !strcmp(file_name, d->keep))
+		return;
+	if (unlink(full_path) && errno != ENOENT)
+		die_errno(_("failed to remove %s"), full_path);
+}
+
+/*
+ * Remove the bitmaps in "<object_dir>/pack" that belong to other
+ * multi-pack-indexes than the one with checksum "keep" (or all of
+ * them, if "keep" is NULL).
+ */
+static void clear_midx_bitmaps(const char *object_dir, const unsigned char *keep)
+{
+	struct clear_midx_bitmaps_data data;
+	char *keep_name = NULL;
+
+	if (keep)
+		keep_name = xstrfmt("multi-pack-index-%s.bitmap",
+				    sha1_to_hex(keep));
+	data.keep = keep_name;
+	for_each_file_in_pack_dir(object_dir, clear_midx_bitmap, &data);
+	free(keep_name);
+}
+
+int write_midx_file(const char *object_dir, const char *preferred_pack_name,
+		    unsigned flags)
+{
+	unsigned char cur_chunk, num_chunks = 0;
+	char *midx_name;
+	uint32_t i;
+	struct hashfile *f = NULL;
+	struct lock_file lk = LOCK_INIT;
+	struct pack_list packs;
+	uint64_t written = 0;
+	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
+	uint32_t nr_entries, num_large_offsets = 0;
+	struct pack_midx_entry *entries = NULL;
+	int large_offsets_needed = 0;
+	int preferred_pack = -1;
+	uint32_t *pack_order = NULL;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
+
+	if ((flags & MIDX_WRITE_BITMAP) &&
+	    strcmp(object_dir, get_object_directory()))
+		die(_("multi-pack-index bitmaps can only be written for "
+		      "the repository's own object directory"));
+
+	midx_name = get_midx_filename(object_dir);
+	if (safe_create_leading_directories(midx_name))
+		die_errno(_("unable to create leading directories of %s"),
+			  midx_name);
+
+	packs.nr = 0;
+	packs.alloc = 16;
+	ALLOC_ARRAY(packs.list, packs.alloc);
+	ALLOC_ARRAY(packs.names, packs.alloc);
+
+	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
+
+	sort_packs_by_name(&packs);
+
+	if (preferred_pack_name) {
+		for (i = 0; i < packs.nr; i++)
+			if (is_pack_named(preferred_pack_name, packs.names[i]))
+				break;
+		if (i == packs.nr)
+			die(_("unknown preferred pack: '%s'"), preferred_pack_name);
+		if (!packs.list[i]->num_objects)
+			die(_("cannot select preferred pack '%s' with no objects"),
+			    preferred_pack_name);
+		preferred_pack = i;
+	} else if (flags & MIDX_WRITE_BITMAP) {
+		for (i = 0; i < packs.nr; i++) {
+			struct packed_git *p = packs.list[i];
+
+			if (!p->num_objects)
+				continue;
+			if (preferred_pack < 0 ||
+			    p->mtime < packs.list[preferred_pack]->mtime)
+				preferred_pack = i;
+		}
+	}
+
+	entries = get_sorted_entries(&packs, preferred_pack, &nr_entries);
+	for (i = 0; i < nr_entries; i++) {
+		if (entries[i].offset > 0x7fffffff)
+			num_large_offsets++;
+		if (entries[i].offset > 0xffffffff)
+			large_offsets_needed = 1;
+	}
+
+	hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
+	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	FREE_AND_NULL(midx_name);
+
+	if (flags & MIDX_WRITE_BITMAP)
+		pack_order = midx_pack_order(entries, nr_entries, preferred_pack);
+
+	cur_chunk = 0;
+	num_chunks = 4;
+	if (large_offsets_needed)
+		num_chunks++;
+	if (pack_order)
+		num_chunks++;
+
+	/* header */
+	hashwrite_be32(f, MIDX_SIGNATURE);
+	hashwrite_u8(f, MIDX_VERSION);
+	hashwrite_u8(f, MIDX_HASH_VERSION);
+	hashwrite_u8(f, num_chunks);
+	hashwrite_u8(f, 0); /* unused padding byte */
+	hashwrite_be32(f, packs.nr);
+	written = MIDX_HEADER_SIZE;
+
+	chunk_ids[cur_chunk] = MIDX_CHUNKID_PACKNAMES;
+	chunk_offsets[cur_chunk] = written + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+
+	cur_chunk++;
+	chunk_ids[cur_chunk] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1];
+	for (i = 0; i < packs.nr; i++)
+		chunk_offsets[cur_chunk] += strlen(packs.names[i]) + 1;
+	if (chunk_offsets[cur_chunk] % MIDX_CHUNK_ALIGNMENT)
+		chunk_offsets[cur_chunk] += MIDX_CHUNK_ALIGNMENT -
+			(chunk_offsets[cur_chunk] % MIDX_CHUNK_ALIGNMENT);
+
+	cur_chunk++;
+	chunk_ids[cur_chunk] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] + MIDX_FANOUT_SIZE;
+
+	cur_chunk++;
+	chunk_ids[cur_chunk] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] + nr_entries * MIDX_HASH_LEN;
+
+	cur_chunk++;
+	chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] + nr_entries * MIDX_CHUNK_OFFSET_WIDTH;
+	if (large_offsets_needed) {
+		chunk_ids[cur_chunk] = MIDX_CHUNKID_LARGEOFFSETS;
+
+		cur_chunk++;
+		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
+					   num_large_offsets * MIDX_CHUNK_LARGE_OFFSET_WIDTH;
+	}
+
+	if (pack_order) {
+		chunk_ids[cur_chunk] = MIDX_CHUNKID_REVINDEX;
+
+		cur_chunk++;
+		chunk_offsets[cur_chunk] = chunk_offsets[cur_chunk - 1] +
+					   nr_entries * MIDX_CHUNK_REVINDEX_WIDTH;
+	}
+
+	chunk_ids[cur_chunk] = 0;
+
+	for (i = 0; i <= num_chunks; i++) {
+		if (i && chunk_offsets[i] < chunk_offsets[i - 1])
+			BUG("incorrect chunk offsets: %"PRIu64" before %"PRIu64,
+			    chunk_offsets[i - 1],
+			    chunk_offsets[i]);
+
+		if (chunk_offsets[i] % MIDX_CHUNK_ALIGNMENT)
+			BUG("chunk offset %"PRIu64" is not properly aligned",
+			    chunk_offsets[i]);
+
+		hashwrite_be32(f, chunk_ids[i]);
+		hashwrite_be32(f, chunk_offsets[i] >> 32);
+		hashwrite_be32(f, chunk_offsets[i]);
+
+		written += MIDX_CHUNKLOOKUP_WIDTH;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		if (written != chunk_offsets[i])
+			BUG("incorrect chunk offset (%"PRIu64" != %"PRIu64") for chunk id %"PRIx32,
+			    chunk_offsets[i],
+			    written,
+			    chunk_ids[i]);
+
+		switch (chunk_ids[i]) {
+		case MIDX_CHUNKID_PACKNAMES:
+			written += write_midx_pack_names(f, packs.names, packs.nr);
+			break;
+
+		case MIDX_CHUNKID_OIDFANOUT:
+			written += write_midx_oid_fanout(f, entries, nr_entries);
+			break;
+
+		case MIDX_CHUNKID_OIDLOOKUP:
+			written += write_midx_oid_lookup(f, MIDX_HASH_LEN, entries, nr_entries);
+			break;
+
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			written += write_midx_object_offsets(f, large_offsets_needed, entries, nr_entries);
+			break;
+
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			written += write_midx_large_offsets(f, num_large_offsets, entries, nr_entries);
+			break;
+
+		case MIDX_CHUNKID_REVINDEX:
+			written += write_midx_revindex(f, pack_order, nr_entries);
+			break;
+
+		default:
+			BUG("trying to write unknown chunk id %"PRIx32,
+			    chunk_ids[i]);
+		}
+	}
+
+	if (written != chunk_offsets[num_chunks])
+		BUG("incorrect final offset %"PRIu64" != %"PRIu64,
+		    written,
+		    chunk_offsets[num_chunks]);
+
+	finalize_hashfile(f, midx_hash, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
+
+	/*
+	 * The bitmap is named after the new multi-pack-index; write it
+	 * before that one takes effect, so that readers never find the
+	 * multi-pack-index without its bitmap.
+	 */
+	if (flags & MIDX_WRITE_BITMAP)
+		write_midx_bitmap(object_dir, midx_hash, entries, nr_entries,
+				  pack_order);
+
+	commit_lock_file(&lk);
+	clear_midx_bitmaps(object_dir,
+			   (flags & MIDX_WRITE_BITMAP) ? midx_hash : NULL);
+
+	for (i = 0; i < packs.nr; i++) {
+		if (packs.list[i]) {
+			close_pack(packs.list[i]);
+			free(packs.list[i]);
+		}
+		free(packs.names[i]);
+	}
+
+	free(packs.list);
+	free(packs.names);
+	free(entries);
+	free(pack_order);
+	return 0;
+}
+
+void clear_midx_file(const char *object_dir)
+{
+	char *midx = get_midx_filename(object_dir);
+
+	if (remove_path(midx))
+		die(_("failed to clear multi-pack-index at %s"), midx);
+	clear_midx_bitmaps(object_dir, NULL);
+
+	free(midx);
+}
+
+static int verify_midx_error;
+
+__attribute__((format (printf, 1, 2)))
+static void midx_report(const char *fmt, ...)
+{
+	va_list ap;
+	verify_midx_error = 1;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+int verify_midx_file(const char *object_dir)
+{
+	uint32_t i;
+	struct multi_pack_index *m = load_multi_pack_index(object_dir, 1);
+	git_hash_ctx ctx;
+	unsigned char checksum[GIT_MAX_RAWSZ];
+	size_t checksum_at;
+
+	verify_midx_error = 0;
+
+	if (!m)
+		return 0;
+
+	checksum_at = m->data_len - the_hash_algo->rawsz;
+	the_hash_algo->init_fn(&ctx);
+	the_hash_algo->update_fn(&ctx, m->data, checksum_at);
+	the_hash_algo->final_fn(checksum, &ctx);
+	if (hashcmp(checksum, m->data + checksum_at))
+		midx_report(_("incorrect checksum"));
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct strbuf pack_name = STRBUF_INIT;
+		struct packed_git *p;
+
+		strbuf_addf(&pack_name, "%s/pack/%s", m->object_dir,
+			    m->pack_names[i]);
+		p = add_packed_git(pack_name.buf, pack_name.len, m->local);
+		if (!p || open_pack_index(p)) {
+			midx_report(_("failed to load pack in position %d"), i);
+			if (p) {
+				close_pack(p);
+				free(p);
+			}
+		} else {
+			m->packs[i] = p;
+		}
+		strbuf_release(&pack_name);
+	}
+
+	for (i = 1; i < 256; i++) {
+		uint32_t oid_fanout1 = ntohl(m->chunk_oid_fanout[i - 1]);
+		uint32_t oid_fanout2 = ntohl(m->chunk_oid_fanout[i]);
+
+		if (oid_fanout1 > oid_fanout2)
+			midx_report(_("oid fanout out of order: fanout[%d] = %"PRIx32" > %"PRIx32" = fanout[%d]"),
+				    i - 1, oid_fanout1, oid_fanout2, i);
+	}
+
+	for (i = 0; i + 1 < m->num_objects; i++) {
+		struct object_id oid1, oid2;
+
+		nth_midxed_object_oid(&oid1, m, i);
+		nth_midxed_object_oid(&oid2, m, i + 1);
+
+		if (oidcmp(&oid1, &oid2) >= 0)
+			midx_report(_("oid lookup out of order: oid[%d] = %s >= %s = oid[%d]"),
+				    i, oid_to_hex(&oid1), oid_to_hex(&oid2), i + 1);
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		struct object_id oid;
+		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
+		off_t m_offset, p_offset;
+		struct packed_git *p;
+
+		nth_midxed_object_oid(&oid, m, i);
+		if (pack_int_id >= m->num_packs) {
+			midx_report(_("bad pack-int-id: %u (%u total packs)"),
+				    pack_int_id, m->num_packs);
+			continue;
+		}
+
+		p = m->packs[pack_int_id];
+		if (!p)
+			continue;
+
+		m_offset = nth_midxed_offset(m, i);
+		p_offset = find_pack_entry_one(oid.hash, p);
+
+		if (m_offset != p_offset)
+			midx_report(_("incorrect object offset for oid[%d] = %s: %"PRIx64" != %"PRIx64),
+				    i, oid_to_hex(&oid), (uint64_t)m_offset,
+				    (uint64_t)p_offset);
+	}
+
+	if (m->chunk_revindex && m->num_objects) {
+		char *seen = xcalloc(m->num_objects, 1);
+		uint32_t preferred = nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0));
+		uint32_t prev_key = 0;
+		off_t prev_offset = 0;
+
+		for (i = 0; i < m->num_objects; i++) {
+			uint32_t nr = pack_pos_to_midx(m, i);
+			uint32_t pack_int_id, key;
+			off_t offset;
+
+			if (nr >= m->num_objects || seen[nr]) {
+				midx_report(_("bad reverse index entry at position %u: %"PRIu32),
+					    i, nr);
+				continue;
+			}
+			seen[nr] = 1;
+
+			pack_int_id = nth_midxed_pack_int_id(m, nr);
+			key = pack_int_id == preferred ? 0 : pack_int_id + 1;
+			offset = nth_midxed_offset(m, nr);
+			if (i && (key < prev_key ||
+				  (key == prev_key && offset <= prev_offset)))
+				midx_report(_("reverse index out of order at position %u"), i);
+			prev_key = key;
+			prev_offset = offset;
+		}
+		free(seen);
+	}
+
+	for (i = 0; i < m->num_packs; i++) {
+		if (m->packs[i]) {
+			close_pack(m->packs[i]);
+			FREE_AND_NULL(m->packs[i]);
+		}
+	}
+	close_midx(m);
+	free(m);
+
+	return verify_midx_error;
+}
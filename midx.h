@@ -0,0 +1,132 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+#include "repository.h"
+
+struct pack_entry;
+
+struct multi_pack_index {
+	struct multi_pack_index *next;
+
+	int fd;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t signature;
+	unsigned char version;
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	int local;
+
+	const unsigned char *chunk_pack_names;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	const unsigned char *chunk_revindex;
+
+	/* inverse of chunk_revindex, see midx_to_pack_pos() */
+	uint32_t *pack_pos;
+
+	const char **pack_names;
+	struct packed_git **packs;
+	char object_dir[FLEX_ARRAY];
+};
+
+#define MIDX_WRITE_BITMAP (1 << 0)
+
+char *get_midx_filename(const char *object_dir);
+
+/*
+ * Return the checksum of "m", which also names its reachability bitmap:
+ * "<object_dir>/pack/multi-pack-index-<checksum>.bitmap".
+ */
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+char *get_midx_bitmap_filename(struct multi_pack_index *m);
+
+/*
+ * Load the multi-pack-index file stored in "<object_dir>/pack". Returns
+ * NULL if there is no such file; dies if the file exists but is corrupt.
+ */
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
+
+/*
+ * Load the multi-pack-index for "object_dir" into the repository's list of
+ * multi-pack-indexes, unless core.multiPackIndex is disabled or an index
+ * for that directory was already loaded. Returns 1 if the repository has a
+ * multi-pack-index for "object_dir" afterwards.
+ */
+int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
+
+/*
+ * Return the multi-pack-index of "r" covering "object_dir", if any.
+ */
+struct multi_pack_index *find_multi_pack_index(struct repository *r,
+					       const char *object_dir);
+
+/*
+ * If "idx_name" (the basename of a ".idx" file) is one of the packs
+ * covered by "m", return 1 and store its pack-int-id into "pack_int_id".
+ */
+int midx_locate_pack(struct multi_pack_index *m, const char *idx_name,
+		     uint32_t *pack_int_id);
+
+int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m,
+		 uint32_t *result);
+struct object_id *nth_midxed_object_oid(struct object_id *oid,
+					struct multi_pack_index *m,
+					uint32_t n);
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+
+/*
+ * A multi-pack-index written with a reverse index also orders its
+ * objects as if they were one pack: first those of the "preferred"
+ * pack, in the order in which they are stored there, then those of
+ * every other pack, in pack-int-id and offset order. Bit positions in
+ * a multi-pack-index bitmap refer to this order.
+ *
+ * pack_pos_to_midx() returns the position in "m" of the object at
+ * "pos" in that order; midx_to_pack_pos() goes the other way.
+ */
+uint32_t pack_pos_to_midx(struct multi_pack_index *m, uint32_t pos);
+uint32_t midx_to_pack_pos(struct multi_pack_index *m, uint32_t at);
+
+/*
+ * If "oid" is in "m" and its pack is still usable, fill "e" and return 1.
+ */
+int fill_midx_entry(const struct object_id *oid, struct pack_entry *e,
+		    struct multi_pack_index *m);
+
+/*
+ * Write a multi-pack-index covering every pack in "<object_dir>/pack".
+ * Objects found in several packs are taken from "preferred_pack_name"
+ * (the name of a ".pack" or ".idx" file in that directory) if given.
+ *
+ * With MIDX_WRITE_BITMAP, also write a reachability bitmap for all refs.
+ * Unless told otherwise, the oldest pack is the preferred one, as that
+ * is likely to be the result of the last full repack. Returns 0 on
+ * success.
+ */
+int write_midx_file(const char *object_dir, const char *preferred_pack_name,
+		    unsigned flags);
+
+/*
+ * Remove the multi-pack-index file in "<object_dir>/pack" and its
+ * bitmap, if any.
+ */
+void clear_midx_file(const char *object_dir);
+
+/*
+ * Check the multi-pack-index in "<object_dir>/pack" against its checksum
+ * and the pack-indexes it covers. Returns the number of problems found.
+ */
+int verify_midx_file(const char *object_dir);
+
+void close_midx(struct multi_pack_index *m);
+
+#endif
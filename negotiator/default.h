@@ -0,0 +1,12 @@
+#ifndef NEGOTIATOR_DEFAULT_H
+#define NEGOTIATOR_DEFAULT_H
+
+struct fetch_negotiator;
+
+/*
+ * Walk back from the tips by commit date, sending every commit that is
+ * not yet known to be common.
+ */
+extern void default_negotiator_init(struct fetch_negotiator *negotiator);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef NEGOTIATOR_SKIPPING_H
+#define NEGOTIATOR_SKIPPING_H
+
+struct fetch_negotiator;
+
+/*
+ * Like the default negotiator, but skip more and more commits between
+ * the "have"s sent along each line of history, until the server
+ * acknowledges one.
+ */
+extern void skipping_negotiator_init(struct fetch_negotiator *negotiator);
+
+#endif
@@ -0,0 +1,317 @@
+#include "cache.h"
+#include "notes.h"
+#include "notes-index.h"
+#include "lockfile.h"
+#include "csum-file.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "sha1-lookup.h"
+
+#define NOTES_INDEX_SIGNATURE 0x4e494458 /* "NIDX" */
+#define NOTES_INDEX_VERSION 1
+#define NOTES_INDEX_OID_VERSION 1 /* SHA-1 */
+#define NOTES_INDEX_FANOUT_SIZE (4 * 256)
+#define NOTES_INDEX_HEADER_SIZE (12 + NOTES_INDEX_FANOUT_SIZE)
+
+/*
+ * The file starts with the signature, one byte each of version and
+ * hash version, two bytes of padding and the number of entries. Then
+ * come a fanout table by the first byte of the object names, as in
+ * pack indexes, the entries themselves (object name, note name), and
+ * a trailing checksum. All numbers are in network byte order.
+ */
+
+struct found_note {
+	struct found_note *next;
+	struct object_id oid;
+};
+
+struct notes_index {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *entries;
+	/* notes returned by notes_index_lookup() */
+	struct found_note *found;
+};
+
+struct notes_index_entry {
+	struct object_id object;
+	struct object_id note;
+};
+
+static const char *notes_index_path(const struct object_id *tree_oid)
+{
+	return git_path("notes-index/%s", oid_to_hex(tree_oid));
+}
+
+struct notes_index *open_notes_index(const struct object_id *tree_oid)
+{
+	const char *path = notes_index_path(tree_oid);
+	size_t rawsz = the_hash_algo->rawsz;
+	struct notes_index *ni;
+	const unsigned char *data;
+	struct stat st;
+	size_t len;
+	uint32_t nr;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < NOTES_INDEX_HEADER_SIZE + rawsz) {
+		close(fd);
+		error(_("notes index %s is too small"), path);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	nr = get_be32(data + 8);
+	if (get_be32(data) != NOTES_INDEX_SIGNATURE ||
+	    data[4] != NOTES_INDEX_VERSION ||
+	    data[5] != NOTES_INDEX_OID_VERSION ||
+	    (len - NOTES_INDEX_HEADER_SIZE - rawsz) / (2 * rawsz) != nr ||
+	    (len - NOTES_INDEX_HEADER_SIZE - rawsz) % (2 * rawsz) ||
+	    get_be32(data + 12 + 4 * 255) != nr) {
+		error(_("notes index %s is corrupt"), path);
+		munmap((void *)data, len);
+		return NULL;
+	}
+
+	ni = xcalloc(1, sizeof(*ni));
+	ni->data = data;
+	ni->data_len = len;
+	ni->nr = nr;
+	ni->fanout = data + 12;
+	ni->entries = data + NOTES_INDEX_HEADER_SIZE;
+	return ni;
+}
+
+const struct object_id *notes_index_lookup(struct notes_index *ni,
+					   const struct object_id *oid)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	struct found_note *found;
+	uint32_t pos;
+
+	if (!bsearch_hash(oid->hash, (const uint32_t *)ni->fanout,
+			  ni->entries, 2 * rawsz, &pos))
+		return NULL;
+
+	/* callers keep what get_note() returns until free_notes() */
+	found = xcalloc(1, sizeof(*found));
+	hashcpy(found->oid.hash, ni->entries + pos * 2 * rawsz + rawsz);
+	found->next = ni->found;
+	ni->found = found;
+	return &found->oid;
+}
+
+void close_notes_index(struct notes_index *ni)
+{
+	if (!ni)
+		return;
+	while (ni->found) {
+		struct found_note *next = ni->found->next;
+		free(ni->found);
+		ni->found = next;
+	}
+	munmap((void *)ni->data, ni->data_len);
+	free(ni);
+}
+
+struct notes_index_list {
+	struct notes_index_entry *entry;
+	size_t nr, alloc;
+};
+
+static void add_entry(struct notes_index_list *list,
+		      const struct object_id *object,
+		      const struct object_id *note)
+{
+	ALLOC_GROW(list->entry, list->nr + 1, list->alloc);
+	oidcpy(&list->entry[list->nr].object, object);
+	if (note)
+		oidcpy(&list->entry[list->nr].note, note);
+	else
+		oidclr(&list->entry[list->nr].note);
+	list->nr++;
+}
+
+/* By object name, a deletion before anything else for the same object */
+static int entry_cmp(const void *a_, const void *b_)
+{
+	const struct notes_index_entry *a = a_, *b = b_;
+	int cmp = oidcmp(&a->object, &b->object);
+
+	if (cmp)
+		return cmp;
+	return !is_null_oid(&a->note) - !is_null_oid(&b->note);
+}
+
+static int add_note_entry(const struct object_id *object_oid,
+			  const struct object_id *note_oid, char *note_path,
+			  void *cb_data)
+{
+	add_entry(cb_data, object_oid, note_oid);
+	return 0;
+}
+
+static int path_to_oid(const char *path, struct object_id *oid)
+{
+	char hex_oid[GIT_SHA1_HEXSZ];
+	int i = 0;
+
+	while (*path && i < GIT_SHA1_HEXSZ) {
+		if (*path != '/')
+			hex_oid[i++] = *path;
+		path++;
+	}
+	if (*path || i != GIT_SHA1_HEXSZ)
+		return -1;
+	return get_oid_hex(hex_oid, oid);
+}
+
+/* Collect the notes added, changed and removed from "old" to "new" */
+static void diff_notes_trees(struct notes_index_list *changes,
+			     const struct object_id *old,
+			     const struct object_id *new)
+{
+	struct diff_options opt;
+	int i;
+
+	diff_setup(&opt);
+	opt.flags.recursive = 1;
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+	diff_tree_oid(old, new, "", &opt);
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+		struct object_id object;
+
+		if (DIFF_FILE_VALID(p->two)) {
+			if (!path_to_oid(p->two->path, &object))
+				add_entry(changes, &object, &p->two->oid);
+		} else if (!path_to_oid(p->one->path, &object))
+			add_entry(changes, &object, NULL);
+	}
+	diff_flush(&opt);
+}
+
+/*
+ * Merge the sorted "changes" into the entries of "old", for each
+ * object taking the last of its changes, which is a note rather than
+ * a deletion when a note moved between levels of the fanout.
+ */
+static void apply_changes(struct notes_index_list *list,
+			  struct notes_index *old,
+			  struct notes_index_list *changes)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+	uint32_t i = 0;
+	size_t j = 0;
+
+	while (i < old->nr || j < changes->nr) {
+		const unsigned char *e = old->entries + i * 2 * rawsz;
+		struct notes_index_entry *c;
+		int cmp;
+
+		if (i >= old->nr)
+			cmp = 1;
+		else if (j >= changes->nr)
+			cmp = -1;
+		else
+			cmp = hashcmp(e, changes->entry[j].object.hash);
+		if (cmp < 0) {
+			struct object_id object, note;
+
+			oidclr(&object);
+			oidclr(&note);
+			hashcpy(object.hash, e);
+			hashcpy(note.hash, e + rawsz);
+			add_entry(list, &object, &note);
+			i++;
+			continue;
+		}
+		if (!cmp)
+			i++;
+		c = &changes->entry[j++];
+		while (j < changes->nr &&
+		       !oidcmp(&c->object, &changes->entry[j].object))
+			c = &changes->entry[j++];
+		if (!is_null_oid(&c->note))
+			add_entry(list, &c->object, &c->note);
+	}
+}
+
+int write_notes_index(struct notes_tree *t,
+		      const struct object_id *old_tree_oid,
+		      const struct object_id *tree_oid)
+{
+	struct notes_index_list list = { NULL, 0, 0 };
+	struct notes_index *old = NULL;
+	struct lock_file lk = LOCK_INIT;
+	struct hashfile *f;
+	const char *path;
+	uint32_t fanout[256];
+	unsigned char hdr[4];
+	size_t i;
+
+	if (old_tree_oid)
+		old = open_notes_index(old_tree_oid);
+	if (old) {
+		struct notes_index_list changes = { NULL, 0, 0 };
+
+		diff_notes_trees(&changes, old_tree_oid, tree_oid);
+		QSORT(changes.entry, changes.nr, entry_cmp);
+		apply_changes(&list, old, &changes);
+		free(changes.entry);
+		close_notes_index(old);
+	} else {
+		for_each_note(t, 0, add_note_entry, &list);
+		QSORT(list.entry, list.nr, entry_cmp);
+	}
+
+	path = notes_index_path(tree_oid);
+	if (safe_create_leading_directories_const(path) ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0) {
+		free(list.entry);
+		return error_errno(_("unable to write notes index %s"), path);
+	}
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+
+	hashwrite_be32(f, NOTES_INDEX_SIGNATURE);
+	hdr[0] = NOTES_INDEX_VERSION;
+	hdr[1] = NOTES_INDEX_OID_VERSION;
+	hdr[2] = hdr[3] = 0;
+	hashwrite(f, hdr, sizeof(hdr));
+	hashwrite_be32(f, list.nr);
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < list.nr; i++)
+		fanout[list.entry[i].object.hash[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+	for (i = 0; i < 256; i++)
+		hashwrite_be32(f, fanout[i]);
+
+	for (i = 0; i < list.nr; i++) {
+		hashwrite(f, list.entry[i].object.hash, the_hash_algo->rawsz);
+		hashwrite(f, list.entry[i].note.hash, the_hash_algo->rawsz);
+	}
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	free(list.entry);
+	if (commit_lock_file(&lk) < 0)
+		return error_errno(_("unable to write notes index %s"), path);
+
+	/* keep one index per notes ref, not one per notes commit */
+	if (old_tree_oid && oidcmp(old_tree_oid, tree_oid))
+		unlink(notes_index_path(old_tree_oid));
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef NOTES_INDEX_H
+#define NOTES_INDEX_H
+
+struct notes_tree;
+struct notes_index;
+
+/*
+ * A notes index lists the objects annotated by a notes tree with their
+ * notes, sorted by object name, so that a note can be looked up with a
+ * binary search instead of reading the trees of the notes fanout. It is
+ * stored as $GIT_DIR/notes-index/<notes tree>, and written along with
+ * notes commits when notes.index is set.
+ */
+
+/*
+ * Open the index of the notes tree "tree_oid". Return NULL if there is
+ * none.
+ */
+struct notes_index *open_notes_index(const struct object_id *tree_oid);
+
+/* Return the note of "oid" in the index, or NULL if it has none. */
+const struct object_id *notes_index_lookup(struct notes_index *ni,
+					   const struct object_id *oid);
+
+void close_notes_index(struct notes_index *ni);
+
+/*
+ * Write the index of "tree_oid", the notes tree just written from "t".
+ * When "old_tree_oid", the tree "t" was read from, has an index, only
+ * the differences between the two trees are read to update it; all of
+ * "t" is loaded otherwise.
+ *
+ * Return 0 on success, -1 on error.
+ */
+int write_notes_index(struct notes_tree *t,
+		      const struct object_id *old_tree_oid,
+		      const struct object_id *tree_oid);
+
+#endif /* NOTES_INDEX_H */
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "refs.h"
 #include "object-store.h"
 #include "diff.h"
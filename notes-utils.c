@@ -3,12 +3,14 @@
 #include "commit.h"
 #include "refs.h"
 #include "notes-utils.h"
+#include "notes-index.h"
 
 void create_notes_commit(struct notes_tree *t, struct commit_list *parents,
 			 const char *msg, size_t msg_len,
 			 struct object_id *result_oid)
 {
-	struct object_id tree_oid;
+	struct object_id tree_oid, old_tree_oid;
+	int write_index;
 
 	assert(t->initialized);
 
@@ -27,9 +29,19 @@ void create_notes_commit(struct notes_tree *t, struct commit_list *parents,
 		/* else: t->ref points to nothing, assume root/orphan commit */
 	}
 
+	/* commit_tree() frees "parents" */
+	if (parents && !parse_commit(parents->item))
+		oidcpy(&old_tree_oid, get_commit_tree_oid(parents->item));
+	else
+		oidclr(&old_tree_oid);
+
 	if (commit_tree(msg, msg_len, &tree_oid, parents, result_oid, NULL,
 			NULL))
 		die("Failed to commit notes tree to database");
+
+	if (!git_config_get_bool("notes.index", &write_index) && write_index)
+		write_notes_index(t, is_null_oid(&old_tree_oid) ?
+				  NULL : &old_tree_oid, &tree_oid);
 }
 
 void commit_notes(struct notes_tree *t, const char *msg)
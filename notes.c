@@ -9,6 +9,7 @@
 #include "tree-walk.h"
 #include "string-list.h"
 #include "refs.h"
+#include "notes-index.h"
 
 /*
  * Use a non-balancing simple 16-tree structure with struct int_node as
@@ -1007,6 +1008,7 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	t->combine_notes = combine_notes;
 	t->initialized = 1;
 	t->dirty = 0;
+	t->index = NULL;
 
 	if (flags & NOTES_INIT_EMPTY || !notes_ref ||
 	    get_oid_treeish(notes_ref, &object_oid))
@@ -1020,6 +1022,7 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 	oidclr(&root_tree.key_oid);
 	oidcpy(&root_tree.val_oid, &oid);
 	load_subtree(t, &root_tree, t->root, 0);
+	t->index = open_notes_index(&oid);
 }
 
 struct notes_tree **load_notes_trees(struct string_list *refs, int flags)
@@ -1111,6 +1114,8 @@ const struct object_id *get_note(struct notes_tree *t,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	if (t->index && !t->dirty)
+		return notes_index_lookup(t->index, oid);
 	found = note_tree_find(t, t->root, 0, oid->hash);
 	return found ? &found->val_oid : NULL;
 }
@@ -1186,6 +1191,7 @@ void free_notes(struct notes_tree *t)
 		t->first_non_note = t->prev_non_note;
 	}
 	free(t->ref);
+	close_notes_index(t->index);
 	memset(t, 0, sizeof(struct notes_tree));
 }
 
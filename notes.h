@@ -36,6 +36,8 @@ int combine_notes_ignore(struct object_id *cur_oid,
 int combine_notes_cat_sort_uniq(struct object_id *cur_oid,
 				const struct object_id *new_oid);
 
+struct notes_index;
+
 /*
  * Notes tree object
  *
@@ -53,6 +55,7 @@ extern struct notes_tree {
 	combine_notes_fn combine_notes;
 	int initialized;
 	int dirty;
+	struct notes_index *index; /* used by get_note() until dirty */
 } default_notes_tree;
 
 /*
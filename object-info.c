@@ -0,0 +1,106 @@
+#include "cache.h"
+#include "repository.h"
+#include "argv-array.h"
+#include "object.h"
+#include "object-store.h"
+#include "sha1-array.h"
+#include "object-info.h"
+#include "pkt-line.h"
+
+struct object_info_data {
+	unsigned size : 1;
+	unsigned type : 1;
+	struct oid_array oids;
+};
+
+static void parse_args(struct packet_reader *request,
+		       struct object_info_data *data)
+{
+	while (packet_reader_read(request) == PACKET_READ_NORMAL) {
+		const char *arg = request->line;
+		const char *hex;
+
+		if (!strcmp(arg, "size")) {
+			data->size = 1;
+		} else if (!strcmp(arg, "type")) {
+			data->type = 1;
+		} else if (skip_prefix(arg, "oid ", &hex)) {
+			struct object_id oid;
+			const char *end;
+
+			if (parse_oid_hex(hex, &oid, &end) || *end)
+				die("object-info: expected object id, got '%s'",
+				    hex);
+			oid_array_append(&data->oids, &oid);
+		} else {
+			die("object-info: unexpected line: '%s'", arg);
+		}
+	}
+
+	if (request->status != PACKET_READ_FLUSH)
+		die("object-info: expected flush after arguments");
+}
+
+/*
+ * Answer with the requested attributes, in the order of the header
+ * line, of each object. The attributes of an object we do not have
+ * are left empty.
+ */
+static void send_info(struct repository *r, struct object_info_data *data)
+{
+	struct strbuf line = STRBUF_INIT;
+	int i;
+
+	if (data->size)
+		strbuf_addstr(&line, " size");
+	if (data->type)
+		strbuf_addstr(&line, " type");
+	if (line.len)
+		packet_write_fmt(1, "%s\n", line.buf + 1);
+
+	for (i = 0; i < data->oids.nr; i++) {
+		const struct object_id *oid = &data->oids.oid[i];
+		struct object_info oi = OBJECT_INFO_INIT;
+		unsigned long size;
+		enum object_type type;
+		int found;
+
+		if (data->size)
+			oi.sizep = &size;
+		if (data->type)
+			oi.typep = &type;
+		found = !oid_object_info_extended(r, oid, &oi, 0);
+
+		strbuf_reset(&line);
+		strbuf_addstr(&line, oid_to_hex(oid));
+		if (data->size) {
+			strbuf_addch(&line, ' ');
+			if (found)
+				strbuf_addf(&line, "%lu", size);
+		}
+		if (data->type) {
+			strbuf_addch(&line, ' ');
+			if (found)
+				strbuf_addstr(&line, type_name(type));
+		}
+		strbuf_addch(&line, '\n');
+		packet_write(1, line.buf, line.len);
+	}
+
+	strbuf_release(&line);
+}
+
+int object_info(struct repository *r, struct argv_array *keys,
+		struct packet_reader *request)
+{
+	struct object_info_data data;
+
+	memset(&data, 0, sizeof(data));
+
+	parse_args(request, &data);
+	send_info(r, &data);
+	packet_flush(1);
+
+	oid_array_clear(&data.oids);
+	return 0;
+}
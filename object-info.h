@@ -0,0 +1,10 @@
+#ifndef OBJECT_INFO_H
+#define OBJECT_INFO_H
+
+struct repository;
+struct argv_array;
+struct packet_reader;
+extern int object_info(struct repository *r, struct argv_array *keys,
+		       struct packet_reader *request);
+
+#endif /* OBJECT_INFO_H */
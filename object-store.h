@@ -11,14 +11,18 @@ struct alternate_object_database {
 	size_t base_len;
 
 	/*
-	 * Used to store the results of readdir(3) calls when searching
-	 * for unique abbreviated hashes.  This cache is never
-	 * invalidated, thus it's racy and not necessarily accurate.
-	 * That's fine for its purpose; don't use it for tasks requiring
-	 * greater accuracy!
+	 * Used to store the results of readdir(3) calls, one array per
+	 * fan-out subdirectory, when searching for unique abbreviated
+	 * hashes and for quick existence checks (see
+	 * core.looseObjectCache). Objects this process writes are added
+	 * to it, and reprepare_packed_git() empties it, but objects other
+	 * processes write in the meantime are missing, thus it's racy and
+	 * not necessarily accurate. That's fine for its purpose; don't use
+	 * it for tasks requiring greater accuracy! Use odb_loose_cache()
+	 * to access it.
 	 */
 	char loose_objects_subdir_seen[256];
-	struct oid_array loose_objects_cache;
+	struct oid_array loose_objects_cache[256];
 
 	/*
 	 * Path to the alternative object store. If this is a relative path,
@@ -58,6 +62,29 @@ void add_to_alternates_memory(const char *dir);
  */
 struct strbuf *alt_scratch_buf(struct alternate_object_database *alt);
 
+/*
+ * Return the local object directory of "r" as an alternate object
+ * database, whose "next" is the first real alternate, so that the list
+ * starting there covers all the object directories of "r".
+ */
+struct alternate_object_database *prepare_objectdir_odb(struct repository *r);
+
+/*
+ * Populate and return the loose object cache array of "alt" that would
+ * contain "oid".
+ */
+struct oid_array *odb_loose_cache(struct alternate_object_database *alt,
+				  const struct object_id *oid);
+
+/* Empty the loose object cache of "alt". */
+void odb_clear_loose_cache(struct alternate_object_database *alt);
+
+/*
+ * Drop the filter of all object names, for it to be built again if
+ * need be, when objects may have been added without its knowledge.
+ */
+void clear_object_filter(struct raw_object_store *o);
+
 struct packed_git {
 	struct packed_git *next;
 	struct list_head mru;
@@ -77,9 +104,19 @@ struct packed_git {
 		 pack_keep_in_core:1,
 		 freshened:1,
 		 do_not_close:1,
-		 pack_promisor:1;
+		 pack_promisor:1,
+		 pack_cruft:1,
+		 multi_pack_index:1;
 	unsigned char sha1[20];
 	struct revindex_entry *revindex;
+	/* the .rev file, if there is one; see pack-revindex.h */
+	const void *revindex_map;
+	size_t revindex_map_size;
+	const uint32_t *revindex_data;
+	/* the .mtimes file of a cruft pack; see pack-mtimes.h */
+	const void *mtimes_map;
+	size_t mtimes_map_size;
+	const uint32_t *mtimes_data;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 };
@@ -97,6 +134,12 @@ struct raw_object_store {
 	struct alternate_object_database *alt_odb_list;
 	struct alternate_object_database **alt_odb_tail;
 
+	/*
+	 * The local object directory as an alternate object database,
+	 * for its loose object cache. See prepare_objectdir_odb().
+	 */
+	struct alternate_object_database *objectdir_odb;
+
 	/*
 	 * Objects that should be substituted by other objects
 	 * (see git-replace(1)).
@@ -113,6 +156,13 @@ struct raw_object_store {
 	/* A most-recently-used ordered version of the packed_git list. */
 	struct list_head packed_git_mru;
 
+	/*
+	 * The multi-pack-indexes of the local object directory and its
+	 * alternates (see midx.h). Packs they cover have their
+	 * "multi_pack_index" bit set and are looked up through the midx.
+	 */
+	struct multi_pack_index *multi_pack_index;
+
 	/*
 	 * A fast, rough count of the number of objects in the repository.
 	 * These two fields are not meant for direct access. Use
@@ -121,6 +171,22 @@ struct raw_object_store {
 	unsigned long approximate_object_count;
 	unsigned approximate_object_count_valid : 1;
 
+	/*
+	 * The names of the objects in the packs no multi-pack-index
+	 * covers, sorted and without duplicates. Use
+	 * get_packed_object_names() instead.
+	 */
+	struct oid_array *packed_object_names;
+
+	/*
+	 * A Bloom filter of the names of all objects in all object
+	 * directories, for the quick lookups of missing objects, and how
+	 * much those lookups have cost since it was last cleared (see
+	 * sha1-file.c).
+	 */
+	struct object_filter *object_filter;
+	uint64_t object_filter_cost;
+
 	/*
 	 * Whether packed_git has already been populated with this repository's
 	 * packs.
@@ -147,6 +213,25 @@ static inline void *read_object_file(const struct object_id *oid, enum object_ty
 	return read_object_file_extended(oid, type, size, 1);
 }
 
+/*
+ * Reading objects is not thread-safe by itself. A caller that wants to
+ * read objects from several threads calls enable_obj_read_lock() before
+ * starting them, and disable_obj_read_lock() once they are done. While
+ * it is enabled, read_object_file() and oid_object_info_extended() hold
+ * a lock, but let go of it while they inflate the data of an object, so
+ * that the expensive part of reading objects runs in parallel.
+ *
+ * The lock is recursive. Code that touches the object store in other
+ * ways (e.g. parse_object(), or adding alternates) must hold it with
+ * obj_read_lock() and obj_read_unlock() while the threads run. Note
+ * that an object read with the lock already held will not let go of
+ * it while inflating.
+ */
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
+
 /* Read and unpack an object file into memory, write memory to an object file */
 int oid_object_info(struct repository *r, const struct object_id *, unsigned long *);
 
@@ -156,6 +241,24 @@ extern int hash_object_file(const void *buf, unsigned long len,
 extern int write_object_file(const void *buf, unsigned long len,
 			     const char *type, struct object_id *oid);
 
+/*
+ * Compress the loose object of "buf" into memory, name it in "oid" and
+ * return it, with its size in "deflated_size". This touches neither
+ * the object store nor any other global state, so that threads may
+ * call it; write_deflated_loose_object() writes the result out.
+ */
+extern void *deflate_loose_object(const void *buf, unsigned long len,
+				  const char *type, struct object_id *oid,
+				  unsigned long *deflated_size);
+
+/*
+ * Write the loose object "oid" prepared by deflate_loose_object(),
+ * unless the object store has it already, like write_object_file().
+ */
+extern int write_deflated_loose_object(const struct object_id *oid,
+				       const void *deflated,
+				       unsigned long size);
+
 extern int hash_object_file_literally(const void *buf, unsigned long len,
 				      const char *type, struct object_id *oid,
 				      unsigned flags);
@@ -193,6 +296,17 @@ static inline int has_sha1_file(const unsigned char *sha1)
 extern int has_object_file(const struct object_id *oid);
 extern int has_object_file_with_flags(const struct object_id *oid, int flags);
 
+/*
+ * Set found[i] for each of the "nr" objects in "oids" that
+ * has_object_file_with_flags() with OBJECT_INFO_QUICK would find, and
+ * clear it for the others. Looking them all up at once goes through
+ * each pack index only once, which is much faster than one lookup
+ * after the other when there are many packs.
+ */
+extern void has_object_files_quick(struct repository *r,
+				   const struct object_id *oids, size_t nr,
+				   unsigned char *found);
+
 /*
  * Return true iff an alternate object database has a loose object
  * with the specified name.  This function does not respect replace
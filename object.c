@@ -64,20 +64,37 @@ static unsigned int hash_obj(const unsigned char *sha1, unsigned int n)
 }
 
 /*
- * Insert obj into the hash table hash, which has length size (which
- * must be a power of 2).  On collisions, simply overflow to the next
- * empty bucket.
+ * Return the tag kept next to the object with the specified sha1 in
+ * obj_hash_tag, so that probing the hash map needs to look at the
+ * object itself only when the tags match.  The tag is taken from other
+ * bits of the sha1 than hash_obj() uses, and is never 0, which marks
+ * an empty bucket.
  */
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static unsigned int tag_obj(const unsigned char *sha1)
+{
+	unsigned int tag;
+
+	memcpy(&tag, sha1 + sizeof(tag), sizeof(tag));
+	return tag | 1;
+}
+
+/*
+ * Insert obj into the hash table hash, and its tag into tags; both have
+ * length size (which must be a power of 2).  On collisions, simply
+ * overflow to the next empty bucket.
+ */
+static void insert_obj_hash(struct object *obj, struct object **hash,
+			    unsigned int *tags, unsigned int size)
 {
 	unsigned int j = hash_obj(obj->oid.hash, size);
 
-	while (hash[j]) {
+	while (tags[j]) {
 		j++;
 		if (j >= size)
 			j = 0;
 	}
 	hash[j] = obj;
+	tags[j] = tag_obj(obj->oid.hash);
 }
 
 /*
@@ -86,19 +103,22 @@ static void insert_obj_hash(struct object *obj, struct object **hash, unsigned i
  */
 struct object *lookup_object(const unsigned char *sha1)
 {
-	unsigned int i, first;
-	struct object *obj;
+	struct parsed_object_pool *o = the_repository->parsed_objects;
+	unsigned int i, first, tag, t;
+	struct object *obj = NULL;
 
-	if (!the_repository->parsed_objects->obj_hash)
+	if (!o->obj_hash)
 		return NULL;
 
-	first = i = hash_obj(sha1,
-			     the_repository->parsed_objects->obj_hash_size);
-	while ((obj = the_repository->parsed_objects->obj_hash[i]) != NULL) {
-		if (!hashcmp(sha1, obj->oid.hash))
+	tag = tag_obj(sha1);
+	first = i = hash_obj(sha1, o->obj_hash_size);
+	while ((t = o->obj_hash_tag[i]) != 0) {
+		if (t == tag && !hashcmp(sha1, o->obj_hash[i]->oid.hash)) {
+			obj = o->obj_hash[i];
 			break;
+		}
 		i++;
-		if (i == the_repository->parsed_objects->obj_hash_size)
+		if (i == o->obj_hash_size)
 			i = 0;
 	}
 	if (obj && i != first) {
@@ -107,8 +127,8 @@ struct object *lookup_object(const unsigned char *sha1)
 		 * that we do not need to walk the hash table the next
 		 * time we look for it.
 		 */
-		SWAP(the_repository->parsed_objects->obj_hash[i],
-		     the_repository->parsed_objects->obj_hash[first]);
+		SWAP(o->obj_hash[i], o->obj_hash[first]);
+		SWAP(o->obj_hash_tag[i], o->obj_hash_tag[first]);
 	}
 	return obj;
 }
@@ -127,17 +147,21 @@ static void grow_object_hash(struct repository *r)
 	 */
 	int new_hash_size = r->parsed_objects->obj_hash_size < 32 ? 32 : 2 * r->parsed_objects->obj_hash_size;
 	struct object **new_hash;
+	unsigned int *new_tags;
 
 	new_hash = xcalloc(new_hash_size, sizeof(struct object *));
+	new_tags = xcalloc(new_hash_size, sizeof(unsigned int));
 	for (i = 0; i < r->parsed_objects->obj_hash_size; i++) {
 		struct object *obj = r->parsed_objects->obj_hash[i];
 
 		if (!obj)
 			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
+		insert_obj_hash(obj, new_hash, new_tags, new_hash_size);
 	}
 	free(r->parsed_objects->obj_hash);
+	free(r->parsed_objects->obj_hash_tag);
 	r->parsed_objects->obj_hash = new_hash;
+	r->parsed_objects->obj_hash_tag = new_tags;
 	r->parsed_objects->obj_hash_size = new_hash_size;
 }
 
@@ -153,6 +177,7 @@ void *create_object(struct repository *r, const unsigned char *sha1, void *o)
 		grow_object_hash(r);
 
 	insert_obj_hash(obj, r->parsed_objects->obj_hash,
+			r->parsed_objects->obj_hash_tag,
 			r->parsed_objects->obj_hash_size);
 	r->parsed_objects->nr_objs++;
 	return obj;
@@ -163,8 +188,13 @@ void *object_as_type(struct object *obj, enum object_type type, int quiet)
 	if (obj->type == type)
 		return obj;
 	else if (obj->type == OBJ_NONE) {
-		if (type == OBJ_COMMIT)
-			((struct commit *)obj)->index = alloc_commit_index(the_repository);
+		if (type == OBJ_COMMIT) {
+			struct commit *c = (struct commit *)obj;
+
+			c->index = alloc_commit_index(the_repository);
+			c->graph_pos = COMMIT_NOT_FROM_GRAPH;
+			c->generation = GENERATION_NUMBER_INFINITY;
+		}
 		obj->type = type;
 		return obj;
 	}
@@ -482,7 +512,7 @@ struct raw_object_store *raw_object_store_new(void)
 static void free_alt_odb(struct alternate_object_database *alt)
 {
 	strbuf_release(&alt->scratch);
-	oid_array_clear(&alt->loose_objects_cache);
+	odb_clear_loose_cache(alt);
 	free(alt);
 }
 
@@ -507,8 +537,14 @@ void raw_object_store_clear(struct raw_object_store *o)
 
 	free_alt_odbs(o);
 	o->alt_odb_tail = NULL;
+	if (o->objectdir_odb) {
+		free_alt_odb(o->objectdir_odb);
+		o->objectdir_odb = NULL;
+	}
 
 	INIT_LIST_HEAD(&o->packed_git_mru);
+	clear_packed_object_names(o);
+	clear_object_filter(o);
 	close_all_packs(o);
 	o->packed_git = NULL;
 }
@@ -539,6 +575,7 @@ void parsed_object_pool_clear(struct parsed_object_pool *o)
 	}
 
 	FREE_AND_NULL(o->obj_hash);
+	FREE_AND_NULL(o->obj_hash_tag);
 	o->obj_hash_size = 0;
 
 	clear_alloc_state(o->blob_state);
@@ -3,6 +3,8 @@
 
 struct parsed_object_pool {
 	struct object **obj_hash;
+	/* a few bits of the name of each object in obj_hash; see object.c */
+	unsigned int *obj_hash_tag;
 	int nr_objs, obj_hash_size;
 
 	/* TODO: migrate alloc_states to mem-pool? */
@@ -53,8 +55,10 @@ struct object_array {
 
 /*
  * object flag allocation:
- * revision.h:               0---------10                              2526
- * fetch-pack.c:             0----5
+ * revision.h:               0---------10                              25----28
+ * fetch-pack.c:             01
+ * negotiator/default.c:       2--5
+ * negotiator/skipping.c:      2--5
  * walker.c:                 0-2
  * upload-pack.c:                4       11----------------19
  * builtin/blame.c:                        12-13
@@ -62,6 +66,7 @@ struct object_array {
  * bundle.c:                                        16
  * http-push.c:                                     16-----19
  * commit.c:                                        16-----19
+ * commit-reach.c:                                  16-----19
  * sha1-name.c:                                              20
  * list-objects-filter.c:                                      21
  * builtin/fsck.c:           0--3
@@ -71,7 +76,7 @@ struct object_array {
  * builtin/show-branch.c:    0-------------------------------------------26
  * builtin/unpack-objects.c:                                 2021
  */
-#define FLAG_BITS  27
+#define FLAG_BITS  29
 
 /*
  * The object type is stored in 3 bits.
@@ -12,7 +12,7 @@
  *      a large list of oids with many duplicates.
  *
  *   2. The per-unique-oid memory footprint is slightly higher due to hash
- *      table overhead.
+ *      table overhead.  See compact-oidset.h for sets of millions of oids.
  */
 
 /**
@@ -51,6 +51,16 @@ int oidset_insert(struct oidset *set, const struct object_id *oid);
  */
 int oidset_remove(struct oidset *set, const struct object_id *oid);
 
+/**
+ * Returns the number of oids in the set.
+ */
+static inline int oidset_size(struct oidset *set)
+{
+	if (!set->map.map.tablesize)
+		return 0;
+	return hashmap_get_size(&set->map.map);
+}
+
 /**
  * Remove all entries from the oidset, freeing any resources associated with
  * it.
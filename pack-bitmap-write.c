@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "object-store.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "tag.h"
 #include "diff.h"
 #include "revision.h"
@@ -473,7 +474,8 @@ static const unsigned char *sha1_access(size_t pos, void *table)
 
 static void write_selected_commits_v1(struct hashfile *f,
 				      struct pack_idx_entry **index,
-				      uint32_t index_nr)
+				      uint32_t index_nr,
+				      off_t *offsets)
 {
 	int i;
 
@@ -485,6 +487,8 @@ static void write_selected_commits_v1(struct hashfile *f,
 
 		if (commit_pos < 0)
 			BUG("trying to write commit not in index");
+		stored->commit_pos = commit_pos;
+		offsets[i] = hashfile_total(f);
 
 		hashwrite_be32(f, commit_pos);
 		hashwrite_u8(f, stored->xor_offset);
@@ -494,6 +498,51 @@ static void write_selected_commits_v1(struct hashfile *f,
 	}
 }
 
+static int commit_pos_cmp(const void *va, const void *vb)
+{
+	const struct bitmapped_commit *a = &writer.selected[*(const uint32_t *)va];
+	const struct bitmapped_commit *b = &writer.selected[*(const uint32_t *)vb];
+
+	return a->commit_pos < b->commit_pos ? -1 :
+		a->commit_pos > b->commit_pos;
+}
+
+/*
+ * Write one row per selected commit, sorted by the position of the
+ * commit in the index, giving the offset of its entry and the row of
+ * the entry it is XORed against, so that a reader can find and load
+ * just the bitmaps it needs.
+ */
+static void write_lookup_table(struct hashfile *f, off_t *offsets)
+{
+	uint32_t *table, *table_inv;
+	uint32_t i;
+
+	ALLOC_ARRAY(table, writer.selected_nr);
+	ALLOC_ARRAY(table_inv, writer.selected_nr);
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = i;
+	QSORT(table, writer.selected_nr, commit_pos_cmp);
+	for (i = 0; i < writer.selected_nr; i++)
+		table_inv[table[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[table[i]];
+		uint32_t xor_row = BITMAP_NO_XOR_ROW;
+
+		if (stored->xor_offset)
+			xor_row = table_inv[table[i] - stored->xor_offset];
+
+		hashwrite_be32(f, stored->commit_pos);
+		hashwrite_be32(f, (uint32_t)(offsets[table[i]] >> 32));
+		hashwrite_be32(f, (uint32_t)offsets[table[i]]);
+		hashwrite_be32(f, xor_row);
+	}
+
+	free(table);
+	free(table_inv);
+}
+
 static void write_hash_cache(struct hashfile *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -523,6 +572,7 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	struct hashfile *f;
 
 	struct bitmap_disk_header header;
+	off_t *offsets;
 
 	int fd = odb_mkstemp(&tmp_file, "pack/tmp_bitmap_XXXXXX");
 
@@ -539,7 +589,13 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.trees);
 	dump_bitmap(f, writer.blobs);
 	dump_bitmap(f, writer.tags);
-	write_selected_commits_v1(f, index, index_nr);
+
+	ALLOC_ARRAY(offsets, writer.selected_nr);
+	write_selected_commits_v1(f, index, index_nr, offsets);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f, offsets);
+	free(offsets);
 
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
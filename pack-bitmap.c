@@ -12,6 +12,8 @@
 #include "packfile.h"
 #include "repository.h"
 #include "object-store.h"
+#include "midx.h"
+#include "list-objects-filter-options.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -29,19 +31,23 @@ struct stored_bitmap {
  * a single bitmap index available (the index for the biggest packfile in
  * the repository), since bitmap indexes need full closure.
  *
+ * The bitmap of a multi-pack-index is preferred over that of any pack. It
+ * covers the objects of all packs in that multi-pack-index, in its pack
+ * order (see midx.h).
+ *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
  */
 struct bitmap_index {
-	/* Packfile to which this bitmap index belongs to */
-	struct packed_git *pack;
-
 	/*
-	 * Mark the first `reuse_objects` in the packfile as reused:
-	 * they will be sent as-is without using them for repacking
-	 * calculations
+	 * Packfile to which this bitmap index belongs to; for a
+	 * multi-pack-index bitmap, its preferred pack, whose objects come
+	 * first in the bitmap and can be reused verbatim
 	 */
-	uint32_t reuse_objects;
+	struct packed_git *pack;
+
+	/* Multi-pack-index to which this bitmap index belongs to, if any */
+	struct multi_pack_index *midx;
 
 	/* mmapped buffer of the whole bitmap index */
 	unsigned char *map;
@@ -69,6 +75,12 @@ struct bitmap_index {
 	/* If not NULL, this is a name-hash cache pointing into map. */
 	uint32_t *hashes;
 
+	/*
+	 * If not NULL, the lookup table pointing into map; the bitmaps of
+	 * commits are then only read when they are first needed.
+	 */
+	const unsigned char *table_lookup;
+
 	/*
 	 * Extended index.
 	 *
@@ -92,6 +104,46 @@ struct bitmap_index {
 	unsigned loaded : 1;
 };
 
+static uint32_t bitmap_num_objects(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects;
+	return index->pack->num_objects;
+}
+
+/*
+ * Look up the object at position "pos" in the bitmap: its id, where to
+ * find it, and its position in the (multi-)pack index, which is what the
+ * name-hash cache is indexed by.
+ */
+static void nth_bitmap_object(struct bitmap_index *index, uint32_t pos,
+			      struct object_id *oid, struct packed_git **pack,
+			      off_t *offset, uint32_t *index_pos)
+{
+	if (index->midx) {
+		struct multi_pack_index *m = index->midx;
+		uint32_t at = pack_pos_to_midx(m, pos);
+
+		nth_midxed_object_oid(oid, m, at);
+		if (pack)
+			*pack = m->packs[nth_midxed_pack_int_id(m, at)];
+		if (offset)
+			*offset = nth_midxed_offset(m, at);
+		if (index_pos)
+			*index_pos = at;
+	} else {
+		uint32_t nr = pack_pos_to_index(index->pack, pos);
+
+		nth_packed_object_oid(oid, index->pack, nr);
+		if (pack)
+			*pack = index->pack;
+		if (offset)
+			*offset = pack_pos_to_offset(index->pack, pos);
+		if (index_pos)
+			*index_pos = nr;
+	}
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -155,13 +207,32 @@ static int load_bitmap_header(struct bitmap_index *index)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
+		index->entry_count = ntohl(header->entry_count);
+
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			unsigned char *end = index->map + index->map_size - 20;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			index->hashes = ((uint32_t *)end) - bitmap_num_objects(index);
+		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			uint64_t table_size = (uint64_t)index->entry_count *
+				BITMAP_LOOKUP_TABLE_ROW_WIDTH;
+			unsigned char *end = index->hashes ?
+				(unsigned char *)index->hashes :
+				index->map + index->map_size - 20;
+
+			if (end < index->map + sizeof(*header) ||
+			    table_size > end - (index->map + sizeof(*header)))
+				return error("Failed to load bitmap lookup table "
+					     "(corrupted?)");
+			index->table_lookup = end - table_size;
 		}
 	}
 
-	index->entry_count = ntohl(header->entry_count);
+	if (index->midx &&
+	    hashcmp(header->checksum, get_midx_checksum(index->midx)))
+		return error("Bitmap index does not match its multi-pack-index");
+
 	index->map_pos += sizeof(*header);
 	return 0;
 }
@@ -208,6 +279,22 @@ static inline uint8_t read_u8(const unsigned char *buffer, size_t *pos)
 	return buffer[(*pos)++];
 }
 
+/*
+ * Find the id of the object at position "idx_pos" of the index (not
+ * in the bitmap order) of the (multi-)pack that "index" belongs to.
+ */
+static int bitmap_index_oid(struct bitmap_index *index, uint32_t idx_pos,
+			    struct object_id *oid)
+{
+	if (idx_pos >= bitmap_num_objects(index))
+		return error("Corrupted bitmap pack index");
+	if (index->midx)
+		nth_midxed_object_oid(oid, index->midx, idx_pos);
+	else
+		nth_packed_object_oid(oid, index->pack, idx_pos);
+	return 0;
+}
+
 #define MAX_XOR_OFFSET 160
 
 static int load_bitmap_entries_v1(struct bitmap_index *index)
@@ -220,13 +307,14 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		struct ewah_bitmap *bitmap = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
-		const unsigned char *sha1;
+		struct object_id oid;
 
 		commit_idx_pos = read_be32(index->map, &index->map_pos);
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		if (bitmap_index_oid(index, commit_idx_pos, &oid) < 0)
+			return -1;
 
 		bitmap = read_bitmap_1(index);
 		if (!bitmap)
@@ -243,12 +331,180 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		}
 
 		recent_bitmaps[i % MAX_XOR_OFFSET] = store_bitmap(
-			index, bitmap, sha1, xor_bitmap, flags);
+			index, bitmap, oid.hash, xor_bitmap, flags);
 	}
 
 	return 0;
 }
 
+struct lookup_table_row {
+	uint32_t commit_pos;
+	uint64_t offset;
+	uint32_t xor_row;
+};
+
+static void read_lookup_table_row(struct bitmap_index *index, uint32_t row,
+				  struct lookup_table_row *out)
+{
+	const unsigned char *p = index->table_lookup +
+		(size_t)row * BITMAP_LOOKUP_TABLE_ROW_WIDTH;
+
+	out->commit_pos = get_be32(p);
+	out->offset = ((uint64_t)get_be32(p + 4) << 32) | get_be32(p + 8);
+	out->xor_row = get_be32(p + 12);
+}
+
+/*
+ * Read the entry of the lookup table row "row" from the file and store
+ * it, XORed against "xor_with".
+ */
+static struct stored_bitmap *load_lookup_table_entry(struct bitmap_index *index,
+						     uint32_t row,
+						     struct stored_bitmap *xor_with)
+{
+	struct lookup_table_row r;
+	struct ewah_bitmap *bitmap;
+	struct object_id oid;
+	int xor_offset, flags;
+
+	read_lookup_table_row(index, row, &r);
+	if (r.offset < sizeof(struct bitmap_disk_header) ||
+	    r.offset > index->map_size - 20 - 6) {
+		error("Corrupted bitmap lookup table (bad offset)");
+		return NULL;
+	}
+	if (bitmap_index_oid(index, r.commit_pos, &oid) < 0)
+		return NULL;
+
+	index->map_pos = r.offset;
+	if (read_be32(index->map, &index->map_pos) != r.commit_pos) {
+		error("Corrupted bitmap lookup table (entry mismatch)");
+		return NULL;
+	}
+	xor_offset = read_u8(index->map, &index->map_pos);
+	flags = read_u8(index->map, &index->map_pos);
+	if (!xor_offset != !xor_with) {
+		error("Corrupted bitmap lookup table (bad XOR row)");
+		return NULL;
+	}
+
+	bitmap = read_bitmap_1(index);
+	if (!bitmap)
+		return NULL;
+	return store_bitmap(index, bitmap, oid.hash, xor_with, flags);
+}
+
+/*
+ * Load the bitmap of lookup table row "row", and those of the rows it
+ * is (transitively) XORed against, unless they are loaded already.
+ */
+static struct stored_bitmap *lazy_bitmap_for_row(struct bitmap_index *index,
+						 uint32_t row)
+{
+	struct stored_bitmap *stored = NULL;
+	uint32_t *chain = NULL;
+	size_t chain_nr = 0, chain_alloc = 0;
+
+	for (;;) {
+		struct lookup_table_row r;
+		struct object_id oid;
+		khiter_t pos;
+
+		read_lookup_table_row(index, row, &r);
+		if (bitmap_index_oid(index, r.commit_pos, &oid) < 0)
+			goto out;
+		pos = kh_get_sha1(index->bitmaps, oid.hash);
+		if (pos < kh_end(index->bitmaps)) {
+			stored = kh_value(index->bitmaps, pos);
+			break;
+		}
+
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = row;
+
+		if (r.xor_row == BITMAP_NO_XOR_ROW)
+			break;
+		if (r.xor_row >= index->entry_count ||
+		    chain_nr >= index->entry_count) {
+			error("Corrupted bitmap lookup table (bad XOR row)");
+			goto out;
+		}
+		row = r.xor_row;
+	}
+
+	while (chain_nr) {
+		stored = load_lookup_table_entry(index, chain[--chain_nr], stored);
+		if (!stored)
+			break;
+	}
+
+out:
+	free(chain);
+	return stored;
+}
+
+static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *index,
+						    const unsigned char *sha1)
+{
+	struct object_id oid;
+	uint32_t idx_pos, lo = 0, hi = index->entry_count;
+	int found;
+
+	hashcpy(oid.hash, sha1);
+	if (index->midx)
+		found = bsearch_midx(&oid, index->midx, &idx_pos);
+	else
+		found = bsearch_pack(&oid, index->pack, &idx_pos);
+	if (!found)
+		return NULL;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t commit_pos = get_be32(index->table_lookup +
+			(size_t)mi * BITMAP_LOOKUP_TABLE_ROW_WIDTH);
+
+		if (commit_pos == idx_pos)
+			return lazy_bitmap_for_row(index, mi);
+		if (commit_pos < idx_pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+/*
+ * Return the bitmap stored for the commit "sha1", if there is one,
+ * reading it from the lookup table if needed.
+ */
+static struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *index,
+					     const unsigned char *sha1)
+{
+	struct stored_bitmap *stored;
+	khiter_t pos = kh_get_sha1(index->bitmaps, sha1);
+
+	if (pos < kh_end(index->bitmaps))
+		stored = kh_value(index->bitmaps, pos);
+	else if (index->table_lookup)
+		stored = lazy_bitmap_for_commit(index, sha1);
+	else
+		stored = NULL;
+
+	return stored ? lookup_stored_bitmap(stored) : NULL;
+}
+
+/* Make sure that every bitmap in the lookup table has been read. */
+static int load_all_lookup_table_entries(struct bitmap_index *index)
+{
+	uint32_t i;
+
+	for (i = 0; index->table_lookup && i < index->entry_count; i++) {
+		if (!lazy_bitmap_for_row(index, i))
+			return -1;
+	}
+	return 0;
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	size_t len;
@@ -301,6 +557,71 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 	return 0;
 }
 
+static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *m)
+{
+	int fd;
+	struct stat st;
+	char *bitmap_name;
+	struct packed_git *preferred;
+	uint32_t i;
+
+	if (!m->chunk_revindex || !m->num_objects)
+		return -1;
+
+	bitmap_name = get_midx_bitmap_filename(m);
+	fd = git_open(bitmap_name);
+	free(bitmap_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	/* the bitmap can refer to the objects of any of the packs */
+	for (i = 0; i < m->num_packs; i++) {
+		if (!m->packs[i] || open_pack_index(m->packs[i])) {
+			warning("ignoring bitmap of incomplete multi-pack-index");
+			close(fd);
+			return -1;
+		}
+	}
+
+	/*
+	 * The objects of the preferred pack come first; all of them, as
+	 * duplicates are always taken from that pack.
+	 */
+	preferred = m->packs[nth_midxed_pack_int_id(m, pack_pos_to_midx(m, 0))];
+	if (preferred->num_objects > m->num_objects ||
+	    m->packs[nth_midxed_pack_int_id(m, pack_pos_to_midx(m,
+				preferred->num_objects - 1))] != preferred) {
+		warning("ignoring bitmap of multi-pack-index without a preferred pack");
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git->midx = m;
+	bitmap_git->pack = preferred;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git->map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0) {
+		munmap(bitmap_git->map, bitmap_git->map_size);
+		bitmap_git->map = NULL;
+		bitmap_git->map_size = 0;
+		bitmap_git->midx = NULL;
+		bitmap_git->pack = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
 static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map && !bitmap_git->loaded);
@@ -315,7 +636,7 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(bitmap_git) < 0)
+	if (!bitmap_git->table_lookup && load_bitmap_entries_v1(bitmap_git) < 0)
 		goto failed;
 
 	bitmap_git->loaded = 1;
@@ -330,11 +651,17 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 
 static int open_pack_bitmap(struct bitmap_index *bitmap_git)
 {
+	struct multi_pack_index *m;
 	struct packed_git *p;
 	int ret = -1;
 
 	assert(!bitmap_git->map && !bitmap_git->loaded);
 
+	for (m = get_multi_pack_index(the_repository); m; m = m->next) {
+		if (open_midx_bitmap_1(bitmap_git, m) == 0)
+			return 0;
+	}
+
 	for (p = get_packed_git(the_repository); p; p = p->next) {
 		if (open_pack_bitmap_1(bitmap_git, p) == 0)
 			ret = 0;
@@ -368,7 +695,7 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
@@ -377,17 +704,35 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 					   const unsigned char *sha1)
 {
+	uint32_t pos;
 	off_t offset = find_pack_entry_one(sha1, bitmap_git->pack);
 	if (!offset)
 		return -1;
 
-	return find_revindex_position(bitmap_git->pack, offset);
+	if (offset_to_pack_pos(bitmap_git->pack, offset, &pos) < 0)
+		return -1;
+	return pos;
+}
+
+static inline int bitmap_position_midx(struct bitmap_index *bitmap_git,
+				       const unsigned char *sha1)
+{
+	struct object_id oid;
+	uint32_t at;
+
+	hashcpy(oid.hash, sha1);
+	if (!bsearch_midx(&oid, bitmap_git->midx, &at))
+		return -1;
+
+	return midx_to_pack_pos(bitmap_git->midx, at);
 }
 
 static int bitmap_position(struct bitmap_index *bitmap_git,
 			   const unsigned char *sha1)
 {
-	int pos = bitmap_position_packfile(bitmap_git, sha1);
+	int pos = bitmap_git->midx ?
+		bitmap_position_midx(bitmap_git, sha1) :
+		bitmap_position_packfile(bitmap_git, sha1);
 	return (pos >= 0) ? pos : bitmap_position_extended(bitmap_git, sha1);
 }
 
@@ -417,7 +762,7 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -448,7 +793,7 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 			      const unsigned char *sha1,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct ewah_bitmap *bitmap;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -456,10 +801,9 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_sha1(bitmap_git->bitmaps, sha1);
-	if (hash_pos < kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, hash_pos);
-		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
+	bitmap = bitmap_for_commit(bitmap_git, sha1);
+	if (bitmap) {
+		bitmap_or_ewah(data->base, bitmap);
 		return 0;
 	}
 
@@ -516,12 +860,10 @@ static struct bitmap *find_objects(struct bitmap_index *bitmap_git,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_sha1(bitmap_git->bitmaps, object->oid.hash);
-
-			if (pos < kh_end(bitmap_git->bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, pos);
-				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
+			struct ewah_bitmap *or_with =
+				bitmap_for_commit(bitmap_git, object->oid.hash);
 
+			if (or_with) {
 				if (base == NULL)
 					base = ewah_to_bitmap(or_with);
 				else
@@ -606,7 +948,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -628,17 +970,28 @@ static void show_objects_for_type(
 
 	struct bitmap *objects = bitmap_git->result;
 
-	if (bitmap_git->reuse_objects == bitmap_git->pack->num_objects)
-		return;
-
 	ewah_iterator_init(&it, type_filter);
 
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i] & filter;
+	/*
+	 * The objects of a pack are mostly grouped by type, so skip the
+	 * stretches of other types whole.
+	 */
+	while (i < objects->word_alloc) {
+		size_t skipped = ewah_iterator_skip_zeroes(&it);
+		eword_t word;
+
+		i += skipped;
+		pos += skipped * BITS_IN_EWORD;
+		if (i >= objects->word_alloc ||
+		    !ewah_iterator_next(&filter, &it))
+			break;
+		word = objects->words[i] & filter;
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
-			struct revindex_entry *entry;
+			struct packed_git *pack;
+			off_t ofs;
+			uint32_t index_pos;
 			uint32_t hash = 0;
 
 			if ((word >> offset) == 0)
@@ -646,16 +999,13 @@ static void show_objects_for_type(
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			if (pos + offset < bitmap_git->reuse_objects)
-				continue;
-
-			entry = &bitmap_git->pack->revindex[pos + offset];
-			nth_packed_object_oid(&oid, bitmap_git->pack, entry->nr);
+			nth_bitmap_object(bitmap_git, pos + offset, &oid,
+					  &pack, &ofs, &index_pos);
 
 			if (bitmap_git->hashes)
-				hash = get_be32(bitmap_git->hashes + entry->nr);
+				hash = get_be32(bitmap_git->hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git->pack, entry->offset);
+			show_reach(&oid, object_type, 0, hash, pack, ofs);
 		}
 
 		pos += BITS_IN_EWORD;
@@ -670,14 +1020,179 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+		if (bitmap_git->midx) {
+			if (bsearch_midx(&object->oid, bitmap_git->midx, NULL))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0) {
 			return 1;
+		}
 	}
 
 	return 0;
 }
 
-struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
+/*
+ * Mark the positions of those "tip_objects" of the given type that are
+ * in the bitmap; filters never omit objects that were asked for by name.
+ */
+static struct bitmap *find_tip_objects(struct bitmap_index *bitmap_git,
+				       struct object_list *tip_objects,
+				       enum object_type type)
+{
+	struct bitmap *result = bitmap_new();
+
+	for (; tip_objects; tip_objects = tip_objects->next) {
+		struct object *object = tip_objects->item;
+		int pos;
+
+		if (object->type != type)
+			continue;
+		pos = bitmap_position(bitmap_git, object->oid.hash);
+		if (pos >= 0)
+			bitmap_set(result, pos);
+	}
+
+	return result;
+}
+
+static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
+				     uint32_t pos)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	unsigned long size;
+	struct object_id oid;
+
+	oi.sizep = &size;
+	if (pos < bitmap_num_objects(bitmap_git)) {
+		struct packed_git *pack;
+		off_t ofs;
+
+		nth_bitmap_object(bitmap_git, pos, &oid, &pack, &ofs, NULL);
+		if (packed_object_info(the_repository, pack, ofs, &oi) < 0)
+			die(_("unable to get size of %s"), oid_to_hex(&oid));
+	} else {
+		struct eindex *eindex = &bitmap_git->ext_index;
+		struct object *obj =
+			eindex->objects[pos - bitmap_num_objects(bitmap_git)];
+
+		if (oid_object_info_extended(the_repository, &obj->oid, &oi, 0) < 0)
+			die(_("unable to get size of %s"), oid_to_hex(&obj->oid));
+	}
+
+	return size;
+}
+
+/*
+ * Unset the bits of "to_filter" for the objects of the given type that
+ * are not tips and are at least "limit" bytes large; a zero "limit"
+ * omits them all without looking at their sizes.
+ */
+static void filter_bitmap_type(struct bitmap_index *bitmap_git,
+			       struct object_list *tip_objects,
+			       struct bitmap *to_filter,
+			       enum object_type type,
+			       unsigned long limit)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct bitmap *tips = find_tip_objects(bitmap_git, tip_objects, type);
+	struct ewah_bitmap *type_bitmap;
+	struct ewah_iterator it;
+	eword_t mask;
+	size_t i = 0;
+
+	switch (type) {
+	case OBJ_COMMIT:
+		type_bitmap = bitmap_git->commits;
+		break;
+	case OBJ_TREE:
+		type_bitmap = bitmap_git->trees;
+		break;
+	case OBJ_BLOB:
+		type_bitmap = bitmap_git->blobs;
+		break;
+	case OBJ_TAG:
+		type_bitmap = bitmap_git->tags;
+		break;
+	default:
+		BUG("filtering unknown object type %d", type);
+	}
+
+	ewah_iterator_init(&it, type_bitmap);
+	while (i < to_filter->word_alloc) {
+		eword_t word;
+		uint32_t offset;
+
+		i += ewah_iterator_skip_zeroes(&it);
+		if (i >= to_filter->word_alloc ||
+		    !ewah_iterator_next(&mask, &it))
+			break;
+		word = to_filter->words[i] & mask;
+
+		if (i < tips->word_alloc)
+			word &= ~tips->words[i];
+
+		if (!limit) {
+			to_filter->words[i] &= ~word;
+		} else {
+			for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+				size_t pos;
+
+				if ((word >> offset) == 0)
+					break;
+				offset += ewah_bit_ctz64(word >> offset);
+				pos = i * BITS_IN_EWORD + offset;
+				if (get_size_by_pos(bitmap_git, pos) >= limit)
+					bitmap_unset(to_filter, pos);
+			}
+		}
+		i++;
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		size_t pos = bitmap_num_objects(bitmap_git) + i;
+
+		if (eindex->objects[i]->type != type ||
+		    !bitmap_get(to_filter, pos) || bitmap_get(tips, pos))
+			continue;
+		if (!limit || get_size_by_pos(bitmap_git, pos) >= limit)
+			bitmap_unset(to_filter, pos);
+	}
+
+	bitmap_free(tips);
+}
+
+/*
+ * Apply "filter" to the objects in "to_filter", unless "bitmap_git" is
+ * NULL. Return -1 if the filter cannot be applied on bitmaps.
+ */
+static int filter_bitmap(struct bitmap_index *bitmap_git,
+			 struct object_list *tip_objects,
+			 struct bitmap *to_filter,
+			 struct list_objects_filter_options *filter)
+{
+	if (!filter || filter->choice == LOFC_DISABLED)
+		return 0;
+
+	if (filter->choice == LOFC_BLOB_NONE) {
+		if (bitmap_git)
+			filter_bitmap_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_BLOB, 0);
+		return 0;
+	}
+
+	if (filter->choice == LOFC_BLOB_LIMIT) {
+		if (bitmap_git)
+			filter_bitmap_type(bitmap_git, tip_objects, to_filter,
+					   OBJ_BLOB, filter->blob_limit_value);
+		return 0;
+	}
+
+	/* the sparse filters need the paths of the objects */
+	return -1;
+}
+
+struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
+					 struct list_objects_filter_options *filter)
 {
 	unsigned int i;
 
@@ -687,7 +1202,13 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	struct bitmap *wants_bitmap = NULL;
 	struct bitmap *haves_bitmap = NULL;
 
-	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
+	struct bitmap_index *bitmap_git;
+
+	/* bitmaps know nothing about the paths that some filters need */
+	if (filter_bitmap(NULL, NULL, NULL, filter) < 0)
+		return NULL;
+
+	bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
 	if (open_pack_bitmap(bitmap_git) < 0)
@@ -758,6 +1279,8 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	if (haves_bitmap)
 		bitmap_and_not(wants_bitmap, haves_bitmap);
 
+	filter_bitmap(bitmap_git, wants, wants_bitmap, filter);
+
 	bitmap_git->result = wants_bitmap;
 
 	bitmap_free(haves_bitmap);
@@ -768,65 +1291,114 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	return NULL;
 }
 
-int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
-				       struct packed_git **packfile,
-				       uint32_t *entries,
-				       off_t *up_to)
+int bitmap_walk_contains(struct bitmap_index *bitmap_git,
+			 const struct object_id *oid)
 {
-	/*
-	 * Reuse the packfile content if we need more than
-	 * 90% of its objects
-	 */
-	static const double REUSE_PERCENT = 0.9;
+	int pos;
 
-	struct bitmap *result = bitmap_git->result;
-	uint32_t reuse_threshold;
-	uint32_t i, reuse_objects = 0;
+	if (!bitmap_git->result)
+		return 0;
+	pos = bitmap_position(bitmap_git, oid->hash);
+	return pos >= 0 && bitmap_get(bitmap_git->result, pos);
+}
 
-	assert(result);
+/*
+ * Mark the object at bitmap position "pos" in "reuse" if it can be copied
+ * verbatim from the pack: it is not a delta, or a delta whose base comes
+ * before it in the pack and is reused too. Return -1 when there is no
+ * point in looking at the objects after it.
+ */
+static int try_partial_reuse(struct bitmap_index *bitmap_git, size_t pos,
+			     struct bitmap *reuse, struct pack_window **w_curs)
+{
+	struct packed_git *p = bitmap_git->pack;
+	off_t offset, header;
+	enum object_type type;
+	unsigned long size;
 
-	for (i = 0; i < result->word_alloc; ++i) {
-		if (result->words[i] != (eword_t)~0) {
-			reuse_objects += ewah_bit_ctz64(~result->words[i]);
-			break;
-		}
+	/* with a multi-pack-index, the objects of the other packs */
+	if (pos >= p->num_objects)
+		return -1;
 
-		reuse_objects += BITS_IN_EWORD;
+	offset = header = pack_pos_to_offset(p, pos);
+	type = unpack_object_header(p, w_curs, &offset, &size);
+	if (type < 0)
+		return -1; /* broken pack; let the slow path complain */
+
+	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		uint32_t base_pos;
+
+		base_offset = get_delta_base(p, w_curs, &offset, type, header);
+		if (!base_offset ||
+		    offset_to_pack_pos(p, base_offset, &base_pos) < 0)
+			return 0;
+
+		/*
+		 * A base that comes after the delta, or that is not sent
+		 * along, would need the delta to be turned into something
+		 * else; leave that to the object_entry code path.
+		 */
+		if (base_pos >= pos || !bitmap_get(reuse, base_pos))
+			return 0;
 	}
 
-#ifdef GIT_BITMAP_DEBUG
-	{
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+	bitmap_set(reuse, pos);
+	return 0;
+}
 
-		entry = &bitmap_git->reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git->pack, entry->nr);
+int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
+				       struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out)
+{
+	struct bitmap *result = bitmap_git->result;
+	struct bitmap *reuse;
+	struct pack_window *w_curs = NULL;
+	size_t i = 0;
+	uint32_t offset;
 
-		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
-			reuse_objects, result->words[i]);
-		fprintf(stderr, " %s\n", sha1_to_hex(sha1));
+	assert(result);
+
+	/* Words of the pack wanted whole are reused whole */
+	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+		i++;
+	if (i > bitmap_git->pack->num_objects / BITS_IN_EWORD)
+		i = bitmap_git->pack->num_objects / BITS_IN_EWORD;
+
+	reuse = bitmap_new();
+	if (i) {
+		bitmap_set(reuse, i * BITS_IN_EWORD - 1);
+		memset(reuse->words, 0xff, i * sizeof(eword_t));
 	}
-#endif
 
-	if (!reuse_objects)
-		return -1;
+	for (; i < result->word_alloc; i++) {
+		eword_t word = result->words[i];
+		size_t pos = i * BITS_IN_EWORD;
 
-	if (reuse_objects >= bitmap_git->pack->num_objects) {
-		bitmap_git->reuse_objects = *entries = bitmap_git->pack->num_objects;
-		*up_to = -1; /* reuse the full pack */
-		*packfile = bitmap_git->pack;
-		return 0;
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+			if (try_partial_reuse(bitmap_git, pos + offset,
+					      reuse, &w_curs) < 0)
+				goto done;
+		}
 	}
 
-	reuse_threshold = bitmap_popcount(bitmap_git->result) * REUSE_PERCENT;
+done:
+	unuse_pack(&w_curs);
 
-	if (reuse_objects < reuse_threshold)
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
 		return -1;
+	}
 
-	bitmap_git->reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git->pack->revindex[reuse_objects].offset;
+	/* The reused objects need not be shown to the caller again */
+	bitmap_and_not(result, reuse);
 	*packfile = bitmap_git->pack;
-
+	*reuse_out = reuse;
 	return 0;
 }
 
@@ -856,39 +1428,35 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 	struct bitmap *objects = bitmap_git->result;
 	struct eindex *eindex = &bitmap_git->ext_index;
 
-	uint32_t i = 0, count = 0;
-	struct ewah_iterator it;
-	eword_t filter;
+	struct ewah_bitmap *type_filter;
+	uint32_t i, count;
 
 	switch (type) {
 	case OBJ_COMMIT:
-		ewah_iterator_init(&it, bitmap_git->commits);
+		type_filter = bitmap_git->commits;
 		break;
 
 	case OBJ_TREE:
-		ewah_iterator_init(&it, bitmap_git->trees);
+		type_filter = bitmap_git->trees;
 		break;
 
 	case OBJ_BLOB:
-		ewah_iterator_init(&it, bitmap_git->blobs);
+		type_filter = bitmap_git->blobs;
 		break;
 
 	case OBJ_TAG:
-		ewah_iterator_init(&it, bitmap_git->tags);
+		type_filter = bitmap_git->tags;
 		break;
 
 	default:
 		return 0;
 	}
 
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i++] & filter;
-		count += ewah_bit_popcount64(word);
-	}
+	count = bitmap_and_ewah_popcount(objects, type_filter);
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -914,6 +1482,84 @@ void count_bitmap_commit_list(struct bitmap_index *bitmap_git,
 		*tags = count_object_type(bitmap_git, OBJ_TAG);
 }
 
+/*
+ * The commits reachable from "roots", walking only as far as the
+ * first bitmapped commits; the flags the walk leaves on the commits
+ * are cleared again.
+ */
+static struct bitmap *find_commits(struct bitmap_index *bitmap_git,
+				   struct object_list *roots,
+				   int ignore_missing_links)
+{
+	struct rev_info revs;
+	struct bitmap *result;
+
+	if (!roots)
+		return bitmap_new();
+
+	init_revisions(&revs, NULL);
+	revs.ignore_missing_links = ignore_missing_links;
+	result = find_objects(bitmap_git, &revs, roots, NULL);
+	if (!result)
+		BUG("failed to perform bitmap walk");
+
+	for (; roots; roots = roots->next)
+		if (roots->item->type == OBJ_COMMIT)
+			clear_commit_marks((struct commit *)roots->item,
+					   ALL_REV_FLAGS);
+	return result;
+}
+
+static uint32_t count_commits(struct bitmap_index *bitmap_git,
+			      struct bitmap *commits)
+{
+	struct bitmap *saved = bitmap_git->result;
+	uint32_t count;
+
+	bitmap_git->result = commits;
+	count = count_object_type(bitmap_git, OBJ_COMMIT);
+	bitmap_git->result = saved;
+	return count;
+}
+
+int bitmap_ahead_behind(struct bitmap_index *bitmap_git,
+			struct commit *ours, struct commit *theirs,
+			struct object_list *haves,
+			uint32_t *num_ours, uint32_t *num_theirs)
+{
+	struct object_list ours_list = { &ours->object, NULL };
+	struct object_list theirs_list = { &theirs->object, NULL };
+	struct object_list tips = { &ours->object, &theirs_list };
+	struct bitmap *reach_ours, *reach_theirs, *reach_haves, *only_ours;
+
+	/*
+	 * As in prepare_bitmap_walk(), a walk that never reaches the
+	 * bitmapped pack would be no quicker than an ordinary one.
+	 */
+	if (!in_bitmapped_pack(bitmap_git, &tips))
+		return -1;
+
+	reach_ours = find_commits(bitmap_git, &ours_list, 0);
+	reach_theirs = find_commits(bitmap_git, &theirs_list, 0);
+	reach_haves = find_commits(bitmap_git, haves, 1);
+
+	only_ours = bitmap_new();
+	bitmap_or(only_ours, reach_ours);
+	bitmap_and_not(only_ours, reach_theirs);
+	bitmap_and_not(only_ours, reach_haves);
+	bitmap_and_not(reach_theirs, reach_ours);
+	bitmap_and_not(reach_theirs, reach_haves);
+
+	*num_ours = count_commits(bitmap_git, only_ours);
+	*num_theirs = count_commits(bitmap_git, reach_theirs);
+
+	bitmap_free(only_ours);
+	bitmap_free(reach_ours);
+	bitmap_free(reach_theirs);
+	bitmap_free(reach_haves);
+	return 0;
+}
+
 struct bitmap_test_data {
 	struct bitmap_index *bitmap_git;
 	struct bitmap *base;
@@ -953,7 +1599,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct ewah_bitmap *bm;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 	struct bitmap_index *bitmap_git;
@@ -968,12 +1614,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git->version, bitmap_git->entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_sha1(bitmap_git->bitmaps, root->oid.hash);
-
-	if (pos < kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git->bitmaps, pos);
-		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
+	bm = bitmap_for_commit(bitmap_git, root->oid.hash);
 
+	if (bm) {
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
 			oid_to_hex(&root->oid), (int)bm->bit_size, ewah_checksum(bm));
 
@@ -1054,17 +1697,18 @@ int rebuild_existing_bitmaps(struct bitmap_index *bitmap_git,
 	khiter_t hash_pos;
 	int hash_ret;
 
-	num_objects = bitmap_git->pack->num_objects;
+	if (load_all_lookup_table_entries(bitmap_git) < 0)
+		return -1;
+
+	num_objects = bitmap_num_objects(bitmap_git);
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+		struct object_id oid;
 		struct object_entry *oe;
 
-		entry = &bitmap_git->pack->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git->pack, entry->nr);
-		oe = packlist_find(mapping, sha1, NULL);
+		nth_bitmap_object(bitmap_git, i, &oid, NULL, NULL, NULL);
+		oe = packlist_find(mapping, oid.hash, NULL);
 
 		if (oe)
 			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
@@ -20,8 +20,18 @@ static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
 };
 
+/*
+ * The lookup table has one row per bitmapped commit, sorted by the
+ * position of the commit in the index: its 4-byte position, the 8-byte
+ * offset of its entry in the file and the 4-byte row of the entry it
+ * is XORed against, or BITMAP_NO_XOR_ROW.
+ */
+#define BITMAP_LOOKUP_TABLE_ROW_WIDTH 16
+#define BITMAP_NO_XOR_ROW 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -35,17 +45,50 @@ typedef int (*show_reachable_fn)(
 	off_t found_offset);
 
 struct bitmap_index;
+struct list_objects_filter_options;
 
 struct bitmap_index *prepare_bitmap_git(void);
 void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
 			      uint32_t *trees, uint32_t *blobs, uint32_t *tags);
+/*
+ * Count the commits reachable from "ours" but neither from "theirs" nor
+ * from any of "haves" (which may be NULL) into "num_ours", and the
+ * other way around into "num_theirs": what "rev-list --left-right
+ * --count ours...theirs" says. Return -1 if the bitmap cannot help, as
+ * when neither commit is in the bitmapped pack.
+ */
+int bitmap_ahead_behind(struct bitmap_index *,
+			struct commit *ours, struct commit *theirs,
+			struct object_list *haves,
+			uint32_t *num_ours, uint32_t *num_theirs);
 void traverse_bitmap_commit_list(struct bitmap_index *,
 				 show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
-struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs);
+/*
+ * Compute the objects reachable from the pending objects of "revs" (but
+ * not from the uninteresting ones), omitting those removed by "filter",
+ * which may be NULL. Return NULL if there is no bitmap, or if it cannot
+ * be used for "filter"; the caller can then do a normal walk.
+ */
+struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
+					 struct list_objects_filter_options *filter);
+/*
+ * Whether "oid" is among the objects that the walk of prepare_bitmap_walk()
+ * found.
+ */
+int bitmap_walk_contains(struct bitmap_index *, const struct object_id *oid);
+/*
+ * Find the objects of the walk that can be copied verbatim from the
+ * bitmapped pack: whole words of it, and then any object that is not a
+ * delta, or whose delta base is copied too. Set "packfile" to the pack,
+ * "entries" to the number of objects and "reuse" to the bitmap of their
+ * pack positions, and drop them from the objects the walk shows.
+ * Return -1 if no object can be reused.
+ */
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *,
 				       struct packed_git **packfile,
-				       uint32_t *entries, off_t *up_to);
+				       uint32_t *entries,
+				       struct bitmap **reuse);
 int rebuild_existing_bitmaps(struct bitmap_index *, struct packing_data *mapping,
 			     khash_sha1 *reused_bitmaps, int show_progress);
 void free_bitmap_index(struct bitmap_index *);
@@ -5,6 +5,7 @@
 #include "progress.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -48,53 +49,59 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
-static int verify_packfile(struct packed_git *p,
-			   struct pack_window **w_curs,
-			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
-
+/* Hash the pack up to its trailing checksum, into "hash". */
+static void hash_packfile(struct packed_git *p, struct pack_window **w_curs,
+			  off_t pack_sig_ofs, unsigned char *hash)
 {
-	off_t index_size = p->index_size;
-	const unsigned char *index_base = p->index_data;
 	git_hash_ctx ctx;
-	unsigned char hash[GIT_MAX_RAWSZ], *pack_sig;
-	off_t offset = 0, pack_sig_ofs = 0;
-	uint32_t nr_objects, i;
-	int err = 0;
-	struct idx_entry *entries;
-
-	if (!is_pack_valid(p))
-		return error("packfile %s cannot be accessed", p->pack_name);
+	off_t offset = 0;
 
 	the_hash_algo->init_fn(&ctx);
 	do {
 		unsigned long remaining;
-		unsigned char *in = use_pack(p, w_curs, offset, &remaining);
+		unsigned char *in;
+
+		obj_read_lock();
+		in = use_pack(p, w_curs, offset, &remaining);
+		obj_read_unlock();
 		offset += remaining;
-		if (!pack_sig_ofs)
-			pack_sig_ofs = p->pack_size - the_hash_algo->rawsz;
 		if (offset > pack_sig_ofs)
 			remaining -= (unsigned int)(offset - pack_sig_ofs);
+		/* the window stays mapped while w_curs holds it */
 		the_hash_algo->update_fn(&ctx, in, remaining);
 	} while (offset < pack_sig_ofs);
 	the_hash_algo->final_fn(hash, &ctx);
+}
+
+static int check_packfile_hash(struct packed_git *p, struct pack_window **w_curs,
+			       off_t pack_sig_ofs, const unsigned char *hash)
+{
+	const unsigned char *index_base = p->index_data;
+	unsigned char *pack_sig;
+	int err = 0;
+
 	pack_sig = use_pack(p, w_curs, pack_sig_ofs, NULL);
 	if (hashcmp(hash, pack_sig))
 		err = error("%s pack checksum mismatch",
 			    p->pack_name);
-	if (hashcmp(index_base + index_size - the_hash_algo->hexsz, pack_sig))
+	if (hashcmp(index_base + p->index_size - the_hash_algo->hexsz, pack_sig))
 		err = error("%s pack checksum does not match its index",
 			    p->pack_name);
 	unuse_pack(w_curs);
+	return err;
+}
+
+/*
+ * The objects of "p" sorted by offset, since unpacking them is more
+ * efficient that way, followed by an entry at the trailing checksum.
+ */
+static struct idx_entry *sorted_entries(struct packed_git *p, off_t pack_sig_ofs)
+{
+	uint32_t nr_objects = p->num_objects, i;
+	struct idx_entry *entries;
 
-	/* Make sure everything reachable from idx is valid.  Since we
-	 * have verified that nr_objects matches between idx and pack,
-	 * we do not do scan-streaming check on the pack file.
-	 */
-	nr_objects = p->num_objects;
 	ALLOC_ARRAY(entries, nr_objects + 1);
 	entries[nr_objects].offset = pack_sig_ofs;
-	/* first sort entries by pack offset, since unpacking them is more efficient that way */
 	for (i = 0; i < nr_objects; i++) {
 		entries[i].oid.hash = nth_packed_object_sha1(p, i);
 		if (!entries[i].oid.hash)
@@ -103,6 +110,48 @@ static int verify_packfile(struct packed_git *p,
 		entries[i].nr = i;
 	}
 	QSORT(entries, nr_objects, compare_entries);
+	return entries;
+}
+
+static int check_entry_crc(struct packed_git *p, struct pack_window **w_curs,
+			   struct idx_entry *entry)
+{
+	off_t offset = entry->offset;
+	off_t len = entry[1].offset - offset;
+
+	if (p->index_version > 1 &&
+	    check_pack_crc(p, w_curs, offset, len, entry->nr))
+		return error("index CRC mismatch for object %s "
+			     "from %s at offset %"PRIuMAX"",
+			     oid_to_hex(entry->oid.oid),
+			     p->pack_name, (uintmax_t)offset);
+	return 0;
+}
+
+static int verify_packfile(struct packed_git *p,
+			   struct pack_window **w_curs,
+			   verify_fn fn,
+			   struct progress *progress, uint32_t base_count)
+
+{
+	unsigned char hash[GIT_MAX_RAWSZ];
+	off_t pack_sig_ofs = p->pack_size - the_hash_algo->rawsz;
+	uint32_t nr_objects, i;
+	int err = 0;
+	struct idx_entry *entries;
+
+	if (!is_pack_valid(p))
+		return error("packfile %s cannot be accessed", p->pack_name);
+
+	hash_packfile(p, w_curs, pack_sig_ofs, hash);
+	err = check_packfile_hash(p, w_curs, pack_sig_ofs, hash);
+
+	/* Make sure everything reachable from idx is valid.  Since we
+	 * have verified that nr_objects matches between idx and pack,
+	 * we do not do scan-streaming check on the pack file.
+	 */
+	nr_objects = p->num_objects;
+	entries = sorted_entries(p, pack_sig_ofs);
 
 	for (i = 0; i < nr_objects; i++) {
 		void *data;
@@ -111,16 +160,8 @@ static int verify_packfile(struct packed_git *p,
 		off_t curpos;
 		int data_valid;
 
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(entries[i].oid.oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
+		if (check_entry_crc(p, w_curs, &entries[i]))
+			err = -1;
 
 		curpos = entries[i].offset;
 		type = unpack_object_header(p, w_curs, &curpos, &size);
@@ -163,6 +204,228 @@ static int verify_packfile(struct packed_git *p,
 	return err;
 }
 
+#ifndef NO_PTHREADS
+/*
+ * With threads, the objects are unpacked and hashed by worker threads
+ * in the order of their offsets, and the main thread hands them to
+ * "fn" in that same order, printing what the workers had to report
+ * about each object just before. The workers stay at most
+ * VERIFY_AHEAD_PER_THREAD objects each ahead of the main thread, and
+ * stop taking new objects while the unpacked objects that wait for it
+ * hold more than VERIFY_AHEAD_BYTES.
+ *
+ * Another thread computes the checksum of the whole pack meanwhile,
+ * which is checked before the first object, as without threads.
+ */
+#define VERIFY_AHEAD_PER_THREAD 64
+#define VERIFY_AHEAD_BYTES (256 * 1024 * 1024)
+
+struct verify_result {
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	char *reports;
+	unsigned done:1,
+		 err:1,
+		 unpacked:1, /* "data" holds the object */
+		 usable:1; /* it can go to "fn", after a check if not unpacked */
+};
+
+struct verify_state {
+	struct packed_git *p;
+	struct idx_entry *entries;
+	struct verify_result *results;
+	uint32_t nr, next, consumed, ahead;
+	size_t bytes;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	off_t pack_sig_ofs;
+	unsigned char hash[GIT_MAX_RAWSZ];
+};
+
+static void verify_one(struct verify_state *vs, uint32_t i,
+		       struct pack_window **w_curs)
+{
+	struct packed_git *p = vs->p;
+	struct idx_entry *entry = &vs->entries[i];
+	struct verify_result *r = &vs->results[i];
+	struct strbuf reports = STRBUF_INIT;
+	off_t curpos = entry->offset;
+
+	capture_reports(&reports);
+
+	obj_read_lock();
+	if (check_entry_crc(p, w_curs, entry))
+		r->err = 1;
+	r->type = unpack_object_header(p, w_curs, &curpos, &r->size);
+	unuse_pack(w_curs);
+	if (r->type != OBJ_BLOB || r->size < big_file_threshold) {
+		r->data = unpack_entry(the_repository, p, entry->offset,
+				       &r->type, &r->size);
+		r->unpacked = 1;
+	}
+	obj_read_unlock();
+
+	if (!r->unpacked)
+		r->usable = 1;
+	else if (!r->data)
+		r->err = !!error("cannot unpack %s from %s at offset %"PRIuMAX"",
+				 oid_to_hex(entry->oid.oid), p->pack_name,
+				 (uintmax_t)entry->offset);
+	else if (check_object_signature(entry->oid.oid, r->data, r->size,
+					type_name(r->type)))
+		r->err = !!error("packed %s from %s is corrupt",
+				 oid_to_hex(entry->oid.oid), p->pack_name);
+	else
+		r->usable = 1;
+
+	capture_reports(NULL);
+	if (reports.len)
+		r->reports = strbuf_detach(&reports, NULL);
+	strbuf_release(&reports);
+}
+
+static void *verify_thread(void *data)
+{
+	struct verify_state *vs = data;
+	struct pack_window *w_curs = NULL;
+
+	pthread_mutex_lock(&vs->mutex);
+	for (;;) {
+		uint32_t i;
+
+		while (vs->next < vs->nr &&
+		       (vs->next >= vs->consumed + vs->ahead ||
+			(vs->bytes > VERIFY_AHEAD_BYTES && vs->next > vs->consumed)))
+			pthread_cond_wait(&vs->cond, &vs->mutex);
+		if (vs->next >= vs->nr)
+			break;
+		i = vs->next++;
+		pthread_mutex_unlock(&vs->mutex);
+
+		verify_one(vs, i, &w_curs);
+
+		pthread_mutex_lock(&vs->mutex);
+		vs->results[i].done = 1;
+		if (vs->results[i].data)
+			vs->bytes += vs->results[i].size;
+		pthread_cond_broadcast(&vs->cond);
+	}
+	pthread_mutex_unlock(&vs->mutex);
+	return NULL;
+}
+
+static void *hash_thread(void *data)
+{
+	struct verify_state *vs = data;
+	struct pack_window *w_curs = NULL;
+
+	hash_packfile(vs->p, &w_curs, vs->pack_sig_ofs, vs->hash);
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return NULL;
+}
+
+static int verify_packfile_threaded(struct packed_git *p,
+				    struct pack_window **w_curs,
+				    verify_fn fn,
+				    struct progress *progress,
+				    uint32_t base_count, int nr_threads)
+{
+	struct verify_state vs;
+	pthread_t *threads, hasher;
+	uint32_t i;
+	int err = 0;
+
+	if (!is_pack_valid(p))
+		return error("packfile %s cannot be accessed", p->pack_name);
+
+	memset(&vs, 0, sizeof(vs));
+	vs.p = p;
+	vs.nr = p->num_objects;
+	vs.ahead = VERIFY_AHEAD_PER_THREAD * nr_threads;
+	vs.pack_sig_ofs = p->pack_size - the_hash_algo->rawsz;
+	vs.entries = sorted_entries(p, vs.pack_sig_ofs);
+	vs.results = xcalloc(vs.nr, sizeof(*vs.results));
+	pthread_mutex_init(&vs.mutex, NULL);
+	pthread_cond_init(&vs.cond, NULL);
+
+	enable_obj_read_lock();
+	begin_report_capture();
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, verify_thread, &vs))
+			die(_("unable to create thread"));
+	if (pthread_create(&hasher, NULL, hash_thread, &vs))
+		die(_("unable to create thread"));
+
+	pthread_join(hasher, NULL);
+	obj_read_lock();
+	if (check_packfile_hash(p, w_curs, vs.pack_sig_ofs, vs.hash))
+		err = -1;
+	obj_read_unlock();
+
+	for (i = 0; i < vs.nr; i++) {
+		struct verify_result *r = &vs.results[i];
+		const struct object_id *oid = vs.entries[i].oid.oid;
+		unsigned long held;
+
+		pthread_mutex_lock(&vs.mutex);
+		while (!r->done)
+			pthread_cond_wait(&vs.cond, &vs.mutex);
+		pthread_mutex_unlock(&vs.mutex);
+
+		if (r->reports)
+			fputs(r->reports, stderr);
+		if (r->err)
+			err = -1;
+
+		held = r->data ? r->size : 0;
+		obj_read_lock();
+		if (r->usable && !r->unpacked &&
+		    check_object_signature(oid, NULL, r->size, type_name(r->type))) {
+			err = error("packed %s from %s is corrupt",
+				    oid_to_hex(oid), p->pack_name);
+			r->usable = 0;
+		}
+		if (r->usable && fn) {
+			int eaten = 0;
+			err |= fn(oid, r->type, r->size, r->data, &eaten);
+			if (eaten)
+				r->data = NULL;
+		}
+		obj_read_unlock();
+
+		if (((base_count + i) & 1023) == 0)
+			display_progress(progress, base_count + i);
+
+		pthread_mutex_lock(&vs.mutex);
+		vs.bytes -= held;
+		vs.consumed = i + 1;
+		pthread_cond_broadcast(&vs.cond);
+		pthread_mutex_unlock(&vs.mutex);
+
+		free(r->data);
+		free(r->reports);
+	}
+	display_progress(progress, base_count + i);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	end_report_capture();
+	disable_obj_read_lock();
+
+	pthread_mutex_destroy(&vs.mutex);
+	pthread_cond_destroy(&vs.cond);
+	free(threads);
+	free(vs.results);
+	free(vs.entries);
+	return err;
+}
+#endif
+
 int verify_pack_index(struct packed_git *p)
 {
 	off_t index_size;
@@ -187,17 +450,29 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count,
+		int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
+	enum pack_access old_access;
 
 	err |= verify_pack_index(p);
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(p, &w_curs, fn, progress, base_count);
+	/* the pack is hashed, and its objects read, in order */
+	old_access = set_pack_access(PACK_ACCESS_SEQUENTIAL);
+
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 && p->num_objects > 1)
+		err |= verify_packfile_threaded(p, &w_curs, fn, progress,
+						base_count, nr_threads);
+	else
+#endif
+		err |= verify_packfile(p, &w_curs, fn, progress, base_count);
 	unuse_pack(&w_curs);
+	set_pack_access(old_access);
 
 	return err;
 }
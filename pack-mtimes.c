@@ -0,0 +1,98 @@
+#include "cache.h"
+#include "pack-mtimes.h"
+#include "object-store.h"
+#include "packfile.h"
+
+static char *pack_mtimes_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.mtimes", (int)len, p->pack_name);
+}
+
+int load_pack_mtimes(struct packed_git *p)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	const size_t header_size = 3 * sizeof(uint32_t);
+	char *mtimes_name;
+	const unsigned char *data;
+	size_t size;
+	struct stat st;
+	int fd;
+
+	if (p->mtimes_data)
+		return 0;
+	if (!p->pack_cruft || open_pack_index(p))
+		return -1;
+
+	mtimes_name = pack_mtimes_filename(p);
+	fd = git_open(mtimes_name);
+	if (fd < 0) {
+		free(mtimes_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(mtimes_name);
+		return -1;
+	}
+	size = xsize_t(st.st_size);
+	if (size != header_size + st_mult(p->num_objects, sizeof(uint32_t)) +
+		    2 * rawsz) {
+		warning(_("mtimes file %s has the wrong size"), mtimes_name);
+		close(fd);
+		free(mtimes_name);
+		return -1;
+	}
+	data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(data) != MTIMES_SIGNATURE ||
+	    get_be32(data + 4) != MTIMES_VERSION ||
+	    get_be32(data + 8) != the_hash_algo->format_id)
+		warning(_("mtimes file %s has an unknown signature, version or hash"),
+			mtimes_name);
+	else if (hashcmp(data + size - 2 * rawsz,
+			 (const unsigned char *)p->index_data +
+			 p->index_size - 2 * rawsz))
+		warning(_("mtimes file %s does not match its pack"),
+			mtimes_name);
+	else {
+		p->mtimes_map = data;
+		p->mtimes_map_size = size;
+		p->mtimes_data = (const uint32_t *)(data + header_size);
+		free(mtimes_name);
+		return 0;
+	}
+	munmap((void *)data, size);
+	free(mtimes_name);
+	return -1;
+}
+
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos)
+{
+	if (!p->mtimes_data)
+		BUG("mtimes of %s are not loaded", p->pack_name);
+	if (pos >= p->num_objects)
+		BUG("pack position out of range: %"PRIu32, pos);
+	return get_be32(p->mtimes_data + pos);
+}
+
+time_t packed_object_mtime(struct packed_git *p, uint32_t pos)
+{
+	if (p->pack_cruft && !load_pack_mtimes(p))
+		return nth_packed_mtime(p, pos);
+	return p->mtime;
+}
+
+void close_pack_mtimes(struct packed_git *p)
+{
+	if (!p->mtimes_map)
+		return;
+	munmap((void *)p->mtimes_map, p->mtimes_map_size);
+	p->mtimes_map = NULL;
+	p->mtimes_map_size = 0;
+	p->mtimes_data = NULL;
+}
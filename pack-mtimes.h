@@ -0,0 +1,45 @@
+#ifndef PACK_MTIMES_H
+#define PACK_MTIMES_H
+
+/*
+ * A cruft pack holds objects that nothing reachable needs any more,
+ * for as long as they are too recent to be pruned.  Exploded loose,
+ * each of them would keep its own modification time; packed, they
+ * keep it in a .mtimes file next to the .idx:
+ *
+ *   - a 4-byte signature, MTIMES_SIGNATURE,
+ *   - a 4-byte version number, MTIMES_VERSION,
+ *   - the 4-byte format id of the hash function,
+ *   - for each object in index order, its 4-byte mtime,
+ *   - the checksum of the pack,
+ *   - the checksum of all of the above.
+ *
+ * All numbers are in network byte order.  A pack with a .mtimes file
+ * is a cruft pack (p->pack_cruft).
+ */
+#define MTIMES_SIGNATURE 0x4d544d45 /* "MTME" */
+#define MTIMES_VERSION 1
+
+struct packed_git;
+
+/*
+ * Map the .mtimes file of "p".  Returns 0 on success, or -1 (with a
+ * warning if it is there but unusable) otherwise.
+ */
+int load_pack_mtimes(struct packed_git *p);
+
+/*
+ * The mtime of the object at index position "pos" of "p".  The
+ * .mtimes file must have been loaded.
+ */
+uint32_t nth_packed_mtime(struct packed_git *p, uint32_t pos);
+
+/*
+ * The mtime of the object at index position "pos" of "p": from its
+ * .mtimes file for a cruft pack, that of the pack itself otherwise.
+ */
+time_t packed_object_mtime(struct packed_git *p, uint32_t pos);
+
+void close_pack_mtimes(struct packed_git *p);
+
+#endif
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "pack-revindex.h"
 #include "object-store.h"
+#include "packfile.h"
 
 /*
  * Pack index for existing packs give us easy access to the offsets into
@@ -156,23 +157,98 @@ static void create_pack_revindex(struct packed_git *p)
 	sort_revindex(p->revindex, num_ent, p->pack_size);
 }
 
+static char *pack_revindex_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
+}
+
+/*
+ * Map the .rev file of "p".  Returns 0 on success, or -1 if there is
+ * none, or if it does not match the pack (with a warning then).
+ */
+static int load_revindex_from_disk(struct packed_git *p)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	const size_t header_size = 3 * sizeof(uint32_t);
+	char *rev_name;
+	const unsigned char *data;
+	size_t size;
+	struct stat st;
+	int fd;
+
+	if (open_pack_index(p))
+		return -1;
+
+	rev_name = pack_revindex_filename(p);
+	fd = git_open(rev_name);
+	if (fd < 0) {
+		free(rev_name);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(rev_name);
+		return -1;
+	}
+	size = xsize_t(st.st_size);
+	if (size != header_size + st_mult(p->num_objects, sizeof(uint32_t)) +
+		    2 * rawsz) {
+		warning(_("reverse-index file %s has the wrong size"), rev_name);
+		close(fd);
+		free(rev_name);
+		return -1;
+	}
+	data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(data) != RIDX_SIGNATURE ||
+	    get_be32(data + 4) != RIDX_VERSION ||
+	    get_be32(data + 8) != the_hash_algo->format_id)
+		warning(_("reverse-index file %s has an unknown signature, version or hash"),
+			rev_name);
+	else if (hashcmp(data + size - 2 * rawsz,
+			 (const unsigned char *)p->index_data +
+			 p->index_size - 2 * rawsz))
+		warning(_("reverse-index file %s does not match its pack"),
+			rev_name);
+	else {
+		p->revindex_map = data;
+		p->revindex_map_size = size;
+		p->revindex_data = (const uint32_t *)(data + header_size);
+		free(rev_name);
+		return 0;
+	}
+	munmap((void *)data, size);
+	free(rev_name);
+	return -1;
+}
+
 void load_pack_revindex(struct packed_git *p)
 {
-	if (!p->revindex)
+	if (p->revindex || p->revindex_data)
+		return;
+	if (load_revindex_from_disk(p))
 		create_pack_revindex(p);
 }
 
-int find_revindex_position(struct packed_git *p, off_t ofs)
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
 {
-	int lo = 0;
-	int hi = p->num_objects + 1;
-	struct revindex_entry *revindex = p->revindex;
+	uint32_t lo = 0;
+	uint32_t hi = p->num_objects + 1;
 
+	load_pack_revindex(p);
 	do {
-		unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
-			return mi;
-		} else if (ofs < revindex[mi].offset)
+		uint32_t mi = lo + (hi - lo) / 2;
+		off_t mi_ofs = pack_pos_to_offset(p, mi);
+
+		if (mi_ofs == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
@@ -182,15 +258,30 @@ int find_revindex_position(struct packed_git *p, off_t ofs)
 	return -1;
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
 {
-	int pos;
-
 	load_pack_revindex(p);
-	pos = find_revindex_position(p, ofs);
+	if (p->revindex)
+		return p->revindex[pos].nr;
+	return get_be32(p->revindex_data + pos);
+}
 
-	if (pos < 0)
-		return NULL;
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	load_pack_revindex(p);
+	if (p->revindex)
+		return p->revindex[pos].offset;
+	if (pos == p->num_objects)
+		return p->pack_size - the_hash_algo->rawsz;
+	return nth_packed_object_offset(p, get_be32(p->revindex_data + pos));
+}
 
-	return p->revindex + pos;
+void close_pack_revindex(struct packed_git *p)
+{
+	if (!p->revindex_map)
+		return;
+	munmap((void *)p->revindex_map, p->revindex_map_size);
+	p->revindex_map = NULL;
+	p->revindex_map_size = 0;
+	p->revindex_data = NULL;
 }
@@ -1,6 +1,30 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
+/*
+ * A reverse index lists the objects of a pack in the order they are
+ * stored in the pack.  An object's rank in that list is its "pack
+ * position"; its rank in the .idx, i.e. in the order of object names,
+ * is its "index position".  The pack position of an object tells where
+ * its data ends (where that of the next one starts), and which object
+ * is at a given offset.
+ *
+ * The reverse index is either read from a .rev file next to the .idx
+ * (see pack.writeReverseIndex), or computed by sorting the offsets of
+ * the .idx.  A .rev file is:
+ *
+ *   - a 4-byte signature, RIDX_SIGNATURE,
+ *   - a 4-byte version number, RIDX_VERSION,
+ *   - the 4-byte format id of the hash function,
+ *   - for each object in pack order, its 4-byte index position,
+ *   - the checksum of the pack,
+ *   - the checksum of all of the above.
+ *
+ * All numbers are in network byte order.
+ */
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+
 struct packed_git;
 
 struct revindex_entry {
@@ -8,9 +32,29 @@ struct revindex_entry {
 	unsigned int nr;
 };
 
+/*
+ * Make the reverse index of "p" ready, from its .rev file if it has a
+ * usable one.  The functions below call it as needed.
+ */
 void load_pack_revindex(struct packed_git *p);
-int find_revindex_position(struct packed_git *p, off_t ofs);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Find the pack position of the object at offset "ofs" of "p".  Returns
+ * 0 and sets "pos" on success, or -1 (after reporting an error) if no
+ * object starts at "ofs".  The trailing checksum of the pack is at pack
+ * position p->num_objects.
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
+
+/* The index position of the object at pack position "pos". */
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
+
+/*
+ * The offset of the object at pack position "pos"; "pos" may be
+ * p->num_objects, for the end of the last object.
+ */
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
+
+void close_pack_revindex(struct packed_git *p);
 
 #endif
@@ -1,6 +1,8 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "pack-revindex.h"
+#include "pack-mtimes.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -176,6 +178,102 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
+static int pack_order_cmp(const void *va, const void *vb, void *ctx)
+{
+	struct pack_idx_entry **objects = ctx;
+	off_t a = objects[*(const uint32_t *)va]->offset;
+	off_t b = objects[*(const uint32_t *)vb]->offset;
+
+	return (a < b) ? -1 : (a != b);
+}
+
+/*
+ * Write the reverse index of a pack, whose "objects" must be sorted by
+ * name like write_idx_file() leaves them, to "rev_name" (or to a new
+ * temporary file if it is NULL), and return its name.  "hash" is the
+ * pack checksum.  See pack-revindex.h for the format.
+ */
+const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects,
+			   uint32_t nr_objects, const unsigned char *hash,
+			   unsigned flags)
+{
+	struct hashfile *f;
+	uint32_t *pack_order;
+	uint32_t i;
+	int fd;
+
+	if (flags & WRITE_REV_VERIFY) {
+		assert(rev_name);
+		f = hashfd_check(rev_name);
+	} else {
+		if (!rev_name) {
+			struct strbuf tmp_file = STRBUF_INIT;
+			fd = odb_mkstemp(&tmp_file, "pack/tmp_rev_XXXXXX");
+			rev_name = strbuf_detach(&tmp_file, NULL);
+		} else {
+			unlink(rev_name);
+			fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+			if (fd < 0)
+				die_errno("unable to create '%s'", rev_name);
+		}
+		f = hashfd(fd, rev_name);
+	}
+
+	ALLOC_ARRAY(pack_order, nr_objects);
+	for (i = 0; i < nr_objects; i++)
+		pack_order[i] = i;
+	QSORT_S(pack_order, nr_objects, pack_order_cmp, objects);
+
+	hashwrite_be32(f, RIDX_SIGNATURE);
+	hashwrite_be32(f, RIDX_VERSION);
+	hashwrite_be32(f, the_hash_algo->format_id);
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, pack_order[i]);
+	free(pack_order);
+
+	hashwrite(f, hash, the_hash_algo->rawsz);
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE |
+				    ((flags & WRITE_REV_VERIFY)
+				    ? 0 : CSUM_FSYNC));
+	return rev_name;
+}
+
+/*
+ * Write the .mtimes file of a cruft pack to "mtimes_name" (or to a
+ * temporary file if it is NULL), and return its name.  "mtimes" are
+ * those of the objects in index order; "hash" is the pack checksum.
+ * See pack-mtimes.h for the format.
+ */
+const char *write_mtimes_file(const char *mtimes_name, const uint32_t *mtimes,
+			      uint32_t nr_objects, const unsigned char *hash)
+{
+	struct hashfile *f;
+	uint32_t i;
+	int fd;
+
+	if (!mtimes_name) {
+		struct strbuf tmp_file = STRBUF_INIT;
+		fd = odb_mkstemp(&tmp_file, "pack/tmp_mtimes_XXXXXX");
+		mtimes_name = strbuf_detach(&tmp_file, NULL);
+	} else {
+		unlink(mtimes_name);
+		fd = open(mtimes_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+		if (fd < 0)
+			die_errno("unable to create '%s'", mtimes_name);
+	}
+	f = hashfd(fd, mtimes_name);
+
+	hashwrite_be32(f, MTIMES_SIGNATURE);
+	hashwrite_be32(f, MTIMES_VERSION);
+	hashwrite_be32(f, the_hash_algo->format_id);
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, mtimes[i]);
+
+	hashwrite(f, hash, the_hash_algo->rawsz);
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_CLOSE | CSUM_FSYNC);
+	return mtimes_name;
+}
+
 off_t write_pack_header(struct hashfile *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -351,7 +449,7 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name = NULL;
 	int basename_len = name_buffer->len;
 
 	if (adjust_shared_perm(pack_tmp_name))
@@ -362,6 +460,13 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	if (pack_idx_opts->flags & WRITE_REV) {
+		rev_tmp_name = write_rev_file(NULL, written_list, nr_written,
+					      sha1, pack_idx_opts->flags);
+		if (adjust_shared_perm(rev_tmp_name))
+			die_errno("unable to make temporary reverse index file readable");
+	}
+
 	strbuf_addf(name_buffer, "%s.pack", sha1_to_hex(sha1));
 
 	if (rename(pack_tmp_name, name_buffer->buf))
@@ -369,6 +474,15 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 
 	strbuf_setlen(name_buffer, basename_len);
 
+	/* in place before the .idx, which is what makes the pack visible */
+	if (rev_tmp_name) {
+		strbuf_addf(name_buffer, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary reverse index file");
+
+		strbuf_setlen(name_buffer, basename_len);
+	}
+
 	strbuf_addf(name_buffer, "%s.idx", sha1_to_hex(sha1));
 	if (rename(idx_tmp_name, name_buffer->buf))
 		die_errno("unable to rename temporary index file");
@@ -376,4 +490,5 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	strbuf_setlen(name_buffer, basename_len);
 
 	free((void *)idx_tmp_name);
+	free((void *)rev_tmp_name);
 }
@@ -40,6 +40,8 @@ struct pack_idx_option {
 	/* flag bits */
 #define WRITE_IDX_VERIFY 01 /* verify only, do not write the idx file */
 #define WRITE_IDX_STRICT 02
+#define WRITE_REV 04 /* also write a .rev file, see write_rev_file() */
+#define WRITE_REV_VERIFY 010 /* verify only, do not write the .rev file */
 
 	uint32_t version;
 	uint32_t off32_limit;
@@ -78,9 +80,16 @@ struct progress;
 typedef int (*verify_fn)(const struct object_id *, enum object_type, unsigned long, void*, int*);
 
 extern const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
+extern const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *hash, unsigned flags);
+extern const char *write_mtimes_file(const char *mtimes_name, const uint32_t *mtimes, uint32_t nr_objects, const unsigned char *hash);
 extern int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 extern int verify_pack_index(struct packed_git *);
-extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t);
+/*
+ * Check the pack "p" and hand each of its objects to "fn". With
+ * "nr_threads" above 1, that many threads unpack and hash the objects,
+ * while "fn" still gets them one at a time, in the same order.
+ */
+extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t, int nr_threads);
 extern off_t write_pack_header(struct hashfile *f, uint32_t);
 extern void fixup_pack_header_footer(int, unsigned char *, const char *, uint32_t, unsigned char *, off_t);
 extern char *index_pack_lockfile(int fd);
@@ -15,6 +15,11 @@
 #include "tree-walk.h"
 #include "tree.h"
 #include "object-store.h"
+#include "midx.h"
+#include "pack-mtimes.h"
+#include "compact-oidset.h"
+#include "trace2.h"
+#include "pack-revindex.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *sha1,
@@ -47,6 +52,8 @@ static unsigned int pack_max_fds;
 static size_t peak_pack_mapped;
 static size_t pack_mapped;
 
+static enum pack_access pack_access;
+
 #define SZ_FMT PRIuMAX
 static inline uintmax_t sz_fmt(size_t s) { return s; }
 
@@ -310,17 +317,26 @@ void close_pack(struct packed_git *p)
 	close_pack_windows(p);
 	close_pack_fd(p);
 	close_pack_index(p);
+	close_pack_revindex(p);
+	close_pack_mtimes(p);
 }
 
 void close_all_packs(struct raw_object_store *o)
 {
 	struct packed_git *p;
+	struct multi_pack_index *m;
 
 	for (p = o->packed_git; p; p = p->next)
 		if (p->do_not_close)
 			BUG("want to close pack marked 'do-not-close'");
 		else
 			close_pack(p);
+
+	while ((m = o->multi_pack_index)) {
+		o->multi_pack_index = m->next;
+		close_midx(m);
+		free(m);
+	}
 }
 
 /*
@@ -530,6 +546,55 @@ static int open_packed_git(struct packed_git *p)
 	return -1;
 }
 
+static void advise_window(struct pack_window *win)
+{
+#ifdef MADV_RANDOM
+	switch (pack_access) {
+	case PACK_ACCESS_NORMAL:
+		madvise(win->base, win->len, MADV_NORMAL);
+		break;
+	case PACK_ACCESS_RANDOM:
+		madvise(win->base, win->len, MADV_RANDOM);
+		break;
+	case PACK_ACCESS_SEQUENTIAL:
+		madvise(win->base, win->len, MADV_SEQUENTIAL);
+		madvise(win->base, win->len, MADV_WILLNEED);
+		break;
+	}
+#endif
+}
+
+enum pack_access set_pack_access(enum pack_access access)
+{
+	enum pack_access old = pack_access;
+	struct packed_git *p;
+	struct pack_window *win;
+
+	if (access == old)
+		return old;
+	pack_access = access;
+	for (p = the_repository->objects->packed_git; p; p = p->next)
+		for (win = p->windows; win; win = win->next)
+			advise_window(win);
+	return old;
+}
+
+/*
+ * With the default window size of 64-bit platforms, there is address
+ * space enough to map packs whole, in one window, whatever their size.
+ * A window size that was configured otherwise is respected.
+ */
+static int map_whole_pack(struct packed_git *p)
+{
+#ifdef NO_MMAP
+	return 0;
+#else
+	return sizeof(void *) >= 8 &&
+	       packed_git_window_size == DEFAULT_PACKED_GIT_WINDOW_SIZE &&
+	       p->pack_size <= packed_git_limit;
+#endif
+}
+
 static int in_window(struct pack_window *win, off_t offset)
 {
 	/* We must promise at least one full hash after the
@@ -569,7 +634,9 @@ unsigned char *use_pack(struct packed_git *p,
 			if (in_window(win, offset))
 				break;
 		}
-		if (!win) {
+		if (win)
+			trace2_counter_add("pack", "windows/hit", 1);
+		else {
 			size_t window_align = packed_git_window_size / 2;
 			off_t len;
 
@@ -577,10 +644,15 @@ unsigned char *use_pack(struct packed_git *p,
 				die("packfile %s cannot be accessed", p->pack_name);
 
 			win = xcalloc(1, sizeof(*win));
-			win->offset = (offset / window_align) * window_align;
-			len = p->pack_size - win->offset;
-			if (len > packed_git_window_size)
-				len = packed_git_window_size;
+			if (map_whole_pack(p)) {
+				win->offset = 0;
+				len = p->pack_size;
+			} else {
+				win->offset = (offset / window_align) * window_align;
+				len = p->pack_size - win->offset;
+				if (len > packed_git_window_size)
+					len = packed_git_window_size;
+			}
 			win->len = (size_t)len;
 			pack_mapped += win->len;
 			while (packed_git_limit < pack_mapped
@@ -592,6 +664,9 @@ unsigned char *use_pack(struct packed_git *p,
 			if (win->base == MAP_FAILED)
 				die_errno("packfile %s cannot be mapped",
 					  p->pack_name);
+			if (pack_access != PACK_ACCESS_NORMAL)
+				advise_window(win);
+			trace2_counter_add("pack", "windows/map", 1);
 			if (!win->offset && win->len == p->pack_size
 				&& !p->do_not_close)
 				close_pack_fd(p);
@@ -665,6 +740,10 @@ struct packed_git *add_packed_git(const char *path, size_t path_len, int local)
 	if (!access(p->pack_name, F_OK))
 		p->pack_promisor = 1;
 
+	xsnprintf(p->pack_name + path_len, alloc - path_len, ".mtimes");
+	if (!access(p->pack_name, F_OK))
+		p->pack_cruft = 1;
+
 	xsnprintf(p->pack_name + path_len, alloc - path_len, ".pack");
 	if (stat(p->pack_name, &st) || !S_ISREG(st.st_mode)) {
 		free(p);
@@ -690,6 +769,7 @@ void install_packed_git(struct repository *r, struct packed_git *pack)
 
 	pack->next = r->objects->packed_git;
 	r->objects->packed_git = pack;
+	clear_object_filter(r->objects);
 }
 
 void (*report_garbage)(unsigned seen_bits, const char *path);
@@ -738,6 +818,56 @@ static void report_pack_garbage(struct string_list *list)
 	report_helper(list, seen_bits, first, list->nr);
 }
 
+void for_each_file_in_pack_dir(const char *objdir,
+			       each_file_in_pack_dir_fn fn,
+			       void *data)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirnamelen;
+	DIR *dir;
+	struct dirent *de;
+
+	strbuf_addstr(&path, objdir);
+	strbuf_addstr(&path, "/pack");
+	dir = opendir(path.buf);
+	if (!dir) {
+		if (errno != ENOENT)
+			error_errno("unable to open object pack directory: %s",
+				    path.buf);
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirnamelen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+
+		strbuf_setlen(&path, dirnamelen);
+		strbuf_addstr(&path, de->d_name);
+
+		fn(path.buf, path.len, de->d_name, data);
+	}
+
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+/*
+ * Mark "p" as being covered by the multi-pack-index "m" (if any), so that
+ * lookups go through the midx instead of the pack's own index.
+ */
+static void link_midx_pack(struct multi_pack_index *m,
+			   struct packed_git *p, const char *idx_name)
+{
+	uint32_t pack_int_id;
+
+	if (!m || !midx_locate_pack(m, idx_name, &pack_int_id))
+		return;
+	m->packs[pack_int_id] = p;
+	p->multi_pack_index = 1;
+}
+
 static void prepare_packed_git_one(struct repository *r, char *objdir, int local)
 {
 	struct strbuf path = STRBUF_INIT;
@@ -745,6 +875,10 @@ static void prepare_packed_git_one(struct repository *r, char *objdir, int local
 	DIR *dir;
 	struct dirent *de;
 	struct string_list garbage = STRING_LIST_INIT_DUP;
+	struct multi_pack_index *m = NULL;
+
+	if (prepare_multi_pack_index_one(r, objdir, local))
+		m = find_multi_pack_index(r, objdir);
 
 	strbuf_addstr(&path, objdir);
 	strbuf_addstr(&path, "/pack");
@@ -786,16 +920,24 @@ static void prepare_packed_git_one(struct repository *r, char *objdir, int local
 			     */
 			    (p = add_packed_git(path.buf, path.len, local)) != NULL)
 				install_packed_git(r, p);
+			if (p)
+				link_midx_pack(m, p, de->d_name);
 		}
 
 		if (!report_garbage)
 			continue;
 
-		if (ends_with(de->d_name, ".idx") ||
-		    ends_with(de->d_name, ".pack") ||
-		    ends_with(de->d_name, ".bitmap") ||
-		    ends_with(de->d_name, ".keep") ||
-		    ends_with(de->d_name, ".promisor"))
+		if (!strcmp(de->d_name, "multi-pack-index") ||
+		    (starts_with(de->d_name, "multi-pack-index-") &&
+		     ends_with(de->d_name, ".bitmap")))
+			continue;
+		else if (ends_with(de->d_name, ".idx") ||
+			 ends_with(de->d_name, ".pack") ||
+			 ends_with(de->d_name, ".bitmap") ||
+			 ends_with(de->d_name, ".rev") ||
+			 ends_with(de->d_name, ".mtimes") ||
+			 ends_with(de->d_name, ".keep") ||
+			 ends_with(de->d_name, ".promisor"))
 			string_list_append(&garbage, path.buf);
 		else
 			report_garbage(PACKDIR_FILE_GARBAGE, path.buf);
@@ -828,10 +970,60 @@ unsigned long approximate_object_count(void)
 			count += p->num_objects;
 		}
 		the_repository->objects->approximate_object_count = count;
+		the_repository->objects->approximate_object_count_valid = 1;
 	}
 	return the_repository->objects->approximate_object_count;
 }
 
+struct unique_names {
+	struct oid_array *names;
+	int nr;
+};
+
+static int keep_packed_object_name(const struct object_id *oid, void *data)
+{
+	struct unique_names *u = data;
+
+	/* compacts in place; never ahead of the entry being read */
+	oidcpy(&u->names->oid[u->nr++], oid);
+	return 0;
+}
+
+struct oid_array *get_packed_object_names(struct repository *r, int build)
+{
+	struct unique_names u;
+	struct oid_array *names;
+	struct packed_git *p;
+	uint32_t i;
+
+	if (r->objects->packed_object_names || !build)
+		return r->objects->packed_object_names;
+
+	names = xcalloc(1, sizeof(*names));
+	for (p = get_packed_git(r); p; p = p->next) {
+		if (p->multi_pack_index || open_pack_index(p))
+			continue;
+		ALLOC_GROW(names->oid, names->nr + p->num_objects, names->alloc);
+		for (i = 0; i < p->num_objects; i++)
+			nth_packed_object_oid(&names->oid[names->nr++], p, i);
+	}
+
+	u.names = names;
+	u.nr = 0;
+	oid_array_for_each_unique(names, keep_packed_object_name, &u);
+	names->nr = u.nr;
+	r->objects->packed_object_names = names;
+	return names;
+}
+
+void clear_packed_object_names(struct raw_object_store *o)
+{
+	if (!o->packed_object_names)
+		return;
+	oid_array_clear(o->packed_object_names);
+	FREE_AND_NULL(o->packed_object_names);
+}
+
 static void *get_next_packed_git(const void *p)
 {
 	return ((const struct packed_git *)p)->next;
@@ -904,7 +1096,17 @@ static void prepare_packed_git(struct repository *r)
 
 void reprepare_packed_git(struct repository *r)
 {
+	struct alternate_object_database *alt;
+
+	/* Whoever added packs may have added loose objects as well */
+	if (r->objects->objectdir_odb)
+		odb_clear_loose_cache(r->objects->objectdir_odb);
+	for (alt = r->objects->alt_odb_list; alt; alt = alt->next)
+		odb_clear_loose_cache(alt);
+
 	r->objects->approximate_object_count_valid = 0;
+	clear_packed_object_names(r->objects);
+	clear_object_filter(r->objects);
 	r->objects->packed_git_initialized = 0;
 	prepare_packed_git(r);
 }
@@ -921,6 +1123,12 @@ struct list_head *get_packed_git_mru(struct repository *r)
 	return &r->objects->packed_git_mru;
 }
 
+struct multi_pack_index *get_multi_pack_index(struct repository *r)
+{
+	prepare_packed_git(r);
+	return r->objects->multi_pack_index;
+}
+
 unsigned long unpack_object_header_buffer(const unsigned char *buf,
 		unsigned long len, enum object_type *type, unsigned long *sizep)
 {
@@ -1037,11 +1245,11 @@ const struct packed_git *has_packed_and_bad(const unsigned char *sha1)
 	return NULL;
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1092,18 +1300,17 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(p, base_pos));
 	} else
 		return NULL;
 }
@@ -1113,12 +1320,11 @@ static int retry_bad_packed_offset(struct repository *r,
 				   off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	struct object_id oid;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	nth_packed_object_oid(&oid, p, revidx->nr);
+	nth_packed_object_oid(&oid, p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, oid.hash);
 	type = oid_object_info(r, &oid, NULL);
 	if (type <= OBJ_NONE)
@@ -1196,10 +1402,47 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
+/*
+ * The delta base cache keeps the bases it was given last, up to
+ * core.deltaBaseCacheLimit bytes of them. With the "lru" policy, it
+ * evicts the one used least recently.
+ *
+ * With the "arc" policy, it follows the adaptive replacement cache: the
+ * bases used only once are on the "recent" list, and those used again
+ * on the "frequent" list. The lists of ghosts remember the keys of the
+ * bases evicted from either, and a base that is requested again while
+ * it is a ghost moves the target size of the "recent" list towards the
+ * list it was evicted from. Bases are evicted from the "recent" list
+ * while it is above that target, so that a scan through many bases
+ * used once does not push out the ones used over and over.
+ *
+ * On top of that, a base that took deltas to rebuild gets second
+ * chances, each of which puts it back at the most recent end of its
+ * list instead of evicting it, the more so the longer its chain.
+ */
+enum delta_base_cache_list {
+	DBC_RECENT,
+	DBC_FREQUENT,
+	DBC_RECENT_GHOST,
+	DBC_FREQUENT_GHOST,
+	DBC_NR
+};
+
+#define DBC_MAX_CREDIT 4
+
 static struct hashmap delta_base_cache;
+/* the size of the bases in the cache, not counting the ghosts */
 static size_t delta_base_cached;
 
-static LIST_HEAD(delta_base_cache_lru);
+static struct list_head delta_base_cache_lists[DBC_NR] = {
+	LIST_HEAD_INIT(delta_base_cache_lists[DBC_RECENT]),
+	LIST_HEAD_INIT(delta_base_cache_lists[DBC_FREQUENT]),
+	LIST_HEAD_INIT(delta_base_cache_lists[DBC_RECENT_GHOST]),
+	LIST_HEAD_INIT(delta_base_cache_lists[DBC_FREQUENT_GHOST]),
+};
+static size_t delta_base_cache_list_size[DBC_NR];
+/* the size the "recent" list is kept to, when it can */
+static size_t delta_base_cache_recent_target;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1210,9 +1453,12 @@ struct delta_base_cache_entry {
 	struct hashmap hash;
 	struct delta_base_cache_key key;
 	struct list_head lru;
-	void *data;
+	void *data;		/* NULL for a ghost */
 	unsigned long size;
 	enum object_type type;
+	unsigned int depth;	/* the number of deltas applied to get it */
+	enum delta_base_cache_list list;
+	unsigned int credit;	/* the second chances it has left */
 };
 
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
@@ -1224,8 +1470,9 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
+/* Return the entry of the base, even if it is a ghost. */
 static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
+find_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
 {
 	struct hashmap_entry entry;
 	struct delta_base_cache_key key;
@@ -1239,6 +1486,20 @@ get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
 	return hashmap_get(&delta_base_cache, &entry, &key);
 }
 
+static inline int is_delta_base_ghost(const struct delta_base_cache_entry *ent)
+{
+	return ent->list == DBC_RECENT_GHOST || ent->list == DBC_FREQUENT_GHOST;
+}
+
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
+{
+	struct delta_base_cache_entry *ent;
+
+	ent = find_delta_base_cache_entry(p, base_offset);
+	return ent && !is_delta_base_ghost(ent) ? ent : NULL;
+}
+
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
 				   const struct delta_base_cache_key *b)
 {
@@ -1262,6 +1523,16 @@ static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 	return !!get_delta_base_cache_entry(p, base_offset);
 }
 
+static void move_delta_base_cache_entry(struct delta_base_cache_entry *ent,
+					enum delta_base_cache_list list)
+{
+	delta_base_cache_list_size[ent->list] -= ent->size;
+	delta_base_cache_list_size[list] += ent->size;
+	ent->list = list;
+	list_del(&ent->lru);
+	list_add_tail(&ent->lru, &delta_base_cache_lists[list]);
+}
+
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
@@ -1271,7 +1542,9 @@ static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 {
 	hashmap_remove(&delta_base_cache, ent, &ent->key);
 	list_del(&ent->lru);
-	delta_base_cached -= ent->size;
+	delta_base_cache_list_size[ent->list] -= ent->size;
+	if (!is_delta_base_ghost(ent))
+		delta_base_cached -= ent->size;
 	free(ent);
 }
 
@@ -1284,6 +1557,9 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 	ent = get_delta_base_cache_entry(p, base_offset);
 	if (!ent)
 		return unpack_entry(r, p, base_offset, type, base_size);
+	trace2_counter_add("pack", "delta_base_cache/hit", 1);
+	if (delta_base_cache_policy == DELTA_BASE_CACHE_ARC)
+		move_delta_base_cache_entry(ent, DBC_FREQUENT);
 
 	if (type)
 		*type = ent->type;
@@ -1301,35 +1577,154 @@ static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
 void clear_delta_base_cache(void)
 {
 	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *entry =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+	int i;
+
+	for (i = 0; i < DBC_NR; i++) {
+		list_for_each_safe(lru, tmp, &delta_base_cache_lists[i]) {
+			struct delta_base_cache_entry *entry =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			release_delta_base_cache(entry);
+		}
 	}
+	delta_base_cache_recent_target = 0;
 }
 
-static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
-	void *base, unsigned long base_size, enum object_type type)
+static struct delta_base_cache_entry *
+first_delta_base_cache_entry(enum delta_base_cache_list list)
 {
-	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
-	struct list_head *lru, *tmp;
+	if (list_empty(&delta_base_cache_lists[list]))
+		return NULL;
+	return list_first_entry(&delta_base_cache_lists[list],
+				struct delta_base_cache_entry, lru);
+}
 
-	delta_base_cached += base_size;
+/*
+ * Evict bases until the cache is within its limit, and forget the
+ * oldest ghosts once the ghosts are about as large as the cache.
+ */
+static void shrink_delta_base_cache(void)
+{
+	size_t *size = delta_base_cache_list_size;
+	struct delta_base_cache_entry *ent;
+
+	while (delta_base_cached > delta_base_cache_limit) {
+		enum delta_base_cache_list list = DBC_FREQUENT;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
+		if (size[DBC_RECENT] &&
+		    (size[DBC_RECENT] > delta_base_cache_recent_target ||
+		     list_empty(&delta_base_cache_lists[DBC_FREQUENT])))
+			list = DBC_RECENT;
+		ent = first_delta_base_cache_entry(list);
+		if (!ent)
 			break;
-		release_delta_base_cache(f);
+		if (ent->credit) {
+			ent->credit--;
+			list_del(&ent->lru);
+			list_add_tail(&ent->lru, &delta_base_cache_lists[list]);
+			continue;
+		}
+
+		trace2_counter_add("pack", "delta_base_cache/evict", 1);
+		if (delta_base_cache_policy != DELTA_BASE_CACHE_ARC) {
+			release_delta_base_cache(ent);
+			continue;
+		}
+		FREE_AND_NULL(ent->data);
+		delta_base_cached -= ent->size;
+		move_delta_base_cache_entry(ent, list == DBC_RECENT ?
+					    DBC_RECENT_GHOST : DBC_FREQUENT_GHOST);
+	}
+
+	while (size[DBC_RECENT] + size[DBC_RECENT_GHOST] > delta_base_cache_limit &&
+	       (ent = first_delta_base_cache_entry(DBC_RECENT_GHOST)))
+		detach_delta_base_cache_entry(ent);
+	while (delta_base_cached + size[DBC_RECENT_GHOST] +
+	       size[DBC_FREQUENT_GHOST] > 2 * delta_base_cache_limit &&
+	       (ent = first_delta_base_cache_entry(DBC_FREQUENT_GHOST)))
+		detach_delta_base_cache_entry(ent);
+}
+
+/*
+ * A ghost was asked for again: had the list it was evicted from been
+ * larger, the base would still be there, so make that list larger, by
+ * more the smaller it is compared to the other.
+ */
+static void adapt_delta_base_cache(const struct delta_base_cache_entry *ghost)
+{
+	size_t *size = delta_base_cache_list_size;
+	size_t *target = &delta_base_cache_recent_target;
+	size_t delta = ghost->size;
+
+	if (ghost->list == DBC_RECENT_GHOST) {
+		if (size[DBC_FREQUENT_GHOST] > size[DBC_RECENT_GHOST])
+			delta = (double)delta * size[DBC_FREQUENT_GHOST] /
+				size[DBC_RECENT_GHOST];
+		*target = delta < delta_base_cache_limit - *target ?
+			  *target + delta : delta_base_cache_limit;
+	} else {
+		if (size[DBC_RECENT_GHOST] > size[DBC_FREQUENT_GHOST])
+			delta = (double)delta * size[DBC_RECENT_GHOST] /
+				size[DBC_FREQUENT_GHOST];
+		*target = delta < *target ? *target - delta : 0;
+	}
+}
+
+static unsigned int delta_base_credit(unsigned int depth)
+{
+	unsigned int credit = 0;
+
+	if (delta_base_cache_policy != DELTA_BASE_CACHE_ARC)
+		return 0;
+	while (depth && credit < DBC_MAX_CREDIT) {
+		credit++;
+		depth >>= 1;
+	}
+	return credit;
+}
+
+/*
+ * Add a base we got by applying "depth" deltas. "reused" is set when it
+ * came out of the cache in the first place.
+ */
+static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
+	void *base, unsigned long base_size, enum object_type type,
+	unsigned int depth, int reused)
+{
+	struct delta_base_cache_entry *ent;
+	enum delta_base_cache_list list = DBC_RECENT;
+
+	/*
+	 * Another thread may have unpacked and cached the same base while
+	 * we did not hold the object read lock.
+	 */
+	ent = find_delta_base_cache_entry(p, base_offset);
+	if (ent && !is_delta_base_ghost(ent)) {
+		free(base);
+		return;
+	}
+	if (ent) {
+		trace2_counter_add("pack", "delta_base_cache/ghost_hit", 1);
+		adapt_delta_base_cache(ent);
+		detach_delta_base_cache_entry(ent);
+		list = DBC_FREQUENT;
+	} else if (reused && delta_base_cache_policy == DELTA_BASE_CACHE_ARC) {
+		list = DBC_FREQUENT;
 	}
 
+	ent = xmalloc(sizeof(*ent));
+	delta_base_cached += base_size;
+	shrink_delta_base_cache();
+
 	ent->key.p = p;
 	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	ent->depth = depth;
+	ent->list = list;
+	ent->credit = delta_base_credit(depth);
+	list_add_tail(&ent->lru, &delta_base_cache_lists[list]);
+	delta_base_cache_list_size[list] += base_size;
 
 	if (!delta_base_cache.cmpfn)
 		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
@@ -1378,8 +1773,12 @@ int packed_object_info(struct repository *r, struct packed_git *p,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t pos;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+			type = OBJ_BAD;
+			goto out;
+		}
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep || oi->type_name) {
@@ -1431,10 +1830,24 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	int st;
 	git_zstream stream;
 	unsigned char *buffer, *in;
+	unsigned long avail;
 
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+	/*
+	 * The common case is that the whole stream sits in the current
+	 * window; inflate it in one go, and only go through the
+	 * git_zstream machinery when that fails.
+	 */
+	in = use_pack(p, w_curs, curpos, &avail);
+	obj_read_unlock();
+	st = git_inflate_buffer(buffer, size, in, avail, &avail);
+	obj_read_lock();
+	if (!st)
+		goto done;
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1443,7 +1856,13 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/*
+		 * The window stays mapped while w_curs holds it, so other
+		 * threads can read objects while we inflate.
+		 */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1454,9 +1873,12 @@ static void *unpack_compressed_entry(struct packed_git *p,
 		return NULL;
 	}
 
+done:
 	/* versions of zlib can clobber unconsumed portion of outbuf */
 	buffer[size] = '\0';
 
+	trace2_counter_add("pack", "inflated/objects", 1);
+	trace2_counter_add("pack", "inflated/bytes", size);
 	return buffer;
 }
 
@@ -1504,6 +1926,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	struct unpack_entry_stack_ent *delta_stack = small_delta_stack;
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
+	unsigned int depth = 0;
 
 	write_pack_access_log(p, obj_offset);
 
@@ -1515,20 +1938,30 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		ent = get_delta_base_cache_entry(p, curpos);
 		if (ent) {
+			trace2_counter_add("pack", "delta_base_cache/hit", 1);
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
+			depth = ent->depth;
 			detach_delta_base_cache_entry(ent);
 			base_from_cache = 1;
 			break;
 		}
+		trace2_counter_add("pack", "delta_base_cache/miss", 1);
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			off_t len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pack_pos, index_pos;
+			off_t len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pack_pos) < 0) {
+				data = NULL;
+				goto out;
+			}
+			len = pack_pos_to_offset(p, pack_pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pack_pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				struct object_id oid;
-				nth_packed_object_oid(&oid, p, revidx->nr);
+				nth_packed_object_oid(&oid, p, index_pos);
 				error("bad packed object CRC for %s",
 				      oid_to_hex(&oid));
 				mark_bad_packed_object(p, oid.hash);
@@ -1599,13 +2032,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		void *base = data;
 		void *external_base = NULL;
 		unsigned long delta_size, base_size = size;
+		off_t base_obj_offset = obj_offset;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -1613,11 +2044,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			struct object_id base_oid;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				nth_packed_object_oid(&base_oid, p, revidx->nr);
+			if (!offset_to_pack_pos(p, obj_offset, &pos)) {
+				nth_packed_object_oid(&base_oid, p,
+						      pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      oid_to_hex(&base_oid), (uintmax_t)obj_offset,
@@ -1643,24 +2074,35 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
-			free(external_base);
-			continue;
-		}
+		} else {
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
+			/*
+			 * We could not apply the delta; warn the user, but
+			 * keep going. Our failure will be noticed either in
+			 * the next iteration of the loop, or if this is the
+			 * final delta, in the caller when we return NULL.
+			 * Those code paths will take care of making a more
+			 * explicit warning and retrying with another copy of
+			 * the object.
+			 */
+			if (!data)
+				error("failed to apply delta");
+		}
 
 		/*
-		 * We could not apply the delta; warn the user, but keep going.
-		 * Our failure will be noticed either in the next iteration of
-		 * the loop, or if this is the final delta, in the caller when
-		 * we return NULL. Those code paths will take care of making
-		 * a more explicit warning and retrying with another copy of
-		 * the object.
+		 * The base only goes to the cache once we are done with
+		 * it: unpack_compressed_entry() lets go of the object read
+		 * lock, and another thread could evict and free it from
+		 * the cache meanwhile.
 		 */
-		if (!data)
-			error("failed to apply delta");
+		if (!external_base)
+			add_delta_base_cache(p, base_obj_offset, base, base_size,
+					     type, depth, base_from_cache);
+		base_from_cache = 0;
+		depth++;
 
 		free(delta_data);
 		free(external_base);
@@ -1856,21 +2298,158 @@ static int fill_pack_entry(const struct object_id *oid,
 int find_pack_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e)
 {
 	struct list_head *pos;
+	struct multi_pack_index *m;
 
 	prepare_packed_git(r);
 	if (!r->objects->packed_git)
 		return 0;
 
+	trace2_counter_add("pack", "find_pack_entry", 1);
+	for (m = r->objects->multi_pack_index; m; m = m->next) {
+		if (fill_midx_entry(oid, e, m))
+			return 1;
+	}
+
 	list_for_each(pos, &r->objects->packed_git_mru) {
 		struct packed_git *p = list_entry(pos, struct packed_git, mru);
-		if (fill_pack_entry(oid, e, p)) {
+		if (!p->multi_pack_index && fill_pack_entry(oid, e, p)) {
 			list_move(&p->mru, &r->objects->packed_git_mru);
 			return 1;
 		}
 	}
+	trace2_counter_add("pack", "find_pack_entry/miss", 1);
 	return 0;
 }
 
+size_t find_pack_entries(struct repository *r,
+			 const struct object_id *oids, size_t nr,
+			 unsigned char *found)
+{
+	struct packed_git *p;
+	struct multi_pack_index *m;
+	struct pack_entry e;
+	size_t i, left = 0;
+
+	for (i = 0; i < nr; i++)
+		if (!found[i])
+			left++;
+	prepare_packed_git(r);
+	if (!r->objects->packed_git)
+		return left;
+
+	trace2_counter_add("pack", "find_pack_entries", left);
+	for (m = r->objects->multi_pack_index; m && left; m = m->next)
+		for (i = 0; i < nr; i++)
+			if (!found[i] && fill_midx_entry(&oids[i], &e, m)) {
+				found[i] = 1;
+				left--;
+			}
+
+	for (p = r->objects->packed_git; p && left; p = p->next) {
+		if (p->multi_pack_index)
+			continue;
+		for (i = 0; i < nr; i++)
+			if (!found[i] && fill_pack_entry(&oids[i], &e, p)) {
+				found[i] = 1;
+				left--;
+			}
+	}
+	trace2_counter_add("pack", "find_pack_entries/miss", left);
+	return left;
+}
+
+/*
+ * How far past its start an object is read ahead when the reverse
+ * index of its pack is not loaded to tell where it ends, and how far
+ * apart the objects to read ahead may be to be read in one range.
+ */
+#define READAHEAD_SLACK (64 * 1024)
+#define READAHEAD_GAP (256 * 1024)
+
+struct readahead_range {
+	struct packed_git *p;
+	off_t start, end;
+};
+
+static int readahead_range_cmp(const void *a_, const void *b_)
+{
+	const struct readahead_range *a = a_, *b = b_;
+
+	if (a->p != b->p)
+		return strcmp(a->p->pack_name, b->p->pack_name);
+	if (a->start != b->start)
+		return a->start < b->start ? -1 : 1;
+	return 0;
+}
+
+static void readahead_pack_range(struct packed_git *p, off_t start, off_t end)
+{
+	struct pack_window *win;
+
+	if (end > p->pack_size)
+		end = p->pack_size;
+	trace2_counter_add("pack", "readahead/bytes", end - start);
+	for (win = p->windows; win; win = win->next) {
+		if (win->offset <= start && end <= win->offset + win->len) {
+#ifdef MADV_WILLNEED
+			size_t page = getpagesize();
+			size_t rel = (start - win->offset) / page * page;
+
+			madvise(win->base + rel, end - win->offset - rel,
+				MADV_WILLNEED);
+#endif
+			return;
+		}
+	}
+#ifdef POSIX_FADV_WILLNEED
+	if (p->pack_fd == -1 && open_packed_git(p))
+		return;
+	posix_fadvise(p->pack_fd, start, end - start, POSIX_FADV_WILLNEED);
+#endif
+}
+
+void readahead_packed_objects(struct repository *r,
+			      const struct oid_array *oids)
+{
+	struct readahead_range *ranges;
+	size_t i, nr = 0;
+
+	if (oids->nr < 2)
+		return;
+	ALLOC_ARRAY(ranges, oids->nr);
+	for (i = 0; i < oids->nr; i++) {
+		struct readahead_range *range = &ranges[nr];
+		struct pack_entry e;
+		uint32_t pos;
+
+		if (!find_pack_entry(r, &oids->oid[i], &e))
+			continue;
+		range->p = e.p;
+		range->start = e.offset;
+		if ((e.p->revindex || e.p->revindex_data) &&
+		    !offset_to_pack_pos(e.p, e.offset, &pos))
+			range->end = pack_pos_to_offset(e.p, pos + 1);
+		else
+			range->end = e.offset + READAHEAD_SLACK;
+		nr++;
+	}
+	QSORT(ranges, nr, readahead_range_cmp);
+
+	for (i = 0; i < nr; i++) {
+		struct readahead_range *range = &ranges[i];
+		off_t end = range->end;
+
+		while (i + 1 < nr && ranges[i + 1].p == range->p &&
+		       ranges[i + 1].start <= end + READAHEAD_GAP) {
+			i++;
+			if (end < ranges[i].end)
+				end = ranges[i].end;
+		}
+		readahead_pack_range(range->p, range->start, end);
+	}
+	free(ranges);
+}
+
 int has_object_pack(const struct object_id *oid)
 {
 	struct pack_entry e;
@@ -1933,12 +2512,12 @@ static int add_promisor_object(const struct object_id *oid,
 			       uint32_t pos,
 			       void *set_)
 {
-	struct oidset *set = set_;
+	struct compact_oidset *set = set_;
 	struct object *obj = parse_object(oid);
 	if (!obj)
 		return 1;
 
-	oidset_insert(set, oid);
+	compact_oidset_insert(set, oid);
 
 	/*
 	 * If this is a tree, commit, or tag, the objects it refers
@@ -1955,24 +2534,24 @@ static int add_promisor_object(const struct object_id *oid,
 			 */
 			return 0;
 		while (tree_entry_gently(&desc, &entry))
-			oidset_insert(set, entry.oid);
+			compact_oidset_insert(set, entry.oid);
 	} else if (obj->type == OBJ_COMMIT) {
 		struct commit *commit = (struct commit *) obj;
 		struct commit_list *parents = commit->parents;
 
-		oidset_insert(set, get_commit_tree_oid(commit));
+		compact_oidset_insert(set, get_commit_tree_oid(commit));
 		for (; parents; parents = parents->next)
-			oidset_insert(set, &parents->item->object.oid);
+			compact_oidset_insert(set, &parents->item->object.oid);
 	} else if (obj->type == OBJ_TAG) {
 		struct tag *tag = (struct tag *) obj;
-		oidset_insert(set, &tag->tagged->oid);
+		compact_oidset_insert(set, &tag->tagged->oid);
 	}
 	return 0;
 }
 
 int is_promisor_object(const struct object_id *oid)
 {
-	static struct oidset promisor_objects;
+	static struct compact_oidset promisor_objects;
 	static int promisor_objects_prepared;
 
 	if (!promisor_objects_prepared) {
@@ -1983,5 +2562,5 @@ int is_promisor_object(const struct object_id *oid)
 		}
 		promisor_objects_prepared = 1;
 	}
-	return oidset_contains(&promisor_objects, oid);
+	return compact_oidset_contains(&promisor_objects, oid);
 }
@@ -39,11 +39,22 @@ extern struct packed_git *parse_pack_index(unsigned char *sha1, const char *idx_
 #define PACKDIR_FILE_GARBAGE 4
 extern void (*report_garbage)(unsigned seen_bits, const char *path);
 
+typedef void each_file_in_pack_dir_fn(const char *full_path, size_t full_path_len,
+				      const char *file_name, void *data);
+/*
+ * Call "fn" for every file in "<objdir>/pack", passing both the full path
+ * and the basename of the file.
+ */
+void for_each_file_in_pack_dir(const char *objdir,
+			       each_file_in_pack_dir_fn fn,
+			       void *data);
+
 extern void reprepare_packed_git(struct repository *r);
 extern void install_packed_git(struct repository *r, struct packed_git *pack);
 
 struct packed_git *get_packed_git(struct repository *r);
 struct list_head *get_packed_git_mru(struct repository *r);
+struct multi_pack_index *get_multi_pack_index(struct repository *r);
 
 /*
  * Give a rough count of objects in the repository. This sacrifices accuracy
@@ -51,11 +62,35 @@ struct list_head *get_packed_git_mru(struct repository *r);
  */
 unsigned long approximate_object_count(void);
 
+/*
+ * Return the sorted names of the objects in the packs of "r" that no
+ * multi-pack-index covers, without duplicates, so that they can be
+ * searched at once rather than pack by pack. They are collected on
+ * the first call with "build" set; NULL is returned until then.
+ */
+struct oid_array *get_packed_object_names(struct repository *r, int build);
+void clear_packed_object_names(struct raw_object_store *o);
+
 extern struct packed_git *find_sha1_pack(const unsigned char *sha1,
 					 struct packed_git *packs);
 
 extern void pack_report(void);
 
+enum pack_access {
+	PACK_ACCESS_NORMAL = 0,
+	PACK_ACCESS_RANDOM,
+	PACK_ACCESS_SEQUENTIAL
+};
+
+/*
+ * Tell how packs are about to be read, so that their windows, those
+ * already mapped and those mapped from now on, get the matching
+ * madvise() hint: object lookups all over the packs, or a scan from
+ * start to end for which the data is read ahead. Return the previous
+ * setting, for the caller to restore when it is done.
+ */
+enum pack_access set_pack_access(enum pack_access access);
+
 /*
  * mmap the index file for the specified packfile (if it is not
  * already mmapped).  Return 0 on success.
@@ -126,6 +161,15 @@ extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsig
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
+/*
+ * Return the offset of the base of the delta of "type" at
+ * "delta_obj_offset", whose header ends at "curpos", and move "curpos"
+ * past the base reference. Return 0 if the base cannot be found.
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
+			    off_t *curpos, enum object_type type,
+			    off_t delta_obj_offset);
+
 extern void release_pack_memory(size_t);
 
 /* global flag to enable extra checks when accessing packed objects */
@@ -144,8 +188,31 @@ extern const struct packed_git *has_packed_and_bad(const unsigned char *sha1);
  */
 extern int find_pack_entry(struct repository *r, const struct object_id *oid, struct pack_entry *e);
 
+/*
+ * Like find_pack_entry() for each of the "nr" objects in "oids" whose
+ * "found" is still zero, setting it for those in a pack, but with the
+ * packs in the outer loop, so that the index of one pack stays in the
+ * cache while it is searched for all of them. Returns how many are
+ * left unfound.
+ */
+extern size_t find_pack_entries(struct repository *r,
+				const struct object_id *oids, size_t nr,
+				unsigned char *found);
+
 extern int has_object_pack(const struct object_id *oid);
 
+/*
+ * Ask the operating system to start reading the packed objects among
+ * "oids" from disk, which a caller that is about to read them all one
+ * after the other can call first so that reading the later ones
+ * overlaps with inflating the earlier ones. The objects are read ahead
+ * in the order of their offsets in their packs, in ranges that take in
+ * the small gaps between them. Does nothing where neither
+ * posix_fadvise() nor madvise() can tell that data will be needed.
+ */
+extern void readahead_packed_objects(struct repository *r,
+				     const struct oid_array *oids);
+
 extern int has_pack_index(const unsigned char *sha1);
 
 /*
@@ -0,0 +1,474 @@
+#include "cache.h"
+#include "config.h"
+#include "dir.h"
+#include "fsmonitor.h"
+#include "object-store.h"
+#include "parallel-checkout.h"
+#include "pkt-line.h"
+#include "run-command.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+struct parallel_checkout {
+	enum {
+		PC_UNINITIALIZED = 0,
+		PC_ACCEPTING_ENTRIES,
+		PC_RUNNING,
+	} status;
+	struct parallel_checkout_item *items;
+	size_t nr, alloc;
+};
+
+static struct parallel_checkout parallel_checkout;
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	if (git_config_get_int("checkout.workers", num_workers))
+		*num_workers = 1;
+	else if (*num_workers < 1)
+		*num_workers = online_cpus();
+
+	if (git_config_get_int("checkout.thresholdForParallelism", threshold))
+		*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		BUG("parallel checkout already initialized");
+
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		BUG("cannot finish parallel checkout: not initialized yet");
+
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
+					     const struct conv_attrs *ca)
+{
+	size_t packed_item_size;
+
+	if (!S_ISREG(ce->ce_mode))
+		return 0;
+
+	/*
+	 * Any filter driver (even one without a smudge command, which
+	 * may still be "required") runs in the main process; this also
+	 * keeps every entry that may be delayed out of the queue.
+	 */
+	if (ca->drv)
+		return 0;
+
+	packed_item_size = sizeof(struct pc_item_fixed_portion) + ce->ce_namelen +
+		(ca->working_tree_encoding ? strlen(ca->working_tree_encoding) : 0);
+	return packed_item_size <= LARGE_PACKET_DATA_MAX;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state)
+{
+	struct parallel_checkout_item *pc_item;
+	struct conv_attrs ca;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES ||
+	    state->base_dir_len)
+		return -1;
+
+	convert_attrs(&ca, ce->name);
+	if (!is_eligible_for_parallel_checkout(ce, &ca))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+
+	pc_item = &parallel_checkout.items[parallel_checkout.nr];
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->ce = ce;
+	pc_item->ca = ca;
+	pc_item->id = parallel_checkout.nr++;
+	return 0;
+}
+
+static int reset_fd(int fd, const char *path)
+{
+	if (lseek(fd, 0, SEEK_SET) != 0)
+		return error_errno("failed to rewind descriptor of '%s'", path);
+	if (ftruncate(fd, 0))
+		return error_errno("failed to truncate file '%s'", path);
+	return 0;
+}
+
+static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
+			       const char *path)
+{
+	int ret;
+	struct stream_filter *filter;
+	struct strbuf buf = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	char *blob;
+	ssize_t wrote;
+
+	filter = get_stream_filter_ca(&pc_item->ca, &pc_item->ce->oid);
+	if (filter) {
+		if (!stream_blob_to_fd(fd, &pc_item->ce->oid, filter, 1))
+			return 0;
+		/* Streaming failed; try again with the blob in memory. */
+		if (reset_fd(fd, path))
+			return -1;
+	}
+
+	blob = read_object_file(&pc_item->ce->oid, &type, &size);
+	if (!blob || type != OBJ_BLOB) {
+		free(blob);
+		return error("unable to read sha1 file of %s (%s)",
+			     path, oid_to_hex(&pc_item->ce->oid));
+	}
+
+	/*
+	 * Errors from convert are OK at this point: the entry has no
+	 * filter driver, so there is nothing "required" that could fail.
+	 */
+	ret = convert_to_working_tree_ca(&pc_item->ca, pc_item->ce->name,
+					 blob, size, &buf);
+	if (ret) {
+		size_t newsize;
+
+		free(blob);
+		blob = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	wrote = write_in_full(fd, blob, size);
+	free(blob);
+	if (wrote < 0)
+		return error("unable to write file '%s'", path);
+
+	return 0;
+}
+
+static int close_and_clear(int *fd)
+{
+	int ret = 0;
+
+	if (*fd >= 0) {
+		ret = close(*fd);
+		*fd = -1;
+	}
+	return ret;
+}
+
+void write_pc_item(struct parallel_checkout_item *pc_item)
+{
+	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
+	const char *path = pc_item->ce->name;
+	int fd, fstat_done = 0;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == ENOTDIR) {
+			/*
+			 * Another entry was written to the same path (or
+			 * to one of its leading directories) in the
+			 * meantime; let the main process sort it out.
+			 */
+			pc_item->status = PC_ITEM_COLLIDED;
+		} else {
+			error_errno("failed to open file '%s'", path);
+			pc_item->status = PC_ITEM_FAILED;
+		}
+		return;
+	}
+
+	if (write_pc_item_to_fd(pc_item, fd, path)) {
+		/* Error was already reported. */
+		pc_item->status = PC_ITEM_FAILED;
+		close_and_clear(&fd);
+		unlink(path);
+		return;
+	}
+
+	if (fstat_is_reliable())
+		fstat_done = !fstat(fd, &pc_item->st);
+
+	if (close_and_clear(&fd)) {
+		error_errno("unable to close file '%s'", path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+
+	if (!fstat_done && lstat(path, &pc_item->st) < 0) {
+		error_errno("unable to stat just-written file '%s'", path);
+		pc_item->status = PC_ITEM_FAILED;
+		return;
+	}
+
+	pc_item->status = PC_ITEM_WRITTEN;
+}
+
+static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
+{
+	size_t len_data;
+	char *data, *variant;
+	struct pc_item_fixed_portion *fixed_portion;
+	const char *working_tree_encoding = pc_item->ca.working_tree_encoding;
+	size_t name_len = pc_item->ce->ce_namelen;
+	size_t working_tree_encoding_len = working_tree_encoding ?
+					   strlen(working_tree_encoding) : 0;
+
+	len_data = sizeof(struct pc_item_fixed_portion) + name_len +
+		   working_tree_encoding_len;
+
+	data = xcalloc(1, len_data);
+
+	fixed_portion = (struct pc_item_fixed_portion *)data;
+	fixed_portion->id = pc_item->id;
+	oidcpy(&fixed_portion->oid, &pc_item->ce->oid);
+	fixed_portion->ce_mode = pc_item->ce->ce_mode;
+	fixed_portion->crlf_action = pc_item->ca.crlf_action;
+	fixed_portion->ident = pc_item->ca.ident;
+	fixed_portion->working_tree_encoding_len = working_tree_encoding_len;
+	fixed_portion->name_len = name_len;
+
+	variant = data + sizeof(*fixed_portion);
+	if (working_tree_encoding_len) {
+		memcpy(variant, working_tree_encoding, working_tree_encoding_len);
+		variant += working_tree_encoding_len;
+	}
+	memcpy(variant, pc_item->ce->name, name_len);
+
+	packet_write(fd, data, len_data);
+
+	free(data);
+}
+
+struct pc_worker {
+	struct child_process cp;
+	size_t next_item_to_complete, nr_items_to_complete;
+};
+
+static void setup_workers(struct pc_worker *workers, int num_workers)
+{
+	size_t base_batch_size, batch_beginning = 0;
+	int i;
+
+	/*
+	 * Give each worker a contiguous range of entries, so that files
+	 * in the same directory tend to be written by the same process.
+	 */
+	base_batch_size = parallel_checkout.nr / num_workers;
+
+	for (i = 0; i < num_workers; i++) {
+		struct pc_worker *worker = &workers[i];
+		struct child_process *cp = &worker->cp;
+		size_t batch_size = base_batch_size, j;
+
+		/* distribute the extra work evenly */
+		if (i < parallel_checkout.nr % num_workers)
+			batch_size++;
+
+		child_process_init(cp);
+		cp->git_cmd = 1;
+		cp->in = -1;
+		cp->out = -1;
+		cp->clean_on_exit = 1;
+		argv_array_push(&cp->args, "checkout--worker");
+
+		if (start_command(cp))
+			die(_("failed to spawn checkout worker"));
+
+		worker->next_item_to_complete = batch_beginning;
+		worker->nr_items_to_complete = batch_size;
+
+		for (j = batch_beginning; j < batch_beginning + batch_size; j++)
+			send_one_item(cp->in, &parallel_checkout.items[j]);
+		packet_flush(cp->in);
+
+		/* The worker reads everything before it writes anything. */
+		close(cp->in);
+		cp->in = -1;
+
+		batch_beginning += batch_size;
+	}
+}
+
+static void parse_and_save_result(const char *buffer, int len,
+				  struct pc_worker *worker)
+{
+	struct pc_item_result *res = (struct pc_item_result *)buffer;
+	struct parallel_checkout_item *pc_item;
+
+	if (len != sizeof(*res))
+		BUG("wrong result size from checkout worker (got %dB, exp %dB)",
+		    len, (int)sizeof(*res));
+
+	if (!worker->nr_items_to_complete)
+		BUG("received result from checkout worker that had no more items");
+
+	if (res->id != worker->next_item_to_complete)
+		BUG("unexpected item id from checkout worker (got %"PRIuMAX", exp %"PRIuMAX")",
+		    (uintmax_t)res->id, (uintmax_t)worker->next_item_to_complete);
+
+	pc_item = &parallel_checkout.items[res->id];
+	pc_item->status = res->status;
+	pc_item->st = res->st;
+
+	worker->next_item_to_complete++;
+	worker->nr_items_to_complete--;
+}
+
+static void gather_results_from_workers(struct pc_worker *workers,
+					int num_workers)
+{
+	int i, active_workers = num_workers;
+	struct pollfd *pfds;
+
+	ALLOC_ARRAY(pfds, num_workers);
+	for (i = 0; i < num_workers; i++) {
+		pfds[i].fd = workers[i].cp.out;
+		pfds[i].events = POLLIN;
+	}
+
+	while (active_workers) {
+		int nr = poll(pfds, num_workers, -1);
+
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("failed to poll checkout workers");
+		}
+
+		for (i = 0; i < num_workers && nr > 0; i++) {
+			struct pc_worker *worker = &workers[i];
+			struct pollfd *pfd = &pfds[i];
+			int len;
+
+			if (!pfd->revents)
+				continue;
+			nr--;
+
+			if (!(pfd->revents & (POLLIN | POLLHUP)))
+				die("unexpected event from checkout worker %d", i);
+
+			len = packet_read(pfd->fd, NULL, NULL, packet_buffer,
+					  sizeof(packet_buffer),
+					  PACKET_READ_GENTLE_ON_EOF);
+			if (len > 0) {
+				parse_and_save_result(packet_buffer, len, worker);
+				continue;
+			}
+
+			/*
+			 * A flush packet or the end of the stream: the
+			 * worker is done. Items that it did not report on
+			 * are left pending and counted as failures below.
+			 */
+			if (len < 0 || worker->nr_items_to_complete)
+				error("checkout worker %d finished before writing all of its entries", i);
+			pfd->fd = -1;
+			active_workers--;
+		}
+	}
+
+	free(pfds);
+}
+
+static int finish_workers(struct pc_worker *workers, int num_workers)
+{
+	int i, errs = 0;
+
+	for (i = 0; i < num_workers; i++) {
+		close(workers[i].cp.out);
+		if (finish_command(&workers[i].cp))
+			errs = 1;
+	}
+	return errs;
+}
+
+static int handle_results(struct checkout *state)
+{
+	int errs = 0;
+	size_t i;
+	int have_collisions = 0;
+
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+		struct cache_entry *ce = pc_item->ce;
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			if (state->refresh_cache) {
+				fill_stat_cache_info(ce, &pc_item->st);
+				ce->ce_flags |= CE_UPDATE_IN_BASE;
+				mark_fsmonitor_invalid(state->istate, ce);
+				state->istate->cache_changed |= CE_ENTRY_CHANGED;
+			}
+			break;
+		case PC_ITEM_COLLIDED:
+			have_collisions = 1;
+			break;
+		case PC_ITEM_PENDING:
+		case PC_ITEM_FAILED:
+			errs = 1;
+			break;
+		default:
+			BUG("unknown checkout item status in parallel checkout");
+		}
+	}
+
+	/*
+	 * Entries that collided on disk are written sequentially now,
+	 * exactly as "git checkout" without workers would have done
+	 * for the second of two such entries: by removing the file in
+	 * the way and writing the entry in its place.
+	 */
+	if (have_collisions) {
+		for (i = 0; i < parallel_checkout.nr; i++) {
+			struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+			if (pc_item->status == PC_ITEM_COLLIDED)
+				errs |= checkout_entry(pc_item->ce, state, NULL);
+		}
+	}
+
+	return errs;
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers, int threshold)
+{
+	int errs;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		BUG("cannot run parallel checkout: uninitialized or already running");
+
+	parallel_checkout.status = PC_RUNNING;
+
+	if (num_workers > parallel_checkout.nr)
+		num_workers = parallel_checkout.nr;
+
+	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
+		size_t i;
+
+		for (i = 0; i < parallel_checkout.nr; i++)
+			write_pc_item(&parallel_checkout.items[i]);
+		errs = 0;
+	} else {
+		struct pc_worker *workers = xcalloc(num_workers, sizeof(*workers));
+
+		setup_workers(workers, num_workers);
+		gather_results_from_workers(workers, num_workers);
+		errs = finish_workers(workers, num_workers);
+		free(workers);
+	}
+
+	errs |= handle_results(state);
+	finish_parallel_checkout();
+	return errs;
+}
@@ -0,0 +1,101 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+#include "convert.h"
+
+struct cache_entry;
+struct checkout;
+
+/****************************************************************
+ * Users of parallel checkout
+ ****************************************************************/
+
+/*
+ * Read checkout.workers and checkout.thresholdForParallelism. A
+ * "num_workers" of one means that checkout is done sequentially.
+ */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * Start accepting entries: from now on, checkout_entry() queues the
+ * regular files it would otherwise write itself, after it has removed
+ * whatever was in their way and created their leading directories.
+ */
+void init_parallel_checkout(void);
+
+/*
+ * Queue "ce" to be written by run_parallel_checkout(). Return 0 if it
+ * was queued, or -1 if it has to be checked out sequentially by the
+ * caller: because parallel checkout was not initialized, or because
+ * the entry is not a regular file whose conversion can be done without
+ * running an external filter.
+ */
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state);
+
+/*
+ * Write all queued entries, using up to "num_workers" worker processes
+ * if at least "threshold" entries were queued, and update their stat
+ * information in the index when "state" asks for it. Entries that
+ * collided with another one on disk (e.g. on a case-insensitive file
+ * system) are checked out again sequentially afterwards. Return 0 on
+ * success and non-zero if any entry could not be written.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers, int threshold);
+
+/****************************************************************
+ * Interface with checkout--worker
+ ****************************************************************/
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/*
+	 * The entry could not be written because there was another file
+	 * already present in its path or leading directories.
+	 */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED,
+};
+
+struct parallel_checkout_item {
+	/* pointer to a istate->cache[] entry. Not owned by us. */
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	size_t id; /* position in the main process' list of items */
+
+	/* Output fields, sent from workers. */
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * The fixed-size portion of an item sent to a checkout--worker; it is
+ * followed by the working tree encoding (if any) and the path.
+ */
+struct pc_item_fixed_portion {
+	size_t id;
+	struct object_id oid;
+	unsigned int ce_mode;
+	enum crlf_action crlf_action;
+	int ident;
+	size_t working_tree_encoding_len;
+	size_t name_len;
+};
+
+/*
+ * The fields of a parallel_checkout_item that are sent back to the main
+ * process. Workers run on the same machine, so "st" is passed as is.
+ */
+struct pc_item_result {
+	size_t id;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * Write "pc_item" to the working tree, setting its "status" and "st".
+ * The path must not exist, but its leading directories must.
+ */
+void write_pc_item(struct parallel_checkout_item *pc_item);
+
+#endif /* PARALLEL_CHECKOUT_H */
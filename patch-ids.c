@@ -3,6 +3,10 @@
 #include "commit.h"
 #include "sha1-lookup.h"
 #include "patch-ids.h"
+#include "config.h"
+#include "oidmap.h"
+#include "lockfile.h"
+#include "csum-file.h"
 
 static int patch_id_defined(struct commit *commit)
 {
@@ -25,6 +29,305 @@ int commit_patch_id(struct commit *commit, struct diff_options *options,
 	return diff_flush_patch_id(options, oid, diff_header_only);
 }
 
+#define PATCH_ID_CACHE_SIGNATURE 0x50494443 /* "PIDC" */
+#define PATCH_ID_CACHE_VERSION 1
+#define PATCH_ID_CACHE_OID_VERSION 1 /* SHA-1 */
+#define PATCH_ID_CACHE_FANOUT_SIZE (4 * 256)
+#define PATCH_ID_CACHE_HEADER_SIZE (20 + PATCH_ID_CACHE_FANOUT_SIZE)
+
+/*
+ * With core.patchIdCache, the patch-ids computed for commits are kept
+ * in $GIT_DIR/patch-id-cache. The file starts with the signature, one
+ * byte each of version and hash version, two bytes of padding, the
+ * number of entries and the eight bytes of diff options the ids were
+ * computed with. Then come a fanout table by the first byte of the
+ * commit names, the entries themselves (commit, header-only patch-id,
+ * full patch-id or zeroes when it was never needed), and a trailing
+ * checksum. All numbers are in network byte order.
+ *
+ * A file written with other diff options is ignored and replaced.
+ */
+
+struct patch_id_cache {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t nr;
+	const unsigned char *fanout;
+	const unsigned char *entries;
+	uint64_t options;
+	/* patch-ids computed by this process */
+	struct oidmap added;
+	int dirty;
+};
+
+struct cached_patch_id {
+	struct oidmap_entry entry;
+	struct object_id header_only;
+	struct object_id full;
+};
+
+static const char *patch_id_cache_path(void)
+{
+	return git_path("patch-id-cache");
+}
+
+static uint64_t patch_id_cache_options(struct diff_options *opt)
+{
+	return opt->xdl_opts;
+}
+
+static struct patch_id_cache *open_patch_id_cache(struct diff_options *opt)
+{
+	const char *path = patch_id_cache_path();
+	size_t rawsz = the_hash_algo->rawsz;
+	struct patch_id_cache *c;
+	const unsigned char *data;
+	struct stat st;
+	size_t len;
+	uint32_t nr;
+	int fd;
+
+	c = xcalloc(1, sizeof(*c));
+	c->options = patch_id_cache_options(opt);
+	oidmap_init(&c->added, 0);
+
+	fd = git_open(path);
+	if (fd < 0)
+		return c;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return c;
+	}
+	len = xsize_t(st.st_size);
+	if (len < PATCH_ID_CACHE_HEADER_SIZE + rawsz) {
+		close(fd);
+		return c;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	nr = get_be32(data + 8);
+	if (get_be32(data) != PATCH_ID_CACHE_SIGNATURE ||
+	    data[4] != PATCH_ID_CACHE_VERSION ||
+	    data[5] != PATCH_ID_CACHE_OID_VERSION ||
+	    (len - PATCH_ID_CACHE_HEADER_SIZE - rawsz) / (3 * rawsz) != nr ||
+	    (len - PATCH_ID_CACHE_HEADER_SIZE - rawsz) % (3 * rawsz) ||
+	    get_be32(data + 20 + 4 * 255) != nr) {
+		warning(_("ignoring corrupt patch-id cache %s"), path);
+		munmap((void *)data, len);
+		return c;
+	}
+	if (get_be64(data + 12) != c->options) {
+		/* computed with other diff options; rewrite it */
+		munmap((void *)data, len);
+		c->dirty = 1;
+		return c;
+	}
+
+	c->data = data;
+	c->data_len = len;
+	c->nr = nr;
+	c->fanout = data + 20;
+	c->entries = data + PATCH_ID_CACHE_HEADER_SIZE;
+	return c;
+}
+
+/*
+ * The cached ids are only valid for whole-tree diffs; a pathspec or an
+ * order file changes what goes into the patch-id.
+ */
+static struct patch_id_cache *usable_cache(struct patch_ids *ids)
+{
+	if (!ids->cache || ids->diffopts.pathspec.nr || ids->diffopts.orderfile)
+		return NULL;
+	return ids->cache;
+}
+
+static int lookup_cached_patch_id(struct patch_ids *ids,
+				  struct commit *commit,
+				  struct object_id *oid, int diff_header_only)
+{
+	struct patch_id_cache *c = usable_cache(ids);
+	size_t rawsz = the_hash_algo->rawsz;
+	struct cached_patch_id *e;
+	uint32_t pos;
+
+	if (!c)
+		return -1;
+	e = oidmap_get(&c->added, &commit->object.oid);
+	if (e) {
+		const struct object_id *id =
+			diff_header_only ? &e->header_only : &e->full;
+		if (!is_null_oid(id)) {
+			oidcpy(oid, id);
+			return 0;
+		}
+	}
+	if (!c->nr ||
+	    !bsearch_hash(commit->object.oid.hash, (const uint32_t *)c->fanout,
+			  c->entries, 3 * rawsz, &pos))
+		return -1;
+	oidclr(oid);
+	hashcpy(oid->hash, c->entries + (3 * pos + (diff_header_only ? 1 : 2)) * rawsz);
+	return is_null_oid(oid) ? -1 : 0;
+}
+
+static void cache_patch_id(struct patch_ids *ids, struct commit *commit,
+			   const struct object_id *oid, int diff_header_only)
+{
+	struct patch_id_cache *c = usable_cache(ids);
+	struct cached_patch_id *e;
+
+	if (!c)
+		return;
+	e = oidmap_get(&c->added, &commit->object.oid);
+	if (!e) {
+		e = xcalloc(1, sizeof(*e));
+		oidcpy(&e->entry.oid, &commit->object.oid);
+		oidmap_put(&c->added, e);
+	}
+	oidcpy(diff_header_only ? &e->header_only : &e->full, oid);
+	c->dirty = 1;
+}
+
+static int cached_patch_id_cmp(const void *a_, const void *b_)
+{
+	const struct cached_patch_id *a = *(const struct cached_patch_id **)a_;
+	const struct cached_patch_id *b = *(const struct cached_patch_id **)b_;
+
+	return oidcmp(&a->entry.oid, &b->entry.oid);
+}
+
+static void write_entry(struct hashfile *f, const unsigned char *commit,
+			const unsigned char *header_only,
+			const unsigned char *full)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+
+	hashwrite(f, commit, rawsz);
+	hashwrite(f, header_only, rawsz);
+	hashwrite(f, full, rawsz);
+}
+
+/* Merge the ids computed by this process into the file */
+static int write_patch_id_cache(struct patch_id_cache *c)
+{
+	const char *path = patch_id_cache_path();
+	size_t rawsz = the_hash_algo->rawsz;
+	struct lock_file lk = LOCK_INIT;
+	struct cached_patch_id **added;
+	struct cached_patch_id *e;
+	struct oidmap_iter iter;
+	struct hashfile *f;
+	uint32_t fanout[256];
+	uint32_t nr, i, j;
+	unsigned char hdr[4];
+	size_t added_nr = 0;
+
+	ALLOC_ARRAY(added, hashmap_get_size(&c->added.map));
+	oidmap_iter_init(&c->added, &iter);
+	while ((e = oidmap_iter_next(&iter)))
+		added[added_nr++] = e;
+	QSORT(added, added_nr, cached_patch_id_cmp);
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = j = nr = 0; i < c->nr || j < added_nr; nr++) {
+		const unsigned char *old = c->entries + i * 3 * rawsz;
+		int cmp;
+
+		if (i >= c->nr)
+			cmp = 1;
+		else if (j >= added_nr)
+			cmp = -1;
+		else
+			cmp = hashcmp(old, added[j]->entry.oid.hash);
+		if (cmp < 0) {
+			fanout[old[0]]++;
+			i++;
+			continue;
+		}
+		fanout[added[j++]->entry.oid.hash[0]]++;
+		if (!cmp)
+			i++;
+	}
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	if (hold_lock_file_for_update(&lk, path, 0) < 0) {
+		free(added);
+		return error_errno(_("unable to write patch-id cache %s"), path);
+	}
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+
+	hashwrite_be32(f, PATCH_ID_CACHE_SIGNATURE);
+	hdr[0] = PATCH_ID_CACHE_VERSION;
+	hdr[1] = PATCH_ID_CACHE_OID_VERSION;
+	hdr[2] = hdr[3] = 0;
+	hashwrite(f, hdr, sizeof(hdr));
+	hashwrite_be32(f, nr);
+	hashwrite_be32(f, c->options >> 32);
+	hashwrite_be32(f, c->options & 0xffffffff);
+	for (i = 0; i < 256; i++)
+		hashwrite_be32(f, fanout[i]);
+
+	for (i = j = 0; i < c->nr || j < added_nr; ) {
+		const unsigned char *old = c->entries + i * 3 * rawsz;
+		int cmp;
+
+		if (i >= c->nr)
+			cmp = 1;
+		else if (j >= added_nr)
+			cmp = -1;
+		else
+			cmp = hashcmp(old, added[j]->entry.oid.hash);
+		if (cmp < 0) {
+			write_entry(f, old, old + rawsz, old + 2 * rawsz);
+			i++;
+			continue;
+		}
+		e = added[j++];
+		if (!cmp) {
+			/* keep what the file knew and we did not compute */
+			write_entry(f, e->entry.oid.hash,
+				    is_null_oid(&e->header_only) ?
+				    old + rawsz : e->header_only.hash,
+				    is_null_oid(&e->full) ?
+				    old + 2 * rawsz : e->full.hash);
+			i++;
+		} else
+			write_entry(f, e->entry.oid.hash,
+				    e->header_only.hash, e->full.hash);
+	}
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+	free(added);
+	if (commit_lock_file(&lk) < 0)
+		return error_errno(_("unable to write patch-id cache %s"), path);
+	return 0;
+}
+
+static void close_patch_id_cache(struct patch_id_cache *c)
+{
+	if (!c)
+		return;
+	if (c->dirty)
+		write_patch_id_cache(c);
+	if (c->data)
+		munmap((void *)c->data, c->data_len);
+	oidmap_free(&c->added, 1);
+	free(c);
+}
+
+static int get_patch_id(struct patch_ids *ids, struct commit *commit,
+			struct object_id *oid, int diff_header_only)
+{
+	if (!lookup_cached_patch_id(ids, commit, oid, diff_header_only))
+		return 0;
+	if (commit_patch_id(commit, &ids->diffopts, oid, diff_header_only))
+		return -1;
+	cache_patch_id(ids, commit, oid, diff_header_only);
+	return 0;
+}
+
 /*
  * When we cannot load the full patch-id for both commits for whatever
  * reason, the function returns -1 (i.e. return error(...)). Despite
@@ -41,16 +344,16 @@ static int patch_id_cmp(const void *cmpfn_data,
 			const void *unused_keydata)
 {
 	/* NEEDSWORK: const correctness? */
-	struct diff_options *opt = (void *)cmpfn_data;
+	struct patch_ids *ids = (void *)cmpfn_data;
 	struct patch_id *a = (void *)entry;
 	struct patch_id *b = (void *)entry_or_key;
 
 	if (is_null_oid(&a->patch_id) &&
-	    commit_patch_id(a->commit, opt, &a->patch_id, 0))
+	    get_patch_id(ids, a->commit, &a->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&a->commit->object.oid));
 	if (is_null_oid(&b->patch_id) &&
-	    commit_patch_id(b->commit, opt, &b->patch_id, 0))
+	    get_patch_id(ids, b->commit, &b->patch_id, 0))
 		return error("Could not get patch ID for %s",
 			oid_to_hex(&b->commit->object.oid));
 	return oidcmp(&a->patch_id, &b->patch_id);
@@ -58,18 +361,24 @@ static int patch_id_cmp(const void *cmpfn_data,
 
 int init_patch_ids(struct patch_ids *ids)
 {
+	int use_cache = 0;
+
 	memset(ids, 0, sizeof(*ids));
 	diff_setup(&ids->diffopts);
 	ids->diffopts.detect_rename = 0;
 	ids->diffopts.flags.recursive = 1;
 	diff_setup_done(&ids->diffopts);
-	hashmap_init(&ids->patches, patch_id_cmp, &ids->diffopts, 256);
+	hashmap_init(&ids->patches, patch_id_cmp, ids, 256);
+	if (!git_config_get_bool("core.patchidcache", &use_cache) && use_cache)
+		ids->cache = open_patch_id_cache(&ids->diffopts);
 	return 0;
 }
 
 int free_patch_ids(struct patch_ids *ids)
 {
 	hashmap_free(&ids->patches, 1);
+	close_patch_id_cache(ids->cache);
+	ids->cache = NULL;
 	return 0;
 }
 
@@ -80,7 +389,7 @@ static int init_patch_id_entry(struct patch_id *patch,
 	struct object_id header_only_patch_id;
 
 	patch->commit = commit;
-	if (commit_patch_id(commit, &ids->diffopts, &header_only_patch_id, 1))
+	if (get_patch_id(ids, commit, &header_only_patch_id, 1))
 		return -1;
 
 	hashmap_entry_init(patch, sha1hash(header_only_patch_id.hash));
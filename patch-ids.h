@@ -7,9 +7,13 @@ struct patch_id {
 	struct commit *commit;
 };
 
+struct patch_id_cache;
+
 struct patch_ids {
 	struct hashmap patches;
 	struct diff_options diffopts;
+	/* ids kept across runs, with core.patchIdCache */
+	struct patch_id_cache *cache;
 };
 
 int commit_patch_id(struct commit *commit, struct diff_options *options,
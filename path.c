@@ -125,6 +125,7 @@ static struct common_dir common_list[] = {
 	{ 0, 0, 0, "config" },
 	{ 1, 0, 0, "gc.pid" },
 	{ 0, 0, 0, "packed-refs" },
+	{ 0, 0, 0, "packed-refs.delta" },
 	{ 0, 0, 0, "shallow" },
 	{ 0, 0, 0, NULL }
 };
@@ -37,7 +37,24 @@ void add_pathspec_matches_against_index(const struct pathspec *pathspec,
 		return;
 	for (i = 0; i < istate->cache_nr; i++) {
 		const struct cache_entry *ce = istate->cache[i];
+		int j;
+
 		ce_path_match(ce, pathspec, seen);
+		if (!S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+
+		/*
+		 * A path inside a sparse directory entry is in the index,
+		 * even though it is not spelled out.
+		 */
+		for (j = 0; j < pathspec->nr; j++) {
+			const struct pathspec_item *item = &pathspec->items[j];
+
+			if (!seen[j] &&
+			    item->nowildcard_len > ce_namelen(ce) &&
+			    !strncmp(item->match, ce->name, ce_namelen(ce)))
+				seen[j] = MATCHED_RECURSIVELY;
+		}
 	}
 }
 
@@ -526,6 +543,116 @@ static void NORETURN unsupported_magic(const char *pattern,
 	    pattern, sb.buf);
 }
 
+static int pathspec_key_cmp(const void *a_, const void *b_)
+{
+	const struct pathspec_key *a = a_, *b = b_;
+	int cmp = memcmp(a->key, b->key, a->len < b->len ? a->len : b->len);
+
+	if (cmp)
+		return cmp;
+	if (a->len != b->len)
+		return a->len < b->len ? -1 : 1;
+	return a->item - b->item;
+}
+
+static void prepare_pathspec_lookup(struct pathspec *pathspec)
+{
+	struct pathspec_lookup *l;
+	int i;
+
+	if (pathspec->nr < PATHSPEC_LOOKUP_MIN)
+		return;
+
+	l = pathspec->lookup = xcalloc(1, sizeof(*l));
+	ALLOC_ARRAY(l->literal, pathspec->nr);
+	ALLOC_ARRAY(l->wildcard, pathspec->nr);
+	ALLOC_ARRAY(l->rest, pathspec->nr);
+	ALLOC_ARRAY(l->not_literal, pathspec->nr);
+	for (i = 0; i < pathspec->nr; i++) {
+		const struct pathspec_item *item = &pathspec->items[i];
+		struct pathspec_key *k;
+
+		if ((item->magic & (PATHSPEC_ICASE | PATHSPEC_EXCLUDE)) ||
+		    item->attr_match_nr) {
+			l->rest[l->rest_nr++] = i;
+			l->not_literal[l->not_literal_nr++] = i;
+			continue;
+		}
+		if (item->nowildcard_len < item->len) {
+			l->not_literal[l->not_literal_nr++] = i;
+			k = &l->wildcard[l->wildcard_nr++];
+			k->len = item->nowildcard_len;
+			while (k->len && item->match[k->len - 1] != '/')
+				k->len--;
+		} else {
+			k = &l->literal[l->literal_nr++];
+			k->len = item->len;
+		}
+		if (k->len && item->match[k->len - 1] == '/')
+			k->len--;
+		k->key = item->match;
+		k->item = i;
+	}
+	QSORT(l->literal, l->literal_nr, pathspec_key_cmp);
+	QSORT(l->wildcard, l->wildcard_nr, pathspec_key_cmp);
+}
+
+static void clear_pathspec_lookup(struct pathspec *pathspec)
+{
+	struct pathspec_lookup *l = pathspec->lookup;
+
+	if (!l)
+		return;
+	free(l->literal);
+	free(l->wildcard);
+	free(l->rest);
+	free(l->not_literal);
+	FREE_AND_NULL(pathspec->lookup);
+}
+
+/*
+ * Compare "key" with "len" bytes of "s", saying that they are equal
+ * when "key" starts with them (unless "exact").
+ */
+static int key_cmp(const struct pathspec_key *key,
+		   const char *s, int len, int exact)
+{
+	int cmp = memcmp(key->key, s, key->len < len ? key->len : len);
+
+	if (cmp)
+		return cmp;
+	if (key->len < len)
+		return -1;
+	return exact && key->len > len;
+}
+
+int pathspec_key_range(const struct pathspec_key *keys, int nr,
+		       const char *s, int len, int exact, int *end)
+{
+	int lo = 0, hi = nr, first;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+
+		if (key_cmp(&keys[mi], s, len, exact) < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	first = lo;
+	hi = nr;
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+
+		if (key_cmp(&keys[mi], s, len, exact) <= 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	*end = lo;
+	return first;
+}
+
 void parse_pathspec(struct pathspec *pathspec,
 		    unsigned magic_mask, unsigned flags,
 		    const char *prefix, const char **argv)
@@ -612,6 +739,7 @@ void parse_pathspec(struct pathspec *pathspec,
 			BUG("PATHSPEC_MAXDEPTH_VALID and PATHSPEC_KEEP_ORDER are incompatible");
 		QSORT(pathspec->items, pathspec->nr, pathspec_item_cmp);
 	}
+	prepare_pathspec_lookup(pathspec);
 }
 
 void copy_pathspec(struct pathspec *dst, const struct pathspec *src)
@@ -638,6 +766,8 @@ void copy_pathspec(struct pathspec *dst, const struct pathspec *src)
 
 		d->attr_check = attr_check_dup(s->attr_check);
 	}
+	dst->lookup = NULL;
+	prepare_pathspec_lookup(dst);
 }
 
 void clear_pathspec(struct pathspec *pathspec)
@@ -658,4 +788,5 @@ void clear_pathspec(struct pathspec *pathspec)
 
 	FREE_AND_NULL(pathspec->items);
 	pathspec->nr = 0;
+	clear_pathspec_lookup(pathspec);
 }
@@ -46,8 +46,59 @@ struct pathspec {
 		} *attr_match;
 		struct attr_check *attr_check;
 	} *items;
+	/* see pathspec_lookup below; NULL for short pathspecs */
+	struct pathspec_lookup *lookup;
 };
 
+/*
+ * With many items, matching a path against each of them in turn is
+ * what costs most, so parse_pathspec() sorts the items by a key that
+ * a matching path has to start with, and the matchers look the few
+ * candidates up with a binary search for the path and each of its
+ * leading directories instead:
+ *
+ *  - a literal item is keyed by its whole "match", without its
+ *    trailing slash, if any;
+ *
+ *  - an item with wildcards is keyed by the leading directories of
+ *    the part before its first wildcard (the empty string if there
+ *    are none); tree_entry_interesting() still tries them in turn.
+ *
+ * Items with :(icase), :(exclude) or :(attr) magic are always tried
+ * in turn, and so is every item when a maximum depth is in effect.
+ */
+#define PATHSPEC_LOOKUP_MIN 16
+
+struct pathspec_key {
+	const char *key;
+	int len;
+	int item;
+};
+
+struct pathspec_lookup {
+	struct pathspec_key *literal, *wildcard;
+	int literal_nr, wildcard_nr;
+	/* indices of the items tried in turn, in increasing order */
+	int *rest, rest_nr;
+	/* the same, with the items with wildcards */
+	int *not_literal, not_literal_nr;
+};
+
+/*
+ * Return the position of the first of the "nr" sorted "keys" that
+ * starts with "len" bytes of "s" (or would, if there is none), and
+ * set "*end" past the last one. With "exact", only the keys equal to
+ * "s" are considered.
+ */
+extern int pathspec_key_range(const struct pathspec_key *keys, int nr,
+			      const char *s, int len, int exact, int *end);
+
+static inline int pathspec_use_lookup(const struct pathspec *ps)
+{
+	return ps->lookup &&
+		!((ps->magic & PATHSPEC_MAXDEPTH) && ps->max_depth != -1);
+}
+
 #define GUARD_PATHSPEC(ps, mask) \
 	do { \
 		if ((ps)->magic & ~(mask))	       \
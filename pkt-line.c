@@ -231,6 +231,52 @@ void packet_buf_write_len(struct strbuf *buf, const char *data, size_t len)
 	packet_trace(data, len, 1);
 }
 
+static void packet_batch_maybe_send(struct packet_batch *batch)
+{
+	if (batch->buf.len >= PACKET_BATCH_SIZE)
+		packet_batch_send(batch);
+}
+
+void packet_batch_write(struct packet_batch *batch, const char *buf, size_t size)
+{
+	if (size > LARGE_PACKET_MAX - 4)
+		die("packet write failed - data exceeds max packet size");
+	packet_buf_write_len(&batch->buf, buf, size);
+	packet_batch_maybe_send(batch);
+}
+
+void packet_batch_write_fmt(struct packet_batch *batch, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	format_packet(&batch->buf, fmt, args);
+	va_end(args);
+	packet_batch_maybe_send(batch);
+}
+
+void packet_batch_send(struct packet_batch *batch)
+{
+	if (!batch->buf.len)
+		return;
+	if (write_in_full(batch->fd, batch->buf.buf, batch->buf.len) < 0) {
+		check_pipe(errno);
+		die_errno("packet write failed");
+	}
+	strbuf_reset(&batch->buf);
+}
+
+void packet_batch_flush(struct packet_batch *batch)
+{
+	packet_buf_flush(&batch->buf);
+	packet_batch_send(batch);
+}
+
+void packet_batch_release(struct packet_batch *batch)
+{
+	strbuf_release(&batch->buf);
+}
+
 int write_packetized_from_fd(int fd_in, int fd_out)
 {
 	static char buf[LARGE_PACKET_DATA_MAX];
@@ -32,6 +32,34 @@ int packet_write_fmt_gently(int fd, const char *fmt, ...) __attribute__((format
 int write_packetized_from_fd(int fd_in, int fd_out);
 int write_packetized_from_buf(const char *src_in, size_t len, int fd_out);
 
+/*
+ * A packet_batch collects packets for "fd" and writes them out in one
+ * write() once PACKET_BATCH_SIZE bytes are pending, or when asked to,
+ * instead of one write() per packet. Whatever is pending must be sent
+ * before reading a reply to it, with packet_batch_send(), or with
+ * packet_batch_flush(), which ends it with a flush packet first.
+ *
+ *	struct packet_batch out = PACKET_BATCH_INIT(1);
+ *
+ *	for_each_ref(...)
+ *		packet_batch_write_fmt(&out, "%s %s\n", ...);
+ *	packet_batch_flush(&out);
+ *	packet_batch_release(&out);
+ */
+struct packet_batch {
+	int fd;
+	struct strbuf buf;
+};
+#define PACKET_BATCH_INIT(fd) { (fd), STRBUF_INIT }
+#define PACKET_BATCH_SIZE (64 * 1024)
+
+void packet_batch_write(struct packet_batch *batch, const char *buf, size_t size);
+void packet_batch_write_fmt(struct packet_batch *batch, const char *fmt, ...)
+	__attribute__((format (printf, 2, 3)));
+void packet_batch_send(struct packet_batch *batch);
+void packet_batch_flush(struct packet_batch *batch);
+void packet_batch_release(struct packet_batch *batch);
+
 /*
  * Read a packetized line into the buffer, which must be at least size bytes
  * long. The return value specifies the number of bytes read into the buffer.
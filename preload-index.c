@@ -5,10 +5,15 @@
 #include "pathspec.h"
 #include "dir.h"
 #include "fsmonitor.h"
+#include "trace2.h"
+#include "convert.h"
+#include "object-store.h"
+#include "blob.h"
 
 #ifdef NO_PTHREADS
 static void preload_index(struct index_state *index,
-			  const struct pathspec *pathspec)
+			  const struct pathspec *pathspec,
+			  unsigned int flags)
 {
 	; /* nothing */
 }
@@ -25,12 +30,131 @@ static void preload_index(struct index_state *index,
 #define MAX_PARALLEL (20)
 #define THREAD_COST (500)
 
+/*
+ * An entry whose stat information does not match its file may still
+ * have the same contents, as after a build step touched every file.
+ * When the caller is about to refresh the index, the threads collect
+ * such entries, whose size matches (or was never recorded), so that
+ * their contents are hashed in parallel as well, instead of one at a
+ * time by refresh_index().
+ */
+struct content_check {
+	int pos;
+	unsigned racy:1, clean:1;
+	struct stat st;
+};
+
 struct thread_data {
 	pthread_t pthread;
 	struct index_state *index;
 	struct pathspec pathspec;
 	int offset, nr;
+	int check_contents;
+	struct content_check *check;
+	int check_nr, check_alloc;
+};
+
+/*
+ * With core.bulkStat, every thread keeps the leading directories of the
+ * entry it looked at last open, and stats entries relative to their
+ * directory: the kernel then looks up a single path component per
+ * entry instead of every component from the top of the work tree, and
+ * opens each directory once since the index is sorted.
+ */
+struct dir_fd_stack {
+	struct strbuf path; /* the directories that are open, with a trailing slash */
+	struct dir_fd {
+		int fd;
+		size_t len; /* of "path" up to and including this directory */
+	} *dirs;
+	int nr, alloc;
 };
+#define DIR_FD_STACK_INIT { STRBUF_INIT, NULL, 0, 0 }
+
+#ifdef HAVE_OPENAT
+static void dir_fd_stack_clear(struct dir_fd_stack *stack)
+{
+	while (stack->nr)
+		close(stack->dirs[--stack->nr].fd);
+	FREE_AND_NULL(stack->dirs);
+	stack->alloc = 0;
+	strbuf_release(&stack->path);
+}
+
+static int dir_lstat(struct dir_fd_stack *stack, const char *name,
+		     struct stat *st)
+{
+	const char *slash;
+	size_t dirlen;
+
+	if (!core_bulk_stat)
+		return lstat(name, st);
+
+	slash = strrchr(name, '/');
+	dirlen = slash ? slash - name + 1 : 0;
+
+	/* Close the directories that do not lead to "name"... */
+	while (stack->nr) {
+		struct dir_fd *d = &stack->dirs[stack->nr - 1];
+
+		if (d->len <= dirlen && !memcmp(stack->path.buf, name, d->len))
+			break;
+		close(d->fd);
+		stack->nr--;
+	}
+	strbuf_setlen(&stack->path, stack->nr ? stack->dirs[stack->nr - 1].len : 0);
+
+	/* ...and open the ones that do, one component at a time. */
+	while (stack->path.len < dirlen) {
+		const char *comp = name + stack->path.len;
+		const char *end = memchr(comp, '/', name + dirlen - comp);
+		char *comp_name = xmemdupz(comp, end - comp);
+		int fd;
+
+		/*
+		 * Do not follow symbolic links; lstat() below reports what
+		 * is in the way of the entry, if anything.
+		 */
+		fd = openat(stack->nr ? stack->dirs[stack->nr - 1].fd : AT_FDCWD,
+			    comp_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+		free(comp_name);
+		if (fd < 0)
+			return lstat(name, st);
+
+		strbuf_add(&stack->path, comp, end - comp + 1);
+		ALLOC_GROW(stack->dirs, stack->nr + 1, stack->alloc);
+		stack->dirs[stack->nr].fd = fd;
+		stack->dirs[stack->nr].len = stack->path.len;
+		stack->nr++;
+	}
+
+	return fstatat(stack->nr ? stack->dirs[stack->nr - 1].fd : AT_FDCWD,
+		       name + dirlen, st, AT_SYMLINK_NOFOLLOW);
+}
+#else
+static void dir_fd_stack_clear(struct dir_fd_stack *stack)
+{
+	; /* nothing */
+}
+
+static int dir_lstat(struct dir_fd_stack *stack, const char *name,
+		     struct stat *st)
+{
+	return lstat(name, st);
+}
+#endif
+
+static int may_have_same_contents(const struct cache_entry *ce,
+				  const struct stat *st, int changed)
+{
+	if (!S_ISREG(ce->ce_mode) || !S_ISREG(st->st_mode))
+		return 0;
+	if (changed & (MODE_CHANGED | TYPE_CHANGED))
+		return 0;
+	/* a size of zero was never filled in, see ie_modified() */
+	return !ce->ce_stat_data.sd_size ||
+		ce->ce_stat_data.sd_size == (unsigned int)st->st_size;
+}
 
 static void *preload_thread(void *_data)
 {
@@ -39,7 +163,10 @@ static void *preload_thread(void *_data)
 	struct index_state *index = p->index;
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
+	struct dir_fd_stack dirs = DIR_FD_STACK_INIT;
+	uint64_t nr_lstat = 0;
 
+	trace2_thread_start("preload_thread");
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
 		nr = index->cache_nr - p->offset;
@@ -47,6 +174,7 @@ static void *preload_thread(void *_data)
 	do {
 		struct cache_entry *ce = *cep++;
 		struct stat st;
+		int changed;
 
 		if (ce_stage(ce))
 			continue;
@@ -62,19 +190,145 @@ static void *preload_thread(void *_data)
 			continue;
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
-		if (lstat(ce->name, &st))
+		nr_lstat++;
+		if (dir_lstat(&dirs, ce->name, &st))
 			continue;
-		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		changed = ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR);
+		if (changed) {
+			if (p->check_contents &&
+			    may_have_same_contents(ce, &st, changed)) {
+				struct content_check *c;
+
+				ALLOC_GROW(p->check, p->check_nr + 1, p->check_alloc);
+				c = &p->check[p->check_nr++];
+				c->pos = cep - 1 - index->cache;
+				/* only racily clean, see ie_match_stat() */
+				c->racy = changed == DATA_CHANGED &&
+					ce->ce_stat_data.sd_size == (unsigned int)st.st_size;
+				c->clean = 0;
+				c->st = st;
+			}
 			continue;
+		}
 		ce_mark_uptodate(ce);
 		mark_fsmonitor_valid(ce);
 	} while (--nr > 0);
 	cache_def_clear(&cache);
+	dir_fd_stack_clear(&dirs);
+	trace2_counter_add("index", "preload/lstat", nr_lstat);
+	trace2_thread_exit();
+	return NULL;
+}
+
+struct hash_data {
+	pthread_t pthread;
+	struct index_state *index;
+	struct content_check *check;
+	int nr;
+};
+
+static int same_contents(const struct cache_entry *ce, struct stat *st)
+{
+	size_t size = xsize_t(st->st_size);
+	struct object_id oid;
+	void *buf = NULL;
+	int fd, ret;
+
+	fd = open(ce->name, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (size)
+		buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED)
+		return 0;
+	ret = !hash_object_file(size ? buf : "", size, blob_type, &oid) &&
+		!oidcmp(&oid, &ce->oid);
+	if (size)
+		munmap(buf, size);
+	return ret;
+}
+
+static void *hash_thread(void *_data)
+{
+	struct hash_data *p = _data;
+	int i;
+
+	trace2_thread_start("preload_hash");
+	for (i = 0; i < p->nr; i++) {
+		struct content_check *c = &p->check[i];
+
+		c->clean = same_contents(p->index->cache[c->pos], &c->st);
+	}
+	trace2_counter_add("index", "preload/hash", p->nr);
+	trace2_thread_exit();
 	return NULL;
 }
 
+/*
+ * Hash the contents of the entries the threads of preload_index()
+ * collected, and refresh those that turn out to be unchanged. Files
+ * that would go through conversions are left to refresh_index(): the
+ * attribute lookups and the filters that decide them are not
+ * thread-safe, and the raw contents are what is hashed here.
+ */
+static void check_contents(struct index_state *index,
+			   struct thread_data *data, int threads)
+{
+	struct hash_data hash_data[MAX_PARALLEL];
+	struct content_check *check = NULL;
+	int nr = 0, alloc = 0, work, i, j;
+
+	for (i = 0; i < threads; i++) {
+		struct thread_data *p = data+i;
+
+		for (j = 0; j < p->check_nr; j++) {
+			const char *name = index->cache[p->check[j].pos]->name;
+
+			if (would_convert_to_git(index, name))
+				continue;
+			ALLOC_GROW(check, nr + 1, alloc);
+			check[nr++] = p->check[j];
+		}
+		FREE_AND_NULL(p->check);
+	}
+	if (!nr)
+		return;
+
+	work = DIV_ROUND_UP(nr, threads);
+	threads = DIV_ROUND_UP(nr, work);
+	for (i = 0; i < threads; i++) {
+		struct hash_data *p = hash_data+i;
+
+		p->index = index;
+		p->check = check + i * work;
+		p->nr = i < threads - 1 ? work : nr - i * work;
+		if (pthread_create(&p->pthread, NULL, hash_thread, p))
+			die("unable to create threaded hashing");
+	}
+	for (i = 0; i < threads; i++)
+		if (pthread_join(hash_data[i].pthread, NULL))
+			die("unable to join threaded hashing");
+
+	for (i = 0; i < nr; i++) {
+		struct content_check *c = &check[i];
+
+		if (!c->clean)
+			continue;
+		if (c->racy) {
+			struct cache_entry *ce = index->cache[c->pos];
+
+			ce_mark_uptodate(ce);
+			mark_fsmonitor_valid(ce);
+		} else
+			refresh_index_entry_at(index, c->pos, &c->st);
+	}
+	free(check);
+}
+
 static void preload_index(struct index_state *index,
-			  const struct pathspec *pathspec)
+			  const struct pathspec *pathspec,
+			  unsigned int flags)
 {
 	int threads, i, work, offset;
 	struct thread_data data[MAX_PARALLEL];
@@ -86,16 +340,25 @@ static void preload_index(struct index_state *index,
 	threads = index->cache_nr / THREAD_COST;
 	if ((index->cache_nr > 1) && (threads < 2) && getenv("GIT_FORCE_PRELOAD_TEST"))
 		threads = 2;
-	if (threads < 2)
-		return;
+	if (threads < 2) {
+		/*
+		 * Even on a single thread, stat'ing relative to directories
+		 * beats the lstat() of each entry in refresh_index().
+		 */
+		if (!core_bulk_stat || !index->cache_nr)
+			return;
+		threads = 1;
+	}
 	if (threads > MAX_PARALLEL)
 		threads = MAX_PARALLEL;
+	trace2_region_enter("index", "preload");
 	offset = 0;
 	work = DIV_ROUND_UP(index->cache_nr, threads);
 	memset(&data, 0, sizeof(data));
 	for (i = 0; i < threads; i++) {
 		struct thread_data *p = data+i;
 		p->index = index;
+		p->check_contents = flags & PRELOAD_REFRESH;
 		if (pathspec)
 			copy_pathspec(&p->pathspec, pathspec);
 		p->offset = offset;
@@ -109,15 +372,18 @@ static void preload_index(struct index_state *index,
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
 	}
+	check_contents(index, data, threads);
+	trace2_region_leave("index", "preload");
 	trace_performance_since(start, "preload index");
 }
 #endif
 
 int read_index_preload(struct index_state *index,
-		       const struct pathspec *pathspec)
+		       const struct pathspec *pathspec,
+		       unsigned int flags)
 {
 	int retval = read_index(index);
 
-	preload_index(index, pathspec);
+	preload_index(index, pathspec, flags);
 	return retval;
 }
@@ -14,6 +14,17 @@
 #include "trailer.h"
 
 static char *user_format;
+
+/*
+ * The offsets of the '%' in user_format, found once when it is first
+ * used instead of for every commit it is expanded for.
+ */
+static struct {
+	size_t *percent;
+	size_t nr, alloc, len;
+	int compiled;
+} user_template;
+
 static struct cmt_fmt_map {
 	const char *name;
 	enum cmit_fmt format;
@@ -36,6 +47,8 @@ static void save_user_format(struct rev_info *rev, const char *cp, int is_tforma
 {
 	free(user_format);
 	user_format = xstrdup(cp);
+	user_template.nr = 0;
+	user_template.compiled = 0;
 	if (is_tformat)
 		rev->use_terminator = 1;
 	rev->commit_format = CMIT_FMT_USERFORMAT;
@@ -557,10 +570,11 @@ static void add_merge_info(const struct pretty_print_context *pp,
 	strbuf_addch(sb, '\n');
 }
 
-static char *get_header(const char *msg, const char *key)
+static char *get_encoding_header(const struct commit *commit, const char *msg)
 {
 	size_t len;
-	const char *v = find_commit_header(msg, key, &len);
+	const char *v = find_commit_header_cached(commit, msg,
+						  COMMIT_HEADER_ENCODING, &len);
 	return v ? xmemdupz(v, len) : NULL;
 }
 
@@ -607,10 +621,10 @@ const char *logmsg_reencode(const struct commit *commit,
 
 	if (!output_encoding || !*output_encoding) {
 		if (commit_encoding)
-			*commit_encoding = get_header(msg, "encoding");
+			*commit_encoding = get_encoding_header(commit, msg);
 		return msg;
 	}
-	encoding = get_header(msg, "encoding");
+	encoding = get_encoding_header(commit, msg);
 	if (commit_encoding)
 		*commit_encoding = encoding;
 	use_encoding = encoding ? encoding : utf8;
@@ -674,23 +688,23 @@ static int mailmap_name(const char **email, size_t *email_len,
 	return mail_map->nr && map_user(mail_map, email, email_len, name, name_len);
 }
 
+/* "s" is NULL if the ident could not be split */
 static size_t format_person_part(struct strbuf *sb, char part,
-				 const char *msg, int len,
+				 const struct ident_split *s,
 				 const struct date_mode *dmode)
 {
 	/* currently all placeholders have same length */
 	const int placeholder_len = 2;
-	struct ident_split s;
 	const char *name, *mail;
 	size_t maillen, namelen;
 
-	if (split_ident_line(&s, msg, len) < 0)
+	if (!s)
 		goto skip;
 
-	name = s.name_begin;
-	namelen = s.name_end - s.name_begin;
-	mail = s.mail_begin;
-	maillen = s.mail_end - s.mail_begin;
+	name = s->name_begin;
+	namelen = s->name_end - s->name_begin;
+	mail = s->mail_begin;
+	maillen = s->mail_end - s->mail_begin;
 
 	if (part == 'N' || part == 'E') /* mailmap lookup */
 		mailmap_name(&mail, &maillen, &name, &namelen);
@@ -703,29 +717,29 @@ static size_t format_person_part(struct strbuf *sb, char part,
 		return placeholder_len;
 	}
 
-	if (!s.date_begin)
+	if (!s->date_begin)
 		goto skip;
 
 	if (part == 't') {	/* date, UNIX timestamp */
-		strbuf_add(sb, s.date_begin, s.date_end - s.date_begin);
+		strbuf_add(sb, s->date_begin, s->date_end - s->date_begin);
 		return placeholder_len;
 	}
 
 	switch (part) {
 	case 'd':	/* date */
-		strbuf_addstr(sb, show_ident_date(&s, dmode));
+		strbuf_addstr(sb, show_ident_date(s, dmode));
 		return placeholder_len;
 	case 'D':	/* date, RFC2822 style */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(RFC2822)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(RFC2822)));
 		return placeholder_len;
 	case 'r':	/* date, relative */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(RELATIVE)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(RELATIVE)));
 		return placeholder_len;
 	case 'i':	/* date, ISO 8601-like */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(ISO8601)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(ISO8601)));
 		return placeholder_len;
 	case 'I':	/* date, ISO 8601 strict */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_MODE(ISO8601_STRICT)));
+		strbuf_addstr(sb, show_ident_date(s, DATE_MODE(ISO8601_STRICT)));
 		return placeholder_len;
 	}
 
@@ -783,6 +797,10 @@ struct format_commit_context {
 	size_t subject_off;
 	size_t body_off;
 
+	/* split on first use, see split_person() */
+	struct ident_split author_ident, committer_ident;
+	int author_split, committer_split;
+
 	/* The following ones are relative to the result struct strbuf. */
 	size_t wrap_start;
 };
@@ -790,8 +808,22 @@ struct format_commit_context {
 static void parse_commit_header(struct format_commit_context *context)
 {
 	const char *msg = context->message;
+	const struct commit_header_offsets *o = NULL;
 	int i;
 
+	/* the offsets only hold for the message as it is in the object */
+	if (msg == get_cached_commit_buffer(context->commit, NULL))
+		o = commit_header_offsets(context->commit, msg);
+	if (o) {
+		context->author.off = o->off[COMMIT_HEADER_AUTHOR];
+		context->author.len = o->len[COMMIT_HEADER_AUTHOR];
+		context->committer.off = o->off[COMMIT_HEADER_COMMITTER];
+		context->committer.len = o->len[COMMIT_HEADER_COMMITTER];
+		context->message_off = o->end;
+		context->commit_header_parsed = 1;
+		return;
+	}
+
 	for (i = 0; msg[i]; i++) {
 		const char *name;
 		int eol;
@@ -813,6 +845,22 @@ static void parse_commit_header(struct format_commit_context *context)
 	context->commit_header_parsed = 1;
 }
 
+/*
+ * Split the ident of "person" in the commit header the first time one of
+ * its placeholders is expanded, and return NULL if it is bogus. "state"
+ * is 0 until then, and afterwards 1 or -1 depending on the outcome.
+ */
+static const struct ident_split *split_person(const char *msg,
+					      const struct chunk *person,
+					      struct ident_split *ident,
+					      int *state)
+{
+	if (!*state)
+		*state = split_ident_line(ident, msg + person->off,
+					  person->len) < 0 ? -1 : 1;
+	return *state > 0 ? ident : NULL;
+}
+
 static int istitlechar(char c)
 {
 	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
@@ -920,6 +968,7 @@ static int format_reflog_person(struct strbuf *sb,
 				struct reflog_walk_info *log,
 				const struct date_mode *dmode)
 {
+	struct ident_split s;
 	const char *ident;
 
 	if (!log)
@@ -929,7 +978,9 @@ static int format_reflog_person(struct strbuf *sb,
 	if (!ident)
 		return 2;
 
-	return format_person_part(sb, part, ident, strlen(ident), dmode);
+	return format_person_part(sb, part,
+				  split_ident_line(&s, ident, strlen(ident)) < 0 ?
+				  NULL : &s, dmode);
 }
 
 static size_t parse_color(struct strbuf *sb, /* in UTF-8 */
@@ -1270,11 +1321,14 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 	switch (placeholder[0]) {
 	case 'a':	/* author ... */
 		return format_person_part(sb, placeholder[1],
-				   msg + c->author.off, c->author.len,
+				   split_person(msg, &c->author, &c->author_ident,
+						&c->author_split),
 				   &c->pretty_ctx->date_mode);
 	case 'c':	/* committer ... */
 		return format_person_part(sb, placeholder[1],
-				   msg + c->committer.off, c->committer.len,
+				   split_person(msg, &c->committer,
+						&c->committer_ident,
+						&c->committer_split),
 				   &c->pretty_ctx->date_mode);
 	case 'e':	/* encoding */
 		if (c->commit_encoding)
@@ -1504,6 +1558,49 @@ void userformat_find_requirements(const char *fmt, struct userformat_want *w)
 	strbuf_release(&dummy);
 }
 
+static void compile_user_format(void)
+{
+	const char *p;
+
+	for (p = strchr(user_format, '%'); p; p = strchr(p + 1, '%')) {
+		ALLOC_GROW(user_template.percent, user_template.nr + 1,
+			   user_template.alloc);
+		user_template.percent[user_template.nr++] = p - user_format;
+	}
+	user_template.len = strlen(user_format);
+	user_template.compiled = 1;
+}
+
+/* What strbuf_expand() does, without looking for the '%' again */
+static void expand_user_format(struct strbuf *sb,
+			       struct format_commit_context *context)
+{
+	size_t i, pos = 0;
+
+	if (!user_template.compiled)
+		compile_user_format();
+	for (i = 0; i < user_template.nr; i++) {
+		size_t percent = user_template.percent[i];
+		size_t consumed;
+
+		if (percent < pos)
+			continue; /* part of the placeholder before it */
+		strbuf_add(sb, user_format + pos, percent - pos);
+		pos = percent + 1;
+		if (user_format[pos] == '%') {
+			strbuf_addch(sb, '%');
+			pos++;
+			continue;
+		}
+		consumed = format_commit_item(sb, user_format + pos, context);
+		if (consumed)
+			pos += consumed;
+		else
+			strbuf_addch(sb, '%');
+	}
+	strbuf_add(sb, user_format + pos, user_template.len - pos);
+}
+
 void format_commit_message(const struct commit *commit,
 			   const char *format, struct strbuf *sb,
 			   const struct pretty_print_context *pretty_ctx)
@@ -1524,7 +1621,10 @@ void format_commit_message(const struct commit *commit,
 					  &context.commit_encoding,
 					  utf8);
 
-	strbuf_expand(sb, format, format_commit_item, &context);
+	if (format == user_format)
+		expand_user_format(sb, &context);
+	else
+		strbuf_expand(sb, format, format_commit_item, &context);
 	rewrap_message_tail(sb, &context, 0, 0, 0);
 
 	/* then convert a commit message to an actual output encoding */
@@ -13,6 +13,7 @@
 #include "progress.h"
 #include "strbuf.h"
 #include "trace.h"
+#include "thread-utils.h"
 
 #define TP_IDX_MAX      8
 
@@ -33,9 +34,20 @@ struct progress {
 	uint64_t last_value;
 	uint64_t total;
 	unsigned last_percent;
+	/* where last_percent changes, not to divide on every call */
+	uint64_t next_percent_value;
 	unsigned delay;
 	struct throughput *throughput;
 	uint64_t start_ns;
+
+	/* what progress_add() adds to, from any thread */
+	size_t counter;
+	int counting;
+	/* set while a thread displays the counter */
+	int displaying;
+#if !defined(NO_PTHREADS) && !defined(__GNUC__)
+	pthread_mutex_t mutex;
+#endif
 };
 
 static volatile sig_atomic_t progress_update;
@@ -85,13 +97,22 @@ static int display(struct progress *progress, uint64_t n, const char *done)
 	if (progress->delay && (!progress_update || --progress->delay))
 		return 0;
 
+	if (progress->total && !progress_update && !done &&
+	    n >= progress->last_value && n < progress->next_percent_value) {
+		progress->last_value = n;
+		return 0;
+	}
+
 	progress->last_value = n;
+
 	tp = (progress->throughput) ? progress->throughput->display.buf : "";
 	eol = done ? done : "   \r";
 	if (progress->total) {
 		unsigned percent = n * 100 / progress->total;
 		if (percent != progress->last_percent || progress_update) {
 			progress->last_percent = percent;
+			progress->next_percent_value =
+				((percent + 1) * progress->total + 99) / 100;
 			if (is_foreground_fd(fileno(stderr)) || done) {
 				fprintf(stderr, "%s: %3u%% (%"PRIuMAX"/%"PRIuMAX")%s%s",
 					progress->title, percent,
@@ -136,20 +157,24 @@ void display_throughput(struct progress *progress, uint64_t total)
 		return;
 	tp = progress->throughput;
 
-	now_ns = getnanotime();
-
 	if (!tp) {
 		progress->throughput = tp = calloc(1, sizeof(*tp));
 		if (tp) {
 			tp->prev_total = tp->curr_total = total;
-			tp->prev_ns = now_ns;
+			tp->prev_ns = getnanotime();
 			strbuf_init(&tp->display, 0);
 		}
 		return;
 	}
 	tp->curr_total = total;
 
-	/* only update throughput every 0.5 s */
+	/*
+	 * This is called for every read; look at the clock only when the
+	 * display is due, and update throughput every 0.5 s at most.
+	 */
+	if (!progress_update)
+		return;
+	now_ns = getnanotime();
 	if (now_ns - tp->prev_ns <= 500000000)
 		return;
 
@@ -190,7 +215,79 @@ void display_throughput(struct progress *progress, uint64_t total)
 
 int display_progress(struct progress *progress, uint64_t n)
 {
-	return progress ? display(progress, n, NULL) : 0;
+	if (!progress)
+		return 0;
+	progress->counter = n;
+	return display(progress, n, NULL);
+}
+
+#if defined(NO_PTHREADS)
+static size_t add_counter(struct progress *progress, size_t n)
+{
+	return progress->counter += n;
+}
+
+static int begin_display(struct progress *progress)
+{
+	return 1;
+}
+
+static void end_display(struct progress *progress)
+{
+}
+#elif defined(__GNUC__)
+static size_t add_counter(struct progress *progress, size_t n)
+{
+	return __atomic_add_fetch(&progress->counter, n, __ATOMIC_RELAXED);
+}
+
+static int begin_display(struct progress *progress)
+{
+	return !__atomic_exchange_n(&progress->displaying, 1, __ATOMIC_ACQUIRE);
+}
+
+static void end_display(struct progress *progress)
+{
+	__atomic_store_n(&progress->displaying, 0, __ATOMIC_RELEASE);
+}
+#else
+static size_t add_counter(struct progress *progress, size_t n)
+{
+	size_t ret;
+
+	pthread_mutex_lock(&progress->mutex);
+	ret = progress->counter += n;
+	pthread_mutex_unlock(&progress->mutex);
+	return ret;
+}
+
+static int begin_display(struct progress *progress)
+{
+	return !pthread_mutex_trylock(&progress->mutex);
+}
+
+static void end_display(struct progress *progress)
+{
+	pthread_mutex_unlock(&progress->mutex);
+}
+#endif
+
+void progress_add(struct progress *progress, size_t n)
+{
+	size_t value;
+
+	if (!progress)
+		return;
+	progress->counting = 1;
+	value = add_counter(progress, n);
+	if (!progress_update)
+		return;
+	/* whoever sees the timer go off first displays, nobody waits */
+	if (begin_display(progress)) {
+		if (progress_update)
+			display(progress, value, NULL);
+		end_display(progress);
+	}
 }
 
 static struct progress *start_progress_delay(const char *title, uint64_t total,
@@ -210,6 +307,13 @@ static struct progress *start_progress_delay(const char *title, uint64_t total,
 	progress->delay = delay;
 	progress->throughput = NULL;
 	progress->start_ns = getnanotime();
+	progress->next_percent_value = 0;
+	progress->counter = 0;
+	progress->counting = 0;
+	progress->displaying = 0;
+#if !defined(NO_PTHREADS) && !defined(__GNUC__)
+	pthread_mutex_init(&progress->mutex, NULL);
+#endif
 	set_progress_signal();
 	return progress;
 }
@@ -235,6 +339,8 @@ void stop_progress_msg(struct progress **p_progress, const char *msg)
 	if (!progress)
 		return;
 	*p_progress = NULL;
+	if (progress->counting)
+		progress->last_value = progress->counter;
 	if (progress->last_value != -1) {
 		/* Force the last update */
 		char *buf;
@@ -253,6 +359,9 @@ void stop_progress_msg(struct progress **p_progress, const char *msg)
 		free(buf);
 	}
 	clear_progress_signal();
+#if !defined(NO_PTHREADS) && !defined(__GNUC__)
+	pthread_mutex_destroy(&progress->mutex);
+#endif
 	if (progress->throughput)
 		strbuf_release(&progress->throughput->display);
 	free(progress->throughput);
@@ -5,6 +5,15 @@ struct progress;
 
 void display_throughput(struct progress *progress, uint64_t total);
 int display_progress(struct progress *progress, uint64_t n);
+
+/*
+ * Add "n" to the count of "progress", for loops run by several threads
+ * at once: it takes no lock, and only displays anything when the
+ * progress timer has gone off, from whichever thread notices first.
+ * display_progress() sets the count, but must not be called while
+ * other threads are adding to it.
+ */
+void progress_add(struct progress *progress, size_t n);
 struct progress *start_progress(const char *title, uint64_t total);
 struct progress *start_delayed_progress(const char *title, uint64_t total);
 void stop_progress(struct progress **progress);
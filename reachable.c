@@ -12,6 +12,9 @@
 #include "packfile.h"
 #include "worktree.h"
 #include "object-store.h"
+#include "pack-mtimes.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 struct connectivity_progress {
 	struct progress *progress;
@@ -56,6 +59,42 @@ static void mark_commit(struct commit *c, void *data)
 	mark_object(&c->object, NULL, data);
 }
 
+/* traverse_bitmap_commit_list() takes no callback data */
+static struct connectivity_progress *bitmap_progress;
+
+static int mark_object_seen(const struct object_id *oid,
+			     enum object_type type,
+			     int exclude,
+			     uint32_t name_hash,
+			     struct packed_git *found_pack,
+			     off_t found_offset)
+{
+	struct object *obj;
+
+	switch (type) {
+	case OBJ_COMMIT:
+		obj = (struct object *)lookup_commit(oid);
+		break;
+	case OBJ_TREE:
+		obj = (struct object *)lookup_tree(oid);
+		break;
+	case OBJ_BLOB:
+		obj = (struct object *)lookup_blob(oid);
+		break;
+	case OBJ_TAG:
+		obj = (struct object *)lookup_tag(oid);
+		break;
+	default:
+		BUG("unknown object type %d", type);
+	}
+	if (!obj)
+		die("unable to create object '%s'", oid_to_hex(oid));
+
+	obj->flags |= SEEN;
+	update_progress(bitmap_progress);
+	return 0;
+}
+
 struct recent_data {
 	struct rev_info *revs;
 	timestamp_t timestamp;
@@ -137,7 +176,7 @@ static int add_recent_packed(const struct object_id *oid,
 
 	if (obj && obj->flags & SEEN)
 		return 0;
-	add_recent_object(oid, p->mtime, data);
+	add_recent_object(oid, packed_object_mtime(p, pos), data);
 	return 0;
 }
 
@@ -162,6 +201,7 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 			    timestamp_t mark_recent, struct progress *progress)
 {
 	struct connectivity_progress cp;
+	struct bitmap_index *bitmap_git;
 
 	/*
 	 * Set up revision parsing, and mark us as being interested
@@ -189,12 +229,26 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 	cp.count = 0;
 
 	/*
-	 * Set up the revision walk - this will move all commits
-	 * from the pending list to the commit walking list.
+	 * With a reachability bitmap, mark what it covers without opening
+	 * those objects at all; only the tips it does not cover are walked.
+	 * The walk of those tips cannot skip missing promisor objects.
 	 */
-	if (prepare_revision_walk(revs))
-		die("revision walk setup failed");
-	traverse_commit_list(revs, mark_commit, mark_object, &cp);
+	bitmap_git = revs->exclude_promisor_objects ? NULL :
+		prepare_bitmap_walk(revs, NULL);
+	if (bitmap_git) {
+		bitmap_progress = &cp;
+		traverse_bitmap_commit_list(bitmap_git, mark_object_seen);
+		bitmap_progress = NULL;
+		free_bitmap_index(bitmap_git);
+	} else {
+		/*
+		 * Set up the revision walk - this will move all commits
+		 * from the pending list to the commit walking list.
+		 */
+		if (prepare_revision_walk(revs))
+			die("revision walk setup failed");
+		traverse_commit_list(revs, mark_commit, mark_object, &cp);
+	}
 
 	if (mark_recent) {
 		revs->ignore_missing_links = 1;
@@ -21,6 +21,11 @@
 #include "split-index.h"
 #include "utf8.h"
 #include "fsmonitor.h"
+#include "thread-utils.h"
+#include "mem-pool.h"
+#include "sparse-index.h"
+#include "trace2.h"
+#include "pathspec.h"
 
 /* Mask for the name length in ce_flags in the on-disk index */
 
@@ -41,6 +46,13 @@
 #define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
 #define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
 #define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
+#define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
+
+/* the size of the "EOIE" extension: 32-bit offset plus the hash */
+#define EOIE_SIZE (4 + GIT_SHA1_RAWSZ)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -62,7 +74,7 @@ static void replace_index_entry(struct index_state *istate, int nr, struct cache
 
 	replace_index_entry_in_base(istate, old, ce);
 	remove_name_hash(istate, old);
-	free(old);
+	discard_cache_entry(old);
 	ce->ce_flags &= ~CE_HASHED;
 	set_index_entry(istate, nr, ce);
 	ce->ce_flags |= CE_UPDATE_IN_BASE;
@@ -75,7 +87,7 @@ void rename_index_entry_at(struct index_state *istate, int nr, const char *new_n
 	struct cache_entry *old_entry = istate->cache[nr], *new_entry;
 	int namelen = strlen(new_name);
 
-	new_entry = xmalloc(cache_entry_size(namelen));
+	new_entry = make_empty_cache_entry(istate, namelen);
 	copy_cache_entry(new_entry, old_entry);
 	new_entry->ce_flags &= ~CE_HASHED;
 	new_entry->ce_namelen = namelen;
@@ -509,6 +521,24 @@ static int index_name_stage_pos(const struct index_state *istate, const char *na
 		}
 		first = next+1;
 	}
+
+	if (istate->sparse_index && first > 0) {
+		/* Note: first <= istate->cache_nr */
+		struct cache_entry *ce = istate->cache[first - 1];
+
+		/*
+		 * If the entry before the insertion position is a sparse
+		 * directory containing "name", the path is only hidden in
+		 * the collapsed tree; expand the index and search again.
+		 * This happens at most once, as the index is full after.
+		 */
+		if (S_ISSPARSEDIR(ce->ce_mode) &&
+		    ce_namelen(ce) < namelen &&
+		    !strncmp(name, ce->name, ce_namelen(ce))) {
+			ensure_full_index((struct index_state *)istate);
+			return index_name_stage_pos(istate, name, namelen, stage);
+		}
+	}
 	return -first-1;
 }
 
@@ -624,7 +654,7 @@ static struct cache_entry *create_alias_ce(struct index_state *istate,
 
 	/* Ok, create the new entry using the name of the existing alias */
 	len = ce_namelen(alias);
-	new_entry = xcalloc(1, cache_entry_size(len));
+	new_entry = make_empty_cache_entry(istate, len);
 	memcpy(new_entry->name, alias->name, len);
 	copy_cache_entry(new_entry, ce);
 	save_or_free_index_entry(istate, ce);
@@ -639,9 +669,11 @@ void set_object_name_for_intent_to_add_entry(struct cache_entry *ce)
 	oidcpy(&ce->oid, &oid);
 }
 
-int add_to_index(struct index_state *istate, const char *path, struct stat *st, int flags)
+static int add_to_index_1(struct index_state *istate, const char *path,
+			  struct stat *st, const struct object_id *oid,
+			  int flags)
 {
-	int size, namelen, was_same;
+	int namelen, was_same;
 	mode_t st_mode = st->st_mode;
 	struct cache_entry *ce, *alias = NULL;
 	unsigned ce_option = CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE|CE_MATCH_RACY_IS_DIRTY;
@@ -663,8 +695,7 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 		while (namelen && path[namelen-1] == '/')
 			namelen--;
 	}
-	size = cache_entry_size(namelen);
-	ce = xcalloc(1, size);
+	ce = make_empty_cache_entry(istate, namelen);
 	memcpy(ce->name, path, namelen);
 	ce->ce_namelen = namelen;
 	if (!intent_only)
@@ -705,13 +736,15 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 				ce_mark_uptodate(alias);
 			alias->ce_flags |= CE_ADDED;
 
-			free(ce);
+			discard_cache_entry(ce);
 			return 0;
 		}
 	}
-	if (!intent_only) {
+	if (oid)
+		oidcpy(&ce->oid, oid);
+	else if (!intent_only) {
 		if (index_path(&ce->oid, path, st, newflags)) {
-			free(ce);
+			discard_cache_entry(ce);
 			return error("unable to index file %s", path);
 		}
 	} else
@@ -728,9 +761,9 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 		    ce->ce_mode == alias->ce_mode);
 
 	if (pretend)
-		free(ce);
+		discard_cache_entry(ce);
 	else if (add_index_entry(istate, ce, add_option)) {
-		free(ce);
+		discard_cache_entry(ce);
 		return error("unable to add %s to index", path);
 	}
 	if (verbose && !was_same)
@@ -738,6 +771,19 @@ int add_to_index(struct index_state *istate, const char *path, struct stat *st,
 	return 0;
 }
 
+int add_to_index(struct index_state *istate, const char *path, struct stat *st, int flags)
+{
+	return add_to_index_1(istate, path, st, NULL, flags);
+}
+
+int add_blob_to_index(struct index_state *istate, const char *path,
+		      struct stat *st, const struct object_id *oid, int flags)
+{
+	if (!S_ISREG(st->st_mode) || (flags & (ADD_CACHE_INTENT | HASH_RENORMALIZE)))
+		BUG("add_blob_to_index() only adds regular files as they are");
+	return add_to_index_1(istate, path, st, oid, flags);
+}
+
 int add_file_to_index(struct index_state *istate, const char *path, int flags)
 {
 	struct stat st;
@@ -746,12 +792,60 @@ int add_file_to_index(struct index_state *istate, const char *path, int flags)
 	return add_to_index(istate, path, &st, flags);
 }
 
-struct cache_entry *make_cache_entry(unsigned int mode,
-		const unsigned char *sha1, const char *path, int stage,
-		unsigned int refresh_options)
+static struct mem_pool *find_mem_pool(struct index_state *istate)
+{
+	struct mem_pool **pool_ptr;
+
+	/*
+	 * Entries of a split index can move to its base index, so they
+	 * are allocated from the pool of the base.
+	 */
+	if (istate->split_index && istate->split_index->base)
+		pool_ptr = &istate->split_index->base->ce_mem_pool;
+	else
+		pool_ptr = &istate->ce_mem_pool;
+
+	if (!*pool_ptr)
+		mem_pool_init(pool_ptr, 0);
+
+	return *pool_ptr;
+}
+
+static struct cache_entry *mem_pool__ce_alloc(struct mem_pool *mem_pool, size_t len)
+{
+	struct cache_entry *ce;
+	ce = mem_pool_alloc(mem_pool, cache_entry_size(len));
+	ce->mem_pool_allocated = 1;
+	return ce;
+}
+
+static struct cache_entry *mem_pool__ce_calloc(struct mem_pool *mem_pool, size_t len)
+{
+	struct cache_entry *ce;
+	ce = mem_pool_calloc(mem_pool, 1, cache_entry_size(len));
+	ce->mem_pool_allocated = 1;
+	return ce;
+}
+
+struct cache_entry *make_empty_cache_entry(struct index_state *istate, size_t len)
+{
+	return mem_pool__ce_calloc(find_mem_pool(istate), len);
+}
+
+struct cache_entry *make_empty_transient_cache_entry(size_t len)
+{
+	return xcalloc(1, cache_entry_size(len));
+}
+
+struct cache_entry *make_cache_entry(struct index_state *istate,
+				     unsigned int mode,
+				     const unsigned char *sha1,
+				     const char *path,
+				     int stage,
+				     unsigned int refresh_options)
 {
-	int size, len;
 	struct cache_entry *ce, *ret;
+	int len;
 
 	if (!verify_path(path, mode)) {
 		error("Invalid path '%s'", path);
@@ -759,8 +853,7 @@ struct cache_entry *make_cache_entry(unsigned int mode,
 	}
 
 	len = strlen(path);
-	size = cache_entry_size(len);
-	ce = xcalloc(1, size);
+	ce = make_empty_cache_entry(istate, len);
 
 	hashcpy(ce->oid.hash, sha1);
 	memcpy(ce->name, path, len);
@@ -768,12 +861,44 @@ struct cache_entry *make_cache_entry(unsigned int mode,
 	ce->ce_namelen = len;
 	ce->ce_mode = create_ce_mode(mode);
 
-	ret = refresh_cache_entry(ce, refresh_options);
+	ret = refresh_cache_entry(istate, ce, refresh_options);
 	if (ret != ce)
-		free(ce);
+		discard_cache_entry(ce);
 	return ret;
 }
 
+struct cache_entry *make_transient_cache_entry(unsigned int mode, const unsigned char *sha1,
+					       const char *path, int stage)
+{
+	struct cache_entry *ce;
+	int len;
+
+	if (!verify_path(path, mode)) {
+		error("Invalid path '%s'", path);
+		return NULL;
+	}
+
+	len = strlen(path);
+	ce = make_empty_transient_cache_entry(len);
+
+	hashcpy(ce->oid.hash, sha1);
+	memcpy(ce->name, path, len);
+	ce->ce_flags = create_ce_flags(stage);
+	ce->ce_namelen = len;
+	ce->ce_mode = create_ce_mode(mode);
+
+	return ce;
+}
+
+void discard_cache_entry(struct cache_entry *ce)
+{
+	/* entries of a memory pool are freed with the pool */
+	if (ce && ce->mem_pool_allocated)
+		return;
+
+	free(ce);
+}
+
 /*
  * Chmod an index entry with either +x or -x.
  *
@@ -1269,7 +1394,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 {
 	struct stat st;
 	struct cache_entry *updated;
-	int changed, size;
+	int changed;
 	int refresh = options & CE_MATCH_REFRESH;
 	int ignore_valid = options & CE_MATCH_IGNORE_VALID;
 	int ignore_skip_worktree = options & CE_MATCH_IGNORE_SKIP_WORKTREE;
@@ -1307,6 +1432,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		return NULL;
 	}
 
+	trace2_counter_add("index", "lstat", 1);
 	if (lstat(ce->name, &st) < 0) {
 		if (ignore_missing && errno == ENOENT)
 			return ce;
@@ -1349,8 +1475,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		return NULL;
 	}
 
-	size = ce_size(ce);
-	updated = xmalloc(size);
+	updated = make_empty_cache_entry(istate, ce_namelen(ce));
 	copy_cache_entry(updated, ce);
 	memcpy(updated->name, ce->name, ce->ce_namelen + 1);
 	fill_stat_cache_info(updated, &st);
@@ -1368,6 +1493,24 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	return updated;
 }
 
+void refresh_index_entry_at(struct index_state *istate, int pos,
+			    struct stat *st)
+{
+	struct cache_entry *ce = istate->cache[pos];
+	struct cache_entry *updated;
+
+	updated = make_empty_cache_entry(istate, ce_namelen(ce));
+	copy_cache_entry(updated, ce);
+	memcpy(updated->name, ce->name, ce->ce_namelen + 1);
+	fill_stat_cache_info(updated, st);
+	/* As in refresh_cache_ent(), without ignore_valid */
+	if (assume_unchanged && !(ce->ce_flags & CE_VALID))
+		updated->ce_flags &= ~CE_VALID;
+	replace_index_entry(istate, pos, updated);
+	ce_mark_uptodate(updated);
+	mark_fsmonitor_valid(updated);
+}
+
 static void show_file(const char * fmt, const char * name, int in_porcelain,
 		      int * first, const char *header_msg)
 {
@@ -1401,6 +1544,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	const char *unmerged_fmt;
 	uint64_t start = getnanotime();
 
+	trace2_region_enter("index", "refresh");
 	modified_fmt = (in_porcelain ? "M\t%s\n" : "%s: needs update\n");
 	deleted_fmt = (in_porcelain ? "D\t%s\n" : "%s: needs update\n");
 	typechange_fmt = (in_porcelain ? "T\t%s\n" : "%s needs update\n");
@@ -1470,14 +1614,16 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 
 		replace_index_entry(istate, i, new_entry);
 	}
+	trace2_region_leave("index", "refresh");
 	trace_performance_since(start, "refresh index");
 	return has_errors;
 }
 
-struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
-					       unsigned int options)
+struct cache_entry *refresh_cache_entry(struct index_state *istate,
+					struct cache_entry *ce,
+					unsigned int options)
 {
-	return refresh_cache_ent(&the_index, ce, options, NULL, NULL);
+	return refresh_cache_ent(istate, ce, options, NULL, NULL);
 }
 
 
@@ -1574,8 +1720,6 @@ int verify_ce_order;
 
 static int verify_hdr(struct cache_header *hdr, unsigned long size)
 {
-	git_hash_ctx c;
-	unsigned char hash[GIT_MAX_RAWSZ];
 	int hdr_version;
 
 	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
@@ -1583,16 +1727,43 @@ static int verify_hdr(struct cache_header *hdr, unsigned long size)
 	hdr_version = ntohl(hdr->hdr_version);
 	if (hdr_version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < hdr_version)
 		return error("bad index version %d", hdr_version);
+	return 0;
+}
 
-	if (!verify_index_checksum)
-		return 0;
+/*
+ * The trailing checksum of the index is only verified by fsck, or when
+ * "index.verifyChecksum" asks for it.
+ */
+static int want_index_checksum(void)
+{
+	int val;
+
+	if (verify_index_checksum)
+		return 1;
+	return !git_config_get_bool("index.verifychecksum", &val) && val;
+}
+
+struct verify_index_checksum_data {
+#ifndef NO_PTHREADS
+	pthread_t pthread;
+#endif
+	const char *mmap;
+	size_t mmap_size;
+	int ret;
+};
+
+static void *verify_index_checksum_thread(void *_data)
+{
+	struct verify_index_checksum_data *p = _data;
+	git_hash_ctx c;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	size_t size = p->mmap_size - the_hash_algo->rawsz;
 
 	the_hash_algo->init_fn(&c);
-	the_hash_algo->update_fn(&c, hdr, size - the_hash_algo->rawsz);
+	the_hash_algo->update_fn(&c, p->mmap, size);
 	the_hash_algo->final_fn(hash, &c);
-	if (hashcmp(hash, (unsigned char *)hdr + size - the_hash_algo->rawsz))
-		return error("bad index file sha1 signature");
-	return 0;
+	p->ret = hashcmp(hash, (const unsigned char *)p->mmap + size) ? -1 : 0;
+	return NULL;
 }
 
 static int read_index_extension(struct index_state *istate,
@@ -1615,6 +1786,14 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_FSMONITOR:
 		read_fsmonitor_extension(istate, data, sz);
 		break;
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
+		/* already handled in do_read_index() */
+		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		/* no content, only an indicator */
+		istate->sparse_index = 1;
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1635,12 +1814,13 @@ int read_index(struct index_state *istate)
 	return read_index_from(istate, get_index_file(), get_git_dir());
 }
 
-static struct cache_entry *cache_entry_from_ondisk(struct ondisk_cache_entry *ondisk,
+static struct cache_entry *cache_entry_from_ondisk(struct mem_pool *mem_pool,
+						   struct ondisk_cache_entry *ondisk,
 						   unsigned int flags,
 						   const char *name,
 						   size_t len)
 {
-	struct cache_entry *ce = xmalloc(cache_entry_size(len));
+	struct cache_entry *ce = mem_pool__ce_alloc(mem_pool, len);
 
 	ce->ce_stat_data.sd_ctime.sec = get_be32(&ondisk->ctime.sec);
 	ce->ce_stat_data.sd_mtime.sec = get_be32(&ondisk->mtime.sec);
@@ -1673,8 +1853,16 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
-	if (name->len < len)
-		die("malformed name field in the index");
+	if (name->len < len) {
+		/*
+		 * The first entry of a block of the index entry offset
+		 * table is stored in full, and is read without knowing
+		 * the name it follows.
+		 */
+		if (name->len)
+			die("malformed name field in the index");
+		len = 0;
+	}
 	strbuf_remove(name, name->len - len, len);
 	for (ep = cp; *ep; ep++)
 		; /* find the end */
@@ -1682,7 +1870,8 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 	return (const char *)ep + 1 - cp_;
 }
 
-static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
+static struct cache_entry *create_from_disk(struct mem_pool *mem_pool,
+					    struct ondisk_cache_entry *ondisk,
 					    unsigned long *ent_size,
 					    struct strbuf *previous_name)
 {
@@ -1713,13 +1902,13 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 		/* v3 and earlier */
 		if (len == CE_NAMEMASK)
 			len = strlen(name);
-		ce = cache_entry_from_ondisk(ondisk, flags, name, len);
+		ce = cache_entry_from_ondisk(mem_pool, ondisk, flags, name, len);
 
 		*ent_size = ondisk_ce_size(ce);
 	} else {
 		unsigned long consumed;
 		consumed = expand_name_field(previous_name, name);
-		ce = cache_entry_from_ondisk(ondisk, flags,
+		ce = cache_entry_from_ondisk(mem_pool, ondisk, flags,
 					     previous_name->buf,
 					     previous_name->len);
 
@@ -1793,16 +1982,477 @@ static void post_read_index_from(struct index_state *istate)
 	tweak_fsmonitor(istate);
 }
 
+/*
+ * The "IEOT" extension records where blocks of index entries start, so
+ * that the blocks can be read on separate threads.  In a version 5
+ * index, it also records the checksum of each block, so that a block
+ * can be read and verified without the others.
+ */
+struct index_entry_offset {
+	/* byte offset of the block in the index file */
+	int offset;
+	/* number of index entries in the block */
+	int nr;
+	/* hash of the bytes of the block, with IEOT_VERSION_HASHED */
+	unsigned char hash[GIT_MAX_RAWSZ];
+};
+
+struct index_entry_offset_table {
+	int nr;
+	int hashed;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+#define IEOT_VERSION	(1)
+#define IEOT_VERSION_HASHED	(2)
+
+static struct index_entry_offset_table *read_ieot_extension(const char *mmap,
+							   size_t mmap_size,
+							   size_t offset)
+{
+	const char *index = NULL;
+	uint32_t extsize, ext_version;
+	struct index_entry_offset_table *ieot;
+	int i, nr;
+
+	/* find the IEOT extension among the extensions at "offset" */
+	while (offset <= mmap_size - the_hash_algo->rawsz - 8) {
+		extsize = get_be32(mmap + offset + 4);
+		if (CACHE_EXT((mmap + offset)) == CACHE_EXT_INDEXENTRYOFFSETTABLE) {
+			index = mmap + offset + 4 + 4;
+			break;
+		}
+		offset += 8;
+		offset += extsize;
+	}
+	if (!index)
+		return NULL;
+
+	/* validate the version is IEOT_VERSION or IEOT_VERSION_HASHED */
+	ext_version = get_be32(index);
+	if (ext_version != IEOT_VERSION && ext_version != IEOT_VERSION_HASHED) {
+		error("invalid IEOT version %d", ext_version);
+		return NULL;
+	}
+	index += sizeof(uint32_t);
+
+	/* extension size - version bytes / bytes per entry */
+	nr = (extsize - sizeof(uint32_t)) /
+		(sizeof(uint32_t) + sizeof(uint32_t) +
+		 (ext_version == IEOT_VERSION_HASHED ? the_hash_algo->rawsz : 0));
+	if (!nr) {
+		error("invalid number of IEOT entries %d", nr);
+		return NULL;
+	}
+	ieot = xmalloc(sizeof(struct index_entry_offset_table)
+		       + (nr * sizeof(struct index_entry_offset)));
+	ieot->nr = nr;
+	ieot->hashed = ext_version == IEOT_VERSION_HASHED;
+	for (i = 0; i < nr; i++) {
+		ieot->entries[i].offset = get_be32(index);
+		index += sizeof(uint32_t);
+		ieot->entries[i].nr = get_be32(index);
+		index += sizeof(uint32_t);
+		if (ieot->hashed) {
+			hashcpy(ieot->entries[i].hash, (const unsigned char *)index);
+			index += the_hash_algo->rawsz;
+		}
+	}
+
+	return ieot;
+}
+
+static void write_ieot_extension(struct strbuf *sb,
+				 struct index_entry_offset_table *ieot)
+{
+	uint32_t buffer;
+	int i;
+
+	/* version */
+	put_be32(&buffer, ieot->hashed ? IEOT_VERSION_HASHED : IEOT_VERSION);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+	/* ieot */
+	for (i = 0; i < ieot->nr; i++) {
+		/* offset */
+		put_be32(&buffer, ieot->entries[i].offset);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+		/* count */
+		put_be32(&buffer, ieot->entries[i].nr);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+		/* hash */
+		if (ieot->hashed)
+			strbuf_add(sb, ieot->entries[i].hash,
+				   the_hash_algo->rawsz);
+	}
+}
+
+/*
+ * The "EOIE" extension is the last one in the index. It records where
+ * the index entries end, so that the extensions can be read while the
+ * entries are, and a hash of the headers of the other extensions that
+ * guards against an index rewritten by a git that did not know it.
+ *
+ * Returns the offset of the first extension, or 0 if there is no valid
+ * "EOIE" extension.
+ */
+static size_t read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	/*
+	 * The end of index entries (EOIE) extension is guaranteed to be
+	 * last so that it can be found by scanning backwards from the
+	 * EOF.
+	 *
+	 * "EOIE"
+	 * <4-byte length>
+	 * <4-byte offset>
+	 * <20-byte hash>
+	 */
+	const char *index, *eoie;
+	uint32_t extsize;
+	size_t offset, src_offset;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx c;
+
+	/* ensure we have an index big enough to contain an EOIE extension */
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + the_hash_algo->rawsz)
+		return 0;
+
+	/* validate the extension signature */
+	index = eoie = mmap + mmap_size - EOIE_SIZE_WITH_HEADER - the_hash_algo->rawsz;
+	if (CACHE_EXT(index) != CACHE_EXT_ENDOFINDEXENTRIES)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/* validate the extension size */
+	extsize = get_be32(index);
+	if (extsize != EOIE_SIZE)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/*
+	 * Validate the offset we're going to look for the first extension
+	 * signature is after the index header and before the eoie extension.
+	 */
+	offset = get_be32(index);
+	if (mmap + offset < mmap + sizeof(struct cache_header))
+		return 0;
+	if (mmap + offset >= eoie)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/*
+	 * The hash is computed over extension types and their sizes (but not
+	 * their contents).  E.g. if we have "TREE" extension that is N-bytes
+	 * long, "REUC" extension that is M-bytes long, followed by "EOIE",
+	 * then the hash would be:
+	 *
+	 * SHA-1("TREE" + <binary representation of N> +
+	 *	 "REUC" + <binary representation of M>)
+	 */
+	src_offset = offset;
+	the_hash_algo->init_fn(&c);
+	while (src_offset < mmap_size - the_hash_algo->rawsz - EOIE_SIZE_WITH_HEADER) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+
+		/* verify the extension size isn't so large it will wrap around */
+		if (src_offset + 8 + extsize < src_offset)
+			return 0;
+
+		the_hash_algo->update_fn(&c, mmap + src_offset, 8);
+
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	the_hash_algo->final_fn(hash, &c);
+	if (hashcmp(hash, (const unsigned char *)index))
+		return 0;
+
+	/* Validate that the extension offsets returned us back to the eoie extension. */
+	if (src_offset != mmap_size - the_hash_algo->rawsz - EOIE_SIZE_WITH_HEADER)
+		return 0;
+
+	return offset;
+}
+
+static void write_eoie_extension(struct strbuf *sb, git_hash_ctx *eoie_context,
+				 size_t offset)
+{
+	uint32_t buffer;
+	unsigned char hash[GIT_MAX_RAWSZ];
+
+	/* offset */
+	put_be32(&buffer, offset);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+	/* hash */
+	the_hash_algo->final_fn(hash, eoie_context);
+	strbuf_add(sb, hash, the_hash_algo->rawsz);
+}
+
+struct load_index_extensions
+{
+#ifndef NO_PTHREADS
+	pthread_t pthread;
+#endif
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long src_offset;
+};
+
+static void *load_index_extensions(void *_data)
+{
+	struct load_index_extensions *p = _data;
+	unsigned long src_offset = p->src_offset;
+
+	while (src_offset <= p->mmap_size - the_hash_algo->rawsz - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, p->mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(p->istate,
+					 p->mmap + src_offset,
+					 (char *)p->mmap + src_offset + 8,
+					 extsize) < 0) {
+			munmap((void *)p->mmap, p->mmap_size);
+			die("index file corrupt");
+		}
+		src_offset += 8;
+		src_offset += extsize;
+	}
+
+	return NULL;
+}
+
+/*
+ * A typical path length, used to estimate how much memory the entries
+ * of an index need when their names are prefix-compressed on disk.
+ */
+#define CACHE_ENTRY_PATH_LENGTH 80
+
+static size_t estimate_cache_size_from_compressed(unsigned int entries)
+{
+	return entries * (sizeof(struct cache_entry) + CACHE_ENTRY_PATH_LENGTH);
+}
+
+static size_t estimate_cache_size(size_t ondisk_size, unsigned int entries)
+{
+	long per_entry = sizeof(struct cache_entry) - sizeof(struct ondisk_cache_entry);
+
+	/*
+	 * An in-memory entry is larger than its on-disk form by the
+	 * difference of the two structures, plus at most the rounding
+	 * done by mem_pool_alloc().
+	 */
+	per_entry += sizeof(uintmax_t);
+	return ondisk_size + entries * per_entry;
+}
+
+/*
+ * Create the pool the entries of "istate" are read into, large enough
+ * for all of them.
+ */
+static void init_ce_mem_pool(struct index_state *istate, size_t mmap_size)
+{
+	if (istate->version >= 4)
+		mem_pool_init(&istate->ce_mem_pool,
+			      estimate_cache_size_from_compressed(istate->cache_nr));
+	else
+		mem_pool_init(&istate->ce_mem_pool,
+			      estimate_cache_size(mmap_size, istate->cache_nr));
+}
+
+/*
+ * Read "nr" index entries starting at byte "start_offset" into the
+ * cache, starting at entry "offset", allocating them from "ce_mem_pool".
+ * Returns the number of bytes read.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    struct mem_pool *ce_mem_pool,
+					    int offset, int nr, const char *mmap,
+					    unsigned long start_offset)
+{
+	int i;
+	unsigned long src_offset = start_offset;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+
+	previous_name = (istate->version >= 4) ? &previous_name_buf : NULL;
+	for (i = offset; i < offset + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + src_offset);
+		ce = create_from_disk(ce_mem_pool, disk_ce, &consumed, previous_name);
+		set_index_entry(istate, i, ce);
+
+		src_offset += consumed;
+	}
+	strbuf_release(&previous_name_buf);
+	return src_offset - start_offset;
+}
+
+/*
+ * An offset table is only used if its blocks cover the index entries
+ * exactly, in order.
+ */
+static int ieot_matches_index(struct index_entry_offset_table *ieot,
+			      unsigned int cache_nr, size_t entries_end)
+{
+	int i;
+	unsigned long nr = 0;
+
+	for (i = 0; i < ieot->nr; i++) {
+		if (ieot->entries[i].offset < sizeof(struct cache_header) ||
+		    ieot->entries[i].offset >= entries_end ||
+		    (i && ieot->entries[i].offset <= ieot->entries[i - 1].offset) ||
+		    ieot->entries[i].nr <= 0)
+			return 0;
+		nr += ieot->entries[i].nr;
+	}
+	return nr == cache_nr;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Mostly randomly chosen maximum thread counts: we want to have at
+ * least 10000 cache entries per thread for it to be worth starting
+ * a thread.
+ */
+#define THREAD_COST		(10000)
+
+struct load_cache_entries_thread_data
+{
+	pthread_t pthread;
+	struct index_state *istate;
+	struct mem_pool *ce_mem_pool;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int offset;		/* the first cache entry of this thread */
+	int ieot_start;		/* the first ieot block of this thread */
+	int ieot_blocks;	/* the number of ieot blocks to read */
+	unsigned long consumed;	/* the number of bytes read */
+};
+
+static void *load_cache_entries_thread(void *_data)
+{
+	struct load_cache_entries_thread_data *p = _data;
+	int i, offset = p->offset;
+
+	trace2_thread_start("load_cache_entries");
+	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
+		p->consumed += load_cache_entry_block(p->istate, p->ce_mem_pool,
+						      offset,
+						      p->ieot->entries[i].nr,
+						      p->mmap,
+						      p->ieot->entries[i].offset);
+		offset += p->ieot->entries[i].nr;
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+static unsigned long load_cache_entries_threaded(struct index_state *istate,
+						 const char *mmap,
+						 int nr_threads,
+						 struct index_entry_offset_table *ieot)
+{
+	int i, offset, ieot_blocks, ieot_start, err;
+	struct load_cache_entries_thread_data *data;
+	unsigned long consumed = 0;
+
+	/* set_index_entry() must not touch the name hash */
+	if (istate->name_hash_initialized)
+		BUG("the name hash isn't thread safe");
+
+	/* ensure we have no more threads than we have blocks to process */
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	data = xcalloc(nr_threads, sizeof(*data));
+
+	offset = ieot_start = 0;
+	ieot_blocks = DIV_ROUND_UP(ieot->nr, nr_threads);
+	/* each thread allocates from a pool of its own */
+	mem_pool_init(&istate->ce_mem_pool, 0);
+
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_thread_data *p = &data[i];
+		int j, nr = 0;
+
+		if (ieot_start + ieot_blocks > ieot->nr)
+			ieot_blocks = ieot->nr - ieot_start;
+
+		p->istate = istate;
+		p->offset = offset;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->ieot_start = ieot_start;
+		p->ieot_blocks = ieot_blocks;
+
+		for (j = p->ieot_start; j < p->ieot_start + p->ieot_blocks; j++)
+			nr += ieot->entries[j].nr;
+		mem_pool_init(&p->ce_mem_pool,
+			      estimate_cache_size_from_compressed(nr));
+
+		err = pthread_create(&p->pthread, NULL, load_cache_entries_thread, p);
+		if (err)
+			die(_("unable to create load_cache_entries thread: %s"), strerror(err));
+
+		offset += nr;
+		ieot_start += ieot_blocks;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_thread_data *p = &data[i];
+
+		err = pthread_join(p->pthread, NULL);
+		if (err)
+			die(_("unable to join load_cache_entries thread: %s"), strerror(err));
+		mem_pool_combine(istate->ce_mem_pool, p->ce_mem_pool);
+		mem_pool_discard(p->ce_mem_pool);
+		consumed += p->consumed;
+	}
+
+	free(data);
+
+	return consumed;
+}
+
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
-	int fd, i;
+	int fd;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
-	void *mmap;
+	const char *mmap;
 	size_t mmap_size;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	struct load_index_extensions p;
+	struct verify_index_checksum_data checksum;
+	size_t extension_offset = 0;
+#ifndef NO_PTHREADS
+	int cpus, nr_threads;
+	struct index_entry_offset_table *ieot = NULL;
+#endif
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -1828,10 +2478,28 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 		die_errno("unable to map index file");
 	close(fd);
 
-	hdr = mmap;
+	hdr = (struct cache_header *)mmap;
 	if (verify_hdr(hdr, mmap_size) < 0)
 		goto unmap;
 
+	/* hash the whole file while we parse the entries */
+	checksum.mmap = mmap;
+	checksum.mmap_size = mmap_size;
+	checksum.ret = 0;
+	if (want_index_checksum()) {
+#ifndef NO_PTHREADS
+		int err = pthread_create(&checksum.pthread, NULL,
+					 verify_index_checksum_thread, &checksum);
+		if (err)
+			die(_("unable to create verify_index_checksum thread: %s"),
+			    strerror(err));
+#else
+		verify_index_checksum_thread(&checksum);
+#endif
+	} else {
+		checksum.mmap = NULL;
+	}
+
 	hashcpy(istate->oid.hash, (const unsigned char *)hdr + mmap_size - the_hash_algo->rawsz);
 	istate->version = ntohl(hdr->hdr_version);
 	istate->cache_nr = ntohl(hdr->hdr_entries);
@@ -1839,50 +2507,93 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
 	istate->initialized = 1;
 
-	if (istate->version == 4)
-		previous_name = &previous_name_buf;
-	else
-		previous_name = NULL;
+	p.istate = istate;
+	p.mmap = mmap;
+	p.mmap_size = mmap_size;
 
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
 
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
+#ifndef NO_PTHREADS
+	if (git_config_get_index_threads(&nr_threads))
+		nr_threads = 1;
 
-		src_offset += consumed;
+	if (!nr_threads) {
+		nr_threads = istate->cache_nr / THREAD_COST;
+		cpus = online_cpus();
+		if (nr_threads > cpus)
+			nr_threads = cpus;
 	}
-	strbuf_release(&previous_name_buf);
+
+	/* load the extensions on a thread of their own while we can */
+	if (nr_threads > 1) {
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+		if (extension_offset) {
+			int err;
+
+			p.src_offset = extension_offset;
+			err = pthread_create(&p.pthread, NULL, load_index_extensions, &p);
+			if (err)
+				die(_("unable to create load_index_extensions thread: %s"), strerror(err));
+
+			nr_threads--;
+		}
+	}
+
+	if (extension_offset && nr_threads > 1)
+		ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
+	if (ieot && !ieot_matches_index(ieot, istate->cache_nr, extension_offset))
+		FREE_AND_NULL(ieot);
+
+	if (ieot) {
+		src_offset += load_cache_entries_threaded(istate, mmap, nr_threads, ieot);
+		free(ieot);
+	} else {
+		init_ce_mem_pool(istate, mmap_size);
+		src_offset += load_cache_entry_block(istate, istate->ce_mem_pool,
+						     0, istate->cache_nr,
+						     mmap, src_offset);
+	}
+#else
+	init_ce_mem_pool(istate, mmap_size);
+	src_offset += load_cache_entry_block(istate, istate->ce_mem_pool,
+					     0, istate->cache_nr,
+					     mmap, src_offset);
+#endif
+
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - the_hash_algo->rawsz - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
-			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
+	/* if we created a thread, join it; otherwise load the extensions here */
+#ifndef NO_PTHREADS
+	if (extension_offset) {
+		int ret = pthread_join(p.pthread, NULL);
+		if (ret)
+			die(_("unable to join load_index_extensions thread: %s"), strerror(ret));
+	}
+#endif
+	if (!extension_offset) {
+		p.src_offset = src_offset;
+		load_index_extensions(&p);
 	}
-	munmap(mmap, mmap_size);
+#ifndef NO_PTHREADS
+	if (checksum.mmap) {
+		int ret = pthread_join(checksum.pthread, NULL);
+		if (ret)
+			die(_("unable to join verify_index_checksum thread: %s"), strerror(ret));
+	}
+#endif
+	if (checksum.ret < 0) {
+		error("bad index file sha1 signature");
+		goto unmap;
+	}
+	munmap((void *)mmap, mmap_size);
+
+	if (istate->sparse_index && command_requires_full_index)
+		ensure_full_index(istate);
 	return istate->cache_nr;
 
 unmap:
-	munmap(mmap, mmap_size);
+	munmap((void *)mmap, mmap_size);
 	die("index file corrupt");
 }
 
@@ -1911,7 +2622,10 @@ int read_index_from(struct index_state *istate, const char *path,
 	if (istate->initialized)
 		return istate->cache_nr;
 
+	trace2_region_enter("index", "do_read_index");
 	ret = do_read_index(istate, path, 0);
+	trace2_region_leave("index", "do_read_index");
+	trace2_data_intmax("index", "read/cache_nr", istate->cache_nr);
 	trace_performance_since(start, "read cache %s", path);
 
 	split_index = istate->split_index;
@@ -1927,7 +2641,9 @@ int read_index_from(struct index_state *istate, const char *path,
 
 	base_oid_hex = oid_to_hex(&split_index->base_oid);
 	base_path = xstrfmt("%s/sharedindex.%s", gitdir, base_oid_hex);
+	trace2_region_enter("index", "shared/do_read_index");
 	ret = do_read_index(split_index->base, base_path, 1);
+	trace2_region_leave("index", "shared/do_read_index");
 	if (oidcmp(&split_index->base_oid, &split_index->base->oid))
 		die("broken index, expect %s in %s, got %s",
 		    base_oid_hex, base_path,
@@ -1941,24 +2657,171 @@ int read_index_from(struct index_state *istate, const char *path,
 	return ret;
 }
 
-int is_index_unborn(struct index_state *istate)
+/*
+ * Whether block of entries from "first" up to "next" (or to the end of
+ * the index if NULL) may hold paths "pathspec" matches: those start
+ * with the part of a pathspec item before its first wildcard.
+ */
+static int block_may_match(const struct pathspec *pathspec,
+			   const char *first, const char *next)
 {
-	return (!istate->cache_nr && !istate->timestamp.sec);
+	int i;
+
+	if (!pathspec->nr)
+		return 1;
+	for (i = 0; i < pathspec->nr; i++) {
+		const struct pathspec_item *item = &pathspec->items[i];
+		int len = item->nowildcard_len;
+
+		if (item->magic & (PATHSPEC_ICASE | PATHSPEC_EXCLUDE))
+			return 1;
+		/* the block starts after the paths under the prefix ... */
+		if (strncmp(first, item->match, len) > 0)
+			continue;
+		/* ... or ends before them */
+		if (next && (strncmp(next, item->match, len) < 0 ||
+			     (!strncmp(next, item->match, len) && !next[len])))
+			continue;
+		return 1;
+	}
+	return 0;
 }
 
-int discard_index(struct index_state *istate)
+/* The path of the first entry of a block of a version 5 index. */
+static void block_first_path(const char *mmap, size_t offset,
+			     struct strbuf *path)
 {
-	int i;
+	const struct ondisk_cache_entry *ondisk;
+	const char *name;
 
-	for (i = 0; i < istate->cache_nr; i++) {
-		if (istate->cache[i]->index &&
-		    istate->split_index &&
-		    istate->split_index->base &&
-		    istate->cache[i]->index <= istate->split_index->base->cache_nr &&
-		    istate->cache[i] == istate->split_index->base->cache[istate->cache[i]->index - 1])
+	ondisk = (const struct ondisk_cache_entry *)(mmap + offset);
+	if (get_be16(&ondisk->flags) & CE_EXTENDED)
+		name = ((const struct ondisk_cache_entry_extended *)ondisk)->name;
+	else
+		name = ondisk->name;
+	strbuf_reset(path);
+	expand_name_field(path, name);
+}
+
+int read_index_from_pathspec(struct index_state *istate, const char *path,
+			     const char *gitdir,
+			     const struct pathspec *pathspec)
+{
+	int fd, i, nr = 0, blocks = 0;
+	struct stat st;
+	const char *mmap;
+	size_t mmap_size, extension_offset, offset;
+	const struct cache_header *hdr;
+	struct index_entry_offset_table *ieot = NULL;
+	struct strbuf first = STRBUF_INIT, next = STRBUF_INIT;
+	unsigned int cache_nr;
+
+	if (istate->initialized)
+		return istate->cache_nr;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return read_index_from(istate, path, gitdir);
+	if (fstat(fd, &st))
+		die_errno("cannot stat the open index");
+	mmap_size = xsize_t(st.st_size);
+	if (mmap_size < sizeof(struct cache_header) + the_hash_algo->rawsz) {
+		close(fd);
+		return read_index_from(istate, path, gitdir);
+	}
+	mmap = xmmap(NULL, mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mmap == MAP_FAILED)
+		die_errno("unable to map index file");
+	close(fd);
+
+	hdr = (const struct cache_header *)mmap;
+	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE) ||
+	    ntohl(hdr->hdr_version) < 5)
+		goto read_all;
+	extension_offset = read_eoie_extension(mmap, mmap_size);
+	if (!extension_offset)
+		goto read_all;
+	/* the entries of a split or sparse index do not tell it all */
+	for (offset = extension_offset;
+	     offset < mmap_size - the_hash_algo->rawsz;
+	     offset += 8 + get_be32(mmap + offset + 4)) {
+		uint32_t ext = CACHE_EXT((mmap + offset));
+
+		if (ext == CACHE_EXT_LINK || ext == CACHE_EXT_SPARSE_DIRECTORIES)
+			goto read_all;
+	}
+	cache_nr = ntohl(hdr->hdr_entries);
+	ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
+	if (!ieot || !ieot->hashed ||
+	    !ieot_matches_index(ieot, cache_nr, extension_offset))
+		goto read_all;
+
+	hashcpy(istate->oid.hash, (const unsigned char *)hdr + mmap_size - the_hash_algo->rawsz);
+	istate->version = ntohl(hdr->hdr_version);
+	istate->cache_nr = cache_nr;
+	istate->cache_alloc = alloc_nr(cache_nr);
+	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
+	init_ce_mem_pool(istate, mmap_size);
+
+	block_first_path(mmap, ieot->entries[0].offset, &next);
+	for (i = 0; i < ieot->nr; i++) {
+		size_t start = ieot->entries[i].offset;
+		size_t end = i + 1 < ieot->nr ?
+			ieot->entries[i + 1].offset : extension_offset;
+		unsigned char hash[GIT_MAX_RAWSZ];
+		git_hash_ctx c;
+
+		strbuf_swap(&first, &next);
+		if (i + 1 < ieot->nr)
+			block_first_path(mmap, end, &next);
+		if (!block_may_match(pathspec, first.buf,
+				     i + 1 < ieot->nr ? next.buf : NULL))
 			continue;
-		free(istate->cache[i]);
+
+		the_hash_algo->init_fn(&c);
+		the_hash_algo->update_fn(&c, mmap + start, end - start);
+		the_hash_algo->final_fn(hash, &c);
+		if (hashcmp(hash, ieot->entries[i].hash))
+			die(_("index file corrupt: bad checksum for the block at %"PRIuMAX),
+			    (uintmax_t)start);
+
+		load_cache_entry_block(istate, istate->ce_mem_pool, nr,
+				       ieot->entries[i].nr, mmap, start);
+		nr += ieot->entries[i].nr;
+		blocks++;
 	}
+	trace2_data_intmax("index", "read/blocks", blocks);
+
+	istate->cache_nr = nr;
+	istate->timestamp.sec = st.st_mtime;
+	istate->timestamp.nsec = ST_MTIME_NSEC(st);
+	istate->initialized = 1;
+	istate->partial = 1;
+	munmap((void *)mmap, mmap_size);
+	free(ieot);
+	strbuf_release(&first);
+	strbuf_release(&next);
+	return istate->cache_nr;
+
+read_all:
+	munmap((void *)mmap, mmap_size);
+	free(ieot);
+	return read_index_from(istate, path, gitdir);
+}
+
+int is_index_unborn(struct index_state *istate)
+{
+	return (!istate->cache_nr && !istate->timestamp.sec);
+}
+
+int discard_index(struct index_state *istate)
+{
+	/*
+	 * Cache entries in istate->cache[] are allocated from the memory
+	 * pool of this index, or of its split index base, and are freed
+	 * together with the pool below. There is no need to free them
+	 * one by one.
+	 */
 	resolve_undo_clear_index(istate);
 	istate->cache_nr = 0;
 	istate->cache_changed = 0;
@@ -1967,8 +2830,24 @@ int discard_index(struct index_state *istate)
 	free_name_hash(istate);
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
+	istate->sparse_index = 0;
+	istate->partial = 0;
 	FREE_AND_NULL(istate->cache);
 	istate->cache_alloc = 0;
+	if (istate->ce_mem_pool) {
+		struct split_index *si = istate->split_index;
+
+		/*
+		 * A base index shared with another index may still
+		 * point at our entries; let it own them.
+		 */
+		if (si && si->refcount > 1 && si->base) {
+			mem_pool_init(&si->base->ce_mem_pool, 0);
+			mem_pool_combine(si->base->ce_mem_pool, istate->ce_mem_pool);
+		}
+		mem_pool_discard(istate->ce_mem_pool);
+		istate->ce_mem_pool = NULL;
+	}
 	discard_split_index(istate);
 	free_untracked_cache(istate->untracked);
 	istate->untracked = NULL;
@@ -2023,11 +2902,16 @@ static int ce_write(git_hash_ctx *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_hash_ctx *context, int fd,
+static int write_index_ext_header(git_hash_ctx *context,
+				  git_hash_ctx *eoie_context, int fd,
 				  unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		the_hash_algo->update_fn(eoie_context, &ext, 4);
+		the_hash_algo->update_fn(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
@@ -2132,8 +3016,18 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
-			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
+/* Like ce_write(), but also feed the data to "block_c", if any. */
+static int ce_write_block(git_hash_ctx *c, git_hash_ctx *block_c, int fd,
+			  void *data, unsigned int len)
+{
+	if (block_c)
+		the_hash_algo->update_fn(block_c, data, len);
+	return ce_write(c, fd, data, len);
+}
+
+static int ce_write_entry(git_hash_ctx *c, git_hash_ctx *block_c, int fd,
+			  struct cache_entry *ce, struct strbuf *previous_name,
+			  struct ondisk_cache_entry *ondisk)
 {
 	int size;
 	int result;
@@ -2155,11 +3049,11 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		result = ce_write(c, fd, ondisk, size);
+		result = ce_write_block(c, block_c, fd, ondisk, size);
 		if (!result)
-			result = ce_write(c, fd, ce->name, len);
+			result = ce_write_block(c, block_c, fd, ce->name, len);
 		if (!result)
-			result = ce_write(c, fd, padding, align_padding_size(size, len));
+			result = ce_write_block(c, block_c, fd, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2173,13 +3067,13 @@ static int ce_write_entry(git_hash_ctx *c, int fd, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		result = ce_write(c, fd, ondisk, size);
+		result = ce_write_block(c, block_c, fd, ondisk, size);
 		if (!result)
-			result = ce_write(c, fd, to_remove_vi, prefix_size);
+			result = ce_write_block(c, block_c, fd, to_remove_vi, prefix_size);
 		if (!result)
-			result = ce_write(c, fd, ce->name + common, ce_namelen(ce) - common);
+			result = ce_write_block(c, block_c, fd, ce->name + common, ce_namelen(ce) - common);
 		if (!result)
-			result = ce_write(c, fd, padding, 1);
+			result = ce_write_block(c, block_c, fd, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2258,6 +3152,28 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
+/*
+ * The number of entries a block of a version 5 index should have, at
+ * least unless it is the last one.
+ */
+static int index_block_entries(void)
+{
+	int nr = git_env_ulong("GIT_TEST_INDEX_BLOCK_ENTRIES", 1024);
+
+	return nr > 0 ? nr : 1;
+}
+
+static int same_directory(const struct cache_entry *a,
+			  const struct cache_entry *b)
+{
+	const char *slash_a = strrchr(a->name, '/');
+	const char *slash_b = strrchr(b->name, '/');
+	size_t len_a = slash_a ? slash_a - a->name : 0;
+	size_t len_b = slash_b ? slash_b - b->name : 0;
+
+	return len_a == len_b && !memcmp(a->name, b->name, len_a);
+}
+
 /*
  * On success, `tempfile` is closed. If it is the temporary file
  * of a `struct lock_file`, we will therefore effectively perform
@@ -2270,7 +3186,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 {
 	uint64_t start = getnanotime();
 	int newfd = tempfile->fd;
-	git_hash_ctx c;
+	git_hash_ctx c, eoie_c_storage, *eoie_c = NULL;
 	struct cache_header hdr;
 	int i, err = 0, removed, extended, hdr_version;
 	struct cache_entry **cache = istate->cache;
@@ -2279,6 +3195,18 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct ondisk_cache_entry_extended ondisk;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 	int drop_cache_tree = istate->drop_cache_tree;
+	off_t offset;
+	int ieot_entries = 1;
+	struct index_entry_offset_table *ieot = NULL;
+	git_hash_ctx block_c_storage, *block_c = NULL;
+	const struct cache_entry *prev = NULL;
+	int nr;
+#ifndef NO_PTHREADS
+	int nr_threads;
+#endif
+
+	if (istate->partial)
+		BUG("cannot write a partially read index");
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -2312,12 +3240,90 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
-	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
+	/*
+	 * A version 5 index is always split into blocks, of entries of
+	 * whole directories where possible, with a checksum each.
+	 */
+	if (!strip_extensions && hdr_version >= 5) {
+		ieot_entries = index_block_entries();
+		ieot = xcalloc(1, sizeof(struct index_entry_offset_table)
+			+ ((entries / ieot_entries + 1) * sizeof(struct index_entry_offset)));
+		ieot->hashed = 1;
+		block_c = &block_c_storage;
+		the_hash_algo->init_fn(block_c);
+	}
+
+#ifndef NO_PTHREADS
+	/*
+	 * Only split the entries into blocks that can be read in parallel
+	 * when "index.threads" asks for more than one thread.
+	 */
+	if (!ieot && !strip_extensions &&
+	    !git_config_get_index_threads(&nr_threads) && nr_threads != 1) {
+		int ieot_blocks, cpus;
+
+		if (!nr_threads) {
+			ieot_blocks = istate->cache_nr / THREAD_COST;
+			cpus = online_cpus();
+			if (ieot_blocks > cpus - 1)
+				ieot_blocks = cpus - 1;
+		} else {
+			ieot_blocks = nr_threads;
+			if (ieot_blocks > istate->cache_nr)
+				ieot_blocks = istate->cache_nr;
+		}
+
+		/*
+		 * no reason to write out the IEOT extension if we don't
+		 * have enough blocks to utilize multi-threading
+		 */
+		if (ieot_blocks > 1) {
+			ieot = xcalloc(1, sizeof(struct index_entry_offset_table)
+				+ (ieot_blocks * sizeof(struct index_entry_offset)));
+			ieot_entries = DIV_ROUND_UP(entries, ieot_blocks);
+		}
+	}
+#endif
+
+	offset = lseek(newfd, 0, SEEK_CUR);
+	if (offset < 0) {
+		free(ieot);
+		return -1;
+	}
+	offset += write_buffer_len;
+	nr = 0;
+	previous_name = (hdr_version >= 4) ? &previous_name_buf : NULL;
 
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
+		if (ieot && nr >= ieot_entries &&
+		    (!block_c || nr >= 2 * ieot_entries ||
+		     !same_directory(prev, ce))) {
+			ieot->entries[ieot->nr].nr = nr;
+			ieot->entries[ieot->nr].offset = offset;
+			if (block_c) {
+				the_hash_algo->final_fn(ieot->entries[ieot->nr].hash, block_c);
+				the_hash_algo->init_fn(block_c);
+			}
+			ieot->nr++;
+			/*
+			 * If we have a V4 index, set the first byte to an
+			 * invalid character to ensure there is nothing
+			 * common with the previous entry, so the first
+			 * entry of each block carries its full name.
+			 */
+			if (previous_name)
+				previous_name->buf[0] = 0;
+			nr = 0;
+			offset = lseek(newfd, 0, SEEK_CUR);
+			if (offset < 0) {
+				free(ieot);
+				return -1;
+			}
+			offset += write_buffer_len;
+		}
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
 		if (is_null_oid(&ce->oid)) {
@@ -2333,23 +3339,61 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 
 			drop_cache_tree = 1;
 		}
-		if (ce_write_entry(&c, newfd, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
+		if (ce_write_entry(&c, block_c, newfd, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
 			err = -1;
 
 		if (err)
 			break;
+		nr++;
+		prev = ce;
+	}
+	if (ieot && nr) {
+		ieot->entries[ieot->nr].nr = nr;
+		ieot->entries[ieot->nr].offset = offset;
+		if (block_c)
+			the_hash_algo->final_fn(ieot->entries[ieot->nr].hash, block_c);
+		ieot->nr++;
 	}
 	strbuf_release(&previous_name_buf);
 
-	if (err)
+	if (err) {
+		free(ieot);
 		return err;
+	}
 
 	/* Write extension data here */
+	offset = lseek(newfd, 0, SEEK_CUR);
+	if (offset < 0) {
+		free(ieot);
+		return -1;
+	}
+	offset += write_buffer_len;
+	if (ieot) {
+		/* the "EOIE" extension is only useful together with "IEOT" */
+		the_hash_algo->init_fn(&eoie_c_storage);
+		eoie_c = &eoie_c_storage;
+	}
+
+	/*
+	 * The "IEOT" extension is written first so that readers can find
+	 * it quickly.
+	 */
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_ieot_extension(&sb, ieot);
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_INDEXENTRYOFFSETTABLE, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		free(ieot);
+		if (err)
+			return -1;
+	}
 	if (!strip_extensions && istate->split_index) {
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2360,7 +3404,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -2370,7 +3414,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2381,7 +3425,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_untracked_extension(&sb, istate->untracked);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_UNTRACKED,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_UNTRACKED,
 					     sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2392,7 +3436,31 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_fsmonitor_extension(&sb, istate);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_FSMONITOR, sb.len) < 0
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_FSMONITOR, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	/*
+	 * The sparse directory entries cannot be stripped; the "sdir"
+	 * extension tells readers that they are there.
+	 */
+	if (istate->sparse_index) {
+		if (write_index_ext_header(&c, eoie_c, newfd,
+					   CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0)
+			return -1;
+	}
+
+	/*
+	 * The "EOIE" extension must be the last extension written so
+	 * that readers can find it right before the trailing hash.
+	 */
+	if (eoie_c) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_eoie_extension(&sb, eoie_c, offset);
+		err = write_index_ext_header(&c, NULL, newfd, CACHE_EXT_ENDOFINDEXENTRIES, sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -2429,7 +3497,21 @@ static int commit_locked_index(struct lock_file *lk)
 static int do_write_locked_index(struct index_state *istate, struct lock_file *lock,
 				 unsigned flags)
 {
-	int ret = do_write_index(istate, lock->tempfile, 0);
+	int ret;
+	int was_full = !istate->sparse_index;
+
+	ret = convert_to_sparse(istate);
+	if (ret)
+		return ret;
+
+	trace2_region_enter("index", "do_write_index");
+	ret = do_write_index(istate, lock->tempfile, 0);
+	trace2_region_leave("index", "do_write_index");
+	trace2_data_intmax("index", "write/cache_nr", istate->cache_nr);
+
+	/* hand a full index back to callers that had one */
+	if (was_full)
+		ensure_full_index(istate);
 	if (ret)
 		return ret;
 	if (flags & COMMIT_LOCK)
@@ -2534,7 +3616,7 @@ static int write_shared_index(struct index_state *istate,
 
 static const int default_max_percent_split_change = 20;
 
-static int too_many_not_shared_entries(struct index_state *istate)
+int too_many_not_shared_entries(struct index_state *istate)
 {
 	int i, not_shared = 0;
 	int max_split = git_config_get_max_percent_split_change();
@@ -2590,7 +3672,12 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		if ((v & 15) < 6)
 			istate->cache_changed |= SPLIT_INDEX_ORDERED;
 	}
-	if (too_many_not_shared_entries(istate))
+	/*
+	 * With splitIndex.deferRewrite, the "split-index" maintenance task
+	 * writes the new shared index instead.
+	 */
+	if (git_config_get_split_index_defer_rewrite() <= 0 &&
+	    too_many_not_shared_entries(istate))
 		istate->cache_changed |= SPLIT_INDEX_ORDERED;
 
 	new_shared_index = istate->cache_changed & SPLIT_INDEX_ORDERED;
@@ -2647,14 +3734,13 @@ int read_index_unmerged(struct index_state *istate)
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce = istate->cache[i];
 		struct cache_entry *new_ce;
-		int size, len;
+		int len;
 
 		if (!ce_stage(ce))
 			continue;
 		unmerged = 1;
 		len = ce_namelen(ce);
-		size = cache_entry_size(len);
-		new_ce = xcalloc(1, size);
+		new_ce = make_empty_cache_entry(istate, len);
 		memcpy(new_ce->name, ce->name, len);
 		new_ce->ce_flags = create_ce_flags(0) | CE_CONFLICTED;
 		new_ce->ce_namelen = len;
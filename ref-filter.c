@@ -5,6 +5,7 @@
 #include "wildmatch.h"
 #include "object-store.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "remote.h"
 #include "color.h"
 #include "tag.h"
@@ -16,8 +17,6 @@
 #include "version.h"
 #include "trailer.h"
 #include "wt-status.h"
-#include "commit-slab.h"
-#include "commit-graph.h"
 
 static struct ref_msg {
 	const char *gone;
@@ -42,6 +41,7 @@ void setup_ref_filter_porcelain_msg(void)
 
 typedef enum { FIELD_STR, FIELD_ULONG, FIELD_TIME } cmp_type;
 typedef enum { COMPARE_EQUAL, COMPARE_UNEQUAL, COMPARE_NONE } cmp_status;
+typedef enum { SOURCE_NONE = 0, SOURCE_OBJ, SOURCE_OTHER } info_source;
 
 struct align {
 	align_type position;
@@ -73,6 +73,7 @@ struct refname_atom {
  */
 static struct used_atom {
 	const char *name;
+	info_source source;
 	cmp_type type;
 	union {
 		char color[COLOR_MAXLEN];
@@ -103,6 +104,21 @@ static struct used_atom {
 } *used_atom;
 static int used_atom_cnt, need_tagged, need_symref;
 
+/*
+ * What we need to know about the object a ref points at ("oi"), and
+ * about the object a tag refers to ("oi_deref"). Atoms that only
+ * need the type or size ask oid_object_info_extended() for them, so
+ * that the object is not read at all unless some atom needs its
+ * contents.
+ */
+static struct expand_data {
+	struct object_id oid;
+	enum object_type type;
+	unsigned long size;
+	void *content;
+	struct object_info info;
+} oi, oi_deref;
+
 /*
  * Expand string, append it to strbuf *sb, then return error code ret.
  * Allow to save few lines of code.
@@ -381,49 +397,50 @@ static int head_atom_parser(const struct ref_format *format, struct used_atom *a
 
 static struct {
 	const char *name;
+	info_source source;
 	cmp_type cmp_type;
 	int (*parser)(const struct ref_format *format, struct used_atom *atom,
 		      const char *arg, struct strbuf *err);
 } valid_atom[] = {
-	{ "refname" , FIELD_STR, refname_atom_parser },
-	{ "objecttype" },
-	{ "objectsize", FIELD_ULONG },
-	{ "objectname", FIELD_STR, objectname_atom_parser },
-	{ "tree" },
-	{ "parent" },
-	{ "numparent", FIELD_ULONG },
-	{ "object" },
-	{ "type" },
-	{ "tag" },
-	{ "author" },
-	{ "authorname" },
-	{ "authoremail" },
-	{ "authordate", FIELD_TIME },
-	{ "committer" },
-	{ "committername" },
-	{ "committeremail" },
-	{ "committerdate", FIELD_TIME },
-	{ "tagger" },
-	{ "taggername" },
-	{ "taggeremail" },
-	{ "taggerdate", FIELD_TIME },
-	{ "creator" },
-	{ "creatordate", FIELD_TIME },
-	{ "subject", FIELD_STR, subject_atom_parser },
-	{ "body", FIELD_STR, body_atom_parser },
-	{ "trailers", FIELD_STR, trailers_atom_parser },
-	{ "contents", FIELD_STR, contents_atom_parser },
-	{ "upstream", FIELD_STR, remote_ref_atom_parser },
-	{ "push", FIELD_STR, remote_ref_atom_parser },
-	{ "symref", FIELD_STR, refname_atom_parser },
-	{ "flag" },
-	{ "HEAD", FIELD_STR, head_atom_parser },
-	{ "color", FIELD_STR, color_atom_parser },
-	{ "align", FIELD_STR, align_atom_parser },
-	{ "end" },
-	{ "if", FIELD_STR, if_atom_parser },
-	{ "then" },
-	{ "else" },
+	{ "refname", SOURCE_NONE, FIELD_STR, refname_atom_parser },
+	{ "objecttype", SOURCE_OTHER },
+	{ "objectsize", SOURCE_OTHER, FIELD_ULONG },
+	{ "objectname", SOURCE_OTHER, FIELD_STR, objectname_atom_parser },
+	{ "tree", SOURCE_OBJ },
+	{ "parent", SOURCE_OBJ },
+	{ "numparent", SOURCE_OBJ, FIELD_ULONG },
+	{ "object", SOURCE_OBJ },
+	{ "type", SOURCE_OBJ },
+	{ "tag", SOURCE_OBJ },
+	{ "author", SOURCE_OBJ },
+	{ "authorname", SOURCE_OBJ },
+	{ "authoremail", SOURCE_OBJ },
+	{ "authordate", SOURCE_OBJ, FIELD_TIME },
+	{ "committer", SOURCE_OBJ },
+	{ "committername", SOURCE_OBJ },
+	{ "committeremail", SOURCE_OBJ },
+	{ "committerdate", SOURCE_OBJ, FIELD_TIME },
+	{ "tagger", SOURCE_OBJ },
+	{ "taggername", SOURCE_OBJ },
+	{ "taggeremail", SOURCE_OBJ },
+	{ "taggerdate", SOURCE_OBJ, FIELD_TIME },
+	{ "creator", SOURCE_OBJ },
+	{ "creatordate", SOURCE_OBJ, FIELD_TIME },
+	{ "subject", SOURCE_OBJ, FIELD_STR, subject_atom_parser },
+	{ "body", SOURCE_OBJ, FIELD_STR, body_atom_parser },
+	{ "trailers", SOURCE_OBJ, FIELD_STR, trailers_atom_parser },
+	{ "contents", SOURCE_OBJ, FIELD_STR, contents_atom_parser },
+	{ "upstream", SOURCE_NONE, FIELD_STR, remote_ref_atom_parser },
+	{ "push", SOURCE_NONE, FIELD_STR, remote_ref_atom_parser },
+	{ "symref", SOURCE_NONE, FIELD_STR, refname_atom_parser },
+	{ "flag", SOURCE_NONE },
+	{ "HEAD", SOURCE_NONE, FIELD_STR, head_atom_parser },
+	{ "color", SOURCE_NONE, FIELD_STR, color_atom_parser },
+	{ "align", SOURCE_NONE, FIELD_STR, align_atom_parser },
+	{ "end", SOURCE_NONE },
+	{ "if", SOURCE_NONE, FIELD_STR, if_atom_parser },
+	{ "then", SOURCE_NONE },
+	{ "else", SOURCE_NONE },
 };
 
 #define REF_FORMATTING_STATE_INIT  { 0, NULL }
@@ -498,6 +515,7 @@ static int parse_ref_filter_atom(const struct ref_format *format,
 	used_atom_cnt++;
 	REALLOC_ARRAY(used_atom, used_atom_cnt);
 	used_atom[at].name = xmemdupz(atom, ep - atom);
+	used_atom[at].source = valid_atom[i].source;
 	used_atom[at].type = valid_atom[i].cmp_type;
 	if (arg) {
 		arg = used_atom[at].name + (arg - atom) + 1;
@@ -514,6 +532,18 @@ static int parse_ref_filter_atom(const struct ref_format *format,
 		return -1;
 	if (*atom == '*')
 		need_tagged = 1;
+	if (valid_atom[i].source == SOURCE_OBJ) {
+		if (*atom == '*')
+			oi_deref.info.contentp = &oi_deref.content;
+		else
+			oi.info.contentp = &oi.content;
+	}
+	if (!strcmp(valid_atom[i].name, "objectsize")) {
+		if (*atom == '*')
+			oi_deref.info.sizep = &oi_deref.size;
+		else
+			oi.info.sizep = &oi.size;
+	}
 	if (!strcmp(valid_atom[i].name, "symref"))
 		need_symref = 1;
 	return at;
@@ -800,18 +830,6 @@ int verify_ref_format(struct ref_format *format)
  * by the "struct object" representation, set *eaten as well---it is a
  * signal from parse_object_buffer to us not to free the buffer.
  */
-static void *get_obj(const struct object_id *oid, struct object **obj, unsigned long *sz, int *eaten)
-{
-	enum object_type type;
-	void *buf = read_object_file(oid, &type, sz);
-
-	if (buf)
-		*obj = parse_object_buffer(oid, type, *sz, buf, eaten);
-	else
-		*obj = NULL;
-	return buf;
-}
-
 static int grab_objectname(const char *name, const struct object_id *oid,
 			   struct atom_value *v, struct used_atom *atom)
 {
@@ -831,8 +849,8 @@ static int grab_objectname(const char *name, const struct object_id *oid,
 	return 0;
 }
 
-/* See grab_values */
-static void grab_common_values(struct atom_value *val, int deref, struct object *obj, void *buf, unsigned long sz)
+/* Fill the atoms that oid_object_info_extended() can answer */
+static void grab_common_values(struct atom_value *val, int deref, struct expand_data *oi)
 {
 	int i;
 
@@ -844,13 +862,13 @@ static void grab_common_values(struct atom_value *val, int deref, struct object
 		if (deref)
 			name++;
 		if (!strcmp(name, "objecttype"))
-			v->s = type_name(obj->type);
+			v->s = type_name(oi->type);
 		else if (!strcmp(name, "objectsize")) {
-			v->value = sz;
-			v->s = xstrfmt("%lu", sz);
+			v->value = oi->size;
+			v->s = xstrfmt("%lu", oi->size);
 		}
 		else if (deref)
-			grab_objectname(name, &obj->oid, v, &used_atom[i]);
+			grab_objectname(name, &oi->oid, v, &used_atom[i]);
 	}
 }
 
@@ -928,6 +946,22 @@ static const char *find_wholine(const char *who, int wholen, const char *buf, un
 	return "";
 }
 
+static const char *find_person(const char *who, int wholen,
+			       struct object *obj, const char *buf,
+			       unsigned long sz)
+{
+	if (obj->type == OBJ_COMMIT &&
+	    (!strcmp(who, "author") || !strcmp(who, "committer"))) {
+		enum commit_header key = *who == 'a' ? COMMIT_HEADER_AUTHOR :
+						       COMMIT_HEADER_COMMITTER;
+		size_t len;
+		const char *v = find_commit_header_cached((struct commit *)obj,
+							  buf, key, &len);
+		return v ? v : "";
+	}
+	return find_wholine(who, wholen, buf, sz);
+}
+
 static const char *copy_line(const char *buf)
 {
 	const char *eol = strchrnul(buf, '\n');
@@ -1027,7 +1061,7 @@ static void grab_person(const char *who, struct atom_value *val, int deref, stru
 		    !starts_with(name + wholen, "date"))
 			continue;
 		if (!wholine)
-			wholine = find_wholine(who, wholen, buf, sz);
+			wholine = find_person(who, wholen, obj, buf, sz);
 		if (!wholine)
 			return; /* no point looking for it */
 		if (name[wholen] == 0)
@@ -1047,7 +1081,7 @@ static void grab_person(const char *who, struct atom_value *val, int deref, stru
 	if (strcmp(who, "tagger") && strcmp(who, "committer"))
 		return; /* "author" for commit object is not wanted */
 	if (!wholine)
-		wholine = find_wholine(who, wholen, buf, sz);
+		wholine = find_person(who, wholen, obj, buf, sz);
 	if (!wholine)
 		return;
 	for (i = 0; i < used_atom_cnt; i++) {
@@ -1209,7 +1243,6 @@ static void fill_missing_values(struct atom_value *val)
  */
 static void grab_values(struct atom_value *val, int deref, struct object *obj, void *buf, unsigned long sz)
 {
-	grab_common_values(val, deref, obj, buf, sz);
 	switch (obj->type) {
 	case OBJ_TAG:
 		grab_tag_values(val, deref, obj, buf, sz);
@@ -1433,23 +1466,36 @@ static const char *get_refname(struct used_atom *atom, struct ref_array_item *re
 	return show_ref(&atom->u.refname, ref->refname);
 }
 
-static int get_object(struct ref_array_item *ref, const struct object_id *oid,
-		       int deref, struct object **obj, struct strbuf *err)
+static int get_object(struct ref_array_item *ref, int deref, struct object **obj,
+		      struct expand_data *oi, struct strbuf *err)
 {
-	int eaten;
+	/* parse_object_buffer() sets eaten to 0 if we have to free() */
+	int eaten = 1;
 	int ret = 0;
-	unsigned long size;
-	void *buf = get_obj(oid, obj, &size, &eaten);
-	if (!buf)
-		ret = strbuf_addf_ret(err, -1, _("missing object %s for %s"),
-				      oid_to_hex(oid), ref->refname);
-	else if (!*obj)
-		ret = strbuf_addf_ret(err, -1, _("parse_object_buffer failed on %s for %s"),
-				      oid_to_hex(oid), ref->refname);
-	else
-		grab_values(ref->value, deref, *obj, buf, size);
+
+	oi->info.typep = &oi->type;
+	if (oi->info.contentp)
+		/* parse_object_buffer() needs the size as well */
+		oi->info.sizep = &oi->size;
+	*obj = NULL;
+	if (oid_object_info_extended(the_repository, &oi->oid, &oi->info,
+				     OBJECT_INFO_LOOKUP_REPLACE))
+		return strbuf_addf_ret(err, -1, _("missing object %s for %s"),
+				       oid_to_hex(&oi->oid), ref->refname);
+
+	if (oi->info.contentp) {
+		*obj = parse_object_buffer(&oi->oid, oi->type, oi->size,
+					   oi->content, &eaten);
+		if (!*obj)
+			ret = strbuf_addf_ret(err, -1, _("parse_object_buffer failed on %s for %s"),
+					      oid_to_hex(&oi->oid), ref->refname);
+		else
+			grab_values(ref->value, deref, *obj, oi->content, oi->size);
+	}
+	if (!ret)
+		grab_common_values(ref->value, deref, oi);
 	if (!eaten)
-		free(buf);
+		free(oi->content);
 	return ret;
 }
 
@@ -1580,7 +1626,11 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 	if (used_atom_cnt <= i)
 		return 0;
 
-	if (get_object(ref, &ref->objectname, 0, &obj, err))
+	/* We need the tag itself to find the object it refers to */
+	if (need_tagged)
+		oi.info.contentp = &oi.content;
+	oidcpy(&oi.oid, &ref->objectname);
+	if (get_object(ref, 0, &obj, &oi, err))
 		return -1;
 
 	/*
@@ -1602,7 +1652,8 @@ static int populate_value(struct ref_array_item *ref, struct strbuf *err)
 	 * is not consistent with what deref_tag() does
 	 * which peels the onion to the core.
 	 */
-	return get_object(ref, tagged, 1, &obj, err);
+	oidcpy(&oi_deref.oid, tagged);
+	return get_object(ref, 1, &obj, &oi_deref, err);
 }
 
 /*
@@ -1621,144 +1672,11 @@ static int get_ref_atom_value(struct ref_array_item *ref, int atom,
 	return 0;
 }
 
-/*
- * Unknown has to be "0" here, because that's the default value for
- * contains_cache slab entries that have not yet been assigned.
- */
-enum contains_result {
-	CONTAINS_UNKNOWN = 0,
-	CONTAINS_NO,
-	CONTAINS_YES
-};
-
-define_commit_slab(contains_cache, enum contains_result);
-
 struct ref_filter_cbdata {
 	struct ref_array *array;
 	struct ref_filter *filter;
-	struct contains_cache contains_cache;
-	struct contains_cache no_contains_cache;
 };
 
-/*
- * Mimicking the real stack, this stack lives on the heap, avoiding stack
- * overflows.
- *
- * At each recursion step, the stack items points to the commits whose
- * ancestors are to be inspected.
- */
-struct contains_stack {
-	int nr, alloc;
-	struct contains_stack_entry {
-		struct commit *commit;
-		struct commit_list *parents;
-	} *contains_stack;
-};
-
-static int in_commit_list(const struct commit_list *want, struct commit *c)
-{
-	for (; want; want = want->next)
-		if (!oidcmp(&want->item->object.oid, &c->object.oid))
-			return 1;
-	return 0;
-}
-
-/*
- * Test whether the candidate is contained in the list.
- * Do not recurse to find out, though, but return -1 if inconclusive.
- */
-static enum contains_result contains_test(struct commit *candidate,
-					  const struct commit_list *want,
-					  struct contains_cache *cache,
-					  uint32_t cutoff)
-{
-	enum contains_result *cached = contains_cache_at(cache, candidate);
-
-	/* If we already have the answer cached, return that. */
-	if (*cached)
-		return *cached;
-
-	/* or are we it? */
-	if (in_commit_list(want, candidate)) {
-		*cached = CONTAINS_YES;
-		return CONTAINS_YES;
-	}
-
-	/* Otherwise, we don't know; prepare to recurse */
-	parse_commit_or_die(candidate);
-
-	if (candidate->generation < cutoff)
-		return CONTAINS_NO;
-
-	return CONTAINS_UNKNOWN;
-}
-
-static void push_to_contains_stack(struct commit *candidate, struct contains_stack *contains_stack)
-{
-	ALLOC_GROW(contains_stack->contains_stack, contains_stack->nr + 1, contains_stack->alloc);
-	contains_stack->contains_stack[contains_stack->nr].commit = candidate;
-	contains_stack->contains_stack[contains_stack->nr++].parents = candidate->parents;
-}
-
-static enum contains_result contains_tag_algo(struct commit *candidate,
-					      const struct commit_list *want,
-					      struct contains_cache *cache)
-{
-	struct contains_stack contains_stack = { 0, 0, NULL };
-	enum contains_result result;
-	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
-	const struct commit_list *p;
-
-	for (p = want; p; p = p->next) {
-		struct commit *c = p->item;
-		load_commit_graph_info(c);
-		if (c->generation < cutoff)
-			cutoff = c->generation;
-	}
-
-	result = contains_test(candidate, want, cache, cutoff);
-	if (result != CONTAINS_UNKNOWN)
-		return result;
-
-	push_to_contains_stack(candidate, &contains_stack);
-	while (contains_stack.nr) {
-		struct contains_stack_entry *entry = &contains_stack.contains_stack[contains_stack.nr - 1];
-		struct commit *commit = entry->commit;
-		struct commit_list *parents = entry->parents;
-
-		if (!parents) {
-			*contains_cache_at(cache, commit) = CONTAINS_NO;
-			contains_stack.nr--;
-		}
-		/*
-		 * If we just popped the stack, parents->item has been marked,
-		 * therefore contains_test will return a meaningful yes/no.
-		 */
-		else switch (contains_test(parents->item, want, cache, cutoff)) {
-		case CONTAINS_YES:
-			*contains_cache_at(cache, commit) = CONTAINS_YES;
-			contains_stack.nr--;
-			break;
-		case CONTAINS_NO:
-			entry->parents = parents->next;
-			break;
-		case CONTAINS_UNKNOWN:
-			push_to_contains_stack(parents->item, &contains_stack);
-			break;
-		}
-	}
-	free(contains_stack.contains_stack);
-	return contains_test(candidate, want, cache, cutoff);
-}
-
-static int commit_contains(struct ref_filter *filter, struct commit *commit,
-			   struct commit_list *list, struct contains_cache *cache)
-{
-	if (filter->with_commit_tag_algo)
-		return contains_tag_algo(commit, list, cache) == CONTAINS_YES;
-	return is_descendant_of(commit, list);
-}
-
 /*
  * Return 1 if the refname matches one of the patterns, otherwise 0.
  * A pattern can be a literal prefix (e.g. a refname "refs/heads/master"
@@ -2028,22 +1946,15 @@ static int ref_filter_handler(const char *refname, const struct object_id *oid,
 		return 0;
 
 	/*
-	 * A merge filter is applied on refs pointing to commits. Hence
-	 * obtain the commit using the 'oid' available and discard all
-	 * non-commits early. The actual filtering is done later.
+	 * The merge and contains filters are applied on refs pointing
+	 * to commits. Hence obtain the commit using the 'oid' available
+	 * and discard all non-commits early. The actual filtering is
+	 * done later.
 	 */
 	if (filter->merge_commit || filter->with_commit || filter->no_commit || filter->verbose) {
 		commit = lookup_commit_reference_gently(oid, 1);
 		if (!commit)
 			return 0;
-		/* We perform the filtering for the '--contains' option... */
-		if (filter->with_commit &&
-		    !commit_contains(filter, commit, filter->with_commit, &ref_cbdata->contains_cache))
-			return 0;
-		/* ...or for the `--no-contains' option */
-		if (filter->no_commit &&
-		    commit_contains(filter, commit, filter->no_commit, &ref_cbdata->no_contains_cache))
-			return 0;
 	}
 
 	/*
@@ -2077,6 +1988,46 @@ void ref_array_clear(struct ref_array *array)
 	array->nr = array->alloc = 0;
 }
 
+/*
+ * Apply the '--contains' and '--no-contains' filters to all the refs
+ * at once, so that the walks from the refs share their work.
+ */
+static void do_contains_filter(struct ref_filter_cbdata *ref_cbdata)
+{
+	struct ref_filter *filter = ref_cbdata->filter;
+	struct ref_array *array = ref_cbdata->array;
+	struct commit **commits;
+	unsigned char *with = NULL, *without = NULL;
+	int i, old_nr = array->nr;
+
+	ALLOC_ARRAY(commits, old_nr);
+	for (i = 0; i < old_nr; i++)
+		commits[i] = array->items[i]->commit;
+
+	if (filter->with_commit) {
+		with = xmalloc(old_nr);
+		commits_contain(filter, commits, old_nr, filter->with_commit, with);
+	}
+	if (filter->no_commit) {
+		without = xmalloc(old_nr);
+		commits_contain(filter, commits, old_nr, filter->no_commit, without);
+	}
+
+	array->nr = 0;
+	for (i = 0; i < old_nr; i++) {
+		struct ref_array_item *item = array->items[i];
+
+		if ((with && !with[i]) || (without && without[i]))
+			free_array_item(item);
+		else
+			array->items[array->nr++] = item;
+	}
+
+	free(commits);
+	free(with);
+	free(without);
+}
+
 static void do_merge_filter(struct ref_filter_cbdata *ref_cbdata)
 {
 	struct rev_info revs;
@@ -2139,9 +2090,6 @@ int filter_refs(struct ref_array *array, struct ref_filter *filter, unsigned int
 		broken = 1;
 	filter->kind = type & FILTER_REFS_KIND_MASK;
 
-	init_contains_cache(&ref_cbdata.contains_cache);
-	init_contains_cache(&ref_cbdata.no_contains_cache);
-
 	/*  Simple per-ref filtering */
 	if (!filter->kind)
 		die("filter_refs: invalid type");
@@ -2164,39 +2112,52 @@ int filter_refs(struct ref_array *array, struct ref_filter *filter, unsigned int
 			head_ref(ref_filter_handler, &ref_cbdata);
 	}
 
-	clear_contains_cache(&ref_cbdata.contains_cache);
-	clear_contains_cache(&ref_cbdata.no_contains_cache);
-
 	/*  Filters that need revision walking */
+	if (filter->with_commit || filter->no_commit)
+		do_contains_filter(&ref_cbdata);
 	if (filter->merge_commit)
 		do_merge_filter(&ref_cbdata);
 
 	return ret;
 }
 
-static int cmp_ref_sorting(struct ref_sorting *s, struct ref_array_item *a, struct ref_array_item *b)
+/*
+ * The values of the sort keys of a ref, computed once before sorting
+ * so that comparisons need not look them up again.
+ */
+struct sort_key {
+	const char *s;
+	uintmax_t value;
+};
+
+struct sort_entry {
+	struct ref_array_item *item;
+	struct sort_key *keys;
+};
+
+struct sort_context {
+	struct ref_sorting *sorting;
+	cmp_type *types;
+};
+
+static int cmp_sort_key(struct ref_sorting *s, cmp_type cmp_type,
+			const struct sort_entry *a, const struct sort_entry *b,
+			int k)
 {
-	struct atom_value *va, *vb;
-	int cmp;
-	cmp_type cmp_type = used_atom[s->atom].type;
+	const struct sort_key *ka = &a->keys[k], *kb = &b->keys[k];
 	int (*cmp_fn)(const char *, const char *);
-	struct strbuf err = STRBUF_INIT;
+	int cmp;
 
-	if (get_ref_atom_value(a, s->atom, &va, &err))
-		die("%s", err.buf);
-	if (get_ref_atom_value(b, s->atom, &vb, &err))
-		die("%s", err.buf);
-	strbuf_release(&err);
 	cmp_fn = s->ignore_case ? strcasecmp : strcmp;
 	if (s->version)
-		cmp = versioncmp(va->s, vb->s);
+		cmp = versioncmp(ka->s, kb->s);
 	else if (cmp_type == FIELD_STR)
-		cmp = cmp_fn(va->s, vb->s);
+		cmp = cmp_fn(ka->s, kb->s);
 	else {
-		if (va->value < vb->value)
+		if (ka->value < kb->value)
 			cmp = -1;
-		else if (va->value == vb->value)
-			cmp = cmp_fn(a->refname, b->refname);
+		else if (ka->value == kb->value)
+			cmp = cmp_fn(a->item->refname, b->item->refname);
 		else
 			cmp = 1;
 	}
@@ -2204,23 +2165,259 @@ static int cmp_ref_sorting(struct ref_sorting *s, struct ref_array_item *a, stru
 	return (s->reverse) ? -cmp : cmp;
 }
 
-static int compare_refs(const void *a_, const void *b_, void *ref_sorting)
+static int compare_sort_entries(const void *a_, const void *b_, void *ctx_)
 {
-	struct ref_array_item *a = *((struct ref_array_item **)a_);
-	struct ref_array_item *b = *((struct ref_array_item **)b_);
+	const struct sort_entry *a = a_, *b = b_;
+	struct sort_context *ctx = ctx_;
 	struct ref_sorting *s;
+	int k;
 
-	for (s = ref_sorting; s; s = s->next) {
-		int cmp = cmp_ref_sorting(s, a, b);
+	for (s = ctx->sorting, k = 0; s; s = s->next, k++) {
+		int cmp = cmp_sort_key(s, ctx->types[k], a, b, k);
 		if (cmp)
 			return cmp;
 	}
 	return 0;
 }
 
+/*
+ * Merge the sorted runs entries[0..mid) and entries[mid..nr), keeping
+ * the entries of the first run first among equal ones.
+ */
+static void merge_sort_entries(struct sort_entry *entries, size_t mid,
+			       size_t nr, struct sort_entry *tmp,
+			       struct sort_context *ctx)
+{
+	size_t i = 0, j = mid, k = 0;
+
+	while (i < mid && j < nr) {
+		if (compare_sort_entries(&entries[j], &entries[i], ctx) < 0)
+			tmp[k++] = entries[j++];
+		else
+			tmp[k++] = entries[i++];
+	}
+	while (i < mid)
+		tmp[k++] = entries[i++];
+	COPY_ARRAY(entries, tmp, k);
+}
+
+#ifndef NO_PTHREADS
+
+#include <pthread.h>
+
+/*
+ * Sorting in threads is only worth it for large ref listings: give
+ * every thread at least THREAD_COST refs, and use at most MAX_PARALLEL
+ * of them.
+ */
+#define MAX_PARALLEL (8)
+#define THREAD_COST (20000)
+
+struct sort_thread {
+	pthread_t pthread;
+	struct sort_entry *entries;
+	size_t nr;
+	struct sort_context *ctx;
+};
+
+static void *sort_thread(void *data)
+{
+	struct sort_thread *t = data;
+	QSORT_S(t->entries, t->nr, compare_sort_entries, t->ctx);
+	return NULL;
+}
+
+static void sort_entries(struct sort_entry *entries, size_t nr,
+			 struct sort_context *ctx)
+{
+	struct sort_thread threads[MAX_PARALLEL];
+	struct sort_entry *tmp;
+	int i, nr_threads = nr / THREAD_COST;
+	size_t done;
+
+	if (nr_threads > online_cpus())
+		nr_threads = online_cpus();
+	if (nr_threads > MAX_PARALLEL)
+		nr_threads = MAX_PARALLEL;
+	if (nr_threads < 2) {
+		QSORT_S(entries, nr, compare_sort_entries, ctx);
+		return;
+	}
+
+	for (i = 0, done = 0; i < nr_threads; i++) {
+		struct sort_thread *t = &threads[i];
+		size_t end = (nr * (i + 1)) / nr_threads;
+
+		t->entries = entries + done;
+		t->nr = end - done;
+		t->ctx = ctx;
+		done = end;
+		if (pthread_create(&t->pthread, NULL, sort_thread, t))
+			die(_("unable to create threaded sort"));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i].pthread, NULL))
+			die(_("unable to join threaded sort"));
+
+	/* Merge the sorted runs into the first one, in order */
+	ALLOC_ARRAY(tmp, nr);
+	for (i = 1, done = threads[0].nr; i < nr_threads; i++) {
+		merge_sort_entries(entries, done, done + threads[i].nr,
+				   tmp, ctx);
+		done += threads[i].nr;
+	}
+	free(tmp);
+}
+
+#else
+
+static void sort_entries(struct sort_entry *entries, size_t nr,
+			 struct sort_context *ctx)
+{
+	QSORT_S(entries, nr, compare_sort_entries, ctx);
+}
+
+#endif
+
+/* Does the atom need to look at the object the ref points at? */
+static int atom_needs_object(const struct used_atom *atom)
+{
+	const char *name = atom->name;
+
+	if (atom->source == SOURCE_NONE)
+		return 0;
+	return *name == '*' || !starts_with(name, "objectname");
+}
+
+struct object_position {
+	struct ref_array_item *item;
+	struct packed_git *pack;
+	off_t offset;
+};
+
+static int compare_object_positions(const void *a_, const void *b_)
+{
+	const struct object_position *a = a_, *b = b_;
+
+	/* Loose objects go last, the rest by pack and offset */
+	if (a->pack != b->pack) {
+		if (!a->pack || !b->pack)
+			return a->pack ? -1 : 1;
+		return a->pack < b->pack ? -1 : 1;
+	}
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+void ref_array_populate(struct ref_array *array, int nr)
+{
+	struct object_position *pos;
+	struct strbuf err = STRBUF_INIT;
+	int i, pos_nr = 0;
+
+	for (i = 0; i < used_atom_cnt; i++)
+		if (atom_needs_object(&used_atom[i]))
+			break;
+	if (i == used_atom_cnt || nr < 2)
+		return;
+
+	ALLOC_ARRAY(pos, nr);
+	for (i = 0; i < nr; i++) {
+		struct ref_array_item *item = array->items[i];
+		struct object_info info = OBJECT_INFO_INIT;
+
+		if (item->value)
+			continue;
+		pos[pos_nr].item = item;
+		pos[pos_nr].pack = NULL;
+		pos[pos_nr].offset = 0;
+		if (!oid_object_info_extended(the_repository, &item->objectname,
+					      &info, OBJECT_INFO_LOOKUP_REPLACE) &&
+		    info.whence == OI_PACKED) {
+			pos[pos_nr].pack = info.u.packed.pack;
+			pos[pos_nr].offset = info.u.packed.offset;
+		}
+		pos_nr++;
+	}
+	QSORT(pos, pos_nr, compare_object_positions);
+
+	for (i = 0; i < pos_nr; i++) {
+		struct ref_array_item *item = pos[i].item;
+
+		/*
+		 * Leave the refs we fail on alone, so that the error
+		 * is reported when their values are asked for.
+		 */
+		if (populate_value(item, &err))
+			FREE_AND_NULL(item->value);
+		else
+			fill_missing_values(item->value);
+		strbuf_reset(&err);
+	}
+	strbuf_release(&err);
+	free(pos);
+}
+
 void ref_array_sort(struct ref_sorting *sorting, struct ref_array *array)
 {
-	QSORT_S(array->items, array->nr, compare_refs, sorting);
+	struct ref_sorting *s;
+
+	/*
+	 * If the sort keys need the objects, every one of them is going
+	 * to be read anyway; read them in the order they are stored.
+	 */
+	struct sort_context ctx;
+	struct sort_entry *entries;
+	struct sort_key *keys;
+	struct strbuf err = STRBUF_INIT;
+	int i, k, nr_keys = 0;
+
+	for (s = sorting; s; s = s->next)
+		if (atom_needs_object(&used_atom[s->atom])) {
+			ref_array_populate(array, array->nr);
+			break;
+		}
+
+	for (s = sorting; s; s = s->next) {
+		nr_keys++;
+		/* versioncmp() reads its configuration on first use */
+		if (s->version)
+			versioncmp("1", "2");
+	}
+	if (!nr_keys || array->nr < 2)
+		return;
+
+	ctx.sorting = sorting;
+	ALLOC_ARRAY(ctx.types, nr_keys);
+	for (s = sorting, k = 0; s; s = s->next, k++)
+		ctx.types[k] = used_atom[s->atom].type;
+
+	ALLOC_ARRAY(entries, array->nr);
+	ALLOC_ARRAY(keys, st_mult(array->nr, nr_keys));
+	for (i = 0; i < array->nr; i++) {
+		struct ref_array_item *item = array->items[i];
+
+		entries[i].item = item;
+		entries[i].keys = keys + st_mult(i, nr_keys);
+		for (s = sorting, k = 0; s; s = s->next, k++) {
+			struct atom_value *v;
+
+			if (get_ref_atom_value(item, s->atom, &v, &err))
+				die("%s", err.buf);
+			entries[i].keys[k].s = v->s;
+			entries[i].keys[k].value = v->value;
+		}
+	}
+	strbuf_release(&err);
+
+	sort_entries(entries, array->nr, &ctx);
+	for (i = 0; i < array->nr; i++)
+		array->items[i] = entries[i].item;
+
+	free(entries);
+	free(keys);
+	free(ctx.types);
 }
 
 static void append_literal(const char *cp, const char *ep, struct ref_formatting_state *state)
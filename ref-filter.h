@@ -109,6 +109,11 @@ void ref_array_clear(struct ref_array *array);
 int verify_ref_format(struct ref_format *format);
 /*  Sort the given ref_array as per the ref_sorting provided */
 void ref_array_sort(struct ref_sorting *sort, struct ref_array *array);
+/*
+ * Compute the values of the first "nr" refs of the ref_array up front,
+ * reading the objects they need in the order they are stored in the packs
+ */
+void ref_array_populate(struct ref_array *array, int nr);
 /*  Based on the given format and quote_style, fill the strbuf */
 int format_ref_array_item(struct ref_array_item *info,
 			  const struct ref_format *format,
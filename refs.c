@@ -20,7 +20,7 @@
 /*
  * List of all available backends
  */
-static struct ref_storage_be *refs_backends = &refs_be_files;
+static struct ref_storage_be *refs_backends = &refs_be_reftable;
 
 static struct ref_storage_be *find_ref_storage_backend(const char *name)
 {
@@ -1460,6 +1460,72 @@ int for_each_namespaced_ref(each_ref_fn fn, void *cb_data)
 	return ret;
 }
 
+int refs_for_each_fullref_in_prefixes(struct ref_store *refs,
+				      const char *namespace,
+				      const char **prefixes,
+				      each_ref_fn fn, void *cb_data)
+{
+	struct string_list full = STRING_LIST_INIT_DUP;
+	const char *last = NULL;
+	int i, ret = 0;
+
+	if (!prefixes || !*prefixes)
+		string_list_append_nodup(&full, xstrfmt("%srefs/", namespace));
+	for (; prefixes && *prefixes; prefixes++)
+		string_list_append_nodup(&full, xstrfmt("%s%s", namespace, *prefixes));
+
+	/*
+	 * Once sorted, a prefix comes right before those that extend
+	 * it, whose refs we iterate over with it. The remaining
+	 * prefixes cover disjoint, increasing ranges of refnames, so
+	 * the refs still come out in order.
+	 */
+	string_list_sort(&full);
+	for (i = 0; !ret && i < full.nr; i++) {
+		const char *prefix = full.items[i].string;
+
+		if (last && starts_with(prefix, last))
+			continue;
+		last = prefix;
+		ret = do_for_each_ref(refs, prefix, fn, 0, 0, cb_data);
+	}
+
+	string_list_clear(&full, 0);
+	return ret;
+}
+
+int refs_update_generation(const char *gitcommondir, int create)
+{
+	struct lock_file lock = LOCK_INIT;
+	char *path = xstrfmt("%s/%s", gitcommondir, REFS_GENERATION_FILE);
+	char *token = NULL;
+	int fd, ret = 0;
+
+	if (!create && access(path, F_OK))
+		goto out;
+
+	/*
+	 * If somebody else holds the lock, the token they are about to
+	 * store also comes after our update.
+	 */
+	fd = hold_lock_file_for_update(&lock, path, 0);
+	if (fd < 0) {
+		ret = -1;
+		goto out;
+	}
+	token = xstrfmt("%"PRIuMAX" %"PRIuMAX"\n",
+			(uintmax_t)getnanotime(), (uintmax_t)getpid());
+	if (write_in_full(fd, token, strlen(token)) < 0 ||
+	    commit_lock_file(&lock)) {
+		rollback_lock_file(&lock);
+		ret = -1;
+	}
+out:
+	free(token);
+	free(path);
+	return ret;
+}
+
 int refs_for_each_rawref(struct ref_store *refs, each_ref_fn fn, void *cb_data)
 {
 	return do_for_each_ref(refs, "", fn, 0,
@@ -1665,9 +1731,25 @@ static struct ref_store *ref_store_init(const char *gitdir,
 					unsigned int flags)
 {
 	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	/*
+	 * The main repository says which backend it uses in its
+	 * config; for others, like submodules, look at what is there.
+	 */
+	if ((flags & REF_STORE_MAIN) && repository_format_ref_storage) {
+		be_name = repository_format_ref_storage;
+	} else {
+		struct strbuf sb = STRBUF_INIT;
+
+		strbuf_addf(&sb, "%s/reftable", gitdir);
+		if (is_directory(sb.buf))
+			be_name = "reftable";
+		strbuf_release(&sb);
+	}
+	be = find_ref_storage_backend(be_name);
+
 	if (!be)
 		BUG("reference backend %s is unknown", be_name);
 
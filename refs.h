@@ -315,6 +315,17 @@ int for_each_glob_ref_in(each_ref_fn fn, const char *pattern,
 int head_ref_namespaced(each_ref_fn fn, void *cb_data);
 int for_each_namespaced_ref(each_ref_fn fn, void *cb_data);
 
+/*
+ * Iterate over the refs whose names are `namespace` followed by one
+ * of the NULL-terminated `prefixes`, each ref once, reading only
+ * those parts of the ref store. Without prefixes, iterate over
+ * `namespace` followed by "refs/".
+ */
+int refs_for_each_fullref_in_prefixes(struct ref_store *refs,
+				      const char *namespace,
+				      const char **prefixes,
+				      each_ref_fn fn, void *cb_data);
+
 /* can be used to learn about broken ref and symref */
 int refs_for_each_rawref(struct ref_store *refs, each_ref_fn fn, void *cb_data);
 int for_each_rawref(each_ref_fn fn, void *cb_data);
@@ -352,6 +363,21 @@ void warn_dangling_symref(FILE *fp, const char *msg_fmt, const char *refname);
 void warn_dangling_symrefs(FILE *fp, const char *msg_fmt,
 			   const struct string_list *refnames);
 
+/*
+ * While this file exists in the common git directory, the files
+ * backend rewrites it with a new token after each update of the refs,
+ * so that a cache of the refs can tell whether it is still current by
+ * comparing the token it was made with to the one in the file.
+ */
+#define REFS_GENERATION_FILE "refs-generation"
+
+/*
+ * Store a new token into REFS_GENERATION_FILE in `gitcommondir`,
+ * creating the file only if `create` is set. Return 0 on success or
+ * if there was nothing to do, and -1 otherwise.
+ */
+int refs_update_generation(const char *gitcommondir, int create);
+
 /*
  * Flags for controlling behaviour of pack_refs()
  * PACK_REFS_PRUNE: Prune loose refs after packing
@@ -1428,6 +1428,7 @@ static int files_copy_or_rename_ref(struct ref_store *ref_store,
 			oldrefname, strerror(errno));
 	ret = 1;
  out:
+	refs_update_generation(refs->gitcommondir, 0);
 	strbuf_release(&sb_newref);
 	strbuf_release(&sb_oldref);
 	strbuf_release(&tmp_renamed_log);
@@ -1818,6 +1819,7 @@ static int files_create_symref(struct ref_store *ref_store,
 
 	ret = create_symref_locked(refs, lock, refname, target, logmsg);
 	unlock_ref(lock);
+	refs_update_generation(refs->gitcommondir, 0);
 	return ret;
 }
 
@@ -2822,6 +2824,8 @@ static int files_transaction_finish(struct ref_store *ref_store,
 		}
 	}
 
+	if (transaction->nr)
+		refs_update_generation(refs->gitcommondir, 0);
 	strbuf_release(&sb);
 	return ret;
 }
@@ -2927,6 +2931,7 @@ static int files_initial_transaction_commit(struct ref_store *ref_store,
 	}
 
 	packed_refs_unlock(refs->packed_ref_store);
+	refs_update_generation(refs->gitcommondir, 0);
 cleanup:
 	if (packed_transaction)
 		ref_transaction_free(packed_transaction);
@@ -3072,6 +3077,8 @@ static int files_reflog_expire(struct ref_store *ref_store,
 					log_file, strerror(errno));
 		} else if (update && commit_ref(lock)) {
 			status |= error("couldn't set %s", lock->ref_name);
+		} else if (update) {
+			refs_update_generation(refs->gitcommondir, 0);
 		}
 	}
 	free(log_file);
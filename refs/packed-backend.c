@@ -106,6 +106,17 @@ struct snapshot {
 	 * replaced since we read it.
 	 */
 	struct stat_validity validity;
+
+	/*
+	 * The references deleted by `packed-refs.delta`, sorted and
+	 * without duplicates, and the raw contents of that file,
+	 * which a transaction adding to it copies. The metadata of
+	 * the file is in `delta_validity`.
+	 */
+	char **deleted;
+	size_t deleted_nr;
+	struct strbuf delta_buf;
+	struct stat_validity delta_validity;
 };
 
 /*
@@ -122,6 +133,14 @@ struct snapshot {
  * On the other hand, it can be locked outside of a reference
  * transaction. In that case, it remains locked even after the
  * transaction is done and the new `packed-refs` file is activated.
+ *
+ * Deleting references from a large `packed-refs` file is expensive,
+ * as the whole file has to be rewritten. With `core.packedRefsDelta`,
+ * deletions are instead recorded in a `packed-refs.delta` file, which
+ * lists one deleted refname per line and hides those references in
+ * `packed-refs`. The next full rewrite of `packed-refs`, as done by
+ * `git pack-refs` or when the delta grows too large, folds it in and
+ * removes it.
  */
 struct packed_ref_store {
 	struct ref_store base;
@@ -131,6 +150,9 @@ struct packed_ref_store {
 	/* The path of the "packed-refs" file: */
 	char *path;
 
+	/* The path of the "packed-refs.delta" file: */
+	char *delta_path;
+
 	/*
 	 * A snapshot of the values read from the `packed-refs` file,
 	 * if it might still be current; otherwise, NULL.
@@ -184,8 +206,15 @@ static void clear_snapshot_buffer(struct snapshot *snapshot)
 static int release_snapshot(struct snapshot *snapshot)
 {
 	if (!--snapshot->referrers) {
+		size_t i;
+
 		stat_validity_clear(&snapshot->validity);
 		clear_snapshot_buffer(snapshot);
+		for (i = 0; i < snapshot->deleted_nr; i++)
+			free(snapshot->deleted[i]);
+		free(snapshot->deleted);
+		strbuf_release(&snapshot->delta_buf);
+		stat_validity_clear(&snapshot->delta_validity);
 		free(snapshot);
 		return 1;
 	} else {
@@ -204,6 +233,8 @@ struct ref_store *packed_ref_store_create(const char *path,
 
 	refs->path = xstrdup(path);
 	chdir_notify_reparent("packed-refs", &refs->path);
+	refs->delta_path = xstrfmt("%s.delta", path);
+	chdir_notify_reparent("packed-refs.delta", &refs->delta_path);
 
 	return ref_store;
 }
@@ -519,6 +550,84 @@ static int load_contents(struct snapshot *snapshot)
 	return 1;
 }
 
+static int cmp_deleted(const void *v1, const void *v2)
+{
+	return strcmp(*(const char **)v1, *(const char **)v2);
+}
+
+/*
+ * Read the `packed-refs.delta` file, if there is one, into the
+ * snapshot. Die on errors.
+ */
+static void load_delta(struct snapshot *snapshot)
+{
+	const char *path = snapshot->refs->delta_path;
+	const char *p, *eof, *eol;
+	size_t alloc = 0, i, nr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return;
+		die_errno("couldn't read %s", path);
+	}
+	stat_validity_update(&snapshot->delta_validity, fd);
+	if (strbuf_read(&snapshot->delta_buf, fd, 0) < 0)
+		die_errno("couldn't read %s", path);
+	close(fd);
+
+	p = snapshot->delta_buf.buf;
+	eof = p + snapshot->delta_buf.len;
+	while (p < eof) {
+		eol = memchr(p, '\n', eof - p);
+		if (!eol)
+			die_unterminated_line(path, p, eof - p);
+		if (eol == p)
+			die_invalid_line(path, p, eof - p);
+		ALLOC_GROW(snapshot->deleted, snapshot->deleted_nr + 1, alloc);
+		snapshot->deleted[snapshot->deleted_nr++] = xmemdupz(p, eol - p);
+		p = eol + 1;
+	}
+
+	QSORT(snapshot->deleted, snapshot->deleted_nr, cmp_deleted);
+	for (i = nr = 0; i < snapshot->deleted_nr; i++) {
+		if (nr && !strcmp(snapshot->deleted[nr - 1], snapshot->deleted[i]))
+			free(snapshot->deleted[i]);
+		else
+			snapshot->deleted[nr++] = snapshot->deleted[i];
+	}
+	snapshot->deleted_nr = nr;
+}
+
+/*
+ * Return the index of the first refname in `snapshot->deleted` that
+ * does not sort before `refname`.
+ */
+static size_t find_deleted_location(struct snapshot *snapshot,
+				    const char *refname)
+{
+	size_t lo = 0, hi = snapshot->deleted_nr;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (strcmp(snapshot->deleted[mid], refname) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int is_deleted(struct snapshot *snapshot, const char *refname)
+{
+	size_t pos = find_deleted_location(snapshot, refname);
+
+	return pos < snapshot->deleted_nr &&
+		!strcmp(snapshot->deleted[pos], refname);
+}
+
 /*
  * Find the place in `snapshot->buf` where the start of the record for
  * `refname` starts. If `mustexist` is true and the reference doesn't
@@ -613,7 +722,7 @@ static const char *find_reference_location(struct snapshot *snapshot,
  *
  *      The references in this file are known to be sorted by refname.
  */
-static struct snapshot *create_snapshot(struct packed_ref_store *refs)
+static struct snapshot *read_snapshot(struct packed_ref_store *refs)
 {
 	struct snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
 	int sorted = 0;
@@ -621,7 +730,9 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 	snapshot->refs = refs;
 	acquire_snapshot(snapshot);
 	snapshot->peeled = PEELED_NONE;
+	strbuf_init(&snapshot->delta_buf, 0);
 
+	load_delta(snapshot);
 	if (!load_contents(snapshot))
 		return snapshot;
 
@@ -692,14 +803,44 @@ static struct snapshot *create_snapshot(struct packed_ref_store *refs)
 	return snapshot;
 }
 
+static int snapshot_is_current(struct snapshot *snapshot)
+{
+	struct packed_ref_store *refs = snapshot->refs;
+
+	return stat_validity_check(&snapshot->validity, refs->path) &&
+		stat_validity_check(&snapshot->delta_validity, refs->delta_path);
+}
+
+/*
+ * Read `packed-refs` and its delta into a new snapshot.
+ *
+ * A full rewrite of `packed-refs` renames the new file into place
+ * before it removes the delta it folded in, so reading the delta
+ * first gives a consistent view, unless the delta was replaced while
+ * we read `packed-refs`; in that case, read everything again.
+ */
+static struct snapshot *create_snapshot(struct packed_ref_store *refs)
+{
+	int tries = 0;
+
+	while (1) {
+		struct snapshot *snapshot = read_snapshot(refs);
+
+		if (++tries >= 5 ||
+		    stat_validity_check(&snapshot->delta_validity, refs->delta_path))
+			return snapshot;
+		release_snapshot(snapshot);
+	}
+}
+
 /*
  * Check that `refs->snapshot` (if present) still reflects the
- * contents of the `packed-refs` file. If not, clear the snapshot.
+ * contents of the `packed-refs` file and its delta. If not, clear the
+ * snapshot.
  */
 static void validate_snapshot(struct packed_ref_store *refs)
 {
-	if (refs->snapshot &&
-	    !stat_validity_check(&refs->snapshot->validity, refs->path))
+	if (refs->snapshot && !snapshot_is_current(refs->snapshot))
 		clear_snapshot(refs);
 }
 
@@ -736,7 +877,7 @@ static int packed_read_raw_ref(struct ref_store *ref_store,
 
 	rec = find_reference_location(snapshot, refname, 1);
 
-	if (!rec) {
+	if (!rec || (snapshot->deleted_nr && is_deleted(snapshot, refname))) {
 		/* refname is not a packed reference. */
 		errno = ENOENT;
 		return -1;
@@ -771,6 +912,9 @@ struct packed_ref_iterator {
 	/* The end of the part of the buffer that will be iterated over: */
 	const char *eof;
 
+	/* The next entry of `snapshot->deleted` to compare with: */
+	size_t deleted_pos;
+
 	/* Scratch space for current values: */
 	struct object_id oid, peeled;
 	struct strbuf refname_buf;
@@ -858,6 +1002,17 @@ static int packed_ref_iterator_advance(struct ref_iterator *ref_iterator)
 	int ok;
 
 	while ((ok = next_record(iter)) == ITER_OK) {
+		struct snapshot *snapshot = iter->snapshot;
+
+		while (iter->deleted_pos < snapshot->deleted_nr &&
+		       strcmp(snapshot->deleted[iter->deleted_pos],
+			      iter->base.refname) < 0)
+			iter->deleted_pos++;
+		if (iter->deleted_pos < snapshot->deleted_nr &&
+		    !strcmp(snapshot->deleted[iter->deleted_pos],
+			    iter->base.refname))
+			continue;
+
 		if (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
 		    ref_type(iter->base.refname) != REF_TYPE_PER_WORKTREE)
 			continue;
@@ -949,6 +1104,8 @@ static struct ref_iterator *packed_ref_iterator_begin(
 
 	iter->pos = start;
 	iter->eof = snapshot->eof;
+	if (prefix && *prefix)
+		iter->deleted_pos = find_deleted_location(snapshot, prefix);
 	strbuf_init(&iter->refname_buf, 0);
 
 	iter->base.oid = &iter->oid;
@@ -1269,6 +1426,128 @@ static int write_with_updates(struct packed_ref_store *refs,
 	return -1;
 }
 
+/*
+ * Whether to record the deletions in `updates` in the delta instead
+ * of rewriting `packed-refs`. Only transactions that do nothing but
+ * delete references qualify, and only as long as the delta stays
+ * small compared to `packed-refs`; otherwise the full rewrite folds
+ * the delta in.
+ */
+static int use_delta(struct packed_ref_store *refs, struct string_list *updates)
+{
+	static int delta_configured = 0;
+	static int delta_enabled = 0;
+	struct snapshot *snapshot = get_snapshot(refs);
+	size_t i, len = snapshot->delta_buf.len;
+
+	if (!delta_configured) {
+		git_config_get_bool("core.packedrefsdelta", &delta_enabled);
+		delta_configured = 1;
+	}
+	if (!delta_enabled || !updates->nr)
+		return 0;
+
+	for (i = 0; i < updates->nr; i++) {
+		struct ref_update *update = updates->items[i].util;
+
+		if (!(update->flags & REF_HAVE_NEW) ||
+		    !is_null_oid(&update->new_oid))
+			return 0;
+		len += strlen(update->refname) + 1;
+	}
+
+	return len <= (snapshot->eof - snapshot->start) / 8;
+}
+
+/*
+ * Write the current delta and the deletions in `updates` to the
+ * delta tempfile, checking the old values of the references like
+ * write_with_updates() does. On error, rollback the tempfile, write
+ * an error message to `err`, and return a nonzero value.
+ */
+static int write_delta_with_updates(struct packed_ref_store *refs,
+				    struct string_list *updates,
+				    struct strbuf *err)
+{
+	struct snapshot *snapshot = get_snapshot(refs);
+	struct strbuf referent = STRBUF_INIT;
+	struct strbuf sb = STRBUF_INIT;
+	size_t i;
+	int fd;
+
+	for (i = 0; i < updates->nr; i++) {
+		struct ref_update *update = updates->items[i].util;
+		struct object_id oid;
+		unsigned int type;
+
+		if (packed_read_raw_ref(&refs->base, update->refname,
+					&oid, &referent, &type)) {
+			if ((update->flags & REF_HAVE_OLD) &&
+			    !is_null_oid(&update->old_oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "reference is missing but expected %s",
+					    update->refname,
+					    oid_to_hex(&update->old_oid));
+				goto error;
+			}
+			continue;
+		}
+
+		if ((update->flags & REF_HAVE_OLD)) {
+			if (is_null_oid(&update->old_oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "reference already exists",
+					    update->refname);
+				goto error;
+			} else if (oidcmp(&update->old_oid, &oid)) {
+				strbuf_addf(err, "cannot update ref '%s': "
+					    "is at %s but expected %s",
+					    update->refname,
+					    oid_to_hex(&oid),
+					    oid_to_hex(&update->old_oid));
+				goto error;
+			}
+		}
+
+		strbuf_addf(&sb, "%s\n", update->refname);
+	}
+
+	strbuf_release(&referent);
+	strbuf_addf(&referent, "%s.new", refs->delta_path);
+	refs->tempfile = create_tempfile(referent.buf);
+	if (!refs->tempfile) {
+		strbuf_addf(err, "unable to create file %s: %s",
+			    referent.buf, strerror(errno));
+		goto error;
+	}
+
+	fd = get_tempfile_fd(refs->tempfile);
+	if (write_in_full(fd, snapshot->delta_buf.buf, snapshot->delta_buf.len) < 0 ||
+	    write_in_full(fd, sb.buf, sb.len) < 0) {
+		strbuf_addf(err, "error writing to %s: %s",
+			    get_tempfile_path(refs->tempfile), strerror(errno));
+		goto error;
+	}
+
+	if (close_tempfile_gently(refs->tempfile)) {
+		strbuf_addf(err, "error closing file %s: %s",
+			    get_tempfile_path(refs->tempfile),
+			    strerror(errno));
+		goto error;
+	}
+
+	strbuf_release(&referent);
+	strbuf_release(&sb);
+	return 0;
+
+error:
+	if (is_tempfile_active(refs->tempfile))
+		delete_tempfile(&refs->tempfile);
+	strbuf_release(&referent);
+	strbuf_release(&sb);
+	return -1;
+}
+
 int is_packed_transaction_needed(struct ref_store *ref_store,
 				 struct ref_transaction *transaction)
 {
@@ -1367,6 +1646,9 @@ struct packed_transaction_backend_data {
 	/* True iff the transaction owns the packed-refs lock. */
 	int own_lock;
 
+	/* True iff the tempfile holds a new delta, not a new packed-refs. */
+	int delta;
+
 	struct string_list updates;
 };
 
@@ -1442,8 +1724,13 @@ static int packed_transaction_prepare(struct ref_store *ref_store,
 		data->own_lock = 1;
 	}
 
-	if (write_with_updates(refs, &data->updates, err))
+	if (use_delta(refs, &data->updates)) {
+		if (write_delta_with_updates(refs, &data->updates, err))
+			goto failure;
+		data->delta = 1;
+	} else if (write_with_updates(refs, &data->updates, err)) {
 		goto failure;
+	}
 
 	transaction->state = REF_TRANSACTION_PREPARED;
 	return 0;
@@ -1474,18 +1761,31 @@ static int packed_transaction_finish(struct ref_store *ref_store,
 			ref_store,
 			REF_STORE_READ | REF_STORE_WRITE | REF_STORE_ODB,
 			"ref_transaction_finish");
+	struct packed_transaction_backend_data *data = transaction->backend_data;
 	int ret = TRANSACTION_GENERIC_ERROR;
 	char *packed_refs_path;
 
 	clear_snapshot(refs);
 
-	packed_refs_path = get_locked_file_path(&refs->lock);
+	if (data->delta)
+		packed_refs_path = xstrdup(refs->delta_path);
+	else
+		packed_refs_path = get_locked_file_path(&refs->lock);
 	if (rename_tempfile(&refs->tempfile, packed_refs_path)) {
 		strbuf_addf(err, "error replacing %s: %s",
-			    refs->path, strerror(errno));
+			    data->delta ? refs->delta_path : refs->path,
+			    strerror(errno));
 		goto cleanup;
 	}
 
+	/*
+	 * The new packed-refs has the deletions of the delta already;
+	 * it must be in place before the delta goes away, see
+	 * create_snapshot().
+	 */
+	if (!data->delta)
+		unlink_or_warn(refs->delta_path);
+
 	ret = 0;
 
 cleanup:
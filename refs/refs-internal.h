@@ -652,6 +652,7 @@ struct ref_storage_be {
 
 extern struct ref_storage_be refs_be_files;
 extern struct ref_storage_be refs_be_packed;
+extern struct ref_storage_be refs_be_reftable;
 
 /*
  * A representation of the reference store for the main repository or
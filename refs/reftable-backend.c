@@ -0,0 +1,1467 @@
+#include "../cache.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../iterator.h"
+#include "../chdir-notify.h"
+
+/*
+ * A ref store keeping its refs and reflogs in a stack of reftables in
+ * $GIT_DIR/reftable. Pseudorefs like ORIG_HEAD and FETCH_HEAD are
+ * still files in $GIT_DIR, as lots of code reads and writes them
+ * directly, and are handled by a files ref store.
+ */
+struct reftable_ref_store {
+	struct ref_store base;
+	unsigned int store_flags;
+
+	char *gitdir;
+	char *gitcommondir;
+	struct reftable_stack *stack;
+	struct ref_store *files_store;
+};
+
+/*
+ * Backend-specific flags for ref_update, with the same meaning as in
+ * files-backend.c:
+ */
+#define REF_DELETING (1 << 5)
+#define REF_NEEDS_COMMIT (1 << 6)
+#define REF_LOG_ONLY (1 << 7)
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+/* The update is for a pseudoref, and done by the files ref store. */
+#define REF_IN_FILES_STORE (1 << 9)
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	refs->gitdir = xstrdup(gitdir);
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+	strbuf_addf(&sb, "%s/reftable", gitdir);
+	refs->stack = reftable_stack_new(absolute_path(sb.buf));
+	strbuf_release(&sb);
+	refs->files_store = refs_be_files.init(gitdir, flags);
+
+	chdir_notify_reparent("reftable-backend $GIT_DIR", &refs->gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+
+	return ref_store;
+}
+
+/*
+ * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
+ * reftable_ref_store or does not support the flags in required_flags.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static int is_pseudoref(const char *refname)
+{
+	return ref_type(refname) == REF_TYPE_PSEUDOREF;
+}
+
+/*
+ * The records of a table to be written, in any order.
+ */
+struct table_data {
+	struct reftable_ref_record *refs;
+	size_t refs_nr, refs_alloc;
+	struct reftable_log_record *logs;
+	size_t logs_nr, logs_alloc;
+};
+
+#define TABLE_DATA_INIT { NULL, 0, 0, NULL, 0, 0 }
+
+static struct reftable_ref_record *table_add_ref(struct table_data *td,
+						 const char *refname,
+						 uint64_t update_index,
+						 enum reftable_ref_type type)
+{
+	struct reftable_ref_record *ref;
+
+	ALLOC_GROW(td->refs, td->refs_nr + 1, td->refs_alloc);
+	ref = &td->refs[td->refs_nr++];
+	memset(ref, 0, sizeof(*ref));
+	strbuf_init(&ref->refname, 0);
+	strbuf_addstr(&ref->refname, refname);
+	strbuf_init(&ref->target, 0);
+	ref->update_index = update_index;
+	ref->type = type;
+	return ref;
+}
+
+static struct reftable_log_record *table_add_log(struct table_data *td,
+						 const char *refname,
+						 uint64_t update_index,
+						 enum reftable_log_type type)
+{
+	struct reftable_log_record *log;
+
+	ALLOC_GROW(td->logs, td->logs_nr + 1, td->logs_alloc);
+	log = &td->logs[td->logs_nr++];
+	memset(log, 0, sizeof(*log));
+	strbuf_init(&log->refname, 0);
+	strbuf_addstr(&log->refname, refname);
+	strbuf_init(&log->ident, 0);
+	strbuf_init(&log->message, 0);
+	log->update_index = update_index;
+	log->type = type;
+	return log;
+}
+
+static void table_data_release(struct table_data *td)
+{
+	size_t i;
+
+	for (i = 0; i < td->refs_nr; i++)
+		reftable_ref_record_release(&td->refs[i]);
+	for (i = 0; i < td->logs_nr; i++)
+		reftable_log_record_release(&td->logs[i]);
+	FREE_AND_NULL(td->refs);
+	FREE_AND_NULL(td->logs);
+	td->refs_nr = td->refs_alloc = td->logs_nr = td->logs_alloc = 0;
+}
+
+static int cmp_ref_records(const void *va, const void *vb)
+{
+	const struct reftable_ref_record *a = va, *b = vb;
+
+	return strcmp(a->refname.buf, b->refname.buf);
+}
+
+static int cmp_log_records(const void *va, const void *vb)
+{
+	const struct reftable_log_record *a = va, *b = vb;
+	int cmp = strcmp(a->refname.buf, b->refname.buf);
+
+	if (cmp)
+		return cmp;
+	/* newest first */
+	return a->update_index < b->update_index ? 1 :
+		a->update_index > b->update_index ? -1 : 0;
+}
+
+static void write_table_data(struct reftable_writer *w, uint64_t min_update_index,
+			     void *cb_data)
+{
+	struct table_data *td = cb_data;
+	size_t i;
+
+	QSORT(td->refs, td->refs_nr, cmp_ref_records);
+	QSORT(td->logs, td->logs_nr, cmp_log_records);
+	for (i = 0; i < td->refs_nr; i++)
+		reftable_writer_add_ref(w, &td->refs[i]);
+	for (i = 0; i < td->logs_nr; i++)
+		reftable_writer_add_log(w, &td->logs[i]);
+}
+
+static uint64_t next_update_index(struct reftable_ref_store *refs)
+{
+	return reftable_stack_max_update_index(refs->stack) + 1;
+}
+
+/*
+ * Add the records of "td", which use "nr_indexes" update indexes
+ * from next_update_index() on, to the locked stack, and commit it.
+ * If there are no records, just unlock the stack. Like the files
+ * backend, mark an update of refs in REFS_GENERATION_FILE.
+ */
+static int commit_table(struct reftable_ref_store *refs, struct table_data *td,
+			uint64_t nr_indexes, struct strbuf *err)
+{
+	int ret = 0;
+
+	if (!td->refs_nr && !td->logs_nr)
+		reftable_stack_rollback(refs->stack);
+	else if (reftable_stack_add(refs->stack, nr_indexes,
+				    write_table_data, td, err))
+		ret = -1;
+	else
+		ret = reftable_stack_commit(refs->stack, err);
+
+	if (ret && reftable_stack_is_locked(refs->stack))
+		reftable_stack_rollback(refs->stack);
+	else if (!ret && td->refs_nr)
+		refs_update_generation(refs->gitcommondir, 0);
+	table_data_release(td);
+	return ret;
+}
+
+/* Set "ref" to "oid", with its peeled value if it is a tag. */
+static void set_ref_value(struct reftable_ref_store *refs,
+			  struct reftable_ref_record *ref,
+			  const struct object_id *oid)
+{
+	ref->type = REFTABLE_REF_VAL1;
+	oidcpy(&ref->oid, oid);
+	if ((refs->store_flags & REF_STORE_ODB) &&
+	    peel_object(oid, &ref->peeled) == PEEL_PEELED)
+		ref->type = REFTABLE_REF_VAL2;
+}
+
+static void fill_log_update(struct reftable_log_record *log,
+			    const struct object_id *old_oid,
+			    const struct object_id *new_oid,
+			    const char *msg)
+{
+	const char *committer = git_committer_info(0);
+	const char *email_end = strrchr(committer, '>');
+	char *end;
+
+	if (!email_end)
+		BUG("committer ident '%s' has no email", committer);
+	oidcpy(&log->old_oid, old_oid);
+	oidcpy(&log->new_oid, new_oid);
+	strbuf_add(&log->ident, committer, email_end + 1 - committer);
+	log->time = parse_timestamp(email_end + 1, &end, 10);
+	log->tz = strtol(end, NULL, 10);
+	if (msg && *msg) {
+		copy_reflog_msg(&log->message, msg);
+		/* drop the tab that separates it in a reflog file */
+		strbuf_remove(&log->message, 0, 1);
+	}
+	strbuf_addch(&log->message, '\n');
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct reftable_iterator *it;
+	int ret;
+
+	it = reftable_stack_logs(refs->stack, refname);
+	ret = !reftable_iterator_next_log(it, &log) &&
+		!strcmp(log.refname.buf, refname) &&
+		log.type != REFTABLE_LOG_DELETION;
+	reftable_iterator_free(it);
+	reftable_log_record_release(&log);
+	return ret;
+}
+
+/*
+ * Whether an update of "refname" should be logged, the same way the
+ * files backend decides whether to append to a reflog.
+ */
+static int should_log(struct reftable_ref_store *refs, const char *refname,
+		      unsigned int flags)
+{
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	return (flags & REF_FORCE_CREATE_REFLOG) ||
+		should_autocreate_reflog(refname) ||
+		reftable_reflog_exists(&refs->base, refname);
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct strbuf sb = STRBUF_INIT;
+	int ret;
+
+	strbuf_addf(&sb, "%s/reftable", refs->gitdir);
+	ret = reftable_stack_init_db(sb.buf, err);
+
+	/*
+	 * HEAD is in the reftable, but repository discovery wants to
+	 * see a file that looks like a symref.
+	 */
+	strbuf_reset(&sb);
+	strbuf_addf(&sb, "%s/HEAD", refs->gitdir);
+	if (!ret && access(sb.buf, F_OK))
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+
+	strbuf_release(&sb);
+	return ret;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	int ret = 0;
+
+	if (is_pseudoref(refname))
+		return refs_read_raw_ref(refs->files_store, refname, oid,
+					 referent, type);
+
+	*type = 0;
+	if (reftable_stack_read_ref(refs->stack, refname, &ref)) {
+		errno = ENOENT;
+		ret = -1;
+	} else if (ref.type == REFTABLE_REF_SYMREF) {
+		strbuf_reset(referent);
+		strbuf_addbuf(referent, &ref.target);
+		*type |= REF_ISSYMREF;
+	} else {
+		oidcpy(oid, &ref.oid);
+	}
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_iterator *iter;
+	struct reftable_ref_record ref;
+	struct object_id oid;
+	unsigned int flags;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	int ok = ITER_DONE;
+
+	while (!reftable_iterator_next_ref(iter->iter, &iter->ref)) {
+		const char *refname = iter->ref.refname.buf;
+
+		if (iter->ref.type == REFTABLE_REF_DELETION)
+			continue;
+		/* like the files backend, only iterate over "refs/" */
+		if (!starts_with(refname, "refs/"))
+			continue;
+		if (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
+		    ref_type(refname) != REF_TYPE_PER_WORKTREE)
+			continue;
+
+		iter->base.flags = 0;
+		if (iter->ref.type == REFTABLE_REF_SYMREF) {
+			int flags;
+
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, &flags)) {
+				oidclr(&iter->oid);
+				iter->base.flags |= REF_ISBROKEN;
+			}
+			iter->base.flags |= REF_ISSYMREF;
+		} else {
+			oidcpy(&iter->oid, &iter->ref.oid);
+		}
+		if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+			if (!refname_is_safe(refname))
+				die("reftable refname is dangerous: %s", refname);
+			oidclr(&iter->oid);
+			iter->base.flags |= REF_BAD_NAME | REF_ISBROKEN;
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid,
+					    iter->base.flags))
+			continue;
+
+		iter->base.refname = refname;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		ok = ITER_ERROR;
+	return ok;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if (iter->base.flags & (REF_ISBROKEN | REF_ISSYMREF))
+		return -1;
+	if (iter->ref.type == REFTABLE_REF_VAL2) {
+		oidcpy(peeled, &iter->ref.peeled);
+		return 0;
+	}
+	return !!peel_object(&iter->oid, peeled);
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	reftable_iterator_free(iter->iter);
+	reftable_ref_record_release(&iter->ref);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct reftable_ref_iterator *iter;
+	struct ref_iterator *ref_iterator;
+	unsigned int required_flags = REF_STORE_READ;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+	refs = reftable_downcast(ref_store, required_flags, "ref_iterator_begin");
+
+	iter = xcalloc(1, sizeof(*iter));
+	ref_iterator = &iter->base;
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable, 1);
+
+	iter->refs = refs;
+	iter->iter = reftable_stack_refs(refs->stack, prefix);
+	strbuf_init(&iter->ref.refname, 0);
+	strbuf_init(&iter->ref.target, 0);
+	iter->base.oid = &iter->oid;
+	iter->flags = flags;
+
+	if (prefix && *prefix)
+		/* Stop iteration after we've gone *past* prefix: */
+		ref_iterator = prefix_ref_iterator_begin(ref_iterator, prefix, 0);
+
+	return ref_iterator;
+}
+
+/*
+ * Transactions. These follow files-backend.c closely, except that
+ * all the updates end up in a single new table.
+ */
+
+struct reftable_transaction_backend_data {
+	/* The updates of pseudorefs. */
+	struct ref_transaction *files_transaction;
+};
+
+/*
+ * If update is a direct update of head_ref (the reference pointed to
+ * by HEAD), then add an extra REF_LOG_ONLY update for HEAD.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Make it REF_LOG_ONLY, and add a separate update
+ * for the referent.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * Return the refname under which update was originally requested.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   !oidcmp(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/*
+ * Prepare update, with the stack locked: read the current value of
+ * the ref into the object_id in update->backend_data and check it,
+ * split symref and HEAD updates, and check for D/F conflicts when
+ * creating the ref.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct object_id *old_oid;
+	int mustexist = (update->flags & REF_HAVE_OLD) &&
+		!is_null_oid(&update->old_oid);
+	int exists, ret = 0;
+
+	update->backend_data = old_oid = xcalloc(1, sizeof(*old_oid));
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			goto out;
+	}
+
+	exists = !reftable_stack_read_ref(refs->stack, update->refname, &ref);
+	update->type = 0;
+	if (!exists) {
+		if (mustexist) {
+			strbuf_addf(err, "cannot lock ref '%s': "
+				    "unable to resolve reference '%s'",
+				    original_update_refname(update),
+				    update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		if ((update->flags & REF_HAVE_NEW) &&
+		    !(update->flags & (REF_DELETING | REF_LOG_ONLY)) &&
+		    refs_verify_refname_available(&refs->base, update->refname,
+						  affected_refnames, NULL, err)) {
+			char *reason = strbuf_detach(err, NULL);
+
+			strbuf_addf(err, "cannot lock ref '%s': %s",
+				    original_update_refname(update), reason);
+			free(reason);
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto out;
+		}
+	}
+
+	if (exists && ref.type == REFTABLE_REF_SYMREF) {
+		update->type = REF_ISSYMREF;
+		if (update->flags & REF_NO_DEREF) {
+			/*
+			 * We won't be reading the referent as part of
+			 * the transaction, so we have to read it here
+			 * to record and possibly check old_oid:
+			 */
+			if (refs_read_ref_full(&refs->base, ref.target.buf, 0,
+					       old_oid, NULL)) {
+				if (update->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(update));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+			} else if (check_old_oid(update, old_oid, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else {
+			ret = split_symref_update(update, ref.target.buf,
+						  transaction, affected_refnames,
+						  err);
+			if (ret)
+				goto out;
+		}
+	} else {
+		struct ref_update *parent_update;
+
+		if (exists)
+			oidcpy(old_oid, &ref.oid);
+		if (check_old_oid(update, old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update)
+			oidcpy(parent_update->backend_data, old_oid);
+	}
+
+	if ((update->flags & REF_HAVE_NEW) &&
+	    !(update->flags & REF_DELETING) &&
+	    !(update->flags & REF_LOG_ONLY) &&
+	    ((update->type & REF_ISSYMREF) || oidcmp(old_oid, &update->new_oid)))
+		update->flags |= REF_NEEDS_COMMIT;
+
+out:
+	reftable_ref_record_release(&ref);
+	return ret;
+}
+
+static void reftable_transaction_cleanup(struct reftable_ref_store *refs,
+					 struct ref_transaction *transaction)
+{
+	struct reftable_transaction_backend_data *backend_data =
+		transaction->backend_data;
+	struct strbuf err = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+
+	if (backend_data && backend_data->files_transaction &&
+	    ref_transaction_abort(backend_data->files_transaction, &err)) {
+		error("error aborting transaction: %s", err.buf);
+		strbuf_release(&err);
+	}
+
+	if (reftable_stack_is_locked(refs->stack))
+		reftable_stack_rollback(refs->stack);
+
+	free(backend_data);
+	transaction->backend_data = NULL;
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct string_list affected_refnames = STRING_LIST_INIT_NODUP;
+	struct reftable_transaction_backend_data *backend_data;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	backend_data = xcalloc(1, sizeof(*backend_data));
+	transaction->backend_data = backend_data;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+
+		string_list_append(&affected_refnames, update->refname)->util = update;
+	}
+	string_list_sort(&affected_refnames);
+	if (ref_update_reject_duplicates(&affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * Locking the stack locks all the refs, and makes sure that
+	 * what we read below is what we are going to update.
+	 */
+	if (reftable_stack_lock(refs->stack, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/* See files_transaction_prepare() about updating HEAD's reflog. */
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/* prepare_update() might append more updates to the transaction. */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+
+		if (is_pseudoref(update->refname)) {
+			if (!backend_data->files_transaction) {
+				backend_data->files_transaction =
+					ref_store_transaction_begin(refs->files_store, err);
+				if (!backend_data->files_transaction) {
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto cleanup;
+				}
+			}
+			ref_transaction_add_update(backend_data->files_transaction,
+						   update->refname, update->flags,
+						   &update->new_oid, &update->old_oid,
+						   update->msg);
+			update->flags |= REF_IN_FILES_STORE;
+			continue;
+		}
+
+		ret = prepare_update(refs, update, transaction, head_ref,
+				     &affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+	if (backend_data->files_transaction &&
+	    ref_transaction_prepare(backend_data->files_transaction, err))
+		ret = TRANSACTION_GENERIC_ERROR;
+
+cleanup:
+	free(head_ref);
+	string_list_clear(&affected_refnames, 0);
+
+	if (ret)
+		reftable_transaction_cleanup(refs, transaction);
+	else
+		transaction->state = REF_TRANSACTION_PREPARED;
+
+	return ret;
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_finish");
+	struct reftable_transaction_backend_data *backend_data;
+	struct table_data td = TABLE_DATA_INIT;
+	uint64_t update_index;
+	size_t i;
+	int ret = 0;
+
+	assert(err);
+
+	if (!transaction->nr) {
+		transaction->state = REF_TRANSACTION_CLOSED;
+		return 0;
+	}
+	backend_data = transaction->backend_data;
+
+	update_index = next_update_index(refs);
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		const struct object_id *old_oid = update->backend_data;
+
+		if (update->flags & REF_IN_FILES_STORE)
+			continue;
+
+		if (update->flags & REF_NEEDS_COMMIT)
+			set_ref_value(refs, table_add_ref(&td, update->refname,
+							  update_index,
+							  REFTABLE_REF_VAL1),
+				      &update->new_oid);
+
+		if ((update->flags & REF_DELETING) &&
+		    !(update->flags & REF_LOG_ONLY)) {
+			/* the reflog goes with the ref */
+			table_add_ref(&td, update->refname, update_index,
+				      REFTABLE_REF_DELETION);
+			if (reftable_reflog_exists(ref_store, update->refname))
+				table_add_log(&td, update->refname, update_index,
+					      REFTABLE_LOG_DELETION);
+		} else if ((update->flags & (REF_NEEDS_COMMIT | REF_LOG_ONLY)) &&
+			   should_log(refs, update->refname, update->flags)) {
+			fill_log_update(table_add_log(&td, update->refname,
+						      update_index,
+						      REFTABLE_LOG_UPDATE),
+					old_oid, &update->new_oid, update->msg);
+		}
+	}
+
+	if (commit_table(refs, &td, 1, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	if (backend_data->files_transaction) {
+		ret = ref_transaction_commit(backend_data->files_transaction, err);
+		ref_transaction_free(backend_data->files_transaction);
+		backend_data->files_transaction = NULL;
+	}
+
+cleanup:
+	reftable_transaction_cleanup(refs, transaction);
+	return ret;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, 0, "ref_transaction_abort");
+
+	reftable_transaction_cleanup(refs, transaction);
+	return 0;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	int ret = reftable_transaction_prepare(ref_store, transaction, err);
+
+	if (!ret)
+		ret = reftable_transaction_finish(ref_store, transaction, err);
+	return ret;
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_lock(refs->stack, &err) ||
+	    reftable_stack_compact_all(refs->stack, &err) ||
+	    reftable_stack_commit(refs->stack, &err)) {
+		if (reftable_stack_is_locked(refs->stack))
+			reftable_stack_rollback(refs->stack);
+		ret = error("%s", err.buf);
+	}
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct table_data td = TABLE_DATA_INIT;
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_ref_record *ref;
+	struct object_id old_oid, new_oid;
+	uint64_t update_index;
+	int ret = 0;
+
+	if (is_pseudoref(refname))
+		return refs_create_symref(refs->files_store, refname, target,
+					  logmsg);
+
+	if (reftable_stack_lock(refs->stack, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+	if (refs_verify_refname_available(&refs->base, refname, NULL, NULL, &err)) {
+		reftable_stack_rollback(refs->stack);
+		ret = error("unable to write symref for %s: %s", refname, err.buf);
+		goto out;
+	}
+	update_index = next_update_index(refs);
+
+	ref = table_add_ref(&td, refname, update_index, REFTABLE_REF_SYMREF);
+	strbuf_addstr(&ref->target, target);
+
+	if (refs_read_ref_full(&refs->base, refname, 0, &old_oid, NULL))
+		oidclr(&old_oid);
+	if (logmsg &&
+	    !refs_read_ref_full(&refs->base, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    should_log(refs, refname, 0))
+		fill_log_update(table_add_log(&td, refname, update_index,
+					      REFTABLE_LOG_UPDATE),
+				&old_oid, &new_oid, logmsg);
+
+	if (commit_table(refs, &td, 1, &err))
+		ret = error("unable to write symref for %s: %s", refname, err.buf);
+out:
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct ref_transaction *transaction;
+	struct strbuf err = STRBUF_INIT;
+	int i, ret = 0;
+
+	if (!refnames->nr)
+		return 0;
+
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		goto error;
+
+	for (i = 0; i < refnames->nr; i++)
+		if (ref_transaction_delete(transaction, refnames->items[i].string,
+					   NULL, flags, msg, &err))
+			goto error;
+
+	if (ref_transaction_commit(transaction, &err))
+		goto error;
+
+	goto out;
+
+error:
+	if (refnames->nr == 1)
+		error(_("could not delete reference %s: %s"),
+		      refnames->items[0].string, err.buf);
+	else
+		error(_("could not delete references: %s"), err.buf);
+	ret = -1;
+
+out:
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+/*
+ * Collect the entries of the reflog of "refname", newest first.
+ */
+static void read_reflog(struct reftable_ref_store *refs, const char *refname,
+			struct table_data *td)
+{
+	struct reftable_iterator *it = reftable_stack_logs(refs->stack, refname);
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+
+	while (!reftable_iterator_next_log(it, &log) &&
+	       !strcmp(log.refname.buf, refname) &&
+	       log.type != REFTABLE_LOG_DELETION) {
+		struct reftable_log_record *entry;
+
+		if (log.type != REFTABLE_LOG_UPDATE)
+			continue;
+		entry = table_add_log(td, refname, log.update_index, log.type);
+		oidcpy(&entry->old_oid, &log.old_oid);
+		oidcpy(&entry->new_oid, &log.new_oid);
+		strbuf_addbuf(&entry->ident, &log.ident);
+		entry->time = log.time;
+		entry->tz = log.tz;
+		strbuf_addbuf(&entry->message, &log.message);
+	}
+	reftable_iterator_free(it);
+	reftable_log_record_release(&log);
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname, const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct table_data td = TABLE_DATA_INIT;
+	struct table_data old_log = TABLE_DATA_INIT;
+	struct strbuf err = STRBUF_INIT;
+	struct object_id orig_oid;
+	uint64_t update_index;
+	int flag = 0, log, ret = 0;
+	size_t i;
+
+	if (!refs_resolve_ref_unsafe(&refs->base, oldrefname,
+				     RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+				     &orig_oid, &flag))
+		return error("refname %s not found", oldrefname);
+
+	if (flag & REF_ISSYMREF) {
+		if (copy)
+			return error("refname %s is a symbolic ref, copying it is not supported",
+				     oldrefname);
+		else
+			return error("refname %s is a symbolic ref, renaming it is not supported",
+				     oldrefname);
+	}
+	if (!refs_rename_ref_available(&refs->base, oldrefname, newrefname))
+		return 1;
+
+	if (reftable_stack_lock(refs->stack, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+	update_index = next_update_index(refs);
+
+	/*
+	 * The new ref gets the reflog of the old one: hide its own
+	 * reflog, if any, and copy the entries of the old one after
+	 * that, using the update indexes following update_index.
+	 */
+	log = reftable_reflog_exists(ref_store, oldrefname);
+	if (log)
+		read_reflog(refs, oldrefname, &old_log);
+
+	if (!copy)
+		table_add_ref(&td, oldrefname, update_index,
+			      REFTABLE_REF_DELETION);
+	set_ref_value(refs, table_add_ref(&td, newrefname, update_index,
+					  REFTABLE_REF_VAL1),
+		      &orig_oid);
+
+	if (log || (!copy && reftable_reflog_exists(ref_store, newrefname)))
+		table_add_log(&td, newrefname, update_index, REFTABLE_LOG_DELETION);
+	if (log && !copy)
+		table_add_log(&td, oldrefname, update_index, REFTABLE_LOG_DELETION);
+	for (i = 0; i < old_log.logs_nr; i++) {
+		struct reftable_log_record *src = &old_log.logs[i];
+		struct reftable_log_record *dst =
+			table_add_log(&td, newrefname,
+				      update_index + old_log.logs_nr - i,
+				      REFTABLE_LOG_UPDATE);
+
+		oidcpy(&dst->old_oid, &src->old_oid);
+		oidcpy(&dst->new_oid, &src->new_oid);
+		strbuf_addbuf(&dst->ident, &src->ident);
+		dst->time = src->time;
+		dst->tz = src->tz;
+		strbuf_addbuf(&dst->message, &src->message);
+	}
+	if (log || should_log(refs, newrefname, 0))
+		fill_log_update(table_add_log(&td, newrefname,
+					      update_index + old_log.logs_nr + 1,
+					      REFTABLE_LOG_UPDATE),
+				&orig_oid, &orig_oid, logmsg);
+
+	if (commit_table(refs, &td, old_log.logs_nr + 2, &err)) {
+		if (copy)
+			error("unable to copy '%s' to '%s': %s",
+			      oldrefname, newrefname, err.buf);
+		else
+			error("unable to rename '%s' to '%s': %s",
+			      oldrefname, newrefname, err.buf);
+		ret = 1;
+	}
+
+out:
+	table_data_release(&old_log);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname,
+					   newrefname, logmsg, 1);
+}
+
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_iterator *iter;
+	struct reftable_log_record log;
+	struct strbuf refname;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	while (!reftable_iterator_next_log(iter->iter, &iter->log)) {
+		int flags;
+
+		/* only look at the newest entry of each reflog */
+		if (!strbuf_cmp(&iter->refname, &iter->log.refname))
+			continue;
+		strbuf_reset(&iter->refname);
+		strbuf_addbuf(&iter->refname, &iter->log.refname);
+		if (iter->log.type == REFTABLE_LOG_DELETION)
+			continue;
+
+		if (refs_read_ref_full(&iter->refs->base, iter->refname.buf, 0,
+				       &iter->oid, &flags)) {
+			error("bad ref for %s", iter->refname.buf);
+			continue;
+		}
+
+		iter->base.refname = iter->refname.buf;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	return ref_iterator_abort(ref_iterator);
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+
+	reftable_iterator_free(iter->iter);
+	reftable_log_record_release(&iter->log);
+	strbuf_release(&iter->refname);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+	struct reftable_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+
+	base_ref_iterator_init(ref_iterator, &reftable_reflog_iterator_vtable, 0);
+	iter->refs = refs;
+	iter->iter = reftable_stack_logs(refs->stack, NULL);
+	strbuf_init(&iter->log.refname, 0);
+	strbuf_init(&iter->log.ident, 0);
+	strbuf_init(&iter->log.message, 0);
+	strbuf_init(&iter->refname, 0);
+	return ref_iterator;
+}
+
+static int show_reflog_entry(struct reftable_log_record *log,
+			     each_reflog_ent_fn fn, void *cb_data)
+{
+	return fn(&log->old_oid, &log->new_oid, log->ident.buf,
+		  log->time, log->tz, log->message.buf, cb_data);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse");
+	struct reftable_iterator *it = reftable_stack_logs(refs->stack, refname);
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	int ret = 0;
+
+	while (!ret && !reftable_iterator_next_log(it, &log) &&
+	       !strcmp(log.refname.buf, refname) &&
+	       log.type != REFTABLE_LOG_DELETION)
+		if (log.type == REFTABLE_LOG_UPDATE)
+			ret = show_reflog_entry(&log, fn, cb_data);
+
+	reftable_iterator_free(it);
+	reftable_log_record_release(&log);
+	return ret;
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+	struct table_data td = TABLE_DATA_INIT;
+	size_t i;
+	int ret = 0;
+
+	read_reflog(refs, refname, &td);
+	for (i = td.logs_nr; !ret && i-- > 0; )
+		ret = show_reflog_entry(&td.logs[i], fn, cb_data);
+	table_data_release(&td);
+	return ret;
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+	struct table_data td = TABLE_DATA_INIT;
+
+	if (!force_create && !should_log(refs, refname, 0))
+		return 0;
+
+	if (reftable_stack_lock(refs->stack, err))
+		return -1;
+	if (!reftable_reflog_exists(ref_store, refname))
+		table_add_log(&td, refname, next_update_index(refs),
+			      REFTABLE_LOG_CREATE);
+	return commit_table(refs, &td, 1, err);
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+	struct table_data td = TABLE_DATA_INIT;
+	struct strbuf err = STRBUF_INIT;
+	int ret = 0;
+
+	if (reftable_stack_lock(refs->stack, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+	if (reftable_reflog_exists(ref_store, refname))
+		table_add_log(&td, refname, next_update_index(refs),
+			      REFTABLE_LOG_DELETION);
+	if (commit_table(refs, &td, 1, &err))
+		ret = error("%s", err.buf);
+out:
+	strbuf_release(&err);
+	return ret;
+}
+
+/*
+ * Expiring a reflog writes a table that hides its old entries and
+ * has the kept ones instead, in the update indexes following that of
+ * the deletion.
+ */
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const struct object_id *oid,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct table_data entries = TABLE_DATA_INIT;
+	struct table_data td = TABLE_DATA_INIT;
+	struct strbuf err = STRBUF_INIT;
+	struct object_id last_kept_oid, ref_oid;
+	uint64_t update_index;
+	int dry_run = flags & EXPIRE_REFLOGS_DRY_RUN;
+	int type = 0, status = 0;
+	size_t i, kept = 0;
+
+	if (reftable_stack_lock(refs->stack, &err)) {
+		error("cannot lock ref '%s': %s", refname, err.buf);
+		strbuf_release(&err);
+		return -1;
+	}
+	if (!reftable_reflog_exists(ref_store, refname)) {
+		reftable_stack_rollback(refs->stack);
+		return 0;
+	}
+	refs_resolve_ref_unsafe(&refs->base, refname, RESOLVE_REF_NO_RECURSE,
+				&ref_oid, &type);
+	update_index = next_update_index(refs);
+	oidclr(&last_kept_oid);
+
+	read_reflog(refs, refname, &entries);
+	(*prepare_fn)(refname, oid, policy_cb_data);
+	for (i = entries.logs_nr; i-- > 0; ) {
+		struct reftable_log_record *e = &entries.logs[i];
+		struct object_id *ooid = &e->old_oid;
+
+		if (flags & EXPIRE_REFLOGS_REWRITE)
+			ooid = &last_kept_oid;
+
+		if ((*should_prune_fn)(ooid, &e->new_oid, e->ident.buf,
+				       e->time, e->tz, e->message.buf,
+				       policy_cb_data)) {
+			if (dry_run)
+				printf("would prune %s", e->message.buf);
+			else if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("prune %s", e->message.buf);
+		} else {
+			if (!dry_run) {
+				struct reftable_log_record *log =
+					table_add_log(&td, refname,
+						      update_index + ++kept,
+						      REFTABLE_LOG_UPDATE);
+
+				oidcpy(&log->old_oid, ooid);
+				oidcpy(&log->new_oid, &e->new_oid);
+				strbuf_addbuf(&log->ident, &e->ident);
+				log->time = e->time;
+				log->tz = e->tz;
+				strbuf_addbuf(&log->message, &e->message);
+				oidcpy(&last_kept_oid, &e->new_oid);
+			}
+			if (flags & EXPIRE_REFLOGS_VERBOSE)
+				printf("keep %s", e->message.buf);
+		}
+	}
+	(*cleanup_fn)(policy_cb_data);
+	table_data_release(&entries);
+
+	if (dry_run) {
+		reftable_stack_rollback(refs->stack);
+		return 0;
+	}
+
+	table_add_log(&td, refname, update_index, REFTABLE_LOG_DELETION);
+	if (!kept)
+		/* the reflog still exists, but is empty */
+		table_add_log(&td, refname, update_index + 1, REFTABLE_LOG_CREATE);
+	/*
+	 * It doesn't make sense to adjust a reference pointed to by a
+	 * symbolic ref based on expiring entries in the symbolic
+	 * reference's reflog. Nor can we update a reference if there
+	 * are no remaining reflog entries.
+	 */
+	if ((flags & EXPIRE_REFLOGS_UPDATE_REF) && !(type & REF_ISSYMREF) &&
+	    !is_null_oid(&last_kept_oid))
+		set_ref_value(refs, table_add_ref(&td, refname, update_index,
+						  REFTABLE_REF_VAL1),
+			      &last_kept_oid);
+
+	if (commit_table(refs, &td, kept ? kept + 1 : 2, &err))
+		status = error("unable to write reflog '%s': %s", refname, err.buf);
+	strbuf_release(&err);
+	return status;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	&refs_be_files,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+	reftable_copy_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
@@ -0,0 +1,1419 @@
+#include "../cache.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "reftable.h"
+#include "../lockfile.h"
+#include "../tempfile.h"
+#include "../prio-queue.h"
+#include "../string-list.h"
+#include "../varint.h"
+
+#define REFTABLE_MAGIC "REFT"
+#define REFTABLE_VERSION 1
+
+/*
+ * The header is the magic, the version, the block size and the range
+ * of update indexes; the footer repeats it, followed by the offsets
+ * of the ref index, the log blocks and the log index, and a CRC-32 of
+ * all that.
+ */
+#define HEADER_SIZE 24
+#define FOOTER_SIZE (HEADER_SIZE + 3 * 8 + 4)
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+/* A block starts with its type and its length as a 24-bit integer. */
+#define BLOCK_HEADER_SIZE 4
+#define BLOCK_SIZE 4096
+#define MAX_BLOCK_LEN ((1 << 24) - 1)
+#define MAX_RESTARTS 0xffff
+
+/* Every RESTART_INTERVAL-th record of a block stores its key in full. */
+#define RESTART_INTERVAL 16
+
+static void put_be24(unsigned char *p, uint32_t value)
+{
+	p[0] = value >> 16;
+	p[1] = value >> 8;
+	p[2] = value;
+}
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static void strbuf_add_varint(struct strbuf *sb, uintmax_t value)
+{
+	unsigned char buf[16];
+
+	strbuf_add(sb, buf, encode_varint(value, buf));
+}
+
+static int key_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+	if (cmp)
+		return cmp;
+	return a_len < b_len ? -1 : a_len != b_len;
+}
+
+/*
+ * A bounds-checked reader of the contents of a table. Reading past
+ * `end` sets `error`, after which all reads return zeroes.
+ */
+struct decoder {
+	const unsigned char *p, *end;
+	int error;
+};
+
+static uintmax_t decode_uint(struct decoder *d)
+{
+	uintmax_t val;
+	unsigned char c;
+
+	if (d->p >= d->end)
+		goto fail;
+	c = *d->p++;
+	val = c & 127;
+	while (c & 128) {
+		val += 1;
+		if (!val || MSB(val, 7) || d->p >= d->end)
+			goto fail;
+		c = *d->p++;
+		val = (val << 7) + (c & 127);
+	}
+	return val;
+
+fail:
+	d->error = 1;
+	d->p = d->end;
+	return 0;
+}
+
+static const unsigned char *decode_bytes(struct decoder *d, uintmax_t len)
+{
+	const unsigned char *p = d->p;
+
+	if (len > d->end - d->p) {
+		d->error = 1;
+		d->p = d->end;
+		return NULL;
+	}
+	d->p += len;
+	return p;
+}
+
+void reftable_ref_record_release(struct reftable_ref_record *ref)
+{
+	strbuf_release(&ref->refname);
+	strbuf_release(&ref->target);
+}
+
+void reftable_log_record_release(struct reftable_log_record *log)
+{
+	strbuf_release(&log->refname);
+	strbuf_release(&log->ident);
+	strbuf_release(&log->message);
+}
+
+/*
+ * Writing
+ */
+
+struct block_writer {
+	struct strbuf buf;
+	uint32_t *restarts;
+	size_t nr_restarts, alloc_restarts;
+	struct strbuf last_key;
+	size_t nr_records;
+};
+
+static void block_writer_reset(struct block_writer *bw, char type)
+{
+	strbuf_reset(&bw->buf);
+	strbuf_addch(&bw->buf, type);
+	strbuf_addchars(&bw->buf, 0, BLOCK_HEADER_SIZE - 1);
+	strbuf_reset(&bw->last_key);
+	bw->nr_restarts = 0;
+	bw->nr_records = 0;
+}
+
+static void block_writer_release(struct block_writer *bw)
+{
+	strbuf_release(&bw->buf);
+	strbuf_release(&bw->last_key);
+	free(bw->restarts);
+}
+
+/* The size the block would have with another record of "len" bytes. */
+static size_t block_writer_size(struct block_writer *bw, size_t len)
+{
+	return bw->buf.len + len + 3 * (bw->nr_restarts + 1) + 2;
+}
+
+/*
+ * A record is the length of the prefix it shares with the key of the
+ * previous record, the length of the rest of its key shifted left by
+ * three bits and or'ed with the type of its value, the rest of the
+ * key, and the value with its length.
+ */
+static void block_writer_add(struct block_writer *bw, const struct strbuf *key,
+			     int value_type, const struct strbuf *value)
+{
+	size_t prefix = 0;
+
+	if (bw->nr_records % RESTART_INTERVAL) {
+		while (prefix < key->len && prefix < bw->last_key.len &&
+		       key->buf[prefix] == bw->last_key.buf[prefix])
+			prefix++;
+	} else {
+		ALLOC_GROW(bw->restarts, bw->nr_restarts + 1, bw->alloc_restarts);
+		bw->restarts[bw->nr_restarts++] = bw->buf.len;
+	}
+
+	strbuf_add_varint(&bw->buf, prefix);
+	strbuf_add_varint(&bw->buf, (uintmax_t)(key->len - prefix) << 3 | value_type);
+	strbuf_add(&bw->buf, key->buf + prefix, key->len - prefix);
+	strbuf_add_varint(&bw->buf, value->len);
+	strbuf_addbuf(&bw->buf, value);
+
+	strbuf_reset(&bw->last_key);
+	strbuf_addbuf(&bw->last_key, key);
+	bw->nr_records++;
+}
+
+/* Append the restart table and fill in the length of the block. */
+static void block_writer_finish(struct block_writer *bw)
+{
+	unsigned char buf[3];
+	size_t i;
+
+	for (i = 0; i < bw->nr_restarts; i++) {
+		put_be24(buf, bw->restarts[i]);
+		strbuf_add(&bw->buf, buf, 3);
+	}
+	if (bw->nr_restarts > MAX_RESTARTS || bw->buf.len + 2 > MAX_BLOCK_LEN)
+		die("reftable block too large");
+	strbuf_addch(&bw->buf, bw->nr_restarts >> 8);
+	strbuf_addch(&bw->buf, bw->nr_restarts & 0xff);
+	put_be24((unsigned char *)bw->buf.buf + 1, bw->buf.len);
+}
+
+struct reftable_writer {
+	int fd;
+	int error;
+	uint64_t offset;
+	uint64_t min_update_index, max_update_index;
+	unsigned char header[HEADER_SIZE];
+
+	/* BLOCK_TYPE_REF or BLOCK_TYPE_LOG */
+	char section;
+	struct block_writer block;
+	/* The last key of each block written in the current section. */
+	struct block_writer index;
+
+	uint64_t ref_index_off, log_off, log_index_off;
+
+	struct strbuf key, value, last_key, scratch;
+};
+
+static void writer_write(struct reftable_writer *w, const void *buf, size_t len)
+{
+	if (!w->error && write_in_full(w->fd, buf, len) < 0)
+		w->error = 1;
+	w->offset += len;
+}
+
+struct reftable_writer *reftable_writer_new(int fd, uint64_t min_update_index,
+					    uint64_t max_update_index)
+{
+	struct reftable_writer *w = xcalloc(1, sizeof(*w));
+
+	w->fd = fd;
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	w->section = BLOCK_TYPE_REF;
+	strbuf_init(&w->block.buf, BLOCK_SIZE);
+	strbuf_init(&w->block.last_key, 0);
+	strbuf_init(&w->index.buf, 0);
+	strbuf_init(&w->index.last_key, 0);
+	strbuf_init(&w->key, 0);
+	strbuf_init(&w->value, 0);
+	strbuf_init(&w->last_key, 0);
+	strbuf_init(&w->scratch, 0);
+	block_writer_reset(&w->block, BLOCK_TYPE_REF);
+	block_writer_reset(&w->index, BLOCK_TYPE_INDEX);
+
+	memcpy(w->header, REFTABLE_MAGIC, 4);
+	w->header[4] = REFTABLE_VERSION;
+	put_be24(w->header + 5, BLOCK_SIZE);
+	put_be64(w->header + 8, min_update_index);
+	put_be64(w->header + 16, max_update_index);
+	writer_write(w, w->header, HEADER_SIZE);
+	return w;
+}
+
+static void writer_flush_block(struct reftable_writer *w)
+{
+	if (!w->block.nr_records)
+		return;
+	block_writer_finish(&w->block);
+	strbuf_reset(&w->scratch);
+	strbuf_add_varint(&w->scratch, w->offset);
+	block_writer_add(&w->index, &w->block.last_key, 0, &w->scratch);
+	writer_write(w, w->block.buf.buf, w->block.buf.len);
+	block_writer_reset(&w->block, w->section);
+}
+
+/* Write out the current section; returns the offset of its index. */
+static uint64_t writer_finish_section(struct reftable_writer *w)
+{
+	uint64_t index_off = 0;
+
+	writer_flush_block(w);
+	if (w->index.nr_records) {
+		index_off = w->offset;
+		block_writer_finish(&w->index);
+		writer_write(w, w->index.buf.buf, w->index.buf.len);
+	}
+	block_writer_reset(&w->index, BLOCK_TYPE_INDEX);
+	strbuf_reset(&w->last_key);
+	return index_off;
+}
+
+/* Add the record in w->key and w->value. */
+static void writer_add(struct reftable_writer *w, int value_type)
+{
+	/* leave room for the varints */
+	size_t len = w->key.len + w->value.len + 3 * 10;
+
+	if (w->last_key.len && key_cmp(w->last_key.buf, w->last_key.len,
+				       w->key.buf, w->key.len) >= 0)
+		BUG("reftable records added out of order");
+	strbuf_reset(&w->last_key);
+	strbuf_addbuf(&w->last_key, &w->key);
+
+	if (w->block.nr_records && block_writer_size(&w->block, len) > BLOCK_SIZE)
+		writer_flush_block(w);
+	block_writer_add(&w->block, &w->key, value_type, &w->value);
+}
+
+static void check_update_index(struct reftable_writer *w, uint64_t update_index)
+{
+	if (update_index < w->min_update_index ||
+	    update_index > w->max_update_index)
+		BUG("reftable update index %"PRIuMAX" out of range",
+		    (uintmax_t)update_index);
+}
+
+void reftable_writer_add_ref(struct reftable_writer *w,
+			     const struct reftable_ref_record *ref)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+
+	if (w->section != BLOCK_TYPE_REF)
+		BUG("reftable ref added after the logs");
+	check_update_index(w, ref->update_index);
+
+	strbuf_reset(&w->key);
+	strbuf_addbuf(&w->key, &ref->refname);
+	strbuf_reset(&w->value);
+	strbuf_add_varint(&w->value, ref->update_index - w->min_update_index);
+	switch (ref->type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL1:
+		strbuf_add(&w->value, ref->oid.hash, rawsz);
+		break;
+	case REFTABLE_REF_VAL2:
+		strbuf_add(&w->value, ref->oid.hash, rawsz);
+		strbuf_add(&w->value, ref->peeled.hash, rawsz);
+		break;
+	case REFTABLE_REF_SYMREF:
+		strbuf_add_varint(&w->value, ref->target.len);
+		strbuf_addbuf(&w->value, &ref->target);
+		break;
+	default:
+		BUG("unknown reftable ref type %d", ref->type);
+	}
+	writer_add(w, ref->type);
+}
+
+/*
+ * The key of a log record is the refname, a NUL and the update
+ * index inverted, so that the newest entries of a ref come first.
+ */
+static void log_key(struct strbuf *key, const char *refname, size_t len,
+		    uint64_t update_index)
+{
+	unsigned char buf[8];
+
+	strbuf_add(key, refname, len);
+	strbuf_addch(key, '\0');
+	put_be64(buf, ~update_index);
+	strbuf_add(key, buf, sizeof(buf));
+}
+
+void reftable_writer_add_log(struct reftable_writer *w,
+			     const struct reftable_log_record *log)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	unsigned char tz[2];
+
+	if (w->section == BLOCK_TYPE_REF) {
+		w->ref_index_off = writer_finish_section(w);
+		w->section = BLOCK_TYPE_LOG;
+		block_writer_reset(&w->block, BLOCK_TYPE_LOG);
+		w->log_off = w->offset;
+	}
+	check_update_index(w, log->update_index);
+
+	strbuf_reset(&w->key);
+	log_key(&w->key, log->refname.buf, log->refname.len, log->update_index);
+	strbuf_reset(&w->value);
+	switch (log->type) {
+	case REFTABLE_LOG_DELETION:
+	case REFTABLE_LOG_CREATE:
+		break;
+	case REFTABLE_LOG_UPDATE:
+		strbuf_add(&w->value, log->old_oid.hash, rawsz);
+		strbuf_add(&w->value, log->new_oid.hash, rawsz);
+		strbuf_add_varint(&w->value, log->ident.len);
+		strbuf_addbuf(&w->value, &log->ident);
+		strbuf_add_varint(&w->value, log->time);
+		tz[0] = (uint16_t)log->tz >> 8;
+		tz[1] = (uint16_t)log->tz & 0xff;
+		strbuf_add(&w->value, tz, 2);
+		strbuf_add_varint(&w->value, log->message.len);
+		strbuf_addbuf(&w->value, &log->message);
+		break;
+	default:
+		BUG("unknown reftable log type %d", log->type);
+	}
+	writer_add(w, log->type);
+}
+
+int reftable_writer_finish(struct reftable_writer *w)
+{
+	unsigned char footer[FOOTER_SIZE];
+	int ret;
+
+	if (w->section == BLOCK_TYPE_REF)
+		w->ref_index_off = writer_finish_section(w);
+	else
+		w->log_index_off = writer_finish_section(w);
+
+	memcpy(footer, w->header, HEADER_SIZE);
+	put_be64(footer + HEADER_SIZE, w->ref_index_off);
+	put_be64(footer + HEADER_SIZE + 8, w->log_off);
+	put_be64(footer + HEADER_SIZE + 16, w->log_index_off);
+	put_be32(footer + FOOTER_SIZE - 4, crc32(0, footer, FOOTER_SIZE - 4));
+	writer_write(w, footer, FOOTER_SIZE);
+
+	ret = w->error ? -1 : 0;
+	block_writer_release(&w->block);
+	block_writer_release(&w->index);
+	strbuf_release(&w->key);
+	strbuf_release(&w->value);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->scratch);
+	free(w);
+	return ret;
+}
+
+/*
+ * Reading
+ */
+
+/*
+ * An open table. Readers are reference counted, so that iterators
+ * can go on using the tables they started with after the stack was
+ * reloaded.
+ */
+struct reftable_reader {
+	int refcount;
+	char *name;
+	char *path;
+	const unsigned char *map;
+	size_t size;
+	uint64_t min_update_index, max_update_index;
+	/* Each of these is 0 if the section is empty. */
+	uint64_t ref_index_off, log_off, log_index_off;
+};
+
+static NORETURN void die_corrupt(const struct reftable_reader *r)
+{
+	die(_("reftable '%s' is corrupt"), r->path);
+}
+
+static void reader_release(struct reftable_reader *r)
+{
+	if (--r->refcount)
+		return;
+	munmap((void *)r->map, r->size);
+	free(r->name);
+	free(r->path);
+	free(r);
+}
+
+/*
+ * Open the table "name" in "dir". Returns NULL and sets errno if it
+ * cannot be opened, and dies if it is not a valid table.
+ */
+static struct reftable_reader *reader_open(const char *dir, const char *name)
+{
+	struct reftable_reader *r;
+	const unsigned char *footer;
+	struct stat st;
+	uint64_t footer_off;
+	int fd;
+
+	r = xcalloc(1, sizeof(*r));
+	r->path = xstrfmt("%s/%s", dir, name);
+	fd = open(r->path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		int saved_errno = errno;
+
+		if (fd >= 0)
+			close(fd);
+		free(r->path);
+		free(r);
+		errno = saved_errno;
+		return NULL;
+	}
+	r->refcount = 1;
+	r->name = xstrdup(name);
+	r->size = xsize_t(st.st_size);
+	if (r->size < HEADER_SIZE + FOOTER_SIZE)
+		die_corrupt(r);
+	r->map = xmmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	footer_off = r->size - FOOTER_SIZE;
+	footer = r->map + footer_off;
+	if (memcmp(r->map, REFTABLE_MAGIC, 4) ||
+	    r->map[4] != REFTABLE_VERSION ||
+	    memcmp(r->map, footer, HEADER_SIZE) ||
+	    get_be32(footer + FOOTER_SIZE - 4) != crc32(0, footer, FOOTER_SIZE - 4))
+		die_corrupt(r);
+
+	r->min_update_index = get_be64(r->map + 8);
+	r->max_update_index = get_be64(r->map + 16);
+	r->ref_index_off = get_be64(footer + HEADER_SIZE);
+	r->log_off = get_be64(footer + HEADER_SIZE + 8);
+	r->log_index_off = get_be64(footer + HEADER_SIZE + 16);
+	if (r->ref_index_off >= footer_off || r->log_off >= footer_off ||
+	    r->log_index_off >= footer_off ||
+	    (r->log_index_off && r->log_off >= r->log_index_off))
+		die_corrupt(r);
+	return r;
+}
+
+/* An iterator over the records of one block. */
+struct block_iter {
+	const struct reftable_reader *r;
+	const unsigned char *block;
+	uint64_t offset;
+	uint32_t len;
+	/* The offset of the restart table, which follows the records. */
+	uint32_t records_end;
+	uint32_t nr_restarts;
+	/* The offset of the next record. */
+	uint32_t next;
+	/* Set if the current record was found by a seek, and not returned yet. */
+	int pending;
+
+	/* The current record. */
+	struct strbuf key;
+	int value_type;
+	const unsigned char *value;
+	size_t value_len;
+};
+
+static void block_iter_init(struct block_iter *bi, const struct reftable_reader *r,
+			    uint64_t offset, char type)
+{
+	uint64_t end = r->size - FOOTER_SIZE;
+	const unsigned char *p = r->map + offset;
+	uint32_t restarts_size;
+
+	if (offset < HEADER_SIZE || offset + BLOCK_HEADER_SIZE > end || *p != type)
+		die_corrupt(r);
+	bi->r = r;
+	bi->block = p;
+	bi->offset = offset;
+	bi->len = get_be24(p + 1);
+	if (bi->len < BLOCK_HEADER_SIZE + 2 || offset + bi->len > end)
+		die_corrupt(r);
+	bi->nr_restarts = get_be16(p + bi->len - 2);
+	restarts_size = 3 * bi->nr_restarts + 2;
+	if (BLOCK_HEADER_SIZE + restarts_size > bi->len)
+		die_corrupt(r);
+	bi->records_end = bi->len - restarts_size;
+	bi->next = BLOCK_HEADER_SIZE;
+	bi->pending = 0;
+	strbuf_reset(&bi->key);
+}
+
+static uint32_t block_iter_restart(struct block_iter *bi, uint32_t i)
+{
+	uint32_t offset = get_be24(bi->block + bi->records_end + 3 * i);
+
+	if (offset < BLOCK_HEADER_SIZE || offset >= bi->records_end)
+		die_corrupt(bi->r);
+	return offset;
+}
+
+/* Move to the next record of the block; returns 1 at its end. */
+static int block_iter_next(struct block_iter *bi)
+{
+	struct decoder d;
+	uintmax_t prefix, suffix;
+	const unsigned char *suffix_p;
+
+	if (bi->pending) {
+		bi->pending = 0;
+		return 0;
+	}
+	if (bi->next >= bi->records_end)
+		return 1;
+
+	d.p = bi->block + bi->next;
+	d.end = bi->block + bi->records_end;
+	d.error = 0;
+	prefix = decode_uint(&d);
+	suffix = decode_uint(&d);
+	bi->value_type = suffix & 7;
+	suffix >>= 3;
+	suffix_p = decode_bytes(&d, suffix);
+	bi->value_len = decode_uint(&d);
+	bi->value = decode_bytes(&d, bi->value_len);
+	if (d.error || prefix > bi->key.len)
+		die_corrupt(bi->r);
+
+	strbuf_setlen(&bi->key, prefix);
+	strbuf_add(&bi->key, suffix_p, suffix);
+	bi->next = d.p - bi->block;
+	return 0;
+}
+
+/* Compare the (full) key of the record at "offset" with "key". */
+static int block_iter_cmp_at(struct block_iter *bi, uint32_t offset,
+			     const struct strbuf *key)
+{
+	struct decoder d;
+	uintmax_t suffix;
+	const unsigned char *p;
+
+	d.p = bi->block + offset;
+	d.end = bi->block + bi->records_end;
+	d.error = 0;
+	if (decode_uint(&d))
+		die_corrupt(bi->r);
+	suffix = decode_uint(&d) >> 3;
+	p = decode_bytes(&d, suffix);
+	if (d.error)
+		die_corrupt(bi->r);
+	return key_cmp((const char *)p, suffix, key->buf, key->len);
+}
+
+/*
+ * Position the iterator so that block_iter_next() returns the first
+ * record whose key is not smaller than "key"; returns 1 if there is
+ * none in this block.
+ */
+static int block_iter_seek(struct block_iter *bi, const struct strbuf *key)
+{
+	uint32_t lo = 0, hi = bi->nr_restarts;
+
+	/* find the first restart point after "key" ... */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (block_iter_cmp_at(bi, block_iter_restart(bi, mid), key) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* ... and scan from the one before it */
+	if (lo) {
+		bi->next = block_iter_restart(bi, lo - 1);
+		strbuf_reset(&bi->key);
+	}
+	while (!block_iter_next(bi)) {
+		if (key_cmp(bi->key.buf, bi->key.len, key->buf, key->len) >= 0) {
+			bi->pending = 1;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* An iterator over the records of one section of a table. */
+struct table_iter {
+	struct reftable_reader *r;
+	char type;
+	/* The offset of the index of the section, which follows its blocks. */
+	uint64_t section_end;
+	int done;
+	struct block_iter bi;
+};
+
+static int table_iter_next(struct table_iter *ti)
+{
+	while (!ti->done) {
+		uint64_t next_block;
+
+		if (!block_iter_next(&ti->bi))
+			return 0;
+		next_block = ti->bi.offset + ti->bi.len;
+		if (next_block >= ti->section_end)
+			ti->done = 1;
+		else
+			block_iter_init(&ti->bi, ti->r, next_block, ti->type);
+	}
+	return 1;
+}
+
+/*
+ * Start iterating over the section "type" of "r" at the first record
+ * not smaller than "key". ti->bi.key must have been initialized.
+ */
+static void table_iter_seek(struct table_iter *ti, struct reftable_reader *r,
+			    char type, const struct strbuf *key)
+{
+	struct block_iter index;
+	struct decoder d;
+	uint64_t offset;
+
+	ti->r = r;
+	ti->type = type;
+	ti->section_end = type == BLOCK_TYPE_REF ? r->ref_index_off : r->log_index_off;
+	ti->done = !ti->section_end;
+	if (ti->done)
+		return;
+
+	/* The index tells which block the records >= key start in. */
+	strbuf_init(&index.key, 0);
+	block_iter_init(&index, r, ti->section_end, BLOCK_TYPE_INDEX);
+	if (block_iter_seek(&index, key) || block_iter_next(&index)) {
+		ti->done = 1;
+		strbuf_release(&index.key);
+		return;
+	}
+	d.p = index.value;
+	d.end = index.value + index.value_len;
+	d.error = 0;
+	offset = decode_uint(&d);
+	if (d.error || offset >= ti->section_end)
+		die_corrupt(r);
+	strbuf_release(&index.key);
+
+	block_iter_init(&ti->bi, r, offset, type);
+	block_iter_seek(&ti->bi, key);
+}
+
+static void decode_ref(const struct reftable_reader *r, const struct block_iter *bi,
+		       struct reftable_ref_record *ref)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	struct decoder d;
+	const unsigned char *p;
+	uintmax_t len;
+
+	d.p = bi->value;
+	d.end = bi->value + bi->value_len;
+	d.error = 0;
+
+	strbuf_reset(&ref->refname);
+	strbuf_addbuf(&ref->refname, &bi->key);
+	ref->update_index = r->min_update_index + decode_uint(&d);
+	ref->type = bi->value_type;
+	oidclr(&ref->oid);
+	oidclr(&ref->peeled);
+	strbuf_reset(&ref->target);
+
+	switch (ref->type) {
+	case REFTABLE_REF_DELETION:
+		break;
+	case REFTABLE_REF_VAL2:
+	case REFTABLE_REF_VAL1:
+		if ((p = decode_bytes(&d, rawsz)))
+			hashcpy(ref->oid.hash, p);
+		if (ref->type == REFTABLE_REF_VAL2 && (p = decode_bytes(&d, rawsz)))
+			hashcpy(ref->peeled.hash, p);
+		break;
+	case REFTABLE_REF_SYMREF:
+		len = decode_uint(&d);
+		if ((p = decode_bytes(&d, len)))
+			strbuf_add(&ref->target, p, len);
+		break;
+	default:
+		die_corrupt(r);
+	}
+	if (d.error)
+		die_corrupt(r);
+}
+
+static void decode_log(const struct reftable_reader *r, const struct block_iter *bi,
+		       struct reftable_log_record *log)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	struct decoder d;
+	const unsigned char *p;
+	uintmax_t len;
+
+	if (bi->key.len < 9 || bi->key.buf[bi->key.len - 9])
+		die_corrupt(r);
+	strbuf_reset(&log->refname);
+	strbuf_add(&log->refname, bi->key.buf, bi->key.len - 9);
+	log->update_index = ~get_be64(bi->key.buf + bi->key.len - 8);
+	log->type = bi->value_type;
+	oidclr(&log->old_oid);
+	oidclr(&log->new_oid);
+	strbuf_reset(&log->ident);
+	strbuf_reset(&log->message);
+	log->time = 0;
+	log->tz = 0;
+
+	d.p = bi->value;
+	d.end = bi->value + bi->value_len;
+	d.error = 0;
+
+	switch (log->type) {
+	case REFTABLE_LOG_DELETION:
+	case REFTABLE_LOG_CREATE:
+		break;
+	case REFTABLE_LOG_UPDATE:
+		if ((p = decode_bytes(&d, rawsz)))
+			hashcpy(log->old_oid.hash, p);
+		if ((p = decode_bytes(&d, rawsz)))
+			hashcpy(log->new_oid.hash, p);
+		len = decode_uint(&d);
+		if ((p = decode_bytes(&d, len)))
+			strbuf_add(&log->ident, p, len);
+		log->time = decode_uint(&d);
+		if ((p = decode_bytes(&d, 2)))
+			log->tz = (int16_t)get_be16(p);
+		len = decode_uint(&d);
+		if ((p = decode_bytes(&d, len)))
+			strbuf_add(&log->message, p, len);
+		break;
+	default:
+		die_corrupt(r);
+	}
+	if (d.error)
+		die_corrupt(r);
+}
+
+/*
+ * Merging tables
+ */
+
+struct merged_sub {
+	struct table_iter ti;
+	/* The position of the table in the stack; newer ones are higher. */
+	int pos;
+};
+
+struct reftable_iterator {
+	char type;
+	struct reftable_reader **readers;
+	int nr;
+	struct merged_sub *subs;
+	/* The tables that have records left, by key, then newest first. */
+	struct prio_queue queue;
+	/* The table whose current record was returned last. */
+	struct merged_sub *current;
+	struct strbuf last_key;
+};
+
+static int merged_sub_cmp(const void *va, const void *vb, void *data)
+{
+	const struct merged_sub *a = va, *b = vb;
+	int cmp = key_cmp(a->ti.bi.key.buf, a->ti.bi.key.len,
+			  b->ti.bi.key.buf, b->ti.bi.key.len);
+
+	return cmp ? cmp : b->pos - a->pos;
+}
+
+static struct reftable_iterator *merged_iterator_new(struct reftable_reader **readers,
+						     int nr, char type,
+						     const struct strbuf *key)
+{
+	struct reftable_iterator *it = xcalloc(1, sizeof(*it));
+	int i;
+
+	it->type = type;
+	it->queue.compare = merged_sub_cmp;
+	strbuf_init(&it->last_key, 0);
+	it->nr = nr;
+	ALLOC_ARRAY(it->readers, nr);
+	it->subs = xcalloc(nr, sizeof(*it->subs));
+	for (i = 0; i < nr; i++) {
+		struct merged_sub *sub = &it->subs[i];
+
+		it->readers[i] = readers[i];
+		readers[i]->refcount++;
+		sub->pos = i;
+		strbuf_init(&sub->ti.bi.key, 0);
+		table_iter_seek(&sub->ti, readers[i], type, key);
+		if (!table_iter_next(&sub->ti))
+			prio_queue_put(&it->queue, sub);
+	}
+	return it;
+}
+
+/*
+ * Return the table holding the next record that is not shadowed by
+ * one in a newer table, or NULL at the end.
+ */
+static struct merged_sub *merged_iterator_next(struct reftable_iterator *it)
+{
+	struct merged_sub *sub;
+
+	if (it->current) {
+		if (!table_iter_next(&it->current->ti))
+			prio_queue_put(&it->queue, it->current);
+		it->current = NULL;
+	}
+
+	while ((sub = prio_queue_get(&it->queue))) {
+		if (!it->last_key.len || strbuf_cmp(&it->last_key, &sub->ti.bi.key)) {
+			strbuf_reset(&it->last_key);
+			strbuf_addbuf(&it->last_key, &sub->ti.bi.key);
+			it->current = sub;
+			return sub;
+		}
+		if (!table_iter_next(&sub->ti))
+			prio_queue_put(&it->queue, sub);
+	}
+	return NULL;
+}
+
+int reftable_iterator_next_ref(struct reftable_iterator *it,
+			       struct reftable_ref_record *ref)
+{
+	struct merged_sub *sub;
+
+	if (it->type != BLOCK_TYPE_REF)
+		BUG("reading a ref from a reftable log iterator");
+	sub = merged_iterator_next(it);
+	if (!sub)
+		return 1;
+	decode_ref(sub->ti.r, &sub->ti.bi, ref);
+	return 0;
+}
+
+int reftable_iterator_next_log(struct reftable_iterator *it,
+			       struct reftable_log_record *log)
+{
+	struct merged_sub *sub;
+
+	if (it->type != BLOCK_TYPE_LOG)
+		BUG("reading a log from a reftable ref iterator");
+	sub = merged_iterator_next(it);
+	if (!sub)
+		return 1;
+	decode_log(sub->ti.r, &sub->ti.bi, log);
+	return 0;
+}
+
+void reftable_iterator_free(struct reftable_iterator *it)
+{
+	int i;
+
+	if (!it)
+		return;
+	for (i = 0; i < it->nr; i++) {
+		strbuf_release(&it->subs[i].ti.bi.key);
+		reader_release(it->readers[i]);
+	}
+	free(it->subs);
+	free(it->readers);
+	clear_prio_queue(&it->queue);
+	strbuf_release(&it->last_key);
+	free(it);
+}
+
+/*
+ * The stack
+ */
+
+struct reftable_stack {
+	char *dir;
+	char *list_path;
+	struct stat_validity list_validity;
+
+	/* The tables, oldest first. */
+	struct reftable_reader **readers;
+	int nr, alloc;
+
+	struct lock_file lock;
+	/* Tables written while the stack was locked. */
+	struct string_list added;
+	/* Tables merged into others, to delete once the stack is committed. */
+	struct string_list obsolete;
+};
+
+struct reftable_stack *reftable_stack_new(const char *dir)
+{
+	struct reftable_stack *stack = xcalloc(1, sizeof(*stack));
+
+	stack->dir = xstrdup(dir);
+	stack->list_path = xstrfmt("%s/tables.list", dir);
+	string_list_init(&stack->added, 1);
+	string_list_init(&stack->obsolete, 1);
+	return stack;
+}
+
+static void stack_clear_readers(struct reftable_stack *stack)
+{
+	int i;
+
+	for (i = 0; i < stack->nr; i++)
+		reader_release(stack->readers[i]);
+	stack->nr = 0;
+	stat_validity_clear(&stack->list_validity);
+}
+
+void reftable_stack_free(struct reftable_stack *stack)
+{
+	if (!stack)
+		return;
+	if (reftable_stack_is_locked(stack))
+		reftable_stack_rollback(stack);
+	stack_clear_readers(stack);
+	free(stack->readers);
+	free(stack->dir);
+	free(stack->list_path);
+	free(stack);
+}
+
+int reftable_stack_init_db(const char *dir, struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	int fd, ret = 0;
+
+	if (mkdir(dir, 0777) && errno != EEXIST) {
+		strbuf_addf(err, "unable to create directory '%s': %s",
+			    dir, strerror(errno));
+		return -1;
+	}
+	if (adjust_shared_perm(dir)) {
+		strbuf_addf(err, "unable to set permissions of '%s'", dir);
+		return -1;
+	}
+
+	strbuf_addf(&path, "%s/tables.list", dir);
+	fd = open(path.buf, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd >= 0) {
+		close(fd);
+		if (adjust_shared_perm(path.buf)) {
+			strbuf_addf(err, "unable to set permissions of '%s'", path.buf);
+			ret = -1;
+		}
+	} else if (errno != EEXIST) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    path.buf, strerror(errno));
+		ret = -1;
+	}
+	strbuf_release(&path);
+	return ret;
+}
+
+/*
+ * Read "tables.list" and open the tables it names, keeping those
+ * that are open already. Returns -1 if a table is missing, which
+ * happens if another process compacted the stack after we read the
+ * list.
+ */
+static int stack_load(struct reftable_stack *stack)
+{
+	struct strbuf list = STRBUF_INIT;
+	struct reftable_reader **readers = NULL;
+	int nr = 0, alloc = 0, i, fd, ret = 0;
+	char *p, *eol;
+
+	fd = open(stack->list_path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			die_errno(_("unable to open '%s'"), stack->list_path);
+	} else if (strbuf_read(&list, fd, 0) < 0) {
+		die_errno(_("unable to read '%s'"), stack->list_path);
+	}
+
+	for (p = list.buf; *p; p = eol + 1) {
+		struct reftable_reader *r = NULL;
+
+		eol = strchrnul(p, '\n');
+		if (!*eol)
+			die(_("'%s' is truncated"), stack->list_path);
+		*eol = '\0';
+		for (i = 0; i < stack->nr; i++) {
+			if (!strcmp(stack->readers[i]->name, p)) {
+				r = stack->readers[i];
+				r->refcount++;
+				break;
+			}
+		}
+		if (!r && !(r = reader_open(stack->dir, p))) {
+			if (errno != ENOENT)
+				die_errno(_("unable to open reftable '%s/%s'"),
+					  stack->dir, p);
+			ret = -1;
+			break;
+		}
+		ALLOC_GROW(readers, nr + 1, alloc);
+		readers[nr++] = r;
+	}
+
+	if (ret) {
+		for (i = 0; i < nr; i++)
+			reader_release(readers[i]);
+		free(readers);
+	} else {
+		stack_clear_readers(stack);
+		free(stack->readers);
+		stack->readers = readers;
+		stack->nr = nr;
+		stack->alloc = alloc;
+		if (fd >= 0)
+			stat_validity_update(&stack->list_validity, fd);
+	}
+	if (fd >= 0)
+		close(fd);
+	strbuf_release(&list);
+	return ret;
+}
+
+static void stack_load_retry(struct reftable_stack *stack)
+{
+	int tries;
+
+	for (tries = 0; stack_load(stack); tries++)
+		if (tries >= 10)
+			die(_("reftables listed in '%s' are missing"),
+			    stack->list_path);
+}
+
+/* Reload the stack if it changed; a locked stack is up to date. */
+static void stack_reload(struct reftable_stack *stack)
+{
+	if (reftable_stack_is_locked(stack) ||
+	    stat_validity_check(&stack->list_validity, stack->list_path))
+		return;
+	stack_load_retry(stack);
+}
+
+uint64_t reftable_stack_max_update_index(struct reftable_stack *stack)
+{
+	stack_reload(stack);
+	return stack->nr ? stack->readers[stack->nr - 1]->max_update_index : 0;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *stack, const char *refname,
+			    struct reftable_ref_record *ref)
+{
+	struct strbuf key = STRBUF_INIT;
+	int i, ret = 1;
+
+	stack_reload(stack);
+	strbuf_addstr(&key, refname);
+	for (i = stack->nr - 1; i >= 0; i--) {
+		struct table_iter ti;
+		int found;
+
+		strbuf_init(&ti.bi.key, 0);
+		table_iter_seek(&ti, stack->readers[i], BLOCK_TYPE_REF, &key);
+		found = !table_iter_next(&ti) && !strbuf_cmp(&ti.bi.key, &key);
+		if (found)
+			decode_ref(stack->readers[i], &ti.bi, ref);
+		strbuf_release(&ti.bi.key);
+		if (found) {
+			ret = ref->type == REFTABLE_REF_DELETION;
+			break;
+		}
+	}
+	strbuf_release(&key);
+	return ret;
+}
+
+struct reftable_iterator *reftable_stack_refs(struct reftable_stack *stack,
+					      const char *prefix)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct reftable_iterator *it;
+
+	stack_reload(stack);
+	if (prefix)
+		strbuf_addstr(&key, prefix);
+	it = merged_iterator_new(stack->readers, stack->nr, BLOCK_TYPE_REF, &key);
+	strbuf_release(&key);
+	return it;
+}
+
+struct reftable_iterator *reftable_stack_logs(struct reftable_stack *stack,
+					      const char *refname)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct reftable_iterator *it;
+
+	stack_reload(stack);
+	if (refname) {
+		strbuf_addstr(&key, refname);
+		strbuf_addch(&key, '\0');
+	}
+	it = merged_iterator_new(stack->readers, stack->nr, BLOCK_TYPE_LOG, &key);
+	strbuf_release(&key);
+	return it;
+}
+
+int reftable_stack_lock(struct reftable_stack *stack, struct strbuf *err)
+{
+	if (hold_lock_file_for_update_timeout(&stack->lock, stack->list_path, 0,
+					      get_files_ref_lock_timeout_ms()) < 0) {
+		unable_to_lock_message(stack->list_path, errno, err);
+		return -1;
+	}
+	if (!stat_validity_check(&stack->list_validity, stack->list_path))
+		stack_load_retry(stack);
+	return 0;
+}
+
+int reftable_stack_is_locked(struct reftable_stack *stack)
+{
+	return is_lock_file_locked(&stack->lock);
+}
+
+/*
+ * Write a table with the update indexes [min, max] and return it.
+ * The table is not part of the stack yet.
+ */
+static struct reftable_reader *stack_write_table(struct reftable_stack *stack,
+						 uint64_t min, uint64_t max,
+						 reftable_write_fn *write_fn,
+						 void *cb_data, struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct tempfile *tmp;
+	struct reftable_writer *w;
+	struct reftable_reader *r = NULL;
+	char *name = NULL;
+
+	strbuf_addf(&path, "%s/tmp_table_XXXXXX", stack->dir);
+	tmp = mks_tempfile_m(path.buf, 0666);
+	if (!tmp) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    path.buf, strerror(errno));
+		goto done;
+	}
+
+	w = reftable_writer_new(get_tempfile_fd(tmp), min, max);
+	write_fn(w, min, cb_data);
+	if (reftable_writer_finish(w) < 0 || close_tempfile_gently(tmp) < 0 ||
+	    adjust_shared_perm(get_tempfile_path(tmp))) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    get_tempfile_path(tmp), strerror(errno));
+		delete_tempfile(&tmp);
+		goto done;
+	}
+
+	name = xstrfmt("%012"PRIx64"-%012"PRIx64"-%s.ref", min, max,
+		       strrchr(get_tempfile_path(tmp), '_') + 1);
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/%s", stack->dir, name);
+	if (rename_tempfile(&tmp, path.buf) < 0) {
+		strbuf_addf(err, "unable to rename to '%s': %s",
+			    path.buf, strerror(errno));
+		goto done;
+	}
+	string_list_append(&stack->added, name);
+	r = reader_open(stack->dir, name);
+	if (!r)
+		die_errno(_("unable to open reftable '%s'"), path.buf);
+
+done:
+	free(name);
+	strbuf_release(&path);
+	return r;
+}
+
+int reftable_stack_add(struct reftable_stack *stack, uint64_t nr_indexes,
+		       reftable_write_fn *write_fn, void *cb_data,
+		       struct strbuf *err)
+{
+	uint64_t min = reftable_stack_max_update_index(stack) + 1;
+	struct reftable_reader *r;
+
+	if (!reftable_stack_is_locked(stack))
+		BUG("adding to a reftable stack that is not locked");
+	if (!nr_indexes)
+		BUG("reftable with no update indexes");
+	r = stack_write_table(stack, min, min + nr_indexes - 1,
+			      write_fn, cb_data, err);
+	if (!r)
+		return -1;
+	ALLOC_GROW(stack->readers, stack->nr + 1, stack->alloc);
+	stack->readers[stack->nr++] = r;
+	return 0;
+}
+
+struct compaction {
+	struct reftable_reader **readers;
+	int nr;
+	/*
+	 * Whether the oldest table is included, so that deletions need
+	 * not be kept to shadow older records.
+	 */
+	int full;
+};
+
+static void write_compacted(struct reftable_writer *w, uint64_t min_update_index,
+			    void *cb_data)
+{
+	struct compaction *c = cb_data;
+	struct reftable_ref_record ref = REFTABLE_REF_RECORD_INIT;
+	struct reftable_log_record log = REFTABLE_LOG_RECORD_INIT;
+	struct strbuf deleted = STRBUF_INIT;
+	struct reftable_iterator *it;
+	int have_deleted = 0;
+
+	it = merged_iterator_new(c->readers, c->nr, BLOCK_TYPE_REF, &deleted);
+	while (!reftable_iterator_next_ref(it, &ref))
+		if (!c->full || ref.type != REFTABLE_REF_DELETION)
+			reftable_writer_add_ref(w, &ref);
+	reftable_iterator_free(it);
+
+	it = merged_iterator_new(c->readers, c->nr, BLOCK_TYPE_LOG, &deleted);
+	while (!reftable_iterator_next_log(it, &log)) {
+		if (have_deleted && !strbuf_cmp(&log.refname, &deleted))
+			continue;
+		have_deleted = 0;
+		if (log.type == REFTABLE_LOG_DELETION) {
+			/* the older entries of this reflog are gone */
+			strbuf_reset(&deleted);
+			strbuf_addbuf(&deleted, &log.refname);
+			have_deleted = 1;
+			if (c->full)
+				continue;
+		}
+		reftable_writer_add_log(w, &log);
+	}
+	reftable_iterator_free(it);
+
+	reftable_ref_record_release(&ref);
+	reftable_log_record_release(&log);
+	strbuf_release(&deleted);
+}
+
+/* Merge the tables from "first" on into one. */
+static int stack_compact(struct reftable_stack *stack, int first, struct strbuf *err)
+{
+	struct compaction c;
+	struct reftable_reader *r;
+	int i;
+
+	if (stack->nr - first < 2)
+		return 0;
+	c.readers = stack->readers + first;
+	c.nr = stack->nr - first;
+	c.full = !first;
+	r = stack_write_table(stack, c.readers[0]->min_update_index,
+			      c.readers[c.nr - 1]->max_update_index,
+			      write_compacted, &c, err);
+	if (!r)
+		return -1;
+
+	for (i = first; i < stack->nr; i++) {
+		string_list_append(&stack->obsolete, stack->readers[i]->name);
+		reader_release(stack->readers[i]);
+	}
+	stack->readers[first] = r;
+	stack->nr = first + 1;
+	return 0;
+}
+
+int reftable_stack_compact_all(struct reftable_stack *stack, struct strbuf *err)
+{
+	if (!reftable_stack_is_locked(stack))
+		BUG("compacting a reftable stack that is not locked");
+	return stack_compact(stack, 0, err);
+}
+
+/*
+ * Keep the sizes of the tables decreasing geometrically from the
+ * oldest to the newest, so that there are only logarithmically many
+ * of them: merge the newest tables with the older ones that are not
+ * more than twice as large as all tables newer than them together.
+ */
+static void stack_auto_compact(struct reftable_stack *stack)
+{
+	struct strbuf err = STRBUF_INIT;
+	uint64_t total;
+	int i;
+
+	if (stack->nr < 2)
+		return;
+	i = stack->nr - 1;
+	total = stack->readers[i]->size;
+	while (i > 0 && stack->readers[i - 1]->size <= 2 * total)
+		total += stack->readers[--i]->size;
+	if (stack_compact(stack, i, &err))
+		warning("%s", err.buf);
+	strbuf_release(&err);
+}
+
+static void unlink_tables(struct reftable_stack *stack, struct string_list *tables)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, tables) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", stack->dir, item->string);
+		unlink_or_warn(path.buf);
+	}
+	string_list_clear(tables, 0);
+	strbuf_release(&path);
+}
+
+int reftable_stack_commit(struct reftable_stack *stack, struct strbuf *err)
+{
+	struct strbuf list = STRBUF_INIT;
+	int i;
+
+	if (!reftable_stack_is_locked(stack))
+		BUG("committing a reftable stack that is not locked");
+
+	stack_auto_compact(stack);
+	for (i = 0; i < stack->nr; i++)
+		strbuf_addf(&list, "%s\n", stack->readers[i]->name);
+	if (write_in_full(get_lock_file_fd(&stack->lock), list.buf, list.len) < 0 ||
+	    commit_lock_file(&stack->lock) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    stack->list_path, strerror(errno));
+		strbuf_release(&list);
+		reftable_stack_rollback(stack);
+		return -1;
+	}
+	strbuf_release(&list);
+
+	string_list_clear(&stack->added, 0);
+	unlink_tables(stack, &stack->obsolete);
+	/* the readers are reused by the next reload */
+	stat_validity_clear(&stack->list_validity);
+	return 0;
+}
+
+void reftable_stack_rollback(struct reftable_stack *stack)
+{
+	rollback_lock_file(&stack->lock);
+	unlink_tables(stack, &stack->added);
+	string_list_clear(&stack->obsolete, 0);
+	stack_clear_readers(stack);
+}
@@ -0,0 +1,160 @@
+#ifndef REFS_REFTABLE_H
+#define REFS_REFTABLE_H
+
+/*
+ * Reading and writing reftables, the files of the "reftable" ref
+ * storage backend, and the stack of them that makes up one ref store.
+ * See Documentation/technical/reftable.txt for the file format.
+ *
+ * A table holds two sorted sections of records: refs, keyed by their
+ * name, and reflog entries, keyed by the name of their ref and their
+ * update index, newest first. A stack is an ordered list of tables;
+ * records in newer tables shadow those with the same key in older
+ * ones, so an update is made by appending a small table, and tables
+ * are merged now and then to keep the stack short.
+ */
+
+#include "../lockfile.h"
+
+/* The value types of ref records. */
+enum reftable_ref_type {
+	REFTABLE_REF_DELETION = 0,	/* the ref was deleted */
+	REFTABLE_REF_VAL1 = 1,		/* an object name */
+	REFTABLE_REF_VAL2 = 2,		/* an object name and its peeled value */
+	REFTABLE_REF_SYMREF = 3		/* the name of another ref */
+};
+
+struct reftable_ref_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_ref_type type;
+	struct object_id oid;
+	struct object_id peeled;
+	struct strbuf target;
+};
+
+#define REFTABLE_REF_RECORD_INIT { STRBUF_INIT, 0, 0, { { 0 } }, { { 0 } }, STRBUF_INIT }
+
+/* The value types of log records. */
+enum reftable_log_type {
+	/*
+	 * The reflog of the ref was deleted: this record hides all the
+	 * older ones of the same ref.
+	 */
+	REFTABLE_LOG_DELETION = 0,
+	/* A ref update. */
+	REFTABLE_LOG_UPDATE = 1,
+	/* The reflog of the ref was created, but is empty. */
+	REFTABLE_LOG_CREATE = 2
+};
+
+struct reftable_log_record {
+	struct strbuf refname;
+	uint64_t update_index;
+	enum reftable_log_type type;
+	struct object_id old_oid;
+	struct object_id new_oid;
+	struct strbuf ident;		/* "Name <email>" */
+	timestamp_t time;
+	int tz;
+	struct strbuf message;		/* LF-terminated, or empty */
+};
+
+#define REFTABLE_LOG_RECORD_INIT { STRBUF_INIT, 0, 0, { { 0 } }, { { 0 } }, \
+				   STRBUF_INIT, 0, 0, STRBUF_INIT }
+
+extern void reftable_ref_record_release(struct reftable_ref_record *ref);
+extern void reftable_log_record_release(struct reftable_log_record *log);
+
+/*
+ * Writing a table: the records of each section must be added in key
+ * order, that is ordered by refname for refs, and by refname, then
+ * decreasing update index for logs. All refs must be added before
+ * the first log. Each record's update index must be within the range
+ * given to reftable_writer_new().
+ */
+struct reftable_writer;
+
+extern struct reftable_writer *reftable_writer_new(int fd, uint64_t min_update_index,
+						   uint64_t max_update_index);
+extern void reftable_writer_add_ref(struct reftable_writer *w,
+				    const struct reftable_ref_record *ref);
+extern void reftable_writer_add_log(struct reftable_writer *w,
+				    const struct reftable_log_record *log);
+/* Write the indexes and footer and free "w"; returns -1 on write errors. */
+extern int reftable_writer_finish(struct reftable_writer *w);
+
+/*
+ * A stack of tables in a directory, listed oldest first in
+ * "tables.list". All functions reading from the stack reload it first
+ * if it changed on disk.
+ */
+struct reftable_stack;
+
+extern struct reftable_stack *reftable_stack_new(const char *dir);
+extern void reftable_stack_free(struct reftable_stack *stack);
+
+/* Create the directory and an empty stack, unless they exist. */
+extern int reftable_stack_init_db(const char *dir, struct strbuf *err);
+
+/* The highest update index used so far. */
+extern uint64_t reftable_stack_max_update_index(struct reftable_stack *stack);
+
+/*
+ * Look up the ref "refname". Returns 0 and fills in "ref" if it
+ * exists, 1 if it does not.
+ */
+extern int reftable_stack_read_ref(struct reftable_stack *stack,
+				   const char *refname,
+				   struct reftable_ref_record *ref);
+
+/*
+ * Iterators over the merged contents of a stack, starting at the
+ * first key that is not smaller than "prefix" (for logs, at the
+ * newest entry of the ref "prefix"). Shadowed records are skipped,
+ * but deletions are returned, as the caller may need to know about
+ * them. next returns 0 on success, and 1 at the end of the records.
+ */
+struct reftable_iterator;
+
+extern struct reftable_iterator *reftable_stack_refs(struct reftable_stack *stack,
+						     const char *prefix);
+extern struct reftable_iterator *reftable_stack_logs(struct reftable_stack *stack,
+						     const char *refname);
+extern int reftable_iterator_next_ref(struct reftable_iterator *it,
+				      struct reftable_ref_record *ref);
+extern int reftable_iterator_next_log(struct reftable_iterator *it,
+				      struct reftable_log_record *log);
+extern void reftable_iterator_free(struct reftable_iterator *it);
+
+/*
+ * Updating the stack: lock it, which also reloads it, then add any
+ * number of tables and finally commit or roll back. Committing
+ * merges the newest tables if there are too many of them.
+ */
+extern int reftable_stack_lock(struct reftable_stack *stack, struct strbuf *err);
+extern int reftable_stack_is_locked(struct reftable_stack *stack);
+
+/*
+ * Write a new table with update indexes
+ * [max_update_index + 1, max_update_index + nr_indexes], calling
+ * "write_fn" to add its records; the table becomes part of the stack
+ * when the stack is committed.
+ */
+typedef void reftable_write_fn(struct reftable_writer *w,
+			       uint64_t min_update_index, void *cb_data);
+extern int reftable_stack_add(struct reftable_stack *stack, uint64_t nr_indexes,
+			      reftable_write_fn *write_fn, void *cb_data,
+			      struct strbuf *err);
+
+/*
+ * Merge all tables into one, leaving out deleted refs and reflogs.
+ * The stack must be locked.
+ */
+extern int reftable_stack_compact_all(struct reftable_stack *stack,
+				      struct strbuf *err);
+
+extern int reftable_stack_commit(struct reftable_stack *stack, struct strbuf *err);
+extern void reftable_stack_rollback(struct reftable_stack *stack);
+
+#endif /* REFS_REFTABLE_H */
@@ -496,10 +496,60 @@ struct rpc_state {
 	int out;
 	int any_written;
 	struct strbuf result;
+
+	/*
+	 * A chunked request is compressed through "gzip_stream" as
+	 * rpc_out() reads it, when "gzip_chunked" is set.
+	 */
+	git_zstream gzip_stream;
+
 	unsigned gzip_request : 1;
+	unsigned gzip_chunked : 1;
+	unsigned gzip_input_done : 1;
 	unsigned initial_buffer : 1;
 };
 
+/*
+ * Fill "ptr" with up to "max" bytes of the gzipped request, reading
+ * more of the request from the client whenever deflate needs it.
+ */
+static size_t rpc_out_gzip(void *ptr, size_t max, struct rpc_state *rpc)
+{
+	git_zstream *stream = &rpc->gzip_stream;
+
+	stream->next_out = ptr;
+	stream->avail_out = max;
+	while (stream->avail_out == max) {
+		int ret;
+
+		if (rpc->pos == rpc->len && !rpc->gzip_input_done) {
+			rpc->initial_buffer = 0;
+			rpc->len = packet_read(rpc->out, NULL, NULL, rpc->buf,
+					       rpc->alloc, 0);
+			rpc->pos = 0;
+			if (!rpc->len)
+				rpc->gzip_input_done = 1;
+		}
+
+		stream->next_in = (unsigned char *)rpc->buf + rpc->pos;
+		stream->avail_in = rpc->len - rpc->pos;
+		ret = git_deflate(stream,
+				  rpc->gzip_input_done ? Z_FINISH : Z_NO_FLUSH);
+		rpc->pos = rpc->len - stream->avail_in;
+		if (ret == Z_STREAM_END)
+			break;
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+			die("cannot deflate request; zlib deflate error %d", ret);
+	}
+	return max - stream->avail_out;
+}
+
+static void rpc_gzip_chunked_init(struct rpc_state *rpc)
+{
+	git_deflate_init_gzip(&rpc->gzip_stream, Z_BEST_COMPRESSION);
+	rpc->gzip_input_done = 0;
+}
+
 static size_t rpc_out(void *ptr, size_t eltsize,
 		size_t nmemb, void *buffer_)
 {
@@ -507,6 +557,9 @@ static size_t rpc_out(void *ptr, size_t eltsize,
 	struct rpc_state *rpc = buffer_;
 	size_t avail = rpc->len - rpc->pos;
 
+	if (rpc->gzip_chunked)
+		return rpc_out_gzip(ptr, max, rpc);
+
 	if (!avail) {
 		rpc->initial_buffer = 0;
 		avail = packet_read(rpc->out, NULL, NULL, rpc->buf, rpc->alloc, 0);
@@ -535,6 +588,11 @@ static curlioerr rpc_ioctl(CURL *handle, int cmd, void *clientp)
 	case CURLIOCMD_RESTARTREAD:
 		if (rpc->initial_buffer) {
 			rpc->pos = 0;
+			if (rpc->gzip_chunked) {
+				/* start compressing from scratch again */
+				git_deflate_end_gently(&rpc->gzip_stream);
+				rpc_gzip_chunked_init(rpc);
+			}
 			return CURLIOE_OK;
 		}
 		error("unable to rewind rpc post data - try increasing http.postBuffer");
@@ -644,7 +702,6 @@ static int post_rpc(struct rpc_state *rpc)
 
 		if (left < LARGE_PACKET_MAX) {
 			large_request = 1;
-			use_gzip = 0;
 			break;
 		}
 
@@ -692,6 +749,15 @@ static int post_rpc(struct rpc_state *rpc)
 		 */
 		headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
 		rpc->initial_buffer = 1;
+		if (use_gzip) {
+			/*
+			 * Compress as we go, rather than holding the whole
+			 * request in memory to compress it first.
+			 */
+			headers = curl_slist_append(headers, "Content-Encoding: gzip");
+			rpc->gzip_chunked = 1;
+			rpc_gzip_chunked_init(rpc);
+		}
 		curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, rpc_out);
 		curl_easy_setopt(slot->curl, CURLOPT_INFILE, rpc);
 #ifndef NO_CURL_IOCTL
@@ -699,7 +765,8 @@ static int post_rpc(struct rpc_state *rpc)
 		curl_easy_setopt(slot->curl, CURLOPT_IOCTLDATA, rpc);
 #endif
 		if (options.verbosity > 1) {
-			fprintf(stderr, "POST %s (chunked)\n", rpc->service_name);
+			fprintf(stderr, "POST %s (chunked%s)\n", rpc->service_name,
+				use_gzip ? ", gzip" : "");
 			fflush(stderr);
 		}
 
@@ -769,6 +836,10 @@ static int post_rpc(struct rpc_state *rpc)
 
 	rpc->any_written = 0;
 	err = run_slot(slot, NULL);
+	if (rpc->gzip_chunked) {
+		git_deflate_end_gently(&rpc->gzip_stream);
+		rpc->gzip_chunked = 0;
+	}
 	if (err == HTTP_REAUTH && !large_request) {
 		credential_fill(&http_auth);
 		goto retry;
@@ -1322,6 +1393,27 @@ static int stateless_connect(const char *service_name)
 	return 0;
 }
 
+/*
+ * Handle "get <url> <path>", downloading a single file (e.g. a bundle)
+ * to <path>.
+ */
+static void parse_get(const char *arg)
+{
+	struct strbuf url = STRBUF_INIT;
+	const char *space = strchr(arg, ' ');
+
+	if (!space)
+		die("remote-curl: protocol error: expected '<url> <path>', missing space");
+
+	strbuf_add(&url, arg, space - arg);
+	if (http_get_file(url.buf, space + 1, NULL) != HTTP_OK)
+		die("remote-curl: failed to download file at URL '%s'", url.buf);
+
+	strbuf_release(&url);
+	printf("\n");
+	fflush(stdout);
+}
+
 int cmd_main(int argc, const char **argv)
 {
 	struct strbuf buf = STRBUF_INIT;
@@ -1371,6 +1463,9 @@ int cmd_main(int argc, const char **argv)
 		} else if (starts_with(buf.buf, "push ")) {
 			parse_push(&buf);
 
+		} else if (skip_prefix(buf.buf, "get ", &arg)) {
+			parse_get(arg);
+
 		} else if (skip_prefix(buf.buf, "option ", &arg)) {
 			char *value = strchr(arg, ' ');
 			int result;
@@ -1395,6 +1490,7 @@ int cmd_main(int argc, const char **argv)
 			printf("option\n");
 			printf("push\n");
 			printf("check-connectivity\n");
+			printf("get\n");
 			printf("\n");
 			fflush(stdout);
 		} else if (skip_prefix(buf.buf, "stateless-connect ", &arg)) {
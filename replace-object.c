@@ -43,6 +43,14 @@ static void prepare_replace_object(struct repository *r)
 	for_each_replace_ref(r, register_replace_ref, NULL);
 }
 
+int replace_refs_in_use(struct repository *r)
+{
+	if (!check_replace_refs)
+		return 0;
+	prepare_replace_object(r);
+	return hashmap_get_size(&r->objects->replace_map->map) != 0;
+}
+
 /* We allow "recursive" replacement. Only within reason, though */
 #define MAXREPLACEDEPTH 5
 
@@ -17,6 +17,12 @@ struct replace_object {
 extern const struct object_id *do_lookup_replace_object(struct repository *r,
 							const struct object_id *oid);
 
+/*
+ * Whether any object is replaced, and replacement is not suppressed;
+ * the replace refs are read if they have not been yet.
+ */
+int replace_refs_in_use(struct repository *r);
+
 /*
  * If object sha1 should be replaced, return the replacement object's
  * name (replaced recursively, if necessary).  The return value is
@@ -28,7 +34,7 @@ static inline const struct object_id *lookup_replace_object(struct repository *r
 {
 	if (!check_replace_refs ||
 	    (r->objects->replace_map &&
-	     r->objects->replace_map->map.tablesize == 0))
+	     !hashmap_get_size(&r->objects->replace_map->map)))
 		return oid;
 	return do_lookup_replace_object(r, oid);
 }
@@ -22,15 +22,21 @@
 #define BOTTOM		(1u<<10)
 #define USER_GIVEN	(1u<<25) /* given directly by the user */
 #define TRACK_LINEAR	(1u<<26)
-#define ALL_REV_FLAGS	(((1u<<11)-1) | USER_GIVEN | TRACK_LINEAR)
+#define TOPO_WALK_EXPLORED	(1u<<27)
+#define TOPO_WALK_INDEGREE	(1u<<28)
+#define ALL_REV_FLAGS	(((1u<<11)-1) | USER_GIVEN | TRACK_LINEAR | \
+			 TOPO_WALK_EXPLORED | TOPO_WALK_INDEGREE)
 
 #define DECORATE_SHORT_REFS	1
 #define DECORATE_FULL_REFS	2
 
 struct rev_info;
+struct bloom_key;
+struct bloom_filter_settings;
 struct log_info;
 struct string_list;
 struct saved_parents;
+struct topo_walk_info;
 define_shared_commit_slab(revision_sources, char *);
 
 struct rev_cmdline_info {
@@ -126,7 +132,14 @@ struct rev_info {
 			tree_blobs_in_commit_order:1,
 
 			/* for internal use only */
-			exclude_promisor_objects:1;
+			exclude_promisor_objects:1,
+			/*
+			 * Blobs from packs are kept as a bit per pack entry
+			 * while walking trees, instead of a "struct blob";
+			 * the object given to show_object() for them is
+			 * only valid during the call.
+			 */
+			compact_blobs:1;
 
 	/* Diff flags */
 	unsigned int	diff:1,
@@ -205,6 +218,14 @@ struct rev_info {
 	struct diff_options diffopt;
 	struct diff_options pruning;
 
+	/*
+	 * Changed-path Bloom filter key of the single path we are limited
+	 * to, if the commit-graph has filters we can use to skip tree
+	 * diffs (see prepare_to_use_bloom_filter()).
+	 */
+	struct bloom_key *bloom_key;
+	struct bloom_filter_settings *bloom_filter_settings;
+
 	struct reflog_walk_info *reflog_info;
 	struct decoration children;
 	struct decoration merge_simplification;
@@ -228,6 +249,13 @@ struct rev_info {
 	const char *break_bar;
 
 	struct revision_sources *sources;
+
+	/*
+	 * State of the incremental --topo-order walk, used instead of
+	 * sorting the whole history up front when the commit-graph has
+	 * generation numbers.
+	 */
+	struct topo_walk_info *topo_walk_info;
 };
 
 extern int ref_excluded(struct string_list *, const char *path);
@@ -7,6 +7,12 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "quote.h"
+#include "trace2.h"
+#include "config.h"
+#include "tempfile.h"
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
 
 void child_process_init(struct child_process *child)
 {
@@ -507,6 +513,89 @@ static void atfork_parent(struct atfork_state *as)
 		"restoring signal mask");
 #endif
 }
+
+#ifdef HAVE_POSIX_SPAWN
+static void spawn_dup2(posix_spawn_file_actions_t *fa, int fd, int to,
+		       int *err)
+{
+	if (!*err)
+		*err = posix_spawn_file_actions_adddup2(fa, fd, to);
+}
+
+static void spawn_close(posix_spawn_file_actions_t *fa, int fd, int *err)
+{
+	if (!*err)
+		*err = posix_spawn_file_actions_addclose(fa, fd);
+}
+
+static void spawn_close_pair(posix_spawn_file_actions_t *fa, int fd[2],
+			     int *err)
+{
+	spawn_close(fa, fd[0], err);
+	spawn_close(fa, fd[1], err);
+}
+
+/*
+ * Start "cmd" with posix_spawn(), which creates the child without
+ * copying our page tables (the C library uses vfork() or an equivalent
+ * clone()), instead of fork() and exec(). The file descriptors are set
+ * up as the child of the fork() in start_command() would do; "fdin",
+ * "fdout" and "fderr" are the pipes made for the child, if any.
+ *
+ * Return 0 if the child was started, or the error number of the
+ * failure, including that of exec'ing the command.
+ */
+static int spawn_command(struct child_process *cmd, const char **argv,
+			 char **childenv, int null_fd,
+			 int *fdin, int *fdout, int *fderr)
+{
+	posix_spawn_file_actions_t fa;
+	int err;
+
+	err = posix_spawn_file_actions_init(&fa);
+	if (err)
+		return err;
+
+	if (cmd->no_stdin)
+		spawn_dup2(&fa, null_fd, 0, &err);
+	else if (fdin) {
+		spawn_dup2(&fa, fdin[0], 0, &err);
+		spawn_close_pair(&fa, fdin, &err);
+	} else if (cmd->in) {
+		spawn_dup2(&fa, cmd->in, 0, &err);
+		spawn_close(&fa, cmd->in, &err);
+	}
+
+	if (cmd->no_stderr)
+		spawn_dup2(&fa, null_fd, 2, &err);
+	else if (fderr) {
+		spawn_dup2(&fa, fderr[1], 2, &err);
+		spawn_close_pair(&fa, fderr, &err);
+	} else if (cmd->err > 1) {
+		spawn_dup2(&fa, cmd->err, 2, &err);
+		spawn_close(&fa, cmd->err, &err);
+	}
+
+	if (cmd->no_stdout)
+		spawn_dup2(&fa, null_fd, 1, &err);
+	else if (cmd->stdout_to_stderr)
+		spawn_dup2(&fa, 2, 1, &err);
+	else if (fdout) {
+		spawn_dup2(&fa, fdout[1], 1, &err);
+		spawn_close_pair(&fa, fdout, &err);
+	} else if (cmd->out > 1) {
+		spawn_dup2(&fa, cmd->out, 1, &err);
+		spawn_close(&fa, cmd->out, &err);
+	}
+
+	/* argv[0] is SHELL_PATH, for the fork() path to retry with */
+	if (!err)
+		err = posix_spawn(&cmd->pid, argv[1], &fa, NULL,
+				  (char *const *) argv + 1, childenv);
+	posix_spawn_file_actions_destroy(&fa);
+	return err;
+}
+#endif
 #endif /* GIT_WINDOWS_NATIVE */
 
 static inline void set_cloexec(int fd)
@@ -707,6 +796,7 @@ int start_command(struct child_process *cmd)
 	}
 
 	trace_run_command(cmd);
+	trace2_child_start(cmd);
 
 	fflush(NULL);
 
@@ -719,9 +809,6 @@ int start_command(struct child_process *cmd)
 	struct child_err cerr;
 	struct atfork_state as;
 
-	if (pipe(notify_pipe))
-		notify_pipe[0] = notify_pipe[1] = -1;
-
 	if (cmd->no_stdin || cmd->no_stdout || cmd->no_stderr) {
 		null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
 		if (null_fd < 0)
@@ -731,6 +818,41 @@ int start_command(struct child_process *cmd)
 
 	prepare_cmd(&argv, cmd);
 	childenv = prep_childenv(cmd->env);
+
+#ifdef HAVE_POSIX_SPAWN
+	/*
+	 * posix_spawn() cannot change directory portably, and does not
+	 * fall back to running a script without "#!" with the shell;
+	 * leave those to fork().
+	 */
+	if (!cmd->dir) {
+		failed_errno = spawn_command(cmd, argv.argv, childenv, null_fd,
+					     need_in ? fdin : NULL,
+					     need_out ? fdout : NULL,
+					     need_err ? fderr : NULL);
+		if (!failed_errno) {
+			if (cmd->clean_on_exit)
+				mark_child_for_cleanup(cmd->pid, cmd);
+			goto spawned;
+		}
+		if (failed_errno != ENOEXEC) {
+			if (failed_errno != ENOENT)
+				cerr.err = CHILD_ERR_ERRNO;
+			else if (cmd->silent_exec_failure)
+				cerr.err = CHILD_ERR_SILENT;
+			else
+				cerr.err = CHILD_ERR_ENOENT;
+			cerr.syserr = failed_errno;
+			child_err_spew(cmd, &cerr);
+			cmd->pid = -1;
+			goto spawned;
+		}
+	}
+#endif
+
+	if (pipe(notify_pipe))
+		notify_pipe[0] = notify_pipe[1] = -1;
+
 	atfork_prepare(&as);
 
 	/*
@@ -852,6 +974,9 @@ int start_command(struct child_process *cmd)
 	}
 	close(notify_pipe[0]);
 
+#ifdef HAVE_POSIX_SPAWN
+spawned:
+#endif
 	if (null_fd >= 0)
 		close(null_fd);
 	argv_array_clear(&argv);
@@ -923,6 +1048,7 @@ int start_command(struct child_process *cmd)
 			close_pair(fderr);
 		else if (cmd->err)
 			close(cmd->err);
+		trace2_child_exit(cmd, -1);
 		child_process_clear(cmd);
 		errno = failed_errno;
 		return -1;
@@ -949,6 +1075,7 @@ int start_command(struct child_process *cmd)
 int finish_command(struct child_process *cmd)
 {
 	int ret = wait_or_whine(cmd->pid, cmd->argv[0], 0);
+	trace2_child_exit(cmd, ret);
 	child_process_clear(cmd);
 	return ret;
 }
@@ -1280,23 +1407,267 @@ const char *find_hook(const char *name)
 	return path.buf;
 }
 
-int run_hook_ve(const char *const *env, const char *name, va_list args)
+/* The util of the commands configured as hook.<name>.command */
+static char hook_is_command;
+
+static void list_hooks(const char *name, struct string_list *hooks)
 {
-	struct child_process hook = CHILD_PROCESS_INIT;
-	const char *p;
+	const char *path = find_hook(name);
+	const struct string_list *commands;
+	struct strbuf key = STRBUF_INIT;
+	int i;
+
+	if (path)
+		string_list_append(hooks, path);
+
+	strbuf_addf(&key, "hook.%s.command", name);
+	commands = git_config_get_value_multi(key.buf);
+	for (i = 0; commands && i < commands->nr; i++) {
+		const char *command = commands->items[i].string;
+
+		if (command && *command)
+			string_list_append(hooks, command)->util = &hook_is_command;
+	}
+	strbuf_release(&key);
+}
+
+int hook_exists(const char *name)
+{
+	struct string_list hooks = STRING_LIST_INIT_DUP;
+	int ret;
+
+	list_hooks(name, &hooks);
+	ret = hooks.nr > 0;
+	string_list_clear(&hooks, 0);
+	return ret;
+}
+
+/* The events whose hooks cannot change the outcome of the operation */
+static int hook_may_be_async(const char *name)
+{
+	static const char *events[] = {
+		"post-applypatch", "post-checkout", "post-commit",
+		"post-merge", "post-receive", "post-update"
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(events); i++)
+		if (!strcmp(name, events[i]))
+			return 1;
+	return 0;
+}
 
-	p = find_hook(name);
-	if (!p)
+static void prepare_hook(struct child_process *cp,
+			 const struct string_list_item *hook,
+			 const struct run_hooks_opt *opt)
+{
+	argv_array_push(&cp->args, hook->string);
+	argv_array_pushv(&cp->args, opt->args.argv);
+	argv_array_pushv(&cp->env_array, opt->env.argv);
+	cp->use_shell = hook->util == &hook_is_command;
+	cp->stdout_to_stderr = 1;
+}
+
+static int run_one_hook(const struct string_list_item *hook,
+			struct run_hooks_opt *opt)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+
+	prepare_hook(&cp, hook, opt);
+	cp.err = opt->err;
+	opt->err = 0; /* start_command() closes it */
+	if (!opt->input) {
+		cp.no_stdin = 1;
+		return run_command(&cp);
+	}
+
+	cp.in = -1;
+	if (start_command(&cp))
+		return -1;
+	/* a hook need not read its input */
+	sigchain_push(SIGPIPE, SIG_IGN);
+	write_in_full(cp.in, opt->input, opt->input_len);
+	close(cp.in);
+	sigchain_pop(SIGPIPE);
+	return finish_command(&cp);
+}
+
+/*
+ * Several hooks cannot share a pipe for their input, so they read it
+ * from a file of their own instead.
+ */
+static struct tempfile *write_hook_input(const struct run_hooks_opt *opt)
+{
+	struct tempfile *input;
+
+	input = mks_tempfile(git_path("hook-input-XXXXXX"));
+	if (!input) {
+		error_errno(_("unable to create a file for hook input"));
+		return NULL;
+	}
+	if (write_in_full(get_tempfile_fd(input), opt->input,
+			  opt->input_len) < 0 ||
+	    close_tempfile_gently(input)) {
+		error_errno(_("unable to write hook input to '%s'"),
+			    get_tempfile_path(input));
+		delete_tempfile(&input);
+	}
+	return input;
+}
+
+struct parallel_hooks {
+	const struct string_list *hooks;
+	const struct run_hooks_opt *opt;
+	const char *input_path;
+	int next;
+	int ret;
+};
+
+static int next_hook(struct child_process *cp, struct strbuf *out,
+		     void *pp_cb, void **pp_task_cb)
+{
+	struct parallel_hooks *ph = pp_cb;
+
+	if (ph->next >= ph->hooks->nr)
 		return 0;
+	prepare_hook(cp, &ph->hooks->items[ph->next++], ph->opt);
+	if (ph->input_path) {
+		cp->in = open(ph->input_path, O_RDONLY);
+		if (cp->in < 0) {
+			strbuf_addf(out, _("could not open '%s': %s\n"),
+				    ph->input_path, strerror(errno));
+			ph->ret = -1;
+			return 0;
+		}
+	}
+	return 1;
+}
 
-	argv_array_push(&hook.args, p);
-	while ((p = va_arg(args, const char *)))
-		argv_array_push(&hook.args, p);
-	hook.env = env;
-	hook.no_stdin = 1;
-	hook.stdout_to_stderr = 1;
+static int hook_start_failure(struct strbuf *out,
+			      void *pp_cb, void *pp_task_cb)
+{
+	struct parallel_hooks *ph = pp_cb;
+
+	ph->ret = -1;
+	return 0;
+}
+
+static int hook_finished(int result, struct strbuf *out,
+			 void *pp_cb, void *pp_task_cb)
+{
+	struct parallel_hooks *ph = pp_cb;
+
+	if (result)
+		ph->ret = result;
+	if (ph->opt->err > 0) {
+		write_in_full(ph->opt->err, out->buf, out->len);
+		strbuf_reset(out);
+	}
+	return 0;
+}
+
+static int run_hooks_parallel(const struct string_list *hooks,
+			      struct run_hooks_opt *opt)
+{
+	struct parallel_hooks ph = { hooks, opt };
+	struct tempfile *input = NULL;
+
+	if (opt->input) {
+		input = write_hook_input(opt);
+		if (!input)
+			return -1;
+		ph.input_path = get_tempfile_path(input);
+	}
+	run_processes_parallel_buffered(hooks->nr, next_hook,
+					hook_start_failure, hook_finished,
+					&ph);
+	delete_tempfile(&input);
+	return ph.ret;
+}
+
+/*
+ * Start the hooks and leave them running: their output has nowhere to
+ * go once we are done, and we do not wait to see how they exit.
+ */
+static void start_hooks_async(const struct string_list *hooks,
+			      const struct run_hooks_opt *opt)
+{
+	struct tempfile *input = NULL;
+	int i;
+
+	if (opt->input) {
+		input = write_hook_input(opt);
+		if (!input)
+			return;
+	}
+	for (i = 0; i < hooks->nr; i++) {
+		struct child_process cp = CHILD_PROCESS_INIT;
+
+		prepare_hook(&cp, &hooks->items[i], opt);
+		cp.stdout_to_stderr = 0;
+		cp.no_stdout = 1;
+		cp.no_stderr = 1;
+		if (input)
+			cp.in = open(get_tempfile_path(input), O_RDONLY);
+		if (cp.in <= 0) {
+			cp.in = 0;
+			cp.no_stdin = 1;
+		}
+		if (start_command(&cp))
+			continue;
+		child_process_clear(&cp);
+	}
+	/* the hooks that are still to read it have it open */
+	delete_tempfile(&input);
+}
+
+int run_hooks(const char *name, struct run_hooks_opt *opt)
+{
+	struct string_list hooks = STRING_LIST_INIT_DUP;
+	int async = 0, ret = 0;
+
+	list_hooks(name, &hooks);
+	if (hooks.nr && hook_may_be_async(name)) {
+		struct strbuf key = STRBUF_INIT;
+
+		strbuf_addf(&key, "hook.%s.async", name);
+		git_config_get_bool(key.buf, &async);
+		strbuf_release(&key);
+	}
 
-	return run_command(&hook);
+	if (!hooks.nr)
+		; /* nothing to run */
+	else if (async) {
+		/* so that the hooks do not hold it open */
+		if (opt->err > 0) {
+			close(opt->err);
+			opt->err = 0;
+		}
+		start_hooks_async(&hooks, opt);
+	}
+	else if (hooks.nr == 1)
+		ret = run_one_hook(&hooks.items[0], opt);
+	else
+		ret = run_hooks_parallel(&hooks, opt);
+
+	if (opt->err > 0)
+		close(opt->err);
+	string_list_clear(&hooks, 0);
+	argv_array_clear(&opt->env);
+	argv_array_clear(&opt->args);
+	return ret;
+}
+
+int run_hook_ve(const char *const *env, const char *name, va_list args)
+{
+	struct run_hooks_opt opt = RUN_HOOKS_OPT_INIT;
+	const char *p;
+
+	for (; env && *env; env++)
+		argv_array_push(&opt.env, *env);
+	while ((p = va_arg(args, const char *)))
+		argv_array_push(&opt.args, p);
+	return run_hooks(name, &opt);
 }
 
 int run_hook_le(const char *const *env, const char *name, ...)
@@ -1498,6 +1869,7 @@ struct parallel_processes {
 	struct pollfd *pfd;
 
 	unsigned shutdown : 1;
+	unsigned buffer_output : 1;
 
 	int output_owner;
 	struct strbuf buffered_output; /* of finished children */
@@ -1629,7 +2001,8 @@ static int pp_start_one(struct parallel_processes *pp)
 	}
 	pp->children[i].process.err = -1;
 	pp->children[i].process.stdout_to_stderr = 1;
-	pp->children[i].process.no_stdin = 1;
+	if (!pp->children[i].process.in)
+		pp->children[i].process.no_stdin = 1;
 
 	if (start_command(&pp->children[i].process)) {
 		code = pp->start_failure(&pp->children[i].err,
@@ -1678,6 +2051,8 @@ static void pp_buffer_stderr(struct parallel_processes *pp, int output_timeout)
 static void pp_output(struct parallel_processes *pp)
 {
 	int i = pp->output_owner;
+	if (pp->buffer_output)
+		return;
 	if (pp->children[i].state == GIT_CP_WORKING &&
 	    pp->children[i].err.len) {
 		strbuf_write(&pp->children[i].err, stderr);
@@ -1742,11 +2117,11 @@ static int pp_collect_finished(struct parallel_processes *pp)
 	return result;
 }
 
-int run_processes_parallel(int n,
-			   get_next_task_fn get_next_task,
-			   start_failure_fn start_failure,
-			   task_finished_fn task_finished,
-			   void *pp_cb)
+static int run_processes_parallel_1(int n, int buffer_output,
+				    get_next_task_fn get_next_task,
+				    start_failure_fn start_failure,
+				    task_finished_fn task_finished,
+				    void *pp_cb)
 {
 	int i, code;
 	int output_timeout = 100;
@@ -1754,6 +2129,7 @@ int run_processes_parallel(int n,
 	struct parallel_processes pp;
 
 	pp_init(&pp, n, get_next_task, start_failure, task_finished, pp_cb);
+	pp.buffer_output = buffer_output;
 	while (1) {
 		for (i = 0;
 		    i < spawn_cap && !pp.shutdown &&
@@ -1783,3 +2159,39 @@ int run_processes_parallel(int n,
 	pp_cleanup(&pp);
 	return 0;
 }
+
+int run_processes_parallel(int n,
+			   get_next_task_fn get_next_task,
+			   start_failure_fn start_failure,
+			   task_finished_fn task_finished,
+			   void *pp_cb)
+{
+	return run_processes_parallel_1(n, 0, get_next_task, start_failure,
+					task_finished, pp_cb);
+}
+
+int run_processes_parallel_buffered(int n,
+				    get_next_task_fn get_next_task,
+				    start_failure_fn start_failure,
+				    task_finished_fn task_finished,
+				    void *pp_cb)
+{
+	return run_processes_parallel_1(n, 1, get_next_task, start_failure,
+					task_finished, pp_cb);
+}
+
+int run_auto_maintenance(int quiet)
+{
+	int enabled;
+	struct child_process maint = CHILD_PROCESS_INIT;
+
+	if (!git_config_get_bool("maintenance.auto", &enabled) &&
+	    !enabled)
+		return 0;
+
+	maint.git_cmd = 1;
+	argv_array_pushl(&maint.args, "maintenance", "run", "--auto", NULL);
+	argv_array_push(&maint.args, quiet ? "--quiet" : "--no-quiet");
+
+	return run_command(&maint);
+}
@@ -46,6 +46,10 @@ struct child_process {
 	unsigned wait_after_clean:1;
 	void (*clean_on_exit_handler)(struct child_process *process);
 	void *clean_on_exit_handler_cbdata;
+
+	/* used by trace2.c to tell the trace2 events of children apart */
+	int trace2_child_id;
+	uint64_t trace2_child_start_ns;
 };
 
 #define CHILD_PROCESS_INIT { NULL, ARGV_ARRAY_INIT, ARGV_ARRAY_INIT }
@@ -68,6 +72,43 @@ LAST_ARG_MUST_BE_NULL
 extern int run_hook_le(const char *const *env, const char *name, ...);
 extern int run_hook_ve(const char *const *env, const char *name, va_list args);
 
+/*
+ * Besides the script in the hooks directory, an event can have any
+ * number of commands configured as hook.<name>.command, which are run
+ * with the shell. When an event has more than one hook, they all run at
+ * once, and the output of each is shown when it is done.
+ *
+ * When hook.<name>.async is set for an event whose hooks cannot change
+ * the outcome of the operation, such as post-commit or post-receive,
+ * its hooks are started with their output discarded and left to run.
+ */
+struct run_hooks_opt {
+	/* added to the environment of the hooks */
+	struct argv_array env;
+	/* passed to the hooks */
+	struct argv_array args;
+	/* the standard input of every hook; /dev/null if NULL */
+	const char *input;
+	size_t input_len;
+	/*
+	 * If set, the output of the hooks goes to this file descriptor
+	 * instead of our standard error, and it is closed when done.
+	 */
+	int err;
+};
+
+#define RUN_HOOKS_OPT_INIT { ARGV_ARRAY_INIT, ARGV_ARRAY_INIT }
+
+/* Return 1 if the event "name" has any hook, 0 otherwise. */
+int hook_exists(const char *name);
+
+/*
+ * Run the hooks of the event "name", and release "opt". Return 0 if
+ * they all succeeded or were started in the background, the non-zero
+ * exit code of one that failed otherwise.
+ */
+int run_hooks(const char *name, struct run_hooks_opt *opt);
+
 #define RUN_COMMAND_NO_STDIN 1
 #define RUN_GIT_CMD	     2	/*If this is to be git sub-command */
 #define RUN_COMMAND_STDOUT_TO_STDERR 4
@@ -82,6 +123,12 @@ int run_command_v_opt(const char **argv, int opt);
  */
 int run_command_v_opt_cd_env(const char **argv, int opt, const char *dir, const char *const *env);
 
+/*
+ * Run "git maintenance run --auto", which replaces "git gc --auto" for
+ * the commands that leave work behind for it.
+ */
+int run_auto_maintenance(int quiet);
+
 /**
  * Execute the given command, sending "in" to its stdin, and capturing its
  * stdout and stderr in the "out" and "err" strbufs. Any of the three may
@@ -152,6 +199,9 @@ void check_pipe(int err);
  * pp_cb is the callback cookie as passed to run_processes_parallel.
  * You can store a child process specific callback cookie in pp_task_cb.
  *
+ * The standard input of the child is /dev/null, unless cp->in is set to
+ * a file descriptor for it to read.
+ *
  * Even after returning 0 to indicate that there are no more processes,
  * this function will be called again until there are no more running
  * child processes.
@@ -222,4 +272,16 @@ int run_processes_parallel(int n,
 			   task_finished_fn,
 			   void *pp_cb);
 
+/**
+ * Like run_processes_parallel(), except that the output of a child is
+ * never shown as it comes: all of it is in the strbuf handed to
+ * task_finished_fn, which may parse it and leave in there only what is
+ * to be shown.
+ */
+int run_processes_parallel_buffered(int n,
+				    get_next_task_fn,
+				    start_failure_fn,
+				    task_finished_fn,
+				    void *pp_cb);
+
 #endif
@@ -5,6 +5,7 @@
 #include "object-store.h"
 #include "object.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "sequencer.h"
 #include "tag.h"
 #include "run-command.h"
@@ -12,6 +13,7 @@
 #include "utf8.h"
 #include "cache-tree.h"
 #include "diff.h"
+#include "diffcore.h"
 #include "revision.h"
 #include "rerere.h"
 #include "merge-recursive.h"
@@ -30,6 +32,8 @@
 #include "oidset.h"
 #include "commit-slab.h"
 #include "alias.h"
+#include "merge-ort.h"
+#include "tree-walk.h"
 
 #define GIT_REFLOG_ACTION "GIT_REFLOG_ACTION"
 
@@ -132,6 +136,13 @@ static GIT_PATH_FUNC(rebase_path_rewritten_pending,
  */
 static GIT_PATH_FUNC(rebase_path_squash_onto, "rebase-merge/squash-onto")
 
+/*
+ * The path of the file containing the OID of the commit that the index and
+ * worktree are at while in-memory picks (rebase.inMemory) have moved HEAD
+ * past it.
+ */
+static GIT_PATH_FUNC(rebase_path_worktree_commit, "rebase-merge/worktree-commit")
+
 /*
  * The path of the file listing refs that need to be deleted after the rebase
  * finishes. This is used by the `label` command to record the need for cleanup.
@@ -181,6 +192,11 @@ static int git_sequencer_config(const char *k, const char *v, void *cb)
 		return status;
 	}
 
+	if (!strcmp(k, "rebase.inmemory")) {
+		opts->in_memory = git_config_bool(k, v);
+		return 0;
+	}
+
 	if (!strcmp(k, "commit.gpgsign")) {
 		opts->gpg_sign = git_config_bool(k, v) ? xstrdup("") : NULL;
 		return 0;
@@ -514,6 +530,12 @@ void append_conflicts_hint(struct strbuf *msgbuf)
 	}
 }
 
+/*
+ * The renames on the HEAD side of the last pick; the next pick onto its
+ * result mostly finds the same ones.
+ */
+static struct rename_cache head_renames;
+
 static int do_recursive_merge(struct commit *base, struct commit *next,
 			      const char *base_label, const char *next_label,
 			      struct object_id *head, struct strbuf *msgbuf,
@@ -537,6 +559,7 @@ static int do_recursive_merge(struct commit *base, struct commit *next,
 	if (is_rebase_i(opts))
 		o.buffer_output = 2;
 	o.show_rename_progress = 1;
+	o.rename_cache = &head_renames;
 
 	head_tree = parse_tree_indirect(head);
 	next_tree = next ? get_commit_tree(next) : empty_tree();
@@ -1193,7 +1216,8 @@ static int parse_head(struct commit **head)
 
 /*
  * Try to commit without forking 'git commit'. In some cases we need
- * to run 'git commit' to display an error message
+ * to run 'git commit' to display an error message. The tree of the new
+ * commit is "tree_oid" if given, and written from the index otherwise.
  *
  * Returns:
  *  -1 - error unable to commit
@@ -1202,6 +1226,7 @@ static int parse_head(struct commit **head)
  */
 static int try_to_commit(struct strbuf *msg, const char *author,
 			 struct replay_opts *opts, unsigned int flags,
+			 const struct object_id *tree_oid,
 			 struct object_id *oid)
 {
 	struct object_id tree;
@@ -1244,7 +1269,9 @@ static int try_to_commit(struct strbuf *msg, const char *author,
 		commit_list_insert(current_head, &parents);
 	}
 
-	if (write_cache_as_tree(&tree, 0, NULL)) {
+	if (tree_oid)
+		oidcpy(&tree, tree_oid);
+	else if (write_cache_as_tree(&tree, 0, NULL)) {
 		res = error(_("git write-tree failed to write a tree"));
 		goto out;
 	}
@@ -1256,7 +1283,7 @@ static int try_to_commit(struct strbuf *msg, const char *author,
 		goto out;
 	}
 
-	if (find_hook("prepare-commit-msg")) {
+	if (hook_exists("prepare-commit-msg")) {
 		res = run_prepare_commit_msg_hook(msg, hook_commit);
 		if (res)
 			goto out;
@@ -1322,7 +1349,7 @@ static int do_commit(const char *msg_file, const char *author,
 					   msg_file);
 
 		res = try_to_commit(msg_file ? &sb : NULL, author, opts, flags,
-				    &oid);
+				    NULL, &oid);
 		strbuf_release(&sb);
 		if (!res) {
 			unlink(git_path_cherry_pick_head(the_repository));
@@ -1610,6 +1637,236 @@ static void record_in_rewritten(struct object_id *oid,
 		flush_rewritten_pending();
 }
 
+/*
+ * With rebase.inMemory, a pick that merges cleanly only writes objects
+ * and moves HEAD. The index and worktree stay at the commit where they
+ * were last checked out, opts->worktree_commit, until a command that
+ * needs them, a conflict or the end of the rebase brings them up to
+ * HEAD in one go. That commit is also kept in
+ * rebase_path_worktree_commit(), so that "git rebase --continue" or
+ * "--skip" catches up if the rebase dies before that.
+ */
+static int sync_in_memory_picks(struct replay_opts *opts)
+{
+	struct object_id head;
+
+	if (!opts->worktree_behind)
+		return 0;
+	opts->worktree_behind = 0;
+
+	if (get_oid("HEAD", &head))
+		return error(_("cannot read HEAD"));
+	read_cache();
+	if (checkout_fast_forward(&opts->worktree_commit, &head, 1)) {
+		advise(_("After moving the files in the way, run 'git rebase "
+			 "--continue'."));
+		return -1; /* the callee should have complained already */
+	}
+	unlink(rebase_path_worktree_commit());
+	return 0;
+}
+
+/*
+ * merge_incore_nonrecursive() does not detect directory renames, which
+ * merge_trees() applies to paths that one side adds to a directory that
+ * the other side moved away. Tell whether "next" adds a path to a
+ * directory that is gone from "head", or takes away a directory that
+ * "head" changed, compared to "base"; such picks are left to the usual
+ * way.
+ */
+static int may_need_directory_renames(struct tree *base, struct tree *head,
+				      struct tree *next)
+{
+	struct diff_options opt;
+	struct strbuf dir = STRBUF_INIT;
+	int i, ret = 0;
+
+	diff_setup(&opt);
+	opt.flags.recursive = 1;
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+	diff_tree_oid(&base->object.oid, &next->object.oid, "", &opt);
+	for (i = 0; !ret && i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+		const char *path = p->two->path, *slash;
+		struct object_id in_base, in_head, in_next;
+		unsigned mode;
+
+		if (DIFF_FILE_VALID(p->one) && DIFF_FILE_VALID(p->two))
+			continue;
+		if (!DIFF_FILE_VALID(p->two))
+			path = p->one->path;
+		slash = strrchr(path, '/');
+		if (!slash)
+			continue;
+		strbuf_reset(&dir);
+		strbuf_add(&dir, path, slash - path);
+		if (get_tree_entry(&base->object.oid, dir.buf, &in_base, &mode))
+			continue;
+		if (!DIFF_FILE_VALID(p->one))
+			ret = !!get_tree_entry(&head->object.oid, dir.buf,
+					       &in_head, &mode);
+		else
+			ret = get_tree_entry(&next->object.oid, dir.buf,
+					     &in_next, &mode) &&
+			      !get_tree_entry(&head->object.oid, dir.buf,
+					      &in_head, &mode) &&
+			      oidcmp(&in_base, &in_head);
+	}
+	diff_flush(&opt);
+	strbuf_release(&dir);
+	return ret;
+}
+
+/*
+ * Merge the trees with merge_incore_nonrecursive(), which finds renames
+ * as merge_trees() does but writes nothing but objects, and store the
+ * merged tree in "result". Fail when the merge has conflicts, so that
+ * the caller lets merge-recursive do it instead.
+ */
+static int merge_trees_in_memory(struct tree *base, struct tree *head,
+				 struct tree *next, const char *base_label,
+				 const char *next_label, struct object_id *result)
+{
+	struct merge_options o;
+	struct merge_result merged;
+	int ret = -1;
+
+	if (may_need_directory_renames(base, head, next))
+		return -1;
+
+	init_merge_options(&o);
+	o.ancestor = base_label;
+	o.branch1 = "HEAD";
+	o.branch2 = next_label;
+	if (merge_incore_nonrecursive(&o, base, head, next, &merged))
+		return -1;
+	if (merged.clean) {
+		oidcpy(result, &merged.tree->object.oid);
+		ret = 0;
+	}
+	merge_result_release(&merged);
+	return ret;
+}
+
+/*
+ * Would checking out "to" over "from" overwrite anything in the worktree?
+ * Picks that add such paths are left to the usual way, which stops and
+ * reschedules them.
+ */
+static int worktree_in_the_way(const struct object_id *from,
+			       const struct object_id *to)
+{
+	struct diff_options opt;
+	int i, ret = 0;
+
+	diff_setup(&opt);
+	opt.flags.recursive = 1;
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+	diff_tree_oid(from, to, "", &opt);
+	for (i = 0; !ret && i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+		struct stat st;
+
+		if (!DIFF_FILE_VALID(p->one) &&
+		    (!lstat(p->two->path, &st) || errno != ENOENT))
+			ret = 1;
+	}
+	diff_flush(&opt);
+	return ret;
+}
+
+/*
+ * Pick "commit" without touching the index and worktree. Return 0 when
+ * done, 1 when it has to be picked the usual way, and -1 on error.
+ */
+static int pick_in_memory(enum todo_command command, struct commit *commit,
+			  struct replay_opts *opts)
+{
+	struct object_id head, tree, oid;
+	struct commit *head_commit, *parent;
+	struct commit_message msg = { NULL, NULL, NULL, NULL };
+	struct strbuf msgbuf = STRBUF_INIT;
+	char *author = NULL;
+	const char *p;
+	int res = 1;
+
+	if (!opts->in_memory || !is_rebase_i(opts) || command != TODO_PICK ||
+	    opts->no_commit || opts->xopts_nr ||
+	    (opts->strategy && strcmp(opts->strategy, "recursive")) ||
+	    !commit->parents || commit->parents->next ||
+	    hook_exists("prepare-commit-msg"))
+		return 1;
+	if (get_oid("HEAD", &head) ||
+	    (opts->have_squash_onto && !oidcmp(&head, &opts->squash_onto)))
+		return 1;
+	/* let the usual pick complain about a dirty index */
+	if (!opts->worktree_behind && index_differs_from("HEAD", NULL, 0))
+		return 1;
+
+	head_commit = lookup_commit_reference(&head);
+	parent = commit->parents->item;
+	if (!head_commit || parse_commit(head_commit) || parse_commit(parent))
+		return 1;
+
+	if (opts->allow_ff && !oidcmp(&parent->object.oid, &head)) {
+		if (worktree_in_the_way(get_commit_tree_oid(head_commit),
+					get_commit_tree_oid(commit)))
+			goto leave;
+		if (!opts->worktree_behind)
+			write_file(rebase_path_worktree_commit(), "%s",
+				   oid_to_hex(&head));
+		strbuf_addf(&msgbuf, _("%s: fast-forward"),
+			    _(action_name(opts)));
+		res = update_ref(msgbuf.buf, "HEAD", &commit->object.oid,
+				 &head, 0, UPDATE_REFS_MSG_ON_ERR) ? -1 : 0;
+		goto leave;
+	}
+
+	if (get_message(commit, &msg) ||
+	    !(author = get_author(msg.message)))
+		goto leave;
+	if (merge_trees_in_memory(get_commit_tree(parent),
+				  get_commit_tree(head_commit),
+				  get_commit_tree(commit),
+				  msg.parent_label, msg.label, &tree) ||
+	    !oidcmp(&tree, get_commit_tree_oid(head_commit)) ||
+	    worktree_in_the_way(get_commit_tree_oid(head_commit), &tree))
+		goto leave;
+
+	if (find_commit_subject(msg.message, &p))
+		strbuf_addstr(&msgbuf, p);
+	if (opts->signoff)
+		append_signoff(&msgbuf, 0, 0);
+	if (!opts->worktree_behind)
+		write_file(rebase_path_worktree_commit(), "%s",
+			   oid_to_hex(&head));
+	res = try_to_commit(&msgbuf, author, opts, 0, &tree, &oid);
+	if (!res) {
+		unlink(git_path_cherry_pick_head(the_repository));
+		unlink(git_path_merge_msg(the_repository));
+	}
+
+leave:
+	if (!opts->worktree_behind) {
+		struct object_id new_head;
+
+		/* HEAD may have moved even if committing failed later on */
+		if (!get_oid("HEAD", &new_head) && oidcmp(&new_head, &head)) {
+			oidcpy(&opts->worktree_commit, &head);
+			opts->worktree_behind = 1;
+		} else {
+			unlink(rebase_path_worktree_commit());
+		}
+	}
+	if (msg.message)
+		free_message(commit, &msg);
+	free(author);
+	strbuf_release(&msgbuf);
+	return res;
+}
+
 static int do_pick_commit(enum todo_command command, struct commit *commit,
 		struct replay_opts *opts, int final_fixup)
 {
@@ -1623,6 +1880,14 @@ static int do_pick_commit(enum todo_command command, struct commit *commit,
 	struct strbuf msgbuf = STRBUF_INIT;
 	int res, unborn = 0, allow;
 
+	res = pick_in_memory(command, commit, opts);
+	if (res <= 0) {
+		update_abort_safety_file();
+		return res;
+	}
+	if (sync_in_memory_picks(opts))
+		return -1;
+
 	if (opts->no_commit) {
 		/*
 		 * We do not intend to commit immediately.  We just want to
@@ -1871,7 +2136,7 @@ static int read_and_refresh_cache(struct replay_opts *opts)
 {
 	struct lock_file index_lock = LOCK_INIT;
 	int index_fd = hold_locked_index(&index_lock, 0);
-	if (read_index_preload(&the_index, NULL) < 0) {
+	if (read_index_preload(&the_index, NULL, PRELOAD_REFRESH) < 0) {
 		rollback_lock_file(&index_lock);
 		return error(_("git %s: failed to read the index"),
 			_(action_name(opts)));
@@ -2275,6 +2540,13 @@ static int read_populate_opts(struct replay_opts *opts)
 			if (get_oid_hex(buf.buf, &opts->squash_onto) < 0)
 				return error(_("unusable squash-onto"));
 			opts->have_squash_onto = 1;
+			strbuf_reset(&buf);
+		}
+
+		if (read_oneliner(&buf, rebase_path_worktree_commit(), 0)) {
+			if (get_oid_hex(buf.buf, &opts->worktree_commit) < 0)
+				return error(_("unusable worktree-commit"));
+			opts->worktree_behind = 1;
 		}
 
 		return 0;
@@ -3168,6 +3440,10 @@ static int pick_commits(struct todo_list *todo_list, struct replay_opts *opts)
 		struct todo_item *item = todo_list->items + todo_list->current;
 		if (save_todo(todo_list, opts))
 			return -1;
+		/* picks see to the worktree themselves; labels do not need it */
+		if (item->command > TODO_SQUASH && item->command != TODO_LABEL &&
+		    !is_noop(item->command) && sync_in_memory_picks(opts))
+			return -1;
 		if (is_rebase_i(opts)) {
 			if (item->command != TODO_COMMENT) {
 				FILE *f = fopen(rebase_path_msgnum(), "w");
@@ -3312,6 +3588,9 @@ static int pick_commits(struct todo_list *todo_list, struct replay_opts *opts)
 			return res;
 	}
 
+	if (sync_in_memory_picks(opts))
+		return -1;
+
 	if (is_rebase_i(opts)) {
 		struct strbuf head_ref = STRBUF_INIT, buf = STRBUF_INIT;
 		struct stat st;
@@ -3572,7 +3851,9 @@ int sequencer_continue(struct replay_opts *opts)
 	if (is_rebase_i(opts)) {
 		if ((res = read_populate_todo(&todo_list, opts)))
 			goto release_todo_list;
-		if (commit_staged_changes(opts, &todo_list))
+		/* bring the index up to HEAD before looking at it */
+		if (sync_in_memory_picks(opts) ||
+		    commit_staged_changes(opts, &todo_list))
 			return -1;
 	} else if (!file_exists(get_todo_path(opts)))
 		return continue_single_pick();
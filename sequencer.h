@@ -33,6 +33,7 @@ struct replay_opts {
 	int allow_empty_message;
 	int keep_redundant_commits;
 	int verbose;
+	int in_memory;
 
 	int mainline;
 
@@ -52,6 +53,10 @@ struct replay_opts {
 	struct object_id squash_onto;
 	int have_squash_onto;
 
+	/* Where in-memory picks left the index and worktree behind HEAD */
+	struct object_id worktree_commit;
+	int worktree_behind;
+
 	/* Only used by REPLAY_NONE */
 	struct rev_info *revs;
 };
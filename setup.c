@@ -2,6 +2,7 @@
 #include "repository.h"
 #include "config.h"
 #include "dir.h"
+#include "refs.h"
 #include "string-list.h"
 #include "chdir-notify.h"
 
@@ -423,6 +424,10 @@ static int check_repo_format(const char *var, const char *value, void *vdata)
 			if (!value)
 				return config_error_nonbool(var);
 			data->partial_clone = xstrdup(value);
+		} else if (!strcmp(ext, "refstorage")) {
+			if (!value)
+				return config_error_nonbool(var);
+			data->ref_storage = xstrdup(value);
 		} else
 			string_list_append(&data->unknown_extensions, ext);
 	} else if (strcmp(var, "core.bare") == 0) {
@@ -466,6 +471,7 @@ static int check_repository_format_gently(const char *gitdir, struct repository_
 
 	repository_format_precious_objects = candidate->precious_objects;
 	repository_format_partial_clone = candidate->partial_clone;
+	repository_format_ref_storage = candidate->ref_storage;
 	string_list_clear(&candidate->unknown_extensions, 0);
 	if (!has_common) {
 		if (candidate->is_bare != -1) {
@@ -516,6 +522,12 @@ int verify_repository_format(const struct repository_format *format,
 		return -1;
 	}
 
+	if (format->ref_storage && !ref_storage_backend_exists(format->ref_storage)) {
+		strbuf_addf(err, _("unknown ref storage format '%s'"),
+			    format->ref_storage);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -940,16 +952,22 @@ static enum discovery_result setup_git_directory_gently_1(struct strbuf *dir,
 		if (offset > min_offset)
 			strbuf_addch(dir, '/');
 		strbuf_addstr(dir, DEFAULT_GIT_DIR_ENVIRONMENT);
-		gitdirenv = read_gitfile_gently(dir->buf, die_on_error ?
-						NULL : &error_code);
+		gitdirenv = read_gitfile_gently(dir->buf, &error_code);
 		if (!gitdirenv) {
-			if (die_on_error ||
-			    error_code == READ_GITFILE_ERR_NOT_A_FILE) {
+			/*
+			 * There is nothing to look into when there is no
+			 * .git at all, which is the case at every level
+			 * below the top of the working tree.
+			 */
+			if (error_code == READ_GITFILE_ERR_NOT_A_FILE) {
 				/* NEEDSWORK: fail if .git is not file nor dir */
 				if (is_git_directory(dir->buf))
 					gitdirenv = DEFAULT_GIT_DIR_ENVIRONMENT;
-			} else if (error_code != READ_GITFILE_ERR_STAT_FAILED)
+			} else if (error_code != READ_GITFILE_ERR_STAT_FAILED) {
+				if (die_on_error)
+					read_gitfile(dir->buf); /* dies */
 				return GIT_DIR_INVALID_GITFILE;
+			}
 		}
 		strbuf_setlen(dir, offset);
 		if (gitdirenv) {
@@ -1033,6 +1051,12 @@ const char *setup_git_directory_gently(int *nongit_ok)
 	const char *prefix;
 	struct repository_format repo_fmt;
 
+	if (startup_info->served) {
+		if (nongit_ok)
+			*nongit_ok = 0;
+		return startup_info->prefix;
+	}
+
 	/*
 	 * We may have read an incomplete configuration before
 	 * setting-up the git directory. If so, clear the cache so
@@ -32,6 +32,8 @@
 #include "packfile.h"
 #include "fetch-object.h"
 #include "object-store.h"
+#include "thread-utils.h"
+#include "trace2.h"
 
 /* The maximum size for an object header. */
 #define MAX_HEADER_LEN 32
@@ -45,6 +47,18 @@
 	"\xe6\x9d\xe2\x9b\xb2\xd1\xd6\x43\x4b\x8b" \
 	"\x29\xae\x77\x5a\xd8\xc2\xe4\x8c\x53\x91"
 
+#define EMPTY_TREE_SHA256_BIN_LITERAL \
+	"\x6e\xf1\x9b\x41\x22\x5c\x53\x69\xf1\xc1" \
+	"\x04\xd4\x5d\x8d\x85\xef\xa9\xb0\x57\xb5" \
+	"\x3b\x14\xb4\xb9\xb9\x39\xdd\x74\xde\xcc" \
+	"\x53\x21"
+
+#define EMPTY_BLOB_SHA256_BIN_LITERAL \
+	"\x47\x3a\x0f\x4c\x3b\xe8\xa9\x36\x81\xa2" \
+	"\x67\xe3\xb1\xe9\xa7\xdc\xda\x11\x85\x43" \
+	"\x6f\xe1\x41\xf7\x74\x91\x20\xa3\x03\x72" \
+	"\x18\x13"
+
 const unsigned char null_sha1[GIT_MAX_RAWSZ];
 const struct object_id null_oid;
 static const struct object_id empty_tree_oid = {
@@ -53,6 +67,12 @@ static const struct object_id empty_tree_oid = {
 static const struct object_id empty_blob_oid = {
 	EMPTY_BLOB_SHA1_BIN_LITERAL
 };
+static const struct object_id empty_tree_oid_sha256 = {
+	EMPTY_TREE_SHA256_BIN_LITERAL
+};
+static const struct object_id empty_blob_oid_sha256 = {
+	EMPTY_BLOB_SHA256_BIN_LITERAL
+};
 
 static void git_hash_sha1_init(git_hash_ctx *ctx)
 {
@@ -69,6 +89,51 @@ static void git_hash_sha1_final(unsigned char *hash, git_hash_ctx *ctx)
 	git_SHA1_Final(hash, &ctx->sha1);
 }
 
+static void git_hash_many_one_by_one(const struct git_hash_algo *algo,
+				     struct git_hash_msg *msgs, size_t nr)
+{
+	git_hash_ctx ctx;
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		algo->init_fn(&ctx);
+		if (msgs[i].hdrlen)
+			algo->update_fn(&ctx, msgs[i].hdr, msgs[i].hdrlen);
+		if (msgs[i].len)
+			algo->update_fn(&ctx, msgs[i].buf, msgs[i].len);
+		algo->final_fn(msgs[i].hash, &ctx);
+	}
+}
+
+static void git_hash_sha1_many(struct git_hash_msg *msgs, size_t nr)
+{
+#ifdef platform_SHA1_Many
+	if (platform_SHA1_Many(msgs, nr))
+		return;
+#endif
+	git_hash_many_one_by_one(&hash_algos[GIT_HASH_SHA1], msgs, nr);
+}
+
+static void git_hash_sha256_init(git_hash_ctx *ctx)
+{
+	git_SHA256_Init(&ctx->sha256);
+}
+
+static void git_hash_sha256_update(git_hash_ctx *ctx, const void *data, size_t len)
+{
+	git_SHA256_Update(&ctx->sha256, data, len);
+}
+
+static void git_hash_sha256_final(unsigned char *hash, git_hash_ctx *ctx)
+{
+	git_SHA256_Final(hash, &ctx->sha256);
+}
+
+static void git_hash_sha256_many(struct git_hash_msg *msgs, size_t nr)
+{
+	git_hash_many_one_by_one(&hash_algos[GIT_HASH_SHA256], msgs, nr);
+}
+
 static void git_hash_unknown_init(git_hash_ctx *ctx)
 {
 	die("trying to init unknown hash");
@@ -84,6 +149,11 @@ static void git_hash_unknown_final(unsigned char *hash, git_hash_ctx *ctx)
 	die("trying to finalize unknown hash");
 }
 
+static void git_hash_unknown_many(struct git_hash_msg *msgs, size_t nr)
+{
+	die("trying to hash with unknown hash");
+}
+
 const struct git_hash_algo hash_algos[GIT_HASH_NALGOS] = {
 	{
 		NULL,
@@ -93,6 +163,7 @@ const struct git_hash_algo hash_algos[GIT_HASH_NALGOS] = {
 		git_hash_unknown_init,
 		git_hash_unknown_update,
 		git_hash_unknown_final,
+		git_hash_unknown_many,
 		NULL,
 		NULL,
 	},
@@ -105,9 +176,23 @@ const struct git_hash_algo hash_algos[GIT_HASH_NALGOS] = {
 		git_hash_sha1_init,
 		git_hash_sha1_update,
 		git_hash_sha1_final,
+		git_hash_sha1_many,
 		&empty_tree_oid,
 		&empty_blob_oid,
 	},
+	{
+		"sha256",
+		/* "s256", big-endian */
+		0x73323536,
+		GIT_SHA256_RAWSZ,
+		GIT_SHA256_HEXSZ,
+		git_hash_sha256_init,
+		git_hash_sha256_update,
+		git_hash_sha256_final,
+		git_hash_sha256_many,
+		&empty_tree_oid_sha256,
+		&empty_blob_oid_sha256,
+	},
 };
 
 const char *empty_tree_oid_hex(void)
@@ -769,6 +854,216 @@ static int has_loose_object(const struct object_id *oid)
 	return check_and_freshen(oid, 0);
 }
 
+struct alternate_object_database *prepare_objectdir_odb(struct repository *r)
+{
+	prepare_alt_odb(r);
+	if (!r->objects->objectdir_odb)
+		r->objects->objectdir_odb = alloc_alt_odb(r->objects->objectdir);
+	r->objects->objectdir_odb->next = r->objects->alt_odb_list;
+	return r->objects->objectdir_odb;
+}
+
+static int append_loose_object(const struct object_id *oid, const char *path,
+			       void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+struct oid_array *odb_loose_cache(struct alternate_object_database *alt,
+				  const struct object_id *oid)
+{
+	int subdir_nr = oid->hash[0];
+
+	if (!alt->loose_objects_subdir_seen[subdir_nr]) {
+		struct strbuf *buf = alt_scratch_buf(alt);
+		for_each_file_in_obj_subdir(subdir_nr, buf,
+					    append_loose_object,
+					    NULL, NULL,
+					    &alt->loose_objects_cache[subdir_nr]);
+		alt->loose_objects_subdir_seen[subdir_nr] = 1;
+	}
+	return &alt->loose_objects_cache[subdir_nr];
+}
+
+void odb_clear_loose_cache(struct alternate_object_database *alt)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(alt->loose_objects_cache); i++)
+		oid_array_clear(&alt->loose_objects_cache[i]);
+	memset(alt->loose_objects_subdir_seen, 0,
+	       sizeof(alt->loose_objects_subdir_seen));
+}
+
+/*
+ * With alternates, a quick lookup of a missing object searches every
+ * pack and the loose object cache of every object directory, which
+ * costs more the larger the network of repositories sharing objects.
+ * A Bloom filter of the names of all the objects, packed and loose,
+ * lets such a lookup fail at once instead. The filter is built once
+ * the lookups of missing objects have searched as many packs and
+ * object directories as there are objects to hash in, and only with
+ * core.looseObjectCache, whose listings of loose objects it relies on.
+ */
+#define OBJECT_FILTER_BITS_PER_OBJECT 10
+#define OBJECT_FILTER_NUM_HASHES 7
+
+struct object_filter {
+	unsigned char *bits;
+	uint64_t nr_bits;
+};
+
+/* Object names are uniformly distributed already; hash them no further */
+static uint64_t object_filter_bit(const struct object_filter *f,
+				  const struct object_id *oid, int i)
+{
+	uint32_t h1 = get_be32(oid->hash);
+	uint32_t h2 = get_be32(oid->hash + 4) | 1;
+
+	return ((uint64_t)h1 + (uint64_t)i * h2) % f->nr_bits;
+}
+
+static void object_filter_add(struct object_filter *f,
+			      const struct object_id *oid)
+{
+	int i;
+
+	for (i = 0; i < OBJECT_FILTER_NUM_HASHES; i++) {
+		uint64_t bit = object_filter_bit(f, oid, i);
+		f->bits[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+static int object_filter_contains(const struct object_filter *f,
+				  const struct object_id *oid)
+{
+	int i;
+
+	for (i = 0; i < OBJECT_FILTER_NUM_HASHES; i++) {
+		uint64_t bit = object_filter_bit(f, oid, i);
+		if (!(f->bits[bit / 8] & (1 << (bit % 8))))
+			return 0;
+	}
+	return 1;
+}
+
+static int add_packed_to_filter(const struct object_id *oid,
+				struct packed_git *p, uint32_t pos,
+				void *data)
+{
+	object_filter_add(data, oid);
+	return 0;
+}
+
+static void build_object_filter(struct repository *r, uint64_t nr_objects)
+{
+	struct object_filter *f = xcalloc(1, sizeof(*f));
+	struct alternate_object_database *alt;
+	struct packed_git *p;
+	struct object_id oid;
+	int i;
+
+	trace2_region_enter("object", "build_object_filter");
+	oidclr(&oid);
+	for (alt = prepare_objectdir_odb(r); alt; alt = alt->next)
+		for (i = 0; i < 256; i++) {
+			oid.hash[0] = i;
+			nr_objects += odb_loose_cache(alt, &oid)->nr;
+		}
+	f->nr_bits = st_mult(nr_objects + 1, OBJECT_FILTER_BITS_PER_OBJECT);
+	f->bits = xcalloc(1, (f->nr_bits + 7) / 8);
+
+	for (p = r->objects->packed_git; p; p = p->next)
+		if (!open_pack_index(p))
+			for_each_object_in_pack(p, add_packed_to_filter, f);
+	for (alt = prepare_objectdir_odb(r); alt; alt = alt->next)
+		for (i = 0; i < 256; i++) {
+			struct oid_array *loose;
+			size_t j;
+
+			oid.hash[0] = i;
+			loose = odb_loose_cache(alt, &oid);
+			for (j = 0; j < loose->nr; j++)
+				object_filter_add(f, &loose->oid[j]);
+		}
+	r->objects->object_filter = f;
+	trace2_region_leave("object", "build_object_filter");
+}
+
+void clear_object_filter(struct raw_object_store *o)
+{
+	o->object_filter_cost = 0;
+	if (!o->object_filter)
+		return;
+	free(o->object_filter->bits);
+	FREE_AND_NULL(o->object_filter);
+}
+
+/* Return 0 if "oid" is certainly missing, 1 if it may exist */
+static int may_have_object(struct repository *r, const struct object_id *oid)
+{
+	struct object_filter *f = r->objects->object_filter;
+
+	return !f || object_filter_contains(f, oid);
+}
+
+/* Account for a quick lookup that did not find its object */
+static void missed_object(struct repository *r)
+{
+	struct raw_object_store *o = r->objects;
+	struct alternate_object_database *alt;
+	struct packed_git *p;
+	uint64_t nr_objects = 0;
+
+	if (o->object_filter || !core_loose_object_cache ||
+	    !o->alt_odb_list || repository_format_partial_clone ||
+	    r != the_repository)
+		return;
+	for (p = o->packed_git; p; p = p->next) {
+		if (open_pack_index(p))
+			continue;
+		nr_objects += p->num_objects;
+		o->object_filter_cost++;
+	}
+	for (alt = prepare_objectdir_odb(r); alt; alt = alt->next)
+		o->object_filter_cost++;
+	if (o->object_filter_cost >= nr_objects)
+		build_object_filter(r, nr_objects);
+}
+
+/*
+ * Keep the loose object cache of the local object directory, and the
+ * filter of all objects, up to date.
+ */
+static void odb_loose_cache_add(const struct object_id *oid)
+{
+	struct alternate_object_database *odb = the_repository->objects->objectdir_odb;
+	struct object_filter *f = the_repository->objects->object_filter;
+	int subdir_nr = oid->hash[0];
+
+	if (odb && odb->loose_objects_subdir_seen[subdir_nr])
+		oid_array_append(&odb->loose_objects_cache[subdir_nr], oid);
+	if (f)
+		object_filter_add(f, oid);
+}
+
+/*
+ * Like has_loose_object(), but looks in the loose object caches, for
+ * the callers that can live with their inaccuracy.
+ */
+static int quick_has_loose(struct repository *r, const unsigned char *sha1)
+{
+	struct alternate_object_database *alt;
+	struct object_id oid;
+
+	hashcpy(oid.hash, sha1);
+	for (alt = prepare_objectdir_odb(r); alt; alt = alt->next)
+		if (oid_array_lookup(odb_loose_cache(alt, &oid), &oid) >= 0)
+			return 1;
+	return 0;
+}
+
 static void mmap_limit_check(size_t length)
 {
 	static size_t limit = 0;
@@ -1081,8 +1376,14 @@ static void *unpack_sha1_rest(git_zstream *stream, void *buffer, unsigned long s
 		 */
 		stream->next_out = buf + bytes;
 		stream->avail_out = size - bytes;
+		/*
+		 * The stream reads from a map of its own, so other threads
+		 * can read objects while we inflate.
+		 */
+		obj_read_unlock();
 		while (status == Z_OK)
 			status = git_inflate(stream, Z_FINISH);
+		obj_read_lock();
 	}
 	if (status == Z_STREAM_END && !stream->avail_in) {
 		git_inflate_end(stream);
@@ -1187,6 +1488,19 @@ static int sha1_loose_object_info(struct repository *r,
 	if (oi->delta_base_sha1)
 		hashclr(oi->delta_base_sha1);
 
+	/*
+	 * A quick lookup may use the loose object cache to tell that the
+	 * object does not exist, or that it does if nothing else is
+	 * asked for, without a stat() in every object directory.
+	 */
+	if (core_loose_object_cache && (flags & OBJECT_INFO_QUICK)) {
+		if (!quick_has_loose(r, sha1))
+			return -1;
+		if (!oi->typep && !oi->type_name && !oi->sizep &&
+		    !oi->contentp && !oi->disk_sizep)
+			return 0;
+	}
+
 	/*
 	 * If we don't care about type or size, then we don't
 	 * need to look inside the object at all. Note that we
@@ -1252,8 +1566,58 @@ static int sha1_loose_object_info(struct repository *r,
 
 int fetch_if_missing = 1;
 
-int oid_object_info_extended(struct repository *r, const struct object_id *oid,
-			     struct object_info *oi, unsigned flags)
+#ifndef NO_PTHREADS
+static int obj_read_use_lock;
+static pthread_mutex_t obj_read_mutex;
+
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		return;
+	obj_read_use_lock = 1;
+	init_recursive_mutex(&obj_read_mutex);
+}
+
+void disable_obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		return;
+	obj_read_use_lock = 0;
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#else
+void enable_obj_read_lock(void)
+{
+}
+
+void disable_obj_read_lock(void)
+{
+}
+
+void obj_read_lock(void)
+{
+}
+
+void obj_read_unlock(void)
+{
+}
+#endif
+
+static int do_oid_object_info_extended(struct repository *r,
+				       const struct object_id *oid,
+				       struct object_info *oi, unsigned flags)
 {
 	static struct object_info blank_oi = OBJECT_INFO_INIT;
 	struct pack_entry e;
@@ -1290,6 +1654,9 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 		}
 	}
 
+	if ((flags & OBJECT_INFO_QUICK) && !may_have_object(r, real))
+		return -1;
+
 	while (1) {
 		if (find_pack_entry(r, real, &e))
 			break;
@@ -1322,6 +1689,8 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 			continue;
 		}
 
+		if (flags & OBJECT_INFO_QUICK)
+			missed_object(r);
 		return -1;
 	}
 
@@ -1334,7 +1703,7 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 	rtype = packed_object_info(r, e.p, e.offset, oi);
 	if (rtype < 0) {
 		mark_bad_packed_object(e.p, real->hash);
-		return oid_object_info_extended(r, real, oi, 0);
+		return do_oid_object_info_extended(r, real, oi, 0);
 	} else if (oi->whence == OI_PACKED) {
 		oi->u.packed.offset = e.offset;
 		oi->u.packed.pack = e.p;
@@ -1345,6 +1714,17 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 	return 0;
 }
 
+int oid_object_info_extended(struct repository *r, const struct object_id *oid,
+			     struct object_info *oi, unsigned flags)
+{
+	int ret;
+
+	obj_read_lock();
+	ret = do_oid_object_info_extended(r, oid, oi, flags);
+	obj_read_unlock();
+	return ret;
+}
+
 /* returns enum object_type or negative */
 int oid_object_info(struct repository *r,
 		    const struct object_id *oid,
@@ -1410,14 +1790,20 @@ void *read_object_file_extended(const struct object_id *oid,
 	const struct packed_git *p;
 	const char *path;
 	struct stat st;
-	const struct object_id *repl = lookup_replace ?
+	const struct object_id *repl;
+
+	obj_read_lock();
+	repl = lookup_replace ?
 		lookup_replace_object(the_repository, oid) : oid;
+	obj_read_unlock();
 
 	errno = 0;
 	data = read_object(repl->hash, type, size);
 	if (data)
 		return data;
 
+	obj_read_lock();
+
 	if (errno && errno != ENOENT)
 		die_errno("failed to read object %s", oid_to_hex(oid));
 
@@ -1433,6 +1819,7 @@ void *read_object_file_extended(const struct object_id *oid,
 	if ((p = has_packed_and_bad(repl->hash)) != NULL)
 		die("packed object %s (stored in %s) is corrupt",
 		    oid_to_hex(repl), p->pack_name);
+	obj_read_unlock();
 
 	return NULL;
 }
@@ -1561,9 +1948,11 @@ int hash_object_file(const void *buf, unsigned long len, const char *type,
 }
 
 /* Finalize a file on disk, and close it. */
-static void close_sha1_file(int fd)
+static void close_sha1_file(int fd, int batch)
 {
-	if (fsync_object_files)
+	if (batch)
+		fsync_loose_object_bulk_checkin(fd);
+	else if (fsync_object_files)
 		fsync_or_die(fd, "sha1 file");
 	if (close(fd) != 0)
 		die_errno("error when closing sha1 file");
@@ -1614,6 +2003,35 @@ static int create_tmpfile(struct strbuf *tmp, const char *filename)
 	return fd;
 }
 
+/*
+ * Name the file of the loose object "oid" in "filename", in the
+ * directory of the bulk checkin if there is one, and open a temporary
+ * file next to it.
+ */
+static int open_loose_object_tmpfile(const struct object_id *oid,
+				     struct strbuf *tmp_file,
+				     struct strbuf *filename)
+{
+	int fd;
+	const char *batch_dir = bulk_checkin_objdir();
+
+	strbuf_reset(filename);
+	if (batch_dir) {
+		strbuf_addf(filename, "%s/", batch_dir);
+		fill_sha1_path(filename, oid->hash);
+	} else
+		sha1_file_name(the_repository, filename, oid->hash);
+
+	fd = create_tmpfile(tmp_file, filename->buf);
+	if (fd < 0) {
+		if (errno == EACCES)
+			return error("insufficient permission for adding an object to repository database %s", get_object_directory());
+		else
+			return error_errno("unable to create temporary file");
+	}
+	return fd;
+}
+
 static int write_loose_object(const struct object_id *oid, char *hdr,
 			      int hdrlen, const void *buf, unsigned long len,
 			      time_t mtime)
@@ -1626,16 +2044,9 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 	static struct strbuf tmp_file = STRBUF_INIT;
 	static struct strbuf filename = STRBUF_INIT;
 
-	strbuf_reset(&filename);
-	sha1_file_name(the_repository, &filename, oid->hash);
-
-	fd = create_tmpfile(&tmp_file, filename.buf);
-	if (fd < 0) {
-		if (errno == EACCES)
-			return error("insufficient permission for adding an object to repository database %s", get_object_directory());
-		else
-			return error_errno("unable to create temporary file");
-	}
+	fd = open_loose_object_tmpfile(oid, &tmp_file, &filename);
+	if (fd < 0)
+		return -1;
 
 	/* Set it up */
 	git_deflate_init(&stream, zlib_compression_level);
@@ -1675,7 +2086,7 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 		die("confused by unstable object source data for %s",
 		    oid_to_hex(oid));
 
-	close_sha1_file(fd);
+	close_sha1_file(fd, !!bulk_checkin_objdir());
 
 	if (mtime) {
 		struct utimbuf utb;
@@ -1685,7 +2096,10 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 			warning_errno("failed utime() on %s", tmp_file.buf);
 	}
 
-	return finalize_object_file(tmp_file.buf, filename.buf);
+	ret = finalize_object_file(tmp_file.buf, filename.buf);
+	if (!ret)
+		odb_loose_cache_add(oid);
+	return ret;
 }
 
 static int freshen_loose_object(const struct object_id *oid)
@@ -1698,6 +2112,12 @@ static int freshen_packed_object(const struct object_id *oid)
 	struct pack_entry e;
 	if (!find_pack_entry(the_repository, oid, &e))
 		return 0;
+	/*
+	 * Touching a cruft pack would not freshen the object, whose
+	 * mtime is in the .mtimes file; write it out again instead.
+	 */
+	if (e.p->pack_cruft)
+		return 0;
 	if (e.p->freshened)
 		return 1;
 	if (!freshen_file(e.p->pack_name))
@@ -1721,6 +2141,74 @@ int write_object_file(const void *buf, unsigned long len, const char *type,
 	return write_loose_object(oid, hdr, hdrlen, buf, len, 0);
 }
 
+void *deflate_loose_object(const void *buf, unsigned long len,
+			   const char *type, struct object_id *oid,
+			   unsigned long *deflated_size)
+{
+	char hdr[MAX_HEADER_LEN];
+	int hdrlen = sizeof(hdr);
+	git_zstream stream;
+	unsigned char *deflated;
+	unsigned long bound;
+	int ret;
+
+	write_object_file_prepare(buf, len, type, oid, hdr, &hdrlen);
+
+	git_deflate_init(&stream, zlib_compression_level);
+	bound = git_deflate_bound(&stream, hdrlen + len);
+	deflated = xmalloc(bound);
+	stream.next_out = deflated;
+	stream.avail_out = bound;
+
+	stream.next_in = (unsigned char *)hdr;
+	stream.avail_in = hdrlen;
+	while (git_deflate(&stream, 0) == Z_OK)
+		; /* nothing */
+
+	stream.next_in = (void *)buf;
+	stream.avail_in = len;
+	do {
+		ret = git_deflate(&stream, Z_FINISH);
+	} while (ret == Z_OK);
+	if (ret != Z_STREAM_END)
+		die("unable to deflate new object %s (%d)", oid_to_hex(oid),
+		    ret);
+	ret = git_deflate_end_gently(&stream);
+	if (ret != Z_OK)
+		die("deflateEnd on object %s failed (%d)", oid_to_hex(oid),
+		    ret);
+	*deflated_size = stream.total_out;
+	return deflated;
+}
+
+int write_deflated_loose_object(const struct object_id *oid,
+				const void *deflated, unsigned long size)
+{
+	int fd, ret;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
+
+	if (freshen_packed_object(oid) || freshen_loose_object(oid))
+		return 0;
+
+	fd = open_loose_object_tmpfile(oid, &tmp_file, &filename);
+	if (fd < 0) {
+		ret = -1;
+		goto out;
+	}
+	if (write_buffer(fd, deflated, size) < 0)
+		die("unable to write sha1 file");
+	close_sha1_file(fd, !!bulk_checkin_objdir());
+
+	ret = finalize_object_file(tmp_file.buf, filename.buf);
+	if (!ret)
+		odb_loose_cache_add(oid);
+out:
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	return ret;
+}
+
 int hash_object_file_literally(const void *buf, unsigned long len,
 			       const char *type, struct object_id *oid,
 			       unsigned flags)
@@ -1785,6 +2273,45 @@ int has_object_file_with_flags(const struct object_id *oid, int flags)
 	return has_sha1_file_with_flags(oid->hash, flags);
 }
 
+void has_object_files_quick(struct repository *r,
+			    const struct object_id *oids, size_t nr,
+			    unsigned char *found)
+{
+	unsigned char *done = xcalloc(nr, 1);
+	size_t i;
+
+	if (!startup_info->have_repository) {
+		memset(found, 0, nr);
+		free(done);
+		return;
+	}
+
+	obj_read_lock();
+	for (i = 0; i < nr; i++)
+		if (is_null_oid(&oids[i]) || !may_have_object(r, &oids[i]))
+			done[i] = 1;
+	memcpy(found, done, nr);
+	find_pack_entries(r, oids, nr, found);
+
+	for (i = 0; i < nr; i++) {
+		struct object_info oi = OBJECT_INFO_INIT;
+
+		if (done[i]) {
+			found[i] = 0;
+			continue;
+		}
+		if (found[i])
+			continue;
+		if (!sha1_loose_object_info(r, oids[i].hash, &oi,
+					    OBJECT_INFO_QUICK))
+			found[i] = 1;
+		else
+			missed_object(r);
+	}
+	obj_read_unlock();
+	free(done);
+}
+
 static void check_tree(const void *buf, size_t size)
 {
 	struct tree_desc desc;
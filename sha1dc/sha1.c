@@ -1701,12 +1701,52 @@ static void sha1_recompression_step(uint32_t step, uint32_t ihvin[5], uint32_t i
 
 
 
+#ifdef SHA1DC_CUSTOM_HW_COMPRESS
+/*
+ * When no disturbance vector passes the unavoidable bit conditions of
+ * the block, the full checks are skipped anyway, and only the
+ * compression itself is needed, which the hardware can do much faster.
+ * It also gives the expanded message to check the conditions on. If
+ * some disturbance vector passes them, or when not checking them, leave
+ * the block to sha1_process(), which also needs the states at every
+ * step.
+ */
+static int sha1_process_hw(SHA1_CTX* ctx, const uint32_t block[16])
+{
+	uint32_t ubc_dv_mask[DVMASKSIZE] = { 0 };
+	uint32_t ihv[5];
+
+	if (!SHA1DC_CUSTOM_HW_AVAILABLE())
+		return 0;
+	if (ctx->detect_coll && !ctx->ubc_check)
+		return 0;
+
+	memcpy(ihv, ctx->ihv, sizeof(ihv));
+	SHA1DC_CUSTOM_HW_COMPRESS(ihv, block, ctx->m1);
+
+	if (ctx->detect_coll)
+	{
+		ubc_check(ctx->m1, ubc_dv_mask);
+		if (ubc_dv_mask[0] != 0)
+			return 0;
+	}
+
+	memcpy(ctx->ihv, ihv, sizeof(ihv));
+	return 1;
+}
+#endif
+
 static void sha1_process(SHA1_CTX* ctx, const uint32_t block[16])
 {
 	unsigned i, j;
 	uint32_t ubc_dv_mask[DVMASKSIZE] = { 0xFFFFFFFF };
 	uint32_t ihvtmp[5];
 
+#ifdef SHA1DC_CUSTOM_HW_COMPRESS
+	if (sha1_process_hw(ctx, block))
+		return;
+#endif
+
 	ctx->ihv1[0] = ctx->ihv[0];
 	ctx->ihv1[1] = ctx->ihv[1];
 	ctx->ihv1[2] = ctx->ihv[2];
@@ -1753,6 +1793,17 @@ static void sha1_process(SHA1_CTX* ctx, const uint32_t block[16])
 	}
 }
 
+#ifdef SHA1DC_CUSTOM_PROCESS_BLOCK
+/*
+ * Process one block of a message whose padding and length the caller
+ * takes care of, with the full collision detection.
+ */
+void SHA1DC_CUSTOM_PROCESS_BLOCK(SHA1_CTX* ctx, const uint32_t block[16])
+{
+	sha1_process(ctx, block);
+}
+#endif
+
 void SHA1DCInit(SHA1_CTX* ctx)
 {
 	ctx->total = 0;
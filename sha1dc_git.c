@@ -1,4 +1,10 @@
 #include "cache.h"
+#include "config.h"
+
+#ifdef DC_SHA1_HW
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
 #ifdef DC_SHA1_EXTERNAL
 /*
@@ -36,3 +42,505 @@ void git_SHA1DCUpdate(SHA1_CTX *ctx, const void *vdata, unsigned long len)
 	}
 	SHA1DCUpdate(ctx, data, len);
 }
+
+#ifdef DC_SHA1_HW
+
+int git_SHA1DC_hw_available(void)
+{
+	static int available = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (available >= 0)
+		return available;
+	available = 0;
+	if (!git_env_bool("GIT_TEST_SHA1DC_HW", 1))
+		return available;
+	/* SSSE3 and SSE4.1, then the SHA extensions */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+	    !(ecx & (1 << 9)) || !(ecx & (1 << 19)))
+		return available;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return available;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	available = !!(ebx & (1 << 29));
+	return available;
+}
+
+/*
+ * Four rounds. "m" holds the message words of these rounds, which are
+ * saved to "W"; while they run, the words of the next ones are computed
+ * into "m1", "m2" and "m3" (the next three groups of words) with
+ * sha1msg1, a xor and sha1msg2. "e" gets the rotated "a" of the
+ * previous rounds added to the words, and "e_next" keeps "a" for the
+ * next rounds.
+ */
+#define SHA1_ROUNDS4(i, e, e_next, m, m1, m2, m3) \
+	do { \
+		_mm_storeu_si128((__m128i *)(W + 4 * (i)), \
+				 _mm_shuffle_epi32(m, 0x1b)); \
+		if (i) \
+			e = _mm_sha1nexte_epu32(e, m); \
+		else \
+			e = _mm_add_epi32(e, m); \
+		e_next = abcd; \
+		if ((i) >= 3 && (i) <= 18) \
+			m1 = _mm_sha1msg2_epu32(m1, m); \
+		abcd = _mm_sha1rnds4_epu32(abcd, e, (i) / 5); \
+		if ((i) >= 1 && (i) <= 16) \
+			m3 = _mm_sha1msg1_epu32(m3, m); \
+		if ((i) >= 2 && (i) <= 17) \
+			m2 = _mm_xor_si128(m2, m); \
+	} while (0)
+
+__attribute__((target("sha,sse4.1")))
+void git_SHA1DC_hw_compress(uint32_t ihv[5], const uint32_t block[16],
+			    uint32_t W[80])
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	const __m128i *data = (const __m128i *)block;
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)ihv), 0x1b);
+	e0 = _mm_set_epi32(ihv[4], 0, 0, 0);
+	abcd_save = abcd;
+	e0_save = e0;
+
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128(data + 0), bswap);
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128(data + 1), bswap);
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128(data + 2), bswap);
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128(data + 3), bswap);
+
+	SHA1_ROUNDS4(0, e0, e1, m0, m1, m2, m3);
+	SHA1_ROUNDS4(1, e1, e0, m1, m2, m3, m0);
+	SHA1_ROUNDS4(2, e0, e1, m2, m3, m0, m1);
+	SHA1_ROUNDS4(3, e1, e0, m3, m0, m1, m2);
+	SHA1_ROUNDS4(4, e0, e1, m0, m1, m2, m3);
+	SHA1_ROUNDS4(5, e1, e0, m1, m2, m3, m0);
+	SHA1_ROUNDS4(6, e0, e1, m2, m3, m0, m1);
+	SHA1_ROUNDS4(7, e1, e0, m3, m0, m1, m2);
+	SHA1_ROUNDS4(8, e0, e1, m0, m1, m2, m3);
+	SHA1_ROUNDS4(9, e1, e0, m1, m2, m3, m0);
+	SHA1_ROUNDS4(10, e0, e1, m2, m3, m0, m1);
+	SHA1_ROUNDS4(11, e1, e0, m3, m0, m1, m2);
+	SHA1_ROUNDS4(12, e0, e1, m0, m1, m2, m3);
+	SHA1_ROUNDS4(13, e1, e0, m1, m2, m3, m0);
+	SHA1_ROUNDS4(14, e0, e1, m2, m3, m0, m1);
+	SHA1_ROUNDS4(15, e1, e0, m3, m0, m1, m2);
+	SHA1_ROUNDS4(16, e0, e1, m0, m1, m2, m3);
+	SHA1_ROUNDS4(17, e1, e0, m1, m2, m3, m0);
+	SHA1_ROUNDS4(18, e0, e1, m2, m3, m0, m1);
+	SHA1_ROUNDS4(19, e1, e0, m3, m0, m1, m2);
+
+	e0 = _mm_sha1nexte_epu32(e0, e0_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+	_mm_storeu_si128((__m128i *)ihv, _mm_shuffle_epi32(abcd, 0x1b));
+	ihv[4] = _mm_extract_epi32(e0, 3);
+}
+
+/*
+ * Eight messages at a time, one in each 32-bit lane of an AVX2 register.
+ */
+#define SHA1_LANES 8
+
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+
+#define ROL8(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/*
+ * The bits of the disturbance vectors in the mask of ubc_check(), and
+ * tests of the unavoidable bit conditions on the expanded message words
+ * of every lane at once, giving all ones in the lanes where they hold.
+ */
+#define DV_I_43_0_bit (1u << 0)
+#define DV_I_44_0_bit (1u << 1)
+#define DV_I_45_0_bit (1u << 2)
+#define DV_I_46_0_bit (1u << 3)
+#define DV_I_46_2_bit (1u << 4)
+#define DV_I_47_0_bit (1u << 5)
+#define DV_I_47_2_bit (1u << 6)
+#define DV_I_48_0_bit (1u << 7)
+#define DV_I_48_2_bit (1u << 8)
+#define DV_I_49_0_bit (1u << 9)
+#define DV_I_49_2_bit (1u << 10)
+#define DV_I_50_0_bit (1u << 11)
+#define DV_I_50_2_bit (1u << 12)
+#define DV_I_51_0_bit (1u << 13)
+#define DV_I_51_2_bit (1u << 14)
+#define DV_I_52_0_bit (1u << 15)
+#define DV_II_45_0_bit (1u << 16)
+#define DV_II_46_0_bit (1u << 17)
+#define DV_II_46_2_bit (1u << 18)
+#define DV_II_47_0_bit (1u << 19)
+#define DV_II_48_0_bit (1u << 20)
+#define DV_II_49_0_bit (1u << 21)
+#define DV_II_49_2_bit (1u << 22)
+#define DV_II_50_0_bit (1u << 23)
+#define DV_II_50_2_bit (1u << 24)
+#define DV_II_51_0_bit (1u << 25)
+#define DV_II_51_2_bit (1u << 26)
+#define DV_II_52_0_bit (1u << 27)
+#define DV_II_53_0_bit (1u << 28)
+#define DV_II_54_0_bit (1u << 29)
+#define DV_II_55_0_bit (1u << 30)
+#define DV_II_56_0_bit (1u << 31)
+
+#define Z(x) ((v8u32)((x) == 0))
+#define NZ(x) ((v8u32)((x) != 0))
+
+/*
+ * Compress one block of each lane, from the words at "block", into
+ * "ihv", and store to "dvmask" what ubc_check() would of each of them.
+ *
+ * The checks of the unavoidable bit conditions are those of
+ * sha1dc/ubc_check.c, without the branches that skip them for the
+ * disturbance vectors that are already ruled out: they only clear bits
+ * that are already clear then, and they are cheaper than branches on
+ * eight lanes.
+ */
+__attribute__((target("avx2")))
+static void sha1_compress_x8(uint32_t ihv[5][SHA1_LANES],
+			     const unsigned char *block[SHA1_LANES],
+			     uint32_t dvmask[SHA1_LANES])
+{
+	v8u32 W[80], a, b, c, d, e, t, mask;
+	int i, l;
+
+	for (i = 0; i < 16; i++)
+		for (l = 0; l < SHA1_LANES; l++)
+			W[i][l] = get_be32(block[l] + 4 * i);
+	for (i = 16; i < 80; i++)
+		W[i] = ROL8(W[i - 3] ^ W[i - 8] ^ W[i - 14] ^ W[i - 16], 1);
+
+	memcpy(&a, ihv[0], sizeof(a));
+	memcpy(&b, ihv[1], sizeof(b));
+	memcpy(&c, ihv[2], sizeof(c));
+	memcpy(&d, ihv[3], sizeof(d));
+	memcpy(&e, ihv[4], sizeof(e));
+
+#define SHA1_ROUND8(f, k) \
+	do { \
+		t = ROL8(a, 5) + (f) + e + (k) + W[i]; \
+		e = d; \
+		d = c; \
+		c = ROL8(b, 30); \
+		b = a; \
+		a = t; \
+	} while (0)
+
+	for (i = 0; i < 20; i++)
+		SHA1_ROUND8(d ^ (b & (c ^ d)), 0x5a827999);
+	for (; i < 40; i++)
+		SHA1_ROUND8(b ^ c ^ d, 0x6ed9eba1);
+	for (; i < 60; i++)
+		SHA1_ROUND8((b & c) | (d & (b | c)), 0x8f1bbcdc);
+	for (; i < 80; i++)
+		SHA1_ROUND8(b ^ c ^ d, 0xca62c1d6);
+
+#undef SHA1_ROUND8
+
+#define SHA1_ADD8(i, x) \
+	do { \
+		memcpy(&t, ihv[i], sizeof(t)); \
+		t += (x); \
+		memcpy(ihv[i], &t, sizeof(t)); \
+	} while (0)
+
+	SHA1_ADD8(0, a);
+	SHA1_ADD8(1, b);
+	SHA1_ADD8(2, c);
+	SHA1_ADD8(3, d);
+	SHA1_ADD8(4, e);
+
+#undef SHA1_ADD8
+
+	mask = ~(v8u32){ 0 };
+	mask &= (((((W[44]^W[45])>>29)&1)-1) | ~(DV_I_48_0_bit|DV_I_51_0_bit|DV_I_52_0_bit|DV_II_45_0_bit|DV_II_46_0_bit|DV_II_50_0_bit|DV_II_51_0_bit));
+	mask &= (((((W[49]^W[50])>>29)&1)-1) | ~(DV_I_46_0_bit|DV_II_45_0_bit|DV_II_50_0_bit|DV_II_51_0_bit|DV_II_55_0_bit|DV_II_56_0_bit));
+	mask &= (((((W[48]^W[49])>>29)&1)-1) | ~(DV_I_45_0_bit|DV_I_52_0_bit|DV_II_49_0_bit|DV_II_50_0_bit|DV_II_54_0_bit|DV_II_55_0_bit));
+	mask &= ((((W[47]^(W[50]>>25))&(1<<4))-(1<<4)) | ~(DV_I_47_0_bit|DV_I_49_0_bit|DV_I_51_0_bit|DV_II_45_0_bit|DV_II_51_0_bit|DV_II_56_0_bit));
+	mask &= (((((W[47]^W[48])>>29)&1)-1) | ~(DV_I_44_0_bit|DV_I_51_0_bit|DV_II_48_0_bit|DV_II_49_0_bit|DV_II_53_0_bit|DV_II_54_0_bit));
+	mask &= (((((W[46]>>4)^(W[49]>>29))&1)-1) | ~(DV_I_46_0_bit|DV_I_48_0_bit|DV_I_50_0_bit|DV_I_52_0_bit|DV_II_50_0_bit|DV_II_55_0_bit));
+	mask &= (((((W[46]^W[47])>>29)&1)-1) | ~(DV_I_43_0_bit|DV_I_50_0_bit|DV_II_47_0_bit|DV_II_48_0_bit|DV_II_52_0_bit|DV_II_53_0_bit));
+	mask &= (((((W[45]>>4)^(W[48]>>29))&1)-1) | ~(DV_I_45_0_bit|DV_I_47_0_bit|DV_I_49_0_bit|DV_I_51_0_bit|DV_II_49_0_bit|DV_II_54_0_bit));
+	mask &= (((((W[45]^W[46])>>29)&1)-1) | ~(DV_I_49_0_bit|DV_I_52_0_bit|DV_II_46_0_bit|DV_II_47_0_bit|DV_II_51_0_bit|DV_II_52_0_bit));
+	mask &= (((((W[44]>>4)^(W[47]>>29))&1)-1) | ~(DV_I_44_0_bit|DV_I_46_0_bit|DV_I_48_0_bit|DV_I_50_0_bit|DV_II_48_0_bit|DV_II_53_0_bit));
+	mask &= (((((W[43]>>4)^(W[46]>>29))&1)-1) | ~(DV_I_43_0_bit|DV_I_45_0_bit|DV_I_47_0_bit|DV_I_49_0_bit|DV_II_47_0_bit|DV_II_52_0_bit));
+	mask &= (((((W[43]^W[44])>>29)&1)-1) | ~(DV_I_47_0_bit|DV_I_50_0_bit|DV_I_51_0_bit|DV_II_45_0_bit|DV_II_49_0_bit|DV_II_50_0_bit));
+	mask &= (((((W[42]>>4)^(W[45]>>29))&1)-1) | ~(DV_I_44_0_bit|DV_I_46_0_bit|DV_I_48_0_bit|DV_I_52_0_bit|DV_II_46_0_bit|DV_II_51_0_bit));
+	mask &= (((((W[41]>>4)^(W[44]>>29))&1)-1) | ~(DV_I_43_0_bit|DV_I_45_0_bit|DV_I_47_0_bit|DV_I_51_0_bit|DV_II_45_0_bit|DV_II_50_0_bit));
+	mask &= (((((W[40]^W[41])>>29)&1)-1) | ~(DV_I_44_0_bit|DV_I_47_0_bit|DV_I_48_0_bit|DV_II_46_0_bit|DV_II_47_0_bit|DV_II_56_0_bit));
+	mask &= (((((W[54]^W[55])>>29)&1)-1) | ~(DV_I_51_0_bit|DV_II_47_0_bit|DV_II_50_0_bit|DV_II_55_0_bit|DV_II_56_0_bit));
+	mask &= (((((W[53]^W[54])>>29)&1)-1) | ~(DV_I_50_0_bit|DV_II_46_0_bit|DV_II_49_0_bit|DV_II_54_0_bit|DV_II_55_0_bit));
+	mask &= (((((W[52]^W[53])>>29)&1)-1) | ~(DV_I_49_0_bit|DV_II_45_0_bit|DV_II_48_0_bit|DV_II_53_0_bit|DV_II_54_0_bit));
+	mask &= ((((W[50]^(W[53]>>25))&(1<<4))-(1<<4)) | ~(DV_I_50_0_bit|DV_I_52_0_bit|DV_II_46_0_bit|DV_II_48_0_bit|DV_II_54_0_bit));
+	mask &= (((((W[50]^W[51])>>29)&1)-1) | ~(DV_I_47_0_bit|DV_II_46_0_bit|DV_II_51_0_bit|DV_II_52_0_bit|DV_II_56_0_bit));
+	mask &= ((((W[49]^(W[52]>>25))&(1<<4))-(1<<4)) | ~(DV_I_49_0_bit|DV_I_51_0_bit|DV_II_45_0_bit|DV_II_47_0_bit|DV_II_53_0_bit));
+	mask &= ((((W[48]^(W[51]>>25))&(1<<4))-(1<<4)) | ~(DV_I_48_0_bit|DV_I_50_0_bit|DV_I_52_0_bit|DV_II_46_0_bit|DV_II_52_0_bit));
+	mask &= (((((W[42]^W[43])>>29)&1)-1) | ~(DV_I_46_0_bit|DV_I_49_0_bit|DV_I_50_0_bit|DV_II_48_0_bit|DV_II_49_0_bit));
+	mask &= (((((W[41]^W[42])>>29)&1)-1) | ~(DV_I_45_0_bit|DV_I_48_0_bit|DV_I_49_0_bit|DV_II_47_0_bit|DV_II_48_0_bit));
+	mask &= (((((W[40]>>4)^(W[43]>>29))&1)-1) | ~(DV_I_44_0_bit|DV_I_46_0_bit|DV_I_50_0_bit|DV_II_49_0_bit|DV_II_56_0_bit));
+	mask &= (((((W[39]>>4)^(W[42]>>29))&1)-1) | ~(DV_I_43_0_bit|DV_I_45_0_bit|DV_I_49_0_bit|DV_II_48_0_bit|DV_II_55_0_bit));
+	mask &= (((((W[38]>>4)^(W[41]>>29))&1)-1) | ~(DV_I_44_0_bit|DV_I_48_0_bit|DV_II_47_0_bit|DV_II_54_0_bit|DV_II_56_0_bit));
+	mask &= (((((W[37]>>4)^(W[40]>>29))&1)-1) | ~(DV_I_43_0_bit|DV_I_47_0_bit|DV_II_46_0_bit|DV_II_53_0_bit|DV_II_55_0_bit));
+	mask &= (((((W[55]^W[56])>>29)&1)-1) | ~(DV_I_52_0_bit|DV_II_48_0_bit|DV_II_51_0_bit|DV_II_56_0_bit));
+	mask &= ((((W[52]^(W[55]>>25))&(1<<4))-(1<<4)) | ~(DV_I_52_0_bit|DV_II_48_0_bit|DV_II_50_0_bit|DV_II_56_0_bit));
+	mask &= ((((W[51]^(W[54]>>25))&(1<<4))-(1<<4)) | ~(DV_I_51_0_bit|DV_II_47_0_bit|DV_II_49_0_bit|DV_II_55_0_bit));
+	mask &= (((((W[51]^W[52])>>29)&1)-1) | ~(DV_I_48_0_bit|DV_II_47_0_bit|DV_II_52_0_bit|DV_II_53_0_bit));
+	mask &= (((((W[36]>>4)^(W[40]>>29))&1)-1) | ~(DV_I_46_0_bit|DV_I_49_0_bit|DV_II_45_0_bit|DV_II_48_0_bit));
+	mask &= ((0-(((W[53]^W[56])>>29)&1)) | ~(DV_I_52_0_bit|DV_II_48_0_bit|DV_II_49_0_bit));
+	mask &= ((0-(((W[51]^W[54])>>29)&1)) | ~(DV_I_50_0_bit|DV_II_46_0_bit|DV_II_47_0_bit));
+	mask &= ((0-(((W[50]^W[52])>>29)&1)) | ~(DV_I_49_0_bit|DV_I_51_0_bit|DV_II_45_0_bit));
+	mask &= ((0-(((W[49]^W[51])>>29)&1)) | ~(DV_I_48_0_bit|DV_I_50_0_bit|DV_I_52_0_bit));
+	mask &= ((0-(((W[48]^W[50])>>29)&1)) | ~(DV_I_47_0_bit|DV_I_49_0_bit|DV_I_51_0_bit));
+	mask &= ((0-(((W[47]^W[49])>>29)&1)) | ~(DV_I_46_0_bit|DV_I_48_0_bit|DV_I_50_0_bit));
+	mask &= ((0-(((W[46]^W[48])>>29)&1)) | ~(DV_I_45_0_bit|DV_I_47_0_bit|DV_I_49_0_bit));
+	mask &= ((((W[45]^W[47])&(1<<6))-(1<<6)) | ~(DV_I_47_2_bit|DV_I_49_2_bit|DV_I_51_2_bit));
+	mask &= ((0-(((W[45]^W[47])>>29)&1)) | ~(DV_I_44_0_bit|DV_I_46_0_bit|DV_I_48_0_bit));
+	mask &= (((((W[44]^W[46])>>6)&1)-1) | ~(DV_I_46_2_bit|DV_I_48_2_bit|DV_I_50_2_bit));
+	mask &= ((0-(((W[44]^W[46])>>29)&1)) | ~(DV_I_43_0_bit|DV_I_45_0_bit|DV_I_47_0_bit));
+	mask &= ((0-((W[41]^(W[42]>>5))&(1<<1))) | ~(DV_I_48_2_bit|DV_II_46_2_bit|DV_II_51_2_bit));
+	mask &= ((0-((W[40]^(W[41]>>5))&(1<<1))) | ~(DV_I_47_2_bit|DV_I_51_2_bit|DV_II_50_2_bit));
+	mask &= ((0-(((W[40]^W[42])>>4)&1)) | ~(DV_I_44_0_bit|DV_I_46_0_bit|DV_II_56_0_bit));
+	mask &= ((0-((W[39]^(W[40]>>5))&(1<<1))) | ~(DV_I_46_2_bit|DV_I_50_2_bit|DV_II_49_2_bit));
+	mask &= ((0-(((W[39]^W[41])>>4)&1)) | ~(DV_I_43_0_bit|DV_I_45_0_bit|DV_II_55_0_bit));
+	mask &= ((0-(((W[38]^W[40])>>4)&1)) | ~(DV_I_44_0_bit|DV_II_54_0_bit|DV_II_56_0_bit));
+	mask &= ((0-(((W[37]^W[39])>>4)&1)) | ~(DV_I_43_0_bit|DV_II_53_0_bit|DV_II_55_0_bit));
+	mask &= ((0-((W[36]^(W[37]>>5))&(1<<1))) | ~(DV_I_47_2_bit|DV_I_50_2_bit|DV_II_46_2_bit));
+	mask &= (((((W[35]>>4)^(W[39]>>29))&1)-1) | ~(DV_I_45_0_bit|DV_I_48_0_bit|DV_II_47_0_bit));
+	mask &= ((0-((W[63]^(W[64]>>5))&(1<<0))) | ~(DV_I_48_0_bit|DV_II_48_0_bit));
+	mask &= ((0-((W[63]^(W[64]>>5))&(1<<1))) | ~(DV_I_45_0_bit|DV_II_45_0_bit));
+	mask &= ((0-((W[62]^(W[63]>>5))&(1<<0))) | ~(DV_I_47_0_bit|DV_II_47_0_bit));
+	mask &= ((0-((W[61]^(W[62]>>5))&(1<<0))) | ~(DV_I_46_0_bit|DV_II_46_0_bit));
+	mask &= ((0-((W[61]^(W[62]>>5))&(1<<2))) | ~(DV_I_46_2_bit|DV_II_46_2_bit));
+	mask &= ((0-((W[60]^(W[61]>>5))&(1<<0))) | ~(DV_I_45_0_bit|DV_II_45_0_bit));
+	mask &= (((((W[58]^W[59])>>29)&1)-1) | ~(DV_II_51_0_bit|DV_II_54_0_bit));
+	mask &= (((((W[57]^W[58])>>29)&1)-1) | ~(DV_II_50_0_bit|DV_II_53_0_bit));
+	mask &= ((((W[56]^(W[59]>>25))&(1<<4))-(1<<4)) | ~(DV_II_52_0_bit|DV_II_54_0_bit));
+	mask &= ((0-(((W[56]^W[59])>>29)&1)) | ~(DV_II_51_0_bit|DV_II_52_0_bit));
+	mask &= (((((W[56]^W[57])>>29)&1)-1) | ~(DV_II_49_0_bit|DV_II_52_0_bit));
+	mask &= ((((W[55]^(W[58]>>25))&(1<<4))-(1<<4)) | ~(DV_II_51_0_bit|DV_II_53_0_bit));
+	mask &= ((((W[54]^(W[57]>>25))&(1<<4))-(1<<4)) | ~(DV_II_50_0_bit|DV_II_52_0_bit));
+	mask &= ((((W[53]^(W[56]>>25))&(1<<4))-(1<<4)) | ~(DV_II_49_0_bit|DV_II_51_0_bit));
+	mask &= ((((W[51]^(W[50]>>5))&(1<<1))-(1<<1)) | ~(DV_I_50_2_bit|DV_II_46_2_bit));
+	mask &= ((((W[48]^W[50])&(1<<6))-(1<<6)) | ~(DV_I_50_2_bit|DV_II_46_2_bit));
+	mask &= ((0-(((W[48]^W[55])>>29)&1)) | ~(DV_I_51_0_bit|DV_I_52_0_bit));
+	mask &= ((((W[47]^W[49])&(1<<6))-(1<<6)) | ~(DV_I_49_2_bit|DV_I_51_2_bit));
+	mask &= ((((W[48]^(W[47]>>5))&(1<<1))-(1<<1)) | ~(DV_I_47_2_bit|DV_II_51_2_bit));
+	mask &= ((((W[46]^W[48])&(1<<6))-(1<<6)) | ~(DV_I_48_2_bit|DV_I_50_2_bit));
+	mask &= ((((W[47]^(W[46]>>5))&(1<<1))-(1<<1)) | ~(DV_I_46_2_bit|DV_II_50_2_bit));
+	mask &= ((0-((W[44]^(W[45]>>5))&(1<<1))) | ~(DV_I_51_2_bit|DV_II_49_2_bit));
+	mask &= ((((W[43]^W[45])&(1<<6))-(1<<6)) | ~(DV_I_47_2_bit|DV_I_49_2_bit));
+	mask &= (((((W[42]^W[44])>>6)&1)-1) | ~(DV_I_46_2_bit|DV_I_48_2_bit));
+	mask &= ((((W[43]^(W[42]>>5))&(1<<1))-(1<<1)) | ~(DV_II_46_2_bit|DV_II_51_2_bit));
+	mask &= ((((W[42]^(W[41]>>5))&(1<<1))-(1<<1)) | ~(DV_I_51_2_bit|DV_II_50_2_bit));
+	mask &= ((((W[41]^(W[40]>>5))&(1<<1))-(1<<1)) | ~(DV_I_50_2_bit|DV_II_49_2_bit));
+	mask &= ((((W[39]^(W[43]>>25))&(1<<4))-(1<<4)) | ~(DV_I_52_0_bit|DV_II_51_0_bit));
+	mask &= ((((W[38]^(W[42]>>25))&(1<<4))-(1<<4)) | ~(DV_I_51_0_bit|DV_II_50_0_bit));
+	mask &= ((0-((W[37]^(W[38]>>5))&(1<<1))) | ~(DV_I_48_2_bit|DV_I_51_2_bit));
+	mask &= ((((W[37]^(W[41]>>25))&(1<<4))-(1<<4)) | ~(DV_I_50_0_bit|DV_II_49_0_bit));
+	mask &= ((0-((W[36]^W[38])&(1<<4))) | ~(DV_II_52_0_bit|DV_II_54_0_bit));
+	mask &= ((0-((W[35]^(W[36]>>5))&(1<<1))) | ~(DV_I_46_2_bit|DV_I_49_2_bit));
+	mask &= ((((W[35]^(W[39]>>25))&(1<<3))-(1<<3)) | ~(DV_I_51_0_bit|DV_II_47_0_bit));
+	mask &= ~(DV_I_43_0_bit & (Z((W[61]^(W[62]>>5)) & (1<<1))
+		 | NZ((W[59]^(W[63]>>25)) & (1<<5))
+		 | Z((W[58]^(W[63]>>30)) & (1<<0))));
+	mask &= ~(DV_I_44_0_bit & (Z((W[62]^(W[63]>>5)) & (1<<1))
+		 | NZ((W[60]^(W[64]>>25)) & (1<<5))
+		 | Z((W[59]^(W[64]>>30)) & (1<<0))));
+	mask &= ((~((W[40]^W[42])>>2)) | ~DV_I_46_2_bit);
+	mask &= ~(DV_I_47_2_bit & (Z((W[62]^(W[63]>>5)) & (1<<2))
+		 | NZ((W[41]^W[43]) & (1<<6))));
+	mask &= ~(DV_I_48_2_bit & (Z((W[63]^(W[64]>>5)) & (1<<2))
+		 | NZ((W[48]^(W[49]<<5)) & (1<<6))));
+	mask &= ~(DV_I_49_2_bit & (NZ((W[49]^(W[50]<<5)) & (1<<6))
+		 | Z((W[42]^W[50]) & (1<<1))
+		 | NZ((W[39]^(W[40]<<5)) & (1<<6))
+		 | Z((W[38]^W[40]) & (1<<1))));
+	mask &= ((((W[36]^W[37])<<7)) | ~DV_I_50_0_bit);
+	mask &= ((((W[43]^W[51])<<11)) | ~DV_I_50_2_bit);
+	mask &= ((((W[37]^W[38])<<9)) | ~DV_I_51_0_bit);
+	mask &= ~(DV_I_51_2_bit & (NZ((W[51]^(W[52]<<5)) & (1<<6))
+		 | NZ((W[49]^W[51]) & (1<<6))
+		 | NZ((W[37]^(W[37]>>5)) & (1<<1))
+		 | NZ((W[35]^(W[39]>>25)) & (1<<5))));
+	mask &= ((((W[38]^W[39])<<11)) | ~DV_I_52_0_bit);
+	mask &= ((((W[47]^W[51])<<17)) | ~DV_II_46_2_bit);
+	mask &= ~(DV_II_48_0_bit & (NZ((W[36]^(W[40]>>25)) & (1<<3))
+		 | Z((W[35]^(W[40]<<2)) & (1<<30))));
+	mask &= ~(DV_II_49_0_bit & (NZ((W[37]^(W[41]>>25)) & (1<<3))
+		 | Z((W[36]^(W[41]<<2)) & (1<<30))));
+	mask &= ~(DV_II_49_2_bit & (NZ((W[53]^(W[54]<<5)) & (1<<6))
+		 | NZ((W[51]^W[53]) & (1<<6))
+		 | Z((W[50]^W[54]) & (1<<1))
+		 | NZ((W[45]^(W[46]<<5)) & (1<<6))
+		 | NZ((W[37]^(W[41]>>25)) & (1<<5))
+		 | Z((W[36]^(W[41]>>30)) & (1<<0))));
+	mask &= ~(DV_II_50_0_bit & (Z((W[55]^W[58]) & (1<<29))
+		 | NZ((W[38]^(W[42]>>25)) & (1<<3))
+		 | Z((W[37]^(W[42]<<2)) & (1<<30))));
+	mask &= ~(DV_II_50_2_bit & (NZ((W[54]^(W[55]<<5)) & (1<<6))
+		 | NZ((W[52]^W[54]) & (1<<6))
+		 | Z((W[51]^W[55]) & (1<<1))
+		 | Z((W[45]^W[47]) & (1<<1))
+		 | NZ((W[38]^(W[42]>>25)) & (1<<5))
+		 | Z((W[37]^(W[42]>>30)) & (1<<0))));
+	mask &= ~(DV_II_51_0_bit & (NZ((W[39]^(W[43]>>25)) & (1<<3))
+		 | Z((W[38]^(W[43]<<2)) & (1<<30))));
+	mask &= ~(DV_II_51_2_bit & (NZ((W[55]^(W[56]<<5)) & (1<<6))
+		 | NZ((W[53]^W[55]) & (1<<6))
+		 | Z((W[52]^W[56]) & (1<<1))
+		 | Z((W[46]^W[48]) & (1<<1))
+		 | NZ((W[39]^(W[43]>>25)) & (1<<5))
+		 | Z((W[38]^(W[43]>>30)) & (1<<0))));
+	mask &= ~(DV_II_52_0_bit & (NZ((W[59]^W[60]) & (1<<29))
+		 | NZ((W[40]^(W[44]>>25)) & (1<<3))
+		 | NZ((W[40]^(W[44]>>25)) & (1<<4))
+		 | Z((W[39]^(W[44]<<2)) & (1<<30))));
+	mask &= ~(DV_II_53_0_bit & (Z((W[58]^W[61]) & (1<<29))
+		 | NZ((W[57]^(W[61]>>25)) & (1<<4))
+		 | NZ((W[41]^(W[45]>>25)) & (1<<3))
+		 | NZ((W[41]^(W[45]>>25)) & (1<<4))));
+	mask &= ~(DV_II_54_0_bit & (NZ((W[58]^(W[62]>>25)) & (1<<4))
+		 | NZ((W[42]^(W[46]>>25)) & (1<<3))
+		 | NZ((W[42]^(W[46]>>25)) & (1<<4))));
+	mask &= ~(DV_II_55_0_bit & (NZ((W[59]^(W[63]>>25)) & (1<<4))
+		 | NZ((W[57]^(W[59]>>25)) & (1<<4))
+		 | NZ((W[43]^(W[47]>>25)) & (1<<3))
+		 | NZ((W[43]^(W[47]>>25)) & (1<<4))));
+	mask &= ~(DV_II_56_0_bit & (NZ((W[60]^(W[64]>>25)) & (1<<4))
+		 | NZ((W[44]^(W[48]>>25)) & (1<<3))
+		 | NZ((W[44]^(W[48]>>25)) & (1<<4))));
+
+	memcpy(dvmask, &mask, sizeof(mask));
+}
+
+#undef Z
+#undef NZ
+
+static int sha1_x8_available(void)
+{
+	static int available = -1;
+
+	if (available < 0)
+		available = git_env_bool("GIT_TEST_SHA1DC_MANY", 1) &&
+			    __builtin_cpu_supports("avx2");
+	return available;
+}
+
+/* A message being hashed in one of the lanes. */
+struct sha1_lane {
+	struct git_hash_msg *msg;
+	size_t block, nr_blocks;
+	SHA1_CTX ctx;
+	/* the blocks with some header or padding in them are built here */
+	uint32_t buf[16];
+};
+
+static void sha1_lane_start(struct sha1_lane *lane, struct git_hash_msg *msg)
+{
+	lane->msg = msg;
+	if (!msg)
+		return;
+	lane->block = 0;
+	/* one more byte for the 0x80 after the message and 8 for its length */
+	lane->nr_blocks = (msg->hdrlen + msg->len + 8) / 64 + 1;
+	git_SHA1DCInit(&lane->ctx);
+}
+
+/* Find the next block of the lane, built into lane->buf if needed. */
+static const unsigned char *sha1_lane_block(struct sha1_lane *lane)
+{
+	const struct git_hash_msg *msg = lane->msg;
+	unsigned char *out = (unsigned char *)lane->buf;
+	size_t off = lane->block * 64, total = msg->hdrlen + msg->len;
+	size_t n = 0, len;
+
+	if (off >= msg->hdrlen && off + 64 <= total)
+		return (const unsigned char *)msg->buf + off - msg->hdrlen;
+
+	memset(out, 0, 64);
+	if (off < msg->hdrlen) {
+		n = msg->hdrlen - off < 64 ? msg->hdrlen - off : 64;
+		memcpy(out, (const unsigned char *)msg->hdr + off, n);
+	}
+	if (n < 64 && off + n < total) {
+		len = total - off - n < 64 - n ? total - off - n : 64 - n;
+		memcpy(out + n, (const unsigned char *)msg->buf + off + n - msg->hdrlen, len);
+		n += len;
+	}
+	if (n < 64 && off + n == total)
+		out[n] = 0x80;
+	if (lane->block == lane->nr_blocks - 1)
+		put_be64(out + 56, (uint64_t)total << 3);
+	return out;
+}
+
+static void sha1_lane_finish(struct sha1_lane *lane)
+{
+	unsigned char *hash = lane->msg->hash;
+	int i;
+
+	for (i = 0; i < 5; i++)
+		put_be32(hash + 4 * i, lane->ctx.ihv[i]);
+	if (lane->ctx.found_collision)
+		die("SHA-1 appears to be part of a collision attack: %s",
+		    sha1_to_hex(hash));
+}
+
+int git_SHA1DC_many(struct git_hash_msg *msgs, size_t nr)
+{
+	static const unsigned char idle_block[64];
+	struct sha1_lane lanes[SHA1_LANES];
+	const unsigned char *block[SHA1_LANES];
+	uint32_t ihv[5][SHA1_LANES], dvmask[SHA1_LANES];
+	size_t next = 0, active = 0;
+	int i, l;
+
+	if (nr < 2 || !sha1_x8_available())
+		return 0;
+
+	for (l = 0; l < SHA1_LANES; l++) {
+		sha1_lane_start(&lanes[l], next < nr ? &msgs[next++] : NULL);
+		active += !!lanes[l].msg;
+	}
+
+	while (active) {
+		for (l = 0; l < SHA1_LANES; l++) {
+			if (!lanes[l].msg) {
+				block[l] = idle_block;
+				continue;
+			}
+			block[l] = sha1_lane_block(&lanes[l]);
+			for (i = 0; i < 5; i++)
+				ihv[i][l] = lanes[l].ctx.ihv[i];
+		}
+
+		sha1_compress_x8(ihv, block, dvmask);
+
+		for (l = 0; l < SHA1_LANES; l++) {
+			struct sha1_lane *lane = &lanes[l];
+
+			if (!lane->msg)
+				continue;
+			if (dvmask[l]) {
+				/* lane->ctx still has the state before the block */
+				if (block[l] != (unsigned char *)lane->buf)
+					memcpy(lane->buf, block[l], 64);
+				git_SHA1DC_process_block(&lane->ctx, lane->buf);
+			} else {
+				for (i = 0; i < 5; i++)
+					lane->ctx.ihv[i] = ihv[i][l];
+			}
+			if (++lane->block < lane->nr_blocks)
+				continue;
+			sha1_lane_finish(lane);
+			sha1_lane_start(lane, next < nr ? &msgs[next++] : NULL);
+			active -= !lane->msg;
+		}
+	}
+	return 1;
+}
+
+#endif
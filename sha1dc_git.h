@@ -14,6 +14,35 @@ void git_SHA1DCInit(SHA1_CTX *);
 #define git_SHA1DCInit	SHA1DCInit
 #endif
 
+/*
+ * On x86 CPUs with the SHA extensions, the copy of sha1dc in sha1dc/
+ * compresses the blocks that cannot be part of a collision attack with
+ * them (see sha1_process_hw() there).
+ */
+#if !defined(NO_DC_SHA1_HW) && !defined(DC_SHA1_EXTERNAL) && \
+    !defined(DC_SHA1_SUBMODULE) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define DC_SHA1_HW
+#define SHA1DC_CUSTOM_HW_AVAILABLE git_SHA1DC_hw_available
+#define SHA1DC_CUSTOM_HW_COMPRESS git_SHA1DC_hw_compress
+int git_SHA1DC_hw_available(void);
+void git_SHA1DC_hw_compress(uint32_t ihv[5], const uint32_t block[16],
+			    uint32_t W[80]);
+
+/*
+ * With AVX2, git_SHA1DC_many() hashes eight messages at a time, and
+ * hands the blocks that might be part of a collision attack over to
+ * the full collision detection of sha1dc/ one by one. It returns 0 when
+ * the CPU cannot do that, leaving the messages to be hashed one by one.
+ */
+struct git_hash_msg;
+#define SHA1DC_CUSTOM_PROCESS_BLOCK git_SHA1DC_process_block
+void git_SHA1DC_process_block(SHA1_CTX *ctx, const uint32_t block[16]);
+int git_SHA1DC_many(struct git_hash_msg *msgs, size_t nr);
+#define platform_SHA1_Many git_SHA1DC_many
+#endif
+
 void git_SHA1DCFinal(unsigned char [20], SHA1_CTX *);
 void git_SHA1DCUpdate(SHA1_CTX *ctx, const void *data, unsigned long len);
 
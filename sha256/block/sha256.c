@@ -0,0 +1,303 @@
+/*
+ * SHA-256 routine, in portable C and, on x86 CPUs that have them, with
+ * the SHA extensions, picked once at runtime.
+ */
+
+#include "cache.h"
+#include "config.h"
+
+#if !defined(NO_SHA256_HW) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define SHA256_HW
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#undef RND
+#undef BLKSIZE
+
+#define BLKSIZE blk_SHA256_BLKSIZE
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *buf,
+				 size_t nr);
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul,
+	0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+	0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul,
+	0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+	0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul,
+	0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+	0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul,
+	0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+	0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul,
+	0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+	0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul,
+	0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+	0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul,
+	0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+	0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul,
+	0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul
+};
+
+void blk_SHA256_Init(blk_SHA256_CTX *ctx)
+{
+	ctx->size = 0;
+	ctx->state[0] = 0x6a09e667ul;
+	ctx->state[1] = 0xbb67ae85ul;
+	ctx->state[2] = 0x3c6ef372ul;
+	ctx->state[3] = 0xa54ff53aul;
+	ctx->state[4] = 0x510e527ful;
+	ctx->state[5] = 0x9b05688cul;
+	ctx->state[6] = 0x1f83d9abul;
+	ctx->state[7] = 0x5be0cd19ul;
+}
+
+static inline uint32_t ror(uint32_t x, unsigned n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t ch(uint32_t x, uint32_t y, uint32_t z)
+{
+	return z ^ (x & (y ^ z));
+}
+
+static inline uint32_t maj(uint32_t x, uint32_t y, uint32_t z)
+{
+	return ((x | y) & z) | (x & y);
+}
+
+static inline uint32_t sigma0(uint32_t x)
+{
+	return ror(x, 2) ^ ror(x, 13) ^ ror(x, 22);
+}
+
+static inline uint32_t sigma1(uint32_t x)
+{
+	return ror(x, 6) ^ ror(x, 11) ^ ror(x, 25);
+}
+
+static inline uint32_t gamma0(uint32_t x)
+{
+	return ror(x, 7) ^ ror(x, 18) ^ (x >> 3);
+}
+
+static inline uint32_t gamma1(uint32_t x)
+{
+	return ror(x, 17) ^ ror(x, 19) ^ (x >> 10);
+}
+
+#define RND(a,b,c,d,e,f,g,h,i) \
+	t0 = h + sigma1(e) + ch(e, f, g) + sha256_k[i] + W[i]; \
+	t1 = sigma0(a) + maj(a, b, c); \
+	d += t0; \
+	h = t0 + t1;
+
+static void sha256_blocks_c(uint32_t state[8], const uint8_t *buf, size_t nr)
+{
+	for (; nr; nr--, buf += BLKSIZE) {
+		uint32_t S[8], W[64], t0, t1;
+		int i;
+
+		/* copy state into S */
+		for (i = 0; i < 8; i++)
+			S[i] = state[i];
+
+		/* load the 512-bit block into W[0..15] */
+		for (i = 0; i < 16; i++)
+			W[i] = get_be32(buf + 4 * i);
+
+		/* fill W[16..63] */
+		for (i = 16; i < 64; i++)
+			W[i] = gamma1(W[i - 2]) + W[i - 7] +
+			       gamma0(W[i - 15]) + W[i - 16];
+
+		for (i = 0; i < 64; i += 8) {
+			RND(S[0],S[1],S[2],S[3],S[4],S[5],S[6],S[7],i+0);
+			RND(S[7],S[0],S[1],S[2],S[3],S[4],S[5],S[6],i+1);
+			RND(S[6],S[7],S[0],S[1],S[2],S[3],S[4],S[5],i+2);
+			RND(S[5],S[6],S[7],S[0],S[1],S[2],S[3],S[4],i+3);
+			RND(S[4],S[5],S[6],S[7],S[0],S[1],S[2],S[3],i+4);
+			RND(S[3],S[4],S[5],S[6],S[7],S[0],S[1],S[2],i+5);
+			RND(S[2],S[3],S[4],S[5],S[6],S[7],S[0],S[1],i+6);
+			RND(S[1],S[2],S[3],S[4],S[5],S[6],S[7],S[0],i+7);
+		}
+
+		for (i = 0; i < 8; i++)
+			state[i] += S[i];
+	}
+}
+
+#ifdef SHA256_HW
+
+static int sha256_hw_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!git_env_bool("GIT_TEST_SHA256_HW", 1))
+		return 0;
+	/* SSSE3 and SSE4.1, then the SHA extensions */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+	    !(ecx & (1 << 9)) || !(ecx & (1 << 19)))
+		return 0;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return !!(ebx & (1 << 29));
+}
+
+/*
+ * Four rounds, on the message words "m" with the constants added, two
+ * rounds per sha256rnds2. Meanwhile the words of later rounds are
+ * computed: "m_next" is completed with sha256msg2, from the words of
+ * these rounds and of the previous ones "m_prev", and "m_prev" is
+ * started with sha256msg1 for the rounds twelve rounds on.
+ */
+#define SHA256_ROUNDS4(i, m_prev, m, m_next) \
+	do { \
+		msg = _mm_add_epi32(m, \
+			_mm_loadu_si128((const __m128i *)(sha256_k + 4 * (i)))); \
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+		if ((i) >= 3 && (i) <= 14) { \
+			tmp = _mm_alignr_epi8(m, m_prev, 4); \
+			m_next = _mm_add_epi32(m_next, tmp); \
+			m_next = _mm_sha256msg2_epu32(m_next, m); \
+		} \
+		msg = _mm_shuffle_epi32(msg, 0x0e); \
+		state0 = _mm_sha256rnds2_epu32(state0, state1, msg); \
+		if ((i) >= 1 && (i) <= 12) \
+			m_prev = _mm_sha256msg1_epu32(m_prev, m); \
+	} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_hw(uint32_t state[8], const uint8_t *buf, size_t nr)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i state0, state1, abef_save, cdgh_save;
+	__m128i msg, tmp, m0, m1, m2, m3;
+
+	/* state0 holds a, b, e and f, state1 c, d, g and h */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xb1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)),
+				   0x1b);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; nr; nr--, buf += BLKSIZE) {
+		const __m128i *data = (const __m128i *)buf;
+
+		abef_save = state0;
+		cdgh_save = state1;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128(data + 0), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128(data + 1), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128(data + 2), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128(data + 3), bswap);
+
+		SHA256_ROUNDS4(0, m3, m0, m1);
+		SHA256_ROUNDS4(1, m0, m1, m2);
+		SHA256_ROUNDS4(2, m1, m2, m3);
+		SHA256_ROUNDS4(3, m2, m3, m0);
+		SHA256_ROUNDS4(4, m3, m0, m1);
+		SHA256_ROUNDS4(5, m0, m1, m2);
+		SHA256_ROUNDS4(6, m1, m2, m3);
+		SHA256_ROUNDS4(7, m2, m3, m0);
+		SHA256_ROUNDS4(8, m3, m0, m1);
+		SHA256_ROUNDS4(9, m0, m1, m2);
+		SHA256_ROUNDS4(10, m1, m2, m3);
+		SHA256_ROUNDS4(11, m2, m3, m0);
+		SHA256_ROUNDS4(12, m3, m0, m1);
+		SHA256_ROUNDS4(13, m0, m1, m2);
+		SHA256_ROUNDS4(14, m1, m2, m3);
+		SHA256_ROUNDS4(15, m2, m3, m0);
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *)state, state0);
+	_mm_storeu_si128((__m128i *)(state + 4), state1);
+}
+
+#endif
+
+static void sha256_blocks_detect(uint32_t state[8], const uint8_t *buf,
+				 size_t nr);
+
+/*
+ * Points to sha256_blocks_detect() until the first block is hashed,
+ * then to the fastest implementation the CPU can run.
+ */
+static sha256_blocks_fn sha256_blocks = sha256_blocks_detect;
+
+static void sha256_blocks_detect(uint32_t state[8], const uint8_t *buf,
+				 size_t nr)
+{
+	sha256_blocks_fn fn = sha256_blocks_c;
+
+#ifdef SHA256_HW
+	if (sha256_hw_available())
+		fn = sha256_blocks_hw;
+#endif
+	sha256_blocks = fn;
+	fn(state, buf, nr);
+}
+
+void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len)
+{
+	unsigned int len_buf = ctx->size % BLKSIZE;
+	const uint8_t *in = data;
+	size_t nr;
+
+	ctx->size += len;
+
+	/* Read the data into buf and process blocks as they get full */
+	if (len_buf) {
+		unsigned int left = BLKSIZE - len_buf;
+
+		if (len < left)
+			left = len;
+		memcpy(ctx->buf + len_buf, in, left);
+		in += left;
+		len -= left;
+		if (len_buf + left < BLKSIZE)
+			return;
+		sha256_blocks(ctx->state, ctx->buf, 1);
+	}
+
+	/* Whole blocks straight from the input, without the copy */
+	nr = len / BLKSIZE;
+	if (nr) {
+		sha256_blocks(ctx->state, in, nr);
+		in += nr * BLKSIZE;
+		len -= nr * BLKSIZE;
+	}
+	if (len)
+		memcpy(ctx->buf, in, len);
+}
+
+void blk_SHA256_Final(unsigned char *digest, blk_SHA256_CTX *ctx)
+{
+	static const unsigned char pad[64] = { 0x80 };
+	unsigned int padlen[2];
+	int i;
+
+	/* Pad with a binary 1 (ie 0x80), then zeroes, then length */
+	padlen[0] = htonl((uint32_t)(ctx->size >> 29));
+	padlen[1] = htonl((uint32_t)(ctx->size << 3));
+
+	i = ctx->size % BLKSIZE;
+	blk_SHA256_Update(ctx, pad, 1 + (63 & (55 - i)));
+	blk_SHA256_Update(ctx, padlen, 8);
+
+	/* copy output */
+	for (i = 0; i < 8; i++, digest += sizeof(uint32_t))
+		put_be32(digest, ctx->state[i]);
+}
@@ -4,6 +4,7 @@
 #include "lockfile.h"
 #include "object-store.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "tag.h"
 #include "pkt-line.h"
 #include "remote.h"
@@ -75,10 +76,10 @@ int is_repository_shallow(struct repository *r)
 }
 
 /*
- * TODO: use "int" elemtype instead of "int *" when/if commit-slab
- * supports a "valid" flag.
+ * The depth at which a commit was reached, plus one, so that zero
+ * means it was not reached yet.
  */
-define_commit_slab(commit_depth, int *);
+define_commit_slab(commit_depth, int);
 struct commit_list *get_shallow_commits(struct object_array *heads, int depth,
 		int shallow_flag, int not_shallow_flag)
 {
@@ -94,28 +95,25 @@ struct commit_list *get_shallow_commits(struct object_array *heads, int depth,
 		struct commit_list *p;
 		if (!commit) {
 			if (i < heads->nr) {
-				int **depth_slot;
 				commit = (struct commit *)
 					deref_tag(heads->objects[i++].item, NULL, 0);
 				if (!commit || commit->object.type != OBJ_COMMIT) {
 					commit = NULL;
 					continue;
 				}
-				depth_slot = commit_depth_at(&depths, commit);
-				if (!*depth_slot)
-					*depth_slot = xmalloc(sizeof(int));
-				**depth_slot = 0;
+				*commit_depth_at(&depths, commit) = 1;
 				cur_depth = 0;
 			} else {
 				commit = (struct commit *)
 					object_array_pop(&stack);
-				cur_depth = **commit_depth_at(&depths, commit);
+				cur_depth = *commit_depth_at(&depths, commit) - 1;
 			}
 		}
+		/* uses the commit-graph when there is one */
 		parse_commit_or_die(commit);
 		cur_depth++;
 		if ((depth != INFINITE_DEPTH && cur_depth >= depth) ||
-		    (is_repository_shallow(the_repository) && !commit->parents &&
+		    (is_repository_shallow(the_repository) &&
 		     (graft = lookup_commit_graft(the_repository, &commit->object.oid)) != NULL &&
 		     graft->nr_parent < 0)) {
 			commit_list_insert(commit, &result);
@@ -125,31 +123,21 @@ struct commit_list *get_shallow_commits(struct object_array *heads, int depth,
 		}
 		commit->object.flags |= not_shallow_flag;
 		for (p = commit->parents, commit = NULL; p; p = p->next) {
-			int **depth_slot = commit_depth_at(&depths, p->item);
-			if (!*depth_slot) {
-				*depth_slot = xmalloc(sizeof(int));
-				**depth_slot = cur_depth;
-			} else {
-				if (cur_depth >= **depth_slot)
-					continue;
-				**depth_slot = cur_depth;
-			}
+			int *depth_slot = commit_depth_at(&depths, p->item);
+			if (*depth_slot && cur_depth >= *depth_slot - 1)
+				continue;
+			*depth_slot = cur_depth + 1;
 			if (p->next)
 				add_object_array(&p->item->object,
 						NULL, &stack);
 			else {
 				commit = p->item;
-				cur_depth = **commit_depth_at(&depths, commit);
+				cur_depth = *depth_slot - 1;
 			}
 		}
 	}
-	for (i = 0; i < depths.slab_count; i++) {
-		int j;
-
-		for (j = 0; j < depths.slab_size; j++)
-			free(depths.slab[i][j]);
-	}
 	clear_commit_depth(&depths);
+	object_array_clear(&stack);
 
 	return result;
 }
@@ -449,6 +437,7 @@ void remove_nonexistent_theirs_shallow(struct shallow_info *info)
 }
 
 define_commit_slab(ref_bitmap, uint32_t *);
+define_commit_slab(paint_indegree, int);
 
 #define POOL_SIZE (512 * 1024)
 
@@ -458,6 +447,9 @@ struct paint_info {
 	char **pools;
 	char *free, *end;
 	unsigned pool_count;
+	/* bitmaps no longer needed, to be handed out again */
+	uint32_t **spare;
+	size_t spare_nr, spare_alloc;
 };
 
 static uint32_t *paint_alloc(struct paint_info *info)
@@ -465,6 +457,8 @@ static uint32_t *paint_alloc(struct paint_info *info)
 	unsigned nr = DIV_ROUND_UP(info->nr_bits, 32);
 	unsigned size = nr * sizeof(uint32_t);
 	void *p;
+	if (info->spare_nr)
+		return info->spare[--info->spare_nr];
 	if (!info->pool_count || size > info->end - info->free) {
 		if (size > POOL_SIZE)
 			BUG("pool size too small for %d in paint_alloc()",
@@ -480,52 +474,59 @@ static uint32_t *paint_alloc(struct paint_info *info)
 	return p;
 }
 
+static void paint_free(struct paint_info *info, uint32_t *bitmap)
+{
+	ALLOC_GROW(info->spare, info->spare_nr + 1, info->spare_alloc);
+	info->spare[info->spare_nr++] = bitmap;
+}
+
 /*
- * Given a commit SHA-1, walk down to parents until either SEEN,
- * UNINTERESTING or BOTTOM is hit. Set the id-th bit in ref_bitmap for
- * all walked commits.
+ * Set the id-th bit in ref_bitmap of every commit that ref[id] reaches
+ * without going through UNINTERESTING commits or past BOTTOM ones.
+ *
+ * The commits that any ref reaches this way are found first, with one
+ * walk. The bits are then pushed down from children to parents in
+ * topological order, so that each commit is visited once instead of
+ * once per ref, and the bitmap of a commit that is not a BOTTOM is
+ * recycled as soon as its parents have theirs.
  */
-static void paint_down(struct paint_info *info, const struct object_id *oid,
-		       unsigned int id)
+static void paint_down(struct paint_info *info, struct oid_array *ref)
 {
-	unsigned int i, nr;
-	struct commit_list *head = NULL;
-	int bitmap_nr = DIV_ROUND_UP(info->nr_bits, 32);
-	size_t bitmap_size = st_mult(sizeof(uint32_t), bitmap_nr);
-	struct commit *c = lookup_commit_reference_gently(oid, 1);
-	uint32_t *tmp; /* to be freed before return */
-	uint32_t *bitmap;
-
-	if (!c)
-		return;
-
-	tmp = xmalloc(bitmap_size);
-	bitmap = paint_alloc(info);
-	memset(bitmap, 0, bitmap_size);
-	bitmap[id / 32] |= (1U << (id % 32));
-	commit_list_insert(c, &head);
-	while (head) {
-		struct commit_list *p;
-		struct commit *c = pop_commit(&head);
-		uint32_t **refs = ref_bitmap_at(&info->ref_bitmap, c);
+	size_t bitmap_size = st_mult(sizeof(uint32_t),
+				     DIV_ROUND_UP(info->nr_bits, 32));
+	struct paint_indegree indegree;
+	struct commit **region = NULL, **stack = NULL;
+	size_t region_nr = 0, region_alloc = 0;
+	size_t stack_nr = 0, stack_alloc = 0;
+	size_t i, j;
+
+	init_paint_indegree(&indegree);
+	for (i = 0; i < ref->nr; i++) {
+		struct commit *c = lookup_commit_reference_gently(ref->oid + i, 1);
+		uint32_t **refs;
 
 		/* XXX check "UNINTERESTING" from pack bitmaps if available */
-		if (c->object.flags & (SEEN | UNINTERESTING))
+		if (!c || (c->object.flags & UNINTERESTING))
 			continue;
-		else
-			c->object.flags |= SEEN;
-
-		if (*refs == NULL)
-			*refs = bitmap;
-		else {
-			memcpy(tmp, *refs, bitmap_size);
-			for (i = 0; i < bitmap_nr; i++)
-				tmp[i] |= bitmap[i];
-			if (memcmp(tmp, *refs, bitmap_size)) {
-				*refs = paint_alloc(info);
-				memcpy(*refs, tmp, bitmap_size);
-			}
+		refs = ref_bitmap_at(&info->ref_bitmap, c);
+		if (!*refs) {
+			*refs = paint_alloc(info);
+			memset(*refs, 0, bitmap_size);
 		}
+		(*refs)[i / 32] |= (1U << (i % 32));
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr++] = c;
+	}
+
+	while (stack_nr) {
+		struct commit *c = stack[--stack_nr];
+		struct commit_list *p;
+
+		if (c->object.flags & SEEN)
+			continue;
+		c->object.flags |= SEEN;
+		ALLOC_GROW(region, region_nr + 1, region_alloc);
+		region[region_nr++] = c;
 
 		if (c->object.flags & BOTTOM)
 			continue;
@@ -535,20 +536,60 @@ static void paint_down(struct paint_info *info, const struct object_id *oid,
 			    oid_to_hex(&c->object.oid));
 
 		for (p = c->parents; p; p = p->next) {
+			if (p->item->object.flags & UNINTERESTING)
+				continue;
+			(*paint_indegree_at(&indegree, p->item))++;
 			if (p->item->object.flags & SEEN)
 				continue;
-			commit_list_insert(p->item, &head);
+			ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+			stack[stack_nr++] = p->item;
 		}
 	}
 
-	nr = get_max_object_index();
-	for (i = 0; i < nr; i++) {
-		struct object *o = get_indexed_object(i);
-		if (o && o->type == OBJ_COMMIT)
-			o->flags &= ~SEEN;
+	/* the commits no other painted commit points at come first */
+	for (i = 0; i < region_nr; i++)
+		if (!*paint_indegree_at(&indegree, region[i])) {
+			ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+			stack[stack_nr++] = region[i];
+		}
+
+	while (stack_nr) {
+		struct commit *c = stack[--stack_nr];
+		uint32_t **refs = ref_bitmap_at(&info->ref_bitmap, c);
+		struct commit_list *p;
+
+		if (c->object.flags & BOTTOM)
+			continue;
+
+		for (p = c->parents; p; p = p->next) {
+			uint32_t **parent_refs;
+			int *parent_indegree;
+
+			if (p->item->object.flags & UNINTERESTING)
+				continue;
+			parent_refs = ref_bitmap_at(&info->ref_bitmap, p->item);
+			if (!*parent_refs) {
+				*parent_refs = paint_alloc(info);
+				memset(*parent_refs, 0, bitmap_size);
+			}
+			for (j = 0; j < bitmap_size / sizeof(uint32_t); j++)
+				(*parent_refs)[j] |= (*refs)[j];
+
+			parent_indegree = paint_indegree_at(&indegree, p->item);
+			if (!--*parent_indegree) {
+				ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+				stack[stack_nr++] = p->item;
+			}
+		}
+		paint_free(info, *refs);
+		*refs = NULL;
 	}
 
-	free(tmp);
+	for (i = 0; i < region_nr; i++)
+		region[i]->object.flags &= ~SEEN;
+	clear_paint_indegree(&indegree);
+	free(region);
+	free(stack);
 }
 
 static int mark_uninteresting(const char *refname, const struct object_id *oid,
@@ -626,8 +667,7 @@ void assign_shallow_commits_to_refs(struct shallow_info *info,
 		c->object.flags |= BOTTOM;
 	}
 
-	for (i = 0; i < ref->nr; i++)
-		paint_down(&pi, ref->oid + i, i);
+	paint_down(&pi, ref);
 
 	if (used) {
 		int bitmap_size = DIV_ROUND_UP(pi.nr_bits, 32) * sizeof(uint32_t);
@@ -651,6 +691,7 @@ void assign_shallow_commits_to_refs(struct shallow_info *info,
 	for (i = 0; i < pi.pool_count; i++)
 		free(pi.pools[i]);
 	free(pi.pools);
+	free(pi.spare);
 	free(shallow);
 }
 
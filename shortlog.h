@@ -2,6 +2,7 @@
 #define SHORTLOG_H
 
 #include "string-list.h"
+#include "hashmap.h"
 
 struct shortlog {
 	struct string_list list;
@@ -18,6 +19,8 @@ struct shortlog {
 	char *common_repo_prefix;
 	int email;
 	struct string_list mailmap;
+	/* raw "name <email>" of an ident to the author it is shown as */
+	struct hashmap idents;
 	FILE *file;
 };
 
@@ -0,0 +1,304 @@
+#include "cache.h"
+#include "config.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "userdiff.h"
+#include "oidmap.h"
+#include "lockfile.h"
+#include "similarity-cache.h"
+#include "trace2.h"
+
+/*
+ * The file starts with a header:
+ *
+ *   4-byte signature "SIMC"
+ *   1-byte version (1)
+ *   1-byte hash version (1 for SHA-1)
+ *   2 bytes of padding
+ *
+ * followed by records, each of which is:
+ *
+ *   the object name of the blob
+ *   4-byte flags: bit 0 is set if the contents of the blob are binary
+ *   8-byte size of the blob
+ *   4-byte number of spans
+ *   8 bytes for each span: its 4-byte hash and its 4-byte count, in the
+ *   order of the hashes
+ *
+ * All numbers are in network byte order. Records are only ever appended,
+ * and when a blob has several records, the last one wins. A record cut
+ * short at the end of the file is ignored, and cut off by the next
+ * process that appends to the file.
+ */
+#define SIMILARITY_CACHE_SIGNATURE 0x53494d43 /* "SIMC" */
+#define SIMILARITY_CACHE_VERSION 1
+#define SIMILARITY_CACHE_OID_VERSION 1
+#define SIMILARITY_CACHE_HEADER_SIZE 8
+#define RECORD_HEADER_SIZE (GIT_SHA1_RAWSZ + 16)
+
+#define CACHED_BINARY (1u << 0)
+
+struct cached_counts {
+	struct oidmap_entry entry;
+	unsigned int binary;
+	uint64_t size;
+	uint32_t nr;
+	const unsigned char *spans;	/* in the file, or in "buf" */
+	unsigned char *buf;		/* the record, if not written yet */
+};
+
+static int use_cache = -1;
+static int loaded;
+static struct oidmap cache;
+static void *cache_map;
+static size_t cache_map_size;
+/* how much of the file we read, and where its last complete record ends */
+static off_t cache_file_size, cache_valid_end;
+static int cache_readonly; /* do not append to a file we cannot read */
+
+static struct cached_counts **pending;
+static int pending_nr, pending_alloc;
+static int hits, misses;
+
+static int similarity_cache_enabled(void)
+{
+	if (use_cache < 0 &&
+	    git_config_get_bool("diff.similaritycache", &use_cache))
+		use_cache = 0;
+	return use_cache;
+}
+
+static char *similarity_cache_filename(void)
+{
+	return xstrfmt("%s/info/similarity-cache", get_object_directory());
+}
+
+static void add_entry(struct cached_counts *e)
+{
+	struct cached_counts *old = oidmap_put(&cache, e);
+
+	if (old) {
+		free(old->buf);
+		free(old);
+	}
+}
+
+/* Return the size of the record at "data", or 0 if it is cut short */
+static size_t parse_record(const unsigned char *data, size_t len)
+{
+	struct cached_counts *e;
+	uint32_t nr;
+	size_t size;
+
+	if (len < RECORD_HEADER_SIZE)
+		return 0;
+	nr = get_be32(data + GIT_SHA1_RAWSZ + 12);
+	size = st_add(RECORD_HEADER_SIZE, st_mult(8, nr));
+	if (len < size)
+		return 0;
+
+	e = xcalloc(1, sizeof(*e));
+	hashcpy(e->entry.oid.hash, data);
+	e->binary = !!(get_be32(data + GIT_SHA1_RAWSZ) & CACHED_BINARY);
+	e->size = get_be64(data + GIT_SHA1_RAWSZ + 4);
+	e->nr = nr;
+	e->spans = data + RECORD_HEADER_SIZE;
+	add_entry(e);
+	return size;
+}
+
+static void load_similarity_cache(void)
+{
+	char *filename;
+	const unsigned char *data;
+	struct stat st;
+	size_t pos;
+	int fd;
+
+	if (loaded)
+		return;
+	loaded = 1;
+	oidmap_init(&cache, 0);
+
+	filename = similarity_cache_filename();
+	fd = git_open(filename);
+	free(filename);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st)) {
+		close(fd);
+		cache_readonly = 1;
+		return;
+	}
+	cache_file_size = st.st_size;
+	if (xsize_t(st.st_size) < SIMILARITY_CACHE_HEADER_SIZE) {
+		close(fd);
+		return;
+	}
+	cache_map_size = xsize_t(st.st_size);
+	cache_map = xmmap(NULL, cache_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	data = cache_map;
+	if (get_be32(data) != SIMILARITY_CACHE_SIGNATURE ||
+	    data[4] != SIMILARITY_CACHE_VERSION ||
+	    data[5] != SIMILARITY_CACHE_OID_VERSION) {
+		/* a cache we do not understand is as good as no cache */
+		munmap(cache_map, cache_map_size);
+		cache_map = NULL;
+		cache_readonly = 1;
+		return;
+	}
+
+	pos = SIMILARITY_CACHE_HEADER_SIZE;
+	while (pos < cache_map_size) {
+		size_t len = parse_record(data + pos, cache_map_size - pos);
+		if (!len)
+			break;
+		pos += len;
+	}
+	cache_valid_end = pos;
+}
+
+int similarity_cache_lookup(struct diff_filespec *one)
+{
+	struct cached_counts *e;
+	uint32_t *spans;
+	int binary;
+	uint32_t i;
+
+	if (!one->oid_valid || !S_ISREG(one->mode) ||
+	    !similarity_cache_enabled())
+		return 0;
+	load_similarity_cache();
+
+	e = oidmap_get(&cache, &one->oid);
+	if (!e) {
+		misses++;
+		return 0;
+	}
+
+	/*
+	 * The counts treat CRLF as LF in text files. They were computed
+	 * with the binary-ness of the contents, which an attribute of the
+	 * path may override.
+	 */
+	diff_filespec_load_driver(one);
+	binary = one->driver->binary != -1 ? one->driver->binary : e->binary;
+	if (binary != e->binary) {
+		misses++;
+		return 0;
+	}
+
+	ALLOC_ARRAY(spans, st_mult(2, e->nr));
+	for (i = 0; i < 2 * e->nr; i++)
+		spans[i] = get_be32(e->spans + 4 * i);
+	one->cnt_data = diffcore_count_from_spans(spans, e->nr);
+	free(spans);
+	one->size = e->size;
+	one->is_binary = binary;
+	hits++;
+	return 1;
+}
+
+void similarity_cache_add(struct diff_filespec *one)
+{
+	struct cached_counts *e;
+	uint32_t *spans;
+	unsigned int nr, i;
+	unsigned char *p;
+
+	if (!one->oid_valid || !S_ISREG(one->mode) || !one->cnt_data ||
+	    !similarity_cache_enabled())
+		return;
+	/* only the counts that depend on the contents alone are cached */
+	if (!one->driver || one->driver->binary != -1 || one->is_binary < 0)
+		return;
+	load_similarity_cache();
+	if (oidmap_get(&cache, &one->oid))
+		return;
+
+	nr = diffcore_count_spans(one->cnt_data, &spans);
+	e = xcalloc(1, sizeof(*e));
+	oidcpy(&e->entry.oid, &one->oid);
+	e->binary = one->is_binary;
+	e->size = one->size;
+	e->nr = nr;
+	e->buf = xmalloc(st_add(RECORD_HEADER_SIZE, st_mult(8, nr)));
+	p = e->buf;
+	hashcpy(p, one->oid.hash);
+	put_be32(p + GIT_SHA1_RAWSZ, e->binary ? CACHED_BINARY : 0);
+	put_be64(p + GIT_SHA1_RAWSZ + 4, e->size);
+	put_be32(p + GIT_SHA1_RAWSZ + 12, nr);
+	for (i = 0; i < 2 * nr; i++)
+		put_be32(p + RECORD_HEADER_SIZE + 4 * i, spans[i]);
+	e->spans = p + RECORD_HEADER_SIZE;
+	free(spans);
+
+	add_entry(e);
+	ALLOC_GROW(pending, pending_nr + 1, pending_alloc);
+	pending[pending_nr++] = e;
+}
+
+void similarity_cache_flush(void)
+{
+	struct lock_file lock = LOCK_INIT;
+	char *filename;
+	struct stat st;
+	int fd, i;
+
+	if (hits || misses) {
+		trace2_counter_add("diff", "similarity-cache/hits", hits);
+		trace2_counter_add("diff", "similarity-cache/misses", misses);
+		hits = misses = 0;
+	}
+	if (!pending_nr)
+		return;
+
+	/*
+	 * The lock only keeps two processes from appending at the same
+	 * time; the file itself is never replaced. If somebody else holds
+	 * it, or appended to the file since we read it, we will count
+	 * these blobs again next time.
+	 */
+	filename = similarity_cache_filename();
+	if (cache_readonly ||
+	    hold_lock_file_for_update(&lock, filename, 0) < 0)
+		goto out;
+	fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd < 0) {
+		rollback_lock_file(&lock);
+		goto out;
+	}
+	adjust_shared_perm(filename);
+	if (fstat(fd, &st) || st.st_size != cache_file_size)
+		goto close_out;
+	if (cache_valid_end < st.st_size && ftruncate(fd, cache_valid_end))
+		goto close_out;
+	cache_file_size = -1; /* until we know how much we wrote */
+	if (!cache_valid_end) {
+		unsigned char hdr[SIMILARITY_CACHE_HEADER_SIZE] = { 0 };
+
+		put_be32(hdr, SIMILARITY_CACHE_SIGNATURE);
+		hdr[4] = SIMILARITY_CACHE_VERSION;
+		hdr[5] = SIMILARITY_CACHE_OID_VERSION;
+		if (write_in_full(fd, hdr, sizeof(hdr)) < 0)
+			goto close_out;
+		cache_valid_end = sizeof(hdr);
+	}
+	for (i = 0; i < pending_nr; i++) {
+		struct cached_counts *e = pending[i];
+		size_t len = st_add(RECORD_HEADER_SIZE, st_mult(8, e->nr));
+
+		if (write_in_full(fd, e->buf, len) < 0)
+			goto close_out;
+		cache_valid_end += len;
+	}
+	cache_file_size = cache_valid_end;
+close_out:
+	close(fd);
+	rollback_lock_file(&lock);
+out:
+	free(filename);
+	pending_nr = 0;
+}
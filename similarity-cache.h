@@ -0,0 +1,26 @@
+#ifndef SIMILARITY_CACHE_H
+#define SIMILARITY_CACHE_H
+
+struct diff_filespec;
+
+/*
+ * The similarity cache keeps in $GIT_DIR/objects/info/similarity-cache
+ * the counts that rename detection computes from the contents of each
+ * blob, so that the next rename detection comparing the same blob does
+ * not have to read and count it again. It is only used when
+ * diff.similarityCache is true.
+ */
+
+/*
+ * Fill the size and the counts (cnt_data) of "one" from the cache, and
+ * return 1 if they were there; return 0 otherwise.
+ */
+int similarity_cache_lookup(struct diff_filespec *one);
+
+/* Remember the counts just computed for "one", if it can be cached. */
+void similarity_cache_add(struct diff_filespec *one);
+
+/* Append the counts remembered since the last call to the cache file. */
+void similarity_cache_flush(void);
+
+#endif
@@ -0,0 +1,231 @@
+#include "cache.h"
+#include "config.h"
+#include "tree.h"
+#include "pathspec.h"
+#include "cache-tree.h"
+#include "sparse-index.h"
+
+static struct cache_entry *construct_sparse_dir_entry(struct index_state *istate,
+						      const char *sparse_dir,
+						      const struct cache_tree *tree)
+{
+	struct cache_entry *ce;
+	size_t len = strlen(sparse_dir);
+
+	ce = make_empty_cache_entry(istate, len);
+	memcpy(ce->name, sparse_dir, len);
+	ce->ce_namelen = len;
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = CE_SKIP_WORKTREE | CE_EXTENDED;
+	oidcpy(&ce->oid, &tree->oid);
+	return ce;
+}
+
+/*
+ * Can the entries cache[start..end), which make up one directory, be
+ * replaced by a single sparse directory entry?
+ */
+static int can_convert_to_sparse(struct index_state *istate, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) || S_ISGITLINK(ce->ce_mode) ||
+		    !ce_skip_worktree(ce) || (ce->ce_flags & CE_REMOVE))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Rewrite the entries cache[start..end), which all live below
+ * "ct_path" (of length "ct_pathlen", with a trailing slash unless it
+ * is the root) and are described by the cache-tree "ct", starting at
+ * position "num_converted". Return the number of entries written.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 int num_converted,
+				 int start, int end,
+				 const char *ct_path, size_t ct_pathlen,
+				 struct cache_tree *ct)
+{
+	int i;
+	int start_converted = num_converted;
+	struct strbuf child_path = STRBUF_INIT;
+
+	/* The root of the tree is never collapsed. */
+	if (ct_pathlen && can_convert_to_sparse(istate, start, end)) {
+		for (i = start; i < end; i++)
+			discard_cache_entry(istate->cache[i]);
+		istate->cache[num_converted] =
+			construct_sparse_dir_entry(istate, ct_path, ct);
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		int count, span, pos = -1;
+		struct cache_entry *ce = istate->cache[i];
+		const char *base, *slash;
+
+		/* Is this an entry directly inside "ct_path"? */
+		base = ce->name + ct_pathlen;
+		slash = strchr(base, '/');
+		if (slash)
+			pos = cache_tree_subtree_pos(ct, base, slash - base);
+
+		if (pos < 0 || ct->down[pos]->cache_tree->entry_count < 0) {
+			istate->cache[num_converted++] = ce;
+			i++;
+			continue;
+		}
+
+		strbuf_reset(&child_path);
+		strbuf_add(&child_path, ce->name, slash - ce->name + 1);
+
+		span = ct->down[pos]->cache_tree->entry_count;
+		count = convert_to_sparse_rec(istate, num_converted,
+					      i, i + span,
+					      child_path.buf, child_path.len,
+					      ct->down[pos]->cache_tree);
+		num_converted += count;
+		i += span;
+	}
+
+	strbuf_release(&child_path);
+	return num_converted - start_converted;
+}
+
+int convert_to_sparse(struct index_state *istate)
+{
+	int enabled = 0;
+	unsigned int i;
+
+	if (istate->split_index || istate->sparse_index ||
+	    !istate->cache_nr || !core_apply_sparse_checkout)
+		return 0;
+	if (git_config_get_bool("index.sparse", &enabled) || !enabled)
+		return 0;
+
+	/*
+	 * The fsmonitor extension records entries by their position in
+	 * the index, which would not survive collapsing directories.
+	 */
+	if (core_fsmonitor)
+		return 0;
+
+	/*
+	 * The cache-tree tells us where each directory starts and ends;
+	 * it cannot be computed when there are unmerged entries, and we
+	 * do not collapse anything then.
+	 */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK))
+		return 0;
+
+	free_name_hash(istate);
+	istate->cache_nr = convert_to_sparse_rec(istate, 0, 0, istate->cache_nr,
+						 "", 0, istate->cache_tree);
+
+	/*
+	 * Older versions of Git refuse an index with the "sdir" extension,
+	 * so do not mark the index as sparse unless something collapsed.
+	 */
+	for (i = 0; i < istate->cache_nr; i++)
+		if (S_ISSPARSEDIR(istate->cache[i]->ce_mode))
+			break;
+	if (i == istate->cache_nr)
+		return 0;
+	istate->sparse_index = 1;
+
+	/* The cache-tree now has sparse directories as its leaves. */
+	cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = cache_tree();
+	cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK);
+	return 0;
+}
+
+static int add_path_to_index(const struct object_id *oid,
+			     struct strbuf *base, const char *path,
+			     unsigned int mode, int stage, void *context)
+{
+	struct index_state *istate = context;
+	struct cache_entry *ce;
+	size_t len = base->len;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	strbuf_addstr(base, path);
+
+	ce = make_empty_cache_entry(istate, base->len);
+	memcpy(ce->name, base->buf, base->len);
+	ce->ce_namelen = base->len;
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = CE_SKIP_WORKTREE | CE_EXTENDED;
+	oidcpy(&ce->oid, oid);
+
+	ALLOC_GROW(istate->cache, istate->cache_nr + 1, istate->cache_alloc);
+	istate->cache[istate->cache_nr++] = ce;
+
+	strbuf_setlen(base, len);
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct cache_entry **sparse_cache;
+	unsigned int i, sparse_nr;
+	struct pathspec ps;
+	unsigned int cache_changed;
+
+	if (!istate || !istate->sparse_index)
+		return;
+
+	free_name_hash(istate);
+
+	sparse_cache = istate->cache;
+	sparse_nr = istate->cache_nr;
+	istate->cache = NULL;
+	istate->cache_nr = 0;
+	istate->cache_alloc = 0;
+	ALLOC_GROW(istate->cache, sparse_nr, istate->cache_alloc);
+
+	memset(&ps, 0, sizeof(ps));
+	for (i = 0; i < sparse_nr; i++) {
+		struct cache_entry *ce = sparse_cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(istate->cache, istate->cache_nr + 1,
+				   istate->cache_alloc);
+			istate->cache[istate->cache_nr++] = ce;
+			continue;
+		}
+		if (!ce_skip_worktree(ce))
+			warning(_("index entry is a directory, but not sparse (%08x)"),
+				ce->ce_flags);
+
+		tree = lookup_tree(&ce->oid);
+		if (!tree || read_tree_recursive(tree, ce->name, ce_namelen(ce),
+						 0, &ps, add_path_to_index, istate))
+			die(_("unable to expand sparse directory '%s'"), ce->name);
+
+		discard_cache_entry(ce);
+	}
+	free(sparse_cache);
+	istate->sparse_index = 0;
+
+	/*
+	 * Recompute the cache-tree now that directories are expanded;
+	 * the contents of the index did not change, so do not mark it
+	 * as needing to be written out.
+	 */
+	cache_changed = istate->cache_changed;
+	cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = cache_tree();
+	cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK);
+	istate->cache_changed = cache_changed;
+}
@@ -0,0 +1,20 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+
+/*
+ * Replace every directory whose entries are all outside of the sparse
+ * checkout (i.e. merged and marked skip-worktree) with a single sparse
+ * directory entry pointing at its tree. This is a no-op unless
+ * "index.sparse" is enabled and the index can be made sparse.
+ */
+int convert_to_sparse(struct index_state *istate);
+
+/*
+ * Expand all sparse directory entries of a sparse index back into the
+ * file entries of their trees, so that the index holds every path.
+ */
+void ensure_full_index(struct index_state *istate);
+
+#endif
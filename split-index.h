@@ -36,4 +36,10 @@ void discard_split_index(struct index_state *istate);
 void add_split_index(struct index_state *istate);
 void remove_split_index(struct index_state *istate);
 
+/*
+ * Whether so many entries of "istate" are not in its shared index that
+ * splitIndex.maxPercentChange asks for a new one.
+ */
+int too_many_not_shared_entries(struct index_state *istate);
+
 #endif
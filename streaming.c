@@ -7,12 +7,15 @@
 #include "object-store.h"
 #include "replace-object.h"
 #include "packfile.h"
+#include "pack-revindex.h"
+#include "tempfile.h"
 
 enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -45,6 +48,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -53,6 +57,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -92,6 +97,21 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct {
+			struct packed_git *pack;
+			off_t pos;
+			/* inflated delta data not interpreted yet */
+			unsigned char buf[4096];
+			unsigned int used, avail;
+			/* the base, in core or spilled to a temporary file */
+			char *base;
+			struct tempfile *base_file;
+			unsigned long base_size;
+			/* the instruction being carried out */
+			unsigned long copy_from, copy_left, insert_left;
+			unsigned long out; /* bytes returned so far */
+		} in_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -125,34 +145,44 @@ static enum input_source istream_source(const struct object_id *oid,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold < size)
-			return pack_non_delta;
+		if (big_file_threshold < size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
 	}
 }
 
-struct git_istream *open_istream(const struct object_id *oid,
-				 enum object_type *type,
-				 unsigned long *size,
-				 struct stream_filter *filter)
+static struct git_istream *open_istream_1(const struct object_id *oid,
+					 enum object_type *type)
 {
 	struct git_istream *st;
 	struct object_info oi = OBJECT_INFO_INIT;
-	const struct object_id *real = lookup_replace_object(the_repository, oid);
-	enum input_source src = istream_source(real, type, &oi);
+	enum input_source src = istream_source(oid, type, &oi);
 
 	if (src < 0)
 		return NULL;
 
 	st = xmalloc(sizeof(*st));
-	if (open_istream_tbl[src](st, &oi, real, type)) {
-		if (open_istream_incore(st, &oi, real, type)) {
+	if (open_istream_tbl[src](st, &oi, oid, type)) {
+		if (open_istream_incore(st, &oi, oid, type)) {
 			free(st);
 			return NULL;
 		}
 	}
+	return st;
+}
+
+struct git_istream *open_istream(const struct object_id *oid,
+				 enum object_type *type,
+				 unsigned long *size,
+				 struct stream_filter *filter)
+{
+	const struct object_id *real = lookup_replace_object(the_repository, oid);
+	struct git_istream *st = open_istream_1(real, type);
+
+	if (!st)
+		return NULL;
 	if (filter) {
 		/* Add "&& !is_null_stream_filter(filter)" for performance */
 		struct git_istream *nst = attach_stream_filter(st, filter);
@@ -457,6 +487,318 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Deltified packed object stream
+ *
+ * The delta data is inflated a buffer at a time and its instructions
+ * carried out as the caller reads, so only the base is kept whole;
+ * a base larger than core.bigFileThreshold is written to a temporary
+ * file first (itself streamed, should it be a delta as well) and
+ * copied from there.
+ *
+ *****************************************************************/
+
+static int fill_delta(struct git_istream *st)
+{
+	st->u.in_delta.used = st->u.in_delta.avail = 0;
+	if (st->z_state != z_used)
+		return -1;
+
+	while (!st->u.in_delta.avail) {
+		int status;
+		struct pack_window *window = NULL;
+		unsigned char *mapped;
+
+		mapped = use_pack(st->u.in_delta.pack, &window,
+				  st->u.in_delta.pos, &st->z.avail_in);
+
+		st->z.next_out = st->u.in_delta.buf;
+		st->z.avail_out = sizeof(st->u.in_delta.buf);
+		st->z.next_in = mapped;
+		status = git_inflate(&st->z, Z_NO_FLUSH);
+
+		st->u.in_delta.pos += st->z.next_in - mapped;
+		st->u.in_delta.avail = st->z.next_out - st->u.in_delta.buf;
+		unuse_pack(&window);
+
+		if (status == Z_STREAM_END) {
+			git_inflate_end(&st->z);
+			st->z_state = z_done;
+			break;
+		}
+		if (status != Z_OK && status != Z_BUF_ERROR) {
+			git_inflate_end(&st->z);
+			st->z_state = z_error;
+			return -1;
+		}
+	}
+	return st->u.in_delta.avail ? 0 : -1;
+}
+
+static int delta_byte(struct git_istream *st)
+{
+	if (st->u.in_delta.used == st->u.in_delta.avail && fill_delta(st))
+		return -1;
+	return st->u.in_delta.buf[st->u.in_delta.used++];
+}
+
+static int delta_hdr_size(struct git_istream *st, unsigned long *size)
+{
+	unsigned long sz = 0;
+	int shift = 0, c;
+
+	do {
+		c = delta_byte(st);
+		if (c < 0 || shift >= bitsizeof(sz))
+			return -1;
+		sz |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	*size = sz;
+	return 0;
+}
+
+static int read_delta_base(struct git_istream *st, char *buf,
+			   unsigned long from, size_t len)
+{
+	if (st->u.in_delta.base) {
+		memcpy(buf, st->u.in_delta.base + from, len);
+		return 0;
+	}
+	if (pread_in_full(get_tempfile_fd(st->u.in_delta.base_file),
+			  buf, len, from) != len)
+		return error_errno(_("unable to read delta base"));
+	return 0;
+}
+
+/* Parse the next copy or insert instruction */
+static int next_delta_instruction(struct git_istream *st, unsigned long left)
+{
+	unsigned long off = 0, size = 0;
+	int cmd = delta_byte(st), c, i;
+
+	if (cmd < 0)
+		return -1;
+	if (!(cmd & 0x80)) {
+		/* cmd == 0 is reserved */
+		if (!cmd || cmd > left)
+			return -1;
+		st->u.in_delta.insert_left = cmd;
+		return 0;
+	}
+	for (i = 0; i < 4; i++) {
+		if (!(cmd & (1 << i)))
+			continue;
+		if ((c = delta_byte(st)) < 0)
+			return -1;
+		off |= (unsigned long)c << (8 * i);
+	}
+	for (i = 0; i < 3; i++) {
+		if (!(cmd & (0x10 << i)))
+			continue;
+		if ((c = delta_byte(st)) < 0)
+			return -1;
+		size |= (unsigned long)c << (8 * i);
+	}
+	if (!size)
+		size = 0x10000;
+	if (unsigned_add_overflows(off, size) ||
+	    off + size > st->u.in_delta.base_size || size > left)
+		return -1;
+	st->u.in_delta.copy_from = off;
+	st->u.in_delta.copy_left = size;
+	return 0;
+}
+
+static read_method_decl(pack_delta)
+{
+	size_t total_read = 0;
+
+	if (st->z_state == z_error)
+		return -1;
+
+	while (total_read < sz) {
+		unsigned long left = st->size - st->u.in_delta.out - total_read;
+		size_t len = sz - total_read;
+
+		if (st->u.in_delta.copy_left) {
+			if (st->u.in_delta.copy_left < len)
+				len = st->u.in_delta.copy_left;
+			if (read_delta_base(st, buf + total_read,
+					    st->u.in_delta.copy_from, len))
+				goto error;
+			st->u.in_delta.copy_from += len;
+			st->u.in_delta.copy_left -= len;
+			total_read += len;
+		} else if (st->u.in_delta.insert_left) {
+			if (st->u.in_delta.used == st->u.in_delta.avail &&
+			    fill_delta(st))
+				goto error;
+			if (st->u.in_delta.insert_left < len)
+				len = st->u.in_delta.insert_left;
+			if (st->u.in_delta.avail - st->u.in_delta.used < len)
+				len = st->u.in_delta.avail - st->u.in_delta.used;
+			memcpy(buf + total_read,
+			       st->u.in_delta.buf + st->u.in_delta.used, len);
+			st->u.in_delta.used += len;
+			st->u.in_delta.insert_left -= len;
+			total_read += len;
+		} else if (!left) {
+			break;
+		} else if (next_delta_instruction(st, left)) {
+			error(_("corrupt delta in pack %s"),
+			      st->u.in_delta.pack->pack_name);
+			goto error;
+		}
+	}
+	st->u.in_delta.out += total_read;
+	return total_read;
+
+error:
+	close_deflated_stream(st);
+	st->z_state = z_error;
+	return -1;
+}
+
+static close_method_decl(pack_delta)
+{
+	close_deflated_stream(st);
+	free(st->u.in_delta.base);
+	delete_tempfile(&st->u.in_delta.base_file);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+static int find_delta_base(struct packed_git *p, off_t obj_offset,
+			   off_t *curpos, enum object_type type,
+			   struct object_id *base_oid)
+{
+	struct pack_window *window = NULL;
+	unsigned char *base_info = use_pack(p, &window, *curpos, NULL);
+	int ret = 0;
+
+	oidclr(base_oid);
+	if (type == OBJ_OFS_DELTA) {
+		unsigned used = 0;
+		unsigned char c = base_info[used++];
+		off_t base_offset = c & 127;
+		uint32_t pos;
+
+		while (c & 128) {
+			base_offset += 1;
+			if (!base_offset || MSB(base_offset, 7)) {
+				ret = -1;
+				goto out;
+			}
+			c = base_info[used++];
+			base_offset = (base_offset << 7) + (c & 127);
+		}
+		base_offset = obj_offset - base_offset;
+		if (base_offset <= 0 || base_offset >= obj_offset ||
+		    offset_to_pack_pos(p, base_offset, &pos) < 0) {
+			ret = -1;
+			goto out;
+		}
+		nth_packed_object_oid(base_oid, p, pack_pos_to_index(p, pos));
+		*curpos += used;
+	} else if (type == OBJ_REF_DELTA) {
+		hashcpy(base_oid->hash, base_info);
+		*curpos += the_hash_algo->rawsz;
+	} else
+		ret = -1;
+out:
+	unuse_pack(&window);
+	return ret;
+}
+
+static int load_delta_base(struct git_istream *st,
+			   const struct object_id *base_oid,
+			   enum object_type *type)
+{
+	struct git_istream *base;
+	unsigned long filled = 0;
+	int fd = -1;
+
+	/* the base is not subject to replacement */
+	base = open_istream_1(base_oid, type);
+	if (!base)
+		return -1;
+	st->u.in_delta.base_size = base->size;
+	if (base->size <= big_file_threshold)
+		st->u.in_delta.base = xmallocz(base->size);
+	else {
+		st->u.in_delta.base_file =
+			mks_tempfile_t("git-delta-base-XXXXXX");
+		if (!st->u.in_delta.base_file) {
+			close_istream(base);
+			return error_errno(_("unable to create temporary file"));
+		}
+		fd = get_tempfile_fd(st->u.in_delta.base_file);
+	}
+
+	while (filled < base->size) {
+		char buf[1024 * 16];
+		char *dst = st->u.in_delta.base ? st->u.in_delta.base + filled : buf;
+		size_t len = base->size - filled;
+		ssize_t readlen;
+
+		if (fd >= 0 && sizeof(buf) < len)
+			len = sizeof(buf);
+		readlen = read_istream(base, dst, len);
+		if (readlen <= 0)
+			break;
+		if (fd >= 0 && write_in_full(fd, buf, readlen) < 0) {
+			error_errno(_("unable to write delta base"));
+			break;
+		}
+		filled += readlen;
+	}
+	close_istream(base);
+	return filled == st->u.in_delta.base_size ? 0 : -1;
+}
+
+static open_method_decl(pack_delta)
+{
+	struct packed_git *p = oi->u.packed.pack;
+	struct pack_window *window = NULL;
+	enum object_type in_pack_type, base_type;
+	struct object_id base_oid;
+	unsigned long size;
+
+	memset(&st->u.in_delta, 0, sizeof(st->u.in_delta));
+	st->z_state = z_unused;
+	st->u.in_delta.pack = p;
+	st->u.in_delta.pos = oi->u.packed.offset;
+	in_pack_type = unpack_object_header(p, &window, &st->u.in_delta.pos,
+					    &size);
+	unuse_pack(&window);
+	if (find_delta_base(p, oi->u.packed.offset, &st->u.in_delta.pos,
+			    in_pack_type, &base_oid) ||
+	    load_delta_base(st, &base_oid, &base_type))
+		goto fail;
+
+	memset(&st->z, 0, sizeof(st->z));
+	git_inflate_init(&st->z);
+	st->z_state = z_used;
+	if (delta_hdr_size(st, &size) || size != st->u.in_delta.base_size ||
+	    delta_hdr_size(st, &st->size))
+		goto fail;
+
+	*type = base_type;
+	st->vtbl = &pack_delta_vtbl;
+	return 0;
+
+fail:
+	close_istream_pack_delta(st);
+	return -1;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -8,6 +8,7 @@
 #include "dir.h"
 #include "diff.h"
 #include "commit.h"
+#include "commit-reach.h"
 #include "revision.h"
 #include "run-command.h"
 #include "diffcore.h"
@@ -22,6 +23,7 @@
 #include "worktree.h"
 #include "parse-options.h"
 #include "object-store.h"
+#include "cache-tree.h"
 
 static int config_update_recurse_submodules = RECURSE_SUBMODULES_OFF;
 static struct string_list changed_submodule_names = STRING_LIST_INIT_DUP;
@@ -1359,14 +1361,15 @@ int fetch_populated_submodules(struct repository *r,
 	return spf.result;
 }
 
-unsigned is_submodule_modified(const char *path, int ignore_untracked)
+/*
+ * Set up "cp" to run "git status --porcelain=2" in the submodule at
+ * "path", and return 1; return 0 if the submodule is not checked out.
+ */
+static int prepare_submodule_status(struct child_process *cp,
+				    const char *path, int ignore_untracked)
 {
-	struct child_process cp = CHILD_PROCESS_INIT;
 	struct strbuf buf = STRBUF_INIT;
-	FILE *fp;
-	unsigned dirty_submodule = 0;
 	const char *git_dir;
-	int ignore_cp_exit_code = 0;
 
 	strbuf_addf(&buf, "%s/.git", path);
 	git_dir = read_gitfile(buf.buf);
@@ -1379,48 +1382,73 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 		/* The submodule is not checked out, so it is not modified */
 		return 0;
 	}
-	strbuf_reset(&buf);
+	strbuf_release(&buf);
 
-	argv_array_pushl(&cp.args, "status", "--porcelain=2", NULL);
+	argv_array_pushl(&cp->args, "status", "--porcelain=2", NULL);
 	if (ignore_untracked)
-		argv_array_push(&cp.args, "-uno");
+		argv_array_push(&cp->args, "-uno");
 
-	prepare_submodule_repo_env(&cp.env_array);
-	cp.git_cmd = 1;
-	cp.no_stdin = 1;
+	prepare_submodule_repo_env(&cp->env_array);
+	cp->git_cmd = 1;
+	cp->no_stdin = 1;
+	cp->dir = path;
+	return 1;
+}
+
+/*
+ * Account for a "line" of the output of "git status --porcelain=2" in
+ * a submodule in "dirty_submodule". Return 1 once there is nothing more
+ * to learn from the rest of the output.
+ */
+static int parse_submodule_status(const char *line, size_t len,
+				  unsigned *dirty_submodule,
+				  int ignore_untracked)
+{
+	/* regular untracked files */
+	if (line[0] == '?')
+		*dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
+
+	if (line[0] == 'u' ||
+	    line[0] == '1' ||
+	    line[0] == '2') {
+		/* T = line type, XY = status, SSSS = submodule state */
+		if (len < strlen("T XY SSSS"))
+			BUG("invalid status --porcelain=2 line %s", line);
+
+		if (line[5] == 'S' && line[8] == 'U')
+			/* nested untracked file */
+			*dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
+
+		if (line[0] == 'u' ||
+		    line[0] == '2' ||
+		    memcmp(line + 5, "S..U", 4))
+			/* other change */
+			*dirty_submodule |= DIRTY_SUBMODULE_MODIFIED;
+	}
+
+	return (*dirty_submodule & DIRTY_SUBMODULE_MODIFIED) &&
+	       ((*dirty_submodule & DIRTY_SUBMODULE_UNTRACKED) ||
+		ignore_untracked);
+}
+
+unsigned is_submodule_modified(const char *path, int ignore_untracked)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	FILE *fp;
+	unsigned dirty_submodule = 0;
+	int ignore_cp_exit_code = 0;
+
+	if (!prepare_submodule_status(&cp, path, ignore_untracked))
+		return 0;
 	cp.out = -1;
-	cp.dir = path;
 	if (start_command(&cp))
 		die("Could not run 'git status --porcelain=2' in submodule %s", path);
 
 	fp = xfdopen(cp.out, "r");
 	while (strbuf_getwholeline(&buf, fp, '\n') != EOF) {
-		/* regular untracked files */
-		if (buf.buf[0] == '?')
-			dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
-
-		if (buf.buf[0] == 'u' ||
-		    buf.buf[0] == '1' ||
-		    buf.buf[0] == '2') {
-			/* T = line type, XY = status, SSSS = submodule state */
-			if (buf.len < strlen("T XY SSSS"))
-				BUG("invalid status --porcelain=2 line %s",
-				    buf.buf);
-
-			if (buf.buf[5] == 'S' && buf.buf[8] == 'U')
-				/* nested untracked file */
-				dirty_submodule |= DIRTY_SUBMODULE_UNTRACKED;
-
-			if (buf.buf[0] == 'u' ||
-			    buf.buf[0] == '2' ||
-			    memcmp(buf.buf + 5, "S..U", 4))
-				/* other change */
-				dirty_submodule |= DIRTY_SUBMODULE_MODIFIED;
-		}
-
-		if ((dirty_submodule & DIRTY_SUBMODULE_MODIFIED) &&
-		    ((dirty_submodule & DIRTY_SUBMODULE_UNTRACKED) ||
-		     ignore_untracked)) {
+		if (parse_submodule_status(buf.buf, buf.len, &dirty_submodule,
+					   ignore_untracked)) {
 			/*
 			 * We're not interested in any further information from
 			 * the child any more, neither output nor its exit code.
@@ -1438,40 +1466,141 @@ unsigned is_submodule_modified(const char *path, int ignore_untracked)
 	return dirty_submodule;
 }
 
+struct submodule_status_cb {
+	struct string_list *submodules;
+	int next;
+	const char *failed;
+};
+
+static int get_status_task(struct child_process *cp, struct strbuf *err,
+			   void *data, void **task_cb)
+{
+	struct submodule_status_cb *sps = data;
+
+	while (sps->next < sps->submodules->nr) {
+		struct string_list_item *item =
+			&sps->submodules->items[sps->next++];
+		struct submodule_status *status = item->util;
+
+		if (prepare_submodule_status(cp, item->string,
+					     status->ignore_untracked)) {
+			*task_cb = item;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int status_start_failure(struct strbuf *err, void *data,
+				void *task_cb)
+{
+	struct submodule_status_cb *sps = data;
+	struct string_list_item *item = task_cb;
+
+	sps->failed = item->string;
+	return 1;
+}
+
+static int status_finish(int retvalue, struct strbuf *err, void *data,
+			 void *task_cb)
+{
+	struct submodule_status_cb *sps = data;
+	struct string_list_item *item = task_cb;
+	struct submodule_status *status = item->util;
+	struct strbuf messages = STRBUF_INIT;
+	const char *line = err->buf, *end = err->buf + err->len;
+
+	/*
+	 * The output of the child, which is in "err", is ours to parse
+	 * and not to show, but for its own messages.
+	 */
+	while (line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		size_t len = eol ? eol - line + 1 : end - line;
+
+		if (line[0] && strchr("?!12u", line[0]))
+			parse_submodule_status(line, len,
+					       &status->dirty_submodule,
+					       status->ignore_untracked);
+		else
+			strbuf_add(&messages, line, len);
+		line += len;
+	}
+	strbuf_swap(err, &messages);
+	strbuf_release(&messages);
+
+	if (retvalue && !sps->failed)
+		sps->failed = item->string;
+	return 0;
+}
+
+void get_submodules_status(struct string_list *submodules, int max_jobs)
+{
+	struct submodule_status_cb sps = { submodules, 0, NULL };
+
+	run_processes_parallel_buffered(max_jobs, get_status_task,
+					status_start_failure, status_finish,
+					&sps);
+	if (sps.failed)
+		die("'git status --porcelain=2' failed in submodule %s",
+		    sps.failed);
+}
+
+/*
+ * Set up "subrepo" for the submodule checked out at "path", and read
+ * its index, so that it can be looked into without running a child.
+ * Return -1 if that cannot be done.
+ */
+static int open_submodule_repo(struct repository *subrepo, const char *path)
+{
+	struct strbuf gitdir = STRBUF_INIT;
+	int ret = 0;
+
+	strbuf_addf(&gitdir, "%s/.git", path);
+	if (repo_init(subrepo, gitdir.buf, path))
+		ret = -1;
+	else if (repo_read_index(subrepo) < 0) {
+		repo_clear(subrepo);
+		ret = -1;
+	}
+	strbuf_release(&gitdir);
+	return ret;
+}
+
 int submodule_uses_gitfile(const char *path)
 {
-	struct child_process cp = CHILD_PROCESS_INIT;
-	const char *argv[] = {
-		"submodule",
-		"foreach",
-		"--quiet",
-		"--recursive",
-		"test -f .git",
-		NULL,
-	};
 	struct strbuf buf = STRBUF_INIT;
+	struct repository subrepo;
 	const char *git_dir;
+	int i, ret = 1;
 
 	strbuf_addf(&buf, "%s/.git", path);
 	git_dir = read_gitfile(buf.buf);
-	if (!git_dir) {
+	if (!git_dir || open_submodule_repo(&subrepo, path)) {
 		strbuf_release(&buf);
 		return 0;
 	}
-	strbuf_release(&buf);
 
-	/* Now test that all nested submodules use a gitfile too */
-	cp.argv = argv;
-	prepare_submodule_repo_env(&cp.env_array);
-	cp.git_cmd = 1;
-	cp.no_stdin = 1;
-	cp.no_stderr = 1;
-	cp.no_stdout = 1;
-	cp.dir = path;
-	if (run_command(&cp))
-		return 0;
+	/*
+	 * Now test that all nested submodules that are checked out use a
+	 * gitfile too, as "git submodule foreach --recursive" would.
+	 */
+	for (i = 0; ret && i < subrepo.index->cache_nr; i++) {
+		const struct cache_entry *ce = subrepo.index->cache[i];
 
-	return 1;
+		if (!S_ISGITLINK(ce->ce_mode) || ce_stage(ce))
+			continue;
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%s/%s/.git", path, ce->name);
+		if (!resolve_gitdir(buf.buf))
+			continue;
+		strbuf_setlen(&buf, buf.len - strlen("/.git"));
+		ret = submodule_uses_gitfile(buf.buf);
+	}
+
+	repo_clear(&subrepo);
+	strbuf_release(&buf);
+	return ret;
 }
 
 /*
@@ -1554,9 +1683,41 @@ static const char *get_super_prefix_or_empty(void)
 	return s;
 }
 
+/*
+ * Whether the index of "subrepo", checked out at "path", is known to
+ * match its HEAD, which is the case if its cache-tree is valid and has
+ * the tree of HEAD.
+ */
+static int submodule_index_matches_head(struct repository *subrepo,
+					const char *path)
+{
+	struct cache_tree *ct = subrepo->index->cache_tree;
+	struct object_id head;
+	struct commit *commit;
+
+	if (!ct || ct->entry_count != subrepo->index->cache_nr)
+		return 0;
+	if (refs_read_ref_full(get_main_ref_store(subrepo), "HEAD",
+			       RESOLVE_REF_READING, &head, NULL))
+		return 0;
+	if (add_submodule_odb(path))
+		return 0;
+	commit = lookup_commit_reference(&head);
+	return commit && !oidcmp(get_commit_tree_oid(commit), &ct->oid);
+}
+
 static int submodule_has_dirty_index(const struct submodule *sub)
 {
 	struct child_process cp = CHILD_PROCESS_INIT;
+	struct repository subrepo;
+
+	if (!open_submodule_repo(&subrepo, sub->path)) {
+		int clean = submodule_index_matches_head(&subrepo, sub->path);
+
+		repo_clear(&subrepo);
+		if (clean)
+			return 0;
+	}
 
 	prepare_submodule_repo_env(&cp.env_array);
 
@@ -1572,6 +1733,29 @@ static int submodule_has_dirty_index(const struct submodule *sub)
 	return finish_command(&cp);
 }
 
+/*
+ * Whether "git read-tree -n -m <commit> <commit>", i.e. keeping the
+ * submodule at "path" where it is, is known to succeed: it leaves the
+ * index alone, unless it has unmerged entries or nested submodules to
+ * recurse into.
+ */
+static int submodule_stays_put(const char *path)
+{
+	struct repository subrepo;
+	int i, ret = 1;
+
+	if (open_submodule_repo(&subrepo, path))
+		return 0;
+	for (i = 0; ret && i < subrepo.index->cache_nr; i++) {
+		const struct cache_entry *ce = subrepo.index->cache[i];
+
+		if (ce_stage(ce) || S_ISGITLINK(ce->ce_mode))
+			ret = 0;
+	}
+	repo_clear(&subrepo);
+	return ret;
+}
+
 static void submodule_reset_index(const char *path)
 {
 	struct child_process cp = CHILD_PROCESS_INIT;
@@ -1633,6 +1817,12 @@ int submodule_move_head(const char *path,
 			return error(_("submodule '%s' has dirty index"), path);
 	}
 
+	if ((flags & SUBMODULE_MOVE_HEAD_DRY_RUN) &&
+	    !(flags & SUBMODULE_MOVE_HEAD_FORCE) &&
+	    old_head && new_head && !strcmp(old_head, new_head) &&
+	    submodule_stays_put(path))
+		return 0;
+
 	if (!(flags & SUBMODULE_MOVE_HEAD_DRY_RUN)) {
 		if (old_head) {
 			if (!submodule_uses_gitfile(path))
@@ -6,6 +6,7 @@ struct diff_options;
 struct argv_array;
 struct oid_array;
 struct remote;
+struct string_list;
 
 enum {
 	RECURSE_SUBMODULES_ONLY = -5,
@@ -83,6 +84,19 @@ extern int fetch_populated_submodules(struct repository *r,
 				      int default_option,
 				      int quiet, int max_parallel_jobs);
 extern unsigned is_submodule_modified(const char *path, int ignore_untracked);
+
+/*
+ * Find out how the submodules at the paths of "submodules" are
+ * modified, like is_submodule_modified() does, running up to
+ * "max_jobs" of them at a time. The util field of each item points to
+ * a submodule_status, whose ignore_untracked the caller fills in.
+ */
+struct submodule_status {
+	unsigned ignore_untracked : 1;
+	unsigned dirty_submodule;
+};
+extern void get_submodules_status(struct string_list *submodules,
+				  int max_jobs);
 extern int submodule_uses_gitfile(const char *path);
 
 #define SUBMODULE_REMOVAL_DIE_ON_ERROR (1<<0)
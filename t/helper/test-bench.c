@@ -0,0 +1,468 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "hashmap.h"
+#include "oidmap.h"
+#include "oidset.h"
+#include "prio-queue.h"
+#include "mergesort.h"
+#include "object.h"
+#include "blob.h"
+#include "ewah/ewok.h"
+
+/*
+ * Each workload runs its phases over "nr" elements and reports, for each
+ * phase, the time and the allocations through xmalloc() and friends per
+ * element. The elements are made up from their index, so that no phase
+ * pays for more than the data structure itself.
+ */
+
+static uint64_t start_time;
+static struct alloc_counter allocs, start_allocs;
+
+static void begin(void)
+{
+	start_allocs = allocs;
+	start_time = getnanotime();
+}
+
+static void end(const char *workload, const char *phase, size_t nr)
+{
+	uint64_t ns = getnanotime() - start_time;
+
+	printf("%-14s %-9s %10"PRIuMAX" %12.1f ns/op %9.3f allocs/op %9.1f bytes/op\n",
+	       workload, phase, (uintmax_t)nr, (double)ns / nr,
+	       (double)(allocs.nr - start_allocs.nr) / nr,
+	       (double)(allocs.bytes - start_allocs.bytes) / nr);
+}
+
+/* splitmix64, to make up keys which are all different from an index */
+static uint64_t mix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* the i-th object name, or with "miss" one which is never among them */
+static void make_oid(struct object_id *oid, size_t i, int miss)
+{
+	uint64_t words[(GIT_MAX_RAWSZ + 7) / 8];
+	size_t j;
+
+	for (j = 0; j < ARRAY_SIZE(words); j++)
+		words[j] = mix(2 * (i * ARRAY_SIZE(words) + j) + !!miss);
+	memset(oid, 0, sizeof(*oid));
+	memcpy(oid->hash, words, the_hash_algo->rawsz);
+}
+
+static void check(int ok, const char *workload, const char *phase)
+{
+	if (!ok)
+		die("%s: %s gave a wrong answer", workload, phase);
+}
+
+struct int_entry {
+	struct hashmap_entry ent;
+	uint64_t key;
+};
+
+static int int_entry_cmp(const void *unused_cmp_data,
+			 const void *entry, const void *entry_or_key,
+			 const void *unused_keydata)
+{
+	const struct int_entry *a = entry, *b = entry_or_key;
+	return a->key != b->key;
+}
+
+static void bench_hashmap(size_t nr)
+{
+	struct int_entry *entries, key;
+	struct hashmap map;
+	struct hashmap_iter iter;
+	size_t i, found = 0;
+
+	entries = xcalloc(nr, sizeof(*entries));
+	for (i = 0; i < nr; i++) {
+		entries[i].key = mix(2 * i);
+		hashmap_entry_init(&entries[i], (unsigned int)entries[i].key);
+	}
+
+	begin();
+	hashmap_init(&map, int_entry_cmp, NULL, 0);
+	for (i = 0; i < nr; i++)
+		hashmap_add(&map, &entries[i]);
+	end("hashmap", "insert", nr);
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		key.key = mix(2 * i);
+		hashmap_entry_init(&key, (unsigned int)key.key);
+		found += !!hashmap_get(&map, &key, NULL);
+	}
+	end("hashmap", "lookup", nr);
+	check(found == nr, "hashmap", "lookup");
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		key.key = mix(2 * i + 1);
+		hashmap_entry_init(&key, (unsigned int)key.key);
+		found -= !hashmap_get(&map, &key, NULL);
+	}
+	end("hashmap", "miss", nr);
+	check(found == 0, "hashmap", "miss");
+
+	begin();
+	hashmap_iter_init(&map, &iter);
+	while (hashmap_iter_next(&iter))
+		found++;
+	end("hashmap", "iterate", nr);
+	check(found == nr, "hashmap", "iterate");
+
+	begin();
+	for (i = 0; i < nr; i++)
+		hashmap_remove(&map, &entries[i], NULL);
+	hashmap_free(&map, 0);
+	end("hashmap", "remove", nr);
+
+	free(entries);
+}
+
+static void bench_oidmap(size_t nr)
+{
+	struct oidmap_entry *entries;
+	struct oidmap map = OIDMAP_INIT;
+	struct oidmap_iter iter;
+	struct object_id oid;
+	size_t i, found = 0;
+
+	entries = xcalloc(nr, sizeof(*entries));
+	for (i = 0; i < nr; i++)
+		make_oid(&entries[i].oid, i, 0);
+
+	begin();
+	oidmap_init(&map, 0);
+	for (i = 0; i < nr; i++)
+		oidmap_put(&map, &entries[i]);
+	end("oidmap", "insert", nr);
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		make_oid(&oid, i, 0);
+		found += !!oidmap_get(&map, &oid);
+	}
+	end("oidmap", "lookup", nr);
+	check(found == nr, "oidmap", "lookup");
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		make_oid(&oid, i, 1);
+		found -= !oidmap_get(&map, &oid);
+	}
+	end("oidmap", "miss", nr);
+	check(found == 0, "oidmap", "miss");
+
+	begin();
+	oidmap_iter_init(&map, &iter);
+	while (oidmap_iter_next(&iter))
+		found++;
+	end("oidmap", "iterate", nr);
+	check(found == nr, "oidmap", "iterate");
+
+	begin();
+	for (i = 0; i < nr; i++)
+		oidmap_remove(&map, &entries[i].oid);
+	oidmap_free(&map, 0);
+	end("oidmap", "remove", nr);
+
+	free(entries);
+}
+
+static void bench_oidset(size_t nr)
+{
+	struct oidset set = OIDSET_INIT;
+	struct oidset_iter iter;
+	struct object_id oid;
+	size_t i, found = 0;
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		make_oid(&oid, i, 0);
+		oidset_insert(&set, &oid);
+	}
+	end("oidset", "insert", nr);
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		make_oid(&oid, i, 0);
+		found += oidset_contains(&set, &oid);
+	}
+	end("oidset", "lookup", nr);
+	check(found == nr, "oidset", "lookup");
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		make_oid(&oid, i, 1);
+		found -= !oidset_contains(&set, &oid);
+	}
+	end("oidset", "miss", nr);
+	check(found == 0, "oidset", "miss");
+
+	begin();
+	oidset_iter_init(&set, &iter);
+	while (oidset_iter_next(&iter))
+		found++;
+	end("oidset", "iterate", nr);
+	check(found == nr, "oidset", "iterate");
+
+	begin();
+	oidset_clear(&set);
+	end("oidset", "clear", nr);
+}
+
+static int uint64_cmp(const void *va, const void *vb, void *data)
+{
+	const uint64_t *a = va, *b = vb;
+	return *a < *b ? -1 : *a > *b;
+}
+
+static void bench_prio_queue(size_t nr)
+{
+	struct prio_queue queue = { uint64_cmp };
+	uint64_t *keys, prev = 0;
+	size_t i;
+
+	ALLOC_ARRAY(keys, nr);
+	for (i = 0; i < nr; i++)
+		keys[i] = mix(i);
+
+	begin();
+	for (i = 0; i < nr; i++)
+		prio_queue_put(&queue, &keys[i]);
+	end("prio-queue", "put", nr);
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		uint64_t *key = prio_queue_get(&queue);
+		check(key && *key >= prev, "prio-queue", "get");
+		prev = *key;
+	}
+	end("prio-queue", "get", nr);
+
+	clear_prio_queue(&queue);
+	free(keys);
+}
+
+struct node {
+	uint64_t key;
+	struct node *next;
+};
+
+static void *node_get_next(const void *a)
+{
+	return ((const struct node *)a)->next;
+}
+
+static void node_set_next(void *a, void *b)
+{
+	((struct node *)a)->next = b;
+}
+
+static int node_cmp(const void *va, const void *vb)
+{
+	const struct node *a = va, *b = vb;
+	return a->key < b->key ? -1 : a->key > b->key;
+}
+
+static void check_sorted(struct node *list, size_t nr)
+{
+	size_t n = 0;
+
+	for (; list; list = list->next, n++)
+		check(!list->next || list->key <= list->next->key,
+		      "mergesort", "sort");
+	check(n == nr, "mergesort", "sort");
+}
+
+static void bench_mergesort(size_t nr)
+{
+	struct node *nodes, *list = NULL;
+	size_t i;
+
+	ALLOC_ARRAY(nodes, nr);
+	for (i = 0; i < nr; i++) {
+		nodes[i].key = mix(i);
+		nodes[i].next = list;
+		list = &nodes[i];
+	}
+
+	begin();
+	list = llist_mergesort(list, node_get_next, node_set_next, node_cmp);
+	end("mergesort", "random", nr);
+	check_sorted(list, nr);
+
+	begin();
+	list = llist_mergesort(list, node_get_next, node_set_next, node_cmp);
+	end("mergesort", "sorted", nr);
+	check_sorted(list, nr);
+
+	free(nodes);
+}
+
+static void bench_strbuf(size_t nr)
+{
+	struct strbuf sb = STRBUF_INIT;
+	size_t i;
+
+	begin();
+	for (i = 0; i < nr; i++)
+		strbuf_addch(&sb, 'a' + i % 26);
+	end("strbuf", "addch", nr);
+	check(sb.len == nr, "strbuf", "addch");
+	strbuf_release(&sb);
+
+	begin();
+	for (i = 0; i < nr; i++)
+		strbuf_addstr(&sb, "0123456789abcdef");
+	end("strbuf", "addstr", nr);
+	check(sb.len == 16 * nr, "strbuf", "addstr");
+	strbuf_release(&sb);
+
+	begin();
+	for (i = 0; i < nr; i++)
+		strbuf_addf(&sb, "%08"PRIxMAX, (uintmax_t)(i & 0xffffffff));
+	end("strbuf", "addf", nr);
+	check(sb.len == 8 * nr, "strbuf", "addf");
+	strbuf_release(&sb);
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		strbuf_reset(&sb);
+		strbuf_addstr(&sb, "refs/heads/");
+		strbuf_addch(&sb, 'a' + i % 26);
+	}
+	end("strbuf", "reuse", nr);
+	strbuf_release(&sb);
+}
+
+static void count_bit(size_t pos, void *payload)
+{
+	(*(size_t *)payload)++;
+}
+
+static void bench_ewah(size_t nr)
+{
+	struct ewah_bitmap *ewah;
+	struct bitmap *bitmap;
+	size_t i, pos = 0, found = 0;
+
+	begin();
+	ewah = ewah_new();
+	for (i = 0; i < nr; i++) {
+		/* runs of neighbours and gaps, as in a pack bitmap */
+		pos += (mix(i) & 7) ? 1 : 1 + mix(i) % 4096;
+		ewah_set(ewah, pos);
+	}
+	end("ewah", "set", nr);
+
+	begin();
+	ewah_each_bit(ewah, count_bit, &found);
+	end("ewah", "iterate", nr);
+	check(found == nr, "ewah", "iterate");
+
+	begin();
+	bitmap = ewah_to_bitmap(ewah);
+	end("ewah", "to-bitmap", nr);
+	check(bitmap_popcount(bitmap) == nr, "ewah", "to-bitmap");
+
+	bitmap_free(bitmap);
+	ewah_free(ewah);
+}
+
+static void bench_lookup_object(size_t nr)
+{
+	struct object_id oid;
+	size_t i, found = 0;
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		make_oid(&oid, i, 0);
+		lookup_blob(&oid);
+	}
+	end("lookup-object", "insert", nr);
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		make_oid(&oid, i, 0);
+		found += !!lookup_object(oid.hash);
+	}
+	end("lookup-object", "lookup", nr);
+	check(found == nr, "lookup-object", "lookup");
+
+	begin();
+	for (i = 0; i < nr; i++) {
+		make_oid(&oid, i, 1);
+		found -= !lookup_object(oid.hash);
+	}
+	end("lookup-object", "miss", nr);
+	check(found == 0, "lookup-object", "miss");
+}
+
+static struct workload {
+	const char *name;
+	void (*fn)(size_t nr);
+} workloads[] = {
+	{ "hashmap", bench_hashmap },
+	{ "oidmap", bench_oidmap },
+	{ "oidset", bench_oidset },
+	{ "prio-queue", bench_prio_queue },
+	{ "mergesort", bench_mergesort },
+	{ "strbuf", bench_strbuf },
+	{ "ewah", bench_ewah },
+	{ "lookup-object", bench_lookup_object },
+};
+
+static size_t parse_nr(const char *arg)
+{
+	char *end;
+	double nr = strtod(arg, &end);
+
+	if (*end || nr < 1 || nr > (double)maximum_unsigned_value_of_type(size_t))
+		die("not a number of elements: %s", arg);
+	return (size_t)nr;
+}
+
+/*
+ * test-tool bench (<workload> | all) [<nr>]
+ *	runs the workload, or all of them, over <nr> elements (a million
+ *	by default, which may be written as 1e6)
+ * test-tool bench list
+ *	lists the workloads
+ */
+int cmd__bench(int argc, const char **argv)
+{
+	size_t nr = 1000000;
+	int i, ran = 0;
+
+	if (argc == 2 && !strcmp(argv[1], "list")) {
+		for (i = 0; i < ARRAY_SIZE(workloads); i++)
+			puts(workloads[i].name);
+		return 0;
+	}
+	if (argc < 2 || argc > 3)
+		die("usage: test-tool bench (<workload> | all) [<nr>]");
+	if (argc == 3)
+		nr = parse_nr(argv[2]);
+
+	set_alloc_counter(&allocs);
+	for (i = 0; i < ARRAY_SIZE(workloads); i++) {
+		if (strcmp(argv[1], "all") && strcmp(argv[1], workloads[i].name))
+			continue;
+		workloads[i].fn(nr);
+		ran = 1;
+	}
+	set_alloc_counter(NULL);
+	if (!ran)
+		die("unknown workload: %s", argv[1]);
+	return 0;
+}
@@ -0,0 +1,41 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "compact-oidset.h"
+
+int cmd__compact_oidset(int argc, const char **argv)
+{
+	struct compact_oidset set = COMPACT_OIDSET_INIT;
+	struct strbuf line = STRBUF_INIT;
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		const char *arg;
+		struct object_id oid;
+
+		if (skip_prefix(line.buf, "insert ", &arg)) {
+			if (get_oid_hex(arg, &oid))
+				die("not a hexadecimal SHA1: %s", arg);
+			printf("%d\n", compact_oidset_insert(&set, &oid));
+		} else if (skip_prefix(line.buf, "contains ", &arg)) {
+			if (get_oid_hex(arg, &oid))
+				die("not a hexadecimal SHA1: %s", arg);
+			printf("%d\n", compact_oidset_contains(&set, &oid));
+		} else if (skip_prefix(line.buf, "remove ", &arg)) {
+			if (get_oid_hex(arg, &oid))
+				die("not a hexadecimal SHA1: %s", arg);
+			printf("%d\n", compact_oidset_remove(&set, &oid));
+		} else if (!strcmp(line.buf, "iterate")) {
+			struct compact_oidset_iter iter;
+			const struct object_id *p;
+
+			compact_oidset_iter_init(&set, &iter);
+			while ((p = compact_oidset_iter_next(&iter)))
+				puts(oid_to_hex(p));
+		} else if (!strcmp(line.buf, "clear"))
+			compact_oidset_clear(&set);
+		else
+			die("unknown command: %s", line.buf);
+	}
+	strbuf_release(&line);
+	compact_oidset_clear(&set);
+	return 0;
+}
@@ -0,0 +1,240 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "ewah/ewok.h"
+
+static uint64_t rand_state;
+
+static uint64_t next_rand(void)
+{
+	/* xorshift64, good enough to make up bitmaps */
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return rand_state;
+}
+
+/*
+ * Make up a bitmap of "nr" words, as plain words and compressed, out of
+ * runs of zeroes, runs of ones and literal words. "runs" is the chance
+ * in 8 that the next stretch is a run.
+ */
+static struct ewah_bitmap *make_bitmap(eword_t *words, size_t nr, int runs)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	size_t i = 0;
+
+	while (i < nr) {
+		size_t len = 1 + next_rand() % 64;
+
+		if (len > nr - i)
+			len = nr - i;
+		if ((int)(next_rand() % 8) < runs) {
+			int v = next_rand() % 2;
+
+			memset(words + i, v ? 0xff : 0, len * sizeof(eword_t));
+			ewah_add_empty_words(ewah, v, len);
+		} else {
+			size_t j;
+
+			for (j = 0; j < len; j++) {
+				words[i + j] = next_rand() & next_rand();
+				ewah_add(ewah, words[i + j]);
+			}
+		}
+		i += len;
+	}
+	return ewah;
+}
+
+/* The word at a time versions, to compare with */
+static void ref_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t i = 0;
+
+	ewah_iterator_init(&it, other);
+	while (ewah_iterator_next(&word, &it))
+		self->words[i++] |= word;
+}
+
+static size_t ref_and_ewah_popcount(struct bitmap *self,
+				    struct ewah_bitmap *mask)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t i = 0, count = 0;
+
+	ewah_iterator_init(&it, mask);
+	while (i < self->word_alloc && ewah_iterator_next(&word, &it))
+		count += ewah_bit_popcount64(self->words[i++] & word);
+	return count;
+}
+
+static struct bitmap *copy_words(const eword_t *words, size_t nr)
+{
+	struct bitmap *bitmap = xmalloc(sizeof(*bitmap));
+
+	bitmap->word_alloc = nr;
+	ALLOC_ARRAY(bitmap->words, nr);
+	COPY_ARRAY(bitmap->words, words, nr);
+	return bitmap;
+}
+
+static void verify(size_t nr, int runs)
+{
+	eword_t *a_words, *b_words;
+	struct ewah_bitmap *a, *b;
+	struct bitmap *x, *y;
+	struct ewah_iterator it;
+	eword_t word;
+	size_t i, count = 0;
+
+	ALLOC_ARRAY(a_words, nr);
+	ALLOC_ARRAY(b_words, nr);
+	a = make_bitmap(a_words, nr, runs);
+	b = make_bitmap(b_words, nr, runs);
+
+	x = ewah_to_bitmap(a);
+	if (x->word_alloc != nr || memcmp(x->words, a_words, nr * sizeof(eword_t)))
+		die("ewah_to_bitmap differs (%"PRIuMAX" words, runs %d)",
+		    (uintmax_t)nr, runs);
+	for (i = 0; i < nr; i++)
+		count += ewah_bit_popcount64(a_words[i]);
+	if (bitmap_popcount(x) != count)
+		die("bitmap_popcount differs");
+
+	y = copy_words(a_words, nr);
+	bitmap_or_ewah(x, b);
+	ref_or_ewah(y, b);
+	for (i = 0; i < nr; i++)
+		if (x->words[i] != (a_words[i] | b_words[i]) ||
+		    y->words[i] != x->words[i])
+			die("bitmap_or_ewah differs at word %"PRIuMAX,
+			    (uintmax_t)i);
+
+	bitmap_free(x);
+	x = copy_words(a_words, nr);
+	if (bitmap_and_ewah_popcount(x, b) != ref_and_ewah_popcount(x, b))
+		die("bitmap_and_ewah_popcount differs");
+
+	ewah_iterator_init(&it, b);
+	for (i = 0; ; i++) {
+		i += ewah_iterator_skip_zeroes(&it);
+		if (!ewah_iterator_next(&word, &it))
+			break;
+		if (i >= nr || word != b_words[i])
+			die("ewah_iterator_skip_zeroes lost its place");
+	}
+	if (i > nr)
+		die("ewah_iterator_skip_zeroes went too far");
+
+	bitmap_free(x);
+	bitmap_free(y);
+	ewah_free(a);
+	ewah_free(b);
+	free(a_words);
+	free(b_words);
+}
+
+static void report(const char *what, uint64_t start, int rounds)
+{
+	printf("%-24s %10.3f ms\n", what,
+	       (getnanotime() - start) / 1e6 / rounds);
+}
+
+static void speed(size_t nr, int runs, int rounds)
+{
+	eword_t *a_words, *b_words;
+	struct ewah_bitmap *a, *b;
+	struct bitmap *x;
+	uint64_t start;
+	size_t sum = 0;
+	int i;
+
+	ALLOC_ARRAY(a_words, nr);
+	ALLOC_ARRAY(b_words, nr);
+	a = make_bitmap(a_words, nr, runs);
+	b = make_bitmap(b_words, nr, runs);
+	x = copy_words(a_words, nr);
+
+	printf("%"PRIuMAX" words, runs %d in 8\n", (uintmax_t)nr, runs);
+
+	start = getnanotime();
+	for (i = 0; i < rounds; i++)
+		bitmap_or_ewah(x, b);
+	report("or-ewah", start, rounds);
+
+	start = getnanotime();
+	for (i = 0; i < rounds; i++)
+		ref_or_ewah(x, b);
+	report("or-ewah (iterator)", start, rounds);
+
+	start = getnanotime();
+	for (i = 0; i < rounds; i++)
+		sum += bitmap_and_ewah_popcount(x, a);
+	report("and-ewah-popcount", start, rounds);
+
+	start = getnanotime();
+	for (i = 0; i < rounds; i++)
+		sum += ref_and_ewah_popcount(x, a);
+	report("and-ewah-popcount (iter)", start, rounds);
+
+	start = getnanotime();
+	for (i = 0; i < rounds; i++) {
+		struct bitmap *y = ewah_to_bitmap(a);
+		sum += y->word_alloc;
+		bitmap_free(y);
+	}
+	report("ewah-to-bitmap", start, rounds);
+
+	start = getnanotime();
+	for (i = 0; i < rounds; i++)
+		sum += bitmap_popcount(x);
+	report("popcount", start, rounds);
+
+	/* keep the compiler from dropping the loops above */
+	if (!sum)
+		printf("nothing counted\n");
+
+	bitmap_free(x);
+	ewah_free(a);
+	ewah_free(b);
+	free(a_words);
+	free(b_words);
+}
+
+/*
+ * test-tool ewah verify
+ *	compares the bitmap kernels with the word at a time versions,
+ *	and checks that skipping zeroes keeps iterators in place
+ * test-tool ewah speed [<words> [<rounds>]]
+ *	times them on made up bitmaps
+ */
+int cmd__ewah(int argc, const char **argv)
+{
+	int runs;
+
+	rand_state = 0x9e3779b97f4a7c15ULL;
+	if (argc == 2 && !strcmp(argv[1], "verify")) {
+		size_t sizes[] = { 1, 2, 63, 64, 65, 1000, 100000 };
+		size_t i;
+
+		for (runs = 0; runs <= 8; runs += 2)
+			for (i = 0; i < ARRAY_SIZE(sizes); i++)
+				verify(sizes[i], runs);
+		printf("ok\n");
+		return 0;
+	}
+	if (argc >= 2 && argc <= 4 && !strcmp(argv[1], "speed")) {
+		size_t nr = argc > 2 ? strtoul(argv[2], NULL, 10) : 1 << 20;
+		int rounds = argc > 3 ? atoi(argv[3]) : 20;
+
+		if (!nr || rounds <= 0)
+			die("usage: test-tool ewah speed [<words> [<rounds>]]");
+		for (runs = 0; runs <= 8; runs += 4)
+			speed(nr, runs, rounds);
+		return 0;
+	}
+	die("usage: test-tool ewah (verify | speed [<words> [<rounds>]])");
+}
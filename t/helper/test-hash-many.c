@@ -0,0 +1,64 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "strbuf.h"
+
+/*
+ * Read paths from stdin, and print the hashes of the contents of the
+ * files, or with --blob their object names as blobs, all hashed
+ * together with the_hash_algo->many_fn().
+ */
+int cmd__hash_many(int ac, const char **av)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct git_hash_msg *msgs = NULL;
+	struct strbuf *bufs = NULL;
+	unsigned char (*hashes)[GIT_MAX_RAWSZ] = NULL;
+	char (*hdrs)[32] = NULL;
+	size_t nr = 0, alloc = 0, i;
+	int blob = 0;
+
+	if (ac == 2 && !strcmp(av[1], "--blob"))
+		blob = 1;
+	else if (ac != 1)
+		die("usage: test-tool hash-many [--blob] <paths");
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		size_t old_alloc = alloc;
+
+		ALLOC_GROW(msgs, nr + 1, alloc);
+		if (alloc != old_alloc) {
+			REALLOC_ARRAY(bufs, alloc);
+			REALLOC_ARRAY(hashes, alloc);
+			REALLOC_ARRAY(hdrs, alloc);
+		}
+		strbuf_init(&bufs[nr], 0);
+		if (strbuf_read_file(&bufs[nr], line.buf, 0) < 0)
+			die_errno("unable to read '%s'", line.buf);
+		msgs[nr].hdrlen = 0;
+		if (blob)
+			msgs[nr].hdrlen = xsnprintf(hdrs[nr], sizeof(hdrs[nr]),
+						    "blob %"PRIuMAX,
+						    (uintmax_t)bufs[nr].len) + 1;
+		msgs[nr].buf = bufs[nr].buf;
+		msgs[nr].len = bufs[nr].len;
+		nr++;
+	}
+	/* the arrays may have moved while growing */
+	for (i = 0; i < nr; i++) {
+		msgs[i].hdr = hdrs[i];
+		msgs[i].hash = hashes[i];
+	}
+
+	the_hash_algo->many_fn(msgs, nr);
+
+	for (i = 0; i < nr; i++) {
+		puts(sha1_to_hex(hashes[i]));
+		strbuf_release(&bufs[i]);
+	}
+	free(msgs);
+	free(bufs);
+	free(hashes);
+	free(hdrs);
+	strbuf_release(&line);
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include "test-tool.h"
+#include "cache.h"
+
+#define NUM_SECONDS 3
+
+/* How many messages --many hashes with each call to many_fn() */
+#define NUM_MANY 32
+
+static inline void compute_hash(const struct git_hash_algo *algo, git_hash_ctx *ctx, uint8_t *final, const void *p, size_t len)
+{
+	algo->init_fn(ctx);
+	algo->update_fn(ctx, p, len);
+	algo->final_fn(final, ctx);
+}
+
+/*
+ * Hash buffers of growing sizes over and over for a few seconds each,
+ * and print the throughput of the given algorithm on each size. With
+ * --many, hash them NUM_MANY at a time with the many_fn() of the
+ * algorithm.
+ */
+int cmd__hash_speed(int ac, const char **av)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct git_hash_msg msgs[NUM_MANY];
+	unsigned char hashes[NUM_MANY][GIT_MAX_RAWSZ];
+	clock_t initial, start, end;
+	unsigned bufsizes[] = { 64, 256, 1024, 8192, 16384, 1048576 };
+	int i, k, many = 0;
+	void *p;
+	const struct git_hash_algo *algo = NULL;
+
+	if (ac == 3 && !strcmp(av[1], "--many")) {
+		many = 1;
+		ac--;
+		av++;
+	}
+	if (ac == 2) {
+		for (i = 1; i < GIT_HASH_NALGOS; i++) {
+			if (!strcmp(av[1], hash_algos[i].name)) {
+				algo = &hash_algos[i];
+				break;
+			}
+		}
+	}
+	if (!algo)
+		die("usage: test-tool hash-speed [--many] algo_name");
+
+	/* Use this as an offset to make overflow less likely. */
+	initial = clock();
+
+	printf("algo: %s%s\n", algo->name, many ? " (many)" : "");
+
+	for (i = 0; i < ARRAY_SIZE(bufsizes); i++) {
+		unsigned long j, kb;
+		double kb_per_sec;
+		p = xcalloc(1, bufsizes[i]);
+		for (k = 0; k < NUM_MANY; k++) {
+			msgs[k].hdr = NULL;
+			msgs[k].hdrlen = 0;
+			msgs[k].buf = p;
+			msgs[k].len = bufsizes[i];
+			msgs[k].hash = hashes[k];
+		}
+		start = end = clock() - initial;
+		for (j = 0; ((end - start) / CLOCKS_PER_SEC) < NUM_SECONDS; j++) {
+			if (many) {
+				algo->many_fn(msgs, NUM_MANY);
+				j += NUM_MANY - 1;
+			} else
+				compute_hash(algo, &ctx, hash, p, bufsizes[i]);
+
+			/*
+			 * Only check elapsed time every 128 iterations to avoid
+			 * dominating the runtime with system calls.
+			 */
+			if (!(j & 127) || many || bufsizes[i] >= 65536)
+				end = clock() - initial;
+		}
+		kb = j * bufsizes[i] / 1024;
+		kb_per_sec = kb / (((double)end - start) / CLOCKS_PER_SEC);
+		printf("size %u: %lu iters; %lu KiB; %0.2f KiB/s\n", bufsizes[i], j, kb, kb_per_sec);
+		free(p);
+	}
+
+	exit(0);
+}
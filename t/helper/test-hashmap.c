@@ -1,6 +1,7 @@
 #include "test-tool.h"
 #include "git-compat-util.h"
 #include "hashmap.h"
+#include "flat-hashmap.h"
 #include "strbuf.h"
 
 struct test_entry
@@ -43,6 +44,97 @@ static struct test_entry *alloc_test_entry(unsigned int hash,
 	return entry;
 }
 
+/*
+ * With "flat", the commands below use a flat_hashmap instead of a
+ * hashmap; these wrappers pick the one in use.
+ */
+static int use_flat;
+
+struct test_map {
+	struct hashmap map;
+	struct flat_hashmap flat;
+};
+
+static void map_init(struct test_map *m, const void *cmp_data)
+{
+	if (use_flat)
+		flat_hashmap_init(&m->flat, test_entry_cmp, cmp_data, 0);
+	else
+		hashmap_init(&m->map, test_entry_cmp, cmp_data, 0);
+}
+
+static void map_free(struct test_map *m, int free_entries)
+{
+	if (use_flat)
+		flat_hashmap_free(&m->flat, free_entries);
+	else
+		hashmap_free(&m->map, free_entries);
+}
+
+static void map_add(struct test_map *m, struct test_entry *entry)
+{
+	if (use_flat)
+		flat_hashmap_add(&m->flat, entry);
+	else
+		hashmap_add(&m->map, entry);
+}
+
+static struct test_entry *map_put(struct test_map *m, struct test_entry *entry)
+{
+	return use_flat ? flat_hashmap_put(&m->flat, entry) :
+			  hashmap_put(&m->map, entry);
+}
+
+static struct test_entry *map_get_from_hash(struct test_map *m,
+					    unsigned int hash,
+					    const char *key)
+{
+	return use_flat ? flat_hashmap_get_from_hash(&m->flat, hash, key) :
+			  hashmap_get_from_hash(&m->map, hash, key);
+}
+
+static struct test_entry *map_get_next(struct test_map *m,
+				       struct test_entry *entry)
+{
+	return use_flat ? flat_hashmap_get_next(&m->flat, entry) :
+			  hashmap_get_next(&m->map, entry);
+}
+
+static struct test_entry *map_remove(struct test_map *m,
+				     struct hashmap_entry *key,
+				     const char *keydata)
+{
+	return use_flat ? flat_hashmap_remove(&m->flat, key, keydata) :
+			  hashmap_remove(&m->map, key, keydata);
+}
+
+static void map_iterate(struct test_map *m)
+{
+	struct test_entry *entry;
+
+	if (use_flat) {
+		struct flat_hashmap_iter iter;
+		flat_hashmap_iter_init(&m->flat, &iter);
+		while ((entry = flat_hashmap_iter_next(&iter)))
+			printf("%s %s\n", entry->key, get_value(entry));
+	} else {
+		struct hashmap_iter iter;
+		hashmap_iter_init(&m->map, &iter);
+		while ((entry = hashmap_iter_next(&iter)))
+			printf("%s %s\n", entry->key, get_value(entry));
+	}
+}
+
+static void map_print_size(struct test_map *m)
+{
+	if (use_flat)
+		printf("%u %u\n", m->flat.tablesize,
+		       flat_hashmap_get_size(&m->flat));
+	else
+		printf("%u %u\n", m->map.tablesize,
+		       hashmap_get_size(&m->map));
+}
+
 #define HASH_METHOD_FNV 0
 #define HASH_METHOD_I 1
 #define HASH_METHOD_IDIV10 2
@@ -77,12 +169,12 @@ static unsigned int hash(unsigned int method, unsigned int i, const char *key)
 }
 
 /*
- * Test performance of hashmap.[ch]
- * Usage: time echo "perfhashmap method rounds" | test-tool hashmap
+ * Test performance of hashmap.[ch] (or flat-hashmap.[ch])
+ * Usage: time echo "perfhashmap method rounds" | test-tool hashmap [flat]
  */
 static void perf_hashmap(unsigned int method, unsigned int rounds)
 {
-	struct hashmap map;
+	struct test_map map;
 	char buf[16];
 	struct test_entry **entries;
 	unsigned int *hashes;
@@ -99,35 +191,35 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
 	if (method & TEST_ADD) {
 		/* test adding to the map */
 		for (j = 0; j < rounds; j++) {
-			hashmap_init(&map, test_entry_cmp, NULL, 0);
+			map_init(&map, NULL);
 
 			/* add entries */
 			for (i = 0; i < TEST_SIZE; i++) {
 				hashmap_entry_init(entries[i], hashes[i]);
-				hashmap_add(&map, entries[i]);
+				map_add(&map, entries[i]);
 			}
 
-			hashmap_free(&map, 0);
+			map_free(&map, 0);
 		}
 	} else {
 		/* test map lookups */
-		hashmap_init(&map, test_entry_cmp, NULL, 0);
+		map_init(&map, NULL);
 
 		/* fill the map (sparsely if specified) */
 		j = (method & TEST_SPARSE) ? TEST_SIZE / 10 : TEST_SIZE;
 		for (i = 0; i < j; i++) {
 			hashmap_entry_init(entries[i], hashes[i]);
-			hashmap_add(&map, entries[i]);
+			map_add(&map, entries[i]);
 		}
 
 		for (j = 0; j < rounds; j++) {
 			for (i = 0; i < TEST_SIZE; i++) {
-				hashmap_get_from_hash(&map, hashes[i],
-						      entries[i]->key);
+				map_get_from_hash(&map, hashes[i],
+						  entries[i]->key);
 			}
 		}
 
-		hashmap_free(&map, 0);
+		map_free(&map, 0);
 	}
 }
 
@@ -144,16 +236,24 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
  * size -> tablesize numentries
  *
  * perfhashmap method rounds -> test hashmap.[ch] performance
+ *
+ * Arguments: [flat] [ignorecase]
  */
 int cmd__hashmap(int argc, const char **argv)
 {
 	struct strbuf line = STRBUF_INIT;
-	struct hashmap map;
+	struct test_map map;
 	int icase;
 
+	if (argc > 1 && !strcmp("flat", argv[1])) {
+		use_flat = 1;
+		argc--;
+		argv++;
+	}
+
 	/* init hash map */
 	icase = argc > 1 && !strcmp("ignorecase", argv[1]);
-	hashmap_init(&map, test_entry_cmp, &icase, 0);
+	map_init(&map, &icase);
 
 	/* process commands from stdin */
 	while (strbuf_getline(&line, stdin) != EOF) {
@@ -186,7 +286,7 @@ int cmd__hashmap(int argc, const char **argv)
 			entry = alloc_test_entry(hash, p1, p2);
 
 			/* add to hashmap */
-			hashmap_add(&map, entry);
+			map_add(&map, entry);
 
 		} else if (!strcmp("put", cmd) && p1 && p2) {
 
@@ -194,7 +294,7 @@ int cmd__hashmap(int argc, const char **argv)
 			entry = alloc_test_entry(hash, p1, p2);
 
 			/* add / replace entry */
-			entry = hashmap_put(&map, entry);
+			entry = map_put(&map, entry);
 
 			/* print and free replaced entry, if any */
 			puts(entry ? get_value(entry) : "NULL");
@@ -203,14 +303,14 @@ int cmd__hashmap(int argc, const char **argv)
 		} else if (!strcmp("get", cmd) && p1) {
 
 			/* lookup entry in hashmap */
-			entry = hashmap_get_from_hash(&map, hash, p1);
+			entry = map_get_from_hash(&map, hash, p1);
 
 			/* print result */
 			if (!entry)
 				puts("NULL");
 			while (entry) {
 				puts(get_value(entry));
-				entry = hashmap_get_next(&map, entry);
+				entry = map_get_next(&map, entry);
 			}
 
 		} else if (!strcmp("remove", cmd) && p1) {
@@ -220,7 +320,7 @@ int cmd__hashmap(int argc, const char **argv)
 			hashmap_entry_init(&key, hash);
 
 			/* remove entry from hashmap */
-			entry = hashmap_remove(&map, &key, p1);
+			entry = map_remove(&map, &key, p1);
 
 			/* print result and free entry*/
 			puts(entry ? get_value(entry) : "NULL");
@@ -228,16 +328,12 @@ int cmd__hashmap(int argc, const char **argv)
 
 		} else if (!strcmp("iterate", cmd)) {
 
-			struct hashmap_iter iter;
-			hashmap_iter_init(&map, &iter);
-			while ((entry = hashmap_iter_next(&iter)))
-				printf("%s %s\n", entry->key, get_value(entry));
+			map_iterate(&map);
 
 		} else if (!strcmp("size", cmd)) {
 
 			/* print table sizes */
-			printf("%u %u\n", map.tablesize,
-			       hashmap_get_size(&map));
+			map_print_size(&map);
 
 		} else if (!strcmp("intern", cmd) && p1) {
 
@@ -265,6 +361,6 @@ int cmd__hashmap(int argc, const char **argv)
 	}
 
 	strbuf_release(&line);
-	hashmap_free(&map, 1);
+	map_free(&map, 1);
 	return 0;
 }
@@ -0,0 +1,149 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "commit.h"
+#include "commit-reach.h"
+#include "config.h"
+#include "ref-filter.h"
+#include "string-list.h"
+#include "tag.h"
+
+static void print_sorted_commit_ids(struct commit_list *list)
+{
+	int i;
+	struct string_list s = STRING_LIST_INIT_DUP;
+
+	while (list) {
+		string_list_append(&s, oid_to_hex(&list->item->object.oid));
+		list = list->next;
+	}
+
+	string_list_sort(&s);
+
+	for (i = 0; i < s.nr; i++)
+		printf("%s\n", s.items[i].string);
+
+	string_list_clear(&s, 0);
+}
+
+int cmd__reach(int ac, const char **av)
+{
+	struct object_id oid_A, oid_B;
+	struct commit *A, *B;
+	struct commit_list *X, *Y;
+	struct commit **X_array;
+	int X_nr, X_alloc;
+	struct strbuf buf = STRBUF_INIT;
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+
+	if (ac < 2)
+		exit(1);
+
+	A = B = NULL;
+	X = Y = NULL;
+	X_nr = 0;
+	X_alloc = 16;
+	ALLOC_ARRAY(X_array, X_alloc);
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		struct object_id oid;
+		struct object *o;
+		struct commit *c;
+		if (buf.len < 3)
+			continue;
+
+		if (get_oid_committish(buf.buf + 2, &oid))
+			die("failed to resolve %s", buf.buf + 2);
+
+		o = deref_tag_noverify(parse_object(&oid));
+		c = o ? object_as_type(o, OBJ_COMMIT, 0) : NULL;
+		if (!c)
+			die("failed to load commit for input %s resulting in oid %s",
+			    buf.buf, oid_to_hex(&oid));
+
+		switch (buf.buf[0]) {
+		case 'A':
+			oidcpy(&oid_A, &oid);
+			A = c;
+			break;
+
+		case 'B':
+			oidcpy(&oid_B, &oid);
+			B = c;
+			break;
+
+		case 'X':
+			commit_list_insert(c, &X);
+			ALLOC_GROW(X_array, X_nr + 1, X_alloc);
+			X_array[X_nr++] = c;
+			break;
+
+		case 'Y':
+			commit_list_insert(c, &Y);
+			break;
+
+		default:
+			die("unexpected start of line: %c", buf.buf[0]);
+		}
+		strbuf_reset(&buf);
+	}
+
+	if (!strcmp(av[1], "ref_newer"))
+		printf("%s(A,B):%d\n", av[1], ref_newer(&oid_A, &oid_B));
+	else if (!strcmp(av[1], "in_merge_bases"))
+		printf("%s(A,B):%d\n", av[1], in_merge_bases(A, B));
+	else if (!strcmp(av[1], "is_descendant_of"))
+		printf("%s(A,X):%d\n", av[1], is_descendant_of(A, X));
+	else if (!strcmp(av[1], "get_merge_bases_many")) {
+		struct commit_list *list = get_merge_bases_many(A, X_nr, X_array);
+		printf("%s(A,X):\n", av[1]);
+		print_sorted_commit_ids(list);
+	} else if (!strcmp(av[1], "reduce_heads")) {
+		struct commit_list *list = reduce_heads(X);
+		printf("%s(X):\n", av[1]);
+		print_sorted_commit_ids(list);
+	} else if (!strcmp(av[1], "can_all_from_reach")) {
+		printf("%s(X,Y):%d\n", av[1], can_all_from_reach(X, Y, 1));
+	} else if (!strcmp(av[1], "commit_contains")) {
+		struct ref_filter filter;
+		struct contains_cache cache;
+		init_contains_cache(&cache);
+
+		memset(&filter, 0, sizeof(filter));
+		if (ac > 2 && !strcmp(av[2], "--tag"))
+			filter.with_commit_tag_algo = 1;
+		printf("%s(_,A,X,_):%d\n", av[1], commit_contains(&filter, A, X, &cache));
+		clear_contains_cache(&cache);
+	} else if (!strcmp(av[1], "commits_contain")) {
+		struct ref_filter filter;
+		struct string_list s = STRING_LIST_INIT_DUP;
+		struct commit_list *p;
+		struct commit **commits;
+		unsigned char *result;
+		int i, nr = commit_list_count(Y);
+
+		memset(&filter, 0, sizeof(filter));
+		if (ac > 2 && !strcmp(av[2], "--tag"))
+			filter.with_commit_tag_algo = 1;
+		ALLOC_ARRAY(commits, nr);
+		for (i = 0, p = Y; p; p = p->next)
+			commits[i++] = p->item;
+		result = xmalloc(nr);
+		commits_contain(&filter, commits, nr, X, result);
+
+		for (i = 0; i < nr; i++)
+			string_list_append_nodup(&s, xstrfmt("%s %d",
+				oid_to_hex(&commits[i]->object.oid), result[i]));
+		string_list_sort(&s);
+		printf("%s(_,Y,X):\n", av[1]);
+		for (i = 0; i < s.nr; i++)
+			printf("%s\n", s.items[i].string);
+		string_list_clear(&s, 0);
+		free(commits);
+		free(result);
+	} else
+		die("unknown method: %s", av[1]);
+
+	exit(0);
+}
@@ -1,14 +1,52 @@
 #include "test-tool.h"
 #include "cache.h"
+#include "sparse-index.h"
+
+static void print_cache_entry(const struct cache_entry *ce)
+{
+	const char *type;
+
+	if (S_ISSPARSEDIR(ce->ce_mode))
+		type = "tree";
+	else if (S_ISGITLINK(ce->ce_mode))
+		type = "commit";
+	else
+		type = "blob";
+
+	printf("%06o %s %s\t%s\n", ce->ce_mode, type,
+	       oid_to_hex(&ce->oid), ce->name);
+}
 
 int cmd__read_cache(int argc, const char **argv)
 {
-	int i, cnt = 1;
-	if (argc == 2)
-		cnt = strtol(argv[1], NULL, 0);
+	int i, cnt = 1, table = 0, expand = 0;
+
+	for (++argv, --argc; argc && starts_with(*argv, "--"); argv++, argc--) {
+		if (!strcmp(*argv, "--table"))
+			table = 1;
+		else if (!strcmp(*argv, "--expand"))
+			expand = 1;
+		else
+			die("unknown option '%s'", *argv);
+	}
+	if (argc == 1)
+		cnt = strtol(argv[0], NULL, 0);
 	setup_git_directory();
+
+	/* show the index as it is stored, sparse directories and all */
+	if (table)
+		command_requires_full_index = 0;
+
 	for (i = 0; i < cnt; i++) {
 		read_cache();
+		if (expand)
+			ensure_full_index(&the_index);
+		if (table) {
+			int j;
+
+			for (j = 0; j < the_index.cache_nr; j++)
+				print_cache_entry(the_index.cache[j]);
+		}
 		discard_cache();
 	}
 	return 0;
@@ -0,0 +1,77 @@
+#include "test-tool.h"
+#include "cache.h"
+#include "run-command.h"
+#include "thread-utils.h"
+#include "trace2.h"
+
+/*
+ * Usage: test-tool trace2 <command>...
+ *
+ * Each command writes some trace2 events:
+ *
+ *   region <category> <label>  enter and leave a region
+ *   data <category> <key> <n>  record the number <n>
+ *   counter <name> <n>         add <n> to a counter
+ *   thread <name>              run a thread that enters a region
+ *   run <arg>...               run a child process (the rest of the
+ *                              command line)
+ *   error <msg>                report an error
+ *   die <msg>                  die
+ *   exit <code>                exit with <code>
+ */
+
+#ifndef NO_PTHREADS
+static void *thread_proc(void *name)
+{
+	trace2_thread_start(name);
+	trace2_region_enter("test", "in-thread");
+	trace2_counter_add("test", "in-thread", 1);
+	trace2_region_leave("test", "in-thread");
+	trace2_thread_exit();
+	return NULL;
+}
+#endif
+
+int cmd__trace2(int argc, const char **argv)
+{
+	argv++;
+	while (*argv) {
+		const char *cmd = *argv++;
+
+		if (!strcmp(cmd, "region") && argv[0] && argv[1]) {
+			trace2_region_enter(argv[0], argv[1]);
+			trace2_region_leave(argv[0], argv[1]);
+			argv += 2;
+		} else if (!strcmp(cmd, "data") && argv[0] && argv[1] && argv[2]) {
+			trace2_data_intmax(argv[0], argv[1], strtoimax(argv[2], NULL, 10));
+			argv += 3;
+		} else if (!strcmp(cmd, "counter") && argv[0] && argv[1]) {
+			trace2_counter_add("test", argv[0], strtoumax(argv[1], NULL, 10));
+			argv += 2;
+		} else if (!strcmp(cmd, "thread") && argv[0]) {
+#ifndef NO_PTHREADS
+			pthread_t thread;
+
+			if (pthread_create(&thread, NULL, thread_proc, (void *)argv[0]))
+				die("unable to create thread");
+			pthread_join(thread, NULL);
+#endif
+			argv++;
+		} else if (!strcmp(cmd, "run") && argv[0]) {
+			struct child_process cp = CHILD_PROCESS_INIT;
+
+			cp.argv = argv;
+			return run_command(&cp);
+		} else if (!strcmp(cmd, "error") && argv[0]) {
+			error("%s", *argv++);
+		} else if (!strcmp(cmd, "die") && argv[0]) {
+			die("%s", argv[0]);
+		} else if (!strcmp(cmd, "exit") && argv[0]) {
+			exit(atoi(argv[0]));
+		} else {
+			die("unknown trace2 test command '%s'", cmd);
+		}
+	}
+
+	return 0;
+}
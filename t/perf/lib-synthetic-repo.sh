@@ -0,0 +1,165 @@
+# Helpers for generating large repositories from scratch.
+#
+# Each generator adds commits on top of the current branch with
+# git-fast-import. The contents, authors and dates depend only on the
+# arguments and on how many commits the branch already has, so the same
+# sequence of calls always produces the same object names, whichever
+# machine and whichever version of git is being measured.
+
+# Find the branch to add to, where its history starts from and how many
+# commits it already has.
+synthetic_start_ () {
+	synthetic_branch_=$("$MODERN_GIT" symbolic-ref HEAD) &&
+	if "$MODERN_GIT" rev-parse -q --verify HEAD >/dev/null
+	then
+		synthetic_from_="$synthetic_branch_^0" &&
+		synthetic_count_=$("$MODERN_GIT" rev-list --count HEAD)
+	else
+		synthetic_from_= &&
+		synthetic_count_=0
+	fi
+}
+
+# Run a perl script emitting a fast-import stream of commits, with
+# commit($msg) defined to start the next commit and file($path, $data)
+# to add a file to it. Every run writes a pack, however small.
+synthetic_import_ () {
+	script=$1
+	shift
+	synthetic_start_ &&
+	perl -e '
+		my $branch = shift;
+		my $from = shift;
+		my $time = 1112911993 + 60 * shift;
+
+		sub commit {
+			my ($msg) = @_;
+			print "commit $branch\n";
+			print "author A U Thor <author\@example.com> $time +0000\n";
+			print "committer C O Mitter <committer\@example.com> $time +0000\n";
+			print "data ", length($msg), "\n$msg\n";
+			if ($from ne "") {
+				print "from $from\n";
+				$from = "";
+			}
+			$time += 60;
+		}
+
+		sub file {
+			my ($path, $data) = @_;
+			print "M 100644 inline $path\n";
+			print "data ", length($data), "\n$data\n";
+		}
+
+		binmode STDOUT;
+	'"$script" \
+		"$synthetic_branch_" "$synthetic_from_" "$synthetic_count_" "$@" |
+	"$MODERN_GIT" -c fastimport.unpackLimit=0 fast-import --quiet
+}
+
+# Add one commit with $1 files, spread over two levels of directories
+# of $2 entries each (default 100).
+synthetic_files () {
+	synthetic_import_ '
+		my ($nr, $width) = @ARGV;
+		$width ||= 100;
+		exit unless $nr;
+		commit("add $nr files\n");
+		for my $i (0..$nr - 1) {
+			my $path = sprintf "files/%04d/%04d/%08d.txt",
+				int($i / ($width * $width)), int($i / $width) % $width, $i;
+			file($path, "file $i\n");
+		}
+	' "$@"
+}
+
+# Add $1 commits, each changing one of $2 files (default 100).
+synthetic_history () {
+	synthetic_import_ '
+		my ($nr, $files) = @ARGV;
+		$files ||= 100;
+		for my $i (0..$nr - 1) {
+			commit("history $i\n");
+			file(sprintf("history/%04d.txt", $i % $files), "change $i\n");
+		}
+	' "$@"
+}
+
+# Add one commit with $1 blobs of $2 bytes each, where the size takes a
+# "k", "m" or "g" suffix. The contents are pseudo-random so that they
+# neither compress nor delta against each other.
+synthetic_big_blobs () {
+	synthetic_import_ '
+		my ($nr, $size) = @ARGV;
+		my %unit = ("" => 1, k => 1024, m => 1024 * 1024,
+			    g => 1024 * 1024 * 1024);
+		$size =~ /^(\d+)([kmg]?)$/i or die "bad size: $size";
+		$size = $1 * $unit{lc $2};
+		exit unless $nr;
+		commit("add $nr blobs of $size bytes\n");
+		for my $i (0..$nr - 1) {
+			my $x = $i + 1;
+			my $data = "";
+			while (length($data) < $size) {
+				# xorshift32
+				$x ^= ($x << 13) & 0xffffffff;
+				$x ^= $x >> 17;
+				$x ^= ($x << 5) & 0xffffffff;
+				$data .= pack("N", $x);
+			}
+			file(sprintf("big/%04d.bin", $i), substr($data, 0, $size));
+		}
+	' "$@"
+}
+
+# Add $1 commits, each in a pack of its own.
+synthetic_packs () {
+	synthetic_import_ '
+		my ($nr) = @ARGV;
+		for my $i (0..$nr - 1) {
+			commit("pack $i\n");
+			file(sprintf("packs/%06d.txt", $i), "pack $i\n");
+			print "checkpoint\n";
+		}
+	' "$@"
+}
+
+# Add $1 refs named $2/<n> (default refs/heads/synthetic), pointing at
+# commits spread evenly over the first-parent history of HEAD.
+synthetic_refs () {
+	"$MODERN_GIT" rev-list --first-parent HEAD |
+	perl -e '
+		my ($nr, $prefix) = @ARGV;
+		$prefix ||= "refs/heads/synthetic";
+		my @commits = <STDIN>;
+		chomp @commits;
+		for my $i (0..$nr - 1) {
+			printf "create %s/%06d %s\n", $prefix, $i,
+				$commits[int($i * @commits / $nr)];
+		}
+	' "$@" |
+	"$MODERN_GIT" update-ref --stdin
+}
+
+# Set up a repository in $1 (default the trash directory) out of the
+# generators above, as big as the GIT_PERF_SYNTHETIC_* variables say.
+# The refs are packed and the objects are left in the packs
+# git-fast-import wrote, and automatic gc is disabled so that it stays
+# that way. The index matches HEAD; call test_checkout_worktree for the
+# files.
+test_perf_synthetic_repo () {
+	repo="${1:-$TRASH_DIRECTORY}"
+	test_perf_fresh_repo "$repo" &&
+	(
+		cd "$repo" &&
+		"$MODERN_GIT" config gc.auto 0 &&
+		synthetic_files ${GIT_PERF_SYNTHETIC_FILES:-100000} &&
+		synthetic_big_blobs ${GIT_PERF_SYNTHETIC_BIG_BLOBS:-4} \
+			${GIT_PERF_SYNTHETIC_BIG_BLOB_SIZE:-16m} &&
+		synthetic_history ${GIT_PERF_SYNTHETIC_COMMITS:-10000} &&
+		synthetic_packs ${GIT_PERF_SYNTHETIC_PACKS:-100} &&
+		synthetic_refs ${GIT_PERF_SYNTHETIC_REFS:-10000} &&
+		"$MODERN_GIT" pack-refs --all &&
+		"$MODERN_GIT" read-tree HEAD
+	) || error "failed to generate a synthetic repository in '$repo'"
+}
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+test_description='Tests whether synthetic repositories are generated reproducibly'
+. ./perf-lib.sh
+. "$TEST_DIRECTORY"/perf/lib-synthetic-repo.sh
+
+test_expect_success 'generators make what they are asked for' '
+	test_perf_fresh_repo small &&
+	(
+		cd small &&
+		synthetic_files 250 10 &&
+		synthetic_big_blobs 2 3k &&
+		synthetic_history 20 &&
+		synthetic_packs 5 &&
+		synthetic_refs 7 &&
+		test 250 = $(git ls-tree -r HEAD files | wc -l) &&
+		test 3072 = $(git cat-file -s HEAD:big/0001.bin) &&
+		test 27 = $(git rev-list --count HEAD) &&
+		test 5 -le $(ls .git/objects/pack/*.pack | wc -l) &&
+		test 7 = $(git for-each-ref refs/heads/synthetic | wc -l)
+	)
+'
+
+test_expect_success 'generators are reproducible' '
+	test_perf_fresh_repo again &&
+	(
+		cd again &&
+		synthetic_files 250 10 &&
+		synthetic_big_blobs 2 3k &&
+		synthetic_history 20 &&
+		synthetic_packs 5 &&
+		synthetic_refs 7
+	) &&
+	git -C small for-each-ref >expect &&
+	git -C again for-each-ref >actual &&
+	test_cmp expect actual &&
+	rm -rf small again
+'
+
+test_perf_synthetic_repo
+
+test_perf 'rev-list --all' '
+	git rev-list --all >/dev/null
+'
+
+test_perf 'rev-list --all --objects' '
+	git rev-list --all --objects >/dev/null
+'
+
+test_perf 'for-each-ref' '
+	git for-each-ref >/dev/null
+'
+
+test_perf 'ls-files' '
+	git ls-files >/dev/null
+'
+
+test_perf 'cat-file big blobs' '
+	git ls-tree HEAD big/ |
+	cut -d" " -f3 |
+	cut -f1 |
+	git cat-file --batch >/dev/null
+'
+
+test_done
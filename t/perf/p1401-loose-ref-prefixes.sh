@@ -0,0 +1,51 @@
+#!/bin/sh
+
+test_description='operations on a few refs in a repository with many loose refs
+
+The child repository has a large number of loose refs outside of the
+refs that a fetch looks at (tags and remote-tracking refs). Operations
+that only care about some prefixes should not have to read all the
+other loose refs from disk. The number of loose refs can be set with
+GIT_PERF_LOOSE_REFS.
+'
+. ./perf-lib.sh
+
+test_expect_success 'create parent and child' '
+	git init parent &&
+	git -C parent commit --allow-empty -m base &&
+	git -C parent tag base &&
+	git clone parent child &&
+	git -C parent commit --allow-empty -m trigger-fetch
+'
+
+test_expect_success 'create many loose refs in the child' '
+	head=$(git -C child rev-parse HEAD) &&
+	perl -e '\''
+		my ($n, $oid) = @ARGV;
+		mkdir "child/.git/refs/unrelated";
+		for my $i (1..$n) {
+			my $dir = sprintf "child/.git/refs/unrelated/%d", $i / 1000;
+			mkdir $dir;
+			open(my $fh, ">", "$dir/$i") or die "$dir/$i: $!";
+			print $fh "$oid\n";
+			close($fh);
+		}
+	'\'' ${GIT_PERF_LOOSE_REFS:-1000000} $head
+'
+
+test_perf 'for-each-ref with a prefix' '
+	git -C child for-each-ref refs/tags/ >/dev/null
+'
+
+test_perf 'fetch with tag following' '
+	# make sure there is something to fetch on each iteration
+	git -C child update-ref -d refs/remotes/origin/master &&
+	git -C child fetch
+'
+
+test_perf 'fetch --prune' '
+	git -C child update-ref -d refs/remotes/origin/master &&
+	git -C child fetch --prune
+'
+
+test_done
@@ -0,0 +1,33 @@
+#!/bin/sh
+
+test_description="Tests performance of finding the repository"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup deep directory' '
+	deep=$(test_seq 1 30 | sed "s/^/d/" | tr "\n" / | sed "s,/$,,") &&
+	mkdir -p "$deep" &&
+	echo "$deep" >deep-path
+'
+
+count=100
+test_perf "rev-parse --show-toplevel at the top, $count times" "
+	for i in \$(test_seq $count)
+	do
+		git rev-parse --show-toplevel >/dev/null || return 1
+	done
+"
+
+test_perf "rev-parse --show-toplevel 30 levels down, $count times" "
+	(
+		cd \"\$(cat deep-path)\" &&
+		for i in \$(test_seq $count)
+		do
+			git rev-parse --show-toplevel >/dev/null || return 1
+		done
+	)
+"
+
+test_done
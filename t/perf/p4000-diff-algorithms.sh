@@ -26,4 +26,22 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+test_expect_success 'setup files with long lines' '
+	"$PERL_PATH" -e "
+		srand(1);
+		for (1..20000) {
+			print join(\"\", map { chr(97 + int(rand(26))) } 1..(50 + \$_ % 2000)), \"\\n\";
+		}
+	" >long1 &&
+	"$PERL_PATH" -pe "\$_ = reverse(\$_) . \"\\n\" if \$. % 97 == 0 && chomp" long1 >long2
+'
+
+test_perf 'diff long lines (Myers)' '
+	test_expect_code 1 git diff --no-index long1 long2 >/dev/null
+'
+
+test_perf 'diff long lines --histogram' '
+	test_expect_code 1 git diff --no-index --histogram long1 long2 >/dev/null
+'
+
 test_done
@@ -0,0 +1,31 @@
+#!/bin/sh
+
+test_description='receive-pack performance with many refs in one push
+
+Pushes a large number of refs (GIT_PERF_PUSH_REFS, 100000 by default)
+into an empty repository, and then deletes them again, like a mirror
+push does.
+'
+. ./perf-lib.sh
+
+test_expect_success 'create refs' '
+	git init &&
+	git commit --allow-empty -m base &&
+	test_seq ${GIT_PERF_PUSH_REFS:-100000} |
+	sed "s,.*,create refs/heads/many/& HEAD," |
+	git update-ref --stdin &&
+	git pack-refs --all
+'
+
+test_perf 'push many new refs' '
+	rm -rf dst.git &&
+	git init --bare dst.git &&
+	git push -q dst.git "refs/heads/many/*:refs/heads/many/*"
+'
+
+test_perf 'delete many refs' '
+	git -C dst.git pack-refs --all &&
+	git push -q dst.git --prune "refs/heads/none/*:refs/heads/many/*"
+'
+
+test_done
@@ -0,0 +1,33 @@
+#!/bin/sh
+
+test_description="Tests bisection performance"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+test_checkout_worktree
+
+test_expect_success 'pick a range to bisect' '
+	good=$(git rev-list --first-parent --skip=1000 -1 HEAD) &&
+	if test -z "$good"
+	then
+		good=$(git rev-list --max-parents=0 HEAD | tail -n 1)
+	fi &&
+	test_export good
+'
+
+test_perf 'rev-list --bisect' '
+	git rev-list --bisect HEAD ^$good >/dev/null
+'
+
+test_perf 'rev-list --bisect-all' '
+	git rev-list --bisect-all HEAD ^$good >/dev/null
+'
+
+test_perf 'bisect step' '
+	git bisect start HEAD $good >/dev/null &&
+	git bisect good >/dev/null &&
+	git bisect reset >/dev/null
+'
+
+test_done
@@ -0,0 +1,40 @@
+#!/bin/sh
+
+test_description='performance of for-each-ref formats'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'create a ref for each commit' '
+	git rev-list --all --max-count=10000 |
+	sed "s,.*,create refs/perf/& &," |
+	git update-ref --stdin &&
+	git pack-refs --all
+'
+
+test_perf 'refname only' '
+	git for-each-ref --format="%(refname)" refs/perf/ >/dev/null
+'
+
+test_perf 'objectname' '
+	git for-each-ref --format="%(objectname) %(refname)" refs/perf/ >/dev/null
+'
+
+test_perf 'objecttype and objectsize' '
+	git for-each-ref --format="%(objecttype) %(objectsize)" refs/perf/ >/dev/null
+'
+
+test_perf 'subject' '
+	git for-each-ref --format="%(subject)" refs/perf/ >/dev/null
+'
+
+test_perf 'sort by committerdate' '
+	git for-each-ref --sort=committerdate refs/perf/ >/dev/null
+'
+
+test_perf 'sort by -creatordate and refname' '
+	git for-each-ref --sort=-creatordate --sort=refname \
+		--format="%(refname)" refs/perf/ >/dev/null
+'
+
+test_done
@@ -43,6 +43,27 @@ test_lazy_prereq WATCHMAN '
 	command -v watchman
 '
 
+# With a .gitignore in every directory, the untracked cache would read
+# them all to find out whether they changed, unless fsmonitor says.
+add_ignore_files () {
+	git ls-tree -r -d --name-only HEAD |
+	while read d
+	do
+		test -e "$d/.gitignore" && continue
+		printf "*.o\n.gitignore\n" >"$d/.gitignore" &&
+		echo "$d/.gitignore" || return 1
+	done >.git/perf-ignore-files &&
+	git status >/dev/null
+}
+
+remove_ignore_files () {
+	while read f
+	do
+		rm -f "$f" || return 1
+	done <.git/perf-ignore-files &&
+	rm .git/perf-ignore-files
+}
+
 if test_have_prereq WATCHMAN
 then
 	# Convert unix style paths to escaped Windows style paths for Watchman
@@ -141,6 +162,18 @@ test_perf "status -uall (fsmonitor=$INTEGRATION_SCRIPT)" '
 	git status -uall
 '
 
+test_expect_success UNTRACKED_CACHE "setup a .gitignore per directory" '
+	add_ignore_files
+'
+
+test_perf UNTRACKED_CACHE "status, .gitignore per directory (fsmonitor=$INTEGRATION_SCRIPT)" '
+	git status
+'
+
+test_expect_success UNTRACKED_CACHE "remove the .gitignore files" '
+	remove_ignore_files
+'
+
 test_expect_success "setup without fsmonitor" '
 	unset INTEGRATION_SCRIPT &&
 	git config --unset core.fsmonitor &&
@@ -171,6 +204,18 @@ test_perf "status -uall (fsmonitor=$INTEGRATION_SCRIPT)" '
 	git status -uall
 '
 
+test_expect_success UNTRACKED_CACHE "setup a .gitignore per directory" '
+	add_ignore_files
+'
+
+test_perf UNTRACKED_CACHE "status, .gitignore per directory (fsmonitor=$INTEGRATION_SCRIPT)" '
+	git status
+'
+
+test_expect_success UNTRACKED_CACHE "remove the .gitignore files" '
+	remove_ignore_files
+'
+
 if test_have_prereq WATCHMAN
 then
 	watchman watch-del "$GIT_WORK_TREE" >/dev/null 2>&1 &&
@@ -150,11 +150,37 @@ immediate=t
 case "$(uname -s)" in Darwin) GTIME="${GTIME:-gtime}";; esac
 GTIME="${GTIME:-/usr/bin/time}"
 
+# Counting system calls requires strace
+if test -n "$GIT_PERF_SYSCALLS"
+then
+	strace -V >/dev/null 2>&1 ||
+	error "GIT_PERF_SYSCALLS is set, but strace does not work"
+fi
+
+# elapsed, user and system time, and the maximum resident set size in KB
+test_perf_time_ () {
+	"$GTIME" -f "%E %U %S %M" -o test_time.$i "$@"
+}
+
+test_perf_strace_ () {
+	strace -f -qq -o test_syscalls "$@"
+}
+
+# Count the calls in the output of test_perf_strace_, where a call that
+# was interrupted by another process shows up as "unfinished" and again
+# as "resumed".
+test_perf_count_syscalls_ () {
+	grep -v -e "<\.\.\. .* resumed>" -e "^[0-9]* *+++ " -e "^[0-9]* *--- " \
+		test_syscalls |
+	wc -l |
+	sed "s/ //g"
+}
+
 test_run_perf_ () {
 	test_cleanup=:
 	test_export_="test_cleanup"
 	export test_cleanup test_export_
-	"$GTIME" -f "%E %U %S" -o test_time.$i "$SHELL" -c '
+	$test_perf_runner_ "$SHELL" -c '
 . '"$TEST_DIRECTORY"/test-lib-functions.sh'
 test_export () {
 	[ $# != 0 ] || return 0
@@ -196,6 +222,8 @@ test_perf () {
 		else
 			echo "perf $test_count - $1:"
 		fi
+		test_perf_runner_=test_perf_time_
+		perf_ok_=t
 		for i in $(test_seq 1 $GIT_PERF_REPEAT_COUNT); do
 			say >&3 "running: $2"
 			if test_run_perf_ "$2"
@@ -208,15 +236,30 @@ test_perf () {
 			else
 				test -z "$verbose" && echo
 				test_failure_ "$@"
+				perf_ok_=
 				break
 			fi
 		done
+		base="$perf_results_dir"/"$perf_results_prefix$(basename "$0" .sh)"."$test_count"
+		rm -f "$base".syscalls
+		if test -n "$GIT_PERF_SYSCALLS" && test -n "$perf_ok_"
+		then
+			# tracing slows everything down, so do not time this run
+			say >&3 "counting system calls: $2"
+			test_perf_runner_=test_perf_strace_
+			if test_run_perf_ "$2"
+			then
+				test_perf_count_syscalls_ >"$base".syscalls
+			else
+				test -z "$verbose" && echo
+				test_failure_ "$@"
+			fi
+		fi
 		if test -z "$verbose"; then
 			echo " ok"
 		else
 			test_ok_ "$1"
 		fi
-		base="$perf_results_dir"/"$perf_results_prefix$(basename "$0" .sh)"."$test_count"
 		"$TEST_DIRECTORY"/perf/min_time.perl test_time.* >"$base".times
 	fi
 	test_finish_
@@ -323,4 +323,66 @@ test_expect_success 'bare repository: test info/attributes' '
 	)
 '
 
+test_expect_success 'compiled matcher agrees with trying every rule' '
+	git init matcher &&
+	(
+		cd matcher &&
+		mkdir -p a/b/c d/e &&
+		cat >.gitattributes <<-\EOF &&
+		* all
+		*.c suffix=c
+		*.h suffix=h
+		*.tar.gz suffix=tar.gz
+		Makefile exact
+		a/b/** under-ab
+		/a/b/c/x.c anchored
+		d/*/y.c wild-dir
+		d* leading-d
+		?.c one-char
+		a/**/z.c deep
+		dir/ mustbedir
+		README -all
+		EOF
+		cat >a/.gitattributes <<-\EOF &&
+		*.c -suffix sub=c
+		b/c/* in-bc
+		makefile lower
+		EOF
+		cat >stdin <<-\EOF &&
+		x.c
+		Makefile
+		makefile
+		README
+		f.tar.gz
+		.c
+		a/x.c
+		a/Makefile
+		a/makefile
+		a/b/x.h
+		a/b/c/x.c
+		a/b/c/y.c
+		a/b/c/z.c
+		a/z.c
+		a/b/dir/
+		dir/
+		d/e/y.c
+		d/e/y.h
+		d/x.tar.gz
+		dd/f
+		EOF
+		GIT_TEST_ATTR_SCAN_ALL=1 git check-attr --stdin -a <stdin >expect &&
+		git check-attr --stdin -a <stdin >actual &&
+		test_cmp expect actual &&
+		grep "^a/b/c/x.c: anchored: set" actual &&
+		grep "^a/b/c/y.c: in-bc: set" actual &&
+		grep "^a/x.c: sub: c" actual &&
+		grep "^README: all: unset" actual &&
+		GIT_TEST_ATTR_SCAN_ALL=1 git -c core.ignorecase=true \
+			check-attr --stdin -a <stdin >expect &&
+		git -c core.ignorecase=true check-attr --stdin -a <stdin >actual &&
+		test_cmp expect actual &&
+		grep "^a/Makefile: lower: set" actual
+	)
+'
+
 test_done
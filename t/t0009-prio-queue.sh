@@ -47,4 +47,15 @@ test_expect_success 'notice empty queue' '
 	test_cmp expect actual
 '
 
+cat >expect <<'EOF'
+2
+2
+3
+NULL
+EOF
+test_expect_success 'peek does not remove' '
+	test-tool prio-queue 3 2 peek get get peek >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -237,6 +237,105 @@ test_expect_success 'grow / shrink' '
 
 '
 
+test_expect_success 'flat: put, get and remove' '
+
+test_hashmap "put key1 value1
+put key2 value2
+put key1 value3
+get key1
+get key2
+remove key1
+remove notInMap
+get key1
+size" "NULL
+NULL
+value1
+value3
+value2
+value3
+NULL
+NULL
+8 1" flat
+
+'
+
+test_expect_success 'flat: add duplicates (case insensitive)' '
+
+	cat >in <<-\EOF &&
+	add key1 value1
+	add Key1 value2
+	add fooBarFrotz value3
+	get KEY1
+	EOF
+	cat >expect <<-\EOF &&
+	value1
+	value2
+	EOF
+	test-tool hashmap flat ignorecase <in >out &&
+	sort out >actual &&
+	test_cmp expect actual
+
+'
+
+test_expect_success 'flat: iterate' '
+
+	cat >in <<-\EOF &&
+	put key1 value1
+	put key2 value2
+	put fooBarFrotz value3
+	iterate
+	EOF
+	cat >expect <<-\EOF &&
+	NULL
+	NULL
+	NULL
+	fooBarFrotz value3
+	key1 value1
+	key2 value2
+	EOF
+	test-tool hashmap flat <in >out &&
+	sort out >actual &&
+	test_cmp expect actual
+
+'
+
+test_expect_success 'flat: reuse removed slots, and grow' '
+
+	rm -f in expect &&
+	for n in $(test_seq 48)
+	do
+		echo put key$n value$n >>in &&
+		echo NULL >>expect
+	done &&
+	echo size >>in &&
+	echo 8 48 >>expect &&
+	for n in $(test_seq 30)
+	do
+		echo remove key$n >>in &&
+		echo value$n >>expect
+	done &&
+	for n in $(test_seq 30)
+	do
+		echo put new$n value$n >>in &&
+		echo NULL >>expect
+	done &&
+	echo size >>in &&
+	echo 8 48 >>expect &&
+	echo put key1 value1 >>in &&
+	echo NULL >>expect &&
+	echo size >>in &&
+	echo 32 49 >>expect &&
+	echo get key40 >>in &&
+	echo value40 >>expect &&
+	echo get new30 >>in &&
+	echo value30 >>expect &&
+	echo get key2 >>in &&
+	echo NULL >>expect &&
+	test-tool hashmap flat <in >out &&
+	test_cmp expect out
+
+'
+
 test_expect_success 'string interning' '
 
 test_hashmap "intern value1
@@ -16,4 +16,12 @@ test_expect_success 'test-sha1 detects shattered pdf' '
 	grep 38762cf7f55934b34d179ae6a4c80cadccbb7f0a err
 '
 
+test_expect_success 'test-tool hash-many detects shattered pdf' '
+	echo "$TEST_DATA/shattered-1.pdf" >paths &&
+	echo "$TEST_DATA/shattered-1.pdf" >>paths &&
+	test_must_fail test-tool hash-many <paths 2>err &&
+	test_i18ngrep collision err &&
+	grep 38762cf7f55934b34d179ae6a4c80cadccbb7f0a err
+'
+
 test_done
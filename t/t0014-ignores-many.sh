@@ -0,0 +1,117 @@
+#!/bin/sh
+
+test_description='long ignore files
+
+Exclude lists of 32 patterns or more are looked up by basename,
+extension and leading directory instead of being tried in turn;
+check that the last matching pattern still decides.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	cat >patterns <<-\EOF &&
+	*.o
+	!keep.o
+	core
+	*.tar.gz
+	!*.gz
+	*~
+	/build/
+	/TODO
+	doc/*.html
+	!doc/index.html
+	/gen/**/out
+	**/tmp
+	deep/a/
+	!deep/a/b
+	l?g
+	EOF
+	cat >paths <<-\EOF &&
+	a.o
+	keep.o
+	sub/keep.o
+	sub/x.o
+	core
+	sub/core
+	core.c
+	a.tar.gz
+	a.gz
+	sub/a.tar.gz
+	file~
+	build/one
+	sub/build/one
+	TODO
+	sub/TODO
+	doc/a.html
+	doc/index.html
+	doc/sub/a.html
+	gen/out
+	gen/x/y/out
+	sub/gen/out
+	tmp
+	x/tmp
+	deep/a/c
+	deep/a/b
+	log
+	sub/lag
+	plain
+	EOF
+	for d in build sub/build doc doc/sub gen/x/y sub/gen x deep/a/b
+	do
+		mkdir -p $d || return 1
+	done &&
+	while read p
+	do
+		test -d "$p" || echo "$p" >"$p" || return 1
+	done <paths &&
+	for i in $(test_seq 1 40)
+	do
+		echo "filler-$i" || return 1
+	done >fillers
+'
+
+# The matches of "patterns", as reported by check-ignore, whether they
+# are all or fewer than half of the ignore file.
+test_ignores () {
+	cat "$@" >.gitignore &&
+	git check-ignore --no-index -n -v --stdin <paths >out &&
+	sed -e "s/^\.gitignore:[0-9]*:/.gitignore::/" out
+}
+
+test_expect_success 'a long .gitignore matches like a short one' '
+	test_ignores patterns >expect &&
+	test_ignores fillers patterns >actual &&
+	test_cmp expect actual &&
+	test_ignores patterns fillers >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a long .gitignore in a subdirectory' '
+	rm .gitignore &&
+	cp patterns sub/.gitignore &&
+	git check-ignore --no-index -n -v --stdin <paths >expect &&
+	cat fillers patterns >sub/.gitignore &&
+	git check-ignore --no-index -n -v --stdin <paths >out &&
+	sed -e "s/^\(sub\/\.gitignore\):[0-9]*:/\1::/" expect >expect.clean &&
+	sed -e "s/^\(sub\/\.gitignore\):[0-9]*:/\1::/" out >actual &&
+	test_cmp expect.clean actual
+'
+
+test_expect_success 'many --exclude patterns' '
+	rm sub/.gitignore &&
+	git ls-files -o --exclude-from=patterns >expect &&
+	git ls-files -o --exclude-from=fillers --exclude-from=patterns >actual &&
+	test_cmp expect actual &&
+	git ls-files -o $(sed -e "s/^/--exclude=/" fillers patterns) >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'ignored files in status' '
+	test_ignores patterns >/dev/null &&
+	git status --porcelain --ignored --untracked-files=all >expect &&
+	cat fillers patterns >.gitignore &&
+	git status --porcelain --ignored --untracked-files=all >actual &&
+	test_cmp expect actual
+'
+
+test_done
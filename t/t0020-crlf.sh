@@ -396,4 +396,58 @@ test_expect_success 'New CRLF file gets LF in repo' '
 	test_cmp alllf alllf2
 '
 
+# Lines that put a CR or an LF at either side of a 32-byte boundary.
+edge_files () {
+	a31=aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa &&
+	printf "$a31\r\n$a31\r\n$a31$a31\r\n" >crlf-edge &&
+	printf "$a31\r\n$a31$a31\n\n" >mixed-edge &&
+	printf "$a31\rb$a31$a31\r\n" >lonecr-edge &&
+	printf "$a31\n$a31\r$a31\r\n" >lonecr-late &&
+	printf "$a31$a31\b\t\033\014$a31\r\n\032" >ctl-edge &&
+	printf "$a31$a31$a31\000\n" >nul-edge &&
+	printf "\177\001\002\003\177\001\002\003$a31\n" >del-edge
+}
+
+test_expect_success 'text stats agree with and without AVX2' '
+	git init edge &&
+	(
+		cd edge &&
+		edge_files &&
+		git add . &&
+		git ls-files --eol >../edge.eol &&
+		git -c core.autocrlf=true add --renormalize . &&
+		git ls-files -s >../edge.blobs
+	) &&
+	grep "i/crlf.*crlf-edge" edge.eol &&
+	grep "i/mixed.*mixed-edge" edge.eol &&
+	grep "i/-text.*lonecr-edge" edge.eol &&
+	grep "i/-text.*lonecr-late" edge.eol &&
+	grep "i/-text.*nul-edge" edge.eol &&
+	git init edge-c &&
+	(
+		cd edge-c &&
+		edge_files &&
+		GIT_TEST_CONVERT_AVX2=false git add . &&
+		GIT_TEST_CONVERT_AVX2=false git ls-files --eol >../edge-c.eol &&
+		GIT_TEST_CONVERT_AVX2=false \
+			git -c core.autocrlf=true add --renormalize . &&
+		git ls-files -s >../edge-c.blobs
+	) &&
+	test_cmp edge-c.eol edge.eol &&
+	test_cmp edge-c.blobs edge.blobs
+'
+
+test_expect_success 'text=true strips only the CR of CRLF' '
+	git init cr-kinds &&
+	(
+		cd cr-kinds &&
+		printf "a\rb\r\nc\r\r\n\r" >file &&
+		echo "file text" >.gitattributes &&
+		git add file &&
+		printf "a\rb\nc\r\n\r" >expect &&
+		git cat-file blob :file >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
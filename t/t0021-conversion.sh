@@ -775,6 +775,51 @@ test_expect_success PERL 'delayed checkout in process filter' '
 	)
 '
 
+test_expect_success PERL 'batched checkout in process filter' '
+	test_config_global filter.a.process "rot13-filter.pl a.log clean smudge delay batch" &&
+	test_config_global filter.a.required true &&
+
+	rm -rf repo &&
+	mkdir repo &&
+	(
+		cd repo &&
+		git init &&
+		echo "*.a filter=a" >.gitattributes &&
+		cp "$TEST_ROOT/test.o" test.a &&
+		cp "$TEST_ROOT/test.o" test-delay10.a &&
+		cp "$TEST_ROOT/test.o" test-delay20.a &&
+		git add . &&
+		git commit -m "test commit"
+	) &&
+
+	S=$(file_size "$TEST_ROOT/test.o") &&
+	cat >a.exp <<-EOF &&
+		START
+		init handshake complete
+		IN: smudge test.a $S [OK] -- [BATCHED]
+		IN: smudge test-delay10.a $S [OK] -- [BATCHED]
+		IN: smudge test-delay20.a $S [OK] -- [BATCHED]
+		IN: list_available_blobs test-delay10.a test.a [OK]
+		IN: smudge test.a 0 [OK] -- OUT: $S . [OK]
+		IN: smudge test-delay10.a 0 [OK] -- OUT: $S . [OK]
+		IN: list_available_blobs test-delay20.a [OK]
+		IN: smudge test-delay20.a 0 [OK] -- OUT: $S . [OK]
+		IN: list_available_blobs [OK]
+		STOP
+	EOF
+
+	rm -rf repo-cloned &&
+	filter_git clone repo repo-cloned &&
+	test_cmp_count a.exp repo-cloned/a.log &&
+
+	(
+		cd repo-cloned &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" test.a &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" test-delay10.a &&
+		test_cmp_committed_rot13 "$TEST_ROOT/test.o" test-delay20.a
+	)
+'
+
 test_expect_success PERL 'missing file in delayed checkout' '
 	test_config_global filter.bug.process "rot13-filter.pl bug.log clean smudge delay" &&
 	test_config_global filter.bug.required true &&
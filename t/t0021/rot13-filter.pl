@@ -28,6 +28,10 @@
 # (7) If data with the pathname "invalid-delay.a" is processed that the
 #     filter will add the path "unfiltered" which was not delayed before
 #     to the "list_available_blobs" response.
+# (8) If data is sent with the "batch" flag, then the filter delays it
+#     without responding, as the "batch" capability asks, and signals
+#     its availability after "count" (1 for paths not in the DELAY hash)
+#     "list_available_blobs" commands.
 #
 
 use 5.008;
@@ -129,9 +133,12 @@ sub rot13 {
 		$debug->flush();
 
 		# Read until flush
+		my $batch = 0;
 		my ( $done, $buffer ) = packet_txt_read();
 		while ( $buffer ne '' ) {
-			if ( $buffer eq "can-delay=1" ) {
+			if ( $buffer eq "batch=1" ) {
+				$batch = 1;
+			} elsif ( $buffer eq "can-delay=1" ) {
 				if ( exists $DELAY{$pathname} and $DELAY{$pathname}{"requested"} == 0 ) {
 					$DELAY{$pathname}{"requested"} = 1;
 				}
@@ -174,7 +181,13 @@ sub rot13 {
 			die "bad command '$command'";
 		}
 
-		if ( $pathname eq "error.r" ) {
+		if ( $batch ) {
+			print $debug "[BATCHED]\n";
+			$debug->flush();
+			$DELAY{$pathname}{"count"} = 1 unless exists $DELAY{$pathname};
+			$DELAY{$pathname}{"requested"} = 2;
+			$DELAY{$pathname}{"output"} = $output;
+		} elsif ( $pathname eq "error.r" ) {
 			print $debug "[ERROR]\n";
 			$debug->flush();
 			packet_txt_write("status=error");
@@ -0,0 +1,189 @@
+#!/bin/sh
+
+test_description='the reftable ref storage backend'
+
+. ./test-lib.sh
+
+nr_tables () {
+	wc -l <"$1/.git/reftable/tables.list"
+}
+
+test_expect_success 'init with reftable' '
+	git init --ref-storage=reftable repo &&
+	test_path_is_dir repo/.git/reftable &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	echo reftable >expect &&
+	git -C repo config extensions.refStorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryFormatVersion >actual &&
+	test_cmp expect actual &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reinit keeps the format' '
+	git init repo &&
+	test_must_fail git init --ref-storage=files repo &&
+	test_must_fail git init --ref-storage=nosuch other &&
+	test_path_is_missing other/.git/config
+'
+
+test_expect_success 'commits and branches' '
+	test_commit -C repo one &&
+	test_commit -C repo two &&
+	git -C repo rev-parse two >expect &&
+	git -C repo rev-parse master >actual &&
+	test_cmp expect actual &&
+	git -C repo branch topic one &&
+	git -C repo rev-parse one >expect &&
+	git -C repo rev-parse topic >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing repo/.git/refs/heads/master &&
+	test_path_is_missing repo/.git/packed-refs
+'
+
+test_expect_success 'for-each-ref and peeled tags' '
+	git -C repo tag -a -m annotated v1 one &&
+	cat >expect <<-EOF &&
+	$(git -C repo rev-parse master) refs/heads/master
+	$(git -C repo rev-parse one) refs/heads/topic
+	$(git -C repo rev-parse one) refs/tags/one
+	$(git -C repo rev-parse two) refs/tags/two
+	$(git -C repo rev-parse v1) refs/tags/v1
+	$(git -C repo rev-parse one) refs/tags/v1^{}
+	EOF
+	git -C repo show-ref -d >actual &&
+	test_cmp expect actual &&
+	git -C repo for-each-ref --format="%(refname)" refs/tags/ >actual &&
+	printf "refs/tags/%s\n" one two v1 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'delete and rename branches' '
+	git -C repo branch doomed &&
+	git -C repo branch -d doomed &&
+	test_must_fail git -C repo rev-parse --verify doomed &&
+	test_must_fail git -C repo reflog exists refs/heads/doomed &&
+	git -C repo branch -m topic renamed &&
+	test_must_fail git -C repo rev-parse --verify topic &&
+	git -C repo rev-parse one >expect &&
+	git -C repo rev-parse renamed >actual &&
+	test_cmp expect actual &&
+	git -C repo reflog show --format=%gs renamed >actual &&
+	cat >expect <<-\EOF &&
+	Branch: renamed refs/heads/topic to refs/heads/renamed
+	branch: Created from one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'D/F conflicts are detected' '
+	test_must_fail git -C repo branch renamed/sub &&
+	test_must_fail git -C repo update-ref refs/heads
+'
+
+test_expect_success 'transactions are atomic' '
+	git -C repo rev-parse master >before &&
+	test_must_fail git -C repo update-ref --stdin <<-EOF &&
+	update refs/heads/master $(git -C repo rev-parse one)
+	create refs/heads/new $(git -C repo rev-parse one)
+	verify refs/heads/renamed $(git -C repo rev-parse two)
+	EOF
+	git -C repo rev-parse master >after &&
+	test_cmp before after &&
+	test_must_fail git -C repo rev-parse --verify refs/heads/new
+'
+
+test_expect_success 'reflogs' '
+	git -C repo reflog show --format=%gs HEAD >actual &&
+	cat >expect <<-\EOF &&
+	commit: two
+	commit (initial): one
+	EOF
+	test_cmp expect actual &&
+	git -C repo rev-parse master@{1} >actual &&
+	git -C repo rev-parse one >expect &&
+	test_cmp expect actual &&
+	git -C repo reflog expire --expire=all --all &&
+	git -C repo reflog show HEAD >actual &&
+	test_must_be_empty actual &&
+	git -C repo reflog exists HEAD
+'
+
+test_expect_success 'symbolic refs and pseudorefs' '
+	git -C repo symbolic-ref refs/heads/alias refs/heads/master &&
+	git -C repo rev-parse master >expect &&
+	git -C repo rev-parse alias >actual &&
+	test_cmp expect actual &&
+	git -C repo update-ref ORIG_HEAD one &&
+	test_path_is_file repo/.git/ORIG_HEAD &&
+	git -C repo rev-parse one >expect &&
+	git -C repo rev-parse ORIG_HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'checkout and detached HEAD' '
+	git -C repo checkout -q one^0 &&
+	test_must_fail git -C repo symbolic-ref HEAD &&
+	git -C repo checkout -q master &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'many refs, and pack-refs compacts the stack' '
+	for i in $(test_seq 200)
+	do
+		echo "create refs/heads/many/$i HEAD" || return 1
+	done >input &&
+	git -C repo update-ref --stdin <input &&
+	for i in $(test_seq 10)
+	do
+		git -C repo branch extra-$i || return 1
+	done &&
+	git -C repo for-each-ref refs/heads/many/ >actual &&
+	test_line_count = 200 actual &&
+	git -C repo rev-parse --verify refs/heads/many/123 &&
+	git -C repo pack-refs --all &&
+	echo 1 >expect &&
+	nr_tables repo >actual &&
+	test_cmp expect actual &&
+	git -C repo for-each-ref refs/heads/many/ >actual &&
+	test_line_count = 200 actual
+'
+
+test_expect_success 'the stack stays short' '
+	for i in $(test_seq 20)
+	do
+		git -C repo update-ref refs/heads/counter HEAD || return 1
+	done &&
+	test $(nr_tables repo) -lt 10
+'
+
+test_expect_success 'fsck, gc and clone' '
+	git -C repo fsck &&
+	git -C repo gc &&
+	git -C repo rev-parse --verify renamed &&
+	git clone repo clone &&
+	git -C repo rev-parse master >expect &&
+	git -C clone rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'an atomic fetch adds a single table' '
+	git init --ref-storage=reftable fetcher &&
+	before=$(nr_tables fetcher) &&
+	git -C fetcher fetch --atomic ../repo \
+		"refs/heads/many/*:refs/remotes/many/*" &&
+	git -C fetcher for-each-ref refs/remotes/many/ >actual &&
+	test_line_count = 200 actual &&
+	test $(nr_tables fetcher) = $(($before + 1))
+'
+
+test_expect_success 'linked worktrees are refused' '
+	test_must_fail git -C repo worktree add ../wt
+'
+
+test_done
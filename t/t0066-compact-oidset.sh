@@ -0,0 +1,93 @@
+#!/bin/sh
+
+test_description='basic tests for the compact oidset implementation'
+. ./test-lib.sh
+
+# oids that sort in another order than they are generated, and share
+# leading bytes with their neighbours
+oids () {
+	for n in $(test_seq $1 $2)
+	do
+		printf "%02x%038x\n" $((n * 37 % 251)) $n
+	done
+}
+
+cmds () {
+	cmd=$1
+	shift
+	oids "$@" | sed "s/^/$cmd /"
+}
+
+test_expect_success 'insert, contains and remove' '
+	oid=$(oids 1 1) &&
+	other=$(oids 2 2) &&
+	cat >in <<-EOF &&
+	insert $oid
+	insert $oid
+	contains $oid
+	contains $other
+	remove $other
+	remove $oid
+	contains $oid
+	insert $oid
+	EOF
+	test-tool compact-oidset <in >actual &&
+	printf "%s\n" 0 1 1 0 0 1 0 0 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'many oids, in sorted runs' '
+	{
+		cmds insert 1 500 &&
+		cmds insert 1 500 &&
+		cmds contains 1 500 &&
+		cmds contains 501 600 &&
+		echo iterate
+	} >in &&
+	GIT_TEST_COMPACT_OIDSET_STAGING=3 test-tool compact-oidset <in >out &&
+	{
+		printf "0\n%.0s" $(test_seq 500) &&
+		printf "1\n%.0s" $(test_seq 500) &&
+		printf "1\n%.0s" $(test_seq 500) &&
+		printf "0\n%.0s" $(test_seq 100)
+	} >expect &&
+	head -n 1600 out >actual &&
+	test_cmp expect actual &&
+	oids 1 500 | sort >expect &&
+	tail -n +1601 out | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'remove from sorted runs' '
+	{
+		cmds insert 1 200 &&
+		cmds remove 101 150 &&
+		cmds remove 101 150 &&
+		cmds contains 101 150 &&
+		cmds insert 141 150 &&
+		cmds insert 201 400 &&
+		cmds contains 101 150 &&
+		echo iterate
+	} >in &&
+	GIT_TEST_COMPACT_OIDSET_STAGING=3 test-tool compact-oidset <in >out &&
+	{
+		printf "0\n%.0s" $(test_seq 200) &&
+		printf "1\n%.0s" $(test_seq 50) &&
+		printf "0\n%.0s" $(test_seq 50) &&
+		printf "0\n%.0s" $(test_seq 50) &&
+		printf "0\n%.0s" $(test_seq 10) &&
+		printf "0\n%.0s" $(test_seq 200) &&
+		printf "0\n%.0s" $(test_seq 40) &&
+		printf "1\n%.0s" $(test_seq 10)
+	} >expect &&
+	head -n 610 out >actual &&
+	test_cmp expect actual &&
+	{
+		oids 1 100 &&
+		oids 141 400
+	} | sort >expect &&
+	tail -n +611 out | sort >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,12 @@
+#!/bin/sh
+
+test_description='basic tests for the bitmap operations of ewah/'
+. ./test-lib.sh
+
+test_expect_success 'bitmap kernels agree with the word at a time versions' '
+	test-tool ewah verify >actual &&
+	echo ok >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,133 @@
+#!/bin/sh
+
+test_description='git command-server'
+
+. ./test-lib.sh
+
+if test -n "$NO_UNIX_SOCKETS"
+then
+	skip_all='command-server needs unix sockets'
+	test_done
+fi
+
+# Run "git" with the server of the test repository, and with the same
+# trace2 target as the server, which it insists on.
+served () {
+	GIT_COMMAND_SERVER="$TRASH_DIRECTORY/.git/command-server.ipc" \
+	GIT_TRACE2_EVENT="$TRASH_DIRECTORY/trace.event" \
+	git "$@"
+}
+
+start_server () {
+	GIT_TRACE2_EVENT="$TRASH_DIRECTORY/trace.event" \
+	git command-server start
+}
+
+served_count () {
+	grep "\"key\":\"served\"" "$TRASH_DIRECTORY/trace.event" | wc -l
+}
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub &&
+	echo one >one &&
+	echo two >dir/two &&
+	echo three >dir/sub/three &&
+	git add . &&
+	cat >>.git/info/exclude <<-\EOF &&
+	expect*
+	actual*
+	out
+	trace.event
+	EOF
+	test_tick &&
+	git commit -m initial &&
+	echo changed >dir/two
+'
+
+test_expect_success 'start, status and stop' '
+	test_when_finished "git command-server stop || :" &&
+	git command-server start &&
+	git command-server status >out &&
+	test_i18ngrep "is serving" out &&
+	test_must_fail git command-server start &&
+	git command-server stop &&
+	test_must_fail git command-server status >out &&
+	test_i18ngrep "is not running" out
+'
+
+test_expect_success 'read-only commands are served' '
+	test_when_finished "git command-server stop" &&
+	rm -f trace.event &&
+	start_server &&
+	(
+		cd dir &&
+		git status --porcelain >../expect.status &&
+		served status --porcelain >../actual.status &&
+		git rev-parse --show-prefix HEAD >../expect.rev-parse &&
+		served rev-parse --show-prefix HEAD >../actual.rev-parse &&
+		git ls-files >../expect.ls-files &&
+		served ls-files >../actual.ls-files &&
+		echo HEAD:dir/two | git cat-file --batch-check >../expect.cat-file &&
+		echo HEAD:dir/two | served cat-file --batch-check >../actual.cat-file &&
+		test_expect_code 1 served diff --quiet &&
+		test_must_fail served cat-file -e HEAD:nope 2>../actual.err
+	) &&
+	for cmd in status rev-parse ls-files cat-file
+	do
+		test_cmp expect.$cmd actual.$cmd || return 1
+	done &&
+	test_i18ngrep "Not a valid object name" actual.err &&
+	test $(served_count) = 6
+'
+
+test_expect_success 'the server notices a change to the index' '
+	test_when_finished "git command-server stop; git reset -q" &&
+	rm -f trace.event &&
+	start_server &&
+	served diff --cached --name-only >actual &&
+	test_must_be_empty actual &&
+	git add dir/two &&
+	served diff --cached --name-only >actual &&
+	echo dir/two >expect &&
+	test_cmp expect actual &&
+	test $(served_count) = 2
+'
+
+test_expect_success 'commands the server cannot run are run by the client' '
+	test_when_finished "git command-server stop" &&
+	rm -f trace.event &&
+	start_server &&
+	git init -q nested &&
+	(
+		cd nested &&
+		served status --porcelain >../actual
+	) &&
+	test_must_be_empty actual &&
+	served --no-pager status --porcelain >/dev/null &&
+	(
+		GIT_DIR=.git &&
+		export GIT_DIR &&
+		served status --porcelain >/dev/null
+	) &&
+	GIT_TRACE2_EVENT="$TRASH_DIRECTORY/trace.event" \
+	GIT_COMMAND_SERVER="$TRASH_DIRECTORY/.git/command-server.ipc" \
+	HOME="$TRASH_DIRECTORY/dir" git status --porcelain >/dev/null &&
+	served count-objects >/dev/null &&
+	test $(served_count) = 0 &&
+	rm -rf nested
+'
+
+test_expect_success 'a change to the configuration stops the server' '
+	test_when_finished "git command-server stop || :" &&
+	rm -f trace.event &&
+	start_server &&
+	served status --porcelain >/dev/null &&
+	git config core.abbrev 12 &&
+	served log -1 --format=%h >actual &&
+	git rev-parse --short=12 HEAD >expect &&
+	test_cmp expect actual &&
+	test $(served_count) = 1 &&
+	test_must_fail git command-server status
+'
+
+test_done
@@ -0,0 +1,32 @@
+#!/bin/sh
+
+test_description='the data structure benchmarks of test-tool bench'
+. ./test-lib.sh
+
+# The workloads check their own answers, so running them small
+# is a test of the data structures as well.
+test_expect_success 'all workloads run and report every phase' '
+	test-tool bench all 1e3 >out &&
+	test-tool bench list >workloads &&
+	while read workload
+	do
+		grep "^$workload  *[a-z-]*  *1000 .* ns/op .* allocs/op .* bytes/op$" out ||
+		return 1
+	done <workloads &&
+	test_line_count = 29 out
+'
+
+test_expect_success 'a workload of odd size' '
+	test-tool bench oidmap 1 >out &&
+	test_line_count = 5 out &&
+	test-tool bench mergesort 12345 >out &&
+	test_line_count = 2 out
+'
+
+test_expect_success 'bad arguments' '
+	test_must_fail test-tool bench no-such-workload &&
+	test_must_fail test-tool bench hashmap 0 &&
+	test_must_fail test-tool bench hashmap many
+'
+
+test_done
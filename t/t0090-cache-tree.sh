@@ -252,4 +252,64 @@ test_expect_success 'switching trees does not invalidate shared index' '
 	test_cmp before after
 '
 
+test_expect_success 'checkout carries the trees of unchanged directories' '
+	git init carry &&
+	(
+		cd carry &&
+		mkdir -p a/b c d &&
+		for f in a/one a/b/two c/three d/four
+		do
+			echo $f >$f || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		git branch other &&
+		echo changed >c/three &&
+		git commit -am change &&
+		git checkout other &&
+		echo staged >d/four &&
+		git add d/four &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" git checkout master &&
+		grep "\"key\":\"carried_trees\",\"value\":[1-9]" trace.event &&
+		git diff-index --cached --name-only HEAD >actual &&
+		echo d/four >expect &&
+		test_cmp expect actual &&
+		test-tool dump-cache-tree >dump &&
+		grep "^$(git rev-parse HEAD:a/b) a/b/" dump &&
+		grep "^$(git rev-parse HEAD:c) c/" dump &&
+		git write-tree &&
+		test-tool dump-cache-tree >dump &&
+		! grep "^invalid" dump
+	)
+'
+
+test_expect_success 'diff-index --cached goes by the cache-tree of the whole index' '
+	git init whole &&
+	(
+		cd whole &&
+		mkdir dir &&
+		echo one >dir/one &&
+		echo two >two &&
+		git add . &&
+		git commit -m base &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git diff-index --cached --exit-code HEAD &&
+		grep "\"key\":\"cache_tree_matched\"" trace.event &&
+		echo new >new &&
+		git add -N new &&
+		git diff-index --cached --name-only --ita-visible-in-index HEAD >actual &&
+		echo new >expect &&
+		test_cmp expect actual &&
+		git rm --cached -q new &&
+		echo changed >dir/one &&
+		git add dir/one &&
+		git diff-index --cached --name-only HEAD >actual &&
+		echo dir/one >expect &&
+		test_cmp expect actual &&
+		git status --porcelain --untracked-files=no >actual &&
+		echo "M  dir/one" >expect &&
+		test_cmp expect actual
+	)
+'
+
 test_done
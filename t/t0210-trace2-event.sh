@@ -0,0 +1,162 @@
+#!/bin/sh
+
+test_description='structured tracing with GIT_TRACE2_EVENT'
+
+. ./test-lib.sh
+
+# Print the events of the given type on the standard output, without
+# the fields that change from run to run.
+events () {
+	grep "^{\"event\":\"$1" trace |
+	sed -e 's/,"sid":"[^"]*"//' \
+	    -e 's/,"time":"[^"]*"//' \
+	    -e 's/,"file":"[^"]*","line":[0-9]*//' \
+	    -e 's/,"t_abs":[0-9.]*//' \
+	    -e 's/,"t_rel":[0-9.]*//'
+}
+
+test_expect_success 'nothing is written unless asked for' '
+	rm -f trace &&
+	test-tool trace2 region test label &&
+	test_path_is_missing trace
+'
+
+test_expect_success 'start, command name and exit' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git version &&
+	events start >actual &&
+	grep "\"argv\":\[\"[^\"]*git\",\"version\"\]" actual &&
+	events cmd_name >actual &&
+	echo "{\"event\":\"cmd_name\",\"thread\":\"main\",\"name\":\"version\"}" >expect &&
+	test_cmp expect actual &&
+	events exit >actual &&
+	echo "{\"event\":\"exit\",\"thread\":\"main\",\"code\":0}" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'regions, data and counters' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool trace2 \
+		region test "a \"label\"" data test key 42 \
+		counter hits 2 counter hits 3 &&
+	events region_ >actual &&
+	cat >expect <<-\EOF &&
+	{"event":"region_enter","thread":"main","nesting":1,"category":"test","label":"a \"label\""}
+	{"event":"region_leave","thread":"main","nesting":1,"category":"test","label":"a \"label\""}
+	EOF
+	test_cmp expect actual &&
+	events data >actual &&
+	echo "{\"event\":\"data\",\"thread\":\"main\",\"nesting\":0,\"category\":\"test\",\"key\":\"key\",\"value\":42}" >expect &&
+	test_cmp expect actual &&
+	events counter >actual &&
+	echo "{\"event\":\"counter\",\"thread\":\"main\",\"category\":\"test\",\"name\":\"hits\",\"value\":5}" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success !NO_PTHREADS 'threads are named' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool trace2 thread worker &&
+	events thread_ >actual &&
+	cat >expect <<-\EOF &&
+	{"event":"thread_start","thread":"th01:worker"}
+	{"event":"thread_exit","thread":"th01:worker"}
+	EOF
+	test_cmp expect actual &&
+	events region_enter >actual &&
+	echo "{\"event\":\"region_enter\",\"thread\":\"th01:worker\",\"nesting\":1,\"category\":\"test\",\"label\":\"in-thread\"}" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'errors and die' '
+	rm -f trace &&
+	test_expect_code 128 env GIT_TRACE2_EVENT="$(pwd)/trace" \
+		test-tool trace2 error "first" die "second" &&
+	events error >actual &&
+	cat >expect <<-\EOF &&
+	{"event":"error","thread":"main","msg":"first","fmt":"%s"}
+	{"event":"error","thread":"main","msg":"second","fmt":"%s"}
+	EOF
+	test_cmp expect actual &&
+	events exit >actual &&
+	echo "{\"event\":\"exit\",\"thread\":\"main\",\"code\":128}" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'exit code is recorded' '
+	rm -f trace &&
+	test_expect_code 3 env GIT_TRACE2_EVENT="$(pwd)/trace" \
+		test-tool trace2 exit 3 &&
+	events exit >actual &&
+	echo "{\"event\":\"exit\",\"thread\":\"main\",\"code\":3}" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'children are traced, and inherit the session id' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" test-tool trace2 run git version &&
+	events child_start >actual &&
+	echo "{\"event\":\"child_start\",\"thread\":\"main\",\"child_id\":0,\"child_class\":\"other\",\"argv\":[\"git\",\"version\"]}" >expect &&
+	test_cmp expect actual &&
+	events child_exit >actual &&
+	grep "\"child_id\":0,\"pid\":[0-9]*,\"code\":0}$" actual &&
+	parent=$(sed -n -e "1s/.*\"sid\":\"\([^\"]*\)\".*/\1/p" trace) &&
+	grep "^{\"event\":\"cmd_name\",\"sid\":\"$parent/" trace
+'
+
+test_expect_success 'index operations are timed' '
+	git init repo &&
+	test_commit -C repo one &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo status &&
+	events region_enter >actual &&
+	grep "\"category\":\"index\",\"label\":\"do_read_index\"" actual &&
+	events data >actual &&
+	grep "\"key\":\"read/cache_nr\",\"value\":1}" actual
+'
+
+test_expect_success 'status and object access report their counters' '
+	git -C repo gc &&
+	>repo/untracked &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo status &&
+	events region_enter >actual &&
+	grep "\"category\":\"dir\",\"label\":\"read_directory\"" actual &&
+	events data >actual &&
+	grep "\"key\":\"read_directory/untracked\",\"value\":1}" actual &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo cat-file -p HEAD:one.t &&
+	events counter >actual &&
+	grep "\"name\":\"find_pack_entry\",\"value\":[1-9]" actual &&
+	grep "\"name\":\"inflated/objects\",\"value\":[1-9]" actual
+'
+
+test_expect_success 'pack window use is counted' '
+	rm -f trace &&
+	git -C repo rev-parse HEAD HEAD: HEAD:one.t >objects &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo cat-file --batch \
+		<objects >/dev/null &&
+	events counter >actual &&
+	grep "\"name\":\"windows/map\",\"value\":1}" actual &&
+	grep "\"name\":\"windows/hit\",\"value\":[1-9]" actual
+'
+
+test_expect_success 'checkout, archive and grep read blobs ahead' '
+	test_commit -C repo two &&
+	test_commit -C repo three &&
+	git -C repo repack -ad &&
+	git -C repo checkout -q one &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo checkout -q - &&
+	events counter >actual &&
+	grep "\"name\":\"readahead/bytes\",\"value\":[1-9]" actual &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo archive HEAD >/dev/null &&
+	events counter >actual &&
+	grep "\"name\":\"readahead/bytes\",\"value\":[1-9]" actual &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C repo grep -q two HEAD &&
+	events counter >actual &&
+	grep "\"name\":\"readahead/bytes\",\"value\":[1-9]" actual
+'
+
+test_done
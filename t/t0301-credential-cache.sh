@@ -106,6 +106,53 @@ test_expect_success SYMLINKS 'use user socket if user directory is a symlink to
 	test -S "$HOME/.git-credential-cache/socket"
 '
 
+test_expect_success PERL 'a slow client does not hold up the others' '
+	test_when_finished "
+		touch done &&
+		wait &&
+		git credential-cache exit --socket \"\$HOME/slow/socket\" &&
+		rm -rf \"\$HOME/slow\" connected done timed-out
+	" &&
+	check approve "cache --socket \"\$HOME/slow/socket\"" <<-\EOF &&
+	protocol=https
+	host=example.com
+	username=store-user
+	password=store-pass
+	EOF
+	{
+		"$PERL_PATH" -MIO::Socket::UNIX -e "
+			my \$s = IO::Socket::UNIX->new(Peer => shift) or die;
+			syswrite \$s, qq(action=get\\n);
+			open my \$fh, qq(>connected) or die;
+			close \$fh;
+			for (1..30) {
+				exit 0 if -e qq(done);
+				sleep 1;
+			}
+			open \$fh, qq(>timed-out) or die;
+		" "$HOME/slow/socket" &
+	} &&
+	for i in $(test_seq 30)
+	do
+		test -f connected && break
+		sleep 1
+	done &&
+	test -f connected &&
+	check fill "cache --socket \"\$HOME/slow/socket\"" <<-\EOF &&
+	protocol=https
+	host=example.com
+	--
+	protocol=https
+	host=example.com
+	username=store-user
+	password=store-pass
+	--
+	EOF
+	touch done &&
+	wait &&
+	test_path_is_missing timed-out
+'
+
 helper_test_timeout cache --timeout=1
 
 # we can't rely on our "trap" above working after test_done,
@@ -573,4 +573,115 @@ test_expect_success 'cat-file --batch-all-objects shows all objects' '
 	test_cmp expect actual
 '
 
+test_expect_success '--batch-order=input shows objects in input order' '
+	{
+		git rev-list --objects --all | cut -d" " -f1 | sort -r &&
+		echo nosuch &&
+		echo HEAD:loop1 &&
+		echo HEAD:morx
+	} >input &&
+	git cat-file --batch --follow-symlinks <input >expect &&
+	git cat-file --batch --follow-symlinks --batch-order=input \
+		<input >actual &&
+	test_cmp expect actual &&
+	GIT_TEST_CAT_FILE_THREADS=4 git cat-file --batch --follow-symlinks \
+		--batch-order=input <input >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-order=pack shows objects by pack offset' '
+	echo not-cloned | git -C all-one hash-object --stdin >expect &&
+	cat all-one/.git/objects/pack/pack-*.idx | git show-index |
+		sort -n | cut -d" " -f2 >>expect &&
+	git -C all-one cat-file --batch-all-objects \
+		--batch-check="%(objectname)" >all-input &&
+	git -C all-one cat-file --batch-check="%(objectname)" \
+		--batch-order=pack <all-input >actual &&
+	test_cmp expect actual &&
+	git -C all-one cat-file --batch-all-objects --batch-order=pack \
+		--batch-check="%(objectname)" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-order=pack shows the contents of the objects' '
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch-check="%(objectname)" --batch-order=pack \
+		<objects >names &&
+	git cat-file --batch <names >expect &&
+	GIT_TEST_CAT_FILE_THREADS=4 git cat-file --batch --batch-order=pack \
+		<objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-order needs input or pack' '
+	test_must_fail git cat-file --batch --batch-order=hash </dev/null &&
+	test_must_fail git cat-file --batch-order=pack HEAD
+'
+
+test_expect_success '--batch-command shows info and contents' '
+	git rev-parse HEAD HEAD^{tree} HEAD:foo >objects &&
+	echo nosuch >>objects &&
+	{
+		git cat-file --batch-check <objects &&
+		git cat-file --batch <objects
+	} >expect &&
+	{
+		sed -e "s/^/info /" objects &&
+		sed -e "s/^/contents /" objects
+	} >commands &&
+	git cat-file --batch-command <commands >actual &&
+	test_cmp expect actual &&
+	git cat-file --batch-command --buffer <commands >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch-command uses the format for both commands' '
+	oid=$(git rev-parse HEAD) &&
+	echo "$oid commit" >expect &&
+	echo "$oid commit" >>expect &&
+	git cat-file commit HEAD >>expect &&
+	echo >>expect &&
+	printf "info %s\ncontents %s\n" $oid $oid |
+	git cat-file --batch-command="%(objectname) %(objecttype)" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success PIPE '--batch-command --buffer writes out on flush' '
+	mkfifo in out &&
+	(git cat-file --batch-command --buffer <in >out &) &&
+	exec 9>in &&
+	exec 8<out &&
+	test_when_finished "exec 9>&-" &&
+	test_when_finished "exec 8<&-" &&
+	git cat-file --batch-check <objects >expect &&
+	echo >&9 "info $(head -n 1 objects)" &&
+	echo >&9 flush &&
+	read response <&8 &&
+	echo "$response" >actual &&
+	head -n 1 expect >expect.1 &&
+	test_cmp expect.1 actual &&
+	echo >&9 "info $(tail -n 1 objects)" &&
+	echo >&9 flush &&
+	read response <&8 &&
+	echo "$response" >actual &&
+	tail -n 1 expect >expect.1 &&
+	test_cmp expect.1 actual
+'
+
+test_expect_success '--batch-command rejects bad commands' '
+	echo flush | test_must_fail git cat-file --batch-command 2>err &&
+	test_i18ngrep "only for --buffer" err &&
+	echo "flush now" |
+	test_must_fail git cat-file --batch-command --buffer 2>err &&
+	test_i18ngrep "takes no arguments" err &&
+	echo info | test_must_fail git cat-file --batch-command 2>err &&
+	test_i18ngrep "requires arguments" err &&
+	echo "infos HEAD" | test_must_fail git cat-file --batch-command 2>err &&
+	test_i18ngrep "unknown command" err &&
+	echo " info HEAD" | test_must_fail git cat-file --batch-command 2>err &&
+	test_i18ngrep "whitespace before command" err &&
+	echo | test_must_fail git cat-file --batch-command 2>err &&
+	test_i18ngrep "empty command" err
+'
+
 test_done
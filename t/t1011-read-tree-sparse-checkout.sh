@@ -275,4 +275,98 @@ test_expect_success 'checkout with --ignore-skip-worktree-bits' '
 	git diff --exit-code HEAD
 '
 
+test_expect_success 'setup cone mode' '
+	git init cone &&
+	(
+		cd cone &&
+		mkdir -p deep/deeper1/deepest deep/deeper2 folder1 folder2 &&
+		for f in a deep/a deep/deeper1/a deep/deeper1/deepest/a \
+			 deep/deeper2/a folder1/a folder2/a
+		do
+			echo $f >$f || return 1
+		done &&
+		git add . &&
+		git commit -m initial &&
+		git config core.sparseCheckout true &&
+		git config core.sparseCheckoutCone true
+	)
+'
+
+# Apply the given cone patterns and check that the skip-worktree bits
+# are the same as without cone mode.
+check_cone () {
+	cat >cone/.git/info/sparse-checkout &&
+	git -C cone read-tree -mu HEAD 2>cone-err &&
+	git -C cone ls-files -t >cone-actual &&
+	git -C cone -c core.sparseCheckoutCone=false read-tree -mu HEAD &&
+	git -C cone ls-files -t >cone-expect &&
+	test_cmp cone-expect cone-actual
+}
+
+test_expect_success 'cone mode: top-level files only' '
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	EOF
+	cat >expect <<-\EOF &&
+	H a
+	S deep/a
+	S deep/deeper1/a
+	S deep/deeper1/deepest/a
+	S deep/deeper2/a
+	S folder1/a
+	S folder2/a
+	EOF
+	test_cmp expect cone-actual &&
+	test_must_be_empty cone-err &&
+	test_path_is_missing cone/deep
+'
+
+test_expect_success 'cone mode: recursive and parent directories' '
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	/deep/
+	!/deep/*/
+	/deep/deeper1/
+	/folder2/
+	EOF
+	cat >expect <<-\EOF &&
+	H a
+	H deep/a
+	H deep/deeper1/a
+	H deep/deeper1/deepest/a
+	S deep/deeper2/a
+	S folder1/a
+	H folder2/a
+	EOF
+	test_cmp expect cone-actual &&
+	test_must_be_empty cone-err &&
+	test_path_is_file cone/deep/deeper1/deepest/a &&
+	test_path_is_missing cone/deep/deeper2
+'
+
+test_expect_success 'cone mode: everything' '
+	echo "/*" | check_cone &&
+	! grep "^S" cone-actual &&
+	test_must_be_empty cone-err
+'
+
+test_expect_success 'cone mode: other patterns disable it' '
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	/deep/deeper*/
+	EOF
+	test_i18ngrep "unrecognized pattern: ./deep/deeper\*." cone-err &&
+	test_i18ngrep "disabling cone pattern matching" cone-err &&
+	check_cone <<-\EOF &&
+	/*
+	!/*/
+	!/folder1/*/
+	EOF
+	test_i18ngrep "unrecognized negative pattern: ./folder1/\*." cone-err &&
+	test_i18ngrep "disabling cone pattern matching" cone-err
+'
+
 test_done
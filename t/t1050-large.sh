@@ -182,6 +182,23 @@ test_expect_success 'repack' '
 	git repack -ad
 '
 
+test_expect_success 'large blobs are compressed by several threads' '
+	test_create_repo parallel &&
+	(
+		cd parallel &&
+		test_seq 200000 >seq &&
+		GIT_TEST_BULK_CHECKIN_THREADS=3 \
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" git add seq &&
+		grep "\"key\":\"parallel_chunks\",\"value\":[1-9]" trace.event &&
+		git index-pack --verify .git/objects/pack/pack-*.pack &&
+		git cat-file blob :seq >actual &&
+		test_cmp seq actual &&
+		sz=$(git rev-parse :seq |
+		     git cat-file --batch-check="%(objectsize:disk)") &&
+		test "$sz" -le 500000
+	)
+'
+
 test_expect_success 'pack-objects with large loose object' '
 	SHA1=$(git hash-object huge) &&
 	test_create_repo loose &&
@@ -194,6 +211,28 @@ test_expect_success 'pack-objects with large loose object' '
 	test_cmp huge actual
 '
 
+test_expect_success 'deltified large blobs are streamed' '
+	test_create_repo delta &&
+	(
+		cd delta &&
+		test-tool genrandom "d" $(( 1800 * 1024 )) >one &&
+		{ cat one && echo two; } >two &&
+		{ echo three && cat two; } >three &&
+		git add one two three &&
+		git commit -q -m delta &&
+		git rev-parse :one :two :three >oids &&
+		GIT_ALLOC_LIMIT=0 git -c core.bigfilethreshold=10m \
+			repack -adf --window=3 --depth=2 &&
+		git cat-file --batch-check="%(deltabase)" <oids >bases &&
+		test $(grep -vc "^0*$" bases) = 2 &&
+		for f in one two three
+		do
+			git cat-file blob :$f >actual &&
+			test_cmp $f actual || return 1
+		done
+	)
+'
+
 test_expect_success 'tar achiving' '
 	git archive --format=tar HEAD >/dev/null
 '
@@ -0,0 +1,180 @@
+#!/bin/sh
+
+test_description='compare full and sparse index in a sparse checkout'
+
+. ./test-lib.sh
+
+# a split index is never made sparse
+sane_unset GIT_TEST_SPLIT_INDEX
+
+test_expect_success 'setup' '
+	git init initial-repo &&
+	(
+		cd initial-repo &&
+		echo a >a &&
+		echo "after deep" >e &&
+		mkdir -p deep/deeper1/deepest folder1/0 folder2 &&
+		echo a >deep/a &&
+		echo a >deep/deeper1/a &&
+		echo a >deep/deeper1/deepest/a &&
+		echo a >folder1/a &&
+		echo a >folder1/0/a &&
+		echo a >folder2/a &&
+		git add . &&
+		git commit -m "initial commit" &&
+		git checkout -b update-folder1 &&
+		echo b >folder1/a &&
+		echo b >folder1/0/b &&
+		git commit -a -m "update folder1" &&
+		git add folder1/0/b &&
+		git commit -m "add folder1/0/b" &&
+		git checkout -b update-deep master &&
+		echo b >deep/deeper1/deepest/a &&
+		git rm -q deep/deeper1/a &&
+		git commit -a -m "update deep" &&
+		git checkout master
+	) &&
+
+	for repo in full-checkout sparse-checkout sparse-index
+	do
+		git clone -q initial-repo $repo || return 1
+	done &&
+
+	git -C sparse-index config index.sparse true &&
+	for repo in sparse-checkout sparse-index
+	do
+		git -C $repo config core.sparseCheckout true &&
+		printf "/*\n!/*/\n/deep/\n" >$repo/.git/info/sparse-checkout &&
+		git -C $repo read-tree -mu HEAD || return 1
+	done
+'
+
+test_expect_success 'sparse-index contents' '
+	(cd sparse-index && test-tool read-cache --table) >cache &&
+	for dir in folder1 folder2
+	do
+		git -C sparse-index rev-parse HEAD:$dir >expect &&
+		grep "^040000 tree $(cat expect)	$dir/$" cache || return 1
+	done &&
+	! grep "^040000" cache | grep "	deep/" &&
+	test_path_is_missing sparse-index/folder1 &&
+
+	(cd sparse-index && test-tool read-cache --table --expand) >expanded &&
+	(cd sparse-checkout && test-tool read-cache --table) >expect &&
+	test_cmp expect expanded &&
+	(cd sparse-checkout && test-tool read-cache --table) >cache &&
+	! grep "^040000" cache
+'
+
+# Run the command in all three repositories and compare their output
+# and exit codes.
+test_all_match () {
+	for repo in full-checkout sparse-checkout sparse-index
+	do
+		(
+			cd $repo && {
+				"$@" >../$repo-out 2>../$repo-err
+				echo $? >../$repo-exit
+			}
+		) || return 1
+	done &&
+	test_cmp full-checkout-out sparse-checkout-out &&
+	test_cmp sparse-checkout-out sparse-index-out &&
+	test_cmp full-checkout-exit sparse-index-exit &&
+	test_cmp sparse-checkout-err sparse-index-err
+}
+
+# Like test_all_match, but the full checkout has all files on disk
+# and may say more.
+test_sparse_match () {
+	for repo in sparse-checkout sparse-index
+	do
+		(
+			cd $repo && {
+				"$@" >../$repo-out 2>../$repo-err
+				echo $? >../$repo-exit
+			}
+		) || return 1
+	done &&
+	test_cmp sparse-checkout-out sparse-index-out &&
+	test_cmp sparse-checkout-exit sparse-index-exit &&
+	test_cmp sparse-checkout-err sparse-index-err
+}
+
+test_expect_success 'status with options' '
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git status --porcelain=v2 -z -u &&
+	test_all_match git status --porcelain=v2 -uno &&
+	test_all_match git status --porcelain=v2 --branch -- deep folder1
+'
+
+test_expect_success 'status against a commit that differs in sparse directories' '
+	test_all_match git reset --soft update-folder1 &&
+	test_all_match git status --porcelain=v2 &&
+	test_sparse_match git status --porcelain=v2 -- folder1/0 &&
+	test_all_match git reset --soft update-deep &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git reset --hard master &&
+	test_all_match git status --porcelain=v2
+'
+
+test_expect_success 'add, commit, checkout' '
+	test_when_finished "test_all_match git reset --hard master" &&
+	test_tick &&
+	for repo in full-checkout sparse-checkout sparse-index
+	do
+		echo new >$repo/newfile &&
+		echo b >>$repo/deep/a || return 1
+	done &&
+	test_all_match git add newfile deep/a &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git commit -m "new and changed" &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git log --stat --format=%s -1 &&
+	test_all_match git rev-parse HEAD^{tree} &&
+	test_all_match git checkout update-folder1 &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git checkout -
+'
+
+test_expect_success 'commit -a and partial commits' '
+	test_when_finished "test_all_match git reset --hard master" &&
+	test_tick &&
+	for repo in full-checkout sparse-checkout sparse-index
+	do
+		echo c >>$repo/a &&
+		echo c >>$repo/deep/a || return 1
+	done &&
+	test_all_match git commit -m partial -- a &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git commit -a -m all &&
+	test_all_match git rev-parse HEAD^{tree}
+'
+
+test_expect_success 'add a path inside a sparse directory' '
+	test_when_finished "test_all_match git reset --hard master" &&
+	for repo in full-checkout sparse-checkout sparse-index
+	do
+		mkdir -p $repo/folder1 &&
+		echo c >$repo/folder1/a || return 1
+	done &&
+	test_all_match git add folder1/a &&
+	test_sparse_match git status --porcelain=v2 -uno &&
+	test_sparse_match git rev-parse :folder1/a
+'
+
+test_expect_success 'commands that need a full index expand it' '
+	test_all_match git ls-files --stage &&
+	test_all_match git diff --cached update-folder1 &&
+	test_sparse_match git ls-files -t
+'
+
+test_expect_success 'index.sparse=false writes a full index' '
+	test_when_finished "git -C sparse-index config index.sparse true" &&
+	git -C sparse-index config index.sparse false &&
+	git -C sparse-index reset --hard &&
+	(cd sparse-index && test-tool read-cache --table) >cache &&
+	! grep "^040000" cache
+'
+
+test_done
@@ -0,0 +1,156 @@
+#!/bin/sh
+
+test_description='cached snapshot of the configuration'
+. ./test-lib.sh
+
+# Age the configuration files, so that they are not too recent to cache.
+age_config () {
+	test-tool chmtime =-10 "$@"
+}
+
+# "git var -l" goes through the configset, unlike "git config".
+test_values () {
+	git var -l >vars &&
+	grep "^test\." vars >actual &&
+	test_cmp expect actual
+}
+
+test_cached_values () {
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git "$@" var -l >vars &&
+	grep "\"key\":\"cache_hit\"" trace.event &&
+	grep "^test\." vars >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'the repository cannot enable the cache' '
+	git config core.configCache true &&
+	git config test.one first &&
+	age_config .git/config &&
+	git var -l &&
+	test_path_is_missing .git/config-cache &&
+	git config --unset core.configCache
+'
+
+test_expect_success 'setup' '
+	git config --global core.configCache true &&
+	git config --add test.multi a &&
+	git config --add test.multi b &&
+	age_config .git/config "$HOME/.gitconfig"
+'
+
+test_expect_success 'reading the configuration writes the cache' '
+	cat >expect <<-\EOF &&
+	test.one=first
+	test.multi=a
+	test.multi=b
+	EOF
+	test_values &&
+	test_path_is_file .git/config-cache &&
+	test_cached_values
+'
+
+test_expect_success 'command-line values still apply' '
+	cat >expect <<-\EOF &&
+	test.one=first
+	test.multi=a
+	test.multi=b
+	test.one=second
+	EOF
+	test_cached_values -c test.one=second
+'
+
+test_expect_success 'a changed file is read again' '
+	git config test.one changed &&
+	age_config .git/config &&
+	cat >expect <<-\EOF &&
+	test.one=changed
+	test.multi=a
+	test.multi=b
+	EOF
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git var -l >vars &&
+	! grep "\"key\":\"cache_hit\"" trace.event &&
+	grep "^test\." vars >actual &&
+	test_cmp expect actual &&
+	test_cached_values
+'
+
+test_expect_success 'included files are checked too' '
+	echo "[test]two = included" >included &&
+	git config include.path ../included &&
+	age_config .git/config included &&
+	cat >expect <<-\EOF &&
+	test.one=changed
+	test.multi=a
+	test.multi=b
+	test.two=included
+	EOF
+	test_values &&
+	test_cached_values &&
+	echo "[test]two = edited" >included &&
+	test-tool chmtime =-5 included &&
+	sed s/included/edited/ expect >expect.edited &&
+	mv expect.edited expect &&
+	test_values
+'
+
+test_expect_success 'a new user configuration is noticed' '
+	test_cached_values &&
+	git config --global test.zero global &&
+	{ echo test.zero=global && cat expect; } >expect.global &&
+	mv expect.global expect &&
+	test_values
+'
+
+test_expect_success 'a garbled cache is ignored' '
+	echo garbage >.git/config-cache &&
+	test_values
+'
+
+# Rewrite the scope of the cached value of test.one and, with "$1",
+# the checksum.
+forge_cache () {
+	perl -MDigest::SHA=sha1 -e '
+		local $/;
+		open(my $fh, "<", ".git/config-cache") or die;
+		binmode $fh;
+		my $cache = <$fh>;
+		close $fh;
+		my $pos = index($cache, "test.one\0") - 11;
+		die "no test.one" if $pos < 0;
+		substr($cache, $pos, 1) = chr(1);
+		substr($cache, -20) = sha1(substr($cache, 0, -20)) if $ARGV[0];
+		open($fh, ">", ".git/config-cache") or die;
+		binmode $fh;
+		print $fh $cache;
+	' "$1"
+}
+
+test_expect_success 'a cache with a wrong checksum is ignored' '
+	test_values &&
+	test_cached_values &&
+	forge_cache "" &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git var -l >vars &&
+	! grep "\"key\":\"cache_hit\"" trace.event
+'
+
+test_expect_success 'the cache cannot hold values of other scopes' '
+	test_values &&
+	test_cached_values &&
+	forge_cache t &&
+	rm -f trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git var -l >vars &&
+	! grep "\"key\":\"cache_hit\"" trace.event
+'
+
+test_expect_success 'core.configCache=false removes the cache' '
+	test_values &&
+	test_path_is_file .git/config-cache &&
+	git config --global core.configCache false &&
+	git var -l &&
+	test_path_is_missing .git/config-cache
+'
+
+test_done
@@ -0,0 +1,123 @@
+#!/bin/sh
+
+test_description='Test hooks configured with hook.<name>.command'
+
+. ./test-lib.sh
+
+test_expect_success 'configured commands run along with the hook script' '
+	mkdir -p .git/hooks &&
+	write_script .git/hooks/pre-commit <<-\EOF &&
+	echo script >>.git/ran
+	EOF
+	test_config hook.pre-commit.command "echo one >>.git/ran" &&
+	git config --add hook.pre-commit.command "echo two >>.git/ran" &&
+	test_commit first &&
+	sort .git/ran >actual &&
+	cat >expect <<-\EOF &&
+	one
+	script
+	two
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'any failing command fails the hook' '
+	test_config hook.pre-commit.command true &&
+	git config --add hook.pre-commit.command false &&
+	test_must_fail git commit --allow-empty -m refused &&
+	test_cmp_rev first HEAD
+'
+
+test_expect_success 'configured commands without a hook script' '
+	rm -f .git/hooks/pre-commit &&
+	test_config hook.pre-commit.command false &&
+	test_must_fail git commit --allow-empty -m refused &&
+	git commit --no-verify --allow-empty -m allowed
+'
+
+test_expect_success 'hooks of one event run in parallel' '
+	write_script wait-for <<-\EOF &&
+	>"$1.started"
+	i=0
+	while ! test -f "$2.started"
+	do
+		test $i -lt 100 || exit 1
+		i=$(($i + 1))
+		sleep 0.1
+	done
+	>"$1.met"
+	EOF
+	test_config hook.post-commit.command "\"$PWD/wait-for\" a b" &&
+	git config --add hook.post-commit.command "\"$PWD/wait-for\" b a" &&
+	git commit --allow-empty -m parallel 2>err &&
+	test_path_is_file a.met &&
+	test_path_is_file b.met
+'
+
+test_expect_success 'hooks get their arguments and input' '
+	git init --bare remote.git &&
+	write_script remote.git/hooks/post-receive <<-\EOF &&
+	cat >script.input
+	EOF
+	git -C remote.git config hook.post-receive.command "cat >command.input" &&
+	git -C remote.git config hook.post-update.command "echo >command.args" &&
+	git push remote.git HEAD:refs/heads/one HEAD:refs/heads/two &&
+	cat >expect <<-EOF &&
+	$ZERO_OID $(git rev-parse HEAD) refs/heads/one
+	$ZERO_OID $(git rev-parse HEAD) refs/heads/two
+	EOF
+	test_cmp expect remote.git/script.input &&
+	test_cmp expect remote.git/command.input &&
+	echo refs/heads/one refs/heads/two >expect &&
+	test_cmp expect remote.git/command.args
+'
+
+test_expect_success 'the output of parallel hooks is not interleaved' '
+	git -C remote.git config hook.pre-receive.command \
+		"echo one-a; sleep 1; echo one-b" &&
+	git -C remote.git config --add hook.pre-receive.command \
+		"sleep 0.5; echo two-a; echo two-b" &&
+	git push remote.git HEAD:refs/heads/three 2>err &&
+	sed -n "s/^remote: \(.*[^ ]\) *\$/\1/p" err >actual &&
+	cat >expect <<-\EOF &&
+	two-a
+	two-b
+	one-a
+	one-b
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'async hooks are not waited for' '
+	rm -f done &&
+	write_script .git/hooks/post-commit <<-\EOF &&
+	i=0
+	while ! test -f go
+	do
+		test $i -lt 100 || break
+		i=$(($i + 1))
+		sleep 0.1
+	done
+	>done
+	EOF
+	test_config hook.post-commit.async true &&
+	git commit --allow-empty -m async &&
+	test_path_is_missing done &&
+	>go &&
+	i=0 &&
+	while ! test -f done
+	do
+		test $i -lt 100 &&
+		i=$(($i + 1)) &&
+		sleep 0.1 || return 1
+	done
+'
+
+test_expect_success 'hook.<name>.async is ignored where the hook decides' '
+	rm -f .git/hooks/post-commit &&
+	test_config hook.pre-commit.command false &&
+	test_config hook.pre-commit.async true &&
+	test_must_fail git commit --allow-empty -m refused
+'
+
+test_done
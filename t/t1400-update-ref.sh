@@ -1274,6 +1274,85 @@ test_expect_success 'stdin -z delete refs works with packed and loose refs' '
 	test_must_fail git rev-parse --verify -q $c
 '
 
+test_expect_success 'stdin runs several transactions in one session' '
+	H=$(git rev-parse $m) &&
+	cat >stdin <<-EOF &&
+	start
+	create refs/heads/txn1 $H
+	commit
+	start
+	create refs/heads/txn2 $H
+	create refs/heads/txn3 $H
+	commit
+	EOF
+	git update-ref --stdin <stdin >actual &&
+	printf "%s: ok\n" start commit start commit >expect &&
+	test_cmp expect actual &&
+	git rev-parse refs/heads/txn1 refs/heads/txn2 refs/heads/txn3 >actual &&
+	printf "%s\n" $H $H $H >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'stdin abort discards queued and prepared updates' '
+	H=$(git rev-parse $m) &&
+	cat >stdin <<-EOF &&
+	start
+	delete refs/heads/txn1 $H
+	abort
+	start
+	delete refs/heads/txn2 $H
+	prepare
+	abort
+	EOF
+	git update-ref --stdin <stdin >actual &&
+	printf "%s: ok\n" start abort start prepare abort >expect &&
+	test_cmp expect actual &&
+	git rev-parse --verify refs/heads/txn1 &&
+	git rev-parse --verify refs/heads/txn2 &&
+	test_path_is_missing .git/refs/heads/txn2.lock
+'
+
+test_expect_success 'stdin aborts a started transaction at end of input' '
+	H=$(git rev-parse $m) &&
+	printf "%s\n" start "delete refs/heads/txn3 $H" prepare >stdin &&
+	git update-ref --stdin <stdin >actual &&
+	printf "%s: ok\n" start prepare >expect &&
+	test_cmp expect actual &&
+	git rev-parse --verify refs/heads/txn3 &&
+	test_path_is_missing .git/refs/heads/txn3.lock
+'
+
+test_expect_success 'stdin commits updates queued before start with it' '
+	H=$(git rev-parse $m) &&
+	printf "%s\n" "delete refs/heads/txn1 $H" start "delete refs/heads/txn2 $H" \
+		commit >stdin &&
+	git update-ref --stdin <stdin >actual &&
+	test_must_fail git rev-parse --verify -q refs/heads/txn1 &&
+	test_must_fail git rev-parse --verify -q refs/heads/txn2
+'
+
+test_expect_success 'stdin refuses updates to a prepared transaction' '
+	H=$(git rev-parse $m) &&
+	printf "%s\n" start prepare "delete refs/heads/txn3 $H" >stdin &&
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "delete: not allowed in prepared transaction" err &&
+	printf "%s\n" start start >stdin &&
+	test_must_fail git update-ref --stdin <stdin 2>err &&
+	grep "start: not allowed in open transaction" err &&
+	git rev-parse --verify refs/heads/txn3
+'
+
+test_expect_success 'stdin -z runs several transactions in one session' '
+	H=$(git rev-parse $m) &&
+	printf $F start "delete refs/heads/txn3" "$H" commit \
+		start "create refs/heads/txn1" "$H" commit >stdin &&
+	git update-ref -z --stdin <stdin >actual &&
+	printf "%s: ok\n" start commit start commit >expect &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify -q refs/heads/txn3 &&
+	git update-ref -d refs/heads/txn1 $H
+'
+
 test_expect_success 'fails with duplicate HEAD update' '
 	git branch target1 $A &&
 	git checkout target1 &&
@@ -758,4 +758,39 @@ test_expect_success 'detect corrupt index file in fsck' '
 	grep "bad index file" errors
 '
 
+test_expect_success 'threaded fsck reports what a single thread does' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 50)
+		do
+			echo blob $i >file$i &&
+			git add file$i &&
+			git commit -q -m "commit $i" || return 1
+		done &&
+		git repack -ad &&
+		for i in $(test_seq 20)
+		do
+			echo loose $i | git hash-object -w --stdin || return 1
+		done >loose &&
+		pack=$(ls .git/objects/pack/pack-*.pack) &&
+		chmod +w $pack &&
+		printf "\377\377\377\377" |
+		dd of=$pack bs=1 conv=notrunc seek=1000 2>/dev/null &&
+		for o in $(sed -n "3p;11p" loose)
+		do
+			file=$(sha1_file $o) &&
+			chmod +w $file &&
+			echo garbage >>$file || return 1
+		done &&
+		echo cruft >$(dirname $(sha1_file $(head -n 1 loose)))/cruft &&
+		test_must_fail git -c fsck.threads=1 fsck --no-progress >expect 2>&1 &&
+		test_i18ngrep "garbage" expect &&
+		test_i18ngrep "bad sha1 file" expect &&
+		test_i18ngrep "CRC mismatch" expect &&
+		test_must_fail git -c fsck.threads=4 fsck --no-progress >actual 2>&1 &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -388,4 +388,21 @@ test_expect_success C_LOCALE_OUTPUT 'ambiguous commits are printed by type first
 	done
 '
 
+test_expect_success 'abbreviations do not change when packs are searched together' '
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >all &&
+	git log --all --raw --abbrev=4 --format="%h %t %p" >expect &&
+	cut -c1-5 all | git cat-file --batch-check >expect.short 2>&1 &&
+	split -l 3 all chunk- &&
+	for chunk in chunk-*
+	do
+		git pack-objects .git/objects/pack/pack <$chunk || return 1
+	done &&
+	git prune-packed &&
+	test $(ls .git/objects/pack/*.pack | wc -l) -gt 2 &&
+	git log --all --raw --abbrev=4 --format="%h %t %p" >actual &&
+	test_cmp expect actual &&
+	cut -c1-5 all | git cat-file --batch-check >actual.short 2>&1 &&
+	test_cmp expect.short actual.short
+'
+
 test_done
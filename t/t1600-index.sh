@@ -73,4 +73,76 @@ test_expect_success 'GIT_INDEX_VERSION takes precedence over config' '
 	)
 '
 
+test_expect_success 'version 5 lists the same entries' '
+	git init v5 &&
+	(
+		cd v5 &&
+		sane_unset GIT_INDEX_VERSION &&
+		mkdir adir bdir cdir &&
+		for d in adir bdir cdir
+		do
+			echo $d >$d/x1 &&
+			echo $d >$d/x2 || return 1
+		done &&
+		git add . &&
+		git ls-files --stage >expect &&
+		GIT_TEST_INDEX_BLOCK_ENTRIES=2 git update-index --index-version 5 &&
+		echo 5 >expect.version &&
+		test-tool index-version <.git/index >actual.version &&
+		test_cmp expect.version actual.version &&
+		git ls-files --stage >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'version 5 reads only the blocks a pathspec needs' '
+	(
+		cd v5 &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" git ls-files adir >actual &&
+		test_write_lines adir/x1 adir/x2 >expect &&
+		test_cmp expect actual &&
+		grep "\"key\":\"read/blocks\",\"value\":1}" trace.event &&
+		git ls-files "?dir/x2" >actual &&
+		test_write_lines adir/x2 bdir/x2 cdir/x2 >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'version 5 verifies only the blocks it reads' '
+	(
+		cd v5 &&
+		cp .git/index index.orig &&
+		pos=$(grep -boa "bdir/x1" .git/index | cut -d: -f1) &&
+		printf "\177" | dd of=.git/index bs=1 seek=$((pos - 1)) conv=notrunc 2>/dev/null &&
+		git ls-files adir >actual &&
+		test_write_lines adir/x1 adir/x2 >expect &&
+		test_cmp expect actual &&
+		test_must_fail git ls-files bdir 2>err &&
+		test_i18ngrep "bad checksum" err &&
+		test_must_fail git fsck 2>err &&
+		mv index.orig .git/index &&
+		git fsck
+	)
+'
+
+test_expect_success 'index.verifyChecksum rejects a corrupt index' '
+	git init checksum &&
+	(
+		cd checksum &&
+		echo a >a &&
+		git add a &&
+		git -c index.verifyChecksum=true ls-files >actual &&
+		echo a >expect &&
+		test_cmp expect actual &&
+		# flip a byte of the ctime of the first entry
+		printf "\377" | dd of=.git/index bs=1 seek=12 conv=notrunc 2>/dev/null &&
+		git ls-files >actual &&
+		test_cmp expect actual &&
+		test_must_fail git -c index.verifyChecksum=true ls-files 2>err &&
+		test_i18ngrep "bad index file sha1 signature" err &&
+		test_must_fail git -c index.verifyChecksum=true -c index.threads=2 status 2>err &&
+		test_i18ngrep "index file corrupt" err
+	)
+'
+
 test_done
@@ -439,4 +439,35 @@ test_expect_success 'writing split index with null sha1 does not write cache tre
 	test_line_count = 0 cache-tree.out
 '
 
+test_expect_success 'splitIndex.deferRewrite leaves the shared index to maintenance' '
+	git init defer &&
+	(
+		cd defer &&
+		git config core.splitIndex true &&
+		git config splitIndex.maxPercentChange 0 &&
+		git config splitIndex.deferRewrite true &&
+		: >one &&
+		git update-index --add one &&
+		test-tool dump-split-index .git/index | grep "^base" >base &&
+		: >two &&
+		git update-index --add two &&
+		test-tool dump-split-index .git/index >actual &&
+		grep "^base" actual >base.after &&
+		test_cmp base base.after &&
+		grep "	two$" actual &&
+		git config splitIndex.maxPercentChange 100 &&
+		git maintenance run --auto --task=split-index &&
+		test-tool dump-split-index .git/index | grep "^base" >base.after &&
+		test_cmp base base.after &&
+		git maintenance run --task=split-index &&
+		test-tool dump-split-index .git/index >actual &&
+		! grep "	two$" actual &&
+		grep "^base" actual >base.after &&
+		! test_cmp base base.after &&
+		git ls-files >actual &&
+		test_write_lines one two >expect &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='multi-threaded index loading'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_INDEX_THREADS
+sane_unset GIT_TEST_SPLIT_INDEX
+
+test_expect_success 'setup' '
+	mkdir dir dir/sub &&
+	for i in $(test_seq 40)
+	do
+		echo $i >file$i &&
+		echo $i >dir/file$i &&
+		echo $i >dir/sub/file$i || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	git ls-files --stage >expect
+'
+
+test_expect_success 'index.threads=1 writes no offset table' '
+	git -c index.threads=1 update-index --force-write-index &&
+	! grep IEOT .git/index &&
+	! grep EOIE .git/index
+'
+
+test_expect_success 'index.threads writes an offset table' '
+	git -c index.threads=4 update-index --force-write-index &&
+	grep IEOT .git/index &&
+	grep EOIE .git/index
+'
+
+for version in 2 4
+do
+	test_expect_success "index v$version is read in parallel" '
+		git update-index --index-version $version &&
+		git -c index.threads=4 update-index --force-write-index &&
+		git -c index.threads=4 ls-files --stage >actual &&
+		test_cmp expect actual &&
+		git -c index.threads=1 ls-files --stage --debug >expect.debug &&
+		git -c index.threads=4 ls-files --stage --debug >actual &&
+		test_cmp expect.debug actual &&
+		git -c index.threads=1 ls-files --stage >actual &&
+		test_cmp expect actual &&
+		GIT_TEST_INDEX_THREADS=3 git ls-files --stage >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "index v$version is updated in parallel" '
+		echo changed >dir/file7 &&
+		git -c index.threads=4 add dir/file7 &&
+		git -c index.threads=4 status --porcelain --untracked-files=no >actual &&
+		echo "M  dir/file7" >expect.status &&
+		test_cmp expect.status actual &&
+		git -c index.threads=4 reset --hard &&
+		git -c index.threads=1 ls-files --stage >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'extensions are read alongside the entries' '
+	echo conflict >file1 &&
+	git -c index.threads=4 update-index --split-index &&
+	git -c index.threads=4 add file1 &&
+	git -c index.threads=4 ls-files --stage file1 >actual &&
+	git -c index.threads=1 ls-files --stage file1 >expect.file1 &&
+	test_cmp expect.file1 actual &&
+	git -c index.threads=4 reset --hard &&
+	git -c index.threads=4 update-index --no-split-index &&
+	git ls-files --stage >actual &&
+	test_cmp expect actual
+'
+
+test_done
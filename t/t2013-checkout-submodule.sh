@@ -63,6 +63,29 @@ test_expect_success '"checkout <submodule>" honors submodule.*.ignore from .git/
 	! test -s actual
 '
 
+test_expect_success 'checkout looks at the index of a submodule in-process' '
+	test_create_repo inproc &&
+	(
+		cd inproc &&
+		test_create_repo sub &&
+		test_commit -C sub one &&
+		git submodule add ./sub sub &&
+		git commit -m sub &&
+		git checkout -b side &&
+		test_commit -C sub two &&
+		git add sub &&
+		git commit -m two &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git checkout --recurse-submodules master &&
+		! grep "\"diff-index\"" trace.event &&
+		test_path_is_missing sub/two.t &&
+		echo dirty >sub/one.t &&
+		git -C sub add one.t &&
+		test_must_fail git checkout --recurse-submodules side 2>err &&
+		test_i18ngrep "dirty index" err
+	)
+'
+
 KNOWN_FAILURE_DIRECTORY_SUBMODULE_CONFLICTS=1
 test_submodule_switch_recursing_with_args "checkout"
 
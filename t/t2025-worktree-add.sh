@@ -527,4 +527,59 @@ test_expect_success '"add" in bare repo invokes post-checkout hook' '
 	test_cmp hook.expect goozy/hook.actual
 '
 
+test_expect_success 'add copies the files that match the index' '
+	test_create_repo seeded &&
+	(
+		# a split index is not copied
+		sane_unset GIT_TEST_SPLIT_INDEX &&
+		cd seeded &&
+		mkdir -p dir/sub &&
+		echo one >dir/sub/one &&
+		echo two >two &&
+		write_script run <<-\EOF &&
+		echo run
+		EOF
+		git add . &&
+		test_commit seed &&
+		test-tool chmtime =-60 dir/sub/one two run seed.t &&
+		git update-index --refresh &&
+		echo changed >two &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git worktree add --detach ../seeded-wt &&
+		grep "\"seeded_files\",\"value\":3" trace
+	) &&
+	echo two >expect &&
+	test_cmp expect seeded-wt/two &&
+	test -x seeded-wt/run &&
+	git -C seeded-wt diff-files --exit-code &&
+	git -C seeded-wt status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'add does not copy from an index of another commit' '
+	(
+		cd seeded &&
+		git checkout two &&
+		test_commit other &&
+		GIT_TRACE2_EVENT="$(pwd)/trace-other" \
+			git worktree add --detach ../seeded-other HEAD^ &&
+		! grep seeded_files trace-other
+	) &&
+	test_path_is_missing seeded-other/other.t &&
+	git -C seeded-other status --porcelain >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'add --sparse checks out what the patterns select' '
+	test_must_fail git -C seeded worktree add --sparse ../sparse-wt &&
+	test_path_is_missing sparse-wt &&
+	test_config -C seeded core.sparseCheckout true &&
+	echo "/dir/" >seeded/.git/info/sparse-checkout &&
+	git -C seeded read-tree -mu HEAD &&
+	git -C seeded worktree add --sparse --detach ../sparse-wt &&
+	test_path_is_file sparse-wt/dir/sub/one &&
+	test_path_is_missing sparse-wt/two &&
+	git -C seeded worktree add --detach ../full-wt &&
+	test_path_is_file full-wt/two
+'
+
 test_done
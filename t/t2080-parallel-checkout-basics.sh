@@ -0,0 +1,131 @@
+#!/bin/sh
+
+test_description='parallel-checkout basics
+
+Ensure that parallel-checkout basically works on clone and checkout,
+spawning the required number of workers and producing the same working
+tree and index as a sequential checkout.
+'
+
+. ./test-lib.sh
+
+# Run "git <args>" with parallel checkout configured to use "$1" workers
+# and no threshold, and check that "$2" workers were spawned.
+test_checkout_workers () {
+	workers=$1 &&
+	expected=$2 &&
+	shift 2 &&
+	rm -f "$TRASH_DIRECTORY/trace" &&
+	GIT_TRACE="$TRASH_DIRECTORY/trace" git -c checkout.workers=$workers \
+		-c checkout.thresholdForParallelism=0 "$@" &&
+	grep "run_command: .*checkout--worker" "$TRASH_DIRECTORY/trace" \
+		>"$TRASH_DIRECTORY/workers" &&
+	test_line_count = $expected "$TRASH_DIRECTORY/workers"
+}
+
+# Compare the working tree and the index of two repositories.
+test_cmp_worktrees () {
+	(cd "$1" && git ls-files -s && git status --porcelain) >expect &&
+	(cd "$2" && git ls-files -s && git status --porcelain) >actual &&
+	test_cmp expect actual &&
+	(cd "$1" && git ls-files -z | xargs -0 cat) >expect &&
+	(cd "$2" && git ls-files -z | xargs -0 cat) >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	git init src &&
+	(
+		cd src &&
+		mkdir -p A/B C &&
+		for i in $(test_seq 20)
+		do
+			echo "file $i" >A/f$i &&
+			echo "file $i" >A/B/f$i &&
+			echo "file $i" >C/f$i || return 1
+		done &&
+		printf "line1\nline2\n" >crlf.txt &&
+		echo "\$Id\$" >ident.txt &&
+		echo "#!/bin/sh" >exec.sh &&
+		chmod +x exec.sh &&
+		cat >.gitattributes <<-\EOF &&
+		crlf.txt text eol=crlf
+		ident.txt ident
+		EOF
+		git add . &&
+		git commit -m first &&
+		git rm -q C/f1 &&
+		echo changed >A/f2 &&
+		echo new >C/new &&
+		git add . &&
+		git commit -m second &&
+		git tag second
+	)
+'
+
+test_expect_success 'sequential clone' '
+	git -c checkout.workers=1 clone src sequential &&
+	test_path_is_file sequential/A/B/f20
+'
+
+test_expect_success 'parallel clone' '
+	test_checkout_workers 2 2 clone src parallel &&
+	test_cmp_worktrees sequential parallel &&
+	test -x parallel/exec.sh &&
+	printf "line1\r\nline2\r\n" >expect &&
+	test_cmp expect parallel/crlf.txt &&
+	grep "Id: [0-9a-f]" parallel/ident.txt
+'
+
+test_expect_success 'parallel checkout of another branch' '
+	git -C sequential checkout -q second~ &&
+	(
+		cd parallel &&
+		test_checkout_workers 2 2 checkout -q second~
+	) &&
+	test_cmp_worktrees sequential parallel &&
+	git -C sequential checkout -q master &&
+	(
+		cd parallel &&
+		# only two files are written; a third worker would be idle
+		test_checkout_workers 3 2 checkout -q master
+	) &&
+	test_cmp_worktrees sequential parallel
+'
+
+test_expect_success 'the index is refreshed after a parallel checkout' '
+	(
+		cd parallel &&
+		git diff-files --exit-code
+	)
+'
+
+test_expect_success 'no workers are spawned below the threshold' '
+	git -C parallel checkout -q second~ &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C parallel -c checkout.workers=2 \
+		-c checkout.thresholdForParallelism=1000 checkout -q master &&
+	! grep "checkout--worker" trace &&
+	test_cmp_worktrees sequential parallel
+'
+
+test_expect_success 'entries with a filter driver are written sequentially' '
+	git clone src filtered &&
+	(
+		cd filtered &&
+		echo "*.txt filter=rot13" >.git/info/attributes &&
+		git config filter.rot13.smudge "tr a-z n-za-m" &&
+		rm crlf.txt ident.txt &&
+		git -c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+			checkout -- . &&
+		git -c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+			reset --hard &&
+		rm crlf.txt &&
+		git -c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+			reset --hard &&
+		printf "yvar1\r\nyvar2\r\n" >expect &&
+		test_cmp expect crlf.txt
+	)
+'
+
+test_done
@@ -253,4 +253,60 @@ test_expect_success SYMLINKS 'pack symlinked packed-refs' '
 	test "$(readlink .git/packed-refs)" = "my-deviant-packed-refs"
 '
 
+test_expect_success 'deleting packed refs with core.packedRefsDelta' '
+	git init delta &&
+	(
+		cd delta &&
+		test_commit base &&
+		for i in $(test_seq 50)
+		do
+			echo "create refs/heads/delta/$i HEAD" || return 1
+		done | git update-ref --stdin &&
+		git pack-refs --all --prune &&
+		cp .git/packed-refs packed-refs.orig &&
+		git -c core.packedRefsDelta branch -D delta/7 delta/13 &&
+		test_cmp packed-refs.orig .git/packed-refs &&
+		printf "refs/heads/delta/%s\n" 7 13 >expect &&
+		test_cmp expect .git/packed-refs.delta &&
+		test_must_fail git rev-parse --verify delta/7 &&
+		git for-each-ref refs/heads/delta/ >refs &&
+		test_line_count = 48 refs &&
+		! grep "delta/13$" refs &&
+		git branch delta/7 &&
+		git rev-parse --verify delta/7 &&
+		git -c core.packedRefsDelta update-ref -d refs/heads/delta/21 &&
+		git -c core.packedRefsDelta update-ref -d refs/heads/delta/22 HEAD &&
+		test_must_fail git -c core.packedRefsDelta \
+			update-ref -d refs/heads/delta/23 base^{tree} &&
+		git rev-parse --verify delta/23 &&
+		test_line_count = 4 .git/packed-refs.delta
+	)
+'
+
+test_expect_success 'pack-refs folds the delta into packed-refs' '
+	(
+		cd delta &&
+		git for-each-ref >before &&
+		git pack-refs --all --prune &&
+		test_path_is_missing .git/packed-refs.delta &&
+		! grep "delta/13$" .git/packed-refs &&
+		git for-each-ref >after &&
+		test_cmp before after
+	)
+'
+
+test_expect_success 'a large delta is folded in by the next deletion' '
+	(
+		cd delta &&
+		for i in $(test_seq 30 49)
+		do
+			git -c core.packedRefsDelta branch -D delta/$i || return 1
+		done &&
+		! grep "delta/30$" .git/packed-refs &&
+		test $(wc -c <.git/packed-refs.delta) -le $(($(wc -c <.git/packed-refs) / 8)) &&
+		git for-each-ref refs/heads/delta/ >refs &&
+		test_line_count = 27 refs
+	)
+'
+
 test_done
@@ -1204,4 +1204,27 @@ test_expect_success 'empty notes are displayed by git log' '
 	test_cmp expect actual
 '
 
+test_expect_success 'git notes add --stdin adds all notes in one commit' '
+	one=$(echo one | git hash-object -w --stdin) &&
+	two=$(echo two | git hash-object -w --stdin) &&
+	empty=$(git hash-object -w --stdin </dev/null) &&
+	echo "HEAD $one" >input &&
+	echo "HEAD^ $two" >>input &&
+	git notes --ref=batch add --stdin <input &&
+	git rev-list refs/notes/batch >commits &&
+	test_line_count = 1 commits &&
+	test "$(git notes --ref=batch list HEAD)" = "$one" &&
+	test "$(git notes --ref=batch list HEAD^)" = "$two" &&
+	echo "HEAD $two" >input &&
+	test_must_fail git notes --ref=batch add --stdin <input &&
+	test "$(git notes --ref=batch list HEAD)" = "$one" &&
+	echo "HEAD^ $empty" >>input &&
+	git notes --ref=batch add -f --stdin <input &&
+	test "$(git notes --ref=batch list HEAD)" = "$two" &&
+	test_must_fail git notes --ref=batch list HEAD^ &&
+	echo "HEAD HEAD" >input &&
+	test_must_fail git notes --ref=batch add -f --stdin <input &&
+	test_must_fail git notes --ref=batch add --stdin -m foo </dev/null
+'
+
 test_done
@@ -89,4 +89,22 @@ test_expect_success 'deleting most notes triggers fanout consolidation' '
 	done
 '
 
+test_expect_success 'notes.index follows notes commits across fanouts' '
+	test_config notes.index true &&
+	git rev-list HEAD |
+	while read sha1
+	do
+		git notes add -f -m "indexed $sha1" "$sha1" || return 1
+	done &&
+	git rev-list HEAD~10 | head -n 5 | xargs git notes remove &&
+	git rev-parse refs/notes/commits^{tree} >expect &&
+	ls .git/notes-index >actual &&
+	test_cmp expect actual &&
+	git log >with-index &&
+	test $(grep -c "^    indexed" with-index) = 295 &&
+	rm -r .git/notes-index &&
+	git log >without-index &&
+	test_cmp without-index with-index
+'
+
 test_done
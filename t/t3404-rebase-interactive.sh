@@ -1415,4 +1415,110 @@ test_expect_success 'rebase -i --gpg-sign=<key-id> overrides commit.gpgSign' '
 	test_i18ngrep "$SQ-S\"S I Gner\"$SQ" err
 '
 
+test_expect_success 'setup rebase.inMemory' '
+	git checkout -b in-memory-base master &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 >in-memory &&
+	echo a >in-memory-other &&
+	git add in-memory in-memory-other &&
+	git commit -m "in-memory base" &&
+	git checkout -b in-memory-topic &&
+	echo b >in-memory-other &&
+	git commit -a -m "other b" &&
+	test_write_lines 1 2 3 4 5 6 7 8 nine >in-memory &&
+	echo a >in-memory-other &&
+	git commit -a -m "nine, other a" &&
+	git checkout -b in-memory-upstream in-memory-base &&
+	test_write_lines one 2 3 4 5 6 7 8 9 >in-memory &&
+	git commit -a -m "one" &&
+	git checkout -b in-memory-conflict in-memory-base &&
+	test_write_lines 1 2 3 4 5 6 7 8 NINE >in-memory &&
+	git commit -a -m "NINE"
+'
+
+test_expect_success 'rebase.inMemory leaves the worktree alone until the end' '
+	git checkout -b in-memory-clean in-memory-topic &&
+	test-tool chmtime =-600 in-memory-other &&
+	test-tool chmtime --get in-memory-other >expect.mtime &&
+	test_config rebase.inMemory true &&
+	git rebase in-memory-upstream &&
+	test-tool chmtime --get in-memory-other >actual.mtime &&
+	test_cmp expect.mtime actual.mtime &&
+	test_write_lines one 2 3 4 5 6 7 8 nine >expect &&
+	test_cmp expect in-memory &&
+	git diff --exit-code HEAD &&
+	git log --format=%s in-memory-upstream.. >actual &&
+	test_write_lines "nine, other a" "other b" >expect &&
+	test_cmp expect actual &&
+	test_cmp_rev in-memory-upstream HEAD~2
+'
+
+test_expect_success 'rebase.inMemory checks out the worktree on conflicts' '
+	git checkout -b in-memory-conflicted in-memory-topic &&
+	test_config rebase.inMemory true &&
+	test_must_fail git rebase in-memory-conflict &&
+	echo b >expect &&
+	git show HEAD:in-memory-other >actual &&
+	test_cmp expect actual &&
+	echo a >expect &&
+	test_cmp expect in-memory-other &&
+	grep "^<<<<<<<" in-memory &&
+	test_write_lines 1 2 3 4 5 6 7 8 nine >in-memory &&
+	git add in-memory &&
+	git rebase --continue &&
+	git diff --exit-code HEAD &&
+	test_cmp_rev in-memory-conflict HEAD~2
+'
+
+test_expect_success 'rebase.inMemory picks changes to renamed paths in memory' '
+	git checkout -b in-memory-renamed in-memory-base &&
+	git mv in-memory in-memory-moved &&
+	git commit -m "moved" &&
+	git checkout -b in-memory-rename-topic in-memory-topic &&
+	test-tool chmtime =-600 in-memory-other &&
+	test-tool chmtime --get in-memory-other >expect.mtime &&
+	test_config rebase.inMemory true &&
+	git rebase in-memory-renamed &&
+	test-tool chmtime --get in-memory-other >actual.mtime &&
+	test_cmp expect.mtime actual.mtime &&
+	test_write_lines 1 2 3 4 5 6 7 8 nine >expect &&
+	test_cmp expect in-memory-moved &&
+	test_path_is_missing in-memory &&
+	git diff --exit-code HEAD
+'
+
+# Leave the index and worktree at HEAD^ as a rebase that died after
+# picking HEAD in memory would.
+fake_in_memory_pick () {
+	git read-tree -u -m HEAD HEAD^ &&
+	git rev-parse HEAD^ >.git/rebase-merge/worktree-commit
+}
+
+test_expect_success 'rebase --continue catches up with in-memory picks' '
+	git checkout -b in-memory-died in-memory-topic &&
+	test_config rebase.inMemory true &&
+	set_fake_editor &&
+	test_must_fail env FAKE_LINES="1 exec_false 2" \
+		git rebase -i in-memory-upstream &&
+	fake_in_memory_pick &&
+	git rebase --continue &&
+	git diff --exit-code HEAD &&
+	git log --format=%s in-memory-upstream.. >actual &&
+	test_write_lines "nine, other a" "other b" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rebase --skip catches up with in-memory picks' '
+	git checkout -b in-memory-skipped in-memory-topic &&
+	test_config rebase.inMemory true &&
+	set_fake_editor &&
+	test_must_fail env FAKE_LINES="1 exec_false 2" \
+		git rebase -i in-memory-upstream &&
+	fake_in_memory_pick &&
+	git rebase --skip &&
+	git diff --exit-code HEAD &&
+	git log --format=%s in-memory-upstream.. >actual &&
+	test_write_lines "nine, other a" "other b" >expect &&
+	test_cmp expect actual
+'
+
 test_done
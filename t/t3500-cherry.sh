@@ -55,4 +55,26 @@ test_expect_success \
      expr "$(echo $(git cherry master my-topic-branch) )" : "+ [^ ]* - .*"
 '
 
+test_expect_success 'cherry gives the same answer from the patch-id cache' '
+	git cherry master my-topic-branch >expect &&
+	git -c core.patchIdCache cherry master my-topic-branch >actual &&
+	test_cmp expect actual &&
+	test_path_is_file .git/patch-id-cache &&
+	git -c core.patchIdCache cherry master my-topic-branch >actual &&
+	test_cmp expect actual &&
+	git -c core.patchIdCache log --cherry-mark --format="%m %s" \
+		master...my-topic-branch >cached &&
+	git log --cherry-mark --format="%m %s" \
+		master...my-topic-branch >uncached &&
+	test_cmp uncached cached
+'
+
+test_expect_success 'patch-id cache computed with other options is replaced' '
+	cp .git/patch-id-cache old &&
+	git -c core.patchIdCache -c diff.algorithm=patience log \
+		--cherry-mark --format="%m %s" master...my-topic-branch >cached &&
+	test_cmp uncached cached &&
+	! test_cmp_bin old .git/patch-id-cache
+'
+
 test_done
@@ -526,4 +526,37 @@ test_expect_success 'commit descriptions in insn sheet are optional' '
 	test_line_count = 4 commits
 '
 
+test_expect_success 'the picks of a sequence reuse the renames of HEAD' '
+	git init renames &&
+	(
+		cd renames &&
+		mkdir dir &&
+		for i in 1 2 3 4 5
+		do
+			test_seq $i 100 >dir/file$i || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		git checkout -b topic &&
+		for i in 1 2 3
+		do
+			echo new >dir/new$i &&
+			git add dir/new$i &&
+			git commit -m "add new$i" || return 1
+		done &&
+		git checkout -b upstream master &&
+		git mv dir moved &&
+		echo more >>moved/file4 &&
+		git commit -a -m move &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git cherry-pick master..topic &&
+		test_path_is_missing dir &&
+		for i in 1 2 3
+		do
+			test_path_is_file moved/new$i || return 1
+		done &&
+		grep "\"category\":\"merge\",\"name\":\"renames/reused\"" trace >counter &&
+		grep "\"value\":11}" counter
+	)
+'
+
 test_done
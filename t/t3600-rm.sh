@@ -858,6 +858,22 @@ test_expect_success 'rm files with two different errors' '
 	test_i18ncmp expect actual
 '
 
+test_expect_success 'rm of a submodule looks for nested ones in-process' '
+	test_create_repo nested-gitfile &&
+	(
+		cd nested-gitfile &&
+		test_create_repo sub &&
+		test_commit -C sub one &&
+		git submodule add ./sub sub &&
+		git commit -m sub &&
+		git submodule absorbgitdirs &&
+		test_path_is_file sub/.git &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" git rm sub &&
+		! grep "\"foreach\"" trace.event &&
+		test_path_is_missing sub
+	)
+'
+
 test_expect_success 'rm empty string should fail' '
 	test_must_fail git rm -rf ""
 '
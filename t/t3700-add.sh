@@ -403,4 +403,74 @@ test_expect_success 'all statuses changed in folder if . is given' '
 	test $(git ls-files --stage | grep ^100755 | wc -l) -eq 0
 '
 
+test_expect_success 'add with core.fsyncMethod=batch' '
+	git init batch &&
+	mkdir batch/dir &&
+	for i in $(test_seq 20)
+	do
+		echo "batch $i" >batch/dir/file$i || return 1
+	done &&
+	git -C batch -c core.fsyncObjectFiles=true \
+		-c core.fsyncMethod=batch add dir &&
+	git -C batch ls-files -s >stage &&
+	test_line_count = 20 stage &&
+	cut -d" " -f2 stage >oids &&
+	for oid in $(cat oids)
+	do
+		f=$(echo $oid | sed -e "s|..|&/|") &&
+		test_path_is_file batch/.git/objects/$f || return 1
+	done &&
+	git -C batch fsck &&
+	ls batch/.git/objects >dirs &&
+	! grep incoming dirs
+'
+
+test_expect_success 'update-index --stdin with core.fsyncMethod=batch' '
+	for i in $(test_seq 20)
+	do
+		echo "more $i" >batch/dir/more$i &&
+		echo dir/more$i || return 1
+	done >paths &&
+	git -C batch -c core.fsyncObjectFiles=true \
+		-c core.fsyncMethod=batch update-index --add --stdin <paths &&
+	git -C batch ls-files -s >stage &&
+	test_line_count = 40 stage &&
+	git -C batch fsck &&
+	ls batch/.git/objects >dirs &&
+	! grep incoming dirs
+'
+
+test_expect_success 'new files are hashed by several threads' '
+	git init threaded &&
+	mkdir threaded/dir &&
+	for i in $(test_seq 30)
+	do
+		echo "threaded $i" >threaded/dir/file$i || return 1
+	done &&
+	printf "crlf\r\n" >threaded/dir/crlf &&
+	echo "file* -text" >threaded/.gitattributes &&
+	echo "crlf text" >>threaded/.gitattributes &&
+	GIT_TEST_ADD_THREADS=4 GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C threaded add . &&
+	grep "\"key\":\"prepared_blobs\",\"value\":31" trace.event &&
+	git -C threaded ls-files -s dir >actual &&
+	(
+		cd threaded &&
+		for f in $(git ls-files dir)
+		do
+			echo "100644 $(git hash-object --path=$f $f) 0	$f" || return 1
+		done
+	) >expect &&
+	test_cmp expect actual &&
+	git -C threaded fsck &&
+	git -C threaded diff --exit-code &&
+	git -C threaded cat-file -p :dir/crlf >crlf &&
+	echo crlf >expect &&
+	test_cmp expect crlf
+'
+
+test_expect_success 'an invalid core.fsyncMethod is refused' '
+	test_must_fail git -c core.fsyncMethod=nosuch add foo5
+'
+
 test_done
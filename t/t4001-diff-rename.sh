@@ -262,4 +262,25 @@ test_expect_success 'diff-tree -l0 defaults to a big rename limit, not zero' '
 	grep "myotherfile.*myfile" actual
 '
 
+test_expect_success 'renames found in threads are the same' '
+	mkdir threads &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test_seq $i 50 >threads/old$i || return 1
+	done &&
+	git add threads &&
+	git commit -m "before threads" &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test_seq $i 48 >threads/new$((9 - $i)) &&
+		git rm -q threads/old$i || return 1
+	done &&
+	git add threads &&
+	git commit -m "after threads" &&
+	GIT_TEST_RENAME_THREADS=1 git diff -M --name-status HEAD^ >expect &&
+	test_line_count = 8 expect &&
+	GIT_TEST_RENAME_THREADS=4 git diff -M --name-status HEAD^ >actual &&
+	test_cmp expect actual
+'
+
 test_done
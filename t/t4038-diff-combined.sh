@@ -435,4 +435,41 @@ test_expect_success 'combine diff gets tree sorting right' '
 	test_cmp expect actual
 '
 
+test_expect_success 'combined diff is the same whichever thread prepares it' '
+	git checkout -b threads master &&
+	for i in $(test_seq 20)
+	do
+		test_seq 20 >threaded-$i &&
+		git add threaded-$i || return 1
+	done &&
+	git commit -m threads-base &&
+	for side in one two three
+	do
+		git checkout -b threads-$side threads &&
+		for i in $(test_seq 20)
+		do
+			sed -e "$i s/\$/ $side/" threaded-$i >tmp &&
+			mv tmp threaded-$i || return 1
+		done &&
+		git commit -a -m threads-$side &&
+		git checkout threads || return 1
+	done &&
+	for i in $(test_seq 20)
+	do
+		sed -e "$i s/\$/ merged/" threaded-$i >tmp &&
+		mv tmp threaded-$i || return 1
+	done &&
+	git add threaded-* &&
+	merge=$(echo threads-merge |
+		git commit-tree -p threads-one -p threads-two -p threads-three \
+			$(git write-tree)) &&
+	git reset --hard $merge &&
+	GIT_TEST_COMBINE_DIFF_THREADS=1 git show --cc HEAD >expect &&
+	GIT_TEST_COMBINE_DIFF_THREADS=4 git show --cc HEAD >actual &&
+	test_cmp expect actual &&
+	GIT_TEST_COMBINE_DIFF_THREADS=1 git show -c HEAD >expect &&
+	GIT_TEST_COMBINE_DIFF_THREADS=4 git show -c HEAD >actual &&
+	test_cmp expect actual
+'
+
 test_done
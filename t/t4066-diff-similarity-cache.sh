@@ -0,0 +1,71 @@
+#!/bin/sh
+
+test_description='rename detection with diff.similarityCache'
+
+. ./test-lib.sh
+
+remove_blob () {
+	blob=$(git rev-parse "$1") &&
+	rm .git/objects/$(echo $blob | sed -e "s|^..|&/|")
+}
+
+test_expect_success setup '
+	test_seq 1 50 >one &&
+	test_seq 10 60 >two &&
+	printf "a\0b\0c\0d\0e\0f\0g\0h\n" >bin &&
+	git add one two bin &&
+	git commit -m base &&
+	git mv one three &&
+	git mv two four &&
+	git mv bin bin2 &&
+	echo more >>three &&
+	echo more >>four &&
+	printf "i\0" >>bin2 &&
+	git commit -a -m move &&
+	git diff -M --name-status HEAD^ >expect &&
+	test_line_count = 3 expect
+'
+
+test_expect_success 'the cache is not written by default' '
+	git diff -M --name-status HEAD^ >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing .git/objects/info/similarity-cache
+'
+
+test_expect_success 'the cache is written and gives the same renames' '
+	git -c diff.similarityCache=true diff -M --name-status HEAD^ >actual &&
+	test_cmp expect actual &&
+	test_path_is_file .git/objects/info/similarity-cache &&
+	git -c diff.similarityCache=true diff -M --name-status HEAD^ >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'attributes that make a file binary bypass the cache' '
+	echo "four binary" >.gitattributes &&
+	git -c diff.similarityCache=true diff -M --name-status HEAD^ >actual &&
+	git -c diff.similarityCache=false diff -M --name-status HEAD^ >expect.attr &&
+	test_cmp expect.attr actual &&
+	rm .gitattributes
+'
+
+test_expect_success 'records cut short are ignored' '
+	cache=.git/objects/info/similarity-cache &&
+	size=$(wc -c <$cache) &&
+	test_copy_bytes $((size - 3)) <$cache >cache.tmp &&
+	mv cache.tmp $cache &&
+	git -c diff.similarityCache=true diff -M --name-status HEAD^ >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cached blobs are not read again' '
+	for blob in HEAD^:one HEAD^:two HEAD:three HEAD:four
+	do
+		remove_blob $blob || return 1
+	done &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c diff.similarityCache=true diff -M --name-status HEAD^ >actual &&
+	test_cmp expect actual &&
+	grep "similarity-cache/hits\",\"value\":6}" trace
+'
+
+test_done
@@ -0,0 +1,58 @@
+#!/bin/sh
+
+test_description='diffs between trees with core.treeCacheLimit'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	mkdir -p a/b c &&
+	for f in a/one a/b/two a/b/three c/four five "six seven" a-b a.b
+	do
+		echo "$f" >"$f" || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m base &&
+	git checkout -b side &&
+	echo side >>a/b/two &&
+	rm -r c &&
+	echo file >c &&
+	git add -A &&
+	test_tick &&
+	git commit -m side &&
+	git checkout master &&
+	echo master >>a/one &&
+	git rm -r -q a/b &&
+	echo dir >a/b &&
+	git add a/b &&
+	test_tick &&
+	git commit -a -m master &&
+	git merge -s ours -m merge side &&
+	echo merge >>five &&
+	git commit -q -a --amend -m merge &&
+	git log --raw -r -m -c --root >expect &&
+	grep "^::" expect
+'
+
+test_expect_success 'the cache gives the same diffs' '
+	git -c core.treeCacheLimit=32m log --raw -r -m -c --root >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'with trees evicted right away' '
+	git -c core.treeCacheLimit=1 log --raw -r -m -c --root >actual &&
+	test_cmp expect actual &&
+	git -c core.treeCacheLimit=0 log --raw -r -m -c --root >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'walking a corrupt tree still fails' '
+	tree=$(git rev-parse HEAD^{tree}) &&
+	git cat-file tree $tree >tree &&
+	printf "100644 broken" >>tree &&
+	broken=$(git hash-object -t tree --literally -w tree) &&
+	test_must_fail git diff-tree $tree $broken 2>err &&
+	test_i18ngrep "too-short tree" err
+'
+
+test_done
@@ -0,0 +1,82 @@
+#!/bin/sh
+
+test_description='git apply with threads'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	for i in $(test_seq 40)
+	do
+		test_write_lines 1 2 3 4 5 6 7 8 9 10 11 12 >file$i || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	for i in $(test_seq 40)
+	do
+		test_write_lines 1 2 3 4 5 six 7 8 9 10 11 12 >file$i || return 1
+	done &&
+	git diff >patch &&
+	git commit -a -m six &&
+	git diff HEAD^ HEAD -- file1 | sed -e "s/six/VI/" >second &&
+	git reset -q --hard HEAD^
+'
+
+test_apply () {
+	git reset -q --hard &&
+	git -c apply.threads=1 apply "$@" 2>expect.err &&
+	git diff HEAD >expect.diff &&
+	git ls-files -s >expect.index &&
+	git reset -q --hard &&
+	git -c apply.threads=4 apply "$@" 2>actual.err &&
+	git diff HEAD >actual.diff &&
+	git ls-files -s >actual.index &&
+	test_cmp expect.err actual.err &&
+	test_cmp expect.diff actual.diff &&
+	test_cmp expect.index actual.index
+}
+
+test_expect_success 'apply to the working tree' '
+	test_apply patch &&
+	grep six file40
+'
+
+test_expect_success 'apply to the index' '
+	test_apply --index patch &&
+	git diff --cached --name-only >changed &&
+	test_line_count = 40 changed
+'
+
+test_expect_success 'apply to the index only' '
+	test_apply --cached patch &&
+	test_must_fail grep six file40
+'
+
+test_expect_success 'patches to the same file are applied in order' '
+	sed -e "s/^+six/+VI/" -e "s/^-6/-six/" <patch >rest &&
+	cat patch rest >both &&
+	test_apply both &&
+	grep VI file40
+'
+
+test_expect_success 'messages are the same' '
+	git reset -q --hard &&
+	sed -e "s/^9$/nine/" <file7 >file7.new &&
+	mv file7.new file7 &&
+	git commit -q -a -m nine &&
+	test_apply -C1 patch &&
+	grep "Context reduced" actual.err &&
+	git reset -q --hard HEAD^
+'
+
+test_expect_success 'failures are reported the same' '
+	git reset -q --hard &&
+	echo changed >file9 &&
+	git commit -q -a -m changed &&
+	test_must_fail git -c apply.threads=1 apply patch 2>expect &&
+	test_must_fail git -c apply.threads=4 apply patch 2>actual &&
+	test_cmp expect actual &&
+	git diff --exit-code HEAD &&
+	git reset -q --hard HEAD^
+'
+
+test_done
@@ -215,4 +215,33 @@ test_expect_success 'shortlog --committer (external)' '
 	test_cmp expect actual
 '
 
+test_expect_success 'shortlog maps each ident once, however it reads commits' '
+	git checkout --orphan idents &&
+	for i in $(test_seq 100)
+	do
+		GIT_AUTHOR_EMAIL=author$((i % 3))@example.com \
+			git commit --allow-empty -m "ident $i" || return 1
+	done &&
+	git rev-list idents | git commit-graph write --stdin-commits &&
+	echo "A U Thor <author0@example.com> <author2@example.com>" >.mailmap &&
+
+	cat >expect <<-\EOF &&
+	    66	A U Thor <author0@example.com>
+	    34	A U Thor <author1@example.com>
+	EOF
+	GIT_TEST_SHORTLOG_THREADS=1 git -c core.commitGraph=true \
+		shortlog -nse idents >actual &&
+	test_cmp expect actual &&
+	GIT_TEST_SHORTLOG_THREADS=4 git -c core.commitGraph=true \
+		shortlog -nse idents >actual &&
+	test_cmp expect actual &&
+
+	GIT_TEST_SHORTLOG_THREADS=1 git -c core.commitGraph=true \
+		shortlog -e idents >expect &&
+	GIT_TEST_SHORTLOG_THREADS=4 git -c core.commitGraph=true \
+		shortlog -e idents >actual &&
+	test_cmp expect actual &&
+	rm .mailmap
+'
+
 test_done
@@ -1668,4 +1668,14 @@ test_expect_success 'log --source paints symmetric ranges' '
 	test_cmp expect actual
 '
 
+test_expect_success 'log shows the same diffs when reading blobs in threads' '
+	for opts in "-p" "--stat -M" "--numstat --root" "-p -m" "-p --cc" \
+		    "-p --first-parent -m" "--dirstat -R"
+	do
+		git log --all $opts >expect &&
+		GIT_TEST_DIFF_PREFETCH_THREADS=3 git log --all $opts >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
@@ -66,6 +66,23 @@ test_expect_success 'check-mailmap bogus contact' '
 	test_must_fail git check-mailmap bogus
 '
 
+test_expect_success 'check-mailmap matches whole emails in any case' '
+	test_when_finished "rm .mailmap" &&
+	cat >.mailmap <<-\EOF &&
+	Short <short@example.com>
+	Long <short@example.com.org>
+	EOF
+	cat >expect <<-\EOF &&
+	Short <SHORT@Example.com>
+	Long <short@EXAMPLE.com.org>
+	Someone <short@example.co>
+	EOF
+	git check-mailmap "Someone <SHORT@Example.com>" \
+		"Someone <short@EXAMPLE.com.org>" \
+		"Someone <short@example.co>" >actual &&
+	test_cmp expect actual
+'
+
 cat >expect <<\EOF
 A U Thor (1):
       initial
@@ -598,4 +598,32 @@ test_expect_success ':only and :unfold work together' '
 	test_cmp expect actual
 '
 
+test_expect_success 'the same format is expanded alike for every commit' '
+	git log -3 --format="%%an %an%Z%x%(trailers%ae %cn <%ce>%" >actual &&
+	git log -3 --format="%an|%ae|%cn|%ce" |
+	sed -e "s/^\([^|]*\)|\([^|]*\)|\([^|]*\)|\(.*\)\$/%an \1%Z%x%(trailers\2 \3 <\4>%/" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a repeated author header is read as before' '
+	tree=$(git write-tree) &&
+	cat >commit <<-EOF &&
+	tree $tree
+	author First <first@example.com> 1234567890 +0000
+	author Second <second@example.com> 1234567890 +0000
+	committer C O Mitter <committer@example.com> 1234567890 +0000
+
+	subject
+	EOF
+	commit=$(git hash-object -t commit -w --literally commit) &&
+	echo "Second <second@example.com> subject" >expect &&
+	git log -1 --format="%an <%ae> %s" $commit >actual &&
+	test_cmp expect actual &&
+	git update-ref refs/heads/repeated-author $commit &&
+	echo "First C O Mitter" >expect &&
+	git for-each-ref --format="%(authorname) %(committername)" \
+		refs/heads/repeated-author >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -106,4 +106,46 @@ test_expect_success 'log -S --no-textconv (missing textconv tool)' '
 	rm .gitattributes
 '
 
+test_expect_success 'setup more history' '
+	for i in 1 2 3 4 5
+	do
+		test_write_lines "one $i" two three >a &&
+		test_write_lines "Picked $i" >b &&
+		git add a b &&
+		test_tick &&
+		git commit -m "more $i" || return 1
+	done &&
+	git rm -q b &&
+	test_tick &&
+	git commit -m "remove b"
+'
+
+test_expect_success 'the pickaxe gives the same answers in threads' '
+	for opts in "-S Picked" "-S picked -i" "-S P.cked --pickaxe-regex" \
+		    "-G one" "-S two --pickaxe-all" "-S three --root"
+	do
+		git log -p $opts >expect &&
+		GIT_TEST_PICKAXE_THREADS=3 git log -p $opts >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'the threads answer for the changes of the commits' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TEST_PICKAXE_THREADS=3 \
+		git log -S Picked --format=%H >actual &&
+	git log -S Picked --format=%H >expect &&
+	test_cmp expect actual &&
+	grep "\"name\":\"prefetch/hits\"" trace
+'
+
+test_expect_success 'threads leave textconv to the pickaxe' '
+	echo "b diff=test" >.gitattributes &&
+	git -c diff.test.textconv="tr P Q <" log -S Qicked --format=%H >expect &&
+	GIT_TEST_PICKAXE_THREADS=3 \
+		git -c diff.test.textconv="tr P Q <" log -S Qicked --format=%H >actual &&
+	test_cmp expect actual &&
+	test_line_count = 2 actual &&
+	rm .gitattributes
+'
+
 test_done
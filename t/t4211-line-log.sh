@@ -116,4 +116,14 @@ test_expect_success 'range_set_union' '
 	git log $(for x in $(test_seq 200); do echo -L $((2*x)),+1:c.c; done)
 '
 
+test_expect_success 'setup commit-graph with changed-path filters' '
+	git rev-list --all >commits &&
+	git commit-graph write --stdin-commits --changed-paths <commits
+'
+
+canned_test "-L 4,12:a.c simple" simple-f
+canned_test "-L :main:a.c simple" simple-main-to-end
+canned_test "-M -L '/long f/,/^}/:b.c' move-support" move-support-f
+canned_test "-M -L ':f:b.c' parallel-change" parallel-change-f-to-main
+
 test_done
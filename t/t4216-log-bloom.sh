@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='git log for a path with Bloom filters'
+. ./test-lib.sh
+
+test_expect_success 'setup test - repo, commits, commit graph, log outputs' '
+	git init &&
+	mkdir A A/B A/B/C &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 A/file1 &&
+	test_commit c5 A/B/file2 &&
+	test_commit c6 A/B/C/file3 &&
+	test_commit c7 A/file1 &&
+	test_commit c8 A/B/file2 &&
+	test_commit c9 A/B/C/file3 &&
+	test_commit c10 file_to_be_deleted &&
+	git checkout -b side HEAD~4 &&
+	test_commit side-1 file4 &&
+	git checkout master &&
+	git merge side &&
+	test_commit c11 file5 &&
+	mv file5 file5_renamed &&
+	git add file5_renamed &&
+	git commit -m "rename" &&
+	rm file_to_be_deleted &&
+	git add . &&
+	git commit -m "file removed" &&
+	git show-ref -s | git commit-graph write --stdin-commits --changed-paths
+'
+
+graph_read_expect () {
+	cat >expect <<-EOF &&
+	header: 43475048 1 1 $2 0
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata generation_data bloom_indexes bloom_data
+	EOF
+	git commit-graph read >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'commit-graph write wrote out the bloom chunks' '
+	graph_read_expect 15 6
+'
+
+setup () {
+	rm -f expect actual &&
+	git -c core.commitGraph=false log --pretty="format:%s" $1 >expect &&
+	git -c core.commitGraph=true log --pretty="format:%s" $1 >actual
+}
+
+test_bloom_filters_used () {
+	setup "$1" &&
+	test_cmp expect actual
+}
+
+for path in A A/B A/B/C A/file1 A/B/file2 A/B/C/file3 file4 file5 file5_renamed file_to_be_deleted A/B/ nonexistent
+do
+	for option in "" \
+		      "--all" \
+		      "--full-history" \
+		      "--full-history --simplify-merges" \
+		      "--simplify-merges" \
+		      "--simplify-by-decoration" \
+		      "--follow" \
+		      "--first-parent" \
+		      "--topo-order" \
+		      "--date-order" \
+		      "--author-date-order" \
+		      "--ancestry-path side..master"
+	do
+		test_expect_success "git log option: $option for path: $path" '
+			test_bloom_filters_used "$option -- $path"
+		'
+	done
+done
+
+test_expect_success 'git log with multiple paths or wildcards skips the filters' '
+	test_bloom_filters_used "-- A file4" &&
+	test_bloom_filters_used "-- *" &&
+	test_bloom_filters_used "-- :(icase)a/file1"
+'
+
+test_expect_success 'git log from a subdirectory' '
+	(
+		cd A &&
+		git -c core.commitGraph=false log --pretty="format:%s" -- B >../expect &&
+		git -c core.commitGraph=true log --pretty="format:%s" -- B >../actual
+	) &&
+	test_cmp expect actual
+'
+
+test_expect_success 'filters are reused by --append' '
+	test_commit c12 A/B/file2 &&
+	git rev-parse HEAD | git commit-graph write --stdin-commits --append --changed-paths &&
+	graph_read_expect 16 6 &&
+	test_bloom_filters_used "-- A/B" &&
+	test_bloom_filters_used "-- file4"
+'
+
+test_expect_success 'commit with many changed paths is never ruled out' '
+	for i in $(test_seq 600)
+	do
+		echo $i >big_$i || return 1
+	done &&
+	git add big_* &&
+	git commit -m "many paths" &&
+	git rev-parse HEAD | git commit-graph write --stdin-commits --append --changed-paths &&
+	test_bloom_filters_used "-- big_300" &&
+	test_bloom_filters_used "-- not_big"
+'
+
+test_done
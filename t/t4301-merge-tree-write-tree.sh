@@ -0,0 +1,166 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >numbers &&
+	test_write_lines a b c d e f g h i >letters &&
+	test_seq 1 30 >long &&
+	mkdir dir &&
+	echo x >dir/x &&
+	git add numbers letters long dir &&
+	test_tick &&
+	git commit -m base &&
+	git tag base &&
+
+	git checkout -b side1 &&
+	test_write_lines 1 two 3 4 5 6 7 8 9 >numbers &&
+	git mv long renamed &&
+	git commit -a -m side1 &&
+
+	git checkout -b side2 base &&
+	test_write_lines 1 2 3 4 5 6 7 eight 9 >numbers &&
+	sed -e "s/^15\$/fifteen/" long >long.new &&
+	mv long.new long &&
+	git commit -a -m side2 &&
+
+	git checkout -b side3 base &&
+	test_write_lines 1 deux 3 4 5 6 7 8 9 >numbers &&
+	git rm -q letters &&
+	git commit -a -m side3
+'
+
+test_expect_success 'clean merge' '
+	git merge-tree --write-tree side1 side2 >out &&
+	test_line_count = 1 out &&
+	tree=$(cat out) &&
+	test_write_lines 1 two 3 4 5 6 7 eight 9 >expect &&
+	git cat-file -p $tree:numbers >actual &&
+	test_cmp expect actual &&
+	git cat-file -p side2:long >expect &&
+	git cat-file -p $tree:renamed >actual &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify -q $tree:long &&
+	git rev-parse side1:letters >expect &&
+	git rev-parse $tree:letters >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the index and the working tree are left alone' '
+	git checkout -q side1 &&
+	git ls-files -s >index.before &&
+	test-tool chmtime =1000000000 .git/index &&
+	test_expect_code 1 git merge-tree --write-tree side1 side3 >out &&
+	git ls-files -s >index.after &&
+	test_cmp index.before index.after &&
+	echo 1000000000 >expect &&
+	test-tool chmtime --get .git/index >actual &&
+	test_cmp expect actual &&
+	git diff --exit-code
+'
+
+test_expect_success 'content conflict' '
+	test_expect_code 1 git merge-tree --write-tree side1 side3 >out &&
+	tree=$(head -n 1 out) &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse base:numbers) 1	numbers
+	100644 $(git rev-parse side1:numbers) 2	numbers
+	100644 $(git rev-parse side3:numbers) 3	numbers
+
+	CONFLICT (content): Merge conflict in numbers
+	EOF
+	sed -e 1d out >actual &&
+	test_cmp expect actual &&
+	git cat-file -p $tree:numbers >merged &&
+	grep "^<<<<<<< side1\$" merged &&
+	grep "^>>>>>>> side3\$" merged &&
+	test_must_fail git rev-parse --verify -q $tree:letters
+'
+
+test_expect_success '--no-messages' '
+	test_expect_code 1 git merge-tree --write-tree --no-messages \
+		side1 side3 >out &&
+	test_line_count = 4 out
+'
+
+test_expect_success 'modify/delete conflict' '
+	git checkout -b modify base &&
+	echo A >>letters &&
+	git commit -a -m modify &&
+	test_expect_code 1 git merge-tree --write-tree modify side3 >out &&
+	grep "^CONFLICT (modify/delete): letters deleted in side3 and modified in modify" out &&
+	tree=$(head -n 1 out) &&
+	git rev-parse modify:letters >expect &&
+	git rev-parse $tree:letters >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rename/delete conflict' '
+	git checkout -b delete-long base &&
+	git rm -q long &&
+	git commit -m delete-long &&
+	test_expect_code 1 git merge-tree --write-tree side1 delete-long >out &&
+	grep "^CONFLICT (rename/delete): long deleted in delete-long and renamed to renamed in side1" out &&
+	tree=$(head -n 1 out) &&
+	git rev-parse side1:renamed >expect &&
+	git rev-parse $tree:renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'directory/file conflict' '
+	git checkout -b file-dir base &&
+	git rm -q -r dir &&
+	echo file >dir &&
+	git add dir &&
+	git commit -m file-dir &&
+	git checkout -b in-dir base &&
+	echo y >dir/y &&
+	git add dir/y &&
+	git commit -m in-dir &&
+	test_expect_code 1 git merge-tree --write-tree file-dir in-dir >out &&
+	grep "^CONFLICT (directory/file): There is a directory with name dir in in-dir. Adding dir as dir~file-dir" out &&
+	tree=$(head -n 1 out) &&
+	git ls-tree -r --name-only $tree >actual &&
+	test_write_lines dir/y "dir~file-dir" letters long numbers >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'criss-cross merge with several merge bases' '
+	git checkout -b cross1 base &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	git commit -a -m cross1 &&
+	git checkout -b cross2 base &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 >numbers &&
+	git commit -a -m cross2 &&
+	git checkout -b cross1-merge cross1 &&
+	git merge -q -m merge1 cross2 &&
+	echo A >>letters &&
+	git commit -a -m more1 &&
+	git checkout -b cross2-merge cross2 &&
+	git merge -q -m merge2 cross1 &&
+	echo B >dir/b &&
+	git add dir/b &&
+	git commit -m more2 &&
+	git merge-base --all cross1-merge cross2-merge >bases &&
+	test_line_count = 2 bases &&
+	git merge-tree --write-tree cross1-merge cross2-merge >out &&
+	tree=$(cat out) &&
+	git cat-file -p cross1-merge:numbers >expect &&
+	git cat-file -p $tree:numbers >actual &&
+	test_cmp expect actual &&
+	git rev-parse cross1-merge:letters cross2-merge:dir/b >expect &&
+	git rev-parse $tree:letters $tree:dir/b >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'works in a bare repository' '
+	git clone -q --bare . bare.git &&
+	git -C bare.git merge-tree --write-tree side1 side2 >actual &&
+	git merge-tree --write-tree side1 side2 >expect &&
+	test_cmp expect actual &&
+	test_expect_code 1 git -C bare.git merge-tree --write-tree side1 side3
+'
+
+test_done
@@ -314,12 +314,90 @@ test_expect_success GZIP 'remote tar.gz is allowed by default' '
 	test_cmp_bin j.tgz remote.tar.gz
 '
 
+test_expect_success GZIP 'git archive with the built-in gzip' '
+	test_config tar.tgz.command "git archive gzip" &&
+	git -c archive.threads=1 archive --format=tgz HEAD >internal.tgz &&
+	gzip -d -c <internal.tgz >internal.tar &&
+	test_cmp_bin b.tar internal.tar
+'
+
+test_expect_success GZIP 'built-in gzip output does not depend on threads' '
+	test_config tar.tgz.command "git archive gzip" &&
+	git -c archive.threads=4 archive --format=tgz HEAD >internal4.tgz &&
+	test_cmp_bin internal.tgz internal4.tgz
+'
+
 test_expect_success GZIP 'remote tar.gz can be disabled' '
 	git config tar.tar.gz.remote false &&
 	test_must_fail git archive --remote=. --format=tar.gz HEAD \
 		>remote.tar.gz
 '
 
+test_expect_success 'setup repository for archive.cache' '
+	git init cached &&
+	test_commit -C cached one &&
+	test_commit -C cached two
+'
+
+test_expect_success 'archive.cache keeps the archive' '
+	git -C cached archive HEAD >uncached.tar &&
+	test_config -C cached archive.cache true &&
+	git -C cached archive HEAD >cached.tar &&
+	test_cmp_bin uncached.tar cached.tar &&
+	ls cached/.git/archive-cache >cache &&
+	test_line_count = 1 cache
+'
+
+test_expect_success 'archive.cache serves the archive it keeps' '
+	test_config -C cached archive.cache true &&
+	cached=cached/.git/archive-cache/$(cat cache) &&
+	chmod +w $cached &&
+	echo cached >$cached &&
+	git -C cached archive HEAD >actual &&
+	git -C cached archive --remote=. HEAD >actual-remote &&
+	echo cached >expect &&
+	test_cmp expect actual &&
+	test_cmp expect actual-remote &&
+	git -C cached archive --prefix=other/ HEAD >/dev/null &&
+	ls cached/.git/archive-cache >cache &&
+	test_line_count = 2 cache
+'
+
+test_expect_success 'archive.cache tells apart conversions' '
+	test_config -C cached archive.cache true &&
+	git -C cached -c core.autocrlf=true -c archive.cache=false \
+		archive HEAD >expect.tar &&
+	git -C cached -c core.autocrlf=true archive HEAD >crlf.tar &&
+	test_cmp_bin expect.tar crlf.tar &&
+	! test_cmp_bin cached.tar crlf.tar &&
+	ls cached/.git/archive-cache >cache &&
+	test_line_count = 3 cache
+'
+
+test_expect_success 'archive.cache does not keep tree archives' '
+	test_config -C cached archive.cache true &&
+	rm -rf cached/.git/archive-cache &&
+	git -C cached archive HEAD: >/dev/null &&
+	test_path_is_missing cached/.git/archive-cache
+'
+
+test_expect_success 'archive.cache does not keep export-subst archives' '
+	test_config archive.cache true &&
+	rm -rf .git/archive-cache &&
+	git archive HEAD >actual.tar &&
+	test_cmp_bin b.tar actual.tar &&
+	ls .git/archive-cache >cache &&
+	test_must_be_empty cache
+'
+
+test_expect_success 'archive.cacheLimit prunes the cache' '
+	test_config -C cached archive.cache true &&
+	test_config -C cached archive.cacheLimit 1 &&
+	git -C cached archive --prefix=third/ HEAD >/dev/null &&
+	ls cached/.git/archive-cache >cache &&
+	test_must_be_empty cache
+'
+
 test_expect_success 'archive and :(glob)' '
 	git archive -v HEAD -- ":(glob)**/sh" >/dev/null 2>actual &&
 	cat >expect <<EOF &&
@@ -163,6 +163,20 @@ test_expect_success 'git archive with --output, inferring format' '
 	test_cmp_bin d.zip d3.zip
 '
 
+test_expect_success 'git archive --format=zip with threads' '
+	git -c archive.threads=1 archive --format=zip HEAD >d4.zip &&
+	git -c archive.threads=4 archive --format=zip HEAD >d5.zip &&
+	test_cmp_bin d.zip d4.zip &&
+	test_cmp_bin d.zip d5.zip
+'
+
+test_expect_success 'git archive --format=zip reusing deflated blobs' '
+	git repack -a -d &&
+	git -c zip.reuseDeflated=true archive --format=zip HEAD >reuse.zip
+'
+
+check_zip reuse
+
 test_expect_success \
     'git archive --format=zip with prefix' \
     'git archive --format=zip --prefix=prefix/ HEAD >e.zip'
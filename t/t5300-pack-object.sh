@@ -463,6 +463,30 @@ test_expect_success !PTHREADS,C_LOCALE_OUTPUT 'pack-objects --threads=N or pack.
 	grep -F "no threads support, ignoring pack.threads" err
 '
 
+test_expect_success PTHREADS 'pack-objects --threads=N reports per-thread statistics' '
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+	git pack-objects --threads=3 --window=2 --stdout <obj-list >threaded.pack &&
+	git index-pack -o threaded.idx threaded.pack &&
+	git verify-pack threaded.idx &&
+	grep "delta search thread" trace >threads &&
+	test_line_count = 3 threads
+'
+
+test_expect_success PTHREADS 'pack-objects --memory-limit takes threads away' '
+	GIT_TRACE2_EVENT="$(pwd)/limit-trace" \
+	git pack-objects --threads=3 --window=2 --memory-limit=1k \
+		--stdout <obj-list >limited.pack 2>err &&
+	git index-pack -o limited.idx limited.pack &&
+	git verify-pack limited.idx &&
+	grep "\"key\":\"memory-limit/threads\",\"value\":1}" limit-trace &&
+	test_i18ngrep "too low" err &&
+	rm -f limit-trace &&
+	GIT_TRACE2_EVENT="$(pwd)/limit-trace" \
+	git -c pack.memoryLimit=1g pack-objects --threads=3 --window=2 \
+		--stdout <obj-list >limited.pack &&
+	grep "\"key\":\"memory-limit/threads\",\"value\":3}" limit-trace
+'
+
 test_expect_success 'pack-objects in too-many-packs mode' '
 	GIT_TEST_FULL_IN_PACK_ARRAY=1 git repack -ad &&
 	git fsck
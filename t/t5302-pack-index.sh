@@ -267,4 +267,70 @@ test_expect_success 'index-pack --fsck-objects also warns upon missing tagger in
     grep "^warning:.* expected .tagger. line" err
 '
 
+test_expect_success 'index-pack with threads reports per-thread statistics' '
+    git init skewed &&
+    (
+	cd skewed &&
+	for i in $(test_seq 1 30)
+	do
+		test_seq $i 200 >file &&
+		git add file &&
+		git commit -q -m $i || return 1
+	done &&
+	git repack -adq --depth=5 &&
+	pack=$(ls .git/objects/pack/*.pack) &&
+	git index-pack --threads=1 -o ../skewed-1.idx $pack &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/../trace" \
+	git index-pack --threads=4 -o ../skewed-4.idx $pack
+    ) &&
+    cmp skewed-1.idx skewed-4.idx &&
+    grep "delta resolution thread" trace >threads &&
+    test_line_count = 4 threads
+'
+
+test_expect_success 'index-pack --report-links lists what the pack lacks' '
+    git init links &&
+    (
+	cd links &&
+	test_commit one &&
+	test_commit two &&
+	git rev-parse HEAD | git pack-objects --stdout >commit.pack &&
+	git index-pack --stdin --report-links <commit.pack >out &&
+	head -n 1 out | grep "^pack	" &&
+	sed -e 1d -e "\$d" out | sort >actual &&
+	git rev-parse HEAD^ HEAD^{tree} | sort >expect &&
+	test_cmp expect actual &&
+	tail -n 1 out >last &&
+	echo >expect &&
+	test_cmp expect last
+    )
+'
+
+test_expect_success PTHREADS 'index-pack --verify reads the pack on threads' '
+    git init ranges &&
+    (
+	cd ranges &&
+	for i in $(test_seq 20)
+	do
+	    test_commit c$i || return 1
+	done &&
+	git repack -adq &&
+	pack=$(ls .git/objects/pack/*.pack) &&
+	git index-pack --threads=1 --verify-stat $pack >../ranges-1 &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/../trace" \
+	git index-pack --threads=4 --verify-stat $pack >../ranges-4 &&
+	cp $pack ../bad.pack &&
+	cp ${pack%.pack}.idx ../bad.idx &&
+	chmod +w ../bad.pack &&
+	size=$(wc -c <$pack) &&
+	printf "\377\377\377\377" |
+	dd of=../bad.pack bs=1 seek=$((size / 2)) conv=notrunc 2>/dev/null &&
+	test_must_fail git index-pack --threads=1 --verify ../bad.pack 2>../err-1 &&
+	test_must_fail git index-pack --threads=4 --verify ../bad.pack 2>../err-4
+    ) &&
+    test_cmp ranges-1 ranges-4 &&
+    grep "parsing 16 ranges of the pack on 4 threads" trace &&
+    test_cmp err-1 err-4
+'
+
 test_done
@@ -330,4 +330,25 @@ test_expect_success 'prune: handle expire option correctly' '
 	git prune --no-expire
 '
 
+test_expect_success 'prune with a reachability bitmap' '
+	git init bitmapped &&
+	(
+		cd bitmapped &&
+		test_commit packed &&
+		git repack -adb &&
+		test_commit loose &&
+		test_commit reflog-only &&
+		git reset --hard HEAD^ &&
+		echo indexed >indexed &&
+		git add indexed &&
+		unreachable=$(echo unreachable | git hash-object -w --stdin) &&
+		git prune --expire=now &&
+		git cat-file -e loose:loose.t &&
+		git cat-file -e HEAD@{1}:reflog-only.t &&
+		git cat-file -e :indexed &&
+		test_must_fail git cat-file -e $unreachable &&
+		git fsck
+	)
+'
+
 test_done
@@ -74,6 +74,27 @@ rev_list_tests() {
 		test_cmp expect actual
 	'
 
+	test_expect_success "counting both sides via bitmap ($state)" '
+		git rev-list --left-right --count other...master >expect &&
+		git rev-list --use-bitmap-index --left-right --count \
+			other...master >actual &&
+		test_cmp expect actual &&
+		git rev-list --left-right --count other...master ^HEAD~2 >expect &&
+		git rev-list --use-bitmap-index --left-right --count \
+			other...master ^HEAD~2 >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "ahead and behind via bitmap ($state)" '
+		git rev-list --left-right --count other...master >counts &&
+		read ahead behind <counts &&
+		test_config branch.other.remote . &&
+		test_config branch.other.merge refs/heads/master &&
+		echo "[ahead $ahead, behind $behind]" >expect &&
+		git for-each-ref --format="%(upstream:track)" refs/heads/other >actual &&
+		test_cmp expect actual
+	'
+
 	test_expect_success "counting commits with limiting ($state)" '
 		git rev-list --count HEAD -- 1.t >expect &&
 		git rev-list --use-bitmap-index --count HEAD -- 1.t >actual &&
@@ -332,6 +353,48 @@ test_expect_success 'pack reuse respects --incremental' '
 	test_cmp expect actual
 '
 
+test_expect_success 'pack reuse skips objects the other side has' '
+	git rev-list --objects HEAD~5..HEAD >objects &&
+	cut -d" " -f1 objects | sort >expect &&
+	printf "HEAD\n^HEAD~5\n" >revs &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git pack-objects --delta-base-offset --revs --stdout \
+		<revs >partial.pack &&
+	grep "\"key\":\"reused-verbatim\"" trace.event &&
+	git index-pack --strict partial.pack &&
+	git show-index <partial.idx >idx &&
+	cut -d" " -f2 idx | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bitmaps with and without a lookup table agree' '
+	git -c pack.writeBitmapLookupTable=false repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	cp $bitmap no-table.bitmap &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --use-bitmap-index --objects --all >expect.unsorted &&
+	git rev-list --use-bitmap-index --count HEAD~5..HEAD >>expect.unsorted &&
+	git -c pack.writeBitmapLookupTable=true repack -adb &&
+	! test_cmp_bin no-table.bitmap $bitmap &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --use-bitmap-index --objects --all >actual.unsorted &&
+	git rev-list --use-bitmap-index --count HEAD~5..HEAD >>actual.unsorted &&
+	sort expect.unsorted >expect &&
+	sort actual.unsorted >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'full repack reuses bitmaps read through the lookup table' '
+	git repack -adb &&
+	git rev-list --use-bitmap-index --objects --all >expect.unsorted &&
+	git repack -adb &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --use-bitmap-index --objects --all >actual.unsorted &&
+	sort expect.unsorted >expect &&
+	sort actual.unsorted >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'truncated bitmap fails gracefully' '
 	git repack -ad &&
 	git rev-list --use-bitmap-index --count --all >expect &&
@@ -344,4 +407,54 @@ test_expect_success 'truncated bitmap fails gracefully' '
 	test_i18ngrep corrupt stderr
 '
 
+test_expect_success 'setup bitmapped repository to push to' '
+	git init --bare push.git &&
+	git -C push.git config receive.unpackLimit 1 &&
+	git push push.git HEAD:refs/heads/master &&
+	git -C push.git repack -adb &&
+	git checkout -b connectivity &&
+	for i in $(test_seq 5)
+	do
+		test_commit connectivity-$i || return 1
+	done
+'
+
+test_expect_success 'push into bitmapped repository needs no rev-list' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git push push.git HEAD:refs/heads/master &&
+	test "$(git -C push.git rev-parse master)" = "$(git rev-parse HEAD)" &&
+	grep "index-pack .*--report-links" trace &&
+	! grep "rev-list --objects --stdin" trace &&
+	git -C push.git fsck
+'
+
+test_expect_success 'fetch into bitmapped repository needs no rev-list' '
+	git clone --bare push.git fetch.git &&
+	git -C fetch.git repack -adb &&
+	test_commit connectivity-fetch &&
+	git push push.git HEAD:refs/heads/master &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C fetch.git -c fetch.unpackLimit=1 \
+		fetch origin master:master &&
+	test "$(git -C fetch.git rev-parse master)" = "$(git rev-parse HEAD)" &&
+	# only the one that tells whether there is anything to fetch
+	grep "run_command: git rev-list --objects --stdin" trace >runs &&
+	test_line_count = 1 runs &&
+	git -C fetch.git fsck
+'
+
+test_expect_success 'connectivity check falls back to rev-list' '
+	git -C push.git repack -adb &&
+	# the server has the parent, but not reachable from its refs
+	git init --bare alt.git &&
+	test_commit connectivity-alt &&
+	git push alt.git HEAD:refs/heads/alt &&
+	echo "$(pwd)/alt.git/objects" >push.git/objects/info/alternates &&
+	test_commit connectivity-after-alt &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git push push.git HEAD:refs/heads/master &&
+	grep "rev-list --objects --stdin" trace &&
+	test "$(git -C push.git rev-parse master)" = "$(git rev-parse HEAD)"
+'
+
 test_done
@@ -52,16 +52,16 @@ graph_git_behavior 'no graph' full commits/3 commits/1
 
 graph_read_expect() {
 	OPTIONAL=""
-	NUM_CHUNKS=3
+	NUM_CHUNKS=4
 	if test ! -z $2
 	then
 		OPTIONAL=" $2"
-		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
+		NUM_CHUNKS=$((4 + $(echo "$2" | wc -w)))
 	fi
 	cat >expect <<- EOF
 	header: 43475048 1 1 $NUM_CHUNKS 0
 	num_commits: $1
-	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	chunks: oid_fanout oid_lookup commit_metadata generation_data$OPTIONAL
 	EOF
 	git commit-graph read >output &&
 	test_cmp expect output
@@ -230,4 +230,144 @@ test_expect_success 'perform fast-forward merge in full repo' '
 	test_cmp expect output
 '
 
+test_expect_success 'setup repo with skewed commit dates' '
+	cd "$TRASH_DIRECTORY" &&
+	git init skewed &&
+	cd skewed &&
+	git config core.commitGraph true &&
+	test_commit base &&
+	git checkout -b future &&
+	GIT_COMMITTER_DATE="@4294967296 +0000" git commit --allow-empty -m future &&
+	GIT_COMMITTER_DATE="@10 +0000" git commit --allow-empty -m past &&
+	git checkout master &&
+	test_commit side &&
+	git checkout -b merge &&
+	git merge -m merge future
+'
+
+test_expect_success 'large corrected commit date offsets overflow' '
+	cd "$TRASH_DIRECTORY/skewed" &&
+	git show-ref -s | git commit-graph write --stdin-commits &&
+	graph_read_expect "5" "generation_data_overflow"
+'
+
+test_expect_success 'reachability with skewed commit dates' '
+	cd "$TRASH_DIRECTORY/skewed" &&
+	>actual &&
+	for mode in true false
+	do
+		git -c core.commitGraph=$mode branch --contains future~1 >>actual &&
+		git -c core.commitGraph=$mode merge-base --is-ancestor future~1 merge &&
+		test_must_fail git -c core.commitGraph=$mode \
+			merge-base --is-ancestor side future &&
+		git -c core.commitGraph=$mode merge-base side future >>actual ||
+		return 1
+	done &&
+	cat >expect <<-EOF &&
+	  future
+	* merge
+	$(git rev-parse base)
+	  future
+	* merge
+	$(git rev-parse base)
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'commitGraph.generationVersion=1 writes no generation data' '
+	cd "$TRASH_DIRECTORY/skewed" &&
+	git show-ref -s |
+	git -c commitGraph.generationVersion=1 commit-graph write --stdin-commits &&
+	git commit-graph read >output &&
+	! grep generation_data output &&
+	git branch --contains future~1 >actual &&
+	git -c core.commitGraph=false branch --contains future~1 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'generations and Bloom filters are used without replace refs' '
+	cd "$TRASH_DIRECTORY" &&
+	git init unreplaced &&
+	cd unreplaced &&
+	git config core.commitGraph true &&
+	test_commit base &&
+	echo target >target &&
+	git add target &&
+	GIT_COMMITTER_DATE="@1200000000 +0000" git commit -m target &&
+	target=$(git rev-parse HEAD) &&
+	GIT_COMMITTER_DATE="@1100000000 +0000" \
+		git commit --allow-empty -m skewed &&
+	GIT_COMMITTER_DATE="@1300000000 +0000" \
+		git commit --allow-empty -m tip &&
+	git tag tip &&
+	git show-ref -s | git commit-graph write --stdin-commits --changed-paths &&
+	echo "$target tags/tip~2" >expect &&
+	git name-rev $target >actual &&
+	test_cmp expect actual &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" git log -- target >/dev/null &&
+	grep "\"key\":\"filters_in_use\"" trace.event
+'
+
+test_expect_success 'setup repo with a replaced commit' '
+	cd "$TRASH_DIRECTORY" &&
+	git init replaced &&
+	cd replaced &&
+	git config core.commitGraph true &&
+	test_commit A &&
+	test_commit B &&
+	test_commit C &&
+	test_commit D &&
+	git checkout -b side A &&
+	for i in $(test_seq 5)
+	do
+		test_commit X$i || return 1
+	done &&
+	git checkout master &&
+	git show-ref -s | git commit-graph write --stdin-commits &&
+	git replace --graft C X5
+'
+
+test_expect_success 'replaced commits are read from their replacement' '
+	cd "$TRASH_DIRECTORY/replaced" &&
+	>actual &&
+	for mode in true false
+	do
+		git -c core.commitGraph=$mode log --format=%s master >>actual &&
+		git -c core.commitGraph=$mode merge-base --is-ancestor X5 master &&
+		git -c core.commitGraph=$mode branch --contains X5 >>actual &&
+		git --no-replace-objects -c core.commitGraph=$mode \
+			log --format=%s master >>actual ||
+		return 1
+	done &&
+	for i in 1 2
+	do
+		cat <<-\EOF || return 1
+		D
+		C
+		X5
+		X4
+		X3
+		X2
+		X1
+		A
+		* master
+		  side
+		D
+		C
+		B
+		A
+		EOF
+	done >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the graph is written without replacements' '
+	cd "$TRASH_DIRECTORY/replaced" &&
+	git show-ref -s | git commit-graph write --stdin-commits &&
+	git --no-replace-objects log --format=%s master >actual &&
+	git --no-replace-objects -c core.commitGraph=false \
+		log --format=%s master >expect &&
+	test_cmp expect actual
+'
+
 test_done
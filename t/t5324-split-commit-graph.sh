@@ -0,0 +1,183 @@
+#!/bin/sh
+
+test_description='split commit graph'
+. ./test-lib.sh
+
+test_expect_success 'setup repo' '
+	git init &&
+	git config core.commitGraph true &&
+	infodir=".git/objects/info" &&
+	graphdir="$infodir/commit-graphs"
+'
+
+write_graph() {
+	git show-ref -s | git commit-graph write --stdin-commits "$@"
+}
+
+graph_read_expect() {
+	NUM_BASE=${2:-0}
+	cat >expect <<- EOF
+	header: 43475048 1 1 $3 $NUM_BASE
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata generation_data$4
+	EOF
+	git commit-graph read >output &&
+	test_cmp expect output
+}
+
+graph_git_two_modes() {
+	git -c core.commitGraph=true $1 >output &&
+	git -c core.commitGraph=false $1 >expect &&
+	test_cmp expect output
+}
+
+graph_git_behavior() {
+	MSG=$1
+	BRANCH=$2
+	COMPARE=$3
+	test_expect_success "check normal git operations: $MSG" '
+		graph_git_two_modes "log --oneline $BRANCH" &&
+		graph_git_two_modes "log --topo-order $BRANCH" &&
+		graph_git_two_modes "log --graph $COMPARE..$BRANCH" &&
+		graph_git_two_modes "branch -vv" &&
+		graph_git_two_modes "merge-base -a $BRANCH $COMPARE"
+	'
+}
+
+test_expect_success 'create commits and write commit-graph' '
+	for i in $(test_seq 10)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	write_graph --split &&
+	test_path_is_missing $infodir/commit-graph &&
+	test_path_is_file $graphdir/commit-graph-chain &&
+	test_line_count = 1 $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 1 graph-files &&
+	graph_read_expect 10 0 4
+'
+
+graph_git_behavior 'graph exists' commits/10 commits/1
+
+test_expect_success 'add a layer on top of the chain' '
+	git checkout -b side commits/3 &&
+	test_commit 11 &&
+	write_graph --split &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 2 graph-files &&
+	graph_read_expect 1 1 5 " base_graphs"
+'
+
+graph_git_behavior 'two layers' side commits/10
+
+test_expect_success 'a small top layer is merged into the new one' '
+	git checkout -b other commits/5 &&
+	test_commit 12 &&
+	git merge -m octopus side commits/10 &&
+	git branch merge/1 &&
+	write_graph --split &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 2 graph-files &&
+	graph_read_expect 3 1 6 " large_edges base_graphs"
+'
+
+graph_git_behavior 'octopus with parents in base layer' merge/1 commits/10
+
+test_expect_success 'a large top layer is kept' '
+	test_commit 13 &&
+	write_graph --split &&
+	test_line_count = 3 $graphdir/commit-graph-chain &&
+	graph_read_expect 1 2 5 " base_graphs"
+'
+
+graph_git_behavior 'three layers' HEAD side
+
+test_expect_success 'nothing new leaves the chain alone' '
+	cp $graphdir/commit-graph-chain chain-before &&
+	write_graph --split &&
+	test_cmp chain-before $graphdir/commit-graph-chain
+'
+
+test_expect_success 'layers are merged geometrically' '
+	test_commit 14 &&
+	write_graph --split &&
+	test_line_count = 1 $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 1 graph-files &&
+	graph_read_expect 15 0 5 " large_edges"
+'
+
+graph_git_behavior 'merged layers' HEAD commits/10
+
+test_expect_success '--size-multiple merges more layers' '
+	test_commit 15 &&
+	write_graph --split &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	test_commit 16 &&
+	write_graph --split --size-multiple=20 &&
+	test_line_count = 1 $graphdir/commit-graph-chain &&
+	graph_read_expect 17 0 5 " large_edges"
+'
+
+test_expect_success 'commit-graph file is merged into a new chain' '
+	test_commit 17 &&
+	write_graph &&
+	test_path_is_file $infodir/commit-graph &&
+	test_path_is_missing $graphdir/commit-graph-chain &&
+	ls $graphdir >graph-files &&
+	test_line_count = 0 graph-files &&
+	test_commit 18 &&
+	write_graph --split &&
+	test_path_is_missing $infodir/commit-graph &&
+	test_line_count = 1 $graphdir/commit-graph-chain &&
+	graph_read_expect 19 0 5 " large_edges"
+'
+
+graph_git_behavior 'chain from commit-graph file' HEAD commits/10
+
+test_expect_success 'layers from a broken chain are ignored' '
+	test_commit 19 &&
+	test_commit 20 &&
+	test_commit 21 &&
+	write_graph --split &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	test_commit 22 &&
+	write_graph --split &&
+	test_line_count = 3 $graphdir/commit-graph-chain &&
+	rm -f $graphdir/graph-$(sed -n 2p $graphdir/commit-graph-chain).graph &&
+	git log --oneline >actual 2>err &&
+	test_i18ngrep "unable to find all commit-graph files" err &&
+	git -c core.commitGraph=false log --oneline >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'changed-path filters in a layer' '
+	rm -rf $graphdir &&
+	write_graph --split --changed-paths &&
+	test_commit 23 &&
+	write_graph --split --changed-paths &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	graph_read_expect 1 1 7 " bloom_indexes bloom_data base_graphs" &&
+	graph_git_two_modes "log --oneline -- 5.t" &&
+	graph_git_two_modes "log --oneline -- 23.t"
+'
+
+test_expect_success 'no generation data on top of a layer without it' '
+	rm -rf $graphdir &&
+	git config commitGraph.generationVersion 1 &&
+	write_graph --split &&
+	git config --unset commitGraph.generationVersion &&
+	test_commit 24 &&
+	write_graph --split &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	git commit-graph read >output &&
+	! grep generation_data output
+'
+
+graph_git_behavior 'layers without generation data' HEAD commits/10
+
+test_done
@@ -0,0 +1,133 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+# The tests below decide for themselves when to write one.
+sane_unset GIT_TEST_WRITE_REV_INDEX
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	for i in $(test_seq 10)
+	do
+		test_commit one-$i || return 1
+	done &&
+	git repack -ad &&
+	for i in $(test_seq 5)
+	do
+		test_commit two-$i || return 1
+	done &&
+	git repack -d &&
+	git repack -adf &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	rev=${pack%.pack}.rev &&
+	test_path_is_missing $rev &&
+	git cat-file --batch-all-objects --batch-check="%(objectname) %(objectsize:disk)" >expect.sizes
+'
+
+test_expect_success 'index-pack writes a reverse index when asked' '
+	idx=${pack%.pack}.idx &&
+	mv $idx $idx.orig &&
+	test_when_finished "mv $idx.orig $idx" &&
+	git index-pack $pack &&
+	test_path_is_missing $rev &&
+	rm $idx &&
+	git -c pack.writeReverseIndex=true index-pack $pack &&
+	test_path_is_file $rev &&
+	test_cmp $idx.orig $idx
+'
+
+test_expect_success 'the reverse index lists the objects in pack order' '
+	git show-index <${pack%.pack}.idx >idx.out &&
+	sort -n idx.out | cut -d" " -f2 >expect &&
+	num=$(wc -l <expect) &&
+	test $(wc -c <$rev) = $((12 + 4 * num + 40)) &&
+	sort -k2 idx.out | cut -d" " -f2 >by-name &&
+	printf "RIDX" >expect.header &&
+	head -c 4 $rev >actual.header &&
+	test_cmp expect.header actual.header &&
+	dd if=$rev bs=1 skip=12 count=$((4 * num)) 2>/dev/null |
+		od -An -tx1 -v | tr -d " \n" | sed "s/......../&\n/g" |
+		while read pos
+		do
+			sed -n "$((0x$pos + 1))p" by-name
+		done >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'disk sizes are the same with a reverse index' '
+	git cat-file --batch-all-objects --batch-check="%(objectname) %(objectsize:disk)" >actual.sizes &&
+	test_cmp expect.sizes actual.sizes
+'
+
+test_expect_success 'index-pack --verify checks the reverse index' '
+	git index-pack --verify $pack &&
+	cp $rev rev.orig &&
+	test_when_finished "mv -f rev.orig $rev" &&
+	chmod +w $rev &&
+	printf "\377\377\377\377" | dd of=$rev bs=1 seek=12 conv=notrunc 2>/dev/null &&
+	test_must_fail git index-pack --verify $pack
+'
+
+test_expect_success 'a reverse index of another pack is ignored' '
+	cp $rev rev.orig &&
+	test_when_finished "mv -f rev.orig $rev" &&
+	chmod +w $rev &&
+	size=$(wc -c <$rev) &&
+	printf "\377\377\377\377" | dd of=$rev bs=1 seek=$((size - 40)) conv=notrunc 2>/dev/null &&
+	git cat-file --batch-all-objects --batch-check="%(objectname) %(objectsize:disk)" >actual.sizes 2>err &&
+	test_cmp expect.sizes actual.sizes &&
+	test_i18ngrep "does not match its pack" err
+'
+
+test_expect_success 'a truncated reverse index is ignored' '
+	cp $rev rev.orig &&
+	test_when_finished "mv -f rev.orig $rev" &&
+	chmod +w $rev &&
+	head -c 100 rev.orig >$rev &&
+	git cat-file --batch-all-objects --batch-check="%(objectname) %(objectsize:disk)" >actual.sizes 2>err &&
+	test_cmp expect.sizes actual.sizes &&
+	test_i18ngrep "wrong size" err
+'
+
+test_expect_success 'repack writes and removes reverse indexes' '
+	test_commit three &&
+	git repack -adf &&
+	test_path_is_missing $rev &&
+	git cat-file --batch-all-objects --batch-check="%(objectname) %(objectsize:disk)" >expect.sizes &&
+	git -c pack.writeReverseIndex=true repack -adf &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	rev=${pack%.pack}.rev &&
+	test_path_is_file $rev &&
+	git index-pack --verify $pack &&
+	git cat-file --batch-all-objects --batch-check="%(objectname) %(objectsize:disk)" >actual.sizes &&
+	test_cmp expect.sizes actual.sizes
+'
+
+test_expect_success 'GIT_TEST_WRITE_REV_INDEX writes a reverse index' '
+	GIT_TEST_WRITE_REV_INDEX=1 git repack -adf &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	test_path_is_file ${pack%.pack}.rev &&
+	git -c pack.writeReverseIndex=false repack -adf &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	test_path_is_missing ${pack%.pack}.rev &&
+	ls $packdir >files &&
+	! grep "\.rev$" files
+'
+
+test_expect_success 'bitmaps work with a reverse index' '
+	git rev-list --objects HEAD >expect.raw &&
+	cut -d" " -f1 expect.raw | sort >expect &&
+	git -c pack.writeReverseIndex=true repack -adb &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	test_path_is_file ${pack%.pack}.rev &&
+	git rev-list --objects --use-bitmap-index HEAD >actual.raw &&
+	cut -d" " -f1 actual.raw | sort >actual &&
+	test_cmp expect actual &&
+	git pack-objects --stdout --all </dev/null >reused.pack &&
+	git index-pack --stdin <reused.pack &&
+	git fsck
+'
+
+test_done
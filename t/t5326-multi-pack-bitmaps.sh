@@ -0,0 +1,152 @@
+#!/bin/sh
+
+test_description='reachability bitmaps for multi-pack-indexes'
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+midx_bitmap () {
+	ls $packdir/multi-pack-index-*.bitmap 2>/dev/null
+}
+
+# Compare what rev-list finds with and without bitmaps.
+rev_list_matches () {
+	git rev-list --objects "$@" >expect.raw &&
+	git rev-list --use-bitmap-index --objects "$@" >actual.raw &&
+	cut -d" " -f1 <expect.raw | sort >expect &&
+	cut -d" " -f1 <actual.raw | sort >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup incremental packs' '
+	git config core.multiPackIndex true &&
+	for i in 1 2 3 4 5
+	do
+		test_commit "commit-$i" &&
+		git repack -d || return 1
+	done &&
+	git checkout -b topic commit-2 &&
+	test_commit side &&
+	git repack -d &&
+	git checkout master &&
+	git tag -a -m annotated annotated commit-3 &&
+	git repack -d &&
+	test $(ls $packdir/*.pack | wc -l) -gt 1
+'
+
+test_expect_success 'write multi-pack-index with a bitmap' '
+	git multi-pack-index write --bitmap &&
+	test_path_is_file $(midx_bitmap) &&
+	git multi-pack-index read >out &&
+	grep "^chunks: .* revindex$" out &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'multi-pack-index bitmap has a name-hash cache' '
+	# the options are the two bytes after the magic and the version;
+	# 0x04 is the hash cache
+	options=$(od -An -tx1 -j7 -N1 $(midx_bitmap) | tr -d " ") &&
+	test $((0x$options & 4)) = 4 &&
+	# the cache holds a hash for the blobs, which all have a name
+	nr=$(git rev-list --objects --all | wc -l) &&
+	tail -c $((4 * $nr + 20)) $(midx_bitmap) | head -c $((4 * $nr)) |
+		od -An -tx1 -v | tr -s " " "\n" | grep -v "^00*$" >nonzero &&
+	test -s nonzero &&
+	git -c pack.writeBitmapHashCache=false multi-pack-index write --bitmap &&
+	options=$(od -An -tx1 -j7 -N1 $(midx_bitmap) | tr -d " ") &&
+	test $((0x$options & 4)) = 0 &&
+	git multi-pack-index write --bitmap
+'
+
+test_expect_success 'bitmap covers the objects of all packs' '
+	git rev-list --test-bitmap commit-5 2>err &&
+	grep "^OK!$" err &&
+	git rev-list --test-bitmap topic 2>err &&
+	grep "^OK!$" err
+'
+
+test_expect_success 'rev-list with the multi-pack-index bitmap' '
+	rev_list_matches --all &&
+	rev_list_matches master ^topic &&
+	rev_list_matches topic ^commit-3 &&
+	rev_list_matches annotated &&
+	git rev-list --count --all >expect &&
+	git rev-list --use-bitmap-index --count --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects with the multi-pack-index bitmap' '
+	git pack-objects --stdout --revs --all </dev/null >all.pack &&
+	git init --bare receiver.git &&
+	git -C receiver.git index-pack --stdin <all.pack &&
+	idx=$(ls receiver.git/objects/pack/*.idx) &&
+	git show-index <$idx | cut -d" " -f2 | sort >actual &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from a repository with a multi-pack-index bitmap' '
+	git clone --no-local --bare . clone.git &&
+	git -C clone.git fsck &&
+	git -C clone.git rev-parse master topic >actual &&
+	git rev-parse master topic >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'objects outside the multi-pack-index' '
+	test_commit loose &&
+	rev_list_matches --all &&
+	git repack -d &&
+	rev_list_matches --all &&
+	rev_list_matches loose ^commit-5
+'
+
+test_expect_success 'preferred pack' '
+	git multi-pack-index write --bitmap &&
+	old=$(midx_bitmap) &&
+	pack=$(ls $packdir/*.pack | tail -n 1) &&
+	git multi-pack-index write --bitmap \
+		--preferred-pack=$(basename $pack) &&
+	new=$(midx_bitmap) &&
+	test "$old" != "$new" &&
+	test_path_is_missing "$old" &&
+	git multi-pack-index verify &&
+	git rev-list --test-bitmap master 2>err &&
+	grep "^OK!$" err &&
+	rev_list_matches --all &&
+	test_must_fail git multi-pack-index write --bitmap \
+		--preferred-pack=does-not-exist.pack 2>err &&
+	test_i18ngrep "unknown preferred pack" err
+'
+
+test_expect_success 'bitmap is not reported as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0$" out
+'
+
+test_expect_success 'missing objects prevent writing a bitmap' '
+	test_when_finished "git update-ref -d refs/heads/unpacked" &&
+	commit=$(echo unpacked | git commit-tree HEAD^{tree}) &&
+	git update-ref refs/heads/unpacked $commit &&
+	old=$(midx_bitmap) &&
+	test_must_fail git multi-pack-index write --bitmap 2>err &&
+	test_i18ngrep "is not in any pack" err &&
+	test "$(midx_bitmap)" = "$old"
+'
+
+test_expect_success 'writing without --bitmap removes the bitmap' '
+	git multi-pack-index write &&
+	test -z "$(midx_bitmap)" &&
+	rev_list_matches --all
+'
+
+test_expect_success 'repack removes the bitmap with the multi-pack-index' '
+	git multi-pack-index write --bitmap &&
+	test_path_is_file $(midx_bitmap) &&
+	git repack -adf &&
+	test_path_is_missing $packdir/multi-pack-index &&
+	test -z "$(midx_bitmap)"
+'
+
+test_done
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+test_description='reading objects through the delta base cache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup long delta chains' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 >file &&
+	for i in $(test_seq 30)
+	do
+		sed -e "${i}s/\$/ $i/" <file >file.new &&
+		{
+			cat file.new &&
+			test_seq $((i * 10))
+		} >file &&
+		cp file "copy-$((i % 3))" &&
+		git add file copy-* &&
+		test_tick &&
+		git commit -q -m "change $i" || return 1
+	done &&
+	git repack -adf --depth=50 --window=50 &&
+	git log -p >expect.log &&
+	git cat-file --batch-all-objects --batch >expect.objects
+'
+
+for policy in lru arc
+do
+	test_expect_success "$policy policy with a tiny cache" '
+		git -c core.deltaBaseCacheLimit=1k \
+		    -c core.deltaBaseCachePolicy=$policy log -p >actual &&
+		test_cmp expect.log actual &&
+		git -c core.deltaBaseCacheLimit=1k \
+		    -c core.deltaBaseCachePolicy=$policy \
+		    cat-file --batch-all-objects --batch >actual &&
+		test_cmp expect.objects actual
+	'
+done
+
+test_expect_success 'arc policy counts ghost hits' '
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+	git -c core.deltaBaseCacheLimit=16k \
+	    -c core.deltaBaseCachePolicy=arc log -p >actual &&
+	test_cmp expect.log actual &&
+	grep "delta_base_cache/evict" trace &&
+	grep "delta_base_cache/ghost_hit" trace
+'
+
+test_expect_success 'unknown policy is rejected' '
+	test_must_fail git -c core.deltaBaseCachePolicy=fifo log -p 2>err &&
+	test_i18ngrep "invalid policy for the delta base cache" err
+'
+
+test_done
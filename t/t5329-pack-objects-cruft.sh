@@ -0,0 +1,144 @@
+#!/bin/sh
+
+test_description='cruft packs of unreachable objects'
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+loose_path () {
+	echo $objdir/$(echo $1 | sed "s,..,&/,")
+}
+
+# Print the mtime that the cruft pack <pack> records for object <oid>.
+cruft_mtime () {
+	pos=$(git show-index <${1%.pack}.idx | cut -d" " -f2 | sort |
+		grep -n $2 | cut -d: -f1) &&
+	hex=$(dd if=${1%.pack}.mtimes bs=1 skip=$((12 + 4 * (pos - 1))) count=4 2>/dev/null |
+		od -An -tx1 | tr -d " \n") &&
+	echo $((0x$hex))
+}
+
+cruft_pack () {
+	ls $packdir/pack-*.mtimes | sed "s/mtimes$/pack/"
+}
+
+test_expect_success 'setup' '
+	test_commit base &&
+	git branch gone &&
+	git checkout gone &&
+	test_commit gone &&
+	gone=$(git rev-parse gone) &&
+	gone_blob=$(git rev-parse gone:gone.t) &&
+	git checkout master &&
+	git repack -adq &&
+	git branch -D gone &&
+	git tag -d gone &&
+	git reflog expire --expire=all --all &&
+	loose=$(echo loose | git hash-object -w --stdin) &&
+	test-tool chmtime =1234567890 $(loose_path $loose)
+'
+
+test_expect_success 'repack --cruft packs unreachable objects with their mtimes' '
+	git repack -d --cruft &&
+	test_path_is_missing $(loose_path $loose) &&
+	test $(ls $packdir/pack-*.pack | wc -l) = 2 &&
+	cruft=$(cruft_pack) &&
+	git show-index <${cruft%.pack}.idx | cut -d" " -f2 >objects &&
+	test_line_count = 4 objects &&
+	grep $gone objects &&
+	grep $loose objects &&
+	test $(cruft_mtime $cruft $loose) = 1234567890 &&
+	git cat-file -p $loose >actual &&
+	echo loose >expect &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'repack --cruft carries the mtimes over' '
+	old=$(cruft_pack) &&
+	another=$(echo another | git hash-object -w --stdin) &&
+	git repack -d --cruft &&
+	test_path_is_missing $old &&
+	test_path_is_missing ${old%.pack}.mtimes &&
+	cruft=$(cruft_pack) &&
+	test $(cruft_mtime $cruft $loose) = 1234567890 &&
+	git cat-file -e $another
+'
+
+test_expect_success 'writing a cruft object again writes it loose' '
+	echo loose | git hash-object -w --stdin &&
+	test_path_is_file $(loose_path $loose) &&
+	git repack -d --cruft &&
+	test_path_is_missing $(loose_path $loose) &&
+	test $(cruft_mtime $(cruft_pack) $loose) -gt 1234567890
+'
+
+test_expect_success '--cruft-expiration leaves out old objects' '
+	old=$(echo old | git hash-object -w --stdin) &&
+	test-tool chmtime =1234567890 $(loose_path $old) &&
+	git repack -d --cruft --cruft-expiration=2.weeks.ago &&
+	git show-index <$(cruft_pack | sed "s/pack$/idx/") >objects &&
+	! grep $old objects &&
+	grep $loose objects &&
+	grep $gone objects &&
+	# the loose copy is left to prune
+	git prune --expire=2.weeks.ago &&
+	test_must_fail git cat-file -e $old
+'
+
+test_expect_success '--cruft-expiration keeps what recent objects need' '
+	git repack -d --cruft --cruft-expiration=now &&
+	test_must_fail git cat-file -e $gone &&
+	test_must_fail git cat-file -e $loose &&
+	test_path_is_missing $packdir/pack-*.mtimes &&
+	old=$(echo old blob | git hash-object -w --stdin) &&
+	test-tool chmtime =1234567890 $(loose_path $old) &&
+	tree=$(printf "100644 blob $old\told\n" | git mktree) &&
+	git repack -d --cruft --cruft-expiration=2.weeks.ago &&
+	git cat-file -e $old &&
+	git cat-file -e $tree &&
+	test_path_is_missing $(loose_path $old)
+'
+
+test_expect_success 'prune goes by the mtimes of a cruft pack' '
+	blob=$(echo needed | git hash-object --stdin) &&
+	tree=$(printf "100644 blob $blob\tneeded\n" | git mktree --missing) &&
+	git repack -d --cruft &&
+	test_path_is_missing $(loose_path $tree) &&
+	test-tool chmtime =1234567890 $(cruft_pack) &&
+	echo needed | git hash-object -w --stdin &&
+	test-tool chmtime =1234567890 $(loose_path $blob) &&
+	git prune --expire=2.weeks.ago &&
+	git cat-file -e $blob
+'
+
+test_expect_success 'gc with gc.cruftPacks' '
+	git repack -adq &&
+	for i in $(test_seq 5)
+	do
+		echo unreachable $i | git hash-object -w --stdin || return 1
+	done >unreachable &&
+	git -c gc.cruftPacks=true gc &&
+	for o in $(cat unreachable)
+	do
+		test_path_is_missing $(loose_path $o) &&
+		git cat-file -e $o || return 1
+	done &&
+	test_path_is_file $(ls $packdir/pack-*.mtimes) &&
+	git gc --cruft --prune=now &&
+	for o in $(cat unreachable)
+	do
+		test_must_fail git cat-file -e $o || return 1
+	done
+'
+
+test_expect_success 'pack-objects --cruft option checks' '
+	test_must_fail git pack-objects --cruft --stdout </dev/null &&
+	test_must_fail git pack-objects --cruft --all $packdir/pack </dev/null &&
+	test_must_fail git pack-objects --cruft-expiration=now $packdir/pack </dev/null &&
+	test_must_fail git repack --cruft -A &&
+	test_must_fail git repack --cruft --geometric=2
+'
+
+test_done
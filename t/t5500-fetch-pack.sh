@@ -814,6 +814,54 @@ test_expect_success 'fetching deepen' '
 	)
 '
 
+test_expect_success 'fetching deepen from a server with a commit-graph' '
+	test_create_repo shallow-graph &&
+	(
+	cd shallow-graph &&
+	test_commit one &&
+	test_commit two &&
+	git checkout -b side one &&
+	test_commit side &&
+	git checkout master &&
+	git merge -m merge side &&
+	test_commit three &&
+	git config core.commitGraph true &&
+	git show-ref -s | git commit-graph write --stdin-commits &&
+	git clone --depth 1 "file://$(pwd)/." deepen &&
+	test_commit four &&
+	git show-ref -s | git commit-graph write --stdin-commits &&
+	git -C deepen fetch --deepen=1 &&
+	git -C deepen log --pretty=tformat:%s origin/master >actual &&
+	test_write_lines four three merge >expected &&
+	test_cmp expected actual &&
+	git -C deepen fetch --depth=4 &&
+	git -C deepen log --pretty=tformat:%s origin/master >actual &&
+	test_write_lines four three merge side two >expected &&
+	test_cmp expected actual &&
+	git -C deepen fsck
+	)
+'
+
+test_expect_success 'fetch into a shallow clone from a server with a commit-graph' '
+	test_create_repo shallow-graph-revert &&
+	(
+	cd shallow-graph-revert &&
+	echo old >file &&
+	git add file &&
+	git commit -m old &&
+	echo new >file &&
+	git commit -a -m new &&
+	git config core.commitGraph true &&
+	git clone --depth 1 "file://$(pwd)/." shallow &&
+	echo old >file &&
+	git commit -a -m revert &&
+	git show-ref -s | git commit-graph write --stdin-commits &&
+	git -C shallow fetch &&
+	git -C shallow fsck &&
+	git -C shallow cat-file -e origin/master:file
+	)
+'
+
 test_expect_success 'filtering by size' '
 	rm -rf server client &&
 	test_create_repo server &&
@@ -157,4 +157,13 @@ test_expect_success 'new clone fetch master and tags' '
 	test_cmp expect actual
 '
 
+test_expect_success 'fetch follows a tag on a commit we have that is not a tip' '
+	git tag -a -m "old tag" tag3 $A &&
+	(
+		cd clone2 &&
+		git fetch &&
+		test $A = $(git rev-parse --verify tag3^0)
+	)
+'
+
 test_done
@@ -522,6 +522,31 @@ test_expect_success 'fetch --dry-run' '
 	! test -f .git/FETCH_HEAD
 '
 
+test_expect_success 'fetch --no-write-fetch-head does not touch FETCH_HEAD' '
+	rm -f .git/FETCH_HEAD &&
+	git fetch --no-write-fetch-head . &&
+	! test -f .git/FETCH_HEAD
+'
+
+test_expect_success 'fetch --prefetch writes only under refs/prefetch/' '
+	git init prefetch-source &&
+	test_commit -C prefetch-source first &&
+	git init prefetch &&
+	(
+		cd prefetch &&
+		git remote add origin ../prefetch-source &&
+		git config --add remote.origin.fetch refs/heads/master &&
+		git config --add remote.origin.fetch "+refs/tags/*:refs/tags/*" &&
+		git fetch --prefetch origin &&
+		git for-each-ref --format="%(refname)" >actual &&
+		echo refs/prefetch/remotes/origin/master >expect &&
+		test_cmp expect actual &&
+		git rev-parse -q --verify refs/prefetch/remotes/origin/master >actual &&
+		git -C ../prefetch-source rev-parse master >expect &&
+		test_cmp expect actual
+	)
+'
+
 test_expect_success "should be able to fetch with duplicate refspecs" '
 	mkdir dups &&
 	(
@@ -865,4 +890,40 @@ test_expect_success C_LOCALE_OUTPUT 'fetch compact output' '
 	test_cmp expect actual
 '
 
+test_expect_success 'atomic fetch updates all refs' '
+	git init atomic-upstream &&
+	test_commit -C atomic-upstream one &&
+	git -C atomic-upstream branch b1 &&
+	git -C atomic-upstream branch b2 &&
+	git clone atomic-upstream atomic &&
+	test_commit -C atomic-upstream two &&
+	git -C atomic-upstream branch -f b1 &&
+	git -C atomic-upstream branch -f b2 &&
+	git -C atomic fetch --atomic origin &&
+	git -C atomic-upstream rev-parse master b1 b2 >expect &&
+	git -C atomic rev-parse origin/master origin/b1 origin/b2 >actual &&
+	test_cmp expect actual &&
+	grep "branch .b2." atomic/.git/FETCH_HEAD
+'
+
+test_expect_success 'atomic fetch updates nothing if a ref is rejected' '
+	test_commit -C atomic-upstream three &&
+	git -C atomic-upstream branch -f b1 &&
+	git -C atomic-upstream branch -f b2 b1~2 &&
+	git -C atomic rev-parse origin/b1 origin/b2 >expect &&
+	cp atomic/.git/FETCH_HEAD fetch-head.expect &&
+	test_must_fail git -C atomic fetch --atomic origin \
+		"refs/heads/*:refs/remotes/origin/*" 2>err &&
+	test_i18ngrep "non-fast-forward" err &&
+	git -C atomic rev-parse origin/b1 origin/b2 >actual &&
+	test_cmp expect actual &&
+	test_cmp fetch-head.expect atomic/.git/FETCH_HEAD &&
+
+	test_must_fail git -C atomic fetch origin \
+		"refs/heads/*:refs/remotes/origin/*" &&
+	git -C atomic-upstream rev-parse b1 >expect &&
+	git -C atomic rev-parse origin/b1 >actual &&
+	test_cmp expect actual
+'
+
 test_done
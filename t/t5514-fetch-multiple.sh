@@ -181,4 +181,41 @@ test_expect_success 'git fetch --all --tags' '
 	test_cmp expect test8/output
 '
 
+test_expect_success 'parallel' '
+	git remote add one ./bogus1 &&
+	git remote add two ./bogus2 &&
+
+	test_must_fail env GIT_TRACE="$PWD/trace" \
+		git fetch --jobs=2 --multiple one two 2>err &&
+	grep "preparing to run up to 2 tasks" trace &&
+	test_i18ngrep "could not fetch .one.*128" err &&
+	test_i18ngrep "could not fetch .two.*128" err
+'
+
+test_expect_success 'parallel fetch with fetch.parallel' '
+	git clone one test9 &&
+	(
+		cd test9 &&
+		git remote add two ../two &&
+		git remote add three ../three &&
+		git -c fetch.parallel=0 fetch --all &&
+		git branch -r >output &&
+		grep three/another output &&
+		grep two/another output &&
+		grep -c "	branch .side. of" .git/FETCH_HEAD >count &&
+		echo 3 >expect &&
+		test_cmp expect count
+	)
+'
+
+test_expect_success 'fetch --all runs maintenance only once' '
+	(
+		cd test9 &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c fetch.parallel=3 fetch --all &&
+		grep "\"event\":\"child_start\".*\"maintenance\"" trace.event >runs &&
+		test_line_count = 1 runs
+	)
+'
+
 test_done
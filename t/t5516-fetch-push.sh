@@ -1632,4 +1632,27 @@ test_expect_success 'updateInstead with push-to-checkout hook' '
 	)
 '
 
+test_expect_success 'push of many refs updates the other refs when one fails' '
+	rm -rf many &&
+	git init --bare many &&
+	for i in $(test_seq 20)
+	do
+		echo "create refs/heads/many/$i HEAD" || return 1
+	done | git update-ref --stdin &&
+	test_when_finished "git for-each-ref --format=\"delete %(refname)\" refs/heads/many/ | git update-ref --stdin" &&
+	mkdir -p many/refs/heads/many &&
+	: >many/refs/heads/many/13.lock &&
+	test_must_fail git push many "refs/heads/many/*:refs/heads/many/*" &&
+	git -C many for-each-ref --format="%(refname)" refs/heads/many/ >actual &&
+	test_line_count = 19 actual &&
+	! grep "many/13$" actual &&
+	rm many/refs/heads/many/13.lock &&
+	git push many "refs/heads/many/*:refs/heads/many/*" &&
+	git -C many for-each-ref refs/heads/many/ >actual &&
+	test_line_count = 20 actual &&
+	git push many $(printf ":refs/heads/many/%s " $(test_seq 20)) &&
+	git -C many for-each-ref refs/heads/many/ >actual &&
+	test_must_be_empty actual
+'
+
 test_done
@@ -68,6 +68,28 @@ test_expect_success 'push from shallow clone, with grafted roots' '
 	git fsck
 '
 
+test_expect_success 'push many refs from shallow clone, some with grafted roots' '
+	test_when_finished "rm -rf shallow3" &&
+	git clone --no-local --depth=2 .git shallow3 &&
+	(
+	cd shallow3 &&
+	git fetch --depth=2 ../full-abc/.git master:abc &&
+	for i in $(test_seq 40)
+	do
+		git branch many$i HEAD~$(($i % 2)) || return 1
+	done &&
+	test_must_fail git push ../.git "refs/heads/many*:refs/remotes/many/*" \
+		abc:refs/remotes/many/abc 2>err &&
+	grep "many/abc.*shallow update not allowed" err
+	) &&
+	test_must_fail git rev-parse many/abc &&
+	for i in $(test_seq 40)
+	do
+		git rev-parse --verify many/$i || return 1
+	done &&
+	git fsck
+'
+
 test_expect_success 'add new shallow root with receive.updateshallow on' '
 	test_config receive.shallowupdate true &&
 	(
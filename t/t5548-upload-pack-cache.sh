@@ -0,0 +1,95 @@
+#!/bin/sh
+
+test_description='upload-pack replays cached packs to identical requests'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	test_commit -C server two &&
+	git -C server config uploadpack.packCacheMaxSize 10m
+'
+
+# Clone "server" into "clone", tracing the commands upload-pack runs.
+traced_clone () {
+	rm -rf clone trace &&
+	GIT_TRACE="$(pwd)/trace" git clone "$@" "file://$(pwd)/server" clone &&
+	git -C clone fsck &&
+	git -C server rev-parse master >expect &&
+	git -C clone rev-parse master >actual &&
+	test_cmp expect actual
+}
+
+cached_packs () {
+	find server/.git/upload-pack-cache -name "*.pack"
+}
+
+test_expect_success 'first request populates the cache' '
+	traced_clone &&
+	grep "run_command: git.* pack-objects" trace &&
+	cached_packs >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'identical request is served from the cache' '
+	traced_clone --no-progress &&
+	! grep "run_command: git.* pack-objects" trace &&
+	cached_packs >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'cache works with protocol v2' '
+	traced_clone -c protocol.version=2 &&
+	! grep "run_command: git.* pack-objects" trace
+'
+
+test_expect_success 'different request gets its own pack' '
+	traced_clone --depth=1 &&
+	grep "run_command: git.* pack-objects" trace &&
+	cached_packs >packs &&
+	test_line_count = 2 packs
+'
+
+test_expect_success 'expired packs are not used and get pruned' '
+	test-tool chmtime =-120 $(cached_packs) &&
+	traced_clone &&
+	grep "run_command: git.* pack-objects" trace &&
+	cached_packs >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'packs larger than the cache are not cached' '
+	rm -rf server/.git/upload-pack-cache &&
+	test_config -C server uploadpack.packCacheMaxSize 100 &&
+	traced_clone &&
+	cached_packs >packs &&
+	test_line_count = 0 packs
+'
+
+# Ask for master without side-band; the pack follows the NAK as is.
+raw_fetch () {
+	test-pkt-line pack >in <<-EOF &&
+	want $(git -C server rev-parse master)
+	0000
+	done
+	EOF
+	git upload-pack --stateless-rpc server <in >out &&
+	test "$(head -c 8 out)" = "0008NAK" &&
+	tail -c +9 out >raw.pack &&
+	git index-pack --strict -o raw.idx raw.pack &&
+	git show-index <raw.idx >objects &&
+	git -C server rev-list --objects master >expect &&
+	test_line_count = $(wc -l <expect) objects
+}
+
+test_expect_success 'pack without side-band, fresh and from the cache' '
+	rm -rf server/.git/upload-pack-cache &&
+	raw_fetch &&
+	test_config -C server uploadpack.packCacheMaxSize 10m &&
+	raw_fetch &&
+	cached_packs >packs &&
+	test_line_count = 1 packs &&
+	raw_fetch
+'
+
+test_done
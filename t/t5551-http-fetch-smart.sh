@@ -285,6 +285,15 @@ test_expect_success 'large fetch-pack requests can be split across POSTs' '
 	test_line_count = 2 posts
 '
 
+test_expect_success 'chunked fetch-pack requests are gzipped as they are sent' '
+	GIT_TRACE_CURL=true git -c http.postbuffer=65536 \
+		clone --bare "$HTTPD_URL/smart/repo.git" split-gzip.git 2>err &&
+	grep "^=> Send header: Transfer-Encoding: chunked" err &&
+	grep "^=> Send header: Content-Encoding: gzip" err &&
+	git -C split-gzip.git for-each-ref refs/tags >actual &&
+	test_line_count = 2000 actual
+'
+
 test_expect_success 'test allowreachablesha1inwant' '
 	test_when_finished "rm -rf test_reachable.git" &&
 	server="$HTTPD_DOCUMENT_ROOT_PATH/repo.git" &&
@@ -402,5 +411,19 @@ test_expect_success 'GIT_TRACE_CURL_NO_DATA prevents data from being traced' '
 	! grep "=> Send data" err
 '
 
+test_expect_success 'GIT_TRACE_PERFORMANCE reports the timing of each request' '
+	rm -rf clone &&
+	GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+		git clone $HTTPD_URL/smart/repo.git clone &&
+	grep "http request .*/info/refs?service=git-upload-pack (HTTP 200)" trace &&
+	grep "http request .*/git-upload-pack (HTTP 200): .*connect" trace
+'
+
+test_expect_success 'unknown http.version is ignored' '
+	rm -rf clone &&
+	git -c http.version=HTTP/0.5 clone $HTTPD_URL/smart/repo.git clone 2>err &&
+	test_i18ngrep "unsupported http version" err
+'
+
 stop_httpd
 test_done
@@ -0,0 +1,117 @@
+#!/bin/sh
+
+test_description='test clone with --bundle-uri'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	test_commit -C server two &&
+	git -C server bundle create ../base.bundle master &&
+	test_commit -C server three &&
+	git -C server bundle create ../incremental.bundle two..master &&
+	git -C server bundle create ../full.bundle master &&
+	test_commit -C server four
+'
+
+# Clone the server with the given options, and make sure that the
+# bundles brought "three" and were used as common history.
+test_bundle_clone () {
+	rm -rf clone trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git clone "$@" "file://$(pwd)/server" clone &&
+	git -C clone rev-parse refs/bundles/master >actual &&
+	git -C server rev-parse three >expect &&
+	test_cmp expect actual &&
+	git -C clone fsck &&
+	git -C clone log --format=%s master >actual &&
+	git -C server log --format=%s master >expect &&
+	test_cmp expect actual &&
+	grep "clone> have $(git -C server rev-parse three)" trace
+}
+
+test_expect_success 'clone with a single bundle' '
+	rm -rf clone &&
+	git clone --bundle-uri="$(pwd)/base.bundle" \
+		"file://$(pwd)/server" clone &&
+	git -C clone rev-parse refs/bundles/master >actual &&
+	git -C server rev-parse two >expect &&
+	test_cmp expect actual &&
+	git -C clone fsck
+'
+
+test_expect_success 'clone with a bundle list of incremental bundles' '
+	cat >list <<-\EOF &&
+	[bundle]
+		version = 1
+		mode = all
+	[bundle "incremental"]
+		uri = incremental.bundle
+	[bundle "base"]
+		uri = base.bundle
+	EOF
+	test_bundle_clone --bundle-uri="file://$(pwd)/list"
+'
+
+test_expect_success 'clone with a bundle list in mode "any"' '
+	cat >list <<-EOF &&
+	[bundle]
+		version = 1
+		mode = any
+	[bundle "missing"]
+		uri = missing.bundle
+	[bundle "full"]
+		uri = $(pwd)/full.bundle
+	[bundle "other"]
+		uri = base.bundle
+	EOF
+	test_bundle_clone --bundle-uri="$(pwd)/list" 2>err &&
+	test_i18ngrep "ignoring bundle .*missing.bundle" err
+'
+
+test_expect_success 'clone ignores a bundle lacking its prerequisites' '
+	rm -rf clone &&
+	git clone --bundle-uri="$(pwd)/incremental.bundle" \
+		"file://$(pwd)/server" clone 2>err &&
+	test_i18ngrep "lacks prerequisites" err &&
+	test_must_fail git -C clone rev-parse --verify refs/bundles/master &&
+	git -C clone fsck
+'
+
+test_expect_success 'clone ignores an unusable bundle URI' '
+	rm -rf clone &&
+	echo garbage >garbage &&
+	git clone --bundle-uri="$(pwd)/garbage" \
+		"file://$(pwd)/server" clone 2>err &&
+	test_i18ngrep "failed to fetch objects from bundle URI" err &&
+	git -C clone fsck
+'
+
+test_expect_success '--bundle-uri is incompatible with --depth' '
+	test_must_fail git clone --depth=1 --bundle-uri="$(pwd)/base.bundle" \
+		"file://$(pwd)/server" shallow 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+. "$TEST_DIRECTORY"/lib-httpd.sh
+start_httpd
+
+test_expect_success 'clone with bundles over http://' '
+	cp base.bundle incremental.bundle "$HTTPD_DOCUMENT_ROOT_PATH/" &&
+	cat >"$HTTPD_DOCUMENT_ROOT_PATH/list" <<-\EOF &&
+	[bundle]
+		version = 1
+		mode = all
+	[bundle "incremental"]
+		uri = incremental.bundle
+	[bundle "base"]
+		uri = base.bundle
+	EOF
+	test_bundle_clone --bundle-uri="$HTTPD_URL/dumb/list" &&
+	! ls clone/.git/objects/pack/tmp_bundle_*
+'
+
+stop_httpd
+
+test_done
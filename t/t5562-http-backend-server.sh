@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='git http-backend as a standalone HTTP server'
+. ./test-lib.sh
+
+if test -n "$NO_CURL"
+then
+	skip_all='skipping test, git built without http support'
+	test_done
+fi
+
+if test_have_prereq !PIPE
+then
+	skip_all='file system does not support FIFOs'
+	test_done
+fi
+
+LIB_HTTP_BACKEND_PORT=${LIB_HTTP_BACKEND_PORT-${this_test#t}}
+SERVER_URL=http://127.0.0.1:$LIB_HTTP_BACKEND_PORT
+SERVER_PID=
+
+start_server () {
+	trap 'code=$?; stop_server; (exit $code); die' EXIT
+
+	mkfifo server_output
+	GIT_PROJECT_ROOT="$TRASH_DIRECTORY/root" GIT_HTTP_EXPORT_ALL=1 \
+	git http-backend --listen=127.0.0.1 \
+		--port="$LIB_HTTP_BACKEND_PORT" "$@" 2>server_output &
+	SERVER_PID=$!
+	>server.log
+	{
+		read -r line <&7
+		printf "%s\n" "$line"
+		cat <&7 &
+	} 7<server_output >>server.log &&
+
+	if test x"$(expr "$line" : "\[[0-9]*\] \(.*\)")" != \
+		x"Listening on port $LIB_HTTP_BACKEND_PORT"
+	then
+		kill "$SERVER_PID"
+		wait "$SERVER_PID"
+		trap 'die' EXIT
+		skip_all='git http-backend failed to start'
+		test_done
+	fi
+}
+
+stop_server () {
+	test -z "$SERVER_PID" && return
+	trap 'die' EXIT
+	kill "$SERVER_PID"
+	wait "$SERVER_PID"
+	SERVER_PID=
+	rm -f server_output
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	mkdir root &&
+	git clone --bare . root/repo.git &&
+	git -C root/repo.git config http.receivepack true
+'
+
+start_server
+
+test_expect_success 'clone' '
+	git clone $SERVER_URL/repo.git clone &&
+	git -C clone log --format=%s >actual &&
+	git log --format=%s >expect &&
+	test_cmp expect actual &&
+	grep "\"GET /repo.git/info/refs?service=git-upload-pack HTTP/1.1\" 200 [0-9]* [0-9.]*ms$" server.log &&
+	grep "\"POST /repo.git/git-upload-pack HTTP/1.1\" 200" server.log
+'
+
+test_expect_success 'requests of one client share a connection' '
+	sed -n "s/^\[\([0-9]*\)\] .*git-upload-pack.*/\1/p" server.log >pids &&
+	test_line_count = 2 pids &&
+	sort -u pids >unique &&
+	test_line_count = 1 unique
+'
+
+test_expect_success 'fetch with protocol v2' '
+	test_commit three &&
+	git push root/repo.git master &&
+	git -C clone -c protocol.version=2 pull --ff-only &&
+	git rev-parse master >expect &&
+	git -C clone rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'push with a chunked request body' '
+	(
+		cd clone &&
+		test-tool genrandom push 100000 >big &&
+		git add big &&
+		git commit -m big &&
+		git -c http.postBuffer=1024 push origin HEAD:master
+	) &&
+	git -C clone rev-parse HEAD >expect &&
+	git -C root/repo.git rev-parse master >actual &&
+	test_cmp expect actual &&
+	grep "\"POST /repo.git/git-receive-pack HTTP/1.1\" 200" server.log
+'
+
+test_expect_success 'dumb clone' '
+	GIT_SMART_HTTP=0 git clone $SERVER_URL/repo.git dumb &&
+	git -C dumb rev-parse HEAD >actual &&
+	git -C root/repo.git rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'missing repository' '
+	test_must_fail git ls-remote $SERVER_URL/nope.git &&
+	grep "\"GET /nope.git/info/refs?service=git-upload-pack HTTP/1.1\" 404" server.log
+'
+
+stop_server
+test_done
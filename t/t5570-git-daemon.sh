@@ -211,5 +211,24 @@ test_expect_success FAKENC 'hostname interpolation works after LF-stripping' '
 	test_cmp expect actual
 '
 
+stop_git_daemon
+start_git_daemon --export-all --prefork=2
+
+test_expect_success 'clone and fetch through pre-forked workers' '
+	rm -rf prefork &&
+	git clone "$GIT_DAEMON_URL/repo.git" prefork &&
+	test_cmp file prefork/file &&
+	for i in 1 2 3
+	do
+		git -C prefork fetch || return 1
+	done &&
+	grep "Connection from 127.0.0.1" daemon.log >connections &&
+	test_line_count = 4 connections
+'
+
+test_expect_success 'pre-forked workers still refuse what they should' '
+	test_must_fail git ls-remote "$GIT_DAEMON_URL/nowhere.git"
+'
+
 stop_git_daemon
 test_done
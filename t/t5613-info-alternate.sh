@@ -136,4 +136,18 @@ test_expect_success CASE_INSENSITIVE_FS 'dup finding can be case-insensitive' '
 	test_cmp expect actual.alternates
 '
 
+test_expect_success 'missing objects are ruled out by a filter of all objects' '
+	git clone A both &&
+	test_commit -C both new &&
+	git -C both pack-objects --revs --all --stdout </dev/null >both.pack &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C C index-pack --stdin \
+		<both.pack >out &&
+	! grep build_object_filter trace &&
+	rm -f trace C/.git/objects/pack/pack-$(cut -f2 out).* &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C C \
+		-c core.looseObjectCache=true index-pack --stdin <both.pack &&
+	grep build_object_filter trace &&
+	git -C C cat-file -e $(git -C both rev-parse new)
+'
+
 test_done
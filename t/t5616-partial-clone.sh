@@ -170,6 +170,75 @@ test_expect_success 'partial clone fetches blobs pointed to by refs even if norm
 	git -C dst fsck
 '
 
+test_expect_success 'setup src repo for diffs in partial clone' '
+	rm -rf src &&
+	git init src &&
+	for i in 1 2 3
+	do
+		test_seq 100 | sed "s/^/line $i /" >src/file.$i || return 1
+	done &&
+	git -C src add . &&
+	git -C src commit -m files &&
+	for i in 1 2 3
+	do
+		echo more >>src/file.$i &&
+		git -C src mv file.$i renamed.$i || return 1
+	done &&
+	git -C src commit -a -m "rename and modify" &&
+	git -C src config uploadpack.allowfilter 1 &&
+	git -C src config uploadpack.allowanysha1inwant 1
+'
+
+# Count the lazy fetches made by the command given after the repository.
+count_lazy_fetches () {
+	rm -rf dst &&
+	>trace &&
+	git clone --bare --filter=blob:none "file://$(pwd)/src" dst &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C dst "$@" >out &&
+	{ grep "> done" trace >fetches || >fetches; }
+}
+
+test_expect_success 'diff fetches missing blobs in a single batch' '
+	count_lazy_fetches log -p &&
+	grep "^+more" out &&
+	test_line_count = 1 fetches
+'
+
+test_expect_success 'rename detection fetches missing blobs in a single batch' '
+	count_lazy_fetches log -M --name-status &&
+	grep "^R" out &&
+	test_line_count = 1 fetches
+'
+
+test_expect_success 'diff without contents does not fetch blobs' '
+	count_lazy_fetches log --no-renames --name-status &&
+	test_line_count = 0 fetches
+'
+
+test_expect_success 'checkout fetches missing blobs in a single batch' '
+	rm -rf dst &&
+	>trace &&
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/src" dst &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C dst checkout --progress \
+		master 2>err &&
+	grep "> done" trace >fetches &&
+	test_line_count = 1 fetches &&
+	test_i18ngrep "Receiving objects" err &&
+	test_cmp src/renamed.1 dst/renamed.1
+'
+
+test_expect_success 'checkout of paths fetches missing blobs in a single batch' '
+	rm -rf dst &&
+	>trace &&
+	git clone --no-checkout --filter=blob:none "file://$(pwd)/src" dst &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C dst checkout --no-progress \
+		HEAD -- . 2>err &&
+	grep "> done" trace >fetches &&
+	test_line_count = 1 fetches &&
+	test_i18ngrep ! "Receiving objects" err &&
+	test_cmp src/renamed.3 dst/renamed.3
+'
+
 . "$TEST_DIRECTORY"/lib-httpd.sh
 start_httpd
 
@@ -11,6 +11,7 @@ test_expect_success 'test capability advertisement' '
 	ls-refs
 	fetch=shallow
 	server-option
+	object-info
 	0000
 	EOF
 
@@ -132,6 +133,31 @@ test_expect_success 'refs/heads prefix' '
 	test_cmp actual expect
 '
 
+test_expect_success 'overlapping and partial ref-prefixes' '
+	test-pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	0001
+	ref-prefix refs/tags/
+	ref-prefix refs/heads/re
+	ref-prefix refs/tags/one
+	ref-prefix refs/heads/d
+	0000
+	EOF
+
+	cat >expect <<-EOF &&
+	$(git rev-parse refs/heads/dev) refs/heads/dev
+	$(git rev-parse refs/heads/release) refs/heads/release
+	$(git rev-parse refs/tags/annotated-tag) refs/tags/annotated-tag
+	$(git rev-parse refs/tags/one) refs/tags/one
+	$(git rev-parse refs/tags/two) refs/tags/two
+	0000
+	EOF
+
+	git serve --stateless-rpc <in >out &&
+	test-pkt-line unpack <out >actual &&
+	test_cmp actual expect
+'
+
 test_expect_success 'peel parameter' '
 	test-pkt-line pack >in <<-EOF &&
 	command=ls-refs
@@ -194,6 +220,65 @@ test_expect_success 'sending server-options' '
 	test_cmp actual expect
 '
 
+test_expect_success 'object-info' '
+	missing=$(echo missing | git hash-object --stdin) &&
+	test-pkt-line pack >in <<-EOF &&
+	command=object-info
+	0001
+	size
+	type
+	oid $(git rev-parse two:two.t)
+	oid $(git rev-parse two)
+	oid $missing
+	0000
+	EOF
+
+	{
+		echo "size type" &&
+		echo "$(git rev-parse two:two.t) $(git cat-file -s two:two.t) blob" &&
+		echo "$(git rev-parse two) $(git cat-file -s two) commit" &&
+		echo "$missing  " &&
+		echo 0000
+	} >expect &&
+
+	git serve --stateless-rpc <in >out &&
+	test-pkt-line unpack <out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'object-info with size only' '
+	test-pkt-line pack >in <<-EOF &&
+	command=object-info
+	0001
+	size
+	oid $(git rev-parse refs/tags/annotated-tag)
+	0000
+	EOF
+
+	cat >expect <<-EOF &&
+	size
+	$(git rev-parse refs/tags/annotated-tag) $(git cat-file -s refs/tags/annotated-tag)
+	0000
+	EOF
+
+	git serve --stateless-rpc <in >out &&
+	test-pkt-line unpack <out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'object-info rejects unknown arguments' '
+	test-pkt-line pack >in <<-EOF &&
+	command=object-info
+	0001
+	size
+	oid not-an-oid
+	0000
+	EOF
+
+	test_must_fail git serve --stateless-rpc <in >/dev/null 2>err &&
+	grep "expected object id" err
+'
+
 test_expect_success 'unexpected lines are not allowed in fetch request' '
 	git init server &&
 
@@ -208,4 +293,131 @@ test_expect_success 'unexpected lines are not allowed in fetch request' '
 	grep "unexpected line: .this-is-not-a-command." err
 '
 
+# Check that a request gives the same answer with and without the
+# cache, and whether it was answered from the cache.
+test_ls_refs_cache () {
+	rm -f trace.event &&
+	git -c uploadpack.lsRefsCache=false serve --stateless-rpc <in >expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git serve --stateless-rpc <in >out &&
+	test_cmp expect out &&
+	if test "$1" = hit
+	then
+		grep "\"key\":\"cache_hit\"" trace.event
+	else
+		! grep "\"key\":\"cache_hit\"" trace.event
+	fi
+}
+
+test_expect_success 'ls-refs with more refs than one batch of packets' '
+	test_seq 2000 |
+	sed "s,.*,create refs/heads/many/branch-with-a-long-name-&-xxxxxxxxxxxxxxxxxxxx HEAD," |
+	git update-ref --stdin &&
+	test-pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	0001
+	ref-prefix refs/heads/many/
+	0000
+	EOF
+
+	git for-each-ref --format="%(objectname) %(refname)" \
+		refs/heads/many/ >expect &&
+	echo 0000 >>expect &&
+	git serve --stateless-rpc <in >out &&
+	test-pkt-line unpack <out >actual &&
+	test_cmp expect actual &&
+
+	git upload-pack --advertise-refs . >out &&
+	test-pkt-line unpack <out >actual &&
+	grep -c refs/heads/many/ actual >count &&
+	echo 2000 >expect &&
+	test_cmp expect count &&
+	tail -n 1 actual >last &&
+	echo 0000 >expect &&
+	test_cmp expect last &&
+
+	git for-each-ref --format="delete %(refname)" refs/heads/many/ |
+	git update-ref --stdin
+'
+
+test_expect_success 'ls-refs answers from its cache' '
+	git config uploadpack.lsRefsCache true &&
+	test-pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	0001
+	peel
+	symrefs
+	0000
+	EOF
+	test_ls_refs_cache miss &&
+	test_path_is_file .git/refs-generation &&
+	test_ls_refs_cache hit &&
+
+	test-pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	0001
+	ref-prefix HEAD
+	ref-prefix refs/heads/
+	ref-prefix refs/tags/one
+	0000
+	EOF
+	test_ls_refs_cache hit
+'
+
+test_expect_success 'ls-refs cache follows updates of the refs' '
+	test-pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	0001
+	peel
+	symrefs
+	0000
+	EOF
+	test_ls_refs_cache hit &&
+	for update in "branch new one" "branch -m new renamed" \
+		"symbolic-ref refs/heads/release refs/heads/dev" \
+		"tag -d one" "tag -a -m new new-tag two" \
+		"update-ref -d refs/heads/renamed" "checkout --detach two"
+	do
+		git $update &&
+		test_ls_refs_cache miss &&
+		test_ls_refs_cache hit || return 1
+	done
+'
+
+test_expect_success 'ls-refs cache keeps the peeled values of symrefs' '
+	git symbolic-ref refs/heads/to-tag refs/tags/new-tag &&
+	test-pkt-line pack >in <<-EOF &&
+	command=ls-refs
+	0001
+	peel
+	symrefs
+	ref-prefix refs/heads/to-tag
+	0000
+	EOF
+	test_ls_refs_cache miss &&
+	test_ls_refs_cache hit &&
+	test-pkt-line unpack <out >actual &&
+	grep "symref-target:refs/tags/new-tag peeled:$(git rev-parse two)" actual
+'
+
+test_expect_success 'ls-refs cache follows updates of reftable refs' '
+	git init --ref-storage=reftable reftable &&
+	(
+		cd reftable &&
+		test_commit one &&
+		git config uploadpack.lsRefsCache true &&
+		test-pkt-line pack >in <<-EOF &&
+		command=ls-refs
+		0001
+		symrefs
+		0000
+		EOF
+		test_ls_refs_cache miss &&
+		test_ls_refs_cache hit &&
+		git branch new &&
+		test_ls_refs_cache miss &&
+		test_ls_refs_cache hit
+	)
+'
+
 test_done
@@ -359,6 +359,65 @@ test_expect_success 'default refspec is used to filter ref when fetchcing' '
 	grep "ref-prefix refs/tags/" log
 '
 
+test_expect_success 'setup packfile-uris tests' '
+	rm -rf uri_parent &&
+	git init uri_parent &&
+	test_commit -C uri_parent one &&
+	git -C uri_parent repack -ad &&
+	uri_pack=$(ls uri_parent/.git/objects/pack/pack-*.pack) &&
+	uri_hash=$(basename "$uri_pack" .pack | sed "s/^pack-//") &&
+	test_commit -C uri_parent two
+'
+
+test_expect_success 'packfile-uris is only advertised if configured' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		ls-remote "file://$(pwd)/uri_parent" &&
+	grep "fetch=" trace >fetch_capabilities &&
+	! grep packfile-uris fetch_capabilities &&
+
+	git -C uri_parent config uploadpack.packfileuri \
+		"$uri_hash https://example.com/one.pack" &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		ls-remote "file://$(pwd)/uri_parent" &&
+	grep "fetch=.*packfile-uris" trace
+'
+
+test_expect_success 'pack-objects writes used packfile URIs before the pack' '
+	git -C uri_parent rev-parse one >revs &&
+	git -C uri_parent pack-objects --revs --stdout \
+		--uri-protocol=https <revs >out &&
+	echo "$uri_hash https://example.com/one.pack" >expect &&
+	head -n 1 out >actual &&
+	test_cmp expect actual &&
+	sed 1d out >uri.pack &&
+	git -C uri_parent index-pack -o ../uri.idx ../uri.pack &&
+	git show-index <uri.idx >objects &&
+	test_line_count = 0 objects &&
+
+	git -C uri_parent pack-objects --revs --stdout \
+		--uri-protocol=http <revs >out &&
+	head -c 4 out >actual &&
+	printf PACK >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'server sends packfile-uris section if requested' '
+	test-pkt-line pack >in <<-EOF &&
+	command=fetch
+	0001
+	packfile-uris https
+	want $(git -C uri_parent rev-parse two)
+	done
+	0000
+	EOF
+
+	git -C uri_parent serve --stateless-rpc <in >out &&
+	grep -a "packfile-uris" out &&
+	grep -a "$uri_hash https://example.com/one.pack" out
+'
+
 # Test protocol v2 with 'http://' transport
 #
 . "$TEST_DIRECTORY"/lib-httpd.sh
@@ -425,6 +484,39 @@ test_expect_success 'push with http:// and a config of v2 does not request v2' '
 	! grep "git< version 2" log
 '
 
+test_expect_success 'clone with packfile URIs over http://' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_uri_parent" &&
+	git init "$P" &&
+	test_commit -C "$P" one &&
+	git -C "$P" repack -ad &&
+	pack=$(ls "$P"/.git/objects/pack/pack-*.pack) &&
+	hash=$(basename "$pack" .pack | sed "s/^pack-//") &&
+	cp "$pack" "$HTTPD_DOCUMENT_ROOT_PATH/one.pack" &&
+	test_commit -C "$P" two &&
+	git -C "$P" config uploadpack.packfileuri \
+		"$hash $HTTPD_URL/dumb/one.pack" &&
+
+	GIT_TRACE_PACKET="$(pwd)/log" git -c protocol.version=2 \
+		-c fetch.uriprotocols=http,https \
+		clone "$HTTPD_URL/smart/http_uri_parent" http_uri_child &&
+
+	grep "< packfile-uris" log &&
+	test_path_is_file http_uri_child/.git/objects/pack/pack-$hash.pack &&
+	git -C http_uri_child fsck &&
+	git -C http_uri_child log --format=%s >actual &&
+	printf "two\none\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone fails if a packfile URI cannot be downloaded' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_uri_parent" &&
+	hash=$(git -C "$P" config uploadpack.packfileuri | cut -d" " -f1) &&
+	git -C "$P" config uploadpack.packfileuri \
+		"$hash $HTTPD_URL/dumb/missing.pack" &&
+	test_must_fail git -c protocol.version=2 \
+		-c fetch.uriprotocols=http \
+		clone "$HTTPD_URL/smart/http_uri_parent" http_uri_broken
+'
 
 stop_httpd
 
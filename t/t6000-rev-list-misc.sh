@@ -114,4 +114,35 @@ test_expect_success '--header shows a NUL after each commit' '
 	test_cmp expect actual
 '
 
+test_expect_success 'core.compactObjectWalk lists the same objects' '
+	git init compact &&
+	(
+		cd compact &&
+		test_commit one &&
+		test_commit two &&
+		git repack -ad &&
+		test_commit three &&
+		echo one >same-as-one &&
+		git add same-as-one &&
+		git commit -m four &&
+		git rev-list --objects --all >expect &&
+		git -c core.compactObjectWalk rev-list --objects --all >actual &&
+		test_cmp expect actual &&
+		git rev-list --objects one..HEAD >expect &&
+		git -c core.compactObjectWalk rev-list --objects one..HEAD >actual &&
+		test_cmp expect actual &&
+		git rev-list --objects HEAD:one.t HEAD >expect &&
+		git -c core.compactObjectWalk rev-list --objects HEAD:one.t HEAD >actual &&
+		test_cmp expect actual &&
+		git -c core.compactObjectWalk pack-objects --revs --stdout \
+			>compact.pack <<-\EOF &&
+		HEAD
+		EOF
+		git index-pack compact.pack &&
+		git rev-list --objects HEAD | cut -d" " -f1 | sort >expect &&
+		git show-index <compact.idx | cut -d" " -f2 | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -897,4 +897,35 @@ test_expect_success 'do not follow renames for empty files' '
 	test_cmp expect empty2
 '
 
+test_expect_success 'only renames of files changed on the other side are detected' '
+	git reset --hard &&
+	git checkout --orphan relevant-base &&
+	git rm -rf . &&
+	git clean -fdqx &&
+	for i in 1 2 3 4
+	do
+		test_seq $i 20 >file$i || return 1
+	done &&
+	git add . &&
+	git commit -m base &&
+	git checkout -b relevant-move &&
+	mkdir moved &&
+	for i in 1 2 3 4
+	do
+		git mv file$i moved/ || return 1
+	done &&
+	echo more >>moved/file1 &&
+	echo more >>moved/file2 &&
+	git commit -a -m move &&
+	git checkout -b relevant-change relevant-base &&
+	test_write_lines change $(test_seq 1 20) >file1 &&
+	git commit -a -m change &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git merge relevant-move &&
+	test_path_is_missing file1 &&
+	test_write_lines change $(test_seq 1 20) more >expect &&
+	test_cmp expect moved/file1 &&
+	grep "\"name\":\"renames/irrelevant-sources\",\"value\":3}" trace &&
+	grep "\"key\":\"rename/basename\",\"value\":1}" trace
+'
+
 test_done
@@ -0,0 +1,98 @@
+#!/bin/sh
+
+test_description='rev-list combining bitmaps and filters'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit base &&
+	for i in 1 2 3 4 5
+	do
+		test-tool genrandom big $((i * 1000)) >big &&
+		echo "small $i" >small &&
+		git add big small &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git tag -a -m "annotated" annotated &&
+	git repack -adb &&
+	echo loose >loose &&
+	test-tool genrandom loose-big 5000 >loose-big &&
+	git add loose loose-big &&
+	git commit -q -m "not in the pack"
+'
+
+# Compare the output of rev-list with and without bitmaps. Paths are not
+# shown by a bitmap walk, so only compare the object names.
+test_bitmap_filter () {
+	git rev-list "$@" >expect.raw &&
+	cut -d" " -f1 <expect.raw | sort >expect &&
+	git rev-list --use-bitmap-index "$@" >actual.raw &&
+	sort actual.raw >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'blob:none filter' '
+	test_bitmap_filter --objects --filter=blob:none HEAD &&
+	test_bitmap_filter --objects --filter=blob:none --all &&
+	test_bitmap_filter --objects --filter=blob:none HEAD~2..HEAD
+'
+
+test_expect_success 'blob:none filter keeps explicitly asked for blobs' '
+	test_bitmap_filter --objects --filter=blob:none HEAD HEAD~1:big HEAD:loose &&
+	git rev-list --use-bitmap-index --objects --filter=blob:none \
+		HEAD~1:big >actual &&
+	git rev-parse HEAD~1:big >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blob:limit filter' '
+	test_bitmap_filter --objects --filter=blob:limit=0 HEAD &&
+	test_bitmap_filter --objects --filter=blob:limit=10 HEAD &&
+	test_bitmap_filter --objects --filter=blob:limit=3000 --all &&
+	test_bitmap_filter --objects --filter=blob:limit=3001 --all &&
+	test_bitmap_filter --objects --filter=blob:limit=1m HEAD~3..HEAD
+'
+
+test_expect_success 'sparse filter falls back to a regular walk' '
+	echo "/small" >sparse &&
+	git rev-list --use-bitmap-index --objects \
+		--filter=sparse:path=sparse HEAD >actual &&
+	git rev-list --objects --filter=sparse:path=sparse HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'filter with --filter-print-omitted' '
+	git rev-list --objects --filter=blob:none \
+		--filter-print-omitted HEAD >expect &&
+	git rev-list --use-bitmap-index --objects --filter=blob:none \
+		--filter-print-omitted HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'count objects' '
+	for args in "HEAD" "--objects HEAD" "--objects --all" \
+		"--objects HEAD~2..HEAD" "--objects --filter=blob:none --all" \
+		"--objects --filter=blob:limit=3000 HEAD" \
+		"--objects HEAD~2..HEAD --filter=blob:limit=0" \
+		"-n 3 HEAD"
+	do
+		git rev-list --count $args >expect &&
+		git rev-list --use-bitmap-index --count $args >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	git rev-list --objects HEAD >objects &&
+	git rev-list --count --objects HEAD >actual &&
+	test_line_count = $(cat actual) objects
+'
+
+test_expect_success 'pack-objects with a filter' '
+	git rev-list --objects --filter=blob:limit=3000 --all >expect.raw &&
+	cut -d" " -f1 <expect.raw | sort >expect &&
+	git pack-objects --revs --all --stdout --filter=blob:limit=3000 \
+		</dev/null >filtered.pack &&
+	git index-pack -o filtered.idx filtered.pack &&
+	git show-index <filtered.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -344,7 +344,7 @@ test_expect_success 'describe tag object' '
 	test_i18ngrep "fatal: test-blob-1 is neither a commit nor blob" actual
 '
 
-test_expect_failure ULIMIT_STACK_SIZE 'name-rev works in a deep repo' '
+test_expect_success ULIMIT_STACK_SIZE 'name-rev works in a deep repo' '
 	i=1 &&
 	while test $i -lt 8000
 	do
@@ -386,4 +386,30 @@ test_expect_success 'describe complains about missing object' '
 	test_must_fail git describe $ZERO_OID
 '
 
+test_expect_success 'name-rev uses generation numbers despite clock skew' '
+	git checkout -b skew master &&
+	echo skew >skew-file &&
+	git add skew-file &&
+	GIT_COMMITTER_DATE="@1200000000 +0000" git commit -m skew-target &&
+	target=$(git rev-parse HEAD) &&
+	GIT_COMMITTER_DATE="@1100000000 +0000" \
+		git commit --allow-empty -m skewed &&
+	GIT_COMMITTER_DATE="@1300000000 +0000" \
+		git commit --allow-empty -m skew-tip &&
+	git tag skew-tag &&
+	git show-ref -s | git commit-graph write --stdin-commits &&
+	test_config core.commitGraph true &&
+	echo "$target tags/skew-tag~2" >expect &&
+	git name-rev $target >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'describe stops walking below the tags it found' '
+	git tag -a -m skew skew-annotated skew~1 &&
+	git describe --debug skew >actual 2>err &&
+	echo "skew-annotated-1-g$(git rev-parse --short skew)" >expect &&
+	test_cmp expect actual &&
+	test_i18ngrep "traversed 2 commits" err
+'
+
 test_done
@@ -0,0 +1,98 @@
+#!/bin/sh
+
+test_description='many pathspecs, looked up rather than tried in turn
+
+With 16 pathspecs or more, the index and tree matchers look up the
+ones a path may match instead of trying each; check that they match
+the same paths as when fewer are given at a time.'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for d in a a/b a/b/c a-b b c.d sub
+	do
+		mkdir -p $d &&
+		for f in one one.c two.c three four-five five "six/seven"
+		do
+			mkdir -p "$(dirname "$d/$f")" &&
+			echo "$d/$f" >"$d/$f" || return 1
+		done || return 1
+	done &&
+	echo top >top &&
+	echo top >top.c &&
+	git add . &&
+	git commit -q -m one &&
+	git ls-files >all &&
+	sed -e "s/\$/ changed/" <all >list &&
+	while read f
+	do
+		echo changed >>"$f" || return 1
+	done <all &&
+	git commit -q -a -m two
+'
+
+# Split the pathspecs in half: each half is tried in turn, and their
+# matches together must be those of the whole.
+test_many () {
+	test $# -ge 16 &&
+	printf "%s\n" "$@" | sed -n "1,8p" >first &&
+	printf "%s\n" "$@" | sed -n "9,\$p" >second &&
+	for cmd in "ls-files" "diff --name-only HEAD^ HEAD" \
+		   "ls-tree -r --name-only HEAD" "log --format= --name-only"
+	do
+		(set -f && git $cmd -- $(cat first)) >halves &&
+		(set -f && git $cmd -- $(cat second)) >>halves &&
+		sort -u halves >expect &&
+		git $cmd -- "$@" >actual &&
+		sort -u actual >actual.sorted &&
+		test_cmp expect actual.sorted || return 1
+	done
+}
+
+test_expect_success 'literal files and directories' '
+	test_many top a/one a/b a-b/two.c sub/six b/six/seven \
+		  c.d/ a/b/c/four-five nothing a/b/c/nothing \
+		  a/two.c b/three a/ sub/one.c a/b/five top.c
+'
+
+test_expect_success 'with wildcards' '
+	test_many "*.c" "a/b/*.c" "sub/s*" "a-b/[ot]*" top "*/five" \
+		  nothing "c.d/?ne" a/b "x*" "a/b/c/*" b/one sub \
+		  "six" "*seven" a/b/c/one
+'
+
+test_expect_success 'from a subdirectory' '
+	(
+		cd a &&
+		test_many one b/c ../top ../sub/two.c b/three "*.c" \
+			  ../a-b b/c/six ../b/one two.c nothing ../c.d/one \
+			  b/c/four-five five three ../b/six/seven
+	)
+'
+
+test_expect_success 'with exclusions' '
+	git ls-files -- a sub ":(exclude)*.c" ":(exclude)a/b" >expect &&
+	git ls-files -- a sub ":(exclude)*.c" ":(exclude)a/b" \
+			nothing1 nothing2 nothing3 nothing4 nothing5 \
+			nothing6 nothing7 nothing8 nothing9 nothing10 \
+			nothing11 nothing12 >actual &&
+	test_cmp expect actual &&
+	git diff --name-only HEAD^ -- a sub ":(exclude)*.c" ":(exclude)a/b" >expect &&
+	git diff --name-only HEAD^ -- a sub ":(exclude)*.c" ":(exclude)a/b" \
+			nothing1 nothing2 nothing3 nothing4 nothing5 \
+			nothing6 nothing7 nothing8 nothing9 nothing10 \
+			nothing11 nothing12 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pathspecs matching nothing are reported' '
+	test_must_fail git ls-files --error-unmatch -- \
+		top a/one a/b a-b/two.c sub/six b/six/seven c.d/ \
+		a/b/c/four-five a/b/c/nothing a/two.c b/three a/ \
+		sub/one.c a/b/five top.c "*.h" 2>err &&
+	test_i18ngrep "a/b/c/nothing" err &&
+	test_i18ngrep "\\*.h" err &&
+	test_i18ngrep ! "a/b/five" err
+'
+
+test_done
@@ -126,6 +126,24 @@ EOF
 	test_cmp ../trace.expect ../trace
 '
 
+test_expect_success 'clean -n and ls-files -o use the cache, too' '
+	GIT_DISABLE_UNTRACKED_CACHE=1 git clean -n >../clean.expect &&
+	: >../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git clean -n >../actual &&
+	test_cmp ../clean.expect ../actual &&
+	test_cmp ../trace.expect ../trace &&
+
+	GIT_DISABLE_UNTRACKED_CACHE=1 git ls-files -o --directory \
+		--no-empty-directory --exclude-standard >../ls-files.expect &&
+	: >../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git ls-files -o --directory --no-empty-directory \
+		--exclude-standard >../actual &&
+	test_cmp ../ls-files.expect ../actual &&
+	test_cmp ../trace.expect ../trace
+'
+
 test_expect_success 'untracked cache after second status' '
 	test-dump-untracked-cache >../actual &&
 	test_cmp ../dump.expect ../actual
@@ -652,4 +652,38 @@ test_expect_success 'make unstaged changes in existing submodule (.M S.M.)' '
 	)
 '
 
+test_expect_success 'index and worktree changes are printed in path order' '
+	git init interleave &&
+	(	cd interleave &&
+		for f in a b c d e
+		do
+			echo $f >$f || return 1
+		done &&
+		git add . &&
+		git commit -m base &&
+		echo B >b &&
+		echo D >d &&
+		echo bb >bb &&
+		git add b bb d &&
+		echo A >a &&
+		echo C >c &&
+		echo DD >d &&
+		rm e &&
+
+		cat >expect <<-EOF &&
+		1 .M N... 100644 100644 100644 $(git rev-parse HEAD:a) $(git rev-parse :a) a
+		1 M. N... 100644 100644 100644 $(git rev-parse HEAD:b) $(git rev-parse :b) b
+		1 A. N... 000000 100644 100644 $ZERO_OID $(git rev-parse :bb) bb
+		1 .M N... 100644 100644 100644 $(git rev-parse HEAD:c) $(git rev-parse :c) c
+		1 MM N... 100644 100644 100644 $(git rev-parse HEAD:d) $(git rev-parse :d) d
+		1 .D N... 100644 100644 000000 $(git rev-parse HEAD:e) $(git rev-parse :e) e
+		? actual
+		? expect
+		EOF
+
+		git status --porcelain=v2 >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
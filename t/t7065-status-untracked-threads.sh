@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='look for untracked files on multiple threads'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_UNTRACKED_THREADS
+
+test_expect_success 'setup' '
+	git init worktree &&
+	(
+		cd worktree &&
+		mkdir -p one/sub two three/deep/deeper four/empty-parent &&
+		for d in one one/sub two three three/deep/deeper
+		do
+			echo tracked >$d/tracked || return 1
+		done &&
+		echo "*.o" >.gitignore &&
+		echo "!keep.o" >one/.gitignore &&
+		echo "deeper/" >three/.gitignore &&
+		git add . &&
+		git commit -q -m initial &&
+
+		for d in . one one/sub two three/deep three/deep/deeper
+		do
+			echo untracked >$d/untracked &&
+			echo object >$d/file.o &&
+			echo object >$d/keep.o || return 1
+		done &&
+		mkdir -p two/new/dir four/empty-parent/empty five &&
+		echo untracked >two/new/dir/file &&
+		echo object >five/only.o &&
+		git init -q one/nested &&
+		test_commit -C one/nested nested
+	) &&
+	mkdir out
+'
+
+# Run the command in "worktree" on a single and on four threads and
+# compare the results.
+test_threads_match () {
+	(
+		cd worktree &&
+		git -c core.untrackedThreads=1 "$@" >../out/serial &&
+		git -c core.untrackedThreads=4 "$@" >../out/threaded
+	) &&
+	test_cmp out/serial out/threaded
+}
+
+test_expect_success 'status' '
+	test_threads_match status --porcelain &&
+	test_threads_match status --porcelain -uall &&
+	test_threads_match status --porcelain --ignored &&
+	test_threads_match status --porcelain --ignored=matching -uall &&
+	test_threads_match status --porcelain --ignored=no -- one three
+'
+
+test_expect_success 'ls-files and clean' '
+	test_threads_match ls-files -o &&
+	test_threads_match ls-files -o --directory &&
+	test_threads_match ls-files -o --directory --no-empty-directory &&
+	test_threads_match ls-files -o -i --exclude-standard &&
+	test_threads_match clean -n -d &&
+	test_threads_match clean -n -d -x
+'
+
+test_expect_success 'threads find what a single thread finds' '
+	(
+		cd worktree &&
+		git -c core.untrackedThreads=true status --porcelain -uall
+	) >out/actual &&
+	test_i18ngrep "^?? two/new/dir/file$" out/actual &&
+	test_i18ngrep "^?? one/keep.o$" out/actual &&
+	! grep "three/deep/deeper" out/actual
+'
+
+test_lazy_prereq UNTRACKED_CACHE '
+	{ git update-index --test-untracked-cache; ret=$?; } &&
+	test $ret -ne 1
+'
+
+test_expect_success UNTRACKED_CACHE 'untracked cache is filled the same way' '
+	for threads in 1 4
+	do
+		(
+			cd worktree &&
+			git update-index --no-untracked-cache &&
+			git update-index --untracked-cache &&
+			sleep 1 &&
+			for run in first second
+			do
+				: >../out/trace &&
+				GIT_FORCE_UNTRACKED_CACHE=true \
+				GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/out/trace" \
+				git -c core.untrackedThreads=$threads \
+					status --porcelain >../out/status-$threads &&
+				mv ../out/trace ../out/trace-$threads-$run || return 1
+			done &&
+			test-dump-untracked-cache >../out/dump-$threads
+		) || return 1
+	done &&
+	test_cmp out/status-1 out/status-4 &&
+	test_cmp out/trace-1-first out/trace-4-first &&
+	test_cmp out/trace-1-second out/trace-4-second &&
+	test_cmp out/dump-1 out/dump-4
+'
+
+test_done
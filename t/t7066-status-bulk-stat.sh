@@ -0,0 +1,71 @@
+#!/bin/sh
+
+test_description='refresh the index by stat-ing relative to directories'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p a/b/c a/d e f &&
+	for p in top a/one a/b/two a/b/c/three a/b/c/four a/d/five e/six f/seven
+	do
+		echo "$p" >$p || return 1
+	done &&
+	test_ln_s_add a/b/c/three link &&
+	git add . &&
+	git commit -q -m initial &&
+	git config core.preloadIndex true &&
+	cat >.git/info/exclude <<-\EOF
+	*.status
+	*.diff
+	actual
+	EOF
+'
+
+# Compare what status and diff-files see with and without core.bulkStat.
+test_bulk_stat_matches () {
+	git -c core.bulkStat=false status --porcelain >expect.status &&
+	git -c core.bulkStat=true status --porcelain >actual.status &&
+	test_cmp expect.status actual.status &&
+	git -c core.bulkStat=false diff-files --name-status >expect.diff &&
+	git -c core.bulkStat=true diff-files --name-status >actual.diff &&
+	test_cmp expect.diff actual.diff
+}
+
+test_expect_success 'clean work tree' '
+	git -c core.bulkStat=true status --porcelain -uno >actual &&
+	test_must_be_empty actual &&
+	test_bulk_stat_matches
+'
+
+test_expect_success 'modified, removed and retyped entries' '
+	test_when_finished "git reset -q --hard" &&
+	echo changed >a/b/c/four &&
+	rm a/d/five &&
+	rm e/six &&
+	mkdir e/six &&
+	test_bulk_stat_matches &&
+	grep "^ M a/b/c/four$" actual.status &&
+	grep "^ D a/d/five$" actual.status
+'
+
+test_expect_success SYMLINKS 'leading directory replaced by a symlink' '
+	test_when_finished "rm -f e && git reset -q --hard" &&
+	rm -r e &&
+	ln -s a e &&
+	test_bulk_stat_matches &&
+	grep "^ D e/six$" actual.status
+'
+
+test_expect_success 'with threaded preload' '
+	test_when_finished "git reset -q --hard" &&
+	echo changed >a/one &&
+	echo changed >f/seven &&
+	(
+		GIT_FORCE_PRELOAD_TEST=true &&
+		export GIT_FORCE_PRELOAD_TEST &&
+		test_bulk_stat_matches
+	) &&
+	test_line_count = 2 actual.diff
+'
+
+test_done
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+test_description='compare the contents of stat-dirty entries while preloading the index'
+
+. ./test-lib.sh
+
+GIT_FORCE_PRELOAD_TEST=true
+export GIT_FORCE_PRELOAD_TEST
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		echo "file $i" >file$i || return 1
+	done &&
+	echo "filtered" >filtered &&
+	echo "filtered filter=rot13" >.gitattributes &&
+	git config filter.rot13.clean ./rot13.sh &&
+	write_script rot13.sh <<-\EOF &&
+	tr "a-zA-Z" "n-za-mN-ZA-M"
+	EOF
+	git add . &&
+	git commit -q -m initial &&
+	test-tool chmtime =-20 .gitattributes file* filtered rot13.sh &&
+	git update-index --refresh &&
+	cat >.git/info/exclude <<-\EOF
+	actual
+	trace
+	EOF
+'
+
+test_expect_success 'touched files are clean, and hashed once' '
+	test-tool chmtime =-10 file* &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git status --porcelain -uno >actual &&
+	test_must_be_empty actual &&
+	grep "\"preload/hash\",\"value\":8}" trace &&
+	rm trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git status --porcelain -uno >actual &&
+	test_must_be_empty actual &&
+	! grep "\"preload/hash\"" trace
+'
+
+test_expect_success 'changes of the same size are found' '
+	test_when_finished "git reset -q --hard" &&
+	echo "file 9" >file3 &&
+	test-tool chmtime +10 file* &&
+	git status --porcelain -uno >actual &&
+	echo " M file3" >expect &&
+	test_cmp expect actual &&
+	git diff --name-only >actual &&
+	echo file3 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'converted files are left to refresh' '
+	test_when_finished "git reset -q --hard" &&
+	test-tool chmtime =-10 filtered &&
+	git status --porcelain -uno >actual &&
+	test_must_be_empty actual &&
+	git cat-file blob :filtered >filtered &&
+	git status --porcelain -uno >actual &&
+	echo " M filtered" >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -669,4 +669,22 @@ test_expect_success 'git clean -d skips untracked dirs containing ignored files'
 	test_path_is_missing foo/b/bb
 '
 
+test_expect_success 'clean removes files on several threads' '
+	mkdir -p many/sub &&
+	for i in $(test_seq 50)
+	do
+		>many-$i &&
+		>many/$i &&
+		>many/sub/$i || return 1
+	done &&
+	git clean -n -d -e "expect*" -e actual >expect &&
+	GIT_TEST_CLEAN_THREADS=4 git clean -f -d -e "expect*" -e actual >actual &&
+	sed -e "s/^Would remove/Removing/" \
+	    -e "s/^Would skip repository/Skipping repository/" \
+		expect >expect.removing &&
+	test_cmp expect.removing actual &&
+	test_path_is_missing many &&
+	test_path_is_missing many-1
+'
+
 test_done
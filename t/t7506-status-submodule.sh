@@ -404,4 +404,17 @@ test_expect_success 'status with added file in nested submodule (short)' '
 	EOF
 '
 
+test_expect_success 'status with submodule.diffJobs' '
+	git -C super status --porcelain=2 >expect &&
+	git -C super -c submodule.diffJobs=3 status --porcelain=2 >actual &&
+	test_cmp expect actual &&
+	git -C super status >expect &&
+	git -C super -c submodule.diffJobs=0 status >actual &&
+	test_cmp expect actual &&
+	git -C super diff >expect &&
+	git -C super -c submodule.diffJobs=3 diff >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C super -c submodule.diffJobs=-1 status
+'
+
 test_done
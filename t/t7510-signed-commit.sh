@@ -227,4 +227,27 @@ test_expect_success GPG 'log.showsignature behaves like --show-signature' '
 	grep "gpg: Good signature" actual
 '
 
+test_expect_success GPG 'verify-commit checks several commits at once' '
+	commits="initial second merge merge^2 fourth-signed seventh-unsigned eighth-signed-alt" &&
+	rm -f expect &&
+	for commit in $commits
+	do
+		test_might_fail git verify-commit --raw $commit 2>>expect || return 1
+	done &&
+	test_must_fail git -c gpg.verifyJobs=4 verify-commit --raw $commits 2>actual &&
+	test_cmp expect actual &&
+	git -c gpg.verifyJobs=4 verify-commit initial second merge
+'
+
+test_expect_success GPG 'log --show-signature verifies a batch as one at a time' '
+	rm -f expect &&
+	for commit in $(git rev-list --all)
+	do
+		git show -s --format=%H --show-signature $commit >>expect || return 1
+	done &&
+	git -c gpg.verifyJobs=4 log --no-walk=unsorted --format=%H --show-signature \
+		$(git rev-list --all) >actual &&
+	test_cmp expect actual
+'
+
 test_done
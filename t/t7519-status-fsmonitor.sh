@@ -353,4 +353,50 @@ test_expect_success UNTRACKED_CACHE 'ignore .git changes when invalidating UNTR'
 	test_cmp before after
 '
 
+test_expect_success UNTRACKED_CACHE 'unchanged .gitignore files are not read' '
+	test_create_repo ignores &&
+	(
+		cd ignores &&
+		mkdir -p .git/hooks dir/sub build/sub &&
+		echo "*.o" >dir/.gitignore &&
+		echo "/build/" >.gitignore &&
+		: >dir/tracked &&
+		: >build/tracked &&
+		git add . &&
+		git add -f build/tracked &&
+		git commit -q -m initial &&
+		: >dir/a.o &&
+		: >dir/a.c &&
+		: >dir/sub/b.o &&
+		: >build/sub/c.o &&
+		write_script .git/hooks/fsmonitor-test <<-\EOF &&
+		EOF
+		git config core.fsmonitor .git/hooks/fsmonitor-test &&
+		git config core.untrackedCache true &&
+		git update-index --untracked-cache --fsmonitor &&
+		git status --porcelain >../expect &&
+		git -c core.fsmonitor= status --porcelain >../actual &&
+		test_cmp ../expect ../actual &&
+		git status --porcelain >../actual &&
+		test_cmp ../expect ../actual &&
+
+		# fsmonitor does not report it, so it is not even read
+		echo "*.c" >dir/.gitignore &&
+		git status --porcelain >../actual &&
+		test_cmp ../expect ../actual &&
+
+		# now it does; the exclusion of build/ still holds
+		write_script .git/hooks/fsmonitor-test <<-\EOF &&
+		printf "dir/.gitignore\0"
+		printf "build/sub/d.o\0"
+		EOF
+		: >build/sub/d.o &&
+		git -c core.fsmonitor= status --porcelain >../expect &&
+		git status --porcelain >../actual &&
+		test_cmp ../expect ../actual &&
+		grep "dir/a.o" ../actual &&
+		! grep "build" ../actual
+	)
+'
+
 test_done
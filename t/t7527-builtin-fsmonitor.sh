@@ -0,0 +1,97 @@
+#!/bin/sh
+
+test_description='built-in file system watcher'
+
+. ./test-lib.sh
+
+if test -n "$NO_UNIX_SOCKETS" || test -z "$FSMONITOR_DAEMON_BACKEND"
+then
+	skip_all='fsmonitor--daemon is not supported on this platform'
+	test_done
+fi
+
+# Compare "git status" as seen through the daemon with a full scan.
+test_status_matches () {
+	git -c core.fsmonitor=false status --porcelain -uall >expect &&
+	git status --porcelain -uall >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	mkdir -p dir1/sub dir2 &&
+	for f in file dir1/file dir1/sub/file dir2/file
+	do
+		echo initial >$f || return 1
+	done &&
+	git add . &&
+	cat >>.git/info/exclude <<-\EOF &&
+	expect
+	actual
+	out
+	trace
+	EOF
+	test_tick &&
+	git commit -m initial &&
+	git config core.fsmonitor true
+'
+
+test_expect_success 'start, status and stop' '
+	test_when_finished "git fsmonitor--daemon stop || :" &&
+	git fsmonitor--daemon start &&
+	git fsmonitor--daemon status >out &&
+	test_i18ngrep "is watching" out &&
+	test_must_fail git fsmonitor--daemon start &&
+	git fsmonitor--daemon stop &&
+	test_must_fail git fsmonitor--daemon status >out &&
+	test_i18ngrep "is not watching" out
+'
+
+test_expect_success 'the daemon is started on demand' '
+	test_when_finished "git fsmonitor--daemon stop" &&
+	test_must_fail git fsmonitor--daemon status &&
+	git status &&
+	git fsmonitor--daemon status
+'
+
+test_expect_success 'changes are reported' '
+	test_when_finished "git fsmonitor--daemon stop" &&
+	git status &&
+	test_status_matches &&
+	echo changed >file &&
+	echo changed >dir1/sub/file &&
+	echo new >dir2/new &&
+	test_status_matches &&
+	echo again >dir1/file &&
+	rm -f trace &&
+	GIT_TRACE_FSMONITOR="$(pwd)/trace" git status &&
+	grep "fsmonitor_refresh_callback .dir1/file." trace &&
+	! grep "fsmonitor_refresh_callback .dir2/file." trace &&
+	rm dir2/file &&
+	test_status_matches &&
+	git reset --hard &&
+	test_status_matches
+'
+
+test_expect_success 'directories that are moved or created are followed' '
+	test_when_finished "git fsmonitor--daemon stop" &&
+	git status &&
+	mv dir1 moved &&
+	test_status_matches &&
+	mv moved dir1 &&
+	test_status_matches &&
+	mkdir -p dir3/deeper &&
+	echo new >dir3/deeper/file &&
+	test_status_matches &&
+	echo changed >dir1/sub/file &&
+	test_status_matches &&
+	git reset --hard &&
+	git clean -fdq &&
+	test_status_matches
+'
+
+test_expect_success 'core.fsmonitor=false does not start the daemon' '
+	git -c core.fsmonitor=false status &&
+	test_must_fail git fsmonitor--daemon status
+'
+
+test_done
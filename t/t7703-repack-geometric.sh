@@ -0,0 +1,140 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+GIT_TEST_MULTI_PACK_INDEX=0
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+# Write <count> new blobs, with contents starting with <prefix>, and
+# print their names.
+blobs () {
+	for i in $(test_seq $2)
+	do
+		echo "$1 $i" | git hash-object -w --stdin || return 1
+	done
+}
+
+# Put <count> new blobs into a pack of their own.
+pack () {
+	blobs "$@" >objects &&
+	git pack-objects -q $packdir/pack <objects >/dev/null &&
+	git prune-packed
+}
+
+pack_sizes () {
+	for idx in $packdir/pack-*.idx
+	do
+		git show-index <$idx | wc -l || return 1
+	done | sort -n | xargs
+}
+
+test_expect_success '--geometric with no packs' '
+	git repack --geometric=2 -d >out &&
+	test_i18ngrep "Nothing new to pack" out
+'
+
+test_expect_success '--geometric leaves packs in progression alone' '
+	pack a 1 &&
+	pack b 2 &&
+	pack c 4 &&
+	ls $packdir/pack-*.pack >before &&
+	git repack --geometric=2 -d &&
+	ls $packdir/pack-*.pack >after &&
+	test_cmp before after
+'
+
+test_expect_success '--geometric packs loose objects on their own' '
+	blobs d 3 >loose &&
+	git repack --geometric=2 -d &&
+	test_path_is_missing $objdir/$(head -n 1 loose | sed "s,..,&/,") &&
+	echo 1 2 3 4 >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--geometric rolls up the smallest packs' '
+	rm -f $packdir/pack-* &&
+	pack e 2 &&
+	pack f 3 &&
+	pack g 12 &&
+	big=$(ls -t $packdir/pack-*.pack | head -n 1) &&
+	git repack --geometric=2 -d &&
+	test_path_is_file $big &&
+	echo 5 12 >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual &&
+	for o in $(blobs e 2) $(blobs f 3) $(blobs g 12)
+	do
+		git cat-file -e $o || return 1
+	done
+'
+
+test_expect_success '--geometric rolls up more packs if it has to' '
+	pack h 6 &&
+	blobs i 2 >loose &&
+	# 6 + 2 loose is too many for the pack of 5, and 13 for that of 12
+	git repack --geometric=2 -d &&
+	echo 25 >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--geometric leaves kept packs out' '
+	pack j 1 &&
+	kept=$(ls -t $packdir/pack-*.pack | head -n 1) &&
+	touch ${kept%.pack}.keep &&
+	pack k 1 &&
+	pack kk 1 &&
+	git repack --geometric=2 -d &&
+	test_path_is_file $kept &&
+	echo 1 2 25 >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--geometric is incompatible with -a' '
+	test_must_fail git repack --geometric=2 -a -d 2>err &&
+	test_i18ngrep "incompatible" err &&
+	test_must_fail git repack --geometric=1 -d
+'
+
+test_expect_success 'pack-objects --stdin-packs leaves out excluded packs' '
+	rm -f $packdir/pack-* &&
+	pack l 3 &&
+	one=$(ls $packdir/pack-*.pack) &&
+	blobs l 3 >expect.raw &&
+	blobs m 2 >>expect.raw &&
+	git pack-objects -q $packdir/pack <expect.raw >/dev/null &&
+	two=$(ls $packdir/pack-*.pack | grep -v $one) &&
+	{
+		basename $two &&
+		echo "^$(basename $one)"
+	} | git pack-objects --stdin-packs $packdir/pack >name &&
+	git show-index <$packdir/pack-$(cat name).idx | cut -d" " -f2 | sort >actual &&
+	blobs m 2 | sort >expect &&
+	test_cmp expect actual &&
+	echo pack-does-not-exist.pack |
+	test_must_fail git pack-objects --stdin-packs $packdir/pack 2>err &&
+	test_i18ngrep "could not find pack" err
+'
+
+test_expect_success 'gc --auto with gc.autoGeometricFactor' '
+	rm -rf $packdir/pack-* $objdir/?? &&
+	pack n 8 &&
+	big=$(ls $packdir/pack-*.pack) &&
+	pack o 1 &&
+	pack p 1 &&
+	pack q 1 &&
+	git -c gc.autoPackLimit=3 -c gc.autoGeometricFactor=2 \
+		-c gc.autoDetach=false gc --auto &&
+	test_path_is_file $big &&
+	echo 3 8 >expect &&
+	pack_sizes >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -1685,4 +1685,24 @@ test_expect_success 'grep does not report i-t-a and assume unchanged with -L' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep -F finds a string at any offset of a line' '
+	>long &&
+	for i in 0 1 2 3 7 8 14 15 16 17 31 32 33 47
+	do
+		printf "%${i}s" "" | tr " " x >>long &&
+		echo "NeedlE" >>long &&
+		printf "%${i}s" "" | tr " " x >>long &&
+		echo "NeedleXneedl" >>long || return 1
+	done &&
+	git grep --no-index -c -F NeedlE long >actual &&
+	echo long:14 >expect &&
+	test_cmp expect actual &&
+	git grep --no-index -c -F -i needlexneedl long >actual &&
+	test_cmp expect actual &&
+	git grep --no-index -c -F -i needle long >actual &&
+	echo long:28 >expect &&
+	test_cmp expect actual &&
+	test_must_fail git grep --no-index -F -i needlexneedle long
+'
+
 test_done
@@ -0,0 +1,71 @@
+#!/bin/sh
+
+test_description='git grep with grep.trigramIndex'
+
+. ./test-lib.sh
+
+remove_blob () {
+	blob=$(git rev-parse "$1") &&
+	rm .git/objects/$(echo $blob | sed -e "s|^..|&/|")
+}
+
+test_expect_success setup '
+	test_write_lines "int main(void)" "{" "	return hello();" "}" >main.c &&
+	test_write_lines "int hello(void)" "{" "	return goodbye_cruel_world;" "}" >hello.c &&
+	test_write_lines "Hello, World" >README &&
+	git add main.c hello.c README &&
+	git commit -m initial &&
+	for pattern in hello Hello World goodbye_cruel_world "main(void)"
+	do
+		git grep "$pattern" HEAD >"expect.$pattern" &&
+		git grep -i "$pattern" HEAD >"expect-i.$pattern" || return 1
+	done
+'
+
+test_expect_success 'the index is not written by default' '
+	git grep hello HEAD >actual &&
+	test_cmp expect.hello actual &&
+	test_path_is_missing .git/objects/info/trigram-index
+'
+
+test_expect_success 'the index is written and gives the same matches' '
+	git -c grep.trigramIndex=true grep hello HEAD >actual &&
+	test_cmp expect.hello actual &&
+	test_path_is_file .git/objects/info/trigram-index &&
+	for pattern in hello Hello World goodbye_cruel_world "main(void)"
+	do
+		git -c grep.trigramIndex=true grep "$pattern" HEAD >actual &&
+		test_cmp "expect.$pattern" actual &&
+		git -c grep.trigramIndex=true grep -i "$pattern" HEAD >actual &&
+		test_cmp "expect-i.$pattern" actual || return 1
+	done
+'
+
+test_expect_success 'blobs that cannot match are not read' '
+	remove_blob HEAD:main.c &&
+	remove_blob HEAD:README &&
+	git -c grep.trigramIndex=true grep goodbye_cruel_world HEAD >actual 2>err &&
+	test_cmp expect.goodbye_cruel_world actual &&
+	test_must_be_empty err &&
+	git -c grep.trigramIndex=true grep -i Goodbye_Cruel_World HEAD >actual 2>err &&
+	test_cmp expect.goodbye_cruel_world actual &&
+	test_must_be_empty err &&
+	git -c grep.trigramIndex=true grep -e goodbye_cruel_world --and -e return \
+		HEAD >actual 2>err &&
+	test_cmp expect.goodbye_cruel_world actual &&
+	test_must_be_empty err &&
+	git -c grep.trigramIndex=true grep -e goodbye_cruel_world --or -e World \
+		HEAD >actual 2>err &&
+	test_i18ngrep "unable to read" err
+'
+
+test_expect_success 'the index is not used with -v or -L' '
+	git -c grep.trigramIndex=true grep -v goodbye_cruel_world HEAD \
+		>actual 2>err &&
+	test_i18ngrep "unable to read" err &&
+	test_might_fail git -c grep.trigramIndex=true grep -L goodbye_cruel_world \
+		HEAD >actual 2>err &&
+	test_i18ngrep "unable to read" err
+'
+
+test_done
@@ -0,0 +1,425 @@
+#!/bin/sh
+
+test_description='git maintenance builtin'
+
+. ./test-lib.sh
+
+GIT_TEST_COMMIT_GRAPH=0
+GIT_TEST_MULTI_PACK_INDEX=0
+
+# Print the subcommands that ran, one per line, from the GIT_TRACE
+# output in <file>.
+ran () {
+	sed -n "s/.*trace: run_command: git //p" "$1"
+}
+
+test_expect_success 'help text' '
+	test_expect_code 129 git maintenance -h 2>err &&
+	test_i18ngrep "usage: git maintenance <subcommand>" err &&
+	test_expect_code 128 git maintenance barf 2>err &&
+	test_i18ngrep "invalid subcommand: barf" err &&
+	test_expect_code 129 git maintenance 2>err &&
+	test_i18ngrep "usage: git maintenance" err
+'
+
+test_expect_success 'run [--auto|--quiet]' '
+	GIT_TRACE="$(pwd)/run-no-auto.txt" git maintenance run 2>/dev/null &&
+	GIT_TRACE="$(pwd)/run-auto.txt" git maintenance run --auto 2>/dev/null &&
+	GIT_TRACE="$(pwd)/run-no-quiet.txt" git maintenance run --no-quiet 2>/dev/null &&
+	ran run-no-auto.txt >actual &&
+	grep "^gc --quiet" actual &&
+	ran run-auto.txt >actual &&
+	grep "^gc --auto --quiet" actual &&
+	ran run-no-quiet.txt >actual &&
+	grep "^gc --no-quiet" actual
+'
+
+test_expect_success 'maintenance.auto config option' '
+	GIT_TRACE="$(pwd)/default.txt" git commit --quiet --allow-empty -m 1 &&
+	ran default.txt >actual &&
+	grep "^maintenance run --auto --quiet" actual &&
+	GIT_TRACE="$(pwd)/true.txt" \
+		git -c maintenance.auto=true commit --quiet --allow-empty -m 2 &&
+	ran true.txt >actual &&
+	grep "^gc --auto --quiet" actual &&
+	GIT_TRACE="$(pwd)/false.txt" \
+		git -c maintenance.auto=false commit --quiet --allow-empty -m 3 &&
+	ran false.txt >actual &&
+	! grep "^maintenance run --auto" actual
+'
+
+test_expect_success 'maintenance.<task>.enabled' '
+	git config maintenance.gc.enabled false &&
+	git config maintenance.commit-graph.enabled true &&
+	GIT_TRACE="$(pwd)/run-config.txt" git maintenance run 2>err &&
+	ran run-config.txt >actual &&
+	! grep "^gc" actual &&
+	grep "^commit-graph write --split --stdin-commits" actual &&
+	git config --unset maintenance.gc.enabled &&
+	git config --unset maintenance.commit-graph.enabled
+'
+
+test_expect_success 'run --task=<task>' '
+	GIT_TRACE="$(pwd)/run-commit-graph.txt" \
+		git maintenance run --task=commit-graph 2>/dev/null &&
+	GIT_TRACE="$(pwd)/run-gc.txt" \
+		git maintenance run --task=gc 2>/dev/null &&
+	GIT_TRACE="$(pwd)/run-both.txt" \
+		git maintenance run --task=gc --task=commit-graph 2>/dev/null &&
+	ran run-commit-graph.txt >actual &&
+	! grep "^gc" actual &&
+	grep "^commit-graph write" actual &&
+	ran run-gc.txt >actual &&
+	grep "^gc --quiet" actual &&
+	! grep "^commit-graph write" actual &&
+	ran run-both.txt | grep -e "^gc --quiet" -e "^commit-graph write" >actual &&
+	cat >expect <<-\EOF &&
+	gc --quiet
+	commit-graph write --split --stdin-commits
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'run --task=bogus' '
+	test_must_fail git maintenance run --task=bogus 2>err &&
+	test_i18ngrep "is not a valid task" err
+'
+
+test_expect_success 'run --task duplicate' '
+	test_must_fail git maintenance run --task=gc --task=gc 2>err &&
+	test_i18ngrep "cannot be selected multiple times" err
+'
+
+test_expect_success 'commit-graph auto condition' '
+	git config core.commitGraph true &&
+	COMMAND="maintenance run --task=commit-graph --auto --quiet" &&
+
+	GIT_TRACE="$(pwd)/cg-no.txt" \
+		git -c maintenance.commit-graph.auto=1 $COMMAND &&
+	GIT_TRACE="$(pwd)/cg-negative-means-yes.txt" \
+		git -c maintenance.commit-graph.auto="-1" $COMMAND &&
+
+	test_commit first &&
+
+	GIT_TRACE="$(pwd)/cg-zero-means-no.txt" \
+		git -c maintenance.commit-graph.auto=0 $COMMAND &&
+	GIT_TRACE="$(pwd)/cg-one-satisfied.txt" \
+		git -c maintenance.commit-graph.auto=1 $COMMAND &&
+
+	git commit --allow-empty -m "second" &&
+	git commit --allow-empty -m "third" &&
+
+	GIT_TRACE="$(pwd)/cg-two-satisfied.txt" \
+		git -c maintenance.commit-graph.auto=2 $COMMAND &&
+
+	! ran cg-no.txt | grep "^commit-graph" &&
+	ran cg-negative-means-yes.txt | grep "^commit-graph" &&
+	! ran cg-zero-means-no.txt | grep "^commit-graph" &&
+	ran cg-one-satisfied.txt | grep "^commit-graph" &&
+	ran cg-two-satisfied.txt | grep "^commit-graph"
+'
+
+test_expect_success 'prefetch multiple remotes' '
+	git clone . clone1 &&
+	git clone . clone2 &&
+	git remote add remote1 "file://$(pwd)/clone1" &&
+	git remote add remote2 "file://$(pwd)/clone2" &&
+	git -C clone1 checkout -b one &&
+	git -C clone2 checkout -b two &&
+	test_commit -C clone1 one &&
+	test_commit -C clone2 two &&
+	GIT_TRACE="$(pwd)/run-prefetch.txt" git maintenance run --task=prefetch 2>/dev/null &&
+	fetchargs="--prefetch --prune --no-tags --no-write-fetch-head --recurse-submodules=no --quiet" &&
+	ran run-prefetch.txt >actual &&
+	grep "^fetch remote1 $fetchargs" actual &&
+	grep "^fetch remote2 $fetchargs" actual &&
+	test_path_is_missing .git/refs/remotes &&
+	git log prefetch/remotes/remote1/one &&
+	git log prefetch/remotes/remote2/two &&
+	git count-objects -v >before &&
+	git fetch --all &&
+	git count-objects -v >after &&
+	test_cmp before after &&
+	test_cmp_rev refs/remotes/remote1/one refs/prefetch/remotes/remote1/one &&
+	test_cmp_rev refs/remotes/remote2/two refs/prefetch/remotes/remote2/two
+'
+
+test_expect_success 'prefetch leaves out remotes with skipFetchAll' '
+	test_commit -C clone1 three &&
+	git config remote.remote1.skipFetchAll true &&
+	test_when_finished "git config --unset remote.remote1.skipFetchAll" &&
+	GIT_TRACE="$(pwd)/run-prefetch-skip.txt" git maintenance run --task=prefetch 2>/dev/null &&
+	ran run-prefetch-skip.txt >actual &&
+	! grep "^fetch remote1" actual &&
+	grep "^fetch remote2" actual &&
+	test "$(git rev-parse refs/prefetch/remotes/remote1/one)" != \
+		"$(git -C clone1 rev-parse refs/heads/one)"
+'
+
+test_expect_success 'log --decorate leaves out prefetched refs' '
+	git log --decorate -1 --format=%d refs/prefetch/remotes/remote2/two >actual &&
+	! grep prefetch actual &&
+	git log --decorate --decorate-refs=refs/prefetch/ -1 --format=%d \
+		refs/prefetch/remotes/remote2/two >actual &&
+	grep prefetch/remotes/remote2/two actual
+'
+
+test_expect_success 'loose-objects task' '
+	# Repack everything so we know the state of the object dir
+	git repack -adk &&
+
+	# Hack to stop maintenance from running during "git commit"
+	echo in use >.git/objects/maintenance.lock &&
+
+	# Assuming that "git commit" creates at least one loose object
+	test_commit create-loose-object &&
+	rm .git/objects/maintenance.lock &&
+
+	ls .git/objects >obj-dir-before &&
+	test -s obj-dir-before &&
+	ls .git/objects/pack/*.pack >packs-before &&
+	test_line_count = 1 packs-before &&
+
+	# The first run creates a pack-file
+	# but does not delete loose objects.
+	git maintenance run --task=loose-objects &&
+	ls .git/objects >obj-dir-between &&
+	test_cmp obj-dir-before obj-dir-between &&
+	ls .git/objects/pack/*.pack >packs-between &&
+	test_line_count = 2 packs-between &&
+	ls .git/objects/pack/loose-*.pack >loose-packs &&
+	test_line_count = 1 loose-packs &&
+
+	# The second run deletes loose objects
+	# but does not create a pack-file.
+	git maintenance run --task=loose-objects &&
+	ls .git/objects >obj-dir-after &&
+	cat >expect <<-\EOF &&
+	info
+	pack
+	EOF
+	test_cmp expect obj-dir-after &&
+	ls .git/objects/pack/*.pack >packs-after &&
+	test_cmp packs-between packs-after
+'
+
+test_expect_success 'loose-objects auto condition' '
+	test_commit create-loose &&
+	COMMAND="maintenance run --task=loose-objects --auto --quiet" &&
+	GIT_TRACE="$(pwd)/trace-lo1.txt" \
+		git -c maintenance.loose-objects.auto=1000 $COMMAND &&
+	! ran trace-lo1.txt | grep "^prune-packed" &&
+	GIT_TRACE="$(pwd)/trace-lo2.txt" \
+		git -c maintenance.loose-objects.auto=1 $COMMAND &&
+	ran trace-lo2.txt | grep "^prune-packed"
+'
+
+test_expect_success 'incremental-repack task' '
+	git repack -adk &&
+	for i in 1 2 3
+	do
+		test_commit incremental-$i &&
+		git repack -dq || return 1
+	done &&
+	ls .git/objects/pack/*.pack >packs-before &&
+	test_line_count = 4 packs-before &&
+	GIT_TRACE="$(pwd)/trace-ir0.txt" \
+		git -c maintenance.incremental-repack.auto=5 \
+		maintenance run --task=incremental-repack --auto &&
+	! ran trace-ir0.txt | grep "^repack" &&
+	GIT_TRACE="$(pwd)/trace-ir1.txt" \
+		git -c core.multiPackIndex=true \
+		maintenance run --task=incremental-repack &&
+	ran trace-ir1.txt | grep "^repack --geometric=2" &&
+	ran trace-ir1.txt | grep "^multi-pack-index write" &&
+	test_path_is_file .git/objects/pack/multi-pack-index &&
+	ls .git/objects/pack/*.pack >packs-after &&
+	test_line_count -lt 4 packs-after &&
+	git fsck
+'
+
+test_expect_success 'pack-refs task' '
+	for n in $(test_seq 1 5)
+	do
+		git branch -f to-pack/$n HEAD || return 1
+	done &&
+	git maintenance run --task=pack-refs &&
+	test_path_is_missing .git/refs/heads/to-pack &&
+	git rev-parse to-pack/3
+'
+
+test_expect_success 'maintenance.strategy inheritance' '
+	test_when_finished git config --unset maintenance.strategy &&
+	git config maintenance.strategy incremental &&
+
+	GIT_TRACE="$(pwd)/incremental-hourly.txt" \
+		git maintenance run --schedule=hourly --quiet &&
+	GIT_TRACE="$(pwd)/incremental-daily.txt" \
+		git maintenance run --schedule=daily --quiet &&
+	GIT_TRACE="$(pwd)/incremental-weekly.txt" \
+		git maintenance run --schedule=weekly --quiet &&
+
+	ran incremental-hourly.txt >hourly &&
+	ran incremental-daily.txt >daily &&
+	ran incremental-weekly.txt >weekly &&
+
+	grep "^commit-graph write" hourly &&
+	! grep "^prune-packed" hourly &&
+	! grep "^repack" hourly &&
+	! grep "^gc" hourly &&
+	! grep "^pack-refs" hourly &&
+
+	grep "^commit-graph write" daily &&
+	grep "^prune-packed" daily &&
+	grep "^repack --geometric" daily &&
+	! grep "^gc" daily &&
+	! grep "^pack-refs" daily &&
+
+	grep "^commit-graph write" weekly &&
+	grep "^prune-packed" weekly &&
+	grep "^repack --geometric" weekly &&
+	! grep "^gc" weekly &&
+	grep "^pack-refs" weekly &&
+
+	# Modify defaults
+	git config maintenance.commit-graph.schedule daily &&
+	git config maintenance.loose-objects.schedule hourly &&
+	git config maintenance.incremental-repack.enabled false &&
+
+	GIT_TRACE="$(pwd)/modified-hourly.txt" \
+		git maintenance run --schedule=hourly --quiet &&
+	GIT_TRACE="$(pwd)/modified-daily.txt" \
+		git maintenance run --schedule=daily --quiet &&
+
+	ran modified-hourly.txt >hourly &&
+	ran modified-daily.txt >daily &&
+	! grep "^commit-graph write" hourly &&
+	grep "^prune-packed" hourly &&
+	grep "^commit-graph write" daily &&
+	! grep "^repack" daily
+'
+
+test_expect_success 'run --schedule checks its argument' '
+	test_must_fail git maintenance run --schedule=annually 2>err &&
+	test_i18ngrep "unrecognized --schedule argument" err &&
+	test_must_fail git maintenance run --auto --schedule=daily 2>err &&
+	test_i18ngrep "at most one" err
+'
+
+test_expect_success 'a held maintenance lock skips the run' '
+	echo in use >.git/objects/maintenance.lock &&
+	test_when_finished "rm -f .git/objects/maintenance.lock" &&
+	GIT_TRACE="$(pwd)/locked.txt" git maintenance run --task=gc --no-quiet 2>err &&
+	test_i18ngrep "lock file" err &&
+	! ran locked.txt | grep "^gc"
+'
+
+test_expect_success 'register and unregister' '
+	test_when_finished git config --global --unset-all maintenance.repo &&
+	git config --global --add maintenance.repo /existing1 &&
+	git config --global --add maintenance.repo /existing2 &&
+	git config --global --get-all maintenance.repo >before &&
+
+	git maintenance register &&
+	test "$(git config maintenance.auto)" = false &&
+	git config --global --get-all maintenance.repo >between &&
+	cp before expect &&
+	pwd >>expect &&
+	test_cmp expect between &&
+
+	# registering twice adds it once
+	git maintenance register &&
+	git config --global --get-all maintenance.repo >actual &&
+	test_cmp expect actual &&
+
+	git maintenance unregister &&
+	git config --global --get-all maintenance.repo >actual &&
+	test_cmp before actual
+'
+
+test_expect_success 'setup mock schedulers' '
+	write_script print-args <<-\EOF &&
+	echo $* >>"$(dirname "$0")"/args
+	EOF
+	write_script mock-crontab <<-\EOF &&
+	if test "$1" = -l
+	then
+		cat "$(dirname "$0")"/crontab 2>/dev/null
+	else
+		cp "$1" "$(dirname "$0")"/crontab
+	fi
+	EOF
+	write_script mock-systemctl-missing <<-\EOF &&
+	exit 1
+	EOF
+	GIT_TEST_CRONTAB="$(pwd)/mock-crontab" &&
+	GIT_TEST_SYSTEMCTL="$(pwd)/mock-systemctl-missing" &&
+	export GIT_TEST_CRONTAB GIT_TEST_SYSTEMCTL
+'
+
+test_expect_success 'start from empty crontab' '
+	test_when_finished git config --global --unset-all maintenance.repo &&
+	rm -f crontab &&
+	git maintenance start &&
+
+	git config --global --get-all maintenance.repo >actual &&
+	pwd >expect &&
+	test_cmp expect actual &&
+
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=hourly" crontab &&
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=daily" crontab &&
+	grep "for-each-repo --config=maintenance.repo maintenance run --schedule=weekly" crontab
+'
+
+test_expect_success 'stop from existing schedule' '
+	git maintenance stop &&
+
+	# Operation is idempotent
+	git maintenance stop &&
+	test_must_be_empty crontab
+'
+
+test_expect_success 'start preserves existing schedule' '
+	echo "Important information!" >crontab &&
+	git maintenance start &&
+	grep "Important information!" crontab &&
+	test $(grep -c "BEGIN GIT MAINTENANCE SCHEDULE" crontab) = 1 &&
+
+	# starting again replaces the schedule
+	git maintenance start &&
+	test $(grep -c "BEGIN GIT MAINTENANCE SCHEDULE" crontab) = 1 &&
+
+	git maintenance stop &&
+	echo "Important information!" >expect &&
+	test_cmp expect crontab
+'
+
+test_expect_success 'start and stop with systemd timers' '
+	test_when_finished git config --global --unset-all maintenance.repo &&
+	write_script mock-systemctl <<-\EOF &&
+	echo "$*" >>"$(dirname "$0")"/systemctl-args
+	EOF
+	rm -f systemctl-args &&
+	XDG_CONFIG_HOME="$(pwd)/xdg" &&
+	export XDG_CONFIG_HOME &&
+	GIT_TEST_SYSTEMCTL="$(pwd)/mock-systemctl" \
+		git maintenance start --scheduler=systemd-timer &&
+	test_path_is_file xdg/systemd/user/git-maintenance@.timer &&
+	grep "OnCalendar=%i" xdg/systemd/user/git-maintenance@.timer &&
+	grep "maintenance run --schedule=%i" xdg/systemd/user/git-maintenance@.service &&
+	grep "^--user enable --now git-maintenance@hourly.timer git-maintenance@daily.timer git-maintenance@weekly.timer" \
+		systemctl-args &&
+	! grep "GIT MAINTENANCE SCHEDULE" crontab &&
+
+	GIT_TEST_SYSTEMCTL="$(pwd)/mock-systemctl" git maintenance stop &&
+	grep "^--user disable --now git-maintenance@hourly.timer" systemctl-args &&
+	test_path_is_missing xdg/systemd/user/git-maintenance@.timer &&
+	test_path_is_missing xdg/systemd/user/git-maintenance@.service
+'
+
+test_expect_success 'start --scheduler checks its argument' '
+	test_must_fail git maintenance start --scheduler=launchd 2>err &&
+	test_i18ngrep "unrecognized --scheduler argument" err
+'
+
+test_done
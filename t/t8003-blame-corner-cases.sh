@@ -271,4 +271,33 @@ test_expect_success 'blame file with CRLF core.autocrlf=true' '
 	grep "A U Thor" actual
 '
 
+test_expect_success 'blame of an octopus merge with the parents diffed in threads' '
+	git config core.autocrlf false &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 11 >octo &&
+	git add octo &&
+	git commit -m octo-base &&
+	git tag octo-base &&
+	for side in two five eight
+	do
+		git checkout -b octo-$side octo-base &&
+		case "$side" in
+		two) n=2 ;;
+		five) n=5 ;;
+		eight) n=8 ;;
+		esac &&
+		sed -e "s/^$n\$/$side/" octo >octo.new &&
+		mv octo.new octo &&
+		git commit -m $side octo || return 1
+	done &&
+	git checkout octo-two &&
+	git merge -m octopus octo-five octo-eight &&
+	sed -e "s/^11\$/eleven/" octo >octo.new &&
+	mv octo.new octo &&
+	git commit --amend -m "evil octopus" octo &&
+	git blame octo >expect &&
+	GIT_TEST_BLAME_THREADS=3 git blame octo >actual &&
+	test_cmp expect actual &&
+	grep "^[0-9a-f]* (.*) eleven" actual
+'
+
 test_done
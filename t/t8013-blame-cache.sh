@@ -0,0 +1,87 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m one &&
+	test_write_lines 1 two 3 4 5 6 7 8 9 10 11 >file &&
+	test_tick &&
+	git commit -a -m two &&
+	git mv file moved &&
+	test_write_lines 1 two 3 4 5 six 7 8 9 10 11 >moved &&
+	test_tick &&
+	git commit -a -m three &&
+	git tag three &&
+	test_write_lines 0 1 two 3 4 5 six 7 eight 9 10 11 >moved &&
+	test_tick &&
+	git commit -a -m four &&
+	git blame --porcelain three -- moved >expect.three &&
+	git blame --porcelain HEAD -- moved >expect.four
+'
+
+test_expect_success 'the cache is not written by default' '
+	git blame --porcelain three -- moved >actual &&
+	test_cmp expect.three actual &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'the blame is the same when written to the cache' '
+	git -c blame.cache=true blame --porcelain three -- moved >actual &&
+	test_cmp expect.three actual &&
+	test_path_is_dir .git/blame-cache &&
+	git -c blame.cache=true blame --porcelain three -- moved >actual &&
+	test_cmp expect.three actual
+'
+
+test_expect_success 'blame resumes from the cache' '
+	git -c blame.cache=true blame --show-stats HEAD -- moved >stats &&
+	grep "^num commits: 1\$" stats &&
+	git -c blame.cache=true blame --porcelain HEAD -- moved >actual &&
+	test_cmp expect.four actual &&
+	git blame --incremental HEAD -- moved >expect &&
+	git -c blame.cache=true blame --incremental HEAD -- moved >actual &&
+	sort expect >expect.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
+test_expect_success 'blame of the working tree resumes from the cache' '
+	echo 12 >>moved &&
+	git blame moved >expect &&
+	git -c blame.cache=true blame --show-stats moved >actual &&
+	grep "^num commits: 1\$" actual &&
+	sed -e "/^num /d" actual >actual.blame &&
+	test_cmp expect actual.blame &&
+	git checkout moved
+'
+
+test_expect_success 'the cache is not used with different options' '
+	git blame -w --porcelain HEAD -- moved >expect &&
+	git -c blame.cache=true blame -w --show-stats HEAD -- moved >stats &&
+	! grep "^num commits: 1\$" stats &&
+	git -c blame.cache=true blame -w --porcelain HEAD -- moved >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the cache is not used for part of history' '
+	git blame --porcelain HEAD~2..HEAD -- moved >expect &&
+	git -c blame.cache=true blame --porcelain HEAD~2..HEAD -- moved >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a broken cache is ignored' '
+	for f in .git/blame-cache/*/*
+	do
+		test_copy_bytes 30 <$f >tmp &&
+		mv tmp $f || return 1
+	done &&
+	git -c blame.cache=true blame --porcelain HEAD -- moved >actual &&
+	test_cmp expect.four actual
+'
+
+test_done
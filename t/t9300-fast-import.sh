@@ -1558,7 +1558,7 @@ test_expect_success 'O: blank lines not necessary after other commands' '
 	INPUT_END
 
 	git fast-import <input &&
-	test 8 = $(find .git/objects/pack -type f | wc -l) &&
+	test 8 = $(find .git/objects/pack -type f \! -name "*.rev" | wc -l) &&
 	test $(git rev-parse refs/tags/O3-2nd) = $(git rev-parse O3^) &&
 	git log --reverse --pretty=oneline O3 | sed s/^.*z// >actual &&
 	test_cmp expect actual
@@ -3262,4 +3262,114 @@ test_expect_success PIPE 'V: checkpoint updates tags after tag' '
 	background_import_still_running
 '
 
+###
+### series W (threads)
+###
+
+test_expect_success 'W: --threads writes the same pack and marks' '
+	test_tick &&
+	for i in $(test_seq 1 40)
+	do
+		echo blob &&
+		echo "mark :$i" &&
+		test_seq $i 200 >data &&
+		echo "data $(wc -c <data)" &&
+		cat data &&
+		echo blob &&
+		echo "data 3" &&
+		echo one ||
+		return 1
+	done >input &&
+	cat >>input <<-INPUT_END &&
+	cat-blob :40
+	commit refs/heads/W
+	committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+	data 0
+	M 644 :1 one
+	M 644 :20 two
+	M 644 :40 three
+
+	INPUT_END
+
+	for threads in 1 4
+	do
+		git init W$threads &&
+		git -C W$threads -c fastimport.unpackLimit=0 \
+			fast-import --threads=$threads \
+			--export-marks=../marks$threads \
+			--cat-blob-fd=3 <input 3>cat$threads &&
+		git verify-pack -v W$threads/.git/objects/pack/*.pack |
+			grep -v "^chain length\|: ok$" >verify$threads ||
+		return 1
+	done &&
+	test_cmp marks1 marks4 &&
+	test_cmp cat1 cat4 &&
+	test_cmp verify1 verify4 &&
+	git -C W1 rev-parse W >expect &&
+	git -C W4 rev-parse W >actual &&
+	test_cmp expect actual
+'
+
+###
+### series X (forgetting objects of finished packs)
+###
+
+test_expect_success 'X: marks into checkpointed packs stay usable' '
+	test_tick &&
+	cat >input <<-INPUT_END &&
+	blob
+	mark :1
+	data 6
+	first
+
+	commit refs/heads/X
+	mark :2
+	committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+	data 0
+	M 644 :1 file
+
+	checkpoint
+
+	blob
+	mark :3
+	data 7
+	second
+
+	commit refs/heads/X
+	mark :4
+	committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE
+	data 0
+	from :2
+	M 644 :1 old
+	M 644 :3 file
+
+	cat-blob :1
+	get-mark :2
+	ls :2 file
+	INPUT_END
+
+	git -c fastimport.unpackLimit=0 fast-import \
+		--export-marks=marks.out --cat-blob-fd=3 <input 3>out &&
+	X2=$(git rev-parse X^) &&
+	X1=$(git rev-parse X^:file) &&
+	cat >expect <<-EOF &&
+	:1 $X1
+	:2 $X2
+	:3 $(git rev-parse X:file)
+	:4 $(git rev-parse X)
+	EOF
+	test_cmp expect marks.out &&
+	cat >expect <<-EOF &&
+	$X1 blob 6
+	first
+
+	$X2
+	100644 blob $X1	file
+	EOF
+	test_cmp expect out &&
+	echo first >expect &&
+	git cat-file blob X:old >actual &&
+	test_cmp expect actual
+'
+
 test_done
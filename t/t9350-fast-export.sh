@@ -53,6 +53,14 @@ test_expect_success 'fast-export | fast-import' '
 
 '
 
+test_expect_success 'fast-export streams blobs over core.bigFileThreshold' '
+
+	git fast-export --all >expect &&
+	git -c core.bigFileThreshold=1 fast-export --all >actual &&
+	test_cmp expect actual
+
+'
+
 test_expect_success 'fast-export master~2..master' '
 
 	git fast-export master~2..master >actual &&
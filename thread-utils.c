@@ -75,3 +75,53 @@ int init_recursive_mutex(pthread_mutex_t *m)
 	}
 	return ret;
 }
+
+static pthread_key_t report_key;
+static void (*saved_error_routine)(const char *err, va_list params);
+static void (*saved_warn_routine)(const char *warn, va_list params);
+
+static void capture_report(const char *prefix, const char *msg, va_list params)
+{
+	struct strbuf *buf = pthread_getspecific(report_key);
+
+	strbuf_addstr(buf, prefix);
+	strbuf_vaddf(buf, msg, params);
+	strbuf_addch(buf, '\n');
+}
+
+static void capture_error(const char *err, va_list params)
+{
+	if (pthread_getspecific(report_key))
+		capture_report("error: ", err, params);
+	else
+		saved_error_routine(err, params);
+}
+
+static void capture_warning(const char *warn, va_list params)
+{
+	if (pthread_getspecific(report_key))
+		capture_report("warning: ", warn, params);
+	else
+		saved_warn_routine(warn, params);
+}
+
+void begin_report_capture(void)
+{
+	pthread_key_create(&report_key, NULL);
+	saved_error_routine = get_error_routine();
+	saved_warn_routine = get_warn_routine();
+	set_error_routine(capture_error);
+	set_warn_routine(capture_warning);
+}
+
+void capture_reports(struct strbuf *buf)
+{
+	pthread_setspecific(report_key, buf);
+}
+
+void end_report_capture(void)
+{
+	set_error_routine(saved_error_routine);
+	set_warn_routine(saved_warn_routine);
+	pthread_key_delete(report_key);
+}
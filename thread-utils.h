@@ -7,9 +7,27 @@
 extern int online_cpus(void);
 extern int init_recursive_mutex(pthread_mutex_t*);
 
+struct strbuf;
+
+/*
+ * Let the threads of a pool report errors without printing them in
+ * whatever order they happen to run. Between begin_report_capture()
+ * and end_report_capture(), which the main thread calls around the
+ * pool, error() and warning() in a thread that called capture_reports()
+ * with a buffer append the message to that buffer, for the main thread
+ * to print once it gets to the work the message is about. A NULL
+ * buffer makes them print again.
+ */
+extern void begin_report_capture(void);
+extern void capture_reports(struct strbuf *buf);
+extern void end_report_capture(void);
+
 #else
 
 #define online_cpus() 1
+#define begin_report_capture()
+#define capture_reports(buf)
+#define end_report_capture()
 
 #endif
 #endif /* THREAD_COMPAT_H */
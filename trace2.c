@@ -0,0 +1,506 @@
+#include "cache.h"
+#include "run-command.h"
+#include "trace2.h"
+#include "version.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
+/* The version of the event format, to be bumped on incompatible changes. */
+#define TRACE2_EVENT_VERSION "1"
+
+#define TRACE2_PARENT_SID_ENVIRONMENT "GIT_TRACE2_PARENT_SID"
+
+static struct trace_key trace2_event_key = { "GIT_TRACE2_EVENT", 0, 0, 0 };
+
+static int trace2_enabled;
+static int trace2_exited;
+static pid_t trace2_pid;
+static uint64_t trace2_start_ns;
+static struct strbuf trace2_sid = STRBUF_INIT;
+static int trace2_next_child_id;
+
+/*
+ * What we know about each thread: its name, and the start times of
+ * the regions it is in.
+ */
+struct trace2_thread {
+	struct strbuf name;
+	uint64_t start_ns;
+	uint64_t *region_start_ns;
+	int nr_regions, alloc_regions;
+};
+
+struct trace2_counter {
+	const char *category;
+	const char *name;
+	uint64_t value;
+};
+
+static struct trace2_counter *trace2_counters;
+static int nr_trace2_counters, alloc_trace2_counters;
+
+#ifndef NO_PTHREADS
+static pthread_key_t trace2_thread_key;
+static pthread_mutex_t trace2_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int trace2_next_thread_id = 1;
+#define trace2_lock() pthread_mutex_lock(&trace2_mutex)
+#define trace2_unlock() pthread_mutex_unlock(&trace2_mutex)
+#else
+#define trace2_lock() (void)0
+#define trace2_unlock() (void)0
+#endif
+
+static struct trace2_thread trace2_main_thread = { STRBUF_INIT };
+
+#ifndef NO_PTHREADS
+static struct trace2_thread *trace2_thread_new(const char *name)
+{
+	struct trace2_thread *th = xcalloc(1, sizeof(*th));
+
+	strbuf_init(&th->name, 0);
+	th->start_ns = getnanotime();
+	trace2_lock();
+	strbuf_addf(&th->name, "th%02d:%s", trace2_next_thread_id++, name);
+	trace2_unlock();
+	pthread_setspecific(trace2_thread_key, th);
+	return th;
+}
+
+static void trace2_thread_free(struct trace2_thread *th)
+{
+	strbuf_release(&th->name);
+	free(th->region_start_ns);
+	free(th);
+}
+#endif
+
+static struct trace2_thread *trace2_thread_get(void)
+{
+#ifndef NO_PTHREADS
+	struct trace2_thread *th = pthread_getspecific(trace2_thread_key);
+
+	/* a thread that did not call trace2_thread_start() */
+	if (!th)
+		th = trace2_thread_new("unnamed");
+	return th;
+#else
+	return &trace2_main_thread;
+#endif
+}
+
+static void json_add_string(struct strbuf *out, const char *s)
+{
+	strbuf_addch(out, '"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		switch (c) {
+		case '"':
+		case '\\':
+			strbuf_addch(out, '\\');
+			strbuf_addch(out, c);
+			break;
+		case '\n':
+			strbuf_addstr(out, "\\n");
+			break;
+		case '\t':
+			strbuf_addstr(out, "\\t");
+			break;
+		case '\r':
+			strbuf_addstr(out, "\\r");
+			break;
+		default:
+			if (c < 0x20)
+				strbuf_addf(out, "\\u%04x", c);
+			else
+				strbuf_addch(out, c);
+		}
+	}
+	strbuf_addch(out, '"');
+}
+
+static void json_add_key(struct strbuf *out, const char *key)
+{
+	strbuf_addch(out, ',');
+	json_add_string(out, key);
+	strbuf_addch(out, ':');
+}
+
+static void json_add_string_field(struct strbuf *out, const char *key,
+				  const char *value)
+{
+	json_add_key(out, key);
+	json_add_string(out, value);
+}
+
+static void json_add_argv_field(struct strbuf *out, const char *key,
+				const char **argv)
+{
+	json_add_key(out, key);
+	strbuf_addch(out, '[');
+	for (; argv && *argv; argv++) {
+		json_add_string(out, *argv);
+		if (argv[1])
+			strbuf_addch(out, ',');
+	}
+	strbuf_addch(out, ']');
+}
+
+static double ns_to_seconds(uint64_t ns)
+{
+	return ns / 1000000000.0;
+}
+
+static void add_utc_time(struct strbuf *out, const struct timeval *tv,
+			 int compact)
+{
+	time_t secs = tv->tv_sec;
+	struct tm tm;
+
+	gmtime_r(&secs, &tm);
+	strbuf_addf(out, compact ? "%04d%02d%02dT%02d%02d%02d.%06ldZ" :
+		    "%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ",
+		    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		    tm.tm_hour, tm.tm_min, tm.tm_sec, (long)tv->tv_usec);
+}
+
+/* Start an event with the fields that every event has. */
+static void event_begin(struct strbuf *out, const char *event,
+			const char *file, int line)
+{
+	struct timeval tv;
+
+	strbuf_addstr(out, "{\"event\":");
+	json_add_string(out, event);
+	json_add_string_field(out, "sid", trace2_sid.buf);
+	json_add_string_field(out, "thread", trace2_thread_get()->name.buf);
+
+	gettimeofday(&tv, NULL);
+	json_add_key(out, "time");
+	strbuf_addch(out, '"');
+	add_utc_time(out, &tv, 0);
+	strbuf_addch(out, '"');
+
+	json_add_string_field(out, "file", file);
+	json_add_key(out, "line");
+	strbuf_addf(out, "%d", line);
+}
+
+static void add_t_abs(struct strbuf *out)
+{
+	json_add_key(out, "t_abs");
+	strbuf_addf(out, "%.6f", ns_to_seconds(getnanotime() - trace2_start_ns));
+}
+
+/* Finish the event and write it with a single write(). */
+static void event_end(struct strbuf *out)
+{
+	strbuf_addstr(out, "}\n");
+	trace_verbatim(&trace2_event_key, out->buf, out->len);
+	strbuf_release(out);
+}
+
+int trace2_is_enabled(void)
+{
+	return trace2_enabled;
+}
+
+void trace2_initialize(const char **argv)
+{
+	struct strbuf out = STRBUF_INIT;
+	const char *parent_sid;
+	struct timeval tv;
+
+	trace2_start_ns = getnanotime();
+	if (!trace_want(&trace2_event_key))
+		return;
+
+	trace2_enabled = 1;
+	trace2_pid = getpid();
+	strbuf_addstr(&trace2_main_thread.name, "main");
+	trace2_main_thread.start_ns = trace2_start_ns;
+#ifndef NO_PTHREADS
+	pthread_key_create(&trace2_thread_key, NULL);
+	pthread_setspecific(trace2_thread_key, &trace2_main_thread);
+#endif
+
+	parent_sid = getenv(TRACE2_PARENT_SID_ENVIRONMENT);
+	if (parent_sid && *parent_sid)
+		strbuf_addf(&trace2_sid, "%s/", parent_sid);
+	gettimeofday(&tv, NULL);
+	add_utc_time(&trace2_sid, &tv, 1);
+	strbuf_addf(&trace2_sid, "-P%08"PRIxMAX, (uintmax_t)trace2_pid);
+	setenv(TRACE2_PARENT_SID_ENVIRONMENT, trace2_sid.buf, 1);
+
+	event_begin(&out, "version", __FILE__, __LINE__);
+	json_add_string_field(&out, "evt", TRACE2_EVENT_VERSION);
+	json_add_string_field(&out, "exe", git_version_string);
+	event_end(&out);
+
+	event_begin(&out, "start", __FILE__, __LINE__);
+	add_t_abs(&out);
+	json_add_argv_field(&out, "argv", argv);
+	event_end(&out);
+}
+
+int trace2_cmd_exit_fl(const char *file, int line, int code)
+{
+	struct strbuf out = STRBUF_INIT;
+	int i;
+
+	/*
+	 * Forked children that do not exec, and exit() calls from the
+	 * atexit handlers, have nothing to report.
+	 */
+	if (!trace2_enabled || trace2_exited || getpid() != trace2_pid)
+		return code;
+	trace2_exited = 1;
+
+	trace2_lock();
+	for (i = 0; i < nr_trace2_counters; i++) {
+		struct trace2_counter *c = &trace2_counters[i];
+
+		event_begin(&out, "counter", file, line);
+		json_add_string_field(&out, "category", c->category);
+		json_add_string_field(&out, "name", c->name);
+		json_add_key(&out, "value");
+		strbuf_addf(&out, "%"PRIuMAX, (uintmax_t)c->value);
+		event_end(&out);
+	}
+	trace2_unlock();
+
+	event_begin(&out, "exit", file, line);
+	add_t_abs(&out);
+	json_add_key(&out, "code");
+	strbuf_addf(&out, "%d", code);
+	event_end(&out);
+	return code;
+}
+
+void trace2_cmd_name_fl(const char *file, int line, const char *name)
+{
+	struct strbuf out = STRBUF_INIT;
+
+	if (!trace2_enabled)
+		return;
+
+	event_begin(&out, "cmd_name", file, line);
+	json_add_string_field(&out, "name", name);
+	event_end(&out);
+}
+
+void trace2_cmd_error_va_fl(const char *file, int line,
+			    const char *fmt, va_list ap)
+{
+	struct strbuf out = STRBUF_INIT;
+	struct strbuf msg = STRBUF_INIT;
+	va_list cp;
+
+	if (!trace2_enabled)
+		return;
+
+	/* the caller still needs "ap" to report the error itself */
+	va_copy(cp, ap);
+	strbuf_vaddf(&msg, fmt, cp);
+	va_end(cp);
+
+	event_begin(&out, "error", file, line);
+	json_add_string_field(&out, "msg", msg.buf);
+	json_add_string_field(&out, "fmt", fmt);
+	event_end(&out);
+	strbuf_release(&msg);
+}
+
+void trace2_child_start_fl(const char *file, int line,
+			   struct child_process *cmd)
+{
+	struct strbuf out = STRBUF_INIT;
+
+	if (!trace2_enabled)
+		return;
+
+	trace2_lock();
+	cmd->trace2_child_id = trace2_next_child_id++;
+	trace2_unlock();
+	cmd->trace2_child_start_ns = getnanotime();
+
+	event_begin(&out, "child_start", file, line);
+	json_add_key(&out, "child_id");
+	strbuf_addf(&out, "%d", cmd->trace2_child_id);
+	json_add_string_field(&out, "child_class",
+			      cmd->git_cmd ? "git" :
+			      cmd->use_shell ? "shell" : "other");
+	json_add_argv_field(&out, "argv", cmd->argv);
+	event_end(&out);
+}
+
+void trace2_child_exit_fl(const char *file, int line,
+			  struct child_process *cmd, int code)
+{
+	struct strbuf out = STRBUF_INIT;
+
+	if (!trace2_enabled)
+		return;
+
+	event_begin(&out, "child_exit", file, line);
+	json_add_key(&out, "child_id");
+	strbuf_addf(&out, "%d", cmd->trace2_child_id);
+	json_add_key(&out, "pid");
+	strbuf_addf(&out, "%"PRIuMAX, (uintmax_t)cmd->pid);
+	json_add_key(&out, "code");
+	strbuf_addf(&out, "%d", code);
+	json_add_key(&out, "t_rel");
+	strbuf_addf(&out, "%.6f",
+		    ns_to_seconds(getnanotime() - cmd->trace2_child_start_ns));
+	event_end(&out);
+}
+
+void trace2_thread_start_fl(const char *file, int line, const char *name)
+{
+	struct strbuf out = STRBUF_INIT;
+
+	if (!trace2_enabled)
+		return;
+
+#ifndef NO_PTHREADS
+	trace2_thread_new(name);
+#endif
+
+	event_begin(&out, "thread_start", file, line);
+	event_end(&out);
+}
+
+void trace2_thread_exit_fl(const char *file, int line)
+{
+	struct strbuf out = STRBUF_INIT;
+	struct trace2_thread *th;
+
+	if (!trace2_enabled)
+		return;
+
+	th = trace2_thread_get();
+	event_begin(&out, "thread_exit", file, line);
+	json_add_key(&out, "t_rel");
+	strbuf_addf(&out, "%.6f",
+		    ns_to_seconds(getnanotime() - th->start_ns));
+	event_end(&out);
+
+#ifndef NO_PTHREADS
+	if (th != &trace2_main_thread) {
+		pthread_setspecific(trace2_thread_key, NULL);
+		trace2_thread_free(th);
+	}
+#endif
+}
+
+void trace2_region_enter_fl(const char *file, int line,
+			    const char *category, const char *label)
+{
+	struct strbuf out = STRBUF_INIT;
+	struct trace2_thread *th;
+
+	if (!trace2_enabled)
+		return;
+
+	th = trace2_thread_get();
+	event_begin(&out, "region_enter", file, line);
+	json_add_key(&out, "nesting");
+	strbuf_addf(&out, "%d", th->nr_regions + 1);
+	json_add_string_field(&out, "category", category);
+	json_add_string_field(&out, "label", label);
+	event_end(&out);
+
+	ALLOC_GROW(th->region_start_ns, th->nr_regions + 1, th->alloc_regions);
+	th->region_start_ns[th->nr_regions++] = getnanotime();
+}
+
+void trace2_region_leave_fl(const char *file, int line,
+			    const char *category, const char *label)
+{
+	struct strbuf out = STRBUF_INIT;
+	struct trace2_thread *th;
+	uint64_t start_ns;
+
+	if (!trace2_enabled)
+		return;
+
+	th = trace2_thread_get();
+	if (!th->nr_regions)
+		BUG("trace2_region_leave() without a region to leave");
+	start_ns = th->region_start_ns[th->nr_regions - 1];
+
+	event_begin(&out, "region_leave", file, line);
+	json_add_key(&out, "t_rel");
+	strbuf_addf(&out, "%.6f", ns_to_seconds(getnanotime() - start_ns));
+	json_add_key(&out, "nesting");
+	strbuf_addf(&out, "%d", th->nr_regions);
+	json_add_string_field(&out, "category", category);
+	json_add_string_field(&out, "label", label);
+	event_end(&out);
+
+	th->nr_regions--;
+}
+
+static void data_begin(struct strbuf *out, const char *file, int line,
+		       const char *category, const char *key)
+{
+	event_begin(out, "data", file, line);
+	add_t_abs(out);
+	json_add_key(out, "nesting");
+	strbuf_addf(out, "%d", trace2_thread_get()->nr_regions);
+	json_add_string_field(out, "category", category);
+	json_add_string_field(out, "key", key);
+}
+
+void trace2_data_string_fl(const char *file, int line, const char *category,
+			   const char *key, const char *value)
+{
+	struct strbuf out = STRBUF_INIT;
+
+	if (!trace2_enabled)
+		return;
+
+	data_begin(&out, file, line, category, key);
+	json_add_string_field(&out, "value", value);
+	event_end(&out);
+}
+
+void trace2_data_intmax_fl(const char *file, int line, const char *category,
+			   const char *key, intmax_t value)
+{
+	struct strbuf out = STRBUF_INIT;
+
+	if (!trace2_enabled)
+		return;
+
+	data_begin(&out, file, line, category, key);
+	json_add_key(&out, "value");
+	strbuf_addf(&out, "%"PRIdMAX, value);
+	event_end(&out);
+}
+
+void trace2_counter_add(const char *category, const char *name,
+			uint64_t value)
+{
+	int i;
+
+	if (!trace2_enabled)
+		return;
+
+	trace2_lock();
+	for (i = 0; i < nr_trace2_counters; i++)
+		if (!strcmp(trace2_counters[i].category, category) &&
+		    !strcmp(trace2_counters[i].name, name))
+			break;
+	if (i == nr_trace2_counters) {
+		ALLOC_GROW(trace2_counters, nr_trace2_counters + 1,
+			   alloc_trace2_counters);
+		trace2_counters[i].category = category;
+		trace2_counters[i].name = name;
+		trace2_counters[i].value = 0;
+		nr_trace2_counters++;
+	}
+	trace2_counters[i].value += value;
+	trace2_unlock();
+}
@@ -0,0 +1,106 @@
+#ifndef TRACE2_H
+#define TRACE2_H
+
+/*
+ * Structured tracing of what Git processes do and how long it takes,
+ * meant to be collected by telemetry tools.
+ *
+ * When GIT_TRACE2_EVENT is set (to the same kind of values as the
+ * GIT_TRACE_* variables), every event is written as a JSON object on
+ * a line of its own. Each process has a session id that is made of
+ * the session id of the Git process that started it, if any, and its
+ * own, so that the events of a whole process tree can be put back
+ * together. See Documentation/technical/api-trace2.txt for the events
+ * and their fields.
+ *
+ * All of these functions do nothing when tracing is disabled.
+ */
+
+struct child_process;
+
+/*
+ * Set up tracing, and record the start of the process with "argv".
+ * Called from main().
+ */
+extern void trace2_initialize(const char **argv);
+
+/* Whether events are being written at all. */
+extern int trace2_is_enabled(void);
+
+/*
+ * Record the exit of the process with "code", and return it. This is
+ * called by the exit() wrapper in git-compat-util.h.
+ */
+extern int trace2_cmd_exit_fl(const char *file, int line, int code);
+
+/* Record the name of the builtin, or whatever the process is running. */
+extern void trace2_cmd_name_fl(const char *file, int line, const char *name);
+#define trace2_cmd_name(name) \
+	trace2_cmd_name_fl(__FILE__, __LINE__, (name))
+
+/* Record a message from error() or die(). */
+extern void trace2_cmd_error_va_fl(const char *file, int line,
+				   const char *fmt, va_list ap);
+#define trace2_cmd_error_va(fmt, ap) \
+	trace2_cmd_error_va_fl(__FILE__, __LINE__, (fmt), (ap))
+
+/*
+ * Record that "cmd" was started or has exited; called by
+ * run-command.c.
+ */
+extern void trace2_child_start_fl(const char *file, int line,
+				  struct child_process *cmd);
+extern void trace2_child_exit_fl(const char *file, int line,
+				 struct child_process *cmd, int code);
+#define trace2_child_start(cmd) \
+	trace2_child_start_fl(__FILE__, __LINE__, (cmd))
+#define trace2_child_exit(cmd, code) \
+	trace2_child_exit_fl(__FILE__, __LINE__, (cmd), (code))
+
+/*
+ * Name the calling thread. Call trace2_thread_start() first thing in
+ * a thread function, and trace2_thread_exit() last thing.
+ */
+extern void trace2_thread_start_fl(const char *file, int line,
+				   const char *name);
+extern void trace2_thread_exit_fl(const char *file, int line);
+#define trace2_thread_start(name) \
+	trace2_thread_start_fl(__FILE__, __LINE__, (name))
+#define trace2_thread_exit() \
+	trace2_thread_exit_fl(__FILE__, __LINE__)
+
+/*
+ * Time a region of code in the calling thread. Regions nest, and each
+ * trace2_region_enter() must be paired with a trace2_region_leave()
+ * with the same arguments.
+ */
+extern void trace2_region_enter_fl(const char *file, int line,
+				   const char *category, const char *label);
+extern void trace2_region_leave_fl(const char *file, int line,
+				   const char *category, const char *label);
+#define trace2_region_enter(category, label) \
+	trace2_region_enter_fl(__FILE__, __LINE__, (category), (label))
+#define trace2_region_leave(category, label) \
+	trace2_region_leave_fl(__FILE__, __LINE__, (category), (label))
+
+/* Record a value, in the current region of the calling thread. */
+extern void trace2_data_string_fl(const char *file, int line,
+				  const char *category, const char *key,
+				  const char *value);
+extern void trace2_data_intmax_fl(const char *file, int line,
+				  const char *category, const char *key,
+				  intmax_t value);
+#define trace2_data_string(category, key, value) \
+	trace2_data_string_fl(__FILE__, __LINE__, (category), (key), (value))
+#define trace2_data_intmax(category, key, value) \
+	trace2_data_intmax_fl(__FILE__, __LINE__, (category), (key), (value))
+
+/*
+ * Add "value" to a counter. Counters are shared by all threads, and
+ * are reported once, when the process exits. "category" and "name"
+ * must stay valid until then (string literals are best).
+ */
+extern void trace2_counter_add(const char *category, const char *name,
+			       uint64_t value);
+
+#endif
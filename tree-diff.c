@@ -38,7 +38,10 @@ static int ll_diff_tree_oid(const struct object_id *old_oid,
  * but not their sha1's.
  *
  * NOTE files and directories *always* compare differently, even when having
- *      the same name - thanks to base_name_compare().
+ *      the same name - a directory sorts as if its name ended with '/',
+ *      as in base_name_compare(), which this is an inlined version of
+ *      for the inner loop of the tree walk: most entries differ in their
+ *      first byte, and the name lengths are known already.
  *
  * NOTE empty (=invalid) descriptor(s) take part in comparison as +infty,
  *      so that they sort *after* valid tree entries.
@@ -49,7 +52,8 @@ static int ll_diff_tree_oid(const struct object_id *old_oid,
 static int tree_entry_pathcmp(struct tree_desc *t1, struct tree_desc *t2)
 {
 	struct name_entry *e1, *e2;
-	int cmp;
+	int len1, len2, cmp;
+	unsigned char c1, c2;
 
 	/* empty descriptors sort after valid tree entries */
 	if (!t1->size)
@@ -59,9 +63,20 @@ static int tree_entry_pathcmp(struct tree_desc *t1, struct tree_desc *t2)
 
 	e1 = &t1->entry;
 	e2 = &t2->entry;
-	cmp = base_name_compare(e1->path, tree_entry_len(e1), e1->mode,
-				e2->path, tree_entry_len(e2), e2->mode);
-	return cmp;
+	/* names are never empty */
+	c1 = e1->path[0];
+	c2 = e2->path[0];
+	if (c1 != c2)
+		return c1 < c2 ? -1 : 1;
+
+	len1 = tree_entry_len(e1);
+	len2 = tree_entry_len(e2);
+	cmp = memcmp(e1->path, e2->path, len1 < len2 ? len1 : len2);
+	if (cmp)
+		return cmp;
+	c1 = len1 > len2 ? e1->path[len2] : S_ISDIR(e1->mode) ? '/' : '\0';
+	c2 = len2 > len1 ? e2->path[len1] : S_ISDIR(e2->mode) ? '/' : '\0';
+	return c1 < c2 ? -1 : c1 > c2 ? 1 : 0;
 }
 
 
@@ -408,7 +423,7 @@ static struct combine_diff_path *ll_diff_tree_paths(
 	struct strbuf *base, struct diff_options *opt)
 {
 	struct tree_desc t, *tp;
-	void *ttree, **tptree;
+	struct parsed_tree *ttree, **tptree;
 	int i;
 
 	FAST_ARRAY_ALLOC(tp, nparent);
@@ -421,8 +436,8 @@ static struct combine_diff_path *ll_diff_tree_paths(
 	 *   diff_tree_oid(parent, commit) )
 	 */
 	for (i = 0; i < nparent; ++i)
-		tptree[i] = fill_tree_descriptor(&tp[i], parents_oid[i]);
-	ttree = fill_tree_descriptor(&t, oid);
+		tptree[i] = fill_tree_descriptor_cached(&tp[i], parents_oid[i]);
+	ttree = fill_tree_descriptor_cached(&t, oid);
 
 	/* Enable recursion indefinitely */
 	opt->pathspec.recursive = opt->flags.recursive;
@@ -537,9 +552,9 @@ static struct combine_diff_path *ll_diff_tree_paths(
 		}
 	}
 
-	free(ttree);
+	release_parsed_tree(ttree);
 	for (i = nparent-1; i >= 0; i--)
-		free(tptree[i]);
+		release_parsed_tree(tptree[i]);
 	FAST_ARRAY_FREE(tptree, nparent);
 	FAST_ARRAY_FREE(tp, nparent);
 
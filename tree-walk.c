@@ -5,6 +5,14 @@
 #include "object-store.h"
 #include "tree.h"
 #include "pathspec.h"
+#include "oidmap.h"
+#include "list.h"
+
+struct parsed_tree_entry {
+	unsigned int mode;
+	unsigned int path_offset; /* from the start of the entry */
+	unsigned int pathlen;
+};
 
 static const char *get_mode(const char *str, unsigned int *modep)
 {
@@ -52,10 +60,21 @@ static int decode_tree_entry(struct tree_desc *desc, const char *buf, unsigned l
 	return 0;
 }
 
+static void decode_parsed_entry(struct tree_desc *desc)
+{
+	const struct parsed_tree_entry *pe = desc->parsed;
+	const char *path = (const char *)desc->buffer + pe->path_offset;
+
+	desc->entry.path = path;
+	desc->entry.mode = pe->mode;
+	desc->entry.oid  = (const struct object_id *)(path + pe->pathlen + 1);
+}
+
 static int init_tree_desc_internal(struct tree_desc *desc, const void *buffer, unsigned long size, struct strbuf *err)
 {
 	desc->buffer = buffer;
 	desc->size = size;
+	desc->parsed = NULL;
 	if (size)
 		return decode_tree_entry(desc, buffer, size, err);
 	return 0;
@@ -93,6 +112,122 @@ void *fill_tree_descriptor(struct tree_desc *desc, const struct object_id *oid)
 	return buf;
 }
 
+struct parsed_tree {
+	struct oidmap_entry ent;
+	struct list_head lru; /* in unused_trees while not in use */
+	void *buffer;
+	unsigned long size;
+	struct parsed_tree_entry *entries;
+	size_t bytes;
+	unsigned int refcount;
+	unsigned cached:1;
+};
+
+static struct oidmap tree_cache;
+static LIST_HEAD(unused_trees); /* least recently used first */
+static size_t tree_cache_bytes;
+
+static int update_tree_entry_internal(struct tree_desc *desc, struct strbuf *err);
+
+/*
+ * Decode the entries of "tree" with the usual checks; a corrupt tree
+ * is walked (and complained about) as fill_tree_descriptor() would.
+ */
+static int parse_tree_entries(struct parsed_tree *tree)
+{
+	struct strbuf err = STRBUF_INIT;
+	struct tree_desc desc;
+	size_t nr = 0, alloc = 0;
+
+	if (init_tree_desc_internal(&desc, tree->buffer, tree->size, &err))
+		goto corrupt;
+	while (desc.size) {
+		struct parsed_tree_entry *pe;
+
+		ALLOC_GROW(tree->entries, nr + 1, alloc);
+		pe = &tree->entries[nr++];
+		pe->mode = desc.entry.mode;
+		pe->path_offset = desc.entry.path - (const char *)desc.buffer;
+		pe->pathlen = tree_entry_len(&desc.entry);
+		if (update_tree_entry_internal(&desc, &err))
+			goto corrupt;
+	}
+	tree->bytes = sizeof(*tree) + tree->size + alloc * sizeof(*tree->entries);
+	return 0;
+
+corrupt:
+	strbuf_release(&err);
+	FREE_AND_NULL(tree->entries);
+	return -1;
+}
+
+static void free_parsed_tree(struct parsed_tree *tree)
+{
+	free(tree->buffer);
+	free(tree->entries);
+	free(tree);
+}
+
+struct parsed_tree *fill_tree_descriptor_cached(struct tree_desc *desc,
+						const struct object_id *oid)
+{
+	struct parsed_tree *tree;
+
+	if (!oid) {
+		init_tree_desc(desc, NULL, 0);
+		return NULL;
+	}
+
+	tree = oidmap_get(&tree_cache, oid);
+	if (!tree) {
+		tree = xcalloc(1, sizeof(*tree));
+		oidcpy(&tree->ent.oid, oid);
+		tree->buffer = read_object_with_reference(oid, tree_type,
+							  &tree->size, NULL);
+		if (!tree->buffer)
+			die("unable to read tree %s", oid_to_hex(oid));
+		if (!parse_tree_entries(tree)) {
+			tree->cached = 1;
+			oidmap_put(&tree_cache, tree);
+			tree_cache_bytes += tree->bytes;
+		}
+	} else if (!tree->refcount)
+		list_del(&tree->lru);
+	tree->refcount++;
+
+	if (!tree->cached) {
+		init_tree_desc(desc, tree->buffer, tree->size);
+		return tree;
+	}
+	desc->buffer = tree->buffer;
+	desc->size = tree->size;
+	desc->parsed = tree->entries;
+	if (desc->size)
+		decode_parsed_entry(desc);
+	return tree;
+}
+
+void release_parsed_tree(struct parsed_tree *tree)
+{
+	if (!tree || --tree->refcount)
+		return;
+	if (!tree->cached) {
+		free_parsed_tree(tree);
+		return;
+	}
+
+	list_add_tail(&tree->lru, &unused_trees);
+	while (tree_cache_bytes > tree_cache_limit && !list_empty(&unused_trees)) {
+		struct parsed_tree *old = list_first_entry(&unused_trees,
+							   struct parsed_tree, lru);
+
+		list_del(&old->lru);
+		oidmap_remove(&tree_cache, &old->ent.oid);
+		tree_cache_bytes -= old->bytes;
+		free_parsed_tree(old);
+	}
+}
+
 static void entry_clear(struct name_entry *a)
 {
 	memset(a, 0, sizeof(*a));
@@ -116,9 +251,14 @@ static int update_tree_entry_internal(struct tree_desc *desc, struct strbuf *err
 	size -= len;
 	desc->buffer = buf;
 	desc->size = size;
-	if (size)
-		return decode_tree_entry(desc, buf, size, err);
-	return 0;
+	if (!size)
+		return 0;
+	if (desc->parsed) {
+		desc->parsed++;
+		decode_parsed_entry(desc);
+		return 0;
+	}
+	return decode_tree_entry(desc, buf, size, err);
 }
 
 void update_tree_entry(struct tree_desc *desc)
@@ -921,6 +1061,93 @@ static int match_wildcard_base(const struct pathspec_item *item,
 	return entry_interesting;
 }
 
+/*
+ * The part of do_match() for the literal items of a pathspec lookup
+ * (see pathspec.h), which it does not try in turn: the items that make
+ * all of "base" interesting are keyed by one of its leading
+ * directories, and those inside "base" that "entry" matches by its
+ * path or, for a directory, by one of its leading directories.
+ */
+static enum interesting match_literal_keys(const struct name_entry *entry,
+					   struct strbuf *base, int base_offset,
+					   const struct pathspec *ps,
+					   enum interesting *never_interesting)
+{
+	const struct pathspec_lookup *l = ps->lookup;
+	const struct pathspec_key *keys = l->literal;
+	const char *base_str = base->buf + base_offset;
+	int baselen = base->len - base_offset;
+	int pathlen = tree_entry_len(entry);
+	enum interesting ret = entry_not_interesting;
+	int i, lo, hi, first, end;
+
+	for (i = 0; i <= baselen; i++) {
+		if (i && base_str[i - 1] != '/')
+			continue;
+		first = pathspec_key_range(keys, l->literal_nr, base_str,
+					   i ? i - 1 : 0, 1, &end);
+		if (first < end)
+			return all_entries_interesting;
+	}
+
+	/* the items inside "base" */
+	lo = pathspec_key_range(keys, l->literal_nr, base_str, baselen, 0, &hi);
+	if (lo == hi)
+		return entry_not_interesting;
+	keys += lo;
+	hi -= lo;
+
+	strbuf_add(base, entry->path, pathlen);
+	first = pathspec_key_range(keys, hi, base->buf + base_offset,
+				   baselen + pathlen, 1, &end);
+	for (i = first; i < end; i++) {
+		const struct pathspec_item *item = &ps->items[keys[i].item];
+		enum interesting unused = entry_not_interesting;
+
+		if (match_entry(item, entry, pathlen, item->match + baselen,
+				item->len - baselen, &unused)) {
+			ret = entry_interesting;
+			goto done;
+		}
+	}
+	if (S_ISDIR(entry->mode) || S_ISGITLINK(entry->mode)) {
+		strbuf_addch(base, '/');
+		first = pathspec_key_range(keys, hi, base->buf + base_offset,
+					   baselen + pathlen + 1, 0, &end);
+		if (first < end) {
+			ret = entry_interesting;
+			goto done;
+		}
+	}
+
+	/*
+	 * As in match_entry(), later entries may still be interesting
+	 * if an item sorts the same as or after this entry, or if one
+	 * is a leading part of it (which may well sort earlier, but it
+	 * is not worth finding out).
+	 */
+	if (*never_interesting == entry_not_interesting)
+		goto done;
+	strbuf_setlen(base, base_offset + baselen + pathlen);
+	if (pathspec_key_range(keys, hi, base->buf + base_offset,
+			       baselen + pathlen, 1, &end) < hi) {
+		*never_interesting = entry_not_interesting;
+		goto done;
+	}
+	for (i = 1; i < pathlen; i++) {
+		first = pathspec_key_range(keys, hi, base->buf + base_offset,
+					   baselen + i, 1, &end);
+		if (first < end) {
+			*never_interesting = entry_not_interesting;
+			break;
+		}
+	}
+
+done:
+	strbuf_setlen(base, base_offset + baselen);
+	return ret;
+}
+
 /*
  * Is a tree entry interesting given the pathspec we have?
  *
@@ -932,7 +1159,8 @@ static enum interesting do_match(const struct name_entry *entry,
 				 const struct pathspec *ps,
 				 int exclude)
 {
-	int i;
+	int i, nr;
+	const int *tried = NULL;
 	int pathlen, baselen = base->len - base_offset;
 	enum interesting never_interesting = ps->has_wildcard ?
 		entry_not_interesting : all_entries_not_interesting;
@@ -958,8 +1186,14 @@ static enum interesting do_match(const struct name_entry *entry,
 
 	pathlen = tree_entry_len(entry);
 
-	for (i = ps->nr - 1; i >= 0; i--) {
-		const struct pathspec_item *item = ps->items+i;
+	nr = ps->nr;
+	if (pathspec_use_lookup(ps)) {
+		tried = ps->lookup->not_literal;
+		nr = ps->lookup->not_literal_nr;
+	}
+
+	for (i = nr - 1; i >= 0; i--) {
+		const struct pathspec_item *item = ps->items + (tried ? tried[i] : i);
 		const char *match = item->match;
 		const char *base_str = base->buf + base_offset;
 		int matchlen = item->len, matched = 0;
@@ -1080,6 +1314,13 @@ static enum interesting do_match(const struct name_entry *entry,
 		if (ps->recursive && S_ISDIR(entry->mode))
 			return entry_interesting;
 	}
+	/* the literal items have no exclude magic */
+	if (tried && !exclude) {
+		enum interesting ret = match_literal_keys(entry, base, base_offset,
+							  ps, &never_interesting);
+		if (ret != entry_not_interesting)
+			return ret;
+	}
 	return never_interesting; /* No matches */
 }
 
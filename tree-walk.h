@@ -7,10 +7,14 @@ struct name_entry {
 	unsigned int mode;
 };
 
+struct parsed_tree_entry;
+
 struct tree_desc {
 	const void *buffer;
 	struct name_entry entry;
 	unsigned int size;
+	/* the entries from "buffer" on, decoded already, if any */
+	const struct parsed_tree_entry *parsed;
 };
 
 static inline const struct object_id *tree_entry_extract(struct tree_desc *desc, const char **pathp, unsigned int *modep)
@@ -44,6 +48,18 @@ int tree_entry_gently(struct tree_desc *, struct name_entry *);
 
 void *fill_tree_descriptor(struct tree_desc *desc, const struct object_id *oid);
 
+/*
+ * Like fill_tree_descriptor(), but the tree comes from a cache of trees
+ * whose entries are decoded already (see core.treeCacheLimit), so that
+ * walking the same tree again neither reads nor parses it. The tree is
+ * kept until the handle returned is given to release_parsed_tree(),
+ * which takes NULL for a NULL "oid" as free() does.
+ */
+struct parsed_tree;
+struct parsed_tree *fill_tree_descriptor_cached(struct tree_desc *desc,
+						const struct object_id *oid);
+void release_parsed_tree(struct parsed_tree *tree);
+
 struct traverse_info;
 typedef int (*traverse_callback_t)(int n, unsigned long mask, unsigned long dirmask, struct name_entry *entry, struct traverse_info *);
 int traverse_trees(int n, struct tree_desc *t, struct traverse_info *info);
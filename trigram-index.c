@@ -0,0 +1,339 @@
+#include "cache.h"
+#include "config.h"
+#include "oidmap.h"
+#include "lockfile.h"
+#include "trigram-index.h"
+#include "trace2.h"
+
+/*
+ * The file starts with a header:
+ *
+ *   4-byte signature "TRGI"
+ *   1-byte version (1)
+ *   1-byte hash version (1 for SHA-1)
+ *   2 bytes of padding
+ *
+ * followed by records, each of which is:
+ *
+ *   the object name of the blob
+ *   4-byte log2 of the number of bits of the filter
+ *   the bits of the filter, the first bit being the lowest bit of the
+ *   first byte
+ *
+ * A trigram is in the filter when the bit at the top bits of its hash is
+ * set, so a filter of 2^n bits can be cut down to one of 2^(n-1) bits by
+ * or'ing its bits in pairs. All numbers are in network byte order.
+ * Records are only ever appended, and when a blob has several records,
+ * the last one wins. A record cut short at the end of the file is
+ * ignored, and cut off by the next process that appends to the file.
+ */
+#define TRIGRAM_INDEX_SIGNATURE 0x54524749 /* "TRGI" */
+#define TRIGRAM_INDEX_VERSION 1
+#define TRIGRAM_INDEX_OID_VERSION 1
+#define TRIGRAM_INDEX_HEADER_SIZE 8
+#define RECORD_HEADER_SIZE (GIT_SHA1_RAWSZ + 4)
+
+/*
+ * A filter has at least twice as many bits as the blob has trigrams,
+ * and between 64 and 2^20 bits. Larger blobs have filters with more bits
+ * set, which let more searches through.
+ */
+#define MIN_BITS_LOG2 6
+#define MAX_BITS_LOG2 20
+
+struct trigram_filter {
+	struct oidmap_entry entry;
+	unsigned int bits_log2;
+	const unsigned char *bits;	/* in the file, or in "buf" */
+	unsigned char *buf;		/* the record, if not written yet */
+};
+
+static int use_index = -1;
+static int loaded;
+static struct oidmap index_map;
+static void *index_mmap;
+static size_t index_mmap_size;
+/* how much of the file we read, and where its last complete record ends */
+static off_t index_file_size, index_valid_end;
+static int index_readonly; /* do not append to a file we cannot read */
+
+static struct trigram_filter **pending;
+static int pending_nr, pending_alloc;
+
+int trigram_index_enabled(void)
+{
+	if (use_index < 0 &&
+	    git_config_get_bool("grep.trigramindex", &use_index))
+		use_index = 0;
+	return use_index;
+}
+
+static char *trigram_index_filename(void)
+{
+	return xstrfmt("%s/info/trigram-index", get_object_directory());
+}
+
+static inline size_t filter_size(unsigned int bits_log2)
+{
+	return ((size_t)1 << bits_log2) / 8;
+}
+
+static inline uint32_t trigram_hash(const unsigned char *p)
+{
+	uint32_t t = (tolower(p[0]) << 16) | (tolower(p[1]) << 8) | tolower(p[2]);
+
+	return t * 2654435761u;
+}
+
+static inline size_t trigram_bit(uint32_t hash, unsigned int bits_log2)
+{
+	return hash >> (32 - bits_log2);
+}
+
+static void add_entry(struct trigram_filter *e)
+{
+	struct trigram_filter *old = oidmap_put(&index_map, e);
+
+	if (old) {
+		free(old->buf);
+		free(old);
+	}
+}
+
+/* Return the size of the record at "data", or 0 if we cannot use it */
+static size_t parse_record(const unsigned char *data, size_t len)
+{
+	struct trigram_filter *e;
+	uint32_t bits_log2;
+	size_t size;
+
+	if (len < RECORD_HEADER_SIZE)
+		return 0;
+	bits_log2 = get_be32(data + GIT_SHA1_RAWSZ);
+	if (bits_log2 < MIN_BITS_LOG2 || bits_log2 > MAX_BITS_LOG2)
+		return 0;
+	size = RECORD_HEADER_SIZE + filter_size(bits_log2);
+	if (len < size)
+		return 0;
+
+	e = xcalloc(1, sizeof(*e));
+	hashcpy(e->entry.oid.hash, data);
+	e->bits_log2 = bits_log2;
+	e->bits = data + RECORD_HEADER_SIZE;
+	add_entry(e);
+	return size;
+}
+
+static void load_trigram_index(void)
+{
+	char *filename;
+	const unsigned char *data;
+	struct stat st;
+	size_t pos;
+	int fd;
+
+	if (loaded)
+		return;
+	loaded = 1;
+	oidmap_init(&index_map, 0);
+
+	filename = trigram_index_filename();
+	fd = git_open(filename);
+	free(filename);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st)) {
+		close(fd);
+		index_readonly = 1;
+		return;
+	}
+	index_file_size = st.st_size;
+	if (xsize_t(st.st_size) < TRIGRAM_INDEX_HEADER_SIZE) {
+		close(fd);
+		return;
+	}
+	index_mmap_size = xsize_t(st.st_size);
+	index_mmap = xmmap(NULL, index_mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	data = index_mmap;
+	if (get_be32(data) != TRIGRAM_INDEX_SIGNATURE ||
+	    data[4] != TRIGRAM_INDEX_VERSION ||
+	    data[5] != TRIGRAM_INDEX_OID_VERSION) {
+		/* an index we do not understand is as good as no index */
+		munmap(index_mmap, index_mmap_size);
+		index_mmap = NULL;
+		index_readonly = 1;
+		return;
+	}
+
+	pos = TRIGRAM_INDEX_HEADER_SIZE;
+	while (pos < index_mmap_size) {
+		size_t len = parse_record(data + pos, index_mmap_size - pos);
+		if (!len)
+			break;
+		pos += len;
+	}
+	index_valid_end = pos;
+}
+
+const struct trigram_filter *trigram_index_lookup(const struct object_id *oid)
+{
+	struct trigram_filter *e;
+
+	if (!trigram_index_enabled())
+		return NULL;
+	load_trigram_index();
+
+	e = oidmap_get(&index_map, oid);
+	trace2_counter_add("grep", e ? "trigram-index/hits" :
+			   "trigram-index/misses", 1);
+	return e;
+}
+
+int trigram_filter_may_contain(const struct trigram_filter *filter,
+			       const char *s, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	size_t i;
+
+	for (i = 0; i + 3 <= len; i++) {
+		size_t bit = trigram_bit(trigram_hash(p + i), filter->bits_log2);
+
+		if (!(filter->bits[bit / 8] & (1 << (bit % 8))))
+			return 0;
+	}
+	return 1;
+}
+
+struct trigram_filter *trigram_filter_compute(const struct object_id *oid,
+					      const char *buf,
+					      unsigned long size)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	struct trigram_filter *e;
+	unsigned char *bits, *rec;
+	unsigned int max_log2 = MIN_BITS_LOG2, bits_log2 = MIN_BITS_LOG2;
+	size_t i, nr = 0;
+
+	/*
+	 * Set the bits of the trigrams in a filter with at least twice as
+	 * many bits as there are bytes, and count them to see how far we
+	 * can cut the filter down.
+	 */
+	while (max_log2 < MAX_BITS_LOG2 &&
+	       ((size_t)1 << max_log2) / 2 < size)
+		max_log2++;
+	bits = xcalloc(1, filter_size(max_log2));
+	for (i = 0; i + 3 <= size; i++) {
+		size_t bit = trigram_bit(trigram_hash(p + i), max_log2);
+
+		if (!(bits[bit / 8] & (1 << (bit % 8)))) {
+			bits[bit / 8] |= 1 << (bit % 8);
+			nr++;
+		}
+	}
+	while (bits_log2 < max_log2 && ((size_t)1 << bits_log2) / 2 < nr)
+		bits_log2++;
+
+	rec = xcalloc(1, RECORD_HEADER_SIZE + filter_size(bits_log2));
+	hashcpy(rec, oid->hash);
+	put_be32(rec + GIT_SHA1_RAWSZ, bits_log2);
+	for (i = 0; i < filter_size(max_log2); i++) {
+		size_t bit;
+		int j;
+
+		if (!bits[i])
+			continue;
+		for (j = 0; j < 8; j++) {
+			if (!(bits[i] & (1 << j)))
+				continue;
+			bit = (i * 8 + j) >> (max_log2 - bits_log2);
+			rec[RECORD_HEADER_SIZE + bit / 8] |= 1 << (bit % 8);
+		}
+	}
+	free(bits);
+
+	e = xcalloc(1, sizeof(*e));
+	oidcpy(&e->entry.oid, oid);
+	e->bits_log2 = bits_log2;
+	e->buf = rec;
+	e->bits = rec + RECORD_HEADER_SIZE;
+	return e;
+}
+
+void trigram_index_add(struct trigram_filter *filter)
+{
+	if (!trigram_index_enabled())
+		goto drop;
+	load_trigram_index();
+	if (oidmap_get(&index_map, &filter->entry.oid))
+		goto drop;
+
+	add_entry(filter);
+	ALLOC_GROW(pending, pending_nr + 1, pending_alloc);
+	pending[pending_nr++] = filter;
+	return;
+
+drop:
+	free(filter->buf);
+	free(filter);
+}
+
+void trigram_index_flush(void)
+{
+	struct lock_file lock = LOCK_INIT;
+	char *filename;
+	struct stat st;
+	int fd, i;
+
+	if (!pending_nr)
+		return;
+
+	/*
+	 * The lock only keeps two processes from appending at the same
+	 * time; the file itself is never replaced. If somebody else holds
+	 * it, or appended to the file since we read it, we will index
+	 * these blobs again next time.
+	 */
+	filename = trigram_index_filename();
+	if (index_readonly ||
+	    hold_lock_file_for_update(&lock, filename, 0) < 0)
+		goto out;
+	fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd < 0) {
+		rollback_lock_file(&lock);
+		goto out;
+	}
+	adjust_shared_perm(filename);
+	if (fstat(fd, &st) || st.st_size != index_file_size)
+		goto close_out;
+	if (index_valid_end < st.st_size && ftruncate(fd, index_valid_end))
+		goto close_out;
+	index_file_size = -1; /* until we know how much we wrote */
+	if (!index_valid_end) {
+		unsigned char hdr[TRIGRAM_INDEX_HEADER_SIZE] = { 0 };
+
+		put_be32(hdr, TRIGRAM_INDEX_SIGNATURE);
+		hdr[4] = TRIGRAM_INDEX_VERSION;
+		hdr[5] = TRIGRAM_INDEX_OID_VERSION;
+		if (write_in_full(fd, hdr, sizeof(hdr)) < 0)
+			goto close_out;
+		index_valid_end = sizeof(hdr);
+	}
+	for (i = 0; i < pending_nr; i++) {
+		struct trigram_filter *e = pending[i];
+		size_t len = RECORD_HEADER_SIZE + filter_size(e->bits_log2);
+
+		if (write_in_full(fd, e->buf, len) < 0)
+			goto close_out;
+		index_valid_end += len;
+	}
+	index_file_size = index_valid_end;
+close_out:
+	close(fd);
+	rollback_lock_file(&lock);
+out:
+	free(filename);
+	pending_nr = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+/*
+ * The trigram index keeps in $GIT_DIR/objects/info/trigram-index, for
+ * each blob that was searched, a filter of the sequences of three bytes
+ * it contains, so that later searches for a fixed string can skip the
+ * blobs that cannot contain it without reading them. It is only used
+ * when grep.trigramIndex is true.
+ *
+ * The trigrams are folded to lowercase ASCII, so that the same filter
+ * answers searches that ignore case and those that do not.
+ */
+
+struct object_id;
+struct trigram_filter;
+
+extern int trigram_index_enabled(void);
+
+/* Return the filter of the blob "oid", or NULL if it is not indexed. */
+extern const struct trigram_filter *trigram_index_lookup(const struct object_id *oid);
+
+/*
+ * Return 0 if the blob of "filter" cannot contain the string "s", and 1
+ * if it may.
+ */
+extern int trigram_filter_may_contain(const struct trigram_filter *filter,
+				      const char *s, size_t len);
+
+/*
+ * Compute the filter of the blob "oid" with the contents "buf". This
+ * does not touch the index, so it can run without holding the lock
+ * that callers from several threads must hold around the other
+ * functions.
+ */
+extern struct trigram_filter *trigram_filter_compute(const struct object_id *oid,
+						     const char *buf,
+						     unsigned long size);
+
+/* Remember "filter" in the index, which takes ownership of it. */
+extern void trigram_index_add(struct trigram_filter *filter);
+
+/* Append the filters remembered since the last call to the index file. */
+extern void trigram_index_flush(void);
+
+#endif
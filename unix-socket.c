@@ -121,3 +121,71 @@ int unix_stream_listen(const char *path)
 	errno = saved_errno;
 	return -1;
 }
+
+int unix_stream_send_fds(int sock, const int *fds, int nr)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte = 0;
+	char *control;
+	size_t size = sizeof(*fds) * nr;
+	int ret;
+
+	control = xcalloc(1, CMSG_SPACE(size));
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(size);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(size);
+	memcpy(CMSG_DATA(cmsg), fds, size);
+
+	do {
+		ret = sendmsg(sock, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+	free(control);
+	return ret == 1 ? 0 : -1;
+}
+
+int unix_stream_recv_fds(int sock, int *fds, int nr)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char byte;
+	char *control;
+	size_t size = sizeof(*fds) * nr;
+	int ret;
+
+	control = xcalloc(1, CMSG_SPACE(size));
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(size);
+
+	do {
+		ret = recvmsg(sock, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	cmsg = ret == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(size)) {
+		free(control);
+		errno = EPROTO;
+		return -1;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), size);
+	free(control);
+	return 0;
+}
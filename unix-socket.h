@@ -4,4 +4,12 @@
 int unix_stream_connect(const char *path);
 int unix_stream_listen(const char *path);
 
+/*
+ * Pass the "nr" descriptors in "fds" to the process at the other end
+ * of "sock", which receives its own copies of them (in the same order)
+ * with unix_stream_recv_fds().  Both return 0 on success, -1 on error.
+ */
+int unix_stream_send_fds(int sock, const int *fds, int nr);
+int unix_stream_recv_fds(int sock, int *fds, int nr);
+
 #endif /* UNIX_SOCKET_H */
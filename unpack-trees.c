@@ -16,8 +16,12 @@
 #include "submodule.h"
 #include "submodule-config.h"
 #include "fsmonitor.h"
+#include "sparse-index.h"
 #include "object-store.h"
 #include "fetch-object.h"
+#include "packfile.h"
+#include "parallel-checkout.h"
+#include "trace2.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -204,12 +208,16 @@ static int do_add_entry(struct unpack_trees_options *o, struct cache_entry *ce,
 			       ADD_CACHE_OK_TO_ADD | ADD_CACHE_OK_TO_REPLACE);
 }
 
-static struct cache_entry *dup_entry(const struct cache_entry *ce)
+static struct cache_entry *dup_entry(const struct cache_entry *ce,
+				     struct index_state *istate)
 {
 	unsigned int size = ce_size(ce);
-	struct cache_entry *new_entry = xmalloc(size);
+	int mem_pool_allocated;
+	struct cache_entry *new_entry = make_empty_cache_entry(istate, ce_namelen(ce));
+	mem_pool_allocated = new_entry->mem_pool_allocated;
 
 	memcpy(new_entry, ce, size);
+	new_entry->mem_pool_allocated = mem_pool_allocated;
 	return new_entry;
 }
 
@@ -217,7 +225,7 @@ static void add_entry(struct unpack_trees_options *o,
 		      const struct cache_entry *ce,
 		      unsigned int set, unsigned int clear)
 {
-	do_add_entry(o, dup_entry(ce), set, clear);
+	do_add_entry(o, dup_entry(ce, &o->result), set, clear);
 }
 
 /*
@@ -352,7 +360,7 @@ static int check_updates(struct unpack_trees_options *o)
 	struct progress *progress = NULL;
 	struct index_state *index = &o->result;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	state.force = 1;
 	state.quiet = 1;
@@ -382,27 +390,26 @@ static int check_updates(struct unpack_trees_options *o)
 	if (should_update_submodules() && o->update && !o->dry_run)
 		load_gitmodules_file(index, &state);
 
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+
 	enable_delayed_checkout(&state);
-	if (repository_format_partial_clone && o->update && !o->dry_run) {
+	if (pc_workers > 1)
+		init_parallel_checkout();
+	if (o->update && !o->dry_run) {
 		/*
 		 * Prefetch the objects that are to be checked out in the loop
-		 * below.
+		 * below, showing the progress of the fetch when we show that
+		 * of the checkout, and have them read ahead from the packs.
 		 */
 		struct oid_array to_fetch = OID_ARRAY_INIT;
-		int fetch_if_missing_store = fetch_if_missing;
-		fetch_if_missing = 0;
 		for (i = 0; i < index->cache_nr; i++) {
 			struct cache_entry *ce = index->cache[i];
 			if ((ce->ce_flags & CE_UPDATE) &&
-			    !S_ISGITLINK(ce->ce_mode)) {
-				if (!has_object_file(&ce->oid))
-					oid_array_append(&to_fetch, &ce->oid);
-			}
+			    !S_ISGITLINK(ce->ce_mode))
+				oid_array_append(&to_fetch, &ce->oid);
 		}
-		if (to_fetch.nr)
-			fetch_objects(repository_format_partial_clone,
-				      &to_fetch);
-		fetch_if_missing = fetch_if_missing_store;
+		prefetch_objects(&to_fetch, o->verbose_update);
+		readahead_packed_objects(the_repository, &to_fetch);
 		oid_array_clear(&to_fetch);
 	}
 	for (i = 0; i < index->cache_nr; i++) {
@@ -419,6 +426,8 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	if (pc_workers > 1)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state);
 	if (o->update)
@@ -777,6 +786,15 @@ static int compare_entry(const struct cache_entry *ce, const struct traverse_inf
 	if (cmp)
 		return cmp;
 
+	/*
+	 * At this point, we know that we have a prefix match. A sparse
+	 * directory entry matches the directory of the same name
+	 * exactly, as its name merely carries the trailing slash.
+	 */
+	if (S_ISSPARSEDIR(ce->ce_mode) && S_ISDIR(n->mode) &&
+	    ce_namelen(ce) == traverse_path_len(info, n) + 1)
+		return 0;
+
 	/*
 	 * Even if the beginning compared identically, the ce should
 	 * compare as bigger than a directory leading up to it!
@@ -784,6 +802,18 @@ static int compare_entry(const struct cache_entry *ce, const struct traverse_inf
 	return ce_namelen(ce) > traverse_path_len(info, n);
 }
 
+/*
+ * Is "ce" a sparse directory entry standing for the directory "n" of
+ * the trees being traversed?
+ */
+static int is_sparse_directory_entry(const struct cache_entry *ce,
+				     const struct name_entry *n,
+				     const struct traverse_info *info)
+{
+	return ce && S_ISSPARSEDIR(ce->ce_mode) && S_ISDIR(n->mode) &&
+		ce_namelen(ce) == traverse_path_len(info, n) + 1;
+}
+
 static int ce_in_traverse_path(const struct cache_entry *ce,
 			       const struct traverse_info *info)
 {
@@ -798,10 +828,19 @@ static int ce_in_traverse_path(const struct cache_entry *ce,
 	return (info->pathlen < ce_namelen(ce));
 }
 
-static struct cache_entry *create_ce_entry(const struct traverse_info *info, const struct name_entry *n, int stage)
+static struct cache_entry *create_ce_entry(const struct traverse_info *info,
+					   const struct name_entry *n,
+					   int stage,
+					   struct index_state *istate,
+					   int is_transient,
+					   int is_sparse_directory)
 {
 	int len = traverse_path_len(info, n);
-	struct cache_entry *ce = xcalloc(1, cache_entry_size(len));
+	int alloc_len = is_sparse_directory ? len + 1 : len;
+	struct cache_entry *ce =
+		is_transient ?
+		make_empty_transient_cache_entry(alloc_len) :
+		make_empty_cache_entry(istate, alloc_len);
 
 	ce->ce_mode = create_ce_mode(n->mode);
 	ce->ce_flags = create_ce_flags(stage);
@@ -809,6 +848,14 @@ static struct cache_entry *create_ce_entry(const struct traverse_info *info, con
 	oidcpy(&ce->oid, n->oid);
 	make_traverse_path(ce->name, info, n);
 
+	if (is_sparse_directory) {
+		ce->name[len] = '/';
+		ce->name[len + 1] = '\0';
+		ce->ce_namelen++;
+		ce->ce_mode = S_IFDIR;
+		ce->ce_flags |= CE_SKIP_WORKTREE;
+	}
+
 	return ce;
 }
 
@@ -826,6 +873,13 @@ static int unpack_nondirectories(int n, unsigned long mask,
 	if (mask == dirmask && !src[0])
 		return 0;
 
+	/*
+	 * A sparse directory entry of the index is compared with the
+	 * trees of the same directory as a whole.
+	 */
+	if (src[0] && S_ISSPARSEDIR(src[0]->ce_mode))
+		conflicts &= ~dirmask;
+
 	/*
 	 * Ok, we've filled in up to any potential index entry in src[0],
 	 * now do the rest.
@@ -847,7 +901,9 @@ static int unpack_nondirectories(int n, unsigned long mask,
 			stage = 3;
 		else
 			stage = 2;
-		src[i + o->merge] = create_ce_entry(info, names + i, stage);
+		src[i + o->merge] = create_ce_entry(info, names + i, stage,
+						    &o->result, o->merge,
+						    bit & dirmask);
 	}
 
 	if (o->merge) {
@@ -856,7 +912,7 @@ static int unpack_nondirectories(int n, unsigned long mask,
 		for (i = 0; i < n; i++) {
 			struct cache_entry *ce = src[i + o->merge];
 			if (ce != o->df_conflict_entry)
-				free(ce);
+				discard_cache_entry(ce);
 		}
 		return rc;
 	}
@@ -996,11 +1052,180 @@ static void debug_unpack_callback(int n,
 		debug_name_entry(i, names + i);
 }
 
+/*
+ * The directories of the last tree that the result of a one- or
+ * two-way merge takes over whole keep the tree of that directory as
+ * their cache-tree, instead of having it computed again from the
+ * entries of the result.
+ *
+ * For each file of that tree, in the order of the traversal, "leaf"
+ * has the entry the merge put in the result for it, if that is the
+ * file of the tree unchanged, and NULL otherwise.  For each directory
+ * of the tree, "dir" has its tree and the range of "leaf" it covers.
+ * Once the result is final, a directory is taken over whole if its
+ * entries in the result are exactly those of its range.
+ */
+struct carried_dir {
+	char *path; /* with a trailing slash */
+	int pathlen;
+	struct object_id oid;
+	int start, end;
+};
+
+struct unpack_trees_carry {
+	int tree;
+	const struct cache_entry **leaf;
+	int leaf_nr, leaf_alloc;
+	struct carried_dir *dir;
+	int dir_nr, dir_alloc;
+	char *path;
+	int path_alloc;
+};
+
+static const char *carry_path(struct unpack_trees_carry *c,
+			      const struct traverse_info *info,
+			      const struct name_entry *n)
+{
+	int len = traverse_path_len(info, n);
+
+	ALLOC_GROW(c->path, len + 2, c->path_alloc);
+	make_traverse_path(c->path, info, n);
+	return c->path;
+}
+
+static void carry_leaf(struct unpack_trees_options *o,
+		       const struct traverse_info *info,
+		       const struct name_entry *n)
+{
+	struct unpack_trees_carry *c = o->carry;
+	struct index_state *result = &o->result;
+	const char *path = carry_path(c, info, n);
+	int len = traverse_path_len(info, n);
+	const struct cache_entry *ce = NULL;
+
+	/* the merge most often has just appended it */
+	if (result->cache_nr) {
+		const struct cache_entry *last = result->cache[result->cache_nr - 1];
+		if (ce_namelen(last) == len && !memcmp(last->name, path, len))
+			ce = last;
+	}
+	if (!ce) {
+		int pos = index_name_pos(result, path, len);
+		if (pos >= 0)
+			ce = result->cache[pos];
+	}
+	if (ce && (ce_stage(ce) || (ce->ce_flags & CE_REMOVE) ||
+		   ce->ce_mode != create_ce_mode(n->mode) ||
+		   oidcmp(&ce->oid, n->oid)))
+		ce = NULL;
+
+	ALLOC_GROW(c->leaf, c->leaf_nr + 1, c->leaf_alloc);
+	c->leaf[c->leaf_nr++] = ce;
+}
+
+static void carry_dir(struct unpack_trees_options *o,
+		      const struct traverse_info *info,
+		      const struct name_entry *n, int start)
+{
+	struct unpack_trees_carry *c = o->carry;
+	int len = traverse_path_len(info, n);
+	struct carried_dir *d;
+	char *path;
+
+	path = xmallocz(len + 1);
+	memcpy(path, carry_path(c, info, n), len);
+	path[len] = '/';
+
+	ALLOC_GROW(c->dir, c->dir_nr + 1, c->dir_alloc);
+	d = &c->dir[c->dir_nr++];
+	d->path = path;
+	d->pathlen = len + 1;
+	oidcpy(&d->oid, n->oid);
+	d->start = start;
+	d->end = c->leaf_nr;
+}
+
+static int carried_dir_cmp(const void *a_, const void *b_)
+{
+	const struct carried_dir *a = a_, *b = b_;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Return how many entries the result has under "d", or -1 if they are
+ * not the files of its tree.
+ */
+static int carried_dir_entries(const struct index_state *result,
+			       const struct unpack_trees_carry *c,
+			       const struct carried_dir *d)
+{
+	int pos = index_name_pos(result, d->path, d->pathlen);
+	int j = d->start;
+
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < result->cache_nr; pos++) {
+		const struct cache_entry *ce = result->cache[pos];
+
+		if (ce_namelen(ce) < d->pathlen ||
+		    memcmp(ce->name, d->path, d->pathlen))
+			break;
+		if (j == d->end || c->leaf[j] != ce)
+			return -1;
+		j++;
+	}
+	return j == d->end ? d->end - d->start : -1;
+}
+
+static void carry_cache_tree(struct unpack_trees_options *o)
+{
+	struct unpack_trees_carry *c = o->carry;
+	int i, carried = 0;
+
+	/* each directory before those in it */
+	QSORT(c->dir, c->dir_nr, carried_dir_cmp);
+	for (i = 0; i < c->dir_nr; i++) {
+		const struct carried_dir *d = &c->dir[i];
+		int j;
+
+		if (carried_dir_entries(&o->result, c, d) < 0)
+			continue;
+		/* then those in it hold the files of their trees, too */
+		for (j = i; j < c->dir_nr && starts_with(c->dir[j].path, d->path); j++) {
+			struct carried_dir *sub = &c->dir[j];
+
+			sub->path[sub->pathlen - 1] = '\0';
+			cache_tree_prime_path(o->result.cache_tree, sub->path,
+					      sub->end - sub->start, &sub->oid);
+			sub->path[sub->pathlen - 1] = '/';
+			carried++;
+		}
+		i = j - 1;
+	}
+	trace2_data_intmax("unpack_trees", "carried_trees", carried);
+}
+
+static void free_carry(struct unpack_trees_options *o)
+{
+	struct unpack_trees_carry *c = o->carry;
+	int i;
+
+	if (!c)
+		return;
+	for (i = 0; i < c->dir_nr; i++)
+		free(c->dir[i].path);
+	free(c->dir);
+	free(c->leaf);
+	free(c->path);
+	FREE_AND_NULL(o->carry);
+}
+
 static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, struct name_entry *names, struct traverse_info *info)
 {
 	struct cache_entry *src[MAX_UNPACK_TREES + 1] = { NULL, };
 	struct unpack_trees_options *o = info->data;
 	const struct name_entry *p = names;
+	int start;
 
 	/* Find first entry with a real name (we could use "mask" too) */
 	while (!p->mode)
@@ -1057,8 +1282,15 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 			mark_ce_used(src[0], o);
 	}
 
+	if (o->carry && (mask & ~dirmask & (1ul << o->carry->tree)))
+		carry_leaf(o, info, names + o->carry->tree);
+
 	/* Now handle any directories.. */
 	if (dirmask) {
+		/* a sparse directory entry has been dealt with as a whole */
+		if (is_sparse_directory_entry(src[0], p, info))
+			return mask;
+
 		/* special case: "diff-index --cached" looking at a tree */
 		if (o->diff_index_cached &&
 		    n == 1 && dirmask == 1 && S_ISDIR(names->mode)) {
@@ -1077,9 +1309,12 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 			}
 		}
 
+		start = o->carry ? o->carry->leaf_nr : 0;
 		if (traverse_trees_recursive(n, dirmask, mask & ~dirmask,
 					     names, info) < 0)
 			return -1;
+		if (o->carry && (dirmask & (1ul << o->carry->tree)))
+			carry_dir(o, info, names + o->carry->tree, start);
 		return mask;
 	}
 
@@ -1122,11 +1357,25 @@ static int clear_ce_flags_dir(struct cache_entry **cache, int nr,
 	 * decision for the entire directory), clear flag here without
 	 * calling clear_ce_flags_1(). That function will call
 	 * the expensive is_excluded_from_list() on every entry.
+	 *
+	 * Cone patterns do tell us so for the directories that are
+	 * included recursively or not at all.
 	 */
-	rc = clear_ce_flags_1(cache, cache_end - cache,
-			      prefix,
-			      select_mask, clear_mask,
-			      el, ret);
+	if (el->use_cone_patterns && ret == MATCHED_RECURSIVE) {
+		struct cache_entry **ce;
+
+		for (ce = cache; ce != cache_end; ce++)
+			if (!select_mask || ((*ce)->ce_flags & select_mask))
+				(*ce)->ce_flags &= ~clear_mask;
+		rc = cache_end - cache;
+	} else if (el->use_cone_patterns && ret == NOT_MATCHED) {
+		rc = cache_end - cache;
+	} else {
+		rc = clear_ce_flags_1(cache, cache_end - cache,
+				      prefix,
+				      select_mask, clear_mask,
+				      el, ret);
+	}
 	strbuf_setlen(prefix, prefix->len - 1);
 	return rc;
 }
@@ -1279,11 +1528,21 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
 
+	/*
+	 * Only "diff-index --cached" knows how to compare the trees with
+	 * the sparse directory entries of the index.
+	 */
+	if (!o->diff_index_cached)
+		ensure_full_index(o->src_index);
+
+	trace2_region_enter("unpack_trees", "unpack_trees");
 	memset(&el, 0, sizeof(el));
 	if (!core_apply_sparse_checkout || !o->update)
 		o->skip_sparse_checkout = 1;
 	if (!o->skip_sparse_checkout) {
 		char *sparse = git_pathdup("info/sparse-checkout");
+
+		el.use_cone_patterns = core_sparse_checkout_cone;
 		if (add_excludes_from_file_to_list(sparse, "", 0, &el, NULL) < 0)
 			o->skip_sparse_checkout = 1;
 		else
@@ -1314,6 +1573,18 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	o->merge_size = len;
 	mark_all_ce_unused(o->src_index);
 
+	/*
+	 * The result of a one- or two-way merge is mostly the last tree;
+	 * see "struct unpack_trees_carry".  With a pathspec, the files of
+	 * the tree outside of it are not seen.
+	 */
+	o->carry = NULL;
+	if (len && o->dst_index && !o->pathspec &&
+	    (o->fn == oneway_merge || o->fn == twoway_merge)) {
+		o->carry = xcalloc(1, sizeof(*o->carry));
+		o->carry->tree = len - 1;
+	}
+
 	/*
 	 * Sparse checkout loop #1: set NEW_SKIP_WORKTREE on existing entries
 	 */
@@ -1321,7 +1592,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		mark_new_skip_worktree(o->el, o->src_index, 0, CE_NEW_SKIP_WORKTREE);
 
 	if (!dfc)
-		dfc = xcalloc(1, cache_entry_size(0));
+		dfc = make_empty_transient_cache_entry(0);
 	o->df_conflict_entry = dfc;
 
 	if (len) {
@@ -1429,6 +1700,8 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		if (!ret) {
 			if (!o->result.cache_tree)
 				o->result.cache_tree = cache_tree();
+			if (o->carry)
+				carry_cache_tree(o);
 			if (!cache_tree_fully_valid(o->result.cache_tree))
 				cache_tree_update(&o->result,
 						  WRITE_TREE_SILENT |
@@ -1443,7 +1716,9 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	o->src_index = NULL;
 
 done:
+	free_carry(o);
 	clear_exclude_list(&el);
+	trace2_region_leave("unpack_trees", "unpack_trees");
 	return ret;
 
 return_failed:
@@ -1788,7 +2063,7 @@ static int merged_entry(const struct cache_entry *ce,
 			struct unpack_trees_options *o)
 {
 	int update = CE_UPDATE;
-	struct cache_entry *merge = dup_entry(ce);
+	struct cache_entry *merge = dup_entry(ce, &o->result);
 
 	if (!old) {
 		/*
@@ -1808,7 +2083,7 @@ static int merged_entry(const struct cache_entry *ce,
 
 		if (verify_absent(merge,
 				  ERROR_WOULD_LOSE_UNTRACKED_OVERWRITTEN, o)) {
-			free(merge);
+			discard_cache_entry(merge);
 			return -1;
 		}
 		invalidate_ce_path(merge, o);
@@ -1834,7 +2109,7 @@ static int merged_entry(const struct cache_entry *ce,
 			update = 0;
 		} else {
 			if (verify_uptodate(old, o)) {
-				free(merge);
+				discard_cache_entry(merge);
 				return -1;
 			}
 			/* Migrate old flags over */
@@ -8,6 +8,7 @@
 
 struct unpack_trees_options;
 struct exclude_list;
+struct unpack_trees_carry;
 
 typedef int (*merge_fn_t)(const struct cache_entry * const *src,
 		struct unpack_trees_options *options);
@@ -80,6 +81,7 @@ struct unpack_trees_options {
 	struct index_state result;
 
 	struct exclude_list *el; /* for internal use */
+	struct unpack_trees_carry *carry; /* for internal use */
 };
 
 extern int unpack_trees(unsigned n, struct tree_desc *t,
@@ -7,6 +7,8 @@
 #include "tag.h"
 #include "object.h"
 #include "commit.h"
+#include "commit-graph.h"
+#include "commit-reach.h"
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
@@ -18,18 +20,21 @@
 #include "version.h"
 #include "string-list.h"
 #include "argv-array.h"
-#include "prio-queue.h"
 #include "protocol.h"
 #include "quote.h"
 #include "upload-pack.h"
 #include "serve.h"
+#include "lockfile.h"
+#include "dir.h"
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
 #define OUR_REF		(1u << 12)
 #define WANTED		(1u << 13)
 #define COMMON_KNOWN	(1u << 14)
-#define REACHABLE	(1u << 15)
 
 #define SHALLOW		(1u << 16)
 #define NOT_SHALLOW	(1u << 17)
@@ -37,6 +42,7 @@
 #define HIDDEN_REF	(1u << 19)
 
 static timestamp_t oldest_have;
+static timestamp_t oldest_have_generation = GENERATION_NUMBER_INFINITY;
 
 static int deepen_relative;
 static int multi_ack;
@@ -65,9 +71,24 @@ static const char *pack_objects_hook;
 
 static int filter_capability_requested;
 static int allow_filter;
+static int allow_packfile_uris;
 static int allow_ref_in_want;
 static struct list_objects_filter_options filter_options;
 
+/*
+ * The protocols of the packfile URIs that the client can download from,
+ * if any; only used by protocol v2.
+ */
+static struct string_list uri_protocols = STRING_LIST_INIT_DUP;
+
+/*
+ * Packs generated for a request are kept below "upload-pack-cache" and
+ * replayed to identical requests made within pack_cache_ttl seconds.
+ * The cache is disabled unless pack_cache_max_size is set.
+ */
+static unsigned long pack_cache_max_size;
+static unsigned long pack_cache_ttl = 60;
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -98,16 +119,329 @@ static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 	return 0;
 }
 
-static void create_pack_file(void)
+/*
+ * Send the "packfile-uris" section for the lines that pack-objects
+ * writes before the pack in "buf", and consume them. Return 1 once the
+ * pack starts, after sending the "packfile" section header.
+ */
+static int send_packfile_uris(struct strbuf *buf, int *uris_sent)
+{
+	for (;;) {
+		char *eol;
+
+		if (buf->len >= 4 && !memcmp(buf->buf, "PACK", 4)) {
+			if (*uris_sent)
+				packet_delim(1);
+			packet_write_fmt(1, "packfile\n");
+			return 1;
+		}
+
+		eol = memchr(buf->buf, '\n', buf->len);
+		if (!eol)
+			return 0;
+		if (!*uris_sent) {
+			packet_write_fmt(1, "packfile-uris\n");
+			*uris_sent = 1;
+		}
+		*eol = '\0';
+		packet_write_fmt(1, "%s\n", buf->buf);
+		strbuf_remove(buf, 0, eol - buf->buf + 1);
+	}
+}
+
+static void write_pack_objects_input(int fd)
+{
+	FILE *pipe_fd = xfdopen(fd, "w");
+	int i;
+
+	if (shallow_nr)
+		for_each_commit_graft(write_one_shallow, pipe_fd);
+
+	for (i = 0; i < want_obj.nr; i++)
+		fprintf(pipe_fd, "%s\n",
+			oid_to_hex(&want_obj.objects[i].item->oid));
+	fprintf(pipe_fd, "--not\n");
+	for (i = 0; i < have_obj.nr; i++)
+		fprintf(pipe_fd, "%s\n",
+			oid_to_hex(&have_obj.objects[i].item->oid));
+	for (i = 0; i < extra_edge_obj.nr; i++)
+		fprintf(pipe_fd, "%s\n",
+			oid_to_hex(&extra_edge_obj.objects[i].item->oid));
+	fprintf(pipe_fd, "\n");
+	fflush(pipe_fd);
+	fclose(pipe_fd);
+}
+
+static int hash_one_oid(const struct object_id *oid, void *data)
+{
+	the_hash_algo->update_fn(data, oid->hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static void hash_object_array(git_hash_ctx *ctx, const char *name,
+			      const struct object_array *objs)
+{
+	struct oid_array sorted = OID_ARRAY_INIT;
+	int i;
+
+	for (i = 0; i < objs->nr; i++)
+		oid_array_append(&sorted, &objs->objects[i].item->oid);
+	the_hash_algo->update_fn(ctx, name, strlen(name) + 1);
+	oid_array_for_each_unique(&sorted, hash_one_oid, ctx);
+	oid_array_clear(&sorted);
+}
+
+static int hash_one_shallow(const struct commit_graft *graft, void *data)
+{
+	if (graft->nr_parent == -1)
+		hash_one_oid(&graft->oid, data);
+	return 0;
+}
+
+/*
+ * Return the path of the cached pack for the current request, which
+ * pack-objects is run for with "args". The order of the objects the
+ * client sent does not matter, and neither does "--progress", which
+ * only changes what pack-objects writes to stderr.
+ */
+static char *pack_cache_path(const struct argv_array *args)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	int i;
+
+	the_hash_algo->init_fn(&ctx);
+	for (i = 0; i < args->argc; i++) {
+		if (!strcmp(args->argv[i], "--progress"))
+			continue;
+		the_hash_algo->update_fn(&ctx, args->argv[i],
+					 strlen(args->argv[i]) + 1);
+	}
+	hash_object_array(&ctx, "want", &want_obj);
+	hash_object_array(&ctx, "have", &have_obj);
+	hash_object_array(&ctx, "edge", &extra_edge_obj);
+	the_hash_algo->update_fn(&ctx, "shallow", strlen("shallow") + 1);
+	if (shallow_nr)
+		for_each_commit_graft(hash_one_shallow, &ctx);
+	the_hash_algo->final_fn(hash, &ctx);
+
+	return git_pathdup("upload-pack-cache/%s.pack", sha1_to_hex(hash));
+}
+
+static int open_cached_pack(const char *path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_mtime + pack_cache_ttl < time(NULL)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+struct cached_pack {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int cached_pack_cmp(const void *a_, const void *b_)
+{
+	const struct cached_pack *a = a_, *b = b_;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Remove the expired packs from the cache, then the oldest ones until
+ * there is room for "incoming" more bytes.
+ */
+static void prune_pack_cache(off_t incoming)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct cached_pack *packs = NULL;
+	int nr = 0, alloc = 0, i;
+	time_t now = time(NULL);
+	off_t total = 0;
+	size_t dirlen;
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_addstr(&path, git_path("upload-pack-cache"));
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		if (stat(path.buf, &st))
+			continue;
+		if (st.st_mtime + pack_cache_ttl < now) {
+			unlink_or_warn(path.buf);
+			continue;
+		}
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = xstrdup(path.buf);
+		packs[nr].mtime = st.st_mtime;
+		packs[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(packs, nr, cached_pack_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total + incoming > pack_cache_max_size &&
+		    !unlink_or_warn(packs[i].path))
+			total -= packs[i].size;
+		free(packs[i].path);
+	}
+	free(packs);
+	strbuf_release(&path);
+}
+
+/*
+ * Add the "len" bytes at "buf" that pack-objects wrote to the pack being
+ * cached, unless the pack gets too large to be cached.
+ */
+static void cache_pack_data(struct lock_file *lk, off_t *cached_size,
+			    const char *buf, ssize_t len)
+{
+	if (!is_lock_file_locked(lk))
+		return;
+	*cached_size += len;
+	if (*cached_size > pack_cache_max_size ||
+	    write_in_full(get_lock_file_fd(lk), buf, len) < 0)
+		rollback_lock_file(lk);
+}
+
+/*
+ * Without a sideband to frame it in, the pack can go to the client
+ * without being copied through our memory. These return the number of
+ * bytes they moved, or 0 if the caller should read() instead, and
+ * clear "*usable" if the kernel cannot do it for these descriptors.
+ * "*buffered" is the byte held back from an earlier read(), if any,
+ * which goes out first.
+ */
+static void send_buffered_byte(int *buffered)
+{
+	char c;
+
+	if (*buffered < 0)
+		return;
+	c = *buffered;
+	write_or_die(1, &c, 1);
+	*buffered = -1;
+}
+
+static ssize_t splice_pack_data(int in, int *buffered, int *usable)
+{
+#ifdef HAVE_SPLICE
+	int avail;
+	ssize_t sz;
+
+	/*
+	 * Leave the last byte in the pipe, so that the read() that gets
+	 * it can hold it back until pack-objects is known to have
+	 * succeeded, as for the data that goes through our memory.
+	 */
+	if (!*usable || ioctl(in, FIONREAD, &avail) || avail <= 1)
+		return 0;
+	send_buffered_byte(buffered);
+	sz = splice(in, NULL, 1, NULL, avail - 1, SPLICE_F_MOVE);
+	if (sz < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		if (errno == EINVAL || errno == ENOSYS) {
+			*usable = 0;
+			return 0;
+		}
+		check_pipe(errno);
+		die_errno("write error");
+	}
+	return sz;
+#else
+	*usable = 0;
+	return 0;
+#endif
+}
+
+/* A cached pack is known to be complete; send all of it at once */
+static ssize_t sendfile_pack_data(int in, int *buffered, int *usable)
+{
+#ifdef HAVE_SENDFILE
+	struct stat st;
+	off_t pos = lseek(in, 0, SEEK_CUR);
+	ssize_t sz, total = 0;
+
+	if (!*usable || pos < 0 || fstat(in, &st))
+		return 0;
+	send_buffered_byte(buffered);
+	while (pos < st.st_size) {
+		sz = sendfile(1, in, &pos, st.st_size - pos);
+		if (sz < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (!total && (errno == EINVAL || errno == ENOSYS)) {
+				*usable = 0;
+				return 0;
+			}
+			check_pipe(errno);
+			die_errno("write error");
+		}
+		if (!sz)
+			break;
+		total += sz;
+	}
+	/* sendfile() does not move the offset of "in" */
+	if (lseek(in, pos, SEEK_SET) < 0)
+		die_errno("unable to seek in the cached pack");
+	return total;
+#else
+	*usable = 0;
+	return 0;
+#endif
+}
+
+/*
+ * With "write_packfile_line", the pack is sent as the "packfile" section
+ * of a protocol v2 response, which may be preceded by a "packfile-uris"
+ * section if the client gave us uri_protocols.
+ */
+static void create_pack_file(int write_packfile_line)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
-	char data[8193], progress[128];
+	char data[LARGE_PACKET_DATA_MAX], progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
 	int buffered = -1;
 	ssize_t sz;
 	int i;
-	FILE *pipe_fd;
+	struct lock_file cache_lock = LOCK_INIT;
+	off_t cached_size = 0;
+	int from_cache = 0;
+	/*
+	 * Until pack-objects is done writing packfile URIs, nothing can be
+	 * sent on the sideband; progress is held back in "held_progress".
+	 */
+	int packfile_started = !write_packfile_line || !uri_protocols.nr;
+	int uris_sent = 0;
+	struct strbuf before_pack = STRBUF_INIT;
+	struct strbuf held_progress = STRBUF_INIT;
+	int zero_copy;
 
 	if (!pack_objects_hook)
 		pack_objects.git_cmd = 1;
@@ -146,32 +480,39 @@ static void create_pack_file(void)
 					 filter_options.filter_spec);
 		}
 	}
+	for (i = 0; write_packfile_line && i < uri_protocols.nr; i++)
+		argv_array_pushf(&pack_objects.args, "--uri-protocol=%s",
+				 uri_protocols.items[i].string);
 
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
 
-	if (start_command(&pack_objects))
-		die("git upload-pack: unable to fork git-pack-objects");
+	if (pack_cache_max_size) {
+		char *path = pack_cache_path(&pack_objects.args);
+		int fd = open_cached_pack(path);
+
+		if (fd >= 0) {
+			/* replay the cached output instead */
+			from_cache = 1;
+			pack_objects.out = fd;
+		} else if (!safe_create_leading_directories(path)) {
+			/* someone else may be caching it already; that is OK */
+			hold_lock_file_for_update(&cache_lock, path, 0);
+		}
+		free(path);
+	}
 
-	pipe_fd = xfdopen(pack_objects.in, "w");
+	if (!from_cache && start_command(&pack_objects))
+		die("git upload-pack: unable to fork git-pack-objects");
+	/* what is written to the cache has to be read */
+	zero_copy = !use_sideband && !is_lock_file_locked(&cache_lock);
 
-	if (shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
+	if (write_packfile_line && packfile_started)
+		packet_write_fmt(1, "packfile\n");
 
-	for (i = 0; i < want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&want_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "--not\n");
-	for (i = 0; i < have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&have_obj.objects[i].item->oid));
-	for (i = 0; i < extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&extra_edge_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "\n");
-	fflush(pipe_fd);
-	fclose(pipe_fd);
+	if (!from_cache)
+		write_pack_objects_input(pack_objects.in);
 
 	/* We read from pack_objects.err to capture stderr output for
 	 * progress bar, and pack_objects.out to capture the pack data.
@@ -219,7 +560,9 @@ static void create_pack_file(void)
 			 */
 			sz = xread(pack_objects.err, progress,
 				  sizeof(progress));
-			if (0 < sz)
+			if (0 < sz && !packfile_started)
+				strbuf_add(&held_progress, progress, sz);
+			else if (0 < sz)
 				send_client_data(2, progress, sz);
 			else if (sz == 0) {
 				close(pack_objects.err);
@@ -230,6 +573,38 @@ static void create_pack_file(void)
 			/* give priority to status messages */
 			continue;
 		}
+		if (0 <= pu && (pfd[pu].revents & (POLLIN|POLLHUP)) &&
+		    !packfile_started) {
+			sz = xread(pack_objects.out, data, sizeof(data));
+			if (sz < 0)
+				goto fail;
+			if (!sz) {
+				close(pack_objects.out);
+				pack_objects.out = -1;
+				continue;
+			}
+			cache_pack_data(&cache_lock, &cached_size, data, sz);
+			strbuf_add(&before_pack, data, sz);
+			if (!send_packfile_uris(&before_pack, &uris_sent))
+				continue;
+
+			packfile_started = 1;
+			if (held_progress.len)
+				send_client_data(2, held_progress.buf,
+						 held_progress.len);
+			/* the pack is at least 4 bytes long here */
+			buffered = before_pack.buf[before_pack.len - 1] & 0xFF;
+			send_client_data(1, before_pack.buf, before_pack.len - 1);
+			strbuf_release(&before_pack);
+			strbuf_release(&held_progress);
+			continue;
+		}
+		if (0 <= pu && (pfd[pu].revents & (POLLIN|POLLHUP)) &&
+		    zero_copy &&
+		    (from_cache ?
+		     sendfile_pack_data(pack_objects.out, &buffered, &zero_copy) :
+		     splice_pack_data(pack_objects.out, &buffered, &zero_copy)) > 0)
+			continue;
 		if (0 <= pu && (pfd[pu].revents & (POLLIN|POLLHUP))) {
 			/* Data ready; we keep the last byte to ourselves
 			 * in case we detect broken rev-list, so that we
@@ -249,7 +624,8 @@ static void create_pack_file(void)
 			sz = xread(pack_objects.out, cp,
 				  sizeof(data) - outsz);
 			if (0 < sz)
-				;
+				cache_pack_data(&cache_lock, &cached_size,
+						cp, sz);
 			else if (sz == 0) {
 				close(pack_objects.out);
 				pack_objects.out = -1;
@@ -276,16 +652,25 @@ static void create_pack_file(void)
 		 * protocol to say anything, so those clients are just out of
 		 * luck.
 		 */
-		if (!ret && use_sideband) {
+		if (!ret && use_sideband && packfile_started) {
 			static const char buf[] = "0005\1";
 			write_or_die(1, buf, 5);
 		}
 	}
 
-	if (finish_command(&pack_objects)) {
+	if (!from_cache && finish_command(&pack_objects)) {
 		error("git upload-pack: git-pack-objects died with error.");
 		goto fail;
 	}
+	if (!packfile_started) {
+		error("git upload-pack: git-pack-objects did not write a pack.");
+		goto fail;
+	}
+	if (is_lock_file_locked(&cache_lock)) {
+		prune_pack_cache(cached_size);
+		if (commit_lock_file(&cache_lock))
+			warning_errno("unable to cache the pack");
+	}
 
 	/* flush the data */
 	if (0 <= buffered) {
@@ -324,10 +709,18 @@ static int got_oid(const char *hex, struct object_id *oid)
 			o->flags |= THEY_HAVE;
 		if (!oldest_have || (commit->date < oldest_have))
 			oldest_have = commit->date;
+		if (commit->generation < oldest_have_generation)
+			oldest_have_generation = commit->generation;
 		for (parents = commit->parents;
 		     parents;
-		     parents = parents->next)
-			parents->item->object.flags |= THEY_HAVE;
+		     parents = parents->next) {
+			struct commit *parent = parents->item;
+
+			parent->object.flags |= THEY_HAVE;
+			load_commit_graph_info(parent);
+			if (parent->generation < oldest_have_generation)
+				oldest_have_generation = parent->generation;
+		}
 	}
 	if (!we_knew_they_have) {
 		add_object_array(o, NULL, &have_obj);
@@ -336,64 +729,17 @@ static int got_oid(const char *hex, struct object_id *oid)
 	return 0;
 }
 
-static int reachable(struct commit *want)
-{
-	struct prio_queue work = { compare_commits_by_commit_date };
-
-	prio_queue_put(&work, want);
-	while (work.nr) {
-		struct commit_list *list;
-		struct commit *commit = prio_queue_get(&work);
-
-		if (commit->object.flags & THEY_HAVE) {
-			want->object.flags |= COMMON_KNOWN;
-			break;
-		}
-		if (!commit->object.parsed)
-			parse_object(&commit->object.oid);
-		if (commit->object.flags & REACHABLE)
-			continue;
-		commit->object.flags |= REACHABLE;
-		if (commit->date < oldest_have)
-			continue;
-		for (list = commit->parents; list; list = list->next) {
-			struct commit *parent = list->item;
-			if (!(parent->object.flags & REACHABLE))
-				prio_queue_put(&work, parent);
-		}
-	}
-	want->object.flags |= REACHABLE;
-	clear_commit_marks(want, REACHABLE);
-	clear_prio_queue(&work);
-	return (want->object.flags & COMMON_KNOWN);
-}
-
+/*
+ * Can we stop negotiating, i.e. can every "want" reach one of the commits
+ * the other side said it has?
+ */
 static int ok_to_give_up(void)
 {
-	int i;
-
 	if (!have_obj.nr)
 		return 0;
 
-	for (i = 0; i < want_obj.nr; i++) {
-		struct object *want = want_obj.objects[i].item;
-
-		if (want->flags & COMMON_KNOWN)
-			continue;
-		want = deref_tag(want, "a want line", 0);
-		if (!want || want->type != OBJ_COMMIT) {
-			/* no way to tell if this is reachable by
-			 * looking at the ancestry chain alone, so
-			 * leave a note to ourselves not to worry about
-			 * this object anymore.
-			 */
-			want_obj.objects[i].item->flags |= COMMON_KNOWN;
-			continue;
-		}
-		if (!reachable((struct commit *)want))
-			return 0;
-	}
-	return 1;
+	return can_all_from_reach_with_flag(&want_obj, THEY_HAVE, COMMON_KNOWN,
+					    oldest_have, oldest_have_generation);
 }
 
 static int get_common_commits(void)
@@ -403,6 +749,8 @@ static int get_common_commits(void)
 	int got_common = 0;
 	int got_other = 0;
 	int sent_ready = 0;
+	/* what we say about the haves of a round goes out at its end */
+	struct packet_batch out = PACKET_BATCH_INIT(1);
 
 	save_commit_buffer = 0;
 
@@ -416,15 +764,18 @@ static int get_common_commits(void)
 			if (multi_ack == 2 && got_common
 			    && !got_other && ok_to_give_up()) {
 				sent_ready = 1;
-				packet_write_fmt(1, "ACK %s ready\n", last_hex);
+				packet_batch_write_fmt(&out, "ACK %s ready\n", last_hex);
 			}
 			if (have_obj.nr == 0 || multi_ack)
-				packet_write_fmt(1, "NAK\n");
+				packet_batch_write_fmt(&out, "NAK\n");
 
 			if (no_done && sent_ready) {
-				packet_write_fmt(1, "ACK %s\n", last_hex);
+				packet_batch_write_fmt(&out, "ACK %s\n", last_hex);
+				packet_batch_send(&out);
+				packet_batch_release(&out);
 				return 0;
 			}
+			packet_batch_send(&out);
 			if (stateless_rpc)
 				exit(0);
 			got_common = 0;
@@ -439,32 +790,36 @@ static int get_common_commits(void)
 					const char *hex = oid_to_hex(&oid);
 					if (multi_ack == 2) {
 						sent_ready = 1;
-						packet_write_fmt(1, "ACK %s ready\n", hex);
+						packet_batch_write_fmt(&out, "ACK %s ready\n", hex);
 					} else
-						packet_write_fmt(1, "ACK %s continue\n", hex);
+						packet_batch_write_fmt(&out, "ACK %s continue\n", hex);
 				}
 				break;
 			default:
 				got_common = 1;
 				oid_to_hex_r(last_hex, &oid);
 				if (multi_ack == 2)
-					packet_write_fmt(1, "ACK %s common\n", last_hex);
+					packet_batch_write_fmt(&out, "ACK %s common\n", last_hex);
 				else if (multi_ack)
-					packet_write_fmt(1, "ACK %s continue\n", last_hex);
+					packet_batch_write_fmt(&out, "ACK %s continue\n", last_hex);
 				else if (have_obj.nr == 1)
-					packet_write_fmt(1, "ACK %s\n", last_hex);
+					packet_batch_write_fmt(&out, "ACK %s\n", last_hex);
 				break;
 			}
 			continue;
 		}
 		if (!strcmp(line, "done")) {
+			int ret = -1;
+
 			if (have_obj.nr > 0) {
 				if (multi_ack)
-					packet_write_fmt(1, "ACK %s\n", last_hex);
-				return 0;
-			}
-			packet_write_fmt(1, "NAK\n");
-			return -1;
+					packet_batch_write_fmt(&out, "ACK %s\n", last_hex);
+				ret = 0;
+			} else
+				packet_batch_write_fmt(&out, "NAK\n");
+			packet_batch_send(&out);
+			packet_batch_release(&out);
+			return ret;
 		}
 		die("git upload-pack: expected SHA1 list, got '%s'", line);
 	}
@@ -999,6 +1354,9 @@ static void format_symref_info(struct strbuf *buf, struct string_list *symref)
 		strbuf_addf(buf, " symref=%s:%s", item->string, (char *)item->util);
 }
 
+/* The ref advertisement, sent in large writes */
+static struct packet_batch advertisement = PACKET_BATCH_INIT(1);
+
 static int send_ref(const char *refname, const struct object_id *oid,
 		    int flag, void *cb_data)
 {
@@ -1015,7 +1373,8 @@ static int send_ref(const char *refname, const struct object_id *oid,
 		struct strbuf symref_info = STRBUF_INIT;
 
 		format_symref_info(&symref_info, cb_data);
-		packet_write_fmt(1, "%s %s%c%s%s%s%s%s%s agent=%s\n",
+		packet_batch_write_fmt(&advertisement,
+			     "%s %s%c%s%s%s%s%s%s agent=%s\n",
 			     oid_to_hex(oid), refname_nons,
 			     0, capabilities,
 			     (allow_unadvertised_object_request & ALLOW_TIP_SHA1) ?
@@ -1028,11 +1387,13 @@ static int send_ref(const char *refname, const struct object_id *oid,
 			     git_user_agent_sanitized());
 		strbuf_release(&symref_info);
 	} else {
-		packet_write_fmt(1, "%s %s\n", oid_to_hex(oid), refname_nons);
+		packet_batch_write_fmt(&advertisement, "%s %s\n",
+				       oid_to_hex(oid), refname_nons);
 	}
 	capabilities = NULL;
 	if (!peel_ref(refname, &peeled))
-		packet_write_fmt(1, "%s %s^{}\n", oid_to_hex(&peeled), refname_nons);
+		packet_batch_write_fmt(&advertisement, "%s %s^{}\n",
+				       oid_to_hex(&peeled), refname_nons);
 	return 0;
 }
 
@@ -1073,6 +1434,14 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 		keepalive = git_config_int(var, value);
 		if (!keepalive)
 			keepalive = -1;
+	} else if (!strcmp("uploadpack.packfileuri", var)) {
+		allow_packfile_uris = 1;
+	} else if (!strcmp("uploadpack.packcachemaxsize", var)) {
+		pack_cache_max_size = git_config_ulong(var, value);
+	} else if (!strcmp("uploadpack.packcachettl", var)) {
+		pack_cache_ttl = git_config_ulong(var, value);
+	} else if (!strcmp("core.commitgraph", var)) {
+		core_commit_graph = git_config_bool(var, value);
 	} else if (current_config_scope() != CONFIG_SCOPE_REPO) {
 		if (!strcmp("uploadpack.packobjectshook", var))
 			return git_config_string(&pack_objects_hook, var, value);
@@ -1100,6 +1469,8 @@ void upload_pack(struct upload_pack_options *options)
 		reset_timeout();
 		head_ref_namespaced(send_ref, &symref);
 		for_each_namespaced_ref(send_ref, &symref);
+		packet_batch_send(&advertisement);
+		packet_batch_release(&advertisement);
 		advertise_shallow_grafts(1);
 		packet_flush(1);
 	} else {
@@ -1113,7 +1484,35 @@ void upload_pack(struct upload_pack_options *options)
 	receive_needs();
 	if (want_obj.nr) {
 		get_common_commits();
-		create_pack_file();
+		create_pack_file(0);
+	}
+}
+
+void upload_pack_any_version(struct upload_pack_options *options)
+{
+	switch (determine_protocol_version_server()) {
+	case protocol_v2: {
+		struct serve_options serve_opts = SERVE_OPTIONS_INIT;
+
+		serve_opts.advertise_capabilities = options->advertise_refs;
+		serve_opts.stateless_rpc = options->stateless_rpc;
+		serve(&serve_opts);
+		break;
+	}
+	case protocol_v1:
+		/*
+		 * v1 is just the original protocol with a version string,
+		 * so just fall through after writing the version string.
+		 */
+		if (options->advertise_refs || !options->stateless_rpc)
+			packet_write_fmt(1, "version 1\n");
+
+		/* fallthrough */
+	case protocol_v0:
+		upload_pack(options);
+		break;
+	case protocol_unknown_version:
+		BUG("unknown protocol version");
 	}
 }
 
@@ -1296,6 +1695,12 @@ static void process_args(struct packet_reader *request,
 			continue;
 		}
 
+		if (allow_packfile_uris &&
+		    skip_prefix(arg, "packfile-uris ", &p)) {
+			string_list_split(&uri_protocols, p, ',', -1);
+			continue;
+		}
+
 		/* ignore unknown lines maybe? */
 		die("unexpected line: '%s'", arg);
 	}
@@ -1479,8 +1884,7 @@ int upload_pack_v2(struct repository *r, struct argv_array *keys,
 			send_wanted_ref_info(&data);
 			send_shallow_info(&data);
 
-			packet_write_fmt(1, "packfile\n");
-			create_pack_file();
+			create_pack_file(1);
 			state = FETCH_DONE;
 			break;
 		case FETCH_DONE:
@@ -1512,6 +1916,10 @@ int upload_pack_advertise(struct repository *r,
 					 &allow_ref_in_want) &&
 		    allow_ref_in_want)
 			strbuf_addstr(value, " ref-in-want");
+
+		if (repo_config_get_value_multi(the_repository,
+						"uploadpack.packfileuri"))
+			strbuf_addstr(value, " packfile-uris");
 	}
 
 	return 1;
@@ -10,6 +10,12 @@ struct upload_pack_options {
 
 void upload_pack(struct upload_pack_options *options);
 
+/*
+ * Serve the client in the protocol version it asked for, with
+ * upload_pack() or, for version 2, serve().
+ */
+void upload_pack_any_version(struct upload_pack_options *options);
+
 struct repository;
 struct argv_array;
 struct packet_reader;
@@ -5,6 +5,7 @@
  */
 #include "git-compat-util.h"
 #include "cache.h"
+#include "trace2.h"
 
 void vreportf(const char *prefix, const char *err, va_list params)
 {
@@ -27,12 +28,14 @@ static NORETURN void usage_builtin(const char *err, va_list params)
 
 static NORETURN void die_builtin(const char *err, va_list params)
 {
+	trace2_cmd_error_va(err, params);
 	vreportf("fatal: ", err, params);
 	exit(128);
 }
 
 static void error_builtin(const char *err, va_list params)
 {
+	trace2_cmd_error_va(err, params);
 	vreportf("error: ", err, params);
 }
 
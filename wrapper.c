@@ -10,9 +10,21 @@ static void do_nothing(size_t size)
 
 static void (*try_to_free_routine)(size_t size) = do_nothing;
 
+static struct alloc_counter *alloc_counter;
+
+void set_alloc_counter(struct alloc_counter *counter)
+{
+	alloc_counter = counter;
+}
+
+/* Every allocation goes through here, so count them here too */
 static int memory_limit_check(size_t size, int gentle)
 {
 	static size_t limit = 0;
+	if (alloc_counter) {
+		alloc_counter->nr++;
+		alloc_counter->bytes += size;
+	}
 	if (!limit) {
 		limit = git_env_ulong("GIT_ALLOC_LIMIT", 0);
 		if (!limit)
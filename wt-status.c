@@ -17,6 +17,7 @@
 #include "utf8.h"
 #include "worktree.h"
 #include "lockfile.h"
+#include "sparse-index.h"
 
 static const char cut_line[] =
 "------------------------ >8 ------------------------\n";
@@ -427,6 +428,53 @@ static char short_submodule_status(struct wt_status_change_data *d)
 	return d->worktree_status;
 }
 
+static void wt_status_collect_changed_pair(struct wt_status *s,
+					   struct wt_status_change_data *d,
+					   struct diff_filepair *p)
+{
+	if (!d->worktree_status)
+		d->worktree_status = p->status;
+	if (S_ISGITLINK(p->two->mode)) {
+		d->dirty_submodule = p->two->dirty_submodule;
+		d->new_submodule_commits = !!oidcmp(&p->one->oid,
+						    &p->two->oid);
+		if (s->status_format == STATUS_FORMAT_SHORT)
+			d->worktree_status = short_submodule_status(d);
+	}
+
+	switch (p->status) {
+	case DIFF_STATUS_ADDED:
+		d->mode_worktree = p->two->mode;
+		break;
+
+	case DIFF_STATUS_DELETED:
+		d->mode_index = p->one->mode;
+		oidcpy(&d->oid_index, &p->one->oid);
+		/* mode_worktree is zero for a delete. */
+		break;
+
+	case DIFF_STATUS_COPIED:
+	case DIFF_STATUS_RENAMED:
+		if (d->rename_status)
+			BUG("multiple renames on the same target? how?");
+		d->rename_source = xstrdup(p->one->path);
+		d->rename_score = p->score * 100 / MAX_SCORE;
+		d->rename_status = p->status;
+		/* fallthru */
+	case DIFF_STATUS_MODIFIED:
+	case DIFF_STATUS_TYPE_CHANGED:
+	case DIFF_STATUS_UNMERGED:
+		d->mode_index = p->one->mode;
+		d->mode_worktree = p->two->mode;
+		oidcpy(&d->oid_index, &p->one->oid);
+		break;
+
+	default:
+		BUG("unhandled diff-files status '%c'", p->status);
+		break;
+	}
+}
+
 static void wt_status_collect_changed_cb(struct diff_queue_struct *q,
 					 struct diff_options *options,
 					 void *data)
@@ -449,48 +497,7 @@ static void wt_status_collect_changed_cb(struct diff_queue_struct *q,
 			d = xcalloc(1, sizeof(*d));
 			it->util = d;
 		}
-		if (!d->worktree_status)
-			d->worktree_status = p->status;
-		if (S_ISGITLINK(p->two->mode)) {
-			d->dirty_submodule = p->two->dirty_submodule;
-			d->new_submodule_commits = !!oidcmp(&p->one->oid,
-							    &p->two->oid);
-			if (s->status_format == STATUS_FORMAT_SHORT)
-				d->worktree_status = short_submodule_status(d);
-		}
-
-		switch (p->status) {
-		case DIFF_STATUS_ADDED:
-			d->mode_worktree = p->two->mode;
-			break;
-
-		case DIFF_STATUS_DELETED:
-			d->mode_index = p->one->mode;
-			oidcpy(&d->oid_index, &p->one->oid);
-			/* mode_worktree is zero for a delete. */
-			break;
-
-		case DIFF_STATUS_COPIED:
-		case DIFF_STATUS_RENAMED:
-			if (d->rename_status)
-				BUG("multiple renames on the same target? how?");
-			d->rename_source = xstrdup(p->one->path);
-			d->rename_score = p->score * 100 / MAX_SCORE;
-			d->rename_status = p->status;
-			/* fallthru */
-		case DIFF_STATUS_MODIFIED:
-		case DIFF_STATUS_TYPE_CHANGED:
-		case DIFF_STATUS_UNMERGED:
-			d->mode_index = p->one->mode;
-			d->mode_worktree = p->two->mode;
-			oidcpy(&d->oid_index, &p->one->oid);
-			break;
-
-		default:
-			BUG("unhandled diff-files status '%c'", p->status);
-			break;
-		}
-
+		wt_status_collect_changed_pair(s, d, p);
 	}
 }
 
@@ -578,27 +585,32 @@ static void wt_status_collect_updated_cb(struct diff_queue_struct *q,
 	}
 }
 
+static void init_changes_worktree(struct wt_status *s, struct rev_info *rev)
+{
+	init_revisions(rev, NULL);
+	setup_revisions(0, NULL, rev, NULL);
+	rev->diffopt.flags.dirty_submodules = 1;
+	rev->diffopt.ita_invisible_in_index = 1;
+	if (!s->show_untracked_files)
+		rev->diffopt.flags.ignore_untracked_in_submodules = 1;
+	if (s->ignore_submodule_arg) {
+		rev->diffopt.flags.override_submodule_config = 1;
+		handle_ignore_submodules_arg(&rev->diffopt, s->ignore_submodule_arg);
+	}
+	rev->diffopt.detect_rename = s->detect_rename >= 0 ? s->detect_rename : rev->diffopt.detect_rename;
+	rev->diffopt.rename_limit = s->rename_limit >= 0 ? s->rename_limit : rev->diffopt.rename_limit;
+	rev->diffopt.rename_score = s->rename_score >= 0 ? s->rename_score : rev->diffopt.rename_score;
+	copy_pathspec(&rev->prune_data, &s->pathspec);
+}
+
 static void wt_status_collect_changes_worktree(struct wt_status *s)
 {
 	struct rev_info rev;
 
-	init_revisions(&rev, NULL);
-	setup_revisions(0, NULL, &rev, NULL);
+	init_changes_worktree(s, &rev);
 	rev.diffopt.output_format |= DIFF_FORMAT_CALLBACK;
-	rev.diffopt.flags.dirty_submodules = 1;
-	rev.diffopt.ita_invisible_in_index = 1;
-	if (!s->show_untracked_files)
-		rev.diffopt.flags.ignore_untracked_in_submodules = 1;
-	if (s->ignore_submodule_arg) {
-		rev.diffopt.flags.override_submodule_config = 1;
-		handle_ignore_submodules_arg(&rev.diffopt, s->ignore_submodule_arg);
-	}
 	rev.diffopt.format_callback = wt_status_collect_changed_cb;
 	rev.diffopt.format_callback_data = s;
-	rev.diffopt.detect_rename = s->detect_rename >= 0 ? s->detect_rename : rev.diffopt.detect_rename;
-	rev.diffopt.rename_limit = s->rename_limit >= 0 ? s->rename_limit : rev.diffopt.rename_limit;
-	rev.diffopt.rename_score = s->rename_score >= 0 ? s->rename_score : rev.diffopt.rename_score;
-	copy_pathspec(&rev.prune_data, &s->pathspec);
 	run_diff_files(&rev, 0);
 }
 
@@ -642,6 +654,8 @@ static void wt_status_collect_changes_initial(struct wt_status *s)
 {
 	int i;
 
+	ensure_full_index(&the_index);
+
 	for (i = 0; i < active_nr; i++) {
 		struct string_list_item *it;
 		struct wt_status_change_data *d;
@@ -2240,6 +2254,17 @@ static void wt_porcelain_v2_print_other(
 	strbuf_release(&buf);
 }
 
+static void wt_porcelain_v2_print_others(struct wt_status *s)
+{
+	int i;
+
+	for (i = 0; i < s->untracked.nr; i++)
+		wt_porcelain_v2_print_other(&s->untracked.items[i], s, '?');
+
+	for (i = 0; i < s->ignored.nr; i++)
+		wt_porcelain_v2_print_other(&s->ignored.items[i], s, '!');
+}
+
 /*
  * Print porcelain V2 status.
  *
@@ -2273,15 +2298,141 @@ static void wt_porcelain_v2_print(struct wt_status *s)
 			wt_porcelain_v2_print_unmerged_entry(it, s);
 	}
 
-	for (i = 0; i < s->untracked.nr; i++) {
-		it = &(s->untracked.items[i]);
-		wt_porcelain_v2_print_other(it, s, '?');
+	wt_porcelain_v2_print_others(s);
+}
+
+struct wt_status_stream {
+	struct wt_status *s;
+	/* the next entry of s->change to print */
+	int next;
+};
+
+static void wt_status_stream_pair(struct wt_status_stream *st,
+				  struct diff_filepair *p)
+{
+	struct wt_status *s = st->s;
+	const char *path = p->two->path;
+	struct wt_status_change_data data;
+	struct string_list_item item;
+
+	s->workdir_dirty = 1;
+
+	/* the entries changed in the index only come first */
+	while (st->next < s->change.nr &&
+	       strcmp(s->change.items[st->next].string, path) < 0)
+		wt_porcelain_v2_print_changed_entry(&s->change.items[st->next++], s);
+
+	if (st->next < s->change.nr &&
+	    !strcmp(s->change.items[st->next].string, path)) {
+		struct string_list_item *it = &s->change.items[st->next++];
+
+		wt_status_collect_changed_pair(s, it->util, p);
+		wt_porcelain_v2_print_changed_entry(it, s);
+		return;
 	}
 
-	for (i = 0; i < s->ignored.nr; i++) {
-		it = &(s->ignored.items[i]);
-		wt_porcelain_v2_print_other(it, s, '!');
+	memset(&data, 0, sizeof(data));
+	item.string = (char *)path;
+	item.util = &data;
+	wt_status_collect_changed_pair(s, &data, p);
+	wt_porcelain_v2_print_changed_entry(&item, s);
+	free(data.rename_source);
+}
+
+/*
+ * Take the filepair that diff_change() or diff_addremove() just
+ * queued, and print it right away.
+ */
+static void wt_status_stream_queued(struct diff_options *options)
+{
+	struct wt_status_stream *st = options->format_callback_data;
+	struct diff_queue_struct *q = &diff_queued_diff;
+	int i;
+
+	if (!q->nr)
+		return;
+	diffcore_std(options);
+	for (i = 0; i < q->nr; i++) {
+		wt_status_stream_pair(st, q->queue[i]);
+		diff_free_filepair(q->queue[i]);
 	}
+	free(q->queue);
+	DIFF_QUEUE_CLEAR(q);
+}
+
+static void wt_status_stream_change(struct diff_options *options,
+				    unsigned old_mode, unsigned new_mode,
+				    const struct object_id *old_oid,
+				    const struct object_id *new_oid,
+				    int old_oid_valid, int new_oid_valid,
+				    const char *fullpath,
+				    unsigned old_dirty_submodule,
+				    unsigned new_dirty_submodule)
+{
+	diff_change(options, old_mode, new_mode, old_oid, new_oid,
+		    old_oid_valid, new_oid_valid, fullpath,
+		    old_dirty_submodule, new_dirty_submodule);
+	wt_status_stream_queued(options);
+}
+
+static void wt_status_stream_addremove(struct diff_options *options,
+				       int addremove, unsigned mode,
+				       const struct object_id *oid,
+				       int oid_valid,
+				       const char *fullpath,
+				       unsigned dirty_submodule)
+{
+	diff_addremove(options, addremove, mode, oid, oid_valid,
+		       fullpath, dirty_submodule);
+	wt_status_stream_queued(options);
+}
+
+int wt_status_can_stream(struct wt_status *s)
+{
+	int i;
+
+	if (s->status_format != STATUS_FORMAT_PORCELAIN_V2)
+		return 0;
+	/*
+	 * Unmerged entries are printed after all the others, and
+	 * intent-to-add entries are additions that the worktree changes
+	 * may pair up with deletions as renames.
+	 */
+	for (i = 0; i < active_nr; i++) {
+		const struct cache_entry *ce = active_cache[i];
+
+		if (ce_stage(ce) || ce_intent_to_add(ce))
+			return 0;
+	}
+	return 1;
+}
+
+void wt_status_stream(struct wt_status *s)
+{
+	struct wt_status_stream st = { s, 0 };
+	struct rev_info rev;
+
+	if (s->show_branch)
+		wt_porcelain_v2_print_tracking(s);
+
+	if (s->is_initial)
+		wt_status_collect_changes_initial(s);
+	else
+		wt_status_collect_changes_index(s);
+
+	init_changes_worktree(s, &rev);
+	/* without intent-to-add entries there is nothing to pair up */
+	rev.diffopt.detect_rename = 0;
+	rev.diffopt.change = wt_status_stream_change;
+	rev.diffopt.add_remove = wt_status_stream_addremove;
+	rev.diffopt.format_callback_data = &st;
+	run_diff_files(&rev, 0);
+	while (st.next < s->change.nr)
+		wt_porcelain_v2_print_changed_entry(&s->change.items[st.next++], s);
+	fflush(s->fp);
+
+	wt_status_collect_untracked(s);
+	wt_porcelain_v2_print_others(s);
 }
 
 void wt_status_print(struct wt_status *s)
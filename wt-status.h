@@ -129,6 +129,20 @@ size_t wt_status_locate_end(const char *s, size_t len);
 void wt_status_add_cut_line(FILE *fp);
 void wt_status_prepare(struct wt_status *s);
 void wt_status_print(struct wt_status *s);
+
+/*
+ * Whether wt_status_stream() can print the status of "s": in porcelain
+ * v2 format, with no unmerged or intent-to-add entries in the index.
+ */
+int wt_status_can_stream(struct wt_status *s);
+
+/*
+ * Collect and print the status together, printing the worktree changes
+ * as run_diff_files() finds them rather than once they are all sorted,
+ * for wt_status_collect() followed by wt_status_print() with the same
+ * output.
+ */
+void wt_status_stream(struct wt_status *s);
 void wt_status_collect(struct wt_status *s);
 void wt_status_get_state(struct wt_status_state *state, int get_detached_from);
 int wt_status_check_rebase(const struct worktree *wt,
@@ -140,6 +140,21 @@ int xdi_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t co
 	return xdl_diff(&a, &b, xpp, xecfg, xecb);
 }
 
+xdprepared_t *xdi_prepare_file(mmfile_t *mf, xpparam_t const *xpp)
+{
+	if (mf->size > MAX_XDIFF_SIZE)
+		return NULL;
+	return xdl_prepare_file(mf, xpp);
+}
+
+int xdi_diff_prepared(xdprepared_t *prep, mmfile_t *mf2, xpparam_t const *xpp,
+		      xdemitconf_t const *xecfg, xdemitcb_t *xecb)
+{
+	if (!prep || mf2->size > MAX_XDIFF_SIZE)
+		return -1;
+	return xdl_diff_prepared(prep, mf2, xpp, xecfg, xecb);
+}
+
 int xdi_diff_outf(mmfile_t *mf1, mmfile_t *mf2,
 		  xdiff_emit_consume_fn fn, void *consume_callback_data,
 		  xpparam_t const *xpp, xdemitconf_t const *xecfg)
@@ -14,6 +14,16 @@
 typedef void (*xdiff_emit_consume_fn)(void *, char *, unsigned long);
 
 int xdi_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp, xdemitconf_t const *xecfg, xdemitcb_t *ecb);
+/*
+ * Diff one file against many: xdi_prepare_file() returns the file split
+ * into lines, or NULL if it is too large, to be given as the first file
+ * to xdi_diff_prepared() with the same xpp, and freed with
+ * xdl_free_prepared(). Unlike xdi_diff(), the common tail of the files
+ * is not trimmed before the diff.
+ */
+xdprepared_t *xdi_prepare_file(mmfile_t *mf, xpparam_t const *xpp);
+int xdi_diff_prepared(xdprepared_t *prep, mmfile_t *mf2, xpparam_t const *xpp,
+		      xdemitconf_t const *xecfg, xdemitcb_t *xecb);
 int xdi_diff_outf(mmfile_t *mf1, mmfile_t *mf2,
 		  xdiff_emit_consume_fn fn, void *consume_callback_data,
 		  xpparam_t const *xpp, xdemitconf_t const *xecfg);
@@ -127,6 +127,19 @@ long xdl_mmfile_size(mmfile_t *mmf);
 int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	     xdemitconf_t const *xecfg, xdemitcb_t *ecb);
 
+/*
+ * A file split into records and classified once, to be diffed against
+ * many others with xdl_diff_prepared(), as if it were the mf1 given to
+ * xdl_diff(). The contents of mf must outlive it, and it must be used
+ * with the same flags it was prepared with.
+ */
+typedef struct s_xdprepared xdprepared_t;
+
+xdprepared_t *xdl_prepare_file(mmfile_t *mf, xpparam_t const *xpp);
+int xdl_diff_prepared(xdprepared_t *prep, mmfile_t *mf2, xpparam_t const *xpp,
+		      xdemitconf_t const *xecfg, xdemitcb_t *ecb);
+void xdl_free_prepared(xdprepared_t *prep);
+
 typedef struct s_xmparam {
 	xpparam_t xpp;
 	int marker_size;
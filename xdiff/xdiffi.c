@@ -321,24 +321,16 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1,
 }
 
 
-int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-		xdfenv_t *xe) {
+/*
+ * Run the diff algorithm on the records of an environment prepared by
+ * xdl_prepare_env(); the caller frees the environment on failure.
+ */
+static int xdl_do_env_diff(xpparam_t const *xpp, xdfenv_t *xe) {
 	long ndiags;
 	long *kvd, *kvdf, *kvdb;
 	xdalgoenv_t xenv;
 	diffdata_t dd1, dd2;
 
-	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF)
-		return xdl_do_patience_diff(mf1, mf2, xpp, xe);
-
-	if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
-		return xdl_do_histogram_diff(mf1, mf2, xpp, xe);
-
-	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
-
-		return -1;
-	}
-
 	/*
 	 * Allocate and setup K vectors to be used by the differential algorithm.
 	 * One is to store the forward path and one to store the backward path.
@@ -346,7 +338,6 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	ndiags = xe->xdf1.nreff + xe->xdf2.nreff + 3;
 	if (!(kvd = (long *) xdl_malloc((2 * ndiags + 2) * sizeof(long)))) {
 
-		xdl_free_env(xe);
 		return -1;
 	}
 	kvdf = kvd;
@@ -373,7 +364,6 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 			 kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0, &xenv) < 0) {
 
 		xdl_free(kvd);
-		xdl_free_env(xe);
 		return -1;
 	}
 
@@ -383,6 +373,29 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 }
 
 
+int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		xdfenv_t *xe) {
+
+	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF)
+		return xdl_do_patience_diff(mf1, mf2, xpp, xe);
+
+	if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
+		return xdl_do_histogram_diff(mf1, mf2, xpp, xe);
+
+	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
+
+		return -1;
+	}
+	if (xdl_do_env_diff(xpp, xe) < 0) {
+
+		xdl_free_env(xe);
+		return -1;
+	}
+
+	return 0;
+}
+
+
 static xdchange_t *xdl_add_change(xdchange_t *xscr, long i1, long i2, long chg1, long chg2) {
 	xdchange_t *xch;
 
@@ -1015,36 +1028,68 @@ static void xdl_mark_ignorable(xdchange_t *xscr, xdfenv_t *xe, long flags)
 	}
 }
 
-int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-	     xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
+/*
+ * Compact the changes found in xe, and emit them; xe is left for the
+ * caller to free.
+ */
+static int xdl_emit_env(xdfenv_t *xe, xpparam_t const *xpp,
+			xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
 	xdchange_t *xscr;
-	xdfenv_t xe;
 	emit_func_t ef = xecfg->hunk_func ? xdl_call_hunk_func : xdl_emit_diff;
 
-	if (xdl_do_diff(mf1, mf2, xpp, &xe) < 0) {
+	if (xdl_change_compact(&xe->xdf1, &xe->xdf2, xpp->flags) < 0 ||
+	    xdl_change_compact(&xe->xdf2, &xe->xdf1, xpp->flags) < 0 ||
+	    xdl_build_script(xe, &xscr) < 0) {
 
 		return -1;
 	}
-	if (xdl_change_compact(&xe.xdf1, &xe.xdf2, xpp->flags) < 0 ||
-	    xdl_change_compact(&xe.xdf2, &xe.xdf1, xpp->flags) < 0 ||
-	    xdl_build_script(&xe, &xscr) < 0) {
-
-		xdl_free_env(&xe);
-		return -1;
-	}
 	if (xscr) {
 		if (xpp->flags & XDF_IGNORE_BLANK_LINES)
-			xdl_mark_ignorable(xscr, &xe, xpp->flags);
+			xdl_mark_ignorable(xscr, xe, xpp->flags);
 
-		if (ef(&xe, xscr, ecb, xecfg) < 0) {
+		if (ef(xe, xscr, ecb, xecfg) < 0) {
 
 			xdl_free_script(xscr);
-			xdl_free_env(&xe);
 			return -1;
 		}
 		xdl_free_script(xscr);
 	}
-	xdl_free_env(&xe);
 
 	return 0;
 }
+
+int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+	     xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
+	xdfenv_t xe;
+	int ret;
+
+	if (xdl_do_diff(mf1, mf2, xpp, &xe) < 0) {
+
+		return -1;
+	}
+	ret = xdl_emit_env(&xe, xpp, xecfg, ecb);
+	xdl_free_env(&xe);
+
+	return ret;
+}
+
+int xdl_diff_prepared(xdprepared_t *prep, mmfile_t *mf2, xpparam_t const *xpp,
+		      xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
+	xdfenv_t xe;
+	mmfile_t *mf1;
+	int ret;
+
+	if ((mf1 = xdl_prepared_fallback(prep, xpp)) != NULL)
+		return xdl_diff(mf1, mf2, xpp, xecfg, ecb);
+
+	if (xdl_prepare_env_prepared(prep, mf2, xpp, &xe) < 0) {
+
+		return -1;
+	}
+	ret = xdl_do_env_diff(xpp, &xe);
+	if (!ret)
+		ret = xdl_emit_env(&xe, xpp, xecfg, ecb);
+	xdl_free_env_prepared(prep, &xe);
+
+	return ret;
+}
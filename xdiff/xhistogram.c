@@ -248,24 +248,40 @@ static int find_lcs(struct histindex *index, struct region *lcs,
 	return index->has_common && index->max_chain_length < index->cnt;
 }
 
-static int fall_back_to_classic_diff(struct histindex *index,
+static int fall_back_to_classic_diff(xpparam_t const *xpp, xdfenv_t *env,
 		int line1, int count1, int line2, int count2)
 {
-	xpparam_t xpp;
-	xpp.flags = index->xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
+	xpparam_t xpp_classic;
+	xpp_classic.flags = xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
 
-	return xdl_fall_back_diff(index->env, &xpp,
+	return xdl_fall_back_diff(env, &xpp_classic,
 				  line1, count1, line2, count2);
 }
 
+static void free_index(struct histindex *index)
+{
+	xdl_free(index->records);
+	xdl_free(index->line_map);
+	xdl_free(index->next_ptrs);
+	xdl_cha_free(&index->rcha);
+}
+
+/*
+ * The index is only needed to find the LCS of the region, and is freed
+ * before diffing the parts around it. Of these, we recurse into the
+ * smaller one and loop on the larger one, so that neither the memory
+ * held by the enclosing calls nor the depth of the recursion grow with
+ * the number of lines even when each LCS only splits off a few of them.
+ */
 static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 	int line1, int count1, int line2, int count2)
 {
 	struct histindex index;
 	struct region lcs;
-	int sz;
+	int sz, found;
 	int result = -1;
 
+redo:
 	if (count1 <= 0 && count2 <= 0)
 		return 0;
 
@@ -319,34 +335,45 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 	index.max_chain_length = 64;
 
 	memset(&lcs, 0, sizeof(lcs));
-	if (find_lcs(&index, &lcs, line1, count1, line2, count2))
-		result = fall_back_to_classic_diff(&index, line1, count1, line2, count2);
-	else {
-		if (lcs.begin1 == 0 && lcs.begin2 == 0) {
-			while (count1--)
-				env->xdf1.rchg[line1++ - 1] = 1;
-			while (count2--)
-				env->xdf2.rchg[line2++ - 1] = 1;
-			result = 0;
-		} else {
-			result = histogram_diff(xpp, env,
-						line1, lcs.begin1 - line1,
-						line2, lcs.begin2 - line2);
-			if (result)
-				goto cleanup;
-			result = histogram_diff(xpp, env,
-						lcs.end1 + 1, LINE_END(1) - lcs.end1,
-						lcs.end2 + 1, LINE_END(2) - lcs.end2);
-			if (result)
-				goto cleanup;
-		}
+	found = !find_lcs(&index, &lcs, line1, count1, line2, count2);
+	free_index(&index);
+
+	if (!found)
+		return fall_back_to_classic_diff(xpp, env,
+						 line1, count1, line2, count2);
+
+	if (lcs.begin1 == 0 && lcs.begin2 == 0) {
+		while (count1--)
+			env->xdf1.rchg[line1++ - 1] = 1;
+		while (count2--)
+			env->xdf2.rchg[line2++ - 1] = 1;
+		return 0;
+	}
+
+	if (lcs.begin1 - line1 + lcs.begin2 - line2 <
+	    LINE_END(1) - lcs.end1 + LINE_END(2) - lcs.end2) {
+		result = histogram_diff(xpp, env,
+					line1, lcs.begin1 - line1,
+					line2, lcs.begin2 - line2);
+		if (result)
+			return result;
+		count1 = LINE_END(1) - lcs.end1;
+		count2 = LINE_END(2) - lcs.end2;
+		line1 = lcs.end1 + 1;
+		line2 = lcs.end2 + 1;
+	} else {
+		result = histogram_diff(xpp, env,
+					lcs.end1 + 1, LINE_END(1) - lcs.end1,
+					lcs.end2 + 1, LINE_END(2) - lcs.end2);
+		if (result)
+			return result;
+		count1 = lcs.begin1 - line1;
+		count2 = lcs.begin2 - line2;
 	}
+	goto redo;
 
 cleanup:
-	xdl_free(index.records);
-	xdl_free(index.line_map);
-	xdl_free(index.next_ptrs);
-	xdl_cha_free(&index.rcha);
+	free_index(&index);
 
 	return result;
 }
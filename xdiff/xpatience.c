@@ -263,17 +263,43 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 		xpparam_t const *xpp, xdfenv_t *env,
 		int line1, int count1, int line2, int count2);
 
-static int walk_common_sequence(struct hashmap *map, struct entry *first,
+/*
+ * The lines of the longest common sequence, copied out of the hash map so
+ * that it can be freed before recursing into the parts between them.
+ */
+struct common_line {
+	int line1, line2;
+};
+
+static struct common_line *copy_common_sequence(struct entry *first, int *nr)
+{
+	struct common_line *common;
+	struct entry *entry;
+	int i = 0;
+
+	for (entry = first; entry; entry = entry->next)
+		i++;
+	if (!(common = xdl_malloc(i * sizeof(*common))))
+		return NULL;
+	for (*nr = i, i = 0, entry = first; entry; entry = entry->next, i++) {
+		common[i].line1 = entry->line1;
+		common[i].line2 = entry->line2;
+	}
+	return common;
+}
+
+static int walk_common_sequence(struct hashmap *map,
+		struct common_line *common, int nr,
 		int line1, int count1, int line2, int count2)
 {
 	int end1 = line1 + count1, end2 = line2 + count2;
-	int next1, next2;
+	int next1, next2, i = 0;
 
 	for (;;) {
 		/* Try to grow the line ranges of common lines */
-		if (first) {
-			next1 = first->line1;
-			next2 = first->line2;
+		if (i < nr) {
+			next1 = common[i].line1;
+			next2 = common[i].line2;
 			while (next1 > line1 && next2 > line2 &&
 					match(map, next1 - 1, next2 - 1)) {
 				next1--;
@@ -291,9 +317,6 @@ static int walk_common_sequence(struct hashmap *map, struct entry *first,
 
 		/* Recurse */
 		if (next1 > line1 || next2 > line2) {
-			struct hashmap submap;
-
-			memset(&submap, 0, sizeof(submap));
 			if (patience_diff(map->file1, map->file2,
 					map->xpp, map->env,
 					line1, next1 - line1,
@@ -301,18 +324,18 @@ static int walk_common_sequence(struct hashmap *map, struct entry *first,
 				return -1;
 		}
 
-		if (!first)
+		if (i >= nr)
 			return 0;
 
-		while (first->next &&
-				first->next->line1 == first->line1 + 1 &&
-				first->next->line2 == first->line2 + 1)
-			first = first->next;
+		while (i + 1 < nr &&
+				common[i + 1].line1 == common[i].line1 + 1 &&
+				common[i + 1].line2 == common[i].line2 + 1)
+			i++;
 
-		line1 = first->line1 + 1;
-		line2 = first->line2 + 1;
+		line1 = common[i].line1 + 1;
+		line2 = common[i].line2 + 1;
 
-		first = first->next;
+		i++;
 	}
 }
 
@@ -366,15 +389,29 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 		return 0;
 	}
 
+	/*
+	 * The recursion only needs the common lines, not the hash map of
+	 * this range; freeing it first keeps the memory held by the
+	 * enclosing calls from growing with the depth of the recursion.
+	 */
 	first = find_longest_common_sequence(&map);
-	if (first)
-		result = walk_common_sequence(&map, first,
+	if (first) {
+		struct common_line *common;
+		int nr;
+
+		common = copy_common_sequence(first, &nr);
+		xdl_free(map.entries);
+		if (!common)
+			return -1;
+		result = walk_common_sequence(&map, common, nr,
 			line1, count1, line2, count2);
-	else
+		xdl_free(common);
+	} else {
+		xdl_free(map.entries);
 		result = fall_back_to_classic_diff(&map,
 			line1, count1, line2, count2);
+	}
 
-	xdl_free(map.entries);
 	return result;
 }
 
@@ -50,6 +50,21 @@ typedef struct s_xdlclassifier {
 	long flags;
 } xdlclassifier_t;
 
+struct s_xdprepared {
+	mmfile_t mf;
+	unsigned long flags;
+	int reuse;
+	xdlclassifier_t cf;
+	xdfile_t xdf;
+	/*
+	 * The classes of mf, and where the classes the last diff added
+	 * start in cf.ncha; they are forgotten after each diff.
+	 */
+	long nclass;
+	chanode_t *cha_tail;
+	long cha_icurr;
+};
+
 
 
 
@@ -319,6 +334,139 @@ void xdl_free_env(xdfenv_t *xe) {
 }
 
 
+xdprepared_t *xdl_prepare_file(mmfile_t *mf, xpparam_t const *xpp) {
+	xdprepared_t *prep;
+	long enl;
+
+	if (!(prep = (xdprepared_t *) xdl_malloc(sizeof(xdprepared_t))))
+		return NULL;
+	memset(prep, 0, sizeof(*prep));
+	prep->mf = *mf;
+	prep->flags = xpp->flags;
+
+	/*
+	 * Patience and histogram diff prepare the files themselves, for
+	 * each range they recurse into; for them we only keep mf.
+	 */
+	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF ||
+	    XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
+		return prep;
+
+	enl = xdl_guess_lines(mf, XDL_GUESS_NLINES1) + 1;
+	if (xdl_init_classifier(&prep->cf, 2 * enl + 1, xpp->flags) < 0)
+		return prep;
+	if (xdl_prepare_ctx(1, mf, enl, xpp, &prep->cf, &prep->xdf) < 0) {
+
+		xdl_free_classifier(&prep->cf);
+		return prep;
+	}
+
+	prep->nclass = prep->cf.count;
+	prep->cha_tail = prep->cf.ncha.tail;
+	prep->cha_icurr = prep->cha_tail ? prep->cha_tail->icurr : 0;
+	prep->reuse = 1;
+
+	return prep;
+}
+
+
+void xdl_free_prepared(xdprepared_t *prep) {
+
+	if (!prep)
+		return;
+	if (prep->reuse) {
+		xdl_free_ctx(&prep->xdf);
+		xdl_free_classifier(&prep->cf);
+	}
+	xdl_free(prep);
+}
+
+
+mmfile_t *xdl_prepared_fallback(xdprepared_t *prep, xpparam_t const *xpp) {
+
+	if (prep->reuse && prep->flags == xpp->flags && !xpp->anchors_nr)
+		return NULL;
+	return &prep->mf;
+}
+
+
+/*
+ * Forget the classes the last diff added to the classifier of prep, and
+ * the counts of the records of xdf2 in the classes of mf.
+ */
+static void xdl_forget_classes(xdprepared_t *prep, xdfile_t *xdf2) {
+	xdlclassifier_t *cf = &prep->cf;
+	chanode_t *cur, *tmp;
+	long i, hi;
+
+	for (i = 0; i < xdf2->nrec; i++)
+		cf->rcrecs[xdf2->recs[i]->ha]->len2 = 0;
+
+	/* the newest class of each hash bucket is at its head */
+	for (i = cf->count - 1; i >= prep->nclass; i--) {
+		hi = (long) XDL_HASHLONG(cf->rcrecs[i]->ha, cf->hbits);
+		cf->rchash[hi] = cf->rcrecs[i]->next;
+	}
+	cf->count = prep->nclass;
+
+	if (prep->cha_tail) {
+		cur = prep->cha_tail->next;
+		prep->cha_tail->next = NULL;
+		prep->cha_tail->icurr = prep->cha_icurr;
+	} else {
+		cur = cf->ncha.head;
+		cf->ncha.head = NULL;
+	}
+	for (; (tmp = cur) != NULL;) {
+		cur = cur->next;
+		xdl_free(tmp);
+	}
+	cf->ncha.tail = cf->ncha.ancur = prep->cha_tail;
+}
+
+
+int xdl_prepare_env_prepared(xdprepared_t *prep, mmfile_t *mf2,
+			     xpparam_t const *xpp, xdfenv_t *xe) {
+	long enl2;
+
+	/* the records of mf stay, the diff results are reset */
+	xe->xdf1 = prep->xdf;
+	memset(xe->xdf1.rchg - 1, 0, (xe->xdf1.nrec + 2) * sizeof(char));
+	xe->xdf1.nreff = 0;
+	xe->xdf1.dstart = 0;
+	xe->xdf1.dend = xe->xdf1.nrec - 1;
+
+	enl2 = xdl_guess_lines(mf2, XDL_GUESS_NLINES1) + 1;
+	if (xdl_prepare_ctx(2, mf2, enl2, xpp, &prep->cf, &xe->xdf2) < 0) {
+
+		/*
+		 * We cannot tell which classes the records that made it
+		 * in were counted in; this and any later diff will
+		 * prepare both files from scratch.
+		 */
+		xdl_free_ctx(&prep->xdf);
+		xdl_free_classifier(&prep->cf);
+		prep->reuse = 0;
+		return -1;
+	}
+
+	if (xdl_optimize_ctxs(&prep->cf, &xe->xdf1, &xe->xdf2) < 0) {
+
+		xdl_free_env_prepared(prep, xe);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void xdl_free_env_prepared(xdprepared_t *prep, xdfenv_t *xe) {
+
+	xdl_forget_classes(prep, &xe->xdf2);
+	xdl_free_ctx(&xe->xdf2);
+}
+
+
 static int xdl_clean_mmatch(char const *dis, long i, long s, long e) {
 	long r, rdis0, rpdis0, rdis1, rpdis1;
 
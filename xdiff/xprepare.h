@@ -28,6 +28,10 @@
 int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		    xdfenv_t *xe);
 void xdl_free_env(xdfenv_t *xe);
+mmfile_t *xdl_prepared_fallback(xdprepared_t *prep, xpparam_t const *xpp);
+int xdl_prepare_env_prepared(xdprepared_t *prep, mmfile_t *mf2,
+			     xpparam_t const *xpp, xdfenv_t *xe);
+void xdl_free_env_prepared(xdprepared_t *prep, xdfenv_t *xe);
 
 
 
@@ -271,3 +271,102 @@ int git_deflate(git_zstream *strm, int flush)
 	      strm->z.msg ? strm->z.msg : "no message");
 	return status;
 }
+
+#ifdef USE_LIBDEFLATE
+/*
+ * libdeflate works on whole buffers only, which is all the callers of
+ * the two functions below need.  Its (de)compressor objects are not
+ * thread-safe, so each call allocates its own; that is a single malloc,
+ * no more than what inflateInit() and deflateInit() cost zlib.
+ */
+#include <libdeflate.h>
+
+int git_inflate_buffer(void *out, unsigned long size,
+		       const void *in, unsigned long inlen,
+		       unsigned long *consumed)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result res;
+	size_t in_used, out_used;
+
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		die("libdeflate: out of memory");
+	res = libdeflate_zlib_decompress_ex(d, in, inlen, out, size,
+					   &in_used, &out_used);
+	libdeflate_free_decompressor(d);
+	if (res != LIBDEFLATE_SUCCESS || out_used != size)
+		return -1;
+	*consumed = in_used;
+	return 0;
+}
+
+void *git_deflate_buffer(const void *in, unsigned long size, int level,
+			 unsigned long *result_size)
+{
+	struct libdeflate_compressor *c;
+	size_t bound;
+	void *out;
+
+	/* libdeflate has no "default"; zlib's default level is 6 */
+	if (level == Z_DEFAULT_COMPRESSION)
+		level = 6;
+	c = libdeflate_alloc_compressor(level);
+	if (!c)
+		die("libdeflate: unable to set up compression level %d", level);
+	bound = libdeflate_zlib_compress_bound(c, size);
+	out = xmalloc(bound);
+	*result_size = libdeflate_zlib_compress(c, in, size, out, bound);
+	libdeflate_free_compressor(c);
+	if (!*result_size)
+		BUG("libdeflate output did not fit its own bound");
+	return out;
+}
+#else
+int git_inflate_buffer(void *out, unsigned long size,
+		       const void *in, unsigned long inlen,
+		       unsigned long *consumed)
+{
+	z_stream z;
+	int status;
+
+	/* leave what does not fit in a single call to git_inflate() */
+	if (size > ZLIB_BUF_MAX)
+		return -1;
+
+	memset(&z, 0, sizeof(z));
+	z.next_in = (unsigned char *)in;
+	z.avail_in = zlib_buf_cap(inlen);
+	z.next_out = out;
+	z.avail_out = size;
+	if (inflateInit(&z) != Z_OK)
+		return -1;
+	status = inflate(&z, Z_FINISH);
+	inflateEnd(&z);
+	if (status != Z_STREAM_END || z.total_out != size)
+		return -1;
+	*consumed = z.total_in;
+	return 0;
+}
+
+void *git_deflate_buffer(const void *in, unsigned long size, int level,
+			 unsigned long *result_size)
+{
+	git_zstream stream;
+	unsigned long bound;
+	void *out;
+
+	git_deflate_init(&stream, level);
+	bound = git_deflate_bound(&stream, size);
+	out = xmalloc(bound);
+	stream.next_out = out;
+	stream.avail_out = bound;
+	stream.next_in = (unsigned char *)in;
+	stream.avail_in = size;
+	while (git_deflate(&stream, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&stream);
+	*result_size = stream.total_out;
+	return out;
+}
+#endif